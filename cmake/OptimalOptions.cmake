@@ -45,6 +45,7 @@ IF(CMAKE_COMPILER_IS_GNUCXX)
 	ENDIF(CMAKE_BUILD_TYPE STREQUAL "debug")
 
 	SET(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -fPIC")
+	SET(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -fPIC")
 ENDIF(CMAKE_COMPILER_IS_GNUCXX)
 
 IF(MSVC)
@@ -27,12 +27,41 @@ bool ZOH::isone(const char *block)
 	return (code == 0x03 || code == 0x07 || code == 0x0b || code == 0x0f);
 }
 
-void ZOH::compress(const Tile &t, char *block)
+// weighted sum of the squared distances of the pixels to their mean, the error of compressing the block to its mean color
+static float block_variance(const Tile &t)
+{
+	float w = 0, s[3] = { 0, 0, 0 }, ss = 0;
+	for (int y=0; y<t.size_y; ++y)
+	for (int x=0; x<t.size_x; ++x)
+	{
+		float iw = t.importance_map[y][x];
+		w += iw;
+		for (int i=0; i<3; ++i)
+		{
+			float c = t.data[y][x].component[i];
+			s[i] += iw * c;
+			ss += iw * c * c;
+		}
+	}
+	if (w > 0)
+		for (int i=0; i<3; ++i) ss -= s[i] * s[i] / w;
+	return ss > 0 ? ss : 0;
+}
+
+void ZOH::compress(const Tile &t, char *block, Format format, float effort, float error_threshold)
 {
 	char oneblock[ZOH::BLOCKSIZE], twoblock[ZOH::BLOCKSIZE];
 
-	float mseone = ZOH::compressone(t, oneblock);
-	float msetwo = ZOH::compresstwo(t, twoblock);
+	float mseone = ZOH::compressone(t, oneblock, format);
+
+	// the one region modes are good enough, don't search the two region ones
+	if (mseone == 0 || (error_threshold > 0 && mseone <= error_threshold * block_variance(t)))
+	{
+		memcpy(block, oneblock, ZOH::BLOCKSIZE);
+		return;
+	}
+
+	float msetwo = ZOH::compresstwo(t, twoblock, format, effort);
 
 	if (mseone <= msetwo)
 		memcpy(block, oneblock, ZOH::BLOCKSIZE);
@@ -40,12 +69,12 @@ void ZOH::compress(const Tile &t, char *block)
 		memcpy(block, twoblock, ZOH::BLOCKSIZE);
 }
 
-void ZOH::decompress(const char *block, Tile &t)
+void ZOH::decompress(const char *block, Tile &t, Format format)
 {
 	if (ZOH::isone(block))
-		ZOH::decompressone(block, t);
+		ZOH::decompressone(block, t, format);
 	else
-		ZOH::decompresstwo(block, t);
+		ZOH::decompresstwo(block, t, format);
 }
 
 /*
@@ -44,19 +44,21 @@ struct ComprEndpts
 static const int BLOCKSIZE=16;
 static const int BITSIZE=128;
 
-void compress(const Tile &t, char *block);
-void decompress(const char *block, Tile &t);
+// effort in [0, 1] scales the search, 0.5 is the default
+// the two region modes are skipped when the one region error is below error_threshold times the variance of the block
+void compress(const Tile &t, char *block, Format format, float effort = 0.5f, float error_threshold = 0.0f);
+void decompress(const char *block, Tile &t, Format format);
 
-float compressone(const Tile &t, char *block);
-float compresstwo(const Tile &t, char *block);
-void decompressone(const char *block, Tile &t);
-void decompresstwo(const char *block, Tile &t);
+float compressone(const Tile &t, char *block, Format format);
+float compresstwo(const Tile &t, char *block, Format format, float effort);
+void decompressone(const char *block, Tile &t, Format format);
+void decompresstwo(const char *block, Tile &t, Format format);
 
-float refinetwo(const Tile &tile, int shapeindex_best, const FltEndpts endpts[NREGIONS_TWO], char *block);
-float roughtwo(const Tile &tile, int shape, FltEndpts endpts[NREGIONS_TWO]);
+float refinetwo(const Tile &tile, int shapeindex_best, const FltEndpts endpts[NREGIONS_TWO], char *block, Format format);
+float roughtwo(const Tile &tile, int shape, FltEndpts endpts[NREGIONS_TWO], Format format);
 
-float refineone(const Tile &tile, int shapeindex_best, const FltEndpts endpts[NREGIONS_ONE], char *block);
-float roughone(const Tile &tile, int shape, FltEndpts endpts[NREGIONS_ONE]);
+float refineone(const Tile &tile, int shapeindex_best, const FltEndpts endpts[NREGIONS_ONE], char *block, Format format);
+float roughone(const Tile &tile, int shape, FltEndpts endpts[NREGIONS_ONE], Format format);
 
 bool isone(const char *block);
 
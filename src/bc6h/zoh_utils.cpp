@@ -13,8 +13,16 @@ See the License for the specific language governing permissions and limitations
 // Utility and common routines
 
 #include "zoh_utils.h"
+#include "tile.h"
 #include "nvmath/Vector.inl"
+#include "nvmath/Fitting.h"
 #include <math.h>
+#include <float.h>
+#include <string.h>
+
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
 
 using namespace nv;
 using namespace ZOH;
@@ -22,7 +30,14 @@ using namespace ZOH;
 static const int denom7_weights_64[] = {0, 9, 18, 27, 37, 46, 55, 64};										// divided by 64
 static const int denom15_weights_64[] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};		// divided by 64
 
-/*static*/ Format Utils::FORMAT;
+#if NV_USE_SSE > 1
+// the same weights as floats, in both directions
+static const float denom7_weights_a[] = {64, 55, 46, 37, 27, 18, 9, 0};
+static const float denom7_weights_b[] = {0, 9, 18, 27, 37, 46, 55, 64};
+static const float denom15_weights_a[] = {64, 60, 55, 51, 47, 43, 38, 34, 30, 26, 21, 17, 13, 9, 4, 0};
+static const float denom15_weights_b[] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+#endif
+
 
 int Utils::lerp(int a, int b, int i, int denom)
 {
@@ -82,11 +97,11 @@ Vector3 Utils::lerp(const Vector3& a, const Vector3 &b, int i, int denom)
 // note that each channel is a float storing the allowable range as a bit pattern converted to float
 // that is, for unsigned f16 say, we would clamp each channel to the range [0, F16MAX]
 
-void Utils::clamp(Vector3 &v)
+void Utils::clamp(Vector3 &v, Format format)
 {
 	for (int i=0; i<3; ++i)
 	{
-		switch(Utils::FORMAT)
+		switch(format)
 		{
 		case UNSIGNED_F16:
 			if (v.component[i] < 0.0) v.component[i] = 0;
@@ -105,12 +120,12 @@ void Utils::clamp(Vector3 &v)
 }
 
 // convert a u16 value to s17 (represented as an int) based on the format expected
-int Utils::ushort_to_format(unsigned short input)
+int Utils::ushort_to_format(unsigned short input, Format format)
 {
 	int out, s;
 
 	// clamp to the valid range we are expecting
-	switch (Utils::FORMAT)
+	switch (format)
 	{
 	case UNSIGNED_F16:
 		if (input & F16S_MASK) out = 0;
@@ -130,12 +145,12 @@ int Utils::ushort_to_format(unsigned short input)
 }
 
 // convert a s17 value to u16 based on the format expected
-unsigned short Utils::format_to_ushort(int input)
+unsigned short Utils::format_to_ushort(int input, Format format)
 {
 	unsigned short out;
 
 	// clamp to the valid range we are expecting
-	switch (Utils::FORMAT)
+	switch (format)
 	{
 	case UNSIGNED_F16:
 		nvDebugCheck (input >= 0 && input <= F16MAX);
@@ -155,7 +170,7 @@ unsigned short Utils::format_to_ushort(int input)
 }
 
 // quantize the input range into equal-sized bins
-int Utils::quantize(float value, int prec)
+int Utils::quantize(float value, int prec, Format format)
 {
 	int q, ivalue, s;
 
@@ -165,7 +180,7 @@ int Utils::quantize(float value, int prec)
 
 	int bias = (prec > 10) ? ((1<<(prec-1))-1) : 0;	// bias precisions 11..16 to get a more accurate quantization
 
-	switch (Utils::FORMAT)
+	switch (format)
 	{
 	case UNSIGNED_F16:
 		nvDebugCheck (value >= 0 && value <= F16MAX);
@@ -190,11 +205,11 @@ int Utils::quantize(float value, int prec)
 	return q;
 }
 
-int Utils::finish_unquantize(int q, int prec)
+int Utils::finish_unquantize(int q, int prec, Format format)
 {
-	if (Utils::FORMAT == UNSIGNED_F16)
+	if (format == UNSIGNED_F16)
 		return (q * 31) >> 6;										// scale the magnitude by 31/64
-	else if (Utils::FORMAT == SIGNED_F16)
+	else if (format == SIGNED_F16)
 		return (q < 0) ? -(((-q) * 31) >> 5) : (q * 31) >> 5;		// scale the magnitude by 31/32
 	else
 		return q;
@@ -206,13 +221,13 @@ int Utils::finish_unquantize(int q, int prec)
 // the asymmetric end bins do not affect PSNR for the test images.
 //
 // code this function assuming an arbitrary bit pattern as the encoded block
-int Utils::unquantize(int q, int prec)
+int Utils::unquantize(int q, int prec, Format format)
 {
 	int unq, s;
 
 	nvDebugCheck (prec > 1);	// not implemented for prec 1
 
-	switch (Utils::FORMAT)
+	switch (format)
 	{
 	// modify this case to move the multiplication by 31 after interpolation.
 	// Need to use finish_unquantize.
@@ -259,6 +274,46 @@ int Utils::unquantize(int q, int prec)
 
 
 
+void Utils::unquantize_palette(int a, int b, int prec, int nindices, Format format, float palette[16])
+{
+	nvDebugCheck (nindices == 8 || nindices == 16);
+
+	a = unquantize(a, prec, format);
+	b = unquantize(b, prec, format);
+
+#if NV_USE_SSE > 1
+	const float *weights_a = (nindices == 16) ? denom15_weights_a : denom7_weights_a;
+	const float *weights_b = (nindices == 16) ? denom15_weights_b : denom7_weights_b;
+
+	// the unquantized endpoints times 64 fit in the 24 bits of a float, so the lerp is exact
+	__m128 fa = _mm_set1_ps(float(a));
+	__m128 fb = _mm_set1_ps(float(b));
+	__m128 round = _mm_set1_ps(32.0f);
+
+	for (int i = 0; i < nindices; i += 4)
+	{
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(fa, _mm_loadu_ps(weights_a + i)), _mm_mul_ps(fb, _mm_loadu_ps(weights_b + i))), round);
+		__m128i q = _mm_srai_epi32(_mm_cvtps_epi32(sum), 6);
+
+		// finish_unquantize: scale the magnitude by 31/64 or 31/32
+		if (format == UNSIGNED_F16)
+			q = _mm_srai_epi32(_mm_sub_epi32(_mm_slli_epi32(q, 5), q), 6);
+		else
+		{
+			__m128i s = _mm_srai_epi32(q, 31);
+			__m128i m = _mm_sub_epi32(_mm_xor_si128(q, s), s);
+			m = _mm_srai_epi32(_mm_sub_epi32(_mm_slli_epi32(m, 5), m), 5);
+			q = _mm_sub_epi32(_mm_xor_si128(m, s), s);
+		}
+
+		_mm_storeu_ps(palette + i, _mm_cvtepi32_ps(q));
+	}
+#else
+	for (int i = 0; i < nindices; ++i)
+		palette[i] = float(finish_unquantize(lerp(a, b, i, nindices - 1), prec, format));
+#endif
+}
+
 // pick a norm!
 #define	NORM_EUCLIDEAN 1
 
@@ -321,4 +376,139 @@ void Utils::parse(const char *encoding, int &ptr, Field &field, int &endbit, int
 	}
 }
 
+// score every shape at once with a line fit of its regions, so that only the promising ones get a rough fit
+void Utils::rank_shapes(const Tile &tile, const int *shapes, int nshapes, int nregions, int count, int index[])
+{
+	nvDebugCheck (nshapes <= 64 && nregions >= 2 && nregions <= 3 && count <= nshapes);
+
+	for (int i = 0; i < nshapes; ++i)
+		index[i] = i;
+
+	if (count >= nshapes)
+		return;
+
+	Vector4 points[Tile::TILE_TOTAL];
+	float weights[Tile::TILE_TOTAL];
+	for (int y = 0; y < Tile::TILE_H; y++)
+	for (int x = 0; x < Tile::TILE_W; x++)
+	{
+		bool inside = x < tile.size_x && y < tile.size_y;
+		points[y*4+x] = inside ? Vector4(tile.data[y][x], 0.0f) : Vector4(0.0f);
+		weights[y*4+x] = inside ? 1.0f : 0.0f;
+	}
+
+	// one bit per pixel for each region but the first
+	uint16 masks[64*2];
+	for (int si = 0; si < nshapes; ++si)
+	{
+		for (int r = 1; r < nregions; ++r)
+			masks[si*(nregions-1)+r-1] = 0;
+		for (int y = 0; y < Tile::TILE_H; y++)
+		for (int x = 0; x < Tile::TILE_W; x++)
+		{
+			int r = shapes[(si&3)*4+(si>>2)*64+x+y*16];
+			if (r > 0) masks[si*(nregions-1)+r-1] |= uint16(1 << (y*4+x));
+		}
+	}
+
+	float errors[64];
+	Fit::estimatePartitionErrors(points, weights, nregions, nshapes, masks, errors);
 
+	// selection sort -- only the first count shapes need to be in order, ties keep the lower shape
+	for (int i = 0; i < count; ++i)
+	{
+		int best = i;
+		for (int j = i+1; j < nshapes; ++j)
+			if (errors[index[j]] < errors[index[best]])
+				best = j;
+		int t = index[i]; index[i] = index[best]; index[best] = t;
+	}
+}
+
+PaletteErrors::PaletteErrors(const Vector3 colors_in[], const float importance_in[], int np, int nindices, int prec, Format format) :
+	np(np), nindices(nindices), prec(prec), format(format)
+{
+	nvDebugCheck (np <= 16 && (nindices == 8 || nindices == 16));
+
+	memset(colors, 0, sizeof(colors));
+	memset(importance, 0, sizeof(importance));
+	memset(dist, 0, sizeof(dist));
+
+	for (int i = 0; i < np; ++i)
+	{
+		for (int ch = 0; ch < 3; ++ch)
+			colors[ch][i] = colors_in[i].component[ch];
+		importance[i] = importance_in[i];
+	}
+}
+
+void PaletteErrors::set_channel(int ch, int a, int b)
+{
+	distances(ch, a, b, dist[ch]);
+}
+
+void PaletteErrors::distances(int ch, int a, int b, float d[16][16]) const
+{
+	float palette[16];
+	Utils::unquantize_palette(a, b, prec, nindices, format, palette);
+
+	for (int j = 0; j < nindices; ++j)
+	{
+#if NV_USE_SSE > 1
+		__m128 p = _mm_set1_ps(palette[j]);
+		for (int i = 0; i < np; i += 4)
+		{
+			__m128 e = _mm_sub_ps(_mm_loadu_ps(colors[ch] + i), p);
+			_mm_storeu_ps(d[j] + i, _mm_mul_ps(e, e));
+		}
+#else
+		for (int i = 0; i < np; ++i)
+		{
+			float e = colors[ch][i] - palette[j];
+			d[j][i] = e * e;
+		}
+#endif
+	}
+}
+
+// same as the squared euclidean norm to the nearest palette entry, weighted by importance, summed over the colors
+float PaletteErrors::error(int ch, int a, int b) const
+{
+	float fresh[16][16];
+	distances(ch, a, b, fresh);
+
+	const float (*d[3])[16] = { dist[0], dist[1], dist[2] };
+	d[ch] = fresh;
+
+	float besterr[16];
+
+#if NV_USE_SSE > 1
+	// four colors at a time, against every palette entry
+	for (int i = 0; i < np; i += 4)
+	{
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		for (int j = 0; j < nindices; ++j)
+		{
+			__m128 e = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(d[0][j] + i), _mm_loadu_ps(d[1][j] + i)), _mm_loadu_ps(d[2][j] + i));
+			best = _mm_min_ps(best, e);
+		}
+		_mm_storeu_ps(besterr + i, _mm_mul_ps(best, _mm_loadu_ps(importance + i)));
+	}
+#else
+	for (int i = 0; i < np; ++i)
+	{
+		float best = FLT_MAX;
+		for (int j = 0; j < nindices; ++j)
+		{
+			float e = d[0][j][i] + d[1][j][i] + d[2][j][i];
+			if (e < best) best = e;
+		}
+		besterr[i] = best * importance[i];
+	}
+#endif
+
+	float toterr = 0;
+	for (int i = 0; i < np; ++i)
+		toterr += besterr[i];
+	return toterr;
+}
@@ -19,6 +19,8 @@ See the License for the specific language governing permissions and limitations
 
 namespace ZOH {
 
+class Tile;
+
 inline int SIGN_EXTEND(int x, int nb) { return ((((signed(x))&(1<<((nb)-1)))?((~0)<<(nb)):0)|(signed(x))); }
 
 enum Field {
@@ -38,34 +40,63 @@ static const int S16MAX		=  0x7fff;
 static const int INT16_MASK	=  0xffff;
 static const int F16MAX		=  0x7bff;		// MAXFLT bit pattern for halfs
 
+// we're either handling unsigned or signed half values; the format is passed
+// to every call so that blocks of different formats can be compressed concurrently
 enum Format { UNSIGNED_F16, SIGNED_F16 };
 
 class Utils
 {
 public:
-    static Format FORMAT;     // this is a global -- we're either handling unsigned or unsigned half values
-
     // error metrics
     static float norm(const nv::Vector3 &a, const nv::Vector3 &b);
     static float mpsnr_norm(const nv::Vector3 &a, int exposure, const nv::Vector3 &b);
 
     // conversion & clamp
-    static int ushort_to_format(unsigned short input);
-    static unsigned short format_to_ushort(int input);
+    static int ushort_to_format(unsigned short input, Format format);
+    static unsigned short format_to_ushort(int input, Format format);
 
     // clamp to format
-    static void clamp(nv::Vector3 &v);
+    static void clamp(nv::Vector3 &v, Format format);
 
     // quantization and unquantization
-    static int finish_unquantize(int q, int prec);
-    static int unquantize(int q, int prec);
-    static int quantize(float value, int prec);
+    static int finish_unquantize(int q, int prec, Format format);
+    static int unquantize(int q, int prec, Format format);
+    static int quantize(float value, int prec, Format format);
+
+    // fused unquantize, lerp and finish_unquantize of one channel of a pair of quantized endpoints, for the nindices palette entries
+    static void unquantize_palette(int a, int b, int prec, int nindices, Format format, float palette[16]);
 
     static void parse(const char *encoding, int &ptr, Field & field, int &endbit, int &len);
 
     // lerping
     static int lerp(int a, int b, int i, int denom);
     static nv::Vector3 lerp(const nv::Vector3 & a, const nv::Vector3 & b, int i, int denom);
+
+    // shape ranking: the count shapes whose regions are estimated to fit a line best, best first
+    static void rank_shapes(const Tile &tile, const int *shapes, int nshapes, int nregions, int count, int index[]);
+};
+
+// error of a set of colors against the palette of a pair of quantized endpoints, for the endpoint refinement searches.
+// the squared distances to the palette are kept per channel, so a candidate that perturbs one channel only recomputes that one
+class PaletteErrors
+{
+public:
+    PaletteErrors(const nv::Vector3 colors[], const float importance[], int np, int nindices, int prec, Format format);
+
+    // use the endpoints a and b for channel ch
+    void set_channel(int ch, int a, int b);
+
+    // total error with the endpoints a and b for channel ch, and the ones that were set for the other channels
+    float error(int ch, int a, int b) const;
+
+private:
+    void distances(int ch, int a, int b, float dist[16][16]) const;
+
+    float colors[3][16];		// [channel][color], padded to 16 colors
+    float importance[16];
+    int np, nindices, prec;
+    Format format;
+    float dist[3][16][16];		// [channel][palette entry][color]
 };
 
 }
@@ -112,9 +112,9 @@ static void compress_endpts(const IntEndpts in[NREGIONS_ONE], ComprEndpts out[NR
 }
 
 // decompress endpoints
-static void decompress_endpts(const ComprEndpts in[NREGIONS_ONE], IntEndpts out[NREGIONS_ONE], const Pattern &p)
+static void decompress_endpts(const ComprEndpts in[NREGIONS_ONE], IntEndpts out[NREGIONS_ONE], const Pattern &p, Format format)
 {
-    bool issigned = Utils::FORMAT == SIGNED_F16;
+    bool issigned = format == SIGNED_F16;
 
     if (p.transformed)
     {
@@ -137,16 +137,16 @@ static void decompress_endpts(const ComprEndpts in[NREGIONS_ONE], IntEndpts out[
     }
 }
 
-static void quantize_endpts(const FltEndpts endpts[NREGIONS_ONE], int prec, IntEndpts q_endpts[NREGIONS_ONE])
+static void quantize_endpts(const FltEndpts endpts[NREGIONS_ONE], int prec, IntEndpts q_endpts[NREGIONS_ONE], Format format)
 {
     for (int region = 0; region < NREGIONS_ONE; ++region)
     {
-        q_endpts[region].A[0] = Utils::quantize(endpts[region].A.x, prec);
-        q_endpts[region].A[1] = Utils::quantize(endpts[region].A.y, prec);
-        q_endpts[region].A[2] = Utils::quantize(endpts[region].A.z, prec);
-        q_endpts[region].B[0] = Utils::quantize(endpts[region].B.x, prec);
-        q_endpts[region].B[1] = Utils::quantize(endpts[region].B.y, prec);
-        q_endpts[region].B[2] = Utils::quantize(endpts[region].B.z, prec);
+        q_endpts[region].A[0] = Utils::quantize(endpts[region].A.x, prec, format);
+        q_endpts[region].A[1] = Utils::quantize(endpts[region].A.y, prec, format);
+        q_endpts[region].A[2] = Utils::quantize(endpts[region].A.z, prec, format);
+        q_endpts[region].B[0] = Utils::quantize(endpts[region].B.x, prec, format);
+        q_endpts[region].B[1] = Utils::quantize(endpts[region].B.y, prec, format);
+        q_endpts[region].B[2] = Utils::quantize(endpts[region].B.z, prec, format);
     }
 }
 
@@ -178,11 +178,11 @@ static void swap_indices(IntEndpts endpts[NREGIONS_ONE], int indices[Tile::TILE_
 }
 
 // endpoints fit only if the compression was lossless
-static bool endpts_fit(const IntEndpts orig[NREGIONS_ONE], const ComprEndpts compressed[NREGIONS_ONE], const Pattern &p)
+static bool endpts_fit(const IntEndpts orig[NREGIONS_ONE], const ComprEndpts compressed[NREGIONS_ONE], const Pattern &p, Format format)
 {
     IntEndpts uncompressed[NREGIONS_ONE];
 
-    decompress_endpts(compressed, uncompressed, p);
+    decompress_endpts(compressed, uncompressed, p, format);
 
     for (int j=0; j<NREGIONS_ONE; ++j)
 	for (int i=0; i<NCHANNELS; ++i)
@@ -315,31 +315,31 @@ static void emit_block(const ComprEndpts endpts[NREGIONS_ONE], int shapeindex, c
     nvDebugCheck(out.getptr() == ZOH::BITSIZE);
 }
 
-static void generate_palette_quantized(const IntEndpts &endpts, int prec, Vector3 palette[NINDICES])
+static void generate_palette_quantized(const IntEndpts &endpts, int prec, Vector3 palette[NINDICES], Format format)
 {
     // scale endpoints
     int a, b;			// really need a IntVector3...
 
-    a = Utils::unquantize(endpts.A[0], prec);
-    b = Utils::unquantize(endpts.B[0], prec);
+    a = Utils::unquantize(endpts.A[0], prec, format);
+    b = Utils::unquantize(endpts.B[0], prec, format);
 
     // interpolate
     for (int i = 0; i < NINDICES; ++i)
-        palette[i].x = float(Utils::finish_unquantize(Utils::lerp(a, b, i, DENOM), prec));
+        palette[i].x = float(Utils::finish_unquantize(Utils::lerp(a, b, i, DENOM), prec, format));
 
-    a = Utils::unquantize(endpts.A[1], prec);
-    b = Utils::unquantize(endpts.B[1], prec);
+    a = Utils::unquantize(endpts.A[1], prec, format);
+    b = Utils::unquantize(endpts.B[1], prec, format);
 
     // interpolate
     for (int i = 0; i < NINDICES; ++i)
-        palette[i].y = float(Utils::finish_unquantize(Utils::lerp(a, b, i, DENOM), prec));
+        palette[i].y = float(Utils::finish_unquantize(Utils::lerp(a, b, i, DENOM), prec, format));
 
-    a = Utils::unquantize(endpts.A[2], prec);
-    b = Utils::unquantize(endpts.B[2], prec);
+    a = Utils::unquantize(endpts.A[2], prec, format);
+    b = Utils::unquantize(endpts.B[2], prec, format);
 
     // interpolate
     for (int i = 0; i < NINDICES; ++i)
-        palette[i].z = float(Utils::finish_unquantize(Utils::lerp(a, b, i, DENOM), prec));
+        palette[i].z = float(Utils::finish_unquantize(Utils::lerp(a, b, i, DENOM), prec, format));
 }
 
 // position 0 was compressed
@@ -354,7 +354,7 @@ static void read_indices(Bits &in, int shapeindex, int indices[Tile::TILE_H][Til
     }
 }
 
-void ZOH::decompressone(const char *block, Tile &t)
+void ZOH::decompressone(const char *block, Tile &t, Format format)
 {
     Bits in(block, ZOH::BITSIZE);
 
@@ -365,11 +365,11 @@ void ZOH::decompressone(const char *block, Tile &t)
     read_header(in, compr_endpts, p);
     int shapeindex = 0;		// only one shape
 
-    decompress_endpts(compr_endpts, endpts, p);
+    decompress_endpts(compr_endpts, endpts, p, format);
 
     Vector3 palette[NREGIONS_ONE][NINDICES];
     for (int r = 0; r < NREGIONS_ONE; ++r)
-        generate_palette_quantized(endpts[r], p.chan[0].prec[0], &palette[r][0]);
+        generate_palette_quantized(endpts[r], p.chan[0].prec[0], &palette[r][0], format);
 
     // read indices
     int indices[Tile::TILE_H][Tile::TILE_W];
@@ -384,48 +384,24 @@ void ZOH::decompressone(const char *block, Tile &t)
             t.data[y][x] = palette[REGION(x,y,shapeindex)][indices[y][x]];
 }
 
-// given a collection of colors and quantized endpoints, generate a palette, choose best entries, and return a single toterr
-static float map_colors(const Vector3 colors[], const float importance[], int np, const IntEndpts &endpts, int prec)
-{
-    Vector3 palette[NINDICES];
-    float toterr = 0;
-    Vector3 err;
-
-    generate_palette_quantized(endpts, prec, palette);
-
-    for (int i = 0; i < np; ++i)
-    {
-        float err, besterr;
-
-        besterr = Utils::norm(colors[i], palette[0]) * importance[i];
-
-        for (int j = 1; j < NINDICES && besterr > 0; ++j)
-        {
-            err = Utils::norm(colors[i], palette[j]) * importance[i];
-
-            if (err > besterr)	// error increased, so we're done searching
-                break;
-            if (err < besterr)
-                besterr = err;
-        }
-        toterr += besterr;
-    }
-    return toterr;
-}
-
 // assign indices given a tile, shape, and quantized endpoints, return toterr for each region
 static void assign_indices(const Tile &tile, int shapeindex, IntEndpts endpts[NREGIONS_ONE], int prec, 
-                           int indices[Tile::TILE_H][Tile::TILE_W], float toterr[NREGIONS_ONE])
+                           int indices[Tile::TILE_H][Tile::TILE_W], float toterr[NREGIONS_ONE], Format format)
 {
     // build list of possibles
     Vector3 palette[NREGIONS_ONE][NINDICES];
 
     for (int region = 0; region < NREGIONS_ONE; ++region)
     {
-        generate_palette_quantized(endpts[region], prec, &palette[region][0]);
+        generate_palette_quantized(endpts[region], prec, &palette[region][0], format);
         toterr[region] = 0;
     }
 
+    // The texels outside of partial tiles are not assigned, they still end up in the block.
+    for (int y = 0; y < Tile::TILE_H; y++)
+	for (int x = 0; x < Tile::TILE_W; x++)
+        indices[y][x] = 0;
+
     Vector3 err;
 
     for (int y = 0; y < tile.size_y; y++)
@@ -453,8 +429,7 @@ static void assign_indices(const Tile &tile, int shapeindex, IntEndpts endpts[NR
     }
 }
 
-static float perturb_one(const Vector3 colors[], const float importance[], int np, int ch, int prec, const IntEndpts &old_endpts, IntEndpts &new_endpts,
-                          float old_err, int do_b)
+static float perturb_one(const PaletteErrors &errors, int ch, int prec, const IntEndpts &old_endpts, IntEndpts &new_endpts, float old_err, int do_b)
 {
     // we have the old endpoints: old_endpts
     // we have the perturbed endpoints: new_endpts
@@ -486,7 +461,7 @@ static float perturb_one(const Vector3 colors[], const float importance[], int n
                     continue;
             }
 
-            float err = map_colors(colors, importance, np, temp_endpts, prec);
+            float err = errors.error(ch, temp_endpts.A[ch], temp_endpts.B[ch]);
 
             if (err < min_err)
             {
@@ -507,13 +482,17 @@ static float perturb_one(const Vector3 colors[], const float importance[], int n
     return min_err;
 }
 
-static void optimize_one(const Vector3 colors[], const float importance[], int np, float orig_err, const IntEndpts &orig_endpts, int prec, IntEndpts &opt_endpts)
+static void optimize_one(const Vector3 colors[], const float importance[], int np, float orig_err, const IntEndpts &orig_endpts, int prec, IntEndpts &opt_endpts, Format format)
 {
+    // candidates only perturb one channel, so the palette errors of the other channels are kept between them
+    PaletteErrors errors(colors, importance, np, NINDICES, prec, format);
+
     float opt_err = orig_err;
     for (int ch = 0; ch < NCHANNELS; ++ch)
     {
         opt_endpts.A[ch] = orig_endpts.A[ch];
         opt_endpts.B[ch] = orig_endpts.B[ch];
+        errors.set_channel(ch, opt_endpts.A[ch], opt_endpts.B[ch]);
     }
     /*
         err0 = perturb(rgb0, delta0)
@@ -542,8 +521,8 @@ static void optimize_one(const Vector3 colors[], const float importance[], int n
     {
         // figure out which endpoint when perturbed gives the most improvement and start there
         // if we just alternate, we can easily end up in a local minima
-        float err0 = perturb_one(colors, importance, np, ch, prec, opt_endpts, new_a, opt_err, 0);	// perturb endpt A
-        float err1 = perturb_one(colors, importance, np, ch, prec, opt_endpts, new_b, opt_err, 1);	// perturb endpt B
+        float err0 = perturb_one(errors, ch, prec, opt_endpts, new_a, opt_err, 0);	// perturb endpt A
+        float err1 = perturb_one(errors, ch, prec, opt_endpts, new_b, opt_err, 1);	// perturb endpt B
 
         if (err0 < err1)
         {
@@ -566,7 +545,7 @@ static void optimize_one(const Vector3 colors[], const float importance[], int n
         // now alternate endpoints and keep trying until there is no improvement
         for (;;)
         {
-            float err = perturb_one(colors, importance, np, ch, prec, opt_endpts, new_endpt, opt_err, do_b);
+            float err = perturb_one(errors, ch, prec, opt_endpts, new_endpt, opt_err, do_b);
             if (err >= opt_err)
                 break;
             if (do_b == 0)
@@ -576,11 +555,12 @@ static void optimize_one(const Vector3 colors[], const float importance[], int n
             opt_err = err;
             do_b = 1 - do_b;	// now move the other endpoint
         }
+        errors.set_channel(ch, opt_endpts.A[ch], opt_endpts.B[ch]);
     }
 }
 
 static void optimize_endpts(const Tile &tile, int shapeindex, const float orig_err[NREGIONS_ONE], 
-                            const IntEndpts orig_endpts[NREGIONS_ONE], int prec, IntEndpts opt_endpts[NREGIONS_ONE])
+                            const IntEndpts orig_endpts[NREGIONS_ONE], int prec, IntEndpts opt_endpts[NREGIONS_ONE], Format format)
 {
     Vector3 pixels[Tile::TILE_TOTAL];
     float importance[Tile::TILE_TOTAL];
@@ -601,7 +581,7 @@ static void optimize_endpts(const Tile &tile, int shapeindex, const float orig_e
             }
         }
 
-        optimize_one(pixels, importance, np, orig_err[region], orig_endpts[region], prec, opt_endpts[region]);
+        optimize_one(pixels, importance, np, orig_err[region], orig_endpts[region], prec, opt_endpts[region], format);
     }
 }
 
@@ -622,7 +602,7 @@ static void optimize_endpts(const Tile &tile, int shapeindex, const float orig_e
                 emit compressed block with original data // to try to preserve maximum endpoint precision
 */
 
-float ZOH::refineone(const Tile &tile, int shapeindex_best, const FltEndpts endpts[NREGIONS_ONE], char *block)
+float ZOH::refineone(const Tile &tile, int shapeindex_best, const FltEndpts endpts[NREGIONS_ONE], char *block, Format format)
 {
     float orig_err[NREGIONS_ONE], opt_err[NREGIONS_ONE], orig_toterr, opt_toterr;
     IntEndpts orig_endpts[NREGIONS_ONE], opt_endpts[NREGIONS_ONE];
@@ -634,20 +614,20 @@ float ZOH::refineone(const Tile &tile, int shapeindex_best, const FltEndpts endp
         // precisions for all channels need to be the same
         for (int i=1; i<NCHANNELS; ++i) nvDebugCheck (patterns[sp].chan[0].prec[0] == patterns[sp].chan[i].prec[0]);
 
-        quantize_endpts(endpts, patterns[sp].chan[0].prec[0], orig_endpts);
-        assign_indices(tile, shapeindex_best, orig_endpts, patterns[sp].chan[0].prec[0], orig_indices, orig_err);
+        quantize_endpts(endpts, patterns[sp].chan[0].prec[0], orig_endpts, format);
+        assign_indices(tile, shapeindex_best, orig_endpts, patterns[sp].chan[0].prec[0], orig_indices, orig_err, format);
         swap_indices(orig_endpts, orig_indices, shapeindex_best);
         compress_endpts(orig_endpts, compr_orig, patterns[sp]);
-        if (endpts_fit(orig_endpts, compr_orig, patterns[sp]))
+        if (endpts_fit(orig_endpts, compr_orig, patterns[sp], format))
         {
-            optimize_endpts(tile, shapeindex_best, orig_err, orig_endpts, patterns[sp].chan[0].prec[0], opt_endpts);
-            assign_indices(tile, shapeindex_best, opt_endpts, patterns[sp].chan[0].prec[0], opt_indices, opt_err);
+            optimize_endpts(tile, shapeindex_best, orig_err, orig_endpts, patterns[sp].chan[0].prec[0], opt_endpts, format);
+            assign_indices(tile, shapeindex_best, opt_endpts, patterns[sp].chan[0].prec[0], opt_indices, opt_err, format);
             swap_indices(opt_endpts, opt_indices, shapeindex_best);
             compress_endpts(opt_endpts, compr_opt, patterns[sp]);
             orig_toterr = opt_toterr = 0;
             for (int i=0; i < NREGIONS_ONE; ++i) { orig_toterr += orig_err[i]; opt_toterr += opt_err[i]; }
 
-            if (endpts_fit(opt_endpts, compr_opt, patterns[sp]) && opt_toterr < orig_toterr)
+            if (endpts_fit(opt_endpts, compr_opt, patterns[sp], format) && opt_toterr < orig_toterr)
             {
                 emit_block(compr_opt, shapeindex_best, patterns[sp], opt_indices, block);
                 return opt_toterr;
@@ -674,7 +654,7 @@ static void generate_palette_unquantized(const FltEndpts endpts[NREGIONS_ONE], V
 }
 
 // generate a palette from unquantized endpoints, then pick best palette color for all pixels in each region, return toterr for all regions combined
-static float map_colors(const Tile &tile, int shapeindex, const FltEndpts endpts[NREGIONS_ONE])
+static float map_colors(const Tile &tile, int shapeindex, const FltEndpts endpts[NREGIONS_ONE], Format format)
 {
     // build list of possibles
     Vector3 palette[NREGIONS_ONE][NINDICES];
@@ -706,7 +686,7 @@ static float map_colors(const Tile &tile, int shapeindex, const FltEndpts endpts
     return toterr;
 }
 
-float ZOH::roughone(const Tile &tile, int shapeindex, FltEndpts endpts[NREGIONS_ONE])
+float ZOH::roughone(const Tile &tile, int shapeindex, FltEndpts endpts[NREGIONS_ONE], Format format)
 {
     for (int region=0; region<NREGIONS_ONE; ++region)
     {
@@ -766,14 +746,14 @@ float ZOH::roughone(const Tile &tile, int shapeindex, FltEndpts endpts[NREGIONS_
         // clamp endpoints
         // the argument for clamping is that the actual endpoints need to be clamped and thus we need to choose the best
         // shape based on endpoints being clamped
-        Utils::clamp(endpts[region].A);
-        Utils::clamp(endpts[region].B);
+        Utils::clamp(endpts[region].A, format);
+        Utils::clamp(endpts[region].B, format);
     }
 
-    return map_colors(tile, shapeindex, endpts);
+    return map_colors(tile, shapeindex, endpts, format);
 }
 
-float ZOH::compressone(const Tile &t, char *block)
+float ZOH::compressone(const Tile &t, char *block, Format format)
 {
     int shapeindex_best = 0;
     FltEndpts endptsbest[NREGIONS_ONE], tempendpts[NREGIONS_ONE];
@@ -786,7 +766,7 @@ float ZOH::compressone(const Tile &t, char *block)
     // hack for now -- just use the best value WORK
     for (int i=0; i<NSHAPES && msebest>0.0; ++i)
     {
-        float mse = roughone(t, i, tempendpts);
+        float mse = roughone(t, i, tempendpts, format);
         if (mse < msebest)
         {
             msebest = mse;
@@ -795,5 +775,5 @@ float ZOH::compressone(const Tile &t, char *block)
         }
 
     }
-    return refineone(t, shapeindex_best, endptsbest, block);
+    return refineone(t, shapeindex_best, endptsbest, block, format);
 }
@@ -18,47 +18,288 @@ See the License for the specific language governing permissions and limitations
 #include "nvmath/Vector.inl"
 #include <cstring>
 #include <float.h>
+#include <math.h>
 
 using namespace nv;
 using namespace AVPCL;
 
-// global flags
-bool AVPCL::flag_premult = false;
-bool AVPCL::flag_nonuniform = false;
-bool AVPCL::flag_nonuniform_ati = false;
+// the shape tables of the two and three region modes, kept apart since both headers use the same names
+namespace TwoRegions {
+#include "shapes_two.h"
+}
+#undef	NREGIONS
+#undef	NSHAPES
+#undef	SHAPEBITS
+#undef	REGION
+#undef	SHAPEINDEX_TO_COMPRESSED_INDICES
+
+namespace ThreeRegions {
+#include "shapes_three.h"
+}
+#undef	NREGIONS
+#undef	NSHAPES
+#undef	SHAPEBITS
+#undef	REGION
+#undef	SHAPEINDEX_TO_COMPRESSED_INDICES
+
+static inline int region(const int *shapes, int x, int y, int si) { return shapes[(si&3)*4+(si>>2)*64+x+y*16]; }
 
-// global mode
-bool AVPCL::mode_rgb = false;		// true if image had constant alpha = 255
+static const int NMODES = 8;
 
-void AVPCL::compress(const Tile &t, char *block)
+// weighted sums of the pixels of a region and of the products of their channels
+struct Moments
+{
+	float w;
+	float s[4];
+	float ss[4][4];
+
+	void clear() { memset(this, 0, sizeof(*this)); }
+	void add(const Moments &m)
+	{
+		w += m.w;
+		for (int i=0; i<4; ++i) s[i] += m.s[i];
+		for (int i=0; i<4; ++i) for (int j=i; j<4; ++j) ss[i][j] += m.ss[i][j];
+	}
+	// sum of the squared distances to the mean of the two channels
+	float scatter(int i, int j) const { return w > 0 ? ss[min(i,j)][max(i,j)] - s[i] * s[j] / w : 0; }
+};
+
+// estimated squared error of a region when only the channels ch[0..nch-1] are fit to a line, with 2^indexbits palette entries and endpoints quantized to endptbits
+static float line_error(const Moments &m, const int *ch, int nch, int indexbits, int endptbits)
+{
+	float scatter[4][4];
+	float trace = 0;
+	int first = 0;
+	for (int i=0; i<nch; ++i)
+	{
+		for (int j=0; j<nch; ++j)
+			scatter[i][j] = m.scatter(ch[i], ch[j]);
+		trace += scatter[i][i];
+		if (scatter[i][i] > scatter[first][first]) first = i;
+	}
+	if (trace <= 0) return 0;
+
+	// the scatter along the principal axis, by power iteration from the widest channel
+	float v[4], norm = 0, lambda = scatter[first][first];
+	for (int i=0; i<nch; ++i) { v[i] = scatter[i][first]; norm += v[i] * v[i]; }
+	norm = sqrtf(norm);
+	for (int i=0; i<nch; ++i) v[i] /= norm;
+	for (int iter=0; iter<8; ++iter)
+	{
+		float mv[4];
+		norm = 0;
+		lambda = 0;
+		for (int i=0; i<nch; ++i)
+		{
+			mv[i] = 0;
+			for (int j=0; j<nch; ++j) mv[i] += scatter[i][j] * v[j];
+			lambda += v[i] * mv[i];
+			norm += mv[i] * mv[i];
+		}
+		if (norm <= 0) break;
+		norm = sqrtf(norm);
+		for (int i=0; i<nch; ++i) v[i] = mv[i] / norm;
+	}
+	lambda = min(max(lambda, 0.0f), trace);
+
+	// points spread evenly along the axis are off by a twelfth of the squared palette step, and so are the endpoints
+	float steps = float((1 << indexbits) - 1);
+	float endpt_step = 255.0f / float((1 << endptbits) - 1);
+	float err = (trace - lambda) + lambda / (steps * steps);
+	for (int i=0; i<nch; ++i)
+		if (scatter[i][i] > 0) err += m.w * endpt_step * endpt_step / 24.0f;
+	return err;
+}
+
+// estimated error of the best shape of a partitioned mode, shapes are read from the first nshapes entries of the table
+static float partition_error(const Moments pixel[Tile::TILE_H][Tile::TILE_W], const Tile &t, const int *shapes, int nshapes, int nregions, const int *ch, int nch, int indexbits, int endptbits)
+{
+	float besterr = FLT_MAX;
+	for (int si=0; si<nshapes; ++si)
+	{
+		Moments m[3];
+		for (int r=0; r<nregions; ++r) m[r].clear();
+		for (int y=0; y<t.size_y; ++y)
+		for (int x=0; x<t.size_x; ++x)
+			m[region(shapes, x, y, si)].add(pixel[y][x]);
+
+		float err = 0;
+		for (int r=0; r<nregions; ++r)
+			err += line_error(m[r], ch, nch, indexbits, endptbits);
+		besterr = min(besterr, err);
+	}
+	return besterr;
+}
+
+// estimate the error of every mode from the statistics of the tile, without searching endpoints or indices
+static void estimate_mode_errors(const Tile &t, float errs[NMODES])
+{
+	static const int rgb[3] = { 0, 1, 2 };
+	static const int rgba[4] = { 0, 1, 2, 3 };
+
+	Moments pixel[Tile::TILE_H][Tile::TILE_W], all;
+	all.clear();
+	for (int y=0; y<t.size_y; ++y)
+	for (int x=0; x<t.size_x; ++x)
+	{
+		Moments &m = pixel[y][x];
+		float w = t.importance_map[y][x];
+		m.clear();
+		m.w = w;
+		for (int i=0; i<4; ++i) m.s[i] = w * t.data[y][x].component[i];
+		for (int i=0; i<4; ++i) for (int j=i; j<4; ++j) m.ss[i][j] = m.s[i] * t.data[y][x].component[j];
+		all.add(m);
+	}
+
+	// modes 0 to 3 have no alpha and decode it as 255
+	float alpha_err = all.ss[3][3] - 2 * 255.0f * all.s[3] + 255.0f * 255.0f * all.w;
+
+	errs[0] = alpha_err + partition_error(pixel, t, ThreeRegions::shapes, 16, 3, rgb, 3, 3, 5);
+	errs[1] = alpha_err + partition_error(pixel, t, TwoRegions::shapes, 64, 2, rgb, 3, 3, 7);
+	errs[2] = alpha_err + partition_error(pixel, t, ThreeRegions::shapes, 64, 3, rgb, 3, 2, 5);
+	errs[3] = alpha_err + partition_error(pixel, t, TwoRegions::shapes, 64, 2, rgb, 3, 2, 8);
+	errs[6] = line_error(all, rgba, 4, 4, 8);
+	errs[7] = partition_error(pixel, t, TwoRegions::shapes, 64, 2, rgba, 4, 2, 6);
+
+	// modes 4 and 5 fit three channels to a line and the fourth one separately, the rotation chooses the separate channel
+	errs[4] = errs[5] = FLT_MAX;
+	for (int rotation=0; rotation<4; ++rotation)
+	{
+		int scalar = (rotation + 3) & 3;
+		int vector[3];
+		for (int i=0, n=0; i<4; ++i) if (i != scalar) vector[n++] = i;
+
+		for (int indexmode=0; indexmode<2; ++indexmode)
+		{
+			float err = line_error(all, vector, 3, indexmode ? 3 : 2, 5) + line_error(all, &scalar, 1, indexmode ? 2 : 3, 6);
+			errs[4] = min(errs[4], err);
+		}
+		errs[5] = min(errs[5], line_error(all, vector, 3, 2, 7) + line_error(all, &scalar, 1, 2, 8));
+	}
+}
+
+typedef float (*CompressMode)(const Tile &t, const Options &options, char *block);
+
+static const CompressMode compress_modes[NMODES] =
+{
+	AVPCL::compress_mode0, AVPCL::compress_mode1, AVPCL::compress_mode2, AVPCL::compress_mode3,
+	AVPCL::compress_mode4, AVPCL::compress_mode5, AVPCL::compress_mode6, AVPCL::compress_mode7,
+};
+
+// weighted sum of the squared distances of the pixels to their mean, the error of compressing the block to its mean color
+static float block_variance(const Tile &t)
+{
+	float w = 0, s[4] = { 0, 0, 0, 0 }, ss = 0;
+	for (int y=0; y<t.size_y; ++y)
+	for (int x=0; x<t.size_x; ++x)
+	{
+		float iw = t.importance_map[y][x];
+		w += iw;
+		for (int i=0; i<4; ++i)
+		{
+			float c = t.data[y][x].component[i];
+			s[i] += iw * c;
+			ss += iw * c * c;
+		}
+	}
+	if (w > 0)
+		for (int i=0; i<4; ++i) ss -= s[i] * s[i] / w;
+	return ss > 0 ? ss : 0;
+}
+
+// at most the number of shapes of a mode
+static const int MAX_ITEMS = 64;
+
+// blocks and errors of items refined as parallel tasks
+struct ItemTasks
+{
+	RefineItem *refine;
+	void *context;
+	char blocks[MAX_ITEMS][AVPCL::BLOCKSIZE];
+	float mse[MAX_ITEMS];
+};
+
+static void item_task(void *context, int i)
+{
+	ItemTasks *tasks = (ItemTasks *)context;
+	tasks->mse[i] = tasks->refine(tasks->context, i, tasks->blocks[i]);
+}
+
+// keep the best of the items [0, count), going in order and stopping once the error is within good_enough
+static float best_item(const Options &options, int count, RefineItem *refine, void *context, float good_enough, char *block)
 {
-	char tempblock[AVPCL::BLOCKSIZE];
 	float msebest = FLT_MAX;
 
-	float mse_mode0 = AVPCL::compress_mode0(t, tempblock);		if(mse_mode0 < msebest) { msebest = mse_mode0; memcpy(block, tempblock, AVPCL::BLOCKSIZE); }
-	float mse_mode1 = AVPCL::compress_mode1(t, tempblock);		if(mse_mode1 < msebest) { msebest = mse_mode1; memcpy(block, tempblock, AVPCL::BLOCKSIZE); }
-	float mse_mode2 = AVPCL::compress_mode2(t, tempblock);		if(mse_mode2 < msebest) { msebest = mse_mode2; memcpy(block, tempblock, AVPCL::BLOCKSIZE); }
-	float mse_mode3 = AVPCL::compress_mode3(t, tempblock);		if(mse_mode3 < msebest) { msebest = mse_mode3; memcpy(block, tempblock, AVPCL::BLOCKSIZE); }
-	float mse_mode4 = AVPCL::compress_mode4(t, tempblock);		if(mse_mode4 < msebest) { msebest = mse_mode4; memcpy(block, tempblock, AVPCL::BLOCKSIZE); }
-	float mse_mode5 = AVPCL::compress_mode5(t, tempblock);		if(mse_mode5 < msebest) { msebest = mse_mode5; memcpy(block, tempblock, AVPCL::BLOCKSIZE); }
-	float mse_mode6 = AVPCL::compress_mode6(t, tempblock);		if(mse_mode6 < msebest) { msebest = mse_mode6; memcpy(block, tempblock, AVPCL::BLOCKSIZE); }
-	float mse_mode7 = AVPCL::compress_mode7(t, tempblock);		if(mse_mode7 < msebest) { msebest = mse_mode7; memcpy(block, tempblock, AVPCL::BLOCKSIZE); }
-		
-	/*if (errfile)
+	if (options.dispatch != NULL && count > 1)
+	{
+		nvDebugCheck (count <= MAX_ITEMS);
+
+		ItemTasks tasks;
+		tasks.refine = refine;
+		tasks.context = context;
+		options.dispatch(options.dispatcher, item_task, &tasks, count);
+
+		// pick the same item as the serial loop below
+		for (int i=0; i<count && msebest>good_enough; ++i)
+			if (tasks.mse[i] < msebest) { msebest = tasks.mse[i]; memcpy(block, tasks.blocks[i], AVPCL::BLOCKSIZE); }
+		return msebest;
+	}
+
+	char tempblock[AVPCL::BLOCKSIZE];
+	for (int i=0; i<count && msebest>good_enough; ++i)
 	{
-		float errs[21];
-		int nerrs = 8;
-		errs[0] = mse_mode0; 
-		errs[1] = mse_mode1; 
-		errs[2] = mse_mode2; 
-		errs[3] = mse_mode3; 
-		errs[4] = mse_mode4; 
-		errs[5] = mse_mode5; 
-		errs[6] = mse_mode6; 
-		errs[7] = mse_mode7;
-		if (fwrite(errs, sizeof(float), nerrs, errfile) != nerrs)
-			throw "Write error on error file";
-	}*/
+		float mse = refine(context, i, tempblock);
+		if (mse < msebest) { msebest = mse; memcpy(block, tempblock, AVPCL::BLOCKSIZE); }
+	}
+	return msebest;
+}
+
+float AVPCL::refine_items(const Options &options, int count, RefineItem *refine, void *context, char *block)
+{
+	return best_item(options, count, refine, context, 0, block);
+}
+
+struct ModeContext
+{
+	const Tile *tile;
+	const Options *options;
+	const int *modes;
+};
+
+static float compress_item(void *context, int item, char *block)
+{
+	const ModeContext *c = (const ModeContext *)context;
+	return compress_modes[c->modes[item]](*c->tile, *c->options, block);
+}
+
+void AVPCL::compress(const Tile &t, const Options &options, char *block)
+{
+	// stop the mode search as soon as a mode's error is within the threshold
+	float good_enough = options.error_threshold > 0 ? options.error_threshold * block_variance(t) : 0;
+
+	// the modes left out of the mask are never compressed
+	int modes[NMODES];
+	int nmodes = 0;
+	for (int mode=0; mode<NMODES; ++mode)
+		if (options.mode_mask & (1 << mode)) modes[nmodes++] = mode;
+	nvDebugCheck (nmodes > 0);
+
+	if (options.mode_candidates < nmodes)
+	{
+		// compress only the modes with the lowest estimated error, in order of increasing estimate
+		float estimate[NMODES];
+		estimate_mode_errors(t, estimate);
+		for (int i=0; i<options.mode_candidates; ++i)
+		for (int j=i+1; j<nmodes; ++j)
+			if (estimate[modes[j]] < estimate[modes[i]])
+			{
+				int tmp = modes[i]; modes[i] = modes[j]; modes[j] = tmp;
+			}
+		nmodes = options.mode_candidates;
+	}
+
+	ModeContext context = { &t, &options, modes };
+	best_item(options, nmodes, compress_item, &context, good_enough, block);
 }
 
 /*
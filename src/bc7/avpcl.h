@@ -28,39 +28,72 @@ static const int NREGIONS_THREE	= 3;
 static const int BLOCKSIZE=16;
 static const int BITSIZE=128;
 
-// global flags
-extern bool flag_premult;
-extern bool flag_nonuniform;
-extern bool flag_nonuniform_ati;
+// compression flags, passed down to every mode so that blocks can be compressed concurrently
+struct Options
+{
+	bool premult;			// use the premultiplied-alpha error metric
+	bool nonuniform;		// weight channels by perceptual importance
+	bool nonuniform_ati;	// use ATI's channel weights instead
+	float channel_weights[4];	// rgba weights of the error when neither nonuniform flag is set, all 1 for the plain squared error
+	float effort;			// search effort in [0, 1], 0.5 is the default
+	int mode_candidates;	// number of modes to compress, picked from an estimate of their error, all 8 modes are compressed when 8
+	int mode_mask;			// bit i enables mode i, 0xFF searches all the modes
+	float error_threshold;	// stop the mode search once a mode's error is below this fraction of the block's variance, 0 searches all modes
+
+	// runs task(context, i) for every i in [0, count) and returns when they're all done, the tasks may run in parallel.
+	// when set, the modes of a block and their shape refinements are compressed as separate tasks, NULL compresses them in order.
+	void (*dispatch)(void *dispatcher, void (*task)(void *context, int i), void *context, int count);
+	void *dispatcher;
+};
+
+// number of the best rough shapes to refine: 1 with no effort, nshapes/4 at the default effort and all of them at full effort
+inline int refine_count(const Options &options, int nshapes)
+{
+	int def = (nshapes + 3) / 4;
+	if (options.effort <= 0.5f)
+		return 1 + int((def - 1) * 2.0f * options.effort + 0.5f);
+	return def + int((nshapes - def) * 2.0f * (options.effort - 0.5f) + 0.5f);
+}
+
+// number of shapes to rough fit, picked from a line fit estimate of all the shapes: twice the refined shapes, at least nshapes/4
+inline int rough_count(const Options &options, int nshapes)
+{
+	int count = 2 * refine_count(options, nshapes);
+	if (count < nshapes/4) count = nshapes/4;
+	return count < nshapes ? count : nshapes;
+}
 
-// global mode
-extern bool mode_rgb;		// true if image had constant alpha = 255
+// refines the items [0, count) with refine(context, i, block) and keeps the best block, going in order and stopping at a perfect fit.
+// the items are refined as parallel tasks when options.dispatch is set, which gives the same block.
+typedef float RefineItem(void *context, int item, char *block);
+float refine_items(const Options &options, int count, RefineItem *refine, void *context, char *block);
 
-void compress(const Tile &t, char *block);
+void compress(const Tile &t, const Options &options, char *block);
 void decompress(const char *block, Tile &t);
 
-float compress_mode0(const Tile &t, char *block);
+float compress_mode0(const Tile &t, const Options &options, char *block);
 void decompress_mode0(const char *block, Tile &t);
 
-float compress_mode1(const Tile &t, char *block);
+float compress_mode1(const Tile &t, const Options &options, char *block);
 void decompress_mode1(const char *block, Tile &t);
 
-float compress_mode2(const Tile &t, char *block);
+float compress_mode2(const Tile &t, const Options &options, char *block);
 void decompress_mode2(const char *block, Tile &t);
 
-float compress_mode3(const Tile &t, char *block);
+float compress_mode3(const Tile &t, const Options &options, char *block);
 void decompress_mode3(const char *block, Tile &t);
 
-float compress_mode4(const Tile &t, char *block);
+float compress_mode4(const Tile &t, const Options &options, char *block);
 void decompress_mode4(const char *block, Tile &t);
 
-float compress_mode5(const Tile &t, char *block);
+float compress_mode5(const Tile &t, const Options &options, char *block);
 void decompress_mode5(const char *block, Tile &t);
 
-float compress_mode6(const Tile &t, char *block);
+float compress_mode6(const Tile &t, const Options &options, char *block);
+float compress_mode6_fast(const Tile &t, const Options &options, char *block);	// single pass SSE2 encoder, much faster and somewhat worse than compress_mode6
 void decompress_mode6(const char *block, Tile &t);
 
-float compress_mode7(const Tile &t, char *block);
+float compress_mode7(const Tile &t, const Options &options, char *block);
 void decompress_mode7(const char *block, Tile &t);
 
 inline int getmode(Bits &in)
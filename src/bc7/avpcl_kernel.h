@@ -0,0 +1,1081 @@
+/*
+Copyright 2007 nVidia, Inc.
+Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file except in compliance with the License.
+
+You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+
+See the License for the specific language governing permissions and limitations under the License.
+*/
+
+// compressor and decompressor shared by the partitioned modes with a single index set: 0, 1, 2, 3 and 7.
+// it's specialized at compile time by a traits struct that describes the mode:
+//
+//	struct ModeTraits
+//	{
+//		enum
+//		{
+//			MODE,			// mode number, written as 1<<MODE in MODE+1 bits
+//			REGIONS,		// regions per shape, 2 or 3
+//			SHAPES,			// number of shapes
+//			SHAPE_BITS,		// bits of the shape index
+//			CHANNELS,		// 3 for RGB with constant alpha, 4 for RGBA
+//			ENDPT_BITS,		// bits of each endpoint channel, not counting the lsb
+//			LSB,			// LSB_NONE, LSB_SHARED or LSB_UNIQUE
+//			INDEX_BITS,		// bits of each index
+//		};
+//		static const int *shape_table();					// shape table, for Utils::rank_shapes
+//		static int region(int x, int y, int shape);			// region of the texel
+//		static int anchor(int shape, int region);			// position of the index of the region that's stored without its high bit
+//	};
+
+#ifndef _AVPCL_KERNEL_H
+#define _AVPCL_KERNEL_H
+
+#include "bits.h"
+#include "tile.h"
+#include "avpcl.h"
+#include "nvcore/Debug.h"
+#include "nvmath/Vector.inl"
+#include "nvmath/Matrix.inl"
+#include "nvmath/Fitting.h"
+#include "avpcl_utils.h"
+#include "endpts.h"
+#include <float.h>
+
+namespace AVPCL {
+
+static const int LSB_NONE	= 0;		// endpoints have no lsb
+static const int LSB_SHARED	= 1;		// one lsb shared by both endpoints of a region
+static const int LSB_UNIQUE	= 2;		// one lsb for each endpoint
+
+// quantized endpoints of a region, the lsbs are ignored with LSB_NONE and equal with LSB_SHARED
+template <int CHANNELS>
+struct IntEndptsLsb
+{
+	int		A[CHANNELS];
+	int		B[CHANNELS];
+	int		a_lsb;
+	int		b_lsb;
+};
+
+#if defined(USE_ZOH_INTERP) && defined(USE_ZOH_INTERP_ROUNDED)
+// weights of Utils::lerp for the 2 and 3 bit indices, divided by 64
+static const int lerp_weights2[4] = {0, 21, 43, 64};
+static const int lerp_weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+#endif
+
+template <class Mode>
+class PartitionKernel
+{
+public:
+	enum
+	{
+		REGIONS = Mode::REGIONS,
+		CHANNELS = Mode::CHANNELS,
+		NINDICES = 1 << Mode::INDEX_BITS,
+		HIGH_INDEXBIT = 1 << (Mode::INDEX_BITS-1),
+		DENOM = NINDICES-1,
+		BIAS = DENOM/2,
+		PREC = Mode::ENDPT_BITS + (Mode::LSB != LSB_NONE ? 1 : 0),	// precision of an endpoint channel including the lsb
+		NLSBMODES = Mode::LSB == LSB_UNIQUE ? 4 : Mode::LSB == LSB_SHARED ? 2 : 1,
+		LSBBITS = Mode::LSB == LSB_UNIQUE ? 2*REGIONS : Mode::LSB == LSB_SHARED ? REGIONS : 0,
+		HEADERBITS = Mode::MODE+1 + Mode::SHAPE_BITS + 2*REGIONS*CHANNELS*Mode::ENDPT_BITS + LSBBITS,
+	};
+
+	typedef IntEndptsLsb<CHANNELS> Endpts;
+
+	static float compress(const Tile &t, const Options &options, char *block);
+	static void decompress(const char *block, Tile &t);
+
+private:
+	// rough endpoints of a shape
+	struct ShapeEndpts
+	{
+		FltEndpts endpts[REGIONS];
+	};
+
+	// what refining one of the best shapes needs
+	struct RefineContext
+	{
+		const Tile *tile;
+		const int *index;
+		const ShapeEndpts *all;
+		const Options *options;
+	};
+
+	// squared length of a weighted error with the texel's importance applied to the color error only, so that the alpha of
+	// unimportant texels, the transparent ones when importance is alpha, still gets fit.
+	static float importance_error(nv::Vector4::Arg err, float importance)
+	{
+		return importance * (err.x * err.x + err.y * err.y + err.z * err.z) + err.w * err.w;
+	}
+
+	// Utils::metric4 with its channel weights hoisted out of the loops. the RGBA modes use Utils::metric4premult when premult is set.
+	static float metric(nv::Vector4::Arg a, nv::Vector4::Arg b, nv::Vector4::Arg weights, float importance, const Options &options)
+	{
+		if (CHANNELS == NCHANNELS_RGBA && options.premult)
+			return Utils::metric4premult(a, b, options) * importance;
+		return importance_error((a - b) * weights, importance);
+	}
+
+	static int pos_to_x(int pos) { return pos & 3; }
+	static int pos_to_y(int pos) { return (pos >> 2) & 3; }
+
+	static void compress_one(const int A[CHANNELS], const int B[CHANNELS], Endpts &compr_endpts);
+	static void uncompress_one(const Endpts &compr_endpts, int A[CHANNELS], int B[CHANNELS]);
+	static void quantize_endpts(const FltEndpts endpts[REGIONS], Endpts q_endpts[REGIONS]);
+	static void swap_indices(Endpts endpts[REGIONS], int indices[Tile::TILE_H][Tile::TILE_W], int shapeindex);
+	static void write_header(const Endpts endpts[REGIONS], int shapeindex, Bits &out);
+	static void read_header(Bits &in, Endpts endpts[REGIONS], int &shapeindex);
+	static void write_indices(const int indices[Tile::TILE_H][Tile::TILE_W], int shapeindex, Bits &out);
+	static void read_indices(Bits &in, int shapeindex, int indices[Tile::TILE_H][Tile::TILE_W]);
+	static void emit_block(const Endpts endpts[REGIONS], int shapeindex, const int indices[Tile::TILE_H][Tile::TILE_W], char *block);
+	static void generate_palette_quantized(const Endpts &endpts, nv::Vector4 palette[NINDICES]);
+	static float map_colors(const nv::Vector4 colors[], const float importance[], int np, const Endpts &endpts, float current_err, int indices[Tile::TILE_TOTAL], const Options &options);
+	static void assign_indices(const Tile &tile, int shapeindex, const Endpts endpts[REGIONS], int indices[Tile::TILE_H][Tile::TILE_W], float toterr[REGIONS], const Options &options);
+	static float perturb_one(const nv::Vector4 colors[], const float importance[], int np, int ch, const Endpts &old_endpts, Endpts &new_endpts, float old_err, int do_b, int indices[Tile::TILE_TOTAL], const Options &options);
+	static float exhaustive(const nv::Vector4 colors[], const float importance[], int np, int ch, float orig_err, Endpts &opt_endpts, int indices[Tile::TILE_TOTAL], const Options &options);
+	static float optimize_one(const nv::Vector4 colors[], const float importance[], int np, float orig_err, const Endpts &orig_endpts, Endpts &opt_endpts, const Options &options);
+	static void optimize_endpts(const Tile &tile, int shapeindex, const float orig_err[REGIONS], const Endpts orig_endpts[REGIONS], float opt_err[REGIONS], Endpts opt_endpts[REGIONS], const Options &options);
+	static float refine(const Tile &tile, int shapeindex_best, const FltEndpts endpts[REGIONS], const Options &options, char *block);
+	static void clamp(nv::Vector4 &v);
+	static float map_colors(const Tile &tile, int shapeindex, const FltEndpts endpts[REGIONS], const Options &options);
+	static float rough(const Tile &tile, int shapeindex, FltEndpts endpts[REGIONS], const Options &options);
+	static float refine_item(void *context, int item, char *block);
+};
+
+// endpoints are PREC bits; drop the lsbs and put the lsb majority in the lsb fields. the alpha lsb isn't counted.
+template <class Mode>
+void PartitionKernel<Mode>::compress_one(const int A[CHANNELS], const int B[CHANNELS], Endpts &compr_endpts)
+{
+	if (Mode::LSB == LSB_NONE)
+	{
+		for (int j=0; j<CHANNELS; ++j)
+		{
+			compr_endpts.A[j] = A[j];
+			compr_endpts.B[j] = B[j];
+		}
+		compr_endpts.a_lsb = compr_endpts.b_lsb = 0;
+		return;
+	}
+
+	int a_ones = 0, b_ones = 0;
+	for (int j=0; j<CHANNELS; ++j)
+	{
+		if (j != CHANNEL_A)
+		{
+			a_ones += A[j] & 1;
+			b_ones += B[j] & 1;
+		}
+		compr_endpts.A[j] = A[j] >> 1;
+		compr_endpts.B[j] = B[j] >> 1;
+		nvAssert (compr_endpts.A[j] < (1 << Mode::ENDPT_BITS));
+		nvAssert (compr_endpts.B[j] < (1 << Mode::ENDPT_BITS));
+	}
+	if (Mode::LSB == LSB_SHARED)
+		compr_endpts.a_lsb = compr_endpts.b_lsb = (a_ones + b_ones) >= NCHANNELS_RGB;
+	else
+	{
+		compr_endpts.a_lsb = a_ones >= 2;
+		compr_endpts.b_lsb = b_ones >= 2;
+	}
+}
+
+template <class Mode>
+void PartitionKernel<Mode>::uncompress_one(const Endpts &compr_endpts, int A[CHANNELS], int B[CHANNELS])
+{
+	for (int j=0; j<CHANNELS; ++j)
+	{
+		if (Mode::LSB == LSB_NONE)
+		{
+			A[j] = compr_endpts.A[j];
+			B[j] = compr_endpts.B[j];
+		}
+		else
+		{
+			A[j] = (compr_endpts.A[j] << 1) | compr_endpts.a_lsb;
+			B[j] = (compr_endpts.B[j] << 1) | compr_endpts.b_lsb;
+		}
+	}
+}
+
+template <class Mode>
+void PartitionKernel<Mode>::quantize_endpts(const FltEndpts endpts[REGIONS], Endpts q_endpts[REGIONS])
+{
+	for (int region = 0; region < REGIONS; ++region)
+	{
+		int A[CHANNELS], B[CHANNELS];
+		for (int j=0; j<CHANNELS; ++j)
+		{
+			A[j] = Utils::quantize(endpts[region].A.component[j], PREC);
+			B[j] = Utils::quantize(endpts[region].B.component[j], PREC);
+		}
+		compress_one(A, B, q_endpts[region]);
+	}
+}
+
+// swap endpoints as needed to ensure that the indices at the anchor positions have a 0 high-order bit
+template <class Mode>
+void PartitionKernel<Mode>::swap_indices(Endpts endpts[REGIONS], int indices[Tile::TILE_H][Tile::TILE_W], int shapeindex)
+{
+	for (int region = 0; region < REGIONS; ++region)
+	{
+		int position = Mode::anchor(shapeindex, region);
+
+		int x = pos_to_x(position);
+		int y = pos_to_y(position);
+		nvAssert(Mode::region(x,y,shapeindex) == region);		// double check the table
+		if (indices[y][x] & HIGH_INDEXBIT)
+		{
+			// high bit is set, swap the endpts and indices for this region
+			int t;
+			for (int i=0; i<CHANNELS; ++i) { t = endpts[region].A[i]; endpts[region].A[i] = endpts[region].B[i]; endpts[region].B[i] = t; }
+			t = endpts[region].a_lsb; endpts[region].a_lsb = endpts[region].b_lsb; endpts[region].b_lsb = t;
+
+			for (int y = 0; y < Tile::TILE_H; y++)
+			for (int x = 0; x < Tile::TILE_W; x++)
+				if (Mode::region(x,y,shapeindex) == region)
+					indices[y][x] = NINDICES - 1 - indices[y][x];
+		}
+	}
+}
+
+template <class Mode>
+void PartitionKernel<Mode>::write_header(const Endpts endpts[REGIONS], int shapeindex, Bits &out)
+{
+	out.write(1 << Mode::MODE, Mode::MODE+1);
+	out.write(shapeindex, Mode::SHAPE_BITS);
+
+	for (int j=0; j<CHANNELS; ++j)
+		for (int i=0; i<REGIONS; ++i)
+		{
+			out.write(endpts[i].A[j], Mode::ENDPT_BITS);
+			out.write(endpts[i].B[j], Mode::ENDPT_BITS);
+		}
+
+	for (int i=0; i<REGIONS; ++i)
+	{
+		if (Mode::LSB == LSB_SHARED)
+			out.write(endpts[i].a_lsb, 1);
+		else if (Mode::LSB == LSB_UNIQUE)
+		{
+			out.write(endpts[i].a_lsb, 1);
+			out.write(endpts[i].b_lsb, 1);
+		}
+	}
+
+	nvAssert (out.getptr() == HEADERBITS);
+}
+
+template <class Mode>
+void PartitionKernel<Mode>::read_header(Bits &in, Endpts endpts[REGIONS], int &shapeindex)
+{
+	int mode = AVPCL::getmode(in);
+	nvAssert (mode == Mode::MODE && in.getptr() == Mode::MODE+1);
+
+	shapeindex = in.read(Mode::SHAPE_BITS);
+
+	for (int j=0; j<CHANNELS; ++j)
+		for (int i=0; i<REGIONS; ++i)
+		{
+			endpts[i].A[j] = in.read(Mode::ENDPT_BITS);
+			endpts[i].B[j] = in.read(Mode::ENDPT_BITS);
+		}
+
+	for (int i=0; i<REGIONS; ++i)
+	{
+		endpts[i].a_lsb = endpts[i].b_lsb = 0;
+		if (Mode::LSB == LSB_SHARED)
+			endpts[i].a_lsb = endpts[i].b_lsb = in.read(1);
+		else if (Mode::LSB == LSB_UNIQUE)
+		{
+			endpts[i].a_lsb = in.read(1);
+			endpts[i].b_lsb = in.read(1);
+		}
+	}
+
+	nvAssert (in.getptr() == HEADERBITS);
+}
+
+template <class Mode>
+void PartitionKernel<Mode>::write_indices(const int indices[Tile::TILE_H][Tile::TILE_W], int shapeindex, Bits &out)
+{
+	int positions[REGIONS];
+
+	for (int r = 0; r < REGIONS; ++r)
+		positions[r] = Mode::anchor(shapeindex, r);
+
+	for (int pos = 0; pos < Tile::TILE_TOTAL; ++pos)
+	{
+		int x = pos_to_x(pos);
+		int y = pos_to_y(pos);
+
+		bool match = false;
+
+		for (int r = 0; r < REGIONS; ++r)
+			if (positions[r] == pos) { match = true; break; }
+
+		out.write(indices[y][x], Mode::INDEX_BITS - (match ? 1 : 0));
+	}
+}
+
+template <class Mode>
+void PartitionKernel<Mode>::read_indices(Bits &in, int shapeindex, int indices[Tile::TILE_H][Tile::TILE_W])
+{
+	int positions[REGIONS];
+
+	for (int r = 0; r < REGIONS; ++r)
+		positions[r] = Mode::anchor(shapeindex, r);
+
+	for (int pos = 0; pos < Tile::TILE_TOTAL; ++pos)
+	{
+		int x = pos_to_x(pos);
+		int y = pos_to_y(pos);
+
+		bool match = false;
+
+		for (int r = 0; r < REGIONS; ++r)
+			if (positions[r] == pos) { match = true; break; }
+
+		indices[y][x]= in.read(Mode::INDEX_BITS - (match ? 1 : 0));
+	}
+}
+
+template <class Mode>
+void PartitionKernel<Mode>::emit_block(const Endpts endpts[REGIONS], int shapeindex, const int indices[Tile::TILE_H][Tile::TILE_W], char *block)
+{
+	Bits out(block, AVPCL::BITSIZE);
+
+	write_header(endpts, shapeindex, out);
+
+	write_indices(indices, shapeindex, out);
+
+	nvAssert(out.getptr() == AVPCL::BITSIZE);
+}
+
+template <class Mode>
+void PartitionKernel<Mode>::generate_palette_quantized(const Endpts &compr_endpts, nv::Vector4 palette[NINDICES])
+{
+	int A[CHANNELS], B[CHANNELS];
+
+	uncompress_one(compr_endpts, A, B);
+
+	// note: don't simplify to a + ((b-a)*i + BIAS)/DENOM as that doesn't work due to the way C handles integer division of negatives
+	for (int j = 0; j < CHANNELS; ++j)
+	{
+		int a = Utils::unquantize(A[j], PREC);
+		int b = Utils::unquantize(B[j], PREC);
+
+		// interpolate
+#if defined(USE_ZOH_INTERP) && defined(USE_ZOH_INTERP_ROUNDED)
+		const int *w = NINDICES == 4 ? lerp_weights2 : lerp_weights3;
+		for (int i = 0; i < NINDICES; ++i)
+			palette[i].component[j] = float((a*w[DENOM-i] + b*w[i] + 32) >> 6);
+#else
+		for (int i = 0; i < NINDICES; ++i)
+			palette[i].component[j] = float(Utils::lerp(a, b, i, BIAS, DENOM));
+#endif
+	}
+
+	// constant alpha
+	if (CHANNELS == NCHANNELS_RGB)
+	{
+		for (int i = 0; i < NINDICES; ++i)
+			palette[i].w = 255.0f;
+	}
+}
+
+template <class Mode>
+void PartitionKernel<Mode>::decompress(const char *block, Tile &t)
+{
+	Bits in(block, AVPCL::BITSIZE);
+
+	Endpts endpts[REGIONS];
+	int shapeindex;
+
+	read_header(in, endpts, shapeindex);
+
+	nv::Vector4 palette[REGIONS][NINDICES];
+	for (int r = 0; r < REGIONS; ++r)
+		generate_palette_quantized(endpts[r], &palette[r][0]);
+
+	int indices[Tile::TILE_H][Tile::TILE_W];
+
+	read_indices(in, shapeindex, indices);
+
+	nvAssert(in.getptr() == AVPCL::BITSIZE);
+
+	// lookup
+	for (int y = 0; y < Tile::TILE_H; y++)
+	for (int x = 0; x < Tile::TILE_W; x++)
+		t.data[y][x] = palette[Mode::region(x,y,shapeindex)][indices[y][x]];
+}
+
+// given a collection of colors and quantized endpoints, generate a palette, choose best entries, and return a single toterr
+template <class Mode>
+float PartitionKernel<Mode>::map_colors(const nv::Vector4 colors[], const float importance[], int np, const Endpts &endpts, float current_err, int indices[Tile::TILE_TOTAL], const Options &options)
+{
+	nv::Vector4 palette[NINDICES];
+	float toterr = 0;
+	const nv::Vector4 weights = Utils::metric4_weights(options);
+
+	generate_palette_quantized(endpts, palette);
+
+	for (int i = 0; i < np; ++i)
+	{
+		float besterr = FLT_MAX;
+
+		for (int j = 0; j < NINDICES && besterr > 0; ++j)
+		{
+			float err = metric(colors[i], palette[j], weights, importance[i], options);
+
+			if (err > besterr)	// error increased, so we're done searching
+				break;
+			if (err < besterr)
+			{
+				besterr = err;
+				indices[i] = j;
+			}
+		}
+		toterr += besterr;
+
+		// check for early exit
+		if (toterr > current_err)
+		{
+			// fill out bogus index values so it's initialized at least
+			for (int k = i; k < np; ++k)
+				indices[k] = -1;
+
+			return FLT_MAX;
+		}
+	}
+	return toterr;
+}
+
+// assign indices given a tile, shape, and quantized endpoints, return toterr for each region
+template <class Mode>
+void PartitionKernel<Mode>::assign_indices(const Tile &tile, int shapeindex, const Endpts endpts[REGIONS],
+										   int indices[Tile::TILE_H][Tile::TILE_W], float toterr[REGIONS], const Options &options)
+{
+	// build list of possibles
+	nv::Vector4 palette[REGIONS][NINDICES];
+
+	for (int region = 0; region < REGIONS; ++region)
+	{
+		generate_palette_quantized(endpts[region], &palette[region][0]);
+		toterr[region] = 0;
+	}
+
+	const nv::Vector4 weights = Utils::metric4_weights(options);
+
+	for (int y = 0; y < tile.size_y; y++)
+	for (int x = 0; x < tile.size_x; x++)
+	{
+		int region = Mode::region(x,y,shapeindex);
+		float err, besterr = FLT_MAX;
+
+		for (int i = 0; i < NINDICES && besterr > 0; ++i)
+		{
+			err = metric(tile.data[y][x], palette[region][i], weights, 1.0f, options);
+
+			if (err > besterr)	// error increased, so we're done searching
+				break;
+			if (err < besterr)
+			{
+				besterr = err;
+				indices[y][x] = i;
+			}
+		}
+		toterr[region] += besterr;
+	}
+}
+
+// note: indices are valid only if the value returned is less than old_err; otherwise they contain -1's
+// this function returns either old_err or a value smaller (if it was successful in improving the error)
+template <class Mode>
+float PartitionKernel<Mode>::perturb_one(const nv::Vector4 colors[], const float importance[], int np, int ch, const Endpts &old_endpts, Endpts &new_endpts,
+										 float old_err, int do_b, int indices[Tile::TILE_TOTAL], const Options &options)
+{
+	// we have the old endpoints: old_endpts
+	// we have the perturbed endpoints: new_endpts
+	// we have the temporary endpoints: temp_endpts
+
+	Endpts temp_endpts;
+	float min_err = old_err;		// start with the best current error
+	int beststep;
+	int temp_indices[Tile::TILE_TOTAL];
+
+	for (int i=0; i<np; ++i)
+		indices[i] = -1;
+
+	// copy real endpoints so we can perturb them
+	temp_endpts = new_endpts = old_endpts;
+
+	const int prec = Mode::ENDPT_BITS;
+
+	// do a logarithmic search for the best error for this endpoint (which)
+	for (int step = 1 << (prec-1); step; step >>= 1)
+	{
+		bool improved = false;
+		for (int sign = -1; sign <= 1; sign += 2)
+		{
+			if (do_b == 0)
+			{
+				temp_endpts.A[ch] = new_endpts.A[ch] + sign * step;
+				if (temp_endpts.A[ch] < 0 || temp_endpts.A[ch] >= (1 << prec))
+					continue;
+			}
+			else
+			{
+				temp_endpts.B[ch] = new_endpts.B[ch] + sign * step;
+				if (temp_endpts.B[ch] < 0 || temp_endpts.B[ch] >= (1 << prec))
+					continue;
+			}
+
+			float err = map_colors(colors, importance, np, temp_endpts, min_err, temp_indices, options);
+
+			if (err < min_err)
+			{
+				improved = true;
+				min_err = err;
+				beststep = sign * step;
+				for (int i=0; i<np; ++i)
+					indices[i] = temp_indices[i];
+			}
+		}
+		// if this was an improvement, move the endpoint and continue search from there
+		if (improved)
+		{
+			if (do_b == 0)
+				new_endpts.A[ch] += beststep;
+			else
+				new_endpts.B[ch] += beststep;
+		}
+	}
+	return min_err;
+}
+
+// the larger the error the more time it is worth spending on an exhaustive search.
+// perturb the endpoints at least -3 to 3.
+// if err > 5000 perturb endpoints 50% of precision
+// if err > 1000 25%
+// if err > 200 12.5%
+// if err > 40  6.25%
+// for np = 16 -- adjust error thresholds as a function of np
+// always ensure endpoint ordering is preserved (no need to overlap the scan)
+// if orig_err returned from this is less than its input value, then indices[] will contain valid indices
+template <class Mode>
+float PartitionKernel<Mode>::exhaustive(const nv::Vector4 colors[], const float importance[], int np, int ch, float orig_err, Endpts &opt_endpts, int indices[Tile::TILE_TOTAL], const Options &options)
+{
+	Endpts temp_endpts;
+	float best_err = orig_err;
+	const int aprec = Mode::ENDPT_BITS;
+	const int bprec = Mode::ENDPT_BITS;
+	int good_indices[Tile::TILE_TOTAL];
+	int temp_indices[Tile::TILE_TOTAL];
+
+	for (int i=0; i<np; ++i)
+		indices[i] = -1;
+
+	float thr_scale = (float)np / (float)Tile::TILE_TOTAL;
+
+	if (orig_err == 0) return orig_err;
+
+	int adelta = 0, bdelta = 0;
+	if (orig_err > 5000.0*thr_scale)		{ adelta = (1 << aprec)/2; bdelta = (1 << bprec)/2; }
+	else if (orig_err > 1000.0*thr_scale)	{ adelta = (1 << aprec)/4; bdelta = (1 << bprec)/4; }
+	else if (orig_err > 200.0*thr_scale)	{ adelta = (1 << aprec)/8; bdelta = (1 << bprec)/8; }
+	else if (orig_err > 40.0*thr_scale)		{ adelta = (1 << aprec)/16; bdelta = (1 << bprec)/16; }
+	adelta = nv::max(adelta, 3);
+	bdelta = nv::max(bdelta, 3);
+
+#ifdef	DISABLE_EXHAUSTIVE
+	adelta = bdelta = 3;
+#endif
+
+	temp_endpts = opt_endpts;
+
+	// ok figure out the range of A and B
+	int alow = nv::max(0, opt_endpts.A[ch] - adelta);
+	int ahigh = nv::min((1<<aprec)-1, opt_endpts.A[ch] + adelta);
+	int blow = nv::max(0, opt_endpts.B[ch] - bdelta);
+	int bhigh = nv::min((1<<bprec)-1, opt_endpts.B[ch] + bdelta);
+
+	int amin, bmin;
+
+	if (opt_endpts.A[ch] <= opt_endpts.B[ch])
+	{
+		// keep a <= b
+		for (int a = alow; a <= ahigh; ++a)
+		for (int b = nv::max(a, blow); b < bhigh; ++b)
+		{
+			temp_endpts.A[ch] = a;
+			temp_endpts.B[ch] = b;
+
+			float err = map_colors(colors, importance, np, temp_endpts, best_err, temp_indices, options);
+			if (err < best_err)
+			{
+				amin = a;
+				bmin = b;
+				best_err = err;
+				for (int i=0; i<np; ++i)
+					good_indices[i] = temp_indices[i];
+			}
+		}
+	}
+	else
+	{
+		// keep b <= a
+		for (int b = blow; b < bhigh; ++b)
+		for (int a = nv::max(b, alow); a <= ahigh; ++a)
+		{
+			temp_endpts.A[ch] = a;
+			temp_endpts.B[ch] = b;
+
+			float err = map_colors(colors, importance, np, temp_endpts, best_err, temp_indices, options);
+			if (err < best_err)
+			{
+				amin = a;
+				bmin = b;
+				best_err = err;
+				for (int i=0; i<np; ++i)
+					good_indices[i] = temp_indices[i];
+			}
+		}
+	}
+	if (best_err < orig_err)
+	{
+		opt_endpts.A[ch] = amin;
+		opt_endpts.B[ch] = bmin;
+		// if we actually improved, update the indices
+		for (int i=0; i<np; ++i)
+			indices[i] = good_indices[i];
+	}
+	return best_err;
+}
+
+template <class Mode>
+float PartitionKernel<Mode>::optimize_one(const nv::Vector4 colors[], const float importance[], int np, float orig_err, const Endpts &orig_endpts, Endpts &opt_endpts, const Options &options)
+{
+	float opt_err = orig_err;
+
+	opt_endpts = orig_endpts;
+
+	/*
+		err0 = perturb(rgb0, delta0)
+		err1 = perturb(rgb1, delta1)
+		if (err0 < err1)
+			if (err0 >= initial_error) break
+			rgb0 += delta0
+			next = 1
+		else
+			if (err1 >= initial_error) break
+			rgb1 += delta1
+			next = 0
+		initial_err = map()
+		for (;;)
+			err = perturb(next ? rgb1:rgb0, delta)
+			if (err >= initial_err) break
+			next? rgb1 : rgb0 += delta
+			initial_err = err
+	*/
+	Endpts new_a, new_b;
+	Endpts new_endpt;
+	int do_b;
+	int orig_indices[Tile::TILE_TOTAL];
+	int new_indices[Tile::TILE_TOTAL];
+	int temp_indices0[Tile::TILE_TOTAL];
+	int temp_indices1[Tile::TILE_TOTAL];
+
+	// now optimize each channel separately
+	// for the first error improvement, we save the indices. then, for any later improvement, we compare the indices
+	// if they differ, we restart the loop (which then falls back to looking for a first improvement.)
+	for (int ch = 0; ch < CHANNELS; ++ch)
+	{
+		// figure out which endpoint when perturbed gives the most improvement and start there
+		// if we just alternate, we can easily end up in a local minima
+		float err0 = perturb_one(colors, importance, np, ch, opt_endpts, new_a, opt_err, 0, temp_indices0, options);	// perturb endpt A
+		float err1 = perturb_one(colors, importance, np, ch, opt_endpts, new_b, opt_err, 1, temp_indices1, options);	// perturb endpt B
+
+		if (err0 < err1)
+		{
+			if (err0 >= opt_err)
+				continue;
+
+			for (int i=0; i<np; ++i)
+			{
+				new_indices[i] = orig_indices[i] = temp_indices0[i];
+				nvAssert (orig_indices[i] != -1);
+			}
+
+			opt_endpts.A[ch] = new_a.A[ch];
+			opt_err = err0;
+			do_b = 1;		// do B next
+		}
+		else
+		{
+			if (err1 >= opt_err)
+				continue;
+
+			for (int i=0; i<np; ++i)
+			{
+				new_indices[i] = orig_indices[i] = temp_indices1[i];
+				nvAssert (orig_indices[i] != -1);
+			}
+
+			opt_endpts.B[ch] = new_b.B[ch];
+			opt_err = err1;
+			do_b = 0;		// do A next
+		}
+
+		// now alternate endpoints and keep trying until there is no improvement
+		for (;;)
+		{
+			float err = perturb_one(colors, importance, np, ch, opt_endpts, new_endpt, opt_err, do_b, temp_indices0, options);
+			if (err >= opt_err)
+				break;
+
+			for (int i=0; i<np; ++i)
+			{
+				new_indices[i] = temp_indices0[i];
+				nvAssert (new_indices[i] != -1);
+			}
+
+			if (do_b == 0)
+				opt_endpts.A[ch] = new_endpt.A[ch];
+			else
+				opt_endpts.B[ch] = new_endpt.B[ch];
+			opt_err = err;
+			do_b = 1 - do_b;	// now move the other endpoint
+		}
+
+		// see if the indices have changed
+		int i;
+		for (i=0; i<np; ++i)
+			if (orig_indices[i] != new_indices[i])
+				break;
+
+		if (i<np)
+			ch = -1;	// start over
+	}
+
+	// finally, do a small exhaustive search around what we think is the global minima to be sure
+	// note this is independent of the above search, so we don't care about the indices from the above
+	// we don't care about the above because if they differ, so what? we've already started at ch=0
+	bool first = true;
+	for (int ch = 0; ch < CHANNELS; ++ch)
+	{
+		float new_err = exhaustive(colors, importance, np, ch, opt_err, opt_endpts, temp_indices0, options);
+
+		if (new_err < opt_err)
+		{
+			opt_err = new_err;
+
+			if (first)
+			{
+				for (int i=0; i<np; ++i)
+				{
+					orig_indices[i] = temp_indices0[i];
+					nvAssert (orig_indices[i] != -1);
+				}
+				first = false;
+			}
+			else
+			{
+				// see if the indices have changed
+				int i;
+				for (i=0; i<np; ++i)
+					if (orig_indices[i] != temp_indices0[i])
+						break;
+
+				if (i<np)
+				{
+					ch = -1;	// start over
+					first = true;
+				}
+			}
+		}
+	}
+
+	return opt_err;
+}
+
+// this will return a valid set of endpoints in opt_endpts regardless of whether it improve orig_endpts or not
+template <class Mode>
+void PartitionKernel<Mode>::optimize_endpts(const Tile &tile, int shapeindex, const float orig_err[REGIONS],
+											const Endpts orig_endpts[REGIONS], float opt_err[REGIONS], Endpts opt_endpts[REGIONS], const Options &options)
+{
+	nv::Vector4 pixels[Tile::TILE_TOTAL];
+	float importance[Tile::TILE_TOTAL];
+	Endpts temp_in, temp_out;
+	int temp_indices[Tile::TILE_TOTAL];
+
+	for (int region=0; region<REGIONS; ++region)
+	{
+		// collect the pixels in the region
+		int np = 0;
+
+		for (int y = 0; y < tile.size_y; y++)
+		for (int x = 0; x < tile.size_x; x++)
+			if (Mode::region(x, y, shapeindex) == region)
+			{
+				pixels[np] = tile.data[y][x];
+				importance[np] = tile.importance_map[y][x];
+				np++;
+			}
+
+		opt_endpts[region] = temp_in = orig_endpts[region];
+		opt_err[region] = orig_err[region];
+
+		float best_err = orig_err[region];
+
+		// try all lsb modes as we search for better endpoints
+		for (int lsbmode=0; lsbmode<NLSBMODES; ++lsbmode)
+		{
+			float temp_in_err;
+
+			if (Mode::LSB == LSB_NONE)
+			{
+				// we didn't change temp_in, so orig_err[region] is still valid
+				temp_in_err = orig_err[region];
+			}
+			else
+			{
+				temp_in.a_lsb = lsbmode & 1;
+				temp_in.b_lsb = Mode::LSB == LSB_SHARED ? lsbmode : (lsbmode >> 1) & 1;
+
+				// make sure we have a valid error for temp_in
+				// we use FLT_MAX here because we want an accurate temp_in_err, no shortcuts
+				// (mapcolors will compute a mapping but will stop if the error exceeds the value passed in the FLT_MAX position)
+				temp_in_err = map_colors(pixels, importance, np, temp_in, FLT_MAX, temp_indices, options);
+			}
+
+			// now try to optimize these endpoints
+			float temp_out_err = optimize_one(pixels, importance, np, temp_in_err, temp_in, temp_out, options);
+
+			// if we find an improvement, update the best so far and correct the output endpoints and errors
+			if (temp_out_err < best_err)
+			{
+				best_err = temp_out_err;
+				opt_err[region] = temp_out_err;
+				opt_endpts[region] = temp_out;
+			}
+		}
+	}
+}
+
+/* optimization algorithm
+	convert endpoints using the mode's precision
+	assign indices and get initial error
+	compress indices (and possibly reorder endpoints)
+	optimize endpoints, get new endpoints, new indices, and new error // new error will almost always be better
+	compress new indices
+	if error is improved
+		emit compressed block with new data
+	else
+		emit compressed block with original data // to try to preserve maximum endpoint precision
+*/
+template <class Mode>
+float PartitionKernel<Mode>::refine(const Tile &tile, int shapeindex_best, const FltEndpts endpts[REGIONS], const Options &options, char *block)
+{
+	float orig_err[REGIONS], opt_err[REGIONS], orig_toterr, opt_toterr, expected_opt_err[REGIONS];
+	Endpts orig_endpts[REGIONS], opt_endpts[REGIONS];
+	int orig_indices[Tile::TILE_H][Tile::TILE_W], opt_indices[Tile::TILE_H][Tile::TILE_W];
+
+	quantize_endpts(endpts, orig_endpts);
+	assign_indices(tile, shapeindex_best, orig_endpts, orig_indices, orig_err, options);
+	swap_indices(orig_endpts, orig_indices, shapeindex_best);
+
+	optimize_endpts(tile, shapeindex_best, orig_err, orig_endpts, expected_opt_err, opt_endpts, options);
+	assign_indices(tile, shapeindex_best, opt_endpts, opt_indices, opt_err, options);
+	swap_indices(opt_endpts, opt_indices, shapeindex_best);
+
+	orig_toterr = opt_toterr = 0;
+	for (int i=0; i < REGIONS; ++i) { orig_toterr += orig_err[i]; opt_toterr += opt_err[i]; }
+	if (opt_toterr < orig_toterr)
+	{
+		emit_block(opt_endpts, shapeindex_best, opt_indices, block);
+		return opt_toterr;
+	}
+	else
+	{
+		// there was no improvement, so go back to the unoptimized endpoints
+		emit_block(orig_endpts, shapeindex_best, orig_indices, block);
+		return orig_toterr;
+	}
+}
+
+template <class Mode>
+void PartitionKernel<Mode>::clamp(nv::Vector4 &v)
+{
+	if (v.x < 0.0f) v.x = 0.0f;
+	if (v.x > 255.0f) v.x = 255.0f;
+	if (v.y < 0.0f) v.y = 0.0f;
+	if (v.y > 255.0f) v.y = 255.0f;
+	if (v.z < 0.0f) v.z = 0.0f;
+	if (v.z > 255.0f) v.z = 255.0f;
+	if (CHANNELS == NCHANNELS_RGB)
+		v.w = 255.0f;
+	else
+	{
+		if (v.w < 0.0f) v.w = 0.0f;
+		if (v.w > 255.0f) v.w = 255.0f;
+	}
+}
+
+// generate a palette from unquantized endpoints, then pick best palette color for all pixels in each region, return toterr for all regions combined
+template <class Mode>
+float PartitionKernel<Mode>::map_colors(const Tile &tile, int shapeindex, const FltEndpts endpts[REGIONS], const Options &options)
+{
+	// build list of possibles
+	nv::Vector4 palette[REGIONS][NINDICES];
+
+	for (int region = 0; region < REGIONS; ++region)
+	for (int i = 0; i < NINDICES; ++i)
+		palette[region][i] = Utils::lerp(endpts[region].A, endpts[region].B, i, 0, DENOM);
+
+	float toterr = 0;
+	const nv::Vector4 weights = Utils::metric4_weights(options);
+
+	for (int y = 0; y < tile.size_y; y++)
+	for (int x = 0; x < tile.size_x; x++)
+	{
+		int region = Mode::region(x,y,shapeindex);
+		float besterr = FLT_MAX;
+
+		for (int i = 0; i < NINDICES && besterr > 0; ++i)
+		{
+			float err = importance_error((tile.data[y][x] - palette[region][i]) * weights, tile.importance_map[y][x]);
+
+			if (err > besterr)	// error increased, so we're done searching. this works for most norms.
+				break;
+			if (err < besterr)
+				besterr = err;
+		}
+		toterr += besterr;
+	}
+	return toterr;
+}
+
+// fit each region with a line along its principal direction. the RGB modes ignore alpha, it's constant in the block.
+template <class Mode>
+float PartitionKernel<Mode>::rough(const Tile &tile, int shapeindex, FltEndpts endpts[REGIONS], const Options &options)
+{
+	for (int region=0; region<REGIONS; ++region)
+	{
+		int np = 0;
+		nv::Vector4 colors[Tile::TILE_TOTAL];
+		nv::Vector3 colors3[Tile::TILE_TOTAL];
+		nv::Vector4 mean(0,0,0,0);
+
+		for (int y = 0; y < tile.size_y; y++)
+		for (int x = 0; x < tile.size_x; x++)
+			if (Mode::region(x,y,shapeindex) == region)
+			{
+				colors[np] = tile.data[y][x];
+				colors3[np] = tile.data[y][x].xyz();
+				mean += tile.data[y][x];
+				++np;
+			}
+
+		// handle simple cases
+		if (np == 0)
+		{
+			nv::Vector4 zero(0,0,0,255.0f);
+			endpts[region].A = zero;
+			endpts[region].B = zero;
+			continue;
+		}
+		else if (np == 1)
+		{
+			endpts[region].A = colors[0];
+			endpts[region].B = colors[0];
+			continue;
+		}
+		else if (np == 2)
+		{
+			endpts[region].A = colors[0];
+			endpts[region].B = colors[1];
+			continue;
+		}
+
+		mean /= float(np);
+
+		nv::Vector4 direction;
+		if (CHANNELS == NCHANNELS_RGB)
+			direction = nv::Vector4(nv::Fit::computePrincipalComponent_EigenSolver(np, colors3), 0);
+		else
+			direction = nv::Fit::computePrincipalComponent_EigenSolver(np, colors);
+
+		// project each pixel value along the principal direction
+		float minp = FLT_MAX, maxp = -FLT_MAX;
+		for (int i = 0; i < np; i++)
+		{
+			float dp = dot(colors[i]-mean, direction);
+			if (dp < minp) minp = dp;
+			if (dp > maxp) maxp = dp;
+		}
+
+		// choose as endpoints 2 points along the principal direction that span the projections of all of the pixel values
+		endpts[region].A = mean + minp*direction;
+		endpts[region].B = mean + maxp*direction;
+
+		// clamp endpoints
+		// the argument for clamping is that the actual endpoints need to be clamped and thus we need to choose the best
+		// shape based on endpoints being clamped
+		clamp(endpts[region].A);
+		clamp(endpts[region].B);
+	}
+
+	return map_colors(tile, shapeindex, endpts, options);
+}
+
+template <class Mode>
+float PartitionKernel<Mode>::refine_item(void *context, int item, char *block)
+{
+	const RefineContext *c = (const RefineContext *)context;
+	int shape = c->index[item];
+	return refine(*c->tile, shape, &c->all[shape].endpts[0], *c->options, block);
+}
+
+template <class Mode>
+float PartitionKernel<Mode>::compress(const Tile &t, const Options &options, char *block)
+{
+	// number of rough cases to look at. reasonable values of this are 1, SHAPES/4, and SHAPES
+	// SHAPES/4 gets nearly all the cases; you can increase that a bit (say by 3 or 4) if you really want to squeeze the last bit out
+	const int NITEMS=refine_count(options, Mode::SHAPES);
+	const int NROUGH=rough_count(options, Mode::SHAPES);
+
+	// pick the best NITEMS shapes and refine these.
+	ShapeEndpts all[Mode::SHAPES];
+	float roughmse[Mode::SHAPES];
+	int index[Mode::SHAPES];
+
+	// only rough fit the NROUGH shapes that look best
+	Utils::rank_shapes(t, Mode::shape_table(), Mode::SHAPES, REGIONS, CHANNELS == NCHANNELS_RGBA, NROUGH, index);
+
+	for (int i=0; i<NROUGH; ++i)
+	{
+		int shape = index[i];
+		roughmse[i] = rough(t, shape, &all[shape].endpts[0], options);
+	}
+
+	// bubble sort -- only need to bubble up the first NITEMS items
+	for (int i=0; i<NITEMS; ++i)
+	for (int j=i+1; j<NROUGH; ++j)
+		if (roughmse[i] > roughmse[j])
+		{
+			float tmse = roughmse[i]; roughmse[i] = roughmse[j]; roughmse[j] = tmse;
+			int tindex = index[i]; index[i] = index[j]; index[j] = tindex;
+		}
+
+	RefineContext context = { &t, index, all, &options };
+	return refine_items(options, NITEMS, refine_item, &context, block);
+}
+
+}
+
+#endif
@@ -25,6 +25,11 @@ See the License for the specific language governing permissions and limitations
 #include "endpts.h"
 #include <cstring>
 #include <float.h>
+#include <math.h>
+
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
 
 using namespace nv;
 using namespace AVPCL;
@@ -390,11 +395,11 @@ void AVPCL::decompress_mode6(const char *block, Tile &t)
 }
 
 // given a collection of colors and quantized endpoints, generate a palette, choose best entries, and return a single toterr
-static float map_colors(const Vector4 colors[], const float importance[], int np, const IntEndptsRGBA_2 &endpts, const RegionPrec &region_prec, float current_err, int indices[Tile::TILE_TOTAL])
+static float map_colors(const Vector4 colors[], const float importance[], int np, const IntEndptsRGBA_2 &endpts, const RegionPrec &region_prec, float current_err, int indices[Tile::TILE_TOTAL], const Options &options)
 {
 	Vector4 palette[NINDICES];
 	float toterr = 0;
-	Vector4 err;
+	const Vector4 weights = Utils::metric4_weights(options);
 
 	generate_palette_quantized(endpts, region_prec, palette);
 
@@ -404,8 +409,14 @@ static float map_colors(const Vector4 colors[], const float importance[], int np
 
 		for (int j = 0; j < NINDICES && besterr > 0; ++j)
 		{
-			err = !AVPCL::flag_premult ? Utils::metric4(colors[i], palette[j]) :
-									     Utils::metric4premult(colors[i], palette[j]) ;
+			// the importance only weighs the color error, the alpha of unimportant pixels still has to fit
+			if (options.premult)
+				err = Utils::metric4premult(colors[i], palette[j], options) * importance[i];
+			else
+			{
+				Vector4 e = (colors[i] - palette[j]) * weights;
+				err = importance[i] * (e.x * e.x + e.y * e.y + e.z * e.z) + e.w * e.w;
+			}
 
 			if (err > besterr)	// error increased, so we're done searching
 				break;
@@ -432,7 +443,7 @@ static float map_colors(const Vector4 colors[], const float importance[], int np
 
 // assign indices given a tile, shape, and quantized endpoints, return toterr for each region
 static void assign_indices(const Tile &tile, int shapeindex, IntEndptsRGBA_2 endpts[NREGIONS], const PatternPrec &pattern_prec, 
-						   int indices[Tile::TILE_H][Tile::TILE_W], float toterr[NREGIONS])
+						   int indices[Tile::TILE_H][Tile::TILE_W], float toterr[NREGIONS], const Options &options)
 {
 	// build list of possibles
 	Vector4 palette[NREGIONS][NINDICES];
@@ -453,8 +464,8 @@ static void assign_indices(const Tile &tile, int shapeindex, IntEndptsRGBA_2 end
 
 		for (int i = 0; i < NINDICES && besterr > 0; ++i)
 		{
-			err = !AVPCL::flag_premult ? Utils::metric4(tile.data[y][x], palette[region][i]) :
-										 Utils::metric4premult(tile.data[y][x], palette[region][i]) ;
+			err = !options.premult ? Utils::metric4(tile.data[y][x], palette[region][i], options) :
+										 Utils::metric4premult(tile.data[y][x], palette[region][i], options) ;
 
 			if (err > besterr)	// error increased, so we're done searching
 				break;
@@ -471,7 +482,7 @@ static void assign_indices(const Tile &tile, int shapeindex, IntEndptsRGBA_2 end
 // note: indices are valid only if the value returned is less than old_err; otherwise they contain -1's
 // this function returns either old_err or a value smaller (if it was successful in improving the error)
 static float perturb_one(const Vector4 colors[], const float importance[], int np, int ch, const RegionPrec &region_prec, const IntEndptsRGBA_2 &old_endpts, IntEndptsRGBA_2 &new_endpts,
-						  float old_err, int do_b, int indices[Tile::TILE_TOTAL])
+						  float old_err, int do_b, int indices[Tile::TILE_TOTAL], const Options &options)
 {
 	// we have the old endpoints: old_endpts
 	// we have the perturbed endpoints: new_endpts
@@ -509,7 +520,7 @@ static float perturb_one(const Vector4 colors[], const float importance[], int n
 					continue;
 			}
 
-            float err = map_colors(colors, importance, np, temp_endpts, region_prec, min_err, temp_indices);
+            float err = map_colors(colors, importance, np, temp_endpts, region_prec, min_err, temp_indices, options);
 
 			if (err < min_err)
 			{
@@ -541,7 +552,7 @@ static float perturb_one(const Vector4 colors[], const float importance[], int n
 // for np = 16 -- adjust error thresholds as a function of np
 // always ensure endpoint ordering is preserved (no need to overlap the scan)
 // if orig_err returned from this is less than its input value, then indices[] will contain valid indices
-static float exhaustive(const Vector4 colors[], const float importance[], int np, int ch, const RegionPrec &region_prec, float orig_err, IntEndptsRGBA_2 &opt_endpts, int indices[Tile::TILE_TOTAL])
+static float exhaustive(const Vector4 colors[], const float importance[], int np, int ch, const RegionPrec &region_prec, float orig_err, IntEndptsRGBA_2 &opt_endpts, int indices[Tile::TILE_TOTAL], const Options &options)
 {
 	IntEndptsRGBA_2 temp_endpts;
 	float best_err = orig_err;
@@ -591,7 +602,7 @@ static float exhaustive(const Vector4 colors[], const float importance[], int np
 			temp_endpts.A[ch] = a;
 			temp_endpts.B[ch] = b;
 		
-            float err = map_colors(colors, importance, np, temp_endpts, region_prec, best_err, temp_indices);
+            float err = map_colors(colors, importance, np, temp_endpts, region_prec, best_err, temp_indices, options);
 			if (err < best_err) 
 			{ 
 				amin = a; 
@@ -611,7 +622,7 @@ static float exhaustive(const Vector4 colors[], const float importance[], int np
 			temp_endpts.A[ch] = a;
 			temp_endpts.B[ch] = b;
 		
-            float err = map_colors(colors, importance, np, temp_endpts, region_prec, best_err, temp_indices);
+            float err = map_colors(colors, importance, np, temp_endpts, region_prec, best_err, temp_indices, options);
 			if (err < best_err) 
 			{ 
 				amin = a; 
@@ -634,7 +645,7 @@ static float exhaustive(const Vector4 colors[], const float importance[], int np
 	return best_err;
 }
 
-static float optimize_one(const Vector4 colors[], const float importance[], int np, float orig_err, const IntEndptsRGBA_2 &orig_endpts, const RegionPrec &region_prec, IntEndptsRGBA_2 &opt_endpts)
+static float optimize_one(const Vector4 colors[], const float importance[], int np, float orig_err, const IntEndptsRGBA_2 &orig_endpts, const RegionPrec &region_prec, IntEndptsRGBA_2 &opt_endpts, const Options &options)
 {
 	float opt_err = orig_err;
 
@@ -673,8 +684,8 @@ static float optimize_one(const Vector4 colors[], const float importance[], int
 	{
 		// figure out which endpoint when perturbed gives the most improvement and start there
 		// if we just alternate, we can easily end up in a local minima
-        float err0 = perturb_one(colors, importance, np, ch, region_prec, opt_endpts, new_a, opt_err, 0, temp_indices0);	// perturb endpt A
-        float err1 = perturb_one(colors, importance, np, ch, region_prec, opt_endpts, new_b, opt_err, 1, temp_indices1);	// perturb endpt B
+        float err0 = perturb_one(colors, importance, np, ch, region_prec, opt_endpts, new_a, opt_err, 0, temp_indices0, options);	// perturb endpt A
+        float err1 = perturb_one(colors, importance, np, ch, region_prec, opt_endpts, new_b, opt_err, 1, temp_indices1, options);	// perturb endpt B
 
 		if (err0 < err1)
 		{
@@ -710,7 +721,7 @@ static float optimize_one(const Vector4 colors[], const float importance[], int
 		// now alternate endpoints and keep trying until there is no improvement
 		for (;;)
 		{
-            float err = perturb_one(colors, importance, np, ch, region_prec, opt_endpts, new_endpt, opt_err, do_b, temp_indices0);
+            float err = perturb_one(colors, importance, np, ch, region_prec, opt_endpts, new_endpt, opt_err, do_b, temp_indices0, options);
 			if (err >= opt_err)
 				break;
 
@@ -744,7 +755,7 @@ static float optimize_one(const Vector4 colors[], const float importance[], int
 	bool first = true;
 	for (int ch = 0; ch < NCHANNELS_RGBA; ++ch)
 	{
-        float new_err = exhaustive(colors, importance, np, ch, region_prec, opt_err, opt_endpts, temp_indices0);
+        float new_err = exhaustive(colors, importance, np, ch, region_prec, opt_err, opt_endpts, temp_indices0, options);
 
 		if (new_err < opt_err)
 		{
@@ -780,7 +791,7 @@ static float optimize_one(const Vector4 colors[], const float importance[], int
 }
 
 static void optimize_endpts(const Tile &tile, int shapeindex, const float orig_err[NREGIONS], 
-							IntEndptsRGBA_2 orig_endpts[NREGIONS], const PatternPrec &pattern_prec, float opt_err[NREGIONS], IntEndptsRGBA_2 opt_endpts[NREGIONS])
+							IntEndptsRGBA_2 orig_endpts[NREGIONS], const PatternPrec &pattern_prec, float opt_err[NREGIONS], IntEndptsRGBA_2 opt_endpts[NREGIONS], const Options &options)
 {
 	Vector4 pixels[Tile::TILE_TOTAL];
     float importance[Tile::TILE_TOTAL];
@@ -816,10 +827,10 @@ static void optimize_endpts(const Tile &tile, int shapeindex, const float orig_e
 			// make sure we have a valid error for temp_in
 			// we use FLT_MAX here because we want an accurate temp_in_err, no shortcuts
 			// (mapcolors will compute a mapping but will stop if the error exceeds the value passed in the FLT_MAX position)
-            float temp_in_err = map_colors(pixels, importance, np, temp_in, pattern_prec.region_precs[region], FLT_MAX, temp_indices);
+            float temp_in_err = map_colors(pixels, importance, np, temp_in, pattern_prec.region_precs[region], FLT_MAX, temp_indices, options);
 
 			// now try to optimize these endpoints
-            float temp_out_err = optimize_one(pixels, importance, np, temp_in_err, temp_in, pattern_prec.region_precs[region], temp_out);
+            float temp_out_err = optimize_one(pixels, importance, np, temp_in_err, temp_in, pattern_prec.region_precs[region], temp_out, options);
 
 			// if we find an improvement, update the best so far and correct the output endpoints and errors
 			if (temp_out_err < best_err)
@@ -851,7 +862,7 @@ static void optimize_endpts(const Tile &tile, int shapeindex, const float orig_e
      simplify the above given that there is no transform now and that endpoints will always fit
 */
 
-static float refine(const Tile &tile, int shapeindex_best, const FltEndpts endpts[NREGIONS], char *block)
+static float refine(const Tile &tile, int shapeindex_best, const FltEndpts endpts[NREGIONS], const Options &options, char *block)
 {
 	float orig_err[NREGIONS], opt_err[NREGIONS], orig_toterr, opt_toterr, expected_opt_err[NREGIONS];
 	IntEndptsRGBA_2 orig_endpts[NREGIONS], opt_endpts[NREGIONS];
@@ -860,12 +871,12 @@ static float refine(const Tile &tile, int shapeindex_best, const FltEndpts endpt
 	for (int sp = 0; sp < NPATTERNS; ++sp)
 	{
 		quantize_endpts(endpts, pattern_precs[sp], orig_endpts);
-		assign_indices(tile, shapeindex_best, orig_endpts, pattern_precs[sp], orig_indices, orig_err);
+		assign_indices(tile, shapeindex_best, orig_endpts, pattern_precs[sp], orig_indices, orig_err, options);
 		swap_indices(orig_endpts, orig_indices, shapeindex_best);
 
-		optimize_endpts(tile, shapeindex_best, orig_err, orig_endpts, pattern_precs[sp], expected_opt_err, opt_endpts);
+		optimize_endpts(tile, shapeindex_best, orig_err, orig_endpts, pattern_precs[sp], expected_opt_err, opt_endpts, options);
 
-		assign_indices(tile, shapeindex_best, opt_endpts, pattern_precs[sp], opt_indices, opt_err);
+		assign_indices(tile, shapeindex_best, opt_endpts, pattern_precs[sp], opt_indices, opt_err, options);
 		// (nreed) Commented out asserts because they go off all the time...not sure why
 		//for (int i=0; i<NREGIONS; ++i)
 		//	nvAssert(expected_opt_err[i] == opt_err[i]);
@@ -910,7 +921,7 @@ static void generate_palette_unquantized(const FltEndpts endpts[NREGIONS], Vecto
 }
 
 // generate a palette from unquantized endpoints, then pick best palette color for all pixels in each region, return toterr for all regions combined
-static float map_colors(const Tile &tile, int shapeindex, const FltEndpts endpts[NREGIONS])
+static float map_colors(const Tile &tile, int shapeindex, const FltEndpts endpts[NREGIONS], const Options &options)
 {
 	// build list of possibles
 	Vector4 palette[NREGIONS][NINDICES];
@@ -926,11 +937,11 @@ static float map_colors(const Tile &tile, int shapeindex, const FltEndpts endpts
 		int region = REGION(x,y,shapeindex);
 		float err, besterr;
 
-		besterr = Utils::metric4(tile.data[y][x], palette[region][0]);
+		besterr = Utils::metric4(tile.data[y][x], palette[region][0], options);
 
 		for (int i = 1; i < NINDICES && besterr > 0; ++i)
 		{
-			err = Utils::metric4(tile.data[y][x], palette[region][i]);
+			err = Utils::metric4(tile.data[y][x], palette[region][i], options);
 
 			if (err > besterr)	// error increased, so we're done searching. this works for most norms.
 				break;
@@ -942,7 +953,7 @@ static float map_colors(const Tile &tile, int shapeindex, const FltEndpts endpts
 	return toterr;
 }
 
-static float rough(const Tile &tile, int shapeindex, FltEndpts endpts[NREGIONS])
+static float rough(const Tile &tile, int shapeindex, FltEndpts endpts[NREGIONS], const Options &options)
 {
 	for (int region=0; region<NREGIONS; ++region)
 	{
@@ -1004,7 +1015,7 @@ static float rough(const Tile &tile, int shapeindex, FltEndpts endpts[NREGIONS])
 		clamp(endpts[region].B);
 	}
 
-	return map_colors(tile, shapeindex, endpts);
+	return map_colors(tile, shapeindex, endpts, options);
 }
 
 static void swap(float *list1, int *list2, int i, int j)
@@ -1013,7 +1024,7 @@ static void swap(float *list1, int *list2, int i, int j)
 	int t1 = list2[i]; list2[i] = list2[j]; list2[j] = t1;
 }
 
-float AVPCL::compress_mode6(const Tile &t, char *block)
+float AVPCL::compress_mode6(const Tile &t, const Options &options, char *block)
 {
 	// number of rough cases to look at. reasonable values of this are 1, NSHAPES/4, and NSHAPES
 	// NSHAPES/4 gets nearly all the cases; you can increase that a bit (say by 3 or 4) if you really want to squeeze the last bit out
@@ -1030,7 +1041,7 @@ float AVPCL::compress_mode6(const Tile &t, char *block)
 
 	for (int i=0; i<NSHAPES; ++i)
 	{
-		roughmse[i] = rough(t, i, &all[i].endpts[0]);
+		roughmse[i] = rough(t, i, &all[i].endpts[0], options);
 		index[i] = i;
 	}
 
@@ -1043,7 +1054,7 @@ float AVPCL::compress_mode6(const Tile &t, char *block)
 	for (int i=0; i<NITEMS && msebest>0; ++i)
 	{
 		int shape = index[i];
-		float mse = refine(t, shape, &all[shape].endpts[0], tempblock);
+		float mse = refine(t, shape, &all[shape].endpts[0], options, tempblock);
 		if (mse < msebest)
 		{
 			memcpy(block, tempblock, sizeof(tempblock));
@@ -1053,3 +1064,247 @@ float AVPCL::compress_mode6(const Tile &t, char *block)
 	return msebest;
 }
 
+// single pass mode 6 encoder, for previews and other uses where the search of compress_mode6 is too slow:
+// fit the principal axis of the pixels, refine the endpoints by least squares, pick the best p-bit of each endpoint
+// and project the pixels onto the quantized endpoints to get their indices. the premultiplied metric and the channel weights are ignored.
+
+static const int weights6[NINDICES] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// index whose weight is the nearest to a projection scaled to [0, 64]
+static const int nearest_index[65] =
+{
+	 0,  0,  0,  1,  1,  1,  1,  2,  2,  2,  2,  2,  3,  3,  3,  3,
+	 4,  4,  4,  4,  5,  5,  5,  5,  6,  6,  6,  6,  6,  7,  7,  7,
+	 7,  8,  8,  8,  8,  9,  9,  9,  9, 10, 10, 10, 10, 10, 11, 11,
+	11, 11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 14, 15,
+	15,
+};
+
+// project the pixels, planar in px, onto the segment from e0 to e1 and return the nearest index of each
+static void project_indices(const float px[NCHANNELS_RGBA][Tile::TILE_TOTAL], const float e0[NCHANNELS_RGBA], const float e1[NCHANNELS_RGBA], int indices[Tile::TILE_TOTAL])
+{
+	float d[NCHANNELS_RGBA], dd = 0;
+	for (int ch=0; ch<NCHANNELS_RGBA; ++ch) { d[ch] = e1[ch] - e0[ch]; dd += d[ch] * d[ch]; }
+
+	if (dd == 0)
+	{
+		for (int i=0; i<Tile::TILE_TOTAL; ++i) indices[i] = 0;
+		return;
+	}
+
+	float scale = 64.0f / dd;
+	for (int ch=0; ch<NCHANNELS_RGBA; ++ch) d[ch] *= scale;
+
+#if NV_USE_SSE > 1
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 top = _mm_set1_ps(64.0f);
+	for (int i=0; i<Tile::TILE_TOTAL; i+=4)
+	{
+		__m128 s = zero;
+		for (int ch=0; ch<NCHANNELS_RGBA; ++ch)
+			s = _mm_add_ps(s, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&px[ch][i]), _mm_set1_ps(e0[ch])), _mm_set1_ps(d[ch])));
+		s = _mm_min_ps(_mm_max_ps(s, zero), top);
+
+		int si[4];
+		_mm_storeu_si128((__m128i *)si, _mm_cvtps_epi32(s));
+		for (int j=0; j<4; ++j) indices[i+j] = nearest_index[si[j]];
+	}
+#else
+	for (int i=0; i<Tile::TILE_TOTAL; ++i)
+	{
+		float s = 0;
+		for (int ch=0; ch<NCHANNELS_RGBA; ++ch) s += (px[ch][i] - e0[ch]) * d[ch];
+		s = s < 0 ? 0 : (s > 64 ? 64 : s);
+		indices[i] = nearest_index[int(s + 0.5f)];
+	}
+#endif
+}
+
+// weighted squared error of the pixels decoded with the given endpoints and indices
+static float indices_error(const float px[NCHANNELS_RGBA][Tile::TILE_TOTAL], const float w[Tile::TILE_TOTAL], const int a[NCHANNELS_RGBA], const int b[NCHANNELS_RGBA], const int indices[Tile::TILE_TOTAL])
+{
+	float palette[NINDICES][NCHANNELS_RGBA];
+	for (int i=0; i<NINDICES; ++i)
+	for (int ch=0; ch<NCHANNELS_RGBA; ++ch)
+		palette[i][ch] = float((a[ch] * (64 - weights6[i]) + b[ch] * weights6[i] + 32) >> 6);
+
+	float err = 0;
+	for (int i=0; i<Tile::TILE_TOTAL; ++i)
+	{
+		float e = 0;
+		for (int ch=0; ch<NCHANNELS_RGBA; ++ch)
+		{
+			float diff = px[ch][i] - palette[indices[i]][ch];
+			e += diff * diff;
+		}
+		err += w[i] * e;
+	}
+	return err;
+}
+
+// quantize an endpoint to 7 bits per channel plus the p-bit that fits it best
+static void quantize_endpoint(const float e[NCHANNELS_RGBA], int q[NCHANNELS_RGBA], int &lsb)
+{
+	float besterr = FLT_MAX;
+	for (int p=0; p<2; ++p)
+	{
+		int t[NCHANNELS_RGBA];
+		float err = 0;
+		for (int ch=0; ch<NCHANNELS_RGBA; ++ch)
+		{
+			int v = int(floorf((e[ch] - p) * 0.5f + 0.5f));
+			t[ch] = v < 0 ? 0 : (v > 127 ? 127 : v);
+			float diff = float(2 * t[ch] + p) - e[ch];
+			err += diff * diff;
+		}
+		if (err < besterr)
+		{
+			besterr = err;
+			lsb = p;
+			for (int ch=0; ch<NCHANNELS_RGBA; ++ch) q[ch] = t[ch];
+		}
+	}
+}
+
+// quantize both endpoints, assign the indices and return the error
+static float quantize_and_map(const float px[NCHANNELS_RGBA][Tile::TILE_TOTAL], const float w[Tile::TILE_TOTAL], const float e0[NCHANNELS_RGBA], const float e1[NCHANNELS_RGBA], IntEndptsRGBA_2 &endpts, int indices[Tile::TILE_TOTAL])
+{
+	quantize_endpoint(e0, endpts.A, endpts.a_lsb);
+	quantize_endpoint(e1, endpts.B, endpts.b_lsb);
+
+	int a[NCHANNELS_RGBA], b[NCHANNELS_RGBA];
+	float qa[NCHANNELS_RGBA], qb[NCHANNELS_RGBA];
+	for (int ch=0; ch<NCHANNELS_RGBA; ++ch)
+	{
+		a[ch] = 2 * endpts.A[ch] + endpts.a_lsb;
+		b[ch] = 2 * endpts.B[ch] + endpts.b_lsb;
+		qa[ch] = float(a[ch]);
+		qb[ch] = float(b[ch]);
+	}
+
+	project_indices(px, qa, qb, indices);
+	return indices_error(px, w, a, b, indices);
+}
+
+static inline float clamp255(float v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+float AVPCL::compress_mode6_fast(const Tile &t, const Options &options, char *block)
+{
+	// planar pixels, the ones outside the tile have no weight
+	float px[NCHANNELS_RGBA][Tile::TILE_TOTAL], w[Tile::TILE_TOTAL];
+	float wsum = 0, mean[NCHANNELS_RGBA] = { 0, 0, 0, 0 };
+	for (int i=0; i<Tile::TILE_TOTAL; ++i)
+	{
+		int x = i & 3, y = i >> 2;
+		bool inside = x < t.size_x && y < t.size_y;
+		w[i] = inside ? t.importance_map[y][x] : 0.0f;
+		for (int ch=0; ch<NCHANNELS_RGBA; ++ch)
+		{
+			px[ch][i] = inside ? t.data[y][x].component[ch] : 0.0f;
+			mean[ch] += w[i] * px[ch][i];
+		}
+		wsum += w[i];
+	}
+	if (wsum > 0)
+		for (int ch=0; ch<NCHANNELS_RGBA; ++ch) mean[ch] /= wsum;
+
+	// principal axis by power iteration on the covariance, starting from its largest diagonal entry
+	float cov[NCHANNELS_RGBA][NCHANNELS_RGBA] = { { 0 } };
+	for (int i=0; i<Tile::TILE_TOTAL; ++i)
+	for (int j=0; j<NCHANNELS_RGBA; ++j)
+	for (int k=j; k<NCHANNELS_RGBA; ++k)
+		cov[j][k] += w[i] * (px[j][i] - mean[j]) * (px[k][i] - mean[k]);
+
+	float axis[NCHANNELS_RGBA] = { 0, 0, 0, 0 };
+	int start = 0;
+	for (int j=0; j<NCHANNELS_RGBA; ++j)
+	{
+		for (int k=0; k<j; ++k) cov[j][k] = cov[k][j];
+		if (cov[j][j] > cov[start][start]) start = j;
+	}
+	axis[start] = 1;
+	for (int iter=0; iter<8; ++iter)
+	{
+		float v[NCHANNELS_RGBA], len = 0;
+		for (int j=0; j<NCHANNELS_RGBA; ++j)
+		{
+			v[j] = cov[j][0] * axis[0] + cov[j][1] * axis[1] + cov[j][2] * axis[2] + cov[j][3] * axis[3];
+			len += v[j] * v[j];
+		}
+		if (len == 0) break;
+		len = 1.0f / sqrtf(len);
+		for (int j=0; j<NCHANNELS_RGBA; ++j) axis[j] = v[j] * len;
+	}
+
+	// endpoints at the extent of the pixels along the axis
+	float tmin = FLT_MAX, tmax = -FLT_MAX;
+	for (int i=0; i<Tile::TILE_TOTAL; ++i)
+	{
+		if (w[i] == 0) continue;
+		float s = 0;
+		for (int ch=0; ch<NCHANNELS_RGBA; ++ch) s += (px[ch][i] - mean[ch]) * axis[ch];
+		if (s < tmin) tmin = s;
+		if (s > tmax) tmax = s;
+	}
+	if (tmin > tmax) tmin = tmax = 0;
+
+	float e0[NCHANNELS_RGBA], e1[NCHANNELS_RGBA];
+	for (int ch=0; ch<NCHANNELS_RGBA; ++ch)
+	{
+		e0[ch] = clamp255(mean[ch] + tmin * axis[ch]);
+		e1[ch] = clamp255(mean[ch] + tmax * axis[ch]);
+	}
+
+	IntEndptsRGBA_2 endpts;
+	int indices[Tile::TILE_TOTAL];
+	float err = quantize_and_map(px, w, e0, e1, endpts, indices);
+
+	// least squares endpoints for these indices, kept when they fit better
+	float aa = 0, ab = 0, bb = 0, ap[NCHANNELS_RGBA] = { 0, 0, 0, 0 }, bp[NCHANNELS_RGBA] = { 0, 0, 0, 0 };
+	for (int i=0; i<Tile::TILE_TOTAL; ++i)
+	{
+		float f = weights6[indices[i]] / 64.0f, g = 1 - f;
+		aa += w[i] * g * g;
+		ab += w[i] * g * f;
+		bb += w[i] * f * f;
+		for (int ch=0; ch<NCHANNELS_RGBA; ++ch)
+		{
+			ap[ch] += w[i] * g * px[ch][i];
+			bp[ch] += w[i] * f * px[ch][i];
+		}
+	}
+	float det = aa * bb - ab * ab;
+	if (det > 1e-6f * wsum * wsum)
+	{
+		float ls0[NCHANNELS_RGBA], ls1[NCHANNELS_RGBA];
+		for (int ch=0; ch<NCHANNELS_RGBA; ++ch)
+		{
+			ls0[ch] = clamp255((bb * ap[ch] - ab * bp[ch]) / det);
+			ls1[ch] = clamp255((aa * bp[ch] - ab * ap[ch]) / det);
+		}
+
+		IntEndptsRGBA_2 ls_endpts;
+		int ls_indices[Tile::TILE_TOTAL];
+		float ls_err = quantize_and_map(px, w, ls0, ls1, ls_endpts, ls_indices);
+		if (ls_err < err)
+		{
+			err = ls_err;
+			endpts = ls_endpts;
+			memcpy(indices, ls_indices, sizeof(indices));
+		}
+	}
+
+	// the high bit of the first index is implicit, swap the endpoints if it's set
+	if (indices[0] & HIGH_INDEXBIT)
+	{
+		for (int ch=0; ch<NCHANNELS_RGBA; ++ch) { int tmp = endpts.A[ch]; endpts.A[ch] = endpts.B[ch]; endpts.B[ch] = tmp; }
+		int tmp = endpts.a_lsb; endpts.a_lsb = endpts.b_lsb; endpts.b_lsb = tmp;
+		for (int i=0; i<Tile::TILE_TOTAL; ++i) indices[i] = NINDICES-1 - indices[i];
+	}
+
+	int indices2d[Tile::TILE_H][Tile::TILE_W];
+	for (int i=0; i<Tile::TILE_TOTAL; ++i) indices2d[i>>2][i&3] = indices[i];
+	emit_block(&endpts, 0, patterns[0], indices2d, block);
+
+	return err;
+}
@@ -14,8 +14,10 @@ See the License for the specific language governing permissions and limitations
 
 #include "avpcl_utils.h"
 #include "avpcl.h"
+#include "tile.h"
 #include "nvcore/Debug.h"
 #include "nvmath/Vector.inl"
+#include "nvmath/Fitting.h"
 #include <math.h>
 
 using namespace nv;
@@ -117,99 +119,44 @@ int Utils::quantize(float value, int prec)
 	return q;
 }
 
-float Utils::metric4(Vector4::Arg a, Vector4::Arg b)
+float Utils::metric4(Vector4::Arg a, Vector4::Arg b, const Options &options)
 {
-	Vector4 err = a - b;
-
-	// if nonuniform, select weights and weigh away
-	if (AVPCL::flag_nonuniform || AVPCL::flag_nonuniform_ati)
-	{
-		float rwt, gwt, bwt;
-		if (AVPCL::flag_nonuniform)
-		{
-			rwt = 0.299f; gwt = 0.587f; bwt = 0.114f;
-		}
-		else /*if (AVPCL::flag_nonuniform_ati)*/
-		{
-			rwt = 0.3086f; gwt = 0.6094f; bwt = 0.0820f;
-		}
-
-		// weigh the components
-		err.x *= rwt;
-		err.y *= gwt;
-		err.z *= bwt;
-	}
+	return lengthSquared((a - b) * metric4_weights(options));
+}
 
-	return lengthSquared(err);
+Vector4 Utils::metric4_weights(const Options &options)
+{
+	if (options.nonuniform)
+		return Vector4(0.299f, 0.587f, 0.114f, 1.0f);
+	if (options.nonuniform_ati)
+		return Vector4(0.3086f, 0.6094f, 0.0820f, 1.0f);
+	return Vector4(options.channel_weights[0], options.channel_weights[1], options.channel_weights[2], options.channel_weights[3]);
 }
 
-// WORK -- implement rotatemode for the below -- that changes where the rwt, gwt, and bwt's go.
-float Utils::metric3(Vector3::Arg a, Vector3::Arg b, int rotatemode)
+// the channel weights in the order of the rotated channels: the 3 channel weights in xyz and the scalar channel's weight in w
+static Vector4 rotated_weights(int rotatemode, const Options &options)
 {
-	Vector3 err = a - b;
+	Vector4 w = Utils::metric4_weights(options);
 
-	// if nonuniform, select weights and weigh away
-	if (AVPCL::flag_nonuniform || AVPCL::flag_nonuniform_ati)
+	switch(rotatemode)
 	{
-		float rwt, gwt, bwt;
-		if (AVPCL::flag_nonuniform)
-		{
-			rwt = 0.299f; gwt = 0.587f; bwt = 0.114f;
-		}
-		else if (AVPCL::flag_nonuniform_ati)
-		{
-			rwt = 0.3086f; gwt = 0.6094f; bwt = 0.0820f;
-		}
-
-		// adjust weights based on rotatemode
-		switch(rotatemode)
-		{
-		case ROTATEMODE_RGBA_RGBA: break;
-		case ROTATEMODE_RGBA_AGBR: rwt = 1.0f; break;
-		case ROTATEMODE_RGBA_RABG: gwt = 1.0f; break;
-		case ROTATEMODE_RGBA_RGAB: bwt = 1.0f; break;
-		default: nvUnreachable();
-		}
-
-		// weigh the components
-		err.x *= rwt;
-		err.y *= gwt;
-		err.z *= bwt;
+	case ROTATEMODE_RGBA_RGBA: return w;
+	case ROTATEMODE_RGBA_AGBR: return Vector4(w.w, w.y, w.z, w.x);
+	case ROTATEMODE_RGBA_RABG: return Vector4(w.x, w.w, w.z, w.y);
+	case ROTATEMODE_RGBA_RGAB: return Vector4(w.x, w.y, w.w, w.z);
+	default: nvUnreachable();
 	}
-
-	return lengthSquared(err);
+	return w;
 }
 
-float Utils::metric1(const float a, const float b, int rotatemode)
+float Utils::metric3(Vector3::Arg a, Vector3::Arg b, int rotatemode, const Options &options)
 {
-	float err = a - b;
-
-	// if nonuniform, select weights and weigh away
-	if (AVPCL::flag_nonuniform || AVPCL::flag_nonuniform_ati)
-	{
-		float rwt, gwt, bwt, awt;
-		if (AVPCL::flag_nonuniform)
-		{
-			rwt = 0.299f; gwt = 0.587f; bwt = 0.114f;
-		}
-		else if (AVPCL::flag_nonuniform_ati)
-		{
-			rwt = 0.3086f; gwt = 0.6094f; bwt = 0.0820f;
-		}
-
-		// adjust weights based on rotatemode
-		switch(rotatemode)
-		{
-		case ROTATEMODE_RGBA_RGBA: awt = 1.0f; break;
-		case ROTATEMODE_RGBA_AGBR: awt = rwt; break;
-		case ROTATEMODE_RGBA_RABG: awt = gwt; break;
-		case ROTATEMODE_RGBA_RGAB: awt = bwt; break;
-		default: nvUnreachable();
-		}
+	return lengthSquared((a - b) * rotated_weights(rotatemode, options).xyz());
+}
 
-		// weigh the components
-		err *= awt;
-	}
+float Utils::metric1(const float a, const float b, int rotatemode, const Options &options)
+{
+	float err = (a - b) * rotated_weights(rotatemode, options).w;
 
 	return err * err;
 }
@@ -238,7 +185,7 @@ static void premult3(Vector3& rgb, float a)
 	rgb.z = Utils::premult(rgb.z, a);
 }
 
-float Utils::metric4premult(Vector4::Arg a, Vector4::Arg b)
+float Utils::metric4premult(Vector4::Arg a, Vector4::Arg b, const Options &options)
 {
 	Vector4 pma = a, pmb = b;
 
@@ -247,29 +194,10 @@ float Utils::metric4premult(Vector4::Arg a, Vector4::Arg b)
 
 	Vector4 err = pma - pmb;
 
-	// if nonuniform, select weights and weigh away
-	if (AVPCL::flag_nonuniform || AVPCL::flag_nonuniform_ati)
-	{
-		float rwt, gwt, bwt;
-		if (AVPCL::flag_nonuniform)
-		{
-			rwt = 0.299f; gwt = 0.587f; bwt = 0.114f;
-		}
-		else /*if (AVPCL::flag_nonuniform_ati)*/
-		{
-			rwt = 0.3086f; gwt = 0.6094f; bwt = 0.0820f;
-		}
-
-		// weigh the components
-		err.x *= rwt;
-		err.y *= gwt;
-		err.z *= bwt;
-	}
-
-	return lengthSquared(err);
+	return lengthSquared(err * metric4_weights(options));
 }
 
-float Utils::metric3premult_alphaout(Vector3::Arg rgb0, float a0, Vector3::Arg rgb1, float a1)
+float Utils::metric3premult_alphaout(Vector3::Arg rgb0, float a0, Vector3::Arg rgb1, float a1, const Options &options)
 {
 	Vector3 pma = rgb0, pmb = rgb1;
 
@@ -278,29 +206,10 @@ float Utils::metric3premult_alphaout(Vector3::Arg rgb0, float a0, Vector3::Arg r
 
 	Vector3 err = pma - pmb;
 
-	// if nonuniform, select weights and weigh away
-	if (AVPCL::flag_nonuniform || AVPCL::flag_nonuniform_ati)
-	{
-		float rwt, gwt, bwt;
-		if (AVPCL::flag_nonuniform)
-		{
-			rwt = 0.299f; gwt = 0.587f; bwt = 0.114f;
-		}
-		else /*if (AVPCL::flag_nonuniform_ati)*/
-		{
-			rwt = 0.3086f; gwt = 0.6094f; bwt = 0.0820f;
-		}
-
-		// weigh the components
-		err.x *= rwt;
-		err.y *= gwt;
-		err.z *= bwt;
-	}
-
-	return lengthSquared(err);
+	return lengthSquared(err * metric4_weights(options).xyz());
 }
 
-float Utils::metric3premult_alphain(Vector3::Arg rgb0, Vector3::Arg rgb1, int rotatemode)
+float Utils::metric3premult_alphain(Vector3::Arg rgb0, Vector3::Arg rgb1, int rotatemode, const Options &options)
 {
 	Vector3 pma = rgb0, pmb = rgb1;
 
@@ -333,58 +242,62 @@ float Utils::metric3premult_alphain(Vector3::Arg rgb0, Vector3::Arg rgb1, int ro
 
 	Vector3 err = pma - pmb;
 
-	// if nonuniform, select weights and weigh away
-	if (AVPCL::flag_nonuniform || AVPCL::flag_nonuniform_ati)
-	{
-		float rwt, gwt, bwt;
-		if (AVPCL::flag_nonuniform)
-		{
-			rwt = 0.299f; gwt = 0.587f; bwt = 0.114f;
-		}
-		else /*if (AVPCL::flag_nonuniform_ati)*/
-		{
-			rwt = 0.3086f; gwt = 0.6094f; bwt = 0.0820f;
-		}
+	return lengthSquared(err * rotated_weights(rotatemode, options).xyz());
+}
 
-		// weigh the components
-		err.x *= rwt;
-		err.y *= gwt;
-		err.z *= bwt;
-	}
+float Utils::metric1premult(float rgb0, float a0, float rgb1, float a1, int rotatemode, const Options &options)
+{
+	float err = (premult(rgb0, a0) - premult(rgb1, a1)) * rotated_weights(rotatemode, options).w;
 
-	return lengthSquared(err);
+	return err * err;
 }
 
-float Utils::metric1premult(float rgb0, float a0, float rgb1, float a1, int rotatemode)
+// score every shape at once with a line fit of its regions, so that only the promising ones get a rough fit
+void Utils::rank_shapes(const Tile &tile, const int *shapes, int nshapes, int nregions, bool fit_alpha, int count, int index[])
 {
-	float err = premult(rgb0, a0) - premult(rgb1, a1);
+	nvAssert (nshapes <= 64 && nregions >= 2 && nregions <= 3 && count <= nshapes);
+
+	for (int i = 0; i < nshapes; ++i)
+		index[i] = i;
 
-	// if nonuniform, select weights and weigh away
-	if (AVPCL::flag_nonuniform || AVPCL::flag_nonuniform_ati)
+	if (count >= nshapes)
+		return;
+
+	Vector4 points[Tile::TILE_TOTAL];
+	float weights[Tile::TILE_TOTAL];
+	for (int y = 0; y < Tile::TILE_H; y++)
+	for (int x = 0; x < Tile::TILE_W; x++)
 	{
-		float rwt, gwt, bwt, awt;
-		if (AVPCL::flag_nonuniform)
-		{
-			rwt = 0.299f; gwt = 0.587f; bwt = 0.114f;
-		}
-		else if (AVPCL::flag_nonuniform_ati)
-		{
-			rwt = 0.3086f; gwt = 0.6094f; bwt = 0.0820f;
-		}
+		bool inside = x < tile.size_x && y < tile.size_y;
+		points[y*4+x] = inside ? tile.data[y][x] : Vector4(0.0f);
+		if (!fit_alpha) points[y*4+x].w = 0.0f;
+		weights[y*4+x] = inside ? tile.importance_map[y][x] : 0.0f;
+	}
 
-		// adjust weights based on rotatemode
-		switch(rotatemode)
+	// one bit per pixel for each region but the first
+	uint16 masks[64*2];
+	for (int si = 0; si < nshapes; ++si)
+	{
+		for (int r = 1; r < nregions; ++r)
+			masks[si*(nregions-1)+r-1] = 0;
+		for (int y = 0; y < Tile::TILE_H; y++)
+		for (int x = 0; x < Tile::TILE_W; x++)
 		{
-		case ROTATEMODE_RGBA_RGBA: awt = 1.0f; break;
-		case ROTATEMODE_RGBA_AGBR: awt = rwt; break;
-		case ROTATEMODE_RGBA_RABG: awt = gwt; break;
-		case ROTATEMODE_RGBA_RGAB: awt = bwt; break;
-		default: nvUnreachable();
+			int r = shapes[(si&3)*4+(si>>2)*64+x+y*16];
+			if (r > 0) masks[si*(nregions-1)+r-1] |= uint16(1 << (y*4+x));
 		}
-
-		// weigh the components
-		err *= awt;
 	}
 
-	return err * err;
+	float errors[64];
+	Fit::estimatePartitionErrors(points, weights, nregions, nshapes, masks, errors);
+
+	// selection sort -- only the first count shapes need to be in order, ties keep the lower shape
+	for (int i = 0; i < count; ++i)
+	{
+		int best = i;
+		for (int j = i+1; j < nshapes; ++j)
+			if (errors[index[j]] < errors[index[best]])
+				best = j;
+		int t = index[i]; index[i] = index[best]; index[best] = t;
+	}
 }
@@ -18,6 +18,9 @@ See the License for the specific language governing permissions and limitations
 
 namespace AVPCL {
 
+struct Options;
+class Tile;
+
 inline int SIGN_EXTEND(int x, int nb) { return ((((x)&(1<<((nb)-1)))?((~0)<<(nb)):0)|(x)); }
 
 static const int INDEXMODE_BITS				= 1;		// 2 different index modes
@@ -36,14 +39,17 @@ class Utils
 {
 public:
 	// error metrics
-	static float metric4(nv::Vector4::Arg a, nv::Vector4::Arg b);
-	static float metric3(nv::Vector3::Arg a, nv::Vector3::Arg b, int rotatemode);
-	static float metric1(float a, float b, int rotatemode);
+	static float metric4(nv::Vector4::Arg a, nv::Vector4::Arg b, const Options &options);
+	static float metric3(nv::Vector3::Arg a, nv::Vector3::Arg b, int rotatemode, const Options &options);
+	static float metric1(float a, float b, int rotatemode, const Options &options);
+
+	// channel weights that all the metrics apply to the error, the nonuniform presets or else options.channel_weights
+	static nv::Vector4 metric4_weights(const Options &options);
 
-	static float metric4premult(nv::Vector4::Arg rgba0, nv::Vector4::Arg rgba1);
-	static float metric3premult_alphaout(nv::Vector3::Arg rgb0, float a0, nv::Vector3::Arg rgb1, float a1);
-	static float metric3premult_alphain(nv::Vector3::Arg rgb0, nv::Vector3::Arg rgb1, int rotatemode);
-	static float metric1premult(float rgb0, float a0, float rgb1, float a1, int rotatemode);
+	static float metric4premult(nv::Vector4::Arg rgba0, nv::Vector4::Arg rgba1, const Options &options);
+	static float metric3premult_alphaout(nv::Vector3::Arg rgb0, float a0, nv::Vector3::Arg rgb1, float a1, const Options &options);
+	static float metric3premult_alphain(nv::Vector3::Arg rgb0, nv::Vector3::Arg rgb1, int rotatemode, const Options &options);
+	static float metric1premult(float rgb0, float a0, float rgb1, float a1, int rotatemode, const Options &options);
 
 	static float premult(float r, float a);
 
@@ -54,6 +60,9 @@ public:
 	// lerping
 	static int lerp(int a, int b, int i, int bias, int denom);
 	static nv::Vector4 lerp(nv::Vector4::Arg a, nv::Vector4::Arg b, int i, int bias, int denom);
+
+	// shape ranking: the count shapes whose regions are estimated to fit a line best, best first. alpha is ignored unless fit_alpha
+	static void rank_shapes(const Tile &tile, const int *shapes, int nshapes, int nregions, bool fit_alpha, int count, int index[]);
 };
 
 }
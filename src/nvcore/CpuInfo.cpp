@@ -0,0 +1,99 @@
+// This code is in the public domain -- castano@gmail.com
+
+#include "CpuInfo.h"
+
+#if NV_CPU_X86 || NV_CPU_X86_64
+#if NV_CC_MSVC
+#include <intrin.h> // __cpuid, __cpuidex, _xgetbv
+#else
+#include <cpuid.h> // __cpuid, __cpuid_count
+#endif
+#endif
+
+using namespace nv;
+
+static uint s_featureMask = ~0U;
+
+#if NV_CPU_X86 || NV_CPU_X86_64
+
+static void cpuid(uint leaf, uint subleaf, uint regs[4])
+{
+#if NV_CC_MSVC
+    __cpuidex((int *)regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// Register state the operating system saves on context switches.
+static uint64 xgetbv()
+{
+#if NV_CC_MSVC
+    return _xgetbv(0);
+#else
+    uint eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (uint64(edx) << 32) | eax;
+#endif
+}
+
+static uint detectFeatures()
+{
+    uint regs[4];
+    cpuid(0, 0, regs);
+    const uint maxLeaf = regs[0];
+
+    cpuid(1, 0, regs);
+    const uint ecx1 = regs[2], edx1 = regs[3];
+
+    uint features = 0;
+    if (edx1 & (1 << 26)) features |= CpuFeature_SSE2 | CpuFeature_StreamingStores;
+
+    // The wide registers are only usable when the OS saves them, see OSXSAVE and XCR0.
+    if ((ecx1 & (1 << 27)) == 0 || (ecx1 & (1 << 28)) == 0) return features;
+
+    const uint64 xcr0 = xgetbv();
+    if ((xcr0 & 0x6) != 0x6) return features;   // XMM and YMM.
+
+    features |= CpuFeature_AVX;
+    if (ecx1 & (1 << 12)) features |= CpuFeature_FMA;
+
+    if (maxLeaf < 7) return features;
+
+    cpuid(7, 0, regs);
+    const uint ebx7 = regs[1];
+    if (ebx7 & (1 << 5)) features |= CpuFeature_AVX2;
+    if ((ebx7 & (1 << 16)) && (xcr0 & 0xE0) == 0xE0) features |= CpuFeature_AVX512F;   // Opmask, ZMM0-15 upper halves, ZMM16-31.
+
+    return features;
+}
+
+#else
+
+static uint detectFeatures()
+{
+    return 0;
+}
+
+#endif
+
+uint nv::cpuFeatures()
+{
+    // Detection is idempotent, threads that race here store the same value.
+    static uint s_features = detectFeatures();
+    return s_features & s_featureMask;
+}
+
+void nv::setCpuFeatureMask(uint mask)
+{
+    s_featureMask = mask;
+}
+
+const char * nv::cpuFeatureName(uint features)
+{
+    if (features & CpuFeature_AVX512F) return "AVX-512";
+    if (features & CpuFeature_AVX2) return "AVX2";
+    if (features & CpuFeature_AVX) return "AVX";
+    if (features & CpuFeature_SSE2) return "SSE2";
+    return "scalar";
+}
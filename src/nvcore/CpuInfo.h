@@ -0,0 +1,33 @@
+// This code is in the public domain -- castano@gmail.com
+
+#pragma once
+#ifndef NV_CORE_CPUINFO_H
+#define NV_CORE_CPUINFO_H
+
+#include "nvcore.h"
+
+namespace nv {
+
+    // Instruction set extensions that the SIMD kernels select at runtime.
+    enum CpuFeature
+    {
+        CpuFeature_SSE2     = 0x01,
+        CpuFeature_AVX      = 0x02,
+        CpuFeature_AVX2     = 0x04,
+        CpuFeature_FMA      = 0x08,
+        CpuFeature_AVX512F  = 0x10,
+        CpuFeature_StreamingStores = 0x20,  // Non-temporal stores, that write large buffers without going through the cache.
+    };
+
+    // Features supported by the CPU and enabled by the operating system, restricted by the feature mask.
+    NVCORE_API uint cpuFeatures();
+
+    // Restrict the features that the kernels use, to compare their paths. Set ~0 to use all of them, which is the default.
+    NVCORE_API void setCpuFeatureMask(uint mask);
+
+    // Name of the widest vector extension in the given features.
+    NVCORE_API const char * cpuFeatureName(uint features);
+
+} // nv namespace
+
+#endif // NV_CORE_CPUINFO_H
@@ -565,7 +565,7 @@ namespace
                         builder.format("  In: [%s] '%s'\n", module, name);
                     }
                 }
-                free(name);
+                ::free(name);   // From the C runtime.
             }
             else {
                 builder.format("  In: '%s'\n", string_array[i]);
@@ -576,7 +576,7 @@ namespace
             lines.append(builder.release());
         }
 
-        free(string_array);
+        ::free(string_array);
     }
 
     static void printStackTrace(void * trace[], int size, int start=0) {
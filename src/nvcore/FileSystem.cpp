@@ -1,6 +1,7 @@
 // This code is in the public domain -- castano@gmail.com
 
 #include "FileSystem.h"
+#include "Debug.h"
 
 #if NV_OS_WIN32
 #define _CRT_NONSTDC_NO_WARNINGS // _chdir is defined deprecated, but that's a bug, chdir is deprecated, _chdir is *not*.
@@ -14,9 +15,16 @@
 #else
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h> // mmap
+#include <fcntl.h> // open
 #include <unistd.h>
+#include <stdlib.h> // mkstemp, getenv
+#include <glob.h>
+#include <utime.h>
+#include <dirent.h> // opendir
 #endif
 #include <stdio.h> // remove, unlink
+#include <string.h> // strrchr
 
 using namespace nv;
 
@@ -78,3 +86,396 @@ bool FileSystem::removeFile(const char * path)
     // @@ Use unlink or remove?
     return remove(path) == 0;
 }
+
+uint FileSystem::findFiles(const char * pattern, FindFileFunc * func, void * arg)
+{
+    uint count = 0;
+
+#if NV_OS_WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE) return 0;
+
+    // The names that are found don't include the directory of the pattern.
+    const char * sep = strrchr(pattern, '\\');
+    const char * sep2 = strrchr(pattern, '/');
+    if (sep2 > sep) sep = sep2;
+    const size_t dirLength = (sep != NULL) ? size_t(sep - pattern + 1) : 0;
+
+    char path[MAX_PATH];
+    do {
+        if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 && dirLength + strlen(data.cFileName) < MAX_PATH) {
+            memcpy(path, pattern, dirLength);
+            strcpy(path + dirLength, data.cFileName);
+            func(path, arg);
+            count++;
+        }
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+#elif NV_OS_UNIX
+    glob_t g;
+    if (glob(pattern, 0, NULL, &g) != 0) return 0;
+
+    for (size_t i = 0; i < g.gl_pathc; i++) {
+        struct stat buf;
+        if (stat(g.gl_pathv[i], &buf) == 0 && S_ISREG(buf.st_mode)) {
+            func(g.gl_pathv[i], arg);
+            count++;
+        }
+    }
+
+    globfree(&g);
+#else
+    // not implemented
+    NV_UNUSED(pattern);
+    NV_UNUSED(func);
+    NV_UNUSED(arg);
+#endif
+
+    return count;
+}
+
+uint FileSystem::findFilesRecursive(const char * directory, FindFileFunc * func, void * arg)
+{
+    uint count = 0;
+
+#if NV_OS_WIN32
+    char path[MAX_PATH];
+    if (_snprintf(path, MAX_PATH, "%s\\*", directory) >= MAX_PATH) return 0;
+
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(path, &data);
+    if (find == INVALID_HANDLE_VALUE) return 0;
+
+    do {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0) continue;
+        if (_snprintf(path, MAX_PATH, "%s\\%s", directory, data.cFileName) >= MAX_PATH) continue;
+
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            // Don't follow junctions and links to directories, to avoid cycles.
+            if ((data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0) {
+                count += findFilesRecursive(path, func, arg);
+            }
+        }
+        else {
+            func(path, arg);
+            count++;
+        }
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+#elif NV_OS_UNIX
+    DIR * dir = opendir(directory);
+    if (dir == NULL) return 0;
+
+    const size_t dirLength = strlen(directory);
+    char * path = NULL;
+    size_t pathSize = 0;
+
+    while (struct dirent * entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        const size_t size = dirLength + strlen(entry->d_name) + 2;
+        if (size > pathSize) {
+            pathSize = size;
+            path = (char *)::realloc(path, pathSize);
+        }
+        snprintf(path, pathSize, "%s/%s", directory, entry->d_name);
+
+        // Not all file systems report the type of the entries. Links to files are followed, links to directories aren't,
+        // to avoid cycles.
+        bool isDirectory = false, isFile = false;
+        struct stat buf;
+#if defined(_DIRENT_HAVE_D_TYPE) || NV_OS_DARWIN
+        if (entry->d_type == DT_DIR || entry->d_type == DT_REG) {
+            isDirectory = (entry->d_type == DT_DIR);
+            isFile = (entry->d_type == DT_REG);
+        }
+        else
+#endif
+        if (lstat(path, &buf) == 0) {
+            isDirectory = S_ISDIR(buf.st_mode);
+            isFile = S_ISREG(buf.st_mode) || (S_ISLNK(buf.st_mode) && stat(path, &buf) == 0 && S_ISREG(buf.st_mode));
+        }
+
+        if (isDirectory) {
+            count += findFilesRecursive(path, func, arg);
+        }
+        else if (isFile) {
+            func(path, arg);
+            count++;
+        }
+    }
+
+    ::free(path);
+    closedir(dir);
+#else
+    // not implemented
+    NV_UNUSED(directory);
+    NV_UNUSED(func);
+    NV_UNUSED(arg);
+#endif
+
+    return count;
+}
+
+bool FileSystem::getFileInfo(const char * path, uint64 * size, uint64 * modifiedTime)
+{
+#if NV_OS_WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) return false;
+
+    if (size != NULL) *size = (uint64(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    if (modifiedTime != NULL) *modifiedTime = ((uint64(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime) / 10000000;
+    return true;
+#elif NV_OS_UNIX
+    struct stat buf;
+    if (stat(path, &buf) != 0) return false;
+
+    if (size != NULL) *size = uint64(buf.st_size);
+    if (modifiedTime != NULL) *modifiedTime = uint64(buf.st_mtime);
+    return true;
+#else
+    // not implemented
+    NV_UNUSED(path);
+    NV_UNUSED(size);
+    NV_UNUSED(modifiedTime);
+    return false;
+#endif
+}
+
+bool FileSystem::touchFile(const char * path)
+{
+#if NV_OS_WIN32
+    HANDLE file = CreateFileA(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    const bool result = SetFileTime(file, NULL, NULL, &now) != 0;
+
+    CloseHandle(file);
+    return result;
+#elif NV_OS_UNIX
+    return utime(path, NULL) == 0;
+#else
+    // not implemented
+    NV_UNUSED(path);
+    return false;
+#endif
+}
+
+void * FileSystem::mapScratchFile(const char * directory, size_t size)
+{
+#if NV_OS_WIN32
+    char tempPath[MAX_PATH];
+    if (directory == NULL) {
+        if (GetTempPathA(MAX_PATH, tempPath) == 0) return NULL;
+        directory = tempPath;
+    }
+
+    char path[MAX_PATH];
+    if (GetTempFileNameA(directory, "nvt", 0, path) == 0) return NULL;
+
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    void * ptr = NULL;
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, DWORD(uint64(size) >> 32), DWORD(size & 0xFFFFFFFF), NULL);
+    if (mapping != NULL) {
+        ptr = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        CloseHandle(mapping);
+    }
+
+    // The view keeps the file alive until it's unmapped.
+    CloseHandle(file);
+    return ptr;
+#elif NV_OS_UNIX
+    if (directory == NULL) {
+        directory = getenv("TMPDIR");
+        if (directory == NULL) directory = "/tmp";
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/nvtt-XXXXXX", directory);
+
+    int fd = mkstemp(path);
+    if (fd == -1) return NULL;
+
+    // Remove the name right away, the file goes away once it's unmapped.
+    unlink(path);
+
+    void * ptr = NULL;
+    if (ftruncate(fd, off_t(size)) == 0) {
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) ptr = NULL;
+    }
+
+    close(fd);
+    return ptr;
+#else
+    // not implemented
+    return NULL;
+#endif
+}
+
+void FileSystem::unmapScratchFile(void * ptr, size_t size)
+{
+#if NV_OS_WIN32
+    NV_UNUSED(size);
+    UnmapViewOfFile(ptr);
+#elif NV_OS_UNIX
+    munmap(ptr, size);
+#else
+    NV_UNUSED(ptr);
+    NV_UNUSED(size);
+#endif
+}
+
+const void * FileSystem::mapFile(const char * path, size_t * size)
+{
+    nvDebugCheck(size != NULL);
+    *size = 0;
+
+#if NV_OS_WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    LARGE_INTEGER fileSize;
+    const void * ptr = NULL;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 && uint64(fileSize.QuadPart) <= uint64(size_t(-1))) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL) {
+            ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        if (ptr != NULL) *size = size_t(fileSize.QuadPart);
+    }
+
+    // The view keeps the file open until it's unmapped.
+    CloseHandle(file);
+    return ptr;
+#elif NV_OS_UNIX
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+
+    struct stat buf;
+    const void * ptr = NULL;
+    if (fstat(fd, &buf) == 0 && S_ISREG(buf.st_mode) && buf.st_size > 0) {
+        ptr = mmap(NULL, size_t(buf.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) ptr = NULL;
+        else *size = size_t(buf.st_size);
+    }
+
+    close(fd);
+    return ptr;
+#else
+    // not implemented
+    NV_UNUSED(path);
+    return NULL;
+#endif
+}
+
+void FileSystem::unmapFile(const void * ptr, size_t size)
+{
+#if NV_OS_WIN32
+    NV_UNUSED(size);
+    UnmapViewOfFile(ptr);
+#elif NV_OS_UNIX
+    munmap(const_cast<void *>(ptr), size);
+#else
+    NV_UNUSED(ptr);
+    NV_UNUSED(size);
+#endif
+}
+
+#if NV_OS_UNIX
+namespace
+{
+    struct UnbufferedFile
+    {
+        int fd;
+    };
+}
+#endif
+
+void * FileSystem::createUnbufferedFile(const char * path)
+{
+#if NV_OS_WIN32
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+    return file;
+#elif NV_OS_UNIX
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#if defined(O_DIRECT)
+    flags |= O_DIRECT;
+#endif
+    int fd = open(path, flags, 0666);
+    if (fd == -1) return NULL;
+#if NV_OS_DARWIN
+    fcntl(fd, F_NOCACHE, 1);
+#endif
+
+    UnbufferedFile * file = new UnbufferedFile;
+    file->fd = fd;
+    return file;
+#else
+    // not implemented
+    NV_UNUSED(path);
+    return NULL;
+#endif
+}
+
+bool FileSystem::writeUnbufferedFile(void * file, const void * data, size_t size)
+{
+    nvDebugCheck((size_t(data) & (kUnbufferedAlignment - 1)) == 0);
+    nvDebugCheck((size & (kUnbufferedAlignment - 1)) == 0);
+
+#if NV_OS_WIN32
+    const uint8 * ptr = (const uint8 *)data;
+    while (size > 0) {
+        const DWORD len = DWORD(size < (1U << 30) ? size : (1U << 30));
+        DWORD written = 0;
+        if (!WriteFile((HANDLE)file, ptr, len, &written, NULL) || written != len) return false;
+        ptr += len;
+        size -= len;
+    }
+    return true;
+#elif NV_OS_UNIX
+    const int fd = ((UnbufferedFile *)file)->fd;
+    const uint8 * ptr = (const uint8 *)data;
+    while (size > 0) {
+        ssize_t written = write(fd, ptr, size);
+        if (written <= 0) return false;
+        ptr += written;
+        size -= size_t(written);
+    }
+    return true;
+#else
+    NV_UNUSED(file);
+    NV_UNUSED(data);
+    NV_UNUSED(size);
+    return false;
+#endif
+}
+
+bool FileSystem::closeUnbufferedFile(void * file, uint64 size)
+{
+#if NV_OS_WIN32
+    LARGE_INTEGER end;
+    end.QuadPart = LONGLONG(size);
+    bool result = SetFilePointerEx((HANDLE)file, end, NULL, FILE_BEGIN) && SetEndOfFile((HANDLE)file);
+    return CloseHandle((HANDLE)file) && result;
+#elif NV_OS_UNIX
+    UnbufferedFile * f = (UnbufferedFile *)file;
+    bool result = ftruncate(f->fd, off_t(size)) == 0;
+    result = close(f->fd) == 0 && result;
+    delete f;
+    return result;
+#else
+    NV_UNUSED(file);
+    NV_UNUSED(size);
+    return false;
+#endif
+}
@@ -16,6 +16,38 @@ namespace nv
         NVCORE_API bool changeDirectory(const char * path);
         NVCORE_API bool removeFile(const char * path);
 
+        // Call func with the path of each file that matches the pattern, with '*' and '?' wildcards in the file name.
+        // Directories are skipped. Returns the number of files found.
+        typedef void FindFileFunc(const char * path, void * arg);
+        NVCORE_API uint findFiles(const char * pattern, FindFileFunc * func, void * arg);
+
+        // Call func with the path of every file in the directory and its subdirectories. Returns the number of files found.
+        NVCORE_API uint findFilesRecursive(const char * directory, FindFileFunc * func, void * arg);
+
+        // Get the size of a file and the time it was last modified, in seconds of an unspecified epoch. Returns false if
+        // the file doesn't exist.
+        NVCORE_API bool getFileInfo(const char * path, uint64 * size, uint64 * modifiedTime);
+
+        // Set the modification time of an existing file to the current time.
+        NVCORE_API bool touchFile(const char * path);
+
+        // Map a zero initialized scratch file of the given size into memory. The file is deleted when it's unmapped.
+        // Returns NULL on failure. If directory is NULL the system temp directory is used.
+        NVCORE_API void * mapScratchFile(const char * directory, size_t size);
+        NVCORE_API void unmapScratchFile(void * ptr, size_t size);
+
+        // Map an existing file into memory for reading, and return its size. Returns NULL on failure and for empty files.
+        NVCORE_API const void * mapFile(const char * path, size_t * size);
+        NVCORE_API void unmapFile(const void * ptr, size_t size);
+
+        // Create a file that is written past the system cache, with O_DIRECT or FILE_FLAG_NO_BUFFERING. The buffers, sizes
+        // and file offsets of the writes must be multiples of kUnbufferedAlignment. Closing trims the file to its final
+        // size, to remove the padding of the last write. Returns NULL on failure, and where the file system doesn't allow it.
+        const uint kUnbufferedAlignment = 4096;
+        NVCORE_API void * createUnbufferedFile(const char * path);
+        NVCORE_API bool writeUnbufferedFile(void * file, const void * data, size_t size);
+        NVCORE_API bool closeUnbufferedFile(void * file, uint64 size);
+
     } // FileSystem namespace
 
 } // nv namespace
@@ -5,6 +5,15 @@
 
 #include <stdlib.h>
 
+#if NV_OS_LINUX
+#include <malloc.h> // malloc_usable_size
+#elif NV_OS_DARWIN
+#include <malloc/malloc.h> // malloc_size
+#elif NV_CC_MSVC
+#include <malloc.h> // _msize
+#include <intrin.h>
+#endif
+
 #define USE_EFENCE 0
 
 #if USE_EFENCE
@@ -15,6 +24,208 @@ extern "C" void EF_free(void * address);
 
 using namespace nv;
 
+
+namespace
+{
+    MallocHook * s_mallocHook = NULL;
+    ReallocHook * s_reallocHook = NULL;
+    FreeHook * s_freeHook = NULL;
+    SizeHook * s_sizeHook = NULL;
+    void * s_userData = NULL;
+
+    // Allocated bytes, the peak since the start, and the peak of each active tracker, whose bits are set in s_trackerMask.
+    volatile size_t s_allocated = 0;
+    volatile size_t s_peak = 0;
+    volatile size_t s_trackerPeak[mem::kMaxPeakTrackers];
+    volatile uint32 s_trackerMask = 0;
+
+    // nvcore can't use the atomics of nvthread.
+    inline size_t compareAndSwap(volatile size_t * ptr, size_t oldValue, size_t newValue)
+    {
+#if NV_CC_MSVC && NV_CPU_X86_64
+        return (size_t)_InterlockedCompareExchange64((volatile __int64 *)ptr, (__int64)newValue, (__int64)oldValue);
+#elif NV_CC_MSVC
+        return (size_t)_InterlockedCompareExchange((volatile long *)ptr, (long)newValue, (long)oldValue);
+#else
+        return __sync_val_compare_and_swap(ptr, oldValue, newValue);
+#endif
+    }
+
+    inline uint32 compareAndSwap(volatile uint32 * ptr, uint32 oldValue, uint32 newValue)
+    {
+#if NV_CC_MSVC
+        return (uint32)_InterlockedCompareExchange((volatile long *)ptr, (long)newValue, (long)oldValue);
+#else
+        return __sync_val_compare_and_swap(ptr, oldValue, newValue);
+#endif
+    }
+
+    inline void storeMax(volatile size_t * ptr, size_t value)
+    {
+        size_t old = *ptr;
+        while (old < value) {
+            const size_t prev = compareAndSwap(ptr, old, value);
+            if (prev == old) break;
+            old = prev;
+        }
+    }
+
+    inline size_t blockSize(const void * ptr)
+    {
+        if (ptr == NULL) return 0;
+        if (s_mallocHook != NULL) return s_sizeHook != NULL ? s_sizeHook(ptr, s_userData) : 0;
+#if NV_OS_LINUX
+        return malloc_usable_size(const_cast<void *>(ptr));
+#elif NV_OS_DARWIN
+        return malloc_size(ptr);
+#elif NV_CC_MSVC
+        return _msize(const_cast<void *>(ptr));
+#else
+        return 0;
+#endif
+    }
+
+    void addAllocated(size_t size)
+    {
+        if (size == 0) return;
+
+        size_t old = s_allocated;
+        for (;;) {
+            const size_t prev = compareAndSwap(&s_allocated, old, old + size);
+            if (prev == old) break;
+            old = prev;
+        }
+        const size_t allocated = old + size;
+
+        storeMax(&s_peak, allocated);
+
+        for (uint32 mask = s_trackerMask; mask != 0; mask &= mask - 1) {
+            int i = 0;
+            while ((mask & (1U << i)) == 0) i++;
+            storeMax(&s_trackerPeak[i], allocated);
+        }
+    }
+
+    void subAllocated(size_t size)
+    {
+        if (size == 0) return;
+
+        size_t old = s_allocated;
+        for (;;) {
+            const size_t prev = compareAndSwap(&s_allocated, old, old - size);
+            if (prev == old) break;
+            old = prev;
+        }
+    }
+}
+
+void mem::setAllocator(MallocHook * mallocHook, ReallocHook * reallocHook, FreeHook * freeHook, void * userData, SizeHook * sizeHook/*= NULL*/)
+{
+    // All or none, a mix would free memory with the wrong allocator.
+    nvCheck((mallocHook == NULL) == (reallocHook == NULL) && (mallocHook == NULL) == (freeHook == NULL));
+
+    s_mallocHook = mallocHook;
+    s_reallocHook = reallocHook;
+    s_freeHook = freeHook;
+    s_sizeHook = sizeHook;
+    s_userData = userData;
+}
+
+void * mem::malloc(size_t size)
+{
+    void * ptr = (s_mallocHook != NULL) ? s_mallocHook(size, s_userData) : ::malloc(size);
+    addAllocated(blockSize(ptr));
+    return ptr;
+}
+
+void * mem::realloc(void * ptr, size_t size)
+{
+    const size_t oldSize = blockSize(ptr);
+
+    void * newPtr = (s_reallocHook != NULL) ? s_reallocHook(ptr, size, s_userData) : ::realloc(ptr, size);
+
+    // A failed realloc leaves the block alone, a realloc to 0 may free it.
+    if (newPtr != NULL || size == 0) {
+        const size_t newSize = blockSize(newPtr);
+        if (newSize > oldSize) addAllocated(newSize - oldSize);
+        else subAllocated(oldSize - newSize);
+    }
+    return newPtr;
+}
+
+void mem::free(const void * ptr)
+{
+    if (ptr == NULL) return;
+
+    subAllocated(blockSize(ptr));
+
+    if (s_freeHook != NULL) s_freeHook(const_cast<void *>(ptr), s_userData);
+    else ::free(const_cast<void *>(ptr));
+}
+
+size_t mem::allocatedBytes()
+{
+    return s_allocated;
+}
+
+size_t mem::peakAllocatedBytes()
+{
+    return s_peak;
+}
+
+int mem::beginPeakTracking()
+{
+    for (;;) {
+        const uint32 mask = s_trackerMask;
+        if (mask == ~0U) return -1;
+
+        int i = 0;
+        while ((mask & (1U << i)) != 0) i++;
+
+        // The peak starts at the current allocation, before the bit publishes the tracker.
+        s_trackerPeak[i] = s_allocated;
+        if (compareAndSwap(&s_trackerMask, mask, mask | (1U << i)) == mask) return i;
+    }
+}
+
+size_t mem::endPeakTracking(int tracker)
+{
+    if (tracker < 0) return s_peak;
+
+    nvDebugCheck(tracker < kMaxPeakTrackers && (s_trackerMask & (1U << tracker)) != 0);
+
+    const size_t peak = s_trackerPeak[tracker];
+
+    uint32 mask = s_trackerMask;
+    for (;;) {
+        const uint32 prev = compareAndSwap(&s_trackerMask, mask, mask & ~(1U << tracker));
+        if (prev == mask) break;
+        mask = prev;
+    }
+    return peak;
+}
+
+void * mem::alignedMalloc(size_t size, size_t alignment)
+{
+    nvDebugCheck(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+    // The start of the allocation is stored right before the aligned pointer.
+    uint8 * base = (uint8 *)mem::malloc(size + alignment - 1 + sizeof(void *));
+    if (base == NULL) return NULL;
+
+    void ** ptr = (void **)((size_t(base) + sizeof(void *) + alignment - 1) & ~(alignment - 1));
+    ptr[-1] = base;
+    return ptr;
+}
+
+void mem::alignedFree(const void * ptr)
+{
+    if (ptr != NULL) {
+        mem::free(((void * const *)ptr)[-1]);
+    }
+}
+
+
 #if NV_OVERRIDE_ALLOC
 
 void * malloc(size_t size)
@@ -14,8 +14,10 @@
 
 #if NV_CC_GNUC
 #   define NV_ALIGN_16 __attribute__ ((__aligned__ (16)))
+#   define NV_ALIGN_64 __attribute__ ((__aligned__ (64)))
 #else
 #   define NV_ALIGN_16 __declspec(align(16))
+#   define NV_ALIGN_64 __declspec(align(64))
 #endif
 
 
@@ -42,17 +44,54 @@ extern "C" {
 
 namespace nv {
 
+    // Allocator hooks, userData is the value given to setAllocator.
+    typedef void * MallocHook(size_t size, void * userData);
+    typedef void * ReallocHook(void * ptr, size_t size, void * userData);
+    typedef void FreeHook(void * ptr, void * userData);
+    typedef size_t SizeHook(const void * ptr, void * userData);
+
+    namespace mem {
+
+        // Route the allocations of the helpers below, and of the containers, strings and images built on them, to the given
+        // functions. NULL functions restore the C runtime heap. Memory must be freed by the allocator that allocated it, so
+        // the hooks have to be set before anything is allocated and kept while anything allocated with them is alive.
+        // sizeHook returns the size of a live allocation, the allocated bytes are only counted when it's given.
+        NVCORE_API void setAllocator(MallocHook * mallocHook, ReallocHook * reallocHook, FreeHook * freeHook, void * userData, SizeHook * sizeHook = NULL);
+
+        // Bytes currently allocated by the helpers below, as the allocator reports them, and the most allocated at once.
+        // The C runtime heap reports the usable size of each block, which includes its rounding.
+        NVCORE_API size_t allocatedBytes();
+        NVCORE_API size_t peakAllocatedBytes();
+
+        // Track the most bytes allocated at once from beginPeakTracking until endPeakTracking, which returns it. The
+        // allocations of all the threads are counted. Trackers nest and overlap, but only kMaxPeakTrackers can be active at
+        // once, the others return the peak since the start of the process.
+        const int kMaxPeakTrackers = 32;
+        NVCORE_API int beginPeakTracking();
+        NVCORE_API size_t endPeakTracking(int tracker);
+
+        NVCORE_API void * malloc(size_t size);
+        NVCORE_API void * realloc(void * ptr, size_t size);
+        NVCORE_API void free(const void * ptr);
+
+        // Memory aligned to a power of two, for SIMD and unbuffered I/O. It's carved out of a larger allocation, and must be
+        // freed with alignedFree.
+        NVCORE_API void * alignedMalloc(size_t size, size_t alignment);
+        NVCORE_API void alignedFree(const void * ptr);
+
+    } // mem namespace
+
     // C++ helpers.
     template <typename T> NV_FORCEINLINE T * malloc(size_t count) {
-        return (T *)::malloc(sizeof(T) * count);
+        return (T *)mem::malloc(sizeof(T) * count);
     }
 
     template <typename T> NV_FORCEINLINE T * realloc(T * ptr, size_t count) {
-        return (T *)::realloc(ptr, sizeof(T) * count);
+        return (T *)mem::realloc(ptr, sizeof(T) * count);
     }
 
     template <typename T> NV_FORCEINLINE void free(const T * ptr) {
-        ::free((void *)ptr);
+        mem::free(ptr);
     }
 
     template <typename T> NV_FORCEINLINE void zero(T & data) {
@@ -0,0 +1,136 @@
+// This code is in the public domain -- castano@gmail.com
+
+#include "PerfCounters.h"
+#include "Array.inl"
+
+using namespace nv;
+
+#if NV_OS_LINUX
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h> // __NR_perf_event_open
+#include <unistd.h> // syscall, read, close
+#include <dirent.h> // opendir, readdir
+#include <string.h> // memset
+#include <stdlib.h> // atoi
+
+static const uint64 s_config[PerfCounters::Counter_Count] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+// Counter of the given thread, 0 is the calling thread.
+static int openCounter(uint64 config, int tid)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0);
+}
+
+// Open the counters of a thread, all of them or none.
+static bool openThread(Array<int> & fds, int tid)
+{
+    const uint first = fds.count();
+    for (int c = 0; c < PerfCounters::Counter_Count; c++) {
+        int fd = openCounter(s_config[c], tid);
+        if (fd < 0) {
+            while (fds.count() > first) {
+                ::close(fds.back());
+                fds.popBack();
+            }
+            return false;
+        }
+        fds.append(fd);
+    }
+    return true;
+}
+
+bool PerfCounters::open(bool allThreads)
+{
+    close();
+
+    if (!allThreads) {
+        return openThread(m_fds, 0);
+    }
+
+    DIR * dir = opendir("/proc/self/task");
+    if (dir == NULL) return false;
+
+    // Threads that exit in the meantime are skipped, but every thread is refused if the first one is.
+    bool refused = false;
+    while (dirent * entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') continue;
+        if (!openThread(m_fds, atoi(entry->d_name)) && m_fds.isEmpty()) {
+            refused = true;
+            break;
+        }
+    }
+    closedir(dir);
+
+    return !refused && !m_fds.isEmpty();
+}
+
+void PerfCounters::close()
+{
+    for (uint i = 0; i < m_fds.count(); i++) {
+        ::close(m_fds[i]);
+    }
+    m_fds.clear();
+}
+
+void PerfCounters::read(uint64 values[Counter_Count]) const
+{
+    for (int c = 0; c < Counter_Count; c++) values[c] = 0;
+
+    for (uint i = 0; i < m_fds.count(); i++) {
+        uint64 data[3];     // value, time enabled, time running
+        if (::read(m_fds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0) continue;
+
+        double value = double(data[0]);
+        if (data[2] < data[1]) value *= double(data[1]) / double(data[2]);
+
+        values[i % Counter_Count] += uint64(value);
+    }
+}
+
+#else
+
+bool PerfCounters::open(bool allThreads)
+{
+    return false;
+}
+
+void PerfCounters::close()
+{
+}
+
+void PerfCounters::read(uint64 values[Counter_Count]) const
+{
+    for (int c = 0; c < Counter_Count; c++) values[c] = 0;
+}
+
+#endif
+
+PerfCounters::PerfCounters()
+{
+}
+
+PerfCounters::~PerfCounters()
+{
+    close();
+}
+
+const char * PerfCounters::name(Counter counter)
+{
+    static const char * const names[Counter_Count] = { "cycles", "instructions", "cache misses", "branch misses" };
+    return names[counter];
+}
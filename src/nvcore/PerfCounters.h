@@ -0,0 +1,48 @@
+// This code is in the public domain -- castano@gmail.com
+
+#pragma once
+#ifndef NV_CORE_PERFCOUNTERS_H
+#define NV_CORE_PERFCOUNTERS_H
+
+#include "nvcore.h"
+#include "Array.h"
+
+namespace nv {
+
+    // Hardware performance counters of the CPU, for the benchmarks. Only implemented with perf_event on Linux, where the
+    // kernel may also refuse them, see /proc/sys/kernel/perf_event_paranoid. Counts user mode only.
+    class NVCORE_CLASS PerfCounters
+    {
+        NV_FORBID_COPY(PerfCounters);
+    public:
+        enum Counter
+        {
+            Counter_Cycles,
+            Counter_Instructions,
+            Counter_CacheMisses,        // Last level cache.
+            Counter_BranchMisses,
+            Counter_Count
+        };
+
+        PerfCounters();
+        ~PerfCounters();
+
+        // Count the calling thread, or all the threads of the process that exist at this point; the threads created later
+        // are not counted, so open the counters once the worker threads are running. Returns false when the counters are
+        // not available.
+        bool open(bool allThreads);
+        void close();
+        bool isOpen() const { return m_fds.count() != 0; }
+
+        // Totals since open, scaled up when the kernel had to share the hardware counters with other events.
+        void read(uint64 values[Counter_Count]) const;
+
+        static const char * name(Counter counter);
+
+    private:
+        Array<int> m_fds;   // Counter_Count for each thread.
+    };
+
+} // nv namespace
+
+#endif // NV_CORE_PERFCOUNTERS_H
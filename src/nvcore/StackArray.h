@@ -0,0 +1,126 @@
+// This code is in the public domain -- castano@gmail.com
+
+#pragma once
+#ifndef NV_CORE_STACKARRAY_H
+#define NV_CORE_STACKARRAY_H
+
+#include "Memory.h"
+#include "Debug.h"
+#include "Utils.h" // construct_range, destroy_range, max
+
+#include <string.h> // memcpy
+#include <new> // for placement new
+
+
+namespace nv
+{
+    /**
+    * Array with room for N elements inside the object. It only goes to the heap when it grows past
+    * them, so a StackArray sized for the common case keeps per-block code free of allocations.
+    * Like Array, the elements must be relocable.
+    */
+    template<typename T, uint N>
+    class StackArray {
+        NV_FORBID_COPY(StackArray);
+    public:
+        NV_FORCEINLINE StackArray() : m_buffer((T *)m_storage.bytes), m_capacity(N), m_size(0) {}
+
+        NV_FORCEINLINE explicit StackArray(uint size) : m_buffer((T *)m_storage.bytes), m_capacity(N), m_size(0) {
+            resize(size);
+        }
+
+        NV_FORCEINLINE StackArray(uint size, const T & elem) : m_buffer((T *)m_storage.bytes), m_capacity(N), m_size(0) {
+            resize(size, elem);
+        }
+
+        NV_FORCEINLINE ~StackArray() {
+            clear();
+            if (!isLocal()) free<T>(m_buffer);
+        }
+
+        NV_FORCEINLINE const T & operator[]( uint index ) const
+        {
+            nvDebugCheck(index < m_size);
+            return m_buffer[index];
+        }
+
+        NV_FORCEINLINE T & operator[]( uint index )
+        {
+            nvDebugCheck(index < m_size);
+            return m_buffer[index];
+        }
+
+        NV_FORCEINLINE uint size() const { return m_size; }
+        NV_FORCEINLINE uint capacity() const { return m_capacity; }
+        NV_FORCEINLINE bool isEmpty() const { return m_size == 0; }
+
+        /// True while the elements live inside the object.
+        NV_FORCEINLINE bool isLocal() const { return m_buffer == (const T *)m_storage.bytes; }
+
+        NV_FORCEINLINE const T * buffer() const { return m_buffer; }
+        NV_FORCEINLINE T * buffer() { return m_buffer; }
+
+        NV_FORCEINLINE T * begin() { return m_buffer; }
+        NV_FORCEINLINE T * end() { return m_buffer + m_size; }
+        NV_FORCEINLINE const T * begin() const { return m_buffer; }
+        NV_FORCEINLINE const T * end() const { return m_buffer + m_size; }
+
+        void push_back(const T & val)
+        {
+            nvDebugCheck(&val < m_buffer || &val >= m_buffer + m_size);
+            reserve(m_size + 1);
+            new(m_buffer + m_size) T(val);
+            m_size++;
+        }
+
+        void resize(uint new_size)
+        {
+            reserve(new_size);
+            if (new_size < m_size) destroy_range(m_buffer, new_size, m_size);
+            else construct_range(m_buffer, new_size, m_size);
+            m_size = new_size;
+        }
+
+        void resize(uint new_size, const T & elem)
+        {
+            nvDebugCheck(&elem < m_buffer || &elem >= m_buffer + m_size);
+            reserve(new_size);
+            if (new_size < m_size) destroy_range(m_buffer, new_size, m_size);
+            else construct_range(m_buffer, new_size, m_size, elem);
+            m_size = new_size;
+        }
+
+        void clear()
+        {
+            destroy_range(m_buffer, 0, m_size);
+            m_size = 0;
+        }
+
+        void reserve(uint desired_capacity)
+        {
+            if (desired_capacity <= m_capacity) return;
+
+            const uint new_capacity = max(desired_capacity, 2 * m_capacity);
+            T * new_buffer = malloc<T>(new_capacity);
+            if (m_size != 0) memcpy((void *)new_buffer, m_buffer, sizeof(T) * m_size);
+            if (!isLocal()) free<T>(m_buffer);
+
+            m_buffer = new_buffer;
+            m_capacity = new_capacity;
+        }
+
+    private:
+        T * m_buffer;
+        uint m_capacity;
+        uint m_size;
+
+        union {
+            uint8 bytes[N * sizeof(T)];
+            double alignDouble;
+            void * alignPointer;
+        } m_storage;
+    };
+
+} // nv namespace
+
+#endif // NV_CORE_STACKARRAY_H
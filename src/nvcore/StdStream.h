@@ -7,6 +7,7 @@
 #include "nvcore.h"
 #include "Stream.h"
 #include "Array.h"
+#include "FileSystem.h" // mapFile
 
 #include <stdio.h> // fopen
 #include <string.h> // memcpy
@@ -54,41 +55,26 @@ namespace nv
 
         /** @name Stream implementation. */
         //@{
-        virtual void seek( uint pos )
+        virtual void seek( uint64 pos )
         {
             nvDebugCheck(m_fp != NULL);
             nvDebugCheck(pos <= size());
-#if NV_OS_WIN32
-            _fseek_nolock(m_fp, pos, SEEK_SET);
-#else
-            fseek(m_fp, pos, SEEK_SET);
-#endif
+            fileSeek(m_fp, int64(pos), SEEK_SET);
         }
 
-        virtual uint tell() const
+        virtual uint64 tell() const
         {
             nvDebugCheck(m_fp != NULL);
-#if NV_OS_WIN32
-            return _ftell_nolock(m_fp);
-#else
-            return (uint)ftell(m_fp);
-#endif
+            return fileTell(m_fp);
         }
 
-        virtual uint size() const
+        virtual uint64 size() const
         {
             nvDebugCheck(m_fp != NULL);
-#if NV_OS_WIN32
-            uint pos = _ftell_nolock(m_fp);
-            _fseek_nolock(m_fp, 0, SEEK_END);
-            uint end = _ftell_nolock(m_fp);
-            _fseek_nolock(m_fp, pos, SEEK_SET);
-#else
-            uint pos = (uint)ftell(m_fp);
-            fseek(m_fp, 0, SEEK_END);
-            uint end = (uint)ftell(m_fp);
-            fseek(m_fp, pos, SEEK_SET);
-#endif
+            uint64 pos = fileTell(m_fp);
+            fileSeek(m_fp, 0, SEEK_END);
+            uint64 end = fileTell(m_fp);
+            fileSeek(m_fp, int64(pos), SEEK_SET);
             return end;
         }
 
@@ -111,18 +97,7 @@ namespace nv
             if (m_fp == NULL) return true;
             //nvDebugCheck(m_fp != NULL);
             //return feof( m_fp ) != 0;
-#if NV_OS_WIN32
-            uint pos = _ftell_nolock(m_fp);
-            _fseek_nolock(m_fp, 0, SEEK_END);
-            uint end = _ftell_nolock(m_fp);
-            _fseek_nolock(m_fp, pos, SEEK_SET);
-#else
-            uint pos = (uint)ftell(m_fp);
-            fseek(m_fp, 0, SEEK_END);
-            uint end = (uint)ftell(m_fp);
-            fseek(m_fp, pos, SEEK_SET);
-#endif
-            return pos == end;
+            return tell() == size();
         }
 
         /// Always true.
@@ -131,6 +106,29 @@ namespace nv
 
     protected:
 
+        // 64 bit versions of fseek and ftell.
+        static void fileSeek(FILE * fp, int64 offset, int origin)
+        {
+#if NV_OS_WIN32
+            _fseeki64_nolock(fp, offset, origin);
+#elif NV_OS_UNIX
+            fseeko(fp, off_t(offset), origin);
+#else
+            fseek(fp, long(offset), origin);
+#endif
+        }
+
+        static uint64 fileTell(FILE * fp)
+        {
+#if NV_OS_WIN32
+            return uint64(_ftelli64_nolock(fp));
+#elif NV_OS_UNIX
+            return uint64(ftello(fp));
+#else
+            return uint64(ftell(fp));
+#endif
+        }
+
         FILE * m_fp;
         bool m_autoclose;
 
@@ -245,7 +243,7 @@ namespace nv
     public:
 
         /// Ctor.
-        MemoryInputStream( const uint8 * mem, uint size ) : m_mem(mem), m_ptr(mem), m_size(size) { }
+        MemoryInputStream( const uint8 * mem, uint64 size ) : m_mem(mem), m_ptr(mem), m_size(size) { }
 
         /** @name Stream implementation. */
         //@{
@@ -255,8 +253,8 @@ namespace nv
             nvDebugCheck(data != NULL);
             nvDebugCheck(!isError());
 
-            uint left = m_size - tell();
-            if (len > left) len = left;
+            uint64 left = m_size - tell();
+            if (len > left) len = uint(left);
 
             memcpy( data, m_ptr, len );
             m_ptr += len;
@@ -264,20 +262,38 @@ namespace nv
             return len;
         }
 
-        virtual void seek( uint pos )
+        virtual uint64 serializeBuffers( const Buffer * buffers, uint count )
+        {
+            nvDebugCheck(!isError());
+
+            uint64 total = 0;
+            for (uint i = 0; i < count; i++) {
+                uint64 len = buffers[i].size;
+                uint64 left = m_size - tell();
+                if (len > left) len = left;
+
+                memcpy( buffers[i].data, m_ptr, size_t(len) );
+                m_ptr += len;
+                total += len;
+            }
+
+            return total;
+        }
+
+        virtual void seek( uint64 pos )
         {
             nvDebugCheck(!isError());
             m_ptr = m_mem + pos;
             nvDebugCheck(!isError());
         }
 
-        virtual uint tell() const
+        virtual uint64 tell() const
         {
             nvDebugCheck(m_ptr >= m_mem);
-            return uint(m_ptr - m_mem);
+            return uint64(m_ptr - m_mem);
         }
 
-        virtual uint size() const
+        virtual uint64 size() const
         {
             return m_size;
         }
@@ -317,11 +333,46 @@ namespace nv
         const uint8 * ptr() const { return m_ptr; }
 
 
-    private:
+    protected:
 
         const uint8 * m_mem;
         const uint8 * m_ptr;
-        uint m_size;
+        uint64 m_size;
+
+    };
+
+
+    /// Memory mapped file input stream. Reads are copies out of the mapping, data() gives direct access to the file
+    /// contents while the stream is alive.
+    class NVCORE_CLASS MappedInputStream : public MemoryInputStream
+    {
+        NV_FORBID_COPY(MappedInputStream);
+    public:
+
+        /// Ctor. The stream is in error state when the file can't be mapped.
+        MappedInputStream( const char * name ) : MemoryInputStream(NULL, 0), m_mappedSize(0)
+        {
+            const void * mem = FileSystem::mapFile(name, &m_mappedSize);
+
+            if (mem != NULL) {
+                m_mem = m_ptr = (const uint8 *)mem;
+                m_size = m_mappedSize;
+            }
+        }
+
+        /// Dtor.
+        virtual ~MappedInputStream()
+        {
+            if (m_mem != NULL) {
+                FileSystem::unmapFile(m_mem, m_mappedSize);
+            }
+        }
+
+        const uint8 * data() const { return m_mem; }
+
+    private:
+
+        size_t m_mappedSize;
 
     };
 
@@ -341,9 +392,9 @@ namespace nv
             return len;
         }
 
-        virtual void seek( uint /*pos*/ ) { /*Not implemented*/ }
-        virtual uint tell() const { return m_buffer.size(); }
-        virtual uint size() const { return m_buffer.size(); }
+        virtual void seek( uint64 /*pos*/ ) { /*Not implemented*/ }
+        virtual uint64 tell() const { return m_buffer.size(); }
+        virtual uint64 size() const { return m_buffer.size(); }
 
         virtual bool isError() const { return false; }
         virtual void clearError() {}
@@ -399,7 +450,7 @@ namespace nv
             return len;
         }
 
-        virtual void seek( uint pos )
+        virtual void seek( uint64 pos )
         {
             m_s->seek( pos );
 
@@ -408,12 +459,12 @@ namespace nv
             }
         }
 
-        virtual uint tell() const
+        virtual uint64 tell() const
         {
             return m_s->tell();
         }
 
-        virtual uint size() const
+        virtual uint64 size() const
         {
             return m_s->size();
         }
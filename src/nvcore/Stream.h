@@ -42,17 +42,56 @@ namespace nv
         ByteOrder byteOrder() const { return m_byteOrder; }
 
 
+        /// One buffer of a vectored transfer.
+        struct Buffer {
+            void * data;
+            uint64 size;
+        };
+
+
         /// Serialize the given data.
         virtual uint serialize( void * data, uint len ) = 0;
 
+        /// Serialize a list of buffers in order, with no limit on their size. Returns the number of bytes transferred, which
+        /// is less than the total only on error or at the end of an input stream. The default splits the buffers in calls
+        /// to serialize.
+        virtual uint64 serializeBuffers( const Buffer * buffers, uint count )
+        {
+            const uint64 maxChunk = 1U << 30;
+            uint64 total = 0;
+
+            for (uint i = 0; i < count; i++) {
+                uint8 * ptr = (uint8 *)buffers[i].data;
+                uint64 left = buffers[i].size;
+
+                while (left > 0) {
+                    const uint len = uint(left < maxChunk ? left : maxChunk);
+                    const uint n = serialize(ptr, len);
+                    total += n;
+                    if (n != len) return total;
+                    ptr += n;
+                    left -= n;
+                }
+            }
+
+            return total;
+        }
+
+        /// Serialize a single buffer of any size.
+        uint64 serializeBuffer( void * data, uint64 len )
+        {
+            Buffer buffer = { data, len };
+            return serializeBuffers(&buffer, 1);
+        }
+
         /// Move to the given position in the archive.
-        virtual void seek( uint pos ) = 0;
+        virtual void seek( uint64 pos ) = 0;
 
         /// Return the current position in the archive.
-        virtual uint tell() const = 0;
+        virtual uint64 tell() const = 0;
 
         /// Return the current size of the archive.
-        virtual uint size() const = 0;
+        virtual uint64 size() const = 0;
 
         /// Determine if there has been any error.
         virtual bool isError() const = 0;
@@ -73,7 +112,7 @@ namespace nv
         virtual bool isSaving() const = 0;
 
 
-        void advance(uint offset) { seek(tell() + offset); }
+        void advance(uint64 offset) { seek(tell() + offset); }
 
 
         // friends	
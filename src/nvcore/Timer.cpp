@@ -27,18 +27,37 @@ uint64 nv::systemClock()
     return counter;
 }
 
+#elif NV_OS_DARWIN
+
+#include <mach/mach_time.h> // mach_absolute_time, mach_timebase_info
+
+uint64 nv::systemClockFrequency()
+{
+    mach_timebase_info_data_t info;
+    mach_timebase_info(&info);
+    return (uint64(1000000000) * info.denom) / info.numer;
+}
+
+uint64 nv::systemClock()
+{
+    return mach_absolute_time();
+}
+
 #else
 
-#include <time.h> // clock
+#include <time.h> // clock_gettime
 
+// Monotonic wall clock time. clock() measures the CPU time of the process, which adds up the time of all the threads.
 uint64 nv::systemClockFrequency()
 {
-    return CLOCKS_PER_SEC;
+    return 1000000000;
 }
 
 uint64 nv::systemClock()
 {
-    return clock();
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
 }
 
 #endif
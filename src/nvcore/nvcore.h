@@ -137,6 +137,21 @@
 #endif
 #endif
 
+// Relaxed constexpr, functions with loops and local variables that are evaluated at compile time.
+#if NV_CC_MSVC
+#define NV_CC_CPP14 (_MSVC_LANG >= 201402L)
+#else
+#define NV_CC_CPP14 (__cplusplus >= 201402L)
+#endif
+
+// Lookup tables are built by functions that C++14 compilers evaluate at compile time. Tables declared as function local
+// statics are then built by older compilers the first time they are used, and once, even when threads race to use them.
+#if NV_CC_CPP14
+#define NV_TABLE_CONSTEXPR constexpr
+#else
+#define NV_TABLE_CONSTEXPR
+#endif
+
 // Endiannes:
 #define NV_LITTLE_ENDIAN    POSH_LITTLE_ENDIAN
 #define NV_BIG_ENDIAN       POSH_BIG_ENDIAN
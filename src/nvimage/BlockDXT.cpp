@@ -28,9 +28,13 @@
 #include "nvcore/Utils.h" // swap
 #include "nvmath/Half.h"
 #include "nvmath/Vector.inl"
+#include "nvthread/TaskScheduler.h"
 
-#include "bc6h/zoh.h"
-#include "bc7/avpcl.h"
+#include <string.h> // memset
+
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
 
 
 using namespace nv;
@@ -40,62 +44,102 @@ using namespace nv;
 BlockDXT1
 ----------------------------------------------------------------------------*/
 
-uint BlockDXT1::evaluatePalette(Color32 color_array[4], bool d3d9/*= false*/) const
+namespace
 {
-    // Does bit expansion before interpolation.
-    color_array[0].b = (col0.b << 3) | (col0.b >> 2);
-    color_array[0].g = (col0.g << 2) | (col0.g >> 4);
-    color_array[0].r = (col0.r << 3) | (col0.r >> 2);
-    color_array[0].a = 0xFF;
+    // Palette of a BC1 decoder, indexed by the 5 and 6 bit values of the endpoint channels.
+    struct PaletteTables
+    {
+        uint8 expand5[32];
+        uint8 expand6[64];
+        uint8 lerp5[32][32];    // Color 2 of four color blocks is lerp[col0][col1], color 3 is lerp[col1][col0].
+        uint8 lerp6[64][64];
+        uint8 mid5[32][32];     // Color 2 of three color blocks is mid[col0][col1].
+        uint8 mid6[64][64];
+    };
+
+    NV_TABLE_CONSTEXPR PaletteTables makePaletteTables(BlockDecoder decoder)
+    {
+        PaletteTables t = {};
+        const bool nv5x = (decoder == BlockDecoder_NV5x);
+        const int bias = (decoder == BlockDecoder_D3D9) ? 1 : 0;
+
+        // Does bit expansion before interpolation.
+        for (int a = 0; a < 32; a++) t.expand5[a] = uint8(nv5x ? (3 * a * 22) / 8 : (a << 3) | (a >> 2));
+        for (int a = 0; a < 64; a++) t.expand6[a] = uint8((a << 2) | (a >> 4));
+
+        for (int a = 0; a < 32; a++) {
+            for (int b = 0; b < 32; b++) {
+                if (nv5x) {
+                    t.lerp5[a][b] = uint8(((2 * a + b) * 22) / 8);
+                    t.mid5[a][b] = uint8(((a + b) * 33) / 8);
+                }
+                else {
+                    t.lerp5[a][b] = uint8((2 * t.expand5[a] + t.expand5[b] + bias) / 3);
+                    t.mid5[a][b] = uint8((t.expand5[a] + t.expand5[b]) / 2);
+                }
+            }
+        }
 
-    // @@ Same as above, but faster?
-    //	Color32 c;
-    //	c.u = ((col0.u << 3) & 0xf8) | ((col0.u << 5) & 0xfc00) | ((col0.u << 8) & 0xf80000);
-    //	c.u |= (c.u >> 5) & 0x070007;
-    //	c.u |= (c.u >> 6) & 0x000300;
-    //	color_array[0].u = c.u;
+        for (int a = 0; a < 64; a++) {
+            for (int b = 0; b < 64; b++) {
+                const int ea = t.expand6[a];
+                const int eb = t.expand6[b];
+                if (nv5x) {
+                    const int gdiff = eb - ea;
+                    t.lerp6[a][b] = uint8((256 * ea + gdiff / 4 + 128 + gdiff * 80) / 256);
+                    t.mid6[a][b] = uint8((256 * ea + gdiff / 4 + 128 + gdiff * 128) / 256);
+                }
+                else {
+                    t.lerp6[a][b] = uint8((2 * ea + eb + bias) / 3);
+                    t.mid6[a][b] = uint8((ea + eb) / 2);
+                }
+            }
+        }
 
-    color_array[1].r = (col1.r << 3) | (col1.r >> 2);
-    color_array[1].g = (col1.g << 2) | (col1.g >> 4);
-    color_array[1].b = (col1.b << 3) | (col1.b >> 2);
-    color_array[1].a = 0xFF;
+        return t;
+    }
 
-    // @@ Same as above, but faster?
-    //	c.u = ((col1.u << 3) & 0xf8) | ((col1.u << 5) & 0xfc00) | ((col1.u << 8) & 0xf80000);
-    //	c.u |= (c.u >> 5) & 0x070007;
-    //	c.u |= (c.u >> 6) & 0x000300;
-    //	color_array[1].u = c.u;
+    // Indexed by BlockDecoder, 30 KB. Built at compile time by C++14 compilers, by older ones on first use in about 30 us.
+    const PaletteTables & paletteTables(BlockDecoder decoder)
+    {
+        static NV_TABLE_CONSTEXPR const PaletteTables s_paletteTables[3] = {
+            makePaletteTables(BlockDecoder_D3D10),
+            makePaletteTables(BlockDecoder_D3D9),
+            makePaletteTables(BlockDecoder_NV5x),
+        };
+        return s_paletteTables[decoder];
+    }
 
-    if( col0.u > col1.u ) {
-        int bias = 0;
-        if (d3d9) bias = 1;
+    inline void evaluatePalette4(const PaletteTables & t, Color16 col0, Color16 col1, Color32 color_array[4])
+    {
+        color_array[0] = Color32(t.expand5[col0.r], t.expand6[col0.g], t.expand5[col0.b], 0xFF);
+        color_array[1] = Color32(t.expand5[col1.r], t.expand6[col1.g], t.expand5[col1.b], 0xFF);
+        color_array[2] = Color32(t.lerp5[col0.r][col1.r], t.lerp6[col0.g][col1.g], t.lerp5[col0.b][col1.b], 0xFF);
+        color_array[3] = Color32(t.lerp5[col1.r][col0.r], t.lerp6[col1.g][col0.g], t.lerp5[col1.b][col0.b], 0xFF);
+    }
 
-        // Four-color block: derive the other two colors.
-        color_array[2].r = (2 * color_array[0].r + color_array[1].r + bias) / 3;
-        color_array[2].g = (2 * color_array[0].g + color_array[1].g + bias) / 3;
-        color_array[2].b = (2 * color_array[0].b + color_array[1].b + bias) / 3;
-        color_array[2].a = 0xFF;
+    inline void evaluatePalette3(const PaletteTables & t, Color16 col0, Color16 col1, Color32 color_array[4])
+    {
+        color_array[0] = Color32(t.expand5[col0.r], t.expand6[col0.g], t.expand5[col0.b], 0xFF);
+        color_array[1] = Color32(t.expand5[col1.r], t.expand6[col1.g], t.expand5[col1.b], 0xFF);
+        color_array[2] = Color32(t.mid5[col0.r][col1.r], t.mid6[col0.g][col1.g], t.mid5[col0.b][col1.b], 0xFF);
 
-        color_array[3].r = (2 * color_array[1].r + color_array[0].r + bias) / 3;
-        color_array[3].g = (2 * color_array[1].g + color_array[0].g + bias) / 3;
-        color_array[3].b = (2 * color_array[1].b + color_array[0].b + bias) / 3;
-        color_array[3].a = 0xFF;
+        // Set all components to 0 to match DXT specs.
+        color_array[3].u = 0;
+    }
+}
+
+
+uint BlockDXT1::evaluatePalette(Color32 color_array[4], bool d3d9/*= false*/) const
+{
+    const PaletteTables & t = paletteTables(d3d9 ? BlockDecoder_D3D9 : BlockDecoder_D3D10);
 
+    if( col0.u > col1.u ) {
+        ::evaluatePalette4(t, col0, col1, color_array);
         return 4;
     }
     else {
-        // Three-color block: derive the other color.
-        color_array[2].r = (color_array[0].r + color_array[1].r) / 2;
-        color_array[2].g = (color_array[0].g + color_array[1].g) / 2;
-        color_array[2].b = (color_array[0].b + color_array[1].b) / 2;
-        color_array[2].a = 0xFF;
-
-        // Set all components to 0 to match DXT specs.
-        color_array[3].r = 0x00; // color_array[2].r;
-        color_array[3].g = 0x00; // color_array[2].g;
-        color_array[3].b = 0x00; // color_array[2].b;
-        color_array[3].a = 0x00;
-
+        ::evaluatePalette3(t, col0, col1, color_array);
         return 3;
     }
 }
@@ -103,46 +147,14 @@ uint BlockDXT1::evaluatePalette(Color32 color_array[4], bool d3d9/*= false*/) co
 
 uint BlockDXT1::evaluatePaletteNV5x(Color32 color_array[4]) const
 {
-    // Does bit expansion before interpolation.
-    color_array[0].b = (3 * col0.b * 22) / 8;
-    color_array[0].g = (col0.g << 2) | (col0.g >> 4);
-    color_array[0].r = (3 * col0.r * 22) / 8;
-    color_array[0].a = 0xFF;
-
-    color_array[1].r = (3 * col1.r * 22) / 8;
-    color_array[1].g = (col1.g << 2) | (col1.g >> 4);
-    color_array[1].b = (3 * col1.b * 22) / 8;
-    color_array[1].a = 0xFF;
-
-    int gdiff = color_array[1].g - color_array[0].g;
+    const PaletteTables & t = paletteTables(BlockDecoder_NV5x);
 
     if( col0.u > col1.u ) {
-        // Four-color block: derive the other two colors.
-        color_array[2].r = ((2 * col0.r + col1.r) * 22) / 8;
-        color_array[2].g = (256 * color_array[0].g + gdiff / 4 + 128 + gdiff * 80) / 256;
-        color_array[2].b = ((2 * col0.b + col1.b) * 22) / 8;
-        color_array[2].a = 0xFF;
-
-        color_array[3].r = ((2 * col1.r + col0.r) * 22) / 8;
-        color_array[3].g = (256 * color_array[1].g - gdiff / 4 + 128 - gdiff * 80) / 256;
-        color_array[3].b = ((2 * col1.b + col0.b) * 22) / 8;
-        color_array[3].a = 0xFF;
-
+        ::evaluatePalette4(t, col0, col1, color_array);
         return 4;
     }
     else {
-        // Three-color block: derive the other color.
-        color_array[2].r = ((col0.r + col1.r) * 33) / 8;
-        color_array[2].g = (256 * color_array[0].g + gdiff / 4 + 128 + gdiff * 128) / 256;
-        color_array[2].b = ((col0.b + col1.b) * 33) / 8;
-        color_array[2].a = 0xFF;
-
-        // Set all components to 0 to match DXT specs.
-        color_array[3].r = 0x00;
-        color_array[3].g = 0x00;
-        color_array[3].b = 0x00;
-        color_array[3].a = 0x00;
-
+        ::evaluatePalette3(t, col0, col1, color_array);
         return 3;
     }
 }
@@ -150,55 +162,13 @@ uint BlockDXT1::evaluatePaletteNV5x(Color32 color_array[4]) const
 // Evaluate palette assuming 3 color block.
 void BlockDXT1::evaluatePalette3(Color32 color_array[4], bool d3d9) const
 {
-    color_array[0].b = (col0.b << 3) | (col0.b >> 2);
-    color_array[0].g = (col0.g << 2) | (col0.g >> 4);
-    color_array[0].r = (col0.r << 3) | (col0.r >> 2);
-    color_array[0].a = 0xFF;
-
-    color_array[1].r = (col1.r << 3) | (col1.r >> 2);
-    color_array[1].g = (col1.g << 2) | (col1.g >> 4);
-    color_array[1].b = (col1.b << 3) | (col1.b >> 2);
-    color_array[1].a = 0xFF;
-
-    // Three-color block: derive the other color.
-    color_array[2].r = (color_array[0].r + color_array[1].r) / 2;
-    color_array[2].g = (color_array[0].g + color_array[1].g) / 2;
-    color_array[2].b = (color_array[0].b + color_array[1].b) / 2;
-    color_array[2].a = 0xFF;
-
-    // Set all components to 0 to match DXT specs.
-    color_array[3].r = 0x00;
-    color_array[3].g = 0x00;
-    color_array[3].b = 0x00;
-    color_array[3].a = 0x00;
+    ::evaluatePalette3(paletteTables(d3d9 ? BlockDecoder_D3D9 : BlockDecoder_D3D10), col0, col1, color_array);
 }
 
 // Evaluate palette assuming 4 color block.
 void BlockDXT1::evaluatePalette4(Color32 color_array[4], bool d3d9) const
 {
-    color_array[0].b = (col0.b << 3) | (col0.b >> 2);
-    color_array[0].g = (col0.g << 2) | (col0.g >> 4);
-    color_array[0].r = (col0.r << 3) | (col0.r >> 2);
-    color_array[0].a = 0xFF;
-
-    color_array[1].r = (col1.r << 3) | (col1.r >> 2);
-    color_array[1].g = (col1.g << 2) | (col1.g >> 4);
-    color_array[1].b = (col1.b << 3) | (col1.b >> 2);
-    color_array[1].a = 0xFF;
-
-    int bias = 0;
-    if (d3d9) bias = 1;
-
-    // Four-color block: derive the other two colors.
-    color_array[2].r = (2 * color_array[0].r + color_array[1].r + bias) / 3;
-    color_array[2].g = (2 * color_array[0].g + color_array[1].g + bias) / 3;
-    color_array[2].b = (2 * color_array[0].b + color_array[1].b + bias) / 3;
-    color_array[2].a = 0xFF;
-
-    color_array[3].r = (2 * color_array[1].r + color_array[0].r + bias) / 3;
-    color_array[3].g = (2 * color_array[1].g + color_array[0].g + bias) / 3;
-    color_array[3].b = (2 * color_array[1].b + color_array[0].b + bias) / 3;
-    color_array[3].a = 0xFF;
+    ::evaluatePalette4(paletteTables(d3d9 ? BlockDecoder_D3D9 : BlockDecoder_D3D10), col0, col1, color_array);
 }
 
 
@@ -631,50 +601,467 @@ void BlockCTX1::setIndices(int * idx)
 }
 
 
+/*----------------------------------------------------------------------------
+BlockBC6 and BlockBC7
+----------------------------------------------------------------------------*/
+
+namespace
+{
+    // Reads a BC6 or BC7 block as a little endian stream of 128 bits.
+    struct BlockBits
+    {
+        BlockBits(const uint8 * data) : lo(0), hi(0), pos(0)
+        {
+            for (uint i = 0; i < 8; i++) {
+                lo |= uint64(data[i]) << (8 * i);
+                hi |= uint64(data[8 + i]) << (8 * i);
+            }
+        }
+
+        uint read(uint count)
+        {
+            nvDebugCheck(count <= 16 && pos + count <= 128);
+            uint64 bits;
+            if (pos >= 64) bits = hi >> (pos - 64);
+            else if (pos == 0) bits = lo;
+            else bits = (lo >> pos) | (hi << (64 - pos));
+            pos += count;
+            return uint(bits & ((uint64(1) << count) - 1));
+        }
+
+        uint64 lo, hi;
+        uint pos;
+    };
+
+    // Interpolation weights of 2, 3 and 4 bit indices, divided by 64.
+    static const uint8 weights2[4] = { 0, 21, 43, 64 };
+    static const uint8 weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+    static const uint8 weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    static const uint8 * const weightTable[5] = { NULL, NULL, weights2, weights3, weights4 };
+
+    // Subset of every pixel, 2 bits per pixel, for the 64 two and three subset partitions.
+    static const uint32 partitionTable[2][64] = {
+      {
+        0x50505050, 0x40404040, 0x54545454, 0x54505040, 0x50404000, 0x55545450, 0x55545040, 0x54504000,
+        0x50400000, 0x55555450, 0x55544000, 0x54400000, 0x55555440, 0x55550000, 0x55555500, 0x55000000,
+        0x55150100, 0x00004054, 0x15010000, 0x00405054, 0x00004050, 0x15050100, 0x05010000, 0x40505054,
+        0x00404050, 0x05010100, 0x14141414, 0x05141450, 0x01155440, 0x00555500, 0x15014054, 0x05414150,
+        0x44444444, 0x55005500, 0x11441144, 0x05055050, 0x05500550, 0x11114444, 0x41144114, 0x44111144,
+        0x15055054, 0x01055040, 0x05041050, 0x05455150, 0x14414114, 0x50050550, 0x41411414, 0x00141400,
+        0x00041504, 0x00105410, 0x10541000, 0x04150400, 0x50410514, 0x41051450, 0x05415014, 0x14054150,
+        0x41050514, 0x41505014, 0x40011554, 0x54150140, 0x50505500, 0x00555050, 0x15151010, 0x54540404,
+      },
+      {
+        0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+        0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+        0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+        0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+        0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+        0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+        0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+        0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254,
+      }
+    };
+
+    // Index of the anchor pixel of the second and third subsets, the first subset is anchored at pixel 0.
+    static const uint8 anchorTable[3][64] = {
+      {
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+        15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+         6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15,
+      },
+      {
+         3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+         3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+         8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+         3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3,
+      },
+      {
+        15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+        15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+        15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+        15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8,
+      }
+    };
+
+    inline bool isAnchor(uint i, uint subsets, uint partition)
+    {
+        return i == 0 || (subsets >= 2 && i == anchorTable[subsets - 2][partition]) || (subsets == 3 && i == anchorTable[2][partition]);
+    }
+
+    struct BC7Mode
+    {
+        uint8 subsets;
+        uint8 partitionBits;
+        uint8 rotationBits;
+        uint8 indexSelectionBits;
+        uint8 colorBits;
+        uint8 alphaBits;
+        uint8 endpointPBits;    // one p-bit per endpoint
+        uint8 sharedPBits;      // one p-bit per subset
+        uint8 indexBits;
+        uint8 indexBits2;
+    };
+
+    static const BC7Mode bc7Modes[8] = {
+        { 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+        { 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+        { 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+        { 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+        { 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+        { 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+        { 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+        { 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+    };
+
+    inline uint8 expandBits(uint v, uint bits)
+    {
+        return uint8((v << (8 - bits)) | (v >> (2 * bits - 8)));
+    }
+
+    inline uint8 interpolate(uint a, uint b, uint weight)
+    {
+        return uint8(((64 - weight) * a + weight * b + 32) >> 6);
+    }
+
+    void decodeBC7(const uint8 * data, ColorBlock * block)
+    {
+        uint mode = 0;
+        while (mode < 8 && (data[0] & (1 << mode)) == 0) mode++;
+
+        if (mode == 8) {
+            // Reserved mode, decodes to transparent black.
+            for (uint i = 0; i < 16; i++) block->color(i) = Color32(0, 0, 0, 0);
+            return;
+        }
+
+        const BC7Mode & m = bc7Modes[mode];
+        BlockBits bits(data);
+        bits.read(mode + 1);
+
+        const uint partition = bits.read(m.partitionBits);
+        const uint rotation = bits.read(m.rotationBits);
+        const uint indexSelection = bits.read(m.indexSelectionBits);
+
+        // Endpoints are stored channel by channel.
+        const uint endpointCount = 2 * m.subsets;
+        uint endpoints[6][4];
+        for (uint c = 0; c < 3; c++) {
+            for (uint e = 0; e < endpointCount; e++) endpoints[e][c] = bits.read(m.colorBits);
+        }
+        for (uint e = 0; e < endpointCount; e++) endpoints[e][3] = m.alphaBits ? bits.read(m.alphaBits) : 255;
+
+        uint colorBits = m.colorBits;
+        uint alphaBits = m.alphaBits;
+        if (m.endpointPBits) {
+            for (uint e = 0; e < endpointCount; e++) {
+                uint p = bits.read(1);
+                for (uint c = 0; c < 3; c++) endpoints[e][c] = (endpoints[e][c] << 1) | p;
+                if (alphaBits) endpoints[e][3] = (endpoints[e][3] << 1) | p;
+            }
+            colorBits++;
+            if (alphaBits) alphaBits++;
+        }
+        if (m.sharedPBits) {
+            for (uint s = 0; s < m.subsets; s++) {
+                uint p = bits.read(1);
+                for (uint c = 0; c < 3; c++) {
+                    endpoints[2 * s + 0][c] = (endpoints[2 * s + 0][c] << 1) | p;
+                    endpoints[2 * s + 1][c] = (endpoints[2 * s + 1][c] << 1) | p;
+                }
+            }
+            colorBits++;
+        }
+
+        for (uint e = 0; e < endpointCount; e++) {
+            for (uint c = 0; c < 3; c++) endpoints[e][c] = expandBits(endpoints[e][c], colorBits);
+            if (alphaBits) endpoints[e][3] = expandBits(endpoints[e][3], alphaBits);
+        }
+
+        uint8 indices[16], indices2[16];
+        for (uint i = 0; i < 16; i++) {
+            indices[i] = uint8(bits.read(m.indexBits - (isAnchor(i, m.subsets, partition) ? 1 : 0)));
+        }
+        if (m.indexBits2) {
+            for (uint i = 0; i < 16; i++) indices2[i] = uint8(bits.read(m.indexBits2 - (i == 0 ? 1 : 0)));
+        }
+        nvDebugCheck(bits.pos == 128);
+
+        // With two index sets, the index selection bit picks the one used by the color.
+        const uint8 * colorIndices = indices;
+        const uint8 * alphaIndices = indices;
+        const uint8 * colorWeights = weightTable[m.indexBits];
+        const uint8 * alphaWeights = weightTable[m.indexBits];
+        if (m.indexBits2) {
+            alphaIndices = indices2;
+            alphaWeights = weightTable[m.indexBits2];
+            if (indexSelection) {
+                swap(colorIndices, alphaIndices);
+                swap(colorWeights, alphaWeights);
+            }
+        }
+
+        const uint32 subsets = m.subsets == 1 ? 0 : partitionTable[m.subsets - 2][partition];
+
+        for (uint i = 0; i < 16; i++) {
+            const uint s = (subsets >> (2 * i)) & 3;
+            const uint * e0 = endpoints[2 * s + 0];
+            const uint * e1 = endpoints[2 * s + 1];
+            const uint wc = colorWeights[colorIndices[i]];
+            const uint wa = alphaWeights[alphaIndices[i]];
+
+            uint8 rgba[4];
+            for (uint c = 0; c < 3; c++) rgba[c] = interpolate(e0[c], e1[c], wc);
+            rgba[3] = interpolate(e0[3], e1[3], wa);
+
+            // The rotation swaps the alpha with one of the color channels.
+            if (rotation) swap(rgba[3], rgba[rotation - 1]);
+
+            block->color(i).setRGBA(rgba[0], rgba[1], rgba[2], rgba[3]);
+        }
+    }
+
+    struct BC6Mode
+    {
+        uint8 mode;
+        uint8 modeBits;
+        uint8 regions;
+        uint8 transformed;      // the other endpoints are stored as deltas from the first one
+        uint8 precision;
+        uint8 deltaBits[3];
+        uint8 headerBits;
+        uint8 fields[80];       // source of every header bit after the mode: (channel * 4 + endpoint) << 4 | bit, or 12 << 4 | bit for the partition
+    };
+
+    // Generated from the mode encodings of the ZOH compressor.
+    static const BC6Mode bc6Modes[14] = {
+        { 0x00, 2, 2, 1, 10, { 5, 5, 5 }, 80, {
+            100, 164, 180, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 64, 65, 66, 67, 68, 69, 70,
+            71, 72, 73, 128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 16, 17, 18, 19, 20, 116, 96,
+            97, 98, 99, 80, 81, 82, 83, 84, 176, 112, 113, 114, 115, 144, 145, 146, 147, 148, 177, 160,
+            161, 162, 163, 32, 33, 34, 35, 36, 178, 48, 49, 50, 51, 52, 179, 192, 193, 194, 195, 196,
+        } },
+        { 0x01, 2, 2, 1, 7, { 6, 6, 6 }, 80, {
+            101, 116, 117, 0, 1, 2, 3, 4, 5, 6, 176, 177, 164, 64, 65, 66, 67, 68, 69, 70,
+            165, 178, 100, 128, 129, 130, 131, 132, 133, 134, 179, 181, 180, 16, 17, 18, 19, 20, 21, 96,
+            97, 98, 99, 80, 81, 82, 83, 84, 85, 112, 113, 114, 115, 144, 145, 146, 147, 148, 149, 160,
+            161, 162, 163, 32, 33, 34, 35, 36, 37, 48, 49, 50, 51, 52, 53, 192, 193, 194, 195, 196,
+        } },
+        { 0x02, 5, 2, 1, 11, { 5, 4, 4 }, 77, {
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73,
+            128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 16, 17, 18, 19, 20, 10, 96, 97, 98, 99,
+            80, 81, 82, 83, 74, 176, 112, 113, 114, 115, 144, 145, 146, 147, 138, 177, 160, 161, 162, 163,
+            32, 33, 34, 35, 36, 178, 48, 49, 50, 51, 52, 179, 192, 193, 194, 195, 196,
+        } },
+        { 0x03, 5, 1, 0, 10, { 10, 10, 10 }, 60, {
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73,
+            128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25,
+            80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 144, 145, 146, 147, 148, 149, 150, 151, 152, 153,
+        } },
+        { 0x06, 5, 2, 1, 11, { 4, 5, 4 }, 77, {
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73,
+            128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 16, 17, 18, 19, 10, 116, 96, 97, 98, 99,
+            80, 81, 82, 83, 84, 74, 112, 113, 114, 115, 144, 145, 146, 147, 138, 177, 160, 161, 162, 163,
+            32, 33, 34, 35, 176, 178, 48, 49, 50, 51, 100, 179, 192, 193, 194, 195, 196,
+        } },
+        { 0x07, 5, 1, 1, 11, { 9, 9, 9 }, 60, {
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73,
+            128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 16, 17, 18, 19, 20, 21, 22, 23, 24, 10,
+            80, 81, 82, 83, 84, 85, 86, 87, 88, 74, 144, 145, 146, 147, 148, 149, 150, 151, 152, 138,
+        } },
+        { 0x0a, 5, 2, 1, 11, { 4, 4, 5 }, 77, {
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73,
+            128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 16, 17, 18, 19, 10, 164, 96, 97, 98, 99,
+            80, 81, 82, 83, 74, 176, 112, 113, 114, 115, 144, 145, 146, 147, 148, 138, 160, 161, 162, 163,
+            32, 33, 34, 35, 177, 178, 48, 49, 50, 51, 180, 179, 192, 193, 194, 195, 196,
+        } },
+        { 0x0b, 5, 1, 1, 12, { 8, 8, 8 }, 60, {
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73,
+            128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 16, 17, 18, 19, 20, 21, 22, 23, 11, 10,
+            80, 81, 82, 83, 84, 85, 86, 87, 75, 74, 144, 145, 146, 147, 148, 149, 150, 151, 139, 138,
+        } },
+        { 0x0e, 5, 2, 1, 9, { 5, 5, 5 }, 77, {
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 164, 64, 65, 66, 67, 68, 69, 70, 71, 72, 100,
+            128, 129, 130, 131, 132, 133, 134, 135, 136, 180, 16, 17, 18, 19, 20, 116, 96, 97, 98, 99,
+            80, 81, 82, 83, 84, 176, 112, 113, 114, 115, 144, 145, 146, 147, 148, 177, 160, 161, 162, 163,
+            32, 33, 34, 35, 36, 178, 48, 49, 50, 51, 52, 179, 192, 193, 194, 195, 196,
+        } },
+        { 0x0f, 5, 1, 1, 16, { 4, 4, 4 }, 60, {
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73,
+            128, 129, 130, 131, 132, 133, 134, 135, 136, 137, 16, 17, 18, 19, 15, 14, 13, 12, 11, 10,
+            80, 81, 82, 83, 79, 78, 77, 76, 75, 74, 144, 145, 146, 147, 143, 142, 141, 140, 139, 138,
+        } },
+        { 0x12, 5, 2, 1, 8, { 6, 5, 5 }, 77, {
+            0, 1, 2, 3, 4, 5, 6, 7, 116, 164, 64, 65, 66, 67, 68, 69, 70, 71, 178, 100,
+            128, 129, 130, 131, 132, 133, 134, 135, 179, 180, 16, 17, 18, 19, 20, 21, 96, 97, 98, 99,
+            80, 81, 82, 83, 84, 176, 112, 113, 114, 115, 144, 145, 146, 147, 148, 177, 160, 161, 162, 163,
+            32, 33, 34, 35, 36, 37, 48, 49, 50, 51, 52, 53, 192, 193, 194, 195, 196,
+        } },
+        { 0x16, 5, 2, 1, 8, { 5, 6, 5 }, 77, {
+            0, 1, 2, 3, 4, 5, 6, 7, 176, 164, 64, 65, 66, 67, 68, 69, 70, 71, 101, 100,
+            128, 129, 130, 131, 132, 133, 134, 135, 117, 180, 16, 17, 18, 19, 20, 116, 96, 97, 98, 99,
+            80, 81, 82, 83, 84, 85, 112, 113, 114, 115, 144, 145, 146, 147, 148, 177, 160, 161, 162, 163,
+            32, 33, 34, 35, 36, 178, 48, 49, 50, 51, 52, 179, 192, 193, 194, 195, 196,
+        } },
+        { 0x1a, 5, 2, 1, 8, { 5, 5, 6 }, 77, {
+            0, 1, 2, 3, 4, 5, 6, 7, 177, 164, 64, 65, 66, 67, 68, 69, 70, 71, 165, 100,
+            128, 129, 130, 131, 132, 133, 134, 135, 181, 180, 16, 17, 18, 19, 20, 116, 96, 97, 98, 99,
+            80, 81, 82, 83, 84, 176, 112, 113, 114, 115, 144, 145, 146, 147, 148, 149, 160, 161, 162, 163,
+            32, 33, 34, 35, 36, 178, 48, 49, 50, 51, 52, 179, 192, 193, 194, 195, 196,
+        } },
+        { 0x1e, 5, 2, 0, 6, { 6, 6, 6 }, 77, {
+            0, 1, 2, 3, 4, 5, 116, 176, 177, 164, 64, 65, 66, 67, 68, 69, 101, 165, 178, 100,
+            128, 129, 130, 131, 132, 133, 117, 179, 181, 180, 16, 17, 18, 19, 20, 21, 96, 97, 98, 99,
+            80, 81, 82, 83, 84, 85, 112, 113, 114, 115, 144, 145, 146, 147, 148, 149, 160, 161, 162, 163,
+            32, 33, 34, 35, 36, 37, 48, 49, 50, 51, 52, 53, 192, 193, 194, 195, 196,
+        } },
+    };
+    static const int8 bc6ModeIndex[32] = { 0, 1, 2, 3, -1, -1, 4, 5, -1, -1, 6, 7, -1, -1, 8, 9, -1, -1, 10, -1, -1, -1, 11, -1, -1, -1, 12, -1, -1, -1, 13, -1 };
+
+    static const uint BC6_PARTITION_FIELD = 12;
+
+    inline int signExtend(int v, int bits)
+    {
+        return (v & (1 << (bits - 1))) ? (v | (~0 << bits)) : v;
+    }
+
+    inline int unquantizeBC6(int q, int prec, bool isSigned)
+    {
+        if (!isSigned) {
+            if (prec >= 15) return q;
+            if (q == 0) return 0;
+            if (q == (1 << prec) - 1) return 0xFFFF;
+            return (q * 0x10000 + 0x8000) >> prec;
+        }
+        else {
+            if (prec >= 16) return q;
+            int s = q < 0;
+            if (s) q = -q;
+            int unq;
+            if (q == 0) unq = 0;
+            else if (q >= (1 << (prec - 1)) - 1) unq = 0x7FFF;
+            else unq = (q * 0x8000 + 0x4000) >> (prec - 1);
+            return s ? -unq : unq;
+        }
+    }
+
+    // Scale the interpolated value to the half range and return its bits.
+    inline uint16 finishBC6(int v, bool isSigned)
+    {
+        if (!isSigned) return uint16((v * 31) >> 6);
+        if (v < 0) return uint16(0x8000 | (((-v) * 31) >> 5));
+        return uint16((v * 31) >> 5);
+    }
+
+    void decodeBC6(const uint8 * data, bool isSigned, uint16 halfs[16][3])
+    {
+        BlockBits bits(data);
+
+        uint mode = bits.read(2);
+        if (mode >= 2) mode |= bits.read(3) << 2;
+
+        const int index = bc6ModeIndex[mode];
+        if (index < 0) {
+            // Reserved mode, decodes to black.
+            memset(halfs, 0, sizeof(uint16) * 16 * 3);
+            return;
+        }
+
+        const BC6Mode & m = bc6Modes[index];
+
+        // Scatter the header bits into their fields without going through the bit reader.
+        int fields[13] = { 0 };
+        for (uint i = 0; i < m.headerBits; i++) {
+            const uint p = bits.pos + i;
+            const uint bit = uint((p < 64 ? bits.lo >> p : bits.hi >> (p - 64)) & 1);
+            fields[m.fields[i] >> 4] |= bit << (m.fields[i] & 15);
+        }
+        bits.pos += m.headerBits;
+
+        int endpoints[4][3];
+        for (uint e = 0; e < 4; e++) {
+            for (uint c = 0; c < 3; c++) endpoints[e][c] = fields[4 * c + e];
+        }
+        const uint partition = fields[BC6_PARTITION_FIELD];
+
+        const int prec = m.precision;
+        const uint endpointCount = 2 * m.regions;
+
+        for (uint c = 0; c < 3; c++) {
+            const int base = endpoints[0][c];
+            if (isSigned) endpoints[0][c] = signExtend(base, prec);
+
+            for (uint e = 1; e < endpointCount; e++) {
+                int v = endpoints[e][c];
+                if (m.transformed) {
+                    v = (signExtend(v, m.deltaBits[c]) + base) & ((1 << prec) - 1);
+                    if (isSigned) v = signExtend(v, prec);
+                }
+                else if (isSigned) {
+                    v = signExtend(v, m.deltaBits[c]);
+                }
+                endpoints[e][c] = v;
+            }
+
+            for (uint e = 0; e < endpointCount; e++) endpoints[e][c] = unquantizeBC6(endpoints[e][c], prec, isSigned);
+        }
+
+        const uint indexBits = m.regions == 1 ? 4 : 3;
+        const uint8 * weights = weightTable[indexBits];
+        const uint32 subsets = m.regions == 1 ? 0 : partitionTable[0][partition];
+
+        for (uint i = 0; i < 16; i++) {
+            const uint anchor = i == 0 || (m.regions == 2 && i == anchorTable[0][partition]);
+            const int w = weights[bits.read(indexBits - anchor)];
+            const uint s = (subsets >> (2 * i)) & 3;
+            for (uint c = 0; c < 3; c++) {
+                const int v = ((64 - w) * endpoints[2 * s + 0][c] + w * endpoints[2 * s + 1][c] + 32) >> 6;
+                halfs[i][c] = finishBC6(v, isSigned);
+            }
+        }
+        nvDebugCheck(bits.pos == 128);
+    }
+
+} // namespace
+
+
 /// Decode BC6 block.
-void BlockBC6::decodeBlock(ColorSet * set) const
+void BlockBC6::decodeBlock(ColorSet * set, bool isSigned/*= false*/) const
 {
-	ZOH::Tile tile(4, 4);
-	ZOH::decompress((const char *)data, tile);
+    set->allocate(4, 4);
+    decodeBlocks(this, 1, isSigned, set->colors);
 
-	// Convert ZOH's tile struct back to NVTT's, and convert half to float.
-	set->allocate(4, 4);
-	for (uint y = 0; y < 4; ++y)
-	{
-		for (uint x = 0; x < 4; ++x)
-		{
-			uint16 rHalf = ZOH::Tile::float2half(tile.data[y][x].x);
-			uint16 gHalf = ZOH::Tile::float2half(tile.data[y][x].y);
-			uint16 bHalf = ZOH::Tile::float2half(tile.data[y][x].z);
-			set->colors[y * 4 + x].x = to_float(rHalf);
-			set->colors[y * 4 + x].y = to_float(gHalf);
-			set->colors[y * 4 + x].z = to_float(bHalf);
-			set->colors[y * 4 + x].w = 1.0f;
+    // Set indices in case someone uses them
+    for (uint i = 0; i < 16; i++) set->indices[i] = i;
+}
+
+/// Decode count consecutive BC6 blocks into 16 colors each.
+void BlockBC6::decodeBlocks(const BlockBC6 * blocks, uint count, bool isSigned, Vector4 * colors)
+{
+    for (uint b = 0; b < count; b++) {
+        uint16 halfs[16][3];
+        decodeBC6(blocks[b].data, isSigned, halfs);
 
-			// Set indices in case someone uses them
-			set->indices[y * 4 + x] = y * 4 + x;
-		}
-	}
+        for (uint i = 0; i < 16; i++) {
+            colors[16 * b + i] = Vector4(to_float(halfs[i][0]), to_float(halfs[i][1]), to_float(halfs[i][2]), 1.0f);
+        }
+    }
 }
 
 
 /// Decode BC7 block.
 void BlockBC7::decodeBlock(ColorBlock * block) const
 {
-	AVPCL::Tile tile(4, 4);
-	AVPCL::decompress((const char *)data, tile);
+    decodeBC7(data, block);
+}
 
-	// Convert AVPCL's tile struct back to NVTT's.
-	for (uint y = 0; y < 4; ++y)
-	{
-		for (uint x = 0; x < 4; ++x)
-		{
-			Vector4 rgba = tile.data[y][x];
-			// Note: decoded rgba values are in [0, 255] range and should be an integer,
-			// because BC7 never uses more than 8 bits per channel.  So no need to round.
-			block->color(x, y).setRGBA(uint8(rgba.x), uint8(rgba.y), uint8(rgba.z), uint8(rgba.w));
-		}
-	}
+/// Decode count consecutive BC7 blocks.
+void BlockBC7::decodeBlocks(const BlockBC7 * blocks, uint count, ColorBlock * output)
+{
+    for (uint b = 0; b < count; b++) {
+        decodeBC7(blocks[b].data, output + b);
+    }
 }
 
 
@@ -692,6 +1079,351 @@ inline void BlockCTX1::flip2()
 }
 
 
+/*----------------------------------------------------------------------------
+Surface decoders
+----------------------------------------------------------------------------*/
+
+namespace
+{
+    // Below this many texels the surface is decoded on the calling thread.
+    const uint kParallelDecodeThreshold = 256 * 1024;
+
+    // Approximate number of texels decoded by each task.
+    const uint kDecodeTaskSize = 32 * 1024;
+
+    // BC1-5 blocks are decoded to 4 rows of BGRA8 texels with the layout of Color32. The palettes are evaluated per block
+    // as 32 bit texels, so every lookup is a single load, and the rows are assembled, merged and converted with SSE2.
+#if NV_USE_SSE > 1
+
+    typedef __m128i TexelRow;
+
+    inline TexelRow splatRow(uint32 value) { return _mm_set1_epi32(value); }
+    inline TexelRow orRows(TexelRow a, TexelRow b) { return _mm_or_si128(a, b); }
+    inline TexelRow maskRow(TexelRow a, uint32 mask) { return _mm_and_si128(a, _mm_set1_epi32(mask)); }
+
+    // Look up the 4 indices of n bits of a row, packed at bit i * n of bits.
+    template <uint n>
+    inline TexelRow lookupRow(uint bits, const uint32 * palette)
+    {
+        const uint m = (1 << n) - 1;
+        return _mm_setr_epi32(palette[bits & m], palette[(bits >> n) & m], palette[(bits >> (2 * n)) & m], palette[(bits >> (3 * n)) & m]);
+    }
+
+    // 4 bit explicit alphas, expanded to 8 bits in the alpha channel. There are no per lane shifts in SSE2, multiplying
+    // the 16 bit lanes by powers of two moves every alpha to bit 12 instead.
+    inline TexelRow explicitAlphaRow(uint16 row)
+    {
+        const __m128i masked = _mm_and_si128(_mm_set1_epi32(row), _mm_setr_epi32(0xF, 0xF0, 0xF00, 0xF000));
+        const __m128i alpha = _mm_srli_epi32(_mm_mullo_epi16(masked, _mm_setr_epi32(1 << 12, 1 << 8, 1 << 4, 1)), 12);
+        return _mm_slli_epi32(_mm_mullo_epi16(alpha, _mm_set1_epi32(17)), 24);
+    }
+
+    inline void storeRow(TexelRow texels, uint32 * dst)
+    {
+        _mm_storeu_si128((__m128i *)dst, texels);
+    }
+
+    inline void storeFloatRow(TexelRow texels, float * dst, uint planeStride)
+    {
+        // Divided rather than scaled by 1/255, to match the other decoders.
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        _mm_storeu_ps(dst + 0 * planeStride, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texels, 16), mask)), scale));
+        _mm_storeu_ps(dst + 1 * planeStride, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texels, 8), mask)), scale));
+        _mm_storeu_ps(dst + 2 * planeStride, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(texels, mask)), scale));
+        _mm_storeu_ps(dst + 3 * planeStride, _mm_div_ps(_mm_cvtepi32_ps(_mm_srli_epi32(texels, 24)), scale));
+    }
+
+#else
+
+    struct TexelRow
+    {
+        uint32 t[4];
+    };
+
+    inline TexelRow splatRow(uint32 value)
+    {
+        TexelRow r;
+        for (uint i = 0; i < 4; i++) r.t[i] = value;
+        return r;
+    }
+
+    inline TexelRow orRows(TexelRow a, TexelRow b)
+    {
+        for (uint i = 0; i < 4; i++) a.t[i] |= b.t[i];
+        return a;
+    }
+
+    inline TexelRow maskRow(TexelRow a, uint32 mask)
+    {
+        for (uint i = 0; i < 4; i++) a.t[i] &= mask;
+        return a;
+    }
+
+    template <uint n>
+    inline TexelRow lookupRow(uint bits, const uint32 * palette)
+    {
+        TexelRow r;
+        for (uint i = 0; i < 4; i++) r.t[i] = palette[(bits >> (n * i)) & ((1 << n) - 1)];
+        return r;
+    }
+
+    inline TexelRow explicitAlphaRow(uint16 row)
+    {
+        TexelRow r;
+        for (uint i = 0; i < 4; i++) r.t[i] = (((row >> (4 * i)) & 0xF) * 17) << 24;
+        return r;
+    }
+
+    inline void storeRow(TexelRow texels, uint32 * dst)
+    {
+        memcpy(dst, texels.t, sizeof(texels.t));
+    }
+
+    inline void storeFloatRow(TexelRow texels, float * dst, uint planeStride)
+    {
+        for (uint i = 0; i < 4; i++) {
+            const Color32 c(texels.t[i]);
+            dst[0 * planeStride + i] = float(c.r) / 255.0f;
+            dst[1 * planeStride + i] = float(c.g) / 255.0f;
+            dst[2 * planeStride + i] = float(c.b) / 255.0f;
+            dst[3 * planeStride + i] = float(c.a) / 255.0f;
+        }
+    }
+
+#endif
+
+    // The alphas of the palette are shifted left by shift bits and or'ed with bits.
+    inline void evaluateAlphaPalette(const AlphaBlockDXT5 & block, BlockDecoder decoder, uint shift, uint32 bits, uint32 palette[8])
+    {
+        uint8 alphas[8];
+        block.evaluatePalette(alphas, decoder == BlockDecoder_D3D9);
+        for (uint i = 0; i < 8; i++) palette[i] = (uint32(alphas[i]) << shift) | bits;
+    }
+
+    inline uint alphaRowBits(const AlphaBlockDXT5 & block, uint y)
+    {
+        return uint(block.u >> (16 + 12 * y)) & 0xFFF;
+    }
+
+    // Decode a BC1-5 block into 4 rows of texels.
+    void decodeRows(BlockFormat format, BlockDecoder decoder, const uint8 * data, TexelRow rows[4])
+    {
+        uint32 palette[8];
+
+        if (format == BlockFormat_BC1 || format == BlockFormat_BC2 || format == BlockFormat_BC3)
+        {
+            const BlockDXT1 & color = *(const BlockDXT1 *)(format == BlockFormat_BC1 ? data : data + 8);
+
+            Color32 colors[4];
+            if (decoder == BlockDecoder_NV5x) color.evaluatePaletteNV5x(colors);
+            else color.evaluatePalette(colors, decoder == BlockDecoder_D3D9);
+            for (uint i = 0; i < 4; i++) palette[i] = colors[i].u;
+
+            for (uint y = 0; y < 4; y++) rows[y] = lookupRow<2>(color.row[y], palette);
+
+            if (format == BlockFormat_BC2)
+            {
+                const AlphaBlockDXT3 & alpha = *(const AlphaBlockDXT3 *)data;
+                for (uint y = 0; y < 4; y++) rows[y] = orRows(maskRow(rows[y], 0x00FFFFFF), explicitAlphaRow(alpha.row[y]));
+            }
+            else if (format == BlockFormat_BC3)
+            {
+                const AlphaBlockDXT5 & alpha = *(const AlphaBlockDXT5 *)data;
+                evaluateAlphaPalette(alpha, decoder, 24, 0, palette);
+                for (uint y = 0; y < 4; y++) rows[y] = orRows(maskRow(rows[y], 0x00FFFFFF), lookupRow<3>(alphaRowBits(alpha, y), palette));
+            }
+        }
+        else if (format == BlockFormat_BC4)
+        {
+            // Replicate the channel to RGB, like BlockATI1::decodeBlock.
+            const AlphaBlockDXT5 & x = *(const AlphaBlockDXT5 *)data;
+            uint8 alphas[8];
+            x.evaluatePalette(alphas, decoder == BlockDecoder_D3D9);
+            for (uint i = 0; i < 8; i++) palette[i] = alphas[i] * 0x00010101U | 0xFF000000;
+
+            for (uint y = 0; y < 4; y++) rows[y] = lookupRow<3>(alphaRowBits(x, y), palette);
+        }
+        else
+        {
+            nvDebugCheck(format == BlockFormat_BC5);
+            const AlphaBlockDXT5 & x = *(const AlphaBlockDXT5 *)data;
+            const AlphaBlockDXT5 & y = *(const AlphaBlockDXT5 *)(data + 8);
+
+            evaluateAlphaPalette(x, decoder, 16, 0xFF000000, palette);
+            for (uint r = 0; r < 4; r++) rows[r] = lookupRow<3>(alphaRowBits(x, r), palette);
+
+            evaluateAlphaPalette(y, decoder, 8, 0, palette);
+            for (uint r = 0; r < 4; r++) rows[r] = orRows(rows[r], lookupRow<3>(alphaRowBits(y, r), palette));
+        }
+    }
+
+    struct DecodeSurfaceContext
+    {
+        BlockFormat format;
+        BlockDecoder decoder;
+        uint w, h;
+        const uint8 * blocks;
+
+        // One of the outputs is set.
+        float * planes;
+        uint planeStride;
+        Color32 * colors;
+        uint pitch;
+    };
+
+    inline uint blockFormatSize(BlockFormat format)
+    {
+        return (format == BlockFormat_BC1 || format == BlockFormat_BC4) ? 8 : 16;
+    }
+
+    // Write the bw x bh texels of a decoded block at (x, y).
+    void writeBlock(const DecodeSurfaceContext * ctx, const uint32 texels[16], uint x, uint y, uint bw, uint bh)
+    {
+        for (uint yy = 0; yy < bh; yy++) {
+            for (uint xx = 0; xx < bw; xx++) {
+                const Color32 c(texels[4 * yy + xx]);
+                if (ctx->planes != NULL) {
+                    float * dst = ctx->planes + (y + yy) * ctx->w + x + xx;
+                    dst[0 * ctx->planeStride] = float(c.r) / 255.0f;
+                    dst[1 * ctx->planeStride] = float(c.g) / 255.0f;
+                    dst[2 * ctx->planeStride] = float(c.b) / 255.0f;
+                    dst[3 * ctx->planeStride] = float(c.a) / 255.0f;
+                }
+                else {
+                    ctx->colors[(y + yy) * ctx->pitch + x + xx] = c;
+                }
+            }
+        }
+    }
+
+    // One item per row of blocks.
+    void DecodeSurfaceTask(void * context, int begin, int end)
+    {
+        const DecodeSurfaceContext * ctx = (const DecodeSurfaceContext *)context;
+        const BlockFormat format = ctx->format;
+        const uint size = blockFormatSize(format);
+        const uint bw = (ctx->w + 3) / 4;
+
+        for (uint by = begin; by < uint(end); by++)
+        {
+            const uint8 * data = ctx->blocks + by * bw * size;
+            const uint y = 4 * by;
+            const uint rows = min(4U, ctx->h - y);
+
+            for (uint bx = 0; bx < bw; bx++, data += size)
+            {
+                const uint x = 4 * bx;
+                const uint columns = min(4U, ctx->w - x);
+
+                if (format == BlockFormat_BC6 || format == BlockFormat_BC6S)
+                {
+                    Vector4 colors[16];
+                    BlockBC6::decodeBlocks((const BlockBC6 *)data, 1, format == BlockFormat_BC6S, colors);
+
+                    for (uint yy = 0; yy < rows; yy++) {
+                        for (uint xx = 0; xx < columns; xx++) {
+                            const Vector4 & c = colors[4 * yy + xx];
+                            if (ctx->planes != NULL) {
+                                float * dst = ctx->planes + (y + yy) * ctx->w + x + xx;
+                                dst[0 * ctx->planeStride] = c.x;
+                                dst[1 * ctx->planeStride] = c.y;
+                                dst[2 * ctx->planeStride] = c.z;
+                                dst[3 * ctx->planeStride] = c.w;
+                            }
+                            else {
+                                ctx->colors[(y + yy) * ctx->pitch + x + xx].setRGBA(
+                                    uint8(clamp(c.x, 0.0f, 1.0f) * 255.0f + 0.5f),
+                                    uint8(clamp(c.y, 0.0f, 1.0f) * 255.0f + 0.5f),
+                                    uint8(clamp(c.z, 0.0f, 1.0f) * 255.0f + 0.5f),
+                                    uint8(clamp(c.w, 0.0f, 1.0f) * 255.0f + 0.5f));
+                            }
+                        }
+                    }
+                }
+                else if (format == BlockFormat_BC7)
+                {
+                    ColorBlock block;
+                    BlockBC7::decodeBlocks((const BlockBC7 *)data, 1, &block);
+                    writeBlock(ctx, (const uint32 *)block.colors(), x, y, columns, rows);
+                }
+                else
+                {
+                    TexelRow texels[4];
+                    decodeRows(format, ctx->decoder, data, texels);
+
+                    if (columns == 4 && rows == 4)
+                    {
+                        for (uint yy = 0; yy < 4; yy++) {
+                            if (ctx->planes != NULL) storeFloatRow(texels[yy], ctx->planes + (y + yy) * ctx->w + x, ctx->planeStride);
+                            else storeRow(texels[yy], &ctx->colors[(y + yy) * ctx->pitch + x].u);
+                        }
+                    }
+                    else
+                    {
+                        uint32 block[16];
+                        for (uint yy = 0; yy < 4; yy++) storeRow(texels[yy], block + 4 * yy);
+                        writeBlock(ctx, block, x, y, columns, rows);
+                    }
+                }
+            }
+        }
+    }
+
+    void dispatchDecode(DecodeSurfaceContext & context)
+    {
+        const uint bh = (context.h + 3) / 4;
+
+        if (context.w * context.h < kParallelDecodeThreshold) {
+            DecodeSurfaceTask(&context, 0, bh);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(DecodeSurfaceTask, &context, bh, max(1U, kDecodeTaskSize / (4 * context.w)));
+        }
+    }
+
+} // namespace
+
+
+void nv::decodeSurface(BlockFormat format, BlockDecoder decoder, uint w, uint h, const void * blocks, float * rgba, uint planeStride)
+{
+    nvDebugCheck(blocks != NULL && rgba != NULL);
+    nvDebugCheck(planeStride >= w * h);
+
+    DecodeSurfaceContext context;
+    context.format = format;
+    context.decoder = decoder;
+    context.w = w;
+    context.h = h;
+    context.blocks = (const uint8 *)blocks;
+    context.planes = rgba;
+    context.planeStride = planeStride;
+    context.colors = NULL;
+    context.pitch = 0;
+
+    dispatchDecode(context);
+}
+
+void nv::decodeSurface(BlockFormat format, BlockDecoder decoder, uint w, uint h, const void * blocks, Color32 * rgba, uint pitch)
+{
+    nvDebugCheck(blocks != NULL && rgba != NULL);
+    nvDebugCheck(pitch >= w);
+
+    DecodeSurfaceContext context;
+    context.format = format;
+    context.decoder = decoder;
+    context.w = w;
+    context.h = h;
+    context.blocks = (const uint8 *)blocks;
+    context.planes = NULL;
+    context.planeStride = 0;
+    context.colors = rgba;
+    context.pitch = pitch;
+
+    dispatchDecode(context);
+}
+
+
 
 
 Stream & nv::operator<<(Stream & stream, BlockDXT1 & block)
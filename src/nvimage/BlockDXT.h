@@ -34,6 +34,7 @@ namespace nv
     struct ColorBlock;
     struct ColorSet;
     struct AlphaBlock4x4;
+    class Vector4;
     class Stream;
 
 
@@ -219,7 +220,9 @@ namespace nv
 	struct BlockBC6
 	{
 		uint8 data[16];		// Not even going to try to write a union for this thing.
-		void decodeBlock(ColorSet * set) const;
+		void decodeBlock(ColorSet * set, bool isSigned = false) const;
+
+		static void decodeBlocks(const BlockBC6 * blocks, uint count, bool isSigned, Vector4 * colors);
 	};
 
 	/// BC7 block.
@@ -227,9 +230,40 @@ namespace nv
 	{
 		uint8 data[16];		// Not even going to try to write a union for this thing.
 		void decodeBlock(ColorBlock * block) const;
+
+		static void decodeBlocks(const BlockBC7 * blocks, uint count, ColorBlock * output);
 	};
 
 
+    /// Block formats of the surface decoders.
+    enum BlockFormat
+    {
+        BlockFormat_BC1,
+        BlockFormat_BC2,
+        BlockFormat_BC3,
+        BlockFormat_BC4,
+        BlockFormat_BC5,
+        BlockFormat_BC6,    // Unsigned.
+        BlockFormat_BC6S,   // Signed.
+        BlockFormat_BC7,
+    };
+
+    /// Palette rounding of the surface decoders.
+    enum BlockDecoder
+    {
+        BlockDecoder_D3D10,
+        BlockDecoder_D3D9,  // Rounds the BC1-5 palettes like D3D9, see BlockDXT1::evaluatePalette.
+        BlockDecoder_NV5x,  // Only changes the BC1 color palette.
+    };
+
+    // Decode a w x h surface of tightly packed blocks into planar float RGBA. Each plane has w * h texels, the planes are
+    // planeStride floats apart. BC1-5 are decoded with SSE2 when available, and large surfaces are decoded in parallel.
+    NVIMAGE_API void decodeSurface(BlockFormat format, BlockDecoder decoder, uint w, uint h, const void * blocks, float * rgba, uint planeStride);
+
+    // Same, into rows of RGBA8 texels pitch texels apart. BC6 is clamped to [0, 1] and rounded.
+    NVIMAGE_API void decodeSurface(BlockFormat format, BlockDecoder decoder, uint w, uint h, const void * blocks, Color32 * rgba, uint pitch);
+
+
 
     // Serialization functions.
     NVIMAGE_API Stream & operator<<(Stream & stream, BlockDXT1 & block);
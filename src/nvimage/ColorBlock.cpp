@@ -12,8 +12,105 @@
 
 #include <string.h> // memcpy
 
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 using namespace nv;
 
+
+void nv::tileBlocks(const float * data, uint w, uint h, uint firstRow, uint rowCount, float * tiles)
+{
+    const uint bw = (w + 3) / 4;
+    const uint srcPlane = w * h;
+
+    for (uint by = firstRow; by < firstRow + rowCount; by++)
+    {
+        float * row = tiles + (by - firstRow) * bw * kTileFloatCount;
+        const uint bh = min(h - 4 * by, 4U);
+
+        // Each row of texels is read once from the four planes, and written to the same row of all the tiles.
+        for (uint i = 0; i < 4; i++)
+        {
+            const float * r = data + (4 * by + i % bh) * w;
+            const float * g = r + srcPlane;
+            const float * b = g + srcPlane;
+            const float * a = b + srcPlane;
+
+            for (uint bx = 0; bx < bw; bx++)
+            {
+                const uint x = 4 * bx;
+                const uint blockWidth = min(w - x, 4U);
+                float * dst = row + bx * kTileFloatCount + 16 * i;
+
+#if NV_USE_SSE > 1
+                if (blockWidth == 4) {
+                    __m128 c0 = _mm_loadu_ps(r + x), c1 = _mm_loadu_ps(g + x), c2 = _mm_loadu_ps(b + x), c3 = _mm_loadu_ps(a + x);
+                    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+                    _mm_storeu_ps(dst + 0, c0);
+                    _mm_storeu_ps(dst + 4, c1);
+                    _mm_storeu_ps(dst + 8, c2);
+                    _mm_storeu_ps(dst + 12, c3);
+                    continue;
+                }
+#endif
+                for (uint e = 0; e < 4; e++) {
+                    const uint idx = x + e % blockWidth;
+                    dst[4 * e + 0] = r[idx];
+                    dst[4 * e + 1] = g[idx];
+                    dst[4 * e + 2] = b[idx];
+                    dst[4 * e + 3] = a[idx];
+                }
+            }
+        }
+    }
+}
+
+void nv::untileBlocks(const float * tiles, uint w, uint h, uint firstRow, uint rowCount, float * data)
+{
+    const uint bw = (w + 3) / 4;
+    const uint dstPlane = w * h;
+
+    for (uint by = firstRow; by < firstRow + rowCount; by++)
+    {
+        const float * row = tiles + (by - firstRow) * bw * kTileFloatCount;
+        const uint bh = min(h - 4 * by, 4U);
+
+        for (uint i = 0; i < bh; i++)
+        {
+            float * r = data + (4 * by + i) * w;
+            float * g = r + dstPlane;
+            float * b = g + dstPlane;
+            float * a = b + dstPlane;
+
+            for (uint bx = 0; bx < bw; bx++)
+            {
+                const uint x = 4 * bx;
+                const uint blockWidth = min(w - x, 4U);
+                const float * src = row + bx * kTileFloatCount + 16 * i;
+
+#if NV_USE_SSE > 1
+                if (blockWidth == 4) {
+                    __m128 c0 = _mm_loadu_ps(src + 0), c1 = _mm_loadu_ps(src + 4), c2 = _mm_loadu_ps(src + 8), c3 = _mm_loadu_ps(src + 12);
+                    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+                    _mm_storeu_ps(r + x, c0);
+                    _mm_storeu_ps(g + x, c1);
+                    _mm_storeu_ps(b + x, c2);
+                    _mm_storeu_ps(a + x, c3);
+                    continue;
+                }
+#endif
+                for (uint e = 0; e < blockWidth; e++) {
+                    r[x + e] = src[4 * e + 0];
+                    g[x + e] = src[4 * e + 1];
+                    b[x + e] = src[4 * e + 2];
+                    a[x + e] = src[4 * e + 3];
+                }
+            }
+        }
+    }
+}
+
 namespace {
 
     // Get approximate luminance.
@@ -104,6 +201,31 @@ void ColorBlock::init(uint w, uint h, const float * data, uint x, uint y)
 
     uint srcPlane = w * h;
 
+#if NV_USE_SSE > 1
+    // Interior blocks load each row of the four planes at once and convert them together.
+    if (bw == 4 && bh == 4)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+
+        for (uint i = 0; i < 4; i++)
+        {
+            const float * src = data + (y + i) * w + x;
+
+            // Same clamp order as the scalar path, so that NaNs also map to 0.
+            __m128i r = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 0 * srcPlane), zero), one), scale));
+            __m128i g = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 1 * srcPlane), zero), one), scale));
+            __m128i b = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 2 * srcPlane), zero), one), scale));
+            __m128i a = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 3 * srcPlane), zero), one), scale));
+
+            __m128i c = _mm_or_si128(_mm_or_si128(b, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(r, 16), _mm_slli_epi32(a, 24)));
+            _mm_storeu_si128((__m128i *)&color(0, i), c);
+        }
+        return;
+    }
+#endif
+
     for (uint i = 0; i < 4; i++)
     {
         const uint by = i % bh;
@@ -122,6 +244,41 @@ void ColorBlock::init(uint w, uint h, const float * data, uint x, uint y)
     }
 }
 
+/// Init the block from a tile of the tiled layout, quantizing the texels like init.
+void ColorBlock::initTile(const float * tile)
+{
+#if NV_USE_SSE > 1
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+
+    for (uint i = 0; i < 4; i++)
+    {
+        // Texels are RGBA, colors are BGRA in memory.
+        __m128i c[4];
+        for (uint k = 0; k < 4; k++) {
+            __m128 v = _mm_loadu_ps(tile + 16 * i + 4 * k);
+            v = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 1, 2));
+            c[k] = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(v, zero), one), scale));
+        }
+
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(c[0], c[1]), _mm_packs_epi32(c[2], c[3]));
+        _mm_storeu_si128((__m128i *)&color(0, i), packed);
+    }
+#else
+    for (uint i = 0; i < 16; i++)
+    {
+        const float * texel = tile + 4 * i;
+
+        Color32 & c = color(i);
+        c.r = uint8(255 * clamp(texel[0], 0.0f, 1.0f));
+        c.g = uint8(255 * clamp(texel[1], 0.0f, 1.0f));
+        c.b = uint8(255 * clamp(texel[2], 0.0f, 1.0f));
+        c.a = uint8(255 * clamp(texel[3], 0.0f, 1.0f));
+    }
+#endif
+}
+
 static inline uint8 component(Color32 c, uint i)
 {
     if (i == 0) return c.r;
@@ -236,6 +393,21 @@ bool ColorBlock::hasAlpha() const
     return false;
 }
 
+uint ColorBlock::maxDifference(const ColorBlock & other) const
+{
+    int diff = 0;
+    for (uint i = 0; i < 16; i++)
+    {
+        const Color32 a = m_color[i];
+        const Color32 b = other.m_color[i];
+        diff = max(diff, abs(a.r - b.r));
+        diff = max(diff, abs(a.g - b.g));
+        diff = max(diff, abs(a.b - b.b));
+        diff = max(diff, abs(a.a - b.a));
+    }
+    return uint(diff);
+}
+
 #if 0
 
 /// Get diameter color range.
@@ -494,6 +666,26 @@ void ColorSet::setColors(const float * data, uint img_w, uint img_h, uint img_x,
     const float * a = data + img_w * img_h * 3;
 
     // Set colors.
+#if NV_USE_SSE > 1
+    // Interior blocks transpose each row of the four planes into four texels.
+    if (block_w == 4 && block_h == 4)
+    {
+        for (uint y = 0; y < 4; y++)
+        {
+            uint idx = img_x + (y + img_y) * img_w;
+            __m128 c0 = _mm_loadu_ps(r + idx);
+            __m128 c1 = _mm_loadu_ps(g + idx);
+            __m128 c2 = _mm_loadu_ps(b + idx);
+            __m128 c3 = _mm_loadu_ps(a + idx);
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            _mm_storeu_ps(colors[4*y + 0].component, c0);
+            _mm_storeu_ps(colors[4*y + 1].component, c1);
+            _mm_storeu_ps(colors[4*y + 2].component, c2);
+            _mm_storeu_ps(colors[4*y + 3].component, c3);
+        }
+    }
+    else
+#endif
     for (uint y = 0, i = 0; y < block_h; y++)
     {
         for (uint x = 0; x < block_w; x++, i++)
@@ -521,6 +713,18 @@ void ColorSet::setColors(const float * data, uint img_w, uint img_h, uint img_x,
     }
 }
 
+/// Set the colors of a whole 4x4 block from a tile of the tiled layout.
+void ColorSet::setTile(const float * tile)
+{
+    allocate(4, 4);
+
+    memcpy(colors, tile, sizeof(colors));
+
+    for (uint i = 0; i < 16; i++) {
+        indices[i] = i;
+    }
+}
+
 void ColorSet::setColors(const Vector3 colors[16], const float weights[16])
 {
 
@@ -13,6 +13,17 @@ namespace nv
     class FloatImage;
 
 
+    // Tiled layout of the 4x4 blocks of an RGBA float image: each block is stored as its 16 texels, in row order, with the
+    // four channels of each texel together, and the blocks follow each other in row order. A block takes 256 contiguous
+    // bytes instead of 16 rows spread over the four planes. Blocks on the edges repeat their texels like ColorBlock::init.
+    const uint kTileFloatCount = 64;
+
+    // Convert rowCount rows of blocks, from firstRow, between the planar layout of a w x h image and the tiled layout.
+    // Tiles only store the rows they convert, untiling writes the texels inside the image.
+    void tileBlocks(const float * data, uint w, uint h, uint firstRow, uint rowCount, float * tiles);
+    void untileBlocks(const float * tiles, uint w, uint h, uint firstRow, uint rowCount, float * data);
+
+
     /// Uncompressed 4x4 color block.
     struct ColorBlock
     {
@@ -24,12 +35,16 @@ namespace nv
         void init(const Image * img, uint x, uint y);
         void init(uint w, uint h, const uint * data, uint x, uint y);
         void init(uint w, uint h, const float * data, uint x, uint y);
+        void initTile(const float * tile);
 
         void swizzle(uint x, uint y, uint z, uint w); // 0=r, 1=g, 2=b, 3=a, 4=0xFF, 5=0
 
         bool isSingleColor(Color32 mask = Color32(0xFF, 0xFF, 0xFF, 0x00)) const;
         bool hasAlpha() const;
 
+        // Largest difference between a channel of a texel and the same channel of the texel of the other block.
+        uint maxDifference(const ColorBlock & other) const;
+
 
         // Accessors
         const Color32 * colors() const;
@@ -90,6 +105,7 @@ namespace nv
         void allocate(uint w, uint h);
 
         void setColors(const float * data, uint img_w, uint img_h, uint img_x, uint img_y);
+        void setTile(const float * tile);
         void setColors(const Vector3 colors[16], const float weights[16]);
         void setColors(const Vector4 colors[16], const float weights[16]);
 
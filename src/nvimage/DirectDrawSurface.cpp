@@ -26,14 +26,21 @@
 #include "Image.h"
 #include "BlockDXT.h"
 #include "PixelFormat.h"
+#include "Supercompression.h"
 
+#include "nvcore/Array.inl"
 #include "nvcore/Debug.h"
 #include "nvcore/Utils.h" // max
 #include "nvcore/StdStream.h"
 #include "nvmath/Vector.inl"
+#include "nvthread/TaskScheduler.h"
 
 #include <string.h> // memset
 
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 
 using namespace nv;
 
@@ -722,6 +729,26 @@ void DDSHeader::setUserVersion(int version)
     this->reserved[8] = version;
 }
 
+void DDSHeader::setSupercompression(uint scheme, uint layout)
+{
+    if (scheme == Supercompression_None) {
+        this->fourcc = FOURCC_DDS;
+        this->reserved[5] = 0;
+        this->reserved[6] = 0;
+    }
+    else {
+        // The format fields still describe the decoded surfaces. The distinct signature keeps the readers that don't know
+        // about supercompression from decoding the compressed bytes, and the surfaces have no fixed linear size.
+        this->fourcc = FOURCC_DDSZ;
+        this->reserved[5] = FOURCC_SUPC;
+        this->reserved[6] = scheme | (layout << 8);
+        if (this->flags & DDSD_LINEARSIZE) {
+            this->flags &= ~DDSD_LINEARSIZE;
+            this->pitch = 0;
+        }
+    }
+}
+
 void DDSHeader::swapBytes()
 {
     this->fourcc = POSH_LittleU32(this->fourcc);
@@ -784,6 +811,22 @@ uint DDSHeader::userVersion() const
     return 0;
 }
 
+uint DDSHeader::supercompression() const
+{
+    if (this->reserved[5] == FOURCC_SUPC) {
+        return this->reserved[6] & 0xFF;
+    }
+    return Supercompression_None;
+}
+
+uint DDSHeader::supercompressionLayout() const
+{
+    if (this->reserved[5] == FOURCC_SUPC) {
+        return (this->reserved[6] >> 8) & 0xFF;
+    }
+    return BlockLayout_None;
+}
+
 bool DDSHeader::isNormalMap() const
 {
     return (pf.flags & DDPF_NORMAL) != 0;
@@ -955,16 +998,16 @@ bool DDSHeader::isBlockFormat() const
 
 
 
-DirectDrawSurface::DirectDrawSurface() : stream(NULL)
+DirectDrawSurface::DirectDrawSurface() : stream(NULL), mem(NULL)
 {
 }
 
-DirectDrawSurface::DirectDrawSurface(const char * name) : stream(NULL)
+DirectDrawSurface::DirectDrawSurface(const char * name) : stream(NULL), mem(NULL)
 {
     load(name);
 }
 
-DirectDrawSurface::DirectDrawSurface(Stream * s) : stream(NULL)
+DirectDrawSurface::DirectDrawSurface(Stream * s) : stream(NULL), mem(NULL)
 {
     load(s);
 }
@@ -976,13 +1019,47 @@ DirectDrawSurface::~DirectDrawSurface()
 
 bool DirectDrawSurface::load(const char * filename)
 {
-    return load(new StdInputStream(filename));
+    MappedInputStream * mapped = new MappedInputStream(filename);
+    if (mapped->isError()) {
+        // Not a regular file, or too large to map.
+        delete mapped;
+        return load(new StdInputStream(filename));
+    }
+
+    bool result = load(mapped);
+    mem = mapped->data();
+    return result;
+}
+
+bool DirectDrawSurface::loadHeader(const char * filename)
+{
+    size_t size = 0;
+
+    FILE * fp = fileOpen(filename, "rb");
+    if (fp != NULL) {
+        // Read the header with a single read, without filling a larger buffer.
+        setvbuf(fp, NULL, _IONBF, 0);
+        size = fread(headerData, 1, sizeof(headerData), fp);
+        fclose(fp);
+    }
+
+    load(new MemoryInputStream(headerData, size));
+
+    // The memory stream doesn't fail on short reads, reject the headers that are cut short.
+    if (size < 128 || (header.hasDX10Header() && size < 148)) {
+        delete stream;
+        stream = NULL;
+        return false;
+    }
+
+    return true;
 }
 
 bool DirectDrawSurface::load(Stream * stream)
 {
     delete this->stream;
     this->stream = stream;
+    this->mem = NULL;
 
     if (!stream->isError())
     {
@@ -1000,7 +1077,13 @@ bool DirectDrawSurface::isValid() const
         return false;
     }
 
-    if (header.fourcc != FOURCC_DDS || header.size != 124)
+    if ((header.fourcc != FOURCC_DDS && header.fourcc != FOURCC_DDSZ) || header.size != 124)
+    {
+        return false;
+    }
+
+    // Supercompressed files have their own signature.
+    if ((header.fourcc == FOURCC_DDSZ) != (header.supercompression() != Supercompression_None))
     {
         return false;
     }
@@ -1025,6 +1108,11 @@ bool DirectDrawSurface::isSupported() const
 {
     nvDebugCheck(isValid());
 
+    if (header.supercompression() != Supercompression_None && !isSupercompressionSupported(header.supercompression()))
+    {
+        return false;
+    }
+
     if (header.hasDX10Header())
     {
         if (header.header10.dxgiFormat == DXGI_FORMAT_BC1_UNORM ||
@@ -1033,7 +1121,9 @@ bool DirectDrawSurface::isSupported() const
             header.header10.dxgiFormat == DXGI_FORMAT_BC4_UNORM ||
             header.header10.dxgiFormat == DXGI_FORMAT_BC5_UNORM ||
             header.header10.dxgiFormat == DXGI_FORMAT_BC6H_UF16 ||
-            header.header10.dxgiFormat == DXGI_FORMAT_BC7_UNORM)
+            header.header10.dxgiFormat == DXGI_FORMAT_BC6H_SF16 ||
+            header.header10.dxgiFormat == DXGI_FORMAT_BC7_UNORM ||
+            header.header10.dxgiFormat == DXGI_FORMAT_BC7_UNORM_SRGB)
         {
             return true;
         }
@@ -1224,7 +1314,23 @@ void DirectDrawSurface::mipmap(Image * img, uint face, uint mipmap)
 {
     nvDebugCheck(isValid());
 
-    stream->seek(offset(face, mipmap));
+    // Supercompressed surfaces are decoded in memory and read from there.
+    Stream * fileStream = stream;
+    Array<uint8> decoded;
+
+    if (header.supercompression() != Supercompression_None)
+    {
+        decoded.resize(surfaceSize(mipmap));
+        if (!readSurface(face, mipmap, decoded.buffer(), decoded.count()))
+        {
+            memset(decoded.buffer(), 0, decoded.count());
+        }
+        stream = new MemoryInputStream(decoded.buffer(), decoded.count());
+    }
+    else
+    {
+        stream->seek(offset(face, mipmap));
+    }
 
     uint w = width();
     uint h = height();
@@ -1249,10 +1355,13 @@ void DirectDrawSurface::mipmap(Image * img, uint face, uint mipmap)
         img->setFormat(Image::Format_RGB);
     }
 
+    // Block surfaces of mapped files are decoded in place.
+    const void * mapped = surfaceData(face, mipmap);
+
     if (header.hasDX10Header())
     {
         // So far only block formats supported.
-        readBlockImage(img);
+        readBlockImage(img, mapped);
     }
     else
     {
@@ -1262,9 +1371,15 @@ void DirectDrawSurface::mipmap(Image * img, uint face, uint mipmap)
         }
         else if (header.pf.flags & DDPF_FOURCC)
         {
-            readBlockImage(img);
+            readBlockImage(img, mapped);
         }
     }
+
+    if (stream != fileStream)
+    {
+        delete stream;
+        stream = fileStream;
+    }
 }
 
 /*void * DirectDrawSurface::readData(uint * sizePtr)
@@ -1332,9 +1447,23 @@ bool DirectDrawSurface::readSurface(uint face, uint mipmap, void * data, uint si
     stream->seek(offset(face, mipmap));
     if (stream->isError()) return false;
 
+    if (header.supercompression() != Supercompression_None) {
+        return decodeSupercompressed(header.supercompression(), header.supercompressionLayout(), *stream, data, size);
+    }
+
     return stream->serialize(data, size) == size;
 }
 
+const void * DirectDrawSurface::surfaceData(uint face, uint mipmap) const
+{
+    if (mem == NULL || header.supercompression() != Supercompression_None) return NULL;
+
+    const uint64 begin = offset(face, mipmap);
+    if (begin + surfaceSize(mipmap) > stream->size()) return NULL;
+
+    return mem + size_t(begin);
+}
+
 
 void DirectDrawSurface::readLinearImage(Image * img)
 {
@@ -1383,36 +1512,40 @@ void DirectDrawSurface::readLinearImage(Image * img)
     }
 }
 
-void DirectDrawSurface::readBlockImage(Image * img)
+// Find the format of the surface decoders that decodes the blocks like readBlock. Returns false for the formats
+// readBlock swizzles or converts to normals afterwards.
+static bool findBlockFormat(const DDSHeader & header, BlockFormat * format)
 {
-    nvDebugCheck(stream != NULL);
-    nvDebugCheck(img != NULL);
-
-    const uint w = img->width();
-    const uint h = img->height();
-
-    const uint bw = (w + 3) / 4;
-    const uint bh = (h + 3) / 4;
-
-    for (uint by = 0; by < bh; by++)
+    if (header.hasDX10Header())
     {
-        for (uint bx = 0; bx < bw; bx++)
-        {
-            ColorBlock block;
-
-            // Read color block.
-            readBlock(&block);
+        const uint dxgiFormat = header.header10.dxgiFormat;
+        if (dxgiFormat >= DXGI_FORMAT_BC1_TYPELESS && dxgiFormat <= DXGI_FORMAT_BC1_UNORM_SRGB) *format = BlockFormat_BC1;
+        else if (dxgiFormat >= DXGI_FORMAT_BC2_TYPELESS && dxgiFormat <= DXGI_FORMAT_BC2_UNORM_SRGB) *format = BlockFormat_BC2;
+        else if (dxgiFormat >= DXGI_FORMAT_BC3_TYPELESS && dxgiFormat <= DXGI_FORMAT_BC3_UNORM_SRGB) *format = BlockFormat_BC3;
+        else if (dxgiFormat == DXGI_FORMAT_BC4_TYPELESS || dxgiFormat == DXGI_FORMAT_BC4_UNORM) *format = BlockFormat_BC4;
+        else if (dxgiFormat == DXGI_FORMAT_BC5_TYPELESS || dxgiFormat == DXGI_FORMAT_BC5_UNORM) *format = BlockFormat_BC5;
+        else if (dxgiFormat == DXGI_FORMAT_BC6H_UF16) *format = BlockFormat_BC6;
+        else if (dxgiFormat == DXGI_FORMAT_BC6H_SF16) *format = BlockFormat_BC6S;
+        else if (dxgiFormat == DXGI_FORMAT_BC7_UNORM || dxgiFormat == DXGI_FORMAT_BC7_UNORM_SRGB) *format = BlockFormat_BC7;
+        else return false;
+    }
+    else
+    {
+        const uint fourcc = header.pf.fourcc;
+        if (fourcc == FOURCC_DXT1) *format = BlockFormat_BC1;
+        else if (fourcc == FOURCC_DXT2 || fourcc == FOURCC_DXT3) *format = BlockFormat_BC2;
+        else if (fourcc == FOURCC_DXT4 || fourcc == FOURCC_DXT5) *format = BlockFormat_BC3;
+        else if (fourcc == FOURCC_ATI1) *format = BlockFormat_BC4;
+        else if (fourcc == FOURCC_ATI2) *format = BlockFormat_BC5;
+        else return false;
+    }
 
-            // Write color block.
-            for (uint y = 0; y < min(4U, h-4*by); y++)
-            {
-                for (uint x = 0; x < min(4U, w-4*bx); x++)
-                {
-                    img->pixel(4*bx+x, 4*by+y) = block.color(x, y);
-                }
-            }
-        }
+    if (header.pf.flags & DDPF_NORMAL)
+    {
+        return *format != BlockFormat_BC3 && *format != BlockFormat_BC5;
     }
+
+    return true;
 }
 
 static Color32 buildNormal(uint8 x, uint8 y)
@@ -1426,72 +1559,43 @@ static Color32 buildNormal(uint8 x, uint8 y)
     return Color32(x, y, z);
 }
 
-
-void DirectDrawSurface::readBlock(ColorBlock * rgba)
+namespace
 {
-    nvDebugCheck(stream != NULL);
-    nvDebugCheck(rgba != NULL);
+    // Channels the normals of a normal map are rebuilt from.
+    enum NormalSource
+    {
+        NormalSource_None,
+        NormalSource_RG,    // ATI2 and BC5.
+        NormalSource_AG,    // DXT5n.
+    };
 
-    uint fourcc = header.pf.fourcc;
+    typedef void BlockReader(const uint8 * data, ColorBlock * rgba);
 
-    // Map DX10 block formats to fourcc codes.
-    if (header.hasDX10Header())
-    {
-        if (header.header10.dxgiFormat == DXGI_FORMAT_BC1_UNORM) fourcc = FOURCC_DXT1;
-        else if (header.header10.dxgiFormat == DXGI_FORMAT_BC2_UNORM) fourcc = FOURCC_DXT3;
-        else if (header.header10.dxgiFormat == DXGI_FORMAT_BC3_UNORM) fourcc = FOURCC_DXT5;
-        else if (header.header10.dxgiFormat == DXGI_FORMAT_BC4_UNORM) fourcc = FOURCC_ATI1;
-        else if (header.header10.dxgiFormat == DXGI_FORMAT_BC5_UNORM) fourcc = FOURCC_ATI2;
-    }
+    void readBlockDXT1(const uint8 * data, ColorBlock * rgba) { ((const BlockDXT1 *)data)->decodeBlock(rgba); }
+    void readBlockDXT3(const uint8 * data, ColorBlock * rgba) { ((const BlockDXT3 *)data)->decodeBlock(rgba); }
+    void readBlockDXT5(const uint8 * data, ColorBlock * rgba) { ((const BlockDXT5 *)data)->decodeBlock(rgba); }
+    void readBlockATI1(const uint8 * data, ColorBlock * rgba) { ((const BlockATI1 *)data)->decodeBlock(rgba); }
+    void readBlockATI2(const uint8 * data, ColorBlock * rgba) { ((const BlockATI2 *)data)->decodeBlock(rgba); }
+    void readBlockBC7(const uint8 * data, ColorBlock * rgba) { ((const BlockBC7 *)data)->decodeBlock(rgba); }
 
-    if (fourcc == FOURCC_DXT1)
-    {
-        BlockDXT1 block;
-        *stream << block;
-        block.decodeBlock(rgba);
-    }
-    else if (fourcc == FOURCC_DXT2 || fourcc == FOURCC_DXT3)
-    {
-        BlockDXT3 block;
-        *stream << block;
-        block.decodeBlock(rgba);
-    }
-    else if (fourcc == FOURCC_DXT4 || fourcc == FOURCC_DXT5 || fourcc == FOURCC_RXGB)
+    void readBlockRXGB(const uint8 * data, ColorBlock * rgba)
     {
-        BlockDXT5 block;
-        *stream << block;
-        block.decodeBlock(rgba);
+        ((const BlockDXT5 *)data)->decodeBlock(rgba);
 
-        if (fourcc == FOURCC_RXGB)
+        // Swap R & A.
+        for (int i = 0; i < 16; i++)
         {
-            // Swap R & A.
-            for (int i = 0; i < 16; i++)
-            {
-                Color32 & c = rgba->color(i);
-                uint tmp = c.r;
-                c.r = c.a;
-                c.a = tmp;
-            }
+            Color32 & c = rgba->color(i);
+            uint tmp = c.r;
+            c.r = c.a;
+            c.a = tmp;
         }
     }
-    else if (fourcc == FOURCC_ATI1)
-    {
-        BlockATI1 block;
-        *stream << block;
-        block.decodeBlock(rgba);
-    }
-    else if (fourcc == FOURCC_ATI2)
-    {
-        BlockATI2 block;
-        *stream << block;
-        block.decodeBlock(rgba);
-    }
-    else if (header.hasDX10Header() && header.header10.dxgiFormat == DXGI_FORMAT_BC6H_UF16)
+
+    void readBlockBC6(const uint8 * data, ColorBlock * rgba, bool isSigned)
     {
-        BlockBC6 block;
-        *stream << block;
         ColorSet set;
-        block.decodeBlock(&set);
+        ((const BlockBC6 *)data)->decodeBlock(&set, isSigned);
 
         // Clamp to [0, 1] and round to 8-bit
         for (int y = 0; y < 4; ++y)
@@ -1507,34 +1611,243 @@ void DirectDrawSurface::readBlock(ColorBlock * rgba)
             }
         }
     }
-    else if (header.hasDX10Header() && header.header10.dxgiFormat == DXGI_FORMAT_BC7_UNORM)
+
+    void readBlockBC6U(const uint8 * data, ColorBlock * rgba) { readBlockBC6(data, rgba, false); }
+    void readBlockBC6S(const uint8 * data, ColorBlock * rgba) { readBlockBC6(data, rgba, true); }
+
+    // How the blocks of a surface are decoded, resolved once from the header instead of for every block.
+    struct BlockDecodePlan
+    {
+        BlockReader * read;
+        NormalSource normal;
+        uint blockSize;
+    };
+
+    bool findBlockDecodePlan(const DDSHeader & header, BlockDecodePlan * plan)
+    {
+        uint fourcc = header.pf.fourcc;
+
+        // Map DX10 block formats to fourcc codes.
+        if (header.hasDX10Header())
+        {
+            const uint format = header.header10.dxgiFormat;
+            if (format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC1_UNORM_SRGB) fourcc = FOURCC_DXT1;
+            else if (format >= DXGI_FORMAT_BC2_TYPELESS && format <= DXGI_FORMAT_BC2_UNORM_SRGB) fourcc = FOURCC_DXT3;
+            else if (format >= DXGI_FORMAT_BC3_TYPELESS && format <= DXGI_FORMAT_BC3_UNORM_SRGB) fourcc = FOURCC_DXT5;
+            else if (format == DXGI_FORMAT_BC4_TYPELESS || format == DXGI_FORMAT_BC4_UNORM) fourcc = FOURCC_ATI1;
+            else if (format == DXGI_FORMAT_BC5_TYPELESS || format == DXGI_FORMAT_BC5_UNORM) fourcc = FOURCC_ATI2;
+        }
+
+        if (fourcc == FOURCC_DXT1) plan->read = readBlockDXT1;
+        else if (fourcc == FOURCC_DXT2 || fourcc == FOURCC_DXT3) plan->read = readBlockDXT3;
+        else if (fourcc == FOURCC_DXT4 || fourcc == FOURCC_DXT5) plan->read = readBlockDXT5;
+        else if (fourcc == FOURCC_RXGB) plan->read = readBlockRXGB;
+        else if (fourcc == FOURCC_ATI1) plan->read = readBlockATI1;
+        else if (fourcc == FOURCC_ATI2) plan->read = readBlockATI2;
+        else if (header.hasDX10Header() && header.header10.dxgiFormat == DXGI_FORMAT_BC6H_UF16) plan->read = readBlockBC6U;
+        else if (header.hasDX10Header() && header.header10.dxgiFormat == DXGI_FORMAT_BC6H_SF16) plan->read = readBlockBC6S;
+        else if (header.hasDX10Header() &&
+            (header.header10.dxgiFormat == DXGI_FORMAT_BC7_UNORM || header.header10.dxgiFormat == DXGI_FORMAT_BC7_UNORM_SRGB)) plan->read = readBlockBC7;
+        else return false;
+
+        // If normal flag set, convert to normal.
+        plan->normal = NormalSource_None;
+        if (header.pf.flags & DDPF_NORMAL)
+        {
+            if (fourcc == FOURCC_ATI2) plan->normal = NormalSource_RG;
+            else if (fourcc == FOURCC_DXT5) plan->normal = NormalSource_AG;
+        }
+
+        plan->blockSize = header.blockSize();
+        return true;
+    }
+
+    // Same as buildNormal, four texels at a time.
+    void buildNormals(ColorBlock * rgba, NormalSource source)
+    {
+#if NV_USE_SSE > 1
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 k255 = _mm_set1_ps(255.0f);
+
+        uint32 * colors = (uint32 *)rgba->colors();
+
+        for (uint i = 0; i < 16; i += 4)
+        {
+            const __m128i c = _mm_loadu_si128((const __m128i *)(colors + i));
+            const __m128i x = (source == NormalSource_RG) ? _mm_and_si128(_mm_srli_epi32(c, 16), mask) : _mm_srli_epi32(c, 24);
+            const __m128i y = _mm_and_si128(_mm_srli_epi32(c, 8), mask);
+
+            const __m128 nx = _mm_sub_ps(_mm_mul_ps(two, _mm_div_ps(_mm_cvtepi32_ps(x), k255)), one);
+            const __m128 ny = _mm_sub_ps(_mm_mul_ps(two, _mm_div_ps(_mm_cvtepi32_ps(y), k255)), one);
+            const __m128 t = _mm_sub_ps(_mm_sub_ps(one, _mm_mul_ps(nx, nx)), _mm_mul_ps(ny, ny));
+            const __m128 nz = _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_sqrt_ps(_mm_max_ps(t, zero)));
+
+            // nz is in [0, 1], so z is in [127, 255] and doesn't need to be clamped.
+            const __m128i z = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(k255, _mm_add_ps(nz, one)), two));
+
+            const __m128i n = _mm_or_si128(_mm_or_si128(_mm_set1_epi32(0xFF000000), _mm_slli_epi32(x, 16)), _mm_or_si128(_mm_slli_epi32(y, 8), z));
+            _mm_storeu_si128((__m128i *)(colors + i), n);
+        }
+#else
+        for (int i = 0; i < 16; i++)
+        {
+            Color32 & c = rgba->color(i);
+            c = buildNormal((source == NormalSource_RG) ? c.r : c.a, c.g);
+        }
+#endif
+    }
+
+    inline void decodeBlock(const BlockDecodePlan & plan, const uint8 * data, ColorBlock * rgba)
+    {
+        plan.read(data, rgba);
+        if (plan.normal != NormalSource_None) buildNormals(rgba, plan.normal);
+    }
+
+    struct ReadBlocksContext
+    {
+        const BlockDecodePlan * plan;
+        const uint8 * blocks;
+        Image * img;
+    };
+
+    // One item per row of blocks.
+    void ReadBlocksTask(void * context, int begin, int end)
+    {
+        const ReadBlocksContext * ctx = (const ReadBlocksContext *)context;
+
+        const uint w = ctx->img->width();
+        const uint h = ctx->img->height();
+        const uint bw = (w + 3) / 4;
+
+        for (uint by = begin; by < uint(end); by++)
+        {
+            for (uint bx = 0; bx < bw; bx++)
+            {
+                ColorBlock block;
+                decodeBlock(*ctx->plan, ctx->blocks + (by * bw + bx) * ctx->plan->blockSize, &block);
+
+                // Write color block.
+                for (uint y = 0; y < min(4U, h-4*by); y++)
+                {
+                    for (uint x = 0; x < min(4U, w-4*bx); x++)
+                    {
+                        ctx->img->pixel(4*bx+x, 4*by+y) = block.color(x, y);
+                    }
+                }
+            }
+        }
+    }
+
+    // Surfaces smaller than this are decoded on the calling thread, larger ones in tasks of about kReadTaskSize texels.
+    const uint kParallelReadThreshold = 256 * 1024;
+    const uint kReadTaskSize = 32 * 1024;
+
+} // namespace
+
+void DirectDrawSurface::readBlockImage(Image * img, const void * mapped)
+{
+    nvDebugCheck(stream != NULL);
+    nvDebugCheck(img != NULL);
+
+    const uint w = img->width();
+    const uint h = img->height();
+
+    const uint bw = (w + 3) / 4;
+    const uint bh = (h + 3) / 4;
+
+    // Read the whole surface, unless it's mapped.
+    Array<uint8> blocks;
+    if (mapped == NULL) {
+        blocks.resize(bw * bh * header.blockSize());
+        stream->serialize(blocks.buffer(), blocks.count());
+        mapped = blocks.buffer();
+    }
+
+    BlockFormat format;
+    if (findBlockFormat(header, &format))
     {
-        BlockBC7 block;
-        *stream << block;
-        block.decodeBlock(rgba);
+        // Decode it straight into the image, rows of blocks in parallel.
+        decodeSurface(format, BlockDecoder_D3D10, w, h, mapped, img->pixels(), w);
+        return;
     }
-    else
+
+    // The swizzled formats and normal maps are decoded block by block, also rows of blocks in parallel.
+    BlockDecodePlan plan;
+    if (!findBlockDecodePlan(header, &plan))
     {
         nvDebugCheck(false);
+        return;
     }
 
-    // If normal flag set, convert to normal.
-    if (header.pf.flags & DDPF_NORMAL)
+    ReadBlocksContext context;
+    context.plan = &plan;
+    context.blocks = (const uint8 *)mapped;
+    context.img = img;
+
+    if (w * h < kParallelReadThreshold) {
+        ReadBlocksTask(&context, 0, bh);
+    }
+    else {
+        TaskScheduler::global()->parallelFor(ReadBlocksTask, &context, bh, max(1U, kReadTaskSize / (4 * w)));
+    }
+}
+
+
+void DirectDrawSurface::decodeBlockRow(const void * data, uint w, uint h, float * rgba, uint planeStride) const
+{
+    nvDebugCheck(header.isBlockFormat());
+    nvDebugCheck(h <= 4);
+
+    BlockDecodePlan plan;
+    if (!findBlockDecodePlan(header, &plan))
     {
-        if (fourcc == FOURCC_ATI2)
+        nvDebugCheck(false);
+        return;
+    }
+
+    const uint bw = (w + 3) / 4;
+
+    // BC6 is decoded without clamping to 8 bits.
+    const bool bc6 = (plan.read == readBlockBC6U || plan.read == readBlockBC6S);
+
+    for (uint bx = 0; bx < bw; bx++)
+    {
+        const uint8 * block = (const uint8 *)data + bx * plan.blockSize;
+        const uint bwidth = min(4U, w - 4 * bx);
+
+        if (bc6)
         {
-            for (int i = 0; i < 16; i++)
-            {
-                Color32 & c = rgba->color(i);
-                c = buildNormal(c.r, c.g);
+            ColorSet set;
+            ((const BlockBC6 *)block)->decodeBlock(&set, plan.read == readBlockBC6S);
+
+            for (uint y = 0; y < h; y++) {
+                for (uint x = 0; x < bwidth; x++) {
+                    const Vector4 & c = set.colors[y * 4 + x];
+                    float * dst = rgba + y * w + 4 * bx + x;
+                    dst[0 * planeStride] = c.x;
+                    dst[1 * planeStride] = c.y;
+                    dst[2 * planeStride] = c.z;
+                    dst[3 * planeStride] = c.w;
+                }
             }
         }
-        else if (fourcc == FOURCC_DXT5)
+        else
         {
-            for (int i = 0; i < 16; i++)
-            {
-                Color32 & c = rgba->color(i);
-                c = buildNormal(c.a, c.g);
+            ColorBlock colors;
+            decodeBlock(plan, block, &colors);
+
+            for (uint y = 0; y < h; y++) {
+                for (uint x = 0; x < bwidth; x++) {
+                    const Color32 c = colors.color(x, y);
+                    float * dst = rgba + y * w + 4 * bx + x;
+                    dst[0 * planeStride] = c.r / 255.0f;
+                    dst[1 * planeStride] = c.g / 255.0f;
+                    dst[2 * planeStride] = c.b / 255.0f;
+                    dst[3 * planeStride] = c.a / 255.0f;
+                }
             }
         }
     }
@@ -1598,18 +1911,29 @@ uint DirectDrawSurface::faceSize() const
     return size;
 }
 
-uint DirectDrawSurface::offset(const uint face, const uint mipmap)
+uint64 DirectDrawSurface::offset(const uint face, const uint mipmap) const
 {
-    uint size = 128; // sizeof(DDSHeader);
+    uint64 size = 128; // sizeof(DDSHeader);
 
     if (header.hasDX10Header())
     {
         size += 20; // sizeof(DDSHeader10);
     }
 
+    if (header.supercompression() != Supercompression_None)
+    {
+        // Returns the end of the file when a surface is truncated.
+        stream->seek(size);
+        for (uint i = 0; i < face * mipmapCount() + mipmap; i++)
+        {
+            if (!skipSupercompressed(*stream)) return stream->size();
+        }
+        return stream->tell();
+    }
+
     if (face != 0)
     {
-        size += face * faceSize();
+        size += uint64(face) * faceSize();
     }
 
     for (uint m = 0; m < mipmap; m++)
@@ -1731,5 +2055,42 @@ void DirectDrawSurface::printInfo() const
     {
         printf("User Version: %d\n", header.reserved[8]);
     }
+
+    if (header.reserved[5] == FOURCC_SUPC)
+    {
+        printf("Supercompression: %s\n", supercompressionName(header.supercompression()));
+    }
+}
+
+void DirectDrawSurface::printSummary() const
+{
+    if (isTexture3D()) printf("%ux%ux%u", width(), height(), depth());
+    else printf("%ux%u", width(), height());
+
+    if (isTextureCube()) printf(" cube");
+    if (isTextureArray()) printf(" array[%u]", arrayCount());
+
+    printf(", %u mipmaps, ", mipmapCount());
+
+    if (header.hasDX10Header()) {
+        printf("DXGI %u (%s)", header.header10.dxgiFormat, getDxgiFormatString((DXGI_FORMAT)header.header10.dxgiFormat));
+    }
+    else if (header.pf.flags & DDPF_FOURCC) {
+        printf("'%c%c%c%c'", (header.pf.fourcc >> 0) & 0xFF, (header.pf.fourcc >> 8) & 0xFF, (header.pf.fourcc >> 16) & 0xFF, (header.pf.fourcc >> 24) & 0xFF);
+    }
+    else {
+        printf("%u bpp", header.pf.bitcount);
+    }
+
+    const uint faceCount = (isTextureCube() ? 6 : 1) * arrayCount();
+
+    if (header.supercompression() != Supercompression_None) {
+        // Only the header is needed for the decoded size.
+        const uint64 headerSize = header.hasDX10Header() ? 148 : 128;
+        printf(", %llu bytes decoded, %s", (unsigned long long)(headerSize + uint64(faceCount) * faceSize()), supercompressionName(header.supercompression()));
+    }
+    else {
+        printf(", %llu bytes", (unsigned long long)offset(faceCount, 0));
+    }
 }
 
@@ -103,6 +103,7 @@ namespace nv
     {
         FOURCC_NVTT = MAKEFOURCC('N', 'V', 'T', 'T'),
         FOURCC_DDS = MAKEFOURCC('D', 'D', 'S', ' '),
+        FOURCC_DDSZ = MAKEFOURCC('D', 'D', 'S', 'Z'),   // Signature of supercompressed files, which other DDS readers can't decode.
         FOURCC_DXT1 = MAKEFOURCC('D', 'X', 'T', '1'),
         FOURCC_DXT2 = MAKEFOURCC('D', 'X', 'T', '2'),
         FOURCC_DXT3 = MAKEFOURCC('D', 'X', 'T', '3'),
@@ -114,6 +115,7 @@ namespace nv
         FOURCC_A2XY = MAKEFOURCC('A', '2', 'X', 'Y'),
         FOURCC_DX10 = MAKEFOURCC('D', 'X', '1', '0'),
         FOURCC_UVER = MAKEFOURCC('U', 'V', 'E', 'R'),
+        FOURCC_SUPC = MAKEFOURCC('S', 'U', 'P', 'C'),
     };
 
 
@@ -337,6 +339,7 @@ namespace nv
         void setSrgbFlag(bool b);
         void setHasAlphaFlag(bool b);
         void setUserVersion(int version);
+        void setSupercompression(uint scheme, uint layout);     // Also sets the signature, call it after setLinearSize.
 
         void swapBytes();
 
@@ -344,6 +347,8 @@ namespace nv
         uint signature() const;
         uint toolVersion() const;
         uint userVersion() const;
+        uint supercompression() const;          // SupercompressionScheme.
+        uint supercompressionLayout() const;    // BlockLayout.
         bool isNormalMap() const;
         bool isSrgb() const;
         bool hasAlpha() const;
@@ -369,6 +374,10 @@ namespace nv
         bool load(const char * filename);
         bool load(Stream * stream);
 
+        // Read only the header of the file, its first 148 bytes. Enough for the image properties and the offsets and sizes of
+        // the surfaces, but the surfaces can't be read.
+        bool loadHeader(const char * filename);
+
         bool isValid() const;
         bool isSupported() const;
 
@@ -395,9 +404,24 @@ namespace nv
         uint surfaceHeight(uint mipmap) const;
         uint surfaceDepth(uint mipmap) const;
         uint surfaceSize(uint mipmap) const;
+
+        // Offset of the surface from the start of the file. The faces, or array elements, are stored one after the other with
+        // all their mipmaps. Supercompressed surfaces have variable sizes, the previous ones are read from the file to skip them.
+        uint64 offset(uint face, uint mipmap) const;
+
         bool readSurface(uint face, uint mipmap, void * data, uint size);
 
+        // Direct access to the surfaceSize(mipmap) bytes of a surface when the file was loaded by name and could be memory
+        // mapped. Returns NULL otherwise, when the file is truncated or when it's supercompressed, readSurface decodes those.
+        // Valid until the surface is reloaded or destroyed.
+        const void * surfaceData(uint face, uint mipmap) const;
+
+        // Decode a row of blocks of a block compressed surface into h <= 4 rows of w texels of planar float RGBA in [0, 1].
+        // The planes of rgba are planeStride floats apart. Doesn't touch the stream, so it can be called from several threads.
+        void decodeBlockRow(const void * data, uint w, uint h, float * rgba, uint planeStride) const;
+
         void printInfo() const;
+        void printSummary() const;  // One line, without the newline.
 
         // Only initialized after loading.
         DDSHeader header;
@@ -405,15 +429,15 @@ namespace nv
     private:
 
         uint faceSize() const;
-        uint offset(uint face, uint mipmap);
 
         void readLinearImage(Image * img);
-        void readBlockImage(Image * img);
-        void readBlock(ColorBlock * rgba);
+        void readBlockImage(Image * img, const void * mapped);   // mapped is the surface of a mapped file, or NULL.
 
 
     private:
         Stream * stream;
+        const uint8 * mem;      // Start of the file mapping, if any.
+        uint8 headerData[148];  // Read by loadHeader.
     };
 
 } // nv namespace
@@ -5,11 +5,349 @@
 
 #include "nvmath/Matrix.h"
 #include "nvmath/Vector.inl"
+#include "nvmath/Color.inl" // toSrgb
+
+#include "nvcore/Utils.h" // clamp
+#include "nvcore/Memory.h" // NV_ALIGN_16
+#include "nvcore/Array.inl"
+
+#include "nvthread/TaskScheduler.h"
 
 #include <float.h> // FLT_MAX
+#include <string.h> // memset
+
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#include "nvmath/SimdVector.h" // approxPow
+#endif
 
 using namespace nv;
 
+static Vector3 rgbToCieLab(Vector3::Arg c);
+static float deltaE(Vector3::Arg lab0, Vector3::Arg lab1);
+static float deltaE94(Vector3::Arg lab0, Vector3::Arg lab1);
+
+namespace
+{
+    // Texels of each slice of the reductions. Images with a single slice are processed on the calling thread.
+    const uint kErrorSliceSize = 16 * 1024;
+
+    // Reductions are split in at most this many slices, each slice accumulates its own partial sums.
+    const uint kMaxErrorSlices = 64;
+
+    // Texels of each block accumulated in single precision before adding them to the double precision sums.
+    const uint kErrorBlockSize = 1024;
+
+    enum ErrorSum
+    {
+        Sum_SquaredColor,
+        Sum_SquaredAlpha,
+        Sum_AbsoluteColor,
+        Sum_AbsoluteAlpha,
+        Sum_CieLab,
+        Sum_CieLab94,
+        Sum_Angle,
+        Sum_SquaredAngle,
+        Sum_Count
+    };
+
+    struct ErrorContext
+    {
+        const float * c0[4];    // Channels of the first image.
+        const float * c1[4];    // Channels of the second image, its alpha weights the color errors.
+        uint count;
+        uint sliceSize;         // Multiple of 4.
+        uint flags;
+        bool alphaWeight;
+
+        double sums[kMaxErrorSlices][Sum_Count];
+    };
+
+    inline void addColorErrors(const ErrorContext * ctx, uint i, double * sums)
+    {
+        const float r = ctx->c0[0][i] - ctx->c1[0][i];
+        const float g = ctx->c0[1][i] - ctx->c1[1][i];
+        const float b = ctx->c0[2][i] - ctx->c1[2][i];
+        const float a = ctx->c0[3][i] - ctx->c1[3][i];
+        const float w = ctx->alphaWeight ? ctx->c1[3][i] : 1.0f;
+
+        sums[Sum_SquaredColor] += (r * r + g * g + b * b) * w;
+        sums[Sum_AbsoluteColor] += (fabsf(r) + fabsf(g) + fabsf(b)) * w;
+        sums[Sum_SquaredAlpha] += a * a;
+        sums[Sum_AbsoluteAlpha] += fabsf(a);
+    }
+
+    inline void addAngle(float cosine, double * sums)
+    {
+        const float angle = acosf(clamp(cosine, -1.0f, 1.0f));
+        sums[Sum_Angle] += angle;
+        sums[Sum_SquaredAngle] += angle * angle;
+    }
+
+    // Cosine of the angle between the normals packed in texel i of both images.
+    inline float normalCosine(const ErrorContext * ctx, uint i)
+    {
+        Vector3 n0 = Vector3(ctx->c0[0][i], ctx->c0[1][i], ctx->c0[2][i]);
+        Vector3 n1 = Vector3(ctx->c1[0][i], ctx->c1[1][i], ctx->c1[2][i]);
+
+        n0 = 2.0f * n0 - Vector3(1);
+        n1 = 2.0f * n1 - Vector3(1);
+
+        n0 = normalizeSafe(n0, Vector3(0), 0.0f);
+        n1 = normalizeSafe(n1, Vector3(0), 0.0f);
+
+        return dot(n0, n1);
+    }
+
+#if NV_USE_SSE > 1
+    inline double horizontalSum(__m128 v)
+    {
+        NV_ALIGN_16 float tmp[4];
+        _mm_store_ps(tmp, v);
+        return double(tmp[0]) + double(tmp[1]) + double(tmp[2]) + double(tmp[3]);
+    }
+
+    inline __m128 absolute(__m128 v)
+    {
+        return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+    }
+
+    // Normalize 2 * n - 1, zero vectors stay zero.
+    inline void unpackNormals(__m128 & x, __m128 & y, __m128 & z)
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+        x = _mm_sub_ps(_mm_add_ps(x, x), one);
+        y = _mm_sub_ps(_mm_add_ps(y, y), one);
+        z = _mm_sub_ps(_mm_add_ps(z, z), one);
+
+        const __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        const __m128 s = _mm_and_ps(_mm_cmpgt_ps(l, _mm_setzero_ps()), _mm_div_ps(one, l));
+        x = _mm_mul_ps(x, s);
+        y = _mm_mul_ps(y, s);
+        z = _mm_mul_ps(z, s);
+    }
+#endif
+
+    void ErrorTask(void * context, int begin, int end)
+    {
+        ErrorContext * ctx = (ErrorContext *)context;
+
+        const bool colorErrors = (ctx->flags & (ErrorMetric_RmsColor | ErrorMetric_RmsAlpha | ErrorMetric_AverageColor | ErrorMetric_AverageAlpha)) != 0;
+        const bool labErrors = (ctx->flags & (ErrorMetric_CieLab | ErrorMetric_CieLab94)) != 0;
+        const bool angularErrors = (ctx->flags & (ErrorMetric_AverageAngular | ErrorMetric_RmsAngular)) != 0;
+
+        for (int s = begin; s < end; s++)
+        {
+            const uint first = uint(s) * ctx->sliceSize;
+            const uint last = min(ctx->count, first + ctx->sliceSize);
+
+            double * sums = ctx->sums[s];
+            memset(sums, 0, sizeof(double) * Sum_Count);
+
+            if (colorErrors)
+            {
+                uint i = first;
+#if NV_USE_SSE > 1
+                const __m128 one = _mm_set1_ps(1.0f);
+
+                while (i + 4 <= last) {
+                    const uint blockEnd = i + min((last - i) & ~3U, kErrorBlockSize);
+                    __m128 squaredColor = _mm_setzero_ps();
+                    __m128 absoluteColor = _mm_setzero_ps();
+                    __m128 squaredAlpha = _mm_setzero_ps();
+                    __m128 absoluteAlpha = _mm_setzero_ps();
+
+                    for (; i < blockEnd; i += 4) {
+                        const __m128 r = _mm_sub_ps(_mm_loadu_ps(ctx->c0[0] + i), _mm_loadu_ps(ctx->c1[0] + i));
+                        const __m128 g = _mm_sub_ps(_mm_loadu_ps(ctx->c0[1] + i), _mm_loadu_ps(ctx->c1[1] + i));
+                        const __m128 b = _mm_sub_ps(_mm_loadu_ps(ctx->c0[2] + i), _mm_loadu_ps(ctx->c1[2] + i));
+                        const __m128 a1 = _mm_loadu_ps(ctx->c1[3] + i);
+                        const __m128 a = _mm_sub_ps(_mm_loadu_ps(ctx->c0[3] + i), a1);
+                        const __m128 w = ctx->alphaWeight ? a1 : one;
+
+                        const __m128 sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(g, g)), _mm_mul_ps(b, b));
+                        const __m128 ab = _mm_add_ps(_mm_add_ps(absolute(r), absolute(g)), absolute(b));
+
+                        squaredColor = _mm_add_ps(squaredColor, _mm_mul_ps(sq, w));
+                        absoluteColor = _mm_add_ps(absoluteColor, _mm_mul_ps(ab, w));
+                        squaredAlpha = _mm_add_ps(squaredAlpha, _mm_mul_ps(a, a));
+                        absoluteAlpha = _mm_add_ps(absoluteAlpha, absolute(a));
+                    }
+
+                    sums[Sum_SquaredColor] += horizontalSum(squaredColor);
+                    sums[Sum_AbsoluteColor] += horizontalSum(absoluteColor);
+                    sums[Sum_SquaredAlpha] += horizontalSum(squaredAlpha);
+                    sums[Sum_AbsoluteAlpha] += horizontalSum(absoluteAlpha);
+                }
+#endif
+                for (; i < last; i++) {
+                    addColorErrors(ctx, i, sums);
+                }
+            }
+
+            if (labErrors)
+            {
+                // Dominated by the powf calls of the conversions, each texel is converted once for both metrics.
+                for (uint i = first; i < last; i++) {
+                    const Vector3 lab0 = rgbToCieLab(Vector3(ctx->c0[0][i], ctx->c0[1][i], ctx->c0[2][i]));
+                    const Vector3 lab1 = rgbToCieLab(Vector3(ctx->c1[0][i], ctx->c1[1][i], ctx->c1[2][i]));
+
+                    if (ctx->flags & ErrorMetric_CieLab) sums[Sum_CieLab] += deltaE(lab0, lab1);
+                    if (ctx->flags & ErrorMetric_CieLab94) sums[Sum_CieLab94] += deltaE94(lab0, lab1);
+                }
+            }
+
+            if (angularErrors)
+            {
+                uint i = first;
+#if NV_USE_SSE > 1
+                for (; i + 4 <= last; i += 4) {
+                    __m128 x0 = _mm_loadu_ps(ctx->c0[0] + i), y0 = _mm_loadu_ps(ctx->c0[1] + i), z0 = _mm_loadu_ps(ctx->c0[2] + i);
+                    __m128 x1 = _mm_loadu_ps(ctx->c1[0] + i), y1 = _mm_loadu_ps(ctx->c1[1] + i), z1 = _mm_loadu_ps(ctx->c1[2] + i);
+                    unpackNormals(x0, y0, z0);
+                    unpackNormals(x1, y1, z1);
+
+                    NV_ALIGN_16 float cosine[4];
+                    _mm_store_ps(cosine, _mm_add_ps(_mm_add_ps(_mm_mul_ps(x0, x1), _mm_mul_ps(y0, y1)), _mm_mul_ps(z0, z1)));
+
+                    for (uint k = 0; k < 4; k++) {
+                        addAngle(cosine[k], sums);
+                    }
+                }
+#endif
+                for (; i < last; i++) {
+                    addAngle(normalCosine(ctx, i), sums);
+                }
+            }
+        }
+    }
+
+    // Sum the errors of the first count texels of the images in sums. The texels are split in slices that only depend
+    // on count, and the partial sums of the slices are added in order, so the result is the same with any number of threads.
+    void accumulateErrors(const FloatImage * img0, const FloatImage * img1, uint count, uint flags, bool alphaWeight, double sums[Sum_Count])
+    {
+        ErrorContext context;
+        for (uint c = 0; c < 4; c++) {
+            context.c0[c] = img0->channel(c);
+            context.c1[c] = img1->channel(c);
+        }
+        context.count = count;
+        context.flags = flags;
+        context.alphaWeight = alphaWeight;
+
+        const uint sliceCount = clamp((count + kErrorSliceSize - 1) / kErrorSliceSize, 1U, kMaxErrorSlices);
+        context.sliceSize = ((count + sliceCount - 1) / sliceCount + 3) & ~3U;
+
+        if (sliceCount == 1) {
+            ErrorTask(&context, 0, 1);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(ErrorTask, &context, sliceCount);
+        }
+
+        for (uint k = 0; k < Sum_Count; k++) {
+            sums[k] = 0.0;
+            for (uint s = 0; s < sliceCount; s++) {
+                sums[k] += context.sums[s][k];
+            }
+        }
+    }
+
+    struct ToneMappedErrorContext
+    {
+        const float * c0[4];
+        const float * c1[4];
+        uint count;
+        uint sliceSize;         // Multiple of 4, the same as for accumulateErrors.
+        bool alphaWeight;
+
+        const float * scales;   // Inverse of the exposures.
+        uint exposureCount;
+        double * sums;          // Squared color errors of each exposure, for each slice.
+    };
+
+    // Scale by the inverse of the exposure, Reinhard tone mapping and sRGB encoding, computed like Surface::scaleBias,
+    // Surface::toneMap and Surface::toSrgb do so the errors match those of the tone mapped surfaces.
+    inline float toneMappedSrgb(float x, float scale)
+    {
+        float v = scale * x;
+        v /= v + 1;
+        return toSrgb(v);
+    }
+
+#if NV_USE_SSE > 1
+    inline __m128 toneMappedSrgb(__m128 x, __m128 scale)
+    {
+        const SimdVector zero(0.0f), one(1.0f), power(0.41666f), srgbScale(1.055f), bias(0.055f);
+        const SimdVector linearScale(12.92f), linearEnd(0.0031308f);
+
+        SimdVector v = SimdVector(scale) * SimdVector(x);
+        v = v / (v + one);
+
+        SimdVector f = min(max(v, zero), one);     // NaNs go to 0.
+        SimdVector curve = approxPow(f, power) * srgbScale - bias;
+        SimdVector linear = f * linearScale;
+        return select(curve, linear, SimdVector(_mm_cmple_ps(f.vec, linearEnd.vec))).vec;
+    }
+#endif
+
+    // Each block of texels is tone mapped at all the exposures while it's in cache, the image is only read once.
+    void ToneMappedErrorTask(void * context, int begin, int end)
+    {
+        ToneMappedErrorContext * ctx = (ToneMappedErrorContext *)context;
+
+        for (int s = begin; s < end; s++)
+        {
+            const uint first = uint(s) * ctx->sliceSize;
+            const uint last = min(ctx->count, first + ctx->sliceSize);
+
+            double * sums = ctx->sums + s * ctx->exposureCount;
+            for (uint e = 0; e < ctx->exposureCount; e++) sums[e] = 0.0;
+
+            uint i = first;
+#if NV_USE_SSE > 1
+            const __m128 one = _mm_set1_ps(1.0f);
+
+            while (i + 4 <= last) {
+                const uint blockBegin = i;
+                const uint blockEnd = i + min((last - i) & ~3U, kErrorBlockSize);
+
+                for (uint e = 0; e < ctx->exposureCount; e++) {
+                    const __m128 scale = _mm_set1_ps(ctx->scales[e]);
+                    __m128 squaredColor = _mm_setzero_ps();
+
+                    for (i = blockBegin; i < blockEnd; i += 4) {
+                        const __m128 r = _mm_sub_ps(toneMappedSrgb(_mm_loadu_ps(ctx->c0[0] + i), scale), toneMappedSrgb(_mm_loadu_ps(ctx->c1[0] + i), scale));
+                        const __m128 g = _mm_sub_ps(toneMappedSrgb(_mm_loadu_ps(ctx->c0[1] + i), scale), toneMappedSrgb(_mm_loadu_ps(ctx->c1[1] + i), scale));
+                        const __m128 b = _mm_sub_ps(toneMappedSrgb(_mm_loadu_ps(ctx->c0[2] + i), scale), toneMappedSrgb(_mm_loadu_ps(ctx->c1[2] + i), scale));
+                        const __m128 w = ctx->alphaWeight ? _mm_loadu_ps(ctx->c1[3] + i) : one;
+
+                        const __m128 sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(g, g)), _mm_mul_ps(b, b));
+                        squaredColor = _mm_add_ps(squaredColor, _mm_mul_ps(sq, w));
+                    }
+
+                    sums[e] += horizontalSum(squaredColor);
+                }
+            }
+#endif
+            for (; i < last; i++) {
+                const float w = ctx->alphaWeight ? ctx->c1[3][i] : 1.0f;
+
+                for (uint e = 0; e < ctx->exposureCount; e++) {
+                    const float scale = ctx->scales[e];
+                    const float r = toneMappedSrgb(ctx->c0[0][i], scale) - toneMappedSrgb(ctx->c1[0][i], scale);
+                    const float g = toneMappedSrgb(ctx->c0[1][i], scale) - toneMappedSrgb(ctx->c1[1][i], scale);
+                    const float b = toneMappedSrgb(ctx->c0[2][i], scale) - toneMappedSrgb(ctx->c1[2][i], scale);
+
+                    sums[e] += (r * r + g * g + b * b) * w;
+                }
+            }
+        }
+    }
+
+} // namespace
+
+
 float nv::rmsColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight)
 {
     if (!sameLayout(img, ref)) {
@@ -18,33 +356,59 @@ float nv::rmsColorError(const FloatImage * img, const FloatImage * ref, bool alp
     nvDebugCheck(img->componentCount() == 4);
     nvDebugCheck(ref->componentCount() == 4);
 
-    double mse = 0;
+    const uint count = img->pixelCount();
+
+    double sums[Sum_Count];
+    accumulateErrors(img, ref, count, ErrorMetric_RmsColor, alphaWeight, sums);
+
+    return float(sqrt(sums[Sum_SquaredColor] / count));
+}
+
+void nv::rmsToneMappedErrors(const FloatImage * img, const FloatImage * ref, bool alphaWeight, const float * exposures, uint exposureCount, float * errors)
+{
+    if (!sameLayout(img, ref)) {
+        for (uint e = 0; e < exposureCount; e++) errors[e] = FLT_MAX;
+        return;
+    }
+    nvDebugCheck(img->componentCount() == 4);
+    nvDebugCheck(ref->componentCount() == 4);
 
     const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++)
-    {
-        float r0 = img->pixel(i + count * 0);
-        float g0 = img->pixel(i + count * 1);
-        float b0 = img->pixel(i + count * 2);
-        //float a0 = img->pixel(i + count * 3);
-        float r1 = ref->pixel(i + count * 0);
-        float g1 = ref->pixel(i + count * 1);
-        float b1 = ref->pixel(i + count * 2);
-        float a1 = ref->pixel(i + count * 3);
+    const uint sliceCount = clamp((count + kErrorSliceSize - 1) / kErrorSliceSize, 1U, kMaxErrorSlices);
 
-        float r = r0 - r1;
-        float g = g0 - g1;
-        float b = b0 - b1;
+    Array<float> scales;
+    scales.resize(exposureCount);
+    for (uint e = 0; e < exposureCount; e++) scales[e] = 1.0f / exposures[e];
 
-        float a = 1;
-        if (alphaWeight) a = a1;
+    Array<double> sums;
+    sums.resize(sliceCount * exposureCount);
 
-        mse += r * r * a;
-        mse += g * g * a;
-        mse += b * b * a;
+    ToneMappedErrorContext context;
+    for (uint c = 0; c < 4; c++) {
+        context.c0[c] = img->channel(c);
+        context.c1[c] = ref->channel(c);
+    }
+    context.count = count;
+    context.sliceSize = ((count + sliceCount - 1) / sliceCount + 3) & ~3U;
+    context.alphaWeight = alphaWeight;
+    context.scales = scales.buffer();
+    context.exposureCount = exposureCount;
+    context.sums = sums.buffer();
+
+    if (sliceCount == 1) {
+        ToneMappedErrorTask(&context, 0, 1);
+    }
+    else {
+        TaskScheduler::global()->parallelFor(ToneMappedErrorTask, &context, sliceCount);
     }
 
-    return float(sqrt(mse / count));
+    for (uint e = 0; e < exposureCount; e++) {
+        double sum = 0.0;
+        for (uint s = 0; s < sliceCount; s++) {
+            sum += sums[s * exposureCount + e];
+        }
+        errors[e] = float(sqrt(sum / count));
+    }
 }
 
 float nv::rmsAlphaError(const FloatImage * img, const FloatImage * ref)
@@ -54,20 +418,12 @@ float nv::rmsAlphaError(const FloatImage * img, const FloatImage * ref)
     }
     nvDebugCheck(img->componentCount() == 4 && ref->componentCount() == 4);
 
-    double mse = 0;
-
     const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++)
-    {
-        float a0 = img->pixel(i + count * 3);
-        float a1 = ref->pixel(i + count * 3);
 
-        float a = a0 - a1;
+    double sums[Sum_Count];
+    accumulateErrors(img, ref, count, ErrorMetric_RmsAlpha, false, sums);
 
-        mse += a * a;
-    }
-
-    return float(sqrt(mse / count));
+    return float(sqrt(sums[Sum_SquaredAlpha] / count));
 }
 
 
@@ -79,33 +435,12 @@ float nv::averageColorError(const FloatImage * img, const FloatImage * ref, bool
     nvDebugCheck(img->componentCount() == 4);
     nvDebugCheck(ref->componentCount() == 4);
 
-    double mae = 0;
-
     const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++)
-    {
-        float r0 = img->pixel(i + count * 0);
-        float g0 = img->pixel(i + count * 1);
-        float b0 = img->pixel(i + count * 2);
-        //float a0 = img->pixel(i + count * 3);
-        float r1 = ref->pixel(i + count * 0);
-        float g1 = ref->pixel(i + count * 1);
-        float b1 = ref->pixel(i + count * 2);
-        float a1 = ref->pixel(i + count * 3);
 
-        float r = fabs(r0 - r1);
-        float g = fabs(g0 - g1);
-        float b = fabs(b0 - b1);
-
-        float a = 1;
-        if (alphaWeight) a = a1;
-
-        mae += r * a;
-        mae += g * a;
-        mae += b * a;
-    }
+    double sums[Sum_Count];
+    accumulateErrors(img, ref, count, ErrorMetric_AverageColor, alphaWeight, sums);
 
-    return float(mae / count);
+    return float(sums[Sum_AbsoluteColor] / count);
 }
 
 float nv::averageAlphaError(const FloatImage * img, const FloatImage * ref)
@@ -115,20 +450,12 @@ float nv::averageAlphaError(const FloatImage * img, const FloatImage * ref)
     }
     nvDebugCheck(img->componentCount() == 4 && ref->componentCount() == 4);
 
-    double mae = 0;
-
     const uint count = img->width() * img->height();
-    for (uint i = 0; i < count; i++)
-    {
-        float a0 = img->pixel(i + count * 3);
-        float a1 = ref->pixel(i + count * 3);
-
-        float a = a0 - a1;
 
-        mae += fabs(a);
-    }
+    double sums[Sum_Count];
+    accumulateErrors(img, ref, count, ErrorMetric_AverageAlpha, false, sums);
 
-    return float(mae / count);
+    return float(sums[Sum_AbsoluteAlpha] / count);
 }
 
 
@@ -230,30 +557,90 @@ static Vector3 cieLabToLCh(Vector3::Arg c)
     return Vector3(c.x, sqrtf(c.y*c.y + c.z*c.z), atan2f(c.y, c.z));
 }
 
-static void rgbToCieLab(const FloatImage * rgbImage, FloatImage * LabImage)
+static float deltaE(Vector3::Arg lab0, Vector3::Arg lab1)
 {
-    nvDebugCheck(rgbImage != NULL && LabImage != NULL);
-    nvDebugCheck(rgbImage->width() == LabImage->width() && rgbImage->height() == LabImage->height());
-    nvDebugCheck(rgbImage->componentCount() >= 3 && LabImage->componentCount() >= 3);
+    // @@ Measure Delta E.
+    Vector3 delta = lab0 - lab1;
+
+    return length(delta);
+}
+
+static float deltaE94(Vector3::Arg lab0, Vector3::Arg lab1)
+{
+    const float kL = 1;
+    const float kC = 1;
+    const float kH = 1;
+    const float k1 = 0.045f;
+    const float k2 = 0.015f;
 
-    const uint w = rgbImage->width();
-    const uint h = LabImage->height();
+    const float sL = 1;
 
-    const float * R = rgbImage->channel(0);
-    const float * G = rgbImage->channel(1);
-    const float * B = rgbImage->channel(2);
+    Vector3 lch0 = cieLabToLCh(lab0);
+    Vector3 lch1 = cieLabToLCh(lab1);
 
-    float * L = LabImage->channel(0);
-    float * a = LabImage->channel(1);
-    float * b = LabImage->channel(2);
+    const float sC = 1 + k1*lch0.x;
+    const float sH = 1 + k2*lch0.x;
 
-    const uint count = w*h;
-    for (uint i = 0; i < count; i++)
+    // @@ Measure Delta E using the 1994 definition
+    Vector3 labDelta = lab0 - lab1;
+    Vector3 lchDelta = lch0 - lch1;
+
+    double deltaLsq = powf(lchDelta.x / (kL*sL), 2);
+    double deltaCsq = powf(lchDelta.y / (kC*sC), 2);
+
+    // avoid possible sqrt of negative value by computing (deltaH/(kH*sH))^2
+    double deltaHsq = powf(labDelta.y, 2) + powf(labDelta.z, 2) - powf(lchDelta.y, 2);
+    deltaHsq /= powf(kH*sH, 2);
+
+    return float(sqrt(deltaLsq + deltaCsq + deltaHsq));
+}
+
+namespace
+{
+    struct CieLabContext
+    {
+        const float * R;
+        const float * G;
+        const float * B;
+        float * L;
+        float * a;
+        float * b;
+    };
+
+    void CieLabTask(void * context, int begin, int end)
     {
-        Vector3 Lab = rgbToCieLab(Vector3(R[i], G[i], B[i]));
-        L[i] = Lab.x;
-        a[i] = Lab.y;
-        b[i] = Lab.z;
+        const CieLabContext * ctx = (const CieLabContext *)context;
+
+        for (int i = begin; i < end; i++)
+        {
+            Vector3 Lab = rgbToCieLab(Vector3(ctx->R[i], ctx->G[i], ctx->B[i]));
+            ctx->L[i] = Lab.x;
+            ctx->a[i] = Lab.y;
+            ctx->b[i] = Lab.z;
+        }
+    }
+}
+
+static void rgbToCieLab(const FloatImage * rgbImage, FloatImage * LabImage)
+{
+    nvDebugCheck(rgbImage != NULL && LabImage != NULL);
+    nvDebugCheck(rgbImage->width() == LabImage->width() && rgbImage->height() == LabImage->height());
+    nvDebugCheck(rgbImage->componentCount() >= 3 && LabImage->componentCount() >= 3);
+
+    CieLabContext context;
+    context.R = rgbImage->channel(0);
+    context.G = rgbImage->channel(1);
+    context.B = rgbImage->channel(2);
+    context.L = LabImage->channel(0);
+    context.a = LabImage->channel(1);
+    context.b = LabImage->channel(2);
+
+    const uint count = rgbImage->pixelCount();
+    if (count <= kErrorSliceSize) {
+        CieLabTask(&context, 0, count);
+    }
+    else {
+        TaskScheduler::global()->parallelFor(CieLabTask, &context, count, kErrorSliceSize);
     }
 }
 
@@ -264,29 +651,12 @@ float nv::cieLabError(const FloatImage * img0, const FloatImage * img1)
     if (!sameLayout(img0, img1)) return FLT_MAX;
     nvDebugCheck(img0->componentCount() == 4 && img1->componentCount() == 4);
 
-    const float * r0 = img0->channel(0);
-    const float * g0 = img0->channel(1);
-    const float * b0 = img0->channel(2);
-
-    const float * r1 = img1->channel(0);
-    const float * g1 = img1->channel(1);
-    const float * b1 = img1->channel(2);
-
-    double error = 0.0f;
-
     const uint count = img0->pixelCount();
-    for (uint i = 0; i < count; i++)
-    {
-        Vector3 lab0 = rgbToCieLab(Vector3(r0[i], g0[i], b0[i]));
-        Vector3 lab1 = rgbToCieLab(Vector3(r1[i], g1[i], b1[i]));
 
-        // @@ Measure Delta E.
-        Vector3 delta = lab0 - lab1;
-        
-        error += length(delta);
-    }
+    double sums[Sum_Count];
+    accumulateErrors(img0, img1, count, ErrorMetric_CieLab, false, sums);
 
-    return float(error / count);
+    return float(sums[Sum_CieLab] / count);
 }
 
 // Assumes input images are in linear sRGB space.
@@ -295,50 +665,12 @@ float nv::cieLab94Error(const FloatImage * img0, const FloatImage * img1)
     if (!sameLayout(img0, img1)) return FLT_MAX;
     nvDebugCheck(img0->componentCount() == 4 && img1->componentCount() == 4);
 
-    const float kL = 1;
-    const float kC = 1;
-    const float kH = 1;
-    const float k1 = 0.045f;
-    const float k2 = 0.015f;
-
-    const float sL = 1;
-
-    const float * r0 = img0->channel(0);
-    const float * g0 = img0->channel(1);
-    const float * b0 = img0->channel(2);
-
-    const float * r1 = img1->channel(0);
-    const float * g1 = img1->channel(1);
-    const float * b1 = img1->channel(2);
-
-    double error = 0.0f;
-
     const uint count = img0->pixelCount();
-    for (uint i = 0; i < count; ++i)
-    {
-        Vector3 lab0 = rgbToCieLab(Vector3(r0[i], g0[i], b0[i]));
-        Vector3 lch0 = cieLabToLCh(lab0);
-        Vector3 lab1 = rgbToCieLab(Vector3(r1[i], g1[i], b1[i]));
-        Vector3 lch1 = cieLabToLCh(lab1);
-
-        const float sC = 1 + k1*lch0.x;
-        const float sH = 1 + k2*lch0.x;
-
-        // @@ Measure Delta E using the 1994 definition
-        Vector3 labDelta = lab0 - lab1;
-        Vector3 lchDelta = lch0 - lch1;
 
-        double deltaLsq = powf(lchDelta.x / (kL*sL), 2);
-        double deltaCsq = powf(lchDelta.y / (kC*sC), 2);
+    double sums[Sum_Count];
+    accumulateErrors(img0, img1, count, ErrorMetric_CieLab94, false, sums);
 
-        // avoid possible sqrt of negative value by computing (deltaH/(kH*sH))^2
-        double deltaHsq = powf(labDelta.y, 2) + powf(labDelta.z, 2) - powf(lchDelta.y, 2);
-        deltaHsq /= powf(kH*sH, 2);
-
-        error += sqrt(deltaLsq + deltaCsq + deltaHsq);
-    }
-
-    return float(error / count);
+    return float(sums[Sum_CieLab94] / count);
 }
 
 float nv::spatialCieLabError(const FloatImage * img0, const FloatImage * img1)
@@ -388,73 +720,342 @@ float nv::averageAngularError(const FloatImage * img0, const FloatImage * img1)
     }
     nvDebugCheck(img0->componentCount() == 4 && img1->componentCount() == 4);
 
-    uint w = img0->width();
-    uint h = img0->height();
+    const uint count = img0->width() * img0->height();
+
+    double sums[Sum_Count];
+    accumulateErrors(img0, img1, count, ErrorMetric_AverageAngular, false, sums);
 
-    const float * x0 = img0->channel(0);
-    const float * y0 = img0->channel(1);
-    const float * z0 = img0->channel(2);
+    return float(sums[Sum_Angle] / count);
+}
+
+float nv::rmsAngularError(const FloatImage * img0, const FloatImage * img1)
+{
+    if (img0 == NULL || img1 == NULL || img0->width() != img1->width() || img0->height() != img1->height()) {
+        return FLT_MAX;
+    }
+    nvDebugCheck(img0->componentCount() == 4 && img1->componentCount() == 4);
 
-    const float * x1 = img1->channel(0);
-    const float * y1 = img1->channel(1);
-    const float * z1 = img1->channel(2);
+    const uint count = img0->width() * img0->height();
 
-    double error = 0.0f;
+    double sums[Sum_Count];
+    accumulateErrors(img0, img1, count, ErrorMetric_RmsAngular, false, sums);
 
-    const uint count = w*h;
-    for (uint i = 0; i < count; i++)
-    {
-        Vector3 n0 = Vector3(x0[i], y0[i], z0[i]);
-        Vector3 n1 = Vector3(x1[i], y1[i], z1[i]);
+    return float(sqrt(sums[Sum_SquaredAngle] / count));
+}
 
-        n0 = 2.0f * n0 - Vector3(1);
-        n1 = 2.0f * n1 - Vector3(1);
 
-        n0 = normalizeSafe(n0, Vector3(0), 0.0f);
-        n1 = normalizeSafe(n1, Vector3(0), 0.0f);
+void nv::computeErrorMetrics(const FloatImage * img, const FloatImage * ref, bool alphaWeight, uint flags, ErrorMetrics * metrics)
+{
+    nvDebugCheck(metrics != NULL);
+    memset(metrics, 0, sizeof(ErrorMetrics));
 
-        error += acos(clamp(dot(n0, n1), -1.0f, 1.0f));
+    if (!sameLayout(img, ref)) {
+        metrics->rmsColor = metrics->rmsAlpha = FLT_MAX;
+        metrics->averageColor = metrics->averageAlpha = FLT_MAX;
+        metrics->cieLab = metrics->cieLab94 = FLT_MAX;
+        metrics->averageAngular = metrics->rmsAngular = FLT_MAX;
+        return;
     }
+    nvDebugCheck(img->componentCount() == 4 && ref->componentCount() == 4);
+
+    const uint count = img->pixelCount();
 
-    return float(error / count);
+    double sums[Sum_Count];
+    accumulateErrors(img, ref, count, flags, alphaWeight, sums);
+
+    if (flags & ErrorMetric_RmsColor) metrics->rmsColor = float(sqrt(sums[Sum_SquaredColor] / count));
+    if (flags & ErrorMetric_RmsAlpha) metrics->rmsAlpha = float(sqrt(sums[Sum_SquaredAlpha] / count));
+    if (flags & ErrorMetric_AverageColor) metrics->averageColor = float(sums[Sum_AbsoluteColor] / count);
+    if (flags & ErrorMetric_AverageAlpha) metrics->averageAlpha = float(sums[Sum_AbsoluteAlpha] / count);
+    if (flags & ErrorMetric_CieLab) metrics->cieLab = float(sums[Sum_CieLab] / count);
+    if (flags & ErrorMetric_CieLab94) metrics->cieLab94 = float(sums[Sum_CieLab94] / count);
+    if (flags & ErrorMetric_AverageAngular) metrics->averageAngular = float(sums[Sum_Angle] / count);
+    if (flags & ErrorMetric_RmsAngular) metrics->rmsAngular = float(sqrt(sums[Sum_SquaredAngle] / count));
 }
 
-float nv::rmsAngularError(const FloatImage * img0, const FloatImage * img1)
+
+// Structural similarity, see:
+// Wang et al., "Image quality assessment: from error visibility to structural similarity", 2004.
+// Wang et al., "Multi-scale structural similarity for image quality assessment", 2003.
+
+namespace
 {
-    if (img0 == NULL || img1 == NULL || img0->width() != img1->width() || img0->height() != img1->height()) {
-        return FLT_MAX;
-    }
-    nvDebugCheck(img0->componentCount() == 4 && img1->componentCount() == 4);
+    // The Gaussian window of the original paper: 11x11 texels, sigma 1.5.
+    const int kSsimRadius = 5;
+    const int kSsimTaps = 2 * kSsimRadius + 1;
+    const float kSsimSigma = 1.5f;
 
-    uint w = img0->width();
-    uint h = img0->height();
+    // Stabilizing constants for a dynamic range of 1.
+    const float kSsimC1 = 0.01f * 0.01f;
+    const float kSsimC2 = 0.03f * 0.03f;
 
-    const float * x0 = img0->channel(0);
-    const float * y0 = img0->channel(1);
-    const float * z0 = img0->channel(2);
+    // Weights of the scales of MS-SSIM, from the finest to the coarsest.
+    const int kMaxSsimScales = 5;
+    const float kMsSsimWeights[kMaxSsimScales] = { 0.0448f, 0.2856f, 0.3001f, 0.2363f, 0.1333f };
 
-    const float * x1 = img1->channel(0);
-    const float * y1 = img1->channel(1);
-    const float * z1 = img1->channel(2);
+    const uint kSsimRowsPerTask = 16;
+    const uint kParallelSsimThreshold = 64 * 1024;
 
-    double error = 0.0f;
+    // Local statistics are the window averages of x, y, x*x, y*y and x*y.
+    enum SsimMoment { Moment_X, Moment_Y, Moment_XX, Moment_YY, Moment_XY, Moment_Count };
 
-    const uint count = w*h;
-    for (uint i = 0; i < count; i++)
+    struct SsimContext
     {
-        Vector3 n0 = Vector3(x0[i], y0[i], z0[i]);
-        Vector3 n1 = Vector3(x1[i], y1[i], z1[i]);
+        const float * x;
+        const float * y;
+        uint w, h;
 
-        n0 = 2.0f * n0 - Vector3(1);
-        n1 = 2.0f * n1 - Vector3(1);
+        float weights[kSsimTaps];
 
-        n0 = normalizeSafe(n0, Vector3(0), 0.0f);
-        n1 = normalizeSafe(n1, Vector3(0), 0.0f);
+        float * moments[Moment_Count];  // Filtered horizontally, w * h each.
+
+        double * rowSsim;               // Sum of the SSIM of the texels of each row.
+        double * rowContrast;           // Sum of the contrast-structure term of the texels of each row.
+    };
+
+    void SsimHorizontalTask(void * context, int begin, int end)
+    {
+        const SsimContext * ctx = (const SsimContext *)context;
+        const int w = int(ctx->w);
+
+        for (int row = begin; row < end; row++)
+        {
+            const float * x = ctx->x + row * w;
+            const float * y = ctx->y + row * w;
+
+            float * out[Moment_Count];
+            for (int m = 0; m < Moment_Count; m++) out[m] = ctx->moments[m] + row * w;
+
+            for (int i = 0; i < w; i++)
+            {
+                float sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+
+                // The edges are clamped, so that images smaller than the window work.
+                const bool inside = (i >= kSsimRadius && i + kSsimRadius < w);
+                for (int k = 0; k < kSsimTaps; k++)
+                {
+                    const int j = inside ? i + k - kSsimRadius : clamp(i + k - kSsimRadius, 0, w - 1);
+                    const float wk = ctx->weights[k];
+                    sx += wk * x[j];
+                    sy += wk * y[j];
+                    sxx += wk * x[j] * x[j];
+                    syy += wk * y[j] * y[j];
+                    sxy += wk * x[j] * y[j];
+                }
+
+                out[Moment_X][i] = sx;
+                out[Moment_Y][i] = sy;
+                out[Moment_XX][i] = sxx;
+                out[Moment_YY][i] = syy;
+                out[Moment_XY][i] = sxy;
+            }
+        }
+    }
+
+    void SsimVerticalTask(void * context, int begin, int end)
+    {
+        const SsimContext * ctx = (const SsimContext *)context;
+        const int w = int(ctx->w);
+        const int h = int(ctx->h);
+
+        // The vertical pass runs along the rows, so that the inner loops are over contiguous texels.
+        Array<float> sums;
+        sums.resize(Moment_Count * w);
+
+        for (int row = begin; row < end; row++)
+        {
+            memset(sums.buffer(), 0, sizeof(float) * Moment_Count * w);
+
+            for (int k = 0; k < kSsimTaps; k++)
+            {
+                const int r = clamp(row + k - kSsimRadius, 0, h - 1);
+                const float wk = ctx->weights[k];
+
+                for (int m = 0; m < Moment_Count; m++)
+                {
+                    const float * in = ctx->moments[m] + r * w;
+                    float * out = sums.buffer() + m * w;
+                    for (int i = 0; i < w; i++) {
+                        out[i] += wk * in[i];
+                    }
+                }
+            }
+
+            const float * mx = sums.buffer() + Moment_X * w;
+            const float * my = sums.buffer() + Moment_Y * w;
+            const float * mxx = sums.buffer() + Moment_XX * w;
+            const float * myy = sums.buffer() + Moment_YY * w;
+            const float * mxy = sums.buffer() + Moment_XY * w;
+
+            double ssim = 0.0;
+            double contrast = 0.0;
+
+            for (int i = 0; i < w; i++)
+            {
+                const float varX = mxx[i] - mx[i] * mx[i];
+                const float varY = myy[i] - my[i] * my[i];
+                const float covXY = mxy[i] - mx[i] * my[i];
+
+                const float l = (2 * mx[i] * my[i] + kSsimC1) / (mx[i] * mx[i] + my[i] * my[i] + kSsimC1);
+                const float cs = (2 * covXY + kSsimC2) / (varX + varY + kSsimC2);
+
+                ssim += l * cs;
+                contrast += cs;
+            }
+
+            ctx->rowSsim[row] = ssim;
+            ctx->rowContrast[row] = contrast;
+        }
+    }
+
+    // Mean SSIM and mean contrast-structure term of two w x h planes.
+    void planeSsim(const float * x, const float * y, uint w, uint h, double * ssim, double * contrast)
+    {
+        SsimContext context;
+        context.x = x;
+        context.y = y;
+        context.w = w;
+        context.h = h;
+
+        float total = 0.0f;
+        for (int k = 0; k < kSsimTaps; k++) {
+            const float d = float(k - kSsimRadius);
+            context.weights[k] = expf(-d * d / (2 * kSsimSigma * kSsimSigma));
+            total += context.weights[k];
+        }
+        for (int k = 0; k < kSsimTaps; k++) {
+            context.weights[k] /= total;
+        }
+
+        Array<float> moments;
+        moments.resize(Moment_Count * w * h);
+        for (int m = 0; m < Moment_Count; m++) {
+            context.moments[m] = moments.buffer() + m * w * h;
+        }
+
+        Array<double> rows;
+        rows.resize(2 * h);
+        context.rowSsim = rows.buffer();
+        context.rowContrast = rows.buffer() + h;
+
+        if (w * h < kParallelSsimThreshold) {
+            SsimHorizontalTask(&context, 0, h);
+            SsimVerticalTask(&context, 0, h);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(SsimHorizontalTask, &context, h, kSsimRowsPerTask);
+            TaskScheduler::global()->parallelFor(SsimVerticalTask, &context, h, kSsimRowsPerTask);
+        }
+
+        // The rows are added in order, so that the result doesn't depend on the number of threads.
+        double ssimSum = 0.0;
+        double contrastSum = 0.0;
+        for (uint r = 0; r < h; r++) {
+            ssimSum += context.rowSsim[r];
+            contrastSum += context.rowContrast[r];
+        }
+
+        *ssim = ssimSum / (w * h);
+        *contrast = contrastSum / (w * h);
+    }
+
+    // Halve a w x h plane with a 2x2 box filter, the last row and column of odd sizes are dropped.
+    void downsamplePlane(const float * in, uint w, uint h, Array<float> & out)
+    {
+        const uint w2 = w / 2;
+        const uint h2 = h / 2;
+        out.resize(w2 * h2);
+
+        for (uint y = 0; y < h2; y++) {
+            const float * r0 = in + (2 * y + 0) * w;
+            const float * r1 = in + (2 * y + 1) * w;
+            for (uint x = 0; x < w2; x++) {
+                out[y * w2 + x] = 0.25f * (r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1]);
+            }
+        }
+    }
+
+    // Multi-scale SSIM of two planes. The scales go down while the coarsest one is at least as large as the window,
+    // their weights are renormalized when there are less than five. Negative terms are clamped to zero.
+    float planeMsSsim(const float * x, const float * y, uint w, uint h)
+    {
+        int scaleCount = 1;
+        while (scaleCount < kMaxSsimScales && min(w >> scaleCount, h >> scaleCount) >= uint(kSsimTaps)) {
+            scaleCount++;
+        }
+
+        float weightSum = 0.0f;
+        for (int s = 0; s < scaleCount; s++) weightSum += kMsSsimWeights[s];
+
+        Array<float> x0, y0, x1, y1;
+        const float * px = x;
+        const float * py = y;
+
+        double result = 1.0;
+
+        for (int s = 0; s < scaleCount; s++)
+        {
+            double ssim, contrast;
+            planeSsim(px, py, w, h, &ssim, &contrast);
+
+            const double term = (s == scaleCount - 1) ? ssim : contrast;
+            result *= pow(max(term, 0.0), double(kMsSsimWeights[s] / weightSum));
+
+            if (s + 1 < scaleCount)
+            {
+                downsamplePlane(px, w, h, x1);
+                downsamplePlane(py, w, h, y1);
+                swap(x0, x1);
+                swap(y0, y1);
+                px = x0.buffer();
+                py = y0.buffer();
+                w /= 2;
+                h /= 2;
+            }
+        }
+
+        return float(result);
+    }
+
+} // namespace
 
-        float angle = acosf(clamp(dot(n0, n1), -1.0f, 1.0f));
-        error += angle * angle;
+
+float nv::structuralSimilarity(const FloatImage * img0, const FloatImage * img1)
+{
+    if (!sameLayout(img0, img1)) return 0.0f;
+    nvDebugCheck(img0->componentCount() >= 3 && img1->componentCount() >= 3);
+
+    const uint w = img0->width();
+    const uint h = img0->height();
+    const uint d = img0->depth();
+
+    double ssim = 0.0;
+    for (uint z = 0; z < d; z++) {
+        for (uint c = 0; c < 3; c++) {
+            double s, cs;
+            planeSsim(img0->plane(c, z), img1->plane(c, z), w, h, &s, &cs);
+            ssim += s;
+        }
     }
 
-    return float(sqrt(error / count));
+    return float(ssim / (3 * d));
 }
 
+float nv::multiScaleStructuralSimilarity(const FloatImage * img0, const FloatImage * img1)
+{
+    if (!sameLayout(img0, img1)) return 0.0f;
+    nvDebugCheck(img0->componentCount() >= 3 && img1->componentCount() >= 3);
+
+    const uint w = img0->width();
+    const uint h = img0->height();
+    const uint d = img0->depth();
+
+    double ssim = 0.0;
+    for (uint z = 0; z < d; z++) {
+        for (uint c = 0; c < 3; c++) {
+            ssim += planeMsSsim(img0->plane(c, z), img1->plane(c, z), w, h);
+        }
+    }
+
+    return float(ssim / (3 * d));
+}
@@ -9,6 +9,10 @@ namespace nv
     float rmsColorError(const FloatImage * img, const FloatImage * ref, bool alphaWeight);
     float rmsAlphaError(const FloatImage * img, const FloatImage * ref);
 
+    // RMS color error of the images scaled by the inverse of each exposure, Reinhard tone mapped and converted to sRGB,
+    // for all the exposures in a single pass over the texels. The alpha of ref weights the errors when alphaWeight is set.
+    void rmsToneMappedErrors(const FloatImage * img, const FloatImage * ref, bool alphaWeight, const float * exposures, uint exposureCount, float * errors);
+
     float cieLabError(const FloatImage * img, const FloatImage * ref);
     float cieLab94Error(const FloatImage * img, const FloatImage * ref);
     float spatialCieLabError(const FloatImage * img, const FloatImage * ref);
@@ -19,4 +23,40 @@ namespace nv
     float averageAngularError(const FloatImage * img0, const FloatImage * img1);
     float rmsAngularError(const FloatImage * img0, const FloatImage * img1);
 
+    // SSIM and MS-SSIM of the color channels, averaged over them, with an 11x11 Gaussian window of sigma 1.5. They are 1
+    // for equal images and 0 when the images don't have the same layout.
+    float structuralSimilarity(const FloatImage * img0, const FloatImage * img1);
+    float multiScaleStructuralSimilarity(const FloatImage * img0, const FloatImage * img1);
+
+    enum ErrorMetricFlags
+    {
+        ErrorMetric_RmsColor        = 0x01,
+        ErrorMetric_RmsAlpha        = 0x02,
+        ErrorMetric_AverageColor    = 0x04,
+        ErrorMetric_AverageAlpha    = 0x08,
+        ErrorMetric_CieLab          = 0x10,
+        ErrorMetric_CieLab94        = 0x20,
+        ErrorMetric_AverageAngular  = 0x40,
+        ErrorMetric_RmsAngular      = 0x80,
+        ErrorMetric_All             = 0xFF,
+    };
+
+    // Results of the functions above, metrics that were not requested are 0.
+    struct ErrorMetrics
+    {
+        float rmsColor;
+        float rmsAlpha;
+        float averageColor;
+        float averageAlpha;
+        float cieLab;
+        float cieLab94;
+        float averageAngular;
+        float rmsAngular;
+    };
+
+    // Compute the requested ErrorMetricFlags in a single pass over the images. Like the functions above, large images
+    // are processed in parallel, and the results don't depend on the number of threads. All metrics are FLT_MAX when
+    // the images don't have the same layout.
+    void computeErrorMetrics(const FloatImage * img, const FloatImage * ref, bool alphaWeight, uint flags, ErrorMetrics * metrics);
+
 } // nv namespace
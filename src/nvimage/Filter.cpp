@@ -34,11 +34,15 @@
  */
 
 #include "Filter.h"
+#include "MemoryPool.h"
 
 #include "nvmath/Vector.h" // Vector4
+#include "nvthread/Mutex.h"
+#include "nvcore/Hash.h"
 #include "nvcore/Utils.h" // swap
 
-#include <string.h> // memset
+#include <string.h> // memset, memcpy, memcmp
+#include <stddef.h> // offsetof
 
 using namespace nv;
 
@@ -148,6 +152,20 @@ float Filter::sampleTriangle(float x, float scale, int samples) const
     return float(2 * sum * isamples);
 }
 
+bool Filter::key(FilterKey * /*key*/) const
+{
+    return false;
+}
+
+void FilterKey::init(Type type, float width)
+{
+    this->type = type;
+    this->width = width;
+    for (int i = 0; i < ParameterCount; i++) {
+        parameters[i] = 0.0f;
+    }
+}
+
 
 
 
@@ -161,6 +179,12 @@ float BoxFilter::evaluate(float x) const
     else return 0.0f;
 }
 
+bool BoxFilter::key(FilterKey * key) const
+{
+    key->init(FilterKey::Type_Box, m_width);
+    return true;
+}
+
 
 TriangleFilter::TriangleFilter() : Filter(1.0f) {}
 TriangleFilter::TriangleFilter(float width) : Filter(width) {}
@@ -172,6 +196,12 @@ float TriangleFilter::evaluate(float x) const
     return 0.0f;
 }
 
+bool TriangleFilter::key(FilterKey * key) const
+{
+    key->init(FilterKey::Type_Triangle, m_width);
+    return true;
+}
+
 
 QuadraticFilter::QuadraticFilter() : Filter(1.5f) {}
 
@@ -186,6 +216,12 @@ float QuadraticFilter::evaluate(float x) const
     return 0.0f;
 }
 
+bool QuadraticFilter::key(FilterKey * key) const
+{
+    key->init(FilterKey::Type_Quadratic, m_width);
+    return true;
+}
+
 
 CubicFilter::CubicFilter() : Filter(1.0f) {}
 
@@ -197,6 +233,12 @@ float CubicFilter::evaluate(float x) const
     return 0.0f;
 }
 
+bool CubicFilter::key(FilterKey * key) const
+{
+    key->init(FilterKey::Type_Cubic, m_width);
+    return true;
+}
+
 
 BSplineFilter::BSplineFilter() : Filter(2.0f) {}
 
@@ -211,6 +253,12 @@ float BSplineFilter::evaluate(float x) const
     return 0.0f;
 }
 
+bool BSplineFilter::key(FilterKey * key) const
+{
+    key->init(FilterKey::Type_BSpline, m_width);
+    return true;
+}
+
 
 MitchellFilter::MitchellFilter() : Filter(2.0f) { setParameters(1.0f/3.0f, 1.0f/3.0f); }
 
@@ -222,6 +270,19 @@ float MitchellFilter::evaluate(float x) const
     return 0.0f;
 }
 
+bool MitchellFilter::key(FilterKey * key) const
+{
+    key->init(FilterKey::Type_Mitchell, m_width);
+    key->parameters[0] = p0;
+    key->parameters[1] = p2;
+    key->parameters[2] = p3;
+    key->parameters[3] = q0;
+    key->parameters[4] = q1;
+    key->parameters[5] = q2;
+    key->parameters[6] = q3;
+    return true;
+}
+
 void MitchellFilter::setParameters(float b, float c)
 {
     p0 = (6.0f -  2.0f * b) / 6.0f;
@@ -243,6 +304,12 @@ float LanczosFilter::evaluate(float x) const
     return 0.0f;
 }
 
+bool LanczosFilter::key(FilterKey * key) const
+{
+    key->init(FilterKey::Type_Lanczos, m_width);
+    return true;
+}
+
 
 SincFilter::SincFilter(float w) : Filter(w) {}
 
@@ -251,6 +318,12 @@ float SincFilter::evaluate(float x) const
     return sincf(PI * x);
 }
 
+bool SincFilter::key(FilterKey * key) const
+{
+    key->init(FilterKey::Type_Sinc, m_width);
+    return true;
+}
+
 
 KaiserFilter::KaiserFilter(float w) : Filter(w) { setParameters(4.0f, 1.0f); }
 
@@ -262,6 +335,14 @@ float KaiserFilter::evaluate(float x) const
     else return 0;
 }
 
+bool KaiserFilter::key(FilterKey * key) const
+{
+    key->init(FilterKey::Type_Kaiser, m_width);
+    key->parameters[0] = alpha;
+    key->parameters[1] = stretch;
+    return true;
+}
+
 void KaiserFilter::setParameters(float alpha, float stretch)
 {
     this->alpha = alpha;
@@ -276,6 +357,13 @@ float GaussianFilter::evaluate(float x) const
     return (1.0f / sqrtf(2 * PI * variance)) * expf(-x*x / (2 * variance));
 }
 
+bool GaussianFilter::key(FilterKey * key) const
+{
+    key->init(FilterKey::Type_Gaussian, m_width);
+    key->parameters[0] = variance;
+    return true;
+}
+
 void GaussianFilter::setParameters(float variance)
 {
     this->variance = variance;
@@ -376,6 +464,37 @@ void Kernel2::transpose()
     }
 }
 
+bool Kernel2::isSeparable(float * column, float * row) const
+{
+    const uint n = m_windowSize;
+
+    // Use the largest element as pivot, its row and column span the kernel if it has rank 1.
+    uint pivot = 0;
+    for (uint i = 1; i < n * n; i++) {
+        if (fabsf(m_data[i]) > fabsf(m_data[pivot])) pivot = i;
+    }
+
+    const float largest = fabsf(m_data[pivot]);
+    if (largest == 0.0f) return false;
+
+    const uint py = pivot / n;
+    const uint px = pivot % n;
+
+    for (uint i = 0; i < n; i++) {
+        column[i] = m_data[i * n + px];
+        row[i] = m_data[py * n + i] / m_data[pivot];
+    }
+
+    const float tolerance = largest * 1e-5f;
+    for (uint y = 0; y < n; y++) {
+        for (uint x = 0; x < n; x++) {
+            if (fabsf(m_data[y * n + x] - column[y] * row[x]) > tolerance) return false;
+        }
+    }
+
+    return true;
+}
+
 // Init laplacian filter, usually used for sharpening.
 void Kernel2::initLaplacian()
 {
@@ -558,10 +677,149 @@ void Kernel2::initBlendedSobel(const Vector4 & scale)
 }
 
 
+namespace
+{
+    // Everything a polyphase kernel depends on.
+    struct PolyphaseKernelKey
+    {
+        bool init(const Filter & f, uint srcLength, uint dstLength, int samples)
+        {
+            memset(this, 0, sizeof(*this));
+            if (!f.key(&filter)) return false;
+            this->srcLength = srcLength;
+            this->dstLength = dstLength;
+            this->samples = samples;
+            hash = sdbmHash(this, offsetof(PolyphaseKernelKey, hash));
+            return true;
+        }
+
+        bool operator==(const PolyphaseKernelKey & other) const
+        {
+            return hash == other.hash && memcmp(this, &other, offsetof(PolyphaseKernelKey, hash)) == 0;
+        }
+
+        FilterKey filter;
+        uint srcLength;
+        uint dstLength;
+        int samples;
+        uint hash;
+    };
+
+    // Weights of recently built polyphase kernels. Evaluating the filter dominates the cost of a kernel, and the same
+    // kernels are built over and over for the mipmaps of many textures of the same size. Shared by all threads.
+    class PolyphaseKernelCache
+    {
+    public:
+        PolyphaseKernelCache() : m_floatCount(0), m_time(0)
+        {
+            for (uint i = 0; i < EntryCount; i++) {
+                m_entries[i].data = NULL;
+                m_entries[i].count = 0;
+            }
+        }
+
+        ~PolyphaseKernelCache()
+        {
+            for (uint i = 0; i < EntryCount; i++) {
+                delete [] m_entries[i].data;
+            }
+        }
+
+        // Copy the weights to data and return true if an identical kernel was built before.
+        bool lookup(const PolyphaseKernelKey & key, float * data, uint count)
+        {
+            Lock<Mutex> lock(m_mutex);
+
+            for (uint i = 0; i < EntryCount; i++) {
+                Entry & entry = m_entries[i];
+                if (entry.data != NULL && entry.key == key) {
+                    nvDebugCheck(entry.count == count);
+                    memcpy(data, entry.data, count * sizeof(float));
+                    entry.lastUse = ++m_time;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void insert(const PolyphaseKernelKey & key, const float * data, uint count)
+        {
+            if (count > MaxFloatCount / 4) {
+                return;
+            }
+
+            float * copy = new float[count];
+            memcpy(copy, data, count * sizeof(float));
+
+            Lock<Mutex> lock(m_mutex);
+
+            // Take a free entry, evicting the least recently used kernels until the new one fits.
+            for (;;) {
+                uint freeEntry = EntryCount;
+                uint victim = EntryCount;
+                for (uint i = 0; i < EntryCount; i++) {
+                    if (m_entries[i].data == NULL) {
+                        if (freeEntry == EntryCount) freeEntry = i;
+                    }
+                    else if (victim == EntryCount || m_entries[i].lastUse < m_entries[victim].lastUse) {
+                        victim = i;
+                    }
+                }
+
+                if (freeEntry != EntryCount && m_floatCount + count <= MaxFloatCount) {
+                    Entry & entry = m_entries[freeEntry];
+                    entry.key = key;
+                    entry.data = copy;
+                    entry.count = count;
+                    entry.lastUse = ++m_time;
+                    m_floatCount += count;
+                    return;
+                }
+
+                nvDebugCheck(victim != EntryCount);
+                m_floatCount -= m_entries[victim].count;
+                delete [] m_entries[victim].data;
+                m_entries[victim].data = NULL;
+            }
+        }
+
+    private:
+        enum {
+            EntryCount = 64,
+            MaxFloatCount = 2 * 1024 * 1024
+        };
+
+        struct Entry
+        {
+            PolyphaseKernelKey key;
+            float * data;
+            uint count;
+            uint lastUse;
+        };
+
+        Mutex m_mutex;
+        Entry m_entries[EntryCount];
+        uint m_floatCount;
+        uint m_time;
+    };
+
+    PolyphaseKernelCache & polyphaseKernelCache()
+    {
+        static PolyphaseKernelCache cache;
+        return cache;
+    }
+
+} // namespace
+
+
 PolyphaseKernel::PolyphaseKernel(const Filter & f, uint srcLength, uint dstLength, int samples/*= 32*/)
 {
     nvDebugCheck(samples > 0);
 
+    PolyphaseKernelKey key;
+    const bool cacheable = key.init(f, srcLength, dstLength, samples);
+
     float scale = float(dstLength) / float(srcLength);
     const float iscale = 1.0f / scale;
 
@@ -575,7 +833,12 @@ PolyphaseKernel::PolyphaseKernel(const Filter & f, uint srcLength, uint dstLengt
     m_width = f.width() * iscale;
     m_windowSize = (int)ceilf(m_width * 2) + 1;
 
-    m_data = new float[m_windowSize * m_length];
+    m_data = poolAllocate<float>(m_windowSize * m_length);
+
+    if (cacheable && polyphaseKernelCache().lookup(key, m_data, m_windowSize * m_length)) {
+        return;
+    }
+
     memset(m_data, 0, sizeof(float) * m_windowSize * m_length);
 
     for (uint i = 0; i < m_length; i++)
@@ -603,11 +866,15 @@ PolyphaseKernel::PolyphaseKernel(const Filter & f, uint srcLength, uint dstLengt
             m_data[i * m_windowSize + j] /= total;
         }
     }
+
+    if (cacheable) {
+        polyphaseKernelCache().insert(key, m_data, m_windowSize * m_length);
+    }
 }
 
 PolyphaseKernel::~PolyphaseKernel()
 {
-    delete [] m_data;
+    poolFree(m_data);
 }
 
 
@@ -11,6 +11,30 @@ namespace nv
 {
     class Vector4;
 
+    /// Identifies a filter function and its parameters. Filters with equal keys produce the same kernels.
+    struct FilterKey
+    {
+        enum Type {
+            Type_Box,
+            Type_Triangle,
+            Type_Quadratic,
+            Type_Cubic,
+            Type_BSpline,
+            Type_Mitchell,
+            Type_Lanczos,
+            Type_Sinc,
+            Type_Kaiser,
+            Type_Gaussian
+        };
+        enum { ParameterCount = 7 };
+
+        void init(Type type, float width);
+
+        uint32 type;
+        float width;
+        float parameters[ParameterCount];
+    };
+
     /// Base filter class.
     class NVIMAGE_CLASS Filter
     {
@@ -25,6 +49,10 @@ namespace nv
 
         virtual float evaluate(float x) const = 0;
 
+        // Describe the filter so that kernels can be shared between equal filters. Returns false if the filter can't be
+        // described, which is the default. Subclasses that change evaluate() must override this too.
+        virtual bool key(FilterKey * key) const;
+
     protected:
         const float m_width;
     };
@@ -36,6 +64,7 @@ namespace nv
         BoxFilter();
         BoxFilter(float width);
         virtual float evaluate(float x) const;
+        virtual bool key(FilterKey * key) const;
     };
 
     // Triangle (bilinear/tent) filter.
@@ -45,6 +74,7 @@ namespace nv
         TriangleFilter();
         TriangleFilter(float width);
         virtual float evaluate(float x) const;
+        virtual bool key(FilterKey * key) const;
     };
 
     // Quadratic (bell) filter.
@@ -53,6 +83,7 @@ namespace nv
     public:
         QuadraticFilter();
         virtual float evaluate(float x) const;
+        virtual bool key(FilterKey * key) const;
     };
 
     // Cubic filter from Thatcher Ulrich.
@@ -61,6 +92,7 @@ namespace nv
     public:
         CubicFilter();
         virtual float evaluate(float x) const;
+        virtual bool key(FilterKey * key) const;
     };
 
     // Cubic b-spline filter from Paul Heckbert.
@@ -69,6 +101,7 @@ namespace nv
     public:
         BSplineFilter();
         virtual float evaluate(float x) const;
+        virtual bool key(FilterKey * key) const;
     };
 
     /// Mitchell & Netravali's two-param cubic
@@ -78,6 +111,7 @@ namespace nv
     public:
         MitchellFilter();
         virtual float evaluate(float x) const;
+        virtual bool key(FilterKey * key) const;
 
         void setParameters(float b, float c);
 
@@ -92,6 +126,7 @@ namespace nv
     public:
         LanczosFilter();
         virtual float evaluate(float x) const;
+        virtual bool key(FilterKey * key) const;
     };
 
     // Sinc filter.
@@ -100,6 +135,7 @@ namespace nv
     public:
         SincFilter(float w);
         virtual float evaluate(float x) const;
+        virtual bool key(FilterKey * key) const;
     };
 
     // Kaiser filter.
@@ -108,6 +144,7 @@ namespace nv
     public:
         KaiserFilter(float w);
         virtual float evaluate(float x) const;
+        virtual bool key(FilterKey * key) const;
 
         void setParameters(float a, float stretch);
 
@@ -122,6 +159,7 @@ namespace nv
     public:
         GaussianFilter(float w);
         virtual float evaluate(float x) const;
+        virtual bool key(FilterKey * key) const;
 
         void setParameters(float variance);
 
@@ -173,6 +211,9 @@ namespace nv
         void normalize();
         void transpose();
 
+        // If the kernel is the outer product of a column and a row kernel, up to rounding, store them and return true.
+        bool isSeparable(float * column, float * row) const;
+
         float valueAt(uint x, uint y) const {
             return m_data[y * m_windowSize + x];
         }
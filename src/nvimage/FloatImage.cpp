@@ -3,6 +3,7 @@
 #include "FloatImage.h"
 #include "Filter.h"
 #include "Image.h"
+#include "MemoryPool.h"
 
 #include "nvmath/Color.h"
 #include "nvmath/Vector.inl"
@@ -13,23 +14,46 @@
 #include "nvcore/Ptr.h"
 #include "nvcore/Memory.h"
 #include "nvcore/Array.inl"
+#include "nvcore/FileSystem.h"
+#include "nvcore/StrLib.h" // Path
+#include "nvcore/CpuInfo.h"
 
+#include "nvthread/TaskScheduler.h"
+
+#include <float.h> // FLT_MAX
 #include <math.h>
 #include <string.h> // memset, memcpy
 
+#if NV_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#if NV_USE_SSE > 1
+#include "nvmath/SimdVector.h" // approxPow
+#endif
+
 
 using namespace nv;
 
+#if defined(HAVE_AVX2)
+namespace nv {
+    // Defined in ResampleAVX2.cpp.
+    uint addScaledLineAVX2(float * dst, const float * src, float w, uint count);
+    uint addProductLineAVX2(float * dst, const float * w, const float * src, uint count);
+    int convolveRowAVX2(const float * const * row, const int * tapX, const int * tapY, const float * tapWeight, int tapCount, int r, int x, int end, float * dst);
+}
+#endif
+
 
 /// Ctor.
 FloatImage::FloatImage() : m_componentCount(0), m_width(0), m_height(0), m_depth(0),
-  m_pixelCount(0), m_floatCount(0), m_mem(NULL)
+  m_pixelCount(0), m_floatCount(0), m_mem(NULL), m_mapped(false), m_external(false)
 {
 }
 
 /// Ctor. Init from image.
 FloatImage::FloatImage(const Image * img) : m_componentCount(0), m_width(0), m_height(0), m_depth(0),
-    m_pixelCount(0), m_floatCount(0), m_mem(NULL)
+    m_pixelCount(0), m_floatCount(0), m_mem(NULL), m_mapped(false), m_external(false)
 {
     initFrom(img);
 }
@@ -116,10 +140,46 @@ Image * FloatImage::createImageGammaCorrect(float gamma/*= 2.2f*/) const
     return img.release();
 }
 
+namespace
+{
+    Path s_scratchDirectory;
+    uint64 s_scratchThreshold = 0;
+
+    // Large images go to a scratch file, so that the OS can page them in and out instead of keeping them all in RAM.
+    float * allocateFloats(uint64 count, bool * mapped)
+    {
+        const uint64 size = count * sizeof(float);
+
+        if (s_scratchThreshold != 0 && size >= s_scratchThreshold)
+        {
+            const char * directory = s_scratchDirectory.isNull() ? NULL : s_scratchDirectory.str();
+
+            float * mem = (float *)FileSystem::mapScratchFile(directory, size_t(size));
+            if (mem != NULL) {
+                *mapped = true;
+                return mem;
+            }
+
+            // Fall back to the heap.
+        }
+
+        *mapped = false;
+        return poolAllocate<float>(size_t(count));
+    }
+}
+
+/// Set where and from what size images are stored out of core.
+void FloatImage::setScratchFile(const char * directory, uint64 threshold)
+{
+    if (directory != NULL) s_scratchDirectory = directory;
+    else s_scratchDirectory.reset();
+    s_scratchThreshold = threshold;
+}
+
 /// Allocate a 2D float image of the given format and the given extents.
 void FloatImage::allocate(uint c, uint w, uint h, uint d)
 {
-    if (m_componentCount != c || m_width != w || m_height != h || m_depth != d)
+    if (m_componentCount != c || m_width != w || m_height != h || m_depth != d || m_external)
     {
         free();
 
@@ -128,26 +188,47 @@ void FloatImage::allocate(uint c, uint w, uint h, uint d)
         m_depth = d;
         m_componentCount = c;
         m_pixelCount = w * h * d;
-        m_floatCount = m_pixelCount * c;
-        m_mem = malloc<float>(m_floatCount);
+        m_floatCount = uint64(m_pixelCount) * c;
+        m_mem = allocateFloats(m_floatCount, &m_mapped);
     }
 }
 
 /// Free the image, but don't clear the members.
 void FloatImage::free()
 {
-    ::free(m_mem);
+    if (m_external) {
+        m_external = false;
+    }
+    else if (m_mapped) {
+        if (m_mem != NULL) FileSystem::unmapScratchFile(m_mem, size_t(m_floatCount * sizeof(float)));
+        m_mapped = false;
+    }
+    else {
+        poolFree(m_mem);
+    }
     m_mem = NULL;
 }
 
 void FloatImage::resizeChannelCount(uint c)
 {
     if (m_componentCount != c) {
-        uint count = m_pixelCount * c;
-        m_mem = realloc<float>(m_mem, count);
+        uint64 count = uint64(m_pixelCount) * c;
+
+        if (m_mapped || m_external || (s_scratchThreshold != 0 && count * sizeof(float) >= s_scratchThreshold)) {
+            // Scratch files and external memory can't be reallocated, move the channels to a new allocation.
+            bool mapped;
+            float * mem = allocateFloats(count, &mapped);
+            memcpy(mem, m_mem, size_t(min(count, m_floatCount) * sizeof(float)));
+            free();
+            m_mem = mem;
+            m_mapped = mapped;
+        }
+        else {
+            m_mem = (float *)poolReallocate(m_mem, size_t(count * sizeof(float)));
+        }
 
         if (c > m_componentCount) {
-            memset(m_mem + m_floatCount, 0, (count - m_floatCount) * sizeof(float));
+            memset(m_mem + m_floatCount, 0, size_t((count - m_floatCount) * sizeof(float)));
         }
 
         m_componentCount = c;
@@ -155,11 +236,18 @@ void FloatImage::resizeChannelCount(uint c)
     }
 }
 
-void FloatImage::clear(float f/*=0.0f*/)
+void FloatImage::wrap(float * mem, uint c, uint w, uint h, uint d/*= 1*/)
 {
-    for (uint i = 0; i < m_floatCount; i++) {
-        m_mem[i] = f;
-    }
+    free();
+
+    m_width = w;
+    m_height = h;
+    m_depth = d;
+    m_componentCount = c;
+    m_pixelCount = w * h * d;
+    m_floatCount = uint64(m_pixelCount) * c;
+    m_mem = mem;
+    m_external = true;
 }
 
 void FloatImage::clear(uint c, float f/*= 0.0f*/)
@@ -183,24 +271,103 @@ void FloatImage::copyChannel(uint src, uint dst)
     memcpy(dstChannel, srcChannel, sizeof(float)*m_pixelCount);
 }
 
+namespace
+{
+    // Toksvig factor of a filtered normal of the given length, the specular power of the texel is scaled by it so that the
+    // highlight widens as much as the normals below it spread.
+    inline float toksvigFactor(float length, float power)
+    {
+        length = min(length, 1.0f);
+        const float d = length + power * (1.0f - length);
+        return (d > 0.0f) ? length / d : 0.0f;
+    }
+
+    // Write the Toksvig factor of the normals in [begin, end) to channels 0 to 2 of toksvig, and 1 to its alpha.
+    void toksvigRange(const FloatImage * img, uint baseComponent, float power, FloatImage * toksvig, uint begin, uint end)
+    {
+        const float * x = img->channel(baseComponent + 0);
+        const float * y = img->channel(baseComponent + 1);
+        const float * z = img->channel(baseComponent + 2);
+
+        float * r = toksvig->channel(0);
+        float * g = toksvig->channel(1);
+        float * b = toksvig->channel(2);
+        float * a = toksvig->channel(3);
+
+        uint i = begin;
+#if NV_USE_SSE
+        // The same operations as toksvigFactor, NaN lengths also go to 1.
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), p = _mm_set1_ps(power);
+        for (; i + 4 <= end; i += 4) {
+            const __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+            const __m128 l = _mm_min_ps(_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz))), one);
+            const __m128 d = _mm_add_ps(l, _mm_mul_ps(p, _mm_sub_ps(one, l)));
+            const __m128 t = _mm_and_ps(_mm_cmpgt_ps(d, zero), _mm_div_ps(l, d));
+            _mm_storeu_ps(r + i, t);
+            _mm_storeu_ps(g + i, t);
+            _mm_storeu_ps(b + i, t);
+            _mm_storeu_ps(a + i, one);
+        }
+#endif
+        for (; i < end; i++) {
+            const float t = toksvigFactor(length(Vector3(x[i], y[i], z[i])), power);
+            r[i] = t;
+            g[i] = t;
+            b[i] = t;
+            a[i] = 1.0f;
+        }
+    }
+
+    void normalizeRange(FloatImage * img, uint baseComponent, uint begin, uint end)
+    {
+        float * x = img->channel(baseComponent + 0);
+        float * y = img->channel(baseComponent + 1);
+        float * z = img->channel(baseComponent + 2);
+
+        uint i = begin;
+#if NV_USE_SSE
+        // The same operations as normalizeSafe, zero vectors go to zero and NaNs stay NaNs.
+        const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+        for (; i + 4 <= end; i += 4) {
+            const __m128 vx = _mm_loadu_ps(x + i), vy = _mm_loadu_ps(y + i), vz = _mm_loadu_ps(z + i);
+            const __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz)));
+            const __m128 mask = _mm_cmpneq_ps(l, zero);
+            const __m128 s = _mm_div_ps(one, l);
+            _mm_storeu_ps(x + i, _mm_and_ps(mask, _mm_mul_ps(vx, s)));
+            _mm_storeu_ps(y + i, _mm_and_ps(mask, _mm_mul_ps(vy, s)));
+            _mm_storeu_ps(z + i, _mm_and_ps(mask, _mm_mul_ps(vz, s)));
+        }
+#endif
+        for (; i < end; i++) {
+            Vector3 normal = normalizeSafe(Vector3(x[i], y[i], z[i]), Vector3(0), 0.0f);
+            x[i] = normal.x;
+            y[i] = normal.y;
+            z[i] = normal.z;
+        }
+    }
+}
+
 void FloatImage::normalize(uint baseComponent)
 {
     nvCheck(baseComponent + 3 <= m_componentCount);
 
-    float * xChannel = this->channel(baseComponent + 0);
-    float * yChannel = this->channel(baseComponent + 1);
-    float * zChannel = this->channel(baseComponent + 2);
+    normalizeRange(this, baseComponent, 0, m_pixelCount);
+}
 
-    const uint count = m_pixelCount;
-    for (uint i = 0; i < count; i++) {
+/// Toksvig map of the normals in channels [base_component, base_component + 3), which are expected in the [-1, 1] range
+/// and not renormalized: channels 0 to 2 of the result have the factor that scales the specular power of each texel,
+/// |n| / (|n| + power * (1 - |n|)), and its alpha is 1.
+/// http://blog.selfshadow.com/2011/07/22/specular-showdown/
+FloatImage * FloatImage::createToksvigMap(uint baseComponent, float power) const
+{
+    nvCheck(baseComponent + 3 <= m_componentCount);
 
-        Vector3 normal(xChannel[i], yChannel[i], zChannel[i]);
-        normal = normalizeSafe(normal, Vector3(0), 0.0f);
+    FloatImage * toksvig = new FloatImage();
+    toksvig->allocate(4, m_width, m_height, m_depth);
 
-        xChannel[i] = normal.x;
-        yChannel[i] = normal.y;
-        zChannel[i] = normal.z;
-    }
+    toksvigRange(this, baseComponent, power, toksvig, 0, m_pixelCount);
+
+    return toksvig;
 }
 
 void FloatImage::packNormals(uint baseComponent)
@@ -252,16 +419,111 @@ void FloatImage::toGamma(uint baseComponent, uint num, float gamma /*= 2.2f*/)
     exponentiate(baseComponent, num, 1.0f/gamma);
 }
 
-/// Exponentiate the elements of the image.
-void FloatImage::exponentiate(uint baseComponent, uint num, float power)
+namespace
+{
+    // Below this many texels per channel the per-texel operations run on the calling thread.
+    const uint kParallelTexelThreshold = 64 * 1024;
+
+    // Number of texels processed by each task, a multiple of 4.
+    const uint kTexelTaskSize = 16 * 1024;
+
+    // Exponentiate the elements [begin, end) of a channel, with the same results as exponentiating the whole channel at
+    // once: approxPow works on each element independently, and the elements that don't fill a group of 4 are padded, so
+    // every element gets the same rounding wherever the range starts and ends. Without approximate it's powf.
+    void exponentiateRange(float * ptr, uint begin, uint end, float power, bool approximate)
+    {
+        uint i = begin;
+#if NV_USE_SSE > 1
+        if (approximate) {
+            const SimdVector vpower(power);
+            if ((size_t(ptr + i) & 15) == 0) {
+                // Aligned channels, see FloatImage::hasAlignedChannels.
+                for (; i + 4 <= end; i += 4) {
+                    SimdVector x(_mm_load_ps(ptr + i));
+                    _mm_store_ps(ptr + i, approxPow(x, vpower).vec);
+                }
+            }
+            for (; i + 4 <= end; i += 4) {
+                SimdVector x(_mm_loadu_ps(ptr + i));
+                _mm_storeu_ps(ptr + i, approxPow(x, vpower).vec);
+            }
+            if (i < end) {
+                NV_ALIGN_16 float tmp[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                for (uint k = i; k < end; k++) tmp[k - i] = ptr[k];
+                _mm_store_ps(tmp, approxPow(SimdVector(_mm_load_ps(tmp)), vpower).vec);
+                for (uint k = i; k < end; k++) ptr[k] = tmp[k - i];
+                i = end;
+            }
+        }
+#endif
+        for (; i < end; i++) {
+            ptr[i] = powf(max(0.0f, ptr[i]), power);
+        }
+    }
+
+    struct ExponentiateContext
+    {
+        float * ptr;
+        float power;
+        bool approximate;
+    };
+
+    void ExponentiateTask(void * context, int begin, int end)
+    {
+        const ExponentiateContext * ctx = (const ExponentiateContext *)context;
+        exponentiateRange(ctx->ptr, begin, end, ctx->power, ctx->approximate);
+    }
+
+    struct ClearContext
+    {
+        float * mem;
+        uint pixelCount;
+        uint componentCount;
+        float value;
+    };
+
+    // Clear the texels [begin, end) of every channel.
+    void ClearTask(void * context, int begin, int end)
+    {
+        const ClearContext * ctx = (const ClearContext *)context;
+        for (uint c = 0; c < ctx->componentCount; c++) {
+            float * ptr = ctx->mem + uint64(c) * ctx->pixelCount;
+            for (int i = begin; i < end; i++) {
+                ptr[i] = ctx->value;
+            }
+        }
+    }
+}
+
+/// Clear all the channels. Large images are cleared by the workers of the task scheduler, each one taking the same
+/// texel ranges of every channel, like the input conversion and the block compressors do. That's the first touch of
+/// a freshly allocated image, so on NUMA systems its pages end up spread over the nodes of the threads that use them.
+void FloatImage::clear(float f/*=0.0f*/)
+{
+    ClearContext context = { m_mem, m_pixelCount, m_componentCount, f };
+
+    if (m_pixelCount < kParallelTexelThreshold) {
+        ClearTask(&context, 0, m_pixelCount);
+    }
+    else {
+        TaskScheduler::global()->parallelFor(ClearTask, &context, m_pixelCount, kTexelTaskSize);
+    }
+}
+
+/// Exponentiate the elements of the image. When approximate is set and with SSE2 this uses a polynomial approximation of
+/// pow, see approxPow, whose results are not rounded like those of powf.
+void FloatImage::exponentiate(uint baseComponent, uint num, float power, bool approximate/*= false*/)
 {
     const uint size = m_pixelCount;
 
     for(uint c = 0; c < num; c++) {
-        float * ptr = this->channel(baseComponent + c);
+        ExponentiateContext context = { this->channel(baseComponent + c), power, approximate };
 
-        for(uint i = 0; i < size; i++) {
-            ptr[i] = powf(max(0.0f, ptr[i]), power);
+        if (size < kParallelTexelThreshold) {
+            ExponentiateTask(&context, 0, size);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(ExponentiateTask, &context, size, kTexelTaskSize);
         }
     }
 }
@@ -514,108 +776,178 @@ float FloatImage::sampleLinearMirror(uint c, float x, float y, float z) const
 }
 
 
-/// Fast downsampling using box filter. 
-///
-/// The extents of the image are divided by two and rounded down.
-///
-/// When the size of the image is odd, this uses a polyphase box filter as explained in:
-/// http://developer.nvidia.com/object/np2_mipmapping.html
-///
-FloatImage * FloatImage::fastDownSample() const
+namespace
 {
-    nvDebugCheck(m_depth == 1);
-    nvDebugCheck(m_width != 1 || m_height != 1);
+    // Number of rows of the source image needed to compute row y of its fastDownSample.
+    // Rows of a fastDownSample computed by each task, and the number of texels below which it runs on the calling thread.
+    const uint kDownSampleRowsPerTask = 8;
+    const uint kParallelDownSampleThreshold = 64 * 1024;
 
-    AutoPtr<FloatImage> dst_image( new FloatImage() );
+    inline uint fastDownSampleRowsNeeded(const FloatImage * src_image, uint y)
+    {
+        const uint h = src_image->height();
+        if (h == 1) return 1;
+        return (h & 1) ? 2 * y + 3 : 2 * y + 2;
+    }
 
-    const uint w = max(1, m_width / 2);
-    const uint h = max(1, m_height / 2);
-    dst_image->allocate(m_componentCount, w, h);
+    // First row of the source image read by row y of its fastDownSample.
+    inline uint fastDownSampleFirstRow(const FloatImage * src_image, uint y)
+    {
+        return (src_image->height() == 1) ? 0 : 2 * y;
+    }
+
+#if NV_USE_SSE > 1
+    // Texels 2x, 2x + 1 and 2x + 2 of a row, for four consecutive values of x.
+    struct PolyphaseTaps
+    {
+        PolyphaseTaps(const float * src)
+        {
+            const __m128 a0 = _mm_loadu_ps(src), a1 = _mm_loadu_ps(src + 4);
+            const __m128 b0 = _mm_loadu_ps(src + 2), b1 = _mm_loadu_ps(src + 6);
+            t0 = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0));
+            t1 = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1));
+            t2 = _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0));
+        }
+        __m128 t0, t1, t2;
+    };
 
-    // 1D box filter.
-    if (m_width == 1 || m_height == 1)
+    // Polyphase weights w - x and 1 + x for four consecutive values of x, exact like their scalar conversions.
+    inline void polyphaseWeights(uint w, uint x, __m128 * w0, __m128 * w2)
     {
-        const uint n = w * h;
+        const __m128i lane = _mm_set_epi32(3, 2, 1, 0);
+        *w0 = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_set1_epi32(int(w - x)), lane));
+        *w2 = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(int(1 + x)), lane));
+    }
+#endif
 
-        if ((m_width * m_height) & 1)
+    // Compute the texels [x0, x1) of row y of the fastDownSample of src_image. The SSE paths add in the same order as the
+    // scalar code, the results are identical.
+    void fastDownSampleSpan(const FloatImage * src_image, FloatImage * dst_image, uint y, uint x0, uint x1)
+    {
+        const uint m_width = src_image->width();
+        const uint m_height = src_image->height();
+        const uint w = dst_image->width();
+        const uint h = dst_image->height();
+        const uint componentCount = dst_image->componentCount();
+
+        // 1D box filter.
+        if (m_width == 1 || m_height == 1)
         {
-            const float scale = 1.0f / (2 * n + 1);
+            const uint n = w * h;
 
-            for(uint c = 0; c < m_componentCount; c++)
+            // A column has one texel per row.
+            const uint begin = (m_width == 1) ? y : x0;
+            const uint end = (m_width == 1) ? y + 1 : x1;
+
+            if ((m_width * m_height) & 1)
             {
-                const float * src = this->channel(c);
-                float * dst = dst_image->channel(c);
+                const float scale = 1.0f / (2 * n + 1);
 
-                for(uint x = 0; x < n; x++)
+                for(uint c = 0; c < componentCount; c++)
                 {
-                    const float w0 = float(n - x);
-                    const float w1 = float(n - 0);
-                    const float w2 = float(1 + x);
+                    const float * src = src_image->channel(c) + 2 * begin;
+                    float * dst = dst_image->channel(c) + begin;
 
-                    *dst++ = scale * (w0 * src[0] + w1 * src[1] + w2 * src[2]);
-                    src += 2;
+                    for(uint x = begin; x < end; x++)
+                    {
+                        const float w0 = float(n - x);
+                        const float w1 = float(n - 0);
+                        const float w2 = float(1 + x);
+
+                        *dst++ = scale * (w0 * src[0] + w1 * src[1] + w2 * src[2]);
+                        src += 2;
+                    }
                 }
             }
-        }
-        else
-        {
-            for(uint c = 0; c < m_componentCount; c++)
+            else
             {
-                const float * src = this->channel(c);
-                float * dst = dst_image->channel(c);
-
-                for(uint x = 0; x < n; x++)
+                for(uint c = 0; c < componentCount; c++)
                 {
-                    *dst = 0.5f * (src[0] + src[1]);
-                    dst++;
-                    src += 2;
+                    const float * src = src_image->channel(c) + 2 * begin;
+                    float * dst = dst_image->channel(c) + begin;
+
+                    for(uint x = begin; x < end; x++)
+                    {
+                        *dst = 0.5f * (src[0] + src[1]);
+                        dst++;
+                        src += 2;
+                    }
                 }
             }
         }
-    }
 
-    // Regular box filter.
-    else if ((m_width & 1) == 0 && (m_height & 1) == 0)
-    {
-        for(uint c = 0; c < m_componentCount; c++)
+        // Regular box filter.
+        else if ((m_width & 1) == 0 && (m_height & 1) == 0)
         {
-            const float * src = this->channel(c);
-            float * dst = dst_image->channel(c);
-
-            for(uint y = 0; y < h; y++)
+            for(uint c = 0; c < componentCount; c++)
             {
-                for(uint x = 0; x < w; x++)
+                const float * src = src_image->channel(c) + 2 * y * m_width + 2 * x0;
+                float * dst = dst_image->channel(c) + y * w + x0;
+
+                uint x = x0;
+#if NV_USE_SSE > 1
+                const __m128 quarter = _mm_set1_ps(0.25f);
+                for (; x + 4 <= x1; x += 4)
+                {
+                    const __m128 a0 = _mm_loadu_ps(src), a1 = _mm_loadu_ps(src + 4);
+                    const __m128 b0 = _mm_loadu_ps(src + m_width), b1 = _mm_loadu_ps(src + m_width + 4);
+                    __m128 sum = _mm_add_ps(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1)));
+                    sum = _mm_add_ps(sum, _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+                    sum = _mm_add_ps(sum, _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+                    _mm_storeu_ps(dst, _mm_mul_ps(quarter, sum));
+                    dst += 4;
+                    src += 8;
+                }
+#endif
+                for(; x < x1; x++)
                 {
                     *dst = 0.25f * (src[0] + src[1] + src[m_width] + src[m_width + 1]);
                     dst++;
                     src += 2;
                 }
-
-                src += m_width;
             }
         }
-    }
 
-    // Polyphase filters.
-    else if (m_width & 1 && m_height & 1)
-    {
-        nvDebugCheck(m_width == 2 * w + 1);
-        nvDebugCheck(m_height == 2 * h + 1);
+        // Polyphase filters.
+        else if (m_width & 1 && m_height & 1)
+        {
+            nvDebugCheck(m_width == 2 * w + 1);
+            nvDebugCheck(m_height == 2 * h + 1);
 
-        const float scale = 1.0f / (m_width * m_height);
+            const float scale = 1.0f / (m_width * m_height);
 
-        for(uint c = 0; c < m_componentCount; c++)
-        {
-            const float * src = this->channel(c);
-            float * dst = dst_image->channel(c);
+            const float v0 = float(h - y);
+            const float v1 = float(h - 0);
+            const float v2 = float(1 + y);
 
-            for(uint y = 0; y < h; y++)
+            for(uint c = 0; c < componentCount; c++)
             {
-                const float v0 = float(h - y);
-                const float v1 = float(h - 0);
-                const float v2 = float(1 + y);
+                const float * src = src_image->channel(c) + 2 * y * m_width;
+                float * dst = dst_image->channel(c) + y * w;
+
+                uint x = x0;
+#if NV_USE_SSE > 1
+                const __m128 sv0 = _mm_set1_ps(v0), sv1 = _mm_set1_ps(v1), sv2 = _mm_set1_ps(v2);
+                const __m128 sw1 = _mm_set1_ps(float(w - 0));
+                const __m128 sscale = _mm_set1_ps(scale);
+                for (; x + 4 <= x1; x += 4)
+                {
+                    __m128 sw0, sw2;
+                    polyphaseWeights(w, x, &sw0, &sw2);
 
-                for (uint x = 0; x < w; x++)
+                    const PolyphaseTaps r0(src + 0 * m_width + 2 * x);
+                    const PolyphaseTaps r1(src + 1 * m_width + 2 * x);
+                    const PolyphaseTaps r2(src + 2 * m_width + 2 * x);
+
+                    __m128 f = _mm_setzero_ps();
+                    f = _mm_add_ps(f, _mm_mul_ps(sv0, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sw0, r0.t0), _mm_mul_ps(sw1, r0.t1)), _mm_mul_ps(sw2, r0.t2))));
+                    f = _mm_add_ps(f, _mm_mul_ps(sv1, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sw0, r1.t0), _mm_mul_ps(sw1, r1.t1)), _mm_mul_ps(sw2, r1.t2))));
+                    f = _mm_add_ps(f, _mm_mul_ps(sv2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sw0, r2.t0), _mm_mul_ps(sw1, r2.t1)), _mm_mul_ps(sw2, r2.t2))));
+
+                    _mm_storeu_ps(dst + x, _mm_mul_ps(f, sscale));
+                }
+#endif
+                for (; x < x1; x++)
                 {
                     const float w0 = float(w - x);
                     const float w1 = float(w - 0);
@@ -626,27 +958,41 @@ FloatImage * FloatImage::fastDownSample() const
                     f += v1 * (w0 * src[1 * m_width + 2 * x] + w1 * src[1 * m_width + 2 * x + 1] + w2 * src[1 * m_width + 2 * x + 2]);
                     f += v2 * (w0 * src[2 * m_width + 2 * x] + w1 * src[2 * m_width + 2 * x + 1] + w2 * src[2 * m_width + 2 * x + 2]);
 
-                    *dst = f * scale;
-                    dst++;
+                    dst[x] = f * scale;
                 }
-
-                src += 2 * m_width;
             }
         }
-    }
-    else if (m_width & 1)
-    {
-        nvDebugCheck(m_width == 2 * w + 1);
-        const float scale = 1.0f / (2 * m_width);
-
-        for(uint c = 0; c < m_componentCount; c++)
+        else if (m_width & 1)
         {
-            const float * src = this->channel(c);
-            float * dst = dst_image->channel(c);
+            nvDebugCheck(m_width == 2 * w + 1);
+            const float scale = 1.0f / (2 * m_width);
 
-            for(uint y = 0; y < h; y++)
+            for(uint c = 0; c < componentCount; c++)
             {
-                for (uint x = 0; x < w; x++)
+                const float * src = src_image->channel(c) + 2 * y * m_width;
+                float * dst = dst_image->channel(c) + y * w;
+
+                uint x = x0;
+#if NV_USE_SSE > 1
+                const __m128 sw1 = _mm_set1_ps(float(w - 0));
+                const __m128 sscale = _mm_set1_ps(scale);
+                for (; x + 4 <= x1; x += 4)
+                {
+                    __m128 sw0, sw2;
+                    polyphaseWeights(w, x, &sw0, &sw2);
+
+                    const PolyphaseTaps r0(src + 2 * x);
+                    const PolyphaseTaps r1(src + m_width + 2 * x);
+
+                    __m128 f = _mm_setzero_ps();
+                    f = _mm_add_ps(f, _mm_mul_ps(sw0, _mm_add_ps(r0.t0, r1.t0)));
+                    f = _mm_add_ps(f, _mm_mul_ps(sw1, _mm_add_ps(r0.t1, r1.t1)));
+                    f = _mm_add_ps(f, _mm_mul_ps(sw2, _mm_add_ps(r0.t2, r1.t2)));
+
+                    _mm_storeu_ps(dst + x, _mm_mul_ps(f, sscale));
+                }
+#endif
+                for (; x < x1; x++)
                 {
                     const float w0 = float(w - x);
                     const float w1 = float(w - 0);
@@ -657,50 +1003,176 @@ FloatImage * FloatImage::fastDownSample() const
                     f += w1 * (src[2 * x + 1] + src[m_width + 2 * x + 1]);
                     f += w2 * (src[2 * x + 2] + src[m_width + 2 * x + 2]);
 
-                    *dst = f * scale;
-                    dst++;
+                    dst[x] = f * scale;
                 }
-
-                src += 2 * m_width;
             }
         }
-    }
-    else if (m_height & 1)
-    {
-        nvDebugCheck(m_height == 2 * h + 1);
+        else if (m_height & 1)
+        {
+            nvDebugCheck(m_height == 2 * h + 1);
 
-        const float scale = 1.0f / (2 * m_height);
+            const float scale = 1.0f / (2 * m_height);
 
-        for(uint c = 0; c < m_componentCount; c++)
-        {
-            const float * src = this->channel(c);
-            float * dst = dst_image->channel(c);
+            const float v0 = float(h - y);
+            const float v1 = float(h - 0);
+            const float v2 = float(1 + y);
 
-            for(uint y = 0; y < h; y++)
+            for(uint c = 0; c < componentCount; c++)
             {
-                const float v0 = float(h - y);
-                const float v1 = float(h - 0);
-                const float v2 = float(1 + y);
+                const float * src = src_image->channel(c) + 2 * y * m_width;
+                float * dst = dst_image->channel(c) + y * w;
+
+                uint x = x0;
+#if NV_USE_SSE > 1
+                const __m128 sv0 = _mm_set1_ps(v0), sv1 = _mm_set1_ps(v1), sv2 = _mm_set1_ps(v2);
+                const __m128 sscale = _mm_set1_ps(scale);
+                for (; x + 4 <= x1; x += 4)
+                {
+                    __m128 f = _mm_setzero_ps();
+                    for (uint i = 0; i < 3; i++)
+                    {
+                        const float * row = src + i * m_width + 2 * x;
+                        const __m128 a0 = _mm_loadu_ps(row), a1 = _mm_loadu_ps(row + 4);
+                        const __m128 pair = _mm_add_ps(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1)));
+                        f = _mm_add_ps(f, _mm_mul_ps(i == 0 ? sv0 : (i == 1 ? sv1 : sv2), pair));
+                    }
 
-                for (uint x = 0; x < w; x++)
+                    _mm_storeu_ps(dst + x, _mm_mul_ps(f, sscale));
+                }
+#endif
+                for (; x < x1; x++)
                 {
                     float f = 0.0f;
                     f += v0 * (src[0 * m_width + 2 * x] + src[0 * m_width + 2 * x + 1]);
                     f += v1 * (src[1 * m_width + 2 * x] + src[1 * m_width + 2 * x + 1]);
                     f += v2 * (src[2 * m_width + 2 * x] + src[2 * m_width + 2 * x + 1]);
 
-                    *dst = f * scale;
-                    dst++;
+                    dst[x] = f * scale;
                 }
-
-                src += 2 * m_width;
             }
         }
     }
 
+    void fastDownSampleRow(const FloatImage * src_image, FloatImage * dst_image, uint y)
+    {
+        fastDownSampleSpan(src_image, dst_image, y, 0, dst_image->width());
+    }
+
+    struct FastDownSampleContext
+    {
+        const FloatImage * src;
+        FloatImage * dst;
+        uint x0, y0, x1;    // Columns and first row of the region, for fastDownSampleRegion.
+    };
+
+    void FastDownSampleTask(void * context, int begin, int end)
+    {
+        const FastDownSampleContext * ctx = (const FastDownSampleContext *)context;
+        for (int y = begin; y < end; y++) {
+            fastDownSampleRow(ctx->src, ctx->dst, y);
+        }
+    }
+
+    void FastDownSampleRegionTask(void * context, int begin, int end)
+    {
+        const FastDownSampleContext * ctx = (const FastDownSampleContext *)context;
+        for (int y = begin; y < end; y++) {
+            fastDownSampleSpan(ctx->src, ctx->dst, ctx->y0 + y, ctx->x0, ctx->x1);
+        }
+    }
+
+} // namespace
+
+/// Fast downsampling using box filter. 
+///
+/// The extents of the image are divided by two and rounded down.
+///
+/// When the size of the image is odd, this uses a polyphase box filter as explained in:
+/// http://developer.nvidia.com/object/np2_mipmapping.html
+///
+FloatImage * FloatImage::fastDownSample() const
+{
+    nvDebugCheck(m_depth == 1);
+    nvDebugCheck(m_width != 1 || m_height != 1);
+
+    AutoPtr<FloatImage> dst_image( new FloatImage() );
+
+    const uint w = max(1, m_width / 2);
+    const uint h = max(1, m_height / 2);
+    dst_image->allocate(m_componentCount, w, h);
+
+    FastDownSampleContext context = { this, dst_image.ptr() };
+
+    if (w * h < kParallelDownSampleThreshold) {
+        FastDownSampleTask(&context, 0, h);
+    }
+    else {
+        TaskScheduler::global()->parallelFor(FastDownSampleTask, &context, h, kDownSampleRowsPerTask);
+    }
+
     return dst_image.release();
 }
 
+/// Recompute the texels [x0, x1) x [y0, y1) of dst, the fastDownSample of this image, after the texels they are built from
+/// changed. The results are identical to those of fastDownSample, the other texels of dst are not touched.
+void FloatImage::fastDownSampleRegion(FloatImage * dst, uint x0, uint y0, uint x1, uint y1) const
+{
+    nvDebugCheck(m_depth == 1);
+    nvDebugCheck(dst->width() == max(1U, width() / 2) && dst->height() == max(1U, height() / 2));
+    nvDebugCheck(dst->componentCount() == m_componentCount);
+    nvDebugCheck(x1 <= dst->width() && y1 <= dst->height());
+
+    if (x0 >= x1 || y0 >= y1) return;
+
+    FastDownSampleContext context = { this, dst, x0, y0, x1 };
+
+    if ((x1 - x0) * (y1 - y0) < kParallelDownSampleThreshold) {
+        FastDownSampleRegionTask(&context, 0, y1 - y0);
+    }
+    else {
+        TaskScheduler::global()->parallelFor(FastDownSampleRegionTask, &context, y1 - y0, kDownSampleRowsPerTask);
+    }
+}
+
+/// Build count successive levels of fastDownSample in a single pass over the image.
+///
+/// The rows of every level are computed as soon as the rows they depend on in the level above are done, while those are
+/// still in the cache, instead of reading each complete level back from memory. The results are identical to calling
+/// fastDownSample repeatedly. levels receives count new images, the first one is the largest.
+void FloatImage::fastDownSampleChain(uint count, FloatImage ** levels) const
+{
+    nvDebugCheck(m_depth == 1);
+
+    uint w = m_width;
+    uint h = m_height;
+    for (uint i = 0; i < count; i++) {
+        nvDebugCheck(w != 1 || h != 1);
+        w = max(1U, w / 2);
+        h = max(1U, h / 2);
+
+        levels[i] = new FloatImage();
+        levels[i]->allocate(m_componentCount, w, h);
+    }
+
+    // Rows done in each level, this image is complete.
+    Array<uint> done;
+    done.resize(count + 1, 0);
+
+    for (uint row = 1; row <= m_height; row++) {
+        done[0] = row;
+
+        for (uint i = 0; i < count; i++) {
+            const FloatImage * src_image = (i == 0) ? this : levels[i - 1];
+            FloatImage * dst_image = levels[i];
+
+            while (done[i + 1] < dst_image->height() && fastDownSampleRowsNeeded(src_image, done[i + 1]) <= done[i]) {
+                fastDownSampleRow(src_image, dst_image, done[i + 1]);
+                done[i + 1]++;
+            }
+        }
+    }
+}
+
 /// Downsample applying a 1D kernel separately in each dimension.
 FloatImage * FloatImage::downSample(const Filter & filter, WrapMode wm) const
 {
@@ -736,34 +1208,13 @@ FloatImage * FloatImage::resize(const Filter & filter, uint w, uint h, WrapMode
     // @@ Select fastest filtering order:
     //if (w * m_height <= h * m_width)
     {
-        tmp_image->allocate(m_componentCount, w, m_height);
-        dst_image->allocate(m_componentCount, w, h);
-
-        // @@ We could avoid this allocation, write directly to dst_plane.
-        Array<float> tmp_column(h);
-        tmp_column.resize(h);
+        tmp_image->allocate(m_componentCount, w, m_height, m_depth);
+        dst_image->allocate(m_componentCount, w, h, m_depth);
 
         for (uint c = 0; c < m_componentCount; c++)
         {
-            for (uint z = 0; z < m_depth; z++)
-            {
-                float * tmp_plane = tmp_image->plane(c, z);
-
-                for (uint y = 0; y < m_height; y++) {
-                    this->applyKernelX(xkernel, y, z, c, wm, tmp_plane + y * w);
-                }
-
-                float * dst_plane = dst_image->plane(c, z);
-
-                for (uint x = 0; x < w; x++) {
-                    tmp_image->applyKernelY(ykernel, x, z, c, wm, tmp_column.buffer());
-
-                    // @@ We could avoid this copy, write directly to dst_plane.
-                    for (uint y = 0; y < h; y++) {
-                        dst_plane[y * w + x] = tmp_column[y];
-                    }
-                }
-            }
+            this->applyKernelX(xkernel, c, wm, tmp_image.ptr());
+            tmp_image->applyKernelY(ykernel, c, wm, dst_image.ptr());
         }
     }
 
@@ -781,7 +1232,6 @@ FloatImage * FloatImage::resize(const Filter & filter, uint w, uint h, uint d, W
     }
 
     AutoPtr<FloatImage> tmp_image( new FloatImage() );
-    AutoPtr<FloatImage> tmp_image2( new FloatImage() );
     AutoPtr<FloatImage> dst_image( new FloatImage() );
 
     PolyphaseKernel xkernel(filter, m_width, w, 32);
@@ -789,54 +1239,23 @@ FloatImage * FloatImage::resize(const Filter & filter, uint w, uint h, uint d, W
     PolyphaseKernel zkernel(filter, m_depth, d, 32);
 
     tmp_image->allocate(m_componentCount, w, m_height, m_depth);
-    tmp_image2->allocate(m_componentCount, w, m_height, d);
     dst_image->allocate(m_componentCount, w, h, d);
 
-    Array<float> tmp_column(h);
-    tmp_column.resize(h);
-
+    // split width in half
     for (uint c = 0; c < m_componentCount; c++)
     {
-        float * tmp_channel = tmp_image->channel(c);
-
-        // split width in half
-        for (uint z = 0; z < m_depth; z++ ) {
-            for (uint y = 0; y < m_height; y++) {
-                this->applyKernelX(xkernel, y, z, c, wm, tmp_channel + z * m_height * w + y * w);
-            }
-        }
-
-        // split depth in half
-        float * tmp2_channel = tmp_image2->channel(c);
-        for (uint y = 0; y < m_height; y++) {
-            for (uint x = 0; x < w; x++) {
-                tmp_image->applyKernelZ(zkernel, x, y, c, wm, tmp_column.buffer() );
+        this->applyKernelX(xkernel, c, wm, tmp_image.ptr());
+    }
 
-                for (uint z = 0; z < d; z++) {
-                    tmp2_channel[z * m_height * w + y * w + x] = tmp_column[z];
-                }
-            }
-        }
+    // split depth and height in half, one band of rows at a time
+    tmp_image->applyKernelZY(zkernel, ykernel, wm, dst_image.ptr());
 
-        // split height in half
-        float * dst_channel = dst_image->channel(c);
+    return dst_image.release();
+}
 
-        for (uint z = 0; z < d; z++ ) {
-            for (uint x = 0; x < w; x++) {
-                tmp_image2->applyKernelY(ykernel, x, z, c, wm, tmp_column.buffer());
 
-                for (uint y = 0; y < h; y++) {
-                    dst_channel[z * h * w + y * w + x] = tmp_column[y];
-                }
-            }
-        }
-    }
-
-    return dst_image.release();
-}
-
-
-/// Downsample applying a 1D kernel separately in each dimension.
+/// Downsample applying a 1D kernel separately in each dimension. The colors are weighted by the given alpha channel, each
+/// pass filters all the channels together.
 FloatImage * FloatImage::resize(const Filter & filter, uint w, uint h, WrapMode wm, uint alpha) const
 {
     nvCheck(alpha < m_componentCount);
@@ -847,42 +1266,11 @@ FloatImage * FloatImage::resize(const Filter & filter, uint w, uint h, WrapMode
     PolyphaseKernel xkernel(filter, m_width, w, 32);
     PolyphaseKernel ykernel(filter, m_height, h, 32);
 
-    {
-        tmp_image->allocate(m_componentCount, w, m_height);
-        dst_image->allocate(m_componentCount, w, h);
-
-        Array<float> tmp_column(h);
-        tmp_column.resize(h);
-
-        for (uint i = 0; i < m_componentCount; i++)
-        {
-            // Process alpha channel first.
-            uint c;
-            if (i == 0) c = alpha;
-            else if (i > alpha) c = i;
-            else c = i - 1;
-
-            for (uint z = 0; z < m_depth; z++)
-            {
-                float * tmp_plane = tmp_image->plane(c, z);
-
-                for (uint y = 0; y < m_height; y++) {
-                    this->applyKernelX(xkernel, y, z, c, wm, tmp_plane + y * w);
-                }
-
-                float * dst_plane = dst_image->plane(c, z);
-
-                for (uint x = 0; x < w; x++) {
-                    tmp_image->applyKernelY(ykernel, x, z, c, wm, tmp_column.buffer());
+    tmp_image->allocate(m_componentCount, w, m_height, m_depth);
+    dst_image->allocate(m_componentCount, w, h, m_depth);
 
-                    // @@ Avoid this copy, write directly to dst_plane.
-                    for (uint y = 0; y < h; y++) {
-                        dst_plane[y * w + x] = tmp_column[y];
-                    }
-                }
-            }
-        }
-    }
+    this->applyAlphaWeightedKernelX(xkernel, alpha, wm, tmp_image.ptr());
+    tmp_image->applyAlphaWeightedKernelY(ykernel, alpha, wm, dst_image.ptr());
 
     return dst_image.release();
 }
@@ -899,7 +1287,6 @@ FloatImage * FloatImage::resize(const Filter & filter, uint w, uint h, uint d, W
     }
 
     AutoPtr<FloatImage> tmp_image( new FloatImage() );
-    AutoPtr<FloatImage> tmp_image2( new FloatImage() );
     AutoPtr<FloatImage> dst_image( new FloatImage() );
 
     PolyphaseKernel xkernel(filter, m_width, w, 32);
@@ -907,72 +1294,392 @@ FloatImage * FloatImage::resize(const Filter & filter, uint w, uint h, uint d, W
     PolyphaseKernel zkernel(filter, m_depth, d, 32);
 
     tmp_image->allocate(m_componentCount, w, m_height, m_depth);
-    tmp_image2->allocate(m_componentCount, w, m_height, d);
     dst_image->allocate(m_componentCount, w, h, d);
 
-    Array<float> tmp_column(h);
-    tmp_column.resize(h);
+    this->applyAlphaWeightedKernelX(xkernel, alpha, wm, tmp_image.ptr());
+    tmp_image->applyAlphaWeightedKernelZY(zkernel, ykernel, alpha, wm, dst_image.ptr());
+
+    return dst_image.release();
+}
+
+
+namespace
+{
+    // Rows of a convolution pass computed by each task.
+    const uint kConvolutionRowsPerTask = 8;
+
+    // Below this many texels a convolution pass runs on the calling thread.
+    const uint kParallelConvolutionThreshold = 64 * 1024;
+
+    // Kernels that are not separable and have a window of at least this size are applied through FFTs.
+    const uint kFftConvolutionMinWindow = 9;
 
-    for (uint i = 0; i < m_componentCount; i++)
+    inline int wrapCoordinate(int x, int w, FloatImage::WrapMode wm)
     {
-        // Process alpha channel first.
-        uint c;
-        if (i == 0) c = alpha;
-        else if (i > alpha) c = i;
-        else c = i - 1;
+        if (wm == FloatImage::WrapMode_Clamp) return wrapClamp(x, w);
+        if (wm == FloatImage::WrapMode_Repeat) return wrapRepeat(x, w);
+        /*if (wm == FloatImage::WrapMode_Mirror)*/ return wrapMirror(x, w);
+    }
 
-        float * tmp_channel = tmp_image->channel(c);
+    // Wrapped coordinates of [-radius, n - radius + window), indexed from 0.
+    static void initWrapTable(Array<int> & table, int n, int window, int radius, FloatImage::WrapMode wm)
+    {
+        table.resize(n + window);
+        for (int i = 0; i < n + window; i++) {
+            table[i] = wrapCoordinate(i - radius, n, wm);
+        }
+    }
 
-        for (uint z = 0; z < m_depth; z++ ) {
-            for (uint y = 0; y < m_height; y++) {
-                this->applyKernelX(xkernel, y, z, c, wm, tmp_channel + z * m_height * w + y * w);
+    // One pass of a direct convolution of a plane. The taps are visited in the order of FloatImage::applyKernelXY.
+    struct ConvolutionContext
+    {
+        const float * src;
+        float * dst;
+        int w, h;
+        int radius;
+        const int * rows;       // See initWrapTable.
+        const int * columns;
+
+        int tapCount;
+        const int * tapX;       // In [0, window).
+        const int * tapY;
+        const float * tapWeight;
+    };
+
+    static inline float convolveWrapped(const ConvolutionContext * ctx, const float * const * row, int x)
+    {
+        float sum = 0.0f;
+        for (int t = 0; t < ctx->tapCount; t++) {
+            sum += ctx->tapWeight[t] * row[ctx->tapY[t]][ctx->columns[x + ctx->tapX[t]]];
+        }
+        return sum;
+    }
+
+    static void ConvolutionTask(void * context, int begin, int end)
+    {
+        const ConvolutionContext * ctx = (const ConvolutionContext *)context;
+
+        const int w = ctx->w;
+        const int r = ctx->radius;
+        const bool avx2 = (cpuFeatures() & CpuFeature_AVX2) != 0;
+
+        // Rows of the window of each tap, the window is at most as tall as the table of rows allows.
+        Array<const float *> rowArray;
+        int window = 0;
+        for (int t = 0; t < ctx->tapCount; t++) window = max(window, ctx->tapY[t] + 1);
+        rowArray.resize(window);
+        const float ** row = rowArray.buffer();
+
+        for (int y = begin; y < end; y++) {
+            for (int i = 0; i < window; i++) {
+                row[i] = ctx->src + ctx->rows[y + i] * w;
+            }
+
+            float * dst = ctx->dst + y * w;
+
+            // The window of the texels in [r, w - r) doesn't wrap horizontally, when the taps span at most 2r+1 columns.
+            const int interiorBegin = min(r, w);
+            const int interiorEnd = max(interiorBegin, w - r);
+
+            int x = 0;
+            for (; x < interiorBegin; x++) {
+                dst[x] = convolveWrapped(ctx, row, x);
+            }
+#if defined(HAVE_AVX2)
+            if (avx2) {
+                x = convolveRowAVX2(row, ctx->tapX, ctx->tapY, ctx->tapWeight, ctx->tapCount, r, x, interiorEnd, dst);
+            }
+#endif
+#if NV_USE_SSE > 1
+            for (; x + 4 <= interiorEnd; x += 4) {
+                __m128 sum = _mm_setzero_ps();
+                for (int t = 0; t < ctx->tapCount; t++) {
+                    const __m128 v = _mm_loadu_ps(row[ctx->tapY[t]] + x + ctx->tapX[t] - r);
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(ctx->tapWeight[t]), v));
+                }
+                _mm_storeu_ps(dst + x, sum);
+            }
+#endif
+            for (; x < interiorEnd; x++) {
+                float sum = 0.0f;
+                for (int t = 0; t < ctx->tapCount; t++) {
+                    sum += ctx->tapWeight[t] * row[ctx->tapY[t]][x + ctx->tapX[t] - r];
+                }
+                dst[x] = sum;
+            }
+            for (; x < w; x++) {
+                dst[x] = convolveWrapped(ctx, row, x);
             }
         }
+    }
+
+    // Apply the taps to a plane. Taps with zero weight must have been removed already.
+    static void convolvePlane(const float * src, float * dst, int w, int h, int window, FloatImage::WrapMode wm,
+        const Array<int> & tapX, const Array<int> & tapY, const Array<float> & tapWeight)
+    {
+        const int radius = window / 2;
+
+        Array<int> rows, columns;
+        initWrapTable(rows, h, window, radius, wm);
+        initWrapTable(columns, w, window, radius, wm);
+
+        ConvolutionContext ctx;
+        ctx.src = src;
+        ctx.dst = dst;
+        ctx.w = w;
+        ctx.h = h;
+        ctx.radius = radius;
+        ctx.rows = rows.buffer();
+        ctx.columns = columns.buffer();
+        ctx.tapCount = tapX.count();
+        ctx.tapX = tapX.buffer();
+        ctx.tapY = tapY.buffer();
+        ctx.tapWeight = tapWeight.buffer();
+
+        if (uint(w * h) < kParallelConvolutionThreshold) {
+            ConvolutionTask(&ctx, 0, h);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(ConvolutionTask, &ctx, h, kConvolutionRowsPerTask);
+        }
+    }
 
-        float * tmp2_channel = tmp_image2->channel(c);
-        for (uint y = 0; y < m_height; y++) {
-            for (uint x = 0; x < w; x++) {
-                tmp_image->applyKernelZ(zkernel, x, y, c, wm, tmp_column.buffer() );
 
-                for (uint z = 0; z < d; z++) {
-                    tmp2_channel[z * m_height * w + y * w + x] = tmp_column[z];
+    // Radix-2 complex FFT of n elements in place, stride apart. The inverse transform is not scaled.
+    static void fft(float * re, float * im, uint n, uint stride, const float * cosTable, const float * sinTable, bool inverse)
+    {
+        // Bit reversal permutation.
+        for (uint i = 1, j = 0; i < n; i++) {
+            uint bit = n >> 1;
+            for (; j & bit; bit >>= 1) j ^= bit;
+            j ^= bit;
+            if (i < j) {
+                swap(re[i * stride], re[j * stride]);
+                swap(im[i * stride], im[j * stride]);
+            }
+        }
+
+        const float sign = inverse ? 1.0f : -1.0f;
+
+        for (uint size = 2; size <= n; size <<= 1) {
+            const uint half = size >> 1;
+            const uint step = n / size;
+            for (uint i = 0; i < n; i += size) {
+                for (uint k = 0; k < half; k++) {
+                    const float wr = cosTable[k * step];
+                    const float wi = sign * sinTable[k * step];
+                    const uint a = (i + k) * stride;
+                    const uint b = (i + k + half) * stride;
+                    const float tr = re[b] * wr - im[b] * wi;
+                    const float ti = re[b] * wi + im[b] * wr;
+                    re[b] = re[a] - tr;
+                    im[b] = im[a] - ti;
+                    re[a] += tr;
+                    im[a] += ti;
                 }
             }
         }
+    }
+
+    static void fft2D(float * re, float * im, uint n, const float * cosTable, const float * sinTable, bool inverse)
+    {
+        for (uint y = 0; y < n; y++) fft(re + y * n, im + y * n, n, 1, cosTable, sinTable, inverse);
+        for (uint x = 0; x < n; x++) fft(re + x, im + x, n, n, cosTable, sinTable, inverse);
+    }
+
+    // Overlap-save convolution of a plane: the output is cut in tiles, the input window of each tile is gathered with wrapping,
+    // transformed, multiplied by the spectrum of the kernel and transformed back. Two tiles go through each complex transform, one
+    // in the real part and one in the imaginary part, since the kernel is real.
+    struct FftConvolutionContext
+    {
+        const float * src;
+        float * dst;
+        int w, h;
+        int window;
+        uint n;                 // Transform size.
+        int tileSize;           // n - window + 1 outputs per side.
+        int tilesX, tileCount;
+        const int * rows;       // See initWrapTable.
+        const int * columns;
+        const float * kernelRe; // Conjugate spectrum of the kernel, scaled by 1 / n^2.
+        const float * kernelIm;
+        const float * cosTable;
+        const float * sinTable;
+    };
+
+    static void FftConvolutionTask(void * context, int begin, int end)
+    {
+        const FftConvolutionContext * ctx = (const FftConvolutionContext *)context;
+
+        const uint n = ctx->n;
+        Array<float> re, im;
+        re.resize(n * n);
+        im.resize(n * n);
+
+        for (int pair = begin; pair < end; pair++) {
+            const int tiles[2] = { 2 * pair, 2 * pair + 1 };
+            float * parts[2] = { re.buffer(), im.buffer() };
+
+            for (int p = 0; p < 2; p++) {
+                float * buffer = parts[p];
+                memset(buffer, 0, n * n * sizeof(float));
+                if (tiles[p] >= ctx->tileCount) continue;
+
+                const int x0 = (tiles[p] % ctx->tilesX) * ctx->tileSize;
+                const int y0 = (tiles[p] / ctx->tilesX) * ctx->tileSize;
+                const int spanX = min(ctx->tileSize, ctx->w - x0) + ctx->window - 1;
+                const int spanY = min(ctx->tileSize, ctx->h - y0) + ctx->window - 1;
+
+                for (int y = 0; y < spanY; y++) {
+                    const float * src = ctx->src + ctx->rows[y0 + y] * ctx->w;
+                    for (int x = 0; x < spanX; x++) {
+                        buffer[y * n + x] = src[ctx->columns[x0 + x]];
+                    }
+                }
+            }
 
-        float * dst_channel = dst_image->channel(c);
+            fft2D(re.buffer(), im.buffer(), n, ctx->cosTable, ctx->sinTable, false);
 
-        for (uint z = 0; z < d; z++ ) {
-            for (uint x = 0; x < w; x++) {
-                tmp_image2->applyKernelY(ykernel, x, z, c, wm, tmp_column.buffer());
+            for (uint i = 0; i < n * n; i++) {
+                const float a = re[i], b = im[i];
+                re[i] = a * ctx->kernelRe[i] - b * ctx->kernelIm[i];
+                im[i] = a * ctx->kernelIm[i] + b * ctx->kernelRe[i];
+            }
+
+            fft2D(re.buffer(), im.buffer(), n, ctx->cosTable, ctx->sinTable, true);
+
+            for (int p = 0; p < 2; p++) {
+                if (tiles[p] >= ctx->tileCount) continue;
+                const float * buffer = parts[p];
 
-                for (uint y = 0; y < h; y++) {
-                    dst_channel[z * h * w + y * w + x] = tmp_column[y];
+                const int x0 = (tiles[p] % ctx->tilesX) * ctx->tileSize;
+                const int y0 = (tiles[p] / ctx->tilesX) * ctx->tileSize;
+                const int sizeX = min(ctx->tileSize, ctx->w - x0);
+                const int sizeY = min(ctx->tileSize, ctx->h - y0);
+
+                for (int y = 0; y < sizeY; y++) {
+                    memcpy(ctx->dst + (y0 + y) * ctx->w + x0, buffer + y * n, sizeX * sizeof(float));
                 }
             }
         }
     }
 
-    return dst_image.release();
-}
+    static void fftConvolvePlane(const float * src, float * dst, int w, int h, const Kernel2 & k, FloatImage::WrapMode wm)
+    {
+        const int window = int(k.windowSize());
+        const int radius = window / 2;
+
+        // Small transforms stay in cache, large ones waste less of each tile on the border of the window. These were the fastest
+        // sizes on 1024x1024 images.
+        const uint n = (window <= 32) ? max(64U, nextPowerOfTwo(uint(2 * window))) : nextPowerOfTwo(uint(4 * window));
+
+        FftConvolutionContext ctx;
+        ctx.src = src;
+        ctx.dst = dst;
+        ctx.w = w;
+        ctx.h = h;
+        ctx.window = window;
+        ctx.n = n;
+        ctx.tileSize = int(n) - window + 1;
+        ctx.tilesX = (w + ctx.tileSize - 1) / ctx.tileSize;
+        ctx.tileCount = ctx.tilesX * ((h + ctx.tileSize - 1) / ctx.tileSize);
+
+        Array<int> rows, columns;
+        initWrapTable(rows, h, window, radius, wm);
+        initWrapTable(columns, w, window, radius, wm);
+        ctx.rows = rows.buffer();
+        ctx.columns = columns.buffer();
+
+        Array<float> cosTable, sinTable;
+        cosTable.resize(n / 2);
+        sinTable.resize(n / 2);
+        for (uint i = 0; i < n / 2; i++) {
+            cosTable[i] = float(cos(2.0 * PI * i / n));
+            sinTable[i] = float(sin(2.0 * PI * i / n));
+        }
+        ctx.cosTable = cosTable.buffer();
+        ctx.sinTable = sinTable.buffer();
+
+        // The output is a correlation with the kernel, that is, a product with the conjugate of its spectrum.
+        Array<float> kernelRe, kernelIm;
+        kernelRe.resize(n * n, 0.0f);
+        kernelIm.resize(n * n, 0.0f);
+        for (int y = 0; y < window; y++) {
+            for (int x = 0; x < window; x++) {
+                kernelRe[y * n + x] = k.valueAt(x, y);
+            }
+        }
+        fft2D(kernelRe.buffer(), kernelIm.buffer(), n, ctx.cosTable, ctx.sinTable, false);
 
+        const float scale = 1.0f / float(n * n);
+        for (uint i = 0; i < n * n; i++) {
+            kernelRe[i] *= scale;
+            kernelIm[i] *= -scale;
+        }
+        ctx.kernelRe = kernelRe.buffer();
+        ctx.kernelIm = kernelIm.buffer();
+
+        const int pairCount = (ctx.tileCount + 1) / 2;
+        if (uint(w * h) < kParallelConvolutionThreshold) {
+            FftConvolutionTask(&ctx, 0, pairCount);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(FftConvolutionTask, &ctx, pairCount);
+        }
+    }
+}
 
+/// Convolve channel c with the given kernel. Each plane is convolved separately. Separable kernels are applied as a horizontal
+/// and a vertical pass, large kernels through FFTs of image tiles, and the others directly.
 void FloatImage::convolve(const Kernel2 & k, uint c, WrapMode wm)
 {
-    AutoPtr<FloatImage> tmpImage(clone());
+    const int w = m_width;
+    const int h = m_height;
+    const int window = int(k.windowSize());
+
+    Array<float> column, row;
+    column.resize(window);
+    row.resize(window);
+    const bool separable = k.isSeparable(column.buffer(), row.buffer());
+
+    // Taps of the passes with non zero weight.
+    Array<int> tapX, tapY, verticalX, verticalY;
+    Array<float> tapWeight, verticalWeight;
+    if (separable) {
+        for (int i = 0; i < window; i++) {
+            if (row[i] != 0.0f) { tapX.append(i); tapY.append(window / 2); tapWeight.append(row[i]); }
+            if (column[i] != 0.0f) { verticalX.append(window / 2); verticalY.append(i); verticalWeight.append(column[i]); }
+        }
+    }
+    else {
+        for (int y = 0; y < window; y++) {
+            for (int x = 0; x < window; x++) {
+                if (k.valueAt(x, y) != 0.0f) { tapX.append(x); tapY.append(y); tapWeight.append(k.valueAt(x, y)); }
+            }
+        }
+    }
 
-    uint w = m_width;
-    uint h = m_height;
-    uint d = m_depth;
+    const bool useFft = !separable && window >= int(kFftConvolutionMinWindow);
+
+    Array<float> source, tmp;
+    source.resize(w * h);
+    if (separable) tmp.resize(w * h);
 
-    for (uint z = 0; z < d; z++)
+    for (uint z = 0; z < m_depth; z++)
     {
-        for (uint y = 0; y < h; y++)
-        {
-            for (uint x = 0; x < w; x++)
-            {
-                pixel(c, x, y, 0) = tmpImage->applyKernelXY(&k, x, y, z, c, wm);
-            }
+        float * plane = this->plane(c, z);
+        memcpy(source.buffer(), plane, w * h * sizeof(float));
+
+        if (separable) {
+            // The horizontal pass reads a single row of its window, the vertical pass a single column.
+            convolvePlane(source.buffer(), tmp.buffer(), w, h, window, wm, tapX, tapY, tapWeight);
+            convolvePlane(tmp.buffer(), plane, w, h, window, wm, verticalX, verticalY, verticalWeight);
+        }
+        else if (useFft) {
+            fftConvolvePlane(source.buffer(), plane, w, h, k, wm);
+        }
+        else {
+            convolvePlane(source.buffer(), plane, w, h, window, wm, tapX, tapY, tapWeight);
         }
     }
 }
@@ -1061,16 +1768,647 @@ float FloatImage::applyKernelZ(const Kernel1 * k, int x, int y, int z, uint c, W
 
     const float * channel = this->channel(c);
 
-    float sum = 0.0f;
-    for (uint i = 0; i < kernelWindow; i++)
-    {
-        const int src_z = int(z + i) - kernelOffset;
-        const int idx = this->index(x, y, src_z, wm);
+    float sum = 0.0f;
+    for (uint i = 0; i < kernelWindow; i++)
+    {
+        const int src_z = int(z + i) - kernelOffset;
+        const int idx = this->index(x, y, src_z, wm);
+
+        sum += k->valueAt(i) * channel[idx];
+    }
+
+    return sum;
+}
+
+
+namespace
+{
+    // Below this many output samples per pass the resampler runs on the calling thread.
+    const uint kParallelResizeThreshold = 64 * 1024;
+
+    // Approximate number of output samples processed by each task.
+    const uint kResizeTaskSize = 16 * 1024;
+
+    // Output channels this large do not fit in the cache, so the vertical and depth passes accumulate each row in cache
+    // and write it with non-temporal stores, that don't evict the source rows.
+    const uint kStreamingResizeThreshold = 2 * 1024 * 1024;
+
+    inline bool streamOutput(const FloatImage * img)
+    {
+#if NV_USE_SSE
+        return img->pixelCount() >= kStreamingResizeThreshold && (cpuFeatures() & CpuFeature_StreamingStores) != 0;
+#else
+        return false;
+#endif
+    }
+
+    // dst[i] = src[i], bypassing the cache.
+    inline void streamLine(float * __restrict dst, const float * __restrict src, uint count)
+    {
+        uint i = 0;
+#if NV_USE_SSE
+        for (; i < count && (intptr_t(dst + i) & 15) != 0; i++) {
+            dst[i] = src[i];
+        }
+        for (; i + 4 <= count; i += 4) {
+            _mm_stream_ps(dst + i, _mm_loadu_ps(src + i));
+        }
+#endif
+        for (; i < count; i++) {
+            dst[i] = src[i];
+        }
+    }
+
+    // Make the non-temporal stores visible before the task is reported as done.
+    inline void endStreaming()
+    {
+#if NV_USE_SSE
+        _mm_sfence();
+#endif
+    }
+
+    // dst[i] += w * src[i]
+    inline void addScaledLine(float * __restrict dst, const float * __restrict src, float w, uint count)
+    {
+        uint i = 0;
+#if defined(HAVE_AVX2)
+        if (cpuFeatures() & CpuFeature_AVX2) i = addScaledLineAVX2(dst, src, w, count);
+#endif
+#if NV_USE_SSE
+        const __m128 vw = _mm_set1_ps(w);
+        for (; i + 8 <= count; i += 8) {
+            __m128 a = _mm_add_ps(_mm_loadu_ps(dst + i + 0), _mm_mul_ps(vw, _mm_loadu_ps(src + i + 0)));
+            __m128 b = _mm_add_ps(_mm_loadu_ps(dst + i + 4), _mm_mul_ps(vw, _mm_loadu_ps(src + i + 4)));
+            _mm_storeu_ps(dst + i + 0, a);
+            _mm_storeu_ps(dst + i + 4, b);
+        }
+#endif
+        for (; i < count; i++) {
+            dst[i] += w * src[i];
+        }
+    }
+
+    // dst[i] += w[i] * src[i]
+    inline void addProductLine(float * __restrict dst, const float * __restrict w, const float * __restrict src, uint count)
+    {
+        uint i = 0;
+#if defined(HAVE_AVX2)
+        if (cpuFeatures() & CpuFeature_AVX2) i = addProductLineAVX2(dst, w, src, count);
+#endif
+#if NV_USE_SSE
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_mul_ps(_mm_loadu_ps(w + i), _mm_loadu_ps(src + i))));
+        }
+#endif
+        for (; i < count; i++) {
+            dst[i] += w[i] * src[i];
+        }
+    }
+
+    // The weight of a texel in the alpha weighted passes. Transparent texels keep a small weight, so that fully transparent
+    // regions still get a color.
+    const float kAlphaWeightBias = 1.0f / 256.0f;
+
+    struct ApplyKernelContext
+    {
+        const FloatImage * src;
+        FloatImage * dst;
+        const PolyphaseKernel * kernel;
+        uint c;                         // The alpha channel in the alpha weighted passes.
+        FloatImage::WrapMode wm;
+    };
+
+    // One item per row of the output, rows of all the slices are numbered consecutively.
+    void ApplyKernelXTask(void * context, int begin, int end)
+    {
+        const ApplyKernelContext * ctx = (const ApplyKernelContext *)context;
+        const uint height = ctx->src->height();
+
+        for (int i = begin; i < end; i++) {
+            const uint y = uint(i) % height;
+            const uint z = uint(i) / height;
+            ctx->src->applyKernelX(*ctx->kernel, y, z, ctx->c, ctx->wm, ctx->dst->scanline(ctx->c, y, z));
+        }
+    }
+
+    // Vertical and depth passes process whole rows, accumulating the weighted source rows into the output row.
+    // That keeps the memory accesses sequential and lets us vectorize over adjacent output pixels.
+    void ApplyKernelYTask(void * context, int begin, int end)
+    {
+        const ApplyKernelContext * ctx = (const ApplyKernelContext *)context;
+        const PolyphaseKernel & k = *ctx->kernel;
+        const uint srcHeight = ctx->src->height();
+        const uint dstHeight = ctx->dst->height();
+        const uint width = ctx->dst->width();
+
+        const float iscale = 1.0f / (float(k.length()) / float(srcHeight));
+        const int windowSize = k.windowSize();
+
+        const bool stream = streamOutput(ctx->dst);
+        Array<float> line;
+        if (stream) line.resize(width);
+
+        for (int idx = begin; idx < end; idx++) {
+            const uint i = uint(idx) % dstHeight;
+            const uint z = uint(idx) / dstHeight;
+
+            const float center = (0.5f + i) * iscale;
+            const int left = (int)floorf(center - k.width());
+            nvDebugCheck((int)ceilf(center + k.width()) - left <= windowSize);
+
+            float * dst = ctx->dst->scanline(ctx->c, i, z);
+            float * row = stream ? line.buffer() : dst;
+            memset(row, 0, width * sizeof(float));
+
+            for (int j = 0; j < windowSize; j++) {
+                const int y = wrapCoordinate(left + j, srcHeight, ctx->wm);
+                addScaledLine(row, ctx->src->scanline(ctx->c, y, z), k.valueAt(i, j), width);
+            }
+
+            if (stream) streamLine(dst, row, width);
+        }
+
+        if (stream) endStreaming();
+    }
+
+    void ApplyKernelZTask(void * context, int begin, int end)
+    {
+        const ApplyKernelContext * ctx = (const ApplyKernelContext *)context;
+        const PolyphaseKernel & k = *ctx->kernel;
+        const uint srcDepth = ctx->src->depth();
+        const uint height = ctx->dst->height();
+        const uint width = ctx->dst->width();
+
+        const float iscale = 1.0f / (float(k.length()) / float(srcDepth));
+        const int windowSize = k.windowSize();
+
+        const bool stream = streamOutput(ctx->dst);
+        Array<float> line;
+        if (stream) line.resize(width);
+
+        for (int idx = begin; idx < end; idx++) {
+            const uint y = uint(idx) % height;
+            const uint i = uint(idx) / height;
+
+            const float center = (0.5f + i) * iscale;
+            const int left = (int)floorf(center - k.width());
+            nvDebugCheck((int)ceilf(center + k.width()) - left <= windowSize);
+
+            float * dst = ctx->dst->scanline(ctx->c, y, i);
+            float * row = stream ? line.buffer() : dst;
+            memset(row, 0, width * sizeof(float));
+
+            for (int j = 0; j < windowSize; j++) {
+                const int z = wrapCoordinate(left + j, srcDepth, ctx->wm);
+                addScaledLine(row, ctx->src->scanline(ctx->c, y, z), k.valueAt(i, j), width);
+            }
+
+            if (stream) streamLine(dst, row, width);
+        }
+
+        if (stream) endStreaming();
+    }
+
+    // The alpha weighted passes read each source texel of every channel once per tap, and compute the weights of the taps
+    // once for all the channels. The results are those of the alpha weighted applyKernelX/Y/Z for the colors, and of the
+    // plain kernel for alpha.
+    void ApplyAlphaWeightedKernelXTask(void * context, int begin, int end)
+    {
+        const ApplyKernelContext * ctx = (const ApplyKernelContext *)context;
+        const PolyphaseKernel & k = *ctx->kernel;
+        const FloatImage * src = ctx->src;
+        const uint a = ctx->c;
+        const uint componentCount = src->componentCount();
+        const uint srcWidth = src->width();
+        const uint height = src->height();
+
+        const uint length = k.length();
+        const float iscale = 1.0f / (float(length) / float(srcWidth));
+        const int windowSize = k.windowSize();
+
+        // Source column and weight of each tap, the same for every channel of the row.
+        Array<int> columns;
+        Array<float> weights;
+        Array<float> norms;
+        columns.resize(length * windowSize);
+        weights.resize(length * windowSize);
+        norms.resize(length);
+
+        for (uint i = 0; i < length; i++) {
+            const float center = (0.5f + i) * iscale;
+            const int left = (int)floorf(center - k.width());
+            nvDebugCheck((int)ceilf(center + k.width()) - left <= windowSize);
+
+            for (int j = 0; j < windowSize; j++) {
+                columns[i * windowSize + j] = wrapCoordinate(left + j, srcWidth, ctx->wm);
+            }
+        }
+
+        for (int r = begin; r < end; r++) {
+            const uint y = uint(r) % height;
+            const uint z = uint(r) / height;
+
+            const float * alpha = src->scanline(a, y, z);
+
+            for (uint i = 0; i < length; i++) {
+                float norm = 0.0f;
+                for (int j = 0; j < windowSize; j++) {
+                    const float w = k.valueAt(i, j) * (alpha[columns[i * windowSize + j]] + kAlphaWeightBias);
+                    weights[i * windowSize + j] = w;
+                    norm += w;
+                }
+                norms[i] = norm;
+            }
+
+            for (uint c = 0; c < componentCount; c++) {
+                const float * channel = src->scanline(c, y, z);
+                float * output = ctx->dst->scanline(c, y, z);
+
+                for (uint i = 0; i < length; i++) {
+                    const int * column = columns.buffer() + i * windowSize;
+
+                    float sum = 0.0f;
+                    if (c == a) {
+                        for (int j = 0; j < windowSize; j++) {
+                            sum += k.valueAt(i, j) * channel[column[j]];
+                        }
+                        output[i] = sum;
+                    }
+                    else {
+                        const float * weight = weights.buffer() + i * windowSize;
+                        for (int j = 0; j < windowSize; j++) {
+                            sum += weight[j] * channel[column[j]];
+                        }
+                        output[i] = sum / norms[i];
+                    }
+                }
+            }
+        }
+    }
+
+    // Accumulate the weighted source row of every channel into the output row, see ApplyAlphaWeightedKernelYTask.
+    void addAlphaWeightedRows(const FloatImage * src, FloatImage * dst, uint a, uint srcY, uint srcZ, uint dstY, uint dstZ,
+        float k, float * weight, float * norm)
+    {
+        const uint width = dst->width();
+        const float * alpha = src->scanline(a, srcY, srcZ);
+
+        uint x = 0;
+#if NV_USE_SSE
+        const __m128 vk = _mm_set1_ps(k);
+        const __m128 vbias = _mm_set1_ps(kAlphaWeightBias);
+        for (; x + 4 <= width; x += 4) {
+            const __m128 w = _mm_mul_ps(vk, _mm_add_ps(_mm_loadu_ps(alpha + x), vbias));
+            _mm_storeu_ps(weight + x, w);
+            _mm_storeu_ps(norm + x, _mm_add_ps(_mm_loadu_ps(norm + x), w));
+        }
+#endif
+        for (; x < width; x++) {
+            weight[x] = k * (alpha[x] + kAlphaWeightBias);
+            norm[x] += weight[x];
+        }
+
+        for (uint c = 0; c < dst->componentCount(); c++) {
+            if (c == a) {
+                addScaledLine(dst->scanline(c, dstY, dstZ), alpha, k, width);
+            }
+            else {
+                addProductLine(dst->scanline(c, dstY, dstZ), weight, src->scanline(c, srcY, srcZ), width);
+            }
+        }
+    }
+
+    void normalizeAlphaWeightedRows(FloatImage * dst, uint a, uint y, uint z, const float * norm)
+    {
+        const uint width = dst->width();
+
+        for (uint c = 0; c < dst->componentCount(); c++) {
+            if (c == a) continue;
+
+            float * row = dst->scanline(c, y, z);
+            uint x = 0;
+#if NV_USE_SSE
+            for (; x + 4 <= width; x += 4) {
+                _mm_storeu_ps(row + x, _mm_div_ps(_mm_loadu_ps(row + x), _mm_loadu_ps(norm + x)));
+            }
+#endif
+            for (; x < width; x++) {
+                row[x] /= norm[x];
+            }
+        }
+    }
+
+    // Like ApplyKernelYTask, the weights of a whole source row are computed at once and accumulated into the output rows
+    // of all the channels.
+    void ApplyAlphaWeightedKernelYTask(void * context, int begin, int end)
+    {
+        const ApplyKernelContext * ctx = (const ApplyKernelContext *)context;
+        const PolyphaseKernel & k = *ctx->kernel;
+        const uint srcHeight = ctx->src->height();
+        const uint dstHeight = ctx->dst->height();
+        const uint width = ctx->dst->width();
+
+        const float iscale = 1.0f / (float(k.length()) / float(srcHeight));
+        const int windowSize = k.windowSize();
+
+        Array<float> weight, norm;
+        weight.resize(width);
+        norm.resize(width);
+
+        for (int idx = begin; idx < end; idx++) {
+            const uint i = uint(idx) % dstHeight;
+            const uint z = uint(idx) / dstHeight;
+
+            const float center = (0.5f + i) * iscale;
+            const int left = (int)floorf(center - k.width());
+            nvDebugCheck((int)ceilf(center + k.width()) - left <= windowSize);
+
+            for (uint c = 0; c < ctx->dst->componentCount(); c++) {
+                memset(ctx->dst->scanline(c, i, z), 0, width * sizeof(float));
+            }
+            memset(norm.buffer(), 0, width * sizeof(float));
+
+            for (int j = 0; j < windowSize; j++) {
+                const int y = wrapCoordinate(left + j, srcHeight, ctx->wm);
+                addAlphaWeightedRows(ctx->src, ctx->dst, ctx->c, y, z, i, z, k.valueAt(i, j), weight.buffer(), norm.buffer());
+            }
+
+            normalizeAlphaWeightedRows(ctx->dst, ctx->c, i, z, norm.buffer());
+        }
+    }
+
+    void ApplyAlphaWeightedKernelZTask(void * context, int begin, int end)
+    {
+        const ApplyKernelContext * ctx = (const ApplyKernelContext *)context;
+        const PolyphaseKernel & k = *ctx->kernel;
+        const uint srcDepth = ctx->src->depth();
+        const uint height = ctx->dst->height();
+        const uint width = ctx->dst->width();
+
+        const float iscale = 1.0f / (float(k.length()) / float(srcDepth));
+        const int windowSize = k.windowSize();
+
+        Array<float> weight, norm;
+        weight.resize(width);
+        norm.resize(width);
+
+        for (int idx = begin; idx < end; idx++) {
+            const uint y = uint(idx) % height;
+            const uint i = uint(idx) / height;
+
+            const float center = (0.5f + i) * iscale;
+            const int left = (int)floorf(center - k.width());
+            nvDebugCheck((int)ceilf(center + k.width()) - left <= windowSize);
+
+            for (uint c = 0; c < ctx->dst->componentCount(); c++) {
+                memset(ctx->dst->scanline(c, y, i), 0, width * sizeof(float));
+            }
+            memset(norm.buffer(), 0, width * sizeof(float));
+
+            for (int j = 0; j < windowSize; j++) {
+                const int z = wrapCoordinate(left + j, srcDepth, ctx->wm);
+                addAlphaWeightedRows(ctx->src, ctx->dst, ctx->c, y, z, y, i, k.valueAt(i, j), weight.buffer(), norm.buffer());
+            }
+
+            normalizeAlphaWeightedRows(ctx->dst, ctx->c, y, i, norm.buffer());
+        }
+    }
+
+    void runApplyKernel(ForRangeTask * task, const ApplyKernelContext & context, uint rowCount)
+    {
+        const uint width = context.dst->width();
+
+        if (rowCount * width < kParallelResizeThreshold) {
+            task((void *)&context, 0, rowCount);
+        }
+        else {
+            const uint step = max(1U, kResizeTaskSize / width);
+            TaskScheduler::global()->parallelFor(task, (void *)&context, rowCount, step);
+        }
+    }
+
+    struct ApplyKernelZYContext
+    {
+        const FloatImage * src;
+        FloatImage * dst;
+        const PolyphaseKernel * zkernel;
+        const PolyphaseKernel * ykernel;
+        int a;                          // The alpha channel, or -1 when the colors are not weighted.
+        FloatImage::WrapMode wm;
+        uint rowsPerBand;
+        uint bandCount;
+    };
+
+    // One item per band of output rows of an output slice. The task filters in z only the source rows that the band
+    // reads, into a slab that stays in cache, and then filters the slab vertically into the output. Each row of the slab
+    // is computed exactly as ApplyKernelZTask computes it, and each output row as ApplyKernelYTask does.
+    void ApplyKernelZYTask(void * context, int begin, int end)
+    {
+        const ApplyKernelZYContext * ctx = (const ApplyKernelZYContext *)context;
+        const PolyphaseKernel & zk = *ctx->zkernel;
+        const PolyphaseKernel & yk = *ctx->ykernel;
+        const FloatImage * src = ctx->src;
+        FloatImage * dst = ctx->dst;
+        const uint componentCount = src->componentCount();
+        const uint srcHeight = src->height();
+        const uint srcDepth = src->depth();
+        const uint dstHeight = dst->height();
+        const uint width = dst->width();
+
+        const float ziscale = 1.0f / (float(zk.length()) / float(srcDepth));
+        const float yiscale = 1.0f / (float(yk.length()) / float(srcHeight));
+        const int zWindowSize = zk.windowSize();
+        const int yWindowSize = yk.windowSize();
+
+        // Source rows read by the largest band.
+        const uint slabHeight = uint(ceilf((ctx->rowsPerBand + 1) * yiscale + 2 * yk.width())) + 2;
+
+        FloatImage slab;
+        slab.allocate(componentCount, width, slabHeight, 1);
+
+        Array<float> weight, norm;
+        if (ctx->a >= 0) {
+            weight.resize(width);
+            norm.resize(width);
+        }
+
+        // The alpha weighted rows are normalized in place, only the plain ones are streamed.
+        const bool stream = ctx->a < 0 && streamOutput(dst);
+        Array<float> line;
+        if (stream) line.resize(width);
+
+        for (int idx = begin; idx < end; idx++) {
+            const uint band = uint(idx) % ctx->bandCount;
+            const uint i = uint(idx) / ctx->bandCount;
+            const uint firstRow = band * ctx->rowsPerBand;
+            const uint lastRow = min(dstHeight, firstRow + ctx->rowsPerBand);
+
+            const int top = (int)floorf((0.5f + firstRow) * yiscale - yk.width());
+            const int bottom = (int)floorf((0.5f + lastRow - 1) * yiscale - yk.width()) + yWindowSize;
+            nvDebugCheck(bottom - top <= int(slabHeight));
+
+            const float zcenter = (0.5f + i) * ziscale;
+            const int zleft = (int)floorf(zcenter - zk.width());
+            nvDebugCheck((int)ceilf(zcenter + zk.width()) - zleft <= zWindowSize);
+
+            for (int r = 0; r < bottom - top; r++) {
+                const int y = wrapCoordinate(top + r, srcHeight, ctx->wm);
+
+                for (uint c = 0; c < componentCount; c++) {
+                    memset(slab.scanline(c, r, 0), 0, width * sizeof(float));
+                }
+
+                if (ctx->a >= 0) {
+                    memset(norm.buffer(), 0, width * sizeof(float));
+                    for (int j = 0; j < zWindowSize; j++) {
+                        const int z = wrapCoordinate(zleft + j, srcDepth, ctx->wm);
+                        addAlphaWeightedRows(src, &slab, ctx->a, y, z, r, 0, zk.valueAt(i, j), weight.buffer(), norm.buffer());
+                    }
+                    normalizeAlphaWeightedRows(&slab, ctx->a, r, 0, norm.buffer());
+                }
+                else {
+                    for (int j = 0; j < zWindowSize; j++) {
+                        const int z = wrapCoordinate(zleft + j, srcDepth, ctx->wm);
+                        for (uint c = 0; c < componentCount; c++) {
+                            addScaledLine(slab.scanline(c, r, 0), src->scanline(c, y, z), zk.valueAt(i, j), width);
+                        }
+                    }
+                }
+            }
+
+            for (uint o = firstRow; o < lastRow; o++) {
+                const float center = (0.5f + o) * yiscale;
+                const int left = (int)floorf(center - yk.width());
+                nvDebugCheck((int)ceilf(center + yk.width()) - left <= yWindowSize);
+
+                if (ctx->a >= 0) {
+                    for (uint c = 0; c < componentCount; c++) {
+                        memset(dst->scanline(c, o, i), 0, width * sizeof(float));
+                    }
+                    memset(norm.buffer(), 0, width * sizeof(float));
+                    for (int j = 0; j < yWindowSize; j++) {
+                        addAlphaWeightedRows(&slab, dst, ctx->a, left + j - top, 0, o, i, yk.valueAt(o, j), weight.buffer(), norm.buffer());
+                    }
+                    normalizeAlphaWeightedRows(dst, ctx->a, o, i, norm.buffer());
+                }
+                else {
+                    for (uint c = 0; c < componentCount; c++) {
+                        float * row = stream ? line.buffer() : dst->scanline(c, o, i);
+                        memset(row, 0, width * sizeof(float));
+                        for (int j = 0; j < yWindowSize; j++) {
+                            addScaledLine(row, slab.scanline(c, left + j - top, 0), yk.valueAt(o, j), width);
+                        }
+                        if (stream) streamLine(dst->scanline(c, o, i), row, width);
+                    }
+                }
+            }
+        }
+
+        if (stream) endStreaming();
+    }
+
+    void runApplyKernelZY(ApplyKernelZYContext & context)
+    {
+        const uint width = context.dst->width();
+        const uint height = context.dst->height();
+        const uint depth = context.dst->depth();
+
+        // Bands of about kResizeTaskSize samples per channel, so that the slab of a band stays in cache.
+        context.rowsPerBand = clamp(kResizeTaskSize / width, 1U, height);
+        context.bandCount = (height + context.rowsPerBand - 1) / context.rowsPerBand;
+
+        const uint itemCount = context.bandCount * depth;
+
+        if (width * height * depth < kParallelResizeThreshold) {
+            ApplyKernelZYTask(&context, 0, itemCount);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(ApplyKernelZYTask, &context, itemCount);
+        }
+    }
+}
+
+/// Apply the horizontal kernel to all the rows of channel c. The output must be allocated with the new width.
+void FloatImage::applyKernelX(const PolyphaseKernel & k, uint c, WrapMode wm, FloatImage * output) const
+{
+    nvDebugCheck(output->width() == k.length() && output->height() == m_height && output->depth() == m_depth);
+
+    ApplyKernelContext context = { this, output, &k, c, wm };
+    runApplyKernel(ApplyKernelXTask, context, m_height * m_depth);
+}
+
+/// Apply the vertical kernel to all the columns of channel c. The output must be allocated with the new height.
+void FloatImage::applyKernelY(const PolyphaseKernel & k, uint c, WrapMode wm, FloatImage * output) const
+{
+    nvDebugCheck(output->width() == m_width && output->height() == k.length() && output->depth() == m_depth);
+
+    ApplyKernelContext context = { this, output, &k, c, wm };
+    runApplyKernel(ApplyKernelYTask, context, output->height() * m_depth);
+}
+
+/// Apply the kernel in the z direction to channel c. The output must be allocated with the new depth.
+void FloatImage::applyKernelZ(const PolyphaseKernel & k, uint c, WrapMode wm, FloatImage * output) const
+{
+    nvDebugCheck(output->width() == m_width && output->height() == m_height && output->depth() == k.length());
+
+    ApplyKernelContext context = { this, output, &k, c, wm };
+    runApplyKernel(ApplyKernelZTask, context, m_height * output->depth());
+}
+
+
+/// Apply the horizontal kernel to all the rows of all the channels, weighting the colors by alpha channel a. The output
+/// must be allocated with the new width.
+void FloatImage::applyAlphaWeightedKernelX(const PolyphaseKernel & k, uint a, WrapMode wm, FloatImage * output) const
+{
+    nvDebugCheck(a < m_componentCount && output->componentCount() == m_componentCount);
+    nvDebugCheck(output->width() == k.length() && output->height() == m_height && output->depth() == m_depth);
+
+    ApplyKernelContext context = { this, output, &k, a, wm };
+    runApplyKernel(ApplyAlphaWeightedKernelXTask, context, m_height * m_depth);
+}
+
+/// Apply the vertical kernel to all the columns of all the channels, weighting the colors by alpha channel a. The output
+/// must be allocated with the new height.
+void FloatImage::applyAlphaWeightedKernelY(const PolyphaseKernel & k, uint a, WrapMode wm, FloatImage * output) const
+{
+    nvDebugCheck(a < m_componentCount && output->componentCount() == m_componentCount);
+    nvDebugCheck(output->width() == m_width && output->height() == k.length() && output->depth() == m_depth);
+
+    ApplyKernelContext context = { this, output, &k, a, wm };
+    runApplyKernel(ApplyAlphaWeightedKernelYTask, context, output->height() * m_depth);
+}
+
+/// Apply the kernel in the z direction to all the channels, weighting the colors by alpha channel a. The output must be
+/// allocated with the new depth.
+void FloatImage::applyAlphaWeightedKernelZ(const PolyphaseKernel & k, uint a, WrapMode wm, FloatImage * output) const
+{
+    nvDebugCheck(a < m_componentCount && output->componentCount() == m_componentCount);
+    nvDebugCheck(output->width() == m_width && output->height() == m_height && output->depth() == k.length());
+
+    ApplyKernelContext context = { this, output, &k, a, wm };
+    runApplyKernel(ApplyAlphaWeightedKernelZTask, context, m_height * output->depth());
+}
+
+/// Apply the kernel in the z direction and then the vertical kernel to all the channels. The output must be allocated
+/// with the new height and depth. The result is the same as applyKernelZ followed by applyKernelY for each channel, but
+/// the volume is processed by bands of output rows, without an intermediate volume.
+void FloatImage::applyKernelZY(const PolyphaseKernel & zk, const PolyphaseKernel & yk, WrapMode wm, FloatImage * output) const
+{
+    nvDebugCheck(output->componentCount() == m_componentCount);
+    nvDebugCheck(output->width() == m_width && output->height() == yk.length() && output->depth() == zk.length());
+
+    ApplyKernelZYContext context = { this, output, &zk, &yk, -1, wm, 0, 0 };
+    runApplyKernelZY(context);
+}
 
-        sum += k->valueAt(i) * channel[idx];
-    }
+/// Alpha weighted version of applyKernelZY, the same as applyAlphaWeightedKernelZ followed by applyAlphaWeightedKernelY.
+void FloatImage::applyAlphaWeightedKernelZY(const PolyphaseKernel & zk, const PolyphaseKernel & yk, uint a, WrapMode wm, FloatImage * output) const
+{
+    nvDebugCheck(a < m_componentCount && output->componentCount() == m_componentCount);
+    nvDebugCheck(output->width() == m_width && output->height() == yk.length() && output->depth() == zk.length());
 
-    return sum;
+    ApplyKernelZYContext context = { this, output, &zk, &yk, int(a), wm, 0, 0 };
+    runApplyKernelZY(context);
 }
 
 
@@ -1095,11 +2433,21 @@ void FloatImage::applyKernelX(const PolyphaseKernel & k, int y, int z, uint c, W
         nvDebugCheck(right - left <= windowSize);
 
         float sum = 0;
-        for (int j = 0; j < windowSize; ++j)
-        {
-            const int idx = this->index(left + j, y, z, wm);
+        if (left >= 0 && left + windowSize <= int(m_width)) {
+            // The window does not wrap, skip the address computation.
+            const float * row = channel + index(left, y, z);
+            for (int j = 0; j < windowSize; ++j)
+            {
+                sum += k.valueAt(i, j) * row[j];
+            }
+        }
+        else {
+            for (int j = 0; j < windowSize; ++j)
+            {
+                const int idx = this->index(left + j, y, z, wm);
 
-            sum += k.valueAt(i, j) * channel[idx];
+                sum += k.valueAt(i, j) * channel[idx];
+            }
         }
 
         output[i] = sum;
@@ -1142,7 +2490,7 @@ void FloatImage::applyKernelY(const PolyphaseKernel & k, int x, int z, uint c, W
 void FloatImage::applyKernelZ(const PolyphaseKernel & k, int x, int y, uint c, WrapMode wm, float * __restrict output) const
 {
     const uint length = k.length();
-    const float scale = float(length) / float(m_height);
+    const float scale = float(length) / float(m_depth);
     const float iscale = 1.0f / scale;
 
     const float width = k.width();
@@ -1243,11 +2591,11 @@ void FloatImage::applyKernelY(const PolyphaseKernel & k, int x, int z, uint c, u
     }
 }
 
-/// Apply 1D horizontal kernel at the given coordinates and return result.
+/// Apply 1D kernel in the Z direction at the given coordinates and return result.
 void FloatImage::applyKernelZ(const PolyphaseKernel & k, int x, int y, uint c, uint a, WrapMode wm, float * __restrict output) const
 {
     const uint length = k.length();
-    const float scale = float(length) / float(m_width);
+    const float scale = float(length) / float(m_depth);
     const float iscale = 1.0f / scale;
 
     const float width = k.width();
@@ -1339,47 +2687,480 @@ void FloatImage::flipZ()
 
 
 
-float FloatImage::alphaTestCoverage(float alphaRef, int alphaChannel, float alphaScale/*=1*/) const
+namespace
 {
-    const uint w = m_width;
-    const uint h = m_height;
-
-    float coverage = 0.0f;
+    // Reductions are split in at most this many slices, each slice accumulates its own partial result.
+    const uint kMaxStatisticSlices = 64;
 
-#if 0
-    const float * alpha = channel(alphaChannel);
+    static uint statisticSliceCount(uint count)
+    {
+        return nv::clamp((count + kTexelTaskSize - 1) / kTexelTaskSize, 1U, kMaxStatisticSlices);
+    }
 
-    const uint count = m_pixelCount;
-    for (uint i = 0; i < count; i++) {
-        if (alpha[i] > alphaRef) coverage += 1.0f; // @@ gt or lt?
+    static void runSlices(ForRangeTask * task, void * context, uint sliceCount)
+    {
+        if (sliceCount == 1) {
+            task(context, 0, 1);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(task, context, sliceCount);
+        }
     }
-    
-    return coverage / float(w * h);
-#else
-    const uint n = 8;
 
-    // If we want subsampling:
-    for (uint y = 0; y < h-1; y++) {
-        for (uint x = 0; x < w-1; x++) {
+    // Computes any combination of range, weighted power sum and histogram of one channel in a single pass.
+    struct StatisticsContext
+    {
+        const float * c;
+        const float * a;        // Alpha channel or NULL.
+        uint count;
+        uint sliceSize;         // Multiple of 4.
+
+        bool computeRange;      // With alpha, only texels whose alpha is greater than alphaRef are included.
+        float alphaRef;
+
+        bool computeSum;        // Sum of c^gamma, weighted by alpha when present.
+        float gamma;
+
+        int binCount;           // 0 when no histogram is requested.
+        float binScale;
+        float binBias;
+
+        float minimum[kMaxStatisticSlices];
+        float maximum[kMaxStatisticSlices];
+        double sum[kMaxStatisticSlices];
+        double weight[kMaxStatisticSlices];
+        int * bins;             // binCount bins per slice.
+    };
+
+    static void StatisticsTask(void * context, int begin, int end)
+    {
+        StatisticsContext * ctx = (StatisticsContext *)context;
+
+        for (int s = begin; s < end; s++) {
+            const uint first = uint(s) * ctx->sliceSize;
+            const uint last = min(ctx->count, first + ctx->sliceSize);
+
+            const float * c = ctx->c;
+            const float * a = ctx->a;
+            int * bins = ctx->bins ? ctx->bins + s * ctx->binCount : NULL;
+
+            float minimum = FLT_MAX;
+            float maximum = -FLT_MAX;
+            double sum = 0.0;
+            double weight = 0.0;
+
+            uint i = first;
+#if NV_USE_SSE > 1
+            const __m128 vref = _mm_set1_ps(ctx->alphaRef);
+            const __m128 vfltmax = _mm_set1_ps(FLT_MAX);
+            const __m128 vfltmin = _mm_set1_ps(-FLT_MAX);
+            const SimdVector vgamma(ctx->gamma);
+            const __m128 vscale = _mm_set1_ps(ctx->binScale);
+            const __m128 vbias = _mm_set1_ps(ctx->binBias);
+            const __m128 vlastBin = _mm_set1_ps(float(ctx->binCount - 1));
+
+            __m128 vmin = vfltmax;
+            __m128 vmax = vfltmin;
+
+            while (i + 4 <= last) {
+                // Accumulate blocks in single precision and the block totals in double precision.
+                const uint blockEnd = i + min((last - i) & ~3U, 1024U);
+                __m128 vsum = _mm_setzero_ps();
+                __m128 vweight = _mm_setzero_ps();
+
+                for (; i < blockEnd; i += 4) {
+                    const __m128 x = _mm_loadu_ps(c + i);
+                    const __m128 w = a ? _mm_loadu_ps(a + i) : _mm_setzero_ps();
+
+                    if (ctx->computeRange) {
+                        __m128 lo = x, hi = x;
+                        if (a) {
+                            const __m128 mask = _mm_cmpgt_ps(w, vref);
+                            lo = _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, vfltmax));
+                            hi = _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, vfltmin));
+                        }
+                        // NaNs in the first operand are ignored, like the scalar comparisons below.
+                        vmin = _mm_min_ps(lo, vmin);
+                        vmax = _mm_max_ps(hi, vmax);
+                    }
+                    if (ctx->computeSum) {
+                        __m128 p = (ctx->gamma == 1.0f) ? x : approxPow(SimdVector(x), vgamma).vec;
+                        if (a) {
+                            p = _mm_mul_ps(p, w);
+                            vweight = _mm_add_ps(vweight, w);
+                        }
+                        vsum = _mm_add_ps(vsum, p);
+                    }
+                    if (bins) {
+                        // Clamping before the truncation is the same as flooring and then clamping the index.
+                        __m128 f = _mm_add_ps(_mm_mul_ps(x, vscale), vbias);
+                        f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), vlastBin);
+
+                        NV_ALIGN_16 int idx[4];
+                        _mm_store_si128((__m128i *)idx, _mm_cvttps_epi32(f));
+                        bins[idx[0]]++;
+                        bins[idx[1]]++;
+                        bins[idx[2]]++;
+                        bins[idx[3]]++;
+                    }
+                }
+
+                NV_ALIGN_16 float tmp[4];
+                _mm_store_ps(tmp, vsum);
+                sum += double(tmp[0]) + double(tmp[1]) + double(tmp[2]) + double(tmp[3]);
+                _mm_store_ps(tmp, vweight);
+                weight += double(tmp[0]) + double(tmp[1]) + double(tmp[2]) + double(tmp[3]);
+            }
 
-            float alpha00 = nv::saturate(pixel(alphaChannel, x+0, y+0, 0) * alphaScale);
-            float alpha10 = nv::saturate(pixel(alphaChannel, x+1, y+0, 0) * alphaScale);
-            float alpha01 = nv::saturate(pixel(alphaChannel, x+0, y+1, 0) * alphaScale);
-            float alpha11 = nv::saturate(pixel(alphaChannel, x+1, y+1, 0) * alphaScale);
+            NV_ALIGN_16 float tmp[4];
+            _mm_store_ps(tmp, vmin);
+            for (int k = 0; k < 4; k++) if (tmp[k] < minimum) minimum = tmp[k];
+            _mm_store_ps(tmp, vmax);
+            for (int k = 0; k < 4; k++) if (tmp[k] > maximum) maximum = tmp[k];
+#endif
+            for (; i < last; i++) {
+                const float x = c[i];
 
-            for (float fy = 0.5f/n; fy < 1.0f; fy++) {
-                for (float fx = 0.5f/n; fx < 1.0f; fx++) {
-                    float alpha = alpha00 * (1 - fx) * (1 - fy) + alpha10 * fx * (1 - fy) + alpha01 * (1 - fx) * fy + alpha11 * fx * fy;
-                    if (alpha > alphaRef) coverage += 1.0f;
+                if (ctx->computeRange && (a == NULL || a[i] > ctx->alphaRef)) {
+                    if (x < minimum) minimum = x;
+                    if (x > maximum) maximum = x;
+                }
+                if (ctx->computeSum) {
+                    const float p = (ctx->gamma == 1.0f) ? x : powf(max(0.0f, x), ctx->gamma);
+                    if (a) {
+                        sum += p * a[i];
+                        weight += a[i];
+                    }
+                    else {
+                        sum += p;
+                    }
                 }
+                if (bins) {
+                    int idx = ftoi_floor(x * ctx->binScale + ctx->binBias);
+                    if (idx < 0) idx = 0;
+                    if (idx > ctx->binCount - 1) idx = ctx->binCount - 1;
+                    bins[idx]++;
+                }
+            }
+
+            ctx->minimum[s] = minimum;
+            ctx->maximum[s] = maximum;
+            ctx->sum[s] = sum;
+            ctx->weight[s] = weight;
+        }
+    }
+
+    static void initStatistics(StatisticsContext & ctx, const FloatImage * img, uint c, int alphaChannel)
+    {
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.c = img->channel(c);
+        ctx.a = (alphaChannel >= 0) ? img->channel(alphaChannel) : NULL;
+        ctx.count = img->pixelCount();
+        ctx.gamma = 1.0f;
+    }
+
+    // Runs the statistics pass and leaves the merged results in the first slice.
+    static void computeStatistics(StatisticsContext & ctx, int * bins)
+    {
+        const uint sliceCount = statisticSliceCount(ctx.count);
+        ctx.sliceSize = ((ctx.count + sliceCount - 1) / sliceCount + 3) & ~3U;
+
+        Array<int> sliceBins;
+        if (ctx.binCount > 0) {
+            sliceBins.resize(sliceCount * ctx.binCount, 0);
+            ctx.bins = sliceBins.buffer();
+        }
+
+        runSlices(StatisticsTask, &ctx, sliceCount);
+
+        for (uint s = 1; s < sliceCount; s++) {
+            if (ctx.minimum[s] < ctx.minimum[0]) ctx.minimum[0] = ctx.minimum[s];
+            if (ctx.maximum[s] > ctx.maximum[0]) ctx.maximum[0] = ctx.maximum[s];
+            ctx.sum[0] += ctx.sum[s];
+            ctx.weight[0] += ctx.weight[s];
+        }
+
+        for (uint s = 0; s < sliceCount; s++) {
+            for (int b = 0; b < ctx.binCount; b++) {
+                bins[b] += ctx.bins[s * ctx.binCount + b];
             }
         }
     }
+}
+
+void FloatImage::range(uint c, float * minimum, float * maximum, int alphaChannel/*= -1*/, float alphaRef/*= 0.0f*/) const
+{
+    StatisticsContext ctx;
+    initStatistics(ctx, this, c, alphaChannel);
+    ctx.computeRange = true;
+    ctx.alphaRef = alphaRef;
+
+    computeStatistics(ctx, NULL);
+
+    *minimum = ctx.minimum[0];
+    *maximum = ctx.maximum[0];
+}
+
+/// Adds the texels of channel c to the bins, a texel with value v goes to bin floor((v - rangeMin) * binCount / rangeMax).
+/// Texels outside the bins are added to the first or last one.
+void FloatImage::histogram(uint c, float rangeMin, float rangeMax, int binCount, int * bins) const
+{
+    if (binCount <= 0) return;
+
+    StatisticsContext ctx;
+    initStatistics(ctx, this, c, -1);
+    ctx.binCount = binCount;
+    ctx.binScale = float(binCount) / rangeMax;
+    ctx.binBias = - ctx.binScale * rangeMin;
+
+    computeStatistics(ctx, bins);
+}
+
+/// Average of c^gamma, optionally weighted by alpha, raised to 1/gamma. With SSE2 this uses approxPow.
+float FloatImage::average(uint c, int alphaChannel/*= -1*/, float gamma/*= 1.0f*/) const
+{
+    StatisticsContext ctx;
+    initStatistics(ctx, this, c, alphaChannel);
+    ctx.computeSum = true;
+    ctx.gamma = gamma;
+
+    computeStatistics(ctx, NULL);
+
+    const double denom = (alphaChannel >= 0) ? ctx.weight[0] : double(ctx.count);
+
+    // Avoid division by zero.
+    if (denom == 0.0) return 0.0f;
+
+    return powf(float(ctx.sum[0] / denom), 1.0f / gamma);
+}
+
+
+namespace
+{
+    // The coverage is measured on a single sample of the bilinear interpolation of every 2x2 quad of texels.
+    const float kCoverageSampleOffset = 0.5f / 8;
+
+    struct CoverageContext
+    {
+        const float * alpha;
+        uint width;
+        uint rowCount;          // Rows of quads.
+        uint rowsPerSlice;
+        float alphaRef;
+        float alphaScale;
+
+        uint64 count[kMaxStatisticSlices];
+    };
 
-    return coverage / float(w * h * n * n);
+    static void CoverageTask(void * context, int begin, int end)
+    {
+        CoverageContext * ctx = (CoverageContext *)context;
+
+        const uint w = ctx->width;
+        const float fx = kCoverageSampleOffset;
+        const float fy = kCoverageSampleOffset;
+        const float alphaScale = ctx->alphaScale;
+        const float alphaRef = ctx->alphaRef;
+
+        for (int s = begin; s < end; s++) {
+            const uint firstRow = uint(s) * ctx->rowsPerSlice;
+            const uint lastRow = min(ctx->rowCount, firstRow + ctx->rowsPerSlice);
+
+            uint64 count = 0;
+
+            for (uint y = firstRow; y < lastRow; y++) {
+                const float * row0 = ctx->alpha + y * w;
+                const float * row1 = row0 + w;
+
+                uint x = 0;
+#if NV_USE_SSE > 1
+                // Same operations in the same order as the scalar loop, so the counts are identical.
+                const __m128 vscale = _mm_set1_ps(alphaScale);
+                const __m128 vref = _mm_set1_ps(alphaRef);
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 one = _mm_set1_ps(1.0f);
+                const __m128 vfx = _mm_set1_ps(fx);
+                const __m128 vfy = _mm_set1_ps(fy);
+                const __m128 v1fx = _mm_set1_ps(1 - fx);
+                const __m128 v1fy = _mm_set1_ps(1 - fy);
+
+                for (; x + 4 < w; x += 4) {
+                    const __m128 a00 = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(row0 + x), vscale), zero), one);
+                    const __m128 a10 = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(row0 + x + 1), vscale), zero), one);
+                    const __m128 a01 = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(row1 + x), vscale), zero), one);
+                    const __m128 a11 = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(row1 + x + 1), vscale), zero), one);
+
+                    __m128 alpha = _mm_mul_ps(_mm_mul_ps(a00, v1fx), v1fy);
+                    alpha = _mm_add_ps(alpha, _mm_mul_ps(_mm_mul_ps(a10, vfx), v1fy));
+                    alpha = _mm_add_ps(alpha, _mm_mul_ps(_mm_mul_ps(a01, v1fx), vfy));
+                    alpha = _mm_add_ps(alpha, _mm_mul_ps(_mm_mul_ps(a11, vfx), vfy));
+
+                    const int mask = _mm_movemask_ps(_mm_cmpgt_ps(alpha, vref));
+                    count += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+                }
 #endif
+                for (; x < w - 1; x++) {
+                    const float alpha00 = nv::saturate(row0[x + 0] * alphaScale);
+                    const float alpha10 = nv::saturate(row0[x + 1] * alphaScale);
+                    const float alpha01 = nv::saturate(row1[x + 0] * alphaScale);
+                    const float alpha11 = nv::saturate(row1[x + 1] * alphaScale);
+
+                    const float alpha = alpha00 * (1 - fx) * (1 - fy) + alpha10 * fx * (1 - fy) + alpha01 * (1 - fx) * fy + alpha11 * fx * fy;
+                    if (alpha > alphaRef) count++;
+                }
+            }
+
+            ctx->count[s] = count;
+        }
+    }
+
+    // Smallest alpha scale at which the coverage sample of the quad passes the alpha test, or FLT_MAX if it never does.
+    // The sample is a sum of clamped linear terms, so it is piecewise linear and non decreasing in the scale.
+    static float coverageThreshold(float a00, float a10, float a01, float a11, float alphaRef)
+    {
+        const float fx = kCoverageSampleOffset;
+        const float fy = kCoverageSampleOffset;
+
+        if (alphaRef < 0.0f) return 0.0f;
+
+        float alpha[4] = { a00, a10, a01, a11 };
+        float weight[4] = { (1 - fx) * (1 - fy), fx * (1 - fy), (1 - fx) * fy, fx * fy };
+        int order[4];
+        int count = 0;
+
+        float slope = 0.0f;
+        for (int i = 0; i < 4; i++) {
+            if (alpha[i] > 0.0f) {
+                // Insertion sort by decreasing alpha, that is, by increasing scale 1/alpha at which the term saturates.
+                int j = count++;
+                while (j > 0 && alpha[order[j - 1]] < alpha[i]) {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = i;
+                slope += weight[i] * alpha[i];
+            }
+        }
+
+        float base = 0.0f;
+        for (int k = 0; k < count; k++) {
+            const int i = order[k];
+            // base + slope / alpha > alphaRef, without the division.
+            if (base * alpha[i] + slope > alphaRef * alpha[i]) {
+                return (alphaRef - base) / slope;
+            }
+            base += weight[i];
+            slope -= weight[i] * alpha[i];
+        }
+
+        return FLT_MAX;
+    }
+
+    // Thresholds are binned in [0, kMaxCoverageScale).
+    const float kMaxCoverageScale = 4.0f;
+    const int kCoverageBinCount = 4096;
+
+    struct CoverageHistogramContext
+    {
+        const float * alpha;
+        uint width;
+        uint rowCount;
+        uint rowsPerSlice;
+        float alphaRef;
+
+        uint * bins;            // kCoverageBinCount bins per slice.
+    };
+
+    // Bin the thresholds of the quads of rows y and y + 1, for y in [firstRow, lastRow).
+    static void addCoverageThresholds(const float * alpha, uint w, uint firstRow, uint lastRow, float alphaRef, uint * bins)
+    {
+        const float binScale = kCoverageBinCount / kMaxCoverageScale;
+
+        for (uint y = firstRow; y < lastRow; y++) {
+            const float * row0 = alpha + y * w;
+            const float * row1 = row0 + w;
+
+            for (uint x = 0; x < w - 1; x++) {
+                const float t = coverageThreshold(row0[x], row0[x + 1], row1[x], row1[x + 1], alphaRef);
+                if (t < kMaxCoverageScale) {
+                    bins[min(int(t * binScale), kCoverageBinCount - 1)]++;
+                }
+            }
+        }
+    }
+
+    static void CoverageHistogramTask(void * context, int begin, int end)
+    {
+        CoverageHistogramContext * ctx = (CoverageHistogramContext *)context;
+
+        for (int s = begin; s < end; s++) {
+            const uint firstRow = uint(s) * ctx->rowsPerSlice;
+            const uint lastRow = min(ctx->rowCount, firstRow + ctx->rowsPerSlice);
+            addCoverageThresholds(ctx->alpha, ctx->width, firstRow, lastRow, ctx->alphaRef, ctx->bins + s * kCoverageBinCount);
+        }
+    }
+
+    // Scale at which the alpha test coverage of an image of w x h texels with the given histograms, one per slice, reaches
+    // the desired coverage. The histogram of the first slice receives the total.
+    static float coverageScale(uint * bins, uint sliceCount, float desiredCoverage, uint w, uint h)
+    {
+        const uint n = 8;
+
+        for (uint s = 1; s < sliceCount; s++) {
+            for (int b = 0; b < kCoverageBinCount; b++) {
+                bins[b] += bins[s * kCoverageBinCount + b];
+            }
+        }
+
+        // Find the bin where the number of passing samples reaches the desired count and interpolate inside it.
+        const double desiredCount = double(desiredCoverage) * double(w * h * n * n);
+        const float binSize = kMaxCoverageScale / kCoverageBinCount;
+
+        double total = 0.0;
+        for (int b = 0; b < kCoverageBinCount; b++) {
+            if (bins[b] != 0 && total + bins[b] >= desiredCount) {
+                const double t = max(0.0, desiredCount - total) / bins[b];
+                return (float(b) + float(t)) * binSize;
+            }
+            total += bins[b];
+        }
+
+        return kMaxCoverageScale;
+    }
+}
+
+/// Fraction of the image that passes the alpha test after the alpha is scaled by alphaScale. Only the first slice of 3D images is considered.
+float FloatImage::alphaTestCoverage(float alphaRef, int alphaChannel, float alphaScale/*=1*/) const
+{
+    const uint w = m_width;
+    const uint h = m_height;
+    const uint n = 8;
+
+    if (w < 2 || h < 2) return 0.0f;
+
+    CoverageContext ctx;
+    ctx.alpha = plane(alphaChannel, 0);
+    ctx.width = w;
+    ctx.rowCount = h - 1;
+    ctx.alphaRef = alphaRef;
+    ctx.alphaScale = alphaScale;
+
+    const uint sliceCount = statisticSliceCount(ctx.rowCount * w);
+    ctx.rowsPerSlice = (ctx.rowCount + sliceCount - 1) / sliceCount;
+
+    runSlices(CoverageTask, &ctx, sliceCount);
+
+    uint64 coverage = 0;
+    for (uint s = 0; s < sliceCount; s++) {
+        coverage += ctx.count[s];
+    }
+
+    return float(coverage) / float(w * h * n * n);
 }
 
+/// Scales the alpha channel so that its alphaTestCoverage matches the desired coverage. Instead of searching the scale, the
+/// scale at which every quad starts to pass the test is computed analytically and binned, and the scale is read back from the
+/// cumulative histogram.
 void FloatImage::scaleAlphaToCoverage(float desiredCoverage, float alphaRef, int alphaChannel)
 {
 #if 0
@@ -1410,26 +3191,27 @@ void FloatImage::scaleAlphaToCoverage(float desiredCoverage, float alphaRef, int
     scaleBias(alphaChannel, 1, alphaScale, 0.0f);
     clamp(alphaChannel, 1, 0.0f, 1.0f); 
 #else
-    float minAlphaScale = 0.0f;
-    float maxAlphaScale = 4.0f;
-    float alphaScale = 1.0f;
+    const uint w = m_width;
+    const uint h = m_height;
 
-    // Determine desired scale using a binary search. Hardcoded to 8 steps max.
-    for (int i = 0; i < 10; i++) {
-        float currentCoverage = alphaTestCoverage(alphaRef, alphaChannel, alphaScale);
+    if (w < 2 || h < 2) return;
 
-        if (currentCoverage < desiredCoverage) {
-            minAlphaScale = alphaScale;
-        }
-        else if (currentCoverage > desiredCoverage) {
-            maxAlphaScale = alphaScale;
-        }
-        else {
-            break;
-        }
+    CoverageHistogramContext ctx;
+    ctx.alpha = plane(alphaChannel, 0);
+    ctx.width = w;
+    ctx.rowCount = h - 1;
+    ctx.alphaRef = alphaRef;
 
-        alphaScale = (minAlphaScale + maxAlphaScale) * 0.5f;
-    }
+    const uint sliceCount = statisticSliceCount(ctx.rowCount * w);
+    ctx.rowsPerSlice = (ctx.rowCount + sliceCount - 1) / sliceCount;
+
+    Array<uint> bins;
+    bins.resize(sliceCount * kCoverageBinCount, 0);
+    ctx.bins = bins.buffer();
+
+    runSlices(CoverageHistogramTask, &ctx, sliceCount);
+
+    const float alphaScale = coverageScale(bins.buffer(), sliceCount, desiredCoverage, w, h);
 
     // Scale alpha channel.
     scaleBias(alphaChannel, 1, alphaScale, 0.0f);
@@ -1440,12 +3222,237 @@ void FloatImage::scaleAlphaToCoverage(float desiredCoverage, float alphaRef, int
 #endif
 }
 
+
+namespace
+{
+    // fastDownSample that also does the passes that usually follow it, on the rows it has just read or written while they
+    // are in the cache: it exponentiates the rows of the source image and bins the coverage thresholds of the result.
+    struct FastDownSampleFusedContext
+    {
+        FloatImage * src;
+        FloatImage * dst;
+        uint rowsPerTask;
+
+        uint baseComponent;     // Channels of src exponentiated, none when num is 0.
+        uint num;
+        float power;
+        bool approximate;       // Exponentiate with approxPow.
+
+        const float * alpha;    // Alpha channel of dst to histogram, or NULL.
+        float alphaRef;
+        uint * bins;            // kCoverageBinCount bins per task.
+
+        bool normalize;         // Renormalize the normals in channels 0 to 2 of dst.
+        float toksvigPower;
+        FloatImage * toksvig;   // Toksvig map of dst before it's normalized, or NULL.
+    };
+
+    void exponentiateRows(const FastDownSampleFusedContext & ctx, uint begin, uint end)
+    {
+        const uint w = ctx.src->width();
+
+        for (uint c = 0; c < ctx.num; c++) {
+            exponentiateRange(ctx.src->channel(ctx.baseComponent + c), begin * w, end * w, ctx.power, ctx.approximate);
+        }
+    }
+
+    // Each task computes rowsPerTask rows of the result, then exponentiates the source rows that no other task reads and
+    // bins the quads of its own rows. The source rows and the quads shared with the next task are left to the caller.
+    void FastDownSampleFusedTask(void * context, int begin, int end)
+    {
+        const FastDownSampleFusedContext * ctx = (const FastDownSampleFusedContext *)context;
+        const uint h = ctx->dst->height();
+
+        for (int t = begin; t < end; t++) {
+            const uint first = uint(t) * ctx->rowsPerTask;
+            const uint last = min(h, first + ctx->rowsPerTask);
+
+            for (uint y = first; y < last; y++) {
+                fastDownSampleRow(ctx->src, ctx->dst, y);
+
+                // The normals of the row while it's in cache.
+                const uint w = ctx->dst->width();
+                if (ctx->toksvig != NULL) {
+                    toksvigRange(ctx->dst, 0, ctx->toksvigPower, ctx->toksvig, y * w, (y + 1) * w);
+                }
+                if (ctx->normalize) {
+                    normalizeRange(ctx->dst, 0, y * w, (y + 1) * w);
+                }
+            }
+
+            if (ctx->num > 0) {
+                const uint rowBegin = (first == 0) ? 0 : fastDownSampleRowsNeeded(ctx->src, first - 1);
+                const uint rowEnd = (last == h) ? ctx->src->height() : fastDownSampleFirstRow(ctx->src, last);
+                if (rowBegin < rowEnd) {
+                    exponentiateRows(*ctx, rowBegin, rowEnd);
+                }
+            }
+
+            if (ctx->alpha != NULL) {
+                addCoverageThresholds(ctx->alpha, ctx->dst->width(), first, last - 1, ctx->alphaRef, ctx->bins + t * kCoverageBinCount);
+            }
+        }
+    }
+
+    FloatImage * fastDownSampleFused(FastDownSampleFusedContext & context)
+    {
+        const FloatImage * src = context.src;
+        const uint w = context.dst->width();
+        const uint h = context.dst->height();
+        const uint taskCount = (h + context.rowsPerTask - 1) / context.rowsPerTask;
+
+        if (w * h < kParallelDownSampleThreshold) {
+            FastDownSampleFusedTask(&context, 0, taskCount);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(FastDownSampleFusedTask, &context, taskCount, 1);
+        }
+
+        for (uint t = 1; t < taskCount; t++) {
+            const uint y = t * context.rowsPerTask;
+
+            // Source rows read by two tasks.
+            if (context.num > 0) {
+                const uint rowBegin = fastDownSampleFirstRow(src, y);
+                const uint rowEnd = fastDownSampleRowsNeeded(src, y - 1);
+                if (rowBegin < rowEnd) {
+                    exponentiateRows(context, rowBegin, rowEnd);
+                }
+            }
+
+            // The quads between two tasks.
+            if (context.alpha != NULL) {
+                addCoverageThresholds(context.alpha, w, y - 1, y, context.alphaRef, context.bins);
+            }
+        }
+
+        return context.dst;
+    }
+}
+
+/// Same as fastDownSample followed by exponentiate(baseComponent, num, power, approximate), in a single pass over the image: the rows
+/// of this image are exponentiated as soon as the rows of the result that read them are done, while they are still in the
+/// cache. The results are identical.
+FloatImage * FloatImage::fastDownSampleExponentiate(uint baseComponent, uint num, float power, bool approximate/*= false*/)
+{
+    return fastDownSampleToCoverage(-1.0f, 0.0f, 0, baseComponent, num, power, approximate);
+}
+
+namespace
+{
+    // Run the fused downsample into context.dst, with the alpha of the result scaled to the coverage when it's not negative.
+    void fastDownSampleToCoverage(FastDownSampleFusedContext & context, float coverage, float alphaRef, int alphaChannel)
+    {
+        FloatImage * dst_image = context.dst;
+        const uint w = dst_image->width();
+        const uint h = dst_image->height();
+
+        // The coverage of images narrower than a quad is not defined, scaleAlphaToCoverage leaves them alone.
+        const bool scaleAlpha = coverage >= 0.0f && w >= 2 && h >= 2;
+
+        context.rowsPerTask = kDownSampleRowsPerTask;
+        context.alpha = scaleAlpha ? dst_image->channel(alphaChannel) : NULL;
+        context.alphaRef = alphaRef;
+        context.bins = NULL;
+
+        Array<uint> bins;
+        uint taskCount = 0;
+        if (scaleAlpha) {
+            // Fewer, larger tasks, each one has its own histogram.
+            context.rowsPerTask = max(kDownSampleRowsPerTask, (h + kMaxStatisticSlices - 1) / kMaxStatisticSlices);
+            taskCount = (h + context.rowsPerTask - 1) / context.rowsPerTask;
+            bins.resize(taskCount * kCoverageBinCount, 0);
+            context.bins = bins.buffer();
+        }
+
+        fastDownSampleFused(context);
+
+        if (scaleAlpha) {
+            const float alphaScale = coverageScale(bins.buffer(), taskCount, coverage, w, h);
+
+            dst_image->scaleBias(alphaChannel, 1, alphaScale, 0.0f);
+            dst_image->clamp(alphaChannel, 1, 0.0f, 1.0f);
+        }
+    }
+}
+
+/// Same as fastDownSample followed by scaleAlphaToCoverage(coverage, alphaRef, alphaChannel) of the result, when coverage
+/// is not negative, and by exponentiate(baseComponent, num, power, approximate) of this image. The coverage thresholds of the result
+/// are binned as its rows are computed, only the scaling of its alpha channel is a separate pass. The results are identical.
+FloatImage * FloatImage::fastDownSampleToCoverage(float coverage, float alphaRef, int alphaChannel, uint baseComponent/*= 0*/, uint num/*= 0*/, float power/*= 1*/, bool approximate/*= false*/)
+{
+    nvDebugCheck(m_depth == 1);
+    nvDebugCheck(m_width != 1 || m_height != 1);
+
+    AutoPtr<FloatImage> dst_image( new FloatImage() );
+
+    const uint w = max(1, m_width / 2);
+    const uint h = max(1, m_height / 2);
+    dst_image->allocate(m_componentCount, w, h);
+
+    FastDownSampleFusedContext context;
+    context.src = this;
+    context.dst = dst_image.ptr();
+    context.baseComponent = baseComponent;
+    context.num = num;
+    context.power = power;
+    context.approximate = approximate;
+    context.normalize = false;
+    context.toksvigPower = 0.0f;
+    context.toksvig = NULL;
+
+    ::fastDownSampleToCoverage(context, coverage, alphaRef, alphaChannel);
+
+    return dst_image.release();
+}
+
+/// Same as fastDownSampleToCoverage(coverage, alphaRef, alphaChannel), followed by createToksvigMap(0, power) of the
+/// result into toksvig when it's not NULL and by normalize(0) of the result when normalize is set. The normals of each
+/// row are processed as soon as it's filtered, while it's still in the cache. The results are identical.
+FloatImage * FloatImage::fastDownSampleNormals(float coverage, float alphaRef, int alphaChannel, bool normalize, float power, FloatImage ** toksvig) const
+{
+    nvDebugCheck(m_depth == 1);
+    nvDebugCheck(m_width != 1 || m_height != 1);
+    nvDebugCheck(m_componentCount >= 3);
+
+    AutoPtr<FloatImage> dst_image( new FloatImage() );
+    AutoPtr<FloatImage> toksvig_image;
+
+    const uint w = max(1, m_width / 2);
+    const uint h = max(1, m_height / 2);
+    dst_image->allocate(m_componentCount, w, h);
+
+    if (toksvig != NULL) {
+        toksvig_image = new FloatImage();
+        toksvig_image->allocate(4, w, h);
+    }
+
+    FastDownSampleFusedContext context;
+    context.src = const_cast<FloatImage *>(this);   // Only read, there are no channels to exponentiate.
+    context.dst = dst_image.ptr();
+    context.baseComponent = 0;
+    context.num = 0;
+    context.power = 1.0f;
+    context.approximate = false;
+    context.normalize = normalize;
+    context.toksvigPower = power;
+    context.toksvig = toksvig_image.ptr();
+
+    ::fastDownSampleToCoverage(context, coverage, alphaRef, alphaChannel);
+
+    if (toksvig != NULL) {
+        *toksvig = toksvig_image.release();
+    }
+
+    return dst_image.release();
+}
+
 FloatImage* FloatImage::clone() const
 {
     FloatImage* copy = new FloatImage();
 
     copy->allocate(m_componentCount, m_width, m_height, m_depth);
-    memcpy(copy->m_mem, m_mem, m_floatCount * sizeof(float));
+    memcpy(copy->m_mem, m_mem, size_t(m_floatCount * sizeof(float)));
 
     return copy;
 }
@@ -50,6 +50,14 @@ namespace nv
         NVIMAGE_API void allocate(uint c, uint w, uint h, uint d = 1);
         NVIMAGE_API void free(); // Does not clear members.
         NVIMAGE_API void resizeChannelCount(uint c);
+
+        // Use memory owned by the caller as the channels, laid out as in an allocated image. It is never freed, and allocate or
+        // resizeChannelCount move the image to memory of its own.
+        NVIMAGE_API void wrap(float * mem, uint c, uint w, uint h, uint d = 1);
+        bool isExternal() const { return m_external; }
+
+        // Images of at least threshold bytes are stored in a memory mapped scratch file instead of the heap. A threshold of 0 disables it.
+        NVIMAGE_API static void setScratchFile(const char * directory, uint64 threshold);
         //@}
 
         /** @name Manipulation. */
@@ -59,6 +67,7 @@ namespace nv
         NVIMAGE_API void copyChannel(uint src, uint dst);
 
         NVIMAGE_API void normalize(uint base_component);
+        NVIMAGE_API FloatImage * createToksvigMap(uint base_component, float power) const;
 
         NVIMAGE_API void packNormals(uint base_component);
         NVIMAGE_API void expandNormals(uint base_component);
@@ -68,12 +77,17 @@ namespace nv
 
         NVIMAGE_API void toLinear(uint base_component, uint num, float gamma = 2.2f);
         NVIMAGE_API void toGamma(uint base_component, uint num, float gamma = 2.2f);
-        NVIMAGE_API void exponentiate(uint base_component, uint num, float power);
+        NVIMAGE_API void exponentiate(uint base_component, uint num, float power, bool approximate = false);
 
         NVIMAGE_API void transform(uint base_component, const Matrix & m, const Vector4 & offset);
         NVIMAGE_API void swizzle(uint base_component, uint r, uint g, uint b, uint a);
 
         NVIMAGE_API FloatImage * fastDownSample() const;
+        NVIMAGE_API FloatImage * fastDownSampleExponentiate(uint base_component, uint num, float power, bool approximate = false);
+        NVIMAGE_API FloatImage * fastDownSampleToCoverage(float coverage, float alphaRef, int alphaChannel, uint base_component = 0, uint num = 0, float power = 1.0f, bool approximate = false);
+        NVIMAGE_API FloatImage * fastDownSampleNormals(float coverage, float alphaRef, int alphaChannel, bool normalize, float power, FloatImage ** toksvig) const;
+        NVIMAGE_API void fastDownSampleChain(uint count, FloatImage ** levels) const;
+        NVIMAGE_API void fastDownSampleRegion(FloatImage * dst, uint x0, uint y0, uint x1, uint y1) const;
         NVIMAGE_API FloatImage * downSample(const Filter & filter, WrapMode wm) const;
         NVIMAGE_API FloatImage * downSample(const Filter & filter, WrapMode wm, uint alpha) const;
         NVIMAGE_API FloatImage * resize(const Filter & filter, uint w, uint h, WrapMode wm) const;
@@ -98,20 +112,41 @@ namespace nv
         NVIMAGE_API void applyKernelY(const PolyphaseKernel & k, int x, int z, uint c, uint a, WrapMode wm, float * output) const;
         NVIMAGE_API void applyKernelZ(const PolyphaseKernel & k, int x, int y, uint c, uint a, WrapMode wm, float * output) const;
 
+        // Apply the kernel along one axis to channel c and store the result in the same channel of the output image. Large images are processed in parallel.
+        NVIMAGE_API void applyKernelX(const PolyphaseKernel & k, uint c, WrapMode wm, FloatImage * output) const;
+        NVIMAGE_API void applyKernelY(const PolyphaseKernel & k, uint c, WrapMode wm, FloatImage * output) const;
+        NVIMAGE_API void applyKernelZ(const PolyphaseKernel & k, uint c, WrapMode wm, FloatImage * output) const;
+
+        // Apply the kernel along one axis to all the channels in a single pass, weighting the colors by the alpha channel a.
+        NVIMAGE_API void applyAlphaWeightedKernelX(const PolyphaseKernel & k, uint a, WrapMode wm, FloatImage * output) const;
+        NVIMAGE_API void applyAlphaWeightedKernelY(const PolyphaseKernel & k, uint a, WrapMode wm, FloatImage * output) const;
+        NVIMAGE_API void applyAlphaWeightedKernelZ(const PolyphaseKernel & k, uint a, WrapMode wm, FloatImage * output) const;
+
+        // Apply the z kernel and then the vertical kernel to all the channels, by bands of output rows in parallel.
+        NVIMAGE_API void applyKernelZY(const PolyphaseKernel & zk, const PolyphaseKernel & yk, WrapMode wm, FloatImage * output) const;
+        NVIMAGE_API void applyAlphaWeightedKernelZY(const PolyphaseKernel & zk, const PolyphaseKernel & yk, uint a, WrapMode wm, FloatImage * output) const;
+
 
         NVIMAGE_API void flipX();
         NVIMAGE_API void flipY();
         NVIMAGE_API void flipZ();
 
+        /** @name Statistics. Large images are reduced in parallel. */
+        //@{
+        NVIMAGE_API void range(uint c, float * minimum, float * maximum, int alphaChannel = -1, float alphaRef = 0.0f) const;
+        NVIMAGE_API void histogram(uint c, float rangeMin, float rangeMax, int binCount, int * bins) const;
+        NVIMAGE_API float average(uint c, int alphaChannel = -1, float gamma = 1.0f) const;
+
         NVIMAGE_API float alphaTestCoverage(float alphaRef, int alphaChannel, float alphaScale = 1.0f) const;
         NVIMAGE_API void scaleAlphaToCoverage(float coverage, float alphaRef, int alphaChannel);
+        //@}
 
 
         uint width() const { return m_width; }
         uint height() const { return m_height; }
         uint depth() const { return m_depth; }
         uint componentCount() const { return m_componentCount; }
-        uint floatCount() const { return m_floatCount; }
+        uint64 floatCount() const { return m_floatCount; }
         uint pixelCount() const { return m_pixelCount; }
 
 
@@ -126,6 +161,14 @@ namespace nv
         const float * scanline(uint c, uint y, uint z) const;
         float * scanline(uint c, uint y, uint z);
 
+        // Allocated images start on a cache line. The channels do too when the pixel count is a multiple of 16, as in the
+        // power of two images of at least 4x4 texels, and so do the rows when the width also is, so SIMD code can use aligned
+        // loads on them. The channels are not padded, they stay back to back as Surface::data exposes them.
+        bool hasAlignedChannels() const;
+        bool hasAlignedRows() const;
+        const float * alignedScanline(uint c, uint y, uint z = 0) const;
+        float * alignedScanline(uint c, uint y, uint z = 0);
+
         //float pixel(uint c, uint x, uint y) const;
         //float & pixel(uint c, uint x, uint y);
 
@@ -182,8 +225,10 @@ namespace nv
         uint16 m_height;
         uint16 m_depth;
         uint32 m_pixelCount;
-        uint32 m_floatCount;
+        uint64 m_floatCount;
         float * m_mem;
+        bool m_mapped;  // m_mem lives in a scratch file.
+        bool m_external;  // m_mem is owned by the caller, see wrap.
 
     };
 
@@ -227,6 +272,30 @@ namespace nv
         return plane(c, z) + y * m_width;
     }
 
+    inline bool FloatImage::hasAlignedChannels() const
+    {
+        return m_mem != NULL && (size_t(m_mem) & 63) == 0 && (m_pixelCount & 15) == 0;
+    }
+
+    inline bool FloatImage::hasAlignedRows() const
+    {
+        return hasAlignedChannels() && (m_width & 15) == 0;
+    }
+
+    /// Get a scanline pointer, for images with aligned rows.
+    inline const float * FloatImage::alignedScanline(uint c, uint y, uint z) const
+    {
+        nvDebugCheck(hasAlignedRows());
+        return scanline(c, y, z);
+    }
+
+    /// Get a scanline pointer, for images with aligned rows.
+    inline float * FloatImage::alignedScanline(uint c, uint y, uint z)
+    {
+        nvDebugCheck(hasAlignedRows());
+        return scanline(c, y, z);
+    }
+
     /// Get pixel component.
     inline float FloatImage::pixel(uint c, uint x, uint y, uint z) const
     {
@@ -9,7 +9,11 @@
 #include "nvcore/Ptr.h"
 #include "nvcore/Utils.h" // swap
 #include "nvcore/Memory.h" // realloc, free
+#include "nvcore/Array.inl"
 
+#include "nvthread/TaskScheduler.h"
+
+#include <math.h> // powf
 #include <string.h> // memcpy
 
 
@@ -142,7 +146,7 @@ void Image::unwrap()
 
 void Image::free()
 {
-    ::free(m_data);
+    nv::free(m_data);
     m_data = NULL;
 }
 
@@ -216,3 +220,221 @@ void Image::fill(Color32 c)
     }
 }
 
+
+
+namespace
+{
+    // Rows of a fastDownSample computed by each task, and the number of texels below which it runs on the calling thread.
+    const uint kDownSampleRowsPerTask = 16;
+    const uint kParallelDownSampleThreshold = 64 * 1024;
+
+    // Texels of one axis of the source image averaged by texel i of the half size image, and their weights. Odd sizes use
+    // the polyphase weights of FloatImage::fastDownSample, that add up to the size of the source.
+    struct BoxTaps
+    {
+        BoxTaps(uint size, uint i)
+        {
+            first = (size == 1) ? 0 : 2 * i;
+            weight[0] = weight[1] = weight[2] = 1;
+
+            if (size == 1) {
+                count = 1;
+                sum = 1;
+            }
+            else if ((size & 1) == 0) {
+                count = 2;
+                sum = 2;
+            }
+            else {
+                const uint n = size / 2;
+                count = 3;
+                sum = size;
+                weight[0] = n - i;
+                weight[1] = n;
+                weight[2] = 1 + i;
+            }
+        }
+
+        uint first, count, sum;
+        uint weight[3];
+    };
+
+    // Encodes linear values to the closest 8 bit color, the number of thresholds below the value. A table indexed by the
+    // exponent and the top mantissa bits of the value has the color at the start of each range of values, the ranges are
+    // narrower than the distance between two thresholds when gamma is at least 1, so one comparison does the rest.
+    struct LinearEncoder
+    {
+        static const uint kShift = 15;
+
+        explicit LinearEncoder(float gamma)
+        {
+            for (uint i = 0; i < 255; i++) {
+                thresholds[i] = powf((float(i) + 0.5f) / 255.0f, gamma);
+            }
+
+            firstRange = bits(thresholds[0]) >> kShift;
+            const uint rangeCount = (bits(1.0f) >> kShift) - firstRange + 1;
+            colors.resize(rangeCount);
+
+            uint c = 0;
+            for (uint i = 0; i < rangeCount; i++) {
+                const uint32 start = (firstRange + i) << kShift;
+                while (c < 255 && bits(thresholds[c]) <= start) c++;
+                colors[i] = uint8(c);
+            }
+        }
+
+        uint8 encode(float v) const
+        {
+            const int range = int(bits(v) >> kShift) - int(firstRange);
+            if (range < 0) return 0;
+
+            uint c = colors[min(range, int(colors.count()) - 1)];
+            while (c < 255 && thresholds[c] <= v) c++;
+            return uint8(c);
+        }
+
+        // Bits of a non negative float, that sort like their values.
+        static uint32 bits(float f)
+        {
+            union { float f; uint32 u; } x = { f };
+            return x.u;
+        }
+
+        float thresholds[255];      // Linear value halfway between each 8 bit color and the next one.
+        uint32 firstRange;
+        Array<uint8> colors;
+    };
+
+    struct DownSampleContext
+    {
+        const Image * src;
+        Image * dst;
+        const float * linear;       // Linear value of each 8 bit color, NULL when the colors are averaged as they are.
+        const LinearEncoder * encoder;
+    };
+
+    void downSampleRow(const DownSampleContext & ctx, uint y)
+    {
+        const Image * src = ctx.src;
+        const uint w = ctx.dst->width();
+        Color32 * dst = ctx.dst->scanline(y);
+
+        const BoxTaps ty(src->height(), y);
+
+        // Regular box filter.
+        if (ty.count == 2 && (src->width() & 1) == 0)
+        {
+            const Color32 * r0 = src->scanline(ty.first);
+            const Color32 * r1 = src->scanline(ty.first + 1);
+            const float * linear = ctx.linear;
+
+            for (uint x = 0; x < w; x++)
+            {
+                const Color32 a = r0[2 * x], b = r0[2 * x + 1], c = r1[2 * x], d = r1[2 * x + 1];
+                if (linear != NULL) {
+                    dst[x].r = ctx.encoder->encode(0.25f * (linear[a.r] + linear[b.r] + linear[c.r] + linear[d.r]));
+                    dst[x].g = ctx.encoder->encode(0.25f * (linear[a.g] + linear[b.g] + linear[c.g] + linear[d.g]));
+                    dst[x].b = ctx.encoder->encode(0.25f * (linear[a.b] + linear[b.b] + linear[c.b] + linear[d.b]));
+                }
+                else {
+                    dst[x].r = uint8((uint(a.r) + b.r + c.r + d.r + 2) >> 2);
+                    dst[x].g = uint8((uint(a.g) + b.g + c.g + d.g + 2) >> 2);
+                    dst[x].b = uint8((uint(a.b) + b.b + c.b + d.b + 2) >> 2);
+                }
+                dst[x].a = uint8((uint(a.a) + b.a + c.a + d.a + 2) >> 2);
+            }
+            return;
+        }
+
+        // Polyphase filters, and colors averaged in linear space.
+        for (uint x = 0; x < w; x++)
+        {
+            const BoxTaps tx(src->width(), x);
+            const uint64 total = uint64(tx.sum) * ty.sum;
+
+            uint64 sum[4] = { 0, 0, 0, 0 };
+            float linearSum[3] = { 0.0f, 0.0f, 0.0f };
+
+            for (uint j = 0; j < ty.count; j++)
+            {
+                const Color32 * row = src->scanline(ty.first + j) + tx.first;
+
+                for (uint i = 0; i < tx.count; i++)
+                {
+                    const uint weight = ty.weight[j] * tx.weight[i];
+                    const Color32 c = row[i];
+
+                    if (ctx.linear != NULL) {
+                        linearSum[0] += float(weight) * ctx.linear[c.r];
+                        linearSum[1] += float(weight) * ctx.linear[c.g];
+                        linearSum[2] += float(weight) * ctx.linear[c.b];
+                    }
+                    else {
+                        sum[0] += uint64(weight) * c.r;
+                        sum[1] += uint64(weight) * c.g;
+                        sum[2] += uint64(weight) * c.b;
+                    }
+                    sum[3] += uint64(weight) * c.a;
+                }
+            }
+
+            if (ctx.linear != NULL) {
+                const float scale = 1.0f / float(total);
+                dst[x].r = ctx.encoder->encode(linearSum[0] * scale);
+                dst[x].g = ctx.encoder->encode(linearSum[1] * scale);
+                dst[x].b = ctx.encoder->encode(linearSum[2] * scale);
+            }
+            else {
+                dst[x].r = uint8((sum[0] + total / 2) / total);
+                dst[x].g = uint8((sum[1] + total / 2) / total);
+                dst[x].b = uint8((sum[2] + total / 2) / total);
+            }
+            dst[x].a = uint8((sum[3] + total / 2) / total);
+        }
+    }
+
+    void DownSampleTask(void * context, int begin, int end)
+    {
+        const DownSampleContext * ctx = (const DownSampleContext *)context;
+        for (int y = begin; y < end; y++) {
+            downSampleRow(*ctx, y);
+        }
+    }
+
+} // namespace
+
+Image * Image::fastDownSample(float gamma/*= 1.0f*/) const
+{
+    nvDebugCheck(m_depth == 1);
+    nvDebugCheck(m_width != 1 || m_height != 1);
+
+    AutoPtr<Image> dst_image(new Image());
+
+    const uint w = max(1U, m_width / 2);
+    const uint h = max(1U, m_height / 2);
+    dst_image->allocate(w, h);
+
+    DownSampleContext context = { this, dst_image.ptr(), NULL, NULL };
+
+    float linear[256];
+    AutoPtr<LinearEncoder> encoder;
+
+    if (gamma != 1.0f) {
+        for (uint i = 0; i < 256; i++) {
+            linear[i] = powf(float(i) / 255.0f, gamma);
+        }
+        encoder = new LinearEncoder(gamma);
+        context.linear = linear;
+        context.encoder = encoder.ptr();
+    }
+
+    if (w * h < kParallelDownSampleThreshold) {
+        DownSampleTask(&context, 0, h);
+    }
+    else {
+        TaskScheduler::global()->parallelFor(DownSampleTask, &context, h, kDownSampleRowsPerTask);
+    }
+
+    return dst_image.release();
+}
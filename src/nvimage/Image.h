@@ -59,6 +59,10 @@ namespace nv
 
         void fill(Color32 c);
 
+        // Half size image built with the box filter of FloatImage::fastDownSample, rounded to 8 bits. The color
+        // channels are averaged in linear space when gamma isn't 1, alpha always is.
+        Image * fastDownSample(float gamma = 1.0f) const;
+
     private:
         void free();
 
@@ -13,11 +13,17 @@
 
 #include "nvcore/Ptr.h"
 #include "nvcore/Utils.h"
-#include "nvcore/Array.h"
+#include "nvcore/Array.inl"
 #include "nvcore/StrLib.h"
 #include "nvcore/StdStream.h"
 #include "nvcore/TextWriter.h"
 
+#include "nvthread/TaskScheduler.h"
+
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 // Extern
 #if defined(HAVE_FREEIMAGE)
 #   include <FreeImage.h>
@@ -50,6 +56,7 @@ extern "C" {
 #   include <ImfInputFile.h>
 #   include <ImfOutputFile.h>
 #   include <ImfArray.h>
+#   include <ImfThreading.h>
 #endif
 
 #if defined(HAVE_STBIMAGE)
@@ -68,183 +75,342 @@ struct Color555 {
     uint16 r : 5;
 };
 
-// Load TGA image.
-static Image * loadTGA(Stream & s)
+// Convert 8 bit values to floats in the [0, 1] range. Same conversion as FloatImage::initFrom.
+static void convertPlane(const uint8 * src, float * dst, uint count)
 {
-    nvCheck(!s.isError());
-    nvCheck(s.isLoading());
+    uint i = 0;
 
-    TgaHeader tga;
-    s << tga;
-    s.seek(TgaHeader::Size + tga.id_length);
-
-    // Get header info.
-    bool rle = false;
-    bool pal = false;
-    bool rgb = false;
-    bool grey = false;
-
-    switch( tga.image_type ) {
-        case TGA_TYPE_RLE_INDEXED:
-            rle = true;
-            // no break is intended!
-        case TGA_TYPE_INDEXED:
-            if( tga.colormap_type!=1 || tga.colormap_size!=24 || tga.colormap_length>256 ) {
-                nvDebug( "*** loadTGA: Error, only 24bit paletted images are supported.\n" );
-                return NULL;
-            }
-            pal = true;
-            break;
+#if NV_USE_SSE > 1
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(255.0f);
 
-	case TGA_TYPE_RLE_RGB:
-	    rle = true;
-	    // no break is intended!
-	case TGA_TYPE_RGB:
-	    rgb = true;
-	    break;
-
-	case TGA_TYPE_RLE_GREY:
-	    rle = true;
-	    // no break is intended!
-	case TGA_TYPE_GREY:
-	    grey = true;
-	    break;
-
-	default:
-	    nvDebug( "*** loadTGA: Error, unsupported image type.\n" );
-	    return NULL;
-    }
-
-    const uint pixel_size = (tga.pixel_size/8);
-    nvDebugCheck(pixel_size <= 4);
-
-    const uint size = tga.width * tga.height * pixel_size;
-
-
-    // Read palette
-    uint8 palette[768];
-    if( pal ) {
-        nvDebugCheck(tga.colormap_length <= 256);
-        s.serialize(palette, 3 * tga.colormap_length);
-    }
-
-    // Decode image.
-    uint8 * mem = new uint8[size];
-    if( rle ) {
-        // Decompress image in src.
-        uint8 * dst = mem;
-        int num = size;
-
-	while (num > 0) {
-	    // Get packet header
-	    uint8 c;
-	    s << c;
-
-	    uint count = (c & 0x7f) + 1;
-	    num -= count * pixel_size;
-
-	    if (c & 0x80) {
-		// RLE pixels.
-		uint8 pixel[4];	// uint8 pixel[pixel_size];
-		s.serialize( pixel, pixel_size );
-		do {
-		    memcpy(dst, pixel, pixel_size);
-		    dst += pixel_size;
-		} while (--count);
-	    }
-	    else {
-		// Raw pixels.
-		count *= pixel_size;
-		//file->Read8(dst, count);
-		s.serialize(dst, count);
-		dst += count;
-	    }
-	}
+    for (; i + 16 <= count; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+        _mm_storeu_ps(dst + i + 0, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+        _mm_storeu_ps(dst + i + 4, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+        _mm_storeu_ps(dst + i + 8, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+        _mm_storeu_ps(dst + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
     }
-    else {
-        s.serialize(mem, size);
+#endif
+
+    for (; i < count; i++) {
+        dst[i] = float(src[i]) / 255.0f;
     }
+}
 
-    // Allocate image.
-    AutoPtr<Image> img(new Image());
-    img->allocate(tga.width, tga.height);
+// Store 8 bit BGR or BGRA texels in the planes of a float image. BGR texels get an opaque alpha.
+static void storeBGRA(const uint8 * src, uint pixelSize, uint count, float * r, float * g, float * b, float * a)
+{
+    nvDebugCheck(pixelSize == 3 || pixelSize == 4);
+
+    uint x = 0;
+
+#if NV_USE_SSE > 1
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    const __m128 scale = _mm_set1_ps(255.0f);
 
-    int lstep;
-    Color32 * dst;
-    if( tga.flags & TGA_ORIGIN_UPPER ) {
-        lstep = tga.width;
-        dst = img->pixels();
+    if (pixelSize == 4) {
+        for (; x + 4 <= count; x += 4) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * x));
+
+            _mm_storeu_ps(b + x, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(v, mask)), scale));
+            _mm_storeu_ps(g + x, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), mask)), scale));
+            _mm_storeu_ps(r + x, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), mask)), scale));
+            _mm_storeu_ps(a + x, _mm_div_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v, 24)), scale));
+        }
     }
     else {
-        lstep = - tga.width;
-        dst = img->pixels() + (tga.height-1) * tga.width;
+        const __m128 one = _mm_set1_ps(1.0f);
+
+        // Each texel is loaded as 4 bytes, so the last group stops one texel before the end of the row.
+        for (; x + 5 <= count; x += 4) {
+            const uint8 * p = src + 3 * x;
+            int32 t0, t1, t2, t3;
+            memcpy(&t0, p + 0, 4);
+            memcpy(&t1, p + 3, 4);
+            memcpy(&t2, p + 6, 4);
+            memcpy(&t3, p + 9, 4);
+            const __m128i v = _mm_setr_epi32(t0, t1, t2, t3);
+
+            _mm_storeu_ps(b + x, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(v, mask)), scale));
+            _mm_storeu_ps(g + x, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), mask)), scale));
+            _mm_storeu_ps(r + x, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), mask)), scale));
+            _mm_storeu_ps(a + x, one);
+        }
     }
+#endif
 
-    // Write image.
-    uint8 * src = mem;
-    if( pal ) {
-        for( int y = 0; y < tga.height; y++ ) {
-            for( int x = 0; x < tga.width; x++ ) {
-                uint8 idx = *src++;
-                dst[x].setBGRA(palette[3*idx+0], palette[3*idx+1], palette[3*idx+2], 0xFF);
-            }
-            dst += lstep;
-        }
+    for (; x < count; x++) {
+        const uint8 * p = src + pixelSize * x;
+        b[x] = float(p[0]) / 255.0f;
+        g[x] = float(p[1]) / 255.0f;
+        r[x] = float(p[2]) / 255.0f;
+        a[x] = (pixelSize == 4) ? float(p[3]) / 255.0f : 1.0f;
     }
-    else if( grey ) {
-        img->setFormat(Image::Format_ARGB);
+}
+
+// Store a row of 8 bit colors in the planes of a 4 channel float image. Same conversion as FloatImage::initFrom.
+static void storeScanline(FloatImage * img, uint y, const Color32 * src)
+{
+    const uint w = img->width();
+    float * r = img->scanline(0, y, 0);
+    float * g = img->scanline(1, y, 0);
+    float * b = img->scanline(2, y, 0);
+    float * a = img->scanline(3, y, 0);
+
+#if NV_LITTLE_ENDIAN
+    // Color32 is stored in BGRA order.
+    storeBGRA((const uint8 *)src, 4, w, r, g, b, a);
+#else
+    for (uint x = 0; x < w; x++) {
+        r[x] = float(src[x].r) / 255.0f;
+        g[x] = float(src[x].g) / 255.0f;
+        b[x] = float(src[x].b) / 255.0f;
+        a[x] = float(src[x].a) / 255.0f;
+    }
+#endif
+}
+
 
-        for( int y = 0; y < tga.height; y++ ) {
-            for( int x = 0; x < tga.width; x++ ) {
-                dst[x].setBGRA(*src, *src, *src, *src);
-                src++;
+namespace {
+
+    // Decodes a TGA file one scanline at a time, so that only a single row of the file is held in memory.
+    struct TgaScanlineReader
+    {
+        TgaScanlineReader(Stream & s) : s(s), rle(false), pal(false), grey(false), pixelSize(0), packetCount(0), packetIsRun(false) {}
+
+        bool readHeader()
+        {
+            nvCheck(!s.isError());
+            nvCheck(s.isLoading());
+
+            s << tga;
+            s.seek(TgaHeader::Size + tga.id_length);
+
+            switch( tga.image_type ) {
+                case TGA_TYPE_RLE_INDEXED:
+                    rle = true;
+                    // no break is intended!
+                case TGA_TYPE_INDEXED:
+                    if( tga.colormap_type!=1 || tga.colormap_size!=24 || tga.colormap_length>256 ) {
+                        nvDebug( "*** loadTGA: Error, only 24bit paletted images are supported.\n" );
+                        return false;
+                    }
+                    pal = true;
+                    break;
+
+                case TGA_TYPE_RLE_RGB:
+                    rle = true;
+                    // no break is intended!
+                case TGA_TYPE_RGB:
+                    break;
+
+                case TGA_TYPE_RLE_GREY:
+                    rle = true;
+                    // no break is intended!
+                case TGA_TYPE_GREY:
+                    grey = true;
+                    break;
+
+                default:
+                    nvDebug( "*** loadTGA: Error, unsupported image type.\n" );
+                    return false;
+            }
+
+            pixelSize = tga.pixel_size / 8;
+            if (pixelSize == 0 || pixelSize > 4) {
+                nvDebug( "*** loadTGA: Error, unsupported pixel size.\n" );
+                return false;
+            }
+
+            if( pal ) {
+                s.serialize(palette, 3 * tga.colormap_length);
             }
-            dst += lstep;
+
+            row.resize(tga.width * pixelSize);
+
+            return !s.isError();
         }
-    }
-    else {
 
-        if( tga.pixel_size == 16 ) {
-            for( int y = 0; y < tga.height; y++ ) {
+        uint width() const { return tga.width; }
+        uint height() const { return tga.height; }
+        bool hasAlpha() const { return grey || (!pal && tga.pixel_size == 32); }
+
+        // Scanlines are stored bottom-up unless the origin is at the top.
+        uint imageRow(uint y) const { return (tga.flags & TGA_ORIGIN_UPPER) ? y : tga.height - 1 - y; }
+
+        // Decode the next scanline of the file.
+        void readScanline(Color32 * dst)
+        {
+#if NV_LITTLE_ENDIAN
+            // 32 bit texels are already in the layout of Color32.
+            if( isBGRA() && tga.pixel_size == 32 ) {
+                readRow((uint8 *)dst);
+                return;
+            }
+#endif
+
+            uint8 * src = row.buffer();
+            readRow(src);
+
+            if( pal ) {
+                for( int x = 0; x < tga.width; x++ ) {
+                    uint8 idx = src[x];
+                    dst[x].setBGRA(palette[3*idx+0], palette[3*idx+1], palette[3*idx+2], 0xFF);
+                }
+            }
+            else if( grey ) {
                 for( int x = 0; x < tga.width; x++ ) {
-                    Color555 c = *reinterpret_cast<Color555 *>(src);
+                    dst[x].setBGRA(src[x], src[x], src[x], src[x]);
+                }
+            }
+            else if( tga.pixel_size == 16 ) {
+                for( int x = 0; x < tga.width; x++ ) {
+                    Color555 c = *reinterpret_cast<Color555 *>(src + 2 * x);
                     uint8 b = (c.b << 3) | (c.b >> 2);
                     uint8 g = (c.g << 3) | (c.g >> 2);
                     uint8 r = (c.r << 3) | (c.r >> 2);
                     dst[x].setBGRA(b, g, r, 0xFF);
-                    src += 2;
                 }
-                dst += lstep;
             }
-        }
-        else if( tga.pixel_size == 24 ) {
-            for( int y = 0; y < tga.height; y++ ) {
+            else if( tga.pixel_size == 24 ) {
                 for( int x = 0; x < tga.width; x++ ) {
-                    dst[x].setBGRA(src[0], src[1], src[2], 0xFF);
-                    src += 3;
+                    dst[x].setBGRA(src[3*x+0], src[3*x+1], src[3*x+2], 0xFF);
+                }
+            }
+            else if( tga.pixel_size == 32 ) {
+                for( int x = 0; x < tga.width; x++ ) {
+                    dst[x].setBGRA(src[4*x+0], src[4*x+1], src[4*x+2], src[4*x+3]);
                 }
-                dst += lstep;
             }
         }
-        else if( tga.pixel_size == 32 ) {
-            img->setFormat(Image::Format_ARGB);
 
-            for( int y = 0; y < tga.height; y++ ) {
-                for( int x = 0; x < tga.width; x++ ) {
-                    dst[x].setBGRA(src[0], src[1], src[2], src[3]);
-                    src += 4;
+        // Decode the next scanline of the file into row y of a 4 channel float image.
+        void readScanline(FloatImage * img, uint y)
+        {
+            if( isBGRA() ) {
+                readRow(row.buffer());
+                storeBGRA(row.buffer(), pixelSize, tga.width, img->scanline(0, y, 0), img->scanline(1, y, 0), img->scanline(2, y, 0), img->scanline(3, y, 0));
+            }
+            else {
+                colors.resize(tga.width);
+                readScanline(colors.buffer());
+                storeScanline(img, y, colors.buffer());
+            }
+        }
+
+    private:
+
+        bool isBGRA() const { return !pal && !grey && (tga.pixel_size == 24 || tga.pixel_size == 32); }
+
+        void readRow(uint8 * dst)
+        {
+            if( rle ) {
+                readPackets(dst, tga.width);
+            }
+            else {
+                s.serialize(dst, row.size());
+            }
+        }
+
+        // RLE packets may span scanlines, so the current packet is carried over to the next row.
+        void readPackets(uint8 * dst, uint count)
+        {
+            while (count > 0) {
+                if (packetCount == 0) {
+                    uint8 c = 0;
+                    s << c;
+
+                    packetCount = (c & 0x7f) + 1;
+                    packetIsRun = (c & 0x80) != 0;
+
+                    if (packetIsRun) {
+                        s.serialize(packetPixel, pixelSize);
+                    }
                 }
-                dst += lstep;
+
+                const uint n = min(count, packetCount);
+                if (packetIsRun) {
+                    // Replicate the pixel, doubling the span that is already filled with each copy.
+                    const uint size = n * pixelSize;
+                    memcpy(dst, packetPixel, pixelSize);
+                    for (uint filled = pixelSize; filled < size; ) {
+                        const uint len = min(filled, size - filled);
+                        memcpy(dst + filled, dst, len);
+                        filled += len;
+                    }
+                    dst += size;
+                }
+                else {
+                    s.serialize(dst, n * pixelSize);
+                    dst += n * pixelSize;
+                }
+
+                count -= n;
+                packetCount -= n;
             }
         }
+
+        Stream & s;
+        TgaHeader tga;
+        bool rle;
+        bool pal;
+        bool grey;
+        uint pixelSize;
+        uint8 palette[768];
+        Array<uint8> row;
+        Array<Color32> colors;
+
+        uint packetCount;
+        bool packetIsRun;
+        uint8 packetPixel[4];
+    };
+
+} // namespace
+
+static Image * loadTGA(Stream & s)
+{
+    TgaScanlineReader reader(s);
+    if (!reader.readHeader()) {
+        return NULL;
+    }
+
+    AutoPtr<Image> img(new Image());
+    img->allocate(reader.width(), reader.height());
+    if (reader.hasAlpha()) {
+        img->setFormat(Image::Format_ARGB);
     }
 
-    // free uncompressed data.
-    delete [] mem;
+    const uint h = reader.height();
+    for (uint y = 0; y < h; y++) {
+        reader.readScanline(img->scanline(reader.imageRow(y)));
+    }
 
     return img.release();
 }
 
+// Load TGA image straight into a float image, without an intermediate 8 bit copy.
+static FloatImage * loadFloatTGA(Stream & s)
+{
+    TgaScanlineReader reader(s);
+    if (!reader.readHeader()) {
+        return NULL;
+    }
+
+    AutoPtr<FloatImage> fimage(new FloatImage());
+    fimage->allocate(4, reader.width(), reader.height());
+
+    const uint h = reader.height();
+    for (uint y = 0; y < h; y++) {
+        reader.readScanline(fimage.ptr(), reader.imageRow(y));
+    }
+
+    return fimage.release();
+}
+
 // Save TGA image.
 static bool saveTGA(Stream & s, const Image * img)
 {
@@ -303,11 +469,111 @@ static bool saveTGA(Stream & s, const Image * img)
     return true;
 }
 
-/*static Image * loadPPM(Stream & s)
+namespace {
+
+    // Read a value of the PPM header, skipping the whitespace and comments before it. The single whitespace
+    // character after the value is consumed too.
+    bool readPPMValue(Stream & s, uint * value)
+    {
+        uint8 c = ' ';
+        for (;;) {
+            if (s.isAtEnd()) return false;
+            s << c;
+
+            if (c == '#') {
+                while (c != '\n' && !s.isAtEnd()) s << c;
+            }
+            else if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+                break;
+            }
+        }
+
+        if (c < '0' || c > '9') return false;
+
+        uint v = 0;
+        while (c >= '0' && c <= '9') {
+            v = 10 * v + (c - '0');
+            if (v > 0xFFFFFF || s.isAtEnd()) return false;
+            s << c;
+        }
+
+        *value = v;
+        return true;
+    }
+
+    // Read the header of a binary PPM file. The header is followed by rows of 8 bit RGB texels.
+    bool readPPMHeader(Stream & s, uint * width, uint * height)
+    {
+        nvCheck(!s.isError());
+        nvCheck(s.isLoading());
+
+        uint8 magic[2] = { 0, 0 };
+        s.serialize(magic, 2);
+        if (magic[0] != 'P' || magic[1] != '6') {
+            // @@ Add support for ASCII and greyscale files.
+            return false;
+        }
+
+        uint maxValue;
+        if (!readPPMValue(s, width) || !readPPMValue(s, height) || !readPPMValue(s, &maxValue)) {
+            return false;
+        }
+
+        // @@ Add support for 16 bit files.
+        return *width != 0 && *height != 0 && maxValue == 255;
+    }
+
+} // namespace
+
+// Load PPM image.
+static Image * loadPPM(Stream & s)
 {
-    // @@
-    return NULL;
-}*/
+    uint w, h;
+    if (!readPPMHeader(s, &w, &h)) {
+        return NULL;
+    }
+
+    AutoPtr<Image> img(new Image());
+    img->allocate(w, h);
+
+    Array<uint8> row;
+    row.resize(3 * w);
+
+    for (uint y = 0; y < h; y++) {
+        if (s.serialize(row.buffer(), row.size()) != row.size()) return NULL;
+
+        Color32 * dst = img->scanline(y);
+        for (uint x = 0; x < w; x++) {
+            dst[x].setRGBA(row[3*x+0], row[3*x+1], row[3*x+2], 0xFF);
+        }
+    }
+
+    return img.release();
+}
+
+// Load PPM image straight into a float image.
+static FloatImage * loadFloatPPM(Stream & s)
+{
+    uint w, h;
+    if (!readPPMHeader(s, &w, &h)) {
+        return NULL;
+    }
+
+    AutoPtr<FloatImage> fimage(new FloatImage());
+    fimage->allocate(4, w, h);
+
+    Array<uint8> row;
+    row.resize(3 * w);
+
+    for (uint y = 0; y < h; y++) {
+        if (s.serialize(row.buffer(), row.size()) != row.size()) return NULL;
+
+        // Texels are in RGB order, so the red and blue planes are swapped.
+        storeBGRA(row.buffer(), 3, w, fimage->scanline(2, y, 0), fimage->scanline(1, y, 0), fimage->scanline(0, y, 0), fimage->scanline(3, y, 0));
+    }
+
+    return fimage.release();
+}
 
 // Save PPM image.
 static bool savePPM(Stream & s, const Image * img)
@@ -341,110 +607,112 @@ static bool savePPM(Stream & s, const Image * img)
     return false;
 }*/
 
-// Load PSD image.
-static Image * loadPSD(Stream & s)
-{
-    nvCheck(!s.isError());
-    nvCheck(s.isLoading());
-
-    s.setByteOrder(Stream::BigEndian);
-
-    PsdHeader header;
-    s << header;
+namespace {
 
-    if (!header.isValid())
+    // Decodes a PSD file one channel at a time. The channels are stored as planes, so each one is expanded into a
+    // buffer of 8 bit values that is then copied to its component of the image.
+    struct PsdChannelReader
     {
-        printf("invalid header!\n");
-        return NULL;
-    }
+        PsdChannelReader(Stream & s) : s(s), compressed(false), channelCount(0), end(0) {}
 
-    if (!header.isSupported())
-    {
-        printf("unsupported file!\n");
-        return NULL;
-    }
+        bool readHeader()
+        {
+            nvCheck(!s.isError());
+            nvCheck(s.isLoading());
 
-    int tmp;
+            s.setByteOrder(Stream::BigEndian);
 
-    // Skip mode data.
-    s << tmp;
-    s.seek(s.tell() + tmp);
+            s << header;
+
+            if (!header.isValid())
+            {
+                printf("invalid header!\n");
+                return false;
+            }
 
-    // Skip image resources.
-    s << tmp;
-    s.seek(s.tell() + tmp);
+            if (!header.isSupported())
+            {
+                printf("unsupported file!\n");
+                return false;
+            }
 
-    // Skip the reserved data.
-    s << tmp;
-    s.seek(s.tell() + tmp);
+            int tmp;
 
-    // Find out if the data is compressed.
-    // Known values:
-    //   0: no compression
-    //   1: RLE compressed
-    uint16 compression;
-    s << compression;
+            // Skip mode data.
+            s << tmp;
+            s.seek(s.tell() + tmp);
 
-    if (compression > 1) {
-        // Unknown compression type.
-        return NULL;
-    }
+            // Skip image resources.
+            s << tmp;
+            s.seek(s.tell() + tmp);
 
-    uint channel_num = header.channel_count;
+            // Skip the reserved data.
+            s << tmp;
+            s.seek(s.tell() + tmp);
 
-    AutoPtr<Image> img(new Image());
-    img->allocate(header.width, header.height);
+            // Find out if the data is compressed.
+            // Known values:
+            //   0: no compression
+            //   1: RLE compressed
+            uint16 compression;
+            s << compression;
 
-    if (channel_num < 4)
-    {
-        // Clear the image.
-        img->fill(Color32(0, 0, 0, 0xFF));
-    }
-    else
-    {
-        // Enable alpha.
-        img->setFormat(Image::Format_ARGB);
+            if (compression > 1) {
+                // Unknown compression type.
+                return false;
+            }
+            compressed = (compression == 1);
 
-        // Ignore remaining channels.
-        channel_num = 4;
-    }
+            // Ignore remaining channels.
+            channelCount = min(uint(header.channel_count), 4U);
 
+            if (compressed) {
+                // Skip the byte counts of the rows, packets are decoded until the channel is complete.
+                s.seek(s.tell() + header.height * header.channel_count * sizeof(uint16));
+            }
 
-    const uint pixel_count = header.height * header.width;
+            // Querying the end of the stream can be expensive, so it's only done once.
+            end = s.size();
 
-    static const uint components[4] = {2, 1, 0, 3};
+            return !s.isError();
+        }
 
-    if (compression)
-    {
-        s.seek(s.tell() + header.height * header.channel_count * sizeof(uint16));
+        uint width() const { return header.width; }
+        uint height() const { return header.height; }
+        uint channels() const { return channelCount; }
 
-        // Read RLE data.
-        for (uint channel = 0; channel < channel_num; channel++)
+        // Decode the next channel of the file, dst holds a value for each pixel.
+        bool readChannel(uint8 * dst)
         {
-            uint8 * ptr = (uint8 *)img->pixels() + components[channel];
+            const uint pixel_count = header.height * header.width;
+
+            if (!compressed) {
+                // We're at the raw image data. It's each channel in order (Red, Green, Blue, Alpha, ...)
+                // where each channel consists of an 8-bit value for each pixel in the image.
+                return s.serialize(dst, pixel_count) == pixel_count;
+            }
+
+            uint64 left = end - s.tell();
 
             uint count = 0;
-            while( count < pixel_count )
+            while (count < pixel_count)
             {
-                if (s.isAtEnd()) return NULL;
+                if (left == 0) return false;
 
                 uint8 c;
                 s << c;
+                left--;
 
                 uint len = c;
                 if (len < 128)
                 {
                     // Copy next len+1 bytes literally.
                     len++;
-                    count += len;
-                    if (count > pixel_count) return NULL;
+                    if (count + len > pixel_count || len > left) return false;
 
-                    while (len != 0)
-                    {
-                        s << *ptr;
-                        ptr += 4;
-                        len--;
-                    }
+                    s.serialize(dst + count, len);
+                    left -= len;
+                    count += len;
                 }
                 else if (len > 128)
                 {
@@ -452,47 +720,111 @@ static Image * loadPSD(Stream & s)
                     // (Interpret len as a negative 8-bit int.)
                     len ^= 0xFF;
                     len += 2;
-                    count += len;
-                    if (s.isAtEnd() || count > pixel_count) return NULL;
+                    if (left == 0 || count + len > pixel_count) return false;
 
                     uint8 val;
                     s << val;
-                    while( len != 0 ) {
-                        *ptr = val;
-                        ptr += 4;
-                        len--;
-                    }
+                    left--;
+
+                    memset(dst + count, val, len);
+                    count += len;
                 }
                 else if( len == 128 ) {
                     // No-op.
                 }
             }
+
+            return true;
         }
+
+    private:
+
+        Stream & s;
+        PsdHeader header;
+        bool compressed;
+        uint channelCount;
+        uint64 end;
+    };
+
+} // namespace
+
+// Load PSD image.
+static Image * loadPSD(Stream & s)
+{
+    PsdChannelReader reader(s);
+    if (!reader.readHeader()) {
+        return NULL;
+    }
+
+    const uint channel_num = reader.channels();
+
+    AutoPtr<Image> img(new Image());
+    img->allocate(reader.width(), reader.height());
+
+    if (channel_num < 4)
+    {
+        // Clear the image.
+        img->fill(Color32(0, 0, 0, 0xFF));
     }
     else
     {
-        // We're at the raw image data. It's each channel in order (Red, Green, Blue, Alpha, ...)
-        // where each channel consists of an 8-bit value for each pixel in the image.
+        // Enable alpha.
+        img->setFormat(Image::Format_ARGB);
+    }
 
-        // Read the data by channel.
-        for (uint channel = 0; channel < channel_num; channel++)
-        {
-            uint8 * ptr = (uint8 *)img->pixels() + components[channel];
+    const uint pixel_count = reader.height() * reader.width();
 
-            // Read the data.
-            uint count = pixel_count;
-            while (count != 0)
-            {
-                s << *ptr;
-                ptr += 4;
-                count--;
-            }
+    Array<uint8> plane;
+    plane.resize(pixel_count);
+
+    static const uint components[4] = {2, 1, 0, 3};
+
+    for (uint channel = 0; channel < channel_num; channel++)
+    {
+        if (!reader.readChannel(plane.buffer())) return NULL;
+
+        uint8 * ptr = (uint8 *)img->pixels() + components[channel];
+        for (uint i = 0; i < pixel_count; i++) {
+            ptr[4 * i] = plane[i];
         }
     }
 
     return img.release();
 }
 
+// Load PSD image straight into the planes of a float image.
+static FloatImage * loadFloatPSD(Stream & s)
+{
+    PsdChannelReader reader(s);
+    if (!reader.readHeader()) {
+        return NULL;
+    }
+
+    const uint channel_num = reader.channels();
+
+    AutoPtr<FloatImage> fimage(new FloatImage());
+    fimage->allocate(4, reader.width(), reader.height());
+
+    const uint pixel_count = reader.height() * reader.width();
+
+    Array<uint8> plane;
+    plane.resize(pixel_count);
+
+    for (uint channel = 0; channel < channel_num; channel++)
+    {
+        if (!reader.readChannel(plane.buffer())) return NULL;
+
+        convertPlane(plane.buffer(), fimage->channel(channel), pixel_count);
+    }
+
+    // Missing color channels are black, and the image is opaque without alpha channel.
+    for (uint channel = channel_num; channel < 4; channel++) {
+        fimage->clear(channel, channel == 3 ? 1.0f : 0.0f);
+    }
+
+    return fimage.release();
+}
+
 static FloatImage * loadFloatDDS(Stream & s)
 {
     nvCheck(s.isLoading());
@@ -631,22 +963,33 @@ static bool saveFloatDDS(Stream & s, const FloatImage * img, uint base_component
 
     s << header;
 
-    uint32 * r = (uint32 *)img->channel(base_component + 0);
-    uint32 * g = (uint32 *)img->channel(base_component + 1);
-    uint32 * b = (uint32 *)img->channel(base_component + 2);
-    uint32 * a = (uint32 *)img->channel(base_component + 3);
+    const float * r = img->channel(base_component + 0);
+    const float * g = img->channel(base_component + 1);
+    const float * b = img->channel(base_component + 2);
+    const float * a = img->channel(base_component + 3);
+
+    // Convert and write runs of pixels at once.
+    const uint runSize = 256;
+    uint16 halves[4][runSize];
+    uint16 texels[4 * runSize];
 
     const uint size = img->width() * img->height();
-    for (uint i = 0; i < size; i++) {
-        uint16 R = half_from_float( *r++ );
-        uint16 G = half_from_float( *g++ );
-        uint16 B = half_from_float( *b++ );
-        uint16 A = half_from_float( *a++ );
+    for (uint i = 0; i < size; i += runSize) {
+        const uint count = min(runSize, size - i);
+
+        half_from_float_array(r + i, halves[0], count);
+        half_from_float_array(g + i, halves[1], count);
+        half_from_float_array(b + i, halves[2], count);
+        half_from_float_array(a + i, halves[3], count);
+
+        for (uint j = 0; j < count; j++) {
+            texels[4 * j + 0] = halves[0][j];
+            texels[4 * j + 1] = halves[1][j];
+            texels[4 * j + 2] = halves[2][j];
+            texels[4 * j + 3] = halves[3][j];
+        }
 
-        s.serialize(&R, sizeof(uint16));
-        s.serialize(&G, sizeof(uint16));
-        s.serialize(&B, sizeof(uint16));
-        s.serialize(&A, sizeof(uint16));
+        s.serialize(texels, count * 4 * sizeof(uint16));
     }
 
     return true;
@@ -655,57 +998,27 @@ static bool saveFloatDDS(Stream & s, const FloatImage * img, uint base_component
 
 #if defined(HAVE_PNG)
 
-static void user_read_data(png_structp png_ptr, png_bytep data, png_size_t length)
-{
-    nvDebugCheck(png_ptr != NULL);
-
-    Stream * s = (Stream *)png_get_io_ptr(png_ptr);
-    s->serialize(data, (int)length);
-
-    if (s->isError()) {
-        png_error(png_ptr, "Read Error");
-    }
-}
-
-
-static Image * loadPNG(Stream & s)
-{
-    nvCheck(!s.isError());
-
-    // Set up a read buffer and check the library version
-    png_structp png_ptr;
-    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    if (png_ptr == NULL) {
-        //	nvDebug( "*** LoadPNG: Error allocating read buffer in file '%s'.\n", name );
-        return false;
-    }
+static void user_read_data(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    nvDebugCheck(png_ptr != NULL);
 
-    // Allocate/initialize a memory block for the image information
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (info_ptr == NULL) {
-        png_destroy_read_struct(&png_ptr, NULL, NULL);
-        //	nvDebug( "*** LoadPNG: Error allocating image information for '%s'.\n", name );
-        return false;
-    }
+    Stream * s = (Stream *)png_get_io_ptr(png_ptr);
+    s->serialize(data, (int)length);
 
-    // Set up the error handling
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-        //	nvDebug( "*** LoadPNG: Error reading png file '%s'.\n", name );
-        return false;
+    if (s->isError()) {
+        png_error(png_ptr, "Read Error");
     }
-
-    // Set up the I/O functions.
-    png_set_read_fn(png_ptr, (void*)&s, user_read_data);
+}
 
 
+// Configure libpng to expand any input to 8 bit RGBA.
+static void setPNGTransforms(png_structp png_ptr, png_infop info_ptr)
+{
     // Retrieve the image header information
     png_uint_32 width, height;
     int bit_depth, color_type, interlace_type;
-    png_read_info(png_ptr, info_ptr);
     png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, &interlace_type, NULL, NULL);
 
-
     if (color_type == PNG_COLOR_TYPE_PALETTE && bit_depth <= 8) {
         // Convert indexed images to RGB.
         png_set_expand(png_ptr);
@@ -755,10 +1068,47 @@ static Image * loadPNG(Stream & s)
             png_set_gamma(png_ptr, screen_gamma, 0.45455);
         }
     }
+}
+
+static Image * loadPNG(Stream & s)
+{
+    nvCheck(!s.isError());
+
+    // Set up a read buffer and check the library version
+    png_structp png_ptr;
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (png_ptr == NULL) {
+        //	nvDebug( "*** LoadPNG: Error allocating read buffer in file '%s'.\n", name );
+        return false;
+    }
+
+    // Allocate/initialize a memory block for the image information
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (info_ptr == NULL) {
+        png_destroy_read_struct(&png_ptr, NULL, NULL);
+        //	nvDebug( "*** LoadPNG: Error allocating image information for '%s'.\n", name );
+        return false;
+    }
+
+    // Set up the error handling
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        //	nvDebug( "*** LoadPNG: Error reading png file '%s'.\n", name );
+        return false;
+    }
+
+    // Set up the I/O functions.
+    png_set_read_fn(png_ptr, (void*)&s, user_read_data);
+
+
+    png_read_info(png_ptr, info_ptr);
+    setPNGTransforms(png_ptr, info_ptr);
 
     // Perform the selected transforms.
     png_read_update_info(png_ptr, info_ptr);
 
+    png_uint_32 width, height;
+    int bit_depth, color_type, interlace_type;
     png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, &interlace_type, NULL, NULL);
 
     AutoPtr<Image> img(new Image());
@@ -805,6 +1155,81 @@ static Image * loadPNG(Stream & s)
     return img.release();
 }
 
+// Load PNG image one row at a time, straight into a float image.
+static FloatImage * loadFloatPNG(Stream & s)
+{
+    nvCheck(!s.isError());
+
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (png_ptr == NULL) {
+        return NULL;
+    }
+
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (info_ptr == NULL) {
+        png_destroy_read_struct(&png_ptr, NULL, NULL);
+        return NULL;
+    }
+
+    // Allocated after setjmp, so they have to be volatile for the error handler to release them.
+    FloatImage * volatile fimage = NULL;
+    uint8 * volatile buffer = NULL;
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        delete fimage;
+        delete [] buffer;
+        return NULL;
+    }
+
+    png_set_read_fn(png_ptr, (void*)&s, user_read_data);
+
+    png_read_info(png_ptr, info_ptr);
+    setPNGTransforms(png_ptr, info_ptr);
+
+    // Output rows in the same byte order as Color32.
+    png_set_bgr(png_ptr);
+
+    const int passes = png_set_interlace_handling(png_ptr);
+
+    png_read_update_info(png_ptr, info_ptr);
+
+    const uint width = png_get_image_width(png_ptr, info_ptr);
+    const uint height = png_get_image_height(png_ptr, info_ptr);
+
+    fimage = new FloatImage();
+    fimage->allocate(4, width, height);
+
+    if (passes == 1) {
+        buffer = new uint8[width * 4];
+
+        for (uint y = 0; y < height; y++) {
+            png_read_row(png_ptr, buffer, NULL);
+            storeScanline(fimage, y, (const Color32 *)buffer);
+        }
+    }
+    else {
+        // Every pass of an interlaced image touches all the rows, so these still need the whole 8 bit image.
+        buffer = new uint8[width * height * 4];
+
+        for (int p = 0; p < passes; p++) {
+            for (uint y = 0; y < height; y++) {
+                png_read_row(png_ptr, buffer + y * width * 4, NULL);
+            }
+        }
+        for (uint y = 0; y < height; y++) {
+            storeScanline(fimage, y, (const Color32 *)(buffer + y * width * 4));
+        }
+    }
+
+    png_read_end(png_ptr, info_ptr);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+
+    delete [] buffer;
+
+    return fimage;
+}
+
 static void user_write_data(png_structp png_ptr, png_bytep data, png_size_t length)
 {
     nvDebugCheck(png_ptr != NULL);
@@ -940,6 +1365,20 @@ static void term_source (j_decompress_ptr /*cinfo*/){
 }
 
 
+// Decompress from a memory buffer holding the whole file.
+static void setJPGSource(jpeg_decompress_struct * cinfo, const Array<uint8> & byte_array)
+{
+    cinfo->src = (struct jpeg_source_mgr *) (*cinfo->mem->alloc_small)
+                ((j_common_ptr) cinfo, JPOOL_PERMANENT, sizeof(struct jpeg_source_mgr));
+    cinfo->src->init_source = init_source;
+    cinfo->src->fill_input_buffer = fill_input_buffer;
+    cinfo->src->skip_input_data = skip_input_data;
+    cinfo->src->resync_to_restart = jpeg_resync_to_restart;	// use default method
+    cinfo->src->term_source = term_source;
+    cinfo->src->bytes_in_buffer = byte_array.size();
+    cinfo->src->next_input_byte = byte_array.buffer();
+}
+
 static Image * loadJPG(Stream & s)
 {
     nvCheck(!s.isError());
@@ -955,15 +1394,7 @@ static Image * loadJPG(Stream & s)
     cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_decompress(&cinfo);
 
-    cinfo.src = (struct jpeg_source_mgr *) (*cinfo.mem->alloc_small)
-                ((j_common_ptr) &cinfo, JPOOL_PERMANENT, sizeof(struct jpeg_source_mgr));
-    cinfo.src->init_source = init_source;
-    cinfo.src->fill_input_buffer = fill_input_buffer;
-    cinfo.src->skip_input_data = skip_input_data;
-    cinfo.src->resync_to_restart = jpeg_resync_to_restart;	// use default method
-    cinfo.src->term_source = term_source;
-    cinfo.src->bytes_in_buffer = byte_array.size();
-    cinfo.src->next_input_byte = byte_array.buffer();
+    setJPGSource(&cinfo, byte_array);
 
     jpeg_read_header(&cinfo, TRUE);
     jpeg_start_decompress(&cinfo);
@@ -1011,6 +1442,64 @@ static Image * loadJPG(Stream & s)
     return img.release();
 }
 
+// Load JPEG image one scanline at a time, straight into a float image.
+static FloatImage * loadFloatJPG(Stream & s)
+{
+    nvCheck(!s.isError());
+
+    // Read the entire file.
+    Array<uint8> byte_array;
+    byte_array.resize(s.size());
+    s.serialize(byte_array.buffer(), s.size());
+
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr jerr;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+
+    setJPGSource(&cinfo, byte_array);
+
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_start_decompress(&cinfo);
+
+    const uint width = cinfo.output_width;
+
+    AutoPtr<FloatImage> fimage(new FloatImage());
+    fimage->allocate(4, width, cinfo.output_height);
+
+    Array<uint8> scanline;
+    scanline.resize(width * cinfo.num_components);
+
+    Array<Color32> row;
+    row.resize(width);
+
+    while( cinfo.output_scanline < cinfo.output_height ){
+        const uint y = cinfo.output_scanline;
+
+        uint8 * src = scanline.buffer();
+        jpeg_read_scanlines(&cinfo, &src, 1);
+
+        if( cinfo.num_components == 3 ) {
+            for( uint x = 0; x < width; x++ ) {
+                row[x] = Color32(src[3*x+0], src[3*x+1], src[3*x+2]);
+            }
+        }
+        else {
+            for( uint x = 0; x < width; x++ ) {
+                row[x] = Color32(src[x], src[x], src[x], src[x]);
+            }
+        }
+
+        storeScanline(fimage.ptr(), y, row.buffer());
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress (&cinfo);
+
+    return fimage.release();
+}
+
 #endif // defined(HAVE_JPEG)
 
 #if defined(HAVE_TIFF)
@@ -1240,8 +1729,8 @@ namespace
 
 	virtual void seekg(Imf::Int64 pos)
 	{
-	    nvDebugCheck(pos >= 0 && pos < UINT_MAX);
-	    m_stream.seek((uint)pos);
+	    nvDebugCheck(pos >= 0);
+	    m_stream.seek(uint64(pos));
 	}
 
 	virtual void clear()
@@ -1277,8 +1766,12 @@ static FloatImage * loadFloatEXR(const char * fileName, Stream & s)
     nvCheck(s.isLoading());
     nvCheck(!s.isError());
 
+    if (Imf::globalThreadCount() == 0) {
+        Imf::setGlobalThreadCount(hardwareThreadCount());
+    }
+
     ExrStream stream(fileName, s);
-    Imf::InputFile inputFile(stream);
+    Imf::InputFile inputFile(stream, Imf::globalThreadCount());
 
     Imath::Box2i box = inputFile.header().dataWindow();
 
@@ -1307,7 +1800,7 @@ static FloatImage * loadFloatEXR(const char * fileName, Stream & s)
         frameBuffer.insert(it.name(), Imf::Slice(Imf::FLOAT, (char *)fimage->channel(channelIndex), sizeof(float), sizeof(float) * width));
     }
 
-    // Read it.
+    // Read it. OpenEXR decodes the scanline blocks or tiles on its own thread pool.
     inputFile.setFrameBuffer (frameBuffer);
     inputFile.readPixels (box.min.y, box.max.y);
 
@@ -1725,7 +2218,7 @@ static Image * loadSTB(Stream & s)
             }
         }
         
-        free(data);
+        stbi_image_free(data);
 
         return img;
     }
@@ -1733,6 +2226,107 @@ static Image * loadSTB(Stream & s)
     return NULL;
 }
 
+namespace
+{
+    // Below this many texels the decoded image is converted on the calling thread.
+    const uint kParallelConvertThreshold = 256 * 1024;
+
+    // Approximate number of texels converted by each task.
+    const uint kConvertTaskSize = 32 * 1024;
+
+    struct ConvertContext
+    {
+        const void * src;
+        FloatImage * img;
+        uint componentCount;    // Of the interleaved float source.
+    };
+
+    // One item per row.
+    static void ConvertRGBA8Task(void * context, int begin, int end)
+    {
+        const ConvertContext * ctx = (const ConvertContext *)context;
+        const uint w = ctx->img->width();
+
+        Array<Color32> row;
+        row.resize(w);
+
+        for (int y = begin; y < end; y++)
+        {
+            const uint8 * src = (const uint8 *)ctx->src + y * w * 4;
+
+            for (uint x = 0; x < w; ++x)
+            {
+                row[x] = Color32(src[x * 4 + 0], src[x * 4 + 1], src[x * 4 + 2], src[x * 4 + 3]);
+            }
+
+            storeScanline(ctx->img, y, row.buffer());
+        }
+    }
+
+    static void ConvertFloatTask(void * context, int begin, int end)
+    {
+        const ConvertContext * ctx = (const ConvertContext *)context;
+        const uint w = ctx->img->width();
+        const uint n = ctx->componentCount;
+
+        for (int y = begin; y < end; y++)
+        {
+            const float * src = (const float *)ctx->src + y * w * n;
+
+            for (uint c = 0; c < n; c++) {
+                float * dst = ctx->img->scanline(c, y, 0);
+
+                for (uint x = 0; x < w; x++) {
+                    dst[x] = src[x * n + c];
+                }
+            }
+        }
+    }
+
+    static void convertRows(ForRangeTask * task, ConvertContext * context)
+    {
+        const uint w = context->img->width();
+        const uint h = context->img->height();
+
+        if (w * h < kParallelConvertThreshold) {
+            task(context, 0, h);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(task, context, h, max(1U, kConvertTaskSize / w));
+        }
+    }
+}
+
+// stb_image can only decode whole images, but its 8 bit output is converted straight into a float image without an
+// intermediate Image. Large images are converted in parallel.
+static FloatImage * loadFloatSTB8(Stream & s)
+{
+    // @@ Assumes stream cursor is at the beginning and that image occupies the whole stream.
+    const int size = s.size();
+    uint8 * buffer = new uint8[size];
+
+    s.serialize(buffer, size);
+
+    int w, h, n;
+    uint8 * data = stbi_load_from_memory(buffer, size, &w, &h, &n, 4);
+
+    delete [] buffer;
+
+    if (data == NULL) {
+        return NULL;
+    }
+
+    FloatImage * fimage = new FloatImage;
+    fimage->allocate(4, w, h);
+
+    ConvertContext context = { data, fimage, 4 };
+    convertRows(ConvertRGBA8Task, &context);
+
+    stbi_image_free(data);
+
+    return fimage;
+}
+
 static FloatImage * loadFloatSTB(Stream & s)
 {
     // @@ Assumes stream cursor is at the beginning and that image occupies the whole stream.
@@ -1751,15 +2345,10 @@ static FloatImage * loadFloatSTB(Stream & s)
         FloatImage * img = new FloatImage;
         img->allocate(n, w, h);
 
-        const int count = w * h;
-
-        for (int c = 0; c < n; c++) {
-            float * dst = img->channel(c);
+        ConvertContext context = { data, img, uint(n) };
+        convertRows(ConvertFloatTask, &context);
 
-            for (int i = 0; i < count; i++) {
-                dst[i] = data[i*n + c];
-            }
-        }
+        stbi_image_free(data);
         return img;
     }
 
@@ -1776,6 +2365,13 @@ Image * nv::ImageIO::load(const char * fileName)
 {
     nvDebugCheck(fileName != NULL);
 
+    // Decode from a mapping of the file, so that reads are plain copies.
+    MappedInputStream mapped(fileName);
+    if (!mapped.isError()) {
+        return ImageIO::load(fileName, mapped);
+    }
+
+    // Not a regular file, or too large to map.
     StdInputStream stream(fileName);
 
     if (stream.isError()) {
@@ -1800,9 +2396,9 @@ Image * nv::ImageIO::load(const char * fileName, Stream & s)
         return loadPSD(s);
     }
 
-    /*if (strCaseDiff(extension, ".ppm") == 0) {
+    if (strCaseDiff(extension, ".ppm") == 0) {
         return loadPPM(s);
-    }*/
+    }
 
 #if defined(HAVE_JPEG)
     if (strCaseDiff(extension, ".jpg") == 0 || strCaseDiff(extension, ".jpeg") == 0) {
@@ -1880,6 +2476,13 @@ FloatImage * nv::ImageIO::loadFloat(const char * fileName)
 {
     nvDebugCheck(fileName != NULL);
 
+    // Decode from a mapping of the file, so that reads are plain copies.
+    MappedInputStream mapped(fileName);
+    if (!mapped.isError()) {
+        return loadFloat(fileName, mapped);
+    }
+
+    // Not a regular file, or too large to map.
     StdInputStream stream(fileName);
 
     if (stream.isError()) {
@@ -1889,6 +2492,37 @@ FloatImage * nv::ImageIO::loadFloat(const char * fileName)
     return loadFloat(fileName, stream);
 }
 
+namespace
+{
+    struct LoadFloatContext
+    {
+        const char * const * fileNames;
+        FloatImage ** images;
+    };
+
+    static void LoadFloatTask(void * context, int i)
+    {
+        const LoadFloatContext * ctx = (const LoadFloatContext *)context;
+        ctx->images[i] = ImageIO::loadFloat(ctx->fileNames[i]);
+    }
+}
+
+uint nv::ImageIO::loadFloatBatch(const char * const * fileNames, uint count, FloatImage ** images)
+{
+    nvDebugCheck(fileNames != NULL && images != NULL);
+
+    // One task per file. The decoders that convert large images in parallel run nested in the same scheduler.
+    LoadFloatContext context = { fileNames, images };
+    TaskScheduler::global()->parallelFor(LoadFloatTask, &context, count);
+
+    uint loaded = 0;
+    for (uint i = 0; i < count; i++) {
+        if (images[i] != NULL) loaded++;
+    }
+
+    return loaded;
+}
+
 FloatImage * nv::ImageIO::loadFloat(const char * fileName, Stream & s)
 {
     nvDebugCheck(fileName != NULL);
@@ -1921,12 +2555,43 @@ FloatImage * nv::ImageIO::loadFloat(const char * fileName, Stream & s)
 #endif
 
     if (strCaseDiff(extension, ".dds") == 0) {
-        const uint spos = s.tell(); // Save stream position.
+        const uint64 spos = s.tell(); // Save stream position.
         FloatImage * floatImage = loadFloatDDS(s);
         if (floatImage != NULL) return floatImage;
         else s.seek(spos);
     }
 
+    // Decode 8 bit formats straight into the float image.
+    if (strCaseDiff(extension, ".tga") == 0) {
+        return loadFloatTGA(s);
+    }
+
+    if (strCaseDiff(extension, ".psd") == 0) {
+        return loadFloatPSD(s);
+    }
+
+    if (strCaseDiff(extension, ".ppm") == 0) {
+        return loadFloatPPM(s);
+    }
+
+#if defined(HAVE_JPEG)
+    if (strCaseDiff(extension, ".jpg") == 0 || strCaseDiff(extension, ".jpeg") == 0) {
+        return loadFloatJPG(s);
+    }
+#endif
+
+#if defined(HAVE_PNG)
+    if (strCaseDiff(extension, ".png") == 0) {
+        return loadFloatPNG(s);
+    }
+#endif
+
+#if defined(HAVE_STBIMAGE)
+    if (strCaseDiff(extension, ".psd") != 0) {
+        return loadFloatSTB8(s);
+    }
+#endif
+
     // Try to load as an RGBA8 image and convert to float.
     AutoPtr<Image> img(load(fileName, s));
     if (img != NULL) {
@@ -23,6 +23,10 @@ namespace nv
         NVIMAGE_API FloatImage * loadFloat(const char * fileName);
         NVIMAGE_API FloatImage * loadFloat(const char * fileName, Stream & s);
 
+        // Load several files in parallel. images[i] is NULL for the files that fail to load. Returns the number of images
+        // that were loaded.
+        NVIMAGE_API uint loadFloatBatch(const char * const * fileNames, uint count, FloatImage ** images);
+
         NVIMAGE_API bool save(const char * fileName, const Image * img, const char ** tags=NULL); // NULL terminated list.
         NVIMAGE_API bool save(const char * fileName, Stream & s, const Image * img, const char ** tags=NULL);
 
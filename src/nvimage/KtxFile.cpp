@@ -2,6 +2,11 @@
 
 #include "KtxFile.h"
 
+#include "nvcore/Stream.h"
+#include "nvcore/Array.inl"
+
+#include <string.h> // memcpy
+
 using namespace nv;
 
 static const uint8 fileIdentifier[12] = {
@@ -31,9 +36,9 @@ KtxHeader::KtxHeader() {
 }
 
 
-Stream & operator<< (Stream & s, DDSHeader & header) {
+Stream & nv::operator<< (Stream & s, KtxHeader & header) {
     s.serialize(header.identifier, 12);
-    s << header.endiannes << header.glType << header.glTypeSize << header.glFormat << header.glInternalFormat << header.glBaseInternalFormat;
+    s << header.endianness << header.glType << header.glTypeSize << header.glFormat << header.glInternalFormat << header.glBaseInternalFormat;
     s << header.pixelWidth << header.pixelHeight << header.pixelDepth;
     s << header.numberOfArrayElements << header.numberOfFaces << header.numberOfMipmapLevels;
     s << header.bytesOfKeyValueData;
@@ -49,35 +54,43 @@ KtxFile::~KtxFile() {
 void KtxFile::addKeyValue(const char * key, const char * value) {
     keyArray.append(key);
     valueArray.append(value);
-    bytesOfKeyValueData += strlen(key) + 1 + strlen(value) + 1;
 }
 
 
-Stream & operator<< (Stream & s, KtxFile & file) {
-    s << header;
+Stream & nv::operator<< (Stream & s, KtxFile & file) {
 
     if (s.isSaving()) {
+        // Each pair is preceded by its size and padded to 4 bytes.
+        const uint keyValueCount = file.keyArray.count();
+        file.header.bytesOfKeyValueData = 0;
+        for (uint i = 0; i < keyValueCount; i++) {
+            const uint keyValueSize = file.keyArray[i].length() + 1 + file.valueArray[i].length() + 1;
+            file.header.bytesOfKeyValueData += 4 + ((keyValueSize + 3) & ~3U);
+        }
 
-        int keyValueCount = keyArray.count();
-        for (int i = 0; i < keyValueCount; i++) {
-            const String & key = keyArray[i];
-            const String & value = valueArray[i];
+        s << file.header;
+
+        for (uint i = 0; i < keyValueCount; i++) {
+            const String & key = file.keyArray[i];
+            const String & value = file.valueArray[i];
             uint keySize = key.length() + 1;
             uint valueSize = value.length() + 1;
             uint keyValueSize = keySize + valueSize;
 
             s << keyValueSize;
 
-            s.serialize(key.str(), keySize);
-            s.serialize(value.str(), valueSize);
+            s.serialize(const_cast<char *>(key.str()), keySize);
+            s.serialize(const_cast<char *>(value.str()), valueSize);
+
+            uint8 padding[3] = { 0, 0, 0 };
+            s.serialize(padding, 3 - ((keyValueSize + 3) % 4));
         }
     }
     else {
+        s << file.header;
+
         // @@ Read key value pairs.
     }
 
     return s;
 }
-
-
-
@@ -6,6 +6,7 @@
 
 #include "nvimage.h"
 #include "nvcore/StrLib.h"
+#include "nvcore/Array.h"
 
 // KTX File format specification:
 // http://www.khronos.org/opengles/sdk/tools/KTX/file_format_spec/#key
@@ -15,21 +16,56 @@ namespace nv
     class Stream;
 
     // GL types (Table 3.2)
-    const uint KTX_UNSIGNED_BYTE;
-    const uint KTX_UNSIGNED_SHORT_5_6_5;
-    // ...
+    const uint KTX_UNSIGNED_BYTE = 0x1401;
+    const uint KTX_UNSIGNED_SHORT = 0x1403;
+    const uint KTX_FLOAT = 0x1406;
+    const uint KTX_HALF_FLOAT = 0x140B;
+    const uint KTX_UNSIGNED_SHORT_5_6_5 = 0x8363;
 
     // GL formats (Table 3.3)
-    // ...
+    const uint KTX_FORMAT_RED = 0x1903;
+    const uint KTX_FORMAT_RG = 0x8227;
+    const uint KTX_FORMAT_RGB = 0x1907;
+    const uint KTX_FORMAT_RGBA = 0x1908;
+    const uint KTX_FORMAT_BGR = 0x80E0;
+    const uint KTX_FORMAT_BGRA = 0x80E1;
 
     // GL internal formats (Table 3.12, 3.13)
-    // ...
+    const uint KTX_INTERNAL_R8 = 0x8229;
+    const uint KTX_INTERNAL_R16 = 0x822A;
+    const uint KTX_INTERNAL_R16F = 0x822D;
+    const uint KTX_INTERNAL_R32F = 0x822E;
+    const uint KTX_INTERNAL_RG16F = 0x822F;
+    const uint KTX_INTERNAL_RG32F = 0x8230;
+    const uint KTX_INTERNAL_RGB8 = 0x8051;
+    const uint KTX_INTERNAL_RGB565 = 0x8D62;
+    const uint KTX_INTERNAL_RGBA8 = 0x8058;
+    const uint KTX_INTERNAL_RGBA16F = 0x881A;
+    const uint KTX_INTERNAL_RGBA32F = 0x8814;
+    const uint KTX_INTERNAL_SRGB8 = 0x8C41;
+    const uint KTX_INTERNAL_SRGB8_ALPHA8 = 0x8C43;
+
+    const uint KTX_INTERNAL_COMPRESSED_RGB_DXT1 = 0x83F0;
+    const uint KTX_INTERNAL_COMPRESSED_RGBA_DXT1 = 0x83F1;
+    const uint KTX_INTERNAL_COMPRESSED_RGBA_DXT3 = 0x83F2;
+    const uint KTX_INTERNAL_COMPRESSED_RGBA_DXT5 = 0x83F3;
+    const uint KTX_INTERNAL_COMPRESSED_SRGB_DXT1 = 0x8C4C;
+    const uint KTX_INTERNAL_COMPRESSED_SRGB_ALPHA_DXT1 = 0x8C4D;
+    const uint KTX_INTERNAL_COMPRESSED_SRGB_ALPHA_DXT3 = 0x8C4E;
+    const uint KTX_INTERNAL_COMPRESSED_SRGB_ALPHA_DXT5 = 0x8C4F;
+    const uint KTX_INTERNAL_COMPRESSED_RED_RGTC1 = 0x8DBB;
+    const uint KTX_INTERNAL_COMPRESSED_RG_RGTC2 = 0x8DBD;
+    const uint KTX_INTERNAL_COMPRESSED_RGBA_BPTC_UNORM = 0x8E8C;
+    const uint KTX_INTERNAL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM = 0x8E8D;
+    const uint KTX_INTERNAL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT = 0x8E8E;
+    const uint KTX_INTERNAL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT = 0x8E8F;
 
     // GL base internal format. (Table 3.11)
-    const uint KTX_RGB;
-    const uint KTX_RGBA;
-    const uint KTX_ALPHA;
-    // ...
+    const uint KTX_RED = 0x1903;
+    const uint KTX_RG = 0x8227;
+    const uint KTX_RGB = 0x1907;
+    const uint KTX_RGBA = 0x1908;
+    const uint KTX_ALPHA = 0x1906;
 
 
     struct KtxHeader {
@@ -52,16 +88,16 @@ namespace nv
 
     };
 
-    NVIMAGE_API Stream & operator<< (Stream & s, DDSHeader & header);
+    NVIMAGE_API Stream & operator<< (Stream & s, KtxHeader & header);
 
 
+    // The header and the key value pairs, the images follow. bytesOfKeyValueData is computed from the pairs when saving.
     struct KtxFile {
         KtxFile();
         ~KtxFile();
 
         void addKeyValue(const char * key, const char * value);
 
-    private:
         KtxHeader header;
 
         Array<String> keyArray;
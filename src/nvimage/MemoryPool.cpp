@@ -0,0 +1,181 @@
+// This code is in the public domain -- castano@gmail.com
+
+#include "MemoryPool.h"
+
+#include "nvcore/Debug.h"
+#include "nvcore/Memory.h"
+
+#include "nvthread/Mutex.h"
+
+#include <string.h> // memmove, memcpy
+
+#if NV_OS_LINUX
+#include <sys/mman.h> // madvise
+#endif
+
+using namespace nv;
+
+
+namespace
+{
+    // Blocks start with their capacity, so that they can be handed out again to smaller allocations. The buffers start
+    // on a cache line, whatever the allocator hooks return, so the header takes a whole line.
+    struct BlockHeader
+    {
+        size_t capacity;
+        uint8 padding[kPoolAlignment - sizeof(size_t)];
+    };
+
+    // Smaller buffers are cheap enough to get from the heap.
+    const size_t kMinPooledSize = 64 * 1024;
+
+    const uint kMaxPooledBlocks = 16;
+    const size_t kMaxPooledBytes = size_t(512) * 1024 * 1024;
+
+    const size_t kHugePageSize = 2 * 1024 * 1024;
+    bool s_hugePages = false;
+
+    // Ask for huge pages over the whole huge pages inside [mem, mem + size).
+    void adviseHugePages(void * mem, size_t size)
+    {
+#if NV_OS_LINUX && defined(MADV_HUGEPAGE)
+        const uintptr_t begin = (uintptr_t(mem) + kHugePageSize - 1) & ~uintptr_t(kHugePageSize - 1);
+        const uintptr_t end = (uintptr_t(mem) + size) & ~uintptr_t(kHugePageSize - 1);
+        if (begin < end) madvise((void *)begin, end - begin, MADV_HUGEPAGE);
+#endif
+    }
+
+    struct Pool
+    {
+        Pool() : jobCount(0), blockCount(0), byteCount(0) {}
+
+        // Remove block i, keeping the others in the order they were freed.
+        BlockHeader * take(uint i)
+        {
+            BlockHeader * block = blocks[i];
+            memmove(blocks + i, blocks + i + 1, (blockCount - i - 1) * sizeof(BlockHeader *));
+            blockCount--;
+            byteCount -= block->capacity;
+            return block;
+        }
+
+        Mutex mutex;
+        uint jobCount;
+        BlockHeader * blocks[kMaxPooledBlocks];  // Oldest first.
+        uint blockCount;
+        size_t byteCount;
+    };
+
+    Pool & pool()
+    {
+        static Pool pool;
+        return pool;
+    }
+
+    BlockHeader * header(void * mem)
+    {
+        return (BlockHeader *)mem - 1;
+    }
+}
+
+
+void * nv::poolAllocate(size_t size)
+{
+    if (size >= kMinPooledSize)
+    {
+        Pool & p = pool();
+        Lock<Mutex> lock(p.mutex);
+
+        // Take the smallest block that fits, as long as less than half of it is wasted.
+        uint best = p.blockCount;
+        for (uint i = 0; i < p.blockCount; i++) {
+            const size_t capacity = p.blocks[i]->capacity;
+            if (capacity >= size && capacity / 2 <= size && (best == p.blockCount || capacity < p.blocks[best]->capacity)) {
+                best = i;
+            }
+        }
+
+        if (best != p.blockCount) {
+            return p.take(best) + 1;
+        }
+    }
+
+    // Huge blocks start on a huge page, so that none of their pages is split with other allocations.
+    const bool huge = s_hugePages && size >= kHugePageThreshold;
+
+    BlockHeader * block = (BlockHeader *)mem::alignedMalloc(sizeof(BlockHeader) + size, huge ? kHugePageSize : kPoolAlignment);
+    if (block == NULL) return NULL;
+
+    if (huge) adviseHugePages(block, sizeof(BlockHeader) + size);
+
+    block->capacity = size;
+    return block + 1;
+}
+
+void * nv::poolReallocate(void * mem, size_t size)
+{
+    if (mem == NULL) return poolAllocate(size);
+
+    BlockHeader * block = header(mem);
+    if (block->capacity >= size) return mem;
+
+    // Aligned memory can't be reallocated in place.
+    void * copy = poolAllocate(size);
+    if (copy == NULL) return NULL;
+
+    memcpy(copy, mem, block->capacity);
+    poolFree(mem);
+    return copy;
+}
+
+void nv::poolFree(void * mem)
+{
+    if (mem == NULL) return;
+
+    BlockHeader * block = header(mem);
+
+    if (block->capacity >= kMinPooledSize && block->capacity <= kMaxPooledBytes)
+    {
+        Pool & p = pool();
+        Lock<Mutex> lock(p.mutex);
+
+        if (p.jobCount != 0)
+        {
+            // Make room by evicting the blocks that were freed first.
+            while (p.blockCount == kMaxPooledBlocks || p.byteCount + block->capacity > kMaxPooledBytes) {
+                mem::alignedFree(p.take(0));
+            }
+
+            p.blocks[p.blockCount++] = block;
+            p.byteCount += block->capacity;
+            return;
+        }
+    }
+
+    mem::alignedFree(block);
+}
+
+void nv::setPoolHugePages(bool enable)
+{
+    s_hugePages = enable;
+}
+
+void nv::beginPoolJob()
+{
+    Pool & p = pool();
+    Lock<Mutex> lock(p.mutex);
+    p.jobCount++;
+}
+
+void nv::endPoolJob()
+{
+    Pool & p = pool();
+    Lock<Mutex> lock(p.mutex);
+    nvDebugCheck(p.jobCount != 0);
+
+    if (--p.jobCount == 0) {
+        while (p.blockCount != 0) {
+            mem::alignedFree(p.take(p.blockCount - 1));
+        }
+    }
+}
@@ -0,0 +1,43 @@
+// This code is in the public domain -- castano@gmail.com
+
+#pragma once
+#ifndef NV_IMAGE_MEMORYPOOL_H
+#define NV_IMAGE_MEMORYPOOL_H
+
+#include "nvimage.h"
+
+namespace nv
+{
+    // Allocation of large transient buffers: images, filter kernels and compressed outputs. While a job is open, freed
+    // buffers are kept and handed out again to allocations of similar size, so that a batch of textures reuses a few
+    // large blocks instead of going through the system heap for every image and mipmap. The pool is shared by all
+    // threads, and closing the last job returns its blocks to the system. Buffers of the pool must be freed with poolFree.
+    // They are aligned to kPoolAlignment bytes, a cache line.
+    const uint kPoolAlignment = 64;
+
+    NVIMAGE_API void * poolAllocate(size_t size);
+    NVIMAGE_API void * poolReallocate(void * mem, size_t size);
+    NVIMAGE_API void poolFree(void * mem);
+
+    // Back new blocks of at least kHugePageThreshold bytes with transparent huge pages, where the OS supports them. Large
+    // images are read block by block all over, so 2 MB pages save most of their TLB misses. Off by default.
+    const size_t kHugePageThreshold = 8 * 1024 * 1024;
+    NVIMAGE_API void setPoolHugePages(bool enable);
+
+    // Jobs nest, the pool is active from the first begin to the last end.
+    NVIMAGE_API void beginPoolJob();
+    NVIMAGE_API void endPoolJob();
+
+    struct PoolJob
+    {
+        PoolJob() { beginPoolJob(); }
+        ~PoolJob() { endPoolJob(); }
+    };
+
+    template <typename T> T * poolAllocate(size_t count) {
+        return (T *)poolAllocate(sizeof(T) * count);
+    }
+
+} // nv namespace
+
+#endif // NV_IMAGE_MEMORYPOOL_H
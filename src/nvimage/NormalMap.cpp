@@ -30,153 +30,411 @@
 #include "nvmath/Vector.h"
 
 #include "nvcore/Ptr.h"
+#include "nvcore/Array.inl"
+
+#include "nvthread/TaskScheduler.h"
+#include "nvthread/Mutex.h"
 
 #include <string.h> // memcpy
 
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 
 using namespace nv;
 
-// Create normal map using the given kernels.
-static FloatImage * createNormalMap(const Image * img, FloatImage::WrapMode wm, Vector4::Arg heightWeights, const Kernel2 * kdu, const Kernel2 * kdv)
+namespace
 {
-    nvDebugCheck(kdu != NULL);
-    nvDebugCheck(kdv != NULL);
-    nvDebugCheck(img != NULL);
+    // Rows of normals computed by each task.
+    const uint kNormalRowsPerTask = 8;
 
-    const uint w = img->width();
-    const uint h = img->height();
+    // Below this many texels the normal map is computed on the calling thread.
+    const uint kParallelNormalThreshold = 64 * 1024;
 
-    AutoPtr<FloatImage> fimage(new FloatImage());
-    fimage->allocate(4, w, h);
+    const int kMaxKernelWindow = 9;
 
-    // Compute height and store in alpha channel:
-    float * alphaChannel = fimage->channel(3);
-    for(uint i = 0; i < w * h; i++)
+    // The taps of a pair of derivative kernels. Taps with zero weight in both kernels are skipped, the others are listed in
+    // the order of FloatImage::applyKernelXY, so the sums are identical.
+    struct NormalMapKernel
     {
-        Vector4 color = toVector4(img->pixel(i));
-        alphaChannel[i] = dot(color, heightWeights);
-    }
+        int window;
+        int tapCount;
+        int tapX[kMaxKernelWindow * kMaxKernelWindow];
+        int tapY[kMaxKernelWindow * kMaxKernelWindow];
+        float tapU[kMaxKernelWindow * kMaxKernelWindow];
+        float tapV[kMaxKernelWindow * kMaxKernelWindow];
+    };
 
-    float heightScale = 1.0f / 16.0f;	// @@ Use a user defined factor.
+    // Filters of the cached kernels: a NormalMapFilter, or the blend of the 9x9 Sobel filters with the given weights.
+    const int kBlendedSobel = -1;
 
-    for(uint y = 0; y < h; y++)
+    static void initNormalMapKernel(NormalMapKernel & kernel, int filter, Vector4::Arg filterWeights)
     {
-        for(uint x = 0; x < w; x++)
+        uint window = 9;
+        switch (filter)
         {
-            const float du = fimage->applyKernelXY(kdu, x, y, 0, 3, wm);
-            const float dv = fimage->applyKernelXY(kdv, x, y, 0, 3, wm);
+            case kBlendedSobel:
+                break;
+            case NormalMapFilter_Sobel3x3:
+                window = 3;
+                break;
+            case NormalMapFilter_Sobel5x5:
+                window = 5;
+                break;
+            case NormalMapFilter_Sobel7x7:
+                window = 7;
+                break;
+            case NormalMapFilter_Sobel9x9:
+                window = 9;
+                break;
+            default:
+                nvDebugCheck(false);
+        };
+
+        Kernel2 kdu(window);
+        if (filter == kBlendedSobel) {
+            kdu.initBlendedSobel(filterWeights);
+        }
+        else {
+            kdu.initSobel();
+        }
+        kdu.normalize();
+
+        Kernel2 kdv(kdu);
+        kdv.transpose();
+
+        kernel.window = int(window);
+        kernel.tapCount = 0;
+        for (int i = 0; i < kernel.window; i++) {
+            for (int e = 0; e < kernel.window; e++) {
+                const float u = kdu.valueAt(e, i);
+                const float v = kdv.valueAt(e, i);
+                if (u != 0.0f || v != 0.0f) {
+                    kernel.tapX[kernel.tapCount] = e;
+                    kernel.tapY[kernel.tapCount] = i;
+                    kernel.tapU[kernel.tapCount] = u;
+                    kernel.tapV[kernel.tapCount] = v;
+                    kernel.tapCount++;
+                }
+            }
+        }
+    }
 
-            Vector3 n = normalize(Vector3(du, dv, heightScale));
+    // Kernels of recently used normal map filters. The same filter is used for all the faces and mipmaps of a texture, and
+    // usually for all the textures. Shared by all threads.
+    class NormalMapKernelCache
+    {
+    public:
+        NormalMapKernelCache() : m_count(0), m_time(0) {}
 
-            fimage->pixel(0, x, y, 0) = 0.5f * n.x + 0.5f;
-            fimage->pixel(1, x, y, 0) = 0.5f * n.y + 0.5f;
-            fimage->pixel(2, x, y, 0) = 0.5f * n.z + 0.5f;
+        void get(int filter, Vector4::Arg filterWeights, NormalMapKernel * kernel)
+        {
+            {
+                Lock<Mutex> lock(m_mutex);
+
+                for (uint i = 0; i < m_count; i++) {
+                    Entry & entry = m_entries[i];
+                    if (entry.filter == filter && equalWeights(entry.weights, filterWeights)) {
+                        *kernel = entry.kernel;
+                        entry.lastUse = ++m_time;
+                        return;
+                    }
+                }
+            }
+
+            initNormalMapKernel(*kernel, filter, filterWeights);
+
+            Lock<Mutex> lock(m_mutex);
+
+            // Take a free entry, or the least recently used one.
+            uint slot = m_count;
+            if (m_count < EntryCount) {
+                m_count++;
+            }
+            else {
+                slot = 0;
+                for (uint i = 1; i < EntryCount; i++) {
+                    if (m_entries[i].lastUse < m_entries[slot].lastUse) slot = i;
+                }
+            }
+
+            Entry & entry = m_entries[slot];
+            entry.filter = filter;
+            entry.weights = filterWeights;
+            entry.kernel = *kernel;
+            entry.lastUse = ++m_time;
         }
+
+    private:
+        static bool equalWeights(Vector4::Arg a, Vector4::Arg b)
+        {
+            return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w;
+        }
+
+        enum { EntryCount = 8 };
+
+        struct Entry
+        {
+            int filter;
+            Vector4 weights;
+            NormalMapKernel kernel;
+            uint lastUse;
+        };
+
+        Mutex m_mutex;
+        Entry m_entries[EntryCount];
+        uint m_count;
+        uint m_time;
+    };
+
+    static void getNormalMapKernel(int filter, Vector4::Arg filterWeights, NormalMapKernel * kernel)
+    {
+        static NormalMapKernelCache cache;
+        cache.get(filter, filterWeights, kernel);
     }
 
-    return fimage.release();
-}
+    // Evaluates both derivative kernels over the height channel. Wrapping is resolved once per row, and through a column
+    // table only near the left and right edges.
+    struct NormalMapContext
+    {
+        const float * height;
+        float * out[3];
+        uint w, h;
+        int radius;
 
+        Array<int> rows;        // Wrapped row of y - radius, for y in [0, h + 2 * radius).
+        Array<int> columns;     // Wrapped column of x - radius, for x in [0, w + 2 * radius).
 
-// Create normal map using the given kernels.
-static FloatImage * createNormalMap(const FloatImage * img, FloatImage::WrapMode wm, const Kernel2 * kdu, const Kernel2 * kdv)
-{
-    nvDebugCheck(kdu != NULL);
-    nvDebugCheck(kdv != NULL);
-    nvDebugCheck(img != NULL);
+        NormalMapKernel kernel;
 
-#pragma NV_MESSAGE("FIXME: Height scale parameter should go away. It should be a sensible value that produces good results when the heightmap is in the [0, 1] range.")
-    const float heightScale = 1.0f / 16.0f;
+        float heightScale;
+        bool packed;            // Store n * 0.5 + 0.5 instead of n.
+    };
 
-    const uint w = img->width();
-    const uint h = img->height();
+    static int wrap(int x, int w, FloatImage::WrapMode wm)
+    {
+        if (wm == FloatImage::WrapMode_Clamp) return wrapClamp(x, w);
+        if (wm == FloatImage::WrapMode_Repeat) return wrapRepeat(x, w);
+        return wrapMirror(x, w);
+    }
 
-    AutoPtr<FloatImage> img_out(new FloatImage());
-    img_out->allocate(4, w, h);
+    static void initNormalMapContext(NormalMapContext & ctx, const FloatImage * img, FloatImage::WrapMode wm, int filter, Vector4::Arg filterWeights)
+    {
+        getNormalMapKernel(filter, filterWeights, &ctx.kernel);
+
+        ctx.height = img->channel(3);
+        ctx.w = img->width();
+        ctx.h = img->height();
+        ctx.radius = ctx.kernel.window / 2;
 
-    for (uint y = 0; y < h; y++)
+        ctx.rows.resize(ctx.h + 2 * ctx.radius);
+        for (uint i = 0; i < ctx.rows.count(); i++) {
+            ctx.rows[i] = wrap(int(i) - ctx.radius, int(ctx.h), wm);
+        }
+        ctx.columns.resize(ctx.w + 2 * ctx.radius);
+        for (uint i = 0; i < ctx.columns.count(); i++) {
+            ctx.columns[i] = wrap(int(i) - ctx.radius, int(ctx.w), wm);
+        }
+    }
+
+    static inline void storeNormal(const NormalMapContext * ctx, uint idx, float du, float dv)
     {
-        for (uint x = 0; x < w; x++)
-        {
-            const float du = img->applyKernelXY(kdu, x, y, 0, 3, wm);
-            const float dv = img->applyKernelXY(kdv, x, y, 0, 3, wm);
+        Vector3 n = normalize(Vector3(du, dv, ctx->heightScale));
+
+        if (ctx->packed) {
+            ctx->out[0][idx] = 0.5f * n.x + 0.5f;
+            ctx->out[1][idx] = 0.5f * n.y + 0.5f;
+            ctx->out[2][idx] = 0.5f * n.z + 0.5f;
+        }
+        else {
+            ctx->out[0][idx] = n.x;
+            ctx->out[1][idx] = n.y;
+            ctx->out[2][idx] = n.z;
+        }
+    }
 
-            Vector3 n = normalize(Vector3(du, dv, heightScale));
+#if NV_USE_SSE > 1
+    // Compute the normals of the texels in [x, end) whose window doesn't wrap, four at a time, and return the first texel
+    // left. TapCount is the tap count of the kernel when it's known at compile time, so that the tap loop is
+    // unrolled, or 0.
+    template <int TapCount>
+    static int computeInteriorNormals(const NormalMapContext * ctx, const float * const * row, float * const * out, int x, int end)
+    {
+        const NormalMapKernel & k = ctx->kernel;
+        const int tapCount = TapCount != 0 ? TapCount : k.tapCount;
+        nvDebugCheck(tapCount == k.tapCount);
+
+        const int r = ctx->radius;
+
+        // Local copies that the stores to the output can't alias.
+        const float * tapRow[kMaxKernelWindow * kMaxKernelWindow];
+        float tapU[kMaxKernelWindow * kMaxKernelWindow];
+        float tapV[kMaxKernelWindow * kMaxKernelWindow];
+        for (int t = 0; t < tapCount; t++) {
+            tapRow[t] = row[k.tapY[t]] + k.tapX[t] - r;
+            tapU[t] = k.tapU[t];
+            tapV[t] = k.tapV[t];
+        }
 
-            img_out->pixel(0, x, y, 0) = n.x;
-            img_out->pixel(1, x, y, 0) = n.y;
-            img_out->pixel(2, x, y, 0) = n.z;
+        const __m128 heightScale = _mm_set1_ps(ctx->heightScale);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+
+        for (; x + 4 <= end; x += 4) {
+            __m128 du = _mm_setzero_ps();
+            __m128 dv = _mm_setzero_ps();
+            for (int t = 0; t < tapCount; t++) {
+                const __m128 v = _mm_loadu_ps(tapRow[t] + x);
+                du = _mm_add_ps(du, _mm_mul_ps(_mm_set1_ps(tapU[t]), v));
+                dv = _mm_add_ps(dv, _mm_mul_ps(_mm_set1_ps(tapV[t]), v));
+            }
+
+            // Same operations as normalize(Vector3).
+            const __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(du, du), _mm_mul_ps(dv, dv)), _mm_mul_ps(heightScale, heightScale)));
+            const __m128 s = _mm_div_ps(one, l);
+            __m128 nx = _mm_mul_ps(du, s);
+            __m128 ny = _mm_mul_ps(dv, s);
+            __m128 nz = _mm_mul_ps(heightScale, s);
+
+            if (ctx->packed) {
+                nx = _mm_add_ps(_mm_mul_ps(half, nx), half);
+                ny = _mm_add_ps(_mm_mul_ps(half, ny), half);
+                nz = _mm_add_ps(_mm_mul_ps(half, nz), half);
+            }
+
+            _mm_storeu_ps(out[0] + x, nx);
+            _mm_storeu_ps(out[1] + x, ny);
+            _mm_storeu_ps(out[2] + x, nz);
         }
+
+        return x;
     }
+#endif
 
-    // Copy alpha channel.
-    /*for (uint y = 0; y < h; y++)
+    static void NormalMapTask(void * context, int begin, int end)
     {
-        for (uint x = 0; x < w; x++)
-        {
-            
-            img_out->pixel(3, x, y, 0) = img->pixel(3, x, y, 0);
+        const NormalMapContext * ctx = (const NormalMapContext *)context;
+        const NormalMapKernel & k = ctx->kernel;
+
+        const int w = int(ctx->w);
+        const int r = ctx->radius;
+        const int * columns = ctx->columns.buffer();
+
+        for (int y = begin; y < end; y++) {
+            const float * row[kMaxKernelWindow];
+            for (int i = 0; i < k.window; i++) {
+                row[i] = ctx->height + ctx->rows[y + i] * w;
+            }
+
+            float * out[3] = { ctx->out[0] + y * w, ctx->out[1] + y * w, ctx->out[2] + y * w };
+            const uint base = uint(y * w);
+
+            // The window of the texels in [r, w - r) doesn't wrap horizontally.
+            const int interiorBegin = min(r, w);
+            const int interiorEnd = max(interiorBegin, w - r);
+
+            int x = 0;
+            for (; x < interiorBegin; x++) {
+                float du = 0.0f, dv = 0.0f;
+                for (int t = 0; t < k.tapCount; t++) {
+                    const float v = row[k.tapY[t]][columns[x + k.tapX[t]]];
+                    du += k.tapU[t] * v;
+                    dv += k.tapV[t] * v;
+                }
+                storeNormal(ctx, base + x, du, dv);
+            }
+
+#if NV_USE_SSE > 1
+            // The 9x9 Sobel kernel and the blended Sobel kernel have 80 taps. Unrolling the smaller kernels doesn't help.
+            if (k.tapCount == 80) {
+                x = computeInteriorNormals<80>(ctx, row, out, x, interiorEnd);
+            }
+            else {
+                x = computeInteriorNormals<0>(ctx, row, out, x, interiorEnd);
+            }
+#endif
+            for (; x < interiorEnd; x++) {
+                float du = 0.0f, dv = 0.0f;
+                for (int t = 0; t < k.tapCount; t++) {
+                    const float v = row[k.tapY[t]][x + k.tapX[t] - r];
+                    du += k.tapU[t] * v;
+                    dv += k.tapV[t] * v;
+                }
+                storeNormal(ctx, base + x, du, dv);
+            }
+
+            for (; x < w; x++) {
+                float du = 0.0f, dv = 0.0f;
+                for (int t = 0; t < k.tapCount; t++) {
+                    const float v = row[k.tapY[t]][columns[x + k.tapX[t]]];
+                    du += k.tapU[t] * v;
+                    dv += k.tapV[t] * v;
+                }
+                storeNormal(ctx, base + x, du, dv);
+            }
         }
-    }*/
-    memcpy(img_out->channel(3), img->channel(3), w * h * sizeof(float));
+    }
 
-    return img_out.release();
+    // Compute the normals of the height in the alpha channel of img with the given filter, and store them in the first
+    // three channels of out.
+    static void computeNormals(const FloatImage * img, FloatImage::WrapMode wm, int filter, Vector4::Arg filterWeights, float heightScale, bool packed, FloatImage * out)
+    {
+        NormalMapContext ctx;
+        initNormalMapContext(ctx, img, wm, filter, filterWeights);
+        ctx.out[0] = out->channel(0);
+        ctx.out[1] = out->channel(1);
+        ctx.out[2] = out->channel(2);
+        ctx.heightScale = heightScale;
+        ctx.packed = packed;
+
+        if (ctx.w * ctx.h < kParallelNormalThreshold) {
+            NormalMapTask(&ctx, 0, ctx.h);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(NormalMapTask, &ctx, ctx.h, kNormalRowsPerTask);
+        }
+    }
 }
 
-
-/// Create normal map using the given filter.
-FloatImage * nv::createNormalMap(const Image * img, FloatImage::WrapMode wm, Vector4::Arg heightWeights, NormalMapFilter filter /*= Sobel3x3*/)
+// Create normal map using the given filter.
+static FloatImage * createNormalMap(const Image * img, FloatImage::WrapMode wm, Vector4::Arg heightWeights, int filter, Vector4::Arg filterWeights)
 {
     nvDebugCheck(img != NULL);
 
-    // Init the kernels.
-    Kernel2 * kdu = NULL;
-    Kernel2 * kdv = NULL;
+    const uint w = img->width();
+    const uint h = img->height();
 
-    switch(filter)
+    AutoPtr<FloatImage> fimage(new FloatImage());
+    fimage->allocate(4, w, h);
+
+    // Compute height and store in alpha channel:
+    float * alphaChannel = fimage->channel(3);
+    for(uint i = 0; i < w * h; i++)
     {
-        case NormalMapFilter_Sobel3x3:
-            kdu = new Kernel2(3);
-            break;
-        case NormalMapFilter_Sobel5x5:
-            kdu = new Kernel2(5);
-            break;
-        case NormalMapFilter_Sobel7x7:
-            kdu = new Kernel2(7);
-            break;
-        case NormalMapFilter_Sobel9x9:
-            kdu = new Kernel2(9);
-            break;
-        default:
-            nvDebugCheck(false);
-    };
+        Vector4 color = toVector4(img->pixel(i));
+        alphaChannel[i] = dot(color, heightWeights);
+    }
 
-    kdu->initSobel();
-    kdu->normalize();
+    float heightScale = 1.0f / 16.0f;	// @@ Use a user defined factor.
 
-    kdv = new Kernel2(*kdu);
-    kdv->transpose();
+    computeNormals(fimage.ptr(), wm, filter, filterWeights, heightScale, /*packed=*/true, fimage.ptr());
 
-    return ::createNormalMap(img, wm, heightWeights, kdu, kdv);
+    return fimage.release();
 }
 
 
-/// Create normal map combining multiple sobel filters.
-FloatImage * nv::createNormalMap(const Image * img, FloatImage::WrapMode wm, Vector4::Arg heightWeights, Vector4::Arg filterWeights)
+/// Create normal map using the given filter.
+FloatImage * nv::createNormalMap(const Image * img, FloatImage::WrapMode wm, Vector4::Arg heightWeights, NormalMapFilter filter /*= Sobel3x3*/)
 {
-    nvDebugCheck(img != NULL);
-
-    Kernel2 * kdu = NULL;
-    Kernel2 * kdv = NULL;
-
-    kdu = new Kernel2(9);
-    kdu->initBlendedSobel(filterWeights);
-    kdu->normalize();
+    return ::createNormalMap(img, wm, heightWeights, filter, Vector4(0.0f));
+}
 
-    kdv = new Kernel2(*kdu);
-    kdv->transpose();
 
-    return ::createNormalMap(img, wm, heightWeights, kdu, kdv);
+/// Create normal map combining multiple sobel filters.
+FloatImage * nv::createNormalMap(const Image * img, FloatImage::WrapMode wm, Vector4::Arg heightWeights, Vector4::Arg filterWeights)
+{
+    return ::createNormalMap(img, wm, heightWeights, kBlendedSobel, filterWeights);
 }
 
 
@@ -184,17 +442,21 @@ FloatImage * nv::createNormalMap(const FloatImage * img, FloatImage::WrapMode wm
 {
     nvDebugCheck(img != NULL);
 
-    Kernel2 * kdu = NULL;
-    Kernel2 * kdv = NULL;
+#pragma NV_MESSAGE("FIXME: Height scale parameter should go away. It should be a sensible value that produces good results when the heightmap is in the [0, 1] range.")
+    const float heightScale = 1.0f / 16.0f;
 
-    kdu = new Kernel2(9);
-    kdu->initBlendedSobel(filterWeights);
-    kdu->normalize();
+    const uint w = img->width();
+    const uint h = img->height();
 
-    kdv = new Kernel2(*kdu);
-    kdv->transpose();
+    AutoPtr<FloatImage> img_out(new FloatImage());
+    img_out->allocate(4, w, h);
+
+    computeNormals(img, wm, kBlendedSobel, filterWeights, heightScale, /*packed=*/false, img_out.ptr());
+
+    // Copy alpha channel.
+    memcpy(img_out->channel(3), img->channel(3), w * h * sizeof(float));
 
-    return ::createNormalMap(img, wm, kdu, kdv);
+    return img_out.release();
 }
 
 
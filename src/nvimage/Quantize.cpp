@@ -14,18 +14,253 @@ http://www.efg2.com/Lab/Library/ImageProcessing/DHALF.TXT
 
 #include "Quantize.h"
 #include "Image.h"
+#include "FloatImage.h"
 #include "PixelFormat.h"
 
 #include "nvmath/Color.h"
 #include "nvmath/Vector.inl"
 
-#include "nvcore/Utils.h" // swap
+#include "nvthread/TaskScheduler.h"
+#include "nvthread/Thread.h"
+#include "nvthread/Atomic.h"
+
+#include "nvcore/Utils.h" // clamp, min
 
 #include <string.h> // memset
 
 
 using namespace nv;
 
+namespace
+{
+	// Floyd-Steinberg error diffusion in a wavefront. A pixel only depends on the previous row up to the next column, so the rows
+	// are processed concurrently, each one at least two chunks behind the previous one. The errors are added in the same order
+	// as in a raster scan, the result doesn't depend on the number of threads.
+	const uint kDitherChunkSize = 64;
+	const uint kParallelDitherThreshold = 256 * 256;
+
+	template <typename Quantizer>
+	struct DitherContext
+	{
+		typedef typename Quantizer::Error Error;
+
+		const Quantizer * quantizer;
+		uint w, h;
+		uint chunkCount;
+		uint ringSize;
+		Error * rows;		// Incoming errors of ringSize rows, w + 2 each.
+		uint * progress;	// Chunks done in each row.
+		uint nextRow;
+	};
+
+	template <typename Quantizer>
+	void DitherTask(void * context, int /*id*/)
+	{
+		typedef typename Quantizer::Error Error;
+
+		DitherContext<Quantizer> * ctx = (DitherContext<Quantizer> *)context;
+		const uint w = ctx->w;
+
+		// The rows are taken in order, so the previous row is always being processed by a running task.
+		for (;;) {
+			const uint y = atomicIncrement(&ctx->nextRow) - 1;
+			if (y >= ctx->h) break;
+
+			Error * row0 = ctx->rows + (y % ctx->ringSize) * (w + 2);
+			Error * row1 = ctx->rows + ((y + 1) % ctx->ringSize) * (w + 2);
+
+			for (uint c = 0; c < ctx->chunkCount; c++) {
+				const uint x0 = c * kDitherChunkSize;
+				const uint x1 = min(x0 + kDitherChunkSize, w);
+
+				// Wait for the errors of the previous row up to x1.
+				if (y > 0) {
+					const uint ready = min(c + 2, ctx->chunkCount);
+					while (loadAcquire(&ctx->progress[y - 1]) < ready) {
+						Thread::yield();
+					}
+				}
+
+				// Clear the errors of the next row this chunk adds to first, the previous chunk added to the ones before.
+				const uint first = (c == 0) ? 0 : x0 + 2;
+				memset(row1 + first, 0, sizeof(Error) * (x1 + 2 - first));
+
+				for (uint x = x0; x < x1; x++) {
+					const Error diff = ctx->quantizer->quantize(x, y, row0[1+x]);
+
+					// Propagate new error.
+					row0[1+x+1] += (7.0f / 16.0f) * diff;
+					row1[1+x-1] += (3.0f / 16.0f) * diff;
+					row1[1+x+0] += (5.0f / 16.0f) * diff;
+					row1[1+x+1] += (1.0f / 16.0f) * diff;
+				}
+
+				storeRelease(&ctx->progress[y], c + 1);
+			}
+		}
+	}
+
+	template <typename Quantizer>
+	void floydSteinberg(const Quantizer & quantizer, uint w, uint h)
+	{
+		typedef typename Quantizer::Error Error;
+
+		DitherContext<Quantizer> context;
+		context.quantizer = &quantizer;
+		context.w = w;
+		context.h = h;
+		context.chunkCount = (w + kDitherChunkSize - 1) / kDitherChunkSize;
+		context.nextRow = 0;
+
+		// Each row has to be a couple of chunks ahead of the next one.
+		uint taskCount = 1;
+		if (w * h >= kParallelDitherThreshold && context.chunkCount >= 4) {
+			taskCount = min(TaskScheduler::global()->workerCount() + 1, context.chunkCount / 2);
+		}
+
+		// The errors of a row are overwritten when the row ringSize - 1 rows below starts, at most taskCount rows are in flight.
+		context.ringSize = taskCount + 2;
+		context.rows = new Error[context.ringSize * (w + 2)];
+		context.progress = new uint[h];
+
+		// The first row starts without errors, the others are cleared by the row above.
+		memset(context.rows, 0, sizeof(Error) * (w + 2));
+		memset(context.progress, 0, sizeof(uint) * h);
+
+		if (taskCount == 1) {
+			DitherTask<Quantizer>(&context, 0);
+		}
+		else {
+			TaskScheduler::global()->parallelFor(DitherTask<Quantizer>, &context, taskCount);
+		}
+
+		delete [] context.rows;
+		delete [] context.progress;
+	}
+
+	// Quantizes the pixel (x, y) with the error diffused to it, and returns the error to diffuse to its neighbors.
+	struct ColorQuantizer
+	{
+		typedef Vector4 Error;
+
+		Image * image;
+		uint rsize, gsize, bsize, asize;
+
+		Vector4 quantize(uint x, uint y, const Vector4 & error) const
+		{
+			Color32 pixel = image->pixel(x, y);
+
+			// Add error.
+			pixel.r = clamp(int(pixel.r) + int(error.x), 0, 255);
+			pixel.g = clamp(int(pixel.g) + int(error.y), 0, 255);
+			pixel.b = clamp(int(pixel.b) + int(error.z), 0, 255);
+			pixel.a = clamp(int(pixel.a) + int(error.w), 0, 255);
+			
+			int r = pixel.r;
+			int g = pixel.g;
+			int b = pixel.b;
+			int a = pixel.a;
+
+			// Convert to our desired size, and reconstruct.
+			r = PixelFormat::convert(r, 8, rsize);
+			r = PixelFormat::convert(r, rsize, 8);
+
+			g = PixelFormat::convert(g, 8, gsize);
+			g = PixelFormat::convert(g, gsize, 8);
+
+			b = PixelFormat::convert(b, 8, bsize);
+			b = PixelFormat::convert(b, bsize, 8);
+
+			a = PixelFormat::convert(a, 8, asize);
+			a = PixelFormat::convert(a, asize, 8);
+
+			// Store color.
+			image->pixel(x, y) = Color32(r, g, b, a);
+			
+			// Compute new error.
+			return Vector4(float(int(pixel.r) - r), float(int(pixel.g) - g), float(int(pixel.b) - b), float(int(pixel.a) - a));
+		}
+	};
+
+	struct BinaryAlphaQuantizer
+	{
+		typedef float Error;
+
+		Image * image;
+		int alpha_threshold;
+
+		float quantize(uint x, uint y, float error) const
+		{
+			Color32 pixel = image->pixel(x, y);
+			
+			// Add error.
+			int alpha = int(pixel.a) + int(error);
+			
+			// Convert color.
+			if (alpha > alpha_threshold) pixel.a = 255;
+			else pixel.a = 0;
+			
+			// Store color.
+			image->pixel(x, y) = pixel;
+			
+			// Compute new error.
+			return float(alpha - pixel.a);
+		}
+	};
+
+	// The errors of the float quantizers are taken against the input without the diffused error, like Surface::quantize did.
+	struct UniformQuantizer
+	{
+		typedef float Error;
+
+		float * channel;
+		uint w;
+		float scale, offset0, offset1;
+
+		float quantize(uint x, uint y, float error) const
+		{
+			float & f = channel[y * w + x];
+
+			// Add error and quantize.
+			float qf = saturate((floorf((f + error) * scale + offset0) + offset1) / scale);
+
+			// Compute new error:
+			float diff = f - qf;
+
+			// Store color.
+			f = qf;
+
+			return diff;
+		}
+	};
+
+	struct ThresholdQuantizer
+	{
+		typedef float Error;
+
+		float * channel;
+		uint w;
+		float threshold;
+
+		float quantize(uint x, uint y, float error) const
+		{
+			float & f = channel[y * w + x];
+
+			// Add error and quantize.
+			float qf = float(f + error > threshold);
+
+			// Compute new error:
+			float diff = f - qf;
+
+			// Store color.
+			f = qf;
+
+			return diff;
+		}
+	};
+
+} // namespace
+
 
 // Simple quantization.
 void nv::Quantize::BinaryAlpha( Image * image, int alpha_threshold /*= 127*/ )
@@ -76,46 +311,8 @@ void nv::Quantize::FloydSteinberg_BinaryAlpha( Image * image, int alpha_threshol
 {
 	nvCheck(image != NULL);
 	
-	const uint w = image->width();
-	const uint h = image->height();
-	
-	// @@ Use fixed point?
-	float * row0 = new float[(w+2)];
-	float * row1 = new float[(w+2)];
-	memset(row0, 0, sizeof(float)*(w+2));
-	memset(row1, 0, sizeof(float)*(w+2));
-	
-	for (uint y = 0; y < h; y++) {
-		for (uint x = 0; x < w; x++) {
-			
-			Color32 pixel = image->pixel(x, y);
-			
-			// Add error.
-			int alpha = int(pixel.a) + int(row0[1+x]);
-			
-			// Convert color.
-			if (alpha > alpha_threshold) pixel.a = 255;
-			else pixel.a = 0;
-			
-			// Store color.
-			image->pixel(x, y) = pixel;
-			
-			// Compute new error.
-			float diff = float(alpha - pixel.a);
-			
-			// Propagate new error.
-			row0[1+x+1] += 7.0f / 16.0f * diff;
-			row1[1+x-1] += 3.0f / 16.0f * diff;
-			row1[1+x+0] += 5.0f / 16.0f * diff;
-			row1[1+x+1] += 1.0f / 16.0f * diff;
-		}
-		
-		swap(row0, row1);
-		memset(row1, 0, sizeof(float)*(w+2));
-	}
-	
-	delete [] row0;
-	delete [] row1;
+	BinaryAlphaQuantizer quantizer = { image, alpha_threshold };
+	floydSteinberg(quantizer, image->width(), image->height());
 }
 
 
@@ -163,60 +360,57 @@ void nv::Quantize::FloydSteinberg(Image * image, uint rsize, uint gsize, uint bs
 {
 	nvCheck(image != NULL);
 	
+	ColorQuantizer quantizer = { image, rsize, gsize, bsize, asize };
+	floydSteinberg(quantizer, image->width(), image->height());
+}
+
+
+// Error diffusion. Floyd Steinberg.
+void nv::Quantize::FloydSteinberg(FloatImage * image, uint channel, uint bits, bool exactEndPoints)
+{
+	nvCheck(image != NULL);
+
 	const uint w = image->width();
 	const uint h = image->height();
-	
-	Vector4 * row0 = new Vector4[w+2];
-	Vector4 * row1 = new Vector4[w+2];
-	memset(row0, 0, sizeof(Vector4)*(w+2));
-	memset(row1, 0, sizeof(Vector4)*(w+2));
-	
-	for (uint y = 0; y < h; y++) {
-		for (uint x = 0; x < w; x++) {
-			
-			Color32 pixel = image->pixel(x, y);
 
-			// Add error.
-			pixel.r = clamp(int(pixel.r) + int(row0[1+x].x), 0, 255);
-			pixel.g = clamp(int(pixel.g) + int(row0[1+x].y), 0, 255);
-			pixel.b = clamp(int(pixel.b) + int(row0[1+x].z), 0, 255);
-			pixel.a = clamp(int(pixel.a) + int(row0[1+x].w), 0, 255);
-			
-			int r = pixel.r;
-			int g = pixel.g;
-			int b = pixel.b;
-			int a = pixel.a;
+	UniformQuantizer quantizer;
+	quantizer.w = w;
+	if (exactEndPoints) {
+		// floor(x*(range-1) + 0.5) / (range-1)
+		quantizer.scale = float((1 << bits) - 1);
+		quantizer.offset0 = 0.5f;
+		quantizer.offset1 = 0.0f;
+	}
+	else {
+		// (floor(x*range) + 0.5) / range
+		quantizer.scale = float(1 << bits);
+		quantizer.offset0 = 0.0f;
+		quantizer.offset1 = 0.5f;
+	}
 
-			// Convert to our desired size, and reconstruct.
-			r = PixelFormat::convert(r, 8, rsize);
-			r = PixelFormat::convert(r, rsize, 8);
+	// @@ Extend Floyd-Steinberg dithering to 3D properly.
+	for (uint z = 0; z < image->depth(); z++) {
+		quantizer.channel = image->channel(channel) + z * w * h;
+		floydSteinberg(quantizer, w, h);
+	}
+}
 
-			g = PixelFormat::convert(g, 8, gsize);
-			g = PixelFormat::convert(g, gsize, 8);
 
-			b = PixelFormat::convert(b, 8, bsize);
-			b = PixelFormat::convert(b, bsize, 8);
+// Error diffusion. Floyd Steinberg.
+void nv::Quantize::FloydSteinberg_Binary(FloatImage * image, uint channel, float threshold)
+{
+	nvCheck(image != NULL);
 
-			a = PixelFormat::convert(a, 8, asize);
-			a = PixelFormat::convert(a, asize, 8);
+	const uint w = image->width();
+	const uint h = image->height();
 
-			// Store color.
-			image->pixel(x, y) = Color32(r, g, b, a);
-			
-			// Compute new error.
-			Vector4 diff(float(int(pixel.r) - r), float(int(pixel.g) - g), float(int(pixel.b) - b), float(int(pixel.a) - a));
-			
-			// Propagate new error.
-			row0[1+x+1] += 7.0f / 16.0f * diff;
-			row1[1+x-1] += 3.0f / 16.0f * diff;
-			row1[1+x+0] += 5.0f / 16.0f * diff;
-			row1[1+x+1] += 1.0f / 16.0f * diff;
-		}
-		
-		swap(row0, row1);
-		memset(row1, 0, sizeof(Vector4)*(w+2));
+	ThresholdQuantizer quantizer;
+	quantizer.w = w;
+	quantizer.threshold = threshold;
+
+	// @@ Extend Floyd-Steinberg dithering to 3D properly.
+	for (uint z = 0; z < image->depth(); z++) {
+		quantizer.channel = image->channel(channel) + z * w * h;
+		floydSteinberg(quantizer, w, h);
 	}
-	
-	delete [] row0;
-	delete [] row1;
 }
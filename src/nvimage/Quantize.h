@@ -10,6 +10,7 @@
 namespace nv
 {
 	class Image;
+	class FloatImage;
 
 	namespace Quantize
 	{
@@ -24,6 +25,10 @@ namespace nv
 		void Truncate(Image * image, uint rsize, uint gsize, uint bsize, uint asize);
 		void FloydSteinberg(Image * image, uint rsize, uint gsize, uint bsize, uint asize);
 
+		// Error diffusion of one channel of each slice of a float image, to bits like Surface::quantize, or to 0 and 1.
+		void FloydSteinberg(FloatImage * image, uint channel, uint bits, bool exactEndPoints);
+		void FloydSteinberg_Binary(FloatImage * image, uint channel, float threshold);
+
 		// @@ Add palette quantization algorithms!
 	}
 }
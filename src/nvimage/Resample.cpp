@@ -0,0 +1,249 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#include "Resample.h"
+#include "Filter.h"
+
+#include "nvmath/nvmath.h"
+#include "nvmath/ftoi.h"
+
+#include "nvcore/Array.inl"
+
+#include "nvthread/TaskScheduler.h"
+
+#include "nvcore/CpuInfo.h"
+
+#include <stdlib.h> // abs
+
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
+using namespace nv;
+
+namespace nv {
+    uint resampleColumnsAVX2(const uint8 * const * rows, const int16 * weights, int tapCount, uint w, int round, int shift, int16 * row);
+}
+
+namespace
+{
+    // Below this many output texels the resampler runs on the calling thread.
+    const uint kParallelResampleThreshold = 64 * 1024;
+
+    // Approximate number of output texels computed by each task.
+    const uint kResampleTaskSize = 16 * 1024;
+
+    // The weights are in 2.14 fixed point. The vertical pass keeps 6 fractional bits in the 16 bit intermediate rows, enough
+    // for the overshoot of the filters with negative lobes.
+    const int kWeightBits = 14;
+    const int kIntermediateBits = 6;
+
+    // Wider kernels, for large reductions, would lose too much precision in their small weights.
+    const int kMaxWindowSize = 64;
+
+    // The taps of a polyphase kernel in fixed point, padded with zero weights to a multiple of padding taps.
+    struct FixedPointKernel
+    {
+        uint length;
+        int windowSize;                 // Taps of the polyphase kernel.
+        int paddedSize;                 // Taps stored per output sample.
+        Array<int> left;                // First source sample of each output sample.
+        Array<int16> weights;
+    };
+
+    static bool initFixedPointKernel(FixedPointKernel & k, const Filter & filter, uint srcLength, uint dstLength, int padding)
+    {
+        PolyphaseKernel kernel(filter, srcLength, dstLength, 32);
+
+        if (kernel.windowSize() > kMaxWindowSize) {
+            return false;
+        }
+
+        k.length = dstLength;
+        k.windowSize = kernel.windowSize();
+        k.paddedSize = (k.windowSize + padding - 1) / padding * padding;
+        k.left.resize(dstLength);
+        k.weights.resize(dstLength * k.paddedSize);
+
+        const float iscale = 1.0f / (float(dstLength) / float(srcLength));
+
+        for (uint i = 0; i < dstLength; i++) {
+            const float center = (0.5f + i) * iscale;
+            k.left[i] = (int)floorf(center - kernel.width());
+
+            // Round the weights and give the rounding error to the largest one, so that they add up to one exactly and flat
+            // areas keep their value.
+            int16 * weights = k.weights.buffer() + i * k.paddedSize;
+            int sum = 0;
+            int largest = 0;
+            for (int j = 0; j < k.windowSize; j++) {
+                const int w = ftoi_round(kernel.valueAt(i, j) * (1 << kWeightBits));
+                nvDebugCheck(w >= -32768 && w <= 32767);
+                weights[j] = int16(w);
+                sum += w;
+                if (abs(w) > abs(weights[largest])) largest = j;
+            }
+            weights[largest] = int16(weights[largest] + (1 << kWeightBits) - sum);
+
+            for (int j = k.windowSize; j < k.paddedSize; j++) {
+                weights[j] = 0;
+            }
+        }
+
+        return true;
+    }
+
+    static int wrap(int x, int w, FloatImage::WrapMode wm)
+    {
+        if (wm == FloatImage::WrapMode_Clamp) return wrapClamp(x, w);
+        if (wm == FloatImage::WrapMode_Repeat) return wrapRepeat(x, w);
+        return wrapMirror(x, w);
+    }
+
+    struct ResampleContext
+    {
+        const uint8 * src;
+        uint8 * dst;
+        uint w, h;
+        uint dstWidth, dstHeight;
+        FloatImage::WrapMode wm;
+        FixedPointKernel xkernel;       // Padded to a multiple of 8 taps.
+        FixedPointKernel ykernel;       // Padded to a multiple of 2 taps.
+        bool avx2;
+    };
+
+    // Filter the source rows vertically into an intermediate row with kIntermediateBits fractional bits.
+    static void resampleColumns(const ResampleContext * ctx, const uint8 * plane, uint y, int16 * row)
+    {
+        const FixedPointKernel & k = ctx->ykernel;
+        const int16 * weights = k.weights.buffer() + y * k.paddedSize;
+        const int round = 1 << (kWeightBits - kIntermediateBits - 1);
+
+        // The padding tap reads the last row of the window with a zero weight.
+        const uint8 * rows[kMaxWindowSize];
+        nvDebugCheck(k.paddedSize <= kMaxWindowSize);
+        for (int j = 0; j < k.paddedSize; j++) {
+            rows[j] = plane + wrap(k.left[y] + min(j, k.windowSize - 1), int(ctx->h), ctx->wm) * ctx->w;
+        }
+
+        uint x = 0;
+#if defined(HAVE_AVX2)
+        if (ctx->avx2) {
+            x = resampleColumnsAVX2(rows, weights, k.paddedSize, ctx->w, round, kWeightBits - kIntermediateBits, row);
+        }
+#endif
+#if NV_USE_SSE > 1
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i vround = _mm_set1_epi32(round);
+        for (; x + 8 <= ctx->w; x += 8) {
+            __m128i lo = vround;
+            __m128i hi = vround;
+            for (int j = 0; j < k.paddedSize; j += 2) {
+                // Interleave two rows so that pmaddwd applies the weights of both taps at once.
+                const __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(rows[j] + x)), zero);
+                const __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(rows[j + 1] + x)), zero);
+                const __m128i w = _mm_set1_epi32(int((uint32(uint16(weights[j + 1])) << 16) | uint16(weights[j])));
+                lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+                hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+            }
+            lo = _mm_srai_epi32(lo, kWeightBits - kIntermediateBits);
+            hi = _mm_srai_epi32(hi, kWeightBits - kIntermediateBits);
+            _mm_storeu_si128((__m128i *)(row + x), _mm_packs_epi32(lo, hi));
+        }
+#endif
+        for (; x < ctx->w; x++) {
+            int sum = round;
+            for (int j = 0; j < k.paddedSize; j++) {
+                sum += weights[j] * rows[j][x];
+            }
+            row[x] = int16(clamp(sum >> (kWeightBits - kIntermediateBits), -32768, 32767));
+        }
+    }
+
+    // Filter an intermediate row horizontally into an output row.
+    static void resampleRow(const ResampleContext * ctx, const int16 * row, uint8 * output)
+    {
+        const FixedPointKernel & k = ctx->xkernel;
+        const int shift = kWeightBits + kIntermediateBits;
+        const int round = 1 << (shift - 1);
+
+        for (uint i = 0; i < ctx->dstWidth; i++) {
+            const int16 * weights = k.weights.buffer() + i * k.paddedSize;
+            const int left = k.left[i];
+
+            int sum = round;
+            if (left >= 0 && left + k.paddedSize <= int(ctx->w)) {
+                // The window, padding included, doesn't wrap.
+                const int16 * texels = row + left;
+                int j = 0;
+#if NV_USE_SSE > 1
+                __m128i acc = _mm_setzero_si128();
+                for (; j < k.paddedSize; j += 8) {
+                    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(texels + j)), _mm_loadu_si128((const __m128i *)(weights + j))));
+                }
+                acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+                acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+                sum += _mm_cvtsi128_si32(acc);
+#endif
+                for (; j < k.windowSize; j++) {
+                    sum += weights[j] * texels[j];
+                }
+            }
+            else {
+                for (int j = 0; j < k.windowSize; j++) {
+                    sum += weights[j] * row[wrap(left + j, int(ctx->w), ctx->wm)];
+                }
+            }
+
+            output[i] = uint8(clamp(sum >> shift, 0, 255));
+        }
+    }
+
+    // One item per output row, rows of all the planes are numbered consecutively. Each row is filtered vertically and then
+    // horizontally, so the intermediate row stays in cache.
+    static void ResampleTask(void * context, int begin, int end)
+    {
+        const ResampleContext * ctx = (const ResampleContext *)context;
+
+        Array<int16> row;
+        row.resize(ctx->w);
+
+        for (int idx = begin; idx < end; idx++) {
+            const uint y = uint(idx) % ctx->dstHeight;
+            const uint p = uint(idx) / ctx->dstHeight;
+
+            resampleColumns(ctx, ctx->src + p * ctx->w * ctx->h, y, row.buffer());
+            resampleRow(ctx, row.buffer(), ctx->dst + (p * ctx->dstHeight + y) * ctx->dstWidth);
+        }
+    }
+}
+
+bool nv::resampleUNorm8(const uint8 * src, uint w, uint h, uint planeCount, const Filter & filter, uint dstWidth, uint dstHeight, FloatImage::WrapMode wm, uint8 * dst)
+{
+    nvDebugCheck(src != NULL && dst != NULL && src != dst);
+
+    ResampleContext context;
+    context.src = src;
+    context.dst = dst;
+    context.w = w;
+    context.h = h;
+    context.dstWidth = dstWidth;
+    context.dstHeight = dstHeight;
+    context.wm = wm;
+    context.avx2 = (cpuFeatures() & CpuFeature_AVX2) != 0;
+    if (!initFixedPointKernel(context.xkernel, filter, w, dstWidth, 8) ||
+        !initFixedPointKernel(context.ykernel, filter, h, dstHeight, 2)) {
+        return false;
+    }
+
+    const uint rowCount = planeCount * dstHeight;
+
+    if (rowCount * dstWidth < kParallelResampleThreshold) {
+        ResampleTask(&context, 0, rowCount);
+    }
+    else {
+        const uint step = max(1U, kResampleTaskSize / dstWidth);
+        TaskScheduler::global()->parallelFor(ResampleTask, &context, rowCount, step);
+    }
+
+    return true;
+}
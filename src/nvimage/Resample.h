@@ -0,0 +1,22 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+#pragma once
+#ifndef NV_IMAGE_RESAMPLE_H
+#define NV_IMAGE_RESAMPLE_H
+
+#include "nvimage.h"
+#include "FloatImage.h" // WrapMode
+
+namespace nv
+{
+    class Filter;
+
+    // Resize planes of 8 bit unorm texels with a separable filter, in 16 bit fixed point. The planes are stored one after the
+    // other, src holds planeCount planes of w * h texels and dst planeCount planes of dstWidth * dstHeight texels. The result
+    // is within one unit of the floating point resize rounded to 8 bits. Returns false without writing dst when the filter
+    // covers too many texels for the fixed point weights, for reductions of more than about 8 times.
+    bool resampleUNorm8(const uint8 * src, uint w, uint h, uint planeCount, const Filter & filter, uint dstWidth, uint dstHeight, FloatImage::WrapMode wm, uint8 * dst);
+
+} // nv namespace
+
+#endif // NV_IMAGE_RESAMPLE_H
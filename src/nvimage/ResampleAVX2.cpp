@@ -0,0 +1,82 @@
+// This code is in the public domain -- castanyo@yahoo.es
+
+// AVX2 versions of the vertical pass of resampleUNorm8 and of the row loops of the FloatImage filters. This file is
+// compiled with ${NV_AVX2_FLAGS}, so it must not call inline functions that other files may also instantiate.
+
+#include "nvcore/nvcore.h"
+
+#include <immintrin.h>
+
+namespace nv {
+    uint resampleColumnsAVX2(const uint8 * const * rows, const int16 * weights, int tapCount, uint w, int round, int shift, int16 * row);
+    uint addScaledLineAVX2(float * dst, const float * src, float w, uint count);
+    uint addProductLineAVX2(float * dst, const float * w, const float * src, uint count);
+    int convolveRowAVX2(const float * const * row, const int * tapX, const int * tapY, const float * tapWeight, int tapCount, int r, int x, int end, float * dst);
+}
+
+// Filter the columns of the source rows 16 at a time, with the same arithmetic as the SSE2 loop of resampleColumns.
+// tapCount is even. Returns the number of columns done.
+uint nv::resampleColumnsAVX2(const uint8 * const * rows, const int16 * weights, int tapCount, uint w, int round, int shift, int16 * row)
+{
+    const __m256i vround = _mm256_set1_epi32(round);
+    const __m128i vshift = _mm_cvtsi32_si128(shift);
+
+    uint x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m256i lo = vround;
+        __m256i hi = vround;
+        for (int j = 0; j < tapCount; j += 2) {
+            // The unpacks work on each 128 bit half, and so does the pack below, which restores the order of the columns.
+            const __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[j] + x)));
+            const __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(rows[j + 1] + x)));
+            const __m256i wj = _mm256_set1_epi32(int((uint32(uint16(weights[j + 1])) << 16) | uint16(weights[j])));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), wj));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), wj));
+        }
+        lo = _mm256_sra_epi32(lo, vshift);
+        hi = _mm256_sra_epi32(hi, vshift);
+        _mm256_storeu_si256((__m256i *)(row + x), _mm256_packs_epi32(lo, hi));
+    }
+
+    return x;
+}
+
+// dst[i] += w * src[i], 8 at a time. Returns the number of elements done.
+uint nv::addScaledLineAVX2(float * __restrict dst, const float * __restrict src, float w, uint count)
+{
+    const __m256 vw = _mm256_set1_ps(w);
+
+    uint i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(vw, _mm256_loadu_ps(src + i))));
+    }
+
+    return i;
+}
+
+// dst[i] += w[i] * src[i], 8 at a time. Returns the number of elements done.
+uint nv::addProductLineAVX2(float * __restrict dst, const float * __restrict w, const float * __restrict src, uint count)
+{
+    uint i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_mul_ps(_mm256_loadu_ps(w + i), _mm256_loadu_ps(src + i))));
+    }
+
+    return i;
+}
+
+// Apply the taps to the texels in [x, end) of a row whose window doesn't wrap, 8 at a time, summing the taps in the same
+// order as the scalar loop. r is the radius of the window. Returns the first texel not done.
+int nv::convolveRowAVX2(const float * const * row, const int * tapX, const int * tapY, const float * tapWeight, int tapCount, int r, int x, int end, float * dst)
+{
+    for (; x + 8 <= end; x += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        for (int t = 0; t < tapCount; t++) {
+            const __m256 v = _mm256_loadu_ps(row[tapY[t]] + x + tapX[t] - r);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(tapWeight[t]), v));
+        }
+        _mm256_storeu_ps(dst + x, sum);
+    }
+
+    return x;
+}
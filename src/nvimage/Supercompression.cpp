@@ -0,0 +1,376 @@
+// This code is in the public domain -- castano@gmail.com
+
+#include "Supercompression.h"
+
+#include "nvcore/Array.inl"
+#include "nvcore/Stream.h"
+#include "nvcore/Utils.h" // min
+
+#include "nvthread/TaskScheduler.h"
+
+#include <string.h> // memcpy
+
+#if defined(HAVE_ZLIB)
+#   include <zlib.h>
+#endif
+
+#if defined(HAVE_ZSTD)
+#   include <zstd.h>
+#endif
+
+#if defined(HAVE_LZ4)
+#   include <lz4.h>
+#   include <lz4hc.h>
+#endif
+
+using namespace nv;
+
+
+namespace
+{
+    // Size of the pieces of the reordered surface that are compressed independently.
+    const uint kChunkSize = 256 * 1024;
+
+    // Chunks that didn't get any smaller are stored as is, with this bit set in their size.
+    const uint kStoredChunk = 0x80000000;
+
+    struct BlockField
+    {
+        uint offset;
+        uint size;
+    };
+
+    // Endpoints first, then indices.
+    const BlockField s_bc1Fields[] = { {0, 4}, {4, 4} };
+    const BlockField s_bc2Fields[] = { {8, 4}, {0, 8}, {12, 4} };
+    const BlockField s_bc3Fields[] = { {0, 2}, {8, 4}, {2, 6}, {12, 4} };
+    const BlockField s_bc4Fields[] = { {0, 2}, {2, 6} };
+    const BlockField s_bc5Fields[] = { {0, 2}, {8, 2}, {2, 6}, {10, 6} };
+
+    // Returns NULL when the surface is not reordered.
+    const BlockField * blockFields(uint layout, uint size, uint * fieldCount, uint * blockSize)
+    {
+        const BlockField * fields = NULL;
+        uint count = 0;
+
+        switch (layout) {
+            case BlockLayout_BC1: fields = s_bc1Fields; count = NV_ARRAY_SIZE(s_bc1Fields); break;
+            case BlockLayout_BC2: fields = s_bc2Fields; count = NV_ARRAY_SIZE(s_bc2Fields); break;
+            case BlockLayout_BC3: fields = s_bc3Fields; count = NV_ARRAY_SIZE(s_bc3Fields); break;
+            case BlockLayout_BC4: fields = s_bc4Fields; count = NV_ARRAY_SIZE(s_bc4Fields); break;
+            case BlockLayout_BC5: fields = s_bc5Fields; count = NV_ARRAY_SIZE(s_bc5Fields); break;
+            default: return NULL;
+        }
+
+        uint bytes = 0;
+        for (uint i = 0; i < count; i++) bytes += fields[i].size;
+
+        if (size % bytes != 0) return NULL;
+
+        *fieldCount = count;
+        *blockSize = bytes;
+        return fields;
+    }
+
+    // Gather each field of all the blocks together, or scatter them back.
+    void reorderBlocks(uint layout, const uint8 * src, uint8 * dst, uint size, bool restore)
+    {
+        uint fieldCount, blockSize;
+        const BlockField * fields = blockFields(layout, size, &fieldCount, &blockSize);
+
+        if (fields == NULL) {
+            memcpy(dst, src, size);
+            return;
+        }
+
+        const uint blockCount = size / blockSize;
+        uint fieldStart = 0;
+
+        for (uint i = 0; i < fieldCount; i++) {
+            const uint offset = fields[i].offset;
+            const uint fieldSize = fields[i].size;
+
+            for (uint b = 0; b < blockCount; b++) {
+                if (restore) memcpy(dst + b * blockSize + offset, src + fieldStart + b * fieldSize, fieldSize);
+                else memcpy(dst + fieldStart + b * fieldSize, src + b * blockSize + offset, fieldSize);
+            }
+
+            fieldStart += blockCount * fieldSize;
+        }
+    }
+
+    uint compressBound(uint scheme, uint size)
+    {
+        switch (scheme) {
+#if defined(HAVE_ZLIB)
+            case Supercompression_Deflate: return uint(::compressBound(size));
+#endif
+#if defined(HAVE_ZSTD)
+            case Supercompression_Zstd: return uint(ZSTD_compressBound(size));
+#endif
+#if defined(HAVE_LZ4)
+            case Supercompression_LZ4: return uint(LZ4_compressBound(int(size)));
+#endif
+            default: return size;
+        }
+    }
+
+    // Returns the compressed size, 0 on failure.
+    uint compressChunk(uint scheme, int level, const uint8 * src, uint size, uint8 * dst, uint capacity)
+    {
+        switch (scheme) {
+#if defined(HAVE_ZLIB)
+            case Supercompression_Deflate: {
+                uLongf dstSize = capacity;
+                if (compress2(dst, &dstSize, src, size, level > 0 ? min(level, 9) : Z_DEFAULT_COMPRESSION) != Z_OK) return 0;
+                return uint(dstSize);
+            }
+#endif
+#if defined(HAVE_ZSTD)
+            case Supercompression_Zstd: {
+                size_t dstSize = ZSTD_compress(dst, capacity, src, size, level);
+                if (ZSTD_isError(dstSize)) return 0;
+                return uint(dstSize);
+            }
+#endif
+#if defined(HAVE_LZ4)
+            case Supercompression_LZ4: {
+                if (level > 0) return uint(LZ4_compress_HC((const char *)src, (char *)dst, int(size), int(capacity), level));
+                return uint(LZ4_compress_default((const char *)src, (char *)dst, int(size), int(capacity)));
+            }
+#endif
+            default: return 0;
+        }
+    }
+
+    bool decompressChunk(uint scheme, const uint8 * src, uint size, uint8 * dst, uint dstSize)
+    {
+        switch (scheme) {
+#if defined(HAVE_ZLIB)
+            case Supercompression_Deflate: {
+                uLongf decodedSize = dstSize;
+                return uncompress(dst, &decodedSize, src, size) == Z_OK && decodedSize == dstSize;
+            }
+#endif
+#if defined(HAVE_ZSTD)
+            case Supercompression_Zstd:
+                return ZSTD_decompress(dst, dstSize, src, size) == dstSize;
+#endif
+#if defined(HAVE_LZ4)
+            case Supercompression_LZ4:
+                return LZ4_decompress_safe((const char *)src, (char *)dst, int(size), int(dstSize)) == int(dstSize);
+#endif
+            default: return false;
+        }
+    }
+
+    struct ChunkContext
+    {
+        uint scheme;
+        int level;
+        const uint8 * src;      // Reordered surface, or encoded chunks.
+        uint8 * dst;
+        uint size;              // Of the surface.
+        uint capacity;          // Of the output of each chunk when encoding.
+        uint * chunkSizes;
+        const uint * chunkOffsets;
+        bool failed;
+    };
+
+    // Each chunk is written to its own slot of capacity bytes.
+    void EncodeChunkTask(void * context, int i)
+    {
+        ChunkContext * ctx = (ChunkContext *)context;
+
+        const uint8 * src = ctx->src + i * kChunkSize;
+        const uint size = min(kChunkSize, ctx->size - i * kChunkSize);
+        uint8 * dst = ctx->dst + size_t(i) * ctx->capacity;
+
+        uint compressedSize = compressChunk(ctx->scheme, ctx->level, src, size, dst, ctx->capacity);
+        if (compressedSize == 0 || compressedSize >= size) {
+            memcpy(dst, src, size);
+            compressedSize = size | kStoredChunk;
+        }
+
+        ctx->chunkSizes[i] = compressedSize;
+    }
+
+    void DecodeChunkTask(void * context, int i)
+    {
+        ChunkContext * ctx = (ChunkContext *)context;
+
+        const uint8 * src = ctx->src + ctx->chunkOffsets[i];
+        const uint compressedSize = ctx->chunkSizes[i] & ~kStoredChunk;
+        uint8 * dst = ctx->dst + i * kChunkSize;
+        const uint size = min(kChunkSize, ctx->size - i * kChunkSize);
+
+        if (ctx->chunkSizes[i] & kStoredChunk) {
+            if (compressedSize != size) ctx->failed = true;
+            else memcpy(dst, src, size);
+        }
+        else if (!decompressChunk(ctx->scheme, src, compressedSize, dst, size)) {
+            ctx->failed = true;
+        }
+    }
+
+    // Read the size of the surface and its chunk table.
+    bool readChunkTable(Stream & s, uint * size, Array<uint> & chunkSizes)
+    {
+        uint32 header[2];
+        if (s.serialize(header, sizeof(header)) != sizeof(header)) return false;
+
+        const uint chunkCount = (header[0] + kChunkSize - 1) / kChunkSize;
+        if (header[1] != chunkCount) return false;
+
+        chunkSizes.resize(chunkCount);
+        if (chunkCount > 0 && s.serialize(chunkSizes.buffer(), chunkCount * 4) != chunkCount * 4) return false;
+
+        *size = header[0];
+        return true;
+    }
+
+} // namespace
+
+
+bool nv::isSupercompressionSupported(uint scheme)
+{
+    switch (scheme) {
+#if defined(HAVE_ZLIB)
+        case Supercompression_Deflate: return true;
+#endif
+#if defined(HAVE_ZSTD)
+        case Supercompression_Zstd: return true;
+#endif
+#if defined(HAVE_LZ4)
+        case Supercompression_LZ4: return true;
+#endif
+        default: return false;
+    }
+}
+
+const char * nv::supercompressionName(uint scheme)
+{
+    switch (scheme) {
+        case Supercompression_None: return "none";
+        case Supercompression_Deflate: return "deflate";
+        case Supercompression_Zstd: return "zstd";
+        case Supercompression_LZ4: return "lz4";
+        default: return "unknown";
+    }
+}
+
+bool nv::supercompress(uint scheme, int level, uint layout, const void * data, uint size, Array<uint8> * output)
+{
+    if (!isSupercompressionSupported(scheme)) return false;
+
+    const uint chunkCount = (size + kChunkSize - 1) / kChunkSize;
+
+    Array<uint8> reordered;
+    reordered.resize(size);
+    reorderBlocks(layout, (const uint8 *)data, reordered.buffer(), size, /*restore=*/false);
+
+    Array<uint> chunkSizes;
+    chunkSizes.resize(chunkCount);
+
+    ChunkContext context;
+    context.scheme = scheme;
+    context.level = level;
+    context.src = reordered.buffer();
+    context.size = size;
+    context.capacity = compressBound(scheme, kChunkSize);
+    context.chunkSizes = chunkSizes.buffer();
+    context.chunkOffsets = NULL;
+    context.failed = false;
+
+    Array<uint8> chunks;
+    chunks.resize(chunkCount * context.capacity);
+    context.dst = chunks.buffer();
+
+    if (chunkCount > 1) {
+        TaskScheduler::global()->parallelFor(EncodeChunkTask, &context, chunkCount);
+    }
+    else if (chunkCount == 1) {
+        EncodeChunkTask(&context, 0);
+    }
+
+    // Header, chunk table and the chunks one after the other.
+    const uint32 header[2] = { size, chunkCount };
+    output->clear();
+    output->append((const uint8 *)header, sizeof(header));
+    output->append((const uint8 *)chunkSizes.buffer(), chunkCount * 4);
+
+    for (uint i = 0; i < chunkCount; i++) {
+        output->append(chunks.buffer() + size_t(i) * context.capacity, chunkSizes[i] & ~kStoredChunk);
+    }
+
+    return true;
+}
+
+bool nv::decodeSupercompressed(uint scheme, uint layout, Stream & s, void * data, uint size)
+{
+    if (!isSupercompressionSupported(scheme)) return false;
+
+    uint decodedSize;
+    Array<uint> chunkSizes;
+    if (!readChunkTable(s, &decodedSize, chunkSizes) || decodedSize != size) return false;
+
+    const uint chunkCount = chunkSizes.count();
+
+    Array<uint> chunkOffsets;
+    chunkOffsets.resize(chunkCount);
+
+    uint64 total = 0;
+    for (uint i = 0; i < chunkCount; i++) {
+        chunkOffsets[i] = uint(total);
+        total += chunkSizes[i] & ~kStoredChunk;
+        if (total > kStoredChunk) return false;
+    }
+
+    Array<uint8> chunks;
+    chunks.resize(uint(total));
+    if (total > 0 && s.serialize(chunks.buffer(), uint(total)) != total) return false;
+
+    Array<uint8> reordered;
+    reordered.resize(size);
+
+    ChunkContext context;
+    context.scheme = scheme;
+    context.level = 0;
+    context.src = chunks.buffer();
+    context.dst = reordered.buffer();
+    context.size = size;
+    context.capacity = 0;
+    context.chunkSizes = chunkSizes.buffer();
+    context.chunkOffsets = chunkOffsets.buffer();
+    context.failed = false;
+
+    if (chunkCount > 1) {
+        TaskScheduler::global()->parallelFor(DecodeChunkTask, &context, chunkCount);
+    }
+    else if (chunkCount == 1) {
+        DecodeChunkTask(&context, 0);
+    }
+
+    if (context.failed) return false;
+
+    reorderBlocks(layout, reordered.buffer(), (uint8 *)data, size, /*restore=*/true);
+    return true;
+}
+
+bool nv::skipSupercompressed(Stream & s)
+{
+    uint size;
+    Array<uint> chunkSizes;
+    if (!readChunkTable(s, &size, chunkSizes)) return false;
+
+    uint64 total = 0;
+    for (uint i = 0; i < chunkSizes.count(); i++) {
+        total += chunkSizes[i] & ~kStoredChunk;
+    }
+
+    const uint64 end = s.tell() + total;
+    if (end > s.size()) return false;
+
+    s.seek(end);
+    return true;
+}
@@ -0,0 +1,50 @@
+// This code is in the public domain -- castano@gmail.com
+
+#pragma once
+#ifndef NV_IMAGE_SUPERCOMPRESSION_H
+#define NV_IMAGE_SUPERCOMPRESSION_H
+
+#include "nvimage.h"
+
+namespace nv
+{
+    class Stream;
+    template <typename T> class Array;
+
+    // Lossless compression on top of the compressed data of a surface.
+    enum SupercompressionScheme
+    {
+        Supercompression_None,
+        Supercompression_Deflate,   // zlib.
+        Supercompression_Zstd,
+        Supercompression_LZ4,
+    };
+
+    // Fields of the blocks that are grouped before compressing: the endpoints of all the blocks, then their indices.
+    enum BlockLayout
+    {
+        BlockLayout_None,   // Compressed as is.
+        BlockLayout_BC1,
+        BlockLayout_BC2,
+        BlockLayout_BC3,
+        BlockLayout_BC4,
+        BlockLayout_BC5,
+    };
+
+    // The schemes depend on the libraries available at build time.
+    NVIMAGE_API bool isSupercompressionSupported(uint scheme);
+    NVIMAGE_API const char * supercompressionName(uint scheme);
+
+    // A supercompressed surface starts with its original size and the table of its chunks, which are compressed
+    // independently, in parallel. A level of 0 selects the default of the scheme.
+    NVIMAGE_API bool supercompress(uint scheme, int level, uint layout, const void * data, uint size, Array<uint8> * output);
+
+    // Read the supercompressed surface at the current position of the stream and decode its 'size' bytes.
+    NVIMAGE_API bool decodeSupercompressed(uint scheme, uint layout, Stream & s, void * data, uint size);
+
+    // Skip the supercompressed surface at the current position of the stream. Returns false if the stream is truncated.
+    NVIMAGE_API bool skipSupercompressed(Stream & s);
+
+} // nv namespace
+
+#endif // NV_IMAGE_SUPERCOMPRESSION_H
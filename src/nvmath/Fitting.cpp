@@ -4,15 +4,27 @@
 #include "Vector.inl"
 #include "Plane.inl"
 
-#include "nvcore/Array.inl"
+#include "nvcore/StackArray.h"
 #include "nvcore/Utils.h" // max, swap
+#include "nvcore/Memory.h" // NV_ALIGN_16
 
 #include <float.h> // FLT_MAX
 //#include <vector>
 #include <string.h>
 
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 using namespace nv;
 
+#if NV_USE_SSE > 1
+static inline __m128 select(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
 // @@ Move to EigenSolver.h
 
 // @@ We should be able to do something cheaper...
@@ -253,6 +265,134 @@ Vector3 nv::Fit::computePrincipalComponent_PowerMethod(int n, const Vector3 *__r
     return firstEigenVector_PowerMethod(matrix);
 }
 
+#if NV_USE_SSE > 1
+
+// Same as firstEigenVector_PowerMethod, for four matrices at once.
+static void firstEigenVector_PowerMethod(const float *__restrict matrices, Vector3 *__restrict output)
+{
+    __m128 m[6];
+    for (int i = 0; i < 6; i++) {
+        m[i] = _mm_setr_ps(matrices[i], matrices[6 + i], matrices[12 + i], matrices[18 + i]);
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 isZero = _mm_and_ps(_mm_cmpeq_ps(m[0], zero), _mm_and_ps(_mm_cmpeq_ps(m[3], zero), _mm_cmpeq_ps(m[5], zero)));
+
+    // estimatePrincipalComponent
+    const __m128 r0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], m[0]), _mm_mul_ps(m[1], m[1])), _mm_mul_ps(m[2], m[2]));
+    const __m128 r1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[1], m[1]), _mm_mul_ps(m[3], m[3])), _mm_mul_ps(m[4], m[4]));
+    const __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[2], m[2]), _mm_mul_ps(m[4], m[4])), _mm_mul_ps(m[5], m[5]));
+    const __m128 pick0 = _mm_and_ps(_mm_cmpgt_ps(r0, r1), _mm_cmpgt_ps(r0, r2));
+    const __m128 pick1 = _mm_cmpgt_ps(r1, r2);
+
+    __m128 vx = select(pick0, m[0], select(pick1, m[1], m[2]));
+    __m128 vy = select(pick0, m[1], select(pick1, m[3], m[4]));
+    __m128 vz = select(pick0, m[2], select(pick1, m[4], m[5]));
+
+    const int NUM = 8;
+    for (int i = 0; i < NUM; i++)
+    {
+        __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m[0]), _mm_mul_ps(vy, m[1])), _mm_mul_ps(vz, m[2]));
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m[1]), _mm_mul_ps(vy, m[3])), _mm_mul_ps(vz, m[4]));
+        __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, m[2]), _mm_mul_ps(vy, m[4])), _mm_mul_ps(vz, m[5]));
+
+        // _mm_max_ps(a, b) returns b unless a > b, like max(a, b).
+        __m128 norm = _mm_max_ps(_mm_max_ps(x, y), z);
+        __m128 inorm = _mm_div_ps(_mm_set1_ps(1.0f), norm);
+
+        vx = _mm_mul_ps(x, inorm);
+        vy = _mm_mul_ps(y, inorm);
+        vz = _mm_mul_ps(z, inorm);
+    }
+
+    NV_ALIGN_16 float result[3][4];
+    _mm_store_ps(result[0], _mm_andnot_ps(isZero, vx));
+    _mm_store_ps(result[1], _mm_andnot_ps(isZero, vy));
+    _mm_store_ps(result[2], _mm_andnot_ps(isZero, vz));
+
+    for (int i = 0; i < 4; i++) {
+        output[i] = Vector3(result[0][i], result[1][i], result[2][i]);
+    }
+}
+
+#endif // NV_USE_SSE > 1
+
+void nv::Fit::computePrincipalComponents_PowerMethod(int count, const float *__restrict matrices, Vector3 *__restrict output)
+{
+    int i = 0;
+#if NV_USE_SSE > 1
+    for (; i + 4 <= count; i += 4) {
+        firstEigenVector_PowerMethod(matrices + 6 * i, output + i);
+    }
+#endif
+    for (; i < count; i++) {
+        output[i] = firstEigenVector_PowerMethod(matrices + 6 * i);
+    }
+}
+
+
+// Closed form eigenvector of the largest eigenvalue, see "Eigenvalues of a symmetric 3x3 matrix", Oliver K. Smith, 1961.
+// The eigenvector is the largest cross product of two rows of (A - lambda I), which spans its null space.
+static Vector3 firstEigenVector_Analytic(const float *__restrict matrix)
+{
+    if (matrix[0] == 0 && matrix[3] == 0 && matrix[5] == 0)
+    {
+        return Vector3(0.0f);
+    }
+
+    const float offdiagonal = matrix[1] * matrix[1] + matrix[2] * matrix[2] + matrix[4] * matrix[4];
+    const float q = (matrix[0] + matrix[3] + matrix[5]) / 3.0f;
+    const float a00 = matrix[0] - q;
+    const float a11 = matrix[3] - q;
+    const float a22 = matrix[5] - q;
+    const float p = sqrtf((a00 * a00 + a11 * a11 + a22 * a22 + 2.0f * offdiagonal) / 6.0f);
+
+    // A multiple of the identity, any direction is an eigenvector.
+    if (p == 0.0f) return estimatePrincipalComponent(matrix);
+
+    // det((A - q I) / p) / 2 is the cosine of three times the angle of the largest eigenvalue.
+    const float det = a00 * (a11 * a22 - matrix[4] * matrix[4]) - matrix[1] * (matrix[1] * a22 - matrix[4] * matrix[2]) + matrix[2] * (matrix[1] * matrix[4] - a11 * matrix[2]);
+    const float r = clamp(det / (2.0f * p * p * p), -1.0f, 1.0f);
+    const float lambda = q + 2.0f * p * cosf(acosf(r) / 3.0f);
+
+    const Vector3 row0(matrix[0] - lambda, matrix[1], matrix[2]);
+    const Vector3 row1(matrix[1], matrix[3] - lambda, matrix[4]);
+    const Vector3 row2(matrix[2], matrix[4], matrix[5] - lambda);
+
+    const Vector3 c01 = cross(row0, row1);
+    const Vector3 c02 = cross(row0, row2);
+    const Vector3 c12 = cross(row1, row2);
+    const float d01 = lengthSquared(c01);
+    const float d02 = lengthSquared(c02);
+    const float d12 = lengthSquared(c12);
+
+    Vector3 v = c01;
+    float d = d01;
+    if (d02 > d) { v = c02; d = d02; }
+    if (d12 > d) { v = c12; d = d12; }
+
+    // The largest eigenvalue is repeated, any direction in its plane will do.
+    if (d == 0.0f) return estimatePrincipalComponent(matrix);
+
+    return v * (1.0f / sqrtf(d));
+}
+
+Vector3 nv::Fit::computePrincipalComponent_Analytic(int n, const Vector3 *__restrict points)
+{
+    float matrix[6];
+    computeCovariance(n, points, matrix);
+
+    return firstEigenVector_Analytic(matrix);
+}
+
+Vector3 nv::Fit::computePrincipalComponent_Analytic(int n, const Vector3 *__restrict points, const float *__restrict weights, Vector3::Arg metric)
+{
+    float matrix[6];
+    computeCovariance(n, points, weights, metric, matrix);
+
+    return firstEigenVector_Analytic(matrix);
+}
+
 
 
 static inline Vector3 firstEigenVector_EigenSolver3(const float *__restrict matrix)
@@ -327,10 +467,13 @@ Vector4 nv::Fit::computePrincipalComponent_EigenSolver(int n, const Vector4 *__r
 
 void ArvoSVD(int rows, int cols, float * Q, float * diag, float * R);
 
+// The SVD buffers stay on the stack for up to a block worth of points.
+static const uint MaxSvdPoints = 16;
+
 Vector3 nv::Fit::computePrincipalComponent_SVD(int n, const Vector3 *__restrict points)
 {
 	// Store the points in an n x n matrix
-    Array<float> Q; Q.resize(n*n, 0.0f);
+    StackArray<float, MaxSvdPoints*MaxSvdPoints> Q(n*n, 0.0f);
 	for (int i = 0; i < n; ++i)
 	{
 		Q[i*n+0] = points[i].x;
@@ -339,8 +482,8 @@ Vector3 nv::Fit::computePrincipalComponent_SVD(int n, const Vector3 *__restrict
 	}
 
 	// Alloc space for the SVD outputs
-    Array<float> diag; diag.resize(n, 0.0f);
-    Array<float> R; R.resize(n*n, 0.0f);
+    StackArray<float, MaxSvdPoints> diag(n, 0.0f);
+    StackArray<float, MaxSvdPoints*MaxSvdPoints> R(n*n, 0.0f);
 
 	ArvoSVD(n, n, &Q[0], &diag[0], &R[0]);
 
@@ -351,7 +494,7 @@ Vector3 nv::Fit::computePrincipalComponent_SVD(int n, const Vector3 *__restrict
 Vector4 nv::Fit::computePrincipalComponent_SVD(int n, const Vector4 *__restrict points)
 {
 	// Store the points in an n x n matrix
-    Array<float> Q; Q.resize(n*n, 0.0f);
+    StackArray<float, MaxSvdPoints*MaxSvdPoints> Q(n*n, 0.0f);
 	for (int i = 0; i < n; ++i)
 	{
 		Q[i*n+0] = points[i].x;
@@ -361,8 +504,8 @@ Vector4 nv::Fit::computePrincipalComponent_SVD(int n, const Vector4 *__restrict
 	}
 
 	// Alloc space for the SVD outputs
-    Array<float> diag; diag.resize(n, 0.0f);
-    Array<float> R; R.resize(n*n, 0.0f);
+    StackArray<float, MaxSvdPoints> diag(n, 0.0f);
+    StackArray<float, MaxSvdPoints*MaxSvdPoints> R(n*n, 0.0f);
 
 	ArvoSVD(n, n, &Q[0], &diag[0], &R[0]);
 
@@ -819,6 +962,9 @@ static bool EigenSolver4_QLAlgorithm(float mat[4][4], float * diag, float * subd
 
 
 
+// Upper bound on the refinement steps of compute4Means, the clusters usually settle in a few.
+static const int MaxMeansIterations = 32;
+
 int nv::Fit::compute4Means(int n, const Vector3 *__restrict points, const float *__restrict weights, Vector3::Arg metric, Vector3 *__restrict cluster)
 {
     // Compute principal component.
@@ -853,7 +999,8 @@ int nv::Fit::compute4Means(int n, const Vector3 *__restrict points, const float
     cluster[3] = (2.0f * cluster[1] + cluster[0]) / 3.0f;
 
     // Now we have to iteratively refine the clusters.
-    while (true)
+    int clusterCount = 0;
+    for (int iteration = 0; iteration < MaxMeansIterations; iteration++)
     {
         Vector3 newCluster[4] = { Vector3(0.0f), Vector3(0.0f), Vector3(0.0f), Vector3(0.0f) };
         float total[4] = {0, 0, 0, 0};
@@ -883,10 +1030,12 @@ int nv::Fit::compute4Means(int n, const Vector3 *__restrict points, const float
                 newCluster[j] /= total[j];
         }
 
+        clusterCount = (total[0] != 0) + (total[1] != 0) + (total[2] != 0) + (total[3] != 0);
+
         if (equal(cluster[0], newCluster[0]) && equal(cluster[1], newCluster[1]) && 
             equal(cluster[2], newCluster[2]) && equal(cluster[3], newCluster[3]))
         {
-            return (total[0] != 0) + (total[1] != 0) + (total[2] != 0) + (total[3] != 0);
+            return clusterCount;
         }
 
         cluster[0] = newCluster[0];
@@ -904,6 +1053,398 @@ int nv::Fit::compute4Means(int n, const Vector3 *__restrict points, const float
             }
         }
     }
+
+    return clusterCount;
+}
+
+#if NV_USE_SSE > 1
+
+static inline __m128 equal(__m128 f0, __m128 f1)
+{
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 scale = _mm_max_ps(_mm_max_ps(_mm_set1_ps(1.0f), _mm_and_ps(f0, absMask)), _mm_and_ps(f1, absMask));
+    return _mm_cmple_ps(_mm_and_ps(_mm_sub_ps(f0, f1), absMask), _mm_mul_ps(_mm_set1_ps(NV_EPSILON), scale));
+}
+
+// Same as compute4Means, for up to four point sets at once, one in each lane. Every lane goes through the operations of
+// the scalar version in the same order, so the results are identical.
+static void compute4Means(int count, const Vector3 (*__restrict points)[16], const float (*__restrict weights)[16], const int *__restrict n,
+    Vector3::Arg metric, Vector3 (*__restrict cluster)[4], int *__restrict clusterCount)
+{
+    const __m128 zero = _mm_setzero_ps();
+
+    // Compute principal components.
+    NV_ALIGN_16 float matrix[4][6] = {};
+    NV_ALIGN_16 float centroid[3][4] = {};
+    NV_ALIGN_16 float pointCount[4] = {};
+    int maxCount = 0;
+    for (int lane = 0; lane < count; lane++) {
+        nvDebugCheck(n[lane] > 0 && n[lane] <= 16);
+        Vector3 c = Fit::computeCovariance(n[lane], points[lane], weights[lane], metric, matrix[lane]);
+        centroid[0][lane] = c.x;
+        centroid[1][lane] = c.y;
+        centroid[2][lane] = c.z;
+        pointCount[lane] = float(n[lane]);
+        maxCount = max(maxCount, n[lane]);
+    }
+
+    Vector3 principalArray[4];
+    firstEigenVector_PowerMethod(matrix[0], principalArray);
+
+    __m128 principal[3];
+    for (int k = 0; k < 3; k++) {
+        principal[k] = _mm_setr_ps(principalArray[0].component[k], principalArray[1].component[k], principalArray[2].component[k], principalArray[3].component[k]);
+    }
+
+    // Transpose the points, the ones past the end of a set are inactive.
+    __m128 p[16][3], w[16], active[16];
+    for (int i = 0; i < maxCount; i++) {
+        NV_ALIGN_16 float lanes[4][4] = {};
+        for (int lane = 0; lane < count; lane++) {
+            if (i < n[lane]) {
+                lanes[0][lane] = points[lane][i].x;
+                lanes[1][lane] = points[lane][i].y;
+                lanes[2][lane] = points[lane][i].z;
+                lanes[3][lane] = weights[lane][i];
+            }
+        }
+        for (int k = 0; k < 3; k++) p[i][k] = _mm_load_ps(lanes[k]);
+        w[i] = _mm_load_ps(lanes[3]);
+        active[i] = _mm_cmplt_ps(_mm_set1_ps(float(i)), _mm_load_ps(pointCount));
+    }
+
+    // Pick initial solution.
+    const __m128 c[3] = { _mm_load_ps(centroid[0]), _mm_load_ps(centroid[1]), _mm_load_ps(centroid[2]) };
+
+    __m128 mindps = zero, maxdps = zero;
+    for (int i = 0; i < maxCount; i++)
+    {
+        __m128 dps = _mm_mul_ps(_mm_sub_ps(p[i][0], c[0]), principal[0]);
+        dps = _mm_add_ps(dps, _mm_mul_ps(_mm_sub_ps(p[i][1], c[1]), principal[1]));
+        dps = _mm_add_ps(dps, _mm_mul_ps(_mm_sub_ps(p[i][2], c[2]), principal[2]));
+
+        if (i == 0) {
+            mindps = maxdps = dps;
+            continue;
+        }
+
+        const __m128 less = _mm_and_ps(active[i], _mm_cmplt_ps(dps, mindps));
+        const __m128 other = _mm_andnot_ps(less, active[i]);
+        mindps = select(less, dps, mindps);
+        maxdps = select(other, dps, maxdps);
+    }
+
+    const __m128 third = _mm_set1_ps(1.0f / 3.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    __m128 cl[4][3];
+    for (int k = 0; k < 3; k++) {
+        cl[0][k] = _mm_add_ps(c[k], _mm_mul_ps(mindps, principal[k]));
+        cl[1][k] = _mm_add_ps(c[k], _mm_mul_ps(maxdps, principal[k]));
+        cl[2][k] = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(two, cl[0][k]), cl[1][k]), third);
+        cl[3][k] = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(two, cl[1][k]), cl[0][k]), third);
+    }
+
+    const __m128 m[3] = { _mm_set1_ps(metric.x), _mm_set1_ps(metric.y), _mm_set1_ps(metric.z) };
+
+    // Lanes that converged keep their clusters, unused lanes start out done.
+    __m128 done = _mm_cmpeq_ps(_mm_load_ps(pointCount), zero);
+    __m128 result = zero;
+
+    for (int iteration = 0; iteration < MaxMeansIterations && _mm_movemask_ps(done) != 0xF; iteration++)
+    {
+        __m128 newCluster[4][3], total[4];
+        for (int j = 0; j < 4; j++) {
+            newCluster[j][0] = newCluster[j][1] = newCluster[j][2] = total[j] = zero;
+        }
+
+        for (int i = 0; i < maxCount; i++)
+        {
+            // Find nearest cluster.
+            __m128 nearest = zero;
+            __m128 mindist = _mm_set1_ps(FLT_MAX);
+            for (int j = 0; j < 4; j++)
+            {
+                const __m128 dx = _mm_mul_ps(_mm_sub_ps(cl[j][0], p[i][0]), m[0]);
+                const __m128 dy = _mm_mul_ps(_mm_sub_ps(cl[j][1], p[i][1]), m[1]);
+                const __m128 dz = _mm_mul_ps(_mm_sub_ps(cl[j][2], p[i][2]), m[2]);
+                const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+                const __m128 less = _mm_cmplt_ps(dist, mindist);
+                mindist = select(less, dist, mindist);
+                nearest = select(less, _mm_set1_ps(float(j)), nearest);
+            }
+
+            // Adding zero to the other clusters leaves them unchanged.
+            for (int j = 0; j < 4; j++)
+            {
+                const __m128 mask = _mm_and_ps(active[i], _mm_cmpeq_ps(nearest, _mm_set1_ps(float(j))));
+                for (int k = 0; k < 3; k++) {
+                    newCluster[j][k] = _mm_add_ps(newCluster[j][k], _mm_and_ps(mask, _mm_mul_ps(w[i], p[i][k])));
+                }
+                total[j] = _mm_add_ps(total[j], _mm_and_ps(mask, w[i]));
+            }
+        }
+
+        __m128 converged = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        __m128 nonzeroCount = zero;
+        for (int j = 0; j < 4; j++)
+        {
+            const __m128 nonzero = _mm_cmpneq_ps(total[j], zero);
+            const __m128 scale = _mm_div_ps(_mm_set1_ps(1.0f), total[j]);
+            for (int k = 0; k < 3; k++) {
+                newCluster[j][k] = select(nonzero, _mm_mul_ps(newCluster[j][k], scale), newCluster[j][k]);
+                converged = _mm_and_ps(converged, equal(cl[j][k], newCluster[j][k]));
+            }
+            nonzeroCount = _mm_add_ps(nonzeroCount, _mm_and_ps(nonzero, _mm_set1_ps(1.0f)));
+        }
+
+        result = select(done, result, nonzeroCount);
+
+        // Lanes that just converged return the clusters of the previous step, like the scalar version.
+        const __m128 update = _mm_andnot_ps(_mm_or_ps(done, converged), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+        done = _mm_or_ps(done, converged);
+
+        for (int j = 0; j < 4; j++) {
+            for (int k = 0; k < 3; k++) cl[j][k] = select(update, newCluster[j][k], cl[j][k]);
+        }
+
+        // Sort clusters by weight, this sequence of swaps gives the same order as the insertion sort.
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = i; j > 0; j--)
+            {
+                const __m128 swapMask = _mm_and_ps(update, _mm_cmpgt_ps(total[j], total[j - 1]));
+                const __m128 t = total[j];
+                total[j] = select(swapMask, total[j - 1], t);
+                total[j - 1] = select(swapMask, t, total[j - 1]);
+                for (int k = 0; k < 3; k++) {
+                    const __m128 a = cl[j][k];
+                    cl[j][k] = select(swapMask, cl[j - 1][k], a);
+                    cl[j - 1][k] = select(swapMask, a, cl[j - 1][k]);
+                }
+            }
+        }
+    }
+
+    NV_ALIGN_16 float lanes[4][3][4];
+    NV_ALIGN_16 float counts[4];
+    for (int j = 0; j < 4; j++) {
+        for (int k = 0; k < 3; k++) _mm_store_ps(lanes[j][k], cl[j][k]);
+    }
+    _mm_store_ps(counts, result);
+
+    for (int lane = 0; lane < count; lane++) {
+        for (int j = 0; j < 4; j++) {
+            cluster[lane][j] = Vector3(lanes[j][0][lane], lanes[j][1][lane], lanes[j][2][lane]);
+        }
+        clusterCount[lane] = int(counts[lane]);
+    }
+}
+
+#endif // NV_USE_SSE > 1
+
+void nv::Fit::compute4Means(int count, const Vector3 points[][16], const float weights[][16], const int * n, const Vector3 & metric, Vector3 clusters[][4], int * clusterCounts)
+{
+    int i = 0;
+#if NV_USE_SSE > 1
+    for (; i < count; i += 4) {
+        ::compute4Means(min(count - i, 4), points + i, weights + i, n + i, metric, clusters + i, clusterCounts + i);
+    }
+#endif
+    for (; i < count; i++) {
+        clusterCounts[i] = compute4Means(n[i], points[i], weights[i], metric, clusters[i]);
+    }
+}
+
+
+// Moments of a weighted point set: the weight, the sums of the weighted channels and of their products.
+static const int MOMENT_COUNT = 15;
+static const int MOMENT_SUM = 1;
+static const int MOMENT_PRODUCT = 5;
+
+// Index of the product of two channels among the MOMENT_PRODUCT moments, the upper triangle is stored row by row.
+static const int productIndex[4][4] = {
+    { 0, 1, 2, 3 },
+    { 1, 4, 5, 6 },
+    { 2, 5, 7, 8 },
+    { 3, 6, 8, 9 },
+};
+
+static const int powerIterations = 6;
+
+// Scatter of a point set away from its principal axis: the trace of its covariance minus the largest eigenvalue.
+static float lineFitError(const float * moments)
+{
+    float covariance[10];
+    float invWeight = moments[0] > 0.0f ? 1.0f / moments[0] : 0.0f;
+    for (int i = 0; i < 4; i++) {
+        for (int j = i; j < 4; j++) {
+            int k = productIndex[i][j];
+            covariance[k] = moments[MOMENT_PRODUCT + k] - moments[MOMENT_SUM + i] * moments[MOMENT_SUM + j] * invWeight;
+        }
+    }
+
+    // Start the power method from the row with the largest diagonal, it is never orthogonal to the principal axis.
+    int first = 0;
+    for (int i = 1; i < 4; i++) {
+        if (covariance[productIndex[i][i]] > covariance[productIndex[first][first]]) first = i;
+    }
+
+    float trace = 0.0f, v[4];
+    for (int i = 0; i < 4; i++) {
+        trace += covariance[productIndex[i][i]];
+        v[i] = covariance[productIndex[first][i]];
+    }
+
+    float lambda = 0.0f;
+    for (int iteration = 0; iteration <= powerIterations; iteration++) {
+        float norm = 0.0f;
+        for (int i = 0; i < 4; i++) norm += v[i] * v[i];
+        if (norm <= 0.0f) break;
+        norm = 1.0f / sqrtf(norm);
+
+        float mv[4];
+        for (int i = 0; i < 4; i++) v[i] *= norm;
+        lambda = 0.0f;
+        for (int i = 0; i < 4; i++) {
+            mv[i] = 0.0f;
+            for (int j = 0; j < 4; j++) mv[i] += covariance[productIndex[i][j]] * v[j];
+        }
+        for (int i = 0; i < 4; i++) {
+            lambda += v[i] * mv[i];
+            v[i] = mv[i];
+        }
+    }
+
+    return max(trace - lambda, 0.0f);
+}
+
+#if NV_USE_SSE > 1
+
+// Same as lineFitError, for four point sets at once.
+static __m128 lineFitError(const __m128 * moments)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    __m128 covariance[10];
+    __m128 invWeight = select(_mm_cmpgt_ps(moments[0], zero), _mm_div_ps(one, _mm_max_ps(moments[0], _mm_set1_ps(FLT_MIN))), zero);
+    for (int i = 0; i < 4; i++) {
+        for (int j = i; j < 4; j++) {
+            int k = productIndex[i][j];
+            covariance[k] = _mm_sub_ps(moments[MOMENT_PRODUCT + k], _mm_mul_ps(_mm_mul_ps(moments[MOMENT_SUM + i], moments[MOMENT_SUM + j]), invWeight));
+        }
+    }
+
+    __m128 trace = covariance[productIndex[0][0]];
+    __m128 widest = trace;
+    __m128 v[4];
+    for (int j = 0; j < 4; j++) v[j] = covariance[productIndex[0][j]];
+    for (int i = 1; i < 4; i++) {
+        __m128 diagonal = covariance[productIndex[i][i]];
+        __m128 wider = _mm_cmpgt_ps(diagonal, widest);
+        for (int j = 0; j < 4; j++) v[j] = select(wider, covariance[productIndex[i][j]], v[j]);
+        widest = _mm_max_ps(widest, diagonal);
+        trace = _mm_add_ps(trace, diagonal);
+    }
+
+    __m128 lambda = zero;
+    for (int iteration = 0; iteration <= powerIterations; iteration++) {
+        __m128 norm = _mm_add_ps(_mm_add_ps(_mm_mul_ps(v[0], v[0]), _mm_mul_ps(v[1], v[1])), _mm_add_ps(_mm_mul_ps(v[2], v[2]), _mm_mul_ps(v[3], v[3])));
+        norm = select(_mm_cmpgt_ps(norm, zero), _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(norm, _mm_set1_ps(FLT_MIN)))), zero);
+
+        __m128 mv[4];
+        for (int i = 0; i < 4; i++) v[i] = _mm_mul_ps(v[i], norm);
+        lambda = zero;
+        for (int i = 0; i < 4; i++) {
+            mv[i] = zero;
+            for (int j = 0; j < 4; j++) mv[i] = _mm_add_ps(mv[i], _mm_mul_ps(covariance[productIndex[i][j]], v[j]));
+            lambda = _mm_add_ps(lambda, _mm_mul_ps(v[i], mv[i]));
+        }
+        for (int i = 0; i < 4; i++) v[i] = mv[i];
+    }
+
+    return _mm_max_ps(_mm_sub_ps(trace, lambda), zero);
+}
+
+#endif // NV_USE_SSE > 1
+
+void nv::Fit::estimatePartitionErrors(const Vector4 points[16], const float weights[16], int nregions, int npartitions, const uint16 * masks, float * errors)
+{
+    nvDebugCheck(nregions >= 1 && nregions <= 3);
+
+    // The moments of subset 0 are those of the whole block minus the moments of the other subsets.
+    float moments[16][MOMENT_COUNT];
+    float total[MOMENT_COUNT];
+    memset(total, 0, sizeof(total));
+
+    int used = 0;
+    for (int i = 0; i < 16; i++) {
+        const float * p = points[i].component;
+        float * m = moments[i];
+        m[0] = weights[i];
+        for (int j = 0; j < 4; j++) m[MOMENT_SUM + j] = weights[i] * p[j];
+        for (int j = 0; j < 4; j++) {
+            for (int k = j; k < 4; k++) m[MOMENT_PRODUCT + productIndex[j][k]] = m[MOMENT_SUM + j] * p[k];
+        }
+        for (int k = 0; k < MOMENT_COUNT; k++) total[k] += m[k];
+        if (weights[i] > 0.0f) used |= 1 << i;
+    }
+
+    const int nmasks = nregions - 1;
+    int p = 0;
+
+#if NV_USE_SSE > 1
+    // Score four partitions at a time, one per lane.
+    for (; p + 4 <= npartitions; p += 4) {
+        __m128 sums[2][MOMENT_COUNT];
+        __m128 rest[MOMENT_COUNT];
+        for (int k = 0; k < MOMENT_COUNT; k++) rest[k] = _mm_set1_ps(total[k]);
+
+        __m128 error = _mm_setzero_ps();
+        for (int r = 0; r < nmasks; r++) {
+            __m128i bits = _mm_setr_epi32(masks[(p + 0) * nmasks + r], masks[(p + 1) * nmasks + r], masks[(p + 2) * nmasks + r], masks[(p + 3) * nmasks + r]);
+
+            __m128 * sum = sums[r];
+            for (int k = 0; k < MOMENT_COUNT; k++) sum[k] = _mm_setzero_ps();
+
+            for (int i = 0; i < 16; i++) {
+                if ((used & (1 << i)) == 0) continue;
+
+                __m128i bit = _mm_set1_epi32(1 << i);
+                __m128 inside = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(bits, bit), bit));
+                for (int k = 0; k < MOMENT_COUNT; k++) sum[k] = _mm_add_ps(sum[k], _mm_and_ps(inside, _mm_set1_ps(moments[i][k])));
+            }
+
+            for (int k = 0; k < MOMENT_COUNT; k++) rest[k] = _mm_sub_ps(rest[k], sum[k]);
+            error = _mm_add_ps(error, lineFitError(sum));
+        }
+        error = _mm_add_ps(error, lineFitError(rest));
+
+        _mm_storeu_ps(errors + p, error);
+    }
+#endif
+
+    for (; p < npartitions; p++) {
+        float rest[MOMENT_COUNT];
+        memcpy(rest, total, sizeof(rest));
+
+        float error = 0.0f;
+        for (int r = 0; r < nmasks; r++) {
+            int mask = masks[p * nmasks + r] & used;
+
+            float sum[MOMENT_COUNT];
+            memset(sum, 0, sizeof(sum));
+            for (int i = 0; i < 16; i++) {
+                if ((mask & (1 << i)) == 0) continue;
+                for (int k = 0; k < MOMENT_COUNT; k++) sum[k] += moments[i][k];
+            }
+
+            for (int k = 0; k < MOMENT_COUNT; k++) rest[k] -= sum[k];
+            error += lineFitError(sum);
+        }
+        errors[p] = error + lineFitError(rest);
+    }
 }
 
 
@@ -941,7 +1482,7 @@ void ArvoSVD(int rows, int cols, float * Q, float * diag, float * R)
 	float  g     = 0.0f;
 	float  scale = 0.0f;
 
-    Array<float> temp; temp.resize(cols, 0.0f);
+    StackArray<float, MaxSvdPoints> temp(cols, 0.0f);
 
 	for( i = 0; i < cols; i++ ) 
 	{
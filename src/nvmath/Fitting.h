@@ -26,6 +26,14 @@ namespace nv
         Vector3 computePrincipalComponent_PowerMethod(int n, const Vector3 * points);
         Vector3 computePrincipalComponent_PowerMethod(int n, const Vector3 * points, const float * weights, const Vector3 & metric);
 
+        // Principal components of count covariance matrices of 6 floats each, as computed by computeCovariance. Same results
+        // as computePrincipalComponent_PowerMethod, several matrices at a time.
+        void computePrincipalComponents_PowerMethod(int count, const float * matrices, Vector3 * output);
+
+        // Closed form solution, unit length. Faster than the eigen solver, but less accurate when eigenvalues are close.
+        Vector3 computePrincipalComponent_Analytic(int n, const Vector3 * points);
+        Vector3 computePrincipalComponent_Analytic(int n, const Vector3 * points, const float * weights, const Vector3 & metric);
+
         Vector3 computePrincipalComponent_EigenSolver(int n, const Vector3 * points);
         Vector3 computePrincipalComponent_EigenSolver(int n, const Vector3 * points, const float * weights, const Vector3 & metric);
 
@@ -43,6 +51,14 @@ namespace nv
 
         // Returns number of clusters [1-4].
         int compute4Means(int n, const Vector3 * points, const float * weights, const Vector3 & metric, Vector3 * cluster);
+
+        // compute4Means of count sets of up to 16 points, several at a time. n holds the number of points of each set.
+        void compute4Means(int count, const Vector3 points[][16], const float weights[][16], const int * n, const Vector3 & metric, Vector3 clusters[][4], int * clusterCounts);
+
+        // Estimates how well each partition of a block of 16 points fits one line per subset, scoring all partitions together.
+        // masks holds nregions-1 16 bit masks per partition selecting the points of subsets 1 and up, subset 0 takes the others.
+        // The error of a partition is the weighted scatter of the points away from the principal axis of their subset.
+        void estimatePartitionErrors(const Vector4 points[16], const float weights[16], int nregions, int npartitions, const uint16 * masks, float * errors);
     }
 
 } // nv namespace
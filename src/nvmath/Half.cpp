@@ -74,6 +74,7 @@
 //
 
 #include "Half.h"
+#include "nvcore/CpuInfo.h"
 #include <stdio.h>
 
 
@@ -395,6 +396,7 @@ nv::half_from_float( uint32 f )
     const uint32 f_h_m_pos_offset           = _uint32_li( 0x0000000d );
     const uint32 h_nan_min                  = _uint32_li( 0x00007c01 );
     const uint32 f_h_e_biased_flag          = _uint32_li( 0x0000008f );
+    const uint32 f_m_denorm_sa_max          = _uint32_li( 0x0000001f ); // Larger shifts flush to zero and are undefined in C.
     const uint32 f_s                        = _uint32_and( f,               f_s_mask         );
     const uint32 f_e                        = _uint32_and( f,               f_e_mask         );
     const uint16 h_s                        = _uint32_srl( f_s,             f_h_s_pos_offset );
@@ -405,7 +407,9 @@ nv::half_from_float( uint32 f )
     const uint32 f_m_round_mask             = _uint32_and( f_m,             f_m_round_bit    );
     const uint32 f_m_round_offset           = _uint32_sll( f_m_round_mask,  one              );
     const uint32 f_m_rounded                = _uint32_add( f_m,             f_m_round_offset );
-    const uint32 f_m_denorm_sa              = _uint32_sub( one,             f_e_half_bias    );
+    const uint32 f_m_denorm_sa_unclamped    = _uint32_sub( one,             f_e_half_bias    );
+    const uint32 f_m_denorm_sa_overflow_msb = _uint32_sub( f_m_denorm_sa_max, f_m_denorm_sa_unclamped );
+    const uint32 f_m_denorm_sa              = _uint32_sels( f_m_denorm_sa_overflow_msb, f_m_denorm_sa_max, f_m_denorm_sa_unclamped );
     const uint32 f_m_with_hidden            = _uint32_or(  f_m_rounded,     f_m_hidden_bit   );
     const uint32 f_m_denorm                 = _uint32_srl( f_m_with_hidden, f_m_denorm_sa    );
     const uint32 h_m_denorm                 = _uint32_srl( f_m_denorm,      f_h_m_pos_offset );
@@ -494,6 +498,7 @@ nv::half_to_float( uint16 h )
 #if NV_CC_GNUC
 #if defined(__i386__) || defined(__x86_64__)
 #include <xmmintrin.h>
+#include <emmintrin.h>
 #endif
 #endif
 
@@ -547,8 +552,6 @@ static __m128 half_to_float4_SSE2(__m128i h)
 
 
 void nv::half_to_float_array_SSE2(const uint16 * vin, float * vout, int count) {
-    nvDebugCheck((intptr_t(vin) & 15) == 0);
-    nvDebugCheck((intptr_t(vout) & 15) == 0);
     nvDebugCheck((count & 7) == 0);
 
     __m128i zero = _mm_setzero_si128();
@@ -567,20 +570,155 @@ void nv::half_to_float_array_SSE2(const uint16 * vin, float * vout, int count) {
     }
 }
 
+// Shift Right Logical with a different shift amount in each lane, sa must be in [0, 31] and a smaller than 2^24.
+static inline __m128i _uint32x4_srlv_small( __m128i a, __m128i sa )
+{
+    // Scale by 2^-sa in floating point, which is exact for these values, and truncate.
+    const __m128i scale  = _mm_slli_epi32( _mm_sub_epi32( _mm_set1_epi32( 127 ), sa ), 23 );
+    const __m128  scaled = _mm_mul_ps( _mm_cvtepi32_ps( a ), _mm_castsi128_ps( scale ) );
+
+    return _mm_cvttps_epi32( scaled );
+}
+
+static inline __m128i _uint32x4_sels( __m128i test, __m128i a, __m128i b )
+{
+    const __m128i mask = _mm_srai_epi32( test, 31 );
+
+    return _mm_or_si128( _mm_and_si128( a, mask ), _mm_andnot_si128( mask, b ) );
+}
+
+// Four lane version of half_from_float, operation by operation. The result is in the low 16 bits of each lane.
+static __m128i half_from_float4_SSE2( __m128i f )
+{
+    const __m128i zero                       = _mm_setzero_si128();
+    const __m128i one                        = _mm_set1_epi32( 0x00000001 );
+    const __m128i ones                       = _mm_set1_epi32( 0xffffffff );
+    const __m128i f_s_mask                   = _mm_set1_epi32( 0x80000000 );
+    const __m128i f_e_mask                   = _mm_set1_epi32( 0x7f800000 );
+    const __m128i f_m_mask                   = _mm_set1_epi32( 0x007fffff );
+    const __m128i f_m_hidden_bit             = _mm_set1_epi32( 0x00800000 );
+    const __m128i f_m_round_bit              = _mm_set1_epi32( 0x00001000 );
+    const __m128i f_snan_mask                = _mm_set1_epi32( 0x7fc00000 );
+    const __m128i h_e_mask                   = _mm_set1_epi32( 0x00007c00 );
+    const __m128i h_snan_mask                = _mm_set1_epi32( 0x00007e00 );
+    const __m128i h_e_mask_value             = _mm_set1_epi32( 0x0000001f );
+    const __m128i f_h_bias_offset            = _mm_set1_epi32( 0x00000070 );
+    const __m128i h_nan_min                  = _mm_set1_epi32( 0x00007c01 );
+    const __m128i f_h_e_biased_flag          = _mm_set1_epi32( 0x0000008f );
+    const __m128i f_m_denorm_sa_max          = _mm_set1_epi32( 0x0000001f );
+    const __m128i f_s                        = _mm_and_si128( f,               f_s_mask         );
+    const __m128i f_e                        = _mm_and_si128( f,               f_e_mask         );
+    const __m128i h_s                        = _mm_srli_epi32( f_s,            16               );
+    const __m128i f_m                        = _mm_and_si128( f,               f_m_mask         );
+    const __m128i f_e_amount                 = _mm_srli_epi32( f_e,            23               );
+    const __m128i f_e_half_bias              = _mm_sub_epi32( f_e_amount,      f_h_bias_offset  );
+    const __m128i f_snan                     = _mm_and_si128( f,               f_snan_mask      );
+    const __m128i f_m_round_mask             = _mm_and_si128( f_m,             f_m_round_bit    );
+    const __m128i f_m_round_offset           = _mm_slli_epi32( f_m_round_mask, 1                );
+    const __m128i f_m_rounded                = _mm_add_epi32( f_m,             f_m_round_offset );
+    const __m128i f_m_denorm_sa_unclamped    = _mm_sub_epi32( one,             f_e_half_bias    );
+    const __m128i f_m_denorm_sa_overflow_msb = _mm_sub_epi32( f_m_denorm_sa_max, f_m_denorm_sa_unclamped );
+    const __m128i f_m_denorm_sa              = _uint32x4_sels( f_m_denorm_sa_overflow_msb, f_m_denorm_sa_max, f_m_denorm_sa_unclamped );
+    const __m128i f_m_with_hidden            = _mm_or_si128( f_m_rounded,      f_m_hidden_bit   );
+    // The shift amount is only meaningful in the lanes that select the denormal result.
+    const __m128i h_m_denorm_sa              = _mm_add_epi32( _mm_and_si128( f_m_denorm_sa, f_m_denorm_sa_max ), _mm_set1_epi32( 13 ) );
+    const __m128i h_m_denorm                 = _uint32x4_srlv_small( f_m_with_hidden, h_m_denorm_sa );
+    const __m128i f_m_rounded_overflow       = _mm_and_si128( f_m_rounded,     f_m_hidden_bit   );
+    const __m128i m_nan                      = _mm_srli_epi32( f_m,            13               );
+    const __m128i h_em_nan                   = _mm_or_si128( h_e_mask,         m_nan            );
+    const __m128i h_e_norm_overflow_offset   = _mm_add_epi32( f_e_half_bias,   one              );
+    const __m128i h_e_norm_overflow          = _mm_slli_epi32( h_e_norm_overflow_offset, 10     );
+    const __m128i h_e_norm                   = _mm_slli_epi32( f_e_half_bias,  10               );
+    const __m128i h_m_norm                   = _mm_srli_epi32( f_m_rounded,    13               );
+    const __m128i h_em_norm                  = _mm_or_si128( h_e_norm,         h_m_norm         );
+    const __m128i is_h_ndenorm_msb           = _mm_sub_epi32( f_h_bias_offset,   f_e_amount     );
+    const __m128i is_f_e_flagged_msb         = _mm_sub_epi32( f_h_e_biased_flag, f_e_half_bias  );
+    const __m128i is_h_denorm_msb            = _mm_xor_si128( is_h_ndenorm_msb,  ones           );
+    const __m128i is_f_m_eqz_msb             = _mm_sub_epi32( f_m,               one            );
+    const __m128i is_h_nan_eqz_msb           = _mm_sub_epi32( m_nan,             one            );
+    const __m128i is_f_inf_msb               = _mm_and_si128( is_f_e_flagged_msb, is_f_m_eqz_msb   );
+    const __m128i is_f_nan_underflow_msb     = _mm_and_si128( is_f_e_flagged_msb, is_h_nan_eqz_msb );
+    const __m128i is_e_overflow_msb          = _mm_sub_epi32( h_e_mask_value,     f_e_half_bias    );
+    const __m128i is_h_inf_msb               = _mm_or_si128(  is_e_overflow_msb,  is_f_inf_msb     );
+    const __m128i is_f_nsnan_msb             = _mm_sub_epi32( f_snan,             f_snan_mask      );
+    const __m128i is_m_norm_overflow_msb     = _mm_sub_epi32( zero,               f_m_rounded_overflow );
+    const __m128i is_f_snan_msb              = _mm_xor_si128( is_f_nsnan_msb,     ones             );
+    const __m128i h_em_overflow_result       = _uint32x4_sels( is_m_norm_overflow_msb, h_e_norm_overflow, h_em_norm                 );
+    const __m128i h_em_nan_result            = _uint32x4_sels( is_f_e_flagged_msb,     h_em_nan,          h_em_overflow_result      );
+    const __m128i h_em_nan_underflow_result  = _uint32x4_sels( is_f_nan_underflow_msb, h_nan_min,         h_em_nan_result           );
+    const __m128i h_em_inf_result            = _uint32x4_sels( is_h_inf_msb,           h_e_mask,          h_em_nan_underflow_result );
+    const __m128i h_em_denorm_result         = _uint32x4_sels( is_h_denorm_msb,        h_m_denorm,        h_em_inf_result           );
+    const __m128i h_em_snan_result           = _uint32x4_sels( is_f_snan_msb,          h_snan_mask,       h_em_denorm_result        );
+    const __m128i h_result                   = _mm_or_si128( h_s, h_em_snan_result );
+
+    return h_result;
+}
+
+void nv::half_from_float_array_SSE2(const float * vin, uint16 * vout, int count) {
+    nvDebugCheck((count & 7) == 0);
+
+    for (int i = 0; i < count; i += 8)
+    {
+        __m128i a = half_from_float4_SSE2(_mm_loadu_si128((const __m128i *)(vin + i)));
+        __m128i b = half_from_float4_SSE2(_mm_loadu_si128((const __m128i *)(vin + i + 4)));
+
+        // Sign extend the low 16 bits so that the saturating pack keeps them unchanged.
+        a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+
+        _mm_storeu_si128((__m128i *)(vout + i), _mm_packs_epi32(a, b));
+    }
+}
+
 #endif 
 
 
-// @@ These tables could be smaller.
-namespace nv {
-    uint32 mantissa_table[2048] = { 0xDEADBEEF };
-    uint32 exponent_table[64];
-    uint32 offset_table[64];
+void nv::half_to_float_array(const uint16 * vin, float * vout, int count) {
+    int i = 0;
+
+#if !NV_OS_IOS
+    const int simdCount = count & ~7;
+#if defined(HAVE_AVX2)
+    if (cpuFeatures() & CpuFeature_AVX2) half_to_float_array_AVX2(vin, vout, simdCount);
+    else
+#endif
+    half_to_float_array_SSE2(vin, vout, simdCount);
+    i = simdCount;
+#endif
+
+    uint32 * uout = (uint32 *)vout;
+    for (; i < count; i++) {
+        uout[i] = half_to_float(vin[i]);
+    }
 }
 
-void nv::half_init_tables()
+void nv::half_from_float_array(const float * vin, uint16 * vout, int count) {
+    int i = 0;
+
+#if !NV_OS_IOS
+    const int simdCount = count & ~7;
+#if defined(HAVE_AVX2)
+    if (cpuFeatures() & CpuFeature_AVX2) half_from_float_array_AVX2(vin, vout, simdCount);
+    else
+#endif
+    half_from_float_array_SSE2(vin, vout, simdCount);
+    i = simdCount;
+#endif
+
+    const uint32 * uin = (const uint32 *)vin;
+    for (; i < count; i++) {
+        vout[i] = half_from_float(uin[i]);
+    }
+}
+
+
+// @@ These tables could be smaller.
+static NV_TABLE_CONSTEXPR nv::HalfTables makeHalfTables()
 {
+    nv::HalfTables t = {};
+
     // Init mantissa table.
-    mantissa_table[0] = 0;
+    t.mantissa[0] = 0;
 
     // denormals
     for (int i = 1; i < 1024; i++) {
@@ -593,44 +731,52 @@ void nv::half_init_tables()
         }
         m &= ~0x00800000;
         e += 0x38800000;
-        mantissa_table[i] = m | e;
+        t.mantissa[i] = m | e;
     }
 
     // normals
     for (int i = 1024; i < 2048; i++) {
-        mantissa_table[i] = (i - 1024) << 13;
+        t.mantissa[i] = (i - 1024) << 13;
     }
 
 
     // Init exponent table.
-    exponent_table[0] = 0;
+    t.exponent[0] = 0;
 
     for (int i = 1; i < 31; i++) {
-        exponent_table[i] = 0x38000000 + (i << 23);
+        t.exponent[i] = 0x38000000 + (i << 23);
     }
 
-    exponent_table[31] = 0x7f800000;
-    exponent_table[32] = 0x80000000;
+    t.exponent[31] = 0x7f800000;
+    t.exponent[32] = 0x80000000;
 
     for (int i = 33; i < 63; i++) {
-        exponent_table[i] = 0xb8000000 + ((i - 32) << 23);
+        t.exponent[i] = 0xb8000000 + ((i - 32) << 23);
     }
 
-    exponent_table[63] = 0xff800000;
+    t.exponent[63] = 0xff800000;
 
 
     // Init offset table.
-    offset_table[0] = 0;
+    t.offset[0] = 0;
 
     for (int i = 1; i < 32; i++) {
-        offset_table[i] = 1024;
+        t.offset[i] = 1024;
     }
 
-    offset_table[32] = 0;
+    t.offset[32] = 0;
 
     for (int i = 33; i < 64; i++) {
-        offset_table[i] = 1024;
+        t.offset[i] = 1024;
     }
+
+    return t;
+}
+
+const nv::HalfTables & nv::half_tables()
+{
+    static NV_TABLE_CONSTEXPR const HalfTables s_tables = makeHalfTables();
+    return s_tables;
 }
 
 
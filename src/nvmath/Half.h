@@ -9,25 +9,41 @@ namespace nv {
     uint32 half_to_float( uint16 h );
     uint16 half_from_float( uint32 f );
 
-    // vin,vout must be 16 byte aligned. count must be a multiple of 8.
+    // vin,vout can have any alignment. count must be a multiple of 8.
     // implement a non-SSE version if we need it. For now, this naming makes it clear this is only available when SSE2 is
     void half_to_float_array_SSE2(const uint16 * vin, float * vout, int count);
 
-    void half_init_tables();
+    // vin,vout can have any alignment. count must be a multiple of 8. Same SSE2 availability as half_to_float_array_SSE2.
+    void half_from_float_array_SSE2(const float * vin, uint16 * vout, int count);
 
-    extern uint32 mantissa_table[2048];
-    extern uint32 exponent_table[64];
-    extern uint32 offset_table[64];
+    // AVX2 versions of the above, same requirements and results. Only call these when cpuFeatures() reports AVX2.
+    void half_to_float_array_AVX2(const uint16 * vin, float * vout, int count);
+    void half_from_float_array_AVX2(const float * vin, uint16 * vout, int count);
+
+    // Same result as half_to_float for each element. No alignment requirements, any count.
+    void half_to_float_array(const uint16 * vin, float * vout, int count);
+
+    // Same result as half_from_float for each element. No alignment requirements, any count.
+    void half_from_float_array(const float * vin, uint16 * vout, int count);
+
+    // Tables of fast_half_to_float, 8.5 KB.
+    struct HalfTables
+    {
+        uint32 mantissa[2048];
+        uint32 exponent[64];
+        uint32 offset[64];
+    };
+
+    // Built at compile time by C++14 compilers, older ones build them the first time they are used, in about 10 us.
+    const HalfTables & half_tables();
 
     // Fast half to float conversion based on:
     // http://www.fox-toolkit.org/ftp/fasthalffloatconversion.pdf
     inline uint32 fast_half_to_float(uint16 h)
     {
-		// Initialize table if necessary.
-		if (mantissa_table[0] != 0)
-			half_init_tables();
+        const HalfTables & t = half_tables();
 	    uint exp = h >> 10;
-	    return mantissa_table[offset_table[exp] + (h & 0x3ff)] + exponent_table[exp];
+	    return t.mantissa[t.offset[exp] + (h & 0x3ff)] + t.exponent[exp];
     }
 
 
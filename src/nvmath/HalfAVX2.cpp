@@ -0,0 +1,134 @@
+// This code is in the public domain -- castano@gmail.com
+
+// AVX2 versions of the SSE2 half conversions in Half.cpp, eight values at a time with the same operations, so the results
+// are identical. This file is compiled with ${NV_AVX2_FLAGS}, it must not call inline functions that other files may
+// also instantiate.
+
+#include "Half.h"
+
+#include <immintrin.h>
+
+static inline __m256 half_to_float8_AVX2(__m256i h)
+{
+    const __m256i mask_nosign       = _mm256_set1_epi32(0x7fff);
+    const __m256i mask_justsign     = _mm256_set1_epi32(0x8000);
+    const __m256i mask_shifted_exp  = _mm256_set1_epi32(0x7c00 << 13);
+    const __m256i expadjust_normal  = _mm256_set1_epi32((127 - 15) << 23);
+    const __m256i expadjust_infnan  = _mm256_set1_epi32((128 - 16) << 23);
+    const __m256i expadjust_denorm  = _mm256_set1_epi32(1 << 23);
+    const __m256i magic_denorm      = _mm256_set1_epi32(113 << 23);
+
+    const __m256i expmant     = _mm256_and_si256(mask_nosign, h);
+    const __m256i justsign    = _mm256_and_si256(h, mask_justsign);
+    const __m256i shifted     = _mm256_slli_epi32(expmant, 13);
+    const __m256i adjusted    = _mm256_add_epi32(expadjust_normal, shifted);
+    const __m256i justexp     = _mm256_and_si256(shifted, mask_shifted_exp);
+
+    const __m256i b_isinfnan  = _mm256_cmpeq_epi32(mask_shifted_exp, justexp);
+    const __m256i b_isdenorm  = _mm256_cmpeq_epi32(_mm256_setzero_si256(), justexp);
+
+    const __m256i adjusted2   = _mm256_add_epi32(adjusted, _mm256_and_si256(b_isinfnan, expadjust_infnan));
+
+    const __m256i den1        = _mm256_add_epi32(expadjust_denorm, adjusted2);
+    const __m256  den2        = _mm256_sub_ps(_mm256_castsi256_ps(den1), _mm256_castsi256_ps(magic_denorm));
+    const __m256  adjusted3   = _mm256_and_ps(den2, _mm256_castsi256_ps(b_isdenorm));
+    const __m256  adjusted4   = _mm256_andnot_ps(_mm256_castsi256_ps(b_isdenorm), _mm256_castsi256_ps(adjusted2));
+    const __m256  adjusted5   = _mm256_or_ps(adjusted3, adjusted4);
+    const __m256i sign        = _mm256_slli_epi32(justsign, 16);
+
+    return _mm256_or_ps(adjusted5, _mm256_castsi256_ps(sign));
+}
+
+void nv::half_to_float_array_AVX2(const uint16 * vin, float * vout, int count)
+{
+    for (int i = 0; i < count; i += 8)
+    {
+        const __m256i in = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(vin + i)));
+        _mm256_storeu_ps(vout + i, half_to_float8_AVX2(in));
+    }
+}
+
+static inline __m256i _uint32x8_sels(__m256i test, __m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(b, a, _mm256_srai_epi32(test, 31));
+}
+
+// Eight lane version of half_from_float, see half_from_float4_SSE2. The result is in the low 16 bits of each lane.
+static inline __m256i half_from_float8_AVX2(__m256i f)
+{
+    const __m256i zero                       = _mm256_setzero_si256();
+    const __m256i one                        = _mm256_set1_epi32( 0x00000001 );
+    const __m256i ones                       = _mm256_set1_epi32( 0xffffffff );
+    const __m256i f_s_mask                   = _mm256_set1_epi32( 0x80000000 );
+    const __m256i f_e_mask                   = _mm256_set1_epi32( 0x7f800000 );
+    const __m256i f_m_mask                   = _mm256_set1_epi32( 0x007fffff );
+    const __m256i f_m_hidden_bit             = _mm256_set1_epi32( 0x00800000 );
+    const __m256i f_m_round_bit              = _mm256_set1_epi32( 0x00001000 );
+    const __m256i f_snan_mask                = _mm256_set1_epi32( 0x7fc00000 );
+    const __m256i h_e_mask                   = _mm256_set1_epi32( 0x00007c00 );
+    const __m256i h_snan_mask                = _mm256_set1_epi32( 0x00007e00 );
+    const __m256i h_e_mask_value             = _mm256_set1_epi32( 0x0000001f );
+    const __m256i f_h_bias_offset            = _mm256_set1_epi32( 0x00000070 );
+    const __m256i h_nan_min                  = _mm256_set1_epi32( 0x00007c01 );
+    const __m256i f_h_e_biased_flag          = _mm256_set1_epi32( 0x0000008f );
+    const __m256i f_m_denorm_sa_max          = _mm256_set1_epi32( 0x0000001f );
+    const __m256i f_s                        = _mm256_and_si256( f,               f_s_mask         );
+    const __m256i f_e                        = _mm256_and_si256( f,               f_e_mask         );
+    const __m256i h_s                        = _mm256_srli_epi32( f_s,            16               );
+    const __m256i f_m                        = _mm256_and_si256( f,               f_m_mask         );
+    const __m256i f_e_amount                 = _mm256_srli_epi32( f_e,            23               );
+    const __m256i f_e_half_bias              = _mm256_sub_epi32( f_e_amount,      f_h_bias_offset  );
+    const __m256i f_snan                     = _mm256_and_si256( f,               f_snan_mask      );
+    const __m256i f_m_round_mask             = _mm256_and_si256( f_m,             f_m_round_bit    );
+    const __m256i f_m_round_offset           = _mm256_slli_epi32( f_m_round_mask, 1                );
+    const __m256i f_m_rounded                = _mm256_add_epi32( f_m,             f_m_round_offset );
+    const __m256i f_m_denorm_sa_unclamped    = _mm256_sub_epi32( one,             f_e_half_bias    );
+    const __m256i f_m_denorm_sa_overflow_msb = _mm256_sub_epi32( f_m_denorm_sa_max, f_m_denorm_sa_unclamped );
+    const __m256i f_m_denorm_sa              = _uint32x8_sels( f_m_denorm_sa_overflow_msb, f_m_denorm_sa_max, f_m_denorm_sa_unclamped );
+    const __m256i f_m_with_hidden            = _mm256_or_si256( f_m_rounded,      f_m_hidden_bit   );
+    // The shift amount is only meaningful in the lanes that select the denormal result.
+    const __m256i h_m_denorm_sa              = _mm256_add_epi32( _mm256_and_si256( f_m_denorm_sa, f_m_denorm_sa_max ), _mm256_set1_epi32( 13 ) );
+    const __m256i h_m_denorm                 = _mm256_srlv_epi32( f_m_with_hidden, h_m_denorm_sa );
+    const __m256i f_m_rounded_overflow       = _mm256_and_si256( f_m_rounded,     f_m_hidden_bit   );
+    const __m256i m_nan                      = _mm256_srli_epi32( f_m,            13               );
+    const __m256i h_em_nan                   = _mm256_or_si256( h_e_mask,         m_nan            );
+    const __m256i h_e_norm_overflow_offset   = _mm256_add_epi32( f_e_half_bias,   one              );
+    const __m256i h_e_norm_overflow          = _mm256_slli_epi32( h_e_norm_overflow_offset, 10     );
+    const __m256i h_e_norm                   = _mm256_slli_epi32( f_e_half_bias,  10               );
+    const __m256i h_m_norm                   = _mm256_srli_epi32( f_m_rounded,    13               );
+    const __m256i h_em_norm                  = _mm256_or_si256( h_e_norm,         h_m_norm         );
+    const __m256i is_h_ndenorm_msb           = _mm256_sub_epi32( f_h_bias_offset,   f_e_amount     );
+    const __m256i is_f_e_flagged_msb         = _mm256_sub_epi32( f_h_e_biased_flag, f_e_half_bias  );
+    const __m256i is_h_denorm_msb            = _mm256_xor_si256( is_h_ndenorm_msb,  ones           );
+    const __m256i is_f_m_eqz_msb             = _mm256_sub_epi32( f_m,               one            );
+    const __m256i is_h_nan_eqz_msb           = _mm256_sub_epi32( m_nan,             one            );
+    const __m256i is_f_inf_msb               = _mm256_and_si256( is_f_e_flagged_msb, is_f_m_eqz_msb   );
+    const __m256i is_f_nan_underflow_msb     = _mm256_and_si256( is_f_e_flagged_msb, is_h_nan_eqz_msb );
+    const __m256i is_e_overflow_msb          = _mm256_sub_epi32( h_e_mask_value,     f_e_half_bias    );
+    const __m256i is_h_inf_msb               = _mm256_or_si256(  is_e_overflow_msb,  is_f_inf_msb     );
+    const __m256i is_f_nsnan_msb             = _mm256_sub_epi32( f_snan,             f_snan_mask      );
+    const __m256i is_m_norm_overflow_msb     = _mm256_sub_epi32( zero,               f_m_rounded_overflow );
+    const __m256i is_f_snan_msb              = _mm256_xor_si256( is_f_nsnan_msb,     ones             );
+    const __m256i h_em_overflow_result       = _uint32x8_sels( is_m_norm_overflow_msb, h_e_norm_overflow, h_em_norm                 );
+    const __m256i h_em_nan_result            = _uint32x8_sels( is_f_e_flagged_msb,     h_em_nan,          h_em_overflow_result      );
+    const __m256i h_em_nan_underflow_result  = _uint32x8_sels( is_f_nan_underflow_msb, h_nan_min,         h_em_nan_result           );
+    const __m256i h_em_inf_result            = _uint32x8_sels( is_h_inf_msb,           h_e_mask,          h_em_nan_underflow_result );
+    const __m256i h_em_denorm_result         = _uint32x8_sels( is_h_denorm_msb,        h_m_denorm,        h_em_inf_result           );
+    const __m256i h_em_snan_result           = _uint32x8_sels( is_f_snan_msb,          h_snan_mask,       h_em_denorm_result        );
+
+    return _mm256_or_si256( h_s, h_em_snan_result );
+}
+
+void nv::half_from_float_array_AVX2(const float * vin, uint16 * vout, int count)
+{
+    for (int i = 0; i < count; i += 8)
+    {
+        const __m256i h = half_from_float8_AVX2(_mm256_loadu_si256((const __m256i *)(vin + i)));
+
+        // Keep the low 16 bits so that the saturating pack leaves them unchanged.
+        const __m256i low = _mm256_and_si256(h, _mm256_set1_epi32(0xffff));
+        const __m128i lo = _mm256_castsi256_si128(low);
+        const __m128i hi = _mm256_extracti128_si256(low, 1);
+        _mm_storeu_si128((__m128i *)(vout + i), _mm_packus_epi32(lo, hi));
+    }
+}
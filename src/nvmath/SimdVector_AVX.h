@@ -0,0 +1,182 @@
+// This code is in the public domain -- Ignacio Castano <castano@gmail.com>
+
+#pragma once
+#ifndef NV_SIMD_VECTOR_AVX_H
+#define NV_SIMD_VECTOR_AVX_H
+
+#include "SimdVector.h"
+
+#include <immintrin.h>
+
+// 8 and 16 wide versions of SimdVector for AVX and AVX-512. They are only defined in the translation units that are
+// compiled for those instruction sets, and the code that uses them is selected at runtime with nv::cpuFeatures.
+//
+// Everything here is force inlined: a regular inline function compiled with the wider instruction set could be picked
+// by the linker for the code that runs on older CPUs. Operations are the same as the SSE ones and in the same order, so
+// the results are identical to SimdVector on the same CPU. These translation units must not contract multiplies and
+// adds into FMA, which AVX-512 has.
+
+namespace nv {
+
+#if defined(__AVX__)
+
+    class SimdVector8
+    {
+    public:
+        enum { Width = 8 };
+
+        __m256 vec;
+
+        typedef SimdVector8 const& Arg;
+
+        NV_FORCEINLINE SimdVector8() {}
+        NV_FORCEINLINE explicit SimdVector8(__m256 v) : vec(v) {}
+        NV_FORCEINLINE explicit SimdVector8(float f) { vec = _mm256_set1_ps(f); }
+
+        // Unaligned load.
+        NV_FORCEINLINE explicit SimdVector8(const float * v) { vec = _mm256_loadu_ps(v); }
+
+        NV_FORCEINLINE void store(float * v) const { _mm256_storeu_ps(v, vec); }
+
+        NV_FORCEINLINE SimdVector8 & operator+=(Arg v) { vec = _mm256_add_ps(vec, v.vec); return *this; }
+        NV_FORCEINLINE SimdVector8 & operator-=(Arg v) { vec = _mm256_sub_ps(vec, v.vec); return *this; }
+        NV_FORCEINLINE SimdVector8 & operator*=(Arg v) { vec = _mm256_mul_ps(vec, v.vec); return *this; }
+    };
+
+    NV_FORCEINLINE SimdVector8 operator+(SimdVector8::Arg left, SimdVector8::Arg right) { return SimdVector8(_mm256_add_ps(left.vec, right.vec)); }
+    NV_FORCEINLINE SimdVector8 operator-(SimdVector8::Arg left, SimdVector8::Arg right) { return SimdVector8(_mm256_sub_ps(left.vec, right.vec)); }
+    NV_FORCEINLINE SimdVector8 operator*(SimdVector8::Arg left, SimdVector8::Arg right) { return SimdVector8(_mm256_mul_ps(left.vec, right.vec)); }
+    NV_FORCEINLINE SimdVector8 operator/(SimdVector8::Arg left, SimdVector8::Arg right) { return SimdVector8(_mm256_div_ps(left.vec, right.vec)); }
+
+    // Bitwise and of two masks.
+    NV_FORCEINLINE SimdVector8 operator&(SimdVector8::Arg left, SimdVector8::Arg right) { return SimdVector8(_mm256_and_ps(left.vec, right.vec)); }
+
+    NV_FORCEINLINE SimdVector8 reciprocal(SimdVector8::Arg v)
+    {
+        // get the reciprocal estimate, vrcpps has the same table as rcpps.
+        __m256 estimate = _mm256_rcp_ps(v.vec);
+
+        // one round of Newton-Rhaphson refinement
+        __m256 diff = _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_mul_ps(estimate, v.vec));
+        return SimdVector8(_mm256_add_ps(_mm256_mul_ps(diff, estimate), estimate));
+    }
+
+    NV_FORCEINLINE SimdVector8 min(SimdVector8::Arg left, SimdVector8::Arg right) { return SimdVector8(_mm256_min_ps(left.vec, right.vec)); }
+    NV_FORCEINLINE SimdVector8 max(SimdVector8::Arg left, SimdVector8::Arg right) { return SimdVector8(_mm256_max_ps(left.vec, right.vec)); }
+
+    NV_FORCEINLINE SimdVector8 truncate(SimdVector8::Arg v)
+    {
+        return SimdVector8(_mm256_cvtepi32_ps(_mm256_cvttps_epi32(v.vec)));
+    }
+
+    NV_FORCEINLINE SimdVector8 compareEqual(SimdVector8::Arg left, SimdVector8::Arg right)
+    {
+        return SimdVector8(_mm256_cmp_ps(left.vec, right.vec, _CMP_EQ_OQ));
+    }
+
+    NV_FORCEINLINE SimdVector8 compareLessThan(SimdVector8::Arg left, SimdVector8::Arg right)
+    {
+        return SimdVector8(_mm256_cmp_ps(left.vec, right.vec, _CMP_LT_OS));
+    }
+
+    NV_FORCEINLINE SimdVector8 select(SimdVector8::Arg off, SimdVector8::Arg on, SimdVector8::Arg bits)
+    {
+        return SimdVector8(_mm256_blendv_ps(off.vec, on.vec, bits.vec));
+    }
+
+    NV_FORCEINLINE bool compareAnyLessThan(SimdVector8::Arg left, SimdVector8::Arg right)
+    {
+        return _mm256_movemask_ps(_mm256_cmp_ps(left.vec, right.vec, _CMP_LT_OS)) != 0;
+    }
+
+#endif // __AVX__
+
+#if defined(__AVX512F__)
+
+    // Masks are kept in vector registers like in the other SimdVectors, with all the bits of a lane set or clear.
+    class SimdVector16
+    {
+    public:
+        enum { Width = 16 };
+
+        __m512 vec;
+
+        typedef SimdVector16 const& Arg;
+
+        NV_FORCEINLINE SimdVector16() {}
+        NV_FORCEINLINE explicit SimdVector16(__m512 v) : vec(v) {}
+        NV_FORCEINLINE explicit SimdVector16(float f) { vec = _mm512_set1_ps(f); }
+
+        // Unaligned load.
+        NV_FORCEINLINE explicit SimdVector16(const float * v) { vec = _mm512_loadu_ps(v); }
+
+        NV_FORCEINLINE void store(float * v) const { _mm512_storeu_ps(v, vec); }
+
+        NV_FORCEINLINE SimdVector16 & operator+=(Arg v) { vec = _mm512_add_ps(vec, v.vec); return *this; }
+        NV_FORCEINLINE SimdVector16 & operator-=(Arg v) { vec = _mm512_sub_ps(vec, v.vec); return *this; }
+        NV_FORCEINLINE SimdVector16 & operator*=(Arg v) { vec = _mm512_mul_ps(vec, v.vec); return *this; }
+    };
+
+    NV_FORCEINLINE SimdVector16 operator+(SimdVector16::Arg left, SimdVector16::Arg right) { return SimdVector16(_mm512_add_ps(left.vec, right.vec)); }
+    NV_FORCEINLINE SimdVector16 operator-(SimdVector16::Arg left, SimdVector16::Arg right) { return SimdVector16(_mm512_sub_ps(left.vec, right.vec)); }
+    NV_FORCEINLINE SimdVector16 operator*(SimdVector16::Arg left, SimdVector16::Arg right) { return SimdVector16(_mm512_mul_ps(left.vec, right.vec)); }
+    NV_FORCEINLINE SimdVector16 operator/(SimdVector16::Arg left, SimdVector16::Arg right) { return SimdVector16(_mm512_div_ps(left.vec, right.vec)); }
+
+    // Bitwise and of two masks.
+    NV_FORCEINLINE SimdVector16 operator&(SimdVector16::Arg left, SimdVector16::Arg right)
+    {
+        return SimdVector16(_mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(left.vec), _mm512_castps_si512(right.vec))));
+    }
+
+    NV_FORCEINLINE SimdVector16 reciprocal(SimdVector16::Arg v)
+    {
+        // vrcp14ps is more accurate than rcpps, estimate each half with vrcpps to get the same results as SimdVector.
+        const __m256 lo = _mm512_castps512_ps256(v.vec);
+        const __m256 hi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v.vec), 1));
+        __m512 estimate = _mm512_castps256_ps512(_mm256_rcp_ps(lo));
+        estimate = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(estimate), _mm256_castps_pd(_mm256_rcp_ps(hi)), 1));
+
+        // one round of Newton-Rhaphson refinement
+        __m512 diff = _mm512_sub_ps(_mm512_set1_ps(1.0f), _mm512_mul_ps(estimate, v.vec));
+        return SimdVector16(_mm512_add_ps(_mm512_mul_ps(diff, estimate), estimate));
+    }
+
+    NV_FORCEINLINE SimdVector16 min(SimdVector16::Arg left, SimdVector16::Arg right) { return SimdVector16(_mm512_min_ps(left.vec, right.vec)); }
+    NV_FORCEINLINE SimdVector16 max(SimdVector16::Arg left, SimdVector16::Arg right) { return SimdVector16(_mm512_max_ps(left.vec, right.vec)); }
+
+    NV_FORCEINLINE SimdVector16 truncate(SimdVector16::Arg v)
+    {
+        return SimdVector16(_mm512_cvtepi32_ps(_mm512_cvttps_epi32(v.vec)));
+    }
+
+    NV_FORCEINLINE SimdVector16 maskToVector16(__mmask16 mask)
+    {
+        return SimdVector16(_mm512_castsi512_ps(_mm512_maskz_mov_epi32(mask, _mm512_set1_epi32(-1))));
+    }
+
+    NV_FORCEINLINE SimdVector16 compareEqual(SimdVector16::Arg left, SimdVector16::Arg right)
+    {
+        return maskToVector16(_mm512_cmp_ps_mask(left.vec, right.vec, _CMP_EQ_OQ));
+    }
+
+    NV_FORCEINLINE SimdVector16 compareLessThan(SimdVector16::Arg left, SimdVector16::Arg right)
+    {
+        return maskToVector16(_mm512_cmp_ps_mask(left.vec, right.vec, _CMP_LT_OS));
+    }
+
+    NV_FORCEINLINE SimdVector16 select(SimdVector16::Arg off, SimdVector16::Arg on, SimdVector16::Arg bits)
+    {
+        const __m512i b = _mm512_castps_si512(bits.vec);
+        return SimdVector16(_mm512_mask_blend_ps(_mm512_test_epi32_mask(b, b), off.vec, on.vec));
+    }
+
+    NV_FORCEINLINE bool compareAnyLessThan(SimdVector16::Arg left, SimdVector16::Arg right)
+    {
+        return _mm512_cmp_ps_mask(left.vec, right.vec, _CMP_LT_OS) != 0;
+    }
+
+#endif // __AVX512F__
+
+} // namespace nv
+
+#endif // NV_SIMD_VECTOR_AVX_H
@@ -45,6 +45,8 @@ namespace nv {
     class SimdVector
     {
     public:
+        enum { Width = 4 };
+
         __m128 vec;
 
         typedef SimdVector const& Arg;
@@ -75,6 +77,11 @@ namespace nv {
             return *this;
         }
 
+        NV_SIMD_NATIVE void store(float * v) const
+        {
+            _mm_store_ps( v, vec );
+        }
+
         NV_SIMD_INLINE float toFloat() const 
         {
             NV_ALIGN_16 float f;
@@ -138,6 +145,18 @@ namespace nv {
         return SimdVector( _mm_mul_ps( left.vec, right.vec ) );
     }
 
+    // Exact division, use reciprocal when an estimate is enough.
+    NV_SIMD_NATIVE SimdVector operator/( SimdVector::Arg left, SimdVector::Arg right  )
+    {
+        return SimdVector( _mm_div_ps( left.vec, right.vec ) );
+    }
+
+    // Bitwise and of two masks.
+    NV_SIMD_NATIVE SimdVector operator&( SimdVector::Arg left, SimdVector::Arg right  )
+    {
+        return SimdVector( _mm_and_ps( left.vec, right.vec ) );
+    }
+
     // Returns a*b + c
     NV_SIMD_INLINE SimdVector multiplyAdd( SimdVector::Arg a, SimdVector::Arg b, SimdVector::Arg c )
     {
@@ -196,6 +215,11 @@ namespace nv {
         return SimdVector( _mm_cmpeq_ps( left.vec, right.vec ) );
     }
 
+    NV_SIMD_NATIVE SimdVector compareLessThan( SimdVector::Arg left, SimdVector::Arg right )
+    {
+        return SimdVector( _mm_cmplt_ps( left.vec, right.vec ) );
+    }
+
     NV_SIMD_INLINE SimdVector select( SimdVector::Arg off, SimdVector::Arg on, SimdVector::Arg bits )
     {
         __m128 a = _mm_andnot_ps( bits.vec, off.vec );
@@ -211,6 +235,63 @@ namespace nv {
         return value != 0;
     }
 
+#if (NV_USE_SSE > 1)
+    // Approximate log2 of x > 0, denormals are flushed to the smallest normal. The mantissa is moved to [sqrt(1/2), sqrt(2))
+    // and its log evaluated with the series of 2*atanh(s), s = (m-1)/(m+1), truncated after s^9. Absolute error is about 1e-7.
+    NV_SIMD_INLINE SimdVector approxLog2( SimdVector::Arg x )
+    {
+        __m128 v = _mm_max_ps( x.vec, _mm_set1_ps( 1.17549435e-38f ) );
+        __m128i bits = _mm_castps_si128( v );
+
+        __m128i e = _mm_sub_epi32( _mm_srli_epi32( bits, 23 ), _mm_set1_epi32( 127 ) );
+        __m128 m = _mm_or_ps( _mm_and_ps( v, _mm_castsi128_ps( _mm_set1_epi32( 0x007FFFFF ) ) ), _mm_set1_ps( 1.0f ) );
+
+        __m128 big = _mm_cmpgt_ps( m, _mm_set1_ps( 1.41421356f ) );
+        m = _mm_or_ps( _mm_andnot_ps( big, m ), _mm_and_ps( big, _mm_mul_ps( m, _mm_set1_ps( 0.5f ) ) ) );
+        e = _mm_sub_epi32( e, _mm_castps_si128( big ) );    // The mask is -1.
+
+        __m128 s = _mm_div_ps( _mm_sub_ps( m, _mm_set1_ps( 1.0f ) ), _mm_add_ps( m, _mm_set1_ps( 1.0f ) ) );
+        __m128 s2 = _mm_mul_ps( s, s );
+
+        // 2/(2k+1) / ln(2)
+        __m128 p = _mm_set1_ps( 0.320598898f );
+        p = _mm_add_ps( _mm_mul_ps( p, s2 ), _mm_set1_ps( 0.412198583f ) );
+        p = _mm_add_ps( _mm_mul_ps( p, s2 ), _mm_set1_ps( 0.577078016f ) );
+        p = _mm_add_ps( _mm_mul_ps( p, s2 ), _mm_set1_ps( 0.961796694f ) );
+        p = _mm_add_ps( _mm_mul_ps( p, s2 ), _mm_set1_ps( 2.885390082f ) );
+
+        return SimdVector( _mm_add_ps( _mm_cvtepi32_ps( e ), _mm_mul_ps( p, s ) ) );
+    }
+
+    // Approximate 2^x, x is clamped to [-126, 127]. The fraction in [-0.5, 0.5] goes through the Taylor series of e^(f*ln(2))
+    // up to the 6th power. Relative error is about 2.5e-7.
+    NV_SIMD_INLINE SimdVector approxExp2( SimdVector::Arg x )
+    {
+        __m128 v = _mm_min_ps( _mm_max_ps( x.vec, _mm_set1_ps( -126.0f ) ), _mm_set1_ps( 127.0f ) );
+
+        __m128i n = _mm_cvtps_epi32( v );
+        __m128 t = _mm_mul_ps( _mm_sub_ps( v, _mm_cvtepi32_ps( n ) ), _mm_set1_ps( 0.693147181f ) );
+
+        __m128 p = _mm_set1_ps( 1.0f / 720 );
+        p = _mm_add_ps( _mm_mul_ps( p, t ), _mm_set1_ps( 1.0f / 120 ) );
+        p = _mm_add_ps( _mm_mul_ps( p, t ), _mm_set1_ps( 1.0f / 24 ) );
+        p = _mm_add_ps( _mm_mul_ps( p, t ), _mm_set1_ps( 1.0f / 6 ) );
+        p = _mm_add_ps( _mm_mul_ps( p, t ), _mm_set1_ps( 0.5f ) );
+        p = _mm_add_ps( _mm_mul_ps( p, t ), _mm_set1_ps( 1.0f ) );
+        p = _mm_add_ps( _mm_mul_ps( p, t ), _mm_set1_ps( 1.0f ) );
+
+        __m128 scale = _mm_castsi128_ps( _mm_slli_epi32( _mm_add_epi32( n, _mm_set1_epi32( 127 ) ), 23 ) );
+        return SimdVector( _mm_mul_ps( p, scale ) );
+    }
+
+    // Approximate x^y for x >= 0, returns 0 when x is 0 or negative. Relative error is about 2e-6 for gamma curves on [0, 4].
+    NV_SIMD_INLINE SimdVector approxPow( SimdVector::Arg x, SimdVector::Arg y )
+    {
+        __m128 r = approxExp2( y * approxLog2( x ) ).vec;
+        return SimdVector( _mm_and_ps( r, _mm_cmpgt_ps( x.vec, _mm_setzero_ps() ) ) );
+    }
+#endif
+
 } // namespace nv
 
 #endif // NV_SIMD_VECTOR_SSE_H
@@ -4,13 +4,14 @@
 #define NV_MATH_SPHERICALHARMONIC_H
 
 #include "nvmath.h"
+#include "Vector.h"
+#include "SimdVector.h"
 
 #include <string.h> // memcpy
 
 
 namespace nv
 {
-    class Vector3;
     class Matrix;
 
     NVMATH_API float legendrePolynomial( int l, int m, float x ) NV_CONST;
@@ -272,6 +273,201 @@ namespace nv
 
 
 
+    /// The basis functions of the first and second order, in the order and with the signs of shBasis, are the product of these
+    /// constants and the polynomials of the direction evaluated by shPolynomials.
+    static const float shPolynomialScale[9] = {
+        0.282095f,                                      // K(0, 0)
+        -0.488603f, 0.488603f, -0.488603f,              // K(1, 0)
+        1.092548f, -1.092548f,                          // sqrt(15.0f / PI) / 2.0f = K(2, -2)
+        0.315392f,                                      // sqrt(5.0f / PI) / 4.0f) = K(2, 0)
+        -1.092548f, 0.546274f                           // sqrt(15.0f / PI) / 4.0f) = K(2, 2)
+    };
+
+    /// Evaluate the polynomials 1, y, z, x, xy, yz, 3z^2-1, xz and x^2-y^2 of the given direction, up to the given order. T can
+    /// also be a SimdVector of four directions.
+    template <int order, typename T>
+    inline void shPolynomials(T x, T y, T z, T * p)
+    {
+        nvStaticCheck(order == 1 || order == 2);
+
+        p[0] = T(1.0f);
+        p[1] = y;
+        p[2] = z;
+        p[3] = x;
+
+        if (order == 2) {
+            p[4] = x * y;
+            p[5] = y * z;
+            p[6] = T(3.0f) * (z * z) - T(1.0f);
+            p[7] = x * z;
+            p[8] = x * x - y * y;
+        }
+    }
+
+
+    /// Spherical harmonic of a fixed order, first or second, with the coefficients stored in place. Unlike Sh it doesn't
+    /// allocate, and the basis is evaluated as polynomials instead of with the Legendre recurrences.
+    template <int order>
+    class ShFixed
+    {
+    public:
+        enum { BasisNum = (order + 1) * (order + 1) };
+
+        /// Reset the sh coefficients.
+        void reset()
+        {
+            for (int i = 0; i < BasisNum; i++) {
+                elem[i] = 0.0f;
+            }
+        }
+
+        /// Evaluate the basis at the given direction.
+        void eval(const Vector3 & dir)
+        {
+            shPolynomials<order>(dir.x, dir.y, dir.z, elem);
+            for (int i = 0; i < BasisNum; i++) {
+                elem[i] *= shPolynomialScale[i];
+            }
+        }
+
+        /// Add spherical harmonics.
+        void operator+= (const ShFixed & sh)
+        {
+            for (int i = 0; i < BasisNum; i++) {
+                elem[i] += sh.elem[i];
+            }
+        }
+
+        /// Scale spherical harmonics.
+        void operator*= (float f)
+        {
+            for (int i = 0; i < BasisNum; i++) {
+                elem[i] *= f;
+            }
+        }
+
+        /// Add scaled spherical harmonics.
+        void addScaled(const ShFixed & sh, float f)
+        {
+            for (int i = 0; i < BasisNum; i++) {
+                elem[i] += sh.elem[i] * f;
+            }
+        }
+
+        /// Add the basis at the given direction scaled by f, the projection of a sample.
+        void addSample(const Vector3 & dir, float f)
+        {
+            float p[BasisNum];
+            shPolynomials<order>(dir.x, dir.y, dir.z, p);
+            for (int i = 0; i < BasisNum; i++) {
+                elem[i] += shPolynomialScale[i] * p[i] * f;
+            }
+        }
+
+        /// Evaluate the spherical harmonic function.
+        float sample(const Vector3 & dir) const
+        {
+            float p[BasisNum];
+            shPolynomials<order>(dir.x, dir.y, dir.z, p);
+
+            float sum = 0.0f;
+            for (int i = 0; i < BasisNum; i++) {
+                sum += elem[i] * shPolynomialScale[i] * p[i];
+            }
+            return sum;
+        }
+
+#if NV_USE_SSE
+        /// Evaluate the spherical harmonic function at four directions.
+        SimdVector sample(SimdVector::Arg x, SimdVector::Arg y, SimdVector::Arg z) const
+        {
+            SimdVector p[BasisNum];
+            shPolynomials<order>(x, y, z, p);
+
+            SimdVector sum(elem[0] * shPolynomialScale[0]);
+            for (int i = 1; i < BasisNum; i++) {
+                sum = multiplyAdd(SimdVector(elem[i] * shPolynomialScale[i]), p[i], sum);
+            }
+            return sum;
+        }
+#endif
+
+        float elem[BasisNum];
+    };
+
+    typedef ShFixed<1> ShL1;
+    typedef ShFixed<2> ShL2;
+
+    /// Compute dot product of the spherical harmonics.
+    template <int order>
+    inline float dot(const ShFixed<order> & a, const ShFixed<order> & b)
+    {
+        float sum = 0;
+        for (int i = 0; i < ShFixed<order>::BasisNum; i++) {
+            sum += a.elem[i] * b.elem[i];
+        }
+        return sum;
+    }
+
+
+#if NV_USE_SSE
+    /// Projection of samples to fixed order spherical harmonics, four directions at a time, with one weight per channel for
+    /// each direction. Each lane keeps its own sums of the weighted polynomials, reduce adds them up and scales them to the
+    /// basis. The sums of all the channels are updated together, so that they don't wait on each other.
+    template <int order, int channelCount = 1>
+    class ShAccumulator4
+    {
+    public:
+        enum { BasisNum = ShFixed<order>::BasisNum };
+
+        ShAccumulator4()
+        {
+            for (int i = 0; i < BasisNum * channelCount; i++) {
+                elem[i] = SimdVector(0.0f);
+            }
+        }
+
+        /// Add the basis at four directions scaled by the weights of each channel.
+        void addSamples(SimdVector::Arg x, SimdVector::Arg y, SimdVector::Arg z, const SimdVector * w)
+        {
+            SimdVector p[BasisNum];
+            shPolynomials<order>(x, y, z, p);
+            addSamples(p, w);
+        }
+
+        /// Add samples with the polynomials of their directions already evaluated.
+        void addSamples(const SimdVector * p, const SimdVector * w)
+        {
+            for (int c = 0; c < channelCount; c++) {
+                elem[c] += w[c];
+            }
+            for (int i = 1; i < BasisNum; i++) {
+                for (int c = 0; c < channelCount; c++) {
+                    elem[i * channelCount + c] += p[i] * w[c];
+                }
+            }
+        }
+
+        /// Add the sums of the four lanes to the coefficients of the spherical harmonic of each channel.
+        void reduce(ShFixed<order> * sh) const
+        {
+            for (int i = 0; i < BasisNum; i++) {
+                for (int c = 0; c < channelCount; c++) {
+                    NV_ALIGN_16 float lanes[4];
+                    _mm_store_ps(lanes, elem[i * channelCount + c].vec);
+                    sh[c].elem[i] += ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) * shPolynomialScale[i];
+                }
+            }
+        }
+
+        SimdVector elem[BasisNum * channelCount];
+    };
+#endif
+
+
+    /// Spherical harmonic matrix.#endif
+
+
     /// Spherical harmonic matrix.
     class ShMatrix
     {
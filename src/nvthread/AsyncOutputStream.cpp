@@ -0,0 +1,164 @@
+// This code is in the public domain -- castano@gmail.com
+
+#include "AsyncOutputStream.h"
+
+#include "nvcore/StdStream.h" // fileOpen
+#include "nvcore/FileSystem.h"
+#include "nvcore/Utils.h" // min
+#include "nvcore/Memory.h" // malloc
+
+#include <string.h> // memcpy
+
+using namespace nv;
+
+
+AsyncOutputStream::AsyncOutputStream(const char * name, bool unbuffered/*= false*/, uint bufferSize/*= 4MB*/) :
+    m_fp(NULL), m_autoclose(true), m_unbufferedFile(NULL)
+{
+    if (unbuffered) {
+        m_unbufferedFile = FileSystem::createUnbufferedFile(name);
+    }
+
+    // Not all file systems support unbuffered writes, fall back to stdio.
+    if (m_unbufferedFile == NULL) {
+        m_fp = fileOpen(name, "wb");
+    }
+
+    start(bufferSize, m_unbufferedFile != NULL ? FileSystem::kUnbufferedAlignment : 1);
+}
+
+AsyncOutputStream::AsyncOutputStream(FILE * fp, bool autoclose, uint bufferSize/*= 4MB*/) :
+    m_fp(fp), m_autoclose(autoclose), m_unbufferedFile(NULL)
+{
+    start(bufferSize, 1);
+}
+
+AsyncOutputStream::~AsyncOutputStream()
+{
+    finish();
+
+    if (m_unbufferedFile != NULL) {
+        FileSystem::closeUnbufferedFile(m_unbufferedFile, m_total);
+    }
+    else if (m_fp != NULL) {
+        if (m_autoclose) fclose(m_fp);
+        else fflush(m_fp);
+    }
+
+    mem::alignedFree(m_memory);
+}
+
+void AsyncOutputStream::start(uint bufferSize, uint alignment)
+{
+    m_memory = NULL;
+    m_buffers[0] = m_buffers[1] = NULL;
+    m_bufferSize = (max(bufferSize, 1U) + alignment - 1) / alignment * alignment;
+    m_alignment = alignment;
+    m_current = 0;
+    m_used = 0;
+    m_total = 0;
+    m_error = false;
+    m_submitted = NULL;
+    m_submittedSize = 0;
+    m_last = false;
+    m_writeError = false;
+    m_pending = false;
+
+    if (m_fp == NULL && m_unbufferedFile == NULL) return;
+
+    m_memory = (uint8 *)mem::alignedMalloc(2 * size_t(m_bufferSize), alignment);
+    if (m_memory == NULL) return;
+
+    m_buffers[0] = m_memory;
+    m_buffers[1] = m_buffers[0] + m_bufferSize;
+
+    m_thread.start(writerThread, this);
+}
+
+uint AsyncOutputStream::serialize(void * data, uint len)
+{
+    nvDebugCheck(data != NULL);
+    if (m_buffers[0] == NULL) return 0;
+
+    const uint8 * ptr = (const uint8 *)data;
+    uint left = len;
+
+    while (left > 0) {
+        const uint count = min(left, m_bufferSize - m_used);
+        memcpy(m_buffers[m_current] + m_used, ptr, count);
+        m_used += count;
+        ptr += count;
+        left -= count;
+
+        if (m_used == m_bufferSize) {
+            submit(/*last=*/false);
+        }
+    }
+
+    m_total += len;
+    return len;
+}
+
+bool AsyncOutputStream::isError() const
+{
+    return m_buffers[0] == NULL || m_error;
+}
+
+// Hand the current buffer to the writer thread and continue with the other one, once the thread is done with it.
+void AsyncOutputStream::submit(bool last)
+{
+    if (m_pending) {
+        m_drained.wait();
+        m_error |= m_writeError;
+    }
+
+    m_submitted = m_buffers[m_current];
+    m_submittedSize = m_used;
+    m_last = last;
+    m_pending = true;
+    m_filled.post();
+
+    m_current ^= 1;
+    m_used = 0;
+}
+
+void AsyncOutputStream::finish()
+{
+    if (!m_thread.isRunning()) return;
+
+    // Pad the last unbuffered write, the file is trimmed when it's closed.
+    const uint padded = (m_used + m_alignment - 1) / m_alignment * m_alignment;
+    memset(m_buffers[m_current] + m_used, 0, padded - m_used);
+    m_used = padded;
+
+    submit(/*last=*/true);
+
+    m_drained.wait();
+    m_error |= m_writeError;
+    m_pending = false;
+
+    m_thread.wait();
+}
+
+/*static*/ void AsyncOutputStream::writerThread(void * arg)
+{
+    AsyncOutputStream * s = (AsyncOutputStream *)arg;
+
+    for (;;) {
+        s->m_filled.wait();
+
+        if (s->m_submittedSize > 0 && !s->m_writeError) {
+            if (s->m_unbufferedFile != NULL) {
+                s->m_writeError = !FileSystem::writeUnbufferedFile(s->m_unbufferedFile, s->m_submitted, s->m_submittedSize);
+            }
+            else {
+                s->m_writeError = fwrite(s->m_submitted, 1, s->m_submittedSize, s->m_fp) != s->m_submittedSize;
+            }
+        }
+
+        const bool last = s->m_last;
+        s->m_drained.post();
+
+        if (last) break;
+    }
+}
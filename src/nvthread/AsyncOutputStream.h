@@ -0,0 +1,83 @@
+// This code is in the public domain -- castano@gmail.com
+
+#pragma once
+#ifndef NV_THREAD_ASYNCOUTPUTSTREAM_H
+#define NV_THREAD_ASYNCOUTPUTSTREAM_H
+
+#include "nvthread.h"
+#include "Thread.h"
+#include "Event.h"
+
+#include "nvcore/Stream.h"
+
+#include <stdio.h> // FILE
+
+namespace nv
+{
+    // Output stream that writes to a file from a background thread. The data is copied into one of two large buffers, a full
+    // buffer is written by the thread while the other one fills, so serialize only waits when the disk falls behind. The
+    // buffered data is written and the file closed by the destructor. The stream isn't seekable.
+    class NVTHREAD_CLASS AsyncOutputStream : public Stream
+    {
+        NV_FORBID_COPY(AsyncOutputStream);
+    public:
+
+        // Create the file. Unbuffered writes bypass the system cache when the file system allows it.
+        AsyncOutputStream(const char * name, bool unbuffered = false, uint bufferSize = 4 * 1024 * 1024);
+        AsyncOutputStream(FILE * fp, bool autoclose, uint bufferSize = 4 * 1024 * 1024);
+        virtual ~AsyncOutputStream();
+
+        /** @name Stream implementation. */
+        //@{
+        virtual uint serialize(void * data, uint len);
+
+        virtual void seek(uint64 /*pos*/) { /*Not implemented*/ }
+        virtual uint64 tell() const { return m_total; }
+        virtual uint64 size() const { return m_total; }
+
+        // Errors of the buffers written so far are reported.
+        virtual bool isError() const;
+        virtual void clearError() {}
+
+        virtual bool isAtEnd() const { return true; }
+        virtual bool isSeekable() const { return false; }
+        virtual bool isLoading() const { return false; }
+        virtual bool isSaving() const { return true; }
+        //@}
+
+    private:
+
+        void start(uint bufferSize, uint alignment);
+        void submit(bool last);
+        void finish();
+
+        static void writerThread(void * arg);
+
+        FILE * m_fp;
+        bool m_autoclose;
+        void * m_unbufferedFile;
+
+        uint8 * m_memory;           // Allocation of both buffers.
+        uint8 * m_buffers[2];
+        uint m_bufferSize;
+        uint m_alignment;           // Size multiple of the unbuffered writes.
+        uint m_current;             // Buffer being filled.
+        uint m_used;
+        uint64 m_total;
+        bool m_error;
+
+        // Owned by the writer thread from m_filled.post() to m_drained.post().
+        const uint8 * m_submitted;
+        uint m_submittedSize;
+        bool m_last;
+        bool m_writeError;
+        bool m_pending;             // The writer thread holds the other buffer.
+
+        Thread m_thread;
+        Event m_filled;
+        Event m_drained;
+    };
+
+} // nv namespace
+
+#endif // NV_THREAD_ASYNCOUTPUTSTREAM_H
@@ -14,6 +14,7 @@
 
 #pragma intrinsic(_InterlockedIncrement, _InterlockedDecrement)
 #pragma intrinsic(_InterlockedCompareExchange, _InterlockedExchange)
+#pragma intrinsic(_InterlockedExchangeAdd)
 
 /*
 extern "C"
@@ -30,9 +31,17 @@ extern "C"
 
 #endif // NV_CC_MSVC
 
-#if NV_CC_CLANG && POSH_CPU_STRONGARM
-// LLVM/Clang do not yet have functioning atomics as of 2.1
-// #include <atomic>
+// Compilers with C++11 support back nv::Atomic with std::atomic. Define NV_USE_STD_ATOMIC to 0 to use the intrinsics instead.
+#ifndef NV_USE_STD_ATOMIC
+#if __cplusplus >= 201103L || (NV_CC_MSVC && _MSC_VER >= 1700)
+#define NV_USE_STD_ATOMIC 1
+#else
+#define NV_USE_STD_ATOMIC 0
+#endif
+#endif
+
+#if NV_USE_STD_ATOMIC
+#include <atomic>
 #endif
 
 //ACS: need this if we want to use Apple's atomics.
@@ -130,6 +139,13 @@ namespace nv {
         return (uint32)_InterlockedDecrement((long *)value);
     }
 
+    // Returns the new value, like atomicIncrement.
+    inline uint32 atomicAdd(uint32 * value, uint32 amount)
+    {
+        nvDebugCheck((intptr_t(value) & 3) == 0);
+        return (uint32)_InterlockedExchangeAdd((long *)value, (long)amount) + amount;
+    }
+
     // Compare '*value' against 'expected', if equal, then stores 'desired' in '*value'.
     // @@ C++0x style CAS? Unlike the C++0x version, 'expected' is not passed by reference and not mutated.
     // @@ Is this strong or weak? Does InterlockedCompareExchange have spurious failures?
@@ -187,6 +203,14 @@ namespace nv {
 
         return __sync_sub_and_fetch(value, 1);
     }
+
+    // Returns the new value, like atomicIncrement.
+    inline uint32 atomicAdd(uint32 * value, uint32 amount)
+    {
+        nvDebugCheck((intptr_t(value) & 3) == 0);
+
+        return __sync_add_and_fetch(value, amount);
+    }
     
     // Compare '*value' against 'expected', if equal, then stores 'desired' in '*value'.
     // @@ C++0x style CAS? Unlike the C++0x version, 'expected' is not passed by reference and not mutated.
@@ -272,6 +296,14 @@ namespace nv {
 
         return __sync_sub_and_fetch(value, 1);
     }
+
+    // Returns the new value, like atomicIncrement.
+    inline uint32 atomicAdd(uint32 * value, uint32 amount)
+    {
+        nvDebugCheck((intptr_t(value) & 3) == 0);
+
+        return __sync_add_and_fetch(value, amount);
+    }
     
     // Compare '*value' against 'expected', if equal, then stores 'desired' in '*value'.
     // @@ C++0x style CAS? Unlike the C++0x version, 'expected' is not passed by reference and not mutated.
@@ -297,54 +329,83 @@ namespace nv {
 
 
 
-    // It would be nice to have C++0x-style atomic types, but I'm not in the mood right now. Only uint32 supported so far.
-#if 0
-    template <typename T>
-    void increment(T * value);
-
-    template <typename T>
-    void decrement(T * value);
-
-    template <>
-    void increment(uint32 * value) {
-    }
-
-    template <>
-    void increment(uint64 * value) {
-    }
-
-
-
+    // Atomic variable with explicit memory orders, for counters and flags that don't need the full barriers of the
+    // functions above. Backed by std::atomic when the compiler has it. Otherwise by the compiler intrinsics, with
+    // the same barriers as the functions above; then 64 bit values are only supported where the intrinsics exist.
+    //
+    // The *Relaxed functions only guarantee atomicity. Acquire loads pair with release stores and the read-modify-write
+    // functions are acquire and release at once.
     template <typename T>
     class Atomic
     {
+        NV_FORBID_COPY(Atomic);
+        NV_COMPILER_CHECK(sizeof(T) == sizeof(uint32) || sizeof(T) == sizeof(uint64));
     public:
-        explicit Atomic()  : m_value() { }
-        explicit Atomic( T val ) : m_value(val) { }
-        ~Atomic() { }
-
-        T loadRelaxed()  const { return m_value; }
-        void storeRelaxed(T val) { m_value = val; }
+        Atomic() : m_value(T()) {}
+        explicit Atomic(T value) : m_value(value) {}
 
-        //T loadAcquire() const volatile { return nv::loadAcquire(&m_value); }
-        //void storeRelease(T val) volatile { nv::storeRelease(&m_value, val); }
+#if NV_USE_STD_ATOMIC
+        T loadRelaxed() const { return m_value.load(std::memory_order_relaxed); }
+        T loadAcquire() const { return m_value.load(std::memory_order_acquire); }
+        void storeRelaxed(T value) { m_value.store(value, std::memory_order_relaxed); }
+        void storeRelease(T value) { m_value.store(value, std::memory_order_release); }
 
-        void increment() /*volatile*/ { nv::atomicIncrement(m_value); }
-        void decrement() /*volatile*/ { nv::atomicDecrement(m_value); }
+        // Add amount and return the previous value.
+        T fetchAddRelaxed(T amount) { return m_value.fetch_add(amount, std::memory_order_relaxed); }
+        T fetchAdd(T amount) { return m_value.fetch_add(amount, std::memory_order_acq_rel); }
 
-        void compareAndStore(T oldVal, T newVal) { nv::atomicCompareAndStore(&m_value, oldVal, newVal); }
-        T compareAndExchange(T oldVal, T newVal) { nv::atomicCompareAndStore(&m_value, oldVal, newVal); }
-        T exchange(T newVal) { nv::atomicExchange(&m_value, newVal); }
+        // Store desired if the value is expected. Unlike std::atomic, expected is not updated on failure.
+        bool compareAndSwap(T expected, T desired) { return m_value.compare_exchange_strong(expected, desired, std::memory_order_acq_rel); }
+        T exchange(T desired) { return m_value.exchange(desired, std::memory_order_acq_rel); }
 
     private:
-        // don't provide operator = or == ; make the client write Store( Load() )
-        NV_FORBID_COPY(Atomic);
-
-        NV_COMPILER_CHECK(sizeof(T) == sizeof(uint32) || sizeof(T) == sizeof(uint64));
+        std::atomic<T> m_value;
+#else
+        T loadRelaxed() const { return *(const volatile T *)&m_value; }
+        T loadAcquire() const
+        {
+            T value = *(const volatile T *)&m_value;    // on x86, loads are Acquire
+            nvCompilerReadBarrier();
+            return value;
+        }
+        void storeRelaxed(T value) { *(volatile T *)&m_value = value; }
+        void storeRelease(T value)
+        {
+            nvCompilerWriteBarrier();
+            *(volatile T *)&m_value = value;    // on x86, stores are Release
+        }
+
+        T fetchAddRelaxed(T amount) { return fetchAdd(amount); }
+#if NV_CC_MSVC
+        T fetchAdd(T amount)
+        {
+            if (sizeof(T) == sizeof(uint32)) return (T)_InterlockedExchangeAdd((long *)&m_value, (long)amount);
+            return (T)_InterlockedExchangeAdd64((__int64 *)&m_value, (__int64)amount);
+        }
+        bool compareAndSwap(T expected, T desired)
+        {
+            if (sizeof(T) == sizeof(uint32)) return _InterlockedCompareExchange((long *)&m_value, (long)desired, (long)expected) == (long)expected;
+            return _InterlockedCompareExchange64((__int64 *)&m_value, (__int64)desired, (__int64)expected) == (__int64)expected;
+        }
+        T exchange(T desired)
+        {
+            if (sizeof(T) == sizeof(uint32)) return (T)_InterlockedExchange((long *)&m_value, (long)desired);
+            return (T)_InterlockedExchange64((__int64 *)&m_value, (__int64)desired);
+        }
+#else
+        T fetchAdd(T amount) { return __sync_fetch_and_add(&m_value, amount); }
+        bool compareAndSwap(T expected, T desired) { return __sync_bool_compare_and_swap(&m_value, expected, desired); }
+        T exchange(T desired)
+        {
+            __sync_synchronize();   // __sync_lock_test_and_set is only an acquire barrier.
+            return __sync_lock_test_and_set(&m_value, desired);
+        }
+#endif
 
+    private:
         T m_value;
-    };
 #endif
+    };
 
 } // nv namespace 
 
@@ -0,0 +1,132 @@
+// This code is in the public domain -- castano@gmail.com
+
+#pragma once
+#ifndef NV_THREAD_CONCURRENTHASHMAP_H
+#define NV_THREAD_CONCURRENTHASHMAP_H
+
+#include "Atomic.h"
+
+#include "nvcore/Memory.h"
+#include "nvcore/Utils.h" // nextPowerOfTwo
+
+#include <string.h> // memcpy, memset
+
+namespace nv
+{
+    // Fixed capacity hash map for caches that are shared by many threads. Keys and values are
+    // plain data copied with memcpy, K must provide operator== and the caller supplies the hash.
+    //
+    // A key lives in one of the ProbeCount slots that follow its hash. When all of them are in use
+    // insert evicts the oldest entry of that window, so the map never grows past its capacity.
+    //
+    // Every slot has a version that is odd while the slot is being written. Writers claim a slot
+    // with atomicCompareAndSwap and readers check that the version did not change while they were
+    // reading the entry. Nobody waits: a lookup that races with a write of the same slot reports
+    // a miss and an insert that races with another one is dropped.
+    template <typename K, typename V>
+    class ConcurrentHashMap
+    {
+        NV_FORBID_COPY(ConcurrentHashMap);
+    public:
+        enum { ProbeCount = 8 };
+
+        // The capacity is rounded up to a power of two.
+        explicit ConcurrentHashMap(uint capacity)
+        {
+            const uint count = nextPowerOfTwo(max(capacity, uint(ProbeCount)));
+            m_slots = (Slot *)mem::alignedMalloc(count * sizeof(Slot), 64);
+            m_mask = count - 1;
+            m_clock = 0;
+            clear();
+        }
+
+        ~ConcurrentHashMap()
+        {
+            mem::alignedFree(m_slots);
+        }
+
+        uint capacity() const { return m_mask + 1; }
+
+        // Not thread safe.
+        void clear()
+        {
+            memset(m_slots, 0, capacity() * sizeof(Slot));
+        }
+
+        // Copy the value of key to value and return true if the key is in the map.
+        bool lookup(uint32 hash, const K & key, V * value) const
+        {
+            for (uint i = 0; i < ProbeCount; i++) {
+                const Slot & slot = m_slots[(hash + i) & m_mask];
+
+                const uint32 version = loadAcquire(&slot.version);
+                if (version == 0 || (version & 1) != 0 || slot.hash != hash) continue;
+
+                // The entry may be torn by a concurrent insert, in which case the version tells us to ignore it.
+                bool found = (slot.key == key);
+                if (found) memcpy(value, &slot.value, sizeof(V));
+
+                nvCompilerReadBarrier();
+                if (loadAcquire(&slot.version) != version) continue;
+
+                if (found) return true;
+            }
+            return false;
+        }
+
+        // Add or replace the value of key. Return false if the slot was taken by another writer.
+        bool insert(uint32 hash, const K & key, const V & value)
+        {
+            const uint32 stamp = atomicIncrement(&m_clock);
+
+            // Reuse the slot of the same key or the first empty one, otherwise evict the oldest entry.
+            Slot * victim = NULL;
+            uint32 victimAge = 0;
+            for (uint i = 0; i < ProbeCount; i++) {
+                Slot & slot = m_slots[(hash + i) & m_mask];
+
+                const uint32 version = loadAcquire(&slot.version);
+                if (version == 0 || ((version & 1) == 0 && slot.hash == hash && slot.key == key)) {
+                    victim = &slot;
+                    break;
+                }
+
+                const uint32 age = stamp - slot.stamp;
+                if (victim == NULL || age > victimAge) {
+                    victim = &slot;
+                    victimAge = age;
+                }
+            }
+
+            const uint32 version = loadAcquire(&victim->version);
+            if ((version & 1) != 0 || !atomicCompareAndSwap(&victim->version, version, version + 1)) {
+                return false;
+            }
+
+            victim->hash = hash;
+            victim->stamp = stamp;
+            memcpy(&victim->key, &key, sizeof(K));
+            memcpy(&victim->value, &value, sizeof(V));
+
+            storeRelease(&victim->version, version + 2);
+            return true;
+        }
+
+    private:
+        struct Slot
+        {
+            uint32 version;     // 0 when empty, odd while being written.
+            uint32 hash;
+            uint32 stamp;       // Insertion time, used to pick the entry to evict.
+            K key;
+            V value;
+        };
+
+        Slot * m_slots;
+        uint m_mask;
+        uint32 m_clock;
+    };
+
+} // nv namespace
+
+#endif // NV_THREAD_CONCURRENTHASHMAP_H
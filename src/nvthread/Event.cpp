@@ -1,6 +1,9 @@
 // This code is in the public domain -- castano@gmail.com
 
 #include "Event.h"
+#include "Atomic.h"
+#include "Thread.h"
+#include "Futex.h"
 
 #if NV_OS_WIN32
 #include "Win32.h"
@@ -10,76 +13,100 @@
 
 using namespace nv;
 
-#if NV_OS_WIN32
-
-struct Event::Private {
-    HANDLE handle;
-};
-
-Event::Event() : m(new Private) {
-    m->handle = CreateEvent(NULL, FALSE, FALSE, NULL);
-}
-
-Event::~Event() {
-    CloseHandle(m->handle);
-}
-
-void Event::post() {
-    SetEvent(m->handle);
+uint nv::spinCount() {
+    static const uint count = (hardwareThreadCount() > 1) ? 4000 : 0;
+    return count;
 }
 
-void Event::wait() {
-    WaitForSingleObject(m->handle, INFINITE);
-}
-
-#elif NV_OS_USE_PTHREAD
+// Posts are counted in an atomic word. wait consumes one, spinning for a while if there are none, and only then blocks
+// on the OS primitive. post only signals the OS primitive when a waiter announced that it's going to block.
 
 struct Event::Private {
+    uint32 count;       // Posts not consumed yet.
+    uint32 waiters;     // Threads blocked in wait, or about to block.
+#if NV_HAVE_FUTEX
+    // Blocks on count.
+#elif NV_OS_WIN32
+    HANDLE handle;
+#elif NV_OS_USE_PTHREAD
     pthread_cond_t pt_cond;
     pthread_mutex_t pt_mutex;
-    int count;
-    int wait_count;
+#endif
 };
 
+static bool tryConsume(uint32 * count) {
+    uint32 c = loadAcquire(count);
+    while (c != 0) {
+        if (atomicCompareAndSwap(count, c, c - 1)) return true;
+        c = loadAcquire(count);
+    }
+    return false;
+}
+
 Event::Event() : m(new Private) {
-    m->count=0;
-    m->wait_count=0;
+    m->count = 0;
+    m->waiters = 0;
+#if NV_HAVE_FUTEX
+#elif NV_OS_WIN32
+    m->handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+#elif NV_OS_USE_PTHREAD
     pthread_mutex_init(&m->pt_mutex, NULL);
     pthread_cond_init(&m->pt_cond, NULL);
+#endif
 }
 
 Event::~Event() {
+#if NV_HAVE_FUTEX
+#elif NV_OS_WIN32
+    CloseHandle(m->handle);
+#elif NV_OS_USE_PTHREAD
     pthread_cond_destroy(&m->pt_cond);
     pthread_mutex_destroy(&m->pt_mutex);
+#endif
 }
 
 void Event::post() {
-    pthread_mutex_lock(&m->pt_mutex);
+    // Both atomics are full barriers: either the waiter sees the post before it blocks, or we see the waiter.
+    atomicIncrement(&m->count);
+    if (atomicAdd(&m->waiters, 0) == 0) return;
 
-    m->count++;
-    
-    //ACS: move this after the unlock?
-    if(m->wait_count>0) {
+#if NV_HAVE_FUTEX
+    futexWake(&m->count, 1);
+#elif NV_OS_WIN32
+    SetEvent(m->handle);
+#elif NV_OS_USE_PTHREAD
+    pthread_mutex_lock(&m->pt_mutex);
     pthread_cond_signal(&m->pt_cond);
-    }
-    
     pthread_mutex_unlock(&m->pt_mutex);
+#endif
 }
 
 void Event::wait() {
-    pthread_mutex_lock(&m->pt_mutex);
-    
-    while(m->count==0) {
-        m->wait_count++;
-    pthread_cond_wait(&m->pt_cond, &m->pt_mutex);
-        m->wait_count--;
+    for (uint i = 0, n = spinCount(); i < n; i++) {
+        if (tryConsume(&m->count)) return;
+        nvYieldProcessor();
+    }
+
+    atomicIncrement(&m->waiters);
+
+    while (!tryConsume(&m->count)) {
+#if NV_HAVE_FUTEX
+        futexWait(&m->count, 0);
+#elif NV_OS_WIN32
+        // The event stays signaled when it's set before we get here.
+        WaitForSingleObject(m->handle, INFINITE);
+#elif NV_OS_USE_PTHREAD
+        // post signals while holding the mutex, so it can't slip between the check and the wait.
+        pthread_mutex_lock(&m->pt_mutex);
+        if (loadAcquire(&m->count) == 0) {
+            pthread_cond_wait(&m->pt_cond, &m->pt_mutex);
+        }
+        pthread_mutex_unlock(&m->pt_mutex);
+#endif
     }
-    m->count--;
-    
-    pthread_mutex_unlock(&m->pt_mutex);
-}
 
-#endif // NV_OS_UNIX
+    atomicDecrement(&m->waiters);
+}
 
 
 /*static*/ void Event::post(Event * events, uint count) {
@@ -95,3 +122,77 @@ void Event::wait() {
         events[i].wait();
     }
 }
+
+
+// The last thread to arrive starts a new generation. The others spin until they see it, then block on the generation.
+
+struct Barrier::Private {
+    uint count;
+    uint32 arrived;
+    uint32 generation;
+#if NV_HAVE_FUTEX
+    // Blocks on generation.
+#elif NV_OS_WIN32
+    // Yields after spinning, there's no portable broadcast primitive before Vista.
+#elif NV_OS_USE_PTHREAD
+    pthread_cond_t pt_cond;
+    pthread_mutex_t pt_mutex;
+#endif
+};
+
+Barrier::Barrier(uint count) : m(new Private) {
+    nvDebugCheck(count > 0);
+    m->count = count;
+    m->arrived = 0;
+    m->generation = 0;
+#if NV_OS_USE_PTHREAD && !NV_HAVE_FUTEX
+    pthread_mutex_init(&m->pt_mutex, NULL);
+    pthread_cond_init(&m->pt_cond, NULL);
+#endif
+}
+
+Barrier::~Barrier() {
+#if NV_OS_USE_PTHREAD && !NV_HAVE_FUTEX
+    pthread_cond_destroy(&m->pt_cond);
+    pthread_mutex_destroy(&m->pt_mutex);
+#endif
+}
+
+void Barrier::wait() {
+    const uint32 generation = loadAcquire(&m->generation);
+
+    if (atomicIncrement(&m->arrived) == m->count) {
+        // Nobody arrives for the next generation before it starts.
+        storeRelease(&m->arrived, 0);
+        atomicIncrement(&m->generation);
+
+#if NV_HAVE_FUTEX
+        futexWakeAll(&m->generation);
+#elif NV_OS_WIN32
+#elif NV_OS_USE_PTHREAD
+        pthread_mutex_lock(&m->pt_mutex);
+        pthread_cond_broadcast(&m->pt_cond);
+        pthread_mutex_unlock(&m->pt_mutex);
+#endif
+        return;
+    }
+
+    for (uint i = 0, n = spinCount(); i < n; i++) {
+        if (loadAcquire(&m->generation) != generation) return;
+        nvYieldProcessor();
+    }
+
+    while (loadAcquire(&m->generation) == generation) {
+#if NV_HAVE_FUTEX
+        futexWait(&m->generation, generation);
+#elif NV_OS_WIN32
+        Thread::yield();
+#elif NV_OS_USE_PTHREAD
+        pthread_mutex_lock(&m->pt_mutex);
+        if (loadAcquire(&m->generation) == generation) {
+            pthread_cond_wait(&m->pt_cond, &m->pt_mutex);
+        }
+        pthread_mutex_unlock(&m->pt_mutex);
+#endif
+    }
+}
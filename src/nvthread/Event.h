@@ -10,7 +10,14 @@
 
 namespace nv
 {
+    // Iterations of nvYieldProcessor that Event, Mutex and Barrier spin before they block. A few microseconds, enough to
+    // bridge the gaps between the tiny dispatches of small mipmaps without the cost of going to sleep and waking up.
+    // Zero on single processor systems, where the thread we wait for can't run while we spin.
+    NVTHREAD_API uint spinCount();
+
     // This is intended to be used by a single waiter thread.
+    // Posts are counted. The waiter spins for a while before it blocks, and post only makes a system call when the
+    // waiter is blocked.
     class NVTHREAD_CLASS Event
     {
         NV_FORBID_COPY(Event);
@@ -29,6 +36,21 @@ namespace nv
         AutoPtr<Private> m;
     };
 
+    // Blocks the threads that call wait until count of them did, then releases all of them. Reusable.
+    class NVTHREAD_CLASS Barrier
+    {
+        NV_FORBID_COPY(Barrier);
+    public:
+        explicit Barrier(uint count);
+        ~Barrier();
+
+        void wait();
+
+    private:
+        struct Private;
+        AutoPtr<Private> m;
+    };
+
 } // nv namespace
 
 #endif // NV_THREAD_EVENT_H
@@ -0,0 +1,41 @@
+// This code is in the public domain -- castano@gmail.com
+
+// Never include this from a header file.
+
+// Linux futexes: block while a word has a given value, and wake the threads blocked on a word.
+
+#include "nvthread.h"
+
+#if NV_OS_LINUX
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <limits.h> // INT_MAX
+
+#define NV_HAVE_FUTEX 1
+
+namespace nv
+{
+    // Returns right away, or spuriously, when *word is no longer value.
+    inline void futexWait(uint32 * word, uint32 value)
+    {
+        syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+    }
+
+    inline void futexWake(uint32 * word, int count)
+    {
+        syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+    }
+
+    inline void futexWakeAll(uint32 * word)
+    {
+        futexWake(word, INT_MAX);
+    }
+}
+
+#else
+
+#define NV_HAVE_FUTEX 0
+
+#endif
@@ -1,6 +1,9 @@
 // This code is in the public domain -- castano@gmail.com
 
 #include "Mutex.h"
+#include "Event.h" // spinCount
+#include "Atomic.h"
+#include "Futex.h"
 
 #if NV_OS_WIN32
 
@@ -16,7 +19,52 @@
 using namespace nv;
 
 
-#if NV_OS_WIN32
+#if NV_HAVE_FUTEX
+
+// Contended locks spin for a while before they block. The state is 0 when unlocked, 1 when locked and 2 when locked
+// and there may be threads blocked on it, see "Futexes Are Tricky" by Ulrich Drepper.
+struct Mutex::Private {
+    uint32 state;
+};
+
+Mutex::Mutex () : m(new Private)
+{
+    m->state = 0;
+}
+
+Mutex::~Mutex ()
+{
+    nvDebugCheck(m->state == 0);
+}
+
+void Mutex::lock()
+{
+    for (uint i = 0, n = spinCount(); i < n; i++) {
+        if (loadAcquire(&m->state) == 0 && atomicCompareAndSwap(&m->state, 0, 1)) return;
+        nvYieldProcessor();
+    }
+
+    // We can't tell whether there are other waiters, so keep the lock marked as contended.
+    uint32 state = atomicSwap(&m->state, 2);
+    while (state != 0) {
+        futexWait(&m->state, 2);
+        state = atomicSwap(&m->state, 2);
+    }
+}
+
+bool Mutex::tryLock()
+{
+    return atomicCompareAndSwap(&m->state, 0, 1);
+}
+
+void Mutex::unlock()
+{
+    if (atomicSwap(&m->state, 0) == 2) {
+        futexWake(&m->state, 1);
+    }
+}
+
+#elif NV_OS_WIN32
 
 struct Mutex::Private {
     CRITICAL_SECTION mutex;
@@ -25,7 +73,8 @@ struct Mutex::Private {
 
 Mutex::Mutex () : m(new Private)
 {
-    InitializeCriticalSection(&m->mutex);
+    // Contended locks spin for a while before they block.
+    InitializeCriticalSectionAndSpinCount(&m->mutex, spinCount());
 }
 
 Mutex::~Mutex ()
@@ -69,6 +118,12 @@ Mutex::~Mutex ()
 
 void Mutex::lock()
 {
+    // Contended locks spin for a while before they block.
+    for (uint i = 0, n = spinCount(); i < n; i++) {
+        if (pthread_mutex_trylock(&m->mutex) == 0) return;
+        nvYieldProcessor();
+    }
+
     int result = pthread_mutex_lock(&m->mutex);
     nvDebugCheck(result == 0);
 }
@@ -4,6 +4,7 @@
 #include "Thread.h"
 #include "Atomic.h"
 #include "ThreadPool.h"
+#include "TaskScheduler.h"
 
 #include "nvcore/Utils.h" // toI32
 
@@ -14,19 +15,39 @@ using namespace nv;
 static void worker(void * arg) {
     ParallelFor * owner = (ParallelFor *)arg;
 
+    const uint count = owner->count;
+    const uint step = owner->step;
+
     while(true) {
-        // Consume one element at a time. @@ Might be more efficient to have custom grain.
-        uint i = atomicIncrement(&owner->idx);
-        if (i > owner->count) {
+        // Consume 'step' elements at a time. The counter only hands out the elements, the pool's start and wait publish the rest.
+        uint end = owner->idx.fetchAddRelaxed(step) + step;
+        uint begin = end - step;
+        if (begin >= count) {
             break;
         }
+        if (end > count) {
+            end = count;
+        }
 
-        owner->task(owner->context, i - 1);
+        if (owner->rangeTask != NULL) {
+            owner->rangeTask(owner->context, begin, end);
+        }
+        else {
+            for (uint i = begin; i < end; i++) {
+                owner->task(owner->context, i);
+            }
+        }
     } 
 }
 
 
-ParallelFor::ParallelFor(ForTask * task, void * context) : task(task), context(context) {
+ParallelFor::ParallelFor(ForTask * task, void * context) : task(task), rangeTask(NULL), context(context) {
+#if ENABLE_PARALLEL_FOR
+    pool = ThreadPool::acquire();
+#endif
+}
+
+ParallelFor::ParallelFor(ForRangeTask * task, void * context) : task(NULL), rangeTask(task), context(context) {
 #if ENABLE_PARALLEL_FOR
     pool = ThreadPool::acquire();
 #endif
@@ -38,12 +59,26 @@ ParallelFor::~ParallelFor() {
 #endif
 }
 
-void ParallelFor::run(uint count) {
+void ParallelFor::run(uint count, uint step/*= 1*/) {
+    nvDebugCheck(step > 0);
+
 #if ENABLE_PARALLEL_FOR
+    if (pool == NULL) {
+        // Nested in a worker of a pool, or all the pools are in use.
+        if (rangeTask != NULL) {
+            TaskScheduler::global()->parallelFor(rangeTask, context, count, step);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(task, context, count, step);
+        }
+        return;
+    }
+
     storeRelease(&this->count, count);
+    storeRelease(&this->step, step);
 
     // Init atomic counter to zero.
-    storeRelease(&idx, 0);
+    idx.storeRelaxed(0);
 
     // Start threads.
     pool->start(worker, this);
@@ -51,10 +86,17 @@ void ParallelFor::run(uint count) {
     // Wait for all threads to complete.
     pool->wait();
 
-    nvDebugCheck(idx >= count);
+    nvDebugCheck(idx.loadRelaxed() >= count);
 #else
-    for (int i = 0; i < toI32(count); i++) {
-        task(context, i);
+    if (rangeTask != NULL) {
+        for (uint begin = 0; begin < count; begin += step) {
+            rangeTask(context, begin, min(begin + step, count));
+        }
+    }
+    else {
+        for (int i = 0; i < toI32(count); i++) {
+            task(context, i);
+        }
     }
 #endif
 }
@@ -5,7 +5,7 @@
 #define NV_THREAD_PARALLELFOR_H
 
 #include "nvthread.h"
-//#include "Atomic.h" // atomic<uint>
+#include "Atomic.h"
 
 namespace nv
 {
@@ -13,15 +13,19 @@ namespace nv
     class ThreadPool;
 
     typedef void ForTask(void * context, int id);
+    typedef void ForRangeTask(void * context, int begin, int end);
 
     struct ParallelFor {
         ParallelFor(ForTask * task, void * context);
+        ParallelFor(ForRangeTask * task, void * context);
         ~ParallelFor();
 
-        void run(uint count);
+        // Workers grab 'step' consecutive items at a time. Range tasks receive the whole [begin, end) run in a single call.
+        void run(uint count, uint step = 1);
 
         // Invariant:
         ForTask * task;
+        ForRangeTask * rangeTask;
         void * context;
         ThreadPool * pool;
         //uint workerCount;   // @@ Move to thread pool.
@@ -29,7 +33,8 @@ namespace nv
 
         // State:
         uint count;
-        /*atomic<uint>*/ uint idx;
+        uint step;
+        Atomic<uint> idx;
     };
 
 } // nv namespace
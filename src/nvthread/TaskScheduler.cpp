@@ -0,0 +1,452 @@
+// This code is in the public domain -- castano@gmail.com
+
+#include "TaskScheduler.h"
+#include "Thread.h"
+#include "Event.h"
+#include "Mutex.h"
+#include "Atomic.h"
+
+#include "nvcore/Utils.h" // max
+#include "nvcore/Memory.h" // realloc
+
+#include <string.h> // memcpy
+
+using namespace nv;
+
+
+namespace {
+
+    struct Task
+    {
+        ForTask * task;
+        ForRangeTask * rangeTask;
+        void * context;
+        uint begin, end, step;
+        TaskGroup * group;
+    };
+
+    // Ring buffer of tasks protected by a mutex. The owner uses the back, thieves use the front.
+    struct TaskQueue
+    {
+        TaskQueue() : buffer(NULL), capacity(0), head(0), count(0) {}
+        ~TaskQueue() { nv::free(buffer); }
+
+        void pushBack(const Task & t)
+        {
+            Lock<Mutex> lock(mutex);
+
+            if (count == capacity) grow();
+
+            buffer[(head + count) & (capacity - 1)] = t;
+            count++;
+        }
+
+        bool popBack(Task * t)
+        {
+            Lock<Mutex> lock(mutex);
+
+            if (count == 0) return false;
+
+            count--;
+            *t = buffer[(head + count) & (capacity - 1)];
+            return true;
+        }
+
+        bool popFront(Task * t)
+        {
+            Lock<Mutex> lock(mutex);
+
+            if (count == 0) return false;
+
+            *t = buffer[head];
+            head = (head + 1) & (capacity - 1);
+            count--;
+            return true;
+        }
+
+        void grow()
+        {
+            uint newCapacity = max(64U, capacity * 2);
+            Task * newBuffer = nv::malloc<Task>(newCapacity);
+
+            // Linearize the ring.
+            for (uint i = 0; i < count; i++) {
+                newBuffer[i] = buffer[(head + i) & (capacity - 1)];
+            }
+
+            nv::free(buffer);
+            buffer = newBuffer;
+            capacity = newCapacity;
+            head = 0;
+        }
+
+        Mutex mutex;
+        Task * buffer;
+        uint capacity;  // Always a power of two.
+        uint head;
+        uint count;
+    };
+
+    struct WorkerArg
+    {
+        TaskScheduler::Private * scheduler;
+        uint index;
+    };
+
+} // namespace
+
+
+struct TaskScheduler::Private
+{
+    uint workerCount;
+    Thread * workers;
+    WorkerArg * workerArgs;
+    Event * wakeEvents;
+    uint * sleeping;
+    uint sleeperCount;
+    uint quit;
+
+    // One queue per worker, plus one shared by all the external threads.
+    uint queueCount;
+    TaskQueue * queues;
+
+    uint currentQueue();
+    void push(uint q, const Task & t);
+    bool pop(uint q, Task * t);
+    void execute(uint q, Task & t);
+    void wake();
+    void help(TaskGroup * group);
+};
+
+
+#if NV_OS_HAS_TLS_QUALIFIER
+static NV_THREAD_LOCAL TaskScheduler::Private * s_currentScheduler = NULL;
+static NV_THREAD_LOCAL uint s_currentQueue = 0;
+#endif
+
+uint TaskScheduler::Private::currentQueue()
+{
+#if NV_OS_HAS_TLS_QUALIFIER
+    if (s_currentScheduler == this) return s_currentQueue;
+#endif
+    return workerCount; // External queue.
+}
+
+void TaskScheduler::Private::push(uint q, const Task & t)
+{
+    queues[q].pushBack(t);
+    wake();
+}
+
+bool TaskScheduler::Private::pop(uint q, Task * t)
+{
+    // Newest task of our own queue first, it's more likely to be in the cache.
+    if (queues[q].popBack(t)) return true;
+
+    // Steal the oldest tasks of the other queues, those are usually the largest ones.
+    for (uint i = 1; i < queueCount; i++) {
+        if (queues[(q + i) % queueCount].popFront(t)) return true;
+    }
+
+    return false;
+}
+
+void TaskScheduler::Private::execute(uint q, Task & t)
+{
+    TaskGroup * group = t.group;
+
+    // Split large ranges in halves and push the upper half so that it can be stolen.
+    if (t.rangeTask != NULL) {
+        while (t.end - t.begin > t.step) {
+            uint chunks = (t.end - t.begin + t.step - 1) / t.step;
+
+            Task upper = t;
+            upper.begin = t.begin + (chunks / 2) * t.step;
+            t.end = upper.begin;
+
+            atomicIncrement(&group->remaining);
+            atomicIncrement(&group->pending);
+            push(q, upper);
+        }
+
+        t.rangeTask(t.context, t.begin, t.end);
+    }
+    else {
+        t.task(t.context, t.begin);
+    }
+
+    if (atomicDecrement(&group->remaining) == 0) {
+        ForTask * continuation = group->continuation;
+        if (continuation != NULL) {
+            group->continuation = NULL;
+            continuation(group->continuationContext, group->continuationId);
+        }
+    }
+
+    atomicDecrement(&group->pending);
+}
+
+void TaskScheduler::Private::wake()
+{
+    // atomicAdd is used as a fenced load. Pairs with the fences in workerFunc before a worker checks the queues for the last time.
+    if (atomicAdd(&sleeperCount, 0) == 0) return;
+
+    for (uint i = 0; i < workerCount; i++) {
+        if (atomicCompareAndSwap(&sleeping[i], 1, 0)) {
+            wakeEvents[i].post();
+            break;
+        }
+    }
+}
+
+void TaskScheduler::Private::help(TaskGroup * group)
+{
+    const uint q = currentQueue();
+
+    while (loadAcquire(&group->pending) != 0) {
+        Task t;
+        if (pop(q, &t)) {
+            execute(q, t);
+        }
+        else {
+            // Remaining tasks are running on other threads.
+            Thread::yield();
+        }
+    }
+}
+
+
+static void workerFunc(void * arg)
+{
+    WorkerArg * w = (WorkerArg *)arg;
+    TaskScheduler::Private * p = w->scheduler;
+    const uint i = w->index;
+
+#if NV_OS_HAS_TLS_QUALIFIER
+    s_currentScheduler = p;
+    s_currentQueue = i;
+#endif
+
+    nv::initWorkerThread(i);
+
+    while (loadAcquire(&p->quit) == 0)
+    {
+        Task t;
+        if (p->pop(i, &t)) {
+            p->execute(i, t);
+            continue;
+        }
+
+        // Announce that we are going to sleep, then look for work one last time so that we don't miss a wake up.
+        atomicSwap(&p->sleeping[i], 1);
+        atomicIncrement(&p->sleeperCount);
+
+        if (p->pop(i, &t)) {
+            if (!atomicCompareAndSwap(&p->sleeping[i], 1, 0)) {
+                // Somebody posted our event already, consume it.
+                p->wakeEvents[i].wait();
+            }
+            atomicDecrement(&p->sleeperCount);
+
+            p->execute(i, t);
+            continue;
+        }
+
+        p->wakeEvents[i].wait();
+        atomicDecrement(&p->sleeperCount);
+    }
+}
+
+
+TaskScheduler::TaskScheduler(uint workerCount/*= ~0U*/) : m(new Private)
+{
+    if (workerCount == ~0U) {
+        workerCount = nv::hardwareThreadCount();
+        if (workerCount > 0) workerCount--;
+    }
+
+    m->workerCount = workerCount;
+    m->sleeperCount = 0;
+    m->quit = 0;
+
+    m->queueCount = workerCount + 1;
+    m->queues = new TaskQueue[m->queueCount];
+
+    m->workers = new Thread[workerCount];
+    m->workerArgs = new WorkerArg[workerCount];
+    m->wakeEvents = new Event[workerCount];
+    m->sleeping = new uint[workerCount];
+
+    for (uint i = 0; i < workerCount; i++) {
+        m->workerArgs[i].scheduler = m.ptr();
+        m->workerArgs[i].index = i;
+        m->sleeping[i] = 0;
+    }
+
+    nvCompilerWriteBarrier();
+
+    for (uint i = 0; i < workerCount; i++) {
+        m->workers[i].start(workerFunc, &m->workerArgs[i]);
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    storeRelease(&m->quit, 1);
+
+    Event::post(m->wakeEvents, m->workerCount);
+    Thread::wait(m->workers, m->workerCount);
+
+    delete [] m->workers;
+    delete [] m->workerArgs;
+    delete [] m->wakeEvents;
+    delete [] m->sleeping;
+    delete [] m->queues;
+}
+
+uint TaskScheduler::workerCount() const
+{
+    return m->workerCount;
+}
+
+namespace {
+    struct ForTaskContext {
+        ForTask * task;
+        void * context;
+    };
+
+    void ForTaskRange(void * arg, int begin, int end) {
+        ForTaskContext * ctx = (ForTaskContext *)arg;
+        for (int i = begin; i < end; i++) {
+            ctx->task(ctx->context, i);
+        }
+    }
+}
+
+void TaskScheduler::parallelFor(ForTask * task, void * context, uint count, uint step/*= 1*/)
+{
+    ForTaskContext ctx = { task, context };
+    parallelFor(ForTaskRange, &ctx, count, step);
+}
+
+void TaskScheduler::parallelFor(ForRangeTask * task, void * context, uint count, uint step/*= 1*/)
+{
+    if (count == 0) return;
+
+    TaskGroup group(this);
+    group.run(task, context, count, step);
+    group.wait();
+}
+
+
+static Mutex s_globalMutex;
+static AutoPtr<TaskScheduler> s_globalOwner;
+static TaskScheduler * s_globalScheduler = NULL;
+static uint s_defaultWorkerCount = ~0U;   // Guarded by s_globalMutex.
+
+/*static*/ TaskScheduler * TaskScheduler::global()
+{
+    TaskScheduler * scheduler = loadAcquirePointer(&s_globalScheduler);
+    if (scheduler == NULL) {
+        Lock<Mutex> lock(s_globalMutex);
+        if (s_globalScheduler == NULL) {
+            if (s_globalOwner == NULL) s_globalOwner = new TaskScheduler(s_defaultWorkerCount);
+            storeReleasePointer(&s_globalScheduler, s_globalOwner.ptr());
+        }
+        scheduler = s_globalScheduler;
+    }
+    return scheduler;
+}
+
+/*static*/ void TaskScheduler::setGlobal(TaskScheduler * scheduler)
+{
+    Lock<Mutex> lock(s_globalMutex);
+    storeReleasePointer(&s_globalScheduler, scheduler);
+}
+
+/*static*/ void TaskScheduler::setDefaultWorkerCount(uint workerCount)
+{
+    Lock<Mutex> lock(s_globalMutex);
+    s_defaultWorkerCount = workerCount;
+
+    if (s_globalScheduler == s_globalOwner.ptr()) {
+        storeReleasePointer(&s_globalScheduler, (TaskScheduler *)NULL);
+    }
+    s_globalOwner = NULL;
+}
+
+
+
+TaskGroup::TaskGroup(TaskScheduler * scheduler/*= NULL*/) : remaining(0), pending(0), continuation(NULL), continuationContext(NULL), continuationId(0)
+{
+    this->scheduler = (scheduler != NULL) ? scheduler : TaskScheduler::global();
+}
+
+TaskGroup::~TaskGroup()
+{
+    wait();
+}
+
+void TaskGroup::run(ForTask * task, void * context, int id/*= 0*/)
+{
+    Task t;
+    t.task = task;
+    t.rangeTask = NULL;
+    t.context = context;
+    t.begin = id;
+    t.end = id + 1;
+    t.step = 1;
+    t.group = this;
+
+    atomicIncrement(&remaining);
+    atomicIncrement(&pending);
+
+    TaskScheduler::Private * p = scheduler->m.ptr();
+    p->push(p->currentQueue(), t);
+}
+
+void TaskGroup::run(ForRangeTask * task, void * context, uint count, uint step/*= 1*/)
+{
+    if (count == 0) return;
+
+    Task t;
+    t.task = NULL;
+    t.rangeTask = task;
+    t.context = context;
+    t.begin = 0;
+    t.end = count;
+    t.step = max(1U, step);
+    t.group = this;
+
+    atomicIncrement(&remaining);
+    atomicIncrement(&pending);
+
+    TaskScheduler::Private * p = scheduler->m.ptr();
+    p->push(p->currentQueue(), t);
+}
+
+void TaskGroup::setContinuation(ForTask * task, void * context, int id/*= 0*/)
+{
+    continuationContext = context;
+    continuationId = id;
+    storeReleasePointer(&continuation, task);
+}
+
+void TaskGroup::wait()
+{
+    while (true) {
+        scheduler->m->help(this);
+
+        // The continuation of a group without tasks runs here.
+        ForTask * task = continuation;
+        if (task == NULL) break;
+
+        continuation = NULL;
+        task(continuationContext, continuationId);
+    }
+}
+
+bool TaskGroup::isDone() const
+{
+    return loadAcquire(&pending) == 0 && continuation == NULL;
+}
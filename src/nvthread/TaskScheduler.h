@@ -0,0 +1,85 @@
+// This code is in the public domain -- castano@gmail.com
+
+#pragma once
+#ifndef NV_THREAD_TASKSCHEDULER_H
+#define NV_THREAD_TASKSCHEDULER_H
+
+#include "nvthread.h"
+#include "ParallelFor.h" // ForTask, ForRangeTask
+
+#include "nvcore/Ptr.h"
+
+// Work-stealing task scheduler. Each worker owns a deque of tasks, it pushes and pops from the back, while idle workers steal from the front of the other deques.
+// Threads waiting on a task group run pending tasks instead of blocking, so tasks can spawn and wait for nested groups without starving the workers.
+// Threads that are not workers of the scheduler share an additional queue.
+
+namespace nv
+{
+    class TaskScheduler;
+
+    class NVTHREAD_CLASS TaskGroup
+    {
+        NV_FORBID_COPY(TaskGroup);
+    public:
+        TaskGroup(TaskScheduler * scheduler = NULL);    // NULL uses the global scheduler.
+        ~TaskGroup();                                   // Waits for all the tasks of the group.
+
+        void run(ForTask * task, void * context, int id = 0);
+
+        // Run the task over [0, count). The range is split recursively into runs of at most 'step' items.
+        void run(ForRangeTask * task, void * context, uint count, uint step = 1);
+
+        // The continuation runs once after all the tasks of the group have finished, on the thread that completed the last one.
+        // It's allowed to add more tasks to the group. All tasks should be added before the group completes, or from tasks of the group.
+        void setContinuation(ForTask * task, void * context, int id = 0);
+
+        // Run pending tasks until all the tasks of the group (and the continuation) have completed.
+        void wait();
+
+        bool isDone() const;
+
+    //private:
+        TaskScheduler * scheduler;
+
+        uint remaining;     // Tasks that have not finished yet.
+        uint pending;       // Like 'remaining', but decremented after the optional continuation has run.
+
+        ForTask * continuation;
+        void * continuationContext;
+        int continuationId;
+    };
+
+    class NVTHREAD_CLASS TaskScheduler
+    {
+        NV_FORBID_COPY(TaskScheduler);
+    public:
+
+        // Shared scheduler, created on first use.
+        static TaskScheduler * global();
+
+        // Make scheduler the shared one, NULL goes back to the default scheduler. The caller keeps the ownership. Only call
+        // it while no task is running, the tools use it to compare worker counts.
+        static void setGlobal(TaskScheduler * scheduler);
+
+        // Workers of the default scheduler, ~0U for the default below. The default scheduler is destroyed and created again on
+        // its next use, with the current worker settings. Only call it while no task is running.
+        static void setDefaultWorkerCount(uint workerCount);
+
+        // By default we create one worker less than the number of hardware threads, the thread that waits on a group makes up for it.
+        TaskScheduler(uint workerCount = ~0U);
+        ~TaskScheduler();
+
+        uint workerCount() const;
+
+        // Run the task over [0, count) and wait for it to complete.
+        void parallelFor(ForTask * task, void * context, uint count, uint step = 1);
+        void parallelFor(ForRangeTask * task, void * context, uint count, uint step = 1);
+
+        struct Private;
+        AutoPtr<Private> m;
+    };
+
+} // nv namespace
+
+
+#endif // NV_THREAD_TASKSCHEDULER_H
@@ -94,7 +94,9 @@ bool Thread::isRunning () const
 
 /*static*/ void Thread::spinWait(uint count)
 {
-    for (uint i = 0; i < count; i++) {}
+    for (uint i = 0; i < count; i++) {
+        nvYieldProcessor();
+    }
 }
 
 /*static*/ void Thread::yield()
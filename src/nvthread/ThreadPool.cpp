@@ -6,83 +6,141 @@
 #include "Atomic.h"
 
 #include "nvcore/Utils.h"
-
-// Most of the time it's not necessary to protect the thread pool, but if it doesn't add a significant overhead, then it'd be safer to do it.
-#define PROTECT_THREAD_POOL 1
+#include "nvcore/Array.inl"
 
 
 using namespace nv;
 
-#if PROTECT_THREAD_POOL 
-Mutex s_pool_mutex;
+namespace {
+
+    // All the pools ever created, and those that are currently idle.
+    struct PoolList {
+        ~PoolList() {
+            for (uint i = 0; i < all.count(); i++) {
+                delete all[i];
+            }
+        }
+
+        Mutex mutex;
+        Array<ThreadPool *> all;
+        Array<ThreadPool *> idle;
+    };
+
+    PoolList s_pools;
+    uint s_workerCount = ~0U;   // Guarded by s_pools.mutex.
+
+    // Each pool has a thread per core, more pools than this only oversubscribe the cores.
+    const uint kMaxPoolCount = 4;
+
+#if NV_OS_HAS_TLS_QUALIFIER
+    // Set in the worker threads of the pools.
+    NV_THREAD_LOCAL bool s_isPoolWorker = false;
 #endif
 
-AutoPtr<ThreadPool> s_pool;
+} // namespace
 
 
 /*static*/ ThreadPool * ThreadPool::acquire()
 {
-#if PROTECT_THREAD_POOL 
-    s_pool_mutex.lock();    // @@ If same thread tries to lock twice, this should assert.
+#if NV_OS_HAS_TLS_QUALIFIER
+    // A loop nested in a worker of a pool doesn't get a pool of its own.
+    if (s_isPoolWorker) return NULL;
 #endif
 
-    if (s_pool == NULL) {
-        ThreadPool * p = new ThreadPool;
-        nvDebugCheck(s_pool == p);
+    Lock<Mutex> lock(s_pools.mutex);
+
+    ThreadPool * pool;
+    if (s_pools.idle.isEmpty()) {
+        // All pools are busy, either other threads are using them or we are nested inside a parallel loop.
+        if (s_pools.all.count() >= kMaxPoolCount) return NULL;
+
+        pool = new ThreadPool((s_workerCount == ~0U) ? nv::hardwareThreadCount() : s_workerCount);
+        s_pools.all.append(pool);
+    }
+    else {
+        pool = s_pools.idle.back();
+        s_pools.idle.popBack();
     }
 
-    return s_pool.ptr();
+    return pool;
 }
 
 /*static*/ void ThreadPool::release(ThreadPool * pool)
 {
-    nvDebugCheck(pool == s_pool);
+    if (pool == NULL) return;
 
     // Make sure the threads of the pool are idle.
-    s_pool->wait();
+    pool->wait();
 
-#if PROTECT_THREAD_POOL 
-    s_pool_mutex.unlock();
-#endif
+    Lock<Mutex> lock(s_pools.mutex);
+    s_pools.idle.append(pool);
+}
+
+/*static*/ void ThreadPool::setWorkerCount(uint count)
+{
+    Lock<Mutex> lock(s_pools.mutex);
+
+    s_workerCount = count;
+
+    for (uint i = 0; i < s_pools.idle.count(); i++) {
+        ThreadPool * pool = s_pools.idle[i];
+        s_pools.all.remove(pool);
+        delete pool;
+    }
+    s_pools.idle.clear();
 }
 
 
 
 
 /*static*/ void ThreadPool::workerFunc(void * arg) {
-    uint i = U32((uintptr_t)arg); // This is OK, because workerCount should always be much smaller than 2^32
+    Worker * worker = (Worker *)arg;
+    ThreadPool * pool = worker->pool;
+    const uint i = worker->index;
+
+    nv::initWorkerThread(i);
+
+#if NV_OS_HAS_TLS_QUALIFIER
+    s_isPoolWorker = true;
+#endif
 
     while(true) 
     {
-        s_pool->startEvents[i].wait();
+        pool->startEvents[i].wait();
 
-        nv::ThreadFunc * func = loadAcquirePointer(&s_pool->func);
+        nv::ThreadFunc * func = loadAcquirePointer(&pool->func);
 
         if (func == NULL) {
             return;
         }
         
-        func(s_pool->arg);
+        func(pool->arg);
 
-        s_pool->finishEvents[i].post();
+        pool->finishBarrier->wait();
     }
 }
 
 
-ThreadPool::ThreadPool() 
+ThreadPool::ThreadPool(uint workerCount) : workerCount(max(workerCount, 1U))
 {
-    s_pool = this;  // Worker threads need this to be initialized before they start.
-
-    workerCount = nv::hardwareThreadCount();
     workers = new Thread[workerCount];
+    workerArgs = new Worker[workerCount];
 
     startEvents = new Event[workerCount];
-    finishEvents = new Event[workerCount];
+    finishBarrier = new Barrier(workerCount + 1);
+
+    for (uint i = 0; i < workerCount; i++) {
+        workerArgs[i].pool = this;
+        workerArgs[i].index = i;
+    }
+
+    func = NULL;
+    arg = NULL;
 
     nvCompilerWriteBarrier(); // @@ Use a memory fence?
 
-    for (uintptr_t i = 0; i < workerCount; i++) {
-        workers[i].start(workerFunc, (void *)i);
+    for (uint i = 0; i < workerCount; i++) {
+        workers[i].start(workerFunc, &workerArgs[i]);
     }
 
     allIdle = true;
@@ -97,8 +155,9 @@ ThreadPool::~ThreadPool()
     Thread::wait(workers, workerCount);
 
     delete [] workers;
+    delete [] workerArgs;
     delete [] startEvents;
-    delete [] finishEvents;
+    delete finishBarrier;
 }
 
 void ThreadPool::start(ThreadFunc * func, void * arg)
@@ -121,7 +180,7 @@ void ThreadPool::wait()
     if (!allIdle)
     {
         // Wait for threads to complete.
-        Event::wait(finishEvents, workerCount);
+        finishBarrier->wait();
 
         allIdle = true;
     }
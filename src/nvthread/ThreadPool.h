@@ -14,11 +14,14 @@
 // The thread pool runs the same function in all worker threads, the idea is to use this as the foundation of a custom task scheduler.
 // When the thread pool starts, the main thread continues running, but the common use case is to inmmediately wait of the termination events of the worker threads.
 // @@ The start and wait methods could probably be merged.
+// acquire() hands out an idle pool and creates a new one when all of them are in use, so that clients running on different threads do not serialize on a single pool.
+// It returns NULL when called from a worker of a pool, or when the maximum number of pools are in use. ParallelFor then runs the loop on the global task scheduler.
 
 namespace nv {
 
     class Thread;
     class Event;
+    class Barrier;
 
     class ThreadPool {
         NV_FORBID_COPY(ThreadPool);
@@ -27,7 +30,12 @@ namespace nv {
         static ThreadPool * acquire();
         static void release(ThreadPool *);
 
-        ThreadPool();
+        // Number of workers of the pools created from now on, ~0U for one per hardware thread, the default. The idle pools
+        // are destroyed, so that the next ones start with the current worker settings. Only call it while no pool is in use,
+        // the tools use it to compare thread counts.
+        static void setWorkerCount(uint count);
+
+        ThreadPool(uint workerCount);
         ~ThreadPool();
 
         void start(ThreadFunc * func, void * arg);
@@ -35,12 +43,18 @@ namespace nv {
 
     private:
 
+        struct Worker {
+            ThreadPool * pool;
+            uint index;
+        };
+
         static void workerFunc(void * arg);
 
         uint workerCount;
         Thread * workers;
+        Worker * workerArgs;
         Event * startEvents;
-        Event * finishEvents;
+        Barrier * finishBarrier;    // The workers and the thread that waits for them.
 
         uint allIdle;
 
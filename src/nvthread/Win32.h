@@ -4,6 +4,6 @@
 
 #define WIN32_LEAN_AND_MEAN
 #define VC_EXTRALEAN
-#define _WIN32_WINNT 0x0400 // for SwitchToThread, TryEnterCriticalSection
+#define _WIN32_WINNT 0x0403 // for SwitchToThread, TryEnterCriticalSection, InitializeCriticalSectionAndSpinCount
 #include <windows.h>
 //#include <process.h> // for _beginthreadex
\ No newline at end of file
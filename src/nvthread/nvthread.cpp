@@ -4,12 +4,26 @@
 
 #include "Thread.h"
 
+#include "nvcore/Utils.h" // min, max
+#include "nvcore/Array.inl"
+
+#include <math.h> // ceil
+
 #if NV_OS_WIN32
 #include "Win32.h"
 #elif NV_OS_UNIX
 #include <sys/types.h>
-#include <sys/sysctl.h>
+#include <sys/resource.h> // setpriority
+#if !NV_OS_LINUX
+#include <sys/sysctl.h> // Not available in recent glibc, and only needed for the BSD code path.
+#endif
 #include <unistd.h>
+#include <pthread.h> // pthread_self
+#if NV_OS_LINUX
+#include <sys/syscall.h> // SYS_gettid
+#include <sched.h> // sched_getaffinity
+#include <stdio.h>
+#endif
 #elif NV_OS_DARWIN
 #import <stdio.h>
 #import <string.h>
@@ -23,10 +37,62 @@
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <pthread.h> // pthread_threadid_np
 #endif
 
 using namespace nv;
 
+namespace
+{
+    ThreadPriority s_workerPriority = ThreadPriority_Normal;
+    Array<uint> s_workerCpus;
+
+#if NV_OS_LINUX
+    // CPUs worth of time the cgroup of the process may use, 0 without a quota.
+    uint cgroupCpuQuota()
+    {
+        double quota = -1, period = 0;
+
+        // cgroup v2: "max 100000" or "<quota> <period>".
+        if (FILE * fp = fopen("/sys/fs/cgroup/cpu.max", "r")) {
+            char value[32];
+            if (fscanf(fp, "%31s %lf", value, &period) == 2 && value[0] != 'm') {
+                sscanf(value, "%lf", &quota);
+            }
+            fclose(fp);
+        }
+        // cgroup v1, the quota is -1 when unlimited.
+        else if (FILE * fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) {
+            if (fscanf(fp, "%lf", &quota) != 1) quota = -1;
+            fclose(fp);
+
+            if (FILE * fp = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) {
+                if (fscanf(fp, "%lf", &period) != 1) period = 0;
+                fclose(fp);
+            }
+        }
+
+        if (quota <= 0 || period <= 0) return 0;
+        return max(1U, uint(ceil(quota / period)));
+    }
+
+    uint availableThreadCount()
+    {
+        uint count = uint(sysconf(_SC_NPROCESSORS_ONLN));
+
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            count = min(count, uint(CPU_COUNT(&set)));
+        }
+
+        const uint quota = cgroupCpuQuota();
+        if (quota != 0) count = min(count, quota);
+
+        return max(count, 1U);
+    }
+#endif
+}
+
 
 // Find the number of cores in the system.
 // Based on: http://stackoverflow.com/questions/150355/programmatically-find-the-number-of-cores-on-a-machine
@@ -39,7 +105,9 @@ uint nv::hardwareThreadCount() {
 #elif NV_OS_XBOX
     return 3; // or 6?
 #elif NV_OS_LINUX // Linux, Solaris, & AIX
-    return sysconf(_SC_NPROCESSORS_ONLN);
+    // Containers usually limit the process through its cgroup, not through the CPUs it sees.
+    static const uint count = availableThreadCount();
+    return count;
 #elif NV_OS_DARWIN || NV_OS_FREEBSD || NV_OS_OPENBSD
     int numCPU;
     int mib[4];
@@ -72,3 +140,66 @@ uint nv::hardwareThreadCount() {
 #endif
 }
 
+void nv::setWorkerPriority(ThreadPriority priority)
+{
+    s_workerPriority = priority;
+}
+
+void nv::setWorkerAffinity(const uint * cpus, uint cpuCount)
+{
+    s_workerCpus.clear();
+    if (cpus != NULL) s_workerCpus.append(cpus, cpuCount);
+}
+
+void nv::initWorkerThread(uint index)
+{
+#if NV_OS_WIN32
+    if (s_workerPriority != ThreadPriority_Normal) {
+        SetThreadPriority(GetCurrentThread(), s_workerPriority == ThreadPriority_Lowest ? THREAD_PRIORITY_LOWEST : THREAD_PRIORITY_BELOW_NORMAL);
+    }
+    if (!s_workerCpus.isEmpty()) {
+        // Only the CPUs of the first processor group.
+        const uint cpu = s_workerCpus[index % s_workerCpus.count()];
+        if (cpu < 8 * sizeof(DWORD_PTR)) SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+    }
+#elif NV_OS_LINUX
+    // The nice value of a Linux thread is its own, raising it doesn't need privileges.
+    if (s_workerPriority != ThreadPriority_Normal) {
+        const int tid = (int)syscall(SYS_gettid);
+        const int nice = getpriority(PRIO_PROCESS, tid);
+        setpriority(PRIO_PROCESS, tid, min(nice + (s_workerPriority == ThreadPriority_Lowest ? 19 : 5), 19));
+    }
+    if (!s_workerCpus.isEmpty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(s_workerCpus[index % s_workerCpus.count()], &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#elif NV_OS_UNIX || NV_OS_DARWIN
+    if (s_workerPriority != ThreadPriority_Normal) {
+        sched_param param;
+        int policy;
+        if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+            const int lowest = sched_get_priority_min(policy);
+            param.sched_priority = (s_workerPriority == ThreadPriority_Lowest) ? lowest : (param.sched_priority + lowest) / 2;
+            pthread_setschedparam(pthread_self(), policy, &param);
+        }
+    }
+#endif
+}
+
+// The identifier that the OS shows in debuggers and profilers.
+uint nv::currentThreadId() {
+#if NV_OS_WIN32
+    return GetCurrentThreadId();
+#elif NV_OS_LINUX
+    return (uint)syscall(SYS_gettid);
+#elif NV_OS_DARWIN
+    uint64_t tid;
+    pthread_threadid_np(NULL, &tid);
+    return (uint)tid;
+#else
+    return (uint)(uintptr_t)pthread_self();
+#endif
+}
+
@@ -71,20 +71,42 @@ inline void sync_synchronize() { asm volatile( "dmb;"); }
 // @@ Atomics.
 
 
-/* Wrap this up:
-#define YieldProcessor() __asm { rep nop }
-#define YieldProcessor _mm_pause
-#define YieldProcessor __yield
-
-BOOL WINAPI SwitchToThread(void);
-*/
+// Hint to the processor that we are in a spin loop, so that it saves power and frees resources for the other hyperthread.
+#if NV_CC_MSVC && (NV_CPU_X86 || NV_CPU_X86_64)
+#define nvYieldProcessor()  _mm_pause()
+#elif (NV_CC_GNUC || NV_CC_CLANG) && (NV_CPU_X86 || NV_CPU_X86_64)
+#define nvYieldProcessor()  __builtin_ia32_pause()
+#elif (NV_CC_GNUC || NV_CC_CLANG) && NV_CPU_ARM
+#define nvYieldProcessor()  asm volatile("yield")
+#else
+#define nvYieldProcessor()  nvCompilerReadWriteBarrier()
+#endif
 
 
 namespace nv
 {
-    // Reentrant.
+    enum ThreadPriority
+    {
+        ThreadPriority_Normal,
+        ThreadPriority_BelowNormal,
+        ThreadPriority_Lowest,
+    };
+
+    // Reentrant. Hardware threads this process can use: the online cores, restricted to the affinity of the process and, on
+    // Linux, to the CPU quota of its cgroup, so that the workers don't oversubscribe the share of a container.
     uint hardwareThreadCount();
 
+    // Not thread-safe. Priority and CPUs of the worker threads started from now on. Worker i of a pool or scheduler runs on
+    // cpus[i % cpuCount], or on any CPU when cpuCount is 0, the default. Affinity is not supported on OSX.
+    void setWorkerPriority(ThreadPriority priority);
+    void setWorkerAffinity(const uint * cpus, uint cpuCount);
+
+    // Reentrant. Called by each worker thread when it starts, applies the settings above.
+    void initWorkerThread(uint index);
+
+    // Reentrant.
+    uint currentThreadId();
+
     // Not thread-safe. Use from main thread only.
     void initWorkers();
     void shutWorkers();
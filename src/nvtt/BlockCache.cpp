@@ -0,0 +1,66 @@
+#include "BlockCache.h"
+
+#include "nvthread/ConcurrentHashMap.h"
+
+#include "nvcore/Hash.h"
+#include "nvcore/Debug.h"
+
+#include <string.h> // memcpy, memcmp
+
+using namespace nv;
+
+
+void BlockCacheKey::init(const float * data, uint w, uint h, uint x, uint y, const uint32 settings[SettingsCount])
+{
+    nvDebugCheck(x + 4 <= w && y + 4 <= h);
+
+    const uint srcPlane = w * h;
+
+    for (uint c = 0; c < 4; c++) {
+        for (uint i = 0; i < 4; i++) {
+            memcpy(words + c * 16 + i * 4, data + c * srcPlane + (y + i) * w + x, 4 * sizeof(float));
+        }
+    }
+
+    memcpy(words + 4*16, settings, SettingsCount * sizeof(uint32));
+
+    hash = sdbmHash(words, sizeof(words));
+}
+
+bool BlockCacheKey::operator==(const BlockCacheKey & other) const
+{
+    return hash == other.hash && memcmp(words, other.words, sizeof(words)) == 0;
+}
+
+
+BlockCache::BlockCache()
+{
+    m_map = new ConcurrentHashMap<BlockCacheKey, Block>(Capacity);
+}
+
+BlockCache::~BlockCache()
+{
+    delete m_map;
+}
+
+bool BlockCache::lookup(const BlockCacheKey & key, void * output, uint size)
+{
+    nvDebugCheck(size <= MaxBlockSize);
+
+    Block block;
+    if (!m_map->lookup(key.hash, key, &block)) return false;
+
+    memcpy(output, block.data, size);
+    return true;
+}
+
+void BlockCache::insert(const BlockCacheKey & key, const void * output, uint size)
+{
+    nvDebugCheck(size <= MaxBlockSize);
+
+    Block block;
+    memcpy(block.data, output, size);
+
+    // Losing the race against another writer only means this block is not cached.
+    m_map->insert(key.hash, key, block);
+}
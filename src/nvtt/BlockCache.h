@@ -0,0 +1,52 @@
+#pragma once
+#ifndef NVTT_BLOCKCACHE_H
+#define NVTT_BLOCKCACHE_H
+
+#include "nvcore/nvcore.h"
+
+namespace nv
+{
+    template <typename K, typename V> class ConcurrentHashMap;
+
+    // Texels of a complete 4x4 block and the settings it's compressed with.
+    struct BlockCacheKey
+    {
+        enum { SettingsCount = 15 };
+
+        void init(const float * data, uint w, uint h, uint x, uint y, const uint32 settings[SettingsCount]);
+        bool operator==(const BlockCacheKey & other) const;
+
+        uint32 words[4*16 + SettingsCount];     // Bit patterns of the planar float texels, followed by the settings.
+        uint32 hash;
+    };
+
+    // Compressed output of previously seen blocks. Bounded in size and safe to use from several threads at once.
+    class BlockCache
+    {
+        NV_FORBID_COPY(BlockCache);
+    public:
+        BlockCache();
+        ~BlockCache();
+
+        // Copy the compressed block to output and return true if an identical block was compressed before.
+        bool lookup(const BlockCacheKey & key, void * output, uint size);
+        void insert(const BlockCacheKey & key, const void * output, uint size);
+
+    private:
+        enum {
+            Capacity = 16384,
+            MaxBlockSize = 16
+        };
+
+        struct Block
+        {
+            uint8 data[MaxBlockSize];
+        };
+
+        ConcurrentHashMap<BlockCacheKey, Block> * m_map;
+    };
+
+} // nv namespace
+
+
+#endif // NVTT_BLOCKCACHE_H
@@ -23,19 +23,33 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include "BlockCompressor.h"
+#include "BlockCache.h"
+#include "RateDistortion.h"
+#include "BlockError.h"
+#include "CompressionOptions.h"
 #include "OutputOptions.h"
 #include "TaskDispatcher.h"
+#include "Profiler.h"
+#include "Progress.h"
 
 #include "nvimage/Image.h"
 #include "nvimage/ColorBlock.h"
 #include "nvimage/BlockDXT.h"
+#include "nvimage/MemoryPool.h"
 
 #include "nvmath/Vector.inl"
 
 #include "nvcore/Memory.h"
+#include "nvcore/Ptr.h"
+
+#include "nvthread/Atomic.h"
 
 #include <new> // placement new
 
+#if NV_USE_SSE
+#include <xmmintrin.h>
+#endif
+
 
 using namespace nv;
 using namespace nvtt;
@@ -84,7 +98,7 @@ void ColorBlockCompressor::compress(nvtt::AlphaMode alphaMode, uint w, uint h, c
     else
     {
         const uint size = bs * bw * bh;
-        uint8 * mem = new uint8[size];
+        uint8 * mem = poolAllocate<uint8>(size);
 
         #pragma omp parallel
         {
@@ -106,14 +120,183 @@ void ColorBlockCompressor::compress(nvtt::AlphaMode alphaMode, uint w, uint h, c
 	    outputOptions.outputHandler->writeData(mem, size);
 	}
 
-        delete [] mem;
+        poolFree(mem);
     }
 #endif
 }
 */
 
 
-struct ColorBlockCompressorContext
+static inline bool sameTexel(const float * r, const float * g, const float * b, const float * a, uint idx, const Vector4 & c)
+{
+    return r[idx] == c.x && g[idx] == c.y && b[idx] == c.z && a[idx] == c.w;
+}
+
+BlockClass nv::classifyBlock(const float * data, uint w, uint h, uint x, uint y, Vector4 * color)
+{
+    const uint bw = min(w - x, 4U);
+    const uint bh = min(h - y, 4U);
+    nvDebugCheck(bw != 0 && bh != 0);
+
+    const uint srcPlane = w * h;
+    const float * r = data + y * w + x;
+    const float * g = r + srcPlane;
+    const float * b = g + srcPlane;
+    const float * a = b + srcPlane;
+
+    const Vector4 c0(r[0], g[0], b[0], a[0]);
+    *color = c0;
+
+#if NV_USE_SSE
+    if (bw == 4 && bh == 4)
+    {
+        // Build 16 bit masks of the texels equal to the first texel and of the transparent texels, one row at a time.
+        const __m128 r0 = _mm_set1_ps(c0.x), g0 = _mm_set1_ps(c0.y), b0 = _mm_set1_ps(c0.z), a0 = _mm_set1_ps(c0.w);
+        const __m128 zero = _mm_setzero_ps();
+
+        uint equal0 = 0, transparent = 0;
+        for (uint i = 0; i < 4; i++)
+        {
+            const uint row = i * w;
+            const __m128 ra = _mm_loadu_ps(a + row);
+            __m128 eq = _mm_and_ps(_mm_and_ps(_mm_cmpeq_ps(_mm_loadu_ps(r + row), r0), _mm_cmpeq_ps(_mm_loadu_ps(g + row), g0)),
+                                   _mm_and_ps(_mm_cmpeq_ps(_mm_loadu_ps(b + row), b0), _mm_cmpeq_ps(ra, a0)));
+            equal0 |= _mm_movemask_ps(eq) << (4 * i);
+            transparent |= _mm_movemask_ps(_mm_cmpeq_ps(ra, zero)) << (4 * i);
+        }
+
+        if (equal0 == 0xFFFF) return BlockClass_Constant;
+        if (transparent == 0xFFFF) return BlockClass_Transparent;
+
+        // Compare the remaining texels against the first texel that differs from c0.
+        uint k = 0;
+        while (equal0 & (1 << k)) k++;
+        const uint idx1 = (k / 4) * w + (k % 4);
+
+        const __m128 r1 = _mm_set1_ps(r[idx1]), g1 = _mm_set1_ps(g[idx1]), b1 = _mm_set1_ps(b[idx1]), a1 = _mm_set1_ps(a[idx1]);
+
+        uint equal1 = 0;
+        for (uint i = 0; i < 4; i++)
+        {
+            const uint row = i * w;
+            __m128 eq = _mm_and_ps(_mm_and_ps(_mm_cmpeq_ps(_mm_loadu_ps(r + row), r1), _mm_cmpeq_ps(_mm_loadu_ps(g + row), g1)),
+                                   _mm_and_ps(_mm_cmpeq_ps(_mm_loadu_ps(b + row), b1), _mm_cmpeq_ps(_mm_loadu_ps(a + row), a1)));
+            equal1 |= _mm_movemask_ps(eq) << (4 * i);
+        }
+
+        return (equal0 | equal1) == 0xFFFF ? BlockClass_TwoColor : BlockClass_General;
+    }
+#endif
+
+    // Blocks on the edges only look at the texels inside the image, the compressors repeat them to fill the block.
+    bool constant = true;
+    bool transparent = true;
+    bool twoColor = true;
+    bool hasSecond = false;
+    Vector4 c1;
+
+    for (uint i = 0; i < bh; i++)
+    {
+        for (uint e = 0; e < bw; e++)
+        {
+            const uint idx = i * w + e;
+
+            if (a[idx] != 0.0f) transparent = false;
+            if (sameTexel(r, g, b, a, idx, c0)) continue;
+
+            constant = false;
+            if (!hasSecond) {
+                c1 = Vector4(r[idx], g[idx], b[idx], a[idx]);
+                hasSecond = true;
+            }
+            else if (!sameTexel(r, g, b, a, idx, c1)) {
+                twoColor = false;
+            }
+        }
+    }
+
+    if (constant) return BlockClass_Constant;
+    if (transparent) return BlockClass_Transparent;
+    if (twoColor) return BlockClass_TwoColor;
+    return BlockClass_General;
+}
+
+// Add the block counts of a level to the user's statistics.
+static void addBlockStatistics(nvtt::BlockStatistics * statistics, const uint32 classCount[BlockClass_Count], uint32 cacheLookups, uint32 cacheHits, uint32 reusedBlocks)
+{
+    if (statistics == NULL) return;
+
+    // Levels of different faces may be compressed concurrently.
+    atomicAdd((uint32 *)&statistics->constantBlocks, classCount[BlockClass_Constant]);
+    atomicAdd((uint32 *)&statistics->transparentBlocks, classCount[BlockClass_Transparent]);
+    atomicAdd((uint32 *)&statistics->twoColorBlocks, classCount[BlockClass_TwoColor]);
+    atomicAdd((uint32 *)&statistics->generalBlocks, classCount[BlockClass_General]);
+    atomicAdd((uint32 *)&statistics->cacheLookups, cacheLookups);
+    atomicAdd((uint32 *)&statistics->cacheHits, cacheHits);
+    atomicAdd((uint32 *)&statistics->reusedBlocks, reusedBlocks);
+}
+
+
+// Settings besides the texels that determine the output of a block.
+static void blockCacheSettings(nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, uint blockSize, uint32 settings[BlockCacheKey::SettingsCount])
+{
+    union { float f; uint32 u; } colorWeight[4] = { { compressionOptions.colorWeight.x }, { compressionOptions.colorWeight.y }, { compressionOptions.colorWeight.z }, { compressionOptions.colorWeight.w } };
+    union { float f; uint32 u; } effort = { compressionOptions.effortLevel() };
+    union { float f; uint32 u; } errorThreshold = { compressionOptions.errorThreshold };
+    union { float f; uint32 u; } rgbmRange = { compressionOptions.rgbmRange };
+    union { float f; uint32 u; } rgbmThreshold = { compressionOptions.rgbmThreshold };
+
+    settings[0] = compressionOptions.format;
+    settings[1] = compressionOptions.quality;
+    settings[2] = colorWeight[0].u;
+    settings[3] = colorWeight[1].u;
+    settings[4] = colorWeight[2].u;
+    settings[5] = colorWeight[3].u;
+    settings[6] = compressionOptions.pixelType | (compressionOptions.decoder << 8);
+    settings[7] = alphaMode | (blockSize << 8);
+    settings[8] = effort.u;
+    settings[9] = compressionOptions.externalCompressor.isNull() ? 0 : compressionOptions.externalCompressor.hash();
+    settings[10] = errorThreshold.u;
+    settings[11] = compressionOptions.bc7ModeMask;
+    settings[12] = rgbmRange.u;
+    settings[13] = rgbmThreshold.u;
+    settings[14] = compressionOptions.normalTransform;
+}
+
+static inline void initBlock(ColorBlock & block, const float * data, uint w, uint h, uint x, uint y)
+{
+    block.init(w, h, data, x, y);
+}
+
+static inline void initBlock(ColorSet & set, const float * data, uint w, uint h, uint x, uint y)
+{
+    set.setColors(data, w, h, x, y);
+}
+
+static inline void initBlock(TexelBlock & block, const float * data, uint w, uint h, uint x, uint y)
+{
+    block.init(data, w, h, x, y);
+}
+
+// Test whether the texels of the block at (x, y) are bitwise identical in both images.
+static bool sameBlock(const float * data, const float * previousData, uint w, uint h, uint x, uint y)
+{
+    const uint bw = min(4U, w - x);
+    const uint bh = min(4U, h - y);
+
+    for (uint c = 0; c < 4; c++) {
+        for (uint j = 0; j < bh; j++) {
+            const uint offset = c * w * h + (y + j) * w + x;
+            if (memcmp(data + offset, previousData + offset, bw * sizeof(float)) != 0) return false;
+        }
+    }
+
+    return true;
+}
+
+
+template <typename Compressor, typename Block>
+struct BlockCompressorContext
 {
     nvtt::AlphaMode alphaMode;
     uint w, h;
@@ -121,44 +304,177 @@ struct ColorBlockCompressorContext
     const nvtt::CompressionOptions::Private * compressionOptions;
 
     uint bw, bh, bs;
+    uint firstBlock;    // Index of the block stored at the start of mem.
     uint8 * mem;
-    ColorBlockCompressor * compressor;
+    Compressor * compressor;
+
+    BlockCache * cache;
+    uint32 cacheSettings[BlockCacheKey::SettingsCount];
+
+    // Previous version of the level, for incremental compression.
+    const float * previousData;
+    const uint8 * previousBlocks;
+
+    Progress * progress;
+
+    uint32 classCount[BlockClass_Count];
+    uint32 cacheLookups;
+    uint32 cacheHits;
+    uint32 reusedBlocks;
+
+    // Compress the blocks of a batch, starting at block first, and remember their output in the cache.
+    void compressBatch(Block * blocks, uint count, BlockScratch * scratch, int first, const BlockCacheKey * keys, const bool * cacheable)
+    {
+        if (count == 0) return;
+
+        uint8 * ptr = mem + first * bs;
+        compressor->compressBlocks(blocks, count, scratch, alphaMode, *compressionOptions, ptr);
+
+        for (uint j = 0; j < count; j++) {
+            if (cacheable[j]) cache->insert(keys[j], ptr + j * bs, bs);
+        }
+    }
 };
 
-// Each task compresses one block.
-void ColorBlockCompressorTask(void * data, int i)
+// Each task compresses a contiguous run of blocks, handing them to the compressor in small batches.
+template <typename Compressor, typename Block>
+void BlockCompressorTask(void * data, int begin, int end)
 {
-    ColorBlockCompressorContext * d = (ColorBlockCompressorContext *) data;
+    BlockCompressorContext<Compressor, Block> * d = (BlockCompressorContext<Compressor, Block> *) data;
+
+    NVTT_PROFILE("compress blocks", end - begin);
+
+    Block blocks[MaxBlockBatch];
+    BlockCacheKey keys[MaxBlockBatch];
+    bool cacheable[MaxBlockBatch];
+
+    AutoPtr<BlockScratch> scratch(d->compressor->createScratch(d->alphaMode, *d->compressionOptions));
 
-    uint x = i % d->bw;
-    uint y = i / d->bw;
+    uint32 classCount[BlockClass_Count] = { 0 };
+    uint32 cacheLookups = 0;
+    uint32 cacheHits = 0;
+    uint32 reusedBlocks = 0;
 
-    //for (uint x = 0; x < d->bw; x++)
+    int first = begin;  // First block of the batch.
+    uint count = 0;
+
+    for (int i = begin; i < end; i++)
     {
-        ColorBlock rgba;
-        rgba.init(d->w, d->h, d->data, 4*x, 4*y);
+        // Report the progress once per batch and stop at the next block once the job is cancelled. The blocks of the
+        // batch that are not compressed yet don't matter then.
+        if (d->progress != NULL) {
+            if ((i - begin) % MaxBlockBatch == 0 && i != begin) d->progress->add(MaxBlockBatch);
+            if (d->progress->isCancelled()) return;
+        }
+
+        uint x = (d->firstBlock + i) % d->bw;
+        uint y = (d->firstBlock + i) / d->bw;
+        uint8 * ptr = d->mem + i * d->bs;
+
+        Vector4 color;
+        BlockClass blockClass = classifyBlock(d->data, d->w, d->h, 4*x, 4*y, &color);
+        classCount[blockClass]++;
+
+        // The color of transparent texels does not matter.
+        if (blockClass == BlockClass_Transparent && d->alphaMode == nvtt::AlphaMode_Transparency) {
+            blockClass = BlockClass_Constant;
+            color = Vector4(0.0f);
+        }
+
+        bool done = false;
+
+        // Blocks that didn't change since the previous output are copied from it.
+        if (d->previousData != NULL && sameBlock(d->data, d->previousData, d->w, d->h, 4*x, 4*y))
+        {
+            memcpy(ptr, d->previousBlocks + (d->firstBlock + i) * d->bs, d->bs);
+            reusedBlocks++;
+            done = true;
+        }
+
+        // Constant blocks skip the batch when the compressor has a direct encoding for them.
+        if (!done && blockClass == BlockClass_Constant) {
+            done = d->compressor->compressConstantBlock(color, d->alphaMode, *d->compressionOptions, ptr);
+        }
+
+        // Otherwise reuse the output of an identical block, if there's one. Only complete blocks are cached.
+        cacheable[count] = false;
+        if (!done && d->cache != NULL && 4*x + 4 <= d->w && 4*y + 4 <= d->h)
+        {
+            keys[count].init(d->data, d->w, d->h, 4*x, 4*y, d->cacheSettings);
+            cacheLookups++;
+
+            if (d->cache->lookup(keys[count], ptr, d->bs)) {
+                cacheHits++;
+                done = true;
+            }
+            else {
+                cacheable[count] = true;
+            }
+        }
+
+        if (done)
+        {
+            d->compressBatch(blocks, count, scratch.ptr(), first, keys, cacheable);
+            first = i + 1;
+            count = 0;
+            continue;
+        }
+
+        initBlock(blocks[count], d->data, d->w, d->h, 4*x, 4*y);
+        count++;
+
+        if (count == MaxBlockBatch)
+        {
+            d->compressBatch(blocks, count, scratch.ptr(), first, keys, cacheable);
+            first = i + 1;
+            count = 0;
+        }
+    }
 
-        uint8 * ptr = d->mem + (y * d->bw + x) * d->bs;
-        d->compressor->compressBlock(rgba, d->alphaMode, *d->compressionOptions, ptr);
+    d->compressBatch(blocks, count, scratch.ptr(), first, keys, cacheable);
+
+    if (d->progress != NULL) {
+        d->progress->add((end - begin - 1) % MaxBlockBatch + 1);
     }
+
+    for (uint c = 0; c < BlockClass_Count; c++) {
+        atomicAdd(&d->classCount[c], classCount[c]);
+    }
+    atomicAdd(&d->cacheLookups, cacheLookups);
+    atomicAdd(&d->cacheHits, cacheHits);
+    atomicAdd(&d->reusedBlocks, reusedBlocks);
 }
 
-void ColorBlockCompressor::compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const float * data, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions)
+template <typename Compressor, typename Block>
+static void compressLevel(Compressor * compressor, nvtt::AlphaMode alphaMode, uint w, uint h, const float * data, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions)
 {
-    nvDebugCheck(d == 1);
-
-    ColorBlockCompressorContext context;
+    BlockCompressorContext<Compressor, Block> context;
     context.alphaMode = alphaMode;
     context.w = w;
     context.h = h;
     context.data = data;
     context.compressionOptions = &compressionOptions;
 
-    context.bs = blockSize();
+    context.bs = compressor->blockSize();
     context.bw = (w + 3) / 4;
     context.bh = (h + 3) / 4;
 
-    context.compressor = this;
+    context.compressor = compressor;
+
+    context.cache = outputOptions.blockCache;
+    blockCacheSettings(alphaMode, compressionOptions, context.bs, context.cacheSettings);
+
+    context.previousData = outputOptions.previousData;
+    context.previousBlocks = outputOptions.previousBlocks;
+
+    context.progress = outputOptions.progress;
+
+    for (uint c = 0; c < BlockClass_Count; c++) {
+        context.classCount[c] = 0;
+    }
+    context.cacheLookups = 0;
+    context.cacheHits = 0;
+    context.reusedBlocks = 0;
 
     SequentialTaskDispatcher sequential;
 
@@ -169,83 +485,198 @@ void ColorBlockCompressor::compress(nvtt::AlphaMode alphaMode, uint w, uint h, u
     dispatcher = &sequential;
 #endif
 
-    const uint count = context.bw * context.bh;
-    const uint size = context.bs * count;
-    context.mem = new uint8[size];
+    // Compress the level in windows of block rows and write each window as soon as it's done.
+    const uint windowRows = outputOptions.streamingWindow > 0 ? min(uint(outputOptions.streamingWindow), context.bh) : context.bh;
+    const uint rowSize = context.bs * context.bw;
+    context.mem = poolAllocate<uint8>(rowSize * windowRows);
+
+    // The errors are measured on the final blocks of each window, after all the passes.
+    const bool measureErrors = (outputOptions.blockErrors != NULL || outputOptions.imageErrorHandler != NULL) && canMeasureBlockErrors(compressionOptions);
+    double squaredError = 0.0;
+
+    for (uint y = 0; y < context.bh; y += windowRows)
+    {
+        const uint rows = min(windowRows, context.bh - y);
+        context.firstBlock = y * context.bw;
+
+        // One row of blocks per task keeps the memory accesses of each worker contiguous.
+        dispatcher->dispatchRange(BlockCompressorTask<Compressor, Block>, &context, rows * context.bw, context.bw);
 
-    dispatcher->dispatch(ColorBlockCompressorTask, &context, count);
+        if (outputOptions.isCancelled()) {
+            break;
+        }
+
+        if (hasRateDistortionPass(compressionOptions)) {
+            NVTT_PROFILE("rate distortion", rows * context.bw);
+            optimizeRateDistortion(data, w, h, y, rows, context.mem, dispatcher, compressionOptions);
+        }
 
-    outputOptions.writeData(context.mem, size);
+        if (measureErrors) {
+            measureBlockErrors(data, w, h, y, rows, context.mem, alphaMode, dispatcher, compressionOptions, outputOptions, &squaredError);
+        }
+
+        outputOptions.writeData(context.mem, rowSize * rows);
+    }
 
-    delete [] context.mem;
+    poolFree(context.mem);
+
+    if (measureErrors && !outputOptions.isCancelled()) {
+        reportImageError(w, h, squaredError, compressionOptions, outputOptions);
+    }
+
+    addBlockStatistics(outputOptions.blockStatistics, context.classCount, context.cacheLookups, context.cacheHits, context.reusedBlocks);
+}
+
+
+void ColorBlockCompressor::compressBlocks(ColorBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+    uint8 * ptr = (uint8 *)output;
+
+    for (uint i = 0; i < count; i++)
+    {
+        compressBlock(blocks[i], alphaMode, compressionOptions, ptr + i * blockSize());
+    }
+}
+
+void ColorBlockCompressor::compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const float * data, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions)
+{
+    nvDebugCheck(d == 1);
+
+    compressLevel<ColorBlockCompressor, ColorBlock>(this, alphaMode, w, h, data, dispatcher, compressionOptions, outputOptions);
 }
 
 
-struct ColorSetCompressorContext
+struct ImageCompressorContext
 {
+    ColorBlockCompressor * compressor;
     nvtt::AlphaMode alphaMode;
-    uint w, h;
-    const float * data;
+    const Image * image;
     const nvtt::CompressionOptions::Private * compressionOptions;
 
-    uint bw, bh, bs;
+    uint bw, bs;
+    uint firstBlock;    // Index of the block stored at the start of mem.
     uint8 * mem;
-    ColorSetCompressor * compressor;
-};
 
+    Progress * progress;
+};
 
-// Each task compresses one block.
-void ColorSetCompressorTask(void * data, int i)
+// Same batches and progress reports as BlockCompressorTask, with the blocks gathered straight from the 8 bit texels.
+static void ImageCompressorTask(void * data, int begin, int end)
 {
-    ColorSetCompressorContext * d = (ColorSetCompressorContext *) data;
+    ImageCompressorContext * d = (ImageCompressorContext *) data;
+
+    NVTT_PROFILE("compress blocks", end - begin);
 
-    uint x = i % d->bw;
-    uint y = i / d->bw;
+    ColorBlock blocks[MaxBlockBatch];
+    AutoPtr<BlockScratch> scratch(d->compressor->createScratch(d->alphaMode, *d->compressionOptions));
 
-    //for (uint x = 0; x < d->bw; x++)
+    for (int i = begin; i < end; i += MaxBlockBatch)
     {
-        ColorSet set;
-        set.setColors(d->data, d->w, d->h, x * 4, y * 4);
+        if (d->progress != NULL && d->progress->isCancelled()) return;
+
+        const uint count = min(uint(end - i), MaxBlockBatch);
+        for (uint j = 0; j < count; j++)
+        {
+            const uint x = (d->firstBlock + i + j) % d->bw;
+            const uint y = (d->firstBlock + i + j) / d->bw;
+            blocks[j].init(d->image, 4*x, 4*y);
+        }
 
-        uint8 * ptr = d->mem + (y * d->bw + x) * d->bs;
-        d->compressor->compressBlock(set, d->alphaMode, *d->compressionOptions, ptr);
+        d->compressor->compressBlocks(blocks, count, scratch.ptr(), d->alphaMode, *d->compressionOptions, d->mem + i * d->bs);
+
+        if (d->progress != NULL) d->progress->add(count);
     }
 }
 
-
-void ColorSetCompressor::compress(AlphaMode alphaMode, uint w, uint h, uint d, const float * data, nvtt::TaskDispatcher * dispatcher, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions)
+void ColorBlockCompressor::compress(nvtt::AlphaMode alphaMode, const Image * image, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions)
 {
-    nvDebugCheck(d == 1);
+    nvDebugCheck(image->depth() == 1);
+    nvDebugCheck(outputOptions.blockCache == NULL && outputOptions.previousData == NULL);
 
-    ColorSetCompressorContext context;
+    ImageCompressorContext context;
+    context.compressor = this;
     context.alphaMode = alphaMode;
-    context.w = w;
-    context.h = h;
-    context.data = data;
+    context.image = image;
     context.compressionOptions = &compressionOptions;
-
+    context.bw = (image->width() + 3) / 4;
     context.bs = blockSize();
-    context.bw = (w + 3) / 4;
-    context.bh = (h + 3) / 4;
+    context.progress = outputOptions.progress;
 
-    context.compressor = this;
+    const uint bh = (image->height() + 3) / 4;
 
     SequentialTaskDispatcher sequential;
 
     // Use a single thread to compress small textures.
-    if (context.bh < 4) dispatcher = &sequential;
+    if (bh < 4) dispatcher = &sequential;
 
 #if _DEBUG
     dispatcher = &sequential;
 #endif
 
-    const uint count = context.bw * context.bh;
-    const uint size = context.bs * count;
-    context.mem = new uint8[size];
+    // Compress the level in windows of block rows and write each window as soon as it's done.
+    const uint windowRows = outputOptions.streamingWindow > 0 ? min(uint(outputOptions.streamingWindow), bh) : bh;
+    const uint rowSize = context.bs * context.bw;
+    context.mem = poolAllocate<uint8>(rowSize * windowRows);
+
+    for (uint y = 0; y < bh; y += windowRows)
+    {
+        const uint rows = min(windowRows, bh - y);
+        context.firstBlock = y * context.bw;
+
+        dispatcher->dispatchRange(ImageCompressorTask, &context, rows * context.bw, context.bw);
+
+        if (outputOptions.isCancelled()) {
+            break;
+        }
+
+        outputOptions.writeData(context.mem, rowSize * rows);
+    }
+
+    poolFree(context.mem);
+}
 
-    dispatcher->dispatch(ColorSetCompressorTask, &context, count);
 
-    outputOptions.writeData(context.mem, size);
+void ColorSetCompressor::compressBlocks(ColorSet * sets, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+    uint8 * ptr = (uint8 *)output;
+
+    for (uint i = 0; i < count; i++)
+    {
+        compressBlock(sets[i], alphaMode, compressionOptions, ptr + i * blockSize());
+    }
+}
+
+
+void ColorSetCompressor::compress(AlphaMode alphaMode, uint w, uint h, uint d, const float * data, nvtt::TaskDispatcher * dispatcher, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions)
+{
+    nvDebugCheck(d == 1);
+
+    compressLevel<ColorSetCompressor, ColorSet>(this, alphaMode, w, h, data, dispatcher, compressionOptions, outputOptions);
+}
+
+
+void TexelBlock::init(const float * data, uint img_w, uint img_h, uint img_x, uint img_y)
+{
+    nvDebugCheck(img_x < img_w && img_y < img_h);
+
+    w = min(4U, img_w - img_x);
+    h = min(4U, img_h - img_y);
+
+    if (w < 4 || h < 4) {
+        memset(rgba, 0, sizeof(rgba));
+    }
+
+    for (uint c = 0; c < 4; c++) {
+        const float * plane = data + c * img_w * img_h;
+        for (uint y = 0; y < h; y++) {
+            memcpy(rgba[c] + 4 * y, plane + (img_y + y) * img_w + img_x, w * sizeof(float));
+        }
+    }
+}
+
+void TexelBlockCompressor::compress(AlphaMode alphaMode, uint w, uint h, uint d, const float * data, nvtt::TaskDispatcher * dispatcher, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions)
+{
+    nvDebugCheck(d == 1);
 
-    delete [] context.mem;
+    compressLevel<TexelBlockCompressor, TexelBlock>(this, alphaMode, w, h, data, dispatcher, compressionOptions, outputOptions);
 }
@@ -32,13 +32,60 @@ namespace nv
 {
     struct ColorSet;
     struct ColorBlock;
+    class Vector4;
+    class Image;
+
+    // Maximum number of blocks passed to compressBlocks at once, enough to fill the widest DXT1 cluster fit kernel.
+    const uint MaxBlockBatch = 16;
+
+    // Block classes, determined before handing the block to the compressor.
+    enum BlockClass
+    {
+        BlockClass_Constant,        // All texels are equal.
+        BlockClass_Transparent,     // All texels are fully transparent.
+        BlockClass_TwoColor,        // The texels have exactly two different values.
+        BlockClass_General,
+        BlockClass_Count
+    };
+
+    // Classify the block at (x, y) of a planar RGBA float image. The color of the first texel is returned in color.
+    BlockClass classifyBlock(const float * data, uint w, uint h, uint x, uint y, Vector4 * color);
+
+    // Working memory of a compressor. Each compression task creates one for its run of blocks and hands it to every
+    // compressBlocks call of the run, so state that only depends on the options is set up once instead of for each block.
+    struct BlockScratch
+    {
+        virtual ~BlockScratch() {}
+    };
 
     struct ColorBlockCompressor : public CompressorInterface
     {
         virtual void compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const float * rgba, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions);
 
+        // Compress the blocks of an 8 bit image as they are. There's no block cache, incremental compression, rate
+        // distortion pass, error measurement or block statistics, the caller only takes this path without them.
+        void compress(nvtt::AlphaMode alphaMode, const Image * image, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions);
+
         virtual void compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output) = 0;
         virtual uint blockSize() const = 0;
+
+        // Compress a run of consecutive blocks. Override it to process several blocks at once, by default it calls compressBlock for each block.
+        virtual void compressBlocks(ColorBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+
+        // Create the scratch passed to compressBlocks, or return NULL when the compressor doesn't need one, that's what the default does.
+        virtual BlockScratch * createScratch(nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions) { return NULL; }
+
+        // Compress a block whose texels all have the given color. Return false to compress it like any other block, that's what the default does.
+        virtual bool compressConstantBlock(const Vector4 & color, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output) { return false; }
+    };
+
+    // The texels of a block copied straight from the planar image, one plane per channel. Texels outside the image are zero.
+    struct TexelBlock
+    {
+        void init(const float * data, uint img_w, uint img_h, uint img_x, uint img_y);
+
+        uint w, h;              // Size of the block inside the image.
+        float rgba[4][16];
     };
 
     struct ColorSetCompressor : public CompressorInterface
@@ -47,6 +94,30 @@ namespace nv
 
         virtual void compressBlock(ColorSet & set, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output) = 0;
         virtual uint blockSize() const = 0;
+
+        // Compress a run of consecutive blocks. Override it to process several blocks at once, by default it calls compressBlock for each set.
+        virtual void compressBlocks(ColorSet * sets, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+
+        // Create the scratch passed to compressBlocks, or return NULL when the compressor doesn't need one, that's what the default does.
+        virtual BlockScratch * createScratch(nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions) { return NULL; }
+
+        // Compress a block whose texels all have the given color. Return false to compress it like any other block, that's what the default does.
+        virtual bool compressConstantBlock(const Vector4 & color, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output) { return false; }
+    };
+
+    // Compressors that convert the texels to their own block representation and don't need the color set analysis.
+    struct TexelBlockCompressor : public CompressorInterface
+    {
+        virtual void compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const float * rgba, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions);
+
+        virtual void compressBlocks(TexelBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output) = 0;
+        virtual uint blockSize() const = 0;
+
+        // Create the scratch passed to compressBlocks, or return NULL when the compressor doesn't need one, that's what the default does.
+        virtual BlockScratch * createScratch(nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions) { return NULL; }
+
+        // Compress a block whose texels all have the given color. Return false to compress it like any other block, that's what the default does.
+        virtual bool compressConstantBlock(const Vector4 & color, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output) { return false; }
     };
 
 } // nv namespace
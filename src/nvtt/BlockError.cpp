@@ -0,0 +1,194 @@
+#include "BlockError.h"
+
+#include "nvimage/BlockDXT.h"
+
+#include "nvcore/Utils.h" // clamp
+
+#include <math.h> // sqrt, log10
+
+using namespace nv;
+using namespace nvtt;
+
+
+namespace
+{
+    struct BlockErrorContext
+    {
+        const float * data;
+        uint w, h;
+        uint y;                 // First block row.
+        uint bw;
+        const uint8 * blocks;
+        uint bs;
+
+        BlockFormat format;
+        BlockDecoder decoder;
+        uint channelMask;       // Bit c set when channel c is measured.
+        bool alphaWeight;       // Weight the color errors by the alpha of the image.
+        bool clampInput;        // The compressors of the LDR formats see the image clamped to [0, 1].
+
+        float * blockErrors;
+        uint blockErrorCount;
+
+        double * rowErrors;
+    };
+
+    bool findBlockFormat(const CompressionOptions::Private & compressionOptions, BlockFormat * format, uint * channelMask, uint * blockSize)
+    {
+        switch (compressionOptions.format)
+        {
+            case Format_BC1:    *format = BlockFormat_BC1; *channelMask = 0x7; *blockSize = 8; return true;
+            case Format_BC1a:   *format = BlockFormat_BC1; *channelMask = 0xF; *blockSize = 8; return true;
+            case Format_BC2:    *format = BlockFormat_BC2; *channelMask = 0xF; *blockSize = 16; return true;
+            case Format_BC3:    *format = BlockFormat_BC3; *channelMask = 0xF; *blockSize = 16; return true;
+            case Format_BC4:    *format = BlockFormat_BC4; *channelMask = 0x1; *blockSize = 8; return true;
+            case Format_BC5:    *format = BlockFormat_BC5; *channelMask = 0x3; *blockSize = 16; return true;
+            case Format_BC7:    *format = BlockFormat_BC7; *channelMask = 0xF; *blockSize = 16; return true;
+            case Format_BC6:
+                // Same choice of signed and unsigned as CompressorBC6.
+                if (compressionOptions.pixelType == PixelType_UnsignedFloat ||
+                    compressionOptions.pixelType == PixelType_UnsignedNorm ||
+                    compressionOptions.pixelType == PixelType_UnsignedInt)
+                {
+                    *format = BlockFormat_BC6;
+                }
+                else
+                {
+                    *format = BlockFormat_BC6S;
+                }
+                *channelMask = 0x7;
+                *blockSize = 16;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void BlockErrorTask(void * context, int row)
+    {
+        const BlockErrorContext * ctx = (const BlockErrorContext *)context;
+
+        const uint by = ctx->y + row;
+        const uint ph = min(4U, ctx->h - 4 * by);
+        const uint count = ctx->w * ph;
+
+        // Decode the row of blocks to four planes of w x ph texels.
+        float * decoded = new float[4 * count];
+        decodeSurface(ctx->format, ctx->decoder, ctx->w, ph, ctx->blocks + row * ctx->bw * ctx->bs, decoded, count);
+
+        const uint planeSize = ctx->w * ctx->h;
+        const float * source = ctx->data + 4 * by * ctx->w;
+
+        double rowError = 0.0;
+
+        for (uint bx = 0; bx < ctx->bw; bx++)
+        {
+            const uint pw = min(4U, ctx->w - 4 * bx);
+
+            float blockError = 0.0f;
+
+            for (uint y = 0; y < ph; y++)
+            {
+                for (uint x = 4 * bx; x < 4 * bx + pw; x++)
+                {
+                    const uint i = y * ctx->w + x;
+
+                    float weight = 1.0f;
+                    if (ctx->alphaWeight) weight = clamp(source[3 * planeSize + i], 0.0f, 1.0f);
+
+                    for (uint c = 0; c < 4; c++)
+                    {
+                        if ((ctx->channelMask & (1 << c)) == 0) continue;
+
+                        float s = source[c * planeSize + i];
+                        if (ctx->clampInput) s = clamp(s, 0.0f, 1.0f);
+
+                        const float d = decoded[c * count + i] - s;
+                        blockError += (c < 3) ? d * d * weight : d * d;
+                    }
+                }
+            }
+
+            const uint b = by * ctx->bw + bx;
+            if (b < ctx->blockErrorCount) {
+                ctx->blockErrors[b] = sqrtf(blockError / (pw * ph));
+            }
+
+            rowError += blockError;
+        }
+
+        ctx->rowErrors[row] = rowError;
+
+        delete [] decoded;
+    }
+
+    uint channelCount(uint mask)
+    {
+        uint count = 0;
+        for (uint c = 0; c < 4; c++) {
+            if (mask & (1 << c)) count++;
+        }
+        return count;
+    }
+
+} // namespace
+
+
+bool nv::canMeasureBlockErrors(const CompressionOptions::Private & compressionOptions)
+{
+    BlockFormat format;
+    uint channelMask, blockSize;
+    return findBlockFormat(compressionOptions, &format, &channelMask, &blockSize);
+}
+
+void nv::measureBlockErrors(const float * data, uint w, uint h, uint y, uint rows, const uint8 * blocks, AlphaMode alphaMode, TaskDispatcher * dispatcher, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, double * squaredError)
+{
+    BlockErrorContext context;
+    context.data = data;
+    context.w = w;
+    context.h = h;
+    context.y = y;
+    context.bw = (w + 3) / 4;
+    context.blocks = blocks;
+
+    if (!findBlockFormat(compressionOptions, &context.format, &context.channelMask, &context.bs)) {
+        nvDebugCheck(false);
+        return;
+    }
+
+    if (compressionOptions.decoder == Decoder_D3D9) context.decoder = BlockDecoder_D3D9;
+    else if (compressionOptions.decoder == Decoder_NV5x) context.decoder = BlockDecoder_NV5x;
+    else context.decoder = BlockDecoder_D3D10;
+
+    context.alphaWeight = (alphaMode == AlphaMode_Transparency);
+    context.clampInput = (compressionOptions.format != Format_BC6);
+
+    context.blockErrors = outputOptions.blockErrors;
+    context.blockErrorCount = outputOptions.blockErrors != NULL ? outputOptions.blockErrorCount : 0;
+
+    // The rows are added in order, so that the total doesn't depend on the number of threads.
+    context.rowErrors = new double[rows];
+
+    dispatcher->dispatch(BlockErrorTask, &context, rows);
+
+    for (uint r = 0; r < rows; r++) {
+        *squaredError += context.rowErrors[r];
+    }
+
+    delete [] context.rowErrors;
+}
+
+void nv::reportImageError(uint w, uint h, double squaredError, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions)
+{
+    BlockFormat format;
+    uint channelMask, blockSize;
+    if (!findBlockFormat(compressionOptions, &format, &channelMask, &blockSize)) return;
+
+    // Same units as the errors measured by the CUDA compressors.
+    const double count = double(w) * double(h);
+    const double mse = squaredError / (count * channelCount(channelMask));
+
+    const float rmse = float(sqrt(squaredError / count));
+    const float psnr = (mse > 0.0) ? float(10.0 * log10(1.0 / mse)) : 999.0f;
+    outputOptions.imageError(rmse, psnr);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#ifndef NVTT_BLOCKERROR_H
+#define NVTT_BLOCKERROR_H
+
+#include "CompressionOptions.h"
+#include "OutputOptions.h"
+
+namespace nv
+{
+    // Whether the error of the output format can be measured, by decoding it: BC1-BC7 without swizzled channels.
+    bool canMeasureBlockErrors(const nvtt::CompressionOptions::Private & compressionOptions);
+
+    // Decode the compressed blocks of rows [y, y + rows) of a w x h planar float image and measure their error against
+    // the image. The RMS error of each block goes to the block error buffer of the output options, when there's one,
+    // and the squared error of the rows is added to squaredError. Block rows are measured in parallel.
+    void measureBlockErrors(const float * data, uint w, uint h, uint y, uint rows, const uint8 * blocks, nvtt::AlphaMode alphaMode, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions, double * squaredError);
+
+    // Report the RMS error and PSNR of a w x h image with the given squared error to the image error handler.
+    void reportImageError(uint w, uint h, double squaredError, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions);
+
+} // nv namespace
+
+
+#endif // NVTT_BLOCKERROR_H
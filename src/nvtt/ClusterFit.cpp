@@ -31,9 +31,83 @@
 #include "nvimage/ColorBlock.h"
 
 #include <float.h> // FLT_MAX
+#include <string.h> // memset
+
+#if NVTT_USE_CLUSTER_FIT_BATCH
+#include "ClusterFitBatch.inl"
+#include "nvcore/CpuInfo.h"
+#endif
 
 using namespace nv;
 
+#if NV_USE_SSE > 1
+// Stable sort of the projections without moving them around: the position of each color is the number of colors that
+// go before it, those with a smaller projection and those with the same projection and a smaller index. The comparisons
+// of each color with 4 others are done at once, and there are no data dependent branches. Projections can't be NaN.
+static void rankColors(const float dps[16], int count, int order[16])
+{
+    __m128 keys[4];
+    __m128i index[4], rank[4];
+    for (int k = 0; k < 4; k++) {
+        keys[k] = _mm_load_ps(dps + 4 * k);
+        index[k] = _mm_setr_epi32(4 * k, 4 * k + 1, 4 * k + 2, 4 * k + 3);
+        rank[k] = _mm_setzero_si128();
+    }
+
+    for (int j = 0; j < count; j++) {
+        const __m128 d = _mm_set1_ps(dps[j]);
+        const __m128i jj = _mm_set1_epi32(j);
+
+        for (int k = 0; k < 4; k++) {
+            const __m128 tie = _mm_and_ps(_mm_cmpeq_ps(d, keys[k]), _mm_castsi128_ps(_mm_cmplt_epi32(jj, index[k])));
+            const __m128 before = _mm_or_ps(_mm_cmplt_ps(d, keys[k]), tie);
+            rank[k] = _mm_sub_epi32(rank[k], _mm_castps_si128(before));    // The mask is -1.
+        }
+    }
+
+    NV_ALIGN_16 int ranks[16];
+    for (int k = 0; k < 4; k++) {
+        _mm_store_si128((__m128i *)(ranks + 4 * k), rank[k]);
+    }
+
+    for (int i = 0; i < count; i++) {
+        order[ranks[i]] = i;
+    }
+}
+#endif
+
+// Sort the colors along the given axis.
+static void sortColors(const Vector3 * colors, int count, const Vector3 & principal, int order[16])
+{
+    // build the list of values
+    NV_ALIGN_16 float dps[16];
+    bool nan = false;
+    for (int i = 0; i < count; ++i)
+    {
+        dps[i] = dot(colors[i], principal);
+        order[i] = i;
+        nan |= isNan(dps[i]);
+    }
+
+#if NV_USE_SSE > 1
+    if (!nan) {
+        for (int i = count; i < 16; i++) dps[i] = 0.0f;
+        rankColors(dps, count, order);
+        return;
+    }
+#endif
+
+    // stable sort
+    for (int i = 0; i < count; ++i)
+    {
+        for (int j = i; j > 0 && dps[j] < dps[j - 1]; --j)
+        {
+            swap(dps[j], dps[j - 1]);
+            swap(order[j], order[j - 1]);
+        }
+    }
+}
+
 ClusterFit::ClusterFit()
 {
 }
@@ -62,24 +136,8 @@ void ClusterFit::setColorSet(const ColorSet * set)
     Vector3 principal = Fit::computePrincipalComponent_PowerMethod(m_count, values, set->weights, metric);
     //Vector3 principal = Fit::computePrincipalComponent_EigenSolver(m_count, values, set->weights, metric);
 
-    // build the list of values
     int order[16];
-    float dps[16];
-    for (uint i = 0; i < m_count; ++i)
-    {
-        dps[i] = dot(values[i], principal);
-        order[i] = i;
-    }
-
-    // stable sort
-    for (uint i = 0; i < m_count; ++i)
-    {
-        for (uint j = i; j > 0 && dps[j] < dps[j - 1]; --j)
-        {
-            swap(dps[j], dps[j - 1]);
-            swap(order[j], order[j - 1]);
-        }
-    }
+    sortColors(values, m_count, principal, order);
 
     // weight all the points
 #if NVTT_USE_SIMD
@@ -126,24 +184,8 @@ void ClusterFit::setColorSet(const Vector3 * colors, const float * weights, int
     Vector3 principal = Fit::computePrincipalComponent_PowerMethod(count, colors, weights, metric);
     //Vector3 principal = Fit::computePrincipalComponent_EigenSolver(count, colors, weights, metric);
 
-    // build the list of values
     int order[16];
-    float dps[16];
-    for (uint i = 0; i < m_count; ++i)
-    {
-        dps[i] = dot(colors[i], principal);
-        order[i] = i;
-    }
-
-    // stable sort
-    for (uint i = 0; i < m_count; ++i)
-    {
-        for (uint j = i; j > 0 && dps[j] < dps[j - 1]; --j)
-        {
-            swap(dps[j], dps[j - 1]);
-            swap(order[j], order[j - 1]);
-        }
-    }
+    sortColors(colors, count, principal, order);
 
     // weight all the points
 #if NVTT_USE_SIMD
@@ -657,3 +699,128 @@ bool ClusterFit::compress4(Vector3 * start, Vector3 * end)
 }
 
 #endif // NVTT_USE_SIMD
+
+
+#if NVTT_USE_CLUSTER_FIT_BATCH
+
+ClusterFitBatch::ClusterFitBatch()
+{
+    uint features = cpuFeatures();
+    NV_UNUSED(features);
+
+    m_compress3 = clusterFitBatchCompress3<SimdVector>;
+    m_compress4 = clusterFitBatchCompress4<SimdVector>;
+    m_laneCount = SimdVector::Width;
+
+#if defined(HAVE_AVX2)
+    if (features & CpuFeature_AVX2) {
+        m_compress3 = clusterFitBatchCompress3_AVX2;
+        m_compress4 = clusterFitBatchCompress4_AVX2;
+        m_laneCount = 8;
+    }
+#endif
+#if defined(HAVE_AVX512)
+    if (features & CpuFeature_AVX512F) {
+        m_compress3 = clusterFitBatchCompress3_AVX512;
+        m_compress4 = clusterFitBatchCompress4_AVX512;
+        m_laneCount = 16;
+    }
+#endif
+}
+
+void ClusterFitBatch::setColorWeights(const Vector4 & w)
+{
+    m_metric = w.xyz();
+    m_lanes.metricSqr[0] = m_metric.x * m_metric.x;
+    m_lanes.metricSqr[1] = m_metric.y * m_metric.y;
+    m_lanes.metricSqr[2] = m_metric.z * m_metric.z;
+}
+
+void ClusterFitBatch::reset()
+{
+    memset(m_lanes.weighted, 0, sizeof(m_lanes.weighted));
+    memset(m_lanes.xsum, 0, sizeof(m_lanes.xsum));
+    for (uint i = 0; i < MaxLaneCount; i++) {
+        m_lanes.count[i] = -1;
+        m_besterror[i] = FLT_MAX;
+    }
+    m_lanes.maxCount = 0;
+}
+
+void ClusterFitBatch::setColorSet(uint lane, const Vector3 * colors, const float * weights, int count)
+{
+    Vector3 principal = Fit::computePrincipalComponent_PowerMethod(count, colors, weights, m_metric);
+    setSortedColorSet(lane, colors, weights, count, principal);
+}
+
+void ClusterFitBatch::setColorSets(uint laneCount, const Vector3 colors[][16], const float weights[][16], const int counts[])
+{
+    nvDebugCheck(laneCount <= m_laneCount);
+
+    float matrices[MaxLaneCount][6];
+    for (uint i = 0; i < laneCount; i++) {
+        Fit::computeCovariance(counts[i], colors[i], weights[i], m_metric, matrices[i]);
+    }
+
+    Vector3 principal[MaxLaneCount];
+    Fit::computePrincipalComponents_PowerMethod(laneCount, matrices[0], principal);
+
+    for (uint i = 0; i < laneCount; i++) {
+        setSortedColorSet(i, colors[i], weights[i], counts[i], principal[i]);
+    }
+}
+
+void ClusterFitBatch::setSortedColorSet(uint lane, const Vector3 * colors, const float * weights, int count, const Vector3 & principal)
+{
+    nvDebugCheck(lane < m_laneCount && count > 0 && count <= 16);
+
+    m_lanes.count[lane] = float(count);
+    m_lanes.maxCount = max(m_lanes.maxCount, count);
+
+    int order[16];
+    sortColors(colors, count, principal, order);
+
+    // weight all the points
+    for (int i = 0; i < count; ++i)
+    {
+        int p = order[i];
+        m_lanes.weighted[0][i][lane] = colors[p].x * weights[p];
+        m_lanes.weighted[1][i][lane] = colors[p].y * weights[p];
+        m_lanes.weighted[2][i][lane] = colors[p].z * weights[p];
+        m_lanes.weighted[3][i][lane] = weights[p];
+
+        for (int c = 0; c < 4; c++) m_lanes.xsum[c][lane] += m_lanes.weighted[c][i][lane];
+    }
+}
+
+// Copy the lanes that improved the best error found so far and return their mask.
+uint ClusterFitBatch::saveBest(const ClusterFitSolution & best, Vector3 start[MaxLaneCount], Vector3 end[MaxLaneCount])
+{
+    uint mask = 0;
+    for (uint i = 0; i < m_laneCount; i++) {
+        if (m_lanes.count[i] > 0 && best.error[i] < m_besterror[i]) {
+            start[i] = Vector3(best.start[0][i], best.start[1][i], best.start[2][i]);
+            end[i] = Vector3(best.end[0][i], best.end[1][i], best.end[2][i]);
+            m_besterror[i] = best.error[i];
+            mask |= 1U << i;
+        }
+    }
+
+    return mask;
+}
+
+uint ClusterFitBatch::compress3(Vector3 start[MaxLaneCount], Vector3 end[MaxLaneCount])
+{
+    ClusterFitSolution best;
+    m_compress3(m_lanes, &best);
+    return saveBest(best, start, end);
+}
+
+uint ClusterFitBatch::compress4(Vector3 start[MaxLaneCount], Vector3 end[MaxLaneCount])
+{
+    ClusterFitSolution best;
+    m_compress4(m_lanes, &best);
+    return saveBest(best, start, end);
+}
+
+#endif // NVTT_USE_CLUSTER_FIT_BATCH
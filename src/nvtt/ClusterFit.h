@@ -34,6 +34,9 @@
 #define NVTT_USE_SIMD (NV_USE_ALTIVEC || NV_USE_SSE)
 //#define NVTT_USE_SIMD 0
 
+// The batched version requires SSE2.
+#define NVTT_USE_CLUSTER_FIT_BATCH (NV_USE_SSE > 1)
+
 namespace nv {
 
     struct ColorSet;
@@ -75,6 +78,67 @@ namespace nv {
     #endif
     };
 
+#if NVTT_USE_CLUSTER_FIT_BATCH
+    // Input of the ClusterFitBatch kernels, one block per lane. Sized for the widest kernel.
+    struct ClusterFitLanes
+    {
+        enum { Count = 16 };
+
+        NV_ALIGN_64 float weighted[4][17][Count];   // component, color, lane. Padded with zeros.
+        NV_ALIGN_64 float xsum[4][Count];           // color | weight
+        NV_ALIGN_64 float count[Count];             // -1 for unused lanes.
+        float metricSqr[3];
+        int maxCount;
+    };
+
+    // Output of the ClusterFitBatch kernels.
+    struct ClusterFitSolution
+    {
+        NV_ALIGN_64 float error[ClusterFitLanes::Count];
+        NV_ALIGN_64 float start[3][ClusterFitLanes::Count];
+        NV_ALIGN_64 float end[3][ClusterFitLanes::Count];
+    };
+
+    // Fits several blocks at once with one block per SIMD lane. Produces the same endpoints as ClusterFit does for each block.
+    // The kernel is selected for the CPU at construction: SSE2 fits 4 blocks, AVX2 8 and AVX-512 16, with identical results.
+    class ClusterFitBatch
+    {
+    public:
+        enum { MaxLaneCount = ClusterFitLanes::Count };
+
+        ClusterFitBatch();
+
+        uint laneCount() const { return m_laneCount; }
+
+        void setColorWeights(const Vector4 & w);
+
+        // Clear all the lanes. Lanes that are not set afterwards are ignored.
+        void reset();
+        void setColorSet(uint lane, const Vector3 * colors, const float * weights, int count);
+
+        // Set the first laneCount lanes, solving for their principal components together.
+        void setColorSets(uint laneCount, const Vector3 colors[][16], const float weights[][16], const int counts[]);
+
+        // Return the mask of the lanes whose solution improved.
+        uint compress3(Vector3 start[MaxLaneCount], Vector3 end[MaxLaneCount]);
+        uint compress4(Vector3 start[MaxLaneCount], Vector3 end[MaxLaneCount]);
+
+    private:
+
+        void setSortedColorSet(uint lane, const Vector3 * colors, const float * weights, int count, const Vector3 & principal);
+        uint saveBest(const ClusterFitSolution & best, Vector3 start[MaxLaneCount], Vector3 end[MaxLaneCount]);
+
+        typedef void Kernel(const ClusterFitLanes & lanes, ClusterFitSolution * best);
+
+        Kernel * m_compress3;
+        Kernel * m_compress4;
+        uint m_laneCount;
+        Vector3 m_metric;
+        ClusterFitLanes m_lanes;
+        float m_besterror[MaxLaneCount];
+    };
+#endif
+
 } // nv namespace
 
 #endif // NVTT_CLUSTERFIT_H
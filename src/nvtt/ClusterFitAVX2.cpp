@@ -0,0 +1,16 @@
+// This code is in the public domain -- castano@gmail.com
+
+// ClusterFitBatch kernels for AVX2, 8 blocks at once. This file is compiled with ${NV_AVX2_FLAGS}.
+
+#include "nvmath/SimdVector_AVX.h"
+#include "ClusterFitBatch.inl"
+
+void nv::clusterFitBatchCompress3_AVX2(const ClusterFitLanes & lanes, ClusterFitSolution * best)
+{
+    clusterFitBatchCompress3<SimdVector8>(lanes, best);
+}
+
+void nv::clusterFitBatchCompress4_AVX2(const ClusterFitLanes & lanes, ClusterFitSolution * best)
+{
+    clusterFitBatchCompress4<SimdVector8>(lanes, best);
+}
@@ -0,0 +1,16 @@
+// This code is in the public domain -- castano@gmail.com
+
+// ClusterFitBatch kernels for AVX-512, 16 blocks at once. This file is compiled with ${NV_AVX512_FLAGS}.
+
+#include "nvmath/SimdVector_AVX.h"
+#include "ClusterFitBatch.inl"
+
+void nv::clusterFitBatchCompress3_AVX512(const ClusterFitLanes & lanes, ClusterFitSolution * best)
+{
+    clusterFitBatchCompress3<SimdVector16>(lanes, best);
+}
+
+void nv::clusterFitBatchCompress4_AVX512(const ClusterFitLanes & lanes, ClusterFitSolution * best)
+{
+    clusterFitBatchCompress4<SimdVector16>(lanes, best);
+}
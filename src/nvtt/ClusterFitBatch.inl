@@ -0,0 +1,201 @@
+// This code is in the public domain -- castano@gmail.com
+
+// Kernels of ClusterFitBatch, written against the SimdVector interface so that the same code is instantiated for every
+// vector width. ClusterFit.cpp instantiates the SSE2 version, ClusterFitAVX2.cpp and ClusterFitAVX512.cpp the wider
+// ones, and those files are compiled for their instruction set. So this code must only call force inlined functions,
+// and templates that live in the anonymous namespace.
+
+#include "ClusterFit.h"
+
+#include <float.h> // FLT_MAX
+
+namespace nv {
+
+    // Entry points of the wider kernels.
+    void clusterFitBatchCompress3_AVX2(const ClusterFitLanes & lanes, ClusterFitSolution * best);
+    void clusterFitBatchCompress4_AVX2(const ClusterFitLanes & lanes, ClusterFitSolution * best);
+    void clusterFitBatchCompress3_AVX512(const ClusterFitLanes & lanes, ClusterFitSolution * best);
+    void clusterFitBatchCompress4_AVX512(const ClusterFitLanes & lanes, ClusterFitSolution * best);
+
+} // nv namespace
+
+namespace {
+
+    using namespace nv;
+
+    // Clamp to [0, 1] and snap to the 565 grid.
+    template <typename Vec>
+    NV_FORCEINLINE Vec snap(const Vec & v, const Vec & grid, const Vec & gridrcp, const Vec & half)
+    {
+        const Vec c = min(Vec(1.0f), max(Vec(0.0f), v));
+        return truncate(grid * c + half) * gridrcp;
+    }
+
+    template <typename Vec>
+    struct Solution
+    {
+        NV_FORCEINLINE Solution() : error(FLT_MAX) {
+            for (int i = 0; i < 3; i++) start[i] = end[i] = Vec(0.0f);
+        }
+
+        // Lane by lane equivalent of the ClusterFit inner loop, evaluates the endpoints for the given cluster sums and keeps them where they win.
+        NV_FORCEINLINE void evaluate(const Vec & valid, const Vec alphax_sum[3], const Vec & alpha2_sum, const Vec betax_sum[3], const Vec & beta2_sum, const Vec & alphabeta_sum, const Vec metricSqr[3], const Vec & half)
+        {
+            static const float gridValues[3] = { 31.0f, 63.0f, 31.0f };
+
+            const Vec factor = reciprocal(alpha2_sum * beta2_sum - alphabeta_sum * alphabeta_sum);
+
+            Vec a[3], b[3];
+            Vec e5[3];
+            for (int i = 0; i < 3; i++) {
+                const Vec grid(gridValues[i]);
+                const Vec gridrcp(1.0f / gridValues[i]);
+
+                a[i] = (alphax_sum[i] * beta2_sum - betax_sum[i] * alphabeta_sum) * factor;
+                b[i] = (betax_sum[i] * alpha2_sum - alphax_sum[i] * alphabeta_sum) * factor;
+
+                a[i] = snap(a[i], grid, gridrcp, half);
+                b[i] = snap(b[i], grid, gridrcp, half);
+
+                // compute the error (we skip the constant xxsum)
+                const Vec e1 = a[i] * a[i] * alpha2_sum + b[i] * b[i] * beta2_sum;
+                const Vec e2 = a[i] * b[i] * alphabeta_sum - a[i] * alphax_sum[i];
+                const Vec e3 = e2 - b[i] * betax_sum[i];
+                const Vec e4 = Vec(2.0f) * e3 + e1;
+
+                // apply the metric to the error term
+                e5[i] = e4 * metricSqr[i];
+            }
+            const Vec e = e5[0] + e5[1] + e5[2];
+
+            // keep the solution if it wins
+            const Vec wins = valid & compareLessThan(e, error);
+            error = select(error, e, wins);
+            for (int i = 0; i < 3; i++) {
+                start[i] = select(start[i], a[i], wins);
+                end[i] = select(end[i], b[i], wins);
+            }
+        }
+
+        NV_FORCEINLINE void store(ClusterFitSolution * best) const
+        {
+            error.store(best->error);
+            for (int i = 0; i < 3; i++) {
+                start[i].store(best->start[i]);
+                end[i].store(best->end[i]);
+            }
+        }
+
+        Vec error;
+        Vec start[3];
+        Vec end[3];
+    };
+
+    template <typename Vec>
+    void clusterFitBatchCompress3(const ClusterFitLanes & lanes, ClusterFitSolution * result)
+    {
+        const int count = lanes.maxCount;
+        const Vec laneCount(lanes.count);
+        const Vec half(0.5f);
+        const Vec quarter(0.25f);
+        const Vec metricSqr[3] = { Vec(lanes.metricSqr[0]), Vec(lanes.metricSqr[1]), Vec(lanes.metricSqr[2]) };
+
+        Vec xsum[4];
+        for (int c = 0; c < 4; c++) xsum[c] = Vec(lanes.xsum[c]);
+
+        Solution<Vec> best;
+
+        Vec x0[4] = { Vec(0.0f), Vec(0.0f), Vec(0.0f), Vec(0.0f) };
+
+        // check all possible clusters for this total order
+        for (int c0 = 0; c0 <= count; c0++)
+        {
+            Vec x1[4] = { Vec(0.0f), Vec(0.0f), Vec(0.0f), Vec(0.0f) };
+
+            for (int c1 = 0; c1 <= count-c0; c1++)
+            {
+                Vec alphax_sum[3], betax_sum[3];
+                for (int c = 0; c < 3; c++) {
+                    const Vec x2 = xsum[c] - x1[c] - x0[c];
+                    alphax_sum[c] = x1[c] * half + x0[c];
+                    betax_sum[c] = x1[c] * half + x2;
+                }
+                const Vec x2w = xsum[3] - x1[3] - x0[3];
+                const Vec alpha2_sum = x1[3] * quarter + x0[3];
+                const Vec beta2_sum = x1[3] * quarter + x2w;
+                const Vec alphabeta_sum = x1[3] * quarter;
+
+                // Lanes where c0+c1 <= count.
+                const Vec valid = compareLessThan(Vec(float(c0+c1-1)), laneCount);
+
+                best.evaluate(valid, alphax_sum, alpha2_sum, betax_sum, beta2_sum, alphabeta_sum, metricSqr, half);
+
+                for (int c = 0; c < 4; c++) x1[c] += Vec(lanes.weighted[c][c0+c1]);
+            }
+
+            for (int c = 0; c < 4; c++) x0[c] += Vec(lanes.weighted[c][c0]);
+        }
+
+        best.store(result);
+    }
+
+    template <typename Vec>
+    void clusterFitBatchCompress4(const ClusterFitLanes & lanes, ClusterFitSolution * result)
+    {
+        const int count = lanes.maxCount;
+        const Vec laneCount(lanes.count);
+        const Vec half(0.5f);
+        const Vec onethird(1.0f/3.0f);
+        const Vec twothirds(2.0f/3.0f);
+        const Vec oneninth(1.0f/9.0f);
+        const Vec fourninths(4.0f/9.0f);
+        const Vec twonineths(2.0f/9.0f);
+        const Vec metricSqr[3] = { Vec(lanes.metricSqr[0]), Vec(lanes.metricSqr[1]), Vec(lanes.metricSqr[2]) };
+
+        Vec xsum[4];
+        for (int c = 0; c < 4; c++) xsum[c] = Vec(lanes.xsum[c]);
+
+        Solution<Vec> best;
+
+        Vec x0[4] = { Vec(0.0f), Vec(0.0f), Vec(0.0f), Vec(0.0f) };
+
+        // check all possible clusters for this total order
+        for (int c0 = 0; c0 <= count; c0++)
+        {
+            Vec x1[4] = { Vec(0.0f), Vec(0.0f), Vec(0.0f), Vec(0.0f) };
+
+            for (int c1 = 0; c1 <= count-c0; c1++)
+            {
+                Vec x2[4] = { Vec(0.0f), Vec(0.0f), Vec(0.0f), Vec(0.0f) };
+
+                for (int c2 = 0; c2 <= count-c0-c1; c2++)
+                {
+                    Vec alphax_sum[3], betax_sum[3];
+                    for (int c = 0; c < 3; c++) {
+                        const Vec x3 = xsum[c] - x2[c] - x1[c] - x0[c];
+                        alphax_sum[c] = x2[c] * onethird + (x1[c] * twothirds + x0[c]);
+                        betax_sum[c] = x2[c] * twothirds + (x1[c] * onethird + x3);
+                    }
+                    const Vec x3w = xsum[3] - x2[3] - x1[3] - x0[3];
+                    const Vec alpha2_sum = x2[3] * oneninth + (x1[3] * fourninths + x0[3]);
+                    const Vec beta2_sum = x2[3] * fourninths + (x1[3] * oneninth + x3w);
+                    const Vec alphabeta_sum = twonineths * (x1[3] + x2[3]);
+
+                    // Lanes where c0+c1+c2 <= count.
+                    const Vec valid = compareLessThan(Vec(float(c0+c1+c2-1)), laneCount);
+
+                    best.evaluate(valid, alphax_sum, alpha2_sum, betax_sum, beta2_sum, alphabeta_sum, metricSqr, half);
+
+                    for (int c = 0; c < 4; c++) x2[c] += Vec(lanes.weighted[c][c0+c1+c2]);
+                }
+
+                for (int c = 0; c < 4; c++) x1[c] += Vec(lanes.weighted[c][c0+c1]);
+            }
+
+            for (int c = 0; c < 4; c++) x0[c] += Vec(lanes.weighted[c][c0]);
+        }
+
+        best.store(result);
+    }
+
+} // namespace
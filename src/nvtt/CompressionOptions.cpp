@@ -49,6 +49,14 @@ void CompressionOptions::reset()
 {
     m.format = Format_DXT1;
     m.quality = Quality_Normal;
+    for (int i = 0; i < 16; i++) m.mipmapQuality[i] = -1;
+    m.effort = -1.0f;
+    m.errorThreshold = 0.0f;
+    m.bc7ModeMask = 0xFF;
+    m.rateDistortionLambda = 0.0f;
+    m.rgbmRange = 1.0f;
+    m.rgbmThreshold = 0.25f;
+    m.normalTransform = NormalTransform_Orthographic;
     m.colorWeight.set(1.0f, 1.0f, 1.0f, 1.0f);
 
     m.bitcount = 32;
@@ -87,6 +95,63 @@ void CompressionOptions::setQuality(Quality quality)
     m.quality = quality;
 }
 
+/// Set the quality of the given mipmap and all the smaller ones, overriding setQuality and the earlier calls for those levels.
+/// The largest levels hold most of the blocks, so they are where a lower quality saves the most time.
+void CompressionOptions::setMipmapQuality(int mipmap, Quality quality)
+{
+    for (int i = max(mipmap, 0); i < 16; i++) m.mipmapQuality[i] = quality;
+}
+
+
+/// Set the search effort of the compressors that can scale it continuously.
+/// An effort of 0 searches the least, 1 the most, and 0.5 matches the default.
+/// Negative values go back to the default.
+void CompressionOptions::setEffort(float effort)
+{
+    m.effort = effort < 0.0f ? -1.0f : nv::min(effort, 1.0f);
+}
+
+/// Set the error at which the BC6 and BC7 compressors stop searching the modes of a block,
+/// as a fraction of the block's variance. Larger thresholds compress faster at lower quality.
+/// A threshold of 0 searches all the modes.
+void CompressionOptions::setErrorThreshold(float threshold)
+{
+    m.errorThreshold = nv::max(threshold, 0.0f);
+}
+
+/// Set the BC7 modes the compressor can use, bit i enables mode i. Fewer modes compress faster.
+/// Mode 6 alone, or modes 1, 3 and 6, usually work well for opaque textures.
+/// A mask without any of the 8 modes enables all of them.
+void CompressionOptions::setBC7ModeMask(unsigned int mask)
+{
+    mask &= 0xFF;
+    m.bc7ModeMask = mask != 0 ? mask : 0xFF;
+}
+
+/// Enable the rate-distortion pass of BC1, BC3, BC4, BC5 and BC7. After compression, blocks take the endpoints or
+/// indices of their left and top neighbors when the squared error that adds, in 8 bit units, is less
+/// than lambda times the bits that saves. That makes the output compress better with a lossless
+/// compressor. Values between 0.5 and 10 are typical, 0 disables the pass.
+void CompressionOptions::setRateDistortionLambda(float lambda)
+{
+    m.rateDistortionLambda = nv::max(lambda, 0.0f);
+}
+
+/// Set the range of the M values of Format_BC3_RGBM, the same values Surface::fromRGBM decodes with.
+/// The colors are clamped to [0, range], and M is stored as (M - threshold) / (range - threshold).
+void CompressionOptions::setRGBMParameters(float range, float threshold)
+{
+    m.rgbmRange = nv::max(range, 1e-3f);
+    m.rgbmThreshold = nv::clamp(threshold, 1e-6f, 0.99f * m.rgbmRange);
+}
+
+/// Set the transform of the normals of Format_BC5_Normal. The compressor measures the angle between the input
+/// normals and the ones that Surface::reconstructNormals produces from the decoded x and y.
+void CompressionOptions::setNormalTransform(NormalTransform xform)
+{
+    m.normalTransform = xform;
+}
+
 
 /// Set the weights of each color channel. 
 /// The choice for these values is subjective. In most cases uniform color weights
@@ -168,6 +233,7 @@ void CompressionOptions::setPitchAlignment(int pitchAlignment)
 
 
 /// Use external compressor.
+/// "fastcluster" is always available and selects squish's fast cluster fit for DXT1 and DXT5.
 void CompressionOptions::setExternalCompressor(const char * name)
 {
     m.externalCompressor = name;
@@ -250,6 +316,8 @@ unsigned int CompressionOptions::d3d9Format() const
             MAKEFOURCC('B', 'C', '7', 'L'),     // Format_BC7
             FOURCC_ATI2,    // Format_BC5_Luma
             FOURCC_DXT5,    // Format_BC3_RGBM
+            FOURCC_DXT5,    // Format_BC3_YCoCg
+            FOURCC_ATI2,    // Format_BC5_Normal
         };
 
         NV_COMPILER_CHECK(NV_ARRAY_SIZE(d3d9_formats) == Format_Count);
@@ -37,6 +37,14 @@ namespace nvtt
         Format format;
 
         Quality quality;
+        int mipmapQuality[16];  // Quality of each level, -1 to use quality. The smaller levels use the last entry.
+        float effort;       // Negative when not set.
+        float errorThreshold;   // Fraction of the block variance at which the BC6 and BC7 mode search stops, 0 to search all modes.
+        uint bc7ModeMask;       // BC7 modes that can be used, bit i for mode i.
+        float rateDistortionLambda; // Bits of output traded per unit of squared error by the rate-distortion pass, 0 to skip it.
+        float rgbmRange;        // Largest M of Format_BC3_RGBM.
+        float rgbmThreshold;    // Smallest M of Format_BC3_RGBM.
+        NormalTransform normalTransform;    // Transform of Format_BC5_Normal.
 
         nv::Vector4 colorWeight;
 
@@ -64,6 +72,18 @@ namespace nvtt
 
         Decoder decoder;
 
+        Quality levelQuality(int mipmap) const
+        {
+            const int q = mipmapQuality[nv::clamp(mipmap, 0, 15)];
+            return q < 0 ? quality : Quality(q);
+        }
+
+        // Search effort in [0, 1], 0.5 unless set explicitly.
+        float effortLevel() const
+        {
+            return effort < 0.0f ? 0.5f : effort;
+        }
+
         uint getBitCount() const
         {
             if (format == Format_RGBA) {
@@ -25,16 +25,22 @@
 #include "CompressorDX10.h"
 #include "QuickCompressDXT.h"
 #include "OptimalCompressDXT.h"
+#include "CompressionOptions.h"
 
 #include "nvtt.h"
 
 #include "nvimage/ColorBlock.h"
 #include "nvimage/BlockDXT.h"
 
+#include "nvmath/Vector.inl"
 #include "nvmath/ftoi.h"
 
 #include <new> // placement new
 
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 using namespace nv;
 using namespace nvtt;
 
@@ -62,6 +68,35 @@ void FastCompressorBC5::compressBlock(ColorBlock & src, nvtt::AlphaMode alphaMod
 }
 
 
+// Search steps of the bounded BC4/BC5 encoder, 16 at the default effort.
+static int boundedIterationCount(const nvtt::CompressionOptions::Private & compressionOptions)
+{
+    return int(32.0f * compressionOptions.effortLevel() + 0.5f);
+}
+
+void CompressorBC4::compressBlock(ColorBlock & src, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+	BlockATI1 * block = new(output) BlockATI1;
+
+    AlphaBlock4x4 tmp;
+    tmp.init(src, 0);  // Copy red to alpha
+	OptimalCompress::compressDXT5A_Bounded(tmp, &block->alpha, boundedIterationCount(compressionOptions));
+}
+
+void CompressorBC5::compressBlock(ColorBlock & src, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+	BlockATI2 * block = new(output) BlockATI2;
+
+    AlphaBlock4x4 tmp;
+
+    tmp.init(src, 0);  // Copy red to alpha
+	OptimalCompress::compressDXT5A_Bounded(tmp, &block->x, boundedIterationCount(compressionOptions));
+	
+    tmp.init(src, 1);  // Copy green to alpha
+	OptimalCompress::compressDXT5A_Bounded(tmp, &block->y, boundedIterationCount(compressionOptions));
+}
+
+
 void ProductionCompressorBC4::compressBlock(ColorBlock & src, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
 {
 	BlockATI1 * block = new(output) BlockATI1;
@@ -91,7 +126,7 @@ void ProductionCompressorBC5_Luma::compressBlock(ColorSet & set, nvtt::AlphaMode
 
     AlphaBlock4x4 tmp;
     tmp.init(set, /*channel=*/0);
-    OptimalCompress::compressDXT5A(tmp, &block->x);
+    OptimalCompress::compressDXT5A_Uniform(tmp, &block->x);
 
     // Decode block->x
     AlphaBlock4x4 decoded;
@@ -115,6 +150,276 @@ void ProductionCompressorBC5_Luma::compressBlock(ColorSet & set, nvtt::AlphaMode
         tmp.alpha[i] = nv::ftoi_round(nv::saturate(residual) * 255.0f);
     }
 
-    OptimalCompress::compressDXT5A(tmp, &block->y);
+    OptimalCompress::compressDXT5A_Uniform(tmp, &block->y);
    
 }
+
+
+// Transform a unit normal like Surface::transformNormals.
+static void transformNormal(Vector3 n, nvtt::NormalTransform xform, float * x, float * y)
+{
+    if (xform == NormalTransform_Stereographic) {
+        const float d = max(1 + n.z, 1e-6f);
+        n.x = n.x / d;
+        n.y = n.y / d;
+    }
+    else if (xform == NormalTransform_Paraboloid || xform == NormalTransform_Quartic) {
+        float a = (n.x * n.x) + (n.y * n.y);
+        if (a > 0.0f) {
+            float b = n.z;
+            float c = -1.0f;
+            float discriminant = b * b - 4.0f * a * c;
+            float t = (-b + sqrtf(discriminant)) / (2.0f * a);
+
+            if (xform == NormalTransform_Quartic) {
+                // Newton's method on f(t) = 1 - zt - (x^2+y^2)t^2 + x^2y^2t^4, see Surface::transformNormals.
+                float d = fabsf(n.z * t - (1 - n.x*n.x*t*t) * (1 - n.y*n.y*t*t));
+                for (int i = 0; i < 32 && d > 0.0001f; i++) {
+                    float ft = 1 - n.z * t - (n.x*n.x + n.y*n.y)*t*t + n.x*n.x*n.y*n.y*t*t*t*t;
+                    float fit = - n.z - 2*(n.x*n.x + n.y*n.y)*t + 4*n.x*n.x*n.y*n.y*t*t*t;
+                    t -= ft / fit;
+                    d = fabsf(n.z * t - (1 - n.x*n.x*t*t) * (1 - n.y*n.y*t*t));
+                }
+            }
+
+            n.x = n.x * t;
+            n.y = n.y * t;
+        }
+    }
+
+    *x = n.x;
+    *y = n.y;
+}
+
+namespace
+{
+    // Unit normals that Surface::reconstructNormals produces for all the pairs of decoded BC5 values. Entry [a][b] is the normal of
+    // x = b and y = a. The transforms are symmetric, so with x and y swapped it's also the normal of x = a and y = b.
+    struct NormalReconstructionTable
+    {
+        float x[256][256];
+        float y[256][256];
+        float z[256][256];
+    };
+}
+
+static NormalReconstructionTable * createNormalReconstructionTable(nvtt::NormalTransform xform)
+{
+    NormalReconstructionTable * table = new NormalReconstructionTable;
+
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            Vector3 n(2.0f * b / 255.0f - 1.0f, 2.0f * a / 255.0f - 1.0f, 0.0f);
+            const float r = n.x * n.x + n.y * n.y;
+
+            if (xform == NormalTransform_Orthographic) {
+                n.z = sqrtf(1 - nv::clamp(r, 0.0f, 1.0f));
+            }
+            else if (xform == NormalTransform_Stereographic) {
+                float denom = 2.0f / (1 + nv::clamp(r, 0.0f, 1.0f));
+                n.x *= denom;
+                n.y *= denom;
+                n.z = denom - 1;
+            }
+            else if (xform == NormalTransform_Paraboloid) {
+                n.z = 1.0f - nv::clamp(r, 0.0f, 1.0f);
+            }
+            else if (xform == NormalTransform_Quartic) {
+                n.z = nv::clamp((1 - n.x * n.x) * (1 - n.y * n.y), 0.0f, 1.0f);
+            }
+
+            n = normalizeSafe(n, Vector3(0.0f), 0.0f);
+
+            table->x[a][b] = n.x;
+            table->y[a][b] = n.y;
+            table->z[a][b] = n.z;
+        }
+    }
+
+    return table;
+}
+
+static const NormalReconstructionTable & normalReconstructionTable(nvtt::NormalTransform xform)
+{
+    switch (xform) {
+        case NormalTransform_Stereographic: {
+            static const NormalReconstructionTable * s_table = createNormalReconstructionTable(NormalTransform_Stereographic);
+            return *s_table;
+        }
+        case NormalTransform_Paraboloid: {
+            static const NormalReconstructionTable * s_table = createNormalReconstructionTable(NormalTransform_Paraboloid);
+            return *s_table;
+        }
+        case NormalTransform_Quartic: {
+            static const NormalReconstructionTable * s_table = createNormalReconstructionTable(NormalTransform_Quartic);
+            return *s_table;
+        }
+        default: {
+            static const NormalReconstructionTable * s_table = createNormalReconstructionTable(NormalTransform_Orthographic);
+            return *s_table;
+        }
+    }
+}
+
+// For the 256 values of one channel, with the other one fixed, 1 - cos of the angle between the normal n and the reconstructed
+// normals. n.x is the component along the free channel and n.y the one along the fixed channel.
+static void computeNormalErrors(const NormalReconstructionTable & table, uint fixed, const Vector3 & n, float errors[256])
+{
+    const float * tx = table.x[fixed];
+    const float * ty = table.y[fixed];
+    const float * tz = table.z[fixed];
+
+#if NV_USE_SSE > 1
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 nx = _mm_set1_ps(n.x);
+    const __m128 ny = _mm_set1_ps(n.y);
+    const __m128 nz = _mm_set1_ps(n.z);
+
+    for (uint b = 0; b < 256; b += 4) {
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(tx + b)), _mm_mul_ps(ny, _mm_loadu_ps(ty + b))), _mm_mul_ps(nz, _mm_loadu_ps(tz + b)));
+        _mm_storeu_ps(errors + b, _mm_sub_ps(one, d));
+    }
+#else
+    for (uint b = 0; b < 256; b++) {
+        errors[b] = 1.0f - ((n.x * tx[b] + n.y * ty[b]) + n.z * tz[b]);
+    }
+#endif
+}
+
+// Total error of the palette of the block for the given errors of each texel. Optionally choose the indices that minimize it.
+static float evaluateNormalErrors(const float errors[16][256], AlphaBlockDXT5 * block, bool outputIndices)
+{
+    uint8 palette[8];
+    block->evaluatePalette(palette, false); // @@ Use target decoder.
+
+    float total = 0.0f;
+    for (uint i = 0; i < 16; i++) {
+        float best = errors[i][palette[0]];
+        uint bestIndex = 0;
+        for (uint k = 1; k < 8; k++) {
+            const float e = errors[i][palette[k]];
+            if (e < best) {
+                best = e;
+                bestIndex = k;
+            }
+        }
+        total += best;
+        if (outputIndices) block->setIndex(i, bestIndex);
+    }
+
+    return total;
+}
+
+// Move the endpoints of the block to the best of their 8 neighbors, halving the step when none of them is better, like the
+// refinement of OptimalCompress::compressDXT5A_Bounded, but for the angular errors.
+static void refineNormalChannel(const float errors[16][256], AlphaBlockDXT5 * block, int iterationCount)
+{
+    static const int offsets[8][2] = { {-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1} };
+
+    const bool eightStep = block->alpha0 > block->alpha1;
+
+    AlphaBlockDXT5 candidate = *block;
+    float besterror = evaluateNormalErrors(errors, &candidate, false);
+    int a0 = block->alpha0;
+    int a1 = block->alpha1;
+
+    int step = 8;
+    for (int i = 0; i < iterationCount && step > 0; i++) {
+        int besta0 = a0;
+        int besta1 = a1;
+
+        for (uint n = 0; n < 8; n++) {
+            int b0 = a0 + offsets[n][0] * step;
+            int b1 = a1 + offsets[n][1] * step;
+
+            if (b0 < 0 || b0 > 255 || b1 < 0 || b1 > 255) continue;
+            if ((b0 > b1) != eightStep) continue;
+
+            candidate.alpha0 = b0;
+            candidate.alpha1 = b1;
+            float error = evaluateNormalErrors(errors, &candidate, false);
+
+            if (error < besterror) {
+                besterror = error;
+                besta0 = b0;
+                besta1 = b1;
+            }
+        }
+
+        if (besta0 == a0 && besta1 == a1) {
+            step /= 2;
+        }
+        else {
+            a0 = besta0;
+            a1 = besta1;
+        }
+    }
+
+    block->alpha0 = a0;
+    block->alpha1 = a1;
+    evaluateNormalErrors(errors, block, true);
+}
+
+void CompressorBC5_Normal::compressBlocks(TexelBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+    const nvtt::NormalTransform xform = compressionOptions.normalTransform;
+    const NormalReconstructionTable & table = normalReconstructionTable(xform);
+
+    // Rounds of refinement of both channels for the angular error, and steps of each refinement.
+    const int roundCount = (compressionOptions.quality == Quality_Fastest) ? 0 : (compressionOptions.quality == Quality_Normal) ? 1 : 2;
+    const int iterationCount = 16;
+
+    uint8 * ptr = (uint8 *)output;
+
+    for (uint b = 0; b < count; b++)
+    {
+        const TexelBlock & src = blocks[b];
+        BlockATI2 * block = new(ptr + b * blockSize()) BlockATI2;
+
+        Vector3 normals[16];
+        AlphaBlock4x4 x, y;
+
+        // Blocks that are smaller than 4x4 repeat their texels, like in ColorBlock::init.
+        for (uint i = 0; i < 16; i++) {
+            const uint j = 4 * ((i / 4) % src.h) + (i % 4) % src.w;
+
+            Vector3 n(2 * src.rgba[0][j] - 1, 2 * src.rgba[1][j] - 1, 2 * src.rgba[2][j] - 1);
+            normals[i] = normalizeSafe(n, Vector3(0, 0, 1), 0.0f);
+
+            float tx, ty;
+            transformNormal(normals[i], xform, &tx, &ty);
+
+            x.alpha[i] = U8(ftoi_round(saturate(0.5f * tx + 0.5f) * 255.0f));
+            y.alpha[i] = U8(ftoi_round(saturate(0.5f * ty + 0.5f) * 255.0f));
+            x.weights[i] = y.weights[i] = 1.0f;
+        }
+
+        // Start with the channel errors.
+        if (compressionOptions.quality == Quality_Fastest) {
+            QuickCompress::compressDXT5A(x, &block->x);
+            QuickCompress::compressDXT5A(y, &block->y);
+        }
+        else {
+            OptimalCompress::compressDXT5A_Uniform(x, &block->x);
+            OptimalCompress::compressDXT5A_Uniform(y, &block->y);
+        }
+
+        // Then refine each channel for the angular errors, with the decoded values of the other one.
+        for (int r = 0; r < roundCount; r++) {
+            float errors[16][256];
+            AlphaBlock4x4 decoded;
+
+            block->y.decodeBlock(&decoded);
+            for (uint i = 0; i < 16; i++) {
+                computeNormalErrors(table, decoded.alpha[i], normals[i], errors[i]);
+            }
+            refineNormalChannel(errors, &block->x, iterationCount);
+
+            block->x.decodeBlock(&decoded);
+            for (uint i = 0; i < 16; i++) {
+                computeNormalErrors(table, decoded.alpha[i], Vector3(normals[i].y, normals[i].x, normals[i].z), errors[i]);
+            }
+            refineNormalChannel(errors, &block->y, iterationCount);
+        }
+    }
+}
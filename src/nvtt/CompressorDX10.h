@@ -45,6 +45,20 @@ namespace nv
 	};
 
 
+	// Normal CPU compressors.
+	struct CompressorBC4 : public ColorBlockCompressor
+	{
+		virtual void compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+		virtual uint blockSize() const { return 8; }
+	};
+
+	struct CompressorBC5 : public ColorBlockCompressor
+	{
+		virtual void compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+		virtual uint blockSize() const { return 16; }
+	};
+
+
 	// Production CPU compressors.
 	struct ProductionCompressorBC4 : public ColorBlockCompressor
 	{
@@ -64,6 +78,13 @@ namespace nv
 		virtual uint blockSize() const { return 16; }
 	};
 
+	// Compresses the x and y of the transformed normals of a normal map packed in [0, 1], for the angular error of the reconstructed normals.
+	struct CompressorBC5_Normal : public TexelBlockCompressor
+	{
+		virtual void compressBlocks(TexelBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+		virtual uint blockSize() const { return 16; }
+	};
+
 
 } // nv namespace
 
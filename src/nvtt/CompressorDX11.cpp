@@ -29,9 +29,13 @@
 #include "nvimage/ColorBlock.h"
 #include "nvmath/Half.h"
 #include "nvmath/Vector.inl"
+#include "nvmath/Color.inl"
+#include "nvthread/nvthread.h"
+#include "nvcore/Ptr.h"
 
 #include "bc6h/zoh.h"
 #include "bc7/avpcl.h"
+#include "bc7/bits.h"
 
 #include <string.h> // memset
 
@@ -39,76 +43,256 @@ using namespace nv;
 using namespace nvtt;
 
 
-void CompressorBC6::compressBlock(ColorSet & tile, AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions, void * output)
+// BC7 mode 5 endpoints that reproduce each 8 bit value when interpolated with index 1.
+struct BC7Mode5Lookup
 {
-    // !!!UNDONE: support channel weights
-    // !!!UNDONE: set flags once, not per block (this is especially sketchy since block compression is multithreaded...)
+    uint8 match[256][2];
+};
+
+static NV_TABLE_CONSTEXPR BC7Mode5Lookup makeBC7Mode5Lookup()
+{
+    BC7Mode5Lookup t = {};
+
+    int bestDistance[256] = {};
+    for (int i = 0; i < 256; i++) {
+        bestDistance[i] = -1;
+    }
+
+    // Record the closest pair of 7 bit endpoints that hits each value.
+    for (int e0 = 0; e0 < 128; e0++)
+    {
+        for (int e1 = 0; e1 < 128; e1++)
+        {
+            const int a = (e0 << 1) | (e0 >> 6);
+            const int b = (e1 << 1) | (e1 >> 6);
+            const int v = (a * 43 + b * 21 + 32) >> 6;
+            const int distance = e0 > e1 ? e0 - e1 : e1 - e0;
+
+            if (bestDistance[v] == -1 || distance < bestDistance[v])
+            {
+                t.match[v][0] = uint8(e0);
+                t.match[v][1] = uint8(e1);
+                bestDistance[v] = distance;
+            }
+        }
+    }
+
+    // Values that can't be reproduced exactly use the nearest one that can.
+    for (int i = 0; i < 256; i++)
+    {
+        for (int d = 1; bestDistance[i] == -1 && d < 256; d++)
+        {
+            int j = -1;
+            if (i - d >= 0 && bestDistance[i - d] != -1) j = i - d;
+            else if (i + d < 256 && bestDistance[i + d] != -1) j = i + d;
+
+            if (j != -1) {
+                t.match[i][0] = t.match[j][0];
+                t.match[i][1] = t.match[j][1];
+                break;
+            }
+        }
+    }
+
+    return t;
+}
+
+// Built at compile time by C++14 compilers, by older ones on first use in about 20 us.
+static const BC7Mode5Lookup & bc7Mode5Lookup()
+{
+    static NV_TABLE_CONSTEXPR const BC7Mode5Lookup s_lookup = makeBC7Mode5Lookup();
+    return s_lookup;
+}
+
+
+namespace
+{
+    struct BC6Scratch : public BlockScratch
+    {
+        ZOH::Format format;
+        ZOH::Tile tile;     // Reused by all the blocks of the task. Every texel is written, including the ones outside the image.
+    };
+}
+
+BlockScratch * CompressorBC6::createScratch(AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions)
+{
+    BC6Scratch * scratch = new BC6Scratch;
 
     if (compressionOptions.pixelType == PixelType_UnsignedFloat ||
         compressionOptions.pixelType == PixelType_UnsignedNorm ||
         compressionOptions.pixelType == PixelType_UnsignedInt)
     {
-        ZOH::Utils::FORMAT = ZOH::UNSIGNED_F16;
+        scratch->format = ZOH::UNSIGNED_F16;
     }
     else
     {
-        ZOH::Utils::FORMAT = ZOH::SIGNED_F16;
+        scratch->format = ZOH::SIGNED_F16;
     }
 
-    // Convert NVTT's tile struct to ZOH's, and convert float to half.
-    ZOH::Tile zohTile(tile.w, tile.h);
-    memset(zohTile.data, 0, sizeof(zohTile.data));
-    memset(zohTile.importance_map, 0, sizeof(zohTile.importance_map));
-    for (uint y = 0; y < tile.h; ++y)
+    return scratch;
+}
+
+void CompressorBC6::compressBlocks(TexelBlock * blocks, uint count, BlockScratch * scratch, AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions, void * output)
+{
+    // !!!UNDONE: support channel weights
+
+    BC6Scratch * s = (BC6Scratch *)scratch;
+    const ZOH::Format format = s->format;
+    ZOH::Tile & zohTile = s->tile;
+    uint16 halves[3][16];
+
+    for (uint b = 0; b < count; b++)
     {
-        for (uint x = 0; x < tile.w; ++x)
+        const TexelBlock & block = blocks[b];
+
+        // The color planes are contiguous, convert them to half at once.
+        half_from_float_array(block.rgba[0], halves[0], 3 * 16);
+
+        zohTile.size_x = block.w;
+        zohTile.size_y = block.h;
+        for (uint y = 0; y < 4; ++y)
         {
-            Vector4 color = tile.color(x, y);
-            uint16 rHalf = to_half(color.x);
-            uint16 gHalf = to_half(color.y);
-            uint16 bHalf = to_half(color.z);
-            zohTile.data[y][x].x = ZOH::Tile::half2float(rHalf);
-            zohTile.data[y][x].y = ZOH::Tile::half2float(gHalf);
-            zohTile.data[y][x].z = ZOH::Tile::half2float(bHalf);
-
-            if (alphaMode == AlphaMode_Transparency) {
-                zohTile.importance_map[y][x] = color.w;
-            }
-            else {
-                zohTile.importance_map[y][x] = 1.0f;
+            for (uint x = 0; x < 4; ++x)
+            {
+                const uint i = y * 4 + x;
+                zohTile.data[y][x].x = ZOH::Tile::half2float(halves[0][i], format);
+                zohTile.data[y][x].y = ZOH::Tile::half2float(halves[1][i], format);
+                zohTile.data[y][x].z = ZOH::Tile::half2float(halves[2][i], format);
+
+                if (x >= block.w || y >= block.h) {
+                    zohTile.importance_map[y][x] = 0.0f;
+                }
+                else if (alphaMode == AlphaMode_Transparency) {
+                    zohTile.importance_map[y][x] = block.rgba[3][i];
+                }
+                else {
+                    zohTile.importance_map[y][x] = 1.0f;
+                }
             }
         }
+
+        ZOH::compress(zohTile, (char *)output + b * blockSize(), format, compressionOptions.effortLevel(), compressionOptions.errorThreshold);
     }
+}
+
+void CompressorBC7::compress(AlphaMode alphaMode, uint w, uint h, uint d, const float * data, TaskDispatcher * dispatcher, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions)
+{
+    const uint blockCount = ((w + 3) / 4) * ((h + 3) / 4);
+    subtaskDispatcher = (blockCount < nv::hardwareThreadCount()) ? dispatcher : NULL;
+
+    ColorSetCompressor::compress(alphaMode, w, h, d, data, dispatcher, compressionOptions, outputOptions);
 
-    ZOH::compress(zohTile, (char *)output);
+    subtaskDispatcher = NULL;
 }
 
-void CompressorBC7::compressBlock(ColorSet & tile, AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions, void * output)
+static void dispatchSubtasks(void * dispatcher, void (*task)(void * context, int i), void * context, int count)
 {
-    // !!!UNDONE: support channel weights
-    // !!!UNDONE: set flags once, not per block (this is especially sketchy since block compression is multithreaded...)
-
-    AVPCL::mode_rgb = false;
-    AVPCL::flag_premult = (alphaMode == AlphaMode_Premultiplied);
-    AVPCL::flag_nonuniform = false;
-    AVPCL::flag_nonuniform_ati = false;
-    
-    // Convert NVTT's tile struct to AVPCL's.
-    AVPCL::Tile avpclTile(tile.w, tile.h);
-    memset(avpclTile.data, 0, sizeof(avpclTile.data));
-    for (uint y = 0; y < tile.h; ++y) {
-        for (uint x = 0; x < tile.w; ++x) {
-            Vector4 color = tile.color(x, y);
-            avpclTile.data[y][x] = color * 255.0f;
-            
-            /*if (alphaMode == AlphaMode_Transparency) {
-                avpclTile.importance_map[y][x] = color.w;
-            }
-            else*/ {
-                avpclTile.importance_map[y][x] = 1.0f;
+    ((TaskDispatcher *)dispatcher)->dispatch(task, context, count);
+}
+
+namespace
+{
+    struct BC7Scratch : public BlockScratch
+    {
+        AVPCL::Options options;
+        bool fastMode6;     // Mode 6 alone at the fastest quality uses the single pass encoder.
+        AVPCL::Tile tile;
+    };
+}
+
+BlockScratch * CompressorBC7::createScratch(AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions)
+{
+    BC7Scratch * scratch = new BC7Scratch;
+
+    AVPCL::Options & options = scratch->options;
+    options.premult = (alphaMode == AlphaMode_Premultiplied);
+    options.nonuniform = false;
+    options.nonuniform_ati = false;
+    options.channel_weights[0] = compressionOptions.colorWeight.x;
+    options.channel_weights[1] = compressionOptions.colorWeight.y;
+    options.channel_weights[2] = compressionOptions.colorWeight.z;
+    options.channel_weights[3] = compressionOptions.colorWeight.w;
+    options.effort = compressionOptions.effortLevel();
+
+    // The faster qualities only compress the modes that are estimated to fit the block best.
+    if (compressionOptions.quality == Quality_Fastest) options.mode_candidates = 1;
+    else if (compressionOptions.quality == Quality_Normal) options.mode_candidates = 2;
+    else options.mode_candidates = 8;
+
+    options.error_threshold = compressionOptions.errorThreshold;
+    options.mode_mask = compressionOptions.bc7ModeMask;
+    options.dispatch = (subtaskDispatcher != NULL) ? dispatchSubtasks : NULL;
+    options.dispatcher = subtaskDispatcher;
+
+    scratch->fastMode6 = (options.mode_mask == (1 << 6) && compressionOptions.quality == Quality_Fastest);
+
+    return scratch;
+}
+
+void CompressorBC7::compressBlock(ColorSet & set, AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions, void * output)
+{
+    AutoPtr<BlockScratch> scratch(createScratch(alphaMode, compressionOptions));
+    compressBlocks(&set, 1, scratch.ptr(), alphaMode, compressionOptions, output);
+}
+
+void CompressorBC7::compressBlocks(ColorSet * sets, uint count, BlockScratch * scratch, AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions, void * output)
+{
+    BC7Scratch * s = (BC7Scratch *)scratch;
+    AVPCL::Tile & avpclTile = s->tile;
+
+    for (uint b = 0; b < count; b++)
+    {
+        ColorSet & tile = sets[b];
+        char * ptr = (char *)output + b * blockSize();
+
+        // The color error of transparent texels matters less, it's weighted by their alpha. The alpha error isn't.
+        if (alphaMode == AlphaMode_Transparency) tile.setAlphaWeights();
+        else tile.setUniformWeights();
+
+        // Convert NVTT's tile struct to AVPCL's.
+        avpclTile.size_x = tile.w;
+        avpclTile.size_y = tile.h;
+        // The texels outside of partial blocks are cleared, the tile is reused by the next blocks of the scratch.
+        memset(avpclTile.data, 0, sizeof(avpclTile.data));
+        memset(avpclTile.importance_map, 0, sizeof(avpclTile.importance_map));
+        for (uint y = 0; y < tile.h; ++y) {
+            for (uint x = 0; x < tile.w; ++x) {
+                avpclTile.data[y][x] = tile.color(x, y) * 255.0f;
+                avpclTile.importance_map[y][x] = tile.weight(y * 4 + x);
             }
         }
+
+        if (s->fastMode6) AVPCL::compress_mode6_fast(avpclTile, s->options, ptr);
+        else AVPCL::compress(avpclTile, s->options, ptr);
     }
+}
+
+// Encode the block in mode 5 using color index 1 and alpha index 0 for all the texels.
+bool CompressorBC7::compressConstantBlock(const Vector4 & color, AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions, void * output)
+{
+    const Color32 c = toColor32(color);
+
+    AVPCL::Bits out((char *)output, AVPCL::BITSIZE);
+    out.write(0x20, 6);     // Mode 5.
+    out.write(0, 2);        // No rotation.
+
+    const BC7Mode5Lookup & lookup = bc7Mode5Lookup();
+    out.write(lookup.match[c.r][0], 7);
+    out.write(lookup.match[c.r][1], 7);
+    out.write(lookup.match[c.g][0], 7);
+    out.write(lookup.match[c.g][1], 7);
+    out.write(lookup.match[c.b][0], 7);
+    out.write(lookup.match[c.b][1], 7);
+    out.write(c.a, 8);
+    out.write(c.a, 8);
+
+    // The anchor index drops its high bit.
+    out.write(1, 1);
+    for (int i = 1; i < 16; i++) out.write(1, 2);
+
+    out.write(0, 1);
+    for (int i = 1; i < 16; i++) out.write(0, 2);
 
-    AVPCL::compress(avpclTile, (char *)output);
+    nvDebugCheck(out.getptr() == AVPCL::BITSIZE);
+    return true;
 }
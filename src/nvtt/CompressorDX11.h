@@ -28,16 +28,26 @@
 
 namespace nv
 {
-    struct CompressorBC6 : public ColorSetCompressor
+    struct CompressorBC6 : public TexelBlockCompressor
     {
-        virtual void compressBlock(ColorSet & set, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+        virtual BlockScratch * createScratch(nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions);
+        virtual void compressBlocks(TexelBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
         virtual uint blockSize() const { return 16; }
     };
 
     struct CompressorBC7 : public ColorSetCompressor
     {
+        CompressorBC7() : subtaskDispatcher(NULL) {}
+
+        // Levels with fewer blocks than hardware threads also compress the modes and shapes of each block as parallel tasks.
+        virtual void compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const float * rgba, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions);
+        virtual BlockScratch * createScratch(nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions);
         virtual void compressBlock(ColorSet & set, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+        virtual void compressBlocks(ColorSet * sets, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+        virtual bool compressConstantBlock(const Vector4 & color, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
         virtual uint blockSize() const { return 16; }
+
+        nvtt::TaskDispatcher * subtaskDispatcher;
     };
 	
 } // nv namespace
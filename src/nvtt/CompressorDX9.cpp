@@ -32,12 +32,14 @@
 // squish
 #include "squish/colourset.h"
 #include "squish/weightedclusterfit.h"
+#include "squish/fastclusterfit.h"
 
 #include "nvtt.h"
 
 #include "nvimage/Image.h"
 #include "nvimage/ColorBlock.h"
 #include "nvimage/BlockDXT.h"
+#include "nvimage/PixelFormat.h"
 
 #include "nvmath/Vector.inl"
 #include "nvmath/Color.inl"
@@ -80,18 +82,37 @@ using namespace nv;
 using namespace nvtt;
 
 
+// Palette rounding of the target decoder, for the single color blocks.
+static BlockDecoder blockDecoder(const nvtt::CompressionOptions::Private & compressionOptions)
+{
+    if (compressionOptions.decoder == Decoder_D3D9) return BlockDecoder_D3D9;
+    if (compressionOptions.decoder == Decoder_NV5x) return BlockDecoder_NV5x;
+    return BlockDecoder_D3D10;
+}
+
+
 void FastCompressorDXT1::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
 {
     BlockDXT1 * block = new(output) BlockDXT1;
     QuickCompress::compressDXT1(rgba, block);
 }
 
+void FastCompressorDXT1::compressBlocks(ColorBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+    QuickCompress::compressDXT1(blocks, count, (BlockDXT1 *)output);
+}
+
 void FastCompressorDXT1a::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
 {
     BlockDXT1 * block = new(output) BlockDXT1;
     QuickCompress::compressDXT1a(rgba, block);
 }
 
+void FastCompressorDXT1a::compressBlocks(ColorBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+    QuickCompress::compressDXT1a(blocks, count, (BlockDXT1 *)output);
+}
+
 void FastCompressorDXT3::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
 {
     BlockDXT3 * block = new(output) BlockDXT3;
@@ -104,27 +125,81 @@ void FastCompressorDXT5::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaM
     QuickCompress::compressDXT5(rgba, block);
 }
 
-void FastCompressorDXT5n::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+void FastCompressorDXT5::compressBlocks(ColorBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
 {
-    rgba.swizzle(4, 1, 5, 0); // 0xFF, G, 0, R
+    QuickCompress::compressDXT5(blocks, count, (BlockDXT5 *)output);
+}
 
+// The fast cluster fit has precomputed sums for the cluster sizes, so it always fits the 16 texels with uniform weights.
+// Don't let the colour set merge duplicate colors, the fit expects exactly 16 points.
+static void compressFastClusterFit(const ColorBlock & rgba, const nvtt::CompressionOptions::Private & compressionOptions, int flags, void * output)
+{
+    nvsquish::FastClusterFit fit;
+    fit.SetMetric(compressionOptions.colorWeight.x, compressionOptions.colorWeight.y, compressionOptions.colorWeight.z);
+
+    nvsquish::ColourSet colours((uint8 *)rgba.colors(), 0, /*createMinimalSet=*/false);
+    fit.SetColourSet(&colours, flags);
+    fit.Compress(output);
+}
+
+void FastClusterCompressorDXT1::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+    if (rgba.isSingleColor())
+    {
+        BlockDXT1 * block = new(output) BlockDXT1;
+        OptimalCompress::compressDXT1(rgba.color(0), block, blockDecoder(compressionOptions));
+    }
+    else
+    {
+        compressFastClusterFit(rgba, compressionOptions, nvsquish::kDxt1, output);
+    }
+}
+
+void FastClusterCompressorDXT5::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
     BlockDXT5 * block = new(output) BlockDXT5;
-    QuickCompress::compressDXT5(rgba, block);
+
+    QuickCompress::compressDXT5A(rgba, &block->alpha);
+
+    if (rgba.isSingleColor())
+    {
+        OptimalCompress::compressDXT1(rgba.color(0), &block->color, blockDecoder(compressionOptions));
+    }
+    else
+    {
+        compressFastClusterFit(rgba, compressionOptions, 0, &block->color);
+    }
+}
+
+void FastCompressorDXT5n::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+    BlockDXT5 * block = new(output) BlockDXT5;
+
+    // Only fit Y in the green channel, the palette has red set to 1 and blue to 0.
+    QuickCompress::compressDXT1G(rgba, &block->color);
+
+    // Compress X in the alpha channel.
+    AlphaBlock4x4 x;
+    x.init(rgba, 0);
+    QuickCompress::compressDXT5A(x, &block->alpha);
 }
 
 
 namespace nv {
-    float compress_dxt1(const Vector3 input_colors[16], const float input_weights[16], const Vector3 & color_weights, BlockDXT1 * output);
+    float compress_dxt1(const Vector3 input_colors[16], const float input_weights[16], const Vector3 & color_weights, BlockDXT1 * output, int exhaustive_volume);
+    void compress_dxt1_batch(int block_count, const Vector3 * input_colors, const float * input_weights, const Vector3 & color_weights, BlockDXT1 * output, float * errors, int exhaustive_volume);
 }
 
-#if 1
-void CompressorDXT1::compressBlock(ColorSet & set, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+// Above the default effort, the DXT1 compressor also tries the exhaustive search on blocks with small bounding boxes.
+static int exhaustiveVolume(const nvtt::CompressionOptions::Private & compressionOptions)
 {
-#if 1
-    // @@ This setup is the same for all compressors.
-    Vector3 input_colors[16];
-    float input_weights[16];
+    float effort = compressionOptions.effortLevel();
+    return effort > 0.5f ? int(800.0f * (effort - 0.5f)) : 0;
+}
 
+// @@ This setup is the same for all compressors.
+static void setup_dxt1_input(const ColorSet & set, nvtt::AlphaMode alphaMode, Vector3 input_colors[16], float input_weights[16])
+{
     uint x, y;
     for (y = 0; y < set.h; y++) {
         for (x = 0; x < set.w; x++) {
@@ -143,8 +218,17 @@ void CompressorDXT1::compressBlock(ColorSet & set, nvtt::AlphaMode alphaMode, co
             input_weights[4*y+x] = 0.0f;
         }
     }
+}
 
-    compress_dxt1(input_colors, input_weights, compressionOptions.colorWeight.xyz(), (BlockDXT1 *)output);
+#if 1
+void CompressorDXT1::compressBlock(ColorSet & set, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+#if 1
+    Vector3 input_colors[16];
+    float input_weights[16];
+    setup_dxt1_input(set, alphaMode, input_colors, input_weights);
+
+    compress_dxt1(input_colors, input_weights, compressionOptions.colorWeight.xyz(), (BlockDXT1 *)output, exhaustiveVolume(compressionOptions));
 
 #else
     set.setUniformWeights();
@@ -178,6 +262,19 @@ void CompressorDXT1::compressBlock(ColorSet & set, nvtt::AlphaMode alphaMode, co
     }
 #endif
 }
+
+void CompressorDXT1::compressBlocks(ColorSet * sets, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+    nvDebugCheck(count <= MaxBlockBatch);
+
+    Vector3 input_colors[MaxBlockBatch][16];
+    float input_weights[MaxBlockBatch][16];
+    for (uint i = 0; i < count; i++) {
+        setup_dxt1_input(sets[i], alphaMode, input_colors[i], input_weights[i]);
+    }
+
+    compress_dxt1_batch(count, &input_colors[0][0], &input_weights[0][0], compressionOptions.colorWeight.xyz(), (BlockDXT1 *)output, NULL, exhaustiveVolume(compressionOptions));
+}
 #elif 0
 
 
@@ -190,7 +287,7 @@ void CompressorDXT1::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode,
 
     if (rgba.isSingleColor())
     {
-        OptimalCompress::compressDXT1(rgba.color(0), block);
+        OptimalCompress::compressDXT1(rgba.color(0), block, blockDecoder(compressionOptions));
         //compress_dxt1_single_color_optimal(rgba.color(0), block);
     }
     else
@@ -218,7 +315,7 @@ void CompressorDXT1::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode,
     if (rgba.isSingleColor())
     {
         BlockDXT1 * block = new(output) BlockDXT1;
-        OptimalCompress::compressDXT1(rgba.color(0), block);
+        OptimalCompress::compressDXT1(rgba.color(0), block, blockDecoder(compressionOptions));
     }
     else
     {
@@ -242,7 +339,7 @@ void CompressorDXT1a::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode
     if (isSingleColor)
     {
         BlockDXT1 * block = new(output) BlockDXT1;
-        OptimalCompress::compressDXT1a(rgba.color(0), alphaMask, block);
+        OptimalCompress::compressDXT1a(rgba.color(0), alphaMask, block, blockDecoder(compressionOptions));
     }
     else
     {
@@ -275,7 +372,7 @@ void CompressorDXT3::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode,
     // Compress color.
     if (rgba.isSingleColor())
     {
-        OptimalCompress::compressDXT1(rgba.color(0), &block->color);
+        OptimalCompress::compressDXT1(rgba.color(0), &block->color, blockDecoder(compressionOptions));
     }
     else
     {
@@ -308,7 +405,7 @@ void CompressorDXT5::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode,
     // Compress color.
     if (rgba.isSingleColor())
     {
-        OptimalCompress::compressDXT1(rgba.color(0), &block->color);
+        OptimalCompress::compressDXT1(rgba.color(0), &block->color, blockDecoder(compressionOptions));
     }
     else
     {
@@ -329,44 +426,21 @@ void CompressorDXT5n::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode
 {
     BlockDXT5 * block = new(output) BlockDXT5;
 
-    // Compress Y.
-    if (compressionOptions.quality == Quality_Highest)
-    {
-        OptimalCompress::compressDXT1G(rgba, &block->color);
-    }
-    else
-    {
-        if (rgba.isSingleColor(Color32(0, 0xFF, 0, 0))) // Mask all but green channel.
-        {
-                OptimalCompress::compressDXT1G(rgba.color(0).g, &block->color);
-        }
-        else
-        {
-            ColorBlock tile = rgba;
-            tile.swizzle(4, 1, 5, 3); // leave alpha in alpha channel.
-
-            nvsquish::WeightedClusterFit fit;
-            fit.SetMetric(0, 1, 0);
-
-            int flags = 0;
-            if (alphaMode == nvtt::AlphaMode_Transparency) flags |= nvsquish::kWeightColourByAlpha;
-
-            nvsquish::ColourSet colours((uint8 *)tile.colors(), flags);
-            fit.SetColourSet(&colours, 0);
-            fit.Compress(&block->color);
-        }
-    }
-
-    rgba.swizzle(4, 1, 5, 0); // 1, G, 0, R
+    // Compress Y. Only the green channel is fit, the palette has red set to 1 and blue to 0. The exhaustive search over the
+    // green endpoints is cheaper than a cluster fit of the swizzled block.
+    OptimalCompress::compressDXT1G(rgba, &block->color);
 
     // Compress X.
+    AlphaBlock4x4 x;
+    x.init(rgba, 0);
+
     if (compressionOptions.quality == Quality_Highest)
     {
-        OptimalCompress::compressDXT5A(rgba, &block->alpha);
+        OptimalCompress::compressDXT5A(x, &block->alpha);
     }
     else
     {
-        QuickCompress::compressDXT5A(rgba, &block->alpha);
+        QuickCompress::compressDXT5A(x, &block->alpha);
     }
 }
 
@@ -374,95 +448,51 @@ void CompressorDXT5n::compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode
 
 
 
-void CompressorBC3_RGBM::compressBlock(ColorSet & src, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+// RGBM stores the color as rgb * M, with rgb in the color block and M in the alpha block, mapped from [threshold, range]
+// to [0, 1] like in Surface::fromRGBM. The texels are converted block by block, so the image doesn't need a toRGBM pass.
+struct RGBMBlock
 {
-    BlockDXT5 * block = new(output)BlockDXT5;
-
-    if (alphaMode == AlphaMode_Transparency) {
-        src.setAlphaWeights();
-    }
-    else {
-        src.setUniformWeights();
-    }
-
-    // Decompress the color block and find the M values that reproduce the input most closely. This should compensate for some of the DXT errors.
-
-    // Compress the resulting M values optimally.
+    Vector3 color[16];  // Input color, clamped to [0, range].
+    float range;
+    float threshold;
+};
 
-    // Repeat this several times until compression error does not improve?
-
-    //Vector3 rgb_block[16];
-    //float m_block[16];
-
-    
-    // Init RGB/M block.
-    const float threshold = 0.15f; // @@ Use compression options.
-#if 0
-    nvsquish::WeightedClusterFit fit;
-
-    ColorBlock rgba;
-    for (int i = 0; i < 16; i++) {
-        const Vector4 & c = src.color(i);
-        float R = saturate(c.x);
-        float G = saturate(c.y);
-        float B = saturate(c.z);
+static inline float decodeM(uint8 a, const RGBMBlock & src)
+{
+    return float(a) / 255.0f * (src.range - src.threshold) + src.threshold;
+}
 
-        float M = max(max(R, G), max(B, threshold));
-        float r = R / M;
-        float g = G / M;
-        float b = B / M;
-        float a = c.w;
+static inline uint8 encodeM(float M, const RGBMBlock & src)
+{
+    return U8(ftoi_round(saturate((M - src.threshold) / (src.range - src.threshold)) * 255.0f));
+}
 
-        rgba.color(i) = toColor32(Vector4(r, g, b, a));
-    }
+// Compress the colors divided by M. The decoder scales them by M again, so the texels are weighted by M squared.
+static void compressRGB(const RGBMBlock & src, const float M[16], const nvtt::CompressionOptions::Private & compressionOptions, BlockDXT1 * dst)
+{
+    if (compressionOptions.quality == Quality_Fastest) {
+        ColorBlock rgba;
+        for (uint i = 0; i < 16; i++) {
+            rgba.color(i) = toColor32(Vector4(saturate(src.color[i] / M[i]), 1.0f));
+        }
 
-    if (rgba.isSingleColor())
-    {
-        OptimalCompress::compressDXT1(rgba.color(0), &block->color);
+        QuickCompress::compressDXT1(rgba, dst);
+        return;
     }
-    else
-    {
-        nvsquish::WeightedClusterFit fit;
-        fit.SetMetric(compressionOptions.colorWeight.x, compressionOptions.colorWeight.y, compressionOptions.colorWeight.z);
 
-        int flags = 0;
-        if (alphaMode == nvtt::AlphaMode_Transparency) flags |= nvsquish::kWeightColourByAlpha;
-
-        nvsquish::ColourSet colours((uint8 *)rgba.colors(), flags);
-        fit.SetColourSet(&colours, 0);
-        fit.Compress(&block->color);
-    }
-#endif
-#if 1
     ColorSet rgb;
-    rgb.allocate(src.w, src.h);     // @@ Handle smaller blocks.
-
-    if (src.colorCount != 16) {
-        nvDebugBreak();
-    }
-
-    for (uint i = 0; i < src.colorCount; i++) {
-        const Vector4 & c = src.color(i);
+    rgb.allocate(4, 4);
 
-        float R = saturate(c.x);
-        float G = saturate(c.y);
-        float B = saturate(c.z);
-
-        float M = max(max(R, G), max(B, threshold));
-        float r = R / M;
-        float g = G / M;
-        float b = B / M;
-        float a = c.w;
-
-        rgb.colors[i] = Vector4(r, g, b, a);
+    for (uint i = 0; i < 16; i++) {
+        rgb.colors[i] = Vector4(saturate(src.color[i] / M[i]), 1.0f);
         rgb.indices[i] = i;
-        rgb.weights[i] = max(c.w, 0.001f);// src.weights[i];   // IC: For some reason 0 weights are causing problems, even if we eliminate the corresponding colors from the set.
+        rgb.weights[i] = M[i] * M[i];
     }
 
-    rgb.createMinimalSet(/*ignoreTransparent=*/true);
+    rgb.createMinimalSet(/*ignoreTransparent=*/false);
 
     if (rgb.isSingleColor(/*ignoreAlpha=*/true)) {
-        OptimalCompress::compressDXT1(toColor32(rgb.color(0)), &block->color);
+        OptimalCompress::compressDXT1(toColor32(rgb.color(0)), dst);
     }
     else {
         ClusterFit fit;
@@ -472,204 +502,203 @@ void CompressorBC3_RGBM::compressBlock(ColorSet & src, nvtt::AlphaMode alphaMode
         Vector3 start, end;
         fit.compress4(&start, &end);
 
-        QuickCompress::outputBlock4(rgb, start, end, &block->color);
+        QuickCompress::outputBlock4(rgb, start, end, dst);
     }
-#endif
-
-    // Decompress RGB/M block.
-    nv::ColorBlock RGB;
-    block->color.decodeBlock(&RGB);
-    
-#if 1
-    AlphaBlock4x4 M;
-    for (int i = 0; i < 16; i++) {
-        const Vector4 & c = src.color(i);
-        float R = saturate(c.x);
-        float G = saturate(c.y);
-        float B = saturate(c.z);
-
-        float r = RGB.color(i).r / 255.0f;
-        float g = RGB.color(i).g / 255.0f;
-        float b = RGB.color(i).b / 255.0f;
-
-        float m = (R / r + G / g + B / b) / 3.0f;
-        //float m = max((R / r + G / g + B / b) / 3.0f, threshold);
-        //float m = max(max(R / r, G / g), max(B / b, threshold));
-        //float m = max(max(R, G), max(B, threshold));
-
-        m = (m - threshold) / (1 - threshold);
+}
 
-        M.alpha[i] = U8(ftoi_round(saturate(m) * 255.0f));
-        M.weights[i] = src.weights[i];
+static void compressM(const AlphaBlock4x4 & M, nvtt::Quality quality, AlphaBlockDXT5 * dst)
+{
+    if (quality == Quality_Fastest) {
+        QuickCompress::compressDXT5A(M, dst);
     }
-
-    // Compress M.
-    if (compressionOptions.quality == Quality_Fastest) {
-        QuickCompress::compressDXT5A(M, &block->alpha);
+    else if (quality == Quality_Normal) {
+        OptimalCompress::compressDXT5A_Bounded(M, dst);
     }
     else {
-        OptimalCompress::compressDXT5A(M, &block->alpha);
+        OptimalCompress::compressDXT5A(M, dst);
     }
-#else
-    OptimalCompress::compressDXT5A_RGBM(src, RGB, &block->alpha);
-#endif
+}
 
-#if 0
-    // Decompress M.
-    block->alpha.decodeBlock(&M);
+// Find the M of each texel that best reproduces the input with the decoded colors of the block, and compress them.
+// An M error scales the decoded color, so the texels are weighted by its squared length.
+static void refitM(const RGBMBlock & src, const BlockDXT1 & color, nvtt::Quality quality, AlphaBlockDXT5 * dst)
+{
+    ColorBlock rgb;
+    color.decodeBlock(&rgb);
 
-    rgb.allocate(src.w, src.h);     // @@ Handle smaller blocks.
+    AlphaBlock4x4 M;
+    for (uint i = 0; i < 16; i++) {
+        const Vector3 c = toVector4(rgb.color(i)).xyz();
+        const float cc = dot(c, c);
 
-    for (uint i = 0; i < src.colorCount; i++) {
-        const Vector4 & c = src.color(i);
+        M.alpha[i] = encodeM(cc > 0.0f ? dot(src.color[i], c) / cc : src.threshold, src);
+        M.weights[i] = cc + 1.0f / 255.0f;
+    }
 
-        float R = saturate(c.x);
-        float G = saturate(c.y);
-        float B = saturate(c.z);
+    compressM(M, quality, dst);
+}
 
-        //float m = max(max(R, G), max(B, threshold));
-        float m = float(M.alpha[i]) / 255.0f * (1 - threshold) + threshold;
-        float r = R / m;
-        float g = G / m;
-        float b = B / m;
-        float a = c.w;
+static void decodeM(const AlphaBlockDXT5 & alpha, const RGBMBlock & src, float M[16])
+{
+    AlphaBlock4x4 a;
+    alpha.decodeBlock(&a);
 
-        rgb.colors[i] = Vector4(r, g, b, a);
-        rgb.indices[i] = i;
-        rgb.weights[i] = max(c.w, 0.001f);// src.weights[i];   // IC: For some reason 0 weights are causing problems, even if we eliminate the corresponding colors from the set.
+    for (uint i = 0; i < 16; i++) {
+        M[i] = decodeM(a.alpha[i], src);
     }
+}
 
-    rgb.createMinimalSet(/*ignoreTransparent=*/true);
+static float evaluateRGBMError(const RGBMBlock & src, const BlockDXT5 & block, const Vector3 & colorWeight)
+{
+    ColorBlock rgb;
+    block.color.decodeBlock(&rgb);
 
-    if (rgb.isSingleColor(/*ignoreAlpha=*/true)) {
-        OptimalCompress::compressDXT1(toColor32(rgb.color(0)), &block->color);
+    float M[16];
+    decodeM(block.alpha, src, M);
+
+    float error = 0.0f;
+    for (uint i = 0; i < 16; i++) {
+        const Vector3 d = (src.color[i] - toVector4(rgb.color(i)).xyz() * M[i]) * colorWeight;
+        error += dot(d, d);
     }
-    else {
-        ClusterFit fit;
-        fit.setMetric(compressionOptions.colorWeight);
-        fit.setColourSet(&rgb);
 
-        Vector3 start, end;
-        fit.compress4(&start, &end);
+    return error;
+}
 
-        QuickCompress::outputBlock4(rgb, start, end, &block->color);
+static void compressRGBM(const RGBMBlock & src, const nvtt::CompressionOptions::Private & compressionOptions, BlockDXT5 * block)
+{
+    // Start with the smallest M that keeps rgb in range. Round it up, so that the quantization doesn't clamp the colors.
+    AlphaBlock4x4 initialM;
+    for (uint i = 0; i < 16; i++) {
+        const Vector3 & c = src.color[i];
+        const float M = max(max(c.x, c.y), max(c.z, src.threshold));
+        initialM.alpha[i] = U8(min(ftoi_ceil((M - src.threshold) / (src.range - src.threshold) * 255.0f), 255));
+        initialM.weights[i] = 1.0f;
     }
-#endif
+    compressM(initialM, compressionOptions.quality, &block->alpha);
 
-#if 0
-    block->color.decodeBlock(&RGB);
+    // Compress the colors for the M values the decoder sees, not for the ones that were asked for.
+    float M[16];
+    decodeM(block->alpha, src, M);
+    compressRGB(src, M, compressionOptions, &block->color);
 
-    //AlphaBlock4x4 M;
-    //M.initWeights(src);
-    
-    for (int i = 0; i < 16; i++) {
-        const Vector4 & c = src.color(i);
-        float R = saturate(c.x);
-        float G = saturate(c.y);
-        float B = saturate(c.z);
+    if (compressionOptions.quality == Quality_Fastest) return;
 
-        float r = RGB.color(i).r / 255.0f;
-        float g = RGB.color(i).g / 255.0f;
-        float b = RGB.color(i).b / 255.0f;
+    // Alternate between fitting M to the colors and the colors to M while the error goes down.
+    const Vector3 colorWeight = compressionOptions.colorWeight.xyz();
+    const int iterationCount = (compressionOptions.quality == Quality_Normal) ? 1 : 3;
 
-        float m = (R / r + G / g + B / b) / 3.0f;
-        //float m = max((R / r + G / g + B / b) / 3.0f, threshold);
-        //float m = max(max(R / r, G / g), max(B / b, threshold));
-        //float m = max(max(R, G), max(B, threshold));
+    float bestError = evaluateRGBMError(src, *block, colorWeight);
 
-        m = (m - threshold) / (1 - threshold);
+    for (int i = 0; i < iterationCount && bestError > 0.0f; i++) {
+        BlockDXT5 candidate = *block;
+        refitM(src, candidate.color, compressionOptions.quality, &candidate.alpha);
 
-        M.alpha[i] = U8(ftoi_round(saturate(m) * 255.0f));
-        M.weights[i] = src.weights[i];
-    }
+        float error = evaluateRGBMError(src, candidate, colorWeight);
+        if (error >= bestError) break;
 
-    // Compress M.
-    if (compressionOptions.quality == Quality_Fastest) {
-        QuickCompress::compressDXT5A(M, &block->alpha);
-    }
-    else {
-        OptimalCompress::compressDXT5A(M, &block->alpha);
-    }
-#endif
+        *block = candidate;
+        bestError = error;
 
+        decodeM(candidate.alpha, src, M);
+        compressRGB(src, M, compressionOptions, &candidate.color);
 
+        error = evaluateRGBMError(src, candidate, colorWeight);
+        if (error >= bestError) break;
 
-#if 0
-    src.fromRGBM(M, threshold);
+        *block = candidate;
+        bestError = error;
+    }
+}
 
-    src.createMinimalSet(/*ignoreTransparent=*/true);
+void CompressorBC3_RGBM::compressBlocks(TexelBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+    // Alpha holds M, the input alpha is ignored.
+    RGBMBlock src;
+    src.range = compressionOptions.rgbmRange;
+    src.threshold = compressionOptions.rgbmThreshold;
 
-    if (src.isSingleColor(/*ignoreAlpha=*/true)) {
-        OptimalCompress::compressDXT1(src.color(0), &block->color);
-    }
-    else {
-        // @@ Use our improved compressor.
-        ClusterFit fit;
-        fit.setMetric(compressionOptions.colorWeight);
-        fit.setColourSet(&src);
+    uint8 * ptr = (uint8 *)output;
 
-        Vector3 start, end;
-        fit.compress4(&start, &end);
+    for (uint b = 0; b < count; b++)
+    {
+        const TexelBlock & block = blocks[b];
 
-        if (fit.compress3(&start, &end)) {
-            QuickCompress::outputBlock3(src, start, end, block->color);
+        // Blocks that are smaller than 4x4 repeat their texels, like in ColorBlock::init.
+        for (uint y = 0; y < 4; y++) {
+            for (uint x = 0; x < 4; x++) {
+                const uint i = 4 * (y % block.h) + (x % block.w);
+                src.color[4 * y + x] = clamp(Vector3(block.rgba[0][i], block.rgba[1][i], block.rgba[2][i]), 0.0f, src.range);
+            }
         }
-        else {
-            QuickCompress::outputBlock4(src, start, end, block->color);
-        }
-    }
-#endif // 0
 
-    // @@ Decompress color and compute M that best approximates src with these colors? Then compress M again?
+        compressRGBM(src, compressionOptions, new(ptr + b * blockSize()) BlockDXT5);
+    }
+}
 
 
 
-    // RGBM encoding.
-    // Maximize precision.
-    // - Number of possible grey levels:
-    //   - Naive:  2^3 = 8
-    //   - Better: 2^3 + 2^2 = 12
-    //   - How to choose threshold? 
-    //     - Ideal = Adaptive per block, don't know where to store.
-    //     - Adaptive per lightmap. How to compute optimal?
-    //     - Fixed: 0.25 in our case. Lightmaps scaled to a fixed [0, 1] range.
+// Convert a block the way Surface::toYCoCg and Surface::blockScaleCoCg with 5 bits convert the image, followed by the
+// bias and the clamping of the BC3-YCoCg mode of the testsuite, and quantize it like ColorBlock::init.
+static void convertBlockToYCoCg(const TexelBlock & block, ColorBlock * rgba)
+{
+    const float * r = block.rgba[0];
+    const float * g = block.rgba[1];
+    const float * b = block.rgba[2];
+
+    float Y[16], Co[16], Cg[16];
+
+    // Compute per block scale.
+    float m = 1.0f / 255.0f;
+    for (uint y = 0; y < block.h; y++) {
+        for (uint x = 0; x < block.w; x++) {
+            const uint i = 4 * y + x;
+            Y[i] = (2*g[i] + r[i] + b[i]) * 0.25f;
+            Co[i] = (r[i] - b[i]);
+            Cg[i] = (2*g[i] - r[i] - b[i]) * 0.5f;
+
+            m = max(m, fabsf(Co[i]));
+            m = max(m, fabsf(Cg[i]));
+        }
+    }
 
-    // - Optimal compressor: Interpolation artifacts.
+    const float scale = PixelFormat::quantizeCeil(m, 5, 8);
+    nvDebugCheck(scale >= m);
 
-    // - Color transform. 
-    //    - Measure error in post-tone-mapping color space. 
-    //    - Assume a simple tone mapping operator. We know minimum and maximum exposure, but don't know exact exposure in game.
-    //    - Guess based on average lighmap color? Use fixed exposure, in scaled lightmap space.
+    // Blocks that are smaller than 4x4 repeat their texels, like in ColorBlock::init.
+    for (uint y = 0; y < 4; y++) {
+        for (uint x = 0; x < 4; x++) {
+            const uint i = 4 * (y % block.h) + (x % block.w);
 
-    // - Enhanced DXT compressor.
-    //    - Typical RGBM encoding as follows:
-    //      rgb -> M = max(rgb), RGB=rgb/M -> RGBM
-    //    - If we add a compression step (M' = M) and M' < M, then rgb may be greater than 1.
-    //      - We could ensure that M' >= M during compression.
-    //      - We could clamp RGB anyway.
-    //      - We could add a fixed scale value to take into account compression errors and avoid clamping.
+            // -1->0, 0->123, 1->246 and -1->0, 0->125, 1->250
+            const float co = clamp(123.0f/255.0f * (Co[i] / scale) + 123.0f/255.0f, 0.0f, 246.0f/255.0f);
+            const float cg = clamp(125.0f/255.0f * (Cg[i] / scale) + 125.0f/255.0f, 0.0f, 250.0f/255.0f);
 
+            Color32 & c = rgba->color(x, y);
+            c.r = uint8(255 * clamp(co, 0.0f, 1.0f));
+            c.g = uint8(255 * clamp(cg, 0.0f, 1.0f));
+            c.b = uint8(255 * clamp(scale, 0.0f, 1.0f));
+            c.a = uint8(255 * clamp(Y[i], 0.0f, 1.0f));
+        }
+    }
+}
 
-    
+void CompressorBC3_YCoCg::compressBlocks(TexelBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+{
+    // Same choice of BC3 compressor as for Format_BC3. Alpha holds the luma, it never weights the colors.
+    FastCompressorDXT5 fastCompressor;
+    CompressorDXT5 compressor;
+    ColorBlockCompressor & bc3 = (compressionOptions.quality == Quality_Fastest) ? (ColorBlockCompressor &)fastCompressor : (ColorBlockCompressor &)compressor;
 
+    uint8 * ptr = (uint8 *)output;
 
-    // Compress color.
-    /*if (rgba.isSingleColor())
-    {
-        OptimalCompress::compressDXT1(rgba.color(0), &block->color);
-    }
-    else
+    for (uint i = 0; i < count; i++)
     {
-        nvsquish::WeightedClusterFit fit;
-        fit.SetMetric(compressionOptions.colorWeight.x, compressionOptions.colorWeight.y, compressionOptions.colorWeight.z);
-
-        int flags = 0;
-        if (alphaMode == nvtt::AlphaMode_Transparency) flags |= nvsquish::kWeightColourByAlpha;
+        ColorBlock rgba;
+        convertBlockToYCoCg(blocks[i], &rgba);
 
-        nvsquish::ColourSet colours((uint8 *)rgba.colors(), flags);
-        fit.SetColourSet(&colours, 0);
-        fit.Compress(&block->color);
-    }*/
+        bc3.compressBlock(rgba, nvtt::AlphaMode_None, compressionOptions, ptr + i * blockSize());
+    }
 }
 
 
@@ -17,6 +17,10 @@
 #include <string.h> // memset
 #include <float.h> // FLT_MAX
 
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 
 using namespace nv;
 
@@ -254,6 +258,74 @@ static float evaluate_palette_error(Color32 palette[4], const Color32 * colors,
 	return total;
 }
 
+#if NV_USE_SSE > 1
+
+// Colors in SoA form for evaluate_palette_error_sse. Red and green are packed in 16 bit pairs, so that _mm_madd_epi16 computes dr*dr + dg*dg.
+struct PackedColors {
+    NV_ALIGN_16 int rg[16];
+    NV_ALIGN_16 int b[16];
+    NV_ALIGN_16 float weights[16];
+    int count;
+};
+
+static void pack_colors(const Color32 * colors, const float * weights, int count, PackedColors * packed) {
+    for (int i = 0; i < 16; i++) {
+        if (i < count) {
+            packed->rg[i] = colors[i].r | (colors[i].g << 16);
+            packed->b[i] = colors[i].b;
+            packed->weights[i] = weights[i];
+        }
+        else {
+            packed->rg[i] = 0;
+            packed->b[i] = 0;
+            packed->weights[i] = 0;
+        }
+    }
+    packed->count = count;
+}
+
+static NV_FORCEINLINE __m128 evaluate_mse_sse(__m128i crg, __m128i cb, __m128i prg, __m128i pb) {
+    __m128i drg = _mm_sub_epi16(crg, prg);
+    __m128i db = _mm_sub_epi16(cb, pb);
+    return _mm_cvtepi32_ps(_mm_add_epi32(_mm_madd_epi16(drg, drg), _mm_madd_epi16(db, db)));
+}
+
+// Same as evaluate_palette_error, four colors at a time. Stops as soon as the error reaches max_error.
+static float evaluate_palette_error_sse(const Color32 palette[4], const PackedColors & colors, float max_error) {
+    __m128i prg[4], pb[4];
+    for (int j = 0; j < 4; j++) {
+        prg[j] = _mm_set1_epi32(palette[j].r | (palette[j].g << 16));
+        pb[j] = _mm_set1_epi32(palette[j].b);
+    }
+
+    float total = 0.0f;
+    for (int i = 0; i < colors.count; i += 4) {
+        __m128i crg = _mm_load_si128((const __m128i *)(colors.rg + i));
+        __m128i cb = _mm_load_si128((const __m128i *)(colors.b + i));
+
+        // The squared distances are exact in float, so the minimum is too.
+        __m128 e = evaluate_mse_sse(crg, cb, prg[0], pb[0]);
+        e = _mm_min_ps(e, evaluate_mse_sse(crg, cb, prg[1], pb[1]));
+        e = _mm_min_ps(e, evaluate_mse_sse(crg, cb, prg[2], pb[2]));
+        e = _mm_min_ps(e, evaluate_mse_sse(crg, cb, prg[3], pb[3]));
+
+        NV_ALIGN_16 float weighted[4];
+        _mm_store_ps(weighted, _mm_mul_ps(e, _mm_load_ps(colors.weights + i)));
+
+        // Accumulate in order, so that the result matches evaluate_palette_error exactly.
+        const int n = min(4, colors.count - i);
+        for (int k = 0; k < n; k++) {
+            total += weighted[k];
+        }
+
+        if (total >= max_error) break;
+    }
+
+	return total;
+}
+
+#endif // NV_USE_SSE > 1
+
 #if 0
 static float evaluate_mse(const BlockDXT1 * output, const Vector3 colors[16]) {
     Color32 palette[4];
@@ -561,41 +633,65 @@ float nv::compress_dxt1_bounding_box_exhaustive(const Vector3 input_colors[16],
         colors32[i] = toColor32(Vector4(colors[i], 1));
     }
 
+#if NV_USE_SSE > 1
+    PackedColors packed_colors;
+    pack_colors(colors32, weights, count, &packed_colors);
+#endif
+
     float best_error = FLT_MAX;
     Color16 best0, best1;           // @@ Record endpoints as Color16?
 
     Color16 c0, c1;
     Color32 palette[4];
 
+    // The palette is built from the precomputed tables in SingleColorLookup instead of being expanded and interpolated for every pair.
     for(int r0 = min_r; r0 <= max_r; r0++)
     for(int g0 = min_g; g0 <= max_g; g0++)
     for(int b0 = min_b; b0 <= max_b; b0++)
     {
         c0.r = r0; c0.g = g0; c0.b = b0;
-        palette[0] = bitexpand_color16_to_color32(c0);
+        palette[0].r = Expand5[r0];
+        palette[0].g = Expand6[g0];
+        palette[0].b = Expand5[b0];
 
         for(int r1 = min_r; r1 <= max_r; r1++)
         for(int g1 = min_g; g1 <= max_g; g1++)
         for(int b1 = min_b; b1 <= max_b; b1++)
         {
             c1.r = r1; c1.g = g1; c1.b = b1;
-            palette[1] = bitexpand_color16_to_color32(c1);
+            palette[1].r = Expand5[r1];
+            palette[1].g = Expand6[g1];
+            palette[1].b = Expand5[b1];
 
             if (c0.u > c1.u) {
                 // Evaluate error in 4 color mode.
-                evaluate_palette4(palette);
+                palette[2].r = Lerp5[r0][r1];
+                palette[2].g = Lerp6[g0][g1];
+                palette[2].b = Lerp5[b0][b1];
+                palette[3].r = Lerp5[r1][r0];
+                palette[3].g = Lerp6[g1][g0];
+                palette[3].b = Lerp5[b1][b0];
             }
             else {
     #if 1
                 // Evaluate error in 3 color mode.
-                evaluate_palette3(palette);
+                palette[2].r = Mid5[r0][r1];
+                palette[2].g = Mid6[g0][g1];
+                palette[2].b = Mid5[b0][b1];
+                palette[3].r = 0;
+                palette[3].g = 0;
+                palette[3].b = 0;
     #else
                 // Skip 3 color mode.
                 continue;
     #endif
             }
 
+    #if NV_USE_SSE > 1
+            float error = evaluate_palette_error_sse(palette, packed_colors, best_error);
+    #else
             float error = evaluate_palette_error(palette, colors32, weights, count);
+    #endif
 
             if (error < best_error) {
                 best_error = error;
@@ -642,10 +738,9 @@ void nv::compress_dxt1_cluster_fit(const Vector3 input_colors[16], const Vector3
 
 
 
-float nv::compress_dxt1(const Vector3 input_colors[16], const float input_weights[16], const Vector3 & color_weights, BlockDXT1 * output)
+// Everything compress_dxt1 does before the cluster fit. Returns the number of distinct colors, the cluster fit is only needed when there's more than one.
+static int compress_dxt1_prepare(const Vector3 input_colors[16], const float input_weights[16], const Vector3 & color_weights, int exhaustive_volume, Vector3 colors[16], float weights[16], float * error, BlockDXT1 * output)
 {
-    Vector3 colors[16];
-    float weights[16];
     int count = reduce_colors(input_colors, input_weights, colors, weights);
 
     if (count == 0) {
@@ -653,28 +748,28 @@ float nv::compress_dxt1(const Vector3 input_colors[16], const float input_weight
         output->col0.u = 0;
         output->col1.u = 0;
         output->indices = 0;
+        *error = 0;
         return 0;
     }
 
 
-    float error = FLT_MAX;
+    *error = FLT_MAX;
 
     // Sometimes the single color compressor produces better results than the exhaustive. This introduces discontinuities between blocks that
     // use different compressors. For this reason, this is not enabled by default.
     if (1) {
-        error = compress_dxt1_single_color(colors, weights, count, color_weights, output);
+        *error = compress_dxt1_single_color(colors, weights, count, color_weights, output);
 
-        if (error == 0.0f || count == 1) {
+        if (*error == 0.0f || count == 1) {
             // Early out.
-            return error;
+            return 1;
         }
     }
 
-    // This is too expensive, even with a low threshold.
-    // If high quality:
-    if (0) {
+    // This is too expensive to do by default, even with a low threshold.
+    if (exhaustive_volume > 0) {
         BlockDXT1 exhaustive_output;
-        float exhaustive_error = compress_dxt1_bounding_box_exhaustive(input_colors, colors, weights, count, color_weights, 400, &exhaustive_output);
+        float exhaustive_error = compress_dxt1_bounding_box_exhaustive(input_colors, colors, weights, count, color_weights, exhaustive_volume, &exhaustive_output);
 
         if (exhaustive_error != FLT_MAX) {
             float exhaustive_error2 = evaluate_mse(input_colors, input_weights, color_weights, &exhaustive_output);
@@ -682,9 +777,9 @@ float nv::compress_dxt1(const Vector3 input_colors[16], const float input_weight
             // The exhaustive compressor does not use color_weights, so the results may be different.
             //nvCheck(equal(exhaustive_error, exhaustive_error2));
 
-            if (exhaustive_error2 < error) {
+            if (exhaustive_error2 < *error) {
                 *output = exhaustive_output;
-                error = exhaustive_error;
+                *error = exhaustive_error2;
             }
         }
     }
@@ -694,10 +789,20 @@ float nv::compress_dxt1(const Vector3 input_colors[16], const float input_weight
     //error = compress_dxt1_least_squares_fit(colors, weigths, error, output);
 
     // Cluster fit cannot handle single color blocks, so encode them optimally if we haven't encoded them already.
-    if (error == FLT_MAX && count == 1) {
-        error = compress_dxt1_single_color_optimal(colors[0], output);
+    if (*error == FLT_MAX && count == 1) {
+        *error = compress_dxt1_single_color_optimal(colors[0], output);
     }
 
+    return count;
+}
+
+float nv::compress_dxt1(const Vector3 input_colors[16], const float input_weights[16], const Vector3 & color_weights, BlockDXT1 * output, int exhaustive_volume/*=0*/)
+{
+    Vector3 colors[16];
+    float weights[16];
+    float error;
+    int count = compress_dxt1_prepare(input_colors, input_weights, color_weights, exhaustive_volume, colors, weights, &error, output);
+
     if (count > 1) {
         BlockDXT1 cluster_fit_output;
         compress_dxt1_cluster_fit(input_colors, colors, weights, count, color_weights, &cluster_fit_output);
@@ -714,6 +819,82 @@ float nv::compress_dxt1(const Vector3 input_colors[16], const float input_weight
 }
 
 
+void nv::compress_dxt1_batch(int block_count, const Vector3 * input_colors, const float * input_weights, const Vector3 & color_weights, BlockDXT1 * output, float * output_errors, int exhaustive_volume/*=0*/)
+{
+#if NVTT_USE_CLUSTER_FIT_BATCH
+    const int MaxLaneCount = ClusterFitBatch::MaxLaneCount;
+
+    ClusterFitBatch fit;
+    fit.setColorWeights(Vector4(color_weights, 1));
+
+    const int laneCount = fit.laneCount();
+
+    for (int base = 0; base < block_count; ) {
+        // Gather the blocks that need the cluster fit.
+        Vector3 colors[MaxLaneCount][16];
+        float weights[MaxLaneCount][16];
+        float error[MaxLaneCount];
+        int block[MaxLaneCount];
+        int counts[MaxLaneCount];
+        int lanes = 0;
+
+        fit.reset();
+
+        for (; base < block_count && lanes < laneCount; base++) {
+            float block_error;
+            int count = compress_dxt1_prepare(input_colors + 16 * base, input_weights + 16 * base, color_weights, exhaustive_volume, colors[lanes], weights[lanes], &block_error, output + base);
+
+            if (count > 1) {
+                counts[lanes] = count;
+                error[lanes] = block_error;
+                block[lanes] = base;
+                lanes++;
+            }
+            else if (output_errors != NULL) {
+                output_errors[base] = block_error;
+            }
+        }
+
+        if (lanes == 0) continue;
+
+        fit.setColorSets(lanes, colors, weights, counts);
+
+        // start & end are in [0, 1] range.
+        Vector3 start[MaxLaneCount], end[MaxLaneCount];
+        fit.compress4(start, end);
+        uint three_color_mask = fit.compress3(start, end);
+
+        for (int i = 0; i < lanes; i++) {
+            const Vector3 * block_colors = input_colors + 16 * block[i];
+            const float * block_weights = input_weights + 16 * block[i];
+
+            BlockDXT1 cluster_fit_output;
+            if (three_color_mask & (1 << i)) {
+                output_block3(block_colors, color_weights, start[i], end[i], &cluster_fit_output);
+            }
+            else {
+                output_block4(block_colors, color_weights, start[i], end[i], &cluster_fit_output);
+            }
+
+            float cluster_fit_error = evaluate_mse(block_colors, block_weights, color_weights, &cluster_fit_output);
+
+            if (cluster_fit_error < error[i]) {
+                output[block[i]] = cluster_fit_output;
+                error[i] = cluster_fit_error;
+            }
+
+            if (output_errors != NULL) output_errors[block[i]] = error[i];
+        }
+    }
+#else
+    for (int i = 0; i < block_count; i++) {
+        float error = compress_dxt1(input_colors + 16 * i, input_weights + 16 * i, color_weights, output + i, exhaustive_volume);
+        if (output_errors != NULL) output_errors[i] = error;
+    }
+#endif
+}
+
+
 // Once we have an index assignment we have colors grouped in 1-4 clusters.
 // If 1 clusters -> Use optimal compressor.
 // If 2 clusters -> Try: (0, 1), (1, 2), (0, 2), (0, 3) - [0, 1]
@@ -17,6 +17,10 @@ namespace nv {
     void compress_dxt1_cluster_fit(const Vector3 input_colors[16], const Vector3 * colors, const float * weights, int count, const Vector3 & color_weights, BlockDXT1 * output);
 
 
-    float compress_dxt1(const Vector3 colors[16], const float weights[16], const Vector3 & color_weights, BlockDXT1 * output);
+    // When exhaustive_volume is not zero, blocks whose bounding box search volume is below it also try the exhaustive search.
+    float compress_dxt1(const Vector3 colors[16], const float weights[16], const Vector3 & color_weights, BlockDXT1 * output, int exhaustive_volume = 0);
+
+    // Compress block_count blocks with 16 colors and weights each. Produces the same output as compress_dxt1, but runs the cluster fit of several blocks at once. errors is optional.
+    void compress_dxt1_batch(int block_count, const Vector3 * colors, const float * weights, const Vector3 & color_weights, BlockDXT1 * output, float * errors, int exhaustive_volume = 0);
 
 }
@@ -28,6 +28,7 @@
 
 #include "nvimage/Image.h"
 #include "nvimage/FloatImage.h"
+#include "nvimage/MemoryPool.h"
 #include "nvimage/PixelFormat.h"
 
 #include "nvmath/Color.h"
@@ -36,6 +37,10 @@
 
 #include "nvcore/Debug.h"
 
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 using namespace nv;
 using namespace nvtt;
 
@@ -161,7 +166,7 @@ namespace
 
     struct BitStream
     {
-        BitStream(uint8 * ptr) : ptr(ptr), buffer(0), bits(0) {
+        BitStream(uint8 * ptr) : start(ptr), ptr(ptr), buffer(0), bits(0) {
         }
 
         void putBits(uint p, int bitCount)
@@ -222,17 +227,253 @@ namespace
         {
             nvDebugCheck(alignment >= 1);
             flush();
-            int remainder = (int)((uintptr_t)ptr % alignment);
+            int remainder = (int)((ptr - start) % alignment);
             if (remainder != 0) {
                 putBits(0, (alignment - remainder) * 8);
             }
         }
 
+        uint8 * start;
         uint8 * ptr;
         uint8 buffer;
         uint8 bits;
     };
 
+
+    struct PixelFormatConverterContext
+    {
+        const float * data;
+        uint w, h, d;
+        uint pitch;
+        uint firstRow;  // Scanline stored at the start of mem.
+        uint8 * mem;
+
+        nvtt::PixelType pixelType;
+        uint pitchAlignment;
+        uint bitCount;
+        uint rshift, rsize;
+        uint gshift, gsize;
+        uint bshift, bsize;
+        uint ashift, asize;
+    };
+
+    // Convert the pixels [begin, end) of a scanline, one at a time.
+    static void convertPixels(const PixelFormatConverterContext & c, const float * src, uint begin, uint end, BitStream & stream)
+    {
+        const uint whd = c.w * c.h * c.d;
+
+        for (uint x = begin; x < end; x++)
+        {
+            float r = src[x + 0 * whd];
+            float g = src[x + 1 * whd];
+            float b = src[x + 2 * whd];
+            float a = src[x + 3 * whd];
+
+            if (c.pixelType == nvtt::PixelType_Float)
+            {
+                if (c.rsize == 32) stream.putFloat(r);
+                else if (c.rsize == 16) stream.putHalf(r);
+                else if (c.rsize == 11) stream.putFloat11(r);
+                else if (c.rsize == 10) stream.putFloat10(r);
+                else stream.putBits(0, c.rsize);
+
+                if (c.gsize == 32) stream.putFloat(g);
+                else if (c.gsize == 16) stream.putHalf(g);
+                else if (c.gsize == 11) stream.putFloat11(g);
+                else if (c.gsize == 10) stream.putFloat10(g);
+                else stream.putBits(0, c.gsize);
+
+                if (c.bsize == 32) stream.putFloat(b);
+                else if (c.bsize == 16) stream.putHalf(b);
+                else if (c.bsize == 11) stream.putFloat11(b);
+                else if (c.bsize == 10) stream.putFloat10(b);
+                else stream.putBits(0, c.bsize);
+
+                if (c.asize == 32) stream.putFloat(a);
+                else if (c.asize == 16) stream.putHalf(a);
+                else if (c.asize == 11) stream.putFloat11(a);
+                else if (c.asize == 10) stream.putFloat10(a);
+                else stream.putBits(0, c.asize);
+            }
+            else
+            {
+                // We first convert to 16 bits, then to the target size. @@ If greater than 16 bits, this will truncate and bitexpand.
+                
+                // @@ Add support for nvtt::PixelType_SignedInt, nvtt::PixelType_SignedNorm, nvtt::PixelType_UnsignedInt
+
+                int ir, ig, ib, ia;
+                if (c.pixelType == nvtt::PixelType_UnsignedNorm) {
+                    ir = iround(clamp(r * 65535.0f, 0.0f, 65535.0f));
+                    ig = iround(clamp(g * 65535.0f, 0.0f, 65535.0f));
+                    ib = iround(clamp(b * 65535.0f, 0.0f, 65535.0f));
+                    ia = iround(clamp(a * 65535.0f, 0.0f, 65535.0f));
+                }
+                else if (c.pixelType == nvtt::PixelType_SignedNorm) {
+                    // @@
+                }
+                else if (c.pixelType == nvtt::PixelType_UnsignedInt) {
+                    ir = iround(clamp(r, 0.0f, 65535.0f));
+                    ig = iround(clamp(g, 0.0f, 65535.0f));
+                    ib = iround(clamp(b, 0.0f, 65535.0f));
+                    ia = iround(clamp(a, 0.0f, 65535.0f));
+                }
+                else if (c.pixelType == nvtt::PixelType_SignedInt) {
+                    // @@
+                }
+                
+                uint p = 0;
+                p |= PixelFormat::convert(ir, 16, c.rsize) << c.rshift;
+                p |= PixelFormat::convert(ig, 16, c.gsize) << c.gshift;
+                p |= PixelFormat::convert(ib, 16, c.bsize) << c.bshift;
+                p |= PixelFormat::convert(ia, 16, c.asize) << c.ashift;
+
+                stream.putBits(p, c.bitCount);
+            }
+        }
+    }
+
+    // Unsigned normalized 8, 16 and 32 bit pixels whose channels have at most 16 bits are truncated from the 16 bit value, so they don't need to bitexpand.
+    static bool isTruncatedUnormLayout(const PixelFormatConverterContext & c)
+    {
+        return c.pixelType == nvtt::PixelType_UnsignedNorm &&
+            (c.bitCount == 8 || c.bitCount == 16 || c.bitCount == 32) &&
+            c.rsize <= 16 && c.gsize <= 16 && c.bsize <= 16 && c.asize <= 16;
+    }
+
+    // Float layouts made of whole halves and floats don't need the bit stream.
+    static bool isByteAlignedFloatLayout(const PixelFormatConverterContext & c)
+    {
+        return c.pixelType == nvtt::PixelType_Float &&
+            (c.rsize == 0 || c.rsize == 16 || c.rsize == 32) &&
+            (c.gsize == 0 || c.gsize == 16 || c.gsize == 32) &&
+            (c.bsize == 0 || c.bsize == 16 || c.bsize == 32) &&
+            (c.asize == 0 || c.asize == 16 || c.asize == 32);
+    }
+
+#if NV_USE_SSE > 1
+
+    // Quantize 4 values to 16 bits exactly like iround(clamp(x * 65535.0f, 0.0f, 65535.0f)) and truncate them to the given size.
+    static inline __m128i quantizeUnorm_SSE2(__m128 x, __m128i shift)
+    {
+        const __m128 scale = _mm_set1_ps(65535.0f);
+        x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(x, scale), _mm_setzero_ps()), scale);
+        __m128i i = _mm_cvttps_epi32(_mm_add_ps(x, _mm_set1_ps(0.5f)));
+        return _mm_srl_epi32(i, shift);
+    }
+
+    // Convert the pixels of a scanline in groups of 4, returns the number of pixels converted.
+    static uint convertTruncatedUnormPixels_SSE2(const PixelFormatConverterContext & c, const float * src, uint8 * dst)
+    {
+        const uint whd = c.w * c.h * c.d;
+        const uint count = c.w & ~3U;
+
+        const __m128i rsize = _mm_cvtsi32_si128(16 - c.rsize), rshift = _mm_cvtsi32_si128(c.rshift);
+        const __m128i gsize = _mm_cvtsi32_si128(16 - c.gsize), gshift = _mm_cvtsi32_si128(c.gshift);
+        const __m128i bsize = _mm_cvtsi32_si128(16 - c.bsize), bshift = _mm_cvtsi32_si128(c.bshift);
+        const __m128i asize = _mm_cvtsi32_si128(16 - c.asize), ashift = _mm_cvtsi32_si128(c.ashift);
+
+        for (uint x = 0; x < count; x += 4)
+        {
+            __m128i p = _mm_sll_epi32(quantizeUnorm_SSE2(_mm_loadu_ps(src + x + 0 * whd), rsize), rshift);
+            p = _mm_or_si128(p, _mm_sll_epi32(quantizeUnorm_SSE2(_mm_loadu_ps(src + x + 1 * whd), gsize), gshift));
+            p = _mm_or_si128(p, _mm_sll_epi32(quantizeUnorm_SSE2(_mm_loadu_ps(src + x + 2 * whd), bsize), bshift));
+            p = _mm_or_si128(p, _mm_sll_epi32(quantizeUnorm_SSE2(_mm_loadu_ps(src + x + 3 * whd), asize), ashift));
+
+            if (c.bitCount == 32) {
+                _mm_storeu_si128((__m128i *)(dst + 4 * x), p);
+            }
+            else {
+                // Sign extend the low 16 bits, so that packing doesn't saturate.
+                p = _mm_srai_epi32(_mm_slli_epi32(p, 16), 16);
+                p = _mm_packs_epi32(p, p);
+
+                if (c.bitCount == 16) {
+                    _mm_storel_epi64((__m128i *)(dst + 2 * x), p);
+                }
+                else {
+                    p = _mm_packus_epi16(p, p);
+                    *(int *)(dst + x) = _mm_cvtsi128_si32(p);
+                }
+            }
+        }
+
+        return count;
+    }
+
+#endif // NV_USE_SSE > 1
+
+    static void convertByteAlignedFloatPixels(const PixelFormatConverterContext & c, const float * src, uint8 * dst)
+    {
+        const uint whd = c.w * c.h * c.d;
+        const uint size[4] = { c.rsize, c.gsize, c.bsize, c.asize };
+
+        // Convert the half channels of a run of pixels at once, then interleave.
+        const uint runSize = 64;
+        uint16 halves[4][runSize];
+
+        for (uint x0 = 0; x0 < c.w; x0 += runSize)
+        {
+            const uint count = min(runSize, c.w - x0);
+
+            for (uint i = 0; i < 4; i++)
+            {
+                if (size[i] == 16) {
+                    half_from_float_array(src + x0 + i * whd, halves[i], count);
+                }
+            }
+
+            for (uint x = 0; x < count; x++)
+            {
+                for (uint i = 0; i < 4; i++)
+                {
+                    if (size[i] == 32) {
+                        *((float *)dst) = src[x0 + x + i * whd];
+                        dst += 4;
+                    }
+                    else if (size[i] == 16) {
+                        *((uint16 *)dst) = halves[i][x];
+                        dst += 2;
+                    }
+                }
+            }
+        }
+    }
+
+    // Convert a range of scanlines of the current window, counting the scanlines of all the slices.
+    static void PixelFormatConverterTask(void * data, int begin, int end)
+    {
+        const PixelFormatConverterContext & c = *(const PixelFormatConverterContext *) data;
+
+        for (int i = begin; i < end; i++)
+        {
+            const float * src = c.data + (c.firstRow + i) * c.w;
+            uint8 * dst = c.mem + i * c.pitch;
+
+            BitStream stream(dst);
+
+            if (isByteAlignedFloatLayout(c))
+            {
+                convertByteAlignedFloatPixels(c, src, dst);
+                stream.ptr += c.w * (c.bitCount / 8);
+            }
+            else
+            {
+                uint x = 0;
+#if NV_USE_SSE > 1
+                if (isTruncatedUnormLayout(c)) {
+                    x = convertTruncatedUnormPixels_SSE2(c, src, dst);
+                    stream.ptr += x * (c.bitCount / 8);
+                }
+#endif
+                convertPixels(c, src, x, c.w, stream);
+            }
+
+            // Zero padding.
+            stream.align(c.pitchAlignment);
+            nvDebugCheck(stream.ptr == dst + c.pitch);
+        }
+    }
+
 } // namespace
 
 
@@ -253,6 +494,7 @@ void PixelFormatConverter::compress(nvtt::AlphaMode /*alphaMode*/, uint w, uint
         gsize = compressionOptions.gsize;
         bsize = compressionOptions.bsize;
         asize = compressionOptions.asize;
+        rshift = gshift = bshift = ashift = 0;
 
         // Other float sizes are not supported and will be zero-padded.
         nvDebugCheck(rsize == 0 || rsize == 10 || rsize == 11 || rsize == 16 || rsize == 32);
@@ -301,97 +543,39 @@ void PixelFormatConverter::compress(nvtt::AlphaMode /*alphaMode*/, uint w, uint
         }
     }
 
-    const uint pitch = computeBytePitch(w, bitCount, compressionOptions.pitchAlignment);
-    const uint whd = w * h * d;
-
-    // Allocate output scanline.
-    uint8 * const dst = malloc<uint8>(pitch);
-
-    for (uint z = 0; z < d; z++)
+    PixelFormatConverterContext context;
+    context.data = data;
+    context.w = w;
+    context.h = h;
+    context.d = d;
+    context.pitch = computeBytePitch(w, bitCount, compressionOptions.pitchAlignment);
+
+    context.pixelType = compressionOptions.pixelType;
+    context.pitchAlignment = compressionOptions.pitchAlignment;
+    context.bitCount = bitCount;
+    context.rshift = rshift; context.rsize = rsize;
+    context.gshift = gshift; context.gsize = gsize;
+    context.bshift = bshift; context.bsize = bsize;
+    context.ashift = ashift; context.asize = asize;
+
+    // The scanlines are converted in parallel, in windows that are small enough to stay in the cache.
+    const uint rowCount = h * d;
+    const uint windowRows = min(rowCount, max(1U, (1U << 20) / context.pitch));
+    const uint grain = max(1U, 16384U / w);
+
+    uint8 * const mem = poolAllocate<uint8>(context.pitch * windowRows);
+    context.mem = mem;
+
+    for (uint y = 0; y < rowCount; y += windowRows)
     {
-        for (uint y = 0; y < h; y++)
-        {
-            const float * src = (const float *)data + (z * h + y) * w;
+        const uint rows = min(windowRows, rowCount - y);
 
-            BitStream stream(dst);
+        context.firstRow = y;
 
-            for (uint x = 0; x < w; x++)
-            {
-                float r = src[x + 0 * whd];
-                float g = src[x + 1 * whd];
-                float b = src[x + 2 * whd];
-                float a = src[x + 3 * whd];
+        dispatcher->dispatchRange(PixelFormatConverterTask, &context, rows, grain);
 
-                if (compressionOptions.pixelType == nvtt::PixelType_Float)
-                {
-                    if (rsize == 32) stream.putFloat(r);
-                    else if (rsize == 16) stream.putHalf(r);
-                    else if (rsize == 11) stream.putFloat11(r);
-                    else if (rsize == 10) stream.putFloat10(r);
-                    else stream.putBits(0, rsize);
-
-                    if (gsize == 32) stream.putFloat(g);
-                    else if (gsize == 16) stream.putHalf(g);
-                    else if (gsize == 11) stream.putFloat11(g);
-                    else if (gsize == 10) stream.putFloat10(g);
-                    else stream.putBits(0, gsize);
-
-                    if (bsize == 32) stream.putFloat(b);
-                    else if (bsize == 16) stream.putHalf(b);
-                    else if (bsize == 11) stream.putFloat11(b);
-                    else if (bsize == 10) stream.putFloat10(b);
-                    else stream.putBits(0, bsize);
-
-                    if (asize == 32) stream.putFloat(a);
-                    else if (asize == 16) stream.putHalf(a);
-                    else if (asize == 11) stream.putFloat11(a);
-                    else if (asize == 10) stream.putFloat10(a);
-                    else stream.putBits(0, asize);
-                }
-                else
-                {
-                    // We first convert to 16 bits, then to the target size. @@ If greater than 16 bits, this will truncate and bitexpand.
-                    
-                    // @@ Add support for nvtt::PixelType_SignedInt, nvtt::PixelType_SignedNorm, nvtt::PixelType_UnsignedInt
-
-                    int ir, ig, ib, ia;
-                    if (compressionOptions.pixelType == nvtt::PixelType_UnsignedNorm) {
-                        ir = iround(clamp(r * 65535.0f, 0.0f, 65535.0f));
-                        ig = iround(clamp(g * 65535.0f, 0.0f, 65535.0f));
-                        ib = iround(clamp(b * 65535.0f, 0.0f, 65535.0f));
-                        ia = iround(clamp(a * 65535.0f, 0.0f, 65535.0f));
-                    }
-                    else if (compressionOptions.pixelType == nvtt::PixelType_SignedNorm) {
-                        // @@
-                    }
-                    else if (compressionOptions.pixelType == nvtt::PixelType_UnsignedInt) {
-                        ir = iround(clamp(r, 0.0f, 65535.0f));
-                        ig = iround(clamp(g, 0.0f, 65535.0f));
-                        ib = iround(clamp(b, 0.0f, 65535.0f));
-                        ia = iround(clamp(a, 0.0f, 65535.0f));
-                    }
-                    else if (compressionOptions.pixelType == nvtt::PixelType_SignedInt) {
-                        // @@
-                    }
-                    
-                    uint p = 0;
-                    p |= PixelFormat::convert(ir, 16, rsize) << rshift;
-                    p |= PixelFormat::convert(ig, 16, gsize) << gshift;
-                    p |= PixelFormat::convert(ib, 16, bsize) << bshift;
-                    p |= PixelFormat::convert(ia, 16, asize) << ashift;
-
-                    stream.putBits(p, bitCount);
-                }
-            }
-
-            // Zero padding.
-            stream.align(compressionOptions.pitchAlignment);
-            nvDebugCheck(stream.ptr == dst + pitch);
-
-            // Scanlines are always byte-aligned.
-            outputOptions.writeData(dst, pitch);
-        }
+        outputOptions.writeData(mem, context.pitch * rows);
     }
 
-    free(dst);
+    poolFree(mem);
 }
@@ -29,16 +29,23 @@
 #include "InputOptions.h"
 #include "CompressionOptions.h"
 #include "OutputOptions.h"
+#include "OutputCache.h"
 #include "Surface.h"
+#include "Profiler.h"
+#include "Progress.h"
+#include "RateDistortion.h"
 
 #include "CompressorDX9.h"
 #include "CompressorDX10.h"
 #include "CompressorDX11.h"
 #include "CompressorRGB.h"
+#include "ExternalCompressor.h"
 #include "cuda/CudaUtils.h"
 #include "cuda/CudaCompressorDXT.h"
+#include "cuda/CudaSurface.h"
 
 #include "nvimage/DirectDrawSurface.h"
+#include "nvimage/KtxFile.h"
 #include "nvimage/ColorBlock.h"
 #include "nvimage/BlockDXT.h"
 #include "nvimage/Image.h"
@@ -48,53 +55,96 @@
 #include "nvimage/NormalMap.h"
 #include "nvimage/PixelFormat.h"
 #include "nvimage/ColorSpace.h"
+#include "nvimage/Supercompression.h"
+#include "nvimage/MemoryPool.h"
+
+#include "nvmath/Vector.inl"
 
 #include "nvcore/Memory.h"
 #include "nvcore/Ptr.h"
+#include "nvcore/Array.inl"
+#include "nvcore/Timer.h"
+
+#include "nvthread/TaskScheduler.h"
+
+#include <float.h> // FLT_MAX
 
 using namespace nv;
 using namespace nvtt;
 
+namespace nvtt
+{
+    // A CUDA context and the calibration of its devices, shared by the compressors that use the same devices.
+    struct SharedCudaContext
+    {
+        nv::CudaContext * context;
+        uint deviceMask;
+        uint minTexels;
+        int refCount;
+        nv::Mutex mutex;    // The compressors, and the faces they compress concurrently, take turns on the devices.
+    };
+}
+
+// The shared contexts, and the lazy initialization of the compressors, are guarded by this mutex.
+static nv::Mutex s_cudaContextMutex;
+static nv::Array<SharedCudaContext *> s_cudaContexts;
+static int s_cudaHardwarePresent = -1;  // Unknown until the first context is requested.
+
+// Whether chooseGpuCompressor has a compressor for the options, checked before creating a context for them.
+static bool hasGpuCompressor(const CompressionOptions::Private & compressionOptions)
+{
+#if defined HAVE_CUDA
+    if (compressionOptions.quality == Quality_Fastest) return false;
+    return compressionOptions.format == Format_DXT1 || compressionOptions.format == Format_BC4 || compressionOptions.format == Format_BC5;
+#else
+    return false;
+#endif
+}
+
+
 Compressor::Compressor() : m(*new Compressor::Private())
 {
-    // CUDA initialization.
-    m.cudaSupported = cuda::isHardwarePresent();
-    m.cudaEnabled = false;
+    // The CUDA context is created on first use.
+    m.cudaEnabled = true;
+    m.cudaDeviceMask = ~0U;
+    m.cudaMinTexels = 512;
+    m.cudaFailed = false;
     m.cuda = NULL;
 
-    enableCudaAcceleration(m.cudaSupported);
-
     m.dispatcher = &m.defaultDispatcher;
+    m.pipelineEnabled = false;
+    m.memoryPoolEnabled = false;
+    m.determinismCheckEnabled = false;
+    m.lastPeakMemory = 0;
 }
 
 Compressor::~Compressor()
 {
+    enableMemoryPool(false);
+    m.releaseCudaContext();
     delete &m;
 }
 
 
 void Compressor::enableCudaAcceleration(bool enable)
 {
-    if (m.cudaSupported)
-    {
-        m.cudaEnabled = enable;
-    }
-
-    if (m.cudaEnabled && m.cuda == NULL)
-    {
-        m.cuda = new CudaContext();
-
-        if (!m.cuda->isValid())
-        {
-            m.cudaEnabled = false;
-            m.cuda = NULL;
-        }
-    }
+    m.cudaEnabled = enable;
 }
 
+// Creates the context to find out whether a device is usable.
 bool Compressor::isCudaAccelerationEnabled() const
 {
-    return m.cudaEnabled;
+    return m.cudaContext() != NULL;
+}
+
+void Compressor::setCudaDeviceMask(unsigned int mask)
+{
+    if (m.cudaDeviceMask != mask)
+    {
+        // The context of the new devices is created on first use.
+        m.releaseCudaContext();
+        m.cudaDeviceMask = mask;
+    }
 }
 
 void Compressor::setTaskDispatcher(TaskDispatcher * disp)
@@ -107,11 +157,258 @@ void Compressor::setTaskDispatcher(TaskDispatcher * disp)
     }
 }
 
+void Compressor::enablePipelining(bool enable)
+{
+    m.pipelineEnabled = enable;
+}
+
+bool Compressor::isPipeliningEnabled() const
+{
+    return m.pipelineEnabled;
+}
+
+void Compressor::setOutputCache(const char * directory, unsigned int maxMegabytes/*= 1024*/)
+{
+    if (directory == NULL) {
+        m.outputCache = NULL;
+    }
+    else {
+        m.outputCache = new OutputCache(directory, uint64(maxMegabytes) * 1024 * 1024);
+    }
+}
+
+void Compressor::enableMemoryPool(bool enable)
+{
+    if (m.memoryPoolEnabled != enable)
+    {
+        // An open job keeps the pool active between calls.
+        if (enable) beginPoolJob();
+        else endPoolJob();
+
+        m.memoryPoolEnabled = enable;
+    }
+}
+
+bool Compressor::isMemoryPoolEnabled() const
+{
+    return m.memoryPoolEnabled;
+}
+
+void Compressor::enableDeterminismCheck(bool enable)
+{
+    m.determinismCheckEnabled = enable;
+}
+
+bool Compressor::isDeterminismCheckEnabled() const
+{
+    return m.determinismCheckEnabled;
+}
+
+
+namespace
+{
+    // Stores the peak of the memory allocated during its lifetime, above the allocation at its construction.
+    struct MemoryWatermark
+    {
+        MemoryWatermark(size_t & peak) : peak(peak), base(mem::allocatedBytes()), tracker(mem::beginPeakTracking()) {}
+        ~MemoryWatermark() {
+            const size_t top = mem::endPeakTracking(tracker);
+            peak = top > base ? top - base : 0;
+        }
+
+        size_t & peak;
+        const size_t base;
+        const int tracker;
+    };
+}
 
 // Input Options API.
 bool Compressor::process(const InputOptions & inputOptions, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
 {
-    return m.compress(inputOptions.m, compressionOptions.m, outputOptions.m);
+    MemoryWatermark watermark(m.lastPeakMemory);
+
+    if (m.determinismCheckEnabled) {
+        return m.processChecked(inputOptions.m, compressionOptions.m, outputOptions.m, NULL, NULL);
+    }
+    return m.process(inputOptions.m, compressionOptions.m, outputOptions.m, NULL, NULL);
+}
+
+bool Compressor::process(const InputOptions & inputOptions, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions, const InputOptions & previousInputOptions, const char * previousFileName) const
+{
+    MemoryWatermark watermark(m.lastPeakMemory);
+
+    if (m.determinismCheckEnabled) {
+        return m.processChecked(inputOptions.m, compressionOptions.m, outputOptions.m, &previousInputOptions.m, previousFileName);
+    }
+    return m.process(inputOptions.m, compressionOptions.m, outputOptions.m, &previousInputOptions.m, previousFileName);
+}
+
+bool Compressor::process(const InputOptions & inputOptions, int targetCount, const CompressionOptions * const * compressionOptions, const OutputOptions * const * outputOptions) const
+{
+    if (targetCount <= 0) return false;
+
+    MemoryWatermark watermark(m.lastPeakMemory);
+
+    nv::Array<const CompressionOptions::Private *> compressionTargets;
+    nv::Array<const OutputOptions::Private *> outputTargets;
+    for (int t = 0; t < targetCount; t++) {
+        compressionTargets.append(&compressionOptions[t]->m);
+        outputTargets.append(&outputOptions[t]->m);
+    }
+
+    return m.compress(inputOptions.m, targetCount, compressionTargets.buffer(), outputTargets.buffer());
+}
+
+struct Job::Private
+{
+    Compressor::Private * compressor;
+    const InputOptions::Private * inputOptions;
+    const CompressionOptions::Private * compressionOptions;
+    OutputOptions::Private outputOptions;
+    JobHandler * handler;
+    bool result;
+
+    nv::AutoPtr<nv::TaskGroup> group;   // NULL until the job is started.
+};
+
+namespace
+{
+    // Loops of the jobs, on the same scheduler.
+    WorkStealingTaskDispatcher s_jobDispatcher;
+
+    void ProcessJobTask(void * context, int /*id*/)
+    {
+        Job::Private * job = (Job::Private *)context;
+        Compressor::Private & m = *job->compressor;
+
+        {
+            MemoryWatermark watermark(m.lastPeakMemory);
+
+            if (m.determinismCheckEnabled) {
+                job->result = m.processChecked(*job->inputOptions, *job->compressionOptions, job->outputOptions, NULL, NULL);
+            }
+            else {
+                job->result = m.process(*job->inputOptions, *job->compressionOptions, job->outputOptions, NULL, NULL);
+            }
+        }
+
+        if (job->handler != NULL) {
+            job->handler->jobFinished(job->result);
+        }
+    }
+}
+
+Job::Job() : m(*new Job::Private())
+{
+    m.compressor = NULL;
+    m.inputOptions = NULL;
+    m.compressionOptions = NULL;
+    m.handler = NULL;
+    m.result = false;
+}
+
+Job::~Job()
+{
+    wait();
+    delete &m;
+}
+
+bool Job::isDone() const
+{
+    return m.group == NULL || m.group->isDone();
+}
+
+bool Job::wait()
+{
+    if (m.group != NULL) {
+        m.group->wait();
+    }
+    return m.result;
+}
+
+void Compressor::processAsync(Job & job, const InputOptions & inputOptions, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions, JobHandler * handler/*= 0*/) const
+{
+    job.wait();
+
+    Job::Private & j = job.m;
+    j.compressor = &m;
+    j.inputOptions = &inputOptions.m;
+    j.compressionOptions = &compressionOptions.m;
+    j.outputOptions = outputOptions.m;
+    j.handler = handler;
+    j.result = false;
+
+    // The default dispatcher may start threads of its own, like OpenMP, inside each job.
+    if (m.dispatcher == &m.defaultDispatcher) {
+        j.outputOptions.dispatcher = &s_jobDispatcher;
+    }
+
+    TaskScheduler * scheduler = TaskScheduler::global();
+    if (scheduler->workerCount() == 0) {
+        j.group = NULL;
+        ProcessJobTask(&j, 0);
+        return;
+    }
+
+    j.group = new nv::TaskGroup(scheduler);
+    j.group->run(ProcessJobTask, &j);
+}
+
+size_t Compressor::estimatePeakMemory(const InputOptions & inputOptions, const CompressionOptions & compressionOptions) const
+{
+    const InputOptions::Private & io = inputOptions.m;
+
+    int w = io.width;
+    int h = io.height;
+    int d = io.depth;
+
+    getTargetExtent(&w, &h, &d, io.maxExtent, io.roundMode, io.textureType);
+
+    int mipmapCount = 1;
+    if (io.generateMipmaps) {
+        mipmapCount = countMipmaps(w, h, d);
+        if (io.maxLevel > 0) mipmapCount = min(mipmapCount, io.maxLevel);
+    }
+
+    // The surfaces hold four float channels.
+    const size_t texelSize = 4 * sizeof(float);
+    const size_t sourceBytes = texelSize * io.width * io.height * io.depth;
+    const size_t topBytes = texelSize * w * h * d;
+    const size_t topOutputBytes = estimateSize(w, h, d, 1, compressionOptions);
+    const size_t faceOutputBytes = estimateSize(w, h, d, mipmapCount, compressionOptions);
+
+    // The windows of blocks, the filter kernels and the rounding of the heap.
+    const size_t overhead = max(sourceBytes, topBytes) / 8;
+
+    // The source image, the image resized along x, and the resized image.
+    size_t facePeak = 0;
+    if (sourceBytes != topBytes) {
+        facePeak = sourceBytes + texelSize * w * io.height * io.depth + topBytes;
+    }
+
+    // The top level, the next level built before the top level is compressed, and the compressed level.
+    facePeak = max(facePeak, topBytes + (mipmapCount > 1 ? topBytes / 4 : 0) + 2 * topOutputBytes);
+
+    size_t peak;
+    if (m.pipelineEnabled) {
+        // The faces are built concurrently, and the levels wait for the compression with their images and then with their output.
+        const size_t concurrentFaces = min<size_t>(io.faceCount, max(1U, TaskScheduler::global()->workerCount()));
+        peak = concurrentFaces * max(facePeak, topBytes * 4 / 3) + io.faceCount * faceOutputBytes;
+    }
+    else if (io.faceCount > 1) {
+        // KTX outputs the faces of each level together, the output options aren't known here so assume it's buffered.
+        peak = facePeak + io.faceCount * faceOutputBytes;
+    }
+    else {
+        peak = facePeak;
+    }
+
+    return peak + overhead;
+}
+
+size_t Compressor::lastPeakMemory() const
+{
+    return m.lastPeakMemory;
 }
 
 int Compressor::estimateSize(const InputOptions & inputOptions, const CompressionOptions & compressionOptions) const
@@ -131,6 +428,89 @@ int Compressor::estimateSize(const InputOptions & inputOptions, const Compressio
     return inputOptions.m.faceCount * estimateSize(w, h, d, mipmapCount, compressionOptions);
 }
 
+namespace
+{
+    // Nanoseconds per 4x4 block of one thread, indexed by format and quality. Measured with blockbench on the natural corpus.
+    // The formats that are not supported cost nothing, the uncompressed ones are only converted.
+    static const float s_blockCost[Format_Count][4] = {
+        //  Fastest     Normal      Production  Highest
+        {   45,         45,         45,         45          },  // RGB
+        {   515,        10560,      10550,      10940       },  // BC1
+        {   580,        15580,      14650,      14610       },  // BC1a
+        {   580,        12590,      13060,      13630       },  // BC2
+        {   1005,       13360,      13380,      13110       },  // BC3
+        {   1090,       5290,       5300,       22120       },  // BC3n
+        {   557,        1961,       20800,      20400       },  // BC4
+        {   990,        3614,       39680,      41630       },  // BC5
+        {   0,          0,          0,          0           },  // DXT1n
+        {   0,          0,          0,          0           },  // CTX1
+        {   127000,     124000,     126000,     128000      },  // BC6
+        {   2196000,    3778000,    12154000,   11490000    },  // BC7
+        {   990,        3614,       39680,      41630       },  // BC5_Luma
+        {   1005,       13360,      13380,      13110       },  // BC3_RGBM
+        {   1005,       13360,      13380,      13110       },  // BC3_YCoCg
+        {   990,        3614,       39680,      41630       },  // BC5_Normal
+    };
+
+    // Nanoseconds per block of the CUDA compressors, only a rough figure, they are bound by the transfers on most devices.
+    static const float s_gpuBlockCost = 50;
+
+    // Nanoseconds per texel of the conversion of the input and the quantization of the output, of the conversions to and from
+    // linear space, and per output texel of each mipmap filter.
+    static const float s_texelCost = 45;
+    static const float s_gammaTexelCost = 35;
+    static const float s_filterTexelCost[3] = { 4, 175, 210 };  // Box, Triangle, Kaiser
+}
+
+float Compressor::estimateCost(const InputOptions & inputOptions, const CompressionOptions & compressionOptions, float * gpuSeconds/*= 0*/) const
+{
+    const InputOptions::Private & io = inputOptions.m;
+    const CompressionOptions::Private & co = compressionOptions.m;
+
+    int w = io.width;
+    int h = io.height;
+    int d = io.depth;
+
+    getTargetExtent(&w, &h, &d, io.maxExtent, io.roundMode, io.textureType);
+
+    int mipmapCount = 1;
+    if (io.generateMipmaps) {
+        mipmapCount = countMipmaps(w, h, d);
+        if (io.maxLevel > 0) mipmapCount = min(mipmapCount, io.maxLevel);
+    }
+
+    const float blockCost = s_blockCost[co.format][co.quality];
+    const float filterCost = s_filterTexelCost[clamp(int(io.mipmapFilter), 0, 2)];
+    const bool convertGamma = !io.isNormalMap && io.inputGamma != io.outputGamma;
+
+    AutoPtr<CompressorInterface> gpuCompressor;
+    if (hasGpuCompressor(co) && m.cudaContext() != NULL) {
+        gpuCompressor = m.chooseGpuCompressor(co);
+    }
+
+    double cpu = 0, gpu = 0;
+    for (int l = 0; l < mipmapCount; l++)
+    {
+        const double texelCount = double(w) * h * d;
+        const double blockCount = double((w + 3) / 4) * ((h + 3) / 4) * d;
+
+        cpu += s_texelCost * texelCount;
+        if (convertGamma) cpu += 2 * s_gammaTexelCost * texelCount;
+        if (l > 0) cpu += filterCost * texelCount;
+
+        if (gpuCompressor != NULL && d == 1 && uint(w * h) >= m.cudaMinTexels) gpu += s_gpuBlockCost * blockCount;
+        else cpu += blockCost * blockCount;
+
+        w = max(1, w / 2);
+        h = max(1, h / 2);
+        d = max(1, d / 2);
+    }
+
+    if (gpuSeconds != NULL) *gpuSeconds = float(io.faceCount * gpu * 1e-9);
+
+    return float(io.faceCount * cpu * 1e-9);
+}
+
 
 // Surface API.
 bool Compressor::outputHeader(const Surface & tex, int mipmapCount, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
@@ -152,189 +532,1873 @@ int Compressor::estimateSize(const Surface & tex, int mipmapCount, const Compres
     return estimateSize(w, h, d, mipmapCount, compressionOptions);
 }
 
-bool Compressor::outputHeader(const CubeSurface & cube, int mipmapCount, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
+namespace
 {
-    return m.outputHeader(TextureType_Cube, cube.edgeLength(), cube.edgeLength(), 1, mipmapCount, false, compressionOptions.m, outputOptions.m);
-}
+    // Writes the compressed blocks of a region to their place in the compressed image.
+    struct RegionOutputHandler : public OutputHandler
+    {
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel) {}
 
-bool Compressor::compress(const CubeSurface & cube, int mipmap, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
-{
-    for (int i = 0; i < 6; i++) {
-        if(!m.compress(cube.face(i), i, mipmap, compressionOptions.m, outputOptions.m)) {
-            return false;
+        virtual bool writeData(const void * data, int size)
+        {
+            const uint8 * src = (const uint8 *)data;
+
+            while (size > 0)
+            {
+                const uint row = offset / rowSize;
+                const uint column = offset % rowSize;
+                const uint count = min(uint(size), rowSize - column);
+                if (row >= rowCount) return false;
+
+                memcpy(output + row * pitch + column, src, count);
+                src += count;
+                size -= count;
+                offset += count;
+            }
+
+            return true;
         }
-    }
-    return true;
+
+        virtual void endImage() {}
+
+        uint8 * output;     // First block of the region.
+        uint pitch;         // Bytes per block row of the image.
+        uint rowSize;       // Bytes per block row of the region.
+        uint rowCount;
+        uint offset;        // Bytes of the region written so far.
+    };
 }
 
-int Compressor::estimateSize(const CubeSurface & cube, int mipmapCount, const CompressionOptions & compressionOptions) const
+bool Compressor::compressRegion(const Surface & img, int x, int y, int w, int h, const CompressionOptions & compressionOptions, void * output, int outputSize, int pitch/*= 0*/) const
 {
-    return 6 * estimateSize(cube.edgeLength(), cube.edgeLength(), 1, mipmapCount, compressionOptions);
-}
+    const Format format = compressionOptions.m.format;
+    if (img.isNull() || img.depth() != 1 || format == Format_RGB || output == NULL) {
+        return false;
+    }
+    if (x < 0 || y < 0 || w <= 0 || h <= 0 || (x & 3) != 0 || (y & 3) != 0 || x + w > img.width() || y + h > img.height()) {
+        return false;
+    }
 
+    const uint bs = computeImageSize(4, 4, 1, 0, 0, format);
 
-// Raw API.
-bool Compressor::outputHeader(TextureType type, int w, int h, int d, int mipmapCount, bool isNormalMap, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
-{
-    return m.outputHeader(type, w, h, d, mipmapCount, isNormalMap, compressionOptions.m, outputOptions.m);
-}
+    RegionOutputHandler handler;
+    handler.rowSize = ((w + 3) / 4) * bs;
+    handler.rowCount = (h + 3) / 4;
+    handler.pitch = pitch > 0 ? uint(pitch) : handler.rowSize;
+    handler.output = (uint8 *)output;
+    handler.offset = 0;
 
-bool Compressor::compress(int w, int h, int d, int face, int mipmap, const float * rgba, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
-{
-    return m.compress(AlphaMode_None, w, h, d, face, mipmap, rgba, compressionOptions.m, outputOptions.m);
+    if (handler.pitch < handler.rowSize || outputSize < 0 || uint(outputSize) < (handler.rowCount - 1) * handler.pitch + handler.rowSize) {
+        return false;
+    }
+
+    // Compress the region as an image of its own, the blocks don't depend on each other.
+    Surface region = img.createSubImage(x, x + w - 1, y, y + h - 1, 0, 0);
+
+    OutputOptions outputOptions;
+    outputOptions.setOutputHandler(&handler);
+    outputOptions.setOutputHeader(false);
+
+    return m.compress(img.alphaMode(), w, h, 1, 0, 0, region.data(), compressionOptions.m, outputOptions.m);
 }
 
-int Compressor::estimateSize(int w, int h, int d, int mipmapCount, const CompressionOptions & compressionOptions) const
+bool Compressor::compressDirtyRegion(const Surface & img, const CompressionOptions & compressionOptions, void * output, int outputSize) const
 {
     const Format format = compressionOptions.m.format;
+    if (img.isNull() || img.depth() != 1 || format == Format_RGB || output == NULL) {
+        return false;
+    }
 
-    const uint bitCount = compressionOptions.m.getBitCount();
-    const uint pitchAlignment = compressionOptions.m.pitchAlignment;
-
-    int size = 0;
-    for (int m = 0; m < mipmapCount; m++)
-    {
-        size += computeImageSize(w, h, d, bitCount, pitchAlignment, format);
+    const uint w = img.width();
+    const uint h = img.height();
+    if (outputSize < 0 || uint(outputSize) < computeImageSize(w, h, 1, 0, 0, format)) {
+        return false;
+    }
 
-        // Compute extents of next mipmap:
-        w = max(1, w / 2);
-        h = max(1, h / 2);
-        d = max(1, d / 2);
+    int x, y, rw, rh;
+    if (!img.dirtyRegion(&x, &y, &rw, &rh)) {
+        return true;
     }
 
-    return size;
+    // Recompress the blocks that overlap the region in place.
+    const uint x0 = uint(x) & ~3U;
+    const uint y0 = uint(y) & ~3U;
+    const uint x1 = min(w, (uint(x + rw) + 3) & ~3U);
+    const uint y1 = min(h, (uint(y + rh) + 3) & ~3U);
+
+    const uint bs = computeImageSize(4, 4, 1, 0, 0, format);
+    const uint pitch = ((w + 3) / 4) * bs;
+    const uint offset = (y0 / 4) * pitch + (x0 / 4) * bs;
+
+    return compressRegion(img, x0, y0, x1 - x0, y1 - y0, compressionOptions, (uint8 *)output + offset, outputSize - offset, pitch);
 }
 
+namespace
+{
+    struct FormatCandidate
+    {
+        Format format;
+        Quality quality;
+    };
 
+    // Candidates of selectFormat from the cheapest to the most expensive: by size first, then by compression time.
+    const FormatCandidate kFormatCandidates[] =
+    {
+        { Format_BC1, Quality_Fastest }, { Format_BC1, Quality_Normal }, { Format_BC1, Quality_Production }, { Format_BC1, Quality_Highest },
+        { Format_BC3, Quality_Fastest }, { Format_BC3, Quality_Normal }, { Format_BC3, Quality_Production }, { Format_BC3, Quality_Highest },
+        { Format_BC7, Quality_Fastest }, { Format_BC7, Quality_Normal }, { Format_BC7, Quality_Production }, { Format_BC7, Quality_Highest },
+    };
 
+    // selectFormat compresses about 1 in kSampleFraction blocks, at least kMinSampleBlocks and at most kMaxSampleBlocks.
+    const uint kSampleFraction = 32;
+    const uint kMinSampleBlocks = 64;
+    const uint kMaxSampleBlocks = 1024;
 
+    struct NullOutputHandler : public OutputHandler
+    {
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel) {}
+        virtual bool writeData(const void * data, int size) { return true; }
+        virtual void endImage() {}
+    };
 
-bool Compressor::Private::compress(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
-{
-    // Make sure enums match.
-    nvStaticCheck(FloatImage::WrapMode_Clamp == (FloatImage::WrapMode)WrapMode_Clamp);
-    nvStaticCheck(FloatImage::WrapMode_Mirror == (FloatImage::WrapMode)WrapMode_Mirror);
-    nvStaticCheck(FloatImage::WrapMode_Repeat == (FloatImage::WrapMode)WrapMode_Repeat);
+    struct SampleErrorHandler : public ImageErrorHandler
+    {
+        virtual void imageError(float rmsError, float psnr) { this->rmsError = rmsError; }
+        float rmsError;
+    };
 
-    // Get output handler.
-    if (!outputOptions.hasValidOutputHandler()) {
-        outputOptions.error(Error_FileOpen);
-        return false;
-    }
+    // Tile the blocks of a regular grid over the first slice of img into a smaller surface with the same settings.
+    void sampleBlocks(const Surface & img, Surface * sample)
+    {
+        const uint w = img.width();
+        const uint h = img.height();
+        const uint bw = (w + 3) / 4;
+        const uint bh = (h + 3) / 4;
 
-    nvtt::Surface img;
-    img.setWrapMode(inputOptions.wrapMode);
-    img.setAlphaMode(inputOptions.alphaMode);
-    img.setNormalMap(inputOptions.isNormalMap);
+        const uint total = bw * bh;
+        const uint target = clamp(total / kSampleFraction, min(total, kMinSampleBlocks), kMaxSampleBlocks);
+        const uint step = max(1U, uint(sqrtf(float(total) / float(target))));
 
-    const int faceCount = inputOptions.faceCount;
-    int width = inputOptions.width;
-    int height = inputOptions.height;
-    int depth = inputOptions.depth;
+        const uint cols = (bw + step - 1) / step;
+        const uint rows = (bh + step - 1) / step;
+        const uint sw = 4 * cols;
+        const uint sh = 4 * rows;
 
-    nv::getTargetExtent(&width, &height, &depth, inputOptions.maxExtent, inputOptions.roundMode, inputOptions.textureType);
+        Array<float> texels;
+        texels.resize(4 * sw * sh);
 
-    // If the extents have not changed, then we can use source images for all mipmaps.
-    bool canUseSourceImages = (inputOptions.width == width && inputOptions.height == height && inputOptions.depth == depth);
+        for (uint c = 0; c < 4; c++)
+        {
+            const float * src = img.channel(c);
+            float * dst = texels.buffer() + c * sw * sh;
 
-    int mipmapCount = 1;
-    if (inputOptions.generateMipmaps) {
-        mipmapCount = countMipmaps(width, height, depth);
-        if (inputOptions.maxLevel > 0) mipmapCount = min(mipmapCount, inputOptions.maxLevel);
-    }
+            for (uint y = 0; y < sh; y++)
+            {
+                const uint by = min((y / 4) * step + step / 2, bh - 1);
+                const uint sy = min(4 * by + y % 4, h - 1);
 
-    if (!outputHeader(inputOptions.textureType, width, height, depth, mipmapCount, img.isNormalMap(), compressionOptions, outputOptions)) {
-        return false;
+                for (uint x = 0; x < sw; x++)
+                {
+                    const uint bx = min((x / 4) * step + step / 2, bw - 1);
+                    const uint sx = min(4 * bx + x % 4, w - 1);
+
+                    dst[y * sw + x] = src[sy * w + sx];
+                }
+            }
+        }
+
+        const float * planes = texels.buffer();
+        sample->setImage(InputFormat_RGBA_32F, sw, sh, 1, planes, planes + sw * sh, planes + 2 * sw * sh, planes + 3 * sw * sh);
+        sample->setWrapMode(img.wrapMode());
+        sample->setAlphaMode(img.alphaMode());
+        sample->setNormalMap(img.isNormalMap());
+    }
+}
+
+bool Compressor::selectFormat(const Surface & img, float targetError, CompressionOptions & compressionOptions, Format * formatPtr/*= 0*/, Quality * qualityPtr/*= 0*/, float * errorPtr/*= 0*/) const
+{
+    if (img.isNull()) return false;
+
+    Surface sample;
+    sampleBlocks(img, &sample);
+
+    // BC1 drops the alpha of images that use it.
+    bool hasAlpha = false;
+    if (img.alphaMode() != AlphaMode_None) {
+        float alphaMin, alphaMax;
+        img.range(3, &alphaMin, &alphaMax);
+        hasAlpha = alphaMin < 1.0f;
+    }
+
+    NullOutputHandler outputHandler;
+    SampleErrorHandler errorHandler;
+
+    OutputOptions outputOptions;
+    outputOptions.setOutputHandler(&outputHandler);
+    outputOptions.setOutputHeader(false);
+    outputOptions.setImageErrorHandler(&errorHandler);
+
+    // The trials keep all the other settings of the compression options.
+    CompressionOptions trial;
+    trial.m = compressionOptions.m;
+
+    bool found = false;
+    FormatCandidate best = { Format_BC7, Quality_Highest };
+    float bestError = FLT_MAX;
+
+    const uint candidateCount = sizeof(kFormatCandidates) / sizeof(kFormatCandidates[0]);
+    for (uint i = 0; i < candidateCount && !found; i++)
+    {
+        const FormatCandidate & candidate = kFormatCandidates[i];
+        if (candidate.format == Format_BC1 && hasAlpha) continue;
+
+        trial.setFormat(candidate.format);
+        trial.setQuality(candidate.quality);
+
+        errorHandler.rmsError = FLT_MAX;
+        if (!compress(sample, 0, 0, trial, outputOptions)) continue;
+
+        // Without a candidate that meets the target, keep the one with the lowest error.
+        found = errorHandler.rmsError <= targetError;
+        if (found || errorHandler.rmsError < bestError) {
+            best = candidate;
+            bestError = errorHandler.rmsError;
+        }
+    }
+
+    compressionOptions.setFormat(best.format);
+    compressionOptions.setQuality(best.quality);
+
+    if (formatPtr != NULL) *formatPtr = best.format;
+    if (qualityPtr != NULL) *qualityPtr = best.quality;
+    if (errorPtr != NULL) *errorPtr = bestError;
+
+    return found;
+}
+
+bool Compressor::outputHeader(const CubeSurface & cube, int mipmapCount, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
+{
+    return m.outputHeader(TextureType_Cube, cube.edgeLength(), cube.edgeLength(), 1, mipmapCount, false, compressionOptions.m, outputOptions.m);
+}
+
+bool Compressor::compress(const CubeSurface & cube, int mipmap, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
+{
+    for (int i = 0; i < 6; i++) {
+        if(!m.compress(cube.face(i), i, mipmap, compressionOptions.m, outputOptions.m)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int Compressor::estimateSize(const CubeSurface & cube, int mipmapCount, const CompressionOptions & compressionOptions) const
+{
+    return 6 * estimateSize(cube.edgeLength(), cube.edgeLength(), 1, mipmapCount, compressionOptions);
+}
+
+bool Compressor::compressCubeArray(const CubeSurface * mipmaps, int cubeCount, int mipmapCount, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
+{
+    return m.compressCubeArray(mipmaps, cubeCount, mipmapCount, compressionOptions.m, outputOptions.m);
+}
+
+bool Compressor::transcode(const char * fileName, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
+{
+    return m.transcode(fileName, compressionOptions.m, outputOptions.m);
+}
+
+
+// Raw API.
+bool Compressor::outputHeader(TextureType type, int w, int h, int d, int mipmapCount, bool isNormalMap, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
+{
+    return m.outputHeader(type, w, h, d, mipmapCount, isNormalMap, compressionOptions.m, outputOptions.m);
+}
+
+bool Compressor::compress(int w, int h, int d, int face, int mipmap, const float * rgba, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const
+{
+    return m.compress(AlphaMode_None, w, h, d, face, mipmap, rgba, compressionOptions.m, outputOptions.m);
+}
+
+int Compressor::estimateSize(int w, int h, int d, int mipmapCount, const CompressionOptions & compressionOptions) const
+{
+    const Format format = compressionOptions.m.format;
+
+    const uint bitCount = compressionOptions.m.getBitCount();
+    const uint pitchAlignment = compressionOptions.m.pitchAlignment;
+
+    int size = 0;
+    for (int m = 0; m < mipmapCount; m++)
+    {
+        size += computeImageSize(w, h, d, bitCount, pitchAlignment, format);
+
+        // Compute extents of next mipmap:
+        w = max(1, w / 2);
+        h = max(1, h / 2);
+        d = max(1, d / 2);
+    }
+
+    return size;
+}
+
+
+
+
+
+namespace
+{
+    // Captures the output of the compression of one image, so that it can be produced out of order and handed to the real output handler later.
+    // With a positional output the image is not captured, its data goes straight to its offset in the output.
+    struct BufferedLevel : public nvtt::OutputHandler, public nvtt::ErrorHandler
+    {
+        BufferedLevel() : face(0), mipmap(0), isGamma(false), size(0), width(0), height(0), depth(0), begun(false), ended(false),
+            positionalOptions(NULL), positionalOffset(0), positionalMutex(NULL) {}
+
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel)
+        {
+            this->size = size;
+            this->width = width;
+            this->height = height;
+            this->depth = depth;
+            this->begun = true;
+            nvDebugCheck(face == this->face && miplevel == this->mipmap);
+
+            if (positionalOptions != NULL) {
+                nv::Lock<nv::Mutex> lock(*positionalMutex);
+                positionalOptions->beginImage(size, width, height, depth, face, miplevel);
+            }
+        }
+
+        virtual bool writeData(const void * data, int size)
+        {
+            if (positionalOptions != NULL) {
+                const size_t offset = positionalOffset;
+                positionalOffset += size;
+                return positionalOptions->writeDataAt(offset, data, size);
+            }
+
+            const uint offset = buffer.count();
+            buffer.resize(offset + size);
+            memcpy(buffer.buffer() + offset, data, size);
+            return true;
+        }
+
+        virtual void endImage()
+        {
+            ended = true;
+
+            if (positionalOptions != NULL) {
+                nv::Lock<nv::Mutex> lock(*positionalMutex);
+                positionalOptions->endImage();
+            }
+        }
+
+        virtual void error(Error e)
+        {
+            if (positionalOptions != NULL) {
+                nv::Lock<nv::Mutex> lock(*positionalMutex);
+                positionalOptions->error(e);
+                return;
+            }
+            errors.append(e);
+        }
+
+        // Send the image at the given offset of the positional output of the options, instead of capturing it.
+        void setPositional(const OutputOptions::Private * outputOptions, size_t offset, nv::Mutex * mutex)
+        {
+            positionalOptions = outputOptions;
+            positionalOffset = offset;
+            positionalMutex = mutex;
+        }
+
+        void flush(const OutputOptions::Private & outputOptions) const
+        {
+            if (positionalOptions != NULL) return; // Already output.
+
+            if (begun) outputOptions.beginImage(size, width, height, depth, face, mipmap);
+            for (uint i = 0; i < errors.count(); i++) {
+                outputOptions.error(errors[i]);
+            }
+            if (!buffer.isEmpty()) outputOptions.writeData(buffer.buffer(), buffer.count());
+            if (ended) outputOptions.endImage();
+        }
+
+        nvtt::Surface image;
+        nvtt::Surface previousImage;    // Only used for incremental compression.
+        int face;
+        int mipmap;
+        bool isGamma;                   // The images are already in the output color space.
+
+        int size, width, height, depth;
+        bool begun, ended;
+        nv::Array<uint8> buffer;
+        nv::Array<Error> errors;
+
+        const OutputOptions::Private * positionalOptions;
+        size_t positionalOffset;        // Of the next write.
+        nv::Mutex * positionalMutex;    // Serializes the calls other than writeDataAt, shared by the levels.
+    };
+
+    // Fields of the blocks that supercompression groups together.
+    uint supercompressionLayout(Format format)
+    {
+        switch (format) {
+            case Format_BC1: case Format_BC1a: case Format_DXT1n: case Format_CTX1: return BlockLayout_BC1;
+            case Format_BC2: return BlockLayout_BC2;
+            case Format_BC3: case Format_BC3n: case Format_BC3_RGBM: case Format_BC3_YCoCg: return BlockLayout_BC3;
+            case Format_BC4: return BlockLayout_BC4;
+            case Format_BC5: case Format_BC5_Luma: case Format_BC5_Normal: return BlockLayout_BC5;
+            default: return BlockLayout_None;
+        }
+    }
+
+    // Append the blocks of the size x size square at x, y of a bw x bh surface to the output in Morton order.
+    void appendMorton(const uint8 * blocks, uint bs, uint bw, uint bh, uint x, uint y, uint size, Array<uint8> * output)
+    {
+        if (x >= bw || y >= bh) return;
+
+        if (size == 1) {
+            output->append(blocks + (y * bw + x) * bs, bs);
+            return;
+        }
+
+        const uint half = size / 2;
+        appendMorton(blocks, bs, bw, bh, x, y, half, output);
+        appendMorton(blocks, bs, bw, bh, x + half, y, half, output);
+        appendMorton(blocks, bs, bw, bh, x, y + half, half, output);
+        appendMorton(blocks, bs, bw, bh, x + half, y + half, half, output);
+    }
+
+    // Interleave the bits of x and y, x first.
+    inline uint mortonCode(uint x, uint y)
+    {
+        uint code = 0;
+        for (uint i = 0; i < 16; i++) {
+            code |= ((x >> i) & 1) << (2 * i);
+            code |= ((y >> i) & 1) << (2 * i + 1);
+        }
+        return code;
+    }
+
+    // Reorder the linear blocks of a bw x bh surface to the tile mode. Returns false when the mode doesn't support the block size.
+    bool tileBlocks(TileMode mode, uint bs, uint bw, uint bh, const uint8 * blocks, Array<uint8> * output)
+    {
+        output->clear();
+
+        if (mode == TileMode_Morton) {
+            output->reserve(bw * bh * bs);
+            appendMorton(blocks, bs, bw, bh, 0, 0, nextPowerOfTwo(max(bw, bh)), output);
+            return true;
+        }
+
+        nvDebugCheck(mode == TileMode_StandardSwizzle64KB);
+        if (bs != 8 && bs != 16) return false;
+
+        // Each tile is a row of 64x64 Morton squares.
+        const uint tileWidth = bs == 8 ? 128 : 64;
+        const uint tileHeight = 64;
+        const uint tileSize = 64 * 1024;
+        const uint tilesPerRow = (bw + tileWidth - 1) / tileWidth;
+        const uint tileRows = (bh + tileHeight - 1) / tileHeight;
+
+        output->resize(tilesPerRow * tileRows * tileSize);
+        memset(output->buffer(), 0, output->count());
+
+        for (uint y = 0; y < bh; y++) {
+            for (uint x = 0; x < bw; x++) {
+                const uint tx = x % tileWidth;
+                const uint ty = y % tileHeight;
+                const uint tile = (y / tileHeight) * tilesPerRow + x / tileWidth;
+                const uint index = (tx / 64) * 64 * 64 + mortonCode(tx % 64, ty);
+                memcpy(output->buffer() + tile * tileSize + index * bs, blocks + (y * bw + x) * bs, bs);
+            }
+        }
+        return true;
+    }
+
+    // Collects the output of an image and outputs it tiled and supercompressed when the image ends. Only redirects the output
+    // when tiling or supercompression is enabled.
+    struct SupercompressionHandler : public nvtt::OutputHandler
+    {
+        SupercompressionHandler(const OutputOptions::Private & outputOptions, Format format) :
+            outputOptions(outputOptions), bufferedOptions(outputOptions), layout(supercompressionLayout(format)),
+            blockSize(format == Format_RGBA ? 0 : computeImageSize(4, 4, 1, 0, 0, format)), width(0), height(0), depth(0), face(0), mipmap(0)
+        {
+            bufferedOptions.outputHandler = this;
+        }
+
+        // The options to compress the image with.
+        const OutputOptions::Private & options() const
+        {
+            const bool buffered = outputOptions.supercompression != nvtt::Supercompression_None || outputOptions.tileMode != TileMode_Linear;
+            return buffered ? bufferedOptions : outputOptions;
+        }
+
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel)
+        {
+            this->width = width;
+            this->height = height;
+            this->depth = depth;
+            this->face = face;
+            this->mipmap = miplevel;
+        }
+
+        virtual bool writeData(const void * data, int size)
+        {
+            buffer.append((const uint8 *)data, size);
+            return true;
+        }
+
+        virtual void endImage()
+        {
+            // Only block compressed 2D surfaces can be tiled.
+            if (outputOptions.tileMode != TileMode_Linear) {
+                const uint bw = (width + 3) / 4;
+                const uint bh = (height + 3) / 4;
+                Array<uint8> tiled;
+                if (blockSize == 0 || depth != 1 || buffer.count() != bw * bh * blockSize ||
+                    !tileBlocks(outputOptions.tileMode, blockSize, bw, bh, buffer.buffer(), &tiled))
+                {
+                    outputOptions.error(Error_UnsupportedFeature);
+                    buffer.clear();
+                    return;
+                }
+                swap(buffer, tiled);
+            }
+
+            if (outputOptions.supercompression == nvtt::Supercompression_None) {
+                outputOptions.beginImage(buffer.count(), width, height, depth, face, mipmap);
+                if (!outputOptions.writeData(buffer.buffer(), buffer.count())) {
+                    outputOptions.error(Error_FileWrite);
+                }
+                outputOptions.endImage();
+
+                buffer.clear();
+                return;
+            }
+
+            // KTX has no field for the scheme.
+            Array<uint8> encoded;
+            if (outputOptions.container == Container_KTX ||
+                !nv::supercompress(outputOptions.supercompression, outputOptions.supercompressionLevel, layout, buffer.buffer(), buffer.count(), &encoded))
+            {
+                outputOptions.error(Error_UnsupportedFeature);
+                buffer.clear();
+                return;
+            }
+
+            outputOptions.beginImage(encoded.count(), width, height, depth, face, mipmap);
+            if (!outputOptions.writeData(encoded.buffer(), encoded.count())) {
+                outputOptions.error(Error_FileWrite);
+            }
+            outputOptions.endImage();
+
+            buffer.clear();
+        }
+
+        const OutputOptions::Private & outputOptions;
+        OutputOptions::Private bufferedOptions;
+        const uint layout;
+        const uint blockSize;   // 0 for the formats without blocks.
+        int width, height, depth, face, mipmap;
+        nv::Array<uint8> buffer;
+    };
+}
+
+struct Compressor::Private::MipmapChain
+{
+    MipmapChain(const Compressor::Private * compressor, const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) :
+        compressor(compressor), inputOptions(inputOptions), compressionOptions(compressionOptions), outputOptions(outputOptions), next(NULL), group(NULL), previousInputOptions(NULL) {}
+
+    // Any of the targets fed by this chain was cancelled.
+    bool isCancelled() const
+    {
+        for (const MipmapChain * target = this; target != NULL; target = target->next) {
+            if (target->outputOptions.isCancelled()) return true;
+        }
+        return false;
+    }
+
+    const Compressor::Private * compressor;
+    const InputOptions::Private & inputOptions;
+    const CompressionOptions::Private & compressionOptions;
+    const OutputOptions::Private & outputOptions;
+
+    int width, height, depth;   // Extents of the first level.
+    int mipmapCount;
+    bool canUseSourceImages;
+
+    // The next target compressed from the levels of this chain, with options of its own. The first chain builds the levels.
+    MipmapChain * next;
+
+    // Only used when pipelining.
+    nv::TaskGroup * group;
+    nv::Array<BufferedLevel> levels;  // faceCount * mipmapCount, face major. Also used to reorder the output without pipelining.
+    nv::Mutex positionalMutex;        // Only used with a positional output.
+
+    // Only used for incremental compression.
+    const InputOptions::Private * previousInputOptions;
+    nv::Array<uint8> previousBlocks;    // Compressed levels of the previous output.
+    nv::Array<uint> previousOffsets;    // Offset of each level in previousBlocks, faceCount * mipmapCount, face major.
+};
+
+namespace
+{
+    struct CubeArrayContext
+    {
+        const Compressor::Private * compressor;
+        const CompressionOptions::Private * compressionOptions;
+        const OutputOptions::Private * outputOptions;
+        nv::Array<BufferedLevel> levels;    // cubeCount * 6 * mipmapCount, in the order of the output.
+    };
+
+    void CompressCubeArrayTask(void * context, int idx)
+    {
+        CubeArrayContext * ctx = (CubeArrayContext *)context;
+        BufferedLevel & level = ctx->levels[idx];
+
+        // Redirect the output to the buffer of this level.
+        OutputOptions::Private outputOptions = *ctx->outputOptions;
+        outputOptions.outputHandler = &level;
+        outputOptions.errorHandler = &level;
+
+        ctx->compressor->compress(level.image, level.face, level.mipmap, *ctx->compressionOptions, outputOptions);
+    }
+
+    void CompressFaceTask(void * context, int face)
+    {
+        Compressor::Private::MipmapChain * chain = (Compressor::Private::MipmapChain *)context;
+        chain->compressor->compressFace(*chain, face);
+    }
+
+    void CompressLevelTask(void * context, int idx)
+    {
+        Compressor::Private::MipmapChain * chain = (Compressor::Private::MipmapChain *)context;
+        BufferedLevel & level = chain->levels[idx];
+
+        // Redirect the output to the buffer of this level.
+        OutputOptions::Private outputOptions = chain->outputOptions;
+        outputOptions.outputHandler = &level;
+        outputOptions.errorHandler = &level;
+
+        chain->compressor->processLevel(*chain, level.image, level.previousImage, level.face, level.mipmap, level.isGamma, outputOptions);
+
+        level.image = nvtt::Surface();  // Release the uncompressed images as soon as possible.
+        level.previousImage = nvtt::Surface();
+    }
+
+    // Set the top level of the given face and bring it to the linear space and extents of the mipmap chain. The texels
+    // are read from the images of source, that may be borrowed from the caller with a row pitch.
+    void loadFace(nvtt::Surface & img, const InputOptions::Private & inputOptions, const InputOptions::Private & source, int f, int w, int h, int d)
+    {
+        const void * image = source.images[f];
+        const uint pitch = source.pitches[f];
+
+        img.setWrapMode(inputOptions.wrapMode);
+        img.setAlphaMode(inputOptions.alphaMode);
+        img.setNormalMap(inputOptions.isNormalMap);
+
+        if (inputOptions.convertToNormalMap) {
+            nvtt::setImageLinear(img, inputOptions.inputFormat, inputOptions.width, inputOptions.height, inputOptions.depth, image, pitch, 1.0f);
+            img.toGreyScale(inputOptions.heightFactors.x, inputOptions.heightFactors.y, inputOptions.heightFactors.z, inputOptions.heightFactors.w);
+            img.toNormalMap(inputOptions.bumpFrequencyScale.x, inputOptions.bumpFrequencyScale.y, inputOptions.bumpFrequencyScale.z, inputOptions.bumpFrequencyScale.w);
+        }
+        else if (img.isNormalMap()) {
+            nvtt::setImageLinear(img, inputOptions.inputFormat, inputOptions.width, inputOptions.height, inputOptions.depth, image, pitch, 1.0f);
+        }
+        else {
+            // To linear space as the texels are converted.
+            nvtt::setImageLinear(img, inputOptions.inputFormat, inputOptions.width, inputOptions.height, inputOptions.depth, image, pitch, inputOptions.inputGamma);
+        }
+
+        // Resize input.
+        img.resize(w, h, d, ResizeFilter_Box);
+
+        // The mipmaps built from the top level keep its alpha test coverage.
+        if (inputOptions.keepAlphaCoverage) {
+            img.setMipmapAlphaCoverage(img.alphaTestCoverage(inputOptions.alphaCoverageRef), inputOptions.alphaCoverageRef);
+        }
+    }
+
+    // Replace the image with the next level of the chain, either the given source image, whose rows are pitch bytes apart,
+    // or a level built from the image.
+    void nextMipmap(nvtt::Surface & img, const InputOptions::Private & inputOptions, const void * source, uint pitch, int w, int h, int d)
+    {
+        bool normalize = img.isNormalMap() && inputOptions.normalizeMipmaps;
+
+        if (source != NULL) {
+            // For already generated mipmaps, we need to convert to linear.
+            if (img.isNormalMap()) {
+                nvtt::setImageLinear(img, inputOptions.inputFormat, w, h, d, source, pitch, 1.0f);
+            }
+            else {
+                nvtt::setImageLinear(img, inputOptions.inputFormat, w, h, d, source, pitch, inputOptions.inputGamma);
+            }
+        }
+        else if (inputOptions.mipmapFilter == MipmapFilter_Kaiser) {
+            float params[2] = { inputOptions.kaiserStretch, inputOptions.kaiserAlpha };
+            img.buildNextMipmap(MipmapFilter_Kaiser, inputOptions.kaiserWidth, params);
+        }
+        else if (normalize) {
+            // The normals are renormalized as the rows of the level are filtered.
+            img.buildNextNormalMipmap(inputOptions.mipmapFilter, true);
+            normalize = false;
+        }
+        else {
+            img.buildNextMipmap(inputOptions.mipmapFilter);
+        }
+        nvDebugCheck(img.width() == w);
+        nvDebugCheck(img.height() == h);
+        nvDebugCheck(img.depth() == d);
+
+        if (normalize) {
+            img.normalizeNormalMap();
+        }
+    }
+}
+
+// Number of 4x4 blocks of a mipmap chain, the unit of the progress of a compression.
+static uint blockCount(int w, int h, int d, int mipmapCount)
+{
+    uint count = 0;
+    for (int m = 0; m < mipmapCount; m++) {
+        count += ((w + 3) / 4) * ((h + 3) / 4) * d;
+        w = max(1, w / 2);
+        h = max(1, h / 2);
+        d = max(1, d / 2);
+    }
+    return count;
+}
+
+bool Compressor::Private::compress(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, const InputOptions::Private * previousInputOptions/*= NULL*/, const char * previousFileName/*= NULL*/) const
+{
+    const CompressionOptions::Private * compressionTargets[1] = { &compressionOptions };
+    const OutputOptions::Private * outputTargets[1] = { &outputOptions };
+
+    return compress(inputOptions, 1, compressionTargets, outputTargets, previousInputOptions, previousFileName);
+}
+
+bool Compressor::Private::compress(const InputOptions::Private & inputOptions, int targetCount, const CompressionOptions::Private * const * compressionTargets, const OutputOptions::Private * const * outputTargets, const InputOptions::Private * previousInputOptions/*= NULL*/, const char * previousFileName/*= NULL*/) const
+{
+    // Make sure enums match.
+    nvStaticCheck(FloatImage::WrapMode_Clamp == (FloatImage::WrapMode)WrapMode_Clamp);
+    nvStaticCheck(FloatImage::WrapMode_Mirror == (FloatImage::WrapMode)WrapMode_Mirror);
+    nvStaticCheck(FloatImage::WrapMode_Repeat == (FloatImage::WrapMode)WrapMode_Repeat);
+
+    // Get output handlers.
+    for (int t = 0; t < targetCount; t++) {
+        if (!outputTargets[t]->hasValidOutputHandler()) {
+            outputTargets[t]->error(Error_FileOpen);
+            return false;
+        }
+    }
+
+    // The mipmaps, filter kernels and output windows reuse the buffers of the previous levels.
+    PoolJob job;
+
+    nvtt::Surface img;
+    img.setWrapMode(inputOptions.wrapMode);
+    img.setAlphaMode(inputOptions.alphaMode);
+    img.setNormalMap(inputOptions.isNormalMap);
+
+    const int faceCount = inputOptions.faceCount;
+    int width = inputOptions.width;
+    int height = inputOptions.height;
+    int depth = inputOptions.depth;
+
+    nv::getTargetExtent(&width, &height, &depth, inputOptions.maxExtent, inputOptions.roundMode, inputOptions.textureType);
+
+    // If the extents have not changed, then we can use source images for all mipmaps.
+    bool canUseSourceImages = (inputOptions.width == width && inputOptions.height == height && inputOptions.depth == depth);
+
+    int mipmapCount = 1;
+    if (inputOptions.generateMipmaps) {
+        mipmapCount = countMipmaps(width, height, depth);
+        if (inputOptions.maxLevel > 0) mipmapCount = min(mipmapCount, inputOptions.maxLevel);
+    }
+
+    // The progress of each target covers all the levels of all the faces.
+    for (int t = 0; t < targetCount; t++) {
+        const OutputOptions::Private & outputOptions = *outputTargets[t];
+        if (outputOptions.progressHandler == NULL || outputOptions.progress != NULL) continue;
+
+        Progress progress(outputOptions.progressHandler, faceCount * blockCount(width, height, depth, mipmapCount));
+        OutputOptions::Private progressOutputOptions = outputOptions;
+        progressOutputOptions.progress = &progress;
+
+        nv::Array<const OutputOptions::Private *> progressTargets;
+        progressTargets.append(outputTargets, targetCount);
+        progressTargets[t] = &progressOutputOptions;
+
+        if (!compress(inputOptions, targetCount, compressionTargets, progressTargets.buffer(), previousInputOptions, previousFileName)) {
+            return false;
+        }
+        if (progress.isCancelled()) {
+            outputOptions.error(Error_Cancelled);
+            return false;
+        }
+        return true;
+    }
+
+    // With a positional output the header is measured on its way out, the images follow it.
+    nv::Array<size_t> imageOffsets;
+    imageOffsets.resize(targetCount, 0);
+
+    for (int t = 0; t < targetCount; t++) {
+        const CompressionOptions::Private & compressionOptions = *compressionTargets[t];
+        const OutputOptions::Private & outputOptions = *outputTargets[t];
+
+        if (outputOptions.positionalOutput() != NULL) {
+            BufferedLevel header;
+            OutputOptions::Private headerOptions = outputOptions;
+            headerOptions.outputHandler = &header;
+
+            if (!outputHeader(inputOptions.textureType, width, height, depth, mipmapCount, img.isNormalMap(), compressionOptions, headerOptions, inputOptions.arraySize)) {
+                return false;
+            }
+            if (!header.buffer.isEmpty() && !outputOptions.writeData(header.buffer.buffer(), header.buffer.count())) {
+                outputOptions.error(Error_FileWrite);
+                return false;
+            }
+            imageOffsets[t] = header.buffer.count();
+        }
+        else if (!outputHeader(inputOptions.textureType, width, height, depth, mipmapCount, img.isNormalMap(), compressionOptions, outputOptions, inputOptions.arraySize)) {
+            return false;
+        }
+    }
+
+    // One chain per target, the first one builds the levels and hands each of them to all the targets before it moves on to
+    // the next one, so that the compressors read the texels while they are still in cache.
+    nv::Array<MipmapChain *> chains;
+    for (int t = 0; t < targetCount; t++) {
+        chains.append(new MipmapChain(this, inputOptions, *compressionTargets[t], *outputTargets[t]));
+        if (t > 0) chains[t - 1]->next = chains[t];
+    }
+
+    MipmapChain & chain = *chains[0];
+
+    for (int t = 0; t < targetCount; t++) {
+        MipmapChain & target = *chains[t];
+        const CompressionOptions::Private & compressionOptions = target.compressionOptions;
+        const OutputOptions::Private & outputOptions = target.outputOptions;
+
+        target.width = width;
+        target.height = height;
+        target.depth = depth;
+        target.mipmapCount = mipmapCount;
+        target.canUseSourceImages = canUseSourceImages;
+
+        // KTX stores the faces of each mipmap together, the levels of cube maps are buffered and output mipmap major.
+        const bool mipmapMajor = (outputOptions.container == Container_KTX && faceCount > 1);
+        if (pipelineEnabled || mipmapMajor || outputOptions.positionalOutput() != NULL) {
+            target.levels.resize(faceCount * mipmapCount);
+        }
+
+        // Each level knows its offset in the output up front, so that it can be written as soon as it's compressed.
+        if (outputOptions.positionalOutput() != NULL) {
+            const uint bitCount = compressionOptions.getBitCount();
+            size_t imageOffset = imageOffsets[t];
+
+            for (int f = 0; f < faceCount; f++) {
+                int w = width, h = height, d = depth;
+                for (int m = 0; m < mipmapCount; m++) {
+                    target.levels[f * mipmapCount + m].setPositional(&outputOptions, imageOffset, &target.positionalMutex);
+                    imageOffset += computeImageSize(w, h, d, bitCount, compressionOptions.pitchAlignment, compressionOptions.format);
+
+                    w = max(1, w / 2);
+                    h = max(1, h / 2);
+                    d = max(1, d / 2);
+                }
+            }
+        }
+    }
+
+    // The previous output is matched against the extents and mipmap count of the chain, so it's loaded once they are set.
+    // Without a matching previous output everything is compressed.
+    if (previousInputOptions != NULL && targetCount == 1 && loadPrevious(chain, *previousInputOptions, previousFileName)) {
+        chain.previousInputOptions = previousInputOptions;
+    }
+
+    // Output images.
+    if (canCompressImages(chain))
+    {
+        for (int f = 0; f < faceCount; f++) {
+            compressFaceImages(chain, f);
+        }
+    }
+    else if (pipelineEnabled)
+    {
+        // The face tasks spawn the compression of each level into the same group as soon as the level is ready.
+        nv::TaskGroup group;
+        for (int t = 0; t < targetCount; t++) {
+            chains[t]->group = &group;
+        }
+
+        for (int f = 0; f < faceCount; f++) {
+            group.run(CompressFaceTask, &chain, f);
+        }
+        group.wait();
+    }
+    else
+    {
+        for (int f = 0; f < faceCount; f++) {
+            compressFace(chain, f);
+        }
+    }
+
+    // Output the buffered images in the same order as the sequential path.
+    if (!chain.isCancelled()) {
+        for (int t = 0; t < targetCount; t++) {
+            const MipmapChain & target = *chains[t];
+            const OutputOptions::Private & outputOptions = target.outputOptions;
+
+            if (outputOptions.container == Container_KTX && faceCount > 1) {
+                for (int m = 0; m < mipmapCount; m++) {
+                    for (int f = 0; f < faceCount; f++) {
+                        target.levels[f * mipmapCount + m].flush(outputOptions);
+                    }
+                }
+            }
+            else if (pipelineEnabled) {
+                for (int f = 0; f < faceCount; f++) {
+                    for (int m = 0; m < mipmapCount; m++) {
+                        target.levels[f * mipmapCount + m].flush(outputOptions);
+                    }
+                }
+            }
+        }
+    }
+
+    deleteAll(chains);
+
+    return true;
+}
+
+bool Compressor::Private::process(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, const InputOptions::Private * previousInputOptions, const char * previousFileName) const
+{
+    // Replaying cached output doesn't report the measured errors.
+    if (previousInputOptions == NULL && outputCache != NULL && outputOptions.imageErrorHandler == NULL && outputOptions.blockErrors == NULL) {
+        return compressCached(inputOptions, compressionOptions, outputOptions);
+    }
+    return compress(inputOptions, compressionOptions, outputOptions, previousInputOptions, previousFileName);
+}
+
+namespace
+{
+    // Keeps the images and the bytes of an output, and forwards the calls to the given output options, if any.
+    struct OutputRecorder : public nvtt::OutputHandler, public nvtt::ErrorHandler
+    {
+        OutputRecorder(const OutputOptions::Private * outputOptions) : outputOptions(outputOptions), failed(false) {}
+
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel)
+        {
+            const int args[6] = { size, width, height, depth, face, miplevel };
+            images.append(args, 6);
+            if (outputOptions != NULL) outputOptions->beginImage(size, width, height, depth, face, miplevel);
+        }
+
+        virtual bool writeData(const void * data, int size)
+        {
+            bytes.append((const uint8 *)data, size);
+            return outputOptions == NULL || outputOptions->writeData(data, size);
+        }
+
+        virtual void endImage()
+        {
+            if (outputOptions != NULL) outputOptions->endImage();
+        }
+
+        virtual void error(Error e)
+        {
+            failed = true;
+            if (outputOptions != NULL) outputOptions->error(e);
+        }
+
+        const OutputOptions::Private * outputOptions;
+        nv::Array<int> images;
+        nv::Array<uint8> bytes;
+        bool failed;
+    };
+}
+
+// The first pass runs with the settings of the compressor and goes to the output options, the second one runs on the
+// calling thread and is only recorded.
+bool Compressor::Private::processChecked(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, const InputOptions::Private * previousInputOptions, const char * previousFileName)
+{
+    OutputRecorder first(&outputOptions);
+    OutputOptions::Private firstOptions = outputOptions;
+    firstOptions.outputHandler = &first;
+    firstOptions.errorHandler = &first;
+
+    if (!process(inputOptions, compressionOptions, firstOptions, previousInputOptions, previousFileName) || first.failed) {
+        return false;
+    }
+
+    OutputRecorder second(NULL);
+    OutputOptions::Private secondOptions = outputOptions;
+    secondOptions.outputHandler = &second;
+    secondOptions.errorHandler = &second;
+    secondOptions.progressHandler = NULL;
+    secondOptions.dispatcher = NULL;
+
+    TaskDispatcher * const savedDispatcher = dispatcher;
+    const bool savedPipeline = pipelineEnabled;
+    nv::AutoPtr<OutputCache> savedCache(outputCache.release());
+
+    SequentialTaskDispatcher sequential;
+    dispatcher = &sequential;
+    pipelineEnabled = false;
+
+    bool success;
+    {
+        TaskScheduler * const savedScheduler = TaskScheduler::global();
+        TaskScheduler scheduler(0);
+        TaskScheduler::setGlobal(&scheduler);
+        success = compress(inputOptions, compressionOptions, secondOptions, previousInputOptions, previousFileName);
+        TaskScheduler::setGlobal(savedScheduler);
+    }
+
+    dispatcher = savedDispatcher;
+    pipelineEnabled = savedPipeline;
+    outputCache = savedCache.release();
+
+    const bool match = first.images.count() == second.images.count() && first.bytes.count() == second.bytes.count() &&
+        memcmp(first.images.buffer(), second.images.buffer(), first.images.count() * sizeof(int)) == 0 &&
+        memcmp(first.bytes.buffer(), second.bytes.buffer(), first.bytes.count()) == 0;
+
+    if (!success || second.failed || !match) {
+        outputOptions.error(Error_NonDeterministic);
+        return false;
+    }
+    return true;
+}
+
+bool Compressor::Private::compressCached(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    if (!outputOptions.hasValidOutputHandler()) {
+        outputOptions.error(Error_FileOpen);
+        return false;
+    }
+
+    // The levels that go to the GPU, and so the output, depend on the CUDA settings.
+    OutputCacheKey key;
+    const bool gpu = hasGpuCompressor(compressionOptions) && cudaContext() != NULL;
+    key.init(inputOptions, compressionOptions, outputOptions, gpu ? cudaMinTexels : 0);
+
+    if (outputCache->replay(key, outputOptions)) {
+        return true;
+    }
+
+    // Redirect the output to a recorder that also forwards it to the real handlers.
+    OutputCacheRecorder recorder(outputOptions);
+    OutputOptions::Private recordingOptions = outputOptions;
+    recordingOptions.outputHandler = &recorder;
+    recordingOptions.errorHandler = &recorder;
+
+    if (!compress(inputOptions, compressionOptions, recordingOptions)) {
+        return false;
+    }
+
+    if (!recorder.failed) {
+        outputCache->store(key, recorder.record);
+    }
+
+    return true;
+}
+
+bool Compressor::Private::compressCubeArray(const CubeSurface * mipmaps, int cubeCount, int mipmapCount, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    if (cubeCount <= 0 || mipmapCount <= 0 || mipmaps[0].isNull())
+    {
+        outputOptions.error(Error_InvalidInput);
+        return false;
+    }
+
+    PoolJob job;
+
+    // All the cubes must have the same mipmap chain.
+    const int edgeLength = mipmaps[0].edgeLength();
+    for (int i = 0; i < cubeCount; i++) {
+        for (int m = 0; m < mipmapCount; m++) {
+            if (mipmaps[i * mipmapCount + m].edgeLength() != max(1, edgeLength >> m)) {
+                outputOptions.error(Error_InvalidInput);
+                return false;
+            }
+        }
+    }
+
+    if (outputOptions.container != Container_DDS10)
+    {
+        outputOptions.error(Error_UnsupportedOutputFormat);
+        return false;
+    }
+
+    if (!outputHeader(TextureType_Cube, edgeLength, edgeLength, 1, mipmapCount, false, compressionOptions, outputOptions, cubeCount)) {
+        return false;
+    }
+
+    // DDS order, all the mipmaps of a face are stored together.
+    CubeArrayContext context;
+    context.compressor = this;
+    context.compressionOptions = &compressionOptions;
+    context.outputOptions = &outputOptions;
+    context.levels.resize(cubeCount * 6 * mipmapCount);
+
+    for (int i = 0; i < cubeCount; i++) {
+        for (int f = 0; f < 6; f++) {
+            for (int m = 0; m < mipmapCount; m++) {
+                BufferedLevel & level = context.levels[(i * 6 + f) * mipmapCount + m];
+                level.image = mipmaps[i * mipmapCount + m].face(f);
+                level.image.data();     // Flush the face on this thread, the tasks only read it.
+                level.face = i * 6 + f;
+                level.mipmap = m;
+            }
+        }
+    }
+
+    if (pipelineEnabled)
+    {
+        nv::TaskGroup group;
+        for (uint i = 0; i < context.levels.count(); i++) {
+            group.run(CompressCubeArrayTask, &context, i);
+        }
+        group.wait();
+
+        for (uint i = 0; i < context.levels.count(); i++) {
+            context.levels[i].flush(outputOptions);
+        }
+    }
+    else
+    {
+        for (uint i = 0; i < context.levels.count(); i++) {
+            const BufferedLevel & level = context.levels[i];
+            if (!compress(level.image, level.face, level.mipmap, compressionOptions, outputOptions)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+namespace
+{
+    struct PageContext
+    {
+        const Compressor::Private * compressor;
+        const CompressionOptions::Private * compressionOptions;
+        PageOutputHandler * handler;
+        nv::Array<nvtt::Surface> levels;
+        nv::Array<uint> firstPages;     // Index of the first page of each level, and the page count at the end.
+        int pageSize, border;
+        bool failed;
+    };
+
+    void CompressPageTask(void * context, int idx)
+    {
+        PageContext * ctx = (PageContext *)context;
+
+        uint m = 0;
+        while (ctx->firstPages[m + 1] <= uint(idx)) m++;
+
+        const nvtt::Surface & level = ctx->levels[m];
+        const FloatImage * image = level.m->image;
+        const FloatImage::WrapMode wrapMode = (FloatImage::WrapMode)level.wrapMode();
+
+        const int pageSize = ctx->pageSize;
+        const int content = pageSize - 2 * ctx->border;
+        const int columns = (level.width() + content - 1) / content;
+        const int px = (idx - ctx->firstPages[m]) % columns;
+        const int py = (idx - ctx->firstPages[m]) / columns;
+
+        // Gather the texels of the page, borders included.
+        const uint count = pageSize * pageSize;
+        nv::Array<float> texels;
+        texels.resize(4 * count);
+
+        const int x0 = px * content - ctx->border;
+        const int y0 = py * content - ctx->border;
+        for (int y = 0; y < pageSize; y++) {
+            for (int x = 0; x < pageSize; x++) {
+                const uint i = image->index(x0 + x, y0 + y, 0, wrapMode);
+                for (uint c = 0; c < 4; c++) {
+                    texels[c * count + y * pageSize + x] = image->channel(c)[i];
+                }
+            }
+        }
+
+        BufferedLevel page;
+        page.mipmap = m;
+
+        OutputOptions outputOptions;
+        outputOptions.setOutputHandler(&page);
+        outputOptions.setErrorHandler(&page);
+        outputOptions.setOutputHeader(false);
+
+        if (!ctx->compressor->compress(level.alphaMode(), pageSize, pageSize, 1, 0, m, texels.buffer(), *ctx->compressionOptions, outputOptions.m) ||
+            !page.errors.isEmpty() || !ctx->handler->writePage(m, px, py, page.buffer.buffer(), page.buffer.count()))
+        {
+            ctx->failed = true;
+        }
+    }
+}
+
+bool Compressor::compressPages(const Surface & img, int pageSize, int border, int mipmapCount, MipmapFilter filter, const CompressionOptions & compressionOptions, PageOutputHandler * handler) const
+{
+    if (img.isNull() || img.depth() != 1 || handler == NULL || border < 0 || pageSize - 2 * border <= 0 || mipmapCount < 0) {
+        return false;
+    }
+
+    PoolJob job;
+
+    PageContext context;
+    context.compressor = &m;
+    context.compressionOptions = &compressionOptions.m;
+    context.handler = handler;
+    context.pageSize = pageSize;
+    context.border = border;
+    context.failed = false;
+
+    // Build the mipmaps first, so that the pages of all of them are compressed together.
+    const int content = pageSize - 2 * border;
+    uint pageCount = 0;
+
+    nvtt::Surface level = img;
+    for (int i = 0; mipmapCount == 0 || i < mipmapCount; i++) {
+        if (i > 0 && !level.buildNextMipmap(filter)) break;
+
+        context.levels.append(level);
+        context.levels.back().data();   // Flush the level on this thread, the tasks only read it.
+        context.firstPages.append(pageCount);
+        pageCount += ((level.width() + content - 1) / content) * ((level.height() + content - 1) / content);
+
+        if (mipmapCount == 0 && level.width() <= content && level.height() <= content) break;
+    }
+    context.firstPages.append(pageCount);
+
+    nv::TaskScheduler::global()->parallelFor(CompressPageTask, &context, pageCount);
+
+    return !context.failed;
+}
+
+// Load the compressed levels of the previous output. Returns false if they can't be used to compress the given input with the current options.
+namespace
+{
+    // Below this many texels in a window of block rows, the decoded window is compressed at once.
+    const uint kTranscodeWindowTexels = 1024 * 1024;
+
+    struct TranscodeContext
+    {
+        const DirectDrawSurface * dds;
+        const uint8 * blocks;   // First block row of the window.
+        uint rowSize;           // Size of a row of blocks.
+        uint w, h;              // Texels of the window.
+        float * rgba;           // Planar, w * h texels per channel.
+    };
+
+    void DecodeBlockRowTask(void * context, int row)
+    {
+        const TranscodeContext * ctx = (const TranscodeContext *)context;
+        const uint y = 4 * row;
+        ctx->dds->decodeBlockRow(ctx->blocks + row * ctx->rowSize, ctx->w, min(4U, ctx->h - y), ctx->rgba + y * ctx->w, ctx->w * ctx->h);
+    }
+}
+
+bool Compressor::Private::transcode(const char * fileName, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    PoolJob job;
+
+    if (outputOptions.container == Container_KTX && compressionOptions.pitchAlignment < 4) {
+        // KTX aligns the rows of uncompressed images to 4 bytes.
+        CompressionOptions::Private ktxCompressionOptions = compressionOptions;
+        ktxCompressionOptions.pitchAlignment = 4;
+        return transcode(fileName, ktxCompressionOptions, outputOptions);
+    }
+
+    if (!outputOptions.hasValidOutputHandler()) {
+        outputOptions.error(Error_FileOpen);
+        return false;
+    }
+
+    DirectDrawSurface dds;
+    if (!dds.load(fileName) || !dds.isValid()) {
+        outputOptions.error(Error_FileOpen);
+        return false;
+    }
+
+    if (!dds.isSupported() || !dds.header.isBlockFormat() || dds.isTexture3D()) {
+        outputOptions.error(Error_UnsupportedFeature);
+        return false;
+    }
+
+    AutoPtr<CompressorInterface> compressor(chooseCpuCompressor(compressionOptions));
+    if (compressor == NULL) {
+        outputOptions.error(Error_UnsupportedFeature);
+        return false;
+    }
+
+    const uint arraySize = dds.arrayCount();
+    const uint faceCount = (dds.isTextureCube() ? 6 : 1) * arraySize;
+    const uint mipmapCount = dds.mipmapCount();
+    const TextureType textureType = dds.isTextureCube() ? TextureType_Cube : TextureType_2D;
+
+    if (!outputHeader(textureType, dds.width(), dds.height(), 1, mipmapCount, dds.header.isNormalMap(), compressionOptions, outputOptions, arraySize)) {
+        return false;
+    }
+
+    const AlphaMode alphaMode = dds.hasAlpha() ? AlphaMode_Transparency : AlphaMode_None;
+    const uint blockSize = dds.header.blockSize();
+
+    // KTX stores the faces of each mipmap together, the surfaces are read in that order instead of buffering the output.
+    const bool mipmapMajor = (outputOptions.container == Container_KTX);
+
+    Array<float> window;
+    Array<uint8> buffer;
+
+    for (uint i = 0; i < faceCount * mipmapCount; i++)
+    {
+        const uint f = mipmapMajor ? i % faceCount : i / mipmapCount;
+        const uint m = mipmapMajor ? i / faceCount : i % mipmapCount;
+
+        const uint w = dds.surfaceWidth(m);
+        const uint h = dds.surfaceHeight(m);
+        const uint bw = (w + 3) / 4;
+        const uint bh = (h + 3) / 4;
+
+        const uint8 * blocks = (const uint8 *)dds.surfaceData(f, m);
+        if (blocks == NULL) {
+            // The file couldn't be mapped, read the compressed surface.
+            buffer.resize(dds.surfaceSize(m));
+            if (!dds.readSurface(f, m, buffer.buffer(), buffer.count())) {
+                outputOptions.error(Error_InvalidInput);
+                return false;
+            }
+            blocks = buffer.buffer();
+        }
+
+        SupercompressionHandler supercompression(outputOptions, compressionOptions.format);
+        const OutputOptions::Private & output = supercompression.options();
+
+        beginImage(w, h, 1, f, m, compressionOptions, output);
+
+        // Decode a window of block rows in parallel and compress it before decoding the next one. The block rows of the
+        // output are independent, so this produces the same output as compressing the whole surface.
+        const uint windowRows = clamp(kTranscodeWindowTexels / (16 * bw), 1U, bh);
+
+        TranscodeContext context;
+        context.dds = &dds;
+        context.rowSize = bw * blockSize;
+        context.w = w;
+
+        for (uint by = 0; by < bh; by += windowRows)
+        {
+            const uint rows = min(windowRows, bh - by);
+
+            context.blocks = blocks + by * context.rowSize;
+            context.h = min(4 * rows, h - 4 * by);
+
+            window.resize(4 * w * context.h);
+            context.rgba = window.buffer();
+
+            dispatcher->dispatch(DecodeBlockRowTask, &context, rows);
+
+            // Error diffusion dithering would need the whole image, only the alpha threshold is applied.
+            if (compressionOptions.binaryAlpha) {
+                const float threshold = float(compressionOptions.alphaThreshold) / 255.0f;
+                float * alpha = context.rgba + 3 * w * context.h;
+                for (uint t = 0; t < w * context.h; t++) {
+                    alpha[t] = alpha[t] > threshold ? 1.0f : 0.0f;
+                }
+            }
+
+            compressor->compress(alphaMode, w, context.h, 1, context.rgba, dispatcher, compressionOptions, output);
+        }
+
+        output.endImage();
+    }
+
+    return true;
+}
+
+bool Compressor::Private::loadPrevious(MipmapChain & chain, const InputOptions::Private & previousInputOptions, const char * previousFileName) const
+{
+    const InputOptions::Private & inputOptions = chain.inputOptions;
+    const CompressionOptions::Private & compressionOptions = chain.compressionOptions;
+    const OutputOptions::Private & outputOptions = chain.outputOptions;
+
+    // The images of the previous input must have the same layout.
+    if (previousInputOptions.textureType != inputOptions.textureType ||
+        previousInputOptions.inputFormat != inputOptions.inputFormat ||
+        previousInputOptions.width != inputOptions.width ||
+        previousInputOptions.height != inputOptions.height ||
+        previousInputOptions.depth != inputOptions.depth ||
+        previousInputOptions.faceCount != inputOptions.faceCount ||
+        previousInputOptions.mipmapCount != inputOptions.mipmapCount)
+    {
+        return false;
+    }
+
+    // The header tells whether the previous output has the same format, extents and mipmaps.
+    if (!outputOptions.outputHeader || (outputOptions.container != Container_DDS && outputOptions.container != Container_DDS10)) {
+        return false;
+    }
+
+    // The blocks of the previous output are read in linear order.
+    if (outputOptions.tileMode != TileMode_Linear) {
+        return false;
+    }
+
+    DirectDrawSurface dds(previousFileName);
+    if (!dds.isValid()) {
+        return false;
+    }
+
+    BufferedLevel header;
+    OutputOptions::Private headerOptions = outputOptions;
+    headerOptions.outputHandler = &header;
+    headerOptions.errorHandler = &header;
+
+    if (!outputHeader(inputOptions.textureType, chain.width, chain.height, chain.depth, chain.mipmapCount, inputOptions.isNormalMap, compressionOptions, headerOptions, inputOptions.arraySize)) {
+        return false;
+    }
+
+    // Compare the headers as they are stored in the file.
+    DDSHeader previousHeader = dds.header;
+    previousHeader.swapBytes();
+
+    if (header.buffer.count() > sizeof(DDSHeader) || memcmp(&previousHeader, header.buffer.buffer(), header.buffer.count()) != 0) {
+        return false;
+    }
+
+    const int faceCount = inputOptions.faceCount;
+    chain.previousOffsets.resize(faceCount * chain.mipmapCount);
+
+    uint offset = 0;
+    for (int f = 0; f < faceCount; f++) {
+        int w = chain.width;
+        int h = chain.height;
+        int d = chain.depth;
+
+        for (int m = 0; m < chain.mipmapCount; m++) {
+            uint size = computeImageSize(w, h, d, compressionOptions.getBitCount(), compressionOptions.pitchAlignment, compressionOptions.format);
+
+            chain.previousOffsets[f * chain.mipmapCount + m] = offset;
+            chain.previousBlocks.resize(offset + size);
+
+            if (!dds.readSurface(f, m, chain.previousBlocks.buffer() + offset, size)) {
+                return false;
+            }
+            offset += size;
+
+            w = max(1, w/2);
+            h = max(1, h/2);
+            d = max(1, d/2);
+        }
+    }
+
+    return true;
+}
+
+// Build the mipmap chain of the given face and compress its levels.
+// For incremental compression the chain of the previous input is built alongside, with the same settings, so that its levels can be compared block by block.
+void Compressor::Private::compressFace(MipmapChain & chain, int f) const
+{
+    const InputOptions::Private & inputOptions = chain.inputOptions;
+    const InputOptions::Private * previousInputOptions = chain.previousInputOptions;
+
+    bool canUseSourceImagesForThisFace = chain.canUseSourceImages;
+
+    nvtt::Surface img;
+    nvtt::Surface previous;
+
+    // When the GPU builds and compresses the first levels, the CPU carries on from the last of them.
+    int m = compressFaceGpu(chain, f, img);
+    if (m > 0) {
+        if (m < chain.mipmapCount) {
+            nextLevel(chain, img, previous, f, m, canUseSourceImagesForThisFace);
+        }
+    }
+    else {
+        loadFace(img, inputOptions, inputOptions, f, chain.width, chain.height, chain.depth);
+
+        if (previousInputOptions != NULL) {
+            loadFace(previous, inputOptions, *previousInputOptions, f, chain.width, chain.height, chain.depth);
+        }
+    }
+
+    // Each level is built before the previous one is compressed, so that the conversion to the output color space can
+    // work on the texels of the level in place, instead of a copy that keeps the linear texels for the next level. Box
+    // filtered levels do the conversion in the same pass that builds the next level.
+    for (; m < chain.mipmapCount && !chain.isCancelled(); m++) {
+        nvtt::Surface nextImg;
+        nvtt::Surface nextPrevious;
+        bool isGamma = false;
+
+        if (m + 1 < chain.mipmapCount) {
+            isGamma = nextLevelToGamma(chain, img, previous, nextImg, nextPrevious, canUseSourceImagesForThisFace);
+            if (!isGamma) {
+                nextImg = img;
+                nextPrevious = previous;
+                nextLevel(chain, nextImg, nextPrevious, f, m + 1, canUseSourceImagesForThisFace);
+            }
+        }
+
+        // The other targets share the level, which is converted to the output color space once for all of them.
+        if (chain.next != NULL && !isGamma && !img.isNormalMap()) {
+            img.toGamma(inputOptions.outputGamma);
+            isGamma = true;
+        }
+        for (MipmapChain * target = chain.next; target != NULL; target = target->next) {
+            nvtt::Surface targetImg = img;
+            nvtt::Surface targetPrevious = previous;
+            compressLevel(*target, targetImg, targetPrevious, f, m, isGamma);
+        }
+
+        compressLevel(chain, img, previous, f, m, isGamma);
+
+        img = nextImg;
+        previous = nextPrevious;
+    }
+}
+
+// Replace the images with the given level, built from the previous one or loaded from the source images. The images
+// that are shared with other surfaces are left untouched.
+void Compressor::Private::nextLevel(MipmapChain & chain, Surface & img, Surface & previous, int f, int m, bool & canUseSourceImages) const
+{
+    const InputOptions::Private & inputOptions = chain.inputOptions;
+    const InputOptions::Private * previousInputOptions = chain.previousInputOptions;
+
+    const int w = max(1, img.width() / 2);
+    const int h = max(1, img.height() / 2);
+    const int d = max(1, img.depth() / 2);
+
+    const int idx = m * inputOptions.faceCount + f;
+
+    bool useSourceImages = false;
+    if (canUseSourceImages) {
+        if (inputOptions.images[idx] == NULL) { // One face is missing in this mipmap level.
+            canUseSourceImages = false; // If one level is missing, ignore the following source images.
+        }
+        else {
+            useSourceImages = true;
+        }
+    }
+
+    nextMipmap(img, inputOptions, useSourceImages ? inputOptions.images[idx] : NULL, inputOptions.pitches[idx], w, h, d);
+
+    if (!previous.isNull()) {
+        if (useSourceImages && previousInputOptions->images[idx] == NULL) {
+            previous = nvtt::Surface(); // The previous input doesn't have this level, compress the rest of the face in full.
+        }
+        else {
+            nextMipmap(previous, inputOptions, useSourceImages ? previousInputOptions->images[idx] : NULL, previousInputOptions->pitches[idx], w, h, d);
+        }
+    }
+}
+
+// Build the next level into nextImg and nextPrevious and convert img and previous to the output color space, in a single
+// pass over their texels. Returns false and leaves the images untouched when the level isn't built with the box filter from
+// the color texels of the level above, nextLevel builds it then.
+bool Compressor::Private::nextLevelToGamma(const MipmapChain & chain, Surface & img, Surface & previous, Surface & nextImg, Surface & nextPrevious, bool canUseSourceImages) const
+{
+    const InputOptions::Private & inputOptions = chain.inputOptions;
+
+    if (canUseSourceImages || inputOptions.mipmapFilter != MipmapFilter_Box || img.isNormalMap()) {
+        return false;
+    }
+
+    img.buildNextMipmapToGamma(MipmapFilter_Box, inputOptions.outputGamma, &nextImg);
+
+    if (!previous.isNull()) {
+        previous.buildNextMipmapToGamma(MipmapFilter_Box, inputOptions.outputGamma, &nextPrevious);
+    }
+
+    return true;
+}
+
+// Build and compress the largest levels of the face on the GPU, from a single upload of the top level, when the options
+// don't need anything the device doesn't do. Returns the number of levels compressed and copies the last of them back to img,
+// so that the CPU can carry on with the levels that are too small for the GPU compressors.
+int Compressor::Private::compressFaceGpu(MipmapChain & chain, int f, Surface & img) const
+{
+#if defined HAVE_CUDA
+    const InputOptions::Private & inputOptions = chain.inputOptions;
+    const CompressionOptions::Private & compressionOptions = chain.compressionOptions;
+    const OutputOptions::Private & outputOptions = chain.outputOptions;
+
+    if (!hasGpuCompressor(compressionOptions) || chain.previousInputOptions != NULL || chain.next != NULL || inputOptions.depth != 1 || chain.depth != 1) {
+        return 0;
+    }
+    if (cudaContext() == NULL || uint(chain.width * chain.height) < cudaMinTexels) {
+        return 0;
+    }
+
+    // Normal maps, alpha weighted filters, alpha coverage and dithering stay on the CPU.
+    if (inputOptions.isNormalMap || inputOptions.convertToNormalMap || inputOptions.alphaMode == AlphaMode_Transparency || inputOptions.keepAlphaCoverage) {
+        return 0;
+    }
+    if (compressionOptions.enableColorDithering || compressionOptions.enableAlphaDithering || compressionOptions.binaryAlpha) {
+        return 0;
+    }
+
+    // So do the chains that use the source images of the mipmaps.
+    if (chain.canUseSourceImages) {
+        for (int m = 1; m < chain.mipmapCount; m++) {
+            if (inputOptions.images[m * inputOptions.faceCount + f] != NULL) return 0;
+        }
+    }
+
+    AutoPtr<CompressorInterface> compressor(chooseGpuCompressor(compressionOptions));
+    if (compressor == NULL) {
+        return 0;
+    }
+    CudaCompressor * cudaCompressor = (CudaCompressor *)compressor.ptr();
+
+    // When pipelining, the other faces wait for the devices while the CPU compresses the small levels of this one.
+    nv::Lock<nv::Mutex> lock(cuda->mutex);
+    cuda::setDevice(cuda->context->device[0]->id);
+
+    // The top level is brought to linear space on the CPU, the device resizes it to the extents of the chain.
+    loadFace(img, inputOptions, inputOptions, f, inputOptions.width, inputOptions.height, inputOptions.depth);
+
+    CudaSurface surface;
+    if (!surface.setImage(img.data(), img.width(), img.height()) || !surface.resize(BoxFilter(), chain.width, chain.height, inputOptions.wrapMode)) {
+        return 0;
+    }
+
+    // Same filters as nextMipmap.
+    BoxFilter box;
+    TriangleFilter triangle;
+    KaiserFilter kaiser(inputOptions.kaiserWidth);
+    kaiser.setParameters(inputOptions.kaiserStretch, inputOptions.kaiserAlpha);
+
+    const Filter & filter = (inputOptions.mipmapFilter == MipmapFilter_Box) ? (const Filter &)box :
+                            (inputOptions.mipmapFilter == MipmapFilter_Triangle) ? (const Filter &)triangle : (const Filter &)kaiser;
+
+    int w = chain.width;
+    int h = chain.height;
+    int m = 0;
+
+    for (;;) {
+        // When the levels are buffered or positional, the level goes through them like the ones compressed by the tasks.
+        OutputOptions::Private levelOutputOptions = outputOptions;
+        if (!chain.levels.isEmpty()) {
+            BufferedLevel & level = chain.levels[f * chain.mipmapCount + m];
+            level.face = f;
+            level.mipmap = m;
+            levelOutputOptions.outputHandler = &level;
+            levelOutputOptions.errorHandler = &level;
+        }
+
+        int size = computeImageSize(w, h, 1, compressionOptions.getBitCount(), compressionOptions.pitchAlignment, compressionOptions.format);
+        levelOutputOptions.beginImage(size, w, h, 1, f, m);
+
+        cudaArray * image = surface.toColor32(inputOptions.outputGamma);
+        if (image == NULL) {
+            levelOutputOptions.error(Error_CudaError);
+        }
+        else {
+            cudaCompressor->compressArray(inputOptions.alphaMode, w, h, NULL, image, compressionOptions, levelOutputOptions);
+        }
+
+        levelOutputOptions.endImage();
+        m++;
+
+        if (outputOptions.progress != NULL && !outputOptions.progress->add(((w + 3) / 4) * ((h + 3) / 4))) {
+            break;
+        }
+
+        // The levels under the crossover go to the CPU compressors, like in compress().
+        if (m == chain.mipmapCount || uint(max(1, w/2) * max(1, h/2)) < cudaMinTexels) {
+            break;
+        }
+
+        if (!surface.buildNextMipmap(filter, inputOptions.wrapMode)) {
+            outputOptions.error(Error_CudaError);
+            break;
+        }
+        w = surface.width();
+        h = surface.height();
+    }
+
+    if (m < chain.mipmapCount) {
+        const uint count = w * h;
+        nv::Array<float> data;
+        data.resize(count * 4);
+
+        if (!surface.getImage(data.buffer())) {
+            outputOptions.error(Error_CudaError);
+        }
+
+        const float * channels = data.buffer();
+        img.setImage(InputFormat_RGBA_32F, w, h, 1, channels, channels + count, channels + 2 * count, channels + 3 * count);
+    }
+
+    return m;
+#else
+    return 0;
+#endif
+}
+
+// Convert the level to the output color space, quantize and compress it. The images are consumed, they are converted in
+// place or handed over to the task that compresses the level in pipelined mode.
+void Compressor::Private::compressLevel(MipmapChain & chain, Surface & img, Surface & previous, int f, int m, bool isGamma) const
+{
+    if (chain.group != NULL) {
+        BufferedLevel & level = chain.levels[f * chain.mipmapCount + m];
+        level.image = img;
+        level.previousImage = previous;
+        img = nvtt::Surface();
+        previous = nvtt::Surface();
+
+        // Surfaces are not reference counted atomically, the task must not share the data with any other surface.
+        // This only copies the texels when the next level couldn't be built from them.
+        level.image.detach();
+        level.previousImage.detach();
+
+        level.face = f;
+        level.mipmap = m;
+        level.isGamma = isGamma;
+        chain.group->run(CompressLevelTask, &chain, f * chain.mipmapCount + m);
+        return;
+    }
+
+    if (!chain.levels.isEmpty()) {
+        BufferedLevel & level = chain.levels[f * chain.mipmapCount + m];
+        level.face = f;
+        level.mipmap = m;
+
+        OutputOptions::Private outputOptions = chain.outputOptions;
+        outputOptions.outputHandler = &level;
+        outputOptions.errorHandler = &level;
+
+        processLevel(chain, img, previous, f, m, isGamma, outputOptions);
+        return;
     }
 
+    processLevel(chain, img, previous, f, m, isGamma, chain.outputOptions);
+}
+
+// The previous version of the level goes through the same conversions, so that the texels of the blocks that didn't change are identical.
+void Compressor::Private::processLevel(const MipmapChain & chain, Surface & img, Surface & previous, int f, int m, bool isGamma, const OutputOptions::Private & outputOptions) const
+{
+    if (!isGamma && !img.isNormalMap()) {
+        img.toGamma(chain.inputOptions.outputGamma);
+    }
+
+    quantize(img, chain.compressionOptions);
+
+    if (previous.isNull()) {
+        compress(img, f, m, chain.compressionOptions, outputOptions);
+        return;
+    }
+
+    if (!isGamma && !previous.isNormalMap()) {
+        previous.toGamma(chain.inputOptions.outputGamma);
+    }
+
+    quantize(previous, chain.compressionOptions);
+
+    OutputOptions::Private incrementalOutputOptions = outputOptions;
+    incrementalOutputOptions.previousData = previous.data();
+    incrementalOutputOptions.previousBlocks = chain.previousBlocks.buffer() + chain.previousOffsets[f * chain.mipmapCount + m];
+
+    compress(img, f, m, chain.compressionOptions, incrementalOutputOptions);
+}
+
+// 8 bit color textures at their own extents, whose levels are box filtered and don't change color space, skip the float
+// texels when they go to the fastest DXT1, DXT1a and DXT5 compressors with nothing else looking at the texels.
+bool Compressor::Private::canCompressImages(const MipmapChain & chain) const
+{
+    const InputOptions::Private & inputOptions = chain.inputOptions;
+    const CompressionOptions::Private & compressionOptions = chain.compressionOptions;
+    const OutputOptions::Private & outputOptions = chain.outputOptions;
+
+    if (chain.next != NULL || chain.previousInputOptions != NULL) return false;
 
-    // Output images.
-    for (int f = 0; f < faceCount; f++)
-    {
-        int w = width;
-        int h = height;
-        int d = depth;
-        bool canUseSourceImagesForThisFace = canUseSourceImages;
+    if (inputOptions.inputFormat != InputFormat_BGRA_8UB || !chain.canUseSourceImages || chain.depth != 1) return false;
+    if (inputOptions.isNormalMap || inputOptions.convertToNormalMap || inputOptions.keepAlphaCoverage) return false;
+    if (inputOptions.alphaMode == AlphaMode_Transparency || inputOptions.inputGamma != inputOptions.outputGamma) return false;
+    if (chain.mipmapCount > 1 && inputOptions.mipmapFilter != MipmapFilter_Box) return false;
 
-        img.setImage(inputOptions.inputFormat, inputOptions.width, inputOptions.height, inputOptions.depth, inputOptions.images[f]);
+    const Format format = compressionOptions.format;
+    if (format != Format_DXT1 && format != Format_DXT1a && format != Format_DXT5) return false;
+    for (int m = 0; m < chain.mipmapCount; m++) {
+        if (compressionOptions.levelQuality(m) != Quality_Fastest) return false;
+    }
+    if (!compressionOptions.externalCompressor.isNull() || hasRateDistortionPass(compressionOptions)) return false;
+    if (compressionOptions.enableColorDithering || compressionOptions.enableAlphaDithering || compressionOptions.binaryAlpha) return false;
 
-        // To normal map.
-        if (inputOptions.convertToNormalMap) {
-            img.toGreyScale(inputOptions.heightFactors.x, inputOptions.heightFactors.y, inputOptions.heightFactors.z, inputOptions.heightFactors.w);
-            img.toNormalMap(inputOptions.bumpFrequencyScale.x, inputOptions.bumpFrequencyScale.y, inputOptions.bumpFrequencyScale.z, inputOptions.bumpFrequencyScale.w);
-        }
+    if (outputOptions.blockCache != NULL || outputOptions.blockStatistics != NULL) return false;
+    if (outputOptions.blockErrors != NULL || outputOptions.imageErrorHandler != NULL) return false;
 
-        // To linear space.
-        if (!img.isNormalMap()) {
-            img.toLinear(inputOptions.inputGamma);
-        }
+#if defined HAVE_CUDA
+    if (hasGpuCompressor(compressionOptions) && cudaContext() != NULL) return false;
+#endif
 
-        // Resize input.
-        img.resize(w, h, d, ResizeFilter_Box);
+    return true;
+}
 
-        nvtt::Surface tmp = img;
-        if (!img.isNormalMap()) {
-            tmp.toGamma(inputOptions.outputGamma);
-        }
+// compressFace for the chains canCompressImages accepts. The levels are the source images while there are some, like in
+// nextLevel, the others are box filtered from the level above in 8 bits, with the colors averaged in linear space.
+void Compressor::Private::compressFaceImages(MipmapChain & chain, int f) const
+{
+    const InputOptions::Private & inputOptions = chain.inputOptions;
 
-        quantize(tmp, compressionOptions);
-        compress(tmp, f, 0, compressionOptions, outputOptions);
+    nv::Image source;   // Wraps the texels of the caller when their rows are contiguous.
+    nv::AutoPtr<nv::Image> built;
+    const nv::Image * img = NULL;
 
-        for (int m = 1; m < mipmapCount; m++) {
-            w = max(1, w/2);
-            h = max(1, h/2);
-            d = max(1, d/2);
+    bool canUseSourceImages = true;
+    uint w = chain.width;
+    uint h = chain.height;
 
-            int idx = m * faceCount + f;
+    for (int m = 0; m < chain.mipmapCount && !chain.isCancelled(); m++)
+    {
+        const int idx = m * inputOptions.faceCount + f;
 
-            bool useSourceImages = false;
-            if (canUseSourceImagesForThisFace) {
-                if (inputOptions.images[idx] == NULL) { // One face is missing in this mipmap level.
-                    canUseSourceImagesForThisFace = false; // If one level is missing, ignore the following source images.
-                }
-                else {
-                    useSourceImages = true;
-                }
-            }
+        if (m > 0) {
+            w = max(1U, w / 2);
+            h = max(1U, h / 2);
+        }
 
-            if (useSourceImages) {
-                img.setImage(inputOptions.inputFormat, w, h, d, inputOptions.images[idx]);
+        if (canUseSourceImages && inputOptions.images[idx] != NULL) {
+            const uint8 * texels = (const uint8 *)inputOptions.images[idx];
+            const uint pitch = inputOptions.pitches[idx];
 
-                // For already generated mipmaps, we need to convert to linear.
-                if (!img.isNormalMap()) {
-                    img.toLinear(inputOptions.inputGamma);
-                }
+            source.unwrap();
+            if (pitch == 0 || pitch == 4 * w) {
+                source.wrap(const_cast<uint8 *>(texels), w, h);
+                img = &source;
             }
             else {
-                if (inputOptions.mipmapFilter == MipmapFilter_Kaiser) {
-                    float params[2] = { inputOptions.kaiserStretch, inputOptions.kaiserAlpha };
-                    img.buildNextMipmap(MipmapFilter_Kaiser, inputOptions.kaiserWidth, params);
-                }
-                else {
-                    img.buildNextMipmap(inputOptions.mipmapFilter);
-                }
-            }
-            nvDebugCheck(img.width() == w);
-            nvDebugCheck(img.height() == h);
-            nvDebugCheck(img.depth() == d);
-
-            if (img.isNormalMap()) {
-                if (inputOptions.normalizeMipmaps) {
-                    img.normalizeNormalMap();
+                nv::Image * copy = new nv::Image;
+                copy->allocate(w, h);
+                for (uint y = 0; y < h; y++) {
+                    memcpy(copy->scanline(y), texels + y * pitch, 4 * w);
                 }
-                tmp = img;
+                built = copy;
+                img = copy;
             }
-            else {
-                tmp = img;
-                tmp.toGamma(inputOptions.outputGamma);
-            }
-
-            quantize(tmp, compressionOptions);
-            compress(tmp, f, m, compressionOptions, outputOptions);
         }
+        else {
+            canUseSourceImages = false; // If one level is missing, ignore the following source images.
+            built = img->fastDownSample(inputOptions.inputGamma);
+            img = built.ptr();
+        }
+        nvDebugCheck(img->width() == w && img->height() == h);
+
+        OutputOptions::Private outputOptions = chain.outputOptions;
+        if (!chain.levels.isEmpty()) {
+            BufferedLevel & level = chain.levels[f * chain.mipmapCount + m];
+            level.face = f;
+            level.mipmap = m;
+            outputOptions.outputHandler = &level;
+            outputOptions.errorHandler = &level;
+        }
+
+        compress(inputOptions.alphaMode, f, m, img, chain.compressionOptions, outputOptions);
     }
 
-    return true;
+    source.unwrap();
 }
 
 bool Compressor::Private::compress(const Surface & tex, int face, int mipmap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
@@ -348,15 +2412,75 @@ bool Compressor::Private::compress(const Surface & tex, int face, int mipmap, co
 
 bool Compressor::Private::compress(AlphaMode alphaMode, int w, int h, int d, int face, int mipmap, const float * rgba, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
 {
-    int size = computeImageSize(w, h, d, compressionOptions.getBitCount(), compressionOptions.pitchAlignment, compressionOptions.format);
-    outputOptions.beginImage(size, w, h, d, face, mipmap);
+    return compressTexels(alphaMode, w, h, d, face, mipmap, rgba, NULL, compressionOptions, outputOptions);
+}
+
+// Only the compressors canCompressImages accepts take the texels of an 8 bit image.
+bool Compressor::Private::compress(AlphaMode alphaMode, int face, int mipmap, const nv::Image * image, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    return compressTexels(alphaMode, image->width(), image->height(), 1, face, mipmap, NULL, image, compressionOptions, outputOptions);
+}
+
+// Compress either the planar float texels in rgba or the 8 bit texels of image.
+bool Compressor::Private::compressTexels(AlphaMode alphaMode, int w, int h, int d, int face, int mipmap, const float * rgba, const nv::Image * image, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    if (outputOptions.container == Container_KTX && compressionOptions.pitchAlignment < 4) {
+        // KTX aligns the rows of uncompressed images to 4 bytes.
+        CompressionOptions::Private ktxCompressionOptions = compressionOptions;
+        ktxCompressionOptions.pitchAlignment = 4;
+        return compressTexels(alphaMode, w, h, d, face, mipmap, rgba, image, ktxCompressionOptions, outputOptions);
+    }
+
+    if (compressionOptions.levelQuality(mipmap) != compressionOptions.quality) {
+        // The level has a quality of its own.
+        CompressionOptions::Private levelCompressionOptions = compressionOptions;
+        levelCompressionOptions.quality = compressionOptions.levelQuality(mipmap);
+        return compressTexels(alphaMode, w, h, d, face, mipmap, rgba, image, levelCompressionOptions, outputOptions);
+    }
+
+    const uint blocks = ((w + 3) / 4) * ((h + 3) / 4) * d;
+
+    // Outside of process the progress covers this image.
+    if (outputOptions.progressHandler != NULL && outputOptions.progress == NULL) {
+        Progress progress(outputOptions.progressHandler, blocks);
+        OutputOptions::Private progressOutputOptions = outputOptions;
+        progressOutputOptions.progress = &progress;
+
+        if (!compressTexels(alphaMode, w, h, d, face, mipmap, rgba, image, compressionOptions, progressOutputOptions)) {
+            if (progress.isCancelled()) outputOptions.error(Error_Cancelled);
+            return false;
+        }
+        return true;
+    }
+
+    if (outputOptions.isCancelled()) {
+        return false;
+    }
+
+    // Supercompressed images are output as a whole once they are complete.
+    SupercompressionHandler supercompression(outputOptions, compressionOptions.format);
+    const OutputOptions::Private * output = &supercompression.options();
+
+    // The compressors report the blocks they finish against the progress of the image, the blocks they don't report are
+    // added once the image is done.
+    Progress imageProgress(outputOptions.progress, blocks);
+    OutputOptions::Private progressOutputOptions;
+    if (outputOptions.progress != NULL) {
+        progressOutputOptions = *output;
+        progressOutputOptions.progress = &imageProgress;
+        output = &progressOutputOptions;
+    }
+
+    beginImage(w, h, d, face, mipmap, compressionOptions, *output);
 
     // Decide what compressor to use.
     AutoPtr<CompressorInterface> compressor;
+    bool gpu = false;
 #if defined HAVE_CUDA
-    if (cudaEnabled && w * h >= 512)
+    if (image == NULL && hasGpuCompressor(compressionOptions) && cudaContext() != NULL && uint(w * h) >= cudaMinTexels)
     {
         compressor = chooseGpuCompressor(compressionOptions);
+        gpu = (compressor != NULL);
     }
 #endif
     if (compressor == NULL)
@@ -364,21 +2488,58 @@ bool Compressor::Private::compress(AlphaMode alphaMode, int w, int h, int d, int
         compressor = chooseCpuCompressor(compressionOptions);
     }
 
+    // Asynchronous jobs may run the loops on the scheduler of the jobs instead.
+    TaskDispatcher * const taskDispatcher = (outputOptions.dispatcher != NULL) ? outputOptions.dispatcher : dispatcher;
+
     if (compressor == NULL)
     {
         outputOptions.error(Error_UnsupportedFeature);
     }
+    else if (gpu)
+    {
+        // The levels of the other faces may be compressed concurrently when pipelining.
+        nv::Lock<nv::Mutex> lock(cuda->mutex);
+        cuda::setDevice(cuda->context->device[0]->id);
+
+        NVTT_PROFILE("compress image (cuda)", blocks);
+        compressor->compress(alphaMode, w, h, d, rgba, taskDispatcher, compressionOptions, *output);
+    }
+    else if (image != NULL)
+    {
+        NVTT_PROFILE("compress image (8 bit)", blocks);
+        ((ColorBlockCompressor *)compressor.ptr())->compress(alphaMode, image, taskDispatcher, compressionOptions, *output);
+    }
     else
     {
-        compressor->compress(alphaMode, w, h, d, rgba, dispatcher, compressionOptions, outputOptions);
+        NVTT_PROFILE("compress image", blocks);
+        compressor->compress(alphaMode, w, h, d, rgba, taskDispatcher, compressionOptions, *output);
     }
 
-    outputOptions.endImage();
+    output->endImage();
 
-    return true;
+    imageProgress.finish();
+
+    return !outputOptions.isCancelled();
 }
 
 
+void Compressor::Private::beginImage(int w, int h, int d, int face, int mipmap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+{
+    int size = computeImageSize(w, h, d, compressionOptions.getBitCount(), compressionOptions.pitchAlignment, compressionOptions.format);
+
+    if (outputOptions.container == Container_KTX && outputOptions.outputHeader && face == 0) {
+        // Each mipmap starts with the size of its image, for cube maps the size of one face. The sizes are multiples of 4,
+        // so there is no padding.
+        nvDebugCheck(size % 4 == 0);
+        uint32 imageSize = size;
+        if (!outputOptions.writeData(&imageSize, 4)) {
+            outputOptions.error(Error_FileWrite);
+        }
+    }
+
+    outputOptions.beginImage(size, w, h, d, face, mipmap);
+}
+
 void Compressor::Private::quantize(Surface & img, const CompressionOptions::Private & compressionOptions) const
 {
     if (compressionOptions.enableColorDithering) {
@@ -404,9 +2565,142 @@ void Compressor::Private::quantize(Surface & img, const CompressionOptions::Priv
 }
 
 
-bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int h, int d, int mipmapCount, bool isNormalMap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const
+// GL format of the output in a KTX header. Returns false when there is no matching GL format.
+static bool setKtxFormat(KtxHeader & header, const CompressionOptions::Private & compressionOptions, bool srgb)
+{
+    const Format format = compressionOptions.format;
+
+    if (format == Format_RGBA)
+    {
+        const uint rsize = compressionOptions.rsize, gsize = compressionOptions.gsize, bsize = compressionOptions.bsize, asize = compressionOptions.asize;
+
+        if (compressionOptions.pixelType == PixelType_Float)
+        {
+            if (rsize != 16 && rsize != 32) return false;
+
+            header.glType = (rsize == 16) ? KTX_HALF_FLOAT : KTX_FLOAT;
+            header.glTypeSize = rsize / 8;
+
+            if (gsize == 0 && bsize == 0 && asize == 0) {
+                header.glFormat = header.glBaseInternalFormat = KTX_RED;
+                header.glInternalFormat = (rsize == 16) ? KTX_INTERNAL_R16F : KTX_INTERNAL_R32F;
+            }
+            else if (gsize == rsize && bsize == 0 && asize == 0) {
+                header.glFormat = header.glBaseInternalFormat = KTX_RG;
+                header.glInternalFormat = (rsize == 16) ? KTX_INTERNAL_RG16F : KTX_INTERNAL_RG32F;
+            }
+            else if (gsize == rsize && bsize == rsize && asize == rsize) {
+                header.glFormat = header.glBaseInternalFormat = KTX_RGBA;
+                header.glInternalFormat = (rsize == 16) ? KTX_INTERNAL_RGBA16F : KTX_INTERNAL_RGBA32F;
+            }
+            else {
+                return false;
+            }
+            return true;
+        }
+
+        // Same masks as the DDS header.
+        uint bitcount = compressionOptions.bitcount;
+        uint rmask = compressionOptions.rmask, gmask = compressionOptions.gmask, bmask = compressionOptions.bmask, amask = compressionOptions.amask;
+        if (bitcount == 0)
+        {
+            bitcount = compressionOptions.getBitCount();
+            if (bitcount > 32) return false;
+
+            const uint bshift = asize;
+            const uint gshift = bshift + bsize;
+            const uint rshift = gshift + gsize;
+            rmask = ((1 << rsize) - 1) << rshift;
+            gmask = ((1 << gsize) - 1) << gshift;
+            bmask = ((1 << bsize) - 1) << bshift;
+            amask = ((1 << asize) - 1);
+        }
+
+        header.glType = KTX_UNSIGNED_BYTE;
+        header.glTypeSize = 1;
+
+        if (bitcount == 32 && gmask == 0xFF00 && amask == 0xFF000000 && (rmask == 0xFF || rmask == 0xFF0000) && (rmask | bmask) == 0xFF00FF) {
+            header.glFormat = (rmask == 0xFF) ? KTX_FORMAT_RGBA : KTX_FORMAT_BGRA;
+            header.glInternalFormat = srgb ? KTX_INTERNAL_SRGB8_ALPHA8 : KTX_INTERNAL_RGBA8;
+            header.glBaseInternalFormat = KTX_RGBA;
+        }
+        else if (bitcount == 24 && gmask == 0xFF00 && amask == 0 && (rmask == 0xFF || rmask == 0xFF0000) && (rmask | bmask) == 0xFF00FF) {
+            header.glFormat = (rmask == 0xFF) ? KTX_FORMAT_RGB : KTX_FORMAT_BGR;
+            header.glInternalFormat = srgb ? KTX_INTERNAL_SRGB8 : KTX_INTERNAL_RGB8;
+            header.glBaseInternalFormat = KTX_RGB;
+        }
+        else if (bitcount == 16 && rmask == 0xF800 && gmask == 0x7E0 && bmask == 0x1F && amask == 0) {
+            header.glType = KTX_UNSIGNED_SHORT_5_6_5;
+            header.glTypeSize = 2;
+            header.glFormat = header.glBaseInternalFormat = KTX_RGB;
+            header.glInternalFormat = KTX_INTERNAL_RGB565;
+        }
+        else if (bitcount == 16 && rmask == 0xFFFF && gmask == 0 && bmask == 0 && amask == 0) {
+            header.glType = KTX_UNSIGNED_SHORT;
+            header.glTypeSize = 2;
+            header.glFormat = header.glBaseInternalFormat = KTX_RED;
+            header.glInternalFormat = KTX_INTERNAL_R16;
+        }
+        else if (bitcount == 8 && rmask == 0xFF && gmask == 0 && bmask == 0 && amask == 0) {
+            header.glFormat = header.glBaseInternalFormat = KTX_RED;
+            header.glInternalFormat = KTX_INTERNAL_R8;
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    // Compressed formats have no type or format.
+    header.glType = 0;
+    header.glTypeSize = 1;
+    header.glFormat = 0;
+
+    if (format == Format_DXT1) {
+        header.glInternalFormat = srgb ? KTX_INTERNAL_COMPRESSED_SRGB_DXT1 : KTX_INTERNAL_COMPRESSED_RGB_DXT1;
+        header.glBaseInternalFormat = KTX_RGB;
+    }
+    else if (format == Format_DXT1a) {
+        header.glInternalFormat = srgb ? KTX_INTERNAL_COMPRESSED_SRGB_ALPHA_DXT1 : KTX_INTERNAL_COMPRESSED_RGBA_DXT1;
+        header.glBaseInternalFormat = KTX_RGBA;
+    }
+    else if (format == Format_DXT3) {
+        header.glInternalFormat = srgb ? KTX_INTERNAL_COMPRESSED_SRGB_ALPHA_DXT3 : KTX_INTERNAL_COMPRESSED_RGBA_DXT3;
+        header.glBaseInternalFormat = KTX_RGBA;
+    }
+    else if (format == Format_DXT5 || format == Format_BC3_RGBM || format == Format_BC3_YCoCg) {
+        header.glInternalFormat = srgb ? KTX_INTERNAL_COMPRESSED_SRGB_ALPHA_DXT5 : KTX_INTERNAL_COMPRESSED_RGBA_DXT5;
+        header.glBaseInternalFormat = KTX_RGBA;
+    }
+    else if (format == Format_DXT5n) {
+        header.glInternalFormat = KTX_INTERNAL_COMPRESSED_RGBA_DXT5;
+        header.glBaseInternalFormat = KTX_RGBA;
+    }
+    else if (format == Format_BC4) {
+        header.glInternalFormat = KTX_INTERNAL_COMPRESSED_RED_RGTC1;
+        header.glBaseInternalFormat = KTX_RED;
+    }
+    else if (format == Format_BC5 || format == Format_BC5_Luma || format == Format_BC5_Normal) {
+        header.glInternalFormat = KTX_INTERNAL_COMPRESSED_RG_RGTC2;
+        header.glBaseInternalFormat = KTX_RG;
+    }
+    else if (format == Format_BC6) {
+        header.glInternalFormat = (compressionOptions.pixelType == PixelType_Float) ? KTX_INTERNAL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT : KTX_INTERNAL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT;
+        header.glBaseInternalFormat = KTX_RGB;
+    }
+    else if (format == Format_BC7) {
+        header.glInternalFormat = srgb ? KTX_INTERNAL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : KTX_INTERNAL_COMPRESSED_RGBA_BPTC_UNORM;
+        header.glBaseInternalFormat = KTX_RGBA;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int h, int d, int mipmapCount, bool isNormalMap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, int arraySize/*= 1*/) const
 {
-    if (w <= 0 || h <= 0 || d <= 0 || mipmapCount <= 0)
+    if (w <= 0 || h <= 0 || d <= 0 || mipmapCount <= 0 || arraySize <= 0)
     {
         outputOptions.error(Error_InvalidInput);
         return false;
@@ -443,6 +2737,8 @@ bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int
 
         if (outputOptions.container == Container_DDS10)
         {
+            header.setArrayCount(arraySize);
+
             if (compressionOptions.format == Format_RGBA)
             {
                 const uint bitcount = compressionOptions.getBitCount();
@@ -482,7 +2778,7 @@ bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int
                 else if (compressionOptions.format == Format_DXT3) {
                     header.setDX10Format(outputOptions.srgb ? DXGI_FORMAT_BC2_UNORM_SRGB : DXGI_FORMAT_BC2_UNORM);
                 }
-                else if (compressionOptions.format == Format_DXT5 || compressionOptions.format == Format_BC3_RGBM) {
+                else if (compressionOptions.format == Format_DXT5 || compressionOptions.format == Format_BC3_RGBM || compressionOptions.format == Format_BC3_YCoCg) {
                     header.setDX10Format(outputOptions.srgb ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM);
                 }
                 else if (compressionOptions.format == Format_DXT5n) {
@@ -492,7 +2788,7 @@ bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int
                 else if (compressionOptions.format == Format_BC4) {
                     header.setDX10Format(DXGI_FORMAT_BC4_UNORM); // DXGI_FORMAT_BC4_SNORM ?
                 }
-                else if (compressionOptions.format == Format_BC5 || compressionOptions.format == Format_BC5_Luma) {
+                else if (compressionOptions.format == Format_BC5 || compressionOptions.format == Format_BC5_Luma || compressionOptions.format == Format_BC5_Normal) {
                     header.setDX10Format(DXGI_FORMAT_BC5_UNORM); // DXGI_FORMAT_BC5_SNORM ?
                     if (isNormalMap) header.setNormalFlag(true);
                 }
@@ -514,6 +2810,9 @@ bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int
         }
         else
         {
+            // Only the DX10 header has an array size.
+            if (arraySize > 1) supported = false;
+
             if (compressionOptions.format == Format_RGBA)
             {
                 // Get output bit count.
@@ -591,7 +2890,7 @@ bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int
                 else if (compressionOptions.format == Format_DXT3) {
                     header.setFourCC('D', 'X', 'T', '3');
                 }
-                else if (compressionOptions.format == Format_DXT5 || compressionOptions.format == Format_BC3_RGBM) {
+                else if (compressionOptions.format == Format_DXT5 || compressionOptions.format == Format_BC3_RGBM || compressionOptions.format == Format_BC3_YCoCg) {
                     header.setFourCC('D', 'X', 'T', '5');
                 }
                 else if (compressionOptions.format == Format_DXT5n) {
@@ -605,7 +2904,7 @@ bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int
                 else if (compressionOptions.format == Format_BC4) {
                     header.setFourCC('A', 'T', 'I', '1');
                 }
-                else if (compressionOptions.format == Format_BC5 || compressionOptions.format == Format_BC5_Luma) {
+                else if (compressionOptions.format == Format_BC5 || compressionOptions.format == Format_BC5_Luma || compressionOptions.format == Format_BC5_Normal) {
                     header.setFourCC('A', 'T', 'I', '2');
                     if (isNormalMap) {
                         header.setNormalFlag(true);
@@ -633,6 +2932,17 @@ bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int
             if (outputOptions.srgb) header.setSrgbFlag(true);
         }
 
+        if (outputOptions.supercompression != Supercompression_None)
+        {
+            if (!nv::isSupercompressionSupported(outputOptions.supercompression))
+            {
+                outputOptions.error(Error_UnsupportedFeature);
+                return false;
+            }
+
+            header.setSupercompression(outputOptions.supercompression, supercompressionLayout(compressionOptions.format));
+        }
+
         if (!supported)
         {
             // This container does not support the requested format.
@@ -659,12 +2969,60 @@ bool Compressor::Private::outputHeader(nvtt::TextureType textureType, int w, int
         return writeSucceed;
     }
 
+    // Output KTX header.
+    if (outputOptions.container == Container_KTX)
+    {
+        KtxFile ktx;
+
+        // KTX has arrays, but their images are interleaved by mipmap, unlike the ones of compressCubeArray. Supercompression
+        // would need KTX2.
+        if (arraySize > 1 || outputOptions.supercompression != Supercompression_None || !setKtxFormat(ktx.header, compressionOptions, outputOptions.srgb))
+        {
+            outputOptions.error(Error_UnsupportedOutputFormat);
+            return false;
+        }
+
+        ktx.header.pixelWidth = w;
+        ktx.header.pixelHeight = h;
+        ktx.header.pixelDepth = (textureType == TextureType_3D) ? d : 0;
+        ktx.header.numberOfFaces = (textureType == TextureType_Cube) ? 6 : 1;
+        ktx.header.numberOfMipmapLevels = mipmapCount;
+
+        // The first row of the images is the top one.
+        ktx.addKeyValue("KTXorientation", "S=r,T=d");
+
+        // The endianness field lets readers swap the file, the header and the image sizes are written in native order.
+        Array<uint8> buffer;
+        BufferOutputStream stream(buffer);
+        stream.setByteOrder(Stream::getSystemByteOrder());
+        stream << ktx;
+
+        bool writeSucceed = outputOptions.writeData(buffer.buffer(), buffer.count());
+        if (!writeSucceed)
+        {
+            outputOptions.error(Error_FileWrite);
+        }
+
+        return writeSucceed;
+    }
+
     return true;
 }
 
 
 CompressorInterface * Compressor::Private::chooseCpuCompressor(const CompressionOptions::Private & compressionOptions) const
 {
+    // Names other than those of the compressors built in are the libraries of nvtt_encoder.h, the other formats ignore them.
+    const String & external = compressionOptions.externalCompressor;
+    if (!external.isNull() && external != "ati" && external != "squish" && external != "d3dx" && external != "stb" && external != "fastcluster" &&
+        isExternalEncoderFormat(compressionOptions.format))
+    {
+        const NvttEncoder * encoder = findExternalEncoder(external.str());
+        if (encoder == NULL) return NULL;
+
+        return new ExternalCompressor(encoder, compressionOptions.format);
+    }
+
     if (compressionOptions.format == Format_RGB)
     {
         return new PixelFormatConverter;
@@ -691,6 +3049,9 @@ CompressorInterface * Compressor::Private::chooseCpuCompressor(const Compression
         else
 #endif
 
+        if (!compressionOptions.externalCompressor.isNull() && compressionOptions.externalCompressor == "fastcluster") return new FastClusterCompressorDXT1;
+        else
+
         if (compressionOptions.quality == Quality_Fastest)
         {
             return new FastCompressorDXT1;
@@ -727,6 +3088,9 @@ CompressorInterface * Compressor::Private::chooseCpuCompressor(const Compression
         else
 #endif
 
+        if (!compressionOptions.externalCompressor.isNull() && compressionOptions.externalCompressor == "fastcluster") return new FastClusterCompressorDXT5;
+        else
+
         if (compressionOptions.quality == Quality_Fastest)
         {
             return new FastCompressorDXT5;
@@ -745,19 +3109,27 @@ CompressorInterface * Compressor::Private::chooseCpuCompressor(const Compression
     }
     else if (compressionOptions.format == Format_BC4)
     {
-        if (compressionOptions.quality == Quality_Fastest || compressionOptions.quality == Quality_Normal)
+        if (compressionOptions.quality == Quality_Fastest)
         {
             return new FastCompressorBC4;
         }
+        else if (compressionOptions.quality == Quality_Normal)
+        {
+            return new CompressorBC4;
+        }
 
         return new ProductionCompressorBC4;
     }
     else if (compressionOptions.format == Format_BC5)
     {
-        if (compressionOptions.quality == Quality_Fastest || compressionOptions.quality == Quality_Normal)
+        if (compressionOptions.quality == Quality_Fastest)
         {
             return new FastCompressorBC5;
         }
+        else if (compressionOptions.quality == Quality_Normal)
+        {
+            return new CompressorBC5;
+        }
 
         return new ProductionCompressorBC5;
     }
@@ -781,6 +3153,14 @@ CompressorInterface * Compressor::Private::chooseCpuCompressor(const Compression
     {
         return new CompressorBC3_RGBM;
     }
+    else if (compressionOptions.format == Format_BC3_YCoCg)
+    {
+        return new CompressorBC3_YCoCg;
+    }
+    else if (compressionOptions.format == Format_BC5_Normal)
+    {
+        return new CompressorBC5_Normal;
+    }
 
     return NULL;
 }
@@ -788,7 +3168,11 @@ CompressorInterface * Compressor::Private::chooseCpuCompressor(const Compression
 
 CompressorInterface * Compressor::Private::chooseGpuCompressor(const CompressionOptions::Private & compressionOptions) const
 {
-    nvDebugCheck(cudaSupported);
+    // The context has to be created by cudaContext first.
+    if (cuda == NULL)
+    {
+        return NULL;
+    }
 
     if (compressionOptions.quality == Quality_Fastest)
     {
@@ -799,7 +3183,7 @@ CompressorInterface * Compressor::Private::chooseGpuCompressor(const Compression
 #if defined HAVE_CUDA
     if (compressionOptions.format == Format_DXT1)
     {
-        return new CudaCompressorDXT1(*cuda);
+        return new CudaCompressorDXT1(*cuda->context);
     }
     else if (compressionOptions.format == Format_DXT1a)
     {
@@ -823,11 +3207,11 @@ CompressorInterface * Compressor::Private::chooseGpuCompressor(const Compression
     }
     else if (compressionOptions.format == Format_BC4)
     {
-        // Not supported.
+        return new CudaCompressorBC4(*cuda->context);
     }
     else if (compressionOptions.format == Format_BC5)
     {
-        // Not supported.
+        return new CudaCompressorBC5(*cuda->context);
     }
     else if (compressionOptions.format == Format_CTX1)
     {
@@ -845,3 +3229,206 @@ CompressorInterface * Compressor::Private::chooseGpuCompressor(const Compression
 
     return NULL;
 }
+
+
+#if defined HAVE_CUDA
+namespace
+{
+    // Discards the images compressed by the calibration.
+    struct NullOutputHandler : public nvtt::OutputHandler
+    {
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel) {}
+        virtual bool writeData(const void * data, int size) { return true; }
+        virtual void endImage() {}
+    };
+
+    // Best time of a few runs, the first one also warms up the device and the caches.
+    float timeCompressor(CompressorInterface * compressor, int w, const float * data, TaskDispatcher * dispatcher, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions)
+    {
+        float best = FLT_MAX;
+        for (int i = 0; i < 3; i++) {
+            Timer timer;
+            timer.start();
+            compressor->compress(AlphaMode_None, w, w, 1, data, dispatcher, compressionOptions, outputOptions);
+            timer.stop();
+            best = min(best, timer.elapsed());
+        }
+        return best;
+    }
+
+    // The crossovers of each set of devices of the machine, one "<texels> <device names>" line each.
+    bool crossoverFileName(Path * fileName)
+    {
+#if NV_OS_WIN32
+        const char * directory = getenv("LOCALAPPDATA");
+#else
+        const char * directory = getenv("HOME");
+#endif
+        if (directory == NULL) return false;
+
+        *fileName = directory;
+        fileName->appendSeparator();
+        fileName->append(".nvtt_cuda_crossover");
+        return true;
+    }
+}
+#endif
+
+// Smallest level that the GPU compresses faster than the CPU, timed with DXT1 on square images. The result is cached in
+// the home directory of the user, so that each machine and set of devices is only measured once.
+nv::CudaContext * Compressor::Private::cudaContext() const
+{
+    if (!cudaEnabled)
+    {
+        return NULL;
+    }
+
+    nv::Lock<nv::Mutex> lock(s_cudaContextMutex);
+
+    if (cuda == NULL && !cudaFailed)
+    {
+        if (s_cudaHardwarePresent < 0)
+        {
+            s_cudaHardwarePresent = cuda::isHardwarePresent() ? 1 : 0;
+        }
+
+        for (uint i = 0; i < s_cudaContexts.count() && cuda == NULL; i++)
+        {
+            if (s_cudaContexts[i]->deviceMask == cudaDeviceMask) cuda = s_cudaContexts[i];
+        }
+
+        if (cuda == NULL && s_cudaHardwarePresent)
+        {
+            AutoPtr<CudaContext> context(new CudaContext(cudaDeviceMask));
+
+            if (context->isValid())
+            {
+                cuda = new SharedCudaContext;
+                cuda->context = context.release();
+                cuda->deviceMask = cudaDeviceMask;
+                cuda->refCount = 0;
+                cuda->minTexels = calibrateCuda();
+                s_cudaContexts.append(cuda);
+            }
+        }
+
+        if (cuda != NULL)
+        {
+            cuda->refCount++;
+            cudaMinTexels = cuda->minTexels;
+        }
+        else
+        {
+            cudaFailed = true;
+        }
+    }
+
+    return (cuda != NULL) ? cuda->context : NULL;
+}
+
+// The context is destroyed with the last compressor that uses it.
+void Compressor::Private::releaseCudaContext()
+{
+    nv::Lock<nv::Mutex> lock(s_cudaContextMutex);
+
+    if (cuda != NULL && --cuda->refCount == 0)
+    {
+        s_cudaContexts.remove(cuda);
+        delete cuda->context;
+        delete cuda;
+    }
+
+    cuda = NULL;
+    cudaFailed = false;
+}
+
+uint Compressor::Private::calibrateCuda() const
+{
+#if defined HAVE_CUDA
+    StringBuilder devices;
+    for (uint d = 0; d < cuda->context->deviceCount; d++) {
+        char name[256];
+        if (!cuda::getDeviceName(cuda->context->device[d]->id, name, sizeof(name))) name[0] = '\0';
+        if (d != 0) devices.append(", ");
+        devices.append(name);
+    }
+
+    Path fileName;
+    const bool cached = crossoverFileName(&fileName);
+
+    if (cached) {
+        FILE * fp = fileOpen(fileName.str(), "r");
+        if (fp != NULL) {
+            char line[1024];
+            uint texels = 0;
+            while (fgets(line, sizeof(line), fp) != NULL) {
+                char * end = NULL;
+                const uint value = uint(strtoul(line, &end, 10));
+                if (*end != ' ') continue;
+
+                // Strip the end of line.
+                end++;
+                end[strcspn(end, "\r\n")] = '\0';
+
+                if (strcmp(end, devices.str()) == 0) texels = value;
+            }
+            fclose(fp);
+
+            if (texels != 0) return texels;
+        }
+    }
+
+    NullOutputHandler nullOutputHandler;
+    OutputOptions outputOptions;
+    outputOptions.setOutputHandler(&nullOutputHandler);
+
+    CompressionOptions compressionOptions;
+    compressionOptions.setFormat(Format_DXT1);
+
+    AutoPtr<CompressorInterface> gpuCompressor(chooseGpuCompressor(compressionOptions.m));
+    AutoPtr<CompressorInterface> cpuCompressor(chooseCpuCompressor(compressionOptions.m));
+
+    // Past the largest size the GPU never wins.
+    const int maxWidth = 512;
+    uint texels = 4 * maxWidth * maxWidth;
+
+    cuda::setDevice(cuda->context->device[0]->id);
+
+    for (int w = 8; w <= maxWidth; w *= 2) {
+        // Noisy gradients, so that the blocks aren't trivial.
+        const uint count = w * w;
+        Array<float> data;
+        data.resize(count * 4);
+
+        uint seed = 1;
+        for (uint i = 0; i < count; i++) {
+            seed = seed * 1103515245 + 12345;
+            const float noise = float((seed >> 16) & 0xFF) / 1024.0f;
+            data[count * 0 + i] = float(i % w) / w * 0.75f + noise;
+            data[count * 1 + i] = float(i / w) / w * 0.75f + noise;
+            data[count * 2 + i] = 0.5f + noise;
+            data[count * 3 + i] = 1.0f;
+        }
+
+        const float gpuTime = timeCompressor(gpuCompressor.ptr(), w, data.buffer(), dispatcher, compressionOptions.m, outputOptions.m);
+        const float cpuTime = timeCompressor(cpuCompressor.ptr(), w, data.buffer(), dispatcher, compressionOptions.m, outputOptions.m);
+
+        if (gpuTime < cpuTime) {
+            texels = count;
+            break;
+        }
+    }
+
+    if (cached) {
+        FILE * fp = fileOpen(fileName.str(), "a");
+        if (fp != NULL) {
+            fprintf(fp, "%u %s\n", texels, devices.str());
+            fclose(fp);
+        }
+    }
+
+    return texels;
+#else
+    return 0;
+#endif
+}
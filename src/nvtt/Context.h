@@ -32,6 +32,8 @@
 #include "nvtt.h"
 #include "TaskDispatcher.h"
 
+#include "nvthread/Mutex.h"
+
 namespace nv
 {
     class Image;
@@ -40,27 +42,62 @@ namespace nv
 namespace nvtt
 {
     struct Mipmap;
+    class OutputCache;
+    struct SharedCudaContext;
 
     struct Compressor::Private
     {
         Private() {}
 
-        bool compress(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool compress(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, const InputOptions::Private * previousInputOptions = NULL, const char * previousFileName = NULL) const;
+        bool compress(const InputOptions::Private & inputOptions, int targetCount, const CompressionOptions::Private * const * compressionOptions, const OutputOptions::Private * const * outputOptions, const InputOptions::Private * previousInputOptions = NULL, const char * previousFileName = NULL) const;
         bool compress(const Surface & tex, int face, int mipmap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
         bool compress(AlphaMode alphaMode, int w, int h, int d, int face, int mipmap, const float * data, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
-
+        bool compress(AlphaMode alphaMode, int face, int mipmap, const nv::Image * image, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool compressTexels(AlphaMode alphaMode, int w, int h, int d, int face, int mipmap, const float * data, const nv::Image * image, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool compressCubeArray(const CubeSurface * mipmaps, int cubeCount, int mipmapCount, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool transcode(const char * fileName, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool compressCached(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        bool process(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, const InputOptions::Private * previousInputOptions, const char * previousFileName) const;
+        bool processChecked(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, const InputOptions::Private * previousInputOptions, const char * previousFileName);
+
+        void beginImage(int w, int h, int d, int face, int mipmap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
         void quantize(Surface & tex, const CompressionOptions::Private & compressionOptions) const;
 
-        bool outputHeader(nvtt::TextureType textureType, int w, int h, int d, int mipmapCount, bool isNormalMap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions) const;
+        struct MipmapChain;
+        bool loadPrevious(MipmapChain & chain, const InputOptions::Private & previousInputOptions, const char * previousFileName) const;
+        void compressFace(MipmapChain & chain, int face) const;
+        int compressFaceGpu(MipmapChain & chain, int face, Surface & img) const;
+        void nextLevel(MipmapChain & chain, Surface & img, Surface & previous, int face, int mipmap, bool & canUseSourceImages) const;
+        bool nextLevelToGamma(const MipmapChain & chain, Surface & img, Surface & previous, Surface & nextImg, Surface & nextPrevious, bool canUseSourceImages) const;
+        void compressLevel(MipmapChain & chain, Surface & img, Surface & previous, int face, int mipmap, bool isGamma) const;
+        void processLevel(const MipmapChain & chain, Surface & img, Surface & previous, int face, int mipmap, bool isGamma, const OutputOptions::Private & outputOptions) const;
+        bool canCompressImages(const MipmapChain & chain) const;
+        void compressFaceImages(MipmapChain & chain, int face) const;
+
+        bool outputHeader(nvtt::TextureType textureType, int w, int h, int d, int mipmapCount, bool isNormalMap, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, int arraySize = 1) const;
 
         nv::CompressorInterface * chooseCpuCompressor(const CompressionOptions::Private & compressionOptions) const;
         nv::CompressorInterface * chooseGpuCompressor(const CompressionOptions::Private & compressionOptions) const;
 
+        nv::CudaContext * cudaContext() const;
+        void releaseCudaContext();
+        uint calibrateCuda() const;
 
-        bool cudaSupported;
-        bool cudaEnabled;
 
-        nv::AutoPtr<nv::CudaContext> cuda;
+        bool cudaEnabled;
+        uint cudaDeviceMask;
+        mutable uint cudaMinTexels;     // Smaller levels are faster on the CPU, calibrated once per machine.
+        mutable bool cudaFailed;        // No usable device in the mask.
+        bool pipelineEnabled;
+        bool memoryPoolEnabled;
+        bool determinismCheckEnabled;
+        mutable size_t lastPeakMemory;  // Above the allocation at the start of the last process() call.
+
+        nv::AutoPtr<OutputCache> outputCache;
+
+        // Created the first time a format with a GPU compressor is compressed, and shared with the compressors that use the same devices.
+        mutable SharedCudaContext * cuda;
 
         TaskDispatcher * dispatcher;
         //SequentialTaskDispatcher defaultDispatcher;
@@ -23,14 +23,34 @@
 
 #include "CubeSurface.h"
 #include "Surface.h"
+#include "Progress.h"
+#include "cuda/CudaUtils.h"
+#include "cuda/CudaSurface.h"
 
 #include "nvimage/DirectDrawSurface.h"
 
 #include "nvmath/Vector.inl"
+#include "nvmath/SphericalHarmonic.h"
+#include "nvmath/ftoi.h"
 
 #include "nvcore/Array.inl"
 #include "nvcore/StrLib.h"
 
+#include "nvthread/TaskScheduler.h"
+#include "nvthread/Mutex.h"
+
+extern "C" {
+#include "ArHosekSkyModel.h"
+}
+
+#if NV_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 using namespace nv;
 using namespace nvtt;
 
@@ -135,47 +155,6 @@ static Vector3 texelDirection(uint face, uint x, uint y, int edgeLength, EdgeFix
 }
 
 
-TexelTable::TexelTable(uint edgeLength) : size(edgeLength) {
-
-    uint hsize = size/2;
-
-    // Allocate a small solid angle table that takes into account cube map symmetry.
-    solidAngleArray.resize(hsize * hsize);
-
-    for (uint y = 0; y < hsize; y++) {
-        for (uint x = 0; x < hsize; x++) {
-            solidAngleArray[y * hsize + x] = solidAngleTerm(hsize+x, hsize+y, 1.0f/edgeLength);
-        }
-    }
-
-
-    directionArray.resize(size*size*6);
-
-    for (uint f = 0; f < 6; f++) {
-        for (uint y = 0; y < size; y++) {
-            for (uint x = 0; x < size; x++) {
-                directionArray[(f * size + y) * size + x] = texelDirection(f, x, y, edgeLength, EdgeFixup_None);
-            }
-        }
-    }
-}
-
-const Vector3 & TexelTable::direction(uint f, uint x, uint y) const {
-    nvDebugCheck(f < 6 && x < size && y < size);
-    return directionArray[(f * size + y) * size + x];
-}
-
-float TexelTable::solidAngle(uint f, uint x, uint y) const {
-    uint hsize = size/2;
-    if (x >= hsize) x -= hsize;
-    else if (x < hsize) x = hsize - x - 1;
-    if (y >= hsize) y -= hsize;
-    else if (y < hsize) y = hsize - y - 1;
-
-    return solidAngleArray[y * hsize + x];
-}
-
-
 static const Vector3 faceNormals[6] = {
     Vector3(1, 0, 0),
     Vector3(-1, 0, 0),
@@ -204,6 +183,175 @@ static const Vector3 faceV[6] = {
 };
 
 
+static int faceCoordinates(const Vector3 & dir, float scale, float * s, float * t);
+
+
+// Cache of the texel tables in use, at most one per edge length.
+static nv::Mutex s_texelTableMutex;
+static Array<TexelTable *> s_texelTables;
+
+const TexelTable * TexelTable::acquire(uint edgeLength)
+{
+    nv::Lock<nv::Mutex> lock(s_texelTableMutex);
+
+    for (uint i = 0; i < s_texelTables.count(); i++) {
+        if (s_texelTables[i]->size == edgeLength) {
+            s_texelTables[i]->refCount++;
+            return s_texelTables[i];
+        }
+    }
+
+    // @@ Build the table outside the lock?
+    TexelTable * table = new TexelTable(edgeLength);
+    table->refCount = 1;
+    s_texelTables.append(table);
+    return table;
+}
+
+void TexelTable::release(const TexelTable * table)
+{
+    nv::Lock<nv::Mutex> lock(s_texelTableMutex);
+
+    TexelTable * t = const_cast<TexelTable *>(table);
+    nvDebugCheck(t->refCount > 0);
+    if (--t->refCount == 0) {
+        s_texelTables.remove(t);
+        delete t;
+    }
+}
+
+TexelTable::TexelTable(uint edgeLength) : size(edgeLength), refCount(0) {
+
+    // Compute the solid angles of a quadrant, that takes into account cube map symmetry, and mirror them to the other
+    // quadrants. With odd sizes the quadrant includes the center row and column.
+    const uint hsize = (size+1)/2;
+    solidAngleArray.resize(size * size);
+
+    for (uint y = 0; y < hsize; y++) {
+        for (uint x = 0; x < hsize; x++) {
+            const float solidAngle = solidAngleTerm(size/2+x, size/2+y, 1.0f/edgeLength);
+            const uint x0 = size/2 + x, x1 = (size-1)/2 - x;
+            const uint y0 = size/2 + y, y1 = (size-1)/2 - y;
+            solidAngleArray[y0 * size + x0] = solidAngle;
+            solidAngleArray[y0 * size + x1] = solidAngle;
+            solidAngleArray[y1 * size + x0] = solidAngle;
+            solidAngleArray[y1 * size + x1] = solidAngle;
+        }
+    }
+
+
+    for (uint c = 0; c < 3; c++) {
+        directionArray[c].resize(size*size);
+    }
+
+    for (uint y = 0; y < size; y++) {
+        for (uint x = 0; x < size; x++) {
+            const Vector3 dir = toFaceFrame(0, texelDirection(0, x, y, edgeLength, EdgeFixup_None));
+            const uint i = y * size + x;
+            directionArray[0][i] = dir.x;
+            directionArray[1][i] = dir.y;
+            directionArray[2][i] = dir.z;
+        }
+    }
+
+
+    // The texels around the border of a face are the ones of the neighbouring faces that contain the directions just past
+    // its edges, at the centers of its edge texels.
+    borderArray.resize(6 * 4 * size);
+
+    const float past = 1.0f + 0.5f / size;
+    for (uint f = 0; f < 6; f++) {
+        for (uint i = 0; i < size; i++) {
+            const float center = (float(i) + 0.5f) * (2.0f / size) - 1.0f;
+            const float u[4] = { center, center, -past, past };
+            const float v[4] = { -past, past, center, center };
+
+            for (uint e = 0; e < 4; e++) {
+                float s, t;
+                const int neighbour = faceCoordinates(faceNormals[f] + faceU[f] * u[e] + faceV[f] * v[e], 0.5f * size, &s, &t);
+                const uint x = nv::clamp(ifloor(s + 0.5f), 0, int(size) - 1);
+                const uint y = nv::clamp(ifloor(t + 0.5f), 0, int(size) - 1);
+                borderArray[(4 * f + e) * size + i] = (neighbour * size + y) * size + x;
+            }
+        }
+    }
+
+    // The tile cones are centered on the direction of the center of the tile. Faces are flat, so the texel furthest from
+    // the axis is one of the corners.
+    tileCount = (size + tileSize - 1) / tileSize;
+    tileAxisArray.resize(tileCount * tileCount);
+    tileCosineArray.resize(tileCount * tileCount);
+    tileSineArray.resize(tileCount * tileCount);
+
+    for (uint t = 0; t < tileCount * tileCount; t++) {
+        uint x0, y0, x1, y1;
+        tileBounds(t, &x0, &y0, &x1, &y1);
+
+        const uint corners[4] = { y0 * size + x0, y0 * size + x1 - 1, (y1 - 1) * size + x0, (y1 - 1) * size + x1 - 1 };
+
+        Vector3 cornerDirs[4];
+        for (uint i = 0; i < 4; i++) {
+            cornerDirs[i] = Vector3(directionArray[0][corners[i]], directionArray[1][corners[i]], directionArray[2][corners[i]]);
+        }
+        const Vector3 axis = normalize(cornerDirs[0] + cornerDirs[1] + cornerDirs[2] + cornerDirs[3]);
+
+        float minCosine = 1.0f;
+        for (uint i = 0; i < 4; i++) {
+            minCosine = min(minCosine, dot(axis, cornerDirs[i]));
+        }
+
+        // Widen the cone a little, so that rounding doesn't cull texels on its border.
+        const float halfAngle = acosf(nv::clamp(minCosine, -1.0f, 1.0f)) + 0.001f;
+
+        tileAxisArray[t] = axis;
+        tileCosineArray[t] = cosf(halfAngle);
+        tileSineArray[t] = sinf(halfAngle);
+    }
+}
+
+Vector3 TexelTable::toFaceFrame(uint f, const Vector3 & dir) {
+    nvDebugCheck(f < 6);
+    return Vector3(dot(dir, faceU[f]), dot(dir, faceV[f]), dot(dir, faceNormals[f]));
+}
+
+Vector3 TexelTable::direction(uint f, uint x, uint y) const {
+    nvDebugCheck(f < 6 && x < size && y < size);
+    const uint i = y * size + x;
+    return faceU[f] * directionArray[0][i] + faceV[f] * directionArray[1][i] + faceNormals[f] * directionArray[2][i];
+}
+
+uint TexelTable::borderTexel(uint f, int x, int y) const {
+    nvDebugCheck(f < 6);
+    if (y < 0 || y >= int(size)) {
+        nvDebugCheck(x >= 0 && x < int(size) && (y == -1 || y == int(size)));
+        return borderArray[(4 * f + (y < 0 ? 0 : 1)) * size + x];
+    }
+    nvDebugCheck(x == -1 || x == int(size));
+    return borderArray[(4 * f + (x < 0 ? 2 : 3)) * size + y];
+}
+
+float TexelTable::solidAngle(uint f, uint x, uint y) const {
+    nvDebugCheck(f < 6 && x < size && y < size);
+    return solidAngleArray[y * size + x];
+}
+
+// Texels [x0, x1) x [y0, y1) of tile t of any face.
+void TexelTable::tileBounds(uint t, uint * x0, uint * y0, uint * x1, uint * y1) const {
+    nvDebugCheck(t < tileCount * tileCount);
+    *x0 = (t % tileCount) * tileSize;
+    *y0 = (t / tileCount) * tileSize;
+    *x1 = min(*x0 + tileSize, size);
+    *y1 = min(*y0 + tileSize, size);
+}
+
+// A tile can only have texels in a cone if the angle between their axes is at most the sum of their half angles. Both half
+// angles are less than PI/2, so the cosine of their sum is decreasing. The axis of the cone is in the frame of the face.
+bool TexelTable::tileIntersectsCone(uint t, const Vector3 & faceDir, float cosineConeAngle, float sineConeAngle) const {
+    const float cosineSum = cosineConeAngle * tileCosineArray[t] - sineConeAngle * tileSineArray[t];
+    return dot(faceDir, tileAxisArray[t]) >= cosineSum;
+}
+
+
 static Vector2 toPolar(Vector3::Arg v) {
     Vector2 p;
     p.x = atan2(v.x, v.y);  // theta
@@ -302,7 +450,7 @@ const Surface & CubeSurface::face(int f) const
 
 bool CubeSurface::load(const char * fileName, int mipmap)
 {
-    if (strEqual(Path::extension(fileName), ".dds")) {
+    if (strEqual(Path::extension(fileName), ".dds") || strEqual(Path::extension(fileName), ".ddsz")) {
         nv::DirectDrawSurface dds(fileName);
 
         if (!dds.isValid()/* || !dds.isSupported()*/) {
@@ -347,16 +495,20 @@ bool CubeSurface::load(const char * fileName, int mipmap)
         uint edgeLength = dds.surfaceWidth(mipmap);
         uint size = dds.surfaceSize(mipmap);
 
-        void * data = malloc(size);
+        void * data = mem::malloc(size);
 
         for (int f = 0; f < 6; f++) {
-            dds.readSurface(f, mipmap, data, size);
-            m->face[f].setImage(inputFormat, edgeLength, edgeLength, 1, data);
+            const void * mapped = dds.surfaceData(f, mipmap);
+            if (mapped == NULL) {
+                dds.readSurface(f, mipmap, data, size);
+                mapped = data;
+            }
+            m->face[f].setImage(inputFormat, edgeLength, edgeLength, 1, mapped);
         }
 
         m->edgeLength = edgeLength;
 
-        free(data);
+        mem::free(data);
 
         return true;
     }
@@ -380,92 +532,183 @@ static const ivec2 foldOffsetHorizontalCross[6] = { {2, 1}, {0, 1}, {1, 0}, {1,
 static const ivec2 foldOffsetColumn[6]          = { {0, 0}, {0, 1}, {0, 2}, {0, 3}, {0, 4}, {0, 5} };
 static const ivec2 foldOffsetRow[6]             = { {0, 0}, {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0} };
 
-void CubeSurface::fold(const Surface & tex, CubeLayout layout)
+namespace
+{
+    // Below this many texels the cubes are processed on the calling thread.
+    const uint kParallelCubeThreshold = 64 * 1024;
+
+    static const ivec2 * foldOffsets(CubeLayout layout)
+    {
+        switch(layout) {
+            case CubeLayout_LatitudeLongitude:
+            case CubeLayout_VerticalCross:
+                return foldOffsetVerticalCross;
+            case CubeLayout_HorizontalCross:
+                return foldOffsetHorizontalCross;
+            case CubeLayout_Column:
+                return foldOffsetColumn;
+            case CubeLayout_Row:
+                return foldOffsetRow;
+        }
+        return NULL;
+    }
+
+    // In the vertical cross the back face is rotated 180 degrees.
+    static bool isBackFaceRotated(CubeLayout layout)
+    {
+        return layout == CubeLayout_VerticalCross || layout == CubeLayout_LatitudeLongitude;
+    }
+
+    struct FoldContext
+    {
+        const Surface * images;
+        CubeSurface * cubes;
+        CubeLayout layout;
+        bool unfold;                    // Copy the faces to the images instead.
+    };
+
+    // One item per row of a face, the rows of all the faces of all the cubes are numbered consecutively.
+    static void FoldTask(void * context, int id)
+    {
+        const FoldContext * ctx = (const FoldContext *)context;
+
+        const uint edgeLength = ctx->cubes[0].m->edgeLength;
+        const uint i = id / (6 * edgeLength);
+        const uint f = (id / edgeLength) % 6;
+        const uint y = id % edgeLength;
+
+        FloatImage * faceImage = ctx->cubes[i].m->face[f].m->image;
+        FloatImage * image = ctx->images[i].m->image;
+
+        const ivec2 offset = foldOffsets(ctx->layout)[f];
+        const bool rotated = (f == 5 && isBackFaceRotated(ctx->layout));
+        const uint faceY = rotated ? edgeLength - 1 - y : y;
+        const uint imageOffset = (offset.y * edgeLength + y) * image->width() + offset.x * edgeLength;
+
+        for (uint c = 0; c < 4; c++) {
+            float * faceRow = faceImage->channel(c) + faceY * edgeLength;
+            float * imageRow = image->channel(c) + imageOffset;
+
+            if (!rotated) {
+                if (ctx->unfold) memcpy(imageRow, faceRow, edgeLength * sizeof(float));
+                else memcpy(faceRow, imageRow, edgeLength * sizeof(float));
+            }
+            else {
+                for (uint x = 0; x < edgeLength; x++) {
+                    if (ctx->unfold) imageRow[x] = faceRow[edgeLength - 1 - x];
+                    else faceRow[edgeLength - 1 - x] = imageRow[x];
+                }
+            }
+        }
+    }
+
+    static void runFoldTask(FoldContext * context, uint count)
+    {
+        const uint edgeLength = context->cubes[0].m->edgeLength;
+        const uint rowCount = count * 6 * edgeLength;
+
+        if (rowCount * edgeLength < kParallelCubeThreshold) {
+            for (uint i = 0; i < rowCount; i++) {
+                FoldTask(context, i);
+            }
+        }
+        else {
+            TaskScheduler::global()->parallelFor(FoldTask, context, rowCount);
+        }
+    }
+}
+
+void nvtt::foldCubes(const Surface * images, int count, CubeLayout layout, CubeSurface * cubes)
 {
-    ivec2 const* offsets = 0;
-    uint edgeLength;
+    if (count <= 0) return;
 
+    uint edgeLength = 0;
     switch(layout) {
         case CubeLayout_LatitudeLongitude:
         case CubeLayout_VerticalCross:
-            edgeLength = tex.height() / 4;
-            offsets = foldOffsetVerticalCross;
+            edgeLength = images[0].height() / 4;
             break;
         case CubeLayout_HorizontalCross:
-            edgeLength = tex.width() / 4;
-            offsets = foldOffsetHorizontalCross;
+            edgeLength = images[0].width() / 4;
             break;
         case CubeLayout_Column:
-            edgeLength = tex.width();
-            offsets = foldOffsetColumn;
+            edgeLength = images[0].width();
             break;
         case CubeLayout_Row:
-            edgeLength = tex.height();
-            offsets = foldOffsetRow;
+            edgeLength = images[0].height();
             break;
     }
 
-    m->edgeLength = edgeLength;
-    for(uint f = 0; f < 6; f++) {
-        uint x = offsets[f].x * edgeLength;
-        uint y = offsets[f].y * edgeLength;
-        m->face[f] = tex.createSubImage(x, x + edgeLength - 1, y, y + edgeLength - 1, 0, 0);
-    }
+    for (int i = 0; i < count; i++) {
+        nvCheck(images[i].width() == images[0].width() && images[i].height() == images[0].height());
+        images[i].m->flush();
 
-    if(layout == CubeLayout_VerticalCross || layout == CubeLayout_LatitudeLongitude) {
-        // Back face needs to be rotated 180 degrees
-        m->face[5].flipX();
-        m->face[5].flipY();
+        cubes[i].detach();
+        cubes[i].m->allocate(edgeLength);
     }
+
+    FoldContext context;
+    context.images = images;
+    context.cubes = cubes;
+    context.layout = layout;
+    context.unfold = false;
+
+    runFoldTask(&context, count);
 }
 
-Surface CubeSurface::unfold(CubeLayout layout) const
+void nvtt::unfoldCubes(const CubeSurface * cubes, int count, CubeLayout layout, Surface * images)
 {
-    ivec2 const* offsets = 0;
-    uint edgeLength = m->edgeLength;
-    uint width;
-    uint height;
+    if (count <= 0) return;
+
+    const uint edgeLength = cubes[0].m->edgeLength;
+    uint width = 0;
+    uint height = 0;
 
     switch(layout) {
         case CubeLayout_LatitudeLongitude:
         case CubeLayout_VerticalCross:
-            offsets = foldOffsetVerticalCross;
             width = 3 * edgeLength;
             height = 4 * edgeLength;
-            // Back face needs to be rotated 180 degrees
-            m->face[5].flipX();
-            m->face[5].flipY();
             break;
         case CubeLayout_HorizontalCross:
-            offsets = foldOffsetHorizontalCross;
             width = 4 * edgeLength;
             height = 3 * edgeLength;
             break;
         case CubeLayout_Column:
-            offsets = foldOffsetColumn;
             width = edgeLength;
             height = 6 * edgeLength;
             break;
         case CubeLayout_Row:
-            offsets = foldOffsetRow;
             width = 6 * edgeLength;
             height = edgeLength;
             break;
     }
 
-    Surface surface;
-    surface.setImage(width, height, 1);
-    for(uint f = 0; f < 6; f++) {
-        uint x = offsets[f].x * edgeLength;
-        uint y = offsets[f].y * edgeLength;
-        surface.copy(m->face[f], 0, 0, 0, edgeLength, edgeLength, 1, x, y, 0);
-    }
+    for (int i = 0; i < count; i++) {
+        nvCheck(cubes[i].m->edgeLength == edgeLength);
+        cubes[i].m->flushFaces();
 
-    if(layout == CubeLayout_VerticalCross || layout == CubeLayout_LatitudeLongitude) {
-        // Undo back face rotation
-        m->face[5].flipY();
-        m->face[5].flipX();
+        images[i].setImage(width, height, 1);
     }
+
+    FoldContext context;
+    context.images = images;
+    context.cubes = const_cast<CubeSurface *>(cubes);
+    context.layout = layout;
+    context.unfold = true;
+
+    runFoldTask(&context, count);
+}
+
+void CubeSurface::fold(const Surface & tex, CubeLayout layout)
+{
+    foldCubes(&tex, 1, layout, this);
+}
+
+Surface CubeSurface::unfold(CubeLayout layout) const
+{
+    Surface surface;
+    unfoldCubes(this, 1, layout, &surface);
     return surface;
 }
 
@@ -473,6 +716,7 @@ float CubeSurface::average(int channel) const
 {
     const uint edgeLength = m->edgeLength;
     m->allocateTexelTable();
+    m->flushFaces();
 
     float total = 0.0f;
     float sum = 0.0f;
@@ -495,22 +739,17 @@ float CubeSurface::average(int channel) const
 
 void CubeSurface::range(int channel, float * minimum_ptr, float * maximum_ptr) const
 {
-    const uint edgeLength = m->edgeLength;
-    m->allocateTexelTable();
+    m->flushFaces();
 
     float minimum = NV_FLOAT_MAX;
     float maximum = 0.0f;
 
     for (int f = 0; f < 6; f++) {
-        float * c = m->face[f].m->image->channel(channel);
+        float faceMinimum, faceMaximum;
+        m->face[f].m->image->range(channel, &faceMinimum, &faceMaximum);
 
-         for (uint y = 0; y < edgeLength; y++) {
-             for (uint x = 0; x < edgeLength; x++) {
-
-                 minimum = nv::min(minimum, c[y * edgeLength + x]);
-                 maximum = nv::max(maximum, c[y * edgeLength + x]);
-            }
-        }
+        minimum = nv::min(minimum, faceMinimum);
+        maximum = nv::max(maximum, faceMaximum);
     }
 
     *minimum_ptr = minimum;
@@ -525,51 +764,240 @@ void CubeSurface::clamp(int channel, float low/*= 0.0f*/, float high/*= 1.0f*/)
 
 
 
-#include "nvmath/SphericalHarmonic.h"
-
-CubeSurface CubeSurface::irradianceFilter(int size, EdgeFixup fixupMethod) const
+namespace
 {
-    m->allocateTexelTable();
+    // Below this many texels the projection and the evaluation run on the calling thread.
+    const uint kParallelShThreshold = 64 * 1024;
 
-    // Transform this cube to spherical harmonic basis
-    Sh2 sh;
+    // Approximate number of texels handled by each task.
+    const uint kShTaskSize = 16 * 1024;
+
+    // Convolution of each band with the clamped cosine lobe, normalized so that a constant cube keeps its value.
+    const float kCosineBandScale[9] = {
+        1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f
+    };
+
+    struct ShProjectionContext
+    {
+        const CubeSurface::Private * cube;
+        uint rowsPerTask;
+        double * sums;                  // 27 per task, the 9 coefficients of each channel.
+    };
+
+    // Add the projection of one row of texels to the coefficients of each channel.
+    static void projectRow(const ShProjectionContext * ctx, uint f, uint y, const float * solidAngles, ShL2 * sh)
+    {
+        const uint edgeLength = ctx->cube->edgeLength;
+        const FloatImage * image = ctx->cube->face[f].m->image;
+        const float * r = image->channel(0) + y * edgeLength;
+        const float * g = image->channel(1) + y * edgeLength;
+        const float * b = image->channel(2) + y * edgeLength;
+
+        const Vector3 & N = faceNormals[f];
+        const Vector3 & U = faceU[f];
+        const Vector3 & V = faceV[f];
+        const float scale = 2.0f / edgeLength;
+        const float v = (float(y) + 0.5f) * scale - 1.0f;
+
+        uint x = 0;
+#if NV_USE_SSE
+        // Four texels at a time, the directions are computed from the texel coordinates like in texelDirection.
+        ShAccumulator4<2, 3> acc;
+
+        const __m128 vscale = _mm_set1_ps(scale);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 vv = _mm_set1_ps(v);
+        const __m128 nx = _mm_set1_ps(N.x + v * V.x), ny = _mm_set1_ps(N.y + v * V.y), nz = _mm_set1_ps(N.z + v * V.z);
+        const __m128 ux = _mm_set1_ps(U.x), uy = _mm_set1_ps(U.y), uz = _mm_set1_ps(U.z);
+        const __m128 vlen = _mm_add_ps(one, _mm_mul_ps(vv, vv));
+
+        for (; x + 4 <= edgeLength; x += 4) {
+            const __m128 u = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f), _mm_set1_ps(float(x))), vscale), one);
+            const __m128 ilen = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(vlen, _mm_mul_ps(u, u))));
+            const SimdVector dx(_mm_mul_ps(_mm_add_ps(nx, _mm_mul_ps(u, ux)), ilen));
+            const SimdVector dy(_mm_mul_ps(_mm_add_ps(ny, _mm_mul_ps(u, uy)), ilen));
+            const SimdVector dz(_mm_mul_ps(_mm_add_ps(nz, _mm_mul_ps(u, uz)), ilen));
+
+            const __m128 solidAngle = _mm_loadu_ps(solidAngles + x);
+            const SimdVector w[3] = {
+                SimdVector(_mm_mul_ps(solidAngle, _mm_loadu_ps(r + x))),
+                SimdVector(_mm_mul_ps(solidAngle, _mm_loadu_ps(g + x))),
+                SimdVector(_mm_mul_ps(solidAngle, _mm_loadu_ps(b + x))),
+            };
+            acc.addSamples(dx, dy, dz, w);
+        }
+
+        acc.reduce(sh);
+#endif
+
+        for (; x < edgeLength; x++) {
+            const float u = (float(x) + 0.5f) * scale - 1.0f;
+            const Vector3 dir = (N + u * U + v * V) * (1.0f / sqrtf(1.0f + u * u + v * v));
+
+            sh[0].addSample(dir, solidAngles[x] * r[x]);
+            sh[1].addSample(dir, solidAngles[x] * g[x]);
+            sh[2].addSample(dir, solidAngles[x] * b[x]);
+        }
+    }
+
+    // Each task projects a band of rows and writes its own partial sums, which are added in order afterwards, so that the
+    // result doesn't depend on the scheduling.
+    static void ShProjectionTask(void * context, int id)
+    {
+        const ShProjectionContext * ctx = (const ShProjectionContext *)context;
+        const CubeSurface::Private * cube = ctx->cube;
+        const uint edgeLength = cube->edgeLength;
+
+        const uint begin = id * ctx->rowsPerTask;
+        const uint end = min(begin + ctx->rowsPerTask, 6 * edgeLength);
+
+        Array<float> solidAngles;
+        solidAngles.resize(edgeLength);
+
+        double * taskSums = ctx->sums + 27 * id;
+        for (uint i = 0; i < 27; i++) taskSums[i] = 0.0;
+
+        for (uint row = begin; row < end; row++) {
+            const uint f = row / edgeLength;
+            const uint y = row % edgeLength;
 
-    // For each texel of the input cube.
-    const uint edgeLength = m->edgeLength;
-    for (uint f = 0; f < 6; f++) {
-        for (uint y = 0; y < edgeLength; y++) {
             for (uint x = 0; x < edgeLength; x++) {
+                solidAngles[x] = cube->texelTable->solidAngle(f, x, y);
+            }
 
-                Vector3 dir = m->texelTable->direction(f, x, y);
-                float solidAngle = m->texelTable->solidAngle(f, x, y);
+            ShL2 rowSh[3];
+            for (uint c = 0; c < 3; c++) rowSh[c].reset();
+            projectRow(ctx, f, y, solidAngles.buffer(), rowSh);
 
-                Sh2 shDir;
-                shDir.eval(dir);
+            for (uint c = 0; c < 3; c++) {
+                for (uint i = 0; i < 9; i++) taskSums[9 * c + i] += rowSh[c].elem[i];
+            }
+        }
+    }
 
-                sh.addScaled(sh, solidAngle);
+    struct ShEvaluationContext
+    {
+        CubeSurface::Private * output;
+        EdgeFixup fixupMethod;
+        ShL2 irradiance[3];             // One per channel.
+    };
+
+    // One item per output row.
+    static void ShEvaluationTask(void * context, int id)
+    {
+        const ShEvaluationContext * ctx = (const ShEvaluationContext *)context;
+        const uint size = ctx->output->edgeLength;
+        const uint f = id / size;
+        const uint y = id % size;
+
+        FloatImage * image = ctx->output->face[f].m->image;
+        float * r = image->channel(0) + y * size;
+        float * g = image->channel(1) + y * size;
+        float * b = image->channel(2) + y * size;
+        float * a = image->channel(3) + y * size;
+
+        // The truncated series rings around bright sources, irradiance is never negative.
+        uint x = 0;
+#if NV_USE_SSE
+        const SimdVector zero(0.0f);
+        for (; x + 4 <= size; x += 4) {
+            NV_ALIGN_16 float dirs[3][4];
+            for (uint i = 0; i < 4; i++) {
+                const Vector3 dir = texelDirection(f, x + i, y, size, ctx->fixupMethod);
+                dirs[0][i] = dir.x;
+                dirs[1][i] = dir.y;
+                dirs[2][i] = dir.z;
             }
+            const SimdVector dx(dirs[0]), dy(dirs[1]), dz(dirs[2]);
+
+            _mm_storeu_ps(r + x, max(ctx->irradiance[0].sample(dx, dy, dz), zero).vec);
+            _mm_storeu_ps(g + x, max(ctx->irradiance[1].sample(dx, dy, dz), zero).vec);
+            _mm_storeu_ps(b + x, max(ctx->irradiance[2].sample(dx, dy, dz), zero).vec);
+        }
+#endif
+        for (; x < size; x++) {
+            const Vector3 dir = texelDirection(f, x, y, size, ctx->fixupMethod);
+            r[x] = max(ctx->irradiance[0].sample(dir), 0.0f);
+            g[x] = max(ctx->irradiance[1].sample(dir), 0.0f);
+            b[x] = max(ctx->irradiance[2].sample(dir), 0.0f);
+        }
+
+        for (x = 0; x < size; x++) {
+            a[x] = 1.0f;
         }
     }
+}
 
+void CubeSurface::shProjection(float * coefficients) const
+{
+    m->allocateTexelTable();
+    m->flushFaces();
 
-    // Evaluate spherical harmonic for each output texel.
-    CubeSurface output;
-    output.m->allocate(size);
+    const uint edgeLength = m->edgeLength;
+    const uint rowCount = 6 * edgeLength;
 
+    ShProjectionContext context;
+    context.cube = m;
+    context.rowsPerTask = (rowCount * edgeLength < kParallelShThreshold) ? rowCount : max(1U, kShTaskSize / edgeLength);
 
+    const uint taskCount = (rowCount + context.rowsPerTask - 1) / context.rowsPerTask;
 
+    Array<double> sums;
+    sums.resize(27 * taskCount);
+    context.sums = sums.buffer();
 
-    // @@ TODO
-    return CubeSurface();
+    if (taskCount == 1) {
+        ShProjectionTask(&context, 0);
+    }
+    else {
+        TaskScheduler::global()->parallelFor(ShProjectionTask, &context, taskCount);
+    }
+
+    for (uint i = 0; i < 27; i++) {
+        double sum = 0.0;
+        for (uint t = 0; t < taskCount; t++) {
+            sum += sums[27 * t + i];
+        }
+        coefficients[i] = float(sum);
+    }
 }
 
+// Irradiance is the convolution with the clamped cosine lobe, which is evaluated in the spherical harmonic basis. It has
+// so little energy above the second band that the truncation changes the result by a few percent at most.
+CubeSurface CubeSurface::irradianceFilter(int size, EdgeFixup fixupMethod) const
+{
+    float coefficients[27];
+    shProjection(coefficients);
+
+    CubeSurface output;
+    output.m->allocate(size);
+
+    ShEvaluationContext context;
+    context.output = output.m;
+    context.fixupMethod = fixupMethod;
+    for (uint i = 0; i < 27; i++) {
+        context.irradiance[i / 9].elem[i % 9] = coefficients[i] * kCosineBandScale[i % 9];
+    }
+
+    const uint rowCount = 6 * size;
+    if (rowCount * size < kParallelShThreshold) {
+        for (uint i = 0; i < rowCount; i++) {
+            ShEvaluationTask(&context, i);
+        }
+    }
+    else {
+        TaskScheduler::global()->parallelFor(ShEvaluationTask, &context, rowCount);
+    }
 
+    return output;
+}
 
 
 // Convolve filter against this cube.
 Vector3 CubeSurface::Private::applyAngularFilter(const Vector3 & filterDir, float coneAngle, float * filterTable, int tableSize)
 {
     const float cosineConeAngle = cos(coneAngle);
+    const float sineConeAngle = sin(coneAngle);
     nvDebugCheck(cosineConeAngle >= 0);
 
     Vector3 color(0);
@@ -579,10 +1007,18 @@ Vector3 CubeSurface::Private::applyAngularFilter(const Vector3 & filterDir, floa
     // - Compute accurate bounds assuming cone axis aligned to plane, result was too small elsewhere.
     // - Compute ellipse that results in the cone/plane intersection and compute its bounds. Sometimes intersection is a parabolla, hard to handle that case.
     // - Compute the 6 axis aligned planes that bound the cone, clip faces against planes. Resulting plane equations are way too complex.
+    // - Bound the directions of tiles of texels with cones, and only visit the tiles that intersect the filter cone. Done.
 
     // What AMD CubeMapGen does:
     // - Compute conservative bounds on the primary face, wrap around the adjacent faces.
 
+#if NV_USE_SSE > 1
+    __m128 vsum = _mm_setzero_ps();
+    __m128 vr = _mm_setzero_ps(), vg = _mm_setzero_ps(), vb = _mm_setzero_ps();
+    const __m128 vcosineConeAngle = _mm_set1_ps(cosineConeAngle);
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    const __m128 tableScale = _mm_set1_ps(float(tableSize - 1));
+#endif
 
     // For each texel of the input cube.
     for (uint f = 0; f < 6; f++) {
@@ -596,78 +1032,82 @@ Vector3 CubeSurface::Private::applyAngularFilter(const Vector3 & filterDir, floa
             continue;
         }
 
-        const int L = I32(edgeLength-1);
-        int x0 = 0, x1 = L;
-        int y0 = 0, y1 = L;
-
-#if 0
-        float u0 = -1;
-        float u1 = 1;
-        float v0 = -1;
-        float v1 = 1;
-
-        // @@ Compute uvs.
-
-        // Expand uv coordinates from [-1,1] to [0, edgeLength)
-        u0 = (u0 + 1) * edgeLength * 0.5f - 0.5f;
-        v0 = (v0 + 1) * edgeLength * 0.5f - 0.5f;
-        u1 = (u1 + 1) * edgeLength * 0.5f - 0.5f;
-        v1 = (v1 + 1) * edgeLength * 0.5f - 0.5f;
-        nvDebugCheck(u0 >= -0.5f && u0 <= edgeLength - 0.5f);
-        nvDebugCheck(v0 >= -0.5f && v0 <= edgeLength - 0.5f);
-        nvDebugCheck(u1 >= -0.5f && u1 <= edgeLength - 0.5f);
-        nvDebugCheck(v1 >= -0.5f && v1 <= edgeLength - 0.5f);
-
-        x0 = clamp(ifloor(u0), 0, L);
-        y0 = clamp(ifloor(v0), 0, L);
-        x1 = clamp(iceil(u1), 0, L);
-        y1 = clamp(iceil(v1), 0, L);
+        const FloatImage * inputImage = face[f].m->image;
+        const float * r = inputImage->channel(0);
+        const float * g = inputImage->channel(1);
+        const float * b = inputImage->channel(2);
+
+        // The texel directions are in the frame of the face, bring the filter direction to it.
+        const Vector3 faceDir = TexelTable::toFaceFrame(f, filterDir);
+        const float * dx = texelTable->directionArray[0].buffer();
+        const float * dy = texelTable->directionArray[1].buffer();
+        const float * dz = texelTable->directionArray[2].buffer();
+        const float * solidAngles = texelTable->solidAngleArray.buffer();
+#if NV_USE_SSE > 1
+        const __m128 fx = _mm_set1_ps(faceDir.x), fy = _mm_set1_ps(faceDir.y), fz = _mm_set1_ps(faceDir.z);
 #endif
 
-        nvDebugCheck(x1 >= x0);
-        nvDebugCheck(y1 >= y0);
-
-        if (x1 == x0 || y1 == y0) {
-            // Skip this face.
-            continue;
-        }
+        for (uint t = 0; t < texelTable->tileCount * texelTable->tileCount; t++) {
+            if (!texelTable->tileIntersectsCone(t, faceDir, cosineConeAngle, sineConeAngle)) {
+                continue;
+            }
 
+            uint x0, y0, x1, y1;
+            texelTable->tileBounds(t, &x0, &y0, &x1, &y1);
 
-        const Surface & inputFace = face[f];
-        const FloatImage * inputImage = inputFace.m->image;
+            for (uint y = y0; y < y1; y++) {
+                uint x = x0;
+#if NV_USE_SSE > 1
+                for (; x + 4 <= x1; x += 4) {
+                    const uint i = y * edgeLength + x;
+                    const __m128 cosineAngle = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(dx + i), fx), _mm_mul_ps(_mm_loadu_ps(dy + i), fy)), _mm_mul_ps(_mm_loadu_ps(dz + i), fz));
+                    const __m128 inside = _mm_cmpgt_ps(cosineAngle, vcosineConeAngle);
+                    if (_mm_movemask_ps(inside) == 0) continue;
 
-        for (int y = y0; y <= y1; y++) {
-            bool inside = false;
-            for (int x = x0; x <= x1; x++) {
+                    NV_ALIGN_16 int idx[4];
+                    _mm_store_si128((__m128i *)idx, _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(cosineAngle, zero), one), tableScale)));
+                    const __m128 scale = _mm_set_ps(filterTable[idx[3]], filterTable[idx[2]], filterTable[idx[1]], filterTable[idx[0]]);
 
-                Vector3 dir = texelTable->direction(f, x, y);
-                float cosineAngle = dot(dir, filterDir);
+                    const __m128 contribution = _mm_and_ps(inside, _mm_mul_ps(_mm_loadu_ps(solidAngles + i), scale));
 
-                if (cosineAngle > cosineConeAngle) {
-                    float solidAngle = texelTable->solidAngle(f, x, y);
-                    //float scale = powf(saturate(cosineAngle), cosinePower);
-                    
-                    int idx = int(saturate(cosineAngle) * (tableSize - 1));
-                    float scale = filterTable[idx]; // @@ Do bilinear interpolation?
+                    vsum = _mm_add_ps(vsum, contribution);
+                    vr = _mm_add_ps(vr, _mm_mul_ps(contribution, _mm_loadu_ps(r + i)));
+                    vg = _mm_add_ps(vg, _mm_mul_ps(contribution, _mm_loadu_ps(g + i)));
+                    vb = _mm_add_ps(vb, _mm_mul_ps(contribution, _mm_loadu_ps(b + i)));
+                }
+#endif
+                for (; x < x1; x++) {
+                    const uint i = y * edgeLength + x;
+                    float cosineAngle = dx[i] * faceDir.x + dy[i] * faceDir.y + dz[i] * faceDir.z;
 
-                    float contribution = solidAngle * scale;
+                    if (cosineAngle > cosineConeAngle) {
+                        int idx = int(saturate(cosineAngle) * (tableSize - 1));
+                        float scale = filterTable[idx]; // @@ Do bilinear interpolation?
 
-                    sum += contribution;
-                    color.x += contribution * inputImage->pixel(0, x, y, 0);
-                    color.y += contribution * inputImage->pixel(1, x, y, 0);
-                    color.z += contribution * inputImage->pixel(2, x, y, 0);
+                        float contribution = solidAngles[i] * scale;
 
-                    inside = true;
-                }
-                else if (inside) {
-                    // Filter scale is monotonic, if we have been inside once and we just exit, then we can skip the rest of the row.
-                    // We could do the same thing for the columns and skip entire rows.
-                    break;
+                        sum += contribution;
+                        color.x += contribution * r[i];
+                        color.y += contribution * g[i];
+                        color.z += contribution * b[i];
+                    }
                 }
             }
         }
     }
 
+#if NV_USE_SSE > 1
+    NV_ALIGN_16 float lanes[4][4];
+    _mm_store_ps(lanes[0], vsum);
+    _mm_store_ps(lanes[1], vr);
+    _mm_store_ps(lanes[2], vg);
+    _mm_store_ps(lanes[3], vb);
+    sum += (lanes[0][0] + lanes[0][1]) + (lanes[0][2] + lanes[0][3]);
+    color.x += (lanes[1][0] + lanes[1][1]) + (lanes[1][2] + lanes[1][3]);
+    color.y += (lanes[2][0] + lanes[2][1]) + (lanes[2][2] + lanes[2][3]);
+    color.z += (lanes[3][0] + lanes[3][1]) + (lanes[3][2] + lanes[3][3]);
+#endif
+
     color *= (1.0f / sum);
 
     return color;
@@ -691,21 +1131,13 @@ Vector3 CubeSurface::Private::applyAngularFilter(const Vector3 & filterDir, floa
 Vector3 CubeSurface::Private::applyCosinePowerFilter(const Vector3 & filterDir, float coneAngle, float cosinePower)
 {
     const float cosineConeAngle = cos(coneAngle);
+    const float sineConeAngle = sin(coneAngle);
     nvDebugCheck(cosineConeAngle >= 0);
 
     Vector3 color(0);
     float sum = 0;
 
-    // Things I have tried to speed this up:
-    // - Compute accurate bounds assuming cone axis aligned to plane, result was too small elsewhere.
-    // - Compute ellipse that results in the cone/plane intersection and compute its bounds. Sometimes intersection is a parabolla, hard to handle that case.
-    // - Compute the 6 axis aligned planes that bound the cone, clip faces against planes. Resulting plane equations are way too complex.
-
-    // What AMD CubeMapGen does:
-    // - Compute conservative bounds on the primary face, wrap around the adjacent faces.
-
-
-    // For each texel of the input cube.
+    // For each texel of the input cube. See applyAngularFilter.
     for (uint f = 0; f < 6; f++) {
 
         // Test face cone agains filter cone.
@@ -717,69 +1149,38 @@ Vector3 CubeSurface::Private::applyCosinePowerFilter(const Vector3 & filterDir,
             continue;
         }
 
-        const int L = I32(edgeLength-1);
-        int x0 = 0, x1 = L;
-        int y0 = 0, y1 = L;
-
-#if 0
-        float u0 = -1;
-        float u1 = 1;
-        float v0 = -1;
-        float v1 = 1;
-
-        // @@ Compute uvs.
-
-        // Expand uv coordinates from [-1,1] to [0, edgeLength)
-        u0 = (u0 + 1) * edgeLength * 0.5f - 0.5f;
-        v0 = (v0 + 1) * edgeLength * 0.5f - 0.5f;
-        u1 = (u1 + 1) * edgeLength * 0.5f - 0.5f;
-        v1 = (v1 + 1) * edgeLength * 0.5f - 0.5f;
-        nvDebugCheck(u0 >= -0.5f && u0 <= edgeLength - 0.5f);
-        nvDebugCheck(v0 >= -0.5f && v0 <= edgeLength - 0.5f);
-        nvDebugCheck(u1 >= -0.5f && u1 <= edgeLength - 0.5f);
-        nvDebugCheck(v1 >= -0.5f && v1 <= edgeLength - 0.5f);
-
-        x0 = clamp(ifloor(u0), 0, L);
-        y0 = clamp(ifloor(v0), 0, L);
-        x1 = clamp(iceil(u1), 0, L);
-        y1 = clamp(iceil(v1), 0, L);
-#endif
-
-        nvDebugCheck(x1 >= x0);
-        nvDebugCheck(y1 >= y0);
-
-        if (x1 == x0 || y1 == y0) {
-            // Skip this face.
-            continue;
-        }
-
-
         const Surface & inputFace = face[f];
         const FloatImage * inputImage = inputFace.m->image;
 
-        for (int y = y0; y <= y1; y++) {
-            bool inside = false;
-            for (int x = x0; x <= x1; x++) {
+        const Vector3 faceDir = TexelTable::toFaceFrame(f, filterDir);
+        const float * dx = texelTable->directionArray[0].buffer();
+        const float * dy = texelTable->directionArray[1].buffer();
+        const float * dz = texelTable->directionArray[2].buffer();
 
-                Vector3 dir = texelTable->direction(f, x, y);
-                float cosineAngle = dot(dir, filterDir);
+        for (uint t = 0; t < texelTable->tileCount * texelTable->tileCount; t++) {
+            if (!texelTable->tileIntersectsCone(t, faceDir, cosineConeAngle, sineConeAngle)) {
+                continue;
+            }
 
-                if (cosineAngle > cosineConeAngle) {
-                    float solidAngle = texelTable->solidAngle(f, x, y);
-                    float scale = powf(saturate(cosineAngle), cosinePower);
-                    float contribution = solidAngle * scale;
+            uint x0, y0, x1, y1;
+            texelTable->tileBounds(t, &x0, &y0, &x1, &y1);
 
-                    sum += contribution;
-                    color.x += contribution * inputImage->pixel(0, x, y, 0);
-                    color.y += contribution * inputImage->pixel(1, x, y, 0);
-                    color.z += contribution * inputImage->pixel(2, x, y, 0);
+            for (uint y = y0; y < y1; y++) {
+                for (uint x = x0; x < x1; x++) {
 
-                    inside = true;
-                }
-                else if (inside) {
-                    // Filter scale is monotonic, if we have been inside once and we just exit, then we can skip the rest of the row.
-                    // We could do the same thing for the columns and skip entire rows.
-                    break;
+                    const uint i = y * edgeLength + x;
+                    float cosineAngle = dx[i] * faceDir.x + dy[i] * faceDir.y + dz[i] * faceDir.z;
+
+                    if (cosineAngle > cosineConeAngle) {
+                        float solidAngle = texelTable->solidAngle(f, x, y);
+                        float scale = powf(saturate(cosineAngle), cosinePower);
+                        float contribution = solidAngle * scale;
+
+                        sum += contribution;
+                        color.x += contribution * inputImage->pixel(0, x, y, 0);
+                        color.y += contribution * inputImage->pixel(1, x, y, 0);
+                        color.z += contribution * inputImage->pixel(2, x, y, 0);
+                    }
                 }
             }
         }
@@ -790,8 +1191,6 @@ Vector3 CubeSurface::Private::applyCosinePowerFilter(const Vector3 & filterDir,
     return color;
 }
 
-#include "nvthread/ParallelFor.h"
-
 struct ApplyAngularFilterContext {
     CubeSurface::Private * inputCube;
     CubeSurface::Private * filteredCube;
@@ -801,110 +1200,289 @@ struct ApplyAngularFilterContext {
     EdgeFixup fixupMethod;
 };
 
-void ApplyAngularFilterTask(void * context, int id)
+// All the mipmaps of one or more prefiltered chains are filtered by the same parallelFor, the rows of texels of their faces
+// are numbered consecutively.
+struct FilterChainContext {
+    FilterChainContext() : progress(NULL) { firstRow.append(0); }
+
+    Progress * progress;            // Counts texels, NULL without a progress handler.
+    Array<ApplyAngularFilterContext> levels;
+    Array<uint> firstRow;           // First row of each level, and the total number of rows at the end.
+    Array<CubeSurface> pyramids;    // Mipmaps of the source cubes that the levels are filtered from.
+    Array<float> filterTables;      // One table of filterTableSize entries per level.
+};
+
+static const int filterTableSize = 512;
+
+void FilterChainTask(void * context, int row)
 {
-    ApplyAngularFilterContext * ctx = (ApplyAngularFilterContext *)context;
+    FilterChainContext * ctx = (FilterChainContext *)context;
+
+    // Last level that starts at or before the row.
+    uint level = 0;
+    uint end = ctx->levels.count();
+    while (end - level > 1) {
+        const uint mid = (level + end) / 2;
+        if (ctx->firstRow[mid] <= uint(row)) level = mid;
+        else end = mid;
+    }
 
-    int size = ctx->filteredCube->edgeLength;
+    const ApplyAngularFilterContext & filter = ctx->levels[level];
+    const int size = filter.filteredCube->edgeLength;
+    const int f = (row - ctx->firstRow[level]) / size;
+    const int y = (row - ctx->firstRow[level]) % size;
 
-    int f = id / (size * size);
-    int idx = id % (size * size);
-    int y = idx / size;
-    int x = idx % size;
+    FloatImage * filteredImage = filter.filteredCube->face[f].m->image;
 
-    nvtt::Surface & filteredFace = ctx->filteredCube->face[f];
-    FloatImage * filteredImage = filteredFace.m->image;
+    for (int x = 0; x < size; x++) {
+        // A single texel of a wide lobe can take milliseconds, check for cancellation before each one.
+        if (ctx->progress != NULL && ctx->progress->isCancelled()) return;
 
-    const Vector3 filterDir = texelDirection(f, x, y, size, ctx->fixupMethod);
+        const Vector3 filterDir = texelDirection(f, x, y, size, filter.fixupMethod);
 
-    // Convolve filter against cube.
-    Vector3 color = ctx->inputCube->applyAngularFilter(filterDir, ctx->coneAngle, ctx->filterTable, ctx->tableSize);
+        // Convolve filter against cube.
+        Vector3 color = filter.inputCube->applyAngularFilter(filterDir, filter.coneAngle, filter.filterTable, filter.tableSize);
 
-    filteredImage->pixel(0, idx) = color.x;
-    filteredImage->pixel(1, idx) = color.y;
-    filteredImage->pixel(2, idx) = color.z;
-}
+        const int idx = y * size + x;
+        filteredImage->pixel(0, idx) = color.x;
+        filteredImage->pixel(1, idx) = color.y;
+        filteredImage->pixel(2, idx) = color.z;
+    }
 
+    if (ctx->progress != NULL) {
+        ctx->progress->add(size);
+    }
+}
 
-CubeSurface CubeSurface::cosinePowerFilter(int size, float cosinePower, EdgeFixup fixupMethod) const
+// Number of texels of mipmaps first to count - 1 of a prefiltered chain, the unit of the progress of the filters.
+static uint filterTexelCount(int size, int first, int count)
 {
-    // Allocate output cube.
-    CubeSurface filteredCube;
-    filteredCube.m->allocate(size);
+    uint texelCount = 0;
+    for (int i = first; i < count; i++) {
+        const uint mipmapSize = max(1, size >> i);
+        texelCount += 6 * mipmapSize * mipmapSize;
+    }
+    return texelCount;
+}
 
-    // Texel table is stored along with the surface so that it's compute only once.
-    m->allocateTexelTable();
 
+// Angle at which the cosine power lobe drops below the threshold.
+static float cosinePowerConeAngle(float cosinePower)
+{
     const float threshold = 0.001f;
-    const float coneAngle = acosf(powf(threshold, 1.0f/cosinePower));
+    return acosf(powf(threshold, 1.0f/cosinePower));
+}
 
+// Half size cube, each texel is the solid angle weighted average of the 2x2 texels it covers.
+static CubeSurface halfSizeCube(CubeSurface::Private * m)
+{
+    nvDebugCheck(m->edgeLength >= 2 && m->edgeLength % 2 == 0);
+    m->allocateTexelTable();
+
+    const uint edgeLength = m->edgeLength;
+    const uint halfEdgeLength = edgeLength / 2;
+
+    CubeSurface half;
+    half.m->allocate(halfEdgeLength);
+
+    for (uint f = 0; f < 6; f++) {
+        const FloatImage * inputImage = m->face[f].m->image;
+        FloatImage * outputImage = half.m->face[f].m->image;
+
+        for (uint y = 0; y < halfEdgeLength; y++) {
+            for (uint x = 0; x < halfEdgeLength; x++) {
+                const uint idx[4] = {
+                    (2 * y) * edgeLength + 2 * x, (2 * y) * edgeLength + 2 * x + 1,
+                    (2 * y + 1) * edgeLength + 2 * x, (2 * y + 1) * edgeLength + 2 * x + 1
+                };
+                const float w[4] = {
+                    m->texelTable->solidAngle(f, 2 * x, 2 * y), m->texelTable->solidAngle(f, 2 * x + 1, 2 * y),
+                    m->texelTable->solidAngle(f, 2 * x, 2 * y + 1), m->texelTable->solidAngle(f, 2 * x + 1, 2 * y + 1)
+                };
+                const float scale = 1.0f / (w[0] + w[1] + w[2] + w[3]);
+
+                for (uint c = 0; c < 4; c++) {
+                    const float * input = inputImage->channel(c);
+                    outputImage->pixel(c, y * halfEdgeLength + x) = (w[0] * input[idx[0]] + w[1] * input[idx[1]] + w[2] * input[idx[2]] + w[3] * input[idx[3]]) * scale;
+                }
+            }
+        }
+    }
+
+    return half;
+}
+
+// Add mipmaps first to count - 1 of the prefiltered chain of a cube to the context. The mipmaps of the source cube, with
+// their texel tables, are built once and shared by all the levels.
+static void addFilterChain(FilterChainContext & context, const CubeSurface & cube, int size, const float * cosinePowers, int first, int count, EdgeFixup fixupMethod, float lobeResolution, CubeSurface * mipmaps)
+{
+    cube.m->allocateTexelTable();
+    cube.m->flushFaces();
+
+    const uint pyramidBase = context.pyramids.count();
+    context.pyramids.append(cube);
+
+    for (int i = first; i < count; i++) {
+        const int mipmapSize = max(1, size >> i);
+        const float cosinePower = cosinePowers[i];
+
+        // Filter wide lobes from the smallest mipmap of the cube that has lobeResolution texels across the lobe, between the
+        // directions where it drops to half its maximum. Near the center of a face a texel of a cube with edge length e spans
+        // an angle of about PI / (2 * e).
+        uint source = pyramidBase;
+        if (lobeResolution > 0.0f) {
+            const float lobeWidth = 2.0f * acosf(powf(0.5f, 1.0f / cosinePower));
+            for (;;) {
+                const uint edgeLength = context.pyramids[source].m->edgeLength;
+                if (edgeLength % 2 != 0 || (edgeLength / 2) * lobeWidth / PI < lobeResolution) break;
+
+                if (source + 1 == context.pyramids.count()) {
+                    context.pyramids.append(halfSizeCube(context.pyramids[source].m));
+                    context.pyramids.back().m->allocateTexelTable();
+                }
+                source++;
+            }
+        }
 
-    // For each texel of the output cube.
-    /*for (uint f = 0; f < 6; f++) {
-        nvtt::Surface filteredFace = filteredCube.m->face[f];
-        FloatImage * filteredImage = filteredFace.m->image;
+        mipmaps[i] = CubeSurface();
+        mipmaps[i].m->allocate(mipmapSize);
+        for (uint f = 0; f < 6; f++) {
+            mipmaps[i].m->face[f].m->image->clear(3, 1.0f);
+        }
 
-        for (uint y = 0; y < uint(size); y++) {
-            for (uint x = 0; x < uint(size); x++) {
+        // @@ Instead of looking up table between [0 - 1] we should probably use [cos(coneAngle), 1]
+        const uint tableOffset = context.filterTables.count();
+        context.filterTables.resize(tableOffset + filterTableSize);
+        for (int t = 0; t < filterTableSize; t++) {
+            context.filterTables[tableOffset + t] = powf(float(t) / (filterTableSize - 1), cosinePower);
+        }
 
-                const Vector3 filterDir = texelDirection(f, x, y, size, fixupMethod);
+        ApplyAngularFilterContext level;
+        level.inputCube = context.pyramids[source].m;
+        level.filteredCube = mipmaps[i].m;
+        level.coneAngle = cosinePowerConeAngle(cosinePower);
+        level.filterTable = NULL;   // Set once the tables of all the levels are allocated.
+        level.tableSize = filterTableSize;
+        level.fixupMethod = fixupMethod;
 
-                // Convolve filter against cube.
-                Vector3 color = m->applyCosinePowerFilter(filterDir, coneAngle, cosinePower);
+        context.levels.append(level);
+        context.firstRow.append(context.firstRow.back() + 6 * mipmapSize);
+    }
+}
 
-                filteredImage->pixel(0, x, y, 0) = color.x;
-                filteredImage->pixel(1, x, y, 0) = color.y;
-                filteredImage->pixel(2, x, y, 0) = color.z;
-            }
-        }
-    }*/
+// Filter all the levels added to the context in one parallelFor.
+static void runFilterChains(FilterChainContext & context, Progress * progress)
+{
+    context.progress = progress;
 
-    ApplyAngularFilterContext context;
-    context.inputCube = m;
-    context.filteredCube = filteredCube.m;
-    context.coneAngle = coneAngle;
-    context.fixupMethod = fixupMethod;
+    for (uint i = 0; i < context.levels.count(); i++) {
+        context.levels[i].filterTable = context.filterTables.buffer() + i * filterTableSize;
+    }
+
+    // Use the task scheduler, so that this can run from inside other tasks. One row of texels at a time.
+    nv::TaskScheduler::global()->parallelFor(FilterChainTask, &context, context.firstRow.back());
+
+    // @@ Implement edge averaging.
+}
 
-    context.tableSize = 512;
-    context.filterTable = new float[context.tableSize];
+// Filter mipmaps first to count - 1 of a prefiltered chain on the CPU.
+static void cosinePowerFilterChain(const CubeSurface & cube, int size, const float * cosinePowers, int first, int count, EdgeFixup fixupMethod, float lobeResolution, CubeSurface * mipmaps, Progress * progress)
+{
+    FilterChainContext context;
+    addFilterChain(context, cube, size, cosinePowers, first, count, fixupMethod, lobeResolution, mipmaps);
+    runFilterChains(context, progress);
+}
 
-    // @@ Instead of looking up table between [0 - 1] we should probably use [cos(coneAngle), 1]
+void nvtt::cosinePowerFilterCubes(const CubeSurface * cubes, int count, int size, const float * cosinePowers, int mipmapCount, EdgeFixup fixupMethod, CubeSurface * mipmaps, float lobeResolution/*= 0.0f*/, ProgressHandler * progressHandler/*= NULL*/)
+{
+    Progress progress(progressHandler, count * filterTexelCount(size, 0, mipmapCount));
 
-    for (int i = 0; i < context.tableSize; i++) {
-        float f = float(i) / (context.tableSize - 1);
-        context.filterTable[i] = powf(f, cosinePower);
+    FilterChainContext context;
+    for (int i = 0; i < count; i++) {
+        addFilterChain(context, cubes[i], size, cosinePowers, 0, mipmapCount, fixupMethod, lobeResolution, mipmaps + i * mipmapCount);
     }
-    
+    runFilterChains(context, progressHandler != NULL ? &progress : NULL);
+}
 
-    nv::ParallelFor parallelFor(ApplyAngularFilterTask, &context);
-    parallelFor.run(6 * size * size);
+CubeSurface CubeSurface::cosinePowerFilter(int size, float cosinePower, EdgeFixup fixupMethod, float lobeResolution/*= 0.0f*/, ProgressHandler * progressHandler/*= NULL*/) const
+{
+    Progress progress(progressHandler, filterTexelCount(size, 0, 1));
 
-    // @@ Implement edge averaging.
-    if (fixupMethod == EdgeFixup_Average) {
-        for (uint f = 0; f < 6; f++) {
-            nvtt::Surface filteredFace = filteredCube.m->face[f];
-            FloatImage * filteredImage = filteredFace.m->image;
+    CubeSurface filteredCube;
+    cosinePowerFilterChain(*this, size, &cosinePower, 0, 1, fixupMethod, lobeResolution, &filteredCube, progressHandler != NULL ? &progress : NULL);
+    return filteredCube;
+}
 
-            // For each component.
-            for (uint c = 0; c < 3; c++) {
-                // @@ For each corner, sample the two adjacent faces.
-                filteredImage->pixel(c, 0, 0, 0);
-                filteredImage->pixel(c, size-1, 0, 0);
-                filteredImage->pixel(c, 0, size-1, 0);
-                filteredImage->pixel(c, size-1, size-1, 0);
+void CubeSurface::cosinePowerFilterMipmaps(int size, const float * cosinePowers, int count, EdgeFixup fixupMethod, CubeSurface * mipmaps, float lobeResolution/*= 0.0f*/, ProgressHandler * progressHandler/*= NULL*/) const
+{
+    Progress progress(progressHandler, filterTexelCount(size, 0, count));
+
+    m->allocateTexelTable();
+    m->flushFaces();
 
-                // @@ For each edge, sample the adjacent face.
+    // Upload the cube and the direction and solid angle of its texels once for all the mipmaps.
+    CudaCubeSurface gpuCube;
+    bool gpu = false;
 
+    if (cuda::isHardwarePresent()) {
+        const uint edgeLength = m->edgeLength;
+
+        Array<float> texels;
+        texels.resize(6 * edgeLength * edgeLength * 4);
+
+        uint i = 0;
+        for (uint f = 0; f < 6; f++) {
+            for (uint y = 0; y < edgeLength; y++) {
+                for (uint x = 0; x < edgeLength; x++, i += 4) {
+                    const Vector3 & dir = m->texelTable->direction(f, x, y);
+                    texels[i + 0] = dir.x;
+                    texels[i + 1] = dir.y;
+                    texels[i + 2] = dir.z;
+                    texels[i + 3] = m->texelTable->solidAngle(f, x, y);
+                }
             }
         }
+
+        const float * faces[6];
+        for (uint f = 0; f < 6; f++) {
+            faces[f] = m->face[f].m->image->channel(0);
+        }
+
+        gpu = gpuCube.setFaces(faces, texels.buffer(), edgeLength);
     }
 
-    return filteredCube;
+    int i = 0;
+    for (; gpu && i < count; i++) {
+        const int mipmapSize = max(1, size >> i);
+
+        mipmaps[i] = CubeSurface();
+        mipmaps[i].m->allocate(mipmapSize);
+
+        float * faces[6];
+        for (uint f = 0; f < 6; f++) {
+            faces[f] = mipmaps[i].m->face[f].m->image->channel(0);
+            mipmaps[i].m->face[f].m->image->clear(3, 1.0f);
+        }
+
+        if (!gpuCube.cosinePowerFilter(mipmapSize, cosinePowers[i], cosinePowerConeAngle(cosinePowers[i]), fixupMethod, faces)) {
+            break;
+        }
+
+        if (!progress.add(6 * mipmapSize * mipmapSize)) {
+            return;
+        }
+    }
+
+    // Filter the rest on the CPU.
+    if (i < count) {
+        cosinePowerFilterChain(*this, size, cosinePowers, i, count, fixupMethod, lobeResolution, mipmaps, progressHandler != NULL ? &progress : NULL);
+    }
 }
 
 
-// Sample cubemap in the given direction.
-Vector3 CubeSurface::Private::sample(const Vector3 & dir)
+// Face that the direction points to, and the texel coordinates of the direction on that face, with texel centers at
+// integers plus one half, times scale. Ties are broken in favor of the x faces, then the y faces.
+static int faceCoordinates(const Vector3 & dir, float scale, float * s, float * t)
 {
     int f = -1;
     if (fabs(dir.x) > fabs(dir.y) && fabs(dir.x) > fabs(dir.z)) {
@@ -921,51 +1499,314 @@ Vector3 CubeSurface::Private::sample(const Vector3 & dir)
     }
     nvDebugCheck(f != -1);
 
-    // uv coordinates corresponding to filterDir.
-    float u = dot(dir, faceU[f]);
-    float v = dot(dir, faceV[f]);
+    // Project to the face, uv coordinates corresponding to filterDir.
+    const float ma = fabs(dir.component[f / 2]);
+    const float u = dot(dir, faceU[f]) / ma;
+    const float v = dot(dir, faceV[f]) / ma;
+
+    *s = (u + 1.0f) * scale - 0.5f;
+    *t = (v + 1.0f) * scale - 0.5f;
 
-    FloatImage * img = face[f].m->image;
+    return f;
+}
 
-    Vector3 color;
-    color.x = img->sampleLinearClamp(0, u, v);
-    color.y = img->sampleLinearClamp(1, u, v);
-    color.z = img->sampleLinearClamp(2, u, v);
+#if NV_USE_SSE > 1
+// Same as faceCoordinates for four directions.
+static void faceCoordinates4(__m128 x, __m128 y, __m128 z, float scale, int * face, float * s, float * t)
+{
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 ax = _mm_andnot_ps(signMask, x);
+    const __m128 ay = _mm_andnot_ps(signMask, y);
+    const __m128 az = _mm_andnot_ps(signMask, z);
+
+    const __m128 xMajor = _mm_and_ps(_mm_cmpgt_ps(ax, ay), _mm_cmpgt_ps(ax, az));
+    const __m128 yMajor = _mm_andnot_ps(xMajor, _mm_cmpgt_ps(ay, az));
+    const __m128 xPositive = _mm_cmpgt_ps(x, zero);
+    const __m128 yPositive = _mm_cmpgt_ps(y, zero);
+    const __m128 zPositive = _mm_cmpgt_ps(z, zero);
+
+    #define SELECT(mask, a, b) _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b))
+    #define NEGATE(a) _mm_xor_ps(a, signMask)
+
+    const __m128 ma = SELECT(xMajor, ax, SELECT(yMajor, ay, az));
+    const __m128 u = SELECT(xMajor, SELECT(xPositive, NEGATE(z), z), SELECT(yMajor, x, SELECT(zPositive, x, NEGATE(x))));
+    const __m128 v = SELECT(yMajor, SELECT(yPositive, z, NEGATE(z)), NEGATE(y));
+
+    // The negative face of each axis follows the positive one.
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 f = SELECT(xMajor, _mm_andnot_ps(xPositive, one),
+                     SELECT(yMajor, _mm_add_ps(_mm_set1_ps(2.0f), _mm_andnot_ps(yPositive, one)),
+                                    _mm_add_ps(_mm_set1_ps(4.0f), _mm_andnot_ps(zPositive, one))));
+
+    #undef SELECT
+    #undef NEGATE
+
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 offset = _mm_set1_ps(scale - 0.5f);        // (u + 1) * scale - 0.5
+    const __m128 ima = _mm_div_ps(vscale, ma);
+
+    _mm_storeu_si128((__m128i *)face, _mm_cvttps_epi32(f));
+    _mm_storeu_ps(s, _mm_add_ps(_mm_mul_ps(u, ima), offset));
+    _mm_storeu_ps(t, _mm_add_ps(_mm_mul_ps(v, ima), offset));
+}
+#endif
 
-    return color;
+// Bilinear sample of the 4 channels of a face at texel coordinates s, t. Doesn't filter across the edges of the face.
+static void sampleFace(const FloatImage * image, float s, float t, float * color)
+{
+    const int edgeLength = image->width();
+
+    const int x = ifloor(s);
+    const int y = ifloor(t);
+    const float fx = s - float(x);
+    const float fy = t - float(y);
+
+    const int x0 = clamp(x, 0, edgeLength - 1);
+    const int x1 = clamp(x + 1, 0, edgeLength - 1);
+    const int y0 = clamp(y, 0, edgeLength - 1);
+    const int y1 = clamp(y + 1, 0, edgeLength - 1);
+
+    for (uint c = 0; c < 4; c++) {
+        const float * channel = image->channel(c);
+        const float * row0 = channel + y0 * edgeLength;
+        const float * row1 = channel + y1 * edgeLength;
+        const float top = lerp(row0[x0], row0[x1], fx);
+        const float bottom = lerp(row1[x0], row1[x1], fx);
+        color[c] = lerp(top, bottom, fy);
+    }
+}
+
+// Sample cubemap in the given direction.
+Vector3 CubeSurface::Private::sample(const Vector3 & dir)
+{
+    float s, t;
+    const int f = faceCoordinates(dir, 0.5f * edgeLength, &s, &t);
+
+    float color[4];
+    sampleFace(face[f].m->image, s, t, color);
+
+    return Vector3(color[0], color[1], color[2]);
+}
+
+namespace
+{
+    struct FastResampleContext
+    {
+        const CubeSurface * cubes;
+        CubeSurface * resampled;
+        uint size;
+        EdgeFixup fixupMethod;
+    };
+
+    // One item per row of a face, the rows of all the faces of all the cubes are numbered consecutively.
+    static void FastResampleTask(void * context, int id)
+    {
+        const FastResampleContext * ctx = (const FastResampleContext *)context;
+        const uint size = ctx->size;
+        const uint i = id / (6 * size);
+        const uint f = (id / size) % 6;
+        const uint y = id % size;
+
+        const CubeSurface::Private * input = ctx->cubes[i].m;
+        const float scale = 0.5f * input->edgeLength;
+
+        FloatImage * image = ctx->resampled[i].m->face[f].m->image;
+
+        uint x = 0;
+#if NV_USE_SSE > 1
+        for (; x + 4 <= size; x += 4) {
+            NV_ALIGN_16 float dx[4], dy[4], dz[4];
+            for (uint k = 0; k < 4; k++) {
+                const Vector3 dir = texelDirection(f, x + k, y, size, ctx->fixupMethod);
+                dx[k] = dir.x;
+                dy[k] = dir.y;
+                dz[k] = dir.z;
+            }
+
+            int face[4];
+            float s[4], t[4];
+            faceCoordinates4(_mm_load_ps(dx), _mm_load_ps(dy), _mm_load_ps(dz), scale, face, s, t);
+
+            for (uint k = 0; k < 4; k++) {
+                float color[4];
+                sampleFace(input->face[face[k]].m->image, s[k], t[k], color);
+
+                const uint idx = y * size + x + k;
+                for (uint c = 0; c < 4; c++) {
+                    image->pixel(c, idx) = color[c];
+                }
+            }
+        }
+#endif
+        for (; x < size; x++) {
+            float s, t;
+            const int face = faceCoordinates(texelDirection(f, x, y, size, ctx->fixupMethod), scale, &s, &t);
+
+            float color[4];
+            sampleFace(input->face[face].m->image, s, t, color);
+
+            const uint idx = y * size + x;
+            for (uint c = 0; c < 4; c++) {
+                image->pixel(c, idx) = color[c];
+            }
+        }
+    }
+}
+
+void nvtt::fastResampleCubes(const CubeSurface * cubes, int count, int size, EdgeFixup fixupMethod, CubeSurface * resampled)
+{
+    if (count <= 0) return;
+
+    for (int i = 0; i < count; i++) {
+        cubes[i].m->flushFaces();
+
+        // Allocate output cube.
+        resampled[i] = CubeSurface();
+        resampled[i].m->allocate(size);
+    }
+
+    FastResampleContext context;
+    context.cubes = cubes;
+    context.resampled = resampled;
+    context.size = size;
+    context.fixupMethod = fixupMethod;
+
+    const uint rowCount = count * 6 * size;
+    if (rowCount * size < kParallelCubeThreshold) {
+        for (uint i = 0; i < rowCount; i++) {
+            FastResampleTask(&context, i);
+        }
+    }
+    else {
+        TaskScheduler::global()->parallelFor(FastResampleTask, &context, rowCount);
+    }
+
+    // @@ Implement edge averaging. Share this code with cosinePowerFilter
 }
 
-// @@ Not tested!
 CubeSurface CubeSurface::fastResample(int size, EdgeFixup fixupMethod) const
 {
-    // Allocate output cube.
     CubeSurface resampledCube;
-    resampledCube.m->allocate(size);
+    fastResampleCubes(this, 1, size, fixupMethod, &resampledCube);
+    return resampledCube;
+}
 
-    // For each texel of the output cube.
-    for (uint f = 0; f < 6; f++) {
-        nvtt::Surface resampledFace = resampledCube.m->face[f];
-        FloatImage * resampledImage = resampledFace.m->image;
+namespace
+{
+    // At most this many input texels along each axis contribute to an output texel, for reductions of up to 3 times.
+    const uint kMaxMipmapTaps = 6;
 
-        for (uint y = 0; y < uint(size); y++) {
-            for (uint x = 0; x < uint(size); x++) {
+    struct MipmapContext
+    {
+        const CubeSurface::Private * input;
+        CubeSurface::Private * output;
+        Array<int> firstTap;            // First input texel read by each output column or row, maybe -1.
+        Array<float> tapWeights;        // kMaxMipmapTaps per output column or row, unused taps have a weight of 0.
+    };
 
-                const Vector3 filterDir = texelDirection(f, x, y, size, fixupMethod);
+    // One item per row of a face of the output. Taps outside of the face read the border texels of the neighbouring faces,
+    // the corners, where three faces meet, are left out.
+    static void MipmapTask(void * context, int id)
+    {
+        const MipmapContext * ctx = (const MipmapContext *)context;
+        const TexelTable * table = ctx->input->texelTable;
+        const int edgeLength = int(ctx->input->edgeLength);
+        const uint size = ctx->output->edgeLength;
+        const uint f = id / size;
+        const uint y = id % size;
+
+        const uint faceSize = uint(edgeLength * edgeLength);
+        const float * inputFaces[6][4];
+        for (uint i = 0; i < 6; i++) {
+            for (uint c = 0; c < 4; c++) {
+                inputFaces[i][c] = ctx->input->face[i].m->image->channel(c);
+            }
+        }
 
-                Vector3 color = m->sample(filterDir);
+        FloatImage * image = ctx->output->face[f].m->image;
+        const float * wy = ctx->tapWeights.buffer() + y * kMaxMipmapTaps;
 
-                resampledImage->pixel(0, x, y, 0) = color.x;
-                resampledImage->pixel(1, x, y, 0) = color.y;
-                resampledImage->pixel(2, x, y, 0) = color.z;
+        for (uint x = 0; x < size; x++) {
+            const float * wx = ctx->tapWeights.buffer() + x * kMaxMipmapTaps;
+
+            float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            float totalWeight = 0.0f;
+
+            for (uint j = 0; j < kMaxMipmapTaps && wy[j] > 0.0f; j++) {
+                const int ty = ctx->firstTap[y] + int(j);
+                const bool yInside = (ty >= 0 && ty < edgeLength);
+
+                for (uint i = 0; i < kMaxMipmapTaps && wx[i] > 0.0f; i++) {
+                    const int tx = ctx->firstTap[x] + int(i);
+                    const bool xInside = (tx >= 0 && tx < edgeLength);
+                    if (!xInside && !yInside) continue;
+
+                    const uint texel = (xInside && yInside) ? f * faceSize + ty * edgeLength + tx : table->borderTexel(f, tx, ty);
+                    const uint texelFace = texel / faceSize;
+                    const uint idx = texel % faceSize;
+
+                    const float w = wx[i] * wy[j] * table->solidAngleArray[idx];
+                    for (uint c = 0; c < 4; c++) {
+                        sum[c] += w * inputFaces[texelFace][c][idx];
+                    }
+                    totalWeight += w;
+                }
+            }
+
+            const float scale = 1.0f / totalWeight;
+            for (uint c = 0; c < 4; c++) {
+                image->pixel(c, y * size + x) = sum[c] * scale;
             }
         }
     }
+}
 
-    // @@ Implement edge averaging. Share this code with cosinePowerFilter
-    if (fixupMethod == EdgeFixup_Average) {
+// The filter is a tent with a radius of one output texel. For even edge lengths its weights are 1, 3, 3, 1 along each axis.
+bool CubeSurface::buildNextMipmap()
+{
+    if (isNull() || m->edgeLength <= 1) return false;
+
+    m->allocateTexelTable();
+    m->flushFaces();
+
+    const uint edgeLength = m->edgeLength;
+    const uint size = max(1U, edgeLength / 2);
+    const float scale = float(edgeLength) / size;
+    nvDebugCheck(scale <= 3.0f);
+
+    CubeSurface next;
+    next.m->allocate(size);
+
+    MipmapContext context;
+    context.input = m;
+    context.output = next.m;
+    context.firstTap.resize(size);
+    context.tapWeights.resize(size * kMaxMipmapTaps);
+
+    // Texels whose centers are within the radius of the tent from the center of the output texel, in input texel coordinates.
+    for (uint i = 0; i < size; i++) {
+        const float center = (float(i) + 0.5f) * scale - 0.5f;
+        const int first = ifloor(center - scale) + 1;
+        context.firstTap[i] = first;
+
+        for (uint t = 0; t < kMaxMipmapTaps; t++) {
+            context.tapWeights[i * kMaxMipmapTaps + t] = max(0.0f, 1.0f - fabsf(float(first + int(t)) - center) / scale);
+        }
     }
 
-    return resampledCube;
+    const uint rowCount = 6 * size;
+    if (rowCount * size < kParallelCubeThreshold) {
+        for (uint i = 0; i < rowCount; i++) {
+            MipmapTask(&context, i);
+        }
+    }
+    else {
+        TaskScheduler::global()->parallelFor(MipmapTask, &context, rowCount);
+    }
+
+    *this = next;
+    return true;
 }
 
 
@@ -992,51 +1833,209 @@ void CubeSurface::toGamma(float gamma)
 }
 
 
-#if 0
-// @@ Provide solar azimuth.
-#include "ArHoseSkyModel.h"
-void CubeSurface::sky(float turbidity, float albedo[3], float solarElevation) {
+namespace
+{
+    // The channels hold the spectral radiance at 700 nm (red), 546.1 nm (green) and 435.8 nm (blue). The model is tabulated
+    // every 40 nm from 320 nm, each channel blends the two configurations around its wavelength.
+    static const double kSkyChannelWavelengths[3] = { 700.0, 546.1, 435.8 };
+
+    // The model cooked for one position of the sun, the radiance of each tabulated wavelength is folded in the blend weights.
+    struct SkyKeyframe
+    {
+        Vector3 sun;
+        float config[3][2][9];
+        float weight[3][2];
+    };
+
+    static void initSkyKeyframe(SkyKeyframe * keyframe, float turbidity, const float albedo[3], float solarElevation, float solarAzimuth)
+    {
+        // The model is only defined for a sun above the horizon.
+        const float elevation = clamp(solarElevation, 0.0f, PI / 2);
+
+        keyframe->sun = Vector3(cosf(elevation) * sinf(solarAzimuth), sinf(elevation), cosf(elevation) * cosf(solarAzimuth));
 
-    ArHosekSkyModelState * skymodel_state[3];
+        for (uint c = 0; c < 3; c++) {
+            ArHosekSkyModelState * state = arhosekskymodelstate_alloc_init(turbidity, clamp(albedo[c], 0.0f, 1.0f), elevation);
 
-    for (int i = 0; i < num_channels; i++) {
-        skymodel_state[i] = arhosekskymodelstate_alloc_init(turbidity, albedo[i], solarElevation);
+            const double t = (kSkyChannelWavelengths[c] - 320.0) / 40.0;
+            const int low = int(t);
+            const double interp = t - low;
+
+            for (uint i = 0; i < 2; i++) {
+                for (uint j = 0; j < 9; j++) {
+                    keyframe->config[c][i][j] = float(state->configs[low + i][j]);
+                }
+                keyframe->weight[c][i] = float((i == 0 ? 1.0 - interp : interp) * state->radiances[low + i]);
+            }
+
+            arhosekskymodelstate_free(state);
+        }
     }
 
-    // 700 nm (red), 546.1 nm (green) and 435.8 nm (blue).
-    float channel_center[3] = {
-        700,    // Red 620740,
-        546.1,  // Green 520570,
-        435.8,  // Blue 450490,
-    };
+    // ArHosekSkyModel_GetRadianceInternal in single precision.
+    static float skyRadiance(const float * c, float cosTheta, float gamma, float cosGamma)
+    {
+        const float expM = expf(c[4] * gamma);
+        const float rayM = cosGamma * cosGamma;
+        const float d = 1.0f + c[8] * c[8] - 2.0f * c[8] * cosGamma;
+        const float mieM = (1.0f + rayM) / (d * sqrtf(d));
+        const float zenith = sqrtf(cosTheta);
 
-    // @@ For each pixel:
-    // What's the channel center for the RGB model?
-    double  skydome_result[3];
-    for (unsigned int i = 0; i < num_channels; i++) {
-        skydome_result[i] = arhosekskymodel_radiance(skymodel_state[i], theta, gamma, channel_center[i]);
+        return (1.0f + c[0] * expf(c[1] / (cosTheta + 0.01f))) * (c[2] + c[3] * expM + c[5] * rayM + c[6] * mieM + c[7] * zenith);
     }
 
-    for (int i = 0; i < num_channels; i++) {
-        arhosek_skymodelstate_free(skymodel_state[i]);
+#if NV_USE_SSE > 1
+    // Abramowitz and Stegun 4.4.46, the error is about 2e-8 before rounding.
+    static SimdVector approxAcos(SimdVector::Arg x)
+    {
+        const SimdVector a(_mm_andnot_ps(_mm_set1_ps(-0.0f), x.vec));
+
+        SimdVector p(-0.0012624911f);
+        p = multiplyAdd(p, a, SimdVector(0.0066700901f));
+        p = multiplyAdd(p, a, SimdVector(-0.0170881256f));
+        p = multiplyAdd(p, a, SimdVector(0.0308918810f));
+        p = multiplyAdd(p, a, SimdVector(-0.0501743046f));
+        p = multiplyAdd(p, a, SimdVector(0.0889789874f));
+        p = multiplyAdd(p, a, SimdVector(-0.2145988016f));
+        p = multiplyAdd(p, a, SimdVector(1.5707963050f));
+
+        const SimdVector r = SimdVector(_mm_sqrt_ps((SimdVector(1.0f) - a).vec)) * p;
+
+        // acos(-x) = pi - acos(x)
+        return select(r, SimdVector(PI) - r, SimdVector(_mm_cmplt_ps(x.vec, _mm_setzero_ps())));
     }
 
-    /*
-    ArHosekXYZSkyModelState * skymodel_state[3];
+    static SimdVector skyRadiance(const float * c, SimdVector::Arg cosTheta, SimdVector::Arg zenith, SimdVector::Arg gamma, SimdVector::Arg cosGamma)
+    {
+        // exp(x) = 2^(x * log2(e))
+        const SimdVector expM = approxExp2(SimdVector(c[4] * 1.44269504f) * gamma);
+        const SimdVector rayM = cosGamma * cosGamma;
+        const SimdVector d = negativeMultiplySubtract(SimdVector(2.0f * c[8]), cosGamma, SimdVector(1.0f + c[8] * c[8]));
+        const SimdVector mieM(_mm_div_ps((SimdVector(1.0f) + rayM).vec, (d * SimdVector(_mm_sqrt_ps(d.vec))).vec));
+        const SimdVector horizon = approxExp2(SimdVector(_mm_div_ps(SimdVector(c[1] * 1.44269504f).vec, (cosTheta + SimdVector(0.01f)).vec)));
+
+        SimdVector sum = multiplyAdd(SimdVector(c[3]), expM, SimdVector(c[2]));
+        sum = multiplyAdd(SimdVector(c[5]), rayM, sum);
+        sum = multiplyAdd(SimdVector(c[6]), mieM, sum);
+        sum = multiplyAdd(SimdVector(c[7]), zenith, sum);
+
+        return multiplyAdd(SimdVector(c[0]), horizon, SimdVector(1.0f)) * sum;
+    }
+#endif
 
-    for (int i = 0; i < num_channels; i++) {
-        skymodel_state[i] = arhosek_xyz_skymodelstate_alloc_init(turbidity, albedo[i], solarElevation);
+    struct SkyContext
+    {
+        CubeSurface * cubes;
+        const SkyKeyframe * keyframes;
+        uint count;
+        uint size;
+    };
+
+    // One item per row of a face. The terms that only depend on the direction of the texels are evaluated once for all the
+    // keyframes.
+    static void SkyTask(void * context, int id)
+    {
+        const SkyContext * ctx = (const SkyContext *)context;
+        const uint size = ctx->size;
+        const uint f = id / size;
+        const uint y = id % size;
+        const uint offset = y * size;
+
+        uint x = 0;
+#if NV_USE_SSE > 1
+        for (; x + 4 <= size; x += 4) {
+            NV_ALIGN_16 float dirs[3][4];
+            for (uint i = 0; i < 4; i++) {
+                const Vector3 dir = texelDirection(f, x + i, y, size, EdgeFixup_None);
+                dirs[0][i] = dir.x;
+                dirs[1][i] = dir.y;
+                dirs[2][i] = dir.z;
+            }
+            const SimdVector dx(dirs[0]), dy(dirs[1]), dz(dirs[2]);
+
+            // Below the horizon the zenith angle is clamped to 90 degrees.
+            const SimdVector cosTheta = max(dy, SimdVector(0.0f));
+            const SimdVector zenith(_mm_sqrt_ps(cosTheta.vec));
+
+            for (uint k = 0; k < ctx->count; k++) {
+                const SkyKeyframe & keyframe = ctx->keyframes[k];
+
+                SimdVector cosGamma = dx * SimdVector(keyframe.sun.x);
+                cosGamma = multiplyAdd(dy, SimdVector(keyframe.sun.y), cosGamma);
+                cosGamma = multiplyAdd(dz, SimdVector(keyframe.sun.z), cosGamma);
+                cosGamma = min(max(cosGamma, SimdVector(-1.0f)), SimdVector(1.0f));
+                const SimdVector gamma = approxAcos(cosGamma);
+
+                FloatImage * image = ctx->cubes[k].m->face[f].m->image;
+                for (uint c = 0; c < 3; c++) {
+                    SimdVector radiance = SimdVector(keyframe.weight[c][0]) * skyRadiance(keyframe.config[c][0], cosTheta, zenith, gamma, cosGamma);
+                    radiance = multiplyAdd(SimdVector(keyframe.weight[c][1]), skyRadiance(keyframe.config[c][1], cosTheta, zenith, gamma, cosGamma), radiance);
+                    _mm_storeu_ps(image->channel(c) + offset + x, radiance.vec);
+                }
+            }
+        }
+#endif
+        for (; x < size; x++) {
+            const Vector3 dir = texelDirection(f, x, y, size, EdgeFixup_None);
+            const float cosTheta = max(dir.y, 0.0f);
+
+            for (uint k = 0; k < ctx->count; k++) {
+                const SkyKeyframe & keyframe = ctx->keyframes[k];
+                const float cosGamma = clamp(dot(dir, keyframe.sun), -1.0f, 1.0f);
+                const float gamma = acosf(cosGamma);
+
+                FloatImage * image = ctx->cubes[k].m->face[f].m->image;
+                for (uint c = 0; c < 3; c++) {
+                    image->channel(c)[offset + x] =
+                        keyframe.weight[c][0] * skyRadiance(keyframe.config[c][0], cosTheta, gamma, cosGamma) +
+                        keyframe.weight[c][1] * skyRadiance(keyframe.config[c][1], cosTheta, gamma, cosGamma);
+                }
+            }
+        }
+
+        for (uint k = 0; k < ctx->count; k++) {
+            float * a = ctx->cubes[k].m->face[f].m->image->channel(3) + offset;
+            for (x = 0; x < size; x++) {
+                a[x] = 1.0f;
+            }
+        }
     }
+}
+
+void nvtt::skyCubes(int size, float turbidity, const float albedo[3], const float * solarElevations, const float * solarAzimuths, int count, CubeSurface * cubes)
+{
+    if (count <= 0) return;
+
+    turbidity = clamp(turbidity, 1.0f, 10.0f);
+
+    Array<SkyKeyframe> keyframes;
+    keyframes.resize(count);
+
+    for (int i = 0; i < count; i++) {
+        initSkyKeyframe(&keyframes[i], turbidity, albedo, solarElevations[i], solarAzimuths[i]);
 
-    // @@ For each pixel.
-    double  skydome_result[3];
-    for (unsigned int i = 0; i < num_channels; i++) {
-        skydome_result[i] = arhosek_xyz_skymodel_radiance(skymodel_state[i], theta, gamma, i);
+        cubes[i].detach();
+        cubes[i].m->allocate(size);
     }
 
-    for (int i = 0; i < num_channels; i++) {
-        arhosek_xyz_skymodelstate_free(skymodel_state[i]);
+    SkyContext context;
+    context.cubes = cubes;
+    context.keyframes = keyframes.buffer();
+    context.count = count;
+    context.size = size;
+
+    const uint rowCount = 6 * size;
+    if (count * rowCount * size < kParallelCubeThreshold) {
+        for (uint i = 0; i < rowCount; i++) {
+            SkyTask(&context, i);
+        }
+    }
+    else {
+        TaskScheduler::global()->parallelFor(SkyTask, &context, rowCount);
     }
-    */
 }
-#endif
\ No newline at end of file
+
+void CubeSurface::sky(int size, float turbidity, const float albedo[3], float solarElevation, float solarAzimuth/*= 0.0f*/)
+{
+    skyCubes(size, turbidity, albedo, &solarElevation, &solarAzimuth, 1, this);
+}
@@ -39,14 +39,41 @@
 namespace nvtt
 {
     struct TexelTable {
-        TexelTable(uint edgeLength);
+        // The tables are shared by all the cubes with the same edge length. acquire returns the cached table, or builds it,
+        // and release deletes it once no cube uses it.
+        static const TexelTable * acquire(uint edgeLength);
+        static void release(const TexelTable * table);
 
         float solidAngle(uint f, uint x, uint y) const;
-        const nv::Vector3 & direction(uint f, uint x, uint y) const;
+        nv::Vector3 direction(uint f, uint x, uint y) const;
+
+        // The faces only differ by a rotation, so the directions of the texels and the tile cones are stored once, in the
+        // frame of a face: the components along its u and v axes and its normal.
+        static nv::Vector3 toFaceFrame(uint f, const nv::Vector3 & dir);
+
+        // The texels of each face are grouped in square tiles, each with a cone that bounds the directions of its texels,
+        // so that the filters only visit the tiles that intersect their own cone.
+        static const uint tileSize = 8;
+        void tileBounds(uint t, uint * x0, uint * y0, uint * x1, uint * y1) const;
+        bool tileIntersectsCone(uint t, const nv::Vector3 & faceDir, float cosineConeAngle, float sineConeAngle) const;
+
+        // Texel of a neighbouring face next to texel (x, y) of face f, where either x or y, but not both, is one texel
+        // outside of the face. The result indexes the texels of all the faces, f * size * size + y * size + x.
+        uint borderTexel(uint f, int x, int y) const;
 
         uint size;
-        nv::Array<float> solidAngleArray;
-        nv::Array<nv::Vector3> directionArray;
+        uint tileCount;                                 // Tiles along each edge of a face.
+        nv::Array<float> solidAngleArray;               // Solid angle of the texels of a face, the same for all faces.
+        nv::Array<float> directionArray[3];             // Components of the direction of each texel in the frame of its face.
+        nv::Array<nv::Vector3> tileAxisArray;           // In the frame of the face.
+        nv::Array<float> tileCosineArray;               // Cosine and sine of the half angle of the tile cones.
+        nv::Array<float> tileSineArray;
+        nv::Array<uint> borderArray;                    // 4 * size texels around each face: above, below, left and right.
+
+    private:
+        TexelTable(uint edgeLength);
+
+        uint refCount;                                  // Guarded by the mutex of the cache.
     };
 
 
@@ -69,15 +96,20 @@ namespace nvtt
             for (uint i = 0; i < 6; i++) {
                 face[i] = p.face[i];
             }
-            texelTable = NULL; // @@ Transfer tables. Needs refcounting?
+            texelTable = (p.texelTable != NULL) ? TexelTable::acquire(p.edgeLength) : NULL;
         }
         ~Private()
         {
-            delete texelTable;
+            if (texelTable != NULL) TexelTable::release(texelTable);
         }
 
         void allocate(uint edgeLength)
         {
+            if (texelTable != NULL && texelTable->size != edgeLength) {
+                TexelTable::release(texelTable);
+                texelTable = NULL;
+            }
+
             this->edgeLength = edgeLength;
             for (uint i = 0; i < 6; i++) {
                 face[i].detach();
@@ -89,7 +121,15 @@ namespace nvtt
         void allocateTexelTable()
         {
             if (texelTable == NULL) {
-                texelTable = new TexelTable(edgeLength);
+                texelTable = TexelTable::acquire(edgeLength);
+            }
+        }
+
+        // The filters read the texels of the faces directly, run their pending operations and unpack them first.
+        void flushFaces() const
+        {
+            for (uint i = 0; i < 6; i++) {
+                face[i].m->flush();
             }
         }
 
@@ -101,7 +141,7 @@ namespace nvtt
 
         uint edgeLength;
         Surface face[6];
-        TexelTable * texelTable;
+        const TexelTable * texelTable;
     };
 
 } // nvtt namespace
@@ -0,0 +1,193 @@
+// This code is in the public domain -- castano@gmail.com
+
+#include "ExternalCompressor.h"
+#include "CompressionOptions.h"
+#include "OutputOptions.h"
+
+#include "nvimage/ColorBlock.h"
+
+#include "nvthread/nvthread.h"
+#include "nvthread/Thread.h"
+#include "nvthread/Atomic.h"
+#include "nvthread/Mutex.h"
+
+#include "nvcore/Library.h"
+#include "nvcore/StrLib.h"
+#include "nvcore/Array.inl"
+
+using namespace nv;
+using namespace nvtt;
+
+
+namespace
+{
+    struct LoadedEncoder
+    {
+        String name;
+        const NvttEncoder * encoder;    // NULL when the library didn't load.
+    };
+
+    // Encoders are looked up for each image, the libraries are loaded once and never unloaded.
+    Mutex & loadedEncodersMutex()
+    {
+        static Mutex mutex;
+        return mutex;
+    }
+
+    Array<LoadedEncoder> & loadedEncoders()
+    {
+        static Array<LoadedEncoder> encoders;
+        return encoders;
+    }
+
+    const NvttEncoder * loadEncoder(const char * name)
+    {
+        void * library = nvLoadLibrary(name);
+        if (library == NULL) {
+            StringBuilder platformName;
+#if NV_OS_WIN32
+            platformName.format("%s.dll", name);
+#elif NV_OS_DARWIN
+            platformName.format("lib%s.dylib", name);
+#else
+            platformName.format("lib%s.so", name);
+#endif
+            library = nvLoadLibrary(platformName.str());
+            if (library == NULL) return NULL;
+        }
+
+        NvttGetEncoderFunction getEncoder = (NvttGetEncoderFunction)nvBindSymbol(library, NVTT_ENCODER_ENTRY_POINT);
+        const NvttEncoder * encoder = (getEncoder != NULL) ? getEncoder(NVTT_ENCODER_ABI_VERSION) : NULL;
+
+        if (encoder == NULL || encoder->abiVersion != NVTT_ENCODER_ABI_VERSION ||
+            encoder->beginImage == NULL || encoder->encodeBlocks == NULL || encoder->endImage == NULL)
+        {
+            nvUnloadLibrary(library);
+            return NULL;
+        }
+
+        return encoder;
+    }
+
+    struct ExternalScratch : public BlockScratch
+    {
+        ExternalScratch(ExternalCompressor * compressor) : compressor(compressor), threadIndex(compressor->acquireThreadIndex()) {}
+        virtual ~ExternalScratch() { compressor->releaseThreadIndex(threadIndex); }
+
+        ExternalCompressor * compressor;
+        uint threadIndex;
+    };
+
+} // namespace
+
+
+const NvttEncoder * nv::findExternalEncoder(const char * name)
+{
+    Lock<Mutex> lock(loadedEncodersMutex());
+
+    Array<LoadedEncoder> & encoders = loadedEncoders();
+    for (uint i = 0; i < encoders.count(); i++) {
+        if (encoders[i].name == name) return encoders[i].encoder;
+    }
+
+    LoadedEncoder loaded;
+    loaded.name = name;
+    loaded.encoder = loadEncoder(name);
+    encoders.append(loaded);
+
+    return loaded.encoder;
+}
+
+bool nv::isExternalEncoderFormat(Format format)
+{
+    return format == Format_DXT1 || format == Format_DXT1a || format == Format_DXT3 || format == Format_DXT5 ||
+        format == Format_BC4 || format == Format_BC5 || format == Format_BC7;
+}
+
+
+ExternalCompressor::ExternalCompressor(const NvttEncoder * encoder, Format format) : encoder(encoder), format(format), state(NULL)
+{
+    threadSlots.resize(max(hardwareThreadCount(), 1U), 0);
+}
+
+void ExternalCompressor::compress(AlphaMode alphaMode, uint w, uint h, uint d, const float * rgba, TaskDispatcher * dispatcher, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions)
+{
+    NvttEncoderSettings settings;
+    settings.structSize = sizeof(NvttEncoderSettings);
+    settings.format = compressionOptions.format;
+    settings.quality = compressionOptions.quality;
+    settings.alphaMode = alphaMode;
+    settings.colorWeights[0] = compressionOptions.colorWeight.x;
+    settings.colorWeights[1] = compressionOptions.colorWeight.y;
+    settings.colorWeights[2] = compressionOptions.colorWeight.z;
+    settings.colorWeights[3] = compressionOptions.colorWeight.w;
+    settings.threadCount = threadSlots.count();
+
+    state = encoder->beginImage(&settings);
+    if (state == NULL) {
+        outputOptions.error(Error_UnsupportedFeature);
+        return;
+    }
+
+    ColorBlockCompressor::compress(alphaMode, w, h, d, rgba, dispatcher, compressionOptions, outputOptions);
+
+    encoder->endImage(state);
+    state = NULL;
+}
+
+void ExternalCompressor::compressBlock(ColorBlock & rgba, AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions, void * output)
+{
+    const uint threadIndex = acquireThreadIndex();
+    encode(&rgba, 1, threadIndex, output);
+    releaseThreadIndex(threadIndex);
+}
+
+void ExternalCompressor::compressBlocks(ColorBlock * blocks, uint count, BlockScratch * scratch, AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions, void * output)
+{
+    if (scratch == NULL) {
+        ColorBlockCompressor::compressBlocks(blocks, count, scratch, alphaMode, compressionOptions, output);
+        return;
+    }
+
+    encode(blocks, count, ((ExternalScratch *)scratch)->threadIndex, output);
+}
+
+BlockScratch * ExternalCompressor::createScratch(AlphaMode alphaMode, const CompressionOptions::Private & compressionOptions)
+{
+    return new ExternalScratch(this);
+}
+
+uint ExternalCompressor::blockSize() const
+{
+    return (format == Format_DXT1 || format == Format_DXT1a || format == Format_BC4) ? 8 : 16;
+}
+
+uint ExternalCompressor::acquireThreadIndex()
+{
+    // There are usually as many tasks as threads, a task only waits when the dispatcher runs more of them at once.
+    for (;;) {
+        for (uint i = 0; i < threadSlots.count(); i++) {
+            if (threadSlots[i] == 0 && atomicCompareAndSwap(&threadSlots[i], 0, 1)) return i;
+        }
+        Thread::yield();
+    }
+}
+
+void ExternalCompressor::releaseThreadIndex(uint index)
+{
+    atomicSwap(&threadSlots[index], 0);
+}
+
+void ExternalCompressor::encode(const ColorBlock * blocks, uint count, uint threadIndex, void * output)
+{
+    // The texels of the blocks are already laid out like the interface expects them.
+    nvStaticCheck(sizeof(ColorBlock) == 16 * sizeof(Color32));
+
+    NvttBlockBatch batch;
+    batch.texels = (const unsigned char *)blocks;
+    batch.blockCount = count;
+    batch.threadIndex = threadIndex;
+    batch.output = output;
+
+    encoder->encodeBlocks(state, &batch);
+}
@@ -0,0 +1,51 @@
+// This code is in the public domain -- castano@gmail.com
+
+#pragma once
+#ifndef NVTT_EXTERNALCOMPRESSOR_H
+#define NVTT_EXTERNALCOMPRESSOR_H
+
+#include "BlockCompressor.h"
+#include "nvtt_encoder.h"
+
+#include "nvcore/Array.h"
+
+
+namespace nv
+{
+    // Return the encoder of the library with the given name, or NULL when it can't be loaded or doesn't support the
+    // interface of nvtt_encoder.h.
+    const NvttEncoder * findExternalEncoder(const char * name);
+
+    // Formats that encoders of nvtt_encoder.h can compress.
+    bool isExternalEncoderFormat(nvtt::Format format);
+
+    // Compress the blocks with an encoder loaded from a library.
+    struct ExternalCompressor : public ColorBlockCompressor
+    {
+        ExternalCompressor(const NvttEncoder * encoder, nvtt::Format format);
+
+        using ColorBlockCompressor::compress;
+        virtual void compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const float * rgba, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions);
+
+        virtual void compressBlock(ColorBlock & rgba, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+        virtual void compressBlocks(ColorBlock * blocks, uint count, BlockScratch * scratch, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+        virtual BlockScratch * createScratch(nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions);
+        virtual uint blockSize() const;
+
+        // Take a thread index no other task of the image holds, and give it back.
+        uint acquireThreadIndex();
+        void releaseThreadIndex(uint index);
+
+    private:
+        void encode(const ColorBlock * blocks, uint count, uint threadIndex, void * output);
+
+        const NvttEncoder * encoder;
+        const nvtt::Format format;
+        void * state;
+        Array<uint32> threadSlots;      // One for each thread index, nonzero while a task holds it.
+    };
+
+} // nv namespace
+
+
+#endif // NVTT_EXTERNALCOMPRESSOR_H
@@ -74,6 +74,47 @@ namespace
         }
     }
 
+    // Index of the image of the given face and mipmap, or -1 if it's not in the layout or doesn't have the extents of the mipmap.
+    static int imageIndex(const InputOptions::Private & m, int width, int height, int depth, int face, int mipLevel)
+    {
+        if (uint(face) >= m.faceCount) {
+            return -1;
+        }
+        if (uint(mipLevel) >= m.mipmapCount) {
+            return -1;
+        }
+
+        const uint idx = mipLevel * m.faceCount + face;
+        if (idx >= m.imageCount) {
+            return -1;
+        }
+
+        // Compute expected width, height and depth for this mipLevel.
+        int w = m.width;
+        int h = m.height;
+        int d = m.depth;
+        for (int i = 0; i < mipLevel; i++) {
+            w = max(1, w/2);
+            h = max(1, h/2);
+            d = max(1, d/2);
+        }
+        if (w != width || h != height || d != depth) {
+            return -1;
+        }
+
+        return int(idx);
+    }
+
+    // Forget the image, and free it unless it's the caller's.
+    static void releaseImage(InputOptions::Private & m, uint idx)
+    {
+        if (m.pitches[idx] == 0) {
+            mem::free(m.images[idx]);
+        }
+        m.images[idx] = NULL;
+        m.pitches[idx] = 0;
+    }
+
 } // namespace
 
 
@@ -112,6 +153,9 @@ void InputOptions::reset()
     m.kaiserAlpha = 4.0f;
     m.kaiserStretch = 1.0f;
 
+    m.keepAlphaCoverage = false;
+    m.alphaCoverageRef = 0.5f;
+
     m.isNormalMap = false;
     m.normalizeMipmaps = true;
     m.convertToNormalMap = false;
@@ -124,17 +168,19 @@ void InputOptions::reset()
 
 
 // Setup the input image.
-void InputOptions::setTextureLayout(TextureType type, int width, int height, int depth /*= 1*/)
+void InputOptions::setTextureLayout(TextureType type, int width, int height, int depth /*= 1*/, int arraySize /*= 1*/)
 {
     // Validate arguments.
     nvCheck(width >= 0);
     nvCheck(height >= 0);
     nvCheck(depth >= 0);
+    nvCheck(arraySize >= 0);
 
     // Correct arguments.
     if (width == 0) width = 1;
     if (height == 0) height = 1;
     if (depth == 0) depth = 1;
+    if (arraySize == 0 || type == TextureType_3D) arraySize = 1;
 
     // Delete previous images.
     resetTextureLayout();
@@ -145,12 +191,15 @@ void InputOptions::setTextureLayout(TextureType type, int width, int height, int
     m.depth = depth;
 
     // Allocate images.
-    m.faceCount = (type == TextureType_Cube) ? 6 : 1;
+    m.arraySize = arraySize;
+    m.faceCount = ((type == TextureType_Cube) ? 6 : 1) * arraySize;
     m.mipmapCount = countMipmaps(width, height, depth);
     m.imageCount = m.mipmapCount * m.faceCount;
     m.images = new void *[m.imageCount];
+    m.pitches = new uint[m.imageCount];
 
     memset(m.images, 0, sizeof(void *) * m.imageCount);
+    memset(m.pitches, 0, sizeof(uint) * m.imageCount);
 }
 
 
@@ -160,14 +209,17 @@ void InputOptions::resetTextureLayout()
     {
         // Delete images.
         for (uint i = 0; i < m.imageCount; i++) {
-            free(m.images[i]);
+            releaseImage(m, i);
         }
 
         // Delete image array.
         delete [] m.images;
+        delete [] m.pitches;
         m.images = NULL;
+        m.pitches = NULL;
 
         m.faceCount = 0;
+        m.arraySize = 0;
         m.mipmapCount = 0;
         m.imageCount = 0;
     }
@@ -177,28 +229,8 @@ void InputOptions::resetTextureLayout()
 // Copies the data to our internal structures.
 bool InputOptions::setMipmapData(const void * data, int width, int height, int depth /*= 1*/, int face /*= 0*/, int mipLevel /*= 0*/)
 {
-    if (uint(face) >= m.faceCount) {
-        return false;
-    }
-    if (uint(mipLevel) >= m.mipmapCount) {
-        return false;
-    }
-
-    const uint idx = mipLevel * m.faceCount + face;
-    if (idx >= m.imageCount) {
-        return false;
-    }
-
-    // Compute expected width, height and depth for this mipLevel. Return false if it doesn't match.
-    int w = m.width;
-    int h = m.height;
-    int d = m.depth;
-    for (int i = 0; i < mipLevel; i++) {
-        w = max(1, w/2);
-        h = max(1, h/2);
-        d = max(1, d/2);
-    }
-    if (w != width || h != height || d != depth) {
+    const int idx = imageIndex(m, width, height, depth, face, mipLevel);
+    if (idx < 0) {
         return false;
     }
 
@@ -224,7 +256,12 @@ bool InputOptions::setMipmapData(const void * data, int width, int height, int d
         return false;
     }
 
-    m.images[idx] = realloc(m.images[idx], imageSize);
+    // The caller's images are replaced by a copy.
+    if (m.pitches[idx] != 0) {
+        releaseImage(m, idx);
+    }
+
+    m.images[idx] = mem::realloc(m.images[idx], imageSize);
     if (m.images[idx] == NULL) {
         // Out of memory.
         return false;
@@ -235,6 +272,33 @@ bool InputOptions::setMipmapData(const void * data, int width, int height, int d
     return true;
 }
 
+// Reference the data of the caller.
+bool InputOptions::setMipmapDataView(const void * data, int width, int height, int depth /*= 1*/, int face /*= 0*/, int mipLevel /*= 0*/, int pitch /*= 0*/)
+{
+    const int idx = imageIndex(m, width, height, depth, face, mipLevel);
+    if (idx < 0 || data == NULL) {
+        return false;
+    }
+
+    uint texelSize;
+    if (m.inputFormat == InputFormat_BGRA_8UB) texelSize = 4 * sizeof(uint8);
+    else if (m.inputFormat == InputFormat_RGBA_16F) texelSize = 4 * sizeof(uint16);
+    else if (m.inputFormat == InputFormat_RGBA_32F) texelSize = 4 * sizeof(float);
+    else if (m.inputFormat == InputFormat_R_32F) texelSize = 1 * sizeof(float);
+    else return false;
+
+    const uint rowSize = width * texelSize;
+    if (pitch < 0 || (pitch != 0 && uint(pitch) < rowSize)) {
+        return false;
+    }
+
+    releaseImage(m, idx);
+    m.images[idx] = const_cast<void *>(data);
+    m.pitches[idx] = (pitch != 0) ? uint(pitch) : rowSize;
+
+    return true;
+}
+
 
 /// Describe the format of the input.
 void InputOptions::setFormat(InputFormat format)
@@ -286,6 +350,13 @@ void InputOptions::setKaiserParameters(float width, float alpha, float stretch)
     m.kaiserStretch = stretch;
 }
 
+/// Scale the alpha of the mipmaps so that they pass the alpha test with the given reference as often as the top level.
+void InputOptions::setMipmapAlphaCoverage(bool enabled, float alphaRef/*= 0.5f*/)
+{
+    m.keepAlphaCoverage = enabled;
+    m.alphaCoverageRef = alphaRef;
+}
+
 /// Indicate whether input is a normal map or not.
 void InputOptions::setNormalMap(bool b)
 {
@@ -35,7 +35,7 @@ namespace nvtt
 
     struct InputOptions::Private
     {
-        Private() : images(NULL) {}
+        Private() : images(NULL), pitches(NULL) {}
 
         WrapMode wrapMode;
         TextureType textureType;
@@ -45,11 +45,13 @@ namespace nvtt
         uint width;
         uint height;
         uint depth;
-        uint faceCount;
+        uint faceCount;     // Of all the layers.
+        uint arraySize;
         uint mipmapCount;
         uint imageCount;
 
         void ** images;
+        uint * pitches;     // Bytes between the rows of the images of the caller, see setMipmapDataView. 0 for our copies.
 
         // Gamma conversion.
         float inputGamma;
@@ -65,6 +67,10 @@ namespace nvtt
         float kaiserAlpha;
         float kaiserStretch;
 
+        // Alpha test coverage of the mipmaps.
+        bool keepAlphaCoverage;
+        float alphaCoverageRef;
+
         // Normal map options.
         bool isNormalMap;
         bool normalizeMipmaps;
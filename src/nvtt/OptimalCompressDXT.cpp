@@ -23,6 +23,7 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include "OptimalCompressDXT.h"
+#include "QuickCompressDXT.h"
 #include "SingleColorLookup.h"
 
 #include <nvimage/ColorBlock.h>
@@ -35,6 +36,10 @@
 #include <limits.h>     // INT_MAX
 #include <float.h>      // FLT_MAX
 
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 using namespace nv;
 using namespace OptimalCompress;
 
@@ -243,6 +248,328 @@ namespace
 		}
 	}
 
+#if NV_USE_SSE > 1
+
+	// Alpha values and weights of a block in SSE registers, for computeAlphaErrorSSE.
+	struct AlphaBlockSSE
+	{
+		__m128i alpha;
+		__m128 weights[4];
+	};
+
+	static void initAlphaBlockSSE(const AlphaBlock4x4 & src, AlphaBlockSSE * dst)
+	{
+		dst->alpha = _mm_loadu_si128((const __m128i *)src.alpha);
+		for (uint i = 0; i < 4; i++) {
+			dst->weights[i] = _mm_loadu_ps(src.weights + 4 * i);
+		}
+	}
+
+	// Same as computeAlphaError, but finds the nearest palette entry of all texels at once.
+	static float computeAlphaErrorSSE(const AlphaBlockSSE & src, const AlphaBlockDXT5 * dst)
+	{
+		uint8 alphas[8];
+		dst->evaluatePalette(alphas, false); // @@ Use target decoder.
+
+		__m128i minDist = _mm_set1_epi8(-1);
+		for (uint p = 0; p < 8; p++)
+		{
+			__m128i a = _mm_set1_epi8(alphas[p]);
+			__m128i dist = _mm_or_si128(_mm_subs_epu8(src.alpha, a), _mm_subs_epu8(a, src.alpha));
+			minDist = _mm_min_epu8(minDist, dist);
+		}
+
+		const __m128i zero = _mm_setzero_si128();
+		__m128i lo = _mm_unpacklo_epi8(minDist, zero);
+		__m128i hi = _mm_unpackhi_epi8(minDist, zero);
+
+		__m128 d0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+		__m128 d1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+		__m128 d2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+		__m128 d3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+
+		__m128 sum = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(_mm_mul_ps(d0, d0), src.weights[0]), _mm_mul_ps(_mm_mul_ps(d1, d1), src.weights[1])),
+			_mm_add_ps(_mm_mul_ps(_mm_mul_ps(d2, d2), src.weights[2]), _mm_mul_ps(_mm_mul_ps(d3, d3), src.weights[3])));
+
+		sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+		sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(sum);
+	}
+
+	typedef AlphaBlockSSE AlphaSearchBlock;
+
+	static void initAlphaSearchBlock(const AlphaBlock4x4 & src, AlphaSearchBlock * dst) { initAlphaBlockSSE(src, dst); }
+	static float computeAlphaSearchError(const AlphaSearchBlock & src, const AlphaBlockDXT5 * dst) { return computeAlphaErrorSSE(src, dst); }
+
+#else
+
+	typedef AlphaBlock4x4 AlphaSearchBlock;
+
+	static void initAlphaSearchBlock(const AlphaBlock4x4 & src, AlphaSearchBlock * dst) { *dst = src; }
+	static float computeAlphaSearchError(const AlphaSearchBlock & src, const AlphaBlockDXT5 * dst) { return computeAlphaError(src, dst); }
+
+#endif
+
+	// Move the endpoints to the best of their 8 neighbors, halving the step when none of them is better.
+	// The order of the endpoints, and with it the palette mode, is preserved.
+	static float refineAlphaEndpoints(const AlphaSearchBlock & src, int * a0, int * a1, int iterationCount)
+	{
+		static const int offsets[8][2] = { {-1, -1}, {-1, 0}, {-1, 1}, {0, -1}, {0, 1}, {1, -1}, {1, 0}, {1, 1} };
+
+		const bool eightStep = *a0 > *a1;
+
+		AlphaBlockDXT5 block;
+		block.alpha0 = *a0;
+		block.alpha1 = *a1;
+		float besterror = computeAlphaSearchError(src, &block);
+
+		int step = 8;
+		for (int i = 0; i < iterationCount && step > 0 && besterror > 0; i++)
+		{
+			int besta0 = *a0;
+			int besta1 = *a1;
+
+			for (uint n = 0; n < 8; n++)
+			{
+				int b0 = *a0 + offsets[n][0] * step;
+				int b1 = *a1 + offsets[n][1] * step;
+
+				if (b0 < 0 || b0 > 255 || b1 < 0 || b1 > 255) continue;
+				if ((b0 > b1) != eightStep) continue;
+
+				block.alpha0 = b0;
+				block.alpha1 = b1;
+				float error = computeAlphaSearchError(src, &block);
+
+				if (error < besterror)
+				{
+					besterror = error;
+					besta0 = b0;
+					besta1 = b1;
+				}
+			}
+
+			if (besta0 == *a0 && besta1 == *a1) {
+				step /= 2;
+			}
+			else {
+				*a0 = besta0;
+				*a1 = besta1;
+			}
+		}
+
+		return besterror;
+	}
+
+	// Squared errors of the nearest palette entry for every value and every pair of endpoints, for the exhaustive searches of the
+	// single channel compressors. They are clamped to 32767, no pair with such an error in a single texel can be the best one,
+	// so the errors of a block can be added with signed saturation, 8 pairs at a time.
+	inline static int16 clampedError(int d)
+	{
+		return int16(min(d * d, 32767));
+	}
+
+	// Four color blocks with green endpoints g0 > g1. The pairs are ordered by g0 and then by g1, the pairs of g0 start at g0 * (g0 - 1) / 2.
+	const uint GreenPairCount = 64 * 63 / 2;
+
+	struct GreenErrorTable
+	{
+		int16 error[256][GreenPairCount];
+		uint8 g0[GreenPairCount];
+		uint8 g1[GreenPairCount];
+	};
+
+	static GreenErrorTable * createGreenErrorTable()
+	{
+		GreenErrorTable * table = new GreenErrorTable;
+
+		BlockDXT1 block;
+		block.col0.r = block.col1.r = 31;
+		block.col0.b = block.col1.b = 0;
+
+		uint p = 0;
+		for (uint g0 = 1; g0 < 64; g0++)
+		{
+			for (uint g1 = 0; g1 < g0; g1++, p++)
+			{
+				block.col0.g = g0;
+				block.col1.g = g1;
+
+				Color32 palette[4];
+				block.evaluatePalette(palette, false); // @@ Use target decoder.
+
+				for (int v = 0; v < 256; v++)
+				{
+					int d = INT_MAX;
+					for (uint k = 0; k < 4; k++) d = min(d, abs(v - int(palette[k].g)));
+					table->error[v][p] = clampedError(d);
+				}
+
+				table->g0[p] = g0;
+				table->g1[p] = g1;
+			}
+		}
+		nvDebugCheck(p == GreenPairCount);
+
+		return table;
+	}
+
+	static const GreenErrorTable & greenErrorTable()
+	{
+		static const GreenErrorTable * s_table = createGreenErrorTable();
+		return *s_table;
+	}
+
+	// The interpolated entries of the DXT5 alpha palettes only depend on the distance between the endpoints: with the
+	// lowest endpoint at a, entry k is a + (k * d) / 7 in the 8 step palette and a + (k * d) / 5 in the 6 step palette.
+	// The errors are indexed by d and by u = a - value + 255, so that the errors of consecutive values of a are adjacent.
+	const uint AlphaErrorRowSize = 511 + 9;     // Room to load 8 errors from any u.
+
+	struct AlphaErrorTables
+	{
+		int16 error8[256][AlphaErrorRowSize];  // alpha0 = a + d, alpha1 = a.
+		int16 error6[256][AlphaErrorRowSize];  // alpha0 = a, alpha1 = a + d, without the 0 and 255 entries.
+	};
+
+	static AlphaErrorTables * createAlphaErrorTables()
+	{
+		AlphaErrorTables * tables = new AlphaErrorTables;
+
+		for (int d = 0; d < 256; d++)
+		{
+			for (int u = 0; u < int(AlphaErrorRowSize); u++)
+			{
+				const int t = 255 - u;    // value - a
+
+				int d8 = INT_MAX, d6 = INT_MAX;
+				for (int k = 0; k < 8; k++) d8 = min(d8, abs(t - (k * d) / 7));
+				for (int k = 0; k < 6; k++) d6 = min(d6, abs(t - (k * d) / 5));
+
+				tables->error8[d][u] = clampedError(d8);
+				tables->error6[d][u] = clampedError(d6);
+			}
+		}
+
+		return tables;
+	}
+
+	static const AlphaErrorTables & alphaErrorTables()
+	{
+		static const AlphaErrorTables * s_tables = createAlphaErrorTables();
+		return *s_tables;
+	}
+
+	// Add the errors of 8 consecutive pairs over the rows of the 16 texels, each capped to the error of the texel for the
+	// fixed palette entries, and return the index of the first pair whose error is less than bestError, or -1.
+	static int sumErrorRows(const int16 * const rows[16], const int16 cap[16], uint count, int * bestError)
+	{
+		int16 sums[8];
+
+#if NV_USE_SSE > 1
+		__m128i sum = _mm_setzero_si128();
+		for (uint i = 0; i < 16; i++)
+		{
+			__m128i e = _mm_min_epi16(_mm_loadu_si128((const __m128i *)rows[i]), _mm_set1_epi16(cap[i]));
+			sum = _mm_adds_epi16(sum, e);
+		}
+
+		if (_mm_movemask_epi8(_mm_cmplt_epi16(sum, _mm_set1_epi16(int16(*bestError)))) == 0) return -1;
+
+		_mm_storeu_si128((__m128i *)sums, sum);
+#else
+		for (uint p = 0; p < 8; p++)
+		{
+			int s = 0;
+			for (uint i = 0; i < 16; i++) s = min(s + min(rows[i][p], cap[i]), 32767);
+			sums[p] = int16(s);
+		}
+#endif
+
+		int best = -1;
+		for (uint p = 0; p < count; p++)
+		{
+			if (sums[p] < *bestError)
+			{
+				*bestError = sums[p];
+				best = p;
+			}
+		}
+		return best;
+	}
+
+	// Search all the four color blocks for the green channel of rgba.
+	static void compressGreenExhaustive(const ColorBlock & rgba, BlockDXT1 * block)
+	{
+		const GreenErrorTable & table = greenErrorTable();
+
+		const int16 * rows[16];
+		int16 cap[16];
+		for (uint i = 0; i < 16; i++)
+		{
+			rows[i] = table.error[rgba.color(i).g];
+			cap[i] = 32767;
+		}
+
+		int bestError = 32767;
+		uint bestPair = 0;
+
+		for (uint p = 0; p < GreenPairCount; p += 8)
+		{
+			int best = sumErrorRows(rows, cap, 8, &bestError);
+			if (best >= 0) bestPair = p + best;
+
+			for (uint i = 0; i < 16; i++) rows[i] += 8;
+		}
+
+		block->col0.r = 31;
+		block->col1.r = 31;
+		block->col0.g = table.g0[bestPair];
+		block->col1.g = table.g1[bestPair];
+		block->col0.b = 0;
+		block->col1.b = 0;
+
+		nvDebugCheck(computeGreenError(rgba, block) == bestError);
+	}
+
+	// Search the pairs of alpha0 in [min0, max0] and alpha1 in [min1, max1] with the given palette, where the lowest endpoint
+	// is a and the other one is a + d. For the 6 step palette, cap holds the error of the 0 and 255 entries.
+	static void searchAlphaPairs(const int16 (*errors)[AlphaErrorRowSize], bool eightStep, const AlphaBlock4x4 & src, const int16 cap[16],
+		int minLow, int maxLow, int minHigh, int maxHigh, int * bestError, int * besta0, int * besta1)
+	{
+		const int16 * rows[16];
+
+		for (int d = max(eightStep ? 1 : 0, minHigh - maxLow); d <= maxHigh - minLow; d++)
+		{
+			const int begin = max(minLow, minHigh - d);
+			const int end = min(maxLow, maxHigh - d);
+
+			for (uint i = 0; i < 16; i++) rows[i] = errors[d] + (begin - src.alpha[i] + 255);
+
+			for (int a = begin; a <= end; a += 8)
+			{
+				int best = sumErrorRows(rows, cap, min(end - a + 1, 8), bestError);
+				if (best >= 0)
+				{
+					*besta0 = eightStep ? a + best + d : a + best;
+					*besta1 = eightStep ? a + best : a + best + d;
+				}
+
+				for (uint i = 0; i < 16; i++) rows[i] += 8;
+			}
+		}
+	}
+
+	static int computeAlphaPairError(const int16 (*errors)[AlphaErrorRowSize], const AlphaBlock4x4 & src, const int16 cap[16], int low, int high)
+	{
+		int error = 0;
+		for (uint i = 0; i < 16; i++)
+		{
+			error += min(errors[high - low][low - src.alpha[i] + 255], cap[i]);
+		}
+		return error;
+	}
+
 } // namespace
 
 
@@ -251,14 +578,16 @@ namespace
 
 // Single color compressor, based on:
 // https://mollyrocket.com/forums/viewtopic.php?t=392
-void OptimalCompress::compressDXT1(Color32 c, BlockDXT1 * dxtBlock)
+void OptimalCompress::compressDXT1(Color32 c, BlockDXT1 * dxtBlock, BlockDecoder decoder/*= BlockDecoder_D3D10*/)
 {
-    dxtBlock->col0.r = OMatch5[c.r][0];
-    dxtBlock->col0.g = OMatch6[c.g][0];
-    dxtBlock->col0.b = OMatch5[c.b][0];
-    dxtBlock->col1.r = OMatch5[c.r][1];
-    dxtBlock->col1.g = OMatch6[c.g][1];
-    dxtBlock->col1.b = OMatch5[c.b][1];
+    const SingleColorLookup & lookup = SingleColorTables[decoder];
+
+    dxtBlock->col0.r = lookup.match5[c.r][0];
+    dxtBlock->col0.g = lookup.match6[c.g][0];
+    dxtBlock->col0.b = lookup.match5[c.b][0];
+    dxtBlock->col1.r = lookup.match5[c.r][1];
+    dxtBlock->col1.g = lookup.match6[c.g][1];
+    dxtBlock->col1.b = lookup.match5[c.b][1];
     dxtBlock->indices = 0xaaaaaaaa;
     
     if (dxtBlock->col0.u < dxtBlock->col1.u)
@@ -268,18 +597,20 @@ void OptimalCompress::compressDXT1(Color32 c, BlockDXT1 * dxtBlock)
     }
 }
 
-void OptimalCompress::compressDXT1a(Color32 c, uint alphaMask, BlockDXT1 * dxtBlock)
+void OptimalCompress::compressDXT1a(Color32 c, uint alphaMask, BlockDXT1 * dxtBlock, BlockDecoder decoder/*= BlockDecoder_D3D10*/)
 {
     if (alphaMask == 0) {
-        compressDXT1(c, dxtBlock);
+        compressDXT1(c, dxtBlock, decoder);
     }
     else {
-        dxtBlock->col0.r = OMatchAlpha5[c.r][0];
-        dxtBlock->col0.g = OMatchAlpha6[c.g][0];
-        dxtBlock->col0.b = OMatchAlpha5[c.b][0];
-        dxtBlock->col1.r = OMatchAlpha5[c.r][1];
-        dxtBlock->col1.g = OMatchAlpha6[c.g][1];
-        dxtBlock->col1.b = OMatchAlpha5[c.b][1];
+        const SingleColorLookup & lookup = SingleColorTables[decoder];
+
+        dxtBlock->col0.r = lookup.matchAlpha5[c.r][0];
+        dxtBlock->col0.g = lookup.matchAlpha6[c.g][0];
+        dxtBlock->col0.b = lookup.matchAlpha5[c.b][0];
+        dxtBlock->col1.r = lookup.matchAlpha5[c.r][1];
+        dxtBlock->col1.g = lookup.matchAlpha6[c.g][1];
+        dxtBlock->col1.b = lookup.matchAlpha5[c.b][1];
         dxtBlock->indices = 0xaaaaaaaa; // 0b1010..1010
 
         if (dxtBlock->col0.u > dxtBlock->col1.u)
@@ -291,13 +622,15 @@ void OptimalCompress::compressDXT1a(Color32 c, uint alphaMask, BlockDXT1 * dxtBl
     }
 }
 
-void OptimalCompress::compressDXT1G(uint8 g, BlockDXT1 * dxtBlock)
+void OptimalCompress::compressDXT1G(uint8 g, BlockDXT1 * dxtBlock, BlockDecoder decoder/*= BlockDecoder_D3D10*/)
 {
+	const SingleColorLookup & lookup = SingleColorTables[decoder];
+
 	dxtBlock->col0.r = 31;
-	dxtBlock->col0.g = OMatch6[g][0];
+	dxtBlock->col0.g = lookup.match6[g][0];
 	dxtBlock->col0.b = 0;
 	dxtBlock->col1.r = 31;
-	dxtBlock->col1.g = OMatch6[g][1];
+	dxtBlock->col1.g = lookup.match6[g][1];
 	dxtBlock->col1.b = 0;
 	dxtBlock->indices = 0xaaaaaaaa;
 
@@ -309,71 +642,20 @@ void OptimalCompress::compressDXT1G(uint8 g, BlockDXT1 * dxtBlock)
 }
 
 
-// Brute force green channel compressor
+// Exhaustive green channel compressor, tries all the four color blocks.
 void OptimalCompress::compressDXT1G(const ColorBlock & rgba, BlockDXT1 * block)
 {
 	nvDebugCheck(block != NULL);
-	
-	uint8 ming = 63;
-	uint8 maxg = 0;
-	
-	bool isSingleColor = true;
-	uint8 singleColor = rgba.color(0).g;
 
-	// Get min/max green.
-	for (uint i = 0; i < 16; i++)
+	if (rgba.isSingleColor(Color32(0, 0xFF, 0, 0)))
 	{
-		uint8 green = (rgba.color(i).g + 1) >> 2;
-		ming = min(ming, green);
-		maxg = max(maxg, green);
-
-		if (rgba.color(i).g != singleColor) isSingleColor = false;
-	}
-
-	if (isSingleColor)
-	{
-		compressDXT1G(singleColor, block);
+		compressDXT1G(rgba.color(0).g, block);
 		return;
 	}
 
-	block->col0.r = 31;
-	block->col1.r = 31;
-	block->col0.g = maxg;
-	block->col1.g = ming;
-	block->col0.b = 0;
-	block->col1.b = 0;
-
-	int bestError = computeGreenError(rgba, block);
-	int bestg0 = maxg;
-	int bestg1 = ming;
-
-	// Expand search space a bit.
-	const int greenExpand = 4;
-	ming = (ming <= greenExpand) ? 0 : ming - greenExpand;
-	maxg = (maxg >= 63-greenExpand) ? 63 : maxg + greenExpand;
-
-	for (int g0 = ming+1; g0 <= maxg; g0++)
-	{
-		for (int g1 = ming; g1 < g0; g1++)
-		{
-			block->col0.g = g0;
-			block->col1.g = g1;
-			int error = computeGreenError(rgba, block, bestError);
-			
-			if (error < bestError)
-			{
-				bestError = error;
-				bestg0 = g0;
-				bestg1 = g1;
-			}
-		}
-	}
-	
-	block->col0.g = bestg0;
-	block->col1.g = bestg1;
-
-	nvDebugCheck(bestg0 == bestg1 || block->isFourColorMode());
+	compressGreenExhaustive(rgba, block);
 
+	nvDebugCheck(block->isFourColorMode());
 
 	Color32 palette[4];
 	block->evaluatePalette(palette, false); // @@ Use target decoder.
@@ -381,104 +663,21 @@ void OptimalCompress::compressDXT1G(const ColorBlock & rgba, BlockDXT1 * block)
 }
 
 
-/*void OptimalCompress::initLumaTables() {
-
-    // For all possible color pairs:
-    for (int c0 = 0; c0 < 65536; c0++) {
-        for (int c1 = 0; c1 < 65536; c1++) {
-            
-            // Compute 
-
-        }
-    }
-
-
-    for (int r = 0; r < 1<<5; r++) {
-        for (int g = 0; g < 1<<6; g++) {
-            for (int b = 0; b < 1<<5; b++) {
-
-
-            }
-        }
-    }
-}*/
-
-
-// Brute force Luma compressor
+// Encodes the luma of the texels in the green channel, like compressDXT1G.
 void OptimalCompress::compressDXT1_Luma(const ColorBlock & rgba, BlockDXT1 * block)
 {
 	nvDebugCheck(block != NULL);
-	
-    // F_YR = 19595/65536.0f, F_YG = 38470/65536.0f, F_YB = 7471/65536.0f;
-    // 195841
-    //if (
 
-
-    /*
-	uint8 ming = 63;
-	uint8 maxg = 0;
-	
-	bool isSingleColor = true;
-	uint8 singleColor = rgba.color(0).g;
-
-	// Get min/max green.
+	// F_YR = 19595/65536.0f, F_YG = 38470/65536.0f, F_YB = 7471/65536.0f
+	ColorBlock luma;
 	for (uint i = 0; i < 16; i++)
 	{
-		uint8 green = (rgba.color(i).g + 1) >> 2;
-		ming = min(ming, green);
-		maxg = max(maxg, green);
-
-		if (rgba.color(i).g != singleColor) isSingleColor = false;
-	}
-
-	if (isSingleColor)
-	{
-		compressDXT1G(singleColor, block);
-		return;
-	}
-
-	block->col0.r = 31;
-	block->col1.r = 31;
-	block->col0.g = maxg;
-	block->col1.g = ming;
-	block->col0.b = 0;
-	block->col1.b = 0;
-
-	int bestError = computeGreenError(rgba, block);
-	int bestg0 = maxg;
-	int bestg1 = ming;
-
-	// Expand search space a bit.
-	const int greenExpand = 4;
-	ming = (ming <= greenExpand) ? 0 : ming - greenExpand;
-	maxg = (maxg >= 63-greenExpand) ? 63 : maxg + greenExpand;
-
-	for (int g0 = ming+1; g0 <= maxg; g0++)
-	{
-		for (int g1 = ming; g1 < g0; g1++)
-		{
-			block->col0.g = g0;
-			block->col1.g = g1;
-			int error = computeGreenError(rgba, block, bestError);
-			
-			if (error < bestError)
-			{
-				bestError = error;
-				bestg0 = g0;
-				bestg1 = g1;
-			}
-		}
+		const Color32 c = rgba.color(i);
+		const uint8 y = uint8((19595 * c.r + 38470 * c.g + 7471 * c.b + 32768) >> 16);
+		luma.color(i) = Color32(y, y, y, 0xFF);
 	}
-	
-	block->col0.g = bestg0;
-	block->col1.g = bestg1;
-
-	nvDebugCheck(bestg0 == bestg1 || block->isFourColorMode());
-    */
 
-	Color32 palette[4];
-	block->evaluatePalette(palette, false); // @@ Use target decoder.
-	block->indices = computeGreenIndices(rgba, palette);
+	compressDXT1G(luma, block);
 }
 
 
@@ -614,6 +813,156 @@ void OptimalCompress::compressDXT5A(const ColorBlock & src, AlphaBlockDXT5 * dst
     compressDXT5A(tmp, dst);
 }
 
+void OptimalCompress::compressDXT5A_Uniform(const AlphaBlock4x4 & src, AlphaBlockDXT5 * dst)
+{
+	int mina = 255;
+	int maxa = 0;
+
+	int mina_no01 = 255;
+	int maxa_no01 = 0;
+
+	// Get min/max alpha.
+	for (uint i = 0; i < 16; i++)
+	{
+		const int alpha = src.alpha[i];
+		mina = min(mina, alpha);
+		maxa = max(maxa, alpha);
+
+		if (alpha != 0 && alpha != 255) {
+			mina_no01 = min(mina_no01, alpha);
+			maxa_no01 = max(maxa_no01, alpha);
+		}
+	}
+
+	// Blocks that the palettes represent exactly are handled like in compressDXT5A.
+	if (maxa - mina < 8) {
+		dst->alpha0 = maxa;
+		dst->alpha1 = mina;
+	}
+	else if (maxa_no01 - mina_no01 < 6) {
+		dst->alpha0 = mina_no01;
+		dst->alpha1 = maxa_no01;
+	}
+	else {
+		const AlphaErrorTables & tables = alphaErrorTables();
+
+		int16 noCap[16];
+		int16 cap[16];     // Error of the 0 and 255 entries of the 6 step palette.
+		for (uint i = 0; i < 16; i++)
+		{
+			noCap[i] = 32767;
+			cap[i] = clampedError(min(int(src.alpha[i]), 255 - src.alpha[i]));
+		}
+
+		// Start with the endpoints at the ends of the range.
+		int besterror = computeAlphaPairError(tables.error8, src, noCap, mina, maxa);
+		int besta0 = maxa;
+		int besta1 = mina;
+
+		const int error6 = computeAlphaPairError(tables.error6, src, cap, mina_no01, maxa_no01);
+		if (error6 < besterror)
+		{
+			besterror = error6;
+			besta0 = mina_no01;
+			besta1 = maxa_no01;
+		}
+
+		// Moving an endpoint more than r inside the range of values adds more than besterror to the texels at the ends.
+		// Outside of the range the search is expanded by a fixed amount, 3 times more than in compressDXT5A.
+		const int r = int(sqrtf(float(besterror)));
+		const int alphaExpand = 24;
+
+		searchAlphaPairs(tables.error8, /*eightStep=*/true, src, noCap,
+			max(mina - alphaExpand, 0), min(mina + r, 255), max(maxa - r, 0), min(maxa + alphaExpand, 255), &besterror, &besta0, &besta1);
+
+		// In the 6 step palette that only holds for the texels that are far from 0 and 255.
+		const int lowCap = min(mina_no01, 255 - mina_no01);
+		const int highCap = min(maxa_no01, 255 - maxa_no01);
+		const int maxLow = (lowCap * lowCap > besterror) ? mina_no01 + r : maxa_no01 + alphaExpand;
+		const int minHigh = (highCap * highCap > besterror) ? maxa_no01 - r : mina_no01 - alphaExpand;
+
+		searchAlphaPairs(tables.error6, /*eightStep=*/false, src, cap,
+			max(mina_no01 - alphaExpand, 0), min(maxLow, 255), max(minHigh, 0), min(maxa_no01 + alphaExpand, 255), &besterror, &besta0, &besta1);
+
+		dst->alpha0 = besta0;
+		dst->alpha1 = besta1;
+	}
+
+	computeAlphaIndices(src, dst);
+}
+
+void OptimalCompress::compressDXT5A_Bounded(const AlphaBlock4x4 & src, AlphaBlockDXT5 * dst, int iterationCount/*=16*/)
+{
+	uint8 mina = 255;
+	uint8 maxa = 0;
+
+	uint8 mina_no01 = 255;
+	uint8 maxa_no01 = 0;
+
+	// Get min/max alpha.
+	for (uint i = 0; i < 16; i++)
+	{
+		uint8 alpha = src.alpha[i];
+		mina = min(mina, alpha);
+		maxa = max(maxa, alpha);
+
+        if (alpha != 0 && alpha != 255) {
+    	    mina_no01 = min(mina_no01, alpha);
+	        maxa_no01 = max(maxa_no01, alpha);
+        }
+	}
+
+    // Blocks that the palettes represent exactly are handled like in compressDXT5A.
+    if (maxa - mina < 8) {
+	    dst->alpha0 = maxa;
+	    dst->alpha1 = mina;
+    }
+    else if (maxa_no01 - mina_no01 < 6) {
+	    dst->alpha0 = mina_no01;
+	    dst->alpha1 = maxa_no01;
+    }
+    else {
+        AlphaSearchBlock block;
+        initAlphaSearchBlock(src, &block);
+
+        // Refine the least squares fit of the 8 step palette.
+        QuickCompress::compressDXT5A(src, dst);
+        int besta0 = dst->alpha0;
+        int besta1 = dst->alpha1;
+        float besterror = refineAlphaEndpoints(block, &besta0, &besta1, iterationCount);
+
+        // And of the full range, which often ends in a different local minimum.
+        {
+            int a0 = maxa;
+            int a1 = mina;
+            float error = refineAlphaEndpoints(block, &a0, &a1, iterationCount);
+
+            if (error < besterror) {
+                besterror = error;
+                besta0 = a0;
+                besta1 = a1;
+            }
+        }
+
+        // And the range of the 6 step palette, when there are texels that its 0 and 255 entries represent.
+        if (mina_no01 < maxa_no01 && (mina == 0 || maxa == 255)) {
+            int a0 = mina_no01;
+            int a1 = maxa_no01;
+            float error = refineAlphaEndpoints(block, &a0, &a1, iterationCount);
+
+            if (error < besterror) {
+                besta0 = a0;
+                besta1 = a1;
+            }
+        }
+
+        dst->alpha0 = besta0;
+        dst->alpha1 = besta1;
+    }
+
+    computeAlphaIndices(src, dst);
+}
+
 
 #include "nvmath/Vector.inl"
 #include "nvmath/ftoi.h"
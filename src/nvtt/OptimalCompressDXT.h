@@ -27,6 +27,8 @@
 
 //#include "nvimage/nvimage.h"
 
+#include "nvimage/BlockDXT.h" // BlockDecoder
+
 #include "nvmath/Color.h"
 
 namespace nv
@@ -42,14 +44,21 @@ namespace nv
 
 	namespace OptimalCompress
 	{
-        // Single color compressors:
-		void compressDXT1(Color32 rgba, BlockDXT1 * dxtBlock);
-		void compressDXT1a(Color32 rgba, uint alphaMask, BlockDXT1 * dxtBlock);
-		void compressDXT1G(uint8 g, BlockDXT1 * dxtBlock);
+        // Single color compressors, for the palette of the given decoder:
+		void compressDXT1(Color32 rgba, BlockDXT1 * dxtBlock, BlockDecoder decoder = BlockDecoder_D3D10);
+		void compressDXT1a(Color32 rgba, uint alphaMask, BlockDXT1 * dxtBlock, BlockDecoder decoder = BlockDecoder_D3D10);
+		void compressDXT1G(uint8 g, BlockDXT1 * dxtBlock, BlockDecoder decoder = BlockDecoder_D3D10);
 		
         void compressDXT3A(const AlphaBlock4x4 & src, AlphaBlockDXT3 * dst);
         void compressDXT5A(const AlphaBlock4x4 & src, AlphaBlockDXT5 * dst);
 
+        // Exhaustive search with tables of precomputed errors, for blocks whose texels have the same weight. It searches more
+        // endpoints than compressDXT5A at a fraction of the cost.
+        void compressDXT5A_Uniform(const AlphaBlock4x4 & src, AlphaBlockDXT5 * dst);
+
+        // Local search around the least squares fit, close to compressDXT5A at a fraction of the cost.
+        void compressDXT5A_Bounded(const AlphaBlock4x4 & src, AlphaBlockDXT5 * dst, int iterationCount=16);
+
 		void compressDXT1G(const ColorBlock & src, BlockDXT1 * dst);
 		void compressDXT3A(const ColorBlock & src, AlphaBlockDXT3 * dst);
 		void compressDXT5A(const ColorBlock & src, AlphaBlockDXT5 * dst);
@@ -0,0 +1,491 @@
+#include "OutputCache.h"
+
+#include "nvthread/Mutex.h"
+
+#include "nvcore/FileSystem.h"
+#include "nvcore/Array.inl"
+#include "nvcore/Debug.h"
+
+#include <stdio.h> // rename
+#include <stdlib.h> // qsort
+#include <string.h> // memcpy
+
+using namespace nv;
+using namespace nvtt;
+
+
+namespace
+{
+    // Streaming version of MurmurHash3 x64_128.
+    struct Hasher
+    {
+        Hasher() : h1(0), h2(0), length(0), tailSize(0) {}
+
+        template <typename T>
+        void add(const T & value)
+        {
+            add(&value, sizeof(T));
+        }
+
+        void add(const void * data, size_t size)
+        {
+            const uint8 * ptr = (const uint8 *)data;
+            length += size;
+
+            if (tailSize > 0) {
+                const size_t count = min(size, size_t(16 - tailSize));
+                memcpy(tail + tailSize, ptr, count);
+                tailSize += uint(count);
+                ptr += count;
+                size -= count;
+
+                if (tailSize < 16) return;
+                block(tail);
+                tailSize = 0;
+            }
+
+            for (; size >= 16; ptr += 16, size -= 16) {
+                block(ptr);
+            }
+
+            memcpy(tail, ptr, size);
+            tailSize = uint(size);
+        }
+
+        void finish(uint64 words[2])
+        {
+            uint64 k1 = 0, k2 = 0;
+            for (uint i = 0; i < tailSize; i++) {
+                if (i < 8) k1 |= uint64(tail[i]) << (8 * i);
+                else k2 |= uint64(tail[i]) << (8 * (i - 8));
+            }
+
+            if (tailSize > 8) {
+                k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+            }
+            if (tailSize > 0) {
+                k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+            }
+
+            h1 ^= length;
+            h2 ^= length;
+            h1 += h2;
+            h2 += h1;
+            h1 = fmix(h1);
+            h2 = fmix(h2);
+            h1 += h2;
+            h2 += h1;
+
+            words[0] = h1;
+            words[1] = h2;
+        }
+
+    private:
+
+        static const uint64 c1 = 0x87c37b91114253d5ULL;
+        static const uint64 c2 = 0x4cf5ad432745937fULL;
+
+        static uint64 rotl(uint64 x, int r)
+        {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        static uint64 fmix(uint64 k)
+        {
+            k ^= k >> 33;
+            k *= 0xff51afd7ed558ccdULL;
+            k ^= k >> 33;
+            k *= 0xc4ceb9fe1a85ec53ULL;
+            k ^= k >> 33;
+            return k;
+        }
+
+        void block(const uint8 * ptr)
+        {
+            uint64 k1, k2;
+            memcpy(&k1, ptr, 8);
+            memcpy(&k2, ptr + 8, 8);
+
+            k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+            h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+            k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+            h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+        }
+
+        uint64 h1, h2;
+        uint64 length;
+        uint8 tail[16];
+        uint tailSize;
+    };
+
+    // Size of the image of the given mipmap, as allocated by InputOptions::setMipmapData, and of each of its rows.
+    uint inputImageSize(const InputOptions::Private & inputOptions, uint mipmap, uint * rowSize = NULL)
+    {
+        uint w = inputOptions.width, h = inputOptions.height, d = inputOptions.depth;
+        for (uint m = 0; m < mipmap; m++) {
+            w = max(1U, w / 2);
+            h = max(1U, h / 2);
+            d = max(1U, d / 2);
+        }
+
+        uint texelSize = 0;
+        switch (inputOptions.inputFormat) {
+            case InputFormat_BGRA_8UB: texelSize = 4 * sizeof(uint8); break;
+            case InputFormat_RGBA_16F: texelSize = 4 * sizeof(uint16); break;
+            case InputFormat_RGBA_32F: texelSize = 4 * sizeof(float); break;
+            case InputFormat_R_32F: texelSize = sizeof(float); break;
+        }
+
+        if (rowSize != NULL) *rowSize = w * texelSize;
+        return w * h * d * texelSize;
+    }
+
+    // Header of the cache files, followed by the record.
+    struct EntryHeader
+    {
+        enum { Magic = 0x434F564E, Version = 1 }; // 'NVOC'
+
+        uint32 magic;
+        uint32 version;
+        uint64 key[2];
+        uint64 recordSize;
+    };
+
+    // Operations in the records.
+    enum RecordOp
+    {
+        RecordOp_BeginImage,    // Followed by the six int32 arguments.
+        RecordOp_WriteData,     // Followed by the int32 size and the data.
+        RecordOp_EndImage,
+    };
+
+    void appendRecord(Array<uint8> & record, const void * data, uint size)
+    {
+        const uint offset = record.count();
+        record.resize(offset + size);
+        memcpy(record.buffer() + offset, data, size);
+    }
+
+    struct CacheFile
+    {
+        Path path;
+        uint64 size;
+        uint64 time;
+    };
+
+    void CollectCacheFile(const char * path, void * arg)
+    {
+        Array<CacheFile> * files = (Array<CacheFile> *)arg;
+
+        CacheFile file;
+        if (FileSystem::getFileInfo(path, &file.size, &file.time)) {
+            file.path = path;
+            files->append(file);
+        }
+    }
+
+    int CompareCacheFiles(const void * a, const void * b)
+    {
+        const CacheFile * fa = *(const CacheFile * const *)a;
+        const CacheFile * fb = *(const CacheFile * const *)b;
+        if (fa->time != fb->time) return fa->time < fb->time ? -1 : 1;
+        return strDiff(fa->path.str(), fb->path.str());
+    }
+}
+
+
+void OutputCacheKey::init(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, uint gpuSettings)
+{
+    Hasher hasher;
+    hasher.add(nvtt::version());
+    hasher.add(uint(EntryHeader::Version));
+    hasher.add(gpuSettings);
+
+    // Input options.
+    hasher.add(inputOptions.wrapMode);
+    hasher.add(inputOptions.textureType);
+    hasher.add(inputOptions.inputFormat);
+    hasher.add(inputOptions.alphaMode);
+    hasher.add(inputOptions.width);
+    hasher.add(inputOptions.height);
+    hasher.add(inputOptions.depth);
+    hasher.add(inputOptions.faceCount);
+    hasher.add(inputOptions.mipmapCount);
+    hasher.add(inputOptions.inputGamma);
+    hasher.add(inputOptions.outputGamma);
+    hasher.add(inputOptions.generateMipmaps);
+    hasher.add(inputOptions.maxLevel);
+    hasher.add(inputOptions.mipmapFilter);
+    hasher.add(inputOptions.kaiserWidth);
+    hasher.add(inputOptions.kaiserAlpha);
+    hasher.add(inputOptions.kaiserStretch);
+    hasher.add(inputOptions.keepAlphaCoverage);
+    hasher.add(inputOptions.alphaCoverageRef);
+    hasher.add(inputOptions.isNormalMap);
+    hasher.add(inputOptions.normalizeMipmaps);
+    hasher.add(inputOptions.convertToNormalMap);
+    hasher.add(inputOptions.heightFactors);
+    hasher.add(inputOptions.bumpFrequencyScale);
+    hasher.add(inputOptions.maxExtent);
+    hasher.add(inputOptions.roundMode);
+
+    for (uint i = 0; i < inputOptions.imageCount; i++) {
+        const bool present = (inputOptions.images[i] != NULL);
+        hasher.add(present);
+        if (present) {
+            uint rowSize;
+            const uint size = inputImageSize(inputOptions, i / inputOptions.faceCount, &rowSize);
+            const uint pitch = inputOptions.pitches[i];
+
+            if (pitch == 0 || pitch == rowSize) {
+                hasher.add(inputOptions.images[i], size);
+            }
+            else {
+                // Borrowed rows with padding, which is not part of the image.
+                const uint8 * row = (const uint8 *)inputOptions.images[i];
+                for (uint offset = 0; offset < size; offset += rowSize, row += pitch) {
+                    hasher.add(row, rowSize);
+                }
+            }
+        }
+    }
+
+    // Compression options.
+    hasher.add(compressionOptions.format);
+    hasher.add(compressionOptions.quality);
+    for (uint i = 0; i < 16; i++) {
+        hasher.add(compressionOptions.mipmapQuality[i]);
+    }
+    hasher.add(compressionOptions.effortLevel());
+    hasher.add(compressionOptions.errorThreshold);
+    hasher.add(compressionOptions.bc7ModeMask);
+    hasher.add(compressionOptions.rateDistortionLambda);
+    hasher.add(compressionOptions.colorWeight);
+    hasher.add(compressionOptions.bitcount);
+    hasher.add(compressionOptions.rmask);
+    hasher.add(compressionOptions.gmask);
+    hasher.add(compressionOptions.bmask);
+    hasher.add(compressionOptions.amask);
+    hasher.add(compressionOptions.rsize);
+    hasher.add(compressionOptions.gsize);
+    hasher.add(compressionOptions.bsize);
+    hasher.add(compressionOptions.asize);
+    hasher.add(compressionOptions.pixelType);
+    hasher.add(compressionOptions.pitchAlignment);
+    if (!compressionOptions.externalCompressor.isNull()) {
+        hasher.add(compressionOptions.externalCompressor.str(), compressionOptions.externalCompressor.length());
+    }
+    hasher.add(compressionOptions.enableColorDithering);
+    hasher.add(compressionOptions.enableAlphaDithering);
+    hasher.add(compressionOptions.binaryAlpha);
+    hasher.add(compressionOptions.alphaThreshold);
+    hasher.add(compressionOptions.decoder);
+    hasher.add(compressionOptions.rgbmRange);
+    hasher.add(compressionOptions.rgbmThreshold);
+    hasher.add(compressionOptions.normalTransform);
+
+    // Output options. The handlers, the streaming window and the block cache don't change the output.
+    hasher.add(outputOptions.outputHeader);
+    hasher.add(outputOptions.container);
+    hasher.add(outputOptions.version);
+    hasher.add(outputOptions.srgb);
+    hasher.add(outputOptions.supercompression);
+    hasher.add(outputOptions.supercompressionLevel);
+    hasher.add(outputOptions.tileMode);
+
+    hasher.finish(words);
+}
+
+
+void OutputCacheRecorder::beginImage(int size, int width, int height, int depth, int face, int miplevel)
+{
+    const uint8 op = RecordOp_BeginImage;
+    const int32 args[6] = { size, width, height, depth, face, miplevel };
+    appendRecord(record, &op, 1);
+    appendRecord(record, args, sizeof(args));
+
+    outputOptions.beginImage(size, width, height, depth, face, miplevel);
+}
+
+bool OutputCacheRecorder::writeData(const void * data, int size)
+{
+    const uint8 op = RecordOp_WriteData;
+    const int32 size32 = size;
+    appendRecord(record, &op, 1);
+    appendRecord(record, &size32, sizeof(size32));
+    appendRecord(record, data, size);
+
+    if (!outputOptions.writeData(data, size)) {
+        failed = true;
+        return false;
+    }
+    return true;
+}
+
+void OutputCacheRecorder::endImage()
+{
+    const uint8 op = RecordOp_EndImage;
+    appendRecord(record, &op, 1);
+
+    outputOptions.endImage();
+}
+
+void OutputCacheRecorder::error(Error e)
+{
+    failed = true;
+    outputOptions.error(e);
+}
+
+
+OutputCache::OutputCache(const char * directory, uint64 maxSize) : m_directory(directory), m_maxSize(maxSize)
+{
+    m_directory.appendSeparator();
+    m_mutex = new Mutex;
+
+    if (!FileSystem::exists(directory)) {
+        FileSystem::createDirectory(directory);
+    }
+}
+
+OutputCache::~OutputCache()
+{
+    delete m_mutex;
+}
+
+void OutputCache::entryPath(const OutputCacheKey & key, Path * path) const
+{
+    path->format("%s%016llx%016llx.nvc", m_directory.str(), (unsigned long long)key.words[0], (unsigned long long)key.words[1]);
+}
+
+bool OutputCache::replay(const OutputCacheKey & key, const OutputOptions::Private & outputOptions) const
+{
+    Path path;
+    entryPath(key, &path);
+
+    size_t size;
+    const uint8 * data = (const uint8 *)FileSystem::mapFile(path.str(), &size);
+    if (data == NULL) {
+        return false;
+    }
+
+    // Files that were cut short by a concurrent writer, or by a crash, are misses.
+    EntryHeader header;
+    bool valid = size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, data, sizeof(header));
+        valid = header.magic == EntryHeader::Magic && header.version == EntryHeader::Version &&
+            header.key[0] == key.words[0] && header.key[1] == key.words[1] && header.recordSize == size - sizeof(header);
+    }
+
+    if (valid) {
+        const uint8 * ptr = data + sizeof(header);
+        const uint8 * end = data + size;
+
+        while (ptr < end) {
+            const uint8 op = *ptr++;
+            if (op == RecordOp_BeginImage) {
+                int32 args[6];
+                memcpy(args, ptr, sizeof(args));
+                ptr += sizeof(args);
+                outputOptions.beginImage(args[0], args[1], args[2], args[3], args[4], args[5]);
+            }
+            else if (op == RecordOp_WriteData) {
+                int32 dataSize;
+                memcpy(&dataSize, ptr, sizeof(dataSize));
+                ptr += sizeof(dataSize);
+                outputOptions.writeData(ptr, dataSize);
+                ptr += dataSize;
+            }
+            else {
+                nvDebugCheck(op == RecordOp_EndImage);
+                outputOptions.endImage();
+            }
+        }
+
+        FileSystem::touchFile(path.str());
+    }
+
+    FileSystem::unmapFile(data, size);
+
+    return valid;
+}
+
+void OutputCache::store(const OutputCacheKey & key, const Array<uint8> & record)
+{
+    const uint64 fileSize = sizeof(EntryHeader) + record.count();
+    if (fileSize > m_maxSize) {
+        return;
+    }
+
+    Lock<Mutex> lock(*m_mutex);
+
+    Path path;
+    entryPath(key, &path);
+
+    // Write to a temporary file first, so that other processes never see a partial entry under the final name.
+    Path tempPath;
+    tempPath.format("%s.tmp", path.str());
+
+    EntryHeader header;
+    header.magic = EntryHeader::Magic;
+    header.version = EntryHeader::Version;
+    header.key[0] = key.words[0];
+    header.key[1] = key.words[1];
+    header.recordSize = record.count();
+
+    bool success;
+    {
+        StdOutputStream stream(tempPath.str());
+        success = !stream.isError();
+        if (success) {
+            stream.serialize(&header, sizeof(header));
+            stream.serializeBuffer(const_cast<uint8 *>(record.buffer()), record.count());
+            success = !stream.isError();
+        }
+    }
+
+    if (success) {
+        FileSystem::removeFile(path.str());
+        success = rename(tempPath.str(), path.str()) == 0;
+    }
+
+    if (!success) {
+        FileSystem::removeFile(tempPath.str());
+        return;
+    }
+
+    evict();
+}
+
+// Remove the least recently used files until the cache fits in the size limit.
+void OutputCache::evict()
+{
+    Path pattern;
+    pattern.format("%s*.nvc", m_directory.str());
+
+    Array<CacheFile> files;
+    FileSystem::findFiles(pattern.str(), CollectCacheFile, &files);
+
+    uint64 totalSize = 0;
+    for (uint i = 0; i < files.count(); i++) {
+        totalSize += files[i].size;
+    }
+
+    if (totalSize <= m_maxSize) {
+        return;
+    }
+
+    Array<const CacheFile *> order;
+    order.resize(files.count());
+    for (uint i = 0; i < files.count(); i++) {
+        order[i] = &files[i];
+    }
+    qsort(order.buffer(), order.count(), sizeof(const CacheFile *), CompareCacheFiles);
+
+    for (uint i = 0; i < order.count() && totalSize > m_maxSize; i++) {
+        if (FileSystem::removeFile(order[i]->path.str())) {
+            totalSize -= order[i]->size;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef NVTT_OUTPUTCACHE_H
+#define NVTT_OUTPUTCACHE_H
+
+#include "InputOptions.h"
+#include "CompressionOptions.h"
+#include "OutputOptions.h"
+
+#include "nvcore/Array.h"
+#include "nvcore/StrLib.h" // Path
+
+namespace nv
+{
+    class Mutex;
+}
+
+namespace nvtt
+{
+    // 128 bit hash of the input images and of all the settings that change the compressed output.
+    struct OutputCacheKey
+    {
+        void init(const InputOptions::Private & inputOptions, const CompressionOptions::Private & compressionOptions, const OutputOptions::Private & outputOptions, uint gpuSettings);
+
+        uint64 words[2];
+    };
+
+    // Output and error handler that forwards the calls to the given output options and records them, to store them in the cache.
+    struct OutputCacheRecorder : public OutputHandler, public ErrorHandler
+    {
+        OutputCacheRecorder(const OutputOptions::Private & outputOptions) : outputOptions(outputOptions), failed(false) {}
+
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel);
+        virtual bool writeData(const void * data, int size);
+        virtual void endImage();
+        virtual void error(Error e);
+
+        const OutputOptions::Private & outputOptions;
+        nv::Array<uint8> record;
+        bool failed;    // An error was reported, the output is not stored.
+    };
+
+    // Outputs of previous calls to Compressor::process, one file per output in a directory that persists across runs. Files
+    // are touched when they are used, and the least recently used ones are removed when the directory grows over the limit.
+    // Several processes can share the same directory.
+    class OutputCache
+    {
+        NV_FORBID_COPY(OutputCache);
+    public:
+        OutputCache(const char * directory, uint64 maxSize);
+        ~OutputCache();
+
+        // Replay the stored output calls to the output options. Returns false if there's no valid output for the key.
+        bool replay(const OutputCacheKey & key, const OutputOptions::Private & outputOptions) const;
+
+        void store(const OutputCacheKey & key, const nv::Array<uint8> & record);
+
+    private:
+        void entryPath(const OutputCacheKey & key, nv::Path * path) const;
+        void evict();
+
+        nv::Path m_directory;
+        uint64 m_maxSize;
+        nv::Mutex * m_mutex;    // Serializes the stores of this process.
+    };
+
+} // nvtt namespace
+
+
+#endif // NVTT_OUTPUTCACHE_H
@@ -23,12 +23,18 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include "OutputOptions.h"
+#include "BlockCache.h"
+#include "Profiler.h"
+#include "Progress.h"
+
+#include "nvthread/AsyncOutputStream.h"
 
 using namespace nvtt;
 
 
 OutputOptions::OutputOptions() : m(*new OutputOptions::Private())
 {
+    m.blockCache = NULL;
     reset();
 }
 
@@ -37,6 +43,8 @@ OutputOptions::~OutputOptions()
     // Cleanup output handler.
     setOutputHandler(NULL);
 
+    enableBlockCache(false);
+
     delete &m;
 }
 
@@ -48,12 +56,31 @@ void OutputOptions::reset()
 
     m.outputHandler = NULL;
     m.errorHandler = NULL;
+    m.positionalHandler = NULL;
 
     m.outputHeader = true;
     m.container = Container_DDS;
     m.version = 0;
     m.srgb = false;
+    m.streamingWindow = 0;
+    m.blockStatistics = NULL;
+    m.imageErrorHandler = NULL;
+    m.blockErrors = NULL;
+    m.blockErrorCount = 0;
+    enableBlockCache(false);
+    m.asyncOutput = false;
+    m.unbufferedOutput = false;
     m.deleteOutputHandler = false;
+    m.supercompression = Supercompression_None;
+    m.supercompressionLevel = 0;
+    m.tileMode = TileMode_Linear;
+
+    m.previousData = NULL;
+    m.previousBlocks = NULL;
+    m.dispatcher = NULL;
+
+    m.progressHandler = NULL;
+    m.progress = NULL;
 }
 
 
@@ -67,17 +94,8 @@ void OutputOptions::setFileName(const char * fileName)
 
     m.fileName = fileName;
     m.fileHandle = NULL;
-    m.outputHandler = NULL;
-    m.deleteOutputHandler = false;
-
-    DefaultOutputHandler * oh = new DefaultOutputHandler(fileName);
-    if (oh->stream.isError()) {
-        delete oh;
-    }
-    else {
-        m.deleteOutputHandler = true;
-        m.outputHandler = oh;
-    }
+    m.positionalHandler = NULL;
+    m.createDefaultOutputHandler();
 }
 
 /// Set output file handle.
@@ -89,17 +107,8 @@ void OutputOptions::setFileHandle(void * fp)
 
     m.fileName.reset();
     m.fileHandle = (FILE *)fp;
-    m.outputHandler = NULL;
-    m.deleteOutputHandler = false;
-
-    DefaultOutputHandler * oh = new DefaultOutputHandler(m.fileHandle);
-    if (oh->stream.isError()) {
-        delete oh;
-    }
-    else {
-        m.deleteOutputHandler = true;
-        m.outputHandler = oh;
-    }
+    m.positionalHandler = NULL;
+    m.createDefaultOutputHandler();
 }
 
 
@@ -113,9 +122,18 @@ void OutputOptions::setOutputHandler(OutputHandler * outputHandler)
     m.fileName.reset();
     m.fileHandle = NULL;
     m.outputHandler = outputHandler;
+    m.positionalHandler = NULL;
     m.deleteOutputHandler = false;
 }
 
+/// Set an output handler that receives the compressed images at their offsets, as soon as they are complete. Replaces the
+/// output file or handler, like setOutputHandler.
+void OutputOptions::setPositionalOutputHandler(PositionalOutputHandler * outputHandler)
+{
+    setOutputHandler(outputHandler);
+    m.positionalHandler = outputHandler;
+}
+
 /// Set error handler.
 void OutputOptions::setErrorHandler(ErrorHandler * errorHandler)
 {
@@ -146,6 +164,118 @@ void OutputOptions::setSrgbFlag(bool b)
     m.srgb = b;
 }
 
+/// Set the number of block rows that are compressed before they are written to the output handler.
+/// With 0, the default, each mipmap level is compressed in full and written at once.
+void OutputOptions::setStreamingWindow(int blockRows)
+{
+    m.streamingWindow = blockRows;
+}
+
+/// Set where to accumulate the block class counts of the block compressors. The counts are added to the existing values.
+void OutputOptions::setBlockStatistics(BlockStatistics * statistics)
+{
+    m.blockStatistics = statistics;
+}
+
+/// Set the handler that receives the error of each image. The CUDA compressors and the CPU compressors of BC1-BC7
+/// measure it, the other formats don't.
+void OutputOptions::setImageErrorHandler(ImageErrorHandler * handler)
+{
+    m.imageErrorHandler = handler;
+}
+
+/// Set where to store the RMS error of each block of the images compressed on the CPU to BC1-BC7, in the units of the
+/// image error handler. The errors of each image overwrite the ones of the previous image, in block order, and only
+/// the first count blocks are stored. Read them in OutputHandler::endImage.
+void OutputOptions::setBlockErrors(float * errors, int count)
+{
+    m.blockErrors = errors;
+    m.blockErrorCount = (errors != NULL && count > 0) ? count : 0;
+}
+
+/// Reuse the output of identical blocks, across all the images written to these output options.
+void OutputOptions::enableBlockCache(bool enable)
+{
+    if (enable) {
+        if (m.blockCache == NULL) m.blockCache = new nv::BlockCache;
+    }
+    else {
+        delete m.blockCache;
+        m.blockCache = NULL;
+    }
+}
+
+/// Write the output file from a background thread, through large buffers, so that compression doesn't wait for the disk. With
+/// unbuffered set the file is written past the system cache, where the file system allows it; this has no effect on file
+/// handles. Applies to the output file set before or after this call; call it before compressing.
+void OutputOptions::enableAsyncOutput(bool enable, bool unbuffered/*= false*/)
+{
+    m.asyncOutput = enable;
+    m.unbufferedOutput = enable && unbuffered;
+
+    if (m.deleteOutputHandler) {
+        delete m.outputHandler;
+        m.deleteOutputHandler = false;
+        m.outputHandler = NULL;
+        m.createDefaultOutputHandler();
+    }
+}
+
+/// Compress each surface losslessly once it's complete. The blocks of the BC1-5 formats are reordered to store their endpoints
+/// and their indices together, which compresses better, and large surfaces are compressed in parallel chunks. The scheme is
+/// recorded in the DDS header, readers of this library decode the surfaces transparently. KTX files can't be supercompressed.
+/// A level of 0 uses the default of the scheme.
+void OutputOptions::setSupercompression(Supercompression scheme, int level/*= 0*/)
+{
+    m.supercompression = scheme;
+    m.supercompressionLevel = level;
+}
+
+/// Write the blocks of each compressed surface in the order a GPU reads them, so that they can be uploaded without
+/// repacking. The 64KB standard swizzle has the extents of the D3D12 64KB tiles, 64x64 blocks of 16 bytes or 128x64
+/// blocks of 8 bytes, with the blocks of each 64x64 square in Morton order; the surfaces are padded to whole tiles. Only
+/// block compressed 2D surfaces can be tiled. The containers have no field for the mode, and estimateSize and the pitch of
+/// the header don't include the padding. Incremental compression is disabled when tiling.
+void OutputOptions::setTileMode(TileMode mode)
+{
+    m.tileMode = mode;
+}
+
+/// Set the handler that receives the progress of the compression and can cancel it. For Compressor::process the progress
+/// covers the whole texture, for the other calls the image being compressed. The compressors stop at their next block once
+/// the handler returns false, the compression then fails with Error_Cancelled.
+void OutputOptions::setProgressHandler(ProgressHandler * handler)
+{
+    m.progressHandler = handler;
+}
+
+void OutputOptions::Private::createDefaultOutputHandler()
+{
+    outputHandler = NULL;
+    deleteOutputHandler = false;
+
+    nv::Stream * stream;
+    if (!fileName.isNull()) {
+        if (asyncOutput) stream = new nv::AsyncOutputStream(fileName.str(), unbufferedOutput);
+        else stream = new nv::StdOutputStream(fileName.str());
+    }
+    else if (fileHandle != NULL) {
+        if (asyncOutput) stream = new nv::AsyncOutputStream(fileHandle, /*autoclose=*/false);
+        else stream = new nv::StdOutputStream(fileHandle, /*autoclose=*/false);
+    }
+    else {
+        return;
+    }
+
+    if (stream->isError()) {
+        delete stream;
+    }
+    else {
+        deleteOutputHandler = true;
+        outputHandler = new DefaultOutputHandler(stream);
+    }
+}
+
 bool OutputOptions::Private::hasValidOutputHandler() const
 {
     if (!fileName.isNull() || fileHandle != NULL)
@@ -163,9 +293,24 @@ void OutputOptions::Private::beginImage(int size, int width, int height, int dep
 
 bool OutputOptions::Private::writeData(const void * data, int size) const
 {
+    NVTT_PROFILE("write", size);
     return outputHandler == NULL || outputHandler->writeData(data, size);
 }
 
+bool OutputOptions::Private::writeDataAt(size_t offset, const void * data, int size) const
+{
+    NVTT_PROFILE("write", size);
+    return positionalHandler->writeDataAt(offset, data, size);
+}
+
+// The positional handler, unless the output has been redirected since it was set, or the images have to be output in order.
+PositionalOutputHandler * OutputOptions::Private::positionalOutput() const
+{
+    if (positionalHandler == NULL || positionalHandler != outputHandler) return NULL;
+    if (container == Container_KTX || supercompression != Supercompression_None || tileMode != TileMode_Linear) return NULL;
+    return positionalHandler;
+}
+
 void OutputOptions::Private::endImage() const
 {
     if (outputHandler != NULL) outputHandler->endImage();
@@ -175,3 +320,13 @@ void OutputOptions::Private::error(Error e) const
 {
     if (errorHandler != NULL) errorHandler->error(e);
 }
+
+void OutputOptions::Private::imageError(float rmsError, float psnr) const
+{
+    if (imageErrorHandler != NULL) imageErrorHandler->imageError(rmsError, psnr);
+}
+
+bool OutputOptions::Private::isCancelled() const
+{
+    return progress != NULL && progress->isCancelled();
+}
@@ -30,16 +30,19 @@
 #include "nvcore/StrLib.h" // Path
 #include "nvcore/StdStream.h"
 
+namespace nv { class BlockCache; }
+namespace nvtt { class Progress; }
+
 
 namespace nvtt
 {
 
 	struct DefaultOutputHandler : public nvtt::OutputHandler
 	{
-		DefaultOutputHandler(const char * fileName) : stream(fileName) {}
-        DefaultOutputHandler(FILE * fp) : stream(fp, false) {}
+		// Takes ownership of the stream.
+		DefaultOutputHandler(nv::Stream * s) : stream(s) {}
 		
-		virtual ~DefaultOutputHandler() {}
+		virtual ~DefaultOutputHandler() { delete stream; }
 		
 		virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel)
 		{
@@ -49,7 +52,7 @@ namespace nvtt
 		// Output data.
 		virtual bool writeData(const void * data, int size)
 		{
-			stream.serialize(const_cast<void *>(data), size);
+			stream->serialize(const_cast<void *>(data), size);
 
 			//return !stream.isError();
 			return true;
@@ -60,7 +63,7 @@ namespace nvtt
 			// ignore.
 		}
 
-		nv::StdOutputStream stream;
+		nv::Stream * stream;
 	};
 
 
@@ -71,21 +74,47 @@ namespace nvtt
 		
 		OutputHandler * outputHandler;
 		ErrorHandler * errorHandler;
+        PositionalOutputHandler * positionalHandler;    // Same object as outputHandler, or NULL.
 
 		bool outputHeader;
 		Container container;
         int version;
         bool srgb;
+        int streamingWindow;
+        BlockStatistics * blockStatistics;
+        ImageErrorHandler * imageErrorHandler;
+        float * blockErrors;
+        uint blockErrorCount;
+        nv::BlockCache * blockCache;
+        bool asyncOutput;
+        bool unbufferedOutput;
         bool deleteOutputHandler;
+        Supercompression supercompression;
+        int supercompressionLevel;
+        TileMode tileMode;
+
+        // Previous version of the image being compressed and its compressed blocks, only set for incremental compression.
+        const float * previousData;
+        const uint8 * previousBlocks;
+
+        ProgressHandler * progressHandler;
+        Progress * progress;    // Progress of the image or texture being compressed, shared by the copies of these options.
 
         void * wrapperProxy;    // For the C/C# wrapper.
+
+        TaskDispatcher * dispatcher;    // Replaces the dispatcher of the compressor when not NULL, set by Compressor::processAsync.
 		
 		bool hasValidOutputHandler() const;
+		void createDefaultOutputHandler();
 
 		void beginImage(int size, int width, int height, int depth, int face, int miplevel) const;
 		bool writeData(const void * data, int size) const;
+        bool writeDataAt(size_t offset, const void * data, int size) const;
+        PositionalOutputHandler * positionalOutput() const;
         void endImage() const;
 		void error(Error e) const;
+        void imageError(float rmsError, float psnr) const;
+        bool isCancelled() const;
 	};
 
 	
@@ -0,0 +1,128 @@
+#include "Profiler.h"
+
+#include "nvthread/nvthread.h"
+#include "nvthread/Mutex.h"
+
+#include "nvcore/Array.inl"
+#include "nvcore/StdStream.h" // fileOpen
+
+using namespace nvtt;
+
+Profiler * nvtt::s_profiler = NULL;
+
+void ProfileScope::end()
+{
+    const uint64 stop = nv::systemClock();
+    const double scale = 1000000.0 / double(nv::systemClockFrequency());
+
+    const size_t peak = nv::mem::endPeakTracking(tracker);
+    const uint threadId = nv::currentThreadId();
+
+    profiler->event(name, double(start) * scale, double(stop - start) * scale, threadId, count);
+    profiler->memory(name, double(stop) * scale, threadId, nv::mem::allocatedBytes(), peak);
+}
+
+void nvtt::setProfiler(Profiler * profiler)
+{
+    s_profiler = profiler;
+}
+
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char * name;
+        double begin;
+        double duration;
+        uint threadId;
+        int count;
+    };
+
+    struct MemoryEvent
+    {
+        double end;
+        size_t allocatedBytes;
+        size_t peakBytes;
+    };
+}
+
+struct TraceProfiler::Private
+{
+    mutable nv::Mutex mutex;
+    nv::Array<TraceEvent> events;
+    nv::Array<MemoryEvent> memoryEvents;
+};
+
+TraceProfiler::TraceProfiler() : m(*new TraceProfiler::Private())
+{
+}
+
+TraceProfiler::~TraceProfiler()
+{
+    delete &m;
+}
+
+void TraceProfiler::event(const char * name, double begin, double duration, unsigned int threadId, int count)
+{
+    TraceEvent e = { name, begin, duration, threadId, count };
+
+    nv::Lock<nv::Mutex> lock(m.mutex);
+    m.events.append(e);
+}
+
+void TraceProfiler::memory(const char * name, double end, unsigned int threadId, size_t allocatedBytes, size_t peakBytes)
+{
+    MemoryEvent e = { end, allocatedBytes, peakBytes };
+
+    nv::Lock<nv::Mutex> lock(m.mutex);
+    m.memoryEvents.append(e);
+}
+
+void TraceProfiler::clear()
+{
+    nv::Lock<nv::Mutex> lock(m.mutex);
+    m.events.clear();
+    m.memoryEvents.clear();
+}
+
+int TraceProfiler::eventCount() const
+{
+    nv::Lock<nv::Mutex> lock(m.mutex);
+    return int(m.events.count());
+}
+
+// Complete ("X") events, and a counter ("C") track of the memory, with the allocated bytes at the end of each event and
+// the peak while it ran. The times are relative to the first event so that the viewers start at 0.
+bool TraceProfiler::save(const char * fileName) const
+{
+    FILE * fp = nv::fileOpen(fileName, "wb");
+    if (fp == NULL) return false;
+
+    nv::Lock<nv::Mutex> lock(m.mutex);
+
+    double origin = 0.0;
+    for (uint i = 0; i < m.events.count(); i++) {
+        if (i == 0 || m.events[i].begin < origin) origin = m.events[i].begin;
+    }
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (uint i = 0; i < m.events.count(); i++)
+    {
+        const TraceEvent & e = m.events[i];
+        fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"count\":%d}}%s\n",
+            e.name, e.threadId, e.begin - origin, e.duration, e.count, i + 1 < m.events.count() || m.memoryEvents.count() != 0 ? "," : "");
+    }
+    for (uint i = 0; i < m.memoryEvents.count(); i++)
+    {
+        const MemoryEvent & e = m.memoryEvents[i];
+        fprintf(fp, "{\"name\":\"memory\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"allocated MB\":%.3f,\"event peak MB\":%.3f}}%s\n",
+            e.end - origin, e.allocatedBytes / 1048576.0, e.peakBytes / 1048576.0, i + 1 < m.memoryEvents.count() ? "," : "");
+    }
+    fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+
+    const bool success = (ferror(fp) == 0);
+    fclose(fp);
+
+    return success;
+}
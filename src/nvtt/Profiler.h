@@ -0,0 +1,46 @@
+#pragma once
+#ifndef NVTT_PROFILER_H
+#define NVTT_PROFILER_H
+
+#include "nvtt.h"
+#include "nvcore/Timer.h" // systemClock
+#include "nvcore/Memory.h" // beginPeakTracking
+
+namespace nvtt
+{
+    // The profiler given to setProfiler, NULL when the events are disabled.
+    extern Profiler * s_profiler;
+
+    // Reports the time between its construction and its destruction as an event of the profiler, if there's one, and
+    // the peak of the memory allocated in between. Costs a load and a branch when profiling is disabled.
+    class ProfileScope
+    {
+    public:
+        ProfileScope(const char * name, int count = 0) : profiler(s_profiler), name(name), count(count) {
+            if (profiler != NULL) {
+                tracker = nv::mem::beginPeakTracking();
+                start = nv::systemClock();
+            }
+        }
+        ~ProfileScope() {
+            if (profiler != NULL) end();
+        }
+
+        // For events whose count is only known at the end.
+        void setCount(int c) { count = c; }
+
+    private:
+        void end();
+
+        Profiler * profiler;
+        const char * name;
+        int count;
+        int tracker;
+        uint64 start;
+    };
+
+} // nvtt namespace
+
+#define NVTT_PROFILE(name, count) nvtt::ProfileScope NV_STRING_JOIN2(profileScope, __LINE__)(name, count)
+
+#endif // NVTT_PROFILER_H
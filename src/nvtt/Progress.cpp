@@ -0,0 +1,57 @@
+#include "Progress.h"
+
+#include "nvcore/Timer.h" // systemClock
+#include "nvcore/Utils.h" // min
+
+using namespace nvtt;
+
+Progress::Progress(ProgressHandler * handler, uint total) : parent(NULL), root(this), handler(handler), total(total), lastReport(0)
+{
+}
+
+Progress::Progress(Progress * parent, uint total) : parent(parent), root(parent != NULL ? parent->root : this), handler(NULL), total(total), lastReport(0)
+{
+}
+
+bool Progress::add(uint count)
+{
+    const uint d = done.fetchAddRelaxed(count) + count;
+
+    if (parent != NULL) {
+        return parent->add(count);
+    }
+
+    if (handler != NULL) {
+        report(d);
+    }
+
+    return !isCancelled();
+}
+
+void Progress::finish()
+{
+    const uint d = done.loadRelaxed();
+    if (d < total) add(total - d);
+}
+
+void Progress::report(uint d)
+{
+    // The threads that find the handler busy carry on with their work.
+    if (!mutex.tryLock()) return;
+
+    // Every few milliseconds, and once at the end.
+    const uint64 now = nv::systemClock();
+    const uint64 interval = nv::systemClockFrequency() / 200;
+
+    if (!isCancelled() && (d >= total || now - lastReport >= interval))
+    {
+        lastReport = now;
+
+        const float fraction = total > 0 ? nv::min(float(d) / float(total), 1.0f) : 1.0f;
+        if (!handler->progress(fraction)) {
+            cancelled.storeRelaxed(1);
+        }
+    }
+
+    mutex.unlock();
+}
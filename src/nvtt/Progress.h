@@ -0,0 +1,47 @@
+#pragma once
+#ifndef NVTT_PROGRESS_H
+#define NVTT_PROGRESS_H
+
+#include "nvtt.h"
+
+#include "nvthread/Atomic.h"
+#include "nvthread/Mutex.h"
+
+namespace nvtt
+{
+    // Work done by a job, in units like blocks or rows of texels, reported to the progress handler, which can cancel the job.
+    // The tasks of the job add their work from any thread and stop once the job is cancelled. A progress with a parent adds
+    // its work to the parent as well, so that each image of a texture can make up for the work its compressor didn't report.
+    class Progress
+    {
+        NV_FORBID_COPY(Progress);
+    public:
+        Progress(ProgressHandler * handler, uint total);
+        Progress(Progress * parent, uint total);
+
+        // Add count units of work. Returns false when the job has been cancelled.
+        bool add(uint count);
+
+        // Add the work that wasn't reported yet.
+        void finish();
+
+        bool isCancelled() const { return root->cancelled.loadRelaxed() != 0; }
+
+    private:
+        void report(uint done);
+
+        Progress * const parent;
+        Progress * const root;
+        ProgressHandler * const handler;
+        const uint total;
+
+        nv::Atomic<uint> done;
+        nv::Atomic<uint> cancelled;
+
+        nv::Mutex mutex;        // Held while the handler is called.
+        uint64 lastReport;
+    };
+
+} // nvtt namespace
+
+#endif // NVTT_PROGRESS_H
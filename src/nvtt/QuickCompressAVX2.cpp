@@ -0,0 +1,16 @@
+// This code is in the public domain -- castano@gmail.com
+
+// QuickCompress batch kernels for AVX2, 8 blocks at once. This file is compiled with ${NV_AVX2_FLAGS}.
+
+#include "nvmath/SimdVector_AVX.h"
+#include "QuickCompressBatch.inl"
+
+void nv::quickCompressBatch3_AVX2(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result)
+{
+    quickCompressBatch3<SimdVector8>(lanes, laneCount, result);
+}
+
+void nv::quickCompressBatch4_AVX2(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result)
+{
+    quickCompressBatch4<SimdVector8>(lanes, laneCount, result);
+}
@@ -0,0 +1,16 @@
+// This code is in the public domain -- castano@gmail.com
+
+// QuickCompress batch kernels for AVX-512, 16 blocks at once. This file is compiled with ${NV_AVX512_FLAGS}.
+
+#include "nvmath/SimdVector_AVX.h"
+#include "QuickCompressBatch.inl"
+
+void nv::quickCompressBatch3_AVX512(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result)
+{
+    quickCompressBatch3<SimdVector16>(lanes, laneCount, result);
+}
+
+void nv::quickCompressBatch4_AVX512(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result)
+{
+    quickCompressBatch4<SimdVector16>(lanes, laneCount, result);
+}
@@ -0,0 +1,359 @@
+// This code is in the public domain -- castano@gmail.com
+
+// Kernels of the batched QuickCompress range fit, one block per SIMD lane. Written against the SimdVector interface like
+// ClusterFitBatch.inl: QuickCompressDXT.cpp instantiates the SSE2 version, QuickCompressAVX2.cpp and QuickCompressAVX512.cpp
+// the wider ones, so this code must only call force inlined functions and templates in the anonymous namespace.
+//
+// Each step repeats the float operations of the scalar functions of QuickCompressDXT.cpp in the same order, so that the
+// blocks are identical to the ones QuickCompress::compressDXT1 and compressDXT1a output.
+
+#include "nvmath/SimdVector.h"
+
+namespace nv {
+
+    // Input of the kernels, one block per lane. Sized for the widest kernel.
+    struct QuickCompressLanes
+    {
+        enum { Count = 16 };
+
+        NV_ALIGN_64 float colors[3][16][Count];     // component, texel, lane. In [0, 255] range.
+        NV_ALIGN_64 float opaque[16][Count];        // 1 for the texels of the 3 color blocks that are fitted, 0 for the transparent ones.
+    };
+
+    // Output of the kernels.
+    struct QuickCompressSolution
+    {
+        NV_ALIGN_64 float col0[QuickCompressLanes::Count];          // 565 colors.
+        NV_ALIGN_64 float col1[QuickCompressLanes::Count];
+        NV_ALIGN_64 float indices[2][QuickCompressLanes::Count];    // Of the first and the last 8 texels.
+    };
+
+    // Entry points of the wider kernels.
+    void quickCompressBatch3_AVX2(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result);
+    void quickCompressBatch4_AVX2(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result);
+    void quickCompressBatch3_AVX512(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result);
+    void quickCompressBatch4_AVX512(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result);
+
+} // nv namespace
+
+namespace {
+
+    using namespace nv;
+
+    // Lane by lane versions of the functions of QuickCompressDXT.cpp, in their own namespace so that they don't take part
+    // in the overload resolution of the scalar ones.
+    namespace lanewise {
+
+    template <typename Vec>
+    NV_FORCEINLINE Vec absolute(const Vec & v)
+    {
+        return max(v, Vec(0.0f) - v);
+    }
+
+    template <typename Vec>
+    NV_FORCEINLINE void swapWhere(const Vec & mask, Vec & a, Vec & b)
+    {
+        const Vec t = a;
+        a = select(a, b, mask);
+        b = select(b, t, mask);
+    }
+
+    // opaque is NULL when every texel is fitted.
+    template <typename Vec>
+    NV_FORCEINLINE void findMinMaxColorsBox(const Vec block[16][3], const Vec * opaque, Vec maxColor[3], Vec minColor[3])
+    {
+        for (int c = 0; c < 3; c++) {
+            maxColor[c] = Vec(0.0f);
+            minColor[c] = Vec(255.0f);
+        }
+
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 3; c++) {
+                if (opaque != NULL) {
+                    maxColor[c] = select(maxColor[c], max(maxColor[c], block[i][c]), opaque[i]);
+                    minColor[c] = select(minColor[c], min(minColor[c], block[i][c]), opaque[i]);
+                }
+                else {
+                    maxColor[c] = max(maxColor[c], block[i][c]);
+                    minColor[c] = min(minColor[c], block[i][c]);
+                }
+            }
+        }
+    }
+
+    template <typename Vec>
+    NV_FORCEINLINE void selectDiagonal(const Vec block[16][3], const Vec * opaque, Vec maxColor[3], Vec minColor[3])
+    {
+        const Vec half(0.5f);
+        Vec center[3];
+        for (int c = 0; c < 3; c++) center[c] = (maxColor[c] + minColor[c]) * half;
+
+        Vec covariance[2] = { Vec(0.0f), Vec(0.0f) };
+        for (int i = 0; i < 16; i++) {
+            const Vec tz = block[i][2] - center[2];
+            for (int c = 0; c < 2; c++) {
+                const Vec sum = covariance[c] + (block[i][c] - center[c]) * tz;
+                covariance[c] = (opaque != NULL) ? select(covariance[c], sum, opaque[i]) : sum;
+            }
+        }
+
+        for (int c = 0; c < 2; c++) {
+            swapWhere(compareLessThan(covariance[c], Vec(0.0f)), maxColor[c], minColor[c]);
+        }
+    }
+
+    template <typename Vec>
+    NV_FORCEINLINE void insetBBox(Vec maxColor[3], Vec minColor[3])
+    {
+        for (int c = 0; c < 3; c++) {
+            const Vec inset = (maxColor[c] - minColor[c]) * Vec(1.0f / 16.0f) - Vec((8.0f / 255.0f) / 16.0f);
+            maxColor[c] = min(max(maxColor[c] - inset, Vec(0.0f)), Vec(255.0f));
+            minColor[c] = min(max(minColor[c] + inset, Vec(0.0f)), Vec(255.0f));
+        }
+    }
+
+    // Replicate the top bits of a 5 or 6 bit component, (q << 3) | (q >> 2) and (q << 2) | (q >> 4).
+    template <typename Vec>
+    NV_FORCEINLINE Vec expand(const Vec & q, int c)
+    {
+        static const float high[3] = { 8.0f, 4.0f, 8.0f };
+        static const float low[3] = { 1.0f / 4.0f, 1.0f / 16.0f, 1.0f / 4.0f };
+        return q * Vec(high[c]) + truncate(q * Vec(low[c]));
+    }
+
+    // Round the colors to the nearest 565 color, replace them with its expansion and return it.
+    template <typename Vec>
+    NV_FORCEINLINE Vec roundAndExpand(Vec color[3])
+    {
+        static const float grid[3] = { 31.0f, 63.0f, 31.0f };
+
+        Vec q[3];
+        for (int c = 0; c < 3; c++) {
+            const Vec g(grid[c]);
+            q[c] = truncate(min(max(color[c] * Vec(grid[c] / 255.0f), Vec(0.0f)), g));
+
+            const Vec q1 = q[c] + Vec(1.0f);
+            const Vec up = compareLessThan(absolute(color[c] - expand(q1, c)), absolute(color[c] - expand(q[c], c)));
+            q[c] = select(q[c], min(q1, g), up);
+
+            color[c] = expand(q[c], c);
+        }
+
+        return q[0] * Vec(2048.0f) + q[1] * Vec(32.0f) + q[2];
+    }
+
+    template <typename Vec>
+    NV_FORCEINLINE Vec colorDistance(const Vec palette[3], const Vec color[3])
+    {
+        const Vec d0 = palette[0] - color[0];
+        const Vec d1 = palette[1] - color[1];
+        const Vec d2 = palette[2] - color[2];
+        return d0 * d0 + d1 * d1 + d2 * d2;
+    }
+
+    template <typename Vec>
+    NV_FORCEINLINE void computeIndices4(const Vec block[16][3], const Vec maxColor[3], const Vec minColor[3], Vec indices[16])
+    {
+        const Vec t2(1.0f / 3.0f), s2(1.0f - 1.0f / 3.0f);
+        const Vec t3(2.0f / 3.0f), s3(1.0f - 2.0f / 3.0f);
+
+        Vec palette[4][3];
+        for (int c = 0; c < 3; c++) {
+            palette[0][c] = maxColor[c];
+            palette[1][c] = minColor[c];
+            palette[2][c] = maxColor[c] * s2 + t2 * minColor[c];
+            palette[3][c] = maxColor[c] * s3 + t3 * minColor[c];
+        }
+
+        const Vec one(1.0f), two(2.0f);
+
+        for (int i = 0; i < 16; i++) {
+            const Vec d0 = colorDistance(palette[0], block[i]);
+            const Vec d1 = colorDistance(palette[1], block[i]);
+            const Vec d2 = colorDistance(palette[2], block[i]);
+            const Vec d3 = colorDistance(palette[3], block[i]);
+
+            const Vec b0 = compareLessThan(d3, d0);
+            const Vec b1 = compareLessThan(d2, d1);
+            const Vec b2 = compareLessThan(d2, d0);
+            const Vec b3 = compareLessThan(d3, d1);
+            const Vec b4 = compareLessThan(d3, d2);
+
+            const Vec x0 = b1 & b2;
+            const Vec x1 = b0 & b3;
+            const Vec x2 = b0 & b4;
+
+            indices[i] = (one & x2) + max(two & x0, two & x1);
+        }
+    }
+
+    template <typename Vec>
+    NV_FORCEINLINE void computeIndices3(const Vec block[16][3], const Vec opaque[16], const Vec maxColor[3], const Vec minColor[3], Vec indices[16])
+    {
+        const Vec half(0.5f);
+
+        Vec palette[3][3];
+        for (int c = 0; c < 3; c++) {
+            palette[0][c] = minColor[c];
+            palette[1][c] = maxColor[c];
+            palette[2][c] = (minColor[c] + maxColor[c]) * half;
+        }
+
+        for (int i = 0; i < 16; i++) {
+            const Vec d0 = colorDistance(palette[0], block[i]);
+            const Vec d1 = colorDistance(palette[1], block[i]);
+            const Vec d2 = colorDistance(palette[2], block[i]);
+
+            const Vec index = select(select(Vec(2.0f), Vec(1.0f), compareLessThan(d1, d2)), Vec(0.0f), compareLessThan(d0, d1) & compareLessThan(d0, d2));
+            indices[i] = select(Vec(3.0f), index, opaque[i]);
+        }
+    }
+
+    // Least squares fit of the endpoints to the indices, the lanes where the fit is degenerate keep their block.
+    template <typename Vec>
+    NV_FORCEINLINE void optimizeEndPoints4(const Vec block[16][3], Vec & color0, Vec & color1, Vec indices[16])
+    {
+        const Vec one(1.0f);
+
+        Vec alpha2_sum(0.0f);
+        Vec beta2_sum(0.0f);
+        Vec alphabeta_sum(0.0f);
+        Vec alphax_sum[3] = { Vec(0.0f), Vec(0.0f), Vec(0.0f) };
+        Vec betax_sum[3] = { Vec(0.0f), Vec(0.0f), Vec(0.0f) };
+
+        for (int i = 0; i < 16; i++) {
+            Vec beta = one & compareEqual(indices[i], one);
+            beta = select(beta, Vec(1.0f / 3.0f), compareEqual(indices[i], Vec(2.0f)));
+            beta = select(beta, Vec(2.0f / 3.0f), compareEqual(indices[i], Vec(3.0f)));
+            const Vec alpha = one - beta;
+
+            alpha2_sum += alpha * alpha;
+            beta2_sum += beta * beta;
+            alphabeta_sum += alpha * beta;
+            for (int c = 0; c < 3; c++) {
+                alphax_sum[c] += alpha * block[i][c];
+                betax_sum[c] += beta * block[i][c];
+            }
+        }
+
+        const Vec denom = alpha2_sum * beta2_sum - alphabeta_sum * alphabeta_sum;
+        const Vec valid = compareLessThan(Vec(NV_EPSILON), absolute(denom));
+        const Vec factor = one / denom;
+
+        Vec a[3], b[3];
+        for (int c = 0; c < 3; c++) {
+            a[c] = (alphax_sum[c] * beta2_sum - betax_sum[c] * alphabeta_sum) * factor;
+            b[c] = (betax_sum[c] * alpha2_sum - alphax_sum[c] * alphabeta_sum) * factor;
+            a[c] = min(max(a[c], Vec(0.0f)), Vec(255.0f));
+            b[c] = min(max(b[c], Vec(0.0f)), Vec(255.0f));
+        }
+
+        Vec c0 = roundAndExpand(a);
+        Vec c1 = roundAndExpand(b);
+
+        const Vec swap = compareLessThan(c0, c1);
+        swapWhere(swap, c0, c1);
+        for (int c = 0; c < 3; c++) swapWhere(swap, a[c], b[c]);
+
+        Vec fitted[16];
+        computeIndices4(block, a, b, fitted);
+
+        color0 = select(color0, c0, valid);
+        color1 = select(color1, c1, valid);
+        for (int i = 0; i < 16; i++) indices[i] = select(indices[i], fitted[i], valid);
+    }
+
+    template <typename Vec>
+    NV_FORCEINLINE void storeSolution(const Vec & color0, const Vec & color1, const Vec indices[16], uint lane, QuickCompressSolution * result)
+    {
+        // 16 bits per half, exact in float.
+        const Vec four(4.0f);
+        Vec lo(0.0f), hi(0.0f);
+        for (int i = 7; i >= 0; i--) {
+            lo = lo * four + indices[i];
+            hi = hi * four + indices[i + 8];
+        }
+
+        color0.store(result->col0 + lane);
+        color1.store(result->col1 + lane);
+        lo.store(result->indices[0] + lane);
+        hi.store(result->indices[1] + lane);
+    }
+
+    template <typename Vec>
+    NV_FORCEINLINE void loadBlock(const QuickCompressLanes & lanes, uint lane, Vec block[16][3])
+    {
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 3; c++) block[i][c] = Vec(lanes.colors[c][i] + lane);
+        }
+    }
+
+    } // lanewise namespace
+
+    // Same as QuickCompress::compressDXT1 for blocks that are not a single color.
+    template <typename Vec>
+    void quickCompressBatch4(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result)
+    {
+        using namespace lanewise;
+
+        for (uint l = 0; l < laneCount; l += Vec::Width)
+        {
+            Vec block[16][3];
+            loadBlock(lanes, l, block);
+
+            Vec maxColor[3], minColor[3];
+            findMinMaxColorsBox<Vec>(block, NULL, maxColor, minColor);
+            selectDiagonal<Vec>(block, NULL, maxColor, minColor);
+            insetBBox(maxColor, minColor);
+
+            Vec color0 = roundAndExpand(maxColor);
+            Vec color1 = roundAndExpand(minColor);
+
+            const Vec swap = compareLessThan(color0, color1);
+            swapWhere(swap, color0, color1);
+            for (int c = 0; c < 3; c++) swapWhere(swap, maxColor[c], minColor[c]);
+
+            Vec indices[16];
+            computeIndices4(block, maxColor, minColor, indices);
+
+            optimizeEndPoints4(block, color0, color1, indices);
+
+            storeSolution(color0, color1, indices, l, result);
+        }
+    }
+
+    // Same as QuickCompress::compressDXT1a for blocks with transparent texels.
+    template <typename Vec>
+    void quickCompressBatch3(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result)
+    {
+        using namespace lanewise;
+
+        for (uint l = 0; l < laneCount; l += Vec::Width)
+        {
+            Vec block[16][3];
+            loadBlock(lanes, l, block);
+
+            Vec opaque[16];
+            for (int i = 0; i < 16; i++) opaque[i] = compareLessThan(Vec(0.5f), Vec(lanes.opaque[i] + l));
+
+            Vec maxColor[3], minColor[3];
+            findMinMaxColorsBox(block, opaque, maxColor, minColor);
+            selectDiagonal(block, opaque, maxColor, minColor);
+            insetBBox(maxColor, minColor);
+
+            Vec color0 = roundAndExpand(maxColor);
+            Vec color1 = roundAndExpand(minColor);
+
+            const Vec swap = compareLessThan(color0, color1);
+            swapWhere(swap, color0, color1);
+            for (int c = 0; c < 3; c++) swapWhere(swap, maxColor[c], minColor[c]);
+
+            Vec indices[16];
+            computeIndices3(block, opaque, maxColor, minColor, indices);
+
+            // The smaller color goes first to select the 3 color mode.
+            storeSolution(color1, color0, indices, l, result);
+        }
+    }
+
+} // namespace
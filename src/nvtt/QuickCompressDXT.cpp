@@ -31,9 +31,15 @@
 #include "nvmath/Color.inl"
 #include "nvmath/Vector.inl"
 #include "nvmath/Fitting.h"
+#include "nvmath/SimdVector.h"
 
 #include "nvcore/Utils.h" // swap
 
+#if NV_USE_SSE > 1
+#include "QuickCompressBatch.inl"
+#include "nvcore/CpuInfo.h"
+#endif
+
 #include <string.h> // memset
 #include <float.h> // FLT_MAX 
 
@@ -67,6 +73,19 @@ inline static uint extractColorBlockRGBA(const ColorBlock & rgba, Vector3 block[
 	return num;
 }
 
+// Blocks with transparent texels are compressed in 3 color mode.
+inline static bool hasTransparentTexels(const ColorBlock & rgba)
+{
+	for (uint i = 0; i < 16; i++)
+	{
+		if (rgba.color(i).a == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 
 // find minimum and maximum colors based on bounding box in color space
 inline static void findMinMaxColorsBox(const Vector3 * block, uint num, Vector3 * restrict maxColor, Vector3 * restrict minColor)
@@ -148,6 +167,12 @@ inline static uint16 roundAndExpand(Vector3 * restrict v)
 	return w;
 }
 
+// The color of a 565 endpoint in [0, 255] range, like the ones roundAndExpand returns.
+inline static Vector3 expandColor16(Color16 c)
+{
+	return Vector3(float((c.r << 3) | (c.r >> 2)), float((c.g << 2) | (c.g >> 4)), float((c.b << 3) | (c.b >> 2)));
+}
+
 // Takes a normalized color in [0, 255] range and returns 
 inline static uint16 roundAndExpand01(Vector3 * restrict v)
 {
@@ -374,6 +399,40 @@ inline static uint computeIndices3(const ColorSet & set, Vector3::Arg maxColor,
 	return indices;
 }
 
+// The transparent texels, those that extractColorBlockRGBA leaves out, get the transparent index.
+inline static uint computeIndices3(const ColorBlock & rgba, Vector3::Arg maxColor, Vector3::Arg minColor)
+{
+	Vector3 palette[4];
+	palette[0] = minColor;
+	palette[1] = maxColor;
+	palette[2] = (palette[0] + palette[1]) * 0.5f;
+	
+	uint indices = 0;
+	for(int i = 0; i < 16; i++)
+	{
+		const Color32 c = rgba.color(i);
+		if (c.a <= 127) {
+			indices |= 3 << (2 * i);
+			continue;
+		}
+
+		const Vector3 color(c.r, c.g, c.b);
+
+		float d0 = colorDistance(palette[0], color);
+		float d1 = colorDistance(palette[1], color);
+		float d2 = colorDistance(palette[2], color);
+		
+		uint index;
+		if (d0 < d1 && d0 < d2) index = 0;
+		else if (d1 < d2) index = 1;
+		else index = 2;
+		
+		indices |= index << (2 * i);
+	}
+
+	return indices;
+}
+
 inline static uint computeIndices3(const Vector3 block[16], Vector3::Arg maxColor, Vector3::Arg minColor)
 {
 	Vector3 palette[4];
@@ -645,6 +704,122 @@ namespace
 		return (block0.u | mask) == (block1.u | mask);
 	}
 
+	// Fit the alpha endpoints to the block, starting with the given ones, and keep the best of the iterations.
+	static void refineAlpha8(const AlphaBlock4x4 & src, AlphaBlockDXT5 block, AlphaBlockDXT5 * dst, int iterationCount)
+	{
+		uint besterror = computeAlphaIndices(src, &block);
+		
+		AlphaBlockDXT5 bestblock = block;
+
+		for (int i = 0; i < iterationCount; i++)
+		{
+			optimizeAlpha8(src, &block);
+			uint error = computeAlphaIndices(src, &block);
+			
+			if (error >= besterror)
+			{
+				// No improvement, stop.
+				break;
+			}
+			if (sameIndices(block, bestblock))
+			{
+				bestblock = block;
+				break;
+			}
+			
+			besterror = error;
+			bestblock = block;
+		};
+		
+		// Copy best block to result;
+		*dst = bestblock;
+	}
+
+	// Indices of the green channel of the texels in a four color block.
+	static uint computeGreenIndices(const ColorBlock & rgba, BlockDXT1 * block)
+	{
+		Color32 palette[4];
+		block->evaluatePalette(palette, false); // @@ Use target decoder.
+
+		uint totalError = 0;
+		uint indices = 0;
+
+		for (uint i = 0; i < 16; i++)
+		{
+			const int green = rgba.color(i).g;
+
+			uint besterror = 256*256;
+			uint best = 0;
+			for (uint p = 0; p < 4; p++)
+			{
+				int d = palette[p].g - green;
+				uint error = d * d;
+
+				if (error < besterror)
+				{
+					besterror = error;
+					best = p;
+				}
+			}
+
+			totalError += besterror;
+			indices |= best << (2 * i);
+		}
+
+		block->indices = indices;
+		return totalError;
+	}
+
+	// Least squares fit of the green endpoints to the indices, like optimizeEndPoints4 for a single channel.
+	static void optimizeGreen4(const ColorBlock & rgba, BlockDXT1 * block)
+	{
+		float alpha2_sum = 0;
+		float beta2_sum = 0;
+		float alphabeta_sum = 0;
+		float alphax_sum = 0;
+		float betax_sum = 0;
+
+		for (int i = 0; i < 16; i++)
+		{
+			const uint bits = block->indices >> (2 * i);
+
+			float beta = float(bits & 1);
+			if (bits & 2) beta = (1 + beta) / 3.0f;
+			float alpha = 1.0f - beta;
+
+			alpha2_sum += alpha * alpha;
+			beta2_sum += beta * beta;
+			alphabeta_sum += alpha * beta;
+			alphax_sum += alpha * rgba.color(i).g;
+			betax_sum += beta * rgba.color(i).g;
+		}
+
+		float denom = alpha2_sum * beta2_sum - alphabeta_sum * alphabeta_sum;
+		if (equal(denom, 0.0f)) return;
+
+		const float factor = 1.0f / denom;
+
+		float a = (alphax_sum * beta2_sum - betax_sum * alphabeta_sum) * factor;
+		float b = (betax_sum * alpha2_sum - alphax_sum * alphabeta_sum) * factor;
+
+		uint green0 = uint(clamp(a, 0.0f, 255.0f) * (63.0f / 255.0f) + 0.5f);
+		uint green1 = uint(clamp(b, 0.0f, 255.0f) * (63.0f / 255.0f) + 0.5f);
+
+		if (green0 < green1)
+		{
+			swap(green0, green1);
+		}
+		else if (green0 == green1)
+		{
+			// Keep the block in four color mode.
+			if (green0 < 63) green0++;
+			else green1--;
+		}
+
+		block->col0.g = green0;
+		block->col1.g = green1;
+	}
+
 } // namespace
 
 
@@ -711,20 +886,32 @@ void QuickCompress::compressDXT1(const ColorBlock & rgba, BlockDXT1 * dxtBlock)
 	}
 }
 
-
-void QuickCompress::compressDXT1a(const ColorBlock & rgba, BlockDXT1 * dxtBlock)
+void QuickCompress::compressDXT1(const ColorBlock & rgba, const BlockDXT1 & start, BlockDXT1 * dxtBlock)
 {
-	bool hasAlpha = false;
-	
-	for (uint i = 0; i < 16; i++)
+	// Single color blocks have an exact solution, and blocks in 3 color mode are not a good start for 4 colors.
+	if (rgba.isSingleColor() || start.col0.u <= start.col1.u)
 	{
-		if (rgba.color(i).a == 0) {
-			hasAlpha = true;
-			break;
-		}
+		compressDXT1(rgba, dxtBlock);
+		return;
 	}
-	
-	if (!hasAlpha)
+
+	Vector3 block[16];
+	extractColorBlockRGB(rgba, block);
+
+	const Vector3 maxColor = expandColor16(start.col0);
+	const Vector3 minColor = expandColor16(start.col1);
+
+	dxtBlock->col0 = start.col0;
+	dxtBlock->col1 = start.col1;
+	dxtBlock->indices = computeIndices4(block, maxColor, minColor);
+
+	optimizeEndPoints4(block, dxtBlock);
+}
+
+
+void QuickCompress::compressDXT1a(const ColorBlock & rgba, BlockDXT1 * dxtBlock)
+{
+	if (!hasTransparentTexels(rgba))
 	{
 		compressDXT1(rgba, dxtBlock);
 	}
@@ -755,13 +942,72 @@ void QuickCompress::compressDXT1a(const ColorBlock & rgba, BlockDXT1 * dxtBlock)
 		
 		dxtBlock->col0 = Color16(color1);
 		dxtBlock->col1 = Color16(color0);
-		dxtBlock->indices = computeIndices3(block, maxColor, minColor);
+		dxtBlock->indices = computeIndices3(rgba, maxColor, minColor);
 		
 		//	optimizeEndPoints(block, dxtBlock);
 	}
 }
 
 
+// Compress the green channel only, with red set to 1 and blue to 0 like in OptimalCompress::compressDXT1G.
+void QuickCompress::compressDXT1G(const ColorBlock & rgba, BlockDXT1 * dxtBlock, int iterationCount/*=8*/)
+{
+	if (rgba.isSingleColor(Color32(0, 0xFF, 0, 0))) // Mask all but green channel.
+	{
+		OptimalCompress::compressDXT1G(rgba.color(0).g, dxtBlock);
+		return;
+	}
+
+	uint8 green0 = 0;
+	uint8 green1 = 255;
+
+	// Get min/max green.
+	for (uint i = 0; i < 16; i++)
+	{
+		uint8 green = rgba.color(i).g;
+		green0 = max(green0, green);
+		green1 = min(green1, green);
+	}
+
+	const int inset = (green0 - green1) / 16;
+	uint g0 = ((green0 - inset) * 63 + 127) / 255;
+	uint g1 = ((green1 + inset) * 63 + 127) / 255;
+	if (g0 == g1)
+	{
+		if (g0 < 63) g0++;
+		else g1--;
+	}
+
+	BlockDXT1 block;
+	block.col0.r = 31;
+	block.col0.g = g0;
+	block.col0.b = 0;
+	block.col1.r = 31;
+	block.col1.g = g1;
+	block.col1.b = 0;
+	uint besterror = computeGreenIndices(rgba, &block);
+
+	BlockDXT1 bestblock = block;
+
+	for (int i = 0; i < iterationCount; i++)
+	{
+		optimizeGreen4(rgba, &block);
+		uint error = computeGreenIndices(rgba, &block);
+
+		if (error >= besterror)
+		{
+			// No improvement, stop.
+			break;
+		}
+
+		besterror = error;
+		bestblock = block;
+	}
+
+	// Copy best block to result;
+	*dxtBlock = bestblock;
+}
+
 void QuickCompress::compressDXT3(const ColorBlock & src, BlockDXT3 * dxtBlock)
 {
 	compressDXT1(src, &dxtBlock->color);
@@ -791,40 +1037,188 @@ void QuickCompress::compressDXT5A(const AlphaBlock4x4 & src, AlphaBlockDXT5 * ds
 	AlphaBlockDXT5 block;
 	block.alpha0 = alpha0 - (alpha0 - alpha1) / 34;
 	block.alpha1 = alpha1 + (alpha0 - alpha1) / 34;
-	uint besterror = computeAlphaIndices(src, &block);
-	
-	AlphaBlockDXT5 bestblock = block;
 
-	for (int i = 0; i < iterationCount; i++)
+	refineAlpha8(src, block, dst, iterationCount);
+}
+
+void QuickCompress::compressDXT5A(const AlphaBlock4x4 & src, const AlphaBlockDXT5 & start, AlphaBlockDXT5 * dst, int iterationCount/*=8*/)
+{
+	// Blocks in 6 alpha mode are not a good start for 8 alphas.
+	if (start.alpha0 <= start.alpha1)
 	{
-		optimizeAlpha8(src, &block);
-		uint error = computeAlphaIndices(src, &block);
-		
-		if (error >= besterror)
+		compressDXT5A(src, dst, iterationCount);
+		return;
+	}
+
+	AlphaBlockDXT5 block;
+	block.alpha0 = start.alpha0;
+	block.alpha1 = start.alpha1;
+
+	refineAlpha8(src, block, dst, iterationCount);
+}
+
+void QuickCompress::compressDXT5(const ColorBlock & rgba, BlockDXT5 * dxtBlock, int iterationCount/*=8*/)
+{
+	compressDXT1(rgba, &dxtBlock->color);
+	compressDXT5A(rgba, &dxtBlock->alpha, iterationCount);
+}
+
+void QuickCompress::compressDXT5(const ColorBlock & rgba, const BlockDXT5 & start, BlockDXT5 * dxtBlock, int iterationCount/*=8*/)
+{
+	AlphaBlock4x4 tmp;
+	tmp.init(rgba, 3);
+
+	compressDXT1(rgba, start.color, &dxtBlock->color);
+	compressDXT5A(tmp, start.alpha, &dxtBlock->alpha, iterationCount);
+}
+
+
+#if NV_USE_SSE > 1
+
+namespace
+{
+	typedef void QuickCompressKernel(const QuickCompressLanes & lanes, uint laneCount, QuickCompressSolution * result);
+
+	// Gathers the blocks of one of the kernels into the lanes, and runs the kernel whenever they are full.
+	struct BlockBatch
+	{
+		BlockBatch(bool threeColors) : count(0)
 		{
-			// No improvement, stop.
-			break;
+			uint features = cpuFeatures();
+			NV_UNUSED(features);
+
+			kernel = threeColors ? quickCompressBatch3<SimdVector> : quickCompressBatch4<SimdVector>;
+			width = SimdVector::Width;
+
+#if defined(HAVE_AVX2)
+			if (features & CpuFeature_AVX2) {
+				kernel = threeColors ? quickCompressBatch3_AVX2 : quickCompressBatch4_AVX2;
+				width = 8;
+			}
+#endif
+#if defined(HAVE_AVX512)
+			if (features & CpuFeature_AVX512F) {
+				kernel = threeColors ? quickCompressBatch3_AVX512 : quickCompressBatch4_AVX512;
+				width = 16;
+			}
+#endif
 		}
-		if (sameIndices(block, bestblock))
+
+		void add(const ColorBlock & rgba, BlockDXT1 * dxtBlock)
 		{
-			bestblock = block;
-			break;
+			for (uint i = 0; i < 16; i++)
+			{
+				const Color32 c = rgba.color(i);
+				lanes.colors[0][i][count] = c.r;
+				lanes.colors[1][i][count] = c.g;
+				lanes.colors[2][i][count] = c.b;
+				lanes.opaque[i][count] = (c.a > 127) ? 1.0f : 0.0f;
+			}
+			output[count++] = dxtBlock;
+
+			if (count == QuickCompressLanes::Count) flush();
 		}
-		
-		besterror = error;
-		bestblock = block;
+
+		void flush()
+		{
+			if (count == 0) return;
+
+			// Fill the rest of the last vector with copies of the last block, the lanes are never left uninitialized.
+			const uint laneCount = (count + width - 1) / width * width;
+			for (uint l = count; l < laneCount; l++)
+			{
+				for (uint i = 0; i < 16; i++)
+				{
+					for (uint c = 0; c < 3; c++) lanes.colors[c][i][l] = lanes.colors[c][i][count - 1];
+					lanes.opaque[i][l] = lanes.opaque[i][count - 1];
+				}
+			}
+
+			QuickCompressSolution solution;
+			kernel(lanes, laneCount, &solution);
+
+			for (uint l = 0; l < count; l++)
+			{
+				output[l]->col0 = Color16(uint16(solution.col0[l]));
+				output[l]->col1 = Color16(uint16(solution.col1[l]));
+				output[l]->indices = uint(solution.indices[0][l]) | (uint(solution.indices[1][l]) << 16);
+			}
+
+			count = 0;
+		}
+
+		QuickCompressLanes lanes;
+		BlockDXT1 * output[QuickCompressLanes::Count];
+		uint count;
+		uint width;
+		QuickCompressKernel * kernel;
 	};
-	
-	// Copy best block to result;
-	*dst = bestblock;
+
+} // namespace
+
+void QuickCompress::compressDXT1(const ColorBlock * src, uint count, BlockDXT1 * dst)
+{
+	BlockBatch batch(false);
+
+	for (uint i = 0; i < count; i++)
+	{
+		if (src[i].isSingleColor()) OptimalCompress::compressDXT1(src[i].color(0), dst + i);
+		else batch.add(src[i], dst + i);
+	}
+
+	batch.flush();
 }
 
-void QuickCompress::compressDXT5(const ColorBlock & rgba, BlockDXT5 * dxtBlock, int iterationCount/*=8*/)
+void QuickCompress::compressDXT1a(const ColorBlock * src, uint count, BlockDXT1 * dst)
 {
-	compressDXT1(rgba, &dxtBlock->color);
-	compressDXT5A(rgba, &dxtBlock->alpha, iterationCount);
+	BlockBatch batch4(false);
+	BlockBatch batch3(true);
+
+	for (uint i = 0; i < count; i++)
+	{
+		if (hasTransparentTexels(src[i])) batch3.add(src[i], dst + i);
+		else if (src[i].isSingleColor()) OptimalCompress::compressDXT1(src[i].color(0), dst + i);
+		else batch4.add(src[i], dst + i);
+	}
+
+	batch4.flush();
+	batch3.flush();
 }
 
+void QuickCompress::compressDXT5(const ColorBlock * src, uint count, BlockDXT5 * dst, int iterationCount/*=8*/)
+{
+	BlockBatch batch(false);
+
+	for (uint i = 0; i < count; i++)
+	{
+		if (src[i].isSingleColor()) OptimalCompress::compressDXT1(src[i].color(0), &dst[i].color);
+		else batch.add(src[i], &dst[i].color);
+
+		compressDXT5A(src[i], &dst[i].alpha, iterationCount);
+	}
+
+	batch.flush();
+}
+
+#else
+
+void QuickCompress::compressDXT1(const ColorBlock * src, uint count, BlockDXT1 * dst)
+{
+	for (uint i = 0; i < count; i++) compressDXT1(src[i], dst + i);
+}
+
+void QuickCompress::compressDXT1a(const ColorBlock * src, uint count, BlockDXT1 * dst)
+{
+	for (uint i = 0; i < count; i++) compressDXT1a(src[i], dst + i);
+}
+
+void QuickCompress::compressDXT5(const ColorBlock * src, uint count, BlockDXT5 * dst, int iterationCount/*=8*/)
+{
+	for (uint i = 0; i < count; i++) compressDXT5(src[i], dst + i, iterationCount);
+}
+
+#endif // NV_USE_SSE > 1
+
 
 
 void QuickCompress::outputBlock4(const ColorSet & set, const Vector3 & start, const Vector3 & end, BlockDXT1 * block)
@@ -43,6 +43,7 @@ namespace nv
 	{
 		void compressDXT1(const ColorBlock & src, BlockDXT1 * dst);
 		void compressDXT1a(const ColorBlock & src, BlockDXT1 * dst);
+		void compressDXT1G(const ColorBlock & src, BlockDXT1 * dst, int iterationCount=8);
 		
 		void compressDXT3(const ColorBlock & src, BlockDXT3 * dst);
 		
@@ -51,6 +52,18 @@ namespace nv
 
 		void compressDXT5(const ColorBlock & src, BlockDXT5 * dst, int iterationCount=8);
 
+		// Start from the endpoints of a similar block, like the same block of the previous frame, instead of the bounding box
+		// of the texels. The output can be the start block.
+		void compressDXT1(const ColorBlock & src, const BlockDXT1 & start, BlockDXT1 * dst);
+		void compressDXT5A(const AlphaBlock4x4 & src, const AlphaBlockDXT5 & start, AlphaBlockDXT5 * dst, int iterationCount=8);
+		void compressDXT5(const ColorBlock & src, const BlockDXT5 & start, BlockDXT5 * dst, int iterationCount=8);
+
+		// Compress count blocks at once, with one block per SIMD lane. The output is the same as the one of the functions
+		// above for each block.
+		void compressDXT1(const ColorBlock * src, uint count, BlockDXT1 * dst);
+		void compressDXT1a(const ColorBlock * src, uint count, BlockDXT1 * dst);
+		void compressDXT5(const ColorBlock * src, uint count, BlockDXT5 * dst, int iterationCount=8);
+
         void outputBlock4(const ColorSet & set, const Vector3 & start, const Vector3 & end, BlockDXT1 * block);
         void outputBlock3(const ColorSet & set, const Vector3 & start, const Vector3 & end, BlockDXT1 * block);
 	}
@@ -0,0 +1,400 @@
+#include "RateDistortion.h"
+
+#include "nvimage/BlockDXT.h"
+#include "nvimage/ColorBlock.h"
+
+#include "nvmath/Vector.inl"
+
+#include "nvcore/Utils.h" // clamp
+
+#include <float.h> // FLT_MAX
+#include <string.h> // memcmp
+
+using namespace nv;
+using namespace nvtt;
+
+
+namespace
+{
+    // Block rows optimized by each task. Blocks only reuse the output of blocks of their own strip, so the output
+    // doesn't depend on the number of threads.
+    const uint kStripRows = 8;
+
+    // Estimated bits of a field that repeats the same field of the left or top neighbor. Other fields cost 8 bits per byte.
+    const float kMatchBits = 12.0f;
+
+    struct RateDistortionContext
+    {
+        const float * data;
+        uint w, h;
+        uint y;             // First block row.
+        uint rows;
+        uint bw;
+        uint8 * blocks;
+
+        Format format;
+        bool d3d9, nv5x;
+        float lambda;
+        Vector4 weights;    // Of the squared error of each channel, in 8 bit units.
+    };
+
+    // The texels of the block inside the image, scaled to [0, 255].
+    struct Texels
+    {
+        void init(const float * data, uint img_w, uint img_h, uint img_x, uint img_y)
+        {
+            w = min(4U, img_w - img_x);
+            h = min(4U, img_h - img_y);
+
+            for (uint c = 0; c < 4; c++) {
+                const float * plane = data + c * img_w * img_h;
+                for (uint y = 0; y < h; y++) {
+                    for (uint x = 0; x < w; x++) {
+                        texel[4 * y + x][c] = 255.0f * clamp(plane[(img_y + y) * img_w + img_x + x], 0.0f, 1.0f);
+                    }
+                }
+            }
+        }
+
+        bool inside(uint i) const { return i % 4 < w && i / 4 < h; }
+
+        uint w, h;
+        float texel[16][4];
+    };
+
+    inline float square(float f) { return f * f; }
+
+    inline float colorError(const Texels & t, uint i, Color32 c, const Vector4 & weights)
+    {
+        return weights.x * square(t.texel[i][0] - c.r) + weights.y * square(t.texel[i][1] - c.g) + weights.z * square(t.texel[i][2] - c.b);
+    }
+
+    // Bits of a field of the given size, depending on whether the neighbors have the same bytes.
+    inline float fieldBits(const uint8 * field, const uint8 * left, const uint8 * top, uint size)
+    {
+        if (left != NULL && memcmp(field, left, size) == 0) return kMatchBits;
+        if (top != NULL && memcmp(field, top, size) == 0) return kMatchBits;
+        return 8.0f * size;
+    }
+
+
+    // Color blocks of BC1 and BC3.
+    struct ColorOptimizer
+    {
+        const RateDistortionContext * ctx;
+        const Texels * texels;
+        bool fourColorOnly;     // BC3 colors are always decoded in four color mode, blocks that would be ambiguous are skipped.
+
+        void evaluatePalette(const BlockDXT1 & block, Color32 palette[4]) const
+        {
+            if (ctx->nv5x) block.evaluatePaletteNV5x(palette);
+            else block.evaluatePalette(palette, ctx->d3d9);
+        }
+
+        bool usable(const BlockDXT1 & block) const
+        {
+            return !fourColorOnly || block.isFourColorMode();
+        }
+
+        float error(const BlockDXT1 & block) const
+        {
+            Color32 palette[4];
+            evaluatePalette(block, palette);
+
+            float e = 0.0f;
+            for (uint i = 0; i < 16; i++) {
+                if (texels->inside(i)) e += colorError(*texels, i, palette[(block.indices >> (2 * i)) & 3], ctx->weights);
+            }
+            return e;
+        }
+
+        // Choose the indices of the block for its endpoints. Three color blocks don't use the transparent index.
+        void fitIndices(BlockDXT1 & block) const
+        {
+            Color32 palette[4];
+            evaluatePalette(block, palette);
+            const uint count = block.isFourColorMode() ? 4 : 3;
+
+            block.indices = 0;
+            for (uint i = 0; i < 16; i++) {
+                if (!texels->inside(i)) continue;
+
+                uint best = 0;
+                float bestError = FLT_MAX;
+                for (uint p = 0; p < count; p++) {
+                    const float e = colorError(*texels, i, palette[p], ctx->weights);
+                    if (e < bestError) {
+                        bestError = e;
+                        best = p;
+                    }
+                }
+                block.indices |= best << (2 * i);
+            }
+        }
+
+        float bits(const BlockDXT1 & block, const BlockDXT1 * left, const BlockDXT1 * top) const
+        {
+            const uint8 * b = (const uint8 *)&block;
+            const uint8 * l = (const uint8 *)left;
+            const uint8 * t = (const uint8 *)top;
+            return fieldBits(b, l, t, 4) + fieldBits(b + 4, l ? l + 4 : NULL, t ? t + 4 : NULL, 4);
+        }
+
+        void optimize(BlockDXT1 * block, const BlockDXT1 * left, const BlockDXT1 * top) const
+        {
+            BlockDXT1 best = *block;
+            float bestCost = error(best) + ctx->lambda * bits(best, left, top);
+
+            const BlockDXT1 * neighbors[2] = { left, top };
+            for (uint n = 0; n < 2; n++) {
+                if (neighbors[n] == NULL) continue;
+                const BlockDXT1 & neighbor = *neighbors[n];
+
+                BlockDXT1 candidates[3];
+                bool valid[3];
+
+                // The endpoints of the neighbor with the best indices for them.
+                candidates[0] = neighbor;
+                fitIndices(candidates[0]);
+                valid[0] = usable(neighbor);
+
+                // The indices of the neighbor with the endpoints of the block.
+                candidates[1] = *block;
+                candidates[1].indices = neighbor.indices;
+                valid[1] = usable(*block);
+
+                // The whole neighbor.
+                candidates[2] = neighbor;
+                valid[2] = usable(neighbor);
+
+                for (uint c = 0; c < 3; c++) {
+                    if (!valid[c]) continue;
+                    const float cost = error(candidates[c]) + ctx->lambda * bits(candidates[c], left, top);
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        best = candidates[c];
+                    }
+                }
+            }
+
+            *block = best;
+        }
+    };
+
+
+    // Alpha blocks of BC3, and the single channel blocks of BC4 and BC5.
+    struct AlphaOptimizer
+    {
+        const RateDistortionContext * ctx;
+        const Texels * texels;
+        uint channel;       // Of the texels encoded by the block.
+        float weight;
+
+        float error(const AlphaBlockDXT5 & block) const
+        {
+            uint8 palette[8];
+            block.evaluatePalette(palette, ctx->d3d9);
+
+            float e = 0.0f;
+            for (uint i = 0; i < 16; i++) {
+                if (texels->inside(i)) e += weight * square(texels->texel[i][channel] - palette[block.index(i)]);
+            }
+            return e;
+        }
+
+        void fitIndices(AlphaBlockDXT5 & block) const
+        {
+            uint8 palette[8];
+            block.evaluatePalette(palette, ctx->d3d9);
+
+            for (uint i = 0; i < 16; i++) {
+                uint best = 0;
+                if (texels->inside(i)) {
+                    float bestError = FLT_MAX;
+                    for (uint p = 0; p < 8; p++) {
+                        const float e = square(texels->texel[i][channel] - palette[p]);
+                        if (e < bestError) {
+                            bestError = e;
+                            best = p;
+                        }
+                    }
+                }
+                block.setIndex(i, best);
+            }
+        }
+
+        float bits(const AlphaBlockDXT5 & block, const AlphaBlockDXT5 * left, const AlphaBlockDXT5 * top) const
+        {
+            const uint8 * b = (const uint8 *)&block;
+            const uint8 * l = (const uint8 *)left;
+            const uint8 * t = (const uint8 *)top;
+            return fieldBits(b, l, t, 2) + fieldBits(b + 2, l ? l + 2 : NULL, t ? t + 2 : NULL, 6);
+        }
+
+        void optimize(AlphaBlockDXT5 * block, const AlphaBlockDXT5 * left, const AlphaBlockDXT5 * top) const
+        {
+            AlphaBlockDXT5 best = *block;
+            float bestCost = error(best) + ctx->lambda * bits(best, left, top);
+
+            const AlphaBlockDXT5 * neighbors[2] = { left, top };
+            for (uint n = 0; n < 2; n++) {
+                if (neighbors[n] == NULL) continue;
+                const AlphaBlockDXT5 & neighbor = *neighbors[n];
+
+                AlphaBlockDXT5 candidates[3];
+
+                candidates[0] = neighbor;
+                fitIndices(candidates[0]);
+
+                candidates[1] = *block;
+                candidates[1].u = (block->u & 0xFFFF) | (neighbor.u & ~uint64(0xFFFF));
+
+                candidates[2] = neighbor;
+
+                for (uint c = 0; c < 3; c++) {
+                    const float cost = error(candidates[c]) + ctx->lambda * bits(candidates[c], left, top);
+                    if (cost < bestCost) {
+                        bestCost = cost;
+                        best = candidates[c];
+                    }
+                }
+            }
+
+            *block = best;
+        }
+    };
+
+
+    // BC7 blocks only take the whole block of a neighbor, the modes don't share a layout of endpoints and indices.
+    float errorBC7(const RateDistortionContext * ctx, const Texels & texels, const BlockBC7 & block)
+    {
+        ColorBlock decoded;
+        block.decodeBlock(&decoded);
+
+        float e = 0.0f;
+        for (uint i = 0; i < 16; i++) {
+            if (!texels.inside(i)) continue;
+            const Color32 c = decoded.color(i);
+            e += colorError(texels, i, c, ctx->weights) + ctx->weights.w * square(texels.texel[i][3] - c.a);
+        }
+        return e;
+    }
+
+    void optimizeBC7(const RateDistortionContext * ctx, const Texels & texels, BlockBC7 * block, const BlockBC7 * left, const BlockBC7 * top)
+    {
+        float bestCost = errorBC7(ctx, texels, *block) + ctx->lambda * fieldBits(block->data, left ? left->data : NULL, top ? top->data : NULL, 16);
+        const BlockBC7 * best = NULL;
+
+        const BlockBC7 * neighbors[2] = { left, top };
+        for (uint n = 0; n < 2; n++) {
+            if (neighbors[n] == NULL) continue;
+            const float cost = errorBC7(ctx, texels, *neighbors[n]) + ctx->lambda * kMatchBits;
+            if (cost < bestCost) {
+                bestCost = cost;
+                best = neighbors[n];
+            }
+        }
+
+        if (best != NULL) *block = *best;
+    }
+
+
+    void RateDistortionTask(void * context, int strip)
+    {
+        const RateDistortionContext * ctx = (const RateDistortionContext *)context;
+
+        const uint bs = (ctx->format == Format_BC1 || ctx->format == Format_BC4) ? 8 : 16;
+        const uint begin = strip * kStripRows;
+        const uint end = min(begin + kStripRows, ctx->rows);
+
+        Texels texels;
+
+        for (uint row = begin; row < end; row++)
+        {
+            for (uint bx = 0; bx < ctx->bw; bx++)
+            {
+                uint8 * block = ctx->blocks + (row * ctx->bw + bx) * bs;
+                const uint8 * left = bx > 0 ? block - bs : NULL;
+                const uint8 * top = row > begin ? block - ctx->bw * bs : NULL;
+
+                texels.init(ctx->data, ctx->w, ctx->h, 4 * bx, 4 * (ctx->y + row));
+
+                if (ctx->format == Format_BC7)
+                {
+                    optimizeBC7(ctx, texels, (BlockBC7 *)block, (const BlockBC7 *)left, (const BlockBC7 *)top);
+                    continue;
+                }
+
+                if (ctx->format == Format_BC4 || ctx->format == Format_BC5)
+                {
+                    // Red, and green in the second half of BC5 blocks. The compressors don't weight them either.
+                    AlphaOptimizer channel;
+                    channel.ctx = ctx;
+                    channel.texels = &texels;
+                    channel.weight = 1.0f;
+
+                    const uint count = (ctx->format == Format_BC5) ? 2 : 1;
+                    for (uint c = 0; c < count; c++) {
+                        channel.channel = c;
+                        channel.optimize((AlphaBlockDXT5 *)(block + 8 * c), left ? (const AlphaBlockDXT5 *)(left + 8 * c) : NULL, top ? (const AlphaBlockDXT5 *)(top + 8 * c) : NULL);
+                    }
+                    continue;
+                }
+
+                // The color block follows the alpha block in BC3.
+                const uint colorOffset = (ctx->format == Format_BC3) ? 8 : 0;
+
+                ColorOptimizer color;
+                color.ctx = ctx;
+                color.texels = &texels;
+                color.fourColorOnly = (ctx->format == Format_BC3);
+                color.optimize((BlockDXT1 *)(block + colorOffset), left ? (const BlockDXT1 *)(left + colorOffset) : NULL, top ? (const BlockDXT1 *)(top + colorOffset) : NULL);
+
+                if (ctx->format == Format_BC3)
+                {
+                    AlphaOptimizer alpha;
+                    alpha.ctx = ctx;
+                    alpha.texels = &texels;
+                    alpha.channel = 3;
+                    alpha.weight = ctx->weights.w;
+                    alpha.optimize((AlphaBlockDXT5 *)block, (const AlphaBlockDXT5 *)left, (const AlphaBlockDXT5 *)top);
+                }
+            }
+        }
+    }
+
+} // namespace
+
+
+bool nv::hasRateDistortionPass(const CompressionOptions::Private & compressionOptions)
+{
+    if (compressionOptions.rateDistortionLambda <= 0.0f) return false;
+
+    const Format format = compressionOptions.format;
+    return format == Format_BC1 || format == Format_BC3 || format == Format_BC4 || format == Format_BC5 || format == Format_BC7;
+}
+
+void nv::optimizeRateDistortion(const float * data, uint w, uint h, uint y, uint rows, uint8 * blocks, TaskDispatcher * dispatcher, const CompressionOptions::Private & compressionOptions)
+{
+    nvDebugCheck(hasRateDistortionPass(compressionOptions));
+
+    RateDistortionContext context;
+    context.data = data;
+    context.w = w;
+    context.h = h;
+    context.y = y;
+    context.rows = rows;
+    context.bw = (w + 3) / 4;
+    context.blocks = blocks;
+
+    context.format = compressionOptions.format;
+    context.d3d9 = (compressionOptions.decoder == Decoder_D3D9);
+    context.nv5x = (compressionOptions.decoder == Decoder_NV5x);
+    context.lambda = compressionOptions.rateDistortionLambda;
+    context.weights = compressionOptions.colorWeight;
+
+    // BC1 is opaque, its alpha doesn't count.
+    if (context.format == Format_BC1) context.weights.w = 0.0f;
+
+    dispatcher->dispatch(RateDistortionTask, &context, (rows + kStripRows - 1) / kStripRows);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#ifndef NVTT_RATEDISTORTION_H
+#define NVTT_RATEDISTORTION_H
+
+#include "CompressionOptions.h"
+
+namespace nv
+{
+    // Whether the rate-distortion pass is enabled and supports the output format: BC1, BC3, BC4, BC5 and BC7.
+    bool hasRateDistortionPass(const nvtt::CompressionOptions::Private & compressionOptions);
+
+    // Re-encode the compressed blocks of rows [y, y + rows) of a w x h planar float image, so that blocks repeat the
+    // endpoints or indices of their left and top neighbors when the error that adds is worth the bits that saves.
+    // The blocks of the rows start at blocks. Horizontal strips of blocks are optimized in parallel.
+    void optimizeRateDistortion(const float * data, uint w, uint h, uint y, uint rows, uint8 * blocks, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions);
+
+} // nv namespace
+
+
+#endif // NVTT_RATEDISTORTION_H
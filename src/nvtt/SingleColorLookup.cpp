@@ -1,90 +1,177 @@
 
 #include "SingleColorLookup.h"
 
-#include "nvcore/Debug.h"
+#include "nvimage/BlockDXT.h" // BlockDecoder
 
-#include <stdlib.h> // abs
+using namespace nv;
 
-// Globals
-uint8 OMatch5[256][2];
-uint8 OMatch6[256][2];
-uint8 OMatchAlpha5[256][2];
-uint8 OMatchAlpha6[256][2];
+// The tables are built at compile time by C++14 compilers, older compilers take about 1 ms to build them at startup.
 
-
-
-static int Mul8Bit(int a, int b)
+namespace
 {
-	int t = a * b + 128;
-	return (t + (t >> 8)) >> 8;
-}
+    // Palette of the D3D10 decoder.
+    struct PaletteLookup
+    {
+        uint8 expand5[32];
+        uint8 expand6[64];
+        uint8 lerp5[32][32];
+        uint8 lerp6[64][64];
+        uint8 mid5[32][32];
+        uint8 mid6[64][64];
+    };
+
+    inline NV_TABLE_CONSTEXPR int absolute(int x)
+    {
+        return x < 0 ? -x : x;
+    }
 
-static inline int Lerp13(int a, int b)
-{
-#ifdef DXT_USE_ROUNDING_BIAS
-    // with rounding bias
-    return a + Mul8Bit(b-a, 0x55);
-#else
-    // without rounding bias
-    // replace "/ 3" by "* 0xaaab) >> 17" if your compiler sucks or you really need every ounce of speed.
-    return (a * 2 + b) / 3;
-#endif
-}
+    inline NV_TABLE_CONSTEXPR int expand(int value, int bits)
+    {
+        return bits == 5 ? (value << 3) | (value >> 2) : (value << 2) | (value >> 4);
+    }
 
-static void PrepareOptTable(uint8 * table, const uint8 * expand, int size, bool alpha_mode)
-{
-	for (int i = 0; i < 256; i++)
-	{
-		int bestErr = 256 * 100;
-
-		for (int min = 0; min < size; min++)
-		{
-			for (int max = 0; max < size; max++)
-			{
-				int mine = expand[min];
-				int maxe = expand[max];
-
-				int err;
-                if (alpha_mode) err = abs((maxe + mine)/2 - i);
-                else err = abs(Lerp13(maxe, mine) - i);
-                err *= 100;
-
-                // DX10 spec says that interpolation must be within 3% of "correct" result,
-                // add this as error term. (normally we'd expect a random distribution of
-                // +-1.5% error, but nowhere in the spec does it say that the error has to be
-                // unbiased - better safe than sorry).
-				err += abs(max - min) * 3;
-
-				if (err < bestErr)
-				{
-					table[i*2+0] = max;
-					table[i*2+1] = min;
-					bestErr = err;
-				}
-			}
-		}
-	}
-}
+    // Color 2 of a block with the 5 or 6 bit endpoints col0 and col1, like BlockDXT1::evaluatePalette and
+    // BlockDXT1::evaluatePaletteNV5x. In three color blocks, color 2 is the midpoint of the endpoints.
+    inline NV_TABLE_CONSTEXPR int color2(BlockDecoder decoder, int bits, int col0, int col1, bool threeColor)
+    {
+        if (decoder == BlockDecoder_NV5x)
+        {
+            if (bits == 5) {
+                return threeColor ? ((col0 + col1) * 33) / 8 : ((2 * col0 + col1) * 22) / 8;
+            }
+
+            const int e0 = expand(col0, 6);
+            const int gdiff = expand(col1, 6) - e0;
+            return threeColor ? (256 * e0 + gdiff / 4 + 128 + gdiff * 128) / 256 : (256 * e0 + gdiff / 4 + 128 + gdiff * 80) / 256;
+        }
+
+        const int e0 = expand(col0, bits);
+        const int e1 = expand(col1, bits);
+        if (threeColor) return (e0 + e1) / 2;
+        return (2 * e0 + e1 + (decoder == BlockDecoder_D3D9 ? 1 : 0)) / 3;
+    }
 
+    // DX10 spec says that interpolation must be within 3% of "correct" result,
+    // add this as error term. (normally we'd expect a random distribution of
+    // +-1.5% error, but nowhere in the spec does it say that the error has to be
+    // unbiased - better safe than sorry).
+    inline NV_TABLE_CONSTEXPR int matchError(int color, int value, int col0, int col1)
+    {
+        return absolute(color - value) * 100 + absolute(col0 - col1) * 3;
+    }
 
-NV_AT_STARTUP(initSingleColorLookup());
+    // Single color compressor tables, based on:
+    // https://mollyrocket.com/forums/viewtopic.php?t=392
+    NV_TABLE_CONSTEXPR void prepareOptTable(uint8 table[256][2], BlockDecoder decoder, int bits, bool threeColor)
+    {
+        const int size = 1 << bits;
+
+        // Values farther than this from color 2 have an error of at least 100 * (window + 1).
+        const int window = 8;
+
+        int bestErr[256] = {};
+        for (int i = 0; i < 256; i++) bestErr[i] = 256 * 100;
+
+        // Visit the endpoints in the same order as a search for each value, but only update the values close to color 2.
+        for (int min = 0; min < size; min++)
+        {
+            for (int max = 0; max < size; max++)
+            {
+                const int color = color2(decoder, bits, max, min, threeColor);
+                const int first = color - window < 0 ? 0 : color - window;
+                const int last = color + window > 255 ? 255 : color + window;
+
+                for (int i = first; i <= last; i++)
+                {
+                    const int err = matchError(color, i, max, min);
+
+                    if (err < bestErr[i])
+                    {
+                        table[i][0] = uint8(max);
+                        table[i][1] = uint8(min);
+                        bestErr[i] = err;
+                    }
+                }
+            }
+        }
+
+        // The endpoints outside the window can only win when none inside of it has a smaller error, search all of them then.
+        for (int i = 0; i < 256; i++)
+        {
+            if (bestErr[i] < 100 * (window + 1)) continue;
+
+            bestErr[i] = 256 * 100;
+
+            for (int min = 0; min < size; min++)
+            {
+                for (int max = 0; max < size; max++)
+                {
+                    const int err = matchError(color2(decoder, bits, max, min, threeColor), i, max, min);
+
+                    if (err < bestErr[i])
+                    {
+                        table[i][0] = uint8(max);
+                        table[i][1] = uint8(min);
+                        bestErr[i] = err;
+                    }
+                }
+            }
+        }
+    }
 
-void initSingleColorLookup()
-{
-	uint8 expand5[32];
-	uint8 expand6[64];
+    NV_TABLE_CONSTEXPR SingleColorLookup makeSingleColorLookup(BlockDecoder decoder)
+    {
+        SingleColorLookup t = {};
+
+        prepareOptTable(t.match5, decoder, 5, false);
+        prepareOptTable(t.match6, decoder, 6, false);
+        prepareOptTable(t.matchAlpha5, decoder, 5, true);
+        prepareOptTable(t.matchAlpha6, decoder, 6, true);
 
-    for (int i = 0; i < 32; i++) {
-		expand5[i] = (i<<3) | (i>>2);
+        return t;
     }
 
-    for (int i = 0; i < 64; i++) {
-		expand6[i] = (i<<2) | (i>>4);
+    NV_TABLE_CONSTEXPR PaletteLookup makePaletteLookup()
+    {
+        PaletteLookup t = {};
+
+        for (int a = 0; a < 32; a++) t.expand5[a] = uint8(expand(a, 5));
+        for (int a = 0; a < 64; a++) t.expand6[a] = uint8(expand(a, 6));
+
+        for (int a = 0; a < 32; a++) {
+            for (int b = 0; b < 32; b++) {
+                t.lerp5[a][b] = uint8((2 * t.expand5[a] + t.expand5[b]) / 3);
+                t.mid5[a][b] = uint8((t.expand5[a] + t.expand5[b]) / 2);
+            }
+        }
+
+        for (int a = 0; a < 64; a++) {
+            for (int b = 0; b < 64; b++) {
+                t.lerp6[a][b] = uint8((2 * t.expand6[a] + t.expand6[b]) / 3);
+                t.mid6[a][b] = uint8((t.expand6[a] + t.expand6[b]) / 2);
+            }
+        }
+
+        return t;
     }
 
-	PrepareOptTable(&OMatch5[0][0], expand5, 32, false);
-	PrepareOptTable(&OMatch6[0][0], expand6, 64, false);
-    PrepareOptTable(&OMatchAlpha5[0][0], expand5, 32, true);
-	PrepareOptTable(&OMatchAlpha6[0][0], expand6, 64, true);
+    NV_TABLE_CONSTEXPR const PaletteLookup s_palette = makePaletteLookup();
 }
 
+NV_TABLE_CONSTEXPR const SingleColorLookup SingleColorTables[3] = {
+    makeSingleColorLookup(BlockDecoder_D3D10),
+    makeSingleColorLookup(BlockDecoder_D3D9),
+    makeSingleColorLookup(BlockDecoder_NV5x),
+};
+
+const uint8 (&OMatch5)[256][2] = SingleColorTables[BlockDecoder_D3D10].match5;
+const uint8 (&OMatch6)[256][2] = SingleColorTables[BlockDecoder_D3D10].match6;
+const uint8 (&OMatchAlpha5)[256][2] = SingleColorTables[BlockDecoder_D3D10].matchAlpha5;
+const uint8 (&OMatchAlpha6)[256][2] = SingleColorTables[BlockDecoder_D3D10].matchAlpha6;
+
+const uint8 (&Expand5)[32] = s_palette.expand5;
+const uint8 (&Expand6)[64] = s_palette.expand6;
+const uint8 (&Lerp5)[32][32] = s_palette.lerp5;
+const uint8 (&Lerp6)[64][64] = s_palette.lerp6;
+const uint8 (&Mid5)[32][32] = s_palette.mid5;
+const uint8 (&Mid6)[64][64] = s_palette.mid6;
@@ -1,9 +1,31 @@
 
 #include "nvcore/nvcore.h" // uint8
 
-extern uint8 OMatch5[256][2];
-extern uint8 OMatch6[256][2];
-extern uint8 OMatchAlpha5[256][2];
-extern uint8 OMatchAlpha6[256][2];
+// Endpoints of the single color blocks for a BC1 decoder, indexed by the 8 bit value of the channel. Entry [v] has the 5 or 6
+// bit endpoints col0 and col1 whose color 2 is closest to v. The alpha tables are for three color blocks, where color 2 is
+// the midpoint of the endpoints.
+struct SingleColorLookup
+{
+    uint8 match5[256][2];
+    uint8 match6[256][2];
+    uint8 matchAlpha5[256][2];
+    uint8 matchAlpha6[256][2];
+};
 
-void initSingleColorLookup();
\ No newline at end of file
+// Indexed by nv::BlockDecoder. Compilers with C++14 constexpr generate the tables at compile time.
+extern const SingleColorLookup SingleColorTables[3];
+
+// D3D10 tables.
+extern const uint8 (&OMatch5)[256][2];
+extern const uint8 (&OMatch6)[256][2];
+extern const uint8 (&OMatchAlpha5)[256][2];
+extern const uint8 (&OMatchAlpha6)[256][2];
+
+// Bit expanded 5 and 6 bit endpoints and the palette entries interpolated between them:
+// Lerp[a][b] = (2*a + b) / 3 in 4 color mode, Mid[a][b] = (a + b) / 2 in 3 color mode.
+extern const uint8 (&Expand5)[32];
+extern const uint8 (&Expand6)[64];
+extern const uint8 (&Lerp5)[32][32];
+extern const uint8 (&Lerp6)[64][64];
+extern const uint8 (&Mid5)[32][32];
+extern const uint8 (&Mid6)[64][64];
@@ -0,0 +1,293 @@
+#include "nvtt.h"
+#include "TaskDispatcher.h"
+#include "QuickCompressDXT.h"
+
+#include "nvimage/ColorBlock.h"
+#include "nvimage/BlockDXT.h"
+
+#include "nvmath/Vector.inl"
+
+#include "bc7/avpcl.h"
+
+#include <new> // placement new
+#include <string.h> // memcpy
+
+using namespace nv;
+using namespace nvtt;
+
+
+struct StreamCompressor::Private
+{
+    bool compress(int w, int h, int pitch, const void * bgra, const void * previousBgra, const void * previousOutput, void * output, int outputSize) const;
+
+    Format format;
+    uint blockSize;     // 0 while no format is set.
+    uint tolerance;     // Of the blocks copied from the previous frame.
+    AVPCL::Options bc7Options;
+
+    TaskDispatcher * dispatcher;
+    ConcurrentTaskDispatcher defaultDispatcher;
+};
+
+namespace
+{
+    // Smaller frames are compressed on the calling thread, the dispatch costs more than the blocks.
+    const uint ParallelBlockThreshold = 4096;
+
+    // Blocks compressed by each task of the dispatch.
+    const uint BlocksPerTask = 1024;
+
+    // Blocks of a sequence that changed more than this are searched from scratch, their previous endpoints are not a good start.
+    const uint SeedThreshold = 32;
+
+    // Blocks that are compressed from scratch are gathered and compressed together, several in each SIMD register.
+    const uint BatchSize = 16;
+
+    struct FrameContext
+    {
+        const StreamCompressor::Private * m;
+        uint w, h;
+        uint pitch;
+        const uint8 * bgra;
+        const uint8 * previousBgra;     // NULL outside of sequences.
+        const uint8 * previousOutput;
+        uint8 * output;
+        uint blockCount;    // Per block row.
+    };
+
+    // Load the block at (x, y), the texels of partial blocks are repeated like in ColorBlock::init.
+    void loadBlock(const FrameContext & frame, const uint8 * bgra, uint x, uint y, ColorBlock & block)
+    {
+        const uint bw = min(frame.w - x, 4U);
+        const uint bh = min(frame.h - y, 4U);
+
+        for (uint i = 0; i < 4; i++)
+        {
+            const Color32 * row = (const Color32 *)(bgra + (y + i % bh) * frame.pitch) + x;
+
+            for (uint e = 0; e < 4; e++)
+            {
+                block.color(e, i) = row[e % bw];
+            }
+        }
+    }
+
+    // The texels outside of partial blocks are zero, like in CompressorBC7.
+    void compressBC7(const FrameContext & frame, uint x, uint y, const ColorBlock & block, void * output)
+    {
+        AVPCL::Tile tile(min(frame.w - x, 4U), min(frame.h - y, 4U));
+
+        for (uint i = 0; i < 4; i++)
+        {
+            for (uint e = 0; e < 4; e++)
+            {
+                const bool inside = int(e) < tile.size_x && int(i) < tile.size_y;
+                const Color32 c = block.color(e, i);
+                tile.data[i][e] = inside ? Vector4(c.r, c.g, c.b, c.a) : Vector4(0.0f);
+                tile.importance_map[i][e] = inside ? 1.0f : 0.0f;
+            }
+        }
+
+        AVPCL::compress_mode6_fast(tile, frame.m->bc7Options, (char *)output);
+    }
+
+    struct BlockBatch
+    {
+        ColorBlock blocks[BatchSize];
+        uint8 * output[BatchSize];
+        uint count;
+    };
+
+    void compressBatch(const StreamCompressor::Private & m, BlockBatch & batch)
+    {
+        if (m.format == Format_DXT5)
+        {
+            BlockDXT5 dxt[BatchSize];
+            QuickCompress::compressDXT5(batch.blocks, batch.count, dxt);
+            for (uint i = 0; i < batch.count; i++) memcpy(batch.output[i], dxt + i, sizeof(BlockDXT5));
+        }
+        else
+        {
+            BlockDXT1 dxt[BatchSize];
+            if (m.format == Format_DXT1) QuickCompress::compressDXT1(batch.blocks, batch.count, dxt);
+            else QuickCompress::compressDXT1a(batch.blocks, batch.count, dxt);
+            for (uint i = 0; i < batch.count; i++) memcpy(batch.output[i], dxt + i, sizeof(BlockDXT1));
+        }
+
+        batch.count = 0;
+    }
+
+    void CompressRowsTask(void * context, int begin, int end)
+    {
+        const FrameContext & frame = *(const FrameContext *)context;
+        const StreamCompressor::Private & m = *frame.m;
+
+        BlockBatch batch;
+        batch.count = 0;
+
+        ColorBlock previousBlock;
+
+        for (int by = begin; by < end; by++)
+        {
+            const uint y = uint(by) * 4;
+            uint8 * output = frame.output + uint(by) * frame.blockCount * m.blockSize;
+
+            for (uint x = 0; x < frame.w; x += 4, output += m.blockSize)
+            {
+                ColorBlock & block = batch.blocks[batch.count];
+                loadBlock(frame, frame.bgra, x, y, block);
+
+                if (frame.previousBgra != NULL)
+                {
+                    const uint8 * previousOutput = frame.previousOutput + (output - frame.output);
+
+                    loadBlock(frame, frame.previousBgra, x, y, previousBlock);
+                    const uint diff = block.maxDifference(previousBlock);
+
+                    if (diff <= m.tolerance)
+                    {
+                        if (output != previousOutput) memcpy(output, previousOutput, m.blockSize);
+                        continue;
+                    }
+                    if (diff <= SeedThreshold && m.format == Format_DXT1)
+                    {
+                        const BlockDXT1 start = *(const BlockDXT1 *)previousOutput;
+                        QuickCompress::compressDXT1(block, start, new(output) BlockDXT1);
+                        continue;
+                    }
+                    if (diff <= SeedThreshold && m.format == Format_DXT5)
+                    {
+                        const BlockDXT5 start = *(const BlockDXT5 *)previousOutput;
+                        QuickCompress::compressDXT5(block, start, new(output) BlockDXT5);
+                        continue;
+                    }
+                }
+
+                if (m.format == Format_BC7)
+                {
+                    compressBC7(frame, x, y, block, output);
+                    continue;
+                }
+
+                batch.output[batch.count++] = output;
+                if (batch.count == BatchSize) compressBatch(m, batch);
+            }
+        }
+
+        if (batch.count != 0) compressBatch(m, batch);
+    }
+}
+
+
+StreamCompressor::StreamCompressor() : m(*new StreamCompressor::Private())
+{
+    m.format = Format_DXT1;
+    m.blockSize = 0;
+    m.tolerance = 0;
+    m.dispatcher = &m.defaultDispatcher;
+
+    // Same settings as the BC7 compressor at the fastest quality, restricted to mode 6.
+    AVPCL::Options & options = m.bc7Options;
+    options.premult = false;
+    options.nonuniform = false;
+    options.nonuniform_ati = false;
+    options.channel_weights[0] = options.channel_weights[1] = options.channel_weights[2] = options.channel_weights[3] = 1.0f;
+    options.effort = 0.0f;
+    options.mode_candidates = 1;
+    options.mode_mask = 1 << 6;
+    options.error_threshold = 0.0f;
+    options.dispatch = NULL;
+    options.dispatcher = NULL;
+}
+
+StreamCompressor::~StreamCompressor()
+{
+    delete &m;
+}
+
+bool StreamCompressor::setFormat(Format format)
+{
+    if (format == Format_DXT1 || format == Format_DXT1a)
+    {
+        m.blockSize = 8;
+    }
+    else if (format == Format_DXT5 || format == Format_BC7)
+    {
+        m.blockSize = 16;
+    }
+    else
+    {
+        return false;
+    }
+
+    m.format = format;
+    return true;
+}
+
+void StreamCompressor::setTaskDispatcher(TaskDispatcher * disp)
+{
+    if (disp == NULL) {
+        m.dispatcher = &m.defaultDispatcher;
+    }
+    else {
+        m.dispatcher = disp;
+    }
+}
+
+int StreamCompressor::frameSize(int w, int h) const
+{
+    return ((w + 3) / 4) * ((h + 3) / 4) * int(m.blockSize);
+}
+
+void StreamCompressor::setSequenceTolerance(int tolerance)
+{
+    m.tolerance = uint(max(0, tolerance));
+}
+
+bool StreamCompressor::compress(int w, int h, int pitch, const void * bgra, void * output, int outputSize) const
+{
+    return m.compress(w, h, pitch, bgra, NULL, NULL, output, outputSize);
+}
+
+bool StreamCompressor::compress(int w, int h, int pitch, const void * bgra, const void * previousBgra, const void * previousOutput, void * output, int outputSize) const
+{
+    if (previousBgra == NULL || previousOutput == NULL)
+    {
+        return false;
+    }
+
+    return m.compress(w, h, pitch, bgra, previousBgra, previousOutput, output, outputSize);
+}
+
+bool StreamCompressor::Private::compress(int w, int h, int pitch, const void * bgra, const void * previousBgra, const void * previousOutput, void * output, int outputSize) const
+{
+    if (blockSize == 0 || w <= 0 || h <= 0 || pitch < 4 * w || bgra == NULL || output == NULL || outputSize < ((w + 3) / 4) * ((h + 3) / 4) * int(blockSize))
+    {
+        return false;
+    }
+
+    FrameContext frame;
+    frame.m = this;
+    frame.w = w;
+    frame.h = h;
+    frame.pitch = pitch;
+    frame.bgra = (const uint8 *)bgra;
+    frame.previousBgra = (const uint8 *)previousBgra;
+    frame.previousOutput = (const uint8 *)previousOutput;
+    frame.output = (uint8 *)output;
+    frame.blockCount = (w + 3) / 4;
+
+    const uint rowCount = (h + 3) / 4;
+
+    if (frame.blockCount * rowCount < ParallelBlockThreshold)
+    {
+        CompressRowsTask(&frame, 0, rowCount);
+    }
+    else
+    {
+        const uint grain = max(1U, BlocksPerTask / frame.blockCount);
+        dispatcher->dispatchRange(CompressRowsTask, &frame, rowCount, grain);
+    }
+
+    return true;
+}
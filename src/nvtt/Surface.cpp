@@ -23,6 +23,10 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include "Surface.h"
+#include "Profiler.h"
+
+#include "nvcore/Array.inl"
+#include "nvcore/CpuInfo.h"
 
 #include "nvmath/Vector.inl"
 #include "nvmath/Matrix.inl"
@@ -33,14 +37,22 @@
 #include "nvimage/Filter.h"
 #include "nvimage/ImageIO.h"
 #include "nvimage/NormalMap.h"
+#include "nvimage/Resample.h"
 #include "nvimage/BlockDXT.h"
 #include "nvimage/ColorBlock.h"
 #include "nvimage/PixelFormat.h"
 #include "nvimage/ErrorMetric.h"
+#include "nvimage/Quantize.h"
+
+#include "nvthread/TaskScheduler.h"
 
 #include <float.h>
 #include <string.h> // memset, memcpy
 
+#if NV_USE_SSE > 1
+#include "nvmath/SimdVector.h" // approxPow
+#endif
+
 #if NV_CC_GNUC
 #include <math.h> // exp2f and log2f
 #endif
@@ -79,13 +91,13 @@ namespace
         else if (format == Format_DXT3) {
             return 16;
         }
-        else if (format == Format_DXT5 || format == Format_DXT5n || format == Format_BC3_RGBM) {
+        else if (format == Format_DXT5 || format == Format_DXT5n || format == Format_BC3_RGBM || format == Format_BC3_YCoCg) {
             return 16;
         }
         else if (format == Format_BC4) {
             return 8;
         }
-        else if (format == Format_BC5 || format == Format_BC5_Luma) {
+        else if (format == Format_BC5 || format == Format_BC5_Luma || format == Format_BC5_Normal) {
             return 16;
         }
         else if (format == Format_CTX1) {
@@ -257,6 +269,9 @@ void Surface::operator=(const Surface & tex)
 
 void Surface::detach()
 {
+    // Everything but the deferred operations needs the texels up to date.
+    m->flush();
+
     if (m->refCount() > 1)
     {
         m->release();
@@ -264,6 +279,32 @@ void Surface::detach()
         m->addRef();
         nvDebugCheck(m->refCount() == 1);
     }
+    else if (m->image != NULL && m->image->isExternal())
+    {
+        // Never write to the texels of a view.
+        FloatImage * image = m->image->clone();
+        delete m->image;
+        m->image = image;
+    }
+}
+
+// Detach for operations that overwrite all the texels. A shared image is left to the other surfaces instead of cloned, the
+// image of the detached surface is NULL then. Pending operations are dropped.
+static void detachTexels(Surface::Private *& m)
+{
+    if (m->refCount() > 1)
+    {
+        m->release();
+        m = new Surface::Private(*m, NULL);
+        m->addRef();
+    }
+    else
+    {
+        m->ops.clear();
+        m->storageFormat = StorageFormat_Float;
+        m->packed.clear();
+        m->packed.shrink();
+    }
 }
 
 void Surface::setWrapMode(WrapMode wrapMode)
@@ -284,6 +325,18 @@ void Surface::setAlphaMode(AlphaMode alphaMode)
     }
 }
 
+void Surface::setMipmapAlphaCoverage(float coverage, float alphaRef/*= 0.5f*/)
+{
+    alphaRef = nv::clamp(alphaRef, 1.0f/256, 255.0f/256);
+
+    if (m->alphaCoverage != coverage || m->alphaCoverageRef != alphaRef)
+    {
+        detach();
+        m->alphaCoverage = coverage;
+        m->alphaCoverageRef = alphaRef;
+    }
+}
+
 void Surface::setNormalMap(bool isNormalMap)
 {
     if (m->isNormalMap != isNormalMap)
@@ -293,6 +346,60 @@ void Surface::setNormalMap(bool isNormalMap)
     }
 }
 
+void Surface::setDeferred(bool deferred)
+{
+    if (m->deferred != deferred)
+    {
+        detach();
+        m->deferred = deferred;
+    }
+}
+
+void Surface::setApproximateGamma(bool approximate)
+{
+    if (m->approximateGamma != approximate)
+    {
+        detach();
+        m->approximateGamma = approximate;
+    }
+}
+
+void Surface::pack(StorageFormat format)
+{
+    if (isNull() || m->storageFormat == format) return;
+
+    detach();
+
+    if (format == StorageFormat_Float) return;
+
+    FloatImage * img = m->image;
+    const uint count = img->pixelCount() * 4;
+    const float * src = img->channel(0);
+
+    if (format == StorageFormat_Half) {
+        m->packed.resize(count * sizeof(uint16));
+        half_from_float_array(src, (uint16 *)m->packed.buffer(), count);
+    }
+    else if (format == StorageFormat_UNorm16) {
+        m->packed.resize(count * sizeof(uint16));
+        uint16 * dst = (uint16 *)m->packed.buffer();
+        for (uint i = 0; i < count; i++) {
+            dst[i] = uint16(ftoi_round(nv::saturate(src[i]) * 65535.0f));
+        }
+    }
+    else {
+        nvDebugCheck(format == StorageFormat_UNorm8);
+        m->packed.resize(count);
+        uint8 * dst = m->packed.buffer();
+        for (uint i = 0; i < count; i++) {
+            dst[i] = uint8(ftoi_round(nv::saturate(src[i]) * 255.0f));
+        }
+    }
+
+    img->resizeChannelCount(0);     // Keep the extents, release the floats.
+    m->storageFormat = format;
+}
+
 bool Surface::isNull() const
 {
     return m->image == NULL;
@@ -331,6 +438,21 @@ bool Surface::isNormalMap() const
     return m->isNormalMap;
 }
 
+bool Surface::isDeferred() const
+{
+    return m->deferred;
+}
+
+bool Surface::isApproximateGamma() const
+{
+    return m->approximateGamma;
+}
+
+StorageFormat Surface::storageFormat() const
+{
+    return m->storageFormat;
+}
+
 TextureType Surface::type() const
 {
     return m->type;
@@ -351,6 +473,7 @@ int Surface::countMipmaps(int min_size) const
 float Surface::alphaTestCoverage(float alphaRef/*= 0.5*/, int alpha_channel/*=3*/) const
 {
     if (m->image == NULL) return 0.0f;
+    m->flush();
 
     alphaRef = nv::clamp(alphaRef, 1.0f/256, 255.0f/256);
 
@@ -360,47 +483,21 @@ float Surface::alphaTestCoverage(float alphaRef/*= 0.5*/, int alpha_channel/*=3*
 float Surface::average(int channel, int alpha_channel/*= -1*/, float gamma /*= 2.2f*/) const
 {
     if (m->image == NULL) return 0.0f;
+    m->flush();
 
-    const uint count = m->image->width() * m->image->height();
-
-    float sum = 0.0f;
-    const float * c = m->image->channel(channel);
-
-    float denom;
-
-    if (alpha_channel == -1) {
-        for (uint i = 0; i < count; i++) {
-            sum += powf(c[i], gamma);
-        }
-
-        denom = float(count);
-    }
-    else {
-        float alpha_sum = 0.0f;
-        const float * a = m->image->channel(alpha_channel);
-        
-        for (uint i = 0; i < count; i++) {
-            sum += powf(c[i], gamma) * a[i];
-            alpha_sum += a[i];
-        }
-
-        denom = alpha_sum;
-    }
-
-    // Avoid division by zero.
-    if (denom == 0.0f) return 0.0f;
-
-    return powf(sum / denom, 1.0f/gamma);
+    return m->image->average(channel, alpha_channel, gamma);
 }
 
 const float * Surface::data() const
 {
+    m->flush();
     return m->image->channel(0);
 }
 
 const float * Surface::channel(int i) const
 {
     if (i < 0 || i > 3) return NULL;
+    m->flush();
     return m->image->channel(i);
 }
 
@@ -411,58 +508,20 @@ void Surface::histogram(int channel, float rangeMin, float rangeMax, int binCoun
     //memset(bins, 0, sizeof(int)*count);
 
     if (m->image == NULL) return;
+    m->flush();
 
-    const float * c = m->image->channel(channel);
-
-    float scale = float(binCount) / rangeMax;
-    float bias = - scale * rangeMin;
-
-    const uint count = m->image->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        float f = c[i] * scale + bias;
-        int idx = ftoi_floor(f);
-        if (idx < 0) idx = 0;
-        if (idx > binCount-1) idx = binCount-1;
-        binPtr[idx]++;
-    }
+    m->image->histogram(channel, rangeMin, rangeMax, binCount, binPtr);
 }
 
 void Surface::range(int channel, float * rangeMin, float * rangeMax, int alpha_channel/*= -1*/, float alpha_ref/*= 0.f*/) const
 {
     Vector2 range(FLT_MAX, -FLT_MAX);
 
-    FloatImage * img = m->image;
-
-    if (alpha_channel == -1) { // no alpha channel; just like the original range function
-
-        if (m->image != NULL) {
-            float * c = img->channel(channel);
-
-            const uint count = img->pixelCount();
-            for (uint p = 0; p < count; p++) {
-                float f = c[p];
-                if (f < range.x) range.x = f;
-                if (f > range.y) range.y = f;
-            }
-        }
-    }
-    else { // use alpha test to ignore some pixels
-        //note, it's quite possible to get FLT_MAX,-FLT_MAX back if all pixels fail the test
+    m->flush();
 
-        if (m->image != NULL)
-        {
-            const float * c = img->channel(channel);
-            const float * a = img->channel(alpha_channel);
-
-            const uint count = img->pixelCount();
-            for (uint p = 0; p < count; p++) {
-                if(a[p]>alpha_ref) {
-                    float f = c[p];
-                    if (f < range.x) range.x = f;
-                    if (f > range.y) range.y = f;
-                }
-            }
-        }
+    // With an alpha channel, texels that fail the alpha test are ignored. It's quite possible to get FLT_MAX,-FLT_MAX back if all pixels fail the test.
+    if (m->image != NULL) {
+        m->image->range(channel, &range.x, &range.y, alpha_channel, alpha_ref);
     }
 
     *rangeMin = range.x;
@@ -470,14 +529,10 @@ void Surface::range(int channel, float * rangeMin, float * rangeMax, int alpha_c
 }
 
 
-bool Surface::load(const char * fileName, bool * hasAlpha/*= NULL*/)
+// Replace the texels of the surface with a loaded image.
+static void setLoadedImage(Surface::Private *& m, FloatImage * img, bool * hasAlpha)
 {
-    AutoPtr<FloatImage> img(ImageIO::loadFloat(fileName));
-    if (img == NULL) {
-        return false;
-    }
-
-    detach();
+    detachTexels(m);
 
     if (hasAlpha != NULL) {
         *hasAlpha = (img->componentCount() == 4);
@@ -487,7 +542,19 @@ bool Surface::load(const char * fileName, bool * hasAlpha/*= NULL*/)
     img->resizeChannelCount(4);
 
     delete m->image;
-    m->image = img.release();
+    m->image = img;
+}
+
+bool Surface::load(const char * fileName, bool * hasAlpha/*= NULL*/)
+{
+    NVTT_PROFILE("load", 0);
+
+    FloatImage * img = ImageIO::loadFloat(fileName);
+    if (img == NULL) {
+        return false;
+    }
+
+    setLoadedImage(m, img, hasAlpha);
 
     return true;
 }
@@ -497,6 +564,7 @@ bool Surface::save(const char * fileName, bool hasAlpha/*=0*/, bool hdr/*=0*/) c
     if (m->image == NULL) {
         return false;
     }
+    m->flush();
 
     if (hdr) {
         return ImageIO::saveFloat(fileName, m->image, 0, 4);
@@ -516,7 +584,7 @@ bool Surface::save(const char * fileName, bool hasAlpha/*=0*/, bool hdr/*=0*/) c
 
 bool Surface::setImage(int w, int h, int d)
 {
-    detach();
+    detachTexels(m);
 
     if (m->image == NULL) {
         m->image = new FloatImage();
@@ -555,335 +623,390 @@ static int filter(unsigned int code, struct _EXCEPTION_POINTERS *ep) {
 
 #endif
 
-bool Surface::setImage(nvtt::InputFormat format, int w, int h, int d, const void * data)
+namespace
 {
-    detach();
+    // Conversions of at least this many texels are split across the task scheduler.
+    const uint kParallelInputThreshold = 64 * 1024;
 
-    if (m->image == NULL) {
-        m->image = new FloatImage();
-    }
-    m->image->allocate(4, w, h, d);
-    m->type = (d == 1) ? TextureType_2D : TextureType_3D;
+    // Texels per task. A multiple of 16, so every task but the last one starts on a 16 byte boundary.
+    const uint kInputTaskSize = 16 * 1024;
 
-    const int count = m->image->pixelCount();
+    // Images this large do not fit in the cache, so their texels are written with non-temporal stores.
+    const uint kStreamingInputThreshold = 512 * 1024;
 
-    float * rdst = m->image->channel(0);
-    float * gdst = m->image->channel(1);
-    float * bdst = m->image->channel(2);
-    float * adst = m->image->channel(3);
+    struct ConvertInputContext
+    {
+        InputFormat format;
+        bool planar;
+        bool stream;
+        const void * src[4];    // One interleaved source, or one source per channel.
+        float * dst[4];
+        uint count;
+        const float * lut;      // Linear values of the 8 bit colors, or NULL.
+        const float * tailLut;  // Values of the texels from lutEnd on, which the conversions compute without SIMD.
+        uint lutEnd;
+        uint width;
+        uint pitch;             // Bytes between the rows of the interleaved source, 0 when they are packed.
+    };
+
+#if NV_USE_SSE > 1
+    static inline void storeTexels(float * dst, __m128 v, bool stream)
+    {
+        if (stream) _mm_stream_ps(dst, v);
+        else _mm_storeu_ps(dst, v);
+    }
 
-    if (format == InputFormat_BGRA_8UB)
+    // Writes 4 interleaved RGBA texels to the channels.
+    static inline void storeInterleaved(float * const * dst, uint i, __m128 t0, __m128 t1, __m128 t2, __m128 t3, bool stream)
     {
-        const Color32 * src = (const Color32 *)data;
+        _MM_TRANSPOSE4_PS(t0, t1, t2, t3);
+        storeTexels(dst[0] + i, t0, stream);
+        storeTexels(dst[1] + i, t1, stream);
+        storeTexels(dst[2] + i, t2, stream);
+        storeTexels(dst[3] + i, t3, stream);
+    }
+#endif
 
-        TRY {
-            for (int i = 0; i < count; i++)
-            {
-                rdst[i] = float(src[i].r) / 255.0f;
-                gdst[i] = float(src[i].g) / 255.0f;
-                bdst[i] = float(src[i].b) / 255.0f;
-                adst[i] = float(src[i].a) / 255.0f;
+    // Converts the color channels to linear space like toLinear or toLinearFromSrgb. With setApproximateGamma toLinearFromSrgb
+    // uses a SIMD approximation for the texels before lutEnd, the last multiple of 4, and the exact function for the rest.
+    static void convertBGRA8Linear(const ConvertInputContext & c, uint begin, uint end)
+    {
+        for (uint i = begin; i < end; i++) {
+            Color32 t;
+            if (c.planar) {
+                t.r = ((const uint8 *)c.src[0])[i];
+                t.g = ((const uint8 *)c.src[1])[i];
+                t.b = ((const uint8 *)c.src[2])[i];
+                t.a = ((const uint8 *)c.src[3])[i];
             }
-        }
-        CATCH {
-            return false;
+            else {
+                t = ((const Color32 *)c.src[0])[i];
+            }
+
+            if (i < c.lutEnd) {
+                c.dst[0][i] = c.lut[t.r];
+                c.dst[1][i] = c.lut[t.g];
+                c.dst[2][i] = c.lut[t.b];
+            }
+            else {
+                c.dst[0][i] = c.tailLut[t.r];
+                c.dst[1][i] = c.tailLut[t.g];
+                c.dst[2][i] = c.tailLut[t.b];
+            }
+            c.dst[3][i] = float(t.a) / 255.0f;
         }
     }
-    else if (format == InputFormat_RGBA_16F)
-    {
-        const uint16 * src = (const uint16 *)data;
 
-        TRY {
-            for (int i = 0; i < count; i++)
-            {
-                ((uint32 *)rdst)[i] = half_to_float(src[4*i+0]);
-                ((uint32 *)gdst)[i] = half_to_float(src[4*i+1]);
-                ((uint32 *)bdst)[i] = half_to_float(src[4*i+2]);
-                ((uint32 *)adst)[i] = half_to_float(src[4*i+3]);
+    static void convertBGRA8(const ConvertInputContext & c, uint begin, uint end)
+    {
+        if (c.lut != NULL) {
+            convertBGRA8Linear(c, begin, end);
+            return;
+        }
+
+        uint i = begin;
+
+        if (c.planar) {
+            for (int k = 0; k < 4; k++) {
+                const uint8 * src = (const uint8 *)c.src[k];
+                float * dst = c.dst[k];
+                i = begin;
+#if NV_USE_SSE > 1
+                const __m128i zero = _mm_setzero_si128();
+                const __m128 scale = _mm_set1_ps(255.0f);
+                for (; i + 16 <= end; i += 16) {
+                    const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+                    const __m128i lo = _mm_unpacklo_epi8(v, zero);
+                    const __m128i hi = _mm_unpackhi_epi8(v, zero);
+                    // Divide rather than multiply by the reciprocal to match the scalar loop exactly.
+                    storeTexels(dst + i + 0,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale), c.stream);
+                    storeTexels(dst + i + 4,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale), c.stream);
+                    storeTexels(dst + i + 8,  _mm_div_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale), c.stream);
+                    storeTexels(dst + i + 12, _mm_div_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale), c.stream);
+                }
+#endif
+                for (; i < end; i++) dst[i] = float(src[i]) / 255.0f;
             }
+            return;
+        }
+
+        const Color32 * src = (const Color32 *)c.src[0];
+        float * rdst = c.dst[0];
+        float * gdst = c.dst[1];
+        float * bdst = c.dst[2];
+        float * adst = c.dst[3];
+
+#if NV_USE_SSE > 1
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        for (; i + 4 <= end; i += 4) {
+            // Color32 is stored as b, g, r, a.
+            const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            storeTexels(bdst + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(v, mask)), scale), c.stream);
+            storeTexels(gdst + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 8), mask)), scale), c.stream);
+            storeTexels(rdst + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 16), mask)), scale), c.stream);
+            storeTexels(adst + i, _mm_div_ps(_mm_cvtepi32_ps(_mm_srli_epi32(v, 24)), scale), c.stream);
         }
-        CATCH {
-            return false;
+#endif
+        for (; i < end; i++) {
+            rdst[i] = float(src[i].r) / 255.0f;
+            gdst[i] = float(src[i].g) / 255.0f;
+            bdst[i] = float(src[i].b) / 255.0f;
+            adst[i] = float(src[i].a) / 255.0f;
         }
     }
-    else if (format == InputFormat_RGBA_32F)
+
+    static void convertRGBA16F(const ConvertInputContext & c, uint begin, uint end)
     {
-        const float * src = (const float *)data;
+        uint i = begin;
 
-        TRY {
-            for (int i = 0; i < count; i++)
-            {
-                rdst[i] = src[4 * i + 0];
-                gdst[i] = src[4 * i + 1];
-                bdst[i] = src[4 * i + 2];
-                adst[i] = src[4 * i + 3];
+        if (c.planar) {
+            for (int k = 0; k < 4; k++) {
+                const uint16 * src = (const uint16 *)c.src[k];
+                float * dst = c.dst[k];
+                half_to_float_array(src + begin, dst + begin, end - begin);
             }
+            return;
         }
-        CATCH {
-            return false;
-        }
-    }
-    else if (format == InputFormat_R_32F)
-    {
-        const float * src = (const float *)data;
 
-        TRY {
-            for (int i = 0; i < count; i++)
-            {
-                rdst[i] = src[i];
-                gdst[i] = 0;
-                bdst[i] = 0;
-                adst[i] = 0;
+        const uint16 * src = (const uint16 *)c.src[0];
+
+#if NV_USE_SSE > 1
+        // Expand a few texels at a time into a buffer that stays in L1, then transpose them into the channels.
+        const uint kChunkSize = 256;
+        NV_ALIGN_16 float tmp[4 * kChunkSize];
+
+        while (i + 4 <= end) {
+            const uint n = min(kChunkSize, (end - i) & ~3U);
+            half_to_float_array(src + 4 * i, tmp, 4 * n);
+
+            for (uint j = 0; j < n; j += 4, i += 4) {
+                storeInterleaved(c.dst, i, _mm_load_ps(tmp + 4 * j + 0), _mm_load_ps(tmp + 4 * j + 4),
+                    _mm_load_ps(tmp + 4 * j + 8), _mm_load_ps(tmp + 4 * j + 12), c.stream);
             }
         }
-        CATCH {
-            return false;
+#endif
+        for (; i < end; i++) {
+            ((uint32 *)c.dst[0])[i] = half_to_float(src[4*i+0]);
+            ((uint32 *)c.dst[1])[i] = half_to_float(src[4*i+1]);
+            ((uint32 *)c.dst[2])[i] = half_to_float(src[4*i+2]);
+            ((uint32 *)c.dst[3])[i] = half_to_float(src[4*i+3]);
         }
     }
 
-    return true;
-}
-
-bool Surface::setImage(InputFormat format, int w, int h, int d, const void * r, const void * g, const void * b, const void * a)
-{
-    detach();
+    static void copyChannel(float * dst, const float * src, uint begin, uint end, bool stream)
+    {
+        if (!stream) {
+            memcpy(dst + begin, src + begin, (end - begin) * sizeof(float));
+            return;
+        }
 
-    if (m->image == NULL) {
-        m->image = new FloatImage();
+        uint i = begin;
+#if NV_USE_SSE > 1
+        for (; i + 4 <= end; i += 4) storeTexels(dst + i, _mm_loadu_ps(src + i), true);
+#endif
+        for (; i < end; i++) dst[i] = src[i];
     }
-    m->image->allocate(4, w, h, d);
-    m->type = (d == 1) ? TextureType_2D : TextureType_3D;
 
-    const int count = m->image->pixelCount();
+    static void clearChannel(float * dst, uint begin, uint end, bool stream)
+    {
+        if (!stream) {
+            memset(dst + begin, 0, (end - begin) * sizeof(float));
+            return;
+        }
 
-    float * rdst = m->image->channel(0);
-    float * gdst = m->image->channel(1);
-    float * bdst = m->image->channel(2);
-    float * adst = m->image->channel(3);
+        uint i = begin;
+#if NV_USE_SSE > 1
+        for (; i + 4 <= end; i += 4) storeTexels(dst + i, _mm_setzero_ps(), true);
+#endif
+        for (; i < end; i++) dst[i] = 0;
+    }
 
-    if (format == InputFormat_BGRA_8UB)
+    static void convertRGBA32F(const ConvertInputContext & c, uint begin, uint end)
     {
-        const uint8 * rsrc = (const uint8 *)r;
-        const uint8 * gsrc = (const uint8 *)g;
-        const uint8 * bsrc = (const uint8 *)b;
-        const uint8 * asrc = (const uint8 *)a;
+        if (c.planar) {
+            for (int k = 0; k < 4; k++) copyChannel(c.dst[k], (const float *)c.src[k], begin, end, c.stream);
+            return;
+        }
 
-        TRY {
-            for (int i = 0; i < count; i++) rdst[i] = float(rsrc[i]) / 255.0f;
-            for (int i = 0; i < count; i++) gdst[i] = float(gsrc[i]) / 255.0f;
-            for (int i = 0; i < count; i++) bdst[i] = float(bsrc[i]) / 255.0f;
-            for (int i = 0; i < count; i++) adst[i] = float(asrc[i]) / 255.0f;
+        const float * src = (const float *)c.src[0];
+        uint i = begin;
+
+#if NV_USE_SSE > 1
+        for (; i + 4 <= end; i += 4) {
+            storeInterleaved(c.dst, i, _mm_loadu_ps(src + 4 * i + 0), _mm_loadu_ps(src + 4 * i + 4),
+                _mm_loadu_ps(src + 4 * i + 8), _mm_loadu_ps(src + 4 * i + 12), c.stream);
         }
-        CATCH {
-            return false;
+#endif
+        for (; i < end; i++) {
+            c.dst[0][i] = src[4 * i + 0];
+            c.dst[1][i] = src[4 * i + 1];
+            c.dst[2][i] = src[4 * i + 2];
+            c.dst[3][i] = src[4 * i + 3];
         }
     }
-    else if (format == InputFormat_RGBA_16F)
+
+    static void convertR32F(const ConvertInputContext & c, uint begin, uint end)
+    {
+        // Both overloads read the red channel from the first source.
+        copyChannel(c.dst[0], (const float *)c.src[0], begin, end, c.stream);
+        clearChannel(c.dst[1], begin, end, c.stream);
+        clearChannel(c.dst[2], begin, end, c.stream);
+        clearChannel(c.dst[3], begin, end, c.stream);
+    }
+
+    static void convertTexels(const ConvertInputContext & c, uint begin, uint end)
     {
-        const uint16 * rsrc = (const uint16 *)r;
-        const uint16 * gsrc = (const uint16 *)g;
-        const uint16 * bsrc = (const uint16 *)b;
-        const uint16 * asrc = (const uint16 *)a;
+        switch (c.format) {
+            case InputFormat_BGRA_8UB: convertBGRA8(c, begin, end); break;
+            case InputFormat_RGBA_16F: convertRGBA16F(c, begin, end); break;
+            case InputFormat_RGBA_32F: convertRGBA32F(c, begin, end); break;
+            case InputFormat_R_32F: convertR32F(c, begin, end); break;
+        }
+    }
 
-        TRY {
-            for (int i = 0; i < count; i++) ((uint32 *)rdst)[i] = half_to_float(rsrc[i]);
-            for (int i = 0; i < count; i++) ((uint32 *)gdst)[i] = half_to_float(gsrc[i]);
-            for (int i = 0; i < count; i++) ((uint32 *)bdst)[i] = half_to_float(bsrc[i]);
-            for (int i = 0; i < count; i++) ((uint32 *)adst)[i] = half_to_float(asrc[i]);
+    static uint inputTexelSize(InputFormat format)
+    {
+        switch (format) {
+            case InputFormat_BGRA_8UB: return 4 * sizeof(uint8);
+            case InputFormat_RGBA_16F: return 4 * sizeof(uint16);
+            case InputFormat_RGBA_32F: return 4 * sizeof(float);
+            case InputFormat_R_32F: return sizeof(float);
         }
-        CATCH {
-            return false;
+        return 0;
+    }
+
+    // Converts the texels of rows that are pitch bytes apart one row at a time. The source of each row is moved back by the
+    // padding of the rows before it, so that the converters index it as if the rows were packed.
+    static void convertRows(const ConvertInputContext & c, uint begin, uint end)
+    {
+        const uint padding = c.pitch - c.width * inputTexelSize(c.format);
+
+        ConvertInputContext row = c;
+        for (uint i = begin; i < end; ) {
+            const uint y = i / c.width;
+            const uint rowEnd = min(end, (y + 1) * c.width);
+
+            row.src[0] = (const uint8 *)c.src[0] + y * padding;
+            convertTexels(row, i, rowEnd);
+            i = rowEnd;
         }
     }
-    else if (format == InputFormat_RGBA_32F)
+
+    static void ConvertInputTask(void * context, int begin, int end)
     {
-        const float * rsrc = (const float *)r;
-        const float * gsrc = (const float *)g;
-        const float * bsrc = (const float *)b;
-        const float * asrc = (const float *)a;
+        const ConvertInputContext * c = (const ConvertInputContext *)context;
 
-        TRY {
-            memcpy(rdst, rsrc, count * sizeof(float));
-            memcpy(gdst, gsrc, count * sizeof(float));
-            memcpy(bdst, bsrc, count * sizeof(float));
-            memcpy(adst, asrc, count * sizeof(float));
+        for (int t = begin; t < end; t++) {
+            const uint first = uint(t) * kInputTaskSize;
+            const uint last = min(c->count, first + kInputTaskSize);
+
+            if (c->pitch != 0) convertRows(*c, first, last);
+            else convertTexels(*c, first, last);
         }
-        CATCH {
-            return false;
+
+#if NV_USE_SSE > 1
+        if (c->stream) {
+            // Make the non-temporal stores visible before the task is reported as done.
+            _mm_sfence();
         }
+#endif
     }
-    else if (format == InputFormat_R_32F)
+
+    // Converts the input texels into the four float channels of the image. 8 bit colors are converted to linear space
+    // through lut when given, the table of the conversion for each of the 256 values, and tailLut, the table of its
+    // scalar path. The rows of interleaved texels are pitch bytes apart, or packed when pitch is 0.
+    static void convertInput(InputFormat format, const void * const * src, bool planar, FloatImage * image, const float * lut = NULL, const float * tailLut = NULL, uint pitch = 0)
     {
-        const float * rsrc = (const float *)r;
+        ConvertInputContext context;
+        context.format = format;
+        context.planar = planar;
+        context.count = image->pixelCount();
+        context.lut = lut;
+#if NV_USE_SSE > 1
+        context.lutEnd = context.count & ~3U;
+#else
+        context.lutEnd = context.count;
+#endif
+        context.tailLut = tailLut;
+        context.width = image->width();
+        context.pitch = (planar || pitch == context.width * inputTexelSize(format)) ? 0 : pitch;
 
-        TRY {
-            memcpy(rdst, rsrc, count * sizeof(float));
-            memset(gdst, 0, count * sizeof(float));
-            memset(bdst, 0, count * sizeof(float));
-            memset(adst, 0, count * sizeof(float));
+        bool aligned = true;
+        for (int k = 0; k < 4; k++) {
+            context.src[k] = src[k];
+            context.dst[k] = image->channel(k);
+            aligned &= (intptr_t(context.dst[k]) & 15) == 0;
         }
-        CATCH {
-            return false;
+
+#if NV_USE_SSE > 1
+        // Rows that don't start on a 16 byte boundary of the channels are not streamed.
+        aligned &= context.pitch == 0 || (context.width & 3) == 0;
+        context.stream = aligned && context.count >= kStreamingInputThreshold && (cpuFeatures() & CpuFeature_StreamingStores) != 0;
+#else
+        context.stream = false;
+#endif
+
+        const uint taskCount = (context.count + kInputTaskSize - 1) / kInputTaskSize;
+
+        if (context.count < kParallelInputThreshold) {
+            ConvertInputTask(&context, 0, taskCount);
+        }
+        else {
+            TaskScheduler::global()->parallelFor(ConvertInputTask, &context, taskCount, 1);
         }
     }
+}
 
-    return true;
+static bool setImageThroughLut(Surface::Private * m, InputFormat format, int w, int h, int d, const void * data, uint pitch, const float * lut, const float * tailLut);
+
+bool Surface::setImage(nvtt::InputFormat format, int w, int h, int d, const void * data)
+{
+    detachTexels(m);
+
+    return setImageThroughLut(m, format, w, h, d, data, 0, NULL, NULL);
 }
 
-// @@ Add support for compressed 3D textures.
-bool Surface::setImage2D(Format format, Decoder decoder, int w, int h, const void * data)
+bool Surface::setImage(InputFormat format, int w, int h, int d, const void * r, const void * g, const void * b, const void * a)
 {
-    if (format != nvtt::Format_BC1 &&
-        format != nvtt::Format_BC2 &&
-        format != nvtt::Format_BC3 &&
-        format != nvtt::Format_BC4 &&
-        format != nvtt::Format_BC5 &&
-        format != nvtt::Format_BC6 &&
-        format != nvtt::Format_BC7)
-    {
+    detachTexels(m);
+
+    if (m->image == NULL) {
+        m->image = new FloatImage();
+    }
+    m->image->allocate(4, w, h, d);
+    m->type = (d == 1) ? TextureType_2D : TextureType_3D;
+
+    const void * src[4] = { r, g, b, a };
+
+    TRY {
+        convertInput(format, src, /*planar=*/true, m->image);
+    }
+    CATCH {
         return false;
     }
 
-    detach();
+    return true;
+}
+
+static PixelOp exponentiateOp(int channel, int count, float power, bool approximate);
+static void exponentiateTexels(const PixelOp & op, float * const c[4], uint begin, uint end);
+static float fromSrgb(float f);
+static void fromSrgbTexels(float * const c[4], uint begin, uint end, bool approximate);
 
+// Decode the 8 bit texels through the tables of the 256 linear values when given, see convertInput.
+static bool setImageThroughLut(Surface::Private * m, InputFormat format, int w, int h, int d, const void * data, uint pitch, const float * lut, const float * tailLut)
+{
     if (m->image == NULL) {
         m->image = new FloatImage();
     }
-    m->image->allocate(4, w, h, 1);
-    m->type = TextureType_2D;
-
-    const int bw = (w + 3) / 4;
-    const int bh = (h + 3) / 4;
-
-    const uint bs = blockSize(format);
+    m->image->allocate(4, w, h, d);
+    m->type = (d == 1) ? TextureType_2D : TextureType_3D;
 
-    const uint8 * ptr = (const uint8 *)data;
+    const void * src[4] = { data, NULL, NULL, NULL };
 
     TRY {
-		if (format == nvtt::Format_BC6)
-		{
-			// BC6 format - decode directly to float
-
-			for (int y = 0; y < bh; y++)
-			{
-				for (int x = 0; x < bw; x++)
-				{
-					ColorSet colors;
-					const BlockBC6 * block = (const BlockBC6 *)ptr;
-					block->decodeBlock(&colors);
-
-					for (int yy = 0; yy < 4; yy++)
-					{
-						for (int xx = 0; xx < 4; xx++)
-						{
-							Vector4 rgba = colors.colors[yy*4 + xx];
-
-							if (x * 4 + xx < w && y * 4 + yy < h)
-							{
-								m->image->pixel(0, x*4 + xx, y*4 + yy, 0) = rgba.x;
-								m->image->pixel(1, x*4 + xx, y*4 + yy, 0) = rgba.y;
-								m->image->pixel(2, x*4 + xx, y*4 + yy, 0) = rgba.z;
-								m->image->pixel(3, x*4 + xx, y*4 + yy, 0) = rgba.w;
-							}
-						}
-					}
-
-					ptr += bs;
-				}
-			}
-		}
-		else
-		{
-			// Non-BC6 - decode to 8-bit, then convert to float
-
-			for (int y = 0; y < bh; y++)
-			{
-				for (int x = 0; x < bw; x++)
-				{
-					ColorBlock colors;
-
-					if (format == nvtt::Format_BC1)
-					{
-						const BlockDXT1 * block = (const BlockDXT1 *)ptr;
-
-						if (decoder == Decoder_D3D10) {
-							block->decodeBlock(&colors, false);
-						}
-						else if (decoder == Decoder_D3D9) {
-							block->decodeBlock(&colors, false);
-						}
-						else if (decoder == Decoder_NV5x) {
-							block->decodeBlockNV5x(&colors);
-						}
-					}
-					else if (format == nvtt::Format_BC2)
-					{
-						const BlockDXT3 * block = (const BlockDXT3 *)ptr;
-
-						if (decoder == Decoder_D3D10) {
-							block->decodeBlock(&colors, false);
-						}
-						else if (decoder == Decoder_D3D9) {
-							block->decodeBlock(&colors, false);
-						}
-						else if (decoder == Decoder_NV5x) {
-							block->decodeBlockNV5x(&colors);
-						}
-					}
-					else if (format == nvtt::Format_BC3)
-					{
-						const BlockDXT5 * block = (const BlockDXT5 *)ptr;
-
-						if (decoder == Decoder_D3D10) {
-							block->decodeBlock(&colors, false);
-						}
-						else if (decoder == Decoder_D3D9) {
-							block->decodeBlock(&colors, false);
-						}
-						else if (decoder == Decoder_NV5x) {
-							block->decodeBlockNV5x(&colors);
-						}
-					}
-					else if (format == nvtt::Format_BC4)
-					{
-						const BlockATI1 * block = (const BlockATI1 *)ptr;
-						block->decodeBlock(&colors, decoder == Decoder_D3D9);
-					}
-					else if (format == nvtt::Format_BC5)
-					{
-						const BlockATI2 * block = (const BlockATI2 *)ptr;
-						block->decodeBlock(&colors, decoder == Decoder_D3D9);
-					}
-					else if (format == nvtt::Format_BC7)
-					{
-						const BlockBC7 * block = (const BlockBC7 *)ptr;
-						block->decodeBlock(&colors);
-					}
-					else
-					{
-						nvDebugCheck(false);
-					}
-
-					for (int yy = 0; yy < 4; yy++)
-					{
-						for (int xx = 0; xx < 4; xx++)
-						{
-							Color32 c = colors.color(xx, yy);
-
-							if (x * 4 + xx < w && y * 4 + yy < h)
-							{
-								m->image->pixel(0, x*4 + xx, y*4 + yy, 0) = float(c.r) * 1.0f/255.0f;
-								m->image->pixel(1, x*4 + xx, y*4 + yy, 0) = float(c.g) * 1.0f/255.0f;
-								m->image->pixel(2, x*4 + xx, y*4 + yy, 0) = float(c.b) * 1.0f/255.0f;
-								m->image->pixel(3, x*4 + xx, y*4 + yy, 0) = float(c.a) * 1.0f/255.0f;
-							}
-						}
-					}
-
-					ptr += bs;
-				}
-			}
-		}
+        convertInput(format, src, /*planar=*/false, m->image, lut, tailLut, pitch);
     }
     CATCH {
         return false;
@@ -892,16 +1015,131 @@ bool Surface::setImage2D(Format format, Decoder decoder, int w, int h, const voi
     return true;
 }
 
+bool Surface::setImageLinear(InputFormat format, int w, int h, int d, const void * data, float gamma)
+{
+    return nvtt::setImageLinear(*this, format, w, h, d, data, 0, gamma);
+}
 
-static void getDefaultFilterWidthAndParams(int filter, float * filterWidth, float params[2])
+bool nvtt::setImageLinear(Surface & img, InputFormat format, int w, int h, int d, const void * data, uint pitch, float gamma)
 {
-    if (filter == ResizeFilter_Box) {
-        *filterWidth = 0.5f;
+    Surface::Private *& m = img.m;
+    detachTexels(m);
+
+    if (format != InputFormat_BGRA_8UB || equal(gamma, 1.0f)) {
+        if (!setImageThroughLut(m, format, w, h, d, data, pitch, NULL, NULL)) {
+            return false;
+        }
+        img.toLinear(gamma);
+        return true;
     }
-    else if (filter == ResizeFilter_Triangle) {
-        *filterWidth = 1.0f;
+
+    // The values toLinear computes for each of the 256 colors, the same for all the texels.
+    float lut[256];
+    for (int i = 0; i < 256; i++) {
+        lut[i] = float(i) / 255.0f;
     }
-    else if (filter == ResizeFilter_Kaiser)
+    float * const c[4] = { lut, NULL, NULL, NULL };
+    exponentiateTexels(exponentiateOp(0, 1, gamma, m->approximateGamma), c, 0, 256);
+
+    return setImageThroughLut(m, format, w, h, d, data, pitch, lut, lut);
+}
+
+bool Surface::setImageLinearFromSrgb(InputFormat format, int w, int h, int d, const void * data)
+{
+    if (format != InputFormat_BGRA_8UB) {
+        if (!setImage(format, w, h, d, data)) {
+            return false;
+        }
+        toLinearFromSrgb();
+        return true;
+    }
+
+    detachTexels(m);
+
+    // The values toLinearFromSrgb computes for each of the 256 colors, it converts three channels.
+    float lut[3][256], tailLut[256];
+    for (int i = 0; i < 256; i++) {
+        lut[0][i] = lut[1][i] = lut[2][i] = float(i) / 255.0f;
+        tailLut[i] = ::fromSrgb(lut[0][i]);
+    }
+    float * const c[4] = { lut[0], lut[1], lut[2], NULL };
+    fromSrgbTexels(c, 0, 256, m->approximateGamma);
+
+    return setImageThroughLut(m, format, w, h, d, data, 0, lut[0], tailLut);
+}
+
+bool Surface::setImageView(int w, int h, int d, const float * data)
+{
+    if (data == NULL) return false;
+
+    detachTexels(m);
+
+    if (m->image == NULL) {
+        m->image = new FloatImage();
+    }
+    m->image->wrap(const_cast<float *>(data), 4, w, h, d);
+    m->type = (d == 1) ? TextureType_2D : TextureType_3D;
+
+    return true;
+}
+
+// @@ Add support for compressed 3D textures.
+bool Surface::setImage2D(Format format, Decoder decoder, int w, int h, const void * data)
+{
+    if (format != nvtt::Format_BC1 &&
+        format != nvtt::Format_BC2 &&
+        format != nvtt::Format_BC3 &&
+        format != nvtt::Format_BC4 &&
+        format != nvtt::Format_BC5 &&
+        format != nvtt::Format_BC6 &&
+        format != nvtt::Format_BC7)
+    {
+        return false;
+    }
+
+    detachTexels(m);
+
+    if (m->image == NULL) {
+        m->image = new FloatImage();
+    }
+    m->image->allocate(4, w, h, 1);
+    m->type = TextureType_2D;
+
+    BlockFormat blockFormat;
+    if (format == nvtt::Format_BC1) blockFormat = BlockFormat_BC1;
+    else if (format == nvtt::Format_BC2) blockFormat = BlockFormat_BC2;
+    else if (format == nvtt::Format_BC3) blockFormat = BlockFormat_BC3;
+    else if (format == nvtt::Format_BC4) blockFormat = BlockFormat_BC4;
+    else if (format == nvtt::Format_BC5) blockFormat = BlockFormat_BC5;
+    else if (format == nvtt::Format_BC6) blockFormat = BlockFormat_BC6;
+    else blockFormat = BlockFormat_BC7;
+
+    // The D3D9 decoder only rounds the BC4 and BC5 palettes differently.
+    BlockDecoder blockDecoder = BlockDecoder_D3D10;
+    if (decoder == Decoder_NV5x) blockDecoder = BlockDecoder_NV5x;
+    else if (decoder == Decoder_D3D9 && (format == nvtt::Format_BC4 || format == nvtt::Format_BC5)) blockDecoder = BlockDecoder_D3D9;
+
+    TRY {
+        // Decode straight into the planes of the image, rows of blocks in parallel.
+        decodeSurface(blockFormat, blockDecoder, w, h, data, m->image->channel(0), m->image->pixelCount());
+    }
+    CATCH {
+        return false;
+    }
+
+    return true;
+}
+
+
+static void getDefaultFilterWidthAndParams(int filter, float * filterWidth, float params[2])
+{
+    if (filter == ResizeFilter_Box) {
+        *filterWidth = 0.5f;
+    }
+    else if (filter == ResizeFilter_Triangle) {
+        *filterWidth = 1.0f;
+    }
+    else if (filter == ResizeFilter_Kaiser)
     {
         *filterWidth = 3.0f;
         params[0] = 4.0f;
@@ -924,71 +1162,78 @@ void Surface::resize(int w, int h, int d, ResizeFilter filter)
     resize(w, h, d, filter, filterWidth, params);
 }
 
+static Filter * createResizeFilter(ResizeFilter filter, float filterWidth, const float * params)
+{
+    if (filter == ResizeFilter_Box)
+    {
+        return new BoxFilter(filterWidth);
+    }
+    else if (filter == ResizeFilter_Triangle)
+    {
+        return new TriangleFilter(filterWidth);
+    }
+    else if (filter == ResizeFilter_Kaiser)
+    {
+        KaiserFilter * kaiser = new KaiserFilter(filterWidth);
+        if (params != NULL) kaiser->setParameters(params[0], params[1]);
+        return kaiser;
+    }
+    else //if (filter == ResizeFilter_Mitchell)
+    {
+        nvDebugCheck(filter == ResizeFilter_Mitchell);
+        MitchellFilter * mitchell = new MitchellFilter();
+        if (params != NULL) mitchell->setParameters(params[0], params[1]);
+        return mitchell;
+    }
+}
+
 void Surface::resize(int w, int h, int d, ResizeFilter filter, float filterWidth, const float * params)
 {
     if (isNull() || (w == width() && h == height() && d == depth())) {
         return;
     }
 
-    detach();
+    NVTT_PROFILE("resize", w * h * d);
 
-    FloatImage * img = m->image;
+    AutoPtr<Filter> resizeFilter(createResizeFilter(filter, filterWidth, params));
 
     FloatImage::WrapMode wrapMode = (FloatImage::WrapMode)m->wrapMode;
 
-    if (m->alphaMode == AlphaMode_Transparency)
+    // Resample the texels of 2D surfaces packed in 8 bits without expanding them, the result stays packed.
+    if (m->storageFormat == StorageFormat_UNorm8 && m->ops.isEmpty() && m->alphaMode != AlphaMode_Transparency && depth() == 1 && d == 1)
     {
-        if (filter == ResizeFilter_Box)
-        {
-            BoxFilter filter(filterWidth);
-            img = img->resize(filter, w, h, d, wrapMode, 3);
-        }
-        else if (filter == ResizeFilter_Triangle)
-        {
-            TriangleFilter filter(filterWidth);
-            img = img->resize(filter, w, h, d, wrapMode, 3);
-        }
-        else if (filter == ResizeFilter_Kaiser)
-        {
-            KaiserFilter filter(filterWidth);
-            if (params != NULL) filter.setParameters(params[0], params[1]);
-            img = img->resize(filter, w, h, d, wrapMode, 3);
-        }
-        else //if (filter == ResizeFilter_Mitchell)
+        Array<uint8> packed;
+        packed.resize(w * h * 4);
+
+        if (resampleUNorm8(m->packed.buffer(), width(), height(), 4, *resizeFilter, w, h, wrapMode, packed.buffer()))
         {
-            nvDebugCheck(filter == ResizeFilter_Mitchell);
-            MitchellFilter filter;
-            if (params != NULL) filter.setParameters(params[0], params[1]);
-            img = img->resize(filter, w, h, d, wrapMode, 3);
+            detachTexels(m);
+
+            FloatImage * img = new FloatImage();
+            img->allocate(0, w, h, 1);   // Only the extents.
+
+            delete m->image;
+            m->image = img;
+            swap(m->packed, packed);
+            m->storageFormat = StorageFormat_UNorm8;
+            return;
         }
     }
+
+    m->flush();
+
+    FloatImage * img = m->image;
+
+    if (m->alphaMode == AlphaMode_Transparency)
+    {
+        img = img->resize(*resizeFilter, w, h, d, wrapMode, 3);
+    }
     else
     {
-        if (filter == ResizeFilter_Box)
-        {
-            BoxFilter filter(filterWidth);
-            img = img->resize(filter, w, h, d, wrapMode);
-        }
-        else if (filter == ResizeFilter_Triangle)
-        {
-            TriangleFilter filter(filterWidth);
-            img = img->resize(filter, w, h, d, wrapMode);
-        }
-        else if (filter == ResizeFilter_Kaiser)
-        {
-            KaiserFilter filter(filterWidth);
-            if (params != NULL) filter.setParameters(params[0], params[1]);
-            img = img->resize(filter, w, h, d, wrapMode);
-        }
-        else //if (filter == ResizeFilter_Mitchell)
-        {
-            nvDebugCheck(filter == ResizeFilter_Mitchell);
-            MitchellFilter filter;
-            if (params != NULL) filter.setParameters(params[0], params[1]);
-            img = img->resize(filter, w, h, d, wrapMode);
-        }
+        img = img->resize(*resizeFilter, w, h, d, wrapMode);
     }
 
+    detachTexels(m);
     delete m->image;
     m->image = img;
 }
@@ -1075,9 +1320,12 @@ bool Surface::buildNextMipmap(MipmapFilter filter, float filterWidth, const floa
         return false;
     }
 
-    detach();
+    NVTT_PROFILE("build mipmap", width() * height() * depth());
+
+    m->flush();
 
     FloatImage * img = m->image;
+    bool alphaScaled = false;
 
     FloatImage::WrapMode wrapMode = (FloatImage::WrapMode)m->wrapMode;
 
@@ -1106,7 +1354,14 @@ bool Surface::buildNextMipmap(MipmapFilter filter, float filterWidth, const floa
         if (filter == MipmapFilter_Box)
         {
             if (filterWidth == 0.5f && img->depth() == 1) {
-                img = img->fastDownSample();
+                // Bin the coverage of the level as it is built.
+                if (m->alphaCoverage >= 0.0f) {
+                    img = img->fastDownSampleToCoverage(m->alphaCoverage, m->alphaCoverageRef, 3);
+                    alphaScaled = true;
+                }
+                else {
+                    img = img->fastDownSample();
+                }
             }
             else {
                 BoxFilter filter(filterWidth);
@@ -1127,6 +1382,138 @@ bool Surface::buildNextMipmap(MipmapFilter filter, float filterWidth, const floa
         }
     }
 
+    if (m->alphaCoverage >= 0.0f && !alphaScaled) {
+        img->scaleAlphaToCoverage(m->alphaCoverage, m->alphaCoverageRef, 3);
+    }
+
+    detachTexels(m);
+    delete m->image;
+    m->image = img;
+
+    return true;
+}
+
+int Surface::buildMipmapChain(MipmapFilter filter, int count, Surface * mipmaps, int min_size /*= 1*/) const
+{
+    float filterWidth;
+    float params[2];
+    getDefaultFilterWidthAndParams(filter, &filterWidth, params);
+
+    return buildMipmapChain(filter, filterWidth, params, count, mipmaps, min_size);
+}
+
+int Surface::buildMipmapChain(MipmapFilter filter, float filterWidth, const float * params, int count, Surface * mipmaps, int min_size /*= 1*/) const
+{
+    if (isNull()) return 0;
+
+    int levelCount = 0;
+    uint w = width();
+    uint h = height();
+    uint d = depth();
+    while (levelCount < count && nv::canMakeNextMipmap(w, h, d, min_size)) {
+        w = max(1U, w / 2);
+        h = max(1U, h / 2);
+        d = max(1U, d / 2);
+        levelCount++;
+    }
+
+    if (levelCount == 0) {
+        return 0;
+    }
+
+    // The same condition under which buildNextMipmap uses fastDownSample. The chain doesn't scale the alpha of its levels.
+    if (filter == MipmapFilter_Box && filterWidth == 0.5f && depth() == 1 && m->alphaMode != AlphaMode_Transparency && m->alphaCoverage < 0.0f)
+    {
+        NVTT_PROFILE("build mipmap chain", width() * height());
+
+        m->flush();
+
+        Array<FloatImage *> images;
+        images.resize(levelCount);
+        m->image->fastDownSampleChain(levelCount, images.buffer());
+
+        for (int i = 0; i < levelCount; i++) {
+            Surface::Private * p = new Surface::Private(*m, images[i]);
+            p->addRef();
+            mipmaps[i].m->release();
+            mipmaps[i].m = p;
+        }
+    }
+    else
+    {
+        Surface level = *this;
+        for (int i = 0; i < levelCount; i++) {
+            level.buildNextMipmap(filter, filterWidth, params, min_size);
+            mipmaps[i] = level;
+        }
+    }
+
+    return levelCount;
+}
+
+bool Surface::buildNextMipmapToGamma(MipmapFilter filter, float gamma, Surface * mipmap, int min_size /*= 1*/)
+{
+    // The same condition under which buildNextMipmap uses fastDownSample, for texels this surface can convert in place.
+    if (filter != MipmapFilter_Box || equal(gamma, 1.0f) || mipmap == this || !canMakeNextMipmap(min_size) ||
+        depth() != 1 || m->alphaMode == AlphaMode_Transparency || m->deferred || m->refCount() > 1 || m->image->isExternal())
+    {
+        *mipmap = *this;
+        bool result = mipmap->buildNextMipmap(filter, min_size);
+        toGamma(gamma);
+        return result;
+    }
+
+    NVTT_PROFILE("build mipmap", width() * height());
+
+    m->flush();
+
+    FloatImage * img = m->image->fastDownSampleToCoverage(m->alphaCoverage, m->alphaCoverageRef, 3, 0, 3, 1.0f / gamma, m->approximateGamma);
+
+    Surface::Private * p = new Surface::Private(*m, img);
+    p->addRef();
+    mipmap->m->release();
+    mipmap->m = p;
+
+    return true;
+}
+
+// The Toksvig map of the surface m, in a surface with the same settings that is not a normal map.
+static Surface toksvigSurface(const Surface::Private * m, FloatImage * img)
+{
+    Surface s;
+    s.m->release();
+    s.m = new Surface::Private(*m, img);
+    s.m->addRef();
+    s.m->isNormalMap = false;
+    s.m->alphaMode = AlphaMode_None;
+    s.m->alphaCoverage = -1.0f;
+    return s;
+}
+
+bool Surface::buildNextNormalMipmap(MipmapFilter filter, bool normalize, float power/*= 0.0f*/, Surface * toksvig/*= NULL*/, int min_size/*= 1*/)
+{
+    // The same condition under which buildNextMipmap uses fastDownSample.
+    if (filter != MipmapFilter_Box || toksvig == this || !canMakeNextMipmap(min_size) ||
+        depth() != 1 || m->alphaMode == AlphaMode_Transparency)
+    {
+        if (!buildNextMipmap(filter, min_size)) return false;
+        if (toksvig != NULL) *toksvig = createToksvigMap(power);
+        if (normalize) normalizeNormalMap();
+        return true;
+    }
+
+    NVTT_PROFILE("build mipmap", width() * height());
+
+    m->flush();
+
+    FloatImage * toksvigImage = NULL;
+    FloatImage * img = m->image->fastDownSampleNormals(m->alphaCoverage, m->alphaCoverageRef, 3, normalize && m->isNormalMap, power, (toksvig != NULL) ? &toksvigImage : NULL);
+
+    if (toksvig != NULL) {
+        *toksvig = toksvigSurface(m, toksvigImage);
+    }
+
+    detachTexels(m);
     delete m->image;
     m->image = img;
 
@@ -1139,8 +1526,6 @@ bool Surface::buildNextMipmapSolidColor(const float * const color_components)
         return false;
     }
 
-    detach();
-
     FloatImage * img = new FloatImage();
     const uint w = max(1, m->image->m_width / 2);
     const uint h = max(1, m->image->m_height / 2);
@@ -1151,12 +1536,145 @@ bool Surface::buildNextMipmapSolidColor(const float * const color_components)
         img->clear(c, color_components[c]);
     }
 
+    detachTexels(m);
     delete m->image;
     m->image = img;
 
     return true;
 }
 
+namespace
+{
+    // Copies of at least this many texels are split across the task scheduler.
+    const uint kParallelCopyThreshold = 64 * 1024;
+
+    // Texels copied by each task.
+    const uint kCopyTaskSize = 16 * 1024;
+
+    // A box of texels copied from src to dst.
+    struct CopyRegion
+    {
+        const FloatImage * src;
+        int xsrc, ysrc, zsrc;
+        int xsize, ysize, zsize;
+        int xdst, ydst, zdst;
+    };
+
+    struct CopyRegionsContext
+    {
+        FloatImage * dst;
+        const CopyRegion * regions;
+        Array<uint> firstRow;   // First row of each region, the rows of all the channels of all the regions are numbered consecutively.
+    };
+
+    static bool overlap(int a0, int asize, int b0, int bsize)
+    {
+        return a0 < b0 + bsize && b0 < a0 + asize;
+    }
+
+    static bool overlapDst(const CopyRegion & a, const CopyRegion & b)
+    {
+        return overlap(a.xdst, a.xsize, b.xdst, b.xsize) && overlap(a.ydst, a.ysize, b.ydst, b.ysize) && overlap(a.zdst, a.zsize, b.zdst, b.zsize);
+    }
+
+    static bool overlapSrcDst(const CopyRegion & a, const CopyRegion & b)
+    {
+        return overlap(a.xsrc, a.xsize, b.xdst, b.xsize) && overlap(a.ysrc, a.ysize, b.ydst, b.ysize) && overlap(a.zsrc, a.zsize, b.zdst, b.zsize);
+    }
+
+    static void CopyRowsTask(void * context, int begin, int end)
+    {
+        const CopyRegionsContext * ctx = (const CopyRegionsContext *)context;
+        const uint * firstRow = ctx->firstRow.buffer();
+        const uint regionCount = ctx->firstRow.count() - 1;
+
+        // Region of the first row.
+        uint r = 0, last = regionCount;
+        while (r + 1 < last) {
+            const uint mid = (r + last) / 2;
+            if (firstRow[mid] <= uint(begin)) r = mid;
+            else last = mid;
+        }
+
+        for (uint row = uint(begin); row < uint(end); row++) {
+            while (row >= firstRow[r + 1]) r++;
+
+            const CopyRegion & region = ctx->regions[r];
+            const uint i = row - firstRow[r];
+            const uint y = i % region.ysize;
+            const uint z = (i / region.ysize) % region.zsize;
+            const uint c = i / (region.ysize * region.zsize);
+
+            float * d = ctx->dst->channel(c) + ctx->dst->index(region.xdst, region.ydst + y, region.zdst + z);
+            const float * s = region.src->channel(c) + region.src->index(region.xsrc, region.ysrc + y, region.zsrc + z);
+            memcpy(d, s, region.xsize * sizeof(float));
+        }
+    }
+
+    // Copy the regions in order, row by row. The regions must be inside their images, and no region can read texels that
+    // another one writes.
+    static void copyTexels(FloatImage * dst, const CopyRegion * regions, uint count)
+    {
+        CopyRegionsContext context;
+        context.dst = dst;
+        context.regions = regions;
+        context.firstRow.resize(count + 1);
+
+        uint rowCount = 0;
+        uint texelCount = 0;
+        for (uint i = 0; i < count; i++) {
+            context.firstRow[i] = rowCount;
+            rowCount += 4 * regions[i].ysize * regions[i].zsize;
+            texelCount += regions[i].xsize * regions[i].ysize * regions[i].zsize;
+        }
+        context.firstRow[count] = rowCount;
+
+        // Regions that overlap in the destination must be copied in order.
+        bool disjoint = true;
+        for (uint i = 0; i < count && disjoint; i++) {
+            for (uint j = i + 1; j < count && disjoint; j++) {
+                disjoint = !overlapDst(regions[i], regions[j]);
+            }
+        }
+
+        if (rowCount == 0) {
+            return;
+        }
+
+        if (!disjoint || texelCount < kParallelCopyThreshold) {
+            CopyRowsTask(&context, 0, rowCount);
+        }
+        else {
+            const uint step = max(1U, kCopyTaskSize * rowCount / texelCount);
+            TaskScheduler::global()->parallelFor(CopyRowsTask, &context, rowCount, step);
+        }
+    }
+
+    // Copy the regions, that may read texels of dst itself. Those are read from a copy of dst when a region overwrites them.
+    static void copyTexels(FloatImage * dst, Array<CopyRegion> & regions)
+    {
+        AutoPtr<FloatImage> snapshot;
+
+        for (uint i = 0; i < regions.count() && snapshot.ptr() == NULL; i++) {
+            if (regions[i].src != dst) continue;
+            for (uint j = 0; j < regions.count(); j++) {
+                if (overlapSrcDst(regions[i], regions[j])) {
+                    snapshot = dst->clone();
+                    break;
+                }
+            }
+        }
+
+        if (snapshot.ptr() != NULL) {
+            for (uint i = 0; i < regions.count(); i++) {
+                if (regions[i].src == dst) regions[i].src = snapshot.ptr();
+            }
+        }
+
+        copyTexels(dst, regions.buffer(), regions.count());
+    }
+}
+
 void Surface::canvasSize(int w, int h, int d)
 {
     nvDebugCheck(w > 0 && h > 0 && d > 0);
@@ -1165,7 +1683,7 @@ void Surface::canvasSize(int w, int h, int d)
         return;
     }
 
-    detach();
+    m->flush();
 
     FloatImage * img = m->image;
 
@@ -1173,21 +1691,10 @@ void Surface::canvasSize(int w, int h, int d)
     new_img->allocate(4, w, h, d);
     new_img->clear();
 
-    w = min(uint(w), img->width());
-    h = min(uint(h), img->height());
-    d = min(uint(d), img->depth());
-
-    for (int z = 0; z < d; z++) {
-        for (int y = 0; y < h; y++) {
-            for (int x = 0; x < w; x++) {
-                new_img->pixel(0, x, y, z) = img->pixel(0, x, y, z);
-                new_img->pixel(1, x, y, z) = img->pixel(1, x, y, z);
-                new_img->pixel(2, x, y, z) = img->pixel(2, x, y, z);
-                new_img->pixel(3, x, y, z) = img->pixel(3, x, y, z);
-            }
-        }
-    }
+    CopyRegion region = { img, 0, 0, 0, int(min(uint(w), img->width())), int(min(uint(h), img->height())), int(min(uint(d), img->depth())), 0, 0, 0 };
+    copyTexels(new_img, &region, 1);
 
+    detachTexels(m);
     delete m->image;
     m->image = new_img;
     m->type = (d == 1) ? TextureType_2D : TextureType_3D;
@@ -1195,14 +1702,102 @@ void Surface::canvasSize(int w, int h, int d)
 
 
 // Color transforms.
+//
+// The per-texel operations are recorded as a PixelOp and run by Private::flush, in parallel over tiles of texels. Surfaces
+// that are not deferred flush them right away.
+
+static PixelOp pixelOp(PixelOp::Type type, int channel = 0, int count = 4)
+{
+    PixelOp op;
+    op.type = type;
+    op.channel = channel;
+    op.count = count;
+    for (int i = 0; i < 20; i++) op.params[i] = 0.0f;
+    return op;
+}
+
+// Apply the operation, or record it when the surface is deferred.
+static void apply(Surface & surface, const PixelOp & op)
+{
+    Surface::Private *& m = surface.m;
+
+    if (m->refCount() > 1 && !m->deferred)
+    {
+        // Copy the shared texels as the operation runs over them, instead of cloning the image first.
+        m->unpack();
+        const FloatImage * source = m->image;
+
+        FloatImage * image = new FloatImage;
+        image->allocate(4, source->width(), source->height(), source->depth());
+
+        m->release();
+        m = new Surface::Private(*m, image);
+        m->addRef();
+
+        m->ops.append(op);
+        m->flush(source);
+        return;
+    }
+
+    // Get our own copy of the texels and of the pending operations, without running them.
+    if (m->refCount() > 1)
+    {
+        m->release();
+        m = new Surface::Private(*m);
+        m->addRef();
+    }
+
+    m->ops.append(op);
+
+    if (!m->deferred) {
+        m->flush();
+    }
+}
+
+static PixelOp exponentiateOp(int channel, int count, float power, bool approximate)
+{
+    PixelOp op = pixelOp(PixelOp::Exponentiate, channel, count);
+    op.params[0] = power;
+    op.params[1] = approximate ? 1.0f : 0.0f;
+    return op;
+}
+
+// Same as FloatImage::exponentiate. With approxPow the texels that don't fill a group of 4 are padded, so that they get
+// the same rounding as the others wherever the tiles end.
+static void exponentiateTexels(const PixelOp & op, float * const c[4], uint begin, uint end)
+{
+    const float power = op.params[0];
+    const bool approximate = op.params[1] != 0.0f;
+
+    for (int k = op.channel; k < op.channel + op.count; k++) {
+        float * x = c[k];
+
+        uint i = begin;
+#if NV_USE_SSE > 1
+        const SimdVector vpower(power);
+        for (; approximate && i + 4 <= end; i += 4) {
+            _mm_storeu_ps(x + i, approxPow(SimdVector(_mm_loadu_ps(x + i)), vpower).vec);
+        }
+        if (approximate && i < end) {
+            NV_ALIGN_16 float tmp[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            for (uint j = i; j < end; j++) tmp[j - i] = x[j];
+            _mm_store_ps(tmp, approxPow(SimdVector(_mm_load_ps(tmp)), vpower).vec);
+            for (uint j = i; j < end; j++) x[j] = tmp[j - i];
+            i = end;
+        }
+#endif
+        for (; i < end; i++) {
+            x[i] = powf(max(0.0f, x[i]), power);
+        }
+    }
+}
+
 void Surface::toLinear(float gamma)
 {
     if (isNull()) return;
     if (equal(gamma, 1.0f)) return;
 
-    detach();
-
-    m->image->toLinear(0, 3, gamma);
+    apply(*this, exponentiateOp(0, 3, gamma, m->approximateGamma));
 }
 
 void Surface::toGamma(float gamma)
@@ -1210,9 +1805,7 @@ void Surface::toGamma(float gamma)
     if (isNull()) return;
     if (equal(gamma, 1.0f)) return;
 
-    detach();
-
-    m->image->toGamma(0, 3, gamma);
+    apply(*this, exponentiateOp(0, 3, 1.0f/gamma, m->approximateGamma));
 }
 
 void Surface::toLinear(int channel, float gamma)
@@ -1220,9 +1813,7 @@ void Surface::toLinear(int channel, float gamma)
     if (isNull()) return;
     if (equal(gamma, 1.0f)) return;
 
-    detach();
-
-    m->image->toLinear(channel, 1, gamma);
+    apply(*this, exponentiateOp(channel, 1, gamma, m->approximateGamma));
 }
 
 void Surface::toGamma(int channel, float gamma)
@@ -1230,9 +1821,7 @@ void Surface::toGamma(int channel, float gamma)
     if (isNull()) return;
     if (equal(gamma, 1.0f)) return;
 
-    detach();
-
-    m->image->toGamma(channel, 1, gamma);
+    apply(*this, exponentiateOp(channel, 1, 1.0f/gamma, m->approximateGamma));
 }
 
 
@@ -1246,23 +1835,37 @@ static float toSrgb(float f) {
     return f;
 }
 
-void Surface::toSrgb()
+static void toSrgbTexels(float * const c[4], uint begin, uint end, bool approximate)
 {
-    if (isNull()) return;
-
-    detach();
-
-    FloatImage * img = m->image;
+    for (int k = 0; k < 3; k++) {
+        float * x = c[k];
 
-    const uint count = img->pixelCount();
-    for (uint c = 0; c < 3; c++) {
-        float * channel = img->channel(c);
-        for (uint i = 0; i < count; i++) {
-            channel[i] = ::toSrgb(channel[i]);
+        uint i = begin;
+#if NV_USE_SSE > 1
+        const SimdVector zero(0.0f), one(1.0f), power(0.41666f), scale(1.055f), bias(0.055f);
+        const SimdVector linearScale(12.92f), linearEnd(0.0031308f);
+        for (; approximate && i + 4 <= end; i += 4) {
+            SimdVector f = min(max(SimdVector(_mm_loadu_ps(x + i)), zero), one);     // NaNs go to 0.
+            SimdVector curve = approxPow(f, power) * scale - bias;
+            SimdVector linear = f * linearScale;
+            _mm_storeu_ps(x + i, select(curve, linear, SimdVector(_mm_cmple_ps(f.vec, linearEnd.vec))).vec);
+        }
+#endif
+        for (; i < end; i++) {
+            x[i] = ::toSrgb(x[i]);
         }
     }
 }
 
+void Surface::toSrgb()
+{
+    if (isNull()) return;
+
+    PixelOp op = pixelOp(PixelOp::ToSrgb);
+    op.params[0] = m->approximateGamma ? 1.0f : 0.0f;
+    apply(*this, op);
+}
+
 static float fromSrgb(float f) {
     if (f < 0.0f)           f = 0.0f;
     else if (f < 0.04045f)  f = f / 12.92f;
@@ -1271,23 +1874,37 @@ static float fromSrgb(float f) {
     return f;
 }
 
-void Surface::toLinearFromSrgb()
+static void fromSrgbTexels(float * const c[4], uint begin, uint end, bool approximate)
 {
-    if (isNull()) return;
-
-    detach();
+    for (int k = 0; k < 3; k++) {
+        float * x = c[k];
 
-    FloatImage * img = m->image;
-
-    const uint count = img->pixelCount();
-    for (uint c = 0; c < 3; c++) {
-        float * channel = img->channel(c);
-        for (uint i = 0; i < count; i++) {
-            channel[i] = ::fromSrgb(channel[i]);
+        uint i = begin;
+#if NV_USE_SSE > 1
+        const SimdVector zero(0.0f), one(1.0f), power(2.4f), scale(1.0f / 1.055f), bias(0.055f);
+        const SimdVector linearScale(1.0f / 12.92f), linearEnd(0.04045f);
+        for (; approximate && i + 4 <= end; i += 4) {
+            SimdVector f = max(min(SimdVector(_mm_loadu_ps(x + i)), one), zero);     // NaNs go to 1.
+            SimdVector curve = approxPow((f + bias) * scale, power);
+            SimdVector linear = f * linearScale;
+            _mm_storeu_ps(x + i, select(curve, linear, SimdVector(_mm_cmplt_ps(f.vec, linearEnd.vec))).vec);
+        }
+#endif
+        for (; i < end; i++) {
+            x[i] = ::fromSrgb(x[i]);
         }
     }
 }
 
+void Surface::toLinearFromSrgb()
+{
+    if (isNull()) return;
+
+    PixelOp op = pixelOp(PixelOp::FromSrgb);
+    op.params[0] = m->approximateGamma ? 1.0f : 0.0f;
+    apply(*this, op);
+}
+
 static float toXenonSrgb(float f) {
     if (f < 0)                  f = 0;
     else if (f < (1.0f/16.0f))  f = 4.0f * f;
@@ -1302,35 +1919,59 @@ void Surface::toXenonSrgb()
 {
     if (isNull()) return;
 
-    detach();
+    apply(*this, pixelOp(PixelOp::ToXenonSrgb));
+}
 
-    FloatImage * img = m->image;
 
-    const uint count = img->pixelCount();
-    for (uint c = 0; c < 3; c++) {
-        float * channel = img->channel(c);
-        for (uint i = 0; i < count; i++) {
-            channel[i] = ::toXenonSrgb(channel[i]);
+static void transformTexels(const PixelOp & op, float * const c[4], uint begin, uint end)
+{
+    const float * p = op.params;
+
+    uint i = begin;
+#if NV_USE_SSE > 1
+    for (; i + 4 <= end; i += 4) {
+        const SimdVector r(_mm_loadu_ps(c[0] + i));
+        const SimdVector g(_mm_loadu_ps(c[1] + i));
+        const SimdVector b(_mm_loadu_ps(c[2] + i));
+        const SimdVector a(_mm_loadu_ps(c[3] + i));
+
+        for (int k = 0; k < 4; k++) {
+            SimdVector x = r * SimdVector(p[k]) + g * SimdVector(p[4 + k]) + b * SimdVector(p[8 + k]) + a * SimdVector(p[12 + k]);
+            _mm_storeu_ps(c[k] + i, (x + SimdVector(p[16 + k])).vec);
         }
     }
-}
+#endif
+    if (i < end) {
+        Matrix xform(
+            Vector4(p[0], p[1], p[2], p[3]),
+            Vector4(p[4], p[5], p[6], p[7]),
+            Vector4(p[8], p[9], p[10], p[11]),
+            Vector4(p[12], p[13], p[14], p[15]));
+        Vector4 offset(p[16], p[17], p[18], p[19]);
 
+        for (; i < end; i++) {
+            Vector4 color = nv::transform(xform, Vector4(c[0][i], c[1][i], c[2][i], c[3][i])) + offset;
+            c[0][i] = color.x;
+            c[1][i] = color.y;
+            c[2][i] = color.z;
+            c[3][i] = color.w;
+        }
+    }
+}
 
 void Surface::transform(const float w0[4], const float w1[4], const float w2[4], const float w3[4], const float offset[4])
 {
     if (isNull()) return;
 
-    detach();
-
-    Matrix xform(
-        Vector4(w0[0], w0[1], w0[2], w0[3]),
-        Vector4(w1[0], w1[1], w1[2], w1[3]),
-        Vector4(w2[0], w2[1], w2[2], w2[3]),
-        Vector4(w3[0], w3[1], w3[2], w3[3]));
-
-    Vector4 voffset(offset[0], offset[1], offset[2], offset[3]);
-
-    m->image->transform(0, xform, voffset);
+    PixelOp op = pixelOp(PixelOp::Transform);
+    for (int i = 0; i < 4; i++) {
+        op.params[0 + i] = w0[i];
+        op.params[4 + i] = w1[i];
+        op.params[8 + i] = w2[i];
+        op.params[12 + i] = w3[i];
+        op.params[16 + i] = offset[i];
+    }
+    apply(*this, op);
 }
 
 // R, G, B, A, 1, 0, -1
@@ -1339,9 +1980,12 @@ void Surface::swizzle(int r, int g, int b, int a)
     if (isNull()) return;
     if (r == 0 && g == 1 && b == 2 && a == 3) return;
 
-    detach();
-
-    m->image->swizzle(0, r, g, b, a);
+    PixelOp op = pixelOp(PixelOp::Swizzle);
+    op.params[0] = float(r);
+    op.params[1] = float(g);
+    op.params[2] = float(b);
+    op.params[3] = float(a);
+    apply(*this, op);
 }
 
 // color * scale + bias
@@ -1350,61 +1994,40 @@ void Surface::scaleBias(int channel, float scale, float bias)
     if (isNull()) return;
     if (equal(scale, 1.0f) && equal(bias, 0.0f)) return;
 
-    detach();
-
-    m->image->scaleBias(channel, 1, scale, bias);
+    PixelOp op = pixelOp(PixelOp::ScaleBias, channel, 1);
+    op.params[0] = scale;
+    op.params[1] = bias;
+    apply(*this, op);
 }
 
 void Surface::clamp(int channel, float low, float high)
 {
     if (isNull()) return;
 
-    detach();
-
-    m->image->clamp(channel, 1, low, high);
+    PixelOp op = pixelOp(PixelOp::Clamp, channel, 1);
+    op.params[0] = low;
+    op.params[1] = high;
+    apply(*this, op);
 }
 
 void Surface::blend(float red, float green, float blue, float alpha, float t)
 {
     if (isNull()) return;
 
-    detach();
-
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
-
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++)
-    {
-        r[i] = lerp(r[i], red, t);
-        g[i] = lerp(g[i], green, t);
-        b[i] = lerp(b[i], blue, t);
-        a[i] = lerp(a[i], alpha, t);
-    }
+    PixelOp op = pixelOp(PixelOp::Blend);
+    op.params[0] = red;
+    op.params[1] = green;
+    op.params[2] = blue;
+    op.params[3] = alpha;
+    op.params[4] = t;
+    apply(*this, op);
 }
 
 void Surface::premultiplyAlpha()
 {
     if (isNull()) return;
 
-    detach();
-
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
-
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++)
-    {
-        r[i] *= a[i];
-        g[i] *= a[i];
-        b[i] *= a[i];
-    }
+    apply(*this, pixelOp(PixelOp::PremultiplyAlpha));
 }
 
 
@@ -1536,24 +2159,16 @@ void Surface::scaleAlphaToCoverage(float coverage, float alphaRef/*= 0.5f*/, int
     return true;
 }*/
 
-// Ideally you should compress/quantize the RGB and M portions independently.
-// Once you have M quantized, you would compute the corresponding RGB and quantize that.
-void Surface::toRGBM(float range/*= 1*/, float threshold/*= 0.25*/)
+static void toRgbmTexels(const PixelOp & op, float * const c[4], uint begin, uint end)
 {
-    if (isNull()) return;
-
-    detach();
+    const float threshold = op.params[0];
 
-    threshold = ::clamp(threshold, 1e-6f, 1.0f);
-
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
+    float * r = c[0];
+    float * g = c[1];
+    float * b = c[2];
+    float * a = c[3];
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
+    for (uint i = begin; i < end; i++) {
         float R = nv::clamp(r[i], 0.0f, 1.0f);
         float G = nv::clamp(g[i], 0.0f, 1.0f);
         float B = nv::clamp(b[i], 0.0f, 1.0f);
@@ -1617,6 +2232,17 @@ void Surface::toRGBM(float range/*= 1*/, float threshold/*= 0.25*/)
     }
 }
 
+// Ideally you should compress/quantize the RGB and M portions independently.
+// Once you have M quantized, you would compute the corresponding RGB and quantize that.
+void Surface::toRGBM(float range/*= 1*/, float threshold/*= 0.25*/)
+{
+    if (isNull()) return;
+
+    PixelOp op = pixelOp(PixelOp::ToRgbm);
+    op.params[0] = ::clamp(threshold, 1e-6f, 1.0f);
+    apply(*this, op);
+}
+
 // @@ IC: Dubious merge. Review!
 void Surface::fromRGBM(float range/*= 1*/, float threshold/*= 0.25*/)
 {
@@ -1754,52 +2380,10 @@ static Color32 toRgbe8(float r, float g, float b)
 }
 */
 
-// For R9G9B9E5, use toRGBE(9, 5), for Ward's RGBE, use toRGBE(8, 8)
-// @@ Note that most Radiance HDR loaders use an exponent bias of 128 instead of 127! This implementation
-// matches the OpenGL extension.
-void Surface::toRGBE(int mantissaBits, int exponentBits)
+static void toRgbeTexels(const PixelOp & op, float * const c[4], uint begin, uint end)
 {
-    // According to the OpenGL extension:
-    // http://www.opengl.org/registry/specs/EXT/texture_shared_exponent.txt
-    //
-    // Components red, green, and blue are first clamped (in the process,
-    // mapping NaN to zero) so:
-    //
-    //     red_c   = max(0, min(sharedexp_max, red))
-    //     green_c = max(0, min(sharedexp_max, green))
-    //     blue_c  = max(0, min(sharedexp_max, blue))
-    //
-    // where sharedexp_max is (2^N-1)/2^N * 2^(Emax-B), N is the number
-    // of mantissa bits per component, Emax is the maximum allowed biased
-    // exponent value (careful: not necessarily 2^E-1 when E is the number of
-    // exponent bits), bits, and B is the exponent bias.  For the RGB9_E5_EXT
-    // format, N=9, Emax=31, and B=15.
-    //
-    // The largest clamped component, max_c, is determined:
-    //
-    //     max_c = max(red_c, green_c, blue_c)
-    //
-    // A preliminary shared exponent is computed:
-    //
-    //     exp_shared_p = max(-B-1, floor(log2(max_c))) + 1 + B
-    //
-    // A refined shared exponent is then computed as:
-    //
-    //     max_s   = floor(max_c   / 2^(exp_shared_p - B - N) + 0.5)
-    //
-    //                  { exp_shared_p,    0 <= max_s <  2^N
-    //     exp_shared = {
-    //                  { exp_shared_p+1,       max_s == 2^N
-    //
-    // These integers values in the range 0 to 2^N-1 are then computed:
-    //
-    //     red_s   = floor(red_c   / 2^(exp_shared - B - N) + 0.5)
-    //     green_s = floor(green_c / 2^(exp_shared - B - N) + 0.5)
-    //     blue_s  = floor(blue_c  / 2^(exp_shared - B - N) + 0.5)
-
-    if (isNull()) return;
-
-    detach();
+    const int mantissaBits = int(op.params[0]);
+    const int exponentBits = int(op.params[1]);
 
     // mantissaBits = N
     // exponentBits = E
@@ -1816,15 +2400,12 @@ void Surface::toRGBE(int mantissaBits, int exponentBits)
     // Maximum representable value: 5 -> 63488, 8 -> HUGE
     const float maxValue = float(exponentMax) / float(exponentMax + 1) * float(1 << (exponentMax - exponentBias));
 
+    float * r = c[0];
+    float * g = c[1];
+    float * b = c[2];
+    float * a = c[3];
 
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
-
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
+    for (uint i = begin; i < end; i++) {
         // Clamp components:
         float R = ::clamp(r[i], 0.0f, maxValue);
         float G = ::clamp(g[i], 0.0f, maxValue);
@@ -1865,6 +2446,57 @@ void Surface::toRGBE(int mantissaBits, int exponentBits)
     }
 }
 
+// For R9G9B9E5, use toRGBE(9, 5), for Ward's RGBE, use toRGBE(8, 8)
+// @@ Note that most Radiance HDR loaders use an exponent bias of 128 instead of 127! This implementation
+// matches the OpenGL extension.
+void Surface::toRGBE(int mantissaBits, int exponentBits)
+{
+    // According to the OpenGL extension:
+    // http://www.opengl.org/registry/specs/EXT/texture_shared_exponent.txt
+    //
+    // Components red, green, and blue are first clamped (in the process,
+    // mapping NaN to zero) so:
+    //
+    //     red_c   = max(0, min(sharedexp_max, red))
+    //     green_c = max(0, min(sharedexp_max, green))
+    //     blue_c  = max(0, min(sharedexp_max, blue))
+    //
+    // where sharedexp_max is (2^N-1)/2^N * 2^(Emax-B), N is the number
+    // of mantissa bits per component, Emax is the maximum allowed biased
+    // exponent value (careful: not necessarily 2^E-1 when E is the number of
+    // exponent bits), bits, and B is the exponent bias.  For the RGB9_E5_EXT
+    // format, N=9, Emax=31, and B=15.
+    //
+    // The largest clamped component, max_c, is determined:
+    //
+    //     max_c = max(red_c, green_c, blue_c)
+    //
+    // A preliminary shared exponent is computed:
+    //
+    //     exp_shared_p = max(-B-1, floor(log2(max_c))) + 1 + B
+    //
+    // A refined shared exponent is then computed as:
+    //
+    //     max_s   = floor(max_c   / 2^(exp_shared_p - B - N) + 0.5)
+    //
+    //                  { exp_shared_p,    0 <= max_s <  2^N
+    //     exp_shared = {
+    //                  { exp_shared_p+1,       max_s == 2^N
+    //
+    // These integers values in the range 0 to 2^N-1 are then computed:
+    //
+    //     red_s   = floor(red_c   / 2^(exp_shared - B - N) + 0.5)
+    //     green_s = floor(green_c / 2^(exp_shared - B - N) + 0.5)
+    //     blue_s  = floor(blue_c  / 2^(exp_shared - B - N) + 0.5)
+
+    if (isNull()) return;
+
+    PixelOp op = pixelOp(PixelOp::ToRgbe);
+    op.params[0] = float(mantissaBits);
+    op.params[1] = float(exponentBits);
+    apply(*this, op);
+}
+
 void Surface::fromRGBE(int mantissaBits, int exponentBits)
 {
     // According to the OpenGL extension:
@@ -1923,21 +2555,14 @@ void Surface::fromRGBE(int mantissaBits, int exponentBits)
     }
 }
 
-// Y is in the [0, 1] range, while CoCg are in the [-1, 1] range.
-void Surface::toYCoCg()
+static void toYCoCgTexels(float * const c[4], uint begin, uint end)
 {
-    if (isNull()) return;
-
-    detach();
-
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
+    float * r = c[0];
+    float * g = c[1];
+    float * b = c[2];
+    float * a = c[3];
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
+    for (uint i = begin; i < end; i++) {
         float R = r[i];
         float G = g[i];
         float B = b[i];
@@ -1953,6 +2578,14 @@ void Surface::toYCoCg()
     }
 }
 
+// Y is in the [0, 1] range, while CoCg are in the [-1, 1] range.
+void Surface::toYCoCg()
+{
+    if (isNull()) return;
+
+    apply(*this, pixelOp(PixelOp::ToYCoCg));
+}
+
 // img.toYCoCg();
 // img.blockScaleCoCg();
 // img.scaleBias(0, 0.5, 0.5);
@@ -1994,97 +2627,352 @@ void Surface::blockScaleCoCg(int bits/*= 5*/, float threshold/*= 0.0*/)
                 }
             }
 
-            float scale = PixelFormat::quantizeCeil(m, bits, 8);
-            nvDebugCheck(scale >= m);
+            float scale = PixelFormat::quantizeCeil(m, bits, 8);
+            nvDebugCheck(scale >= m);
+
+            // Store block scale in blue channel and scale CoCg.
+            for (uint j = 0; j < 4; j++) {
+                for (uint i = 0; i < 4; i++) {
+                    uint x = min(bi*4 + i, w);
+                    uint y = min(bj*4 + j, h);
+
+                    float & Co = img->pixel(0, x, y, 0);
+                    float & Cg = img->pixel(1, x, y, 0);
+
+                    Co /= scale;
+                    nvDebugCheck(fabsf(Co) <= 1.0f);
+
+                    Cg /= scale;
+                    nvDebugCheck(fabsf(Cg) <= 1.0f);
+
+                    img->pixel(2, x, y, 0) = scale;
+                }
+            }
+        }
+    }
+}
+
+void Surface::fromYCoCg()
+{
+    if (isNull()) return;
+
+    detach();
+
+    FloatImage * img = m->image;
+    float * r = img->channel(0);
+    float * g = img->channel(1);
+    float * b = img->channel(2);
+    float * a = img->channel(3);
+
+    const uint count = img->pixelCount();
+    for (uint i = 0; i < count; i++) {
+        float Co = r[i];
+        float Cg = g[i];
+        float scale = b[i] * 0.5f;
+        float Y = a[i];
+
+        Co *= scale;
+        Cg *= scale;
+
+        float R = Y + Co - Cg;
+        float G = Y + Cg;
+        float B = Y - Co - Cg;
+
+        r[i] = R;
+        g[i] = G;
+        b[i] = B;
+        a[i] = 1.0f;
+    }
+}
+
+static void toLuvwTexels(const PixelOp & op, float * const c[4], uint begin, uint end)
+{
+    float irange = 1.0f / op.params[0];
+
+    float * r = c[0];
+    float * g = c[1];
+    float * b = c[2];
+    float * a = c[3];
+
+    for (uint i = begin; i < end; i++) {
+        float R = nv::clamp(r[i] * irange, 0.0f, 1.0f);
+        float G = nv::clamp(g[i] * irange, 0.0f, 1.0f);
+        float B = nv::clamp(b[i] * irange, 0.0f, 1.0f);
+
+        float L = max(sqrtf(R*R + G*G + B*B), 1e-6f); // Avoid division by zero.
+
+        r[i] = R / L;
+        g[i] = G / L;
+        b[i] = B / L;
+        a[i] = L / sqrtf(3);
+    }
+}
+
+void Surface::toLUVW(float range/*= 1.0f*/)
+{
+    if (isNull()) return;
+
+    PixelOp op = pixelOp(PixelOp::ToLuvw);
+    op.params[0] = range;
+    apply(*this, op);
+}
+
+void Surface::fromLUVW(float range/*= 1.0f*/)
+{
+    // Decompression is the same as in RGBM.
+    fromRGBM(range * sqrtf(3));
+}
+
+static void toneMapTexels(const PixelOp & op, float * const c[4], uint begin, uint end)
+{
+    const ToneMapper tm = ToneMapper(int(op.params[0]));
+
+    float * r = c[0];
+    float * g = c[1];
+    float * b = c[2];
+
+    uint i = begin;
+
+    if (tm == ToneMapper_Linear || tm == ToneMapper_Lightmap) {
+        // Clamp preserving the hue.
+        // @@ Lightmap goals:
+        // Preserve hue.
+        // Avoid clamping abrubtly.
+        // Minimize color difference along most of the color range. [0, alpha)
+#if NV_USE_SSE > 1
+        const SimdVector one(1.0f);
+        for (; i + 4 <= end; i += 4) {
+            SimdVector R(_mm_loadu_ps(r + i)), G(_mm_loadu_ps(g + i)), B(_mm_loadu_ps(b + i));
+            SimdVector m = max(max(R, G), B);
+            SimdVector scale = select(one, one / m, SimdVector(_mm_cmpgt_ps(m.vec, one.vec)));
+            _mm_storeu_ps(r + i, (R * scale).vec);
+            _mm_storeu_ps(g + i, (G * scale).vec);
+            _mm_storeu_ps(b + i, (B * scale).vec);
+        }
+#endif
+        for (; i < end; i++) {
+            float m = max3(r[i], g[i], b[i]);
+            if (m > 1.0f) {
+                r[i] *= 1.0f / m;
+                g[i] *= 1.0f / m;
+                b[i] *= 1.0f / m;
+            }
+        }
+    }
+    else if (tm == ToneMapper_Reindhart) {
+        for (int k = 0; k < 3; k++) {
+            float * x = c[k];
+
+            i = begin;
+#if NV_USE_SSE > 1
+            const SimdVector one(1.0f);
+            for (; i + 4 <= end; i += 4) {
+                SimdVector X(_mm_loadu_ps(x + i));
+                _mm_storeu_ps(x + i, (X / (X + one)).vec);
+            }
+#endif
+            for (; i < end; i++) {
+                x[i] /= x[i] + 1;
+            }
+        }
+    }
+    else if (tm == ToneMapper_Halo) {
+        for (int k = 0; k < 3; k++) {
+            float * x = c[k];
+
+            i = begin;
+#if NV_USE_SSE > 1
+            const SimdVector one(1.0f), zero(0.0f);
+            for (; i + 4 <= end; i += 4) {
+                _mm_storeu_ps(x + i, (one - approxExp2(zero - SimdVector(_mm_loadu_ps(x + i)))).vec);
+            }
+#endif
+            for (; i < end; i++) {
+                x[i] = 1 - exp2f(-x[i]);
+            }
+        }
+    }
+}
+
+static void applyTexels(const PixelOp & op, float * const c[4], uint begin, uint end)
+{
+    const float * p = op.params;
+
+    switch (op.type) {
+        case PixelOp::Exponentiate:
+            exponentiateTexels(op, c, begin, end);
+            break;
+        case PixelOp::ToSrgb:
+            toSrgbTexels(c, begin, end, p[0] != 0.0f);
+            break;
+        case PixelOp::FromSrgb:
+            fromSrgbTexels(c, begin, end, p[0] != 0.0f);
+            break;
+        case PixelOp::ToXenonSrgb:
+            for (int k = 0; k < 3; k++) {
+                for (uint i = begin; i < end; i++) c[k][i] = ::toXenonSrgb(c[k][i]);
+            }
+            break;
+        case PixelOp::Transform:
+            transformTexels(op, c, begin, end);
+            break;
+        case PixelOp::Swizzle: {
+            const int r = int(p[0]), g = int(p[1]), b = int(p[2]), a = int(p[3]);
+            for (uint i = begin; i < end; i++) {
+                const float v[7] = { c[0][i], c[1][i], c[2][i], c[3][i], 1.0f, 0.0f, -1.0f };
+                c[0][i] = v[r];
+                c[1][i] = v[g];
+                c[2][i] = v[b];
+                c[3][i] = v[a];
+            }
+            break;
+        }
+        case PixelOp::ScaleBias: {
+            float * x = c[op.channel];
+            for (uint i = begin; i < end; i++) x[i] = p[0] * x[i] + p[1];
+            break;
+        }
+        case PixelOp::Clamp: {
+            float * x = c[op.channel];
+            for (uint i = begin; i < end; i++) x[i] = nv::clamp(x[i], p[0], p[1]);
+            break;
+        }
+        case PixelOp::Blend:
+            for (int k = 0; k < 4; k++) {
+                for (uint i = begin; i < end; i++) c[k][i] = lerp(c[k][i], p[k], p[4]);
+            }
+            break;
+        case PixelOp::PremultiplyAlpha:
+            for (uint i = begin; i < end; i++) {
+                c[0][i] *= c[3][i];
+                c[1][i] *= c[3][i];
+                c[2][i] *= c[3][i];
+            }
+            break;
+        case PixelOp::ToRgbm:
+            toRgbmTexels(op, c, begin, end);
+            break;
+        case PixelOp::ToRgbe:
+            toRgbeTexels(op, c, begin, end);
+            break;
+        case PixelOp::ToYCoCg:
+            toYCoCgTexels(c, begin, end);
+            break;
+        case PixelOp::ToLuvw:
+            toLuvwTexels(op, c, begin, end);
+            break;
+        case PixelOp::ToneMap:
+            toneMapTexels(op, c, begin, end);
+            break;
+    }
+}
+
+namespace
+{
+    // Texels per tile, all the pending operations run on a tile while it's in cache. A multiple of 4.
+    const uint kTileSize = 1024;
 
-            // Store block scale in blue channel and scale CoCg.
-            for (uint j = 0; j < 4; j++) {
-                for (uint i = 0; i < 4; i++) {
-                    uint x = min(bi*4 + i, w);
-                    uint y = min(bj*4 + j, h);
+    // Below this many texels the operations run on the calling thread.
+    const uint kParallelFlushThreshold = 64 * 1024;
 
-                    float & Co = img->pixel(0, x, y, 0);
-                    float & Cg = img->pixel(1, x, y, 0);
+    struct FlushContext
+    {
+        const Surface::Private * m;
+        const FloatImage * source;
+    };
 
-                    Co /= scale;
-                    nvDebugCheck(fabsf(Co) <= 1.0f);
+    void FlushTask(void * context, int begin, int end)
+    {
+        const FlushContext * ctx = (const FlushContext *)context;
+        const Surface::Private * m = ctx->m;
+        FloatImage * img = m->image;
 
-                    Cg /= scale;
-                    nvDebugCheck(fabsf(Cg) <= 1.0f);
+        float * const c[4] = { img->channel(0), img->channel(1), img->channel(2), img->channel(3) };
+        const uint count = img->pixelCount();
 
-                    img->pixel(2, x, y, 0) = scale;
+        for (int t = begin; t < end; t++) {
+            const uint first = uint(t) * kTileSize;
+            const uint last = min(count, first + kTileSize);
+
+            if (ctx->source != NULL) {
+                for (uint k = 0; k < 4; k++) {
+                    memcpy(c[k] + first, ctx->source->channel(k) + first, (last - first) * sizeof(float));
                 }
             }
+
+            for (uint o = 0; o < m->ops.count(); o++) {
+                applyTexels(m->ops[o], c, first, last);
+            }
         }
     }
 }
 
-void Surface::fromYCoCg()
+// Run the pending operations one tile of texels at a time, all of them while the tile is in cache, instead of one pass
+// over the whole image for each. Tiles are distributed over the task scheduler for large images.
+void Surface::Private::unpack() const
 {
-    if (isNull()) return;
-
-    detach();
-
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
-
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        float Co = r[i];
-        float Cg = g[i];
-        float scale = b[i] * 0.5f;
-        float Y = a[i];
+    if (storageFormat == StorageFormat_Float) return;
 
-        Co *= scale;
-        Cg *= scale;
+    image->allocate(4, image->width(), image->height(), image->depth());
 
-        float R = Y + Co - Cg;
-        float G = Y + Cg;
-        float B = Y - Co - Cg;
+    const uint count = image->pixelCount() * 4;
+    float * dst = image->channel(0);
 
-        r[i] = R;
-        g[i] = G;
-        b[i] = B;
-        a[i] = 1.0f;
+    if (storageFormat == StorageFormat_Half) {
+        const uint16 * src = (const uint16 *)packed.buffer();
+        for (uint i = 0; i < count; i++) {
+            dst[i] = to_float(src[i]);
+        }
+    }
+    else if (storageFormat == StorageFormat_UNorm16) {
+        const uint16 * src = (const uint16 *)packed.buffer();
+        for (uint i = 0; i < count; i++) {
+            dst[i] = float(src[i]) / 65535.0f;
+        }
+    }
+    else {
+        const uint8 * src = packed.buffer();
+        for (uint i = 0; i < count; i++) {
+            dst[i] = float(src[i]) / 255.0f;
+        }
     }
+
+    packed.clear();
+    packed.shrink();
+    storageFormat = StorageFormat_Float;
 }
 
-void Surface::toLUVW(float range/*= 1.0f*/)
+void Surface::Private::flush(const FloatImage * source/*= NULL*/) const
 {
-    if (isNull()) return;
+    unpack();
 
-    detach();
+    if (ops.isEmpty() && source == NULL) return;
 
-    float irange = 1.0f / range;
+    // Run the operations of a view into texels of its own.
+    AutoPtr<FloatImage> view;
+    if (source == NULL && image->isExternal()) {
+        view = image;
+        source = image;
+        image = new FloatImage;
+        image->allocate(4, source->width(), source->height(), source->depth());
+    }
 
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    float * a = img->channel(3);
+    nvDebugCheck(image != NULL && image->componentCount() == 4);
+    nvDebugCheck(source == NULL || (source->pixelCount() == image->pixelCount() && source->componentCount() == 4));
 
-    const uint count = img->pixelCount();
-    for (uint i = 0; i < count; i++) {
-        float R = nv::clamp(r[i] * irange, 0.0f, 1.0f);
-        float G = nv::clamp(g[i] * irange, 0.0f, 1.0f);
-        float B = nv::clamp(b[i] * irange, 0.0f, 1.0f);
+    const uint count = image->pixelCount();
+    const uint tileCount = (count + kTileSize - 1) / kTileSize;
 
-        float L = max(sqrtf(R*R + G*G + B*B), 1e-6f); // Avoid division by zero.
+    FlushContext context = { this, source };
 
-        r[i] = R / L;
-        g[i] = G / L;
-        b[i] = B / L;
-        a[i] = L / sqrtf(3);
+    if (count < kParallelFlushThreshold) {
+        FlushTask(&context, 0, tileCount);
+    }
+    else {
+        TaskScheduler::global()->parallelFor(FlushTask, &context, tileCount, 16);
     }
-}
 
-void Surface::fromLUVW(float range/*= 1.0f*/)
-{
-    // Decompression is the same as in RGBM.
-    fromRGBM(range * sqrtf(3));
+    ops.clear();
 }
 
 void Surface::abs(int channel)
@@ -2117,53 +3005,9 @@ void Surface::toneMap(ToneMapper tm, float * parameters)
 {
     if (isNull()) return;
 
-    detach();
-
-    FloatImage * img = m->image;
-    float * r = img->channel(0);
-    float * g = img->channel(1);
-    float * b = img->channel(2);
-    const uint count = img->pixelCount();
-
-    if (tm == ToneMapper_Linear) {
-        // Clamp preserving the hue.
-        for (uint i = 0; i < count; i++) {
-            float m = max3(r[i], g[i], b[i]);
-            if (m > 1.0f) {
-                r[i] *= 1.0f / m;
-                g[i] *= 1.0f / m;
-                b[i] *= 1.0f / m;
-            }
-        }
-    }
-    else if (tm == ToneMapper_Reindhart) {
-        for (uint i = 0; i < count; i++) {
-            r[i] /= r[i] + 1;
-            g[i] /= g[i] + 1;
-            b[i] /= b[i] + 1;
-        }
-    }
-    else if (tm == ToneMapper_Halo) {
-        for (uint i = 0; i < count; i++) {
-            r[i] = 1 - exp2f(-r[i]);
-            g[i] = 1 - exp2f(-g[i]);
-            b[i] = 1 - exp2f(-b[i]);
-        }
-    }
-    else if (tm == ToneMapper_Lightmap) {
-        // @@ Goals:
-        // Preserve hue.
-        // Avoid clamping abrubtly.
-        // Minimize color difference along most of the color range. [0, alpha)
-        for (uint i = 0; i < count; i++) {
-            float m = max3(r[i], g[i], b[i]);
-            if (m > 1.0f) {
-                r[i] *= 1.0f / m;
-                g[i] *= 1.0f / m;
-                b[i] *= 1.0f / m;
-            }
-        }
-    }
+    PixelOp op = pixelOp(PixelOp::ToneMap);
+    op.params[0] = float(tm);
+    apply(*this, op);
 }
 
 void Surface::toLogScale(int channel, float base) {
@@ -2324,7 +3168,7 @@ void Surface::fromJPEGLS()
 */
 
 
-// If dither is true, this uses Floyd-Steinberg dithering method.
+// If dither is true, this uses Floyd-Steinberg dithering method, with the rows processed concurrently.
 void Surface::binarize(int channel, float threshold, bool dither)
 {
     if (isNull()) return;
@@ -2341,57 +3185,20 @@ void Surface::binarize(int channel, float threshold, bool dither)
         }
     }
     else {
-        const uint w = img->width();
-        const uint h = img->height();
-        const uint d = img->depth();
-
-        float * row0 = new float[(w+2)];
-        float * row1 = new float[(w+2)];
-
-        // @@ Extend Floyd-Steinberg dithering to 3D properly.
-        for (uint z = 0; z < d; z++) {
-            memset(row0, 0, sizeof(float)*(w+2));
-            memset(row1, 0, sizeof(float)*(w+2));
-
-            for (uint y = 0; y < h; y++) {
-                for (uint x = 0; x < w; x++) {
-
-                    float & f = img->pixel(channel, x, y, 0);
-
-                    // Add error and quantize.
-                    float qf = float(f + row0[1+x] > threshold);
-
-                    // Compute new error:
-                    float diff = f - qf;
-
-                    // Store color.
-                    f = qf;
-
-                    // Propagate new error.
-                    row0[1+x+1] += (7.0f / 16.0f) * diff;
-                    row1[1+x-1] += (3.0f / 16.0f) * diff;
-                    row1[1+x+0] += (5.0f / 16.0f) * diff;
-                    row1[1+x+1] += (1.0f / 16.0f) * diff;
-                }
-
-                swap(row0, row1);
-                memset(row1, 0, sizeof(float)*(w+2));
-            }
-        }
-
-        delete [] row0;
-        delete [] row1;
+        Quantize::FloydSteinberg_Binary(img, channel, threshold);
     }
 }
 
 // Uniform quantizer.
 // Assumes input is in [0, 1] range. Output is in the [0, 1] range, but rounded to the middle of each bin.
 // If exactEndPoints is true, [0, 1] are represented exactly, and the correponding bins are half the size, so quantization is not truly uniform.
-// When dither is true, this uses Floyd-Steinberg dithering.
+// When dither is true, this uses Floyd-Steinberg dithering, with the rows processed concurrently.
 void Surface::quantize(int channel, int bits, bool exactEndPoints, bool dither)
 {
     if (isNull()) return;
 
+    NVTT_PROFILE("quantize", width() * height() * depth());
+
     detach();
 
     FloatImage * img = m->image;
@@ -2418,45 +3225,7 @@ void Surface::quantize(int channel, int bits, bool exactEndPoints, bool dither)
         }
     }
     else {
-        const uint w = img->width();
-        const uint h = img->height();
-        const uint d = img->depth();
-
-        float * row0 = new float[(w+2)];
-        float * row1 = new float[(w+2)];
-
-        for (uint z = 0; z < d; z++) {
-            memset(row0, 0, sizeof(float)*(w+2));
-            memset(row1, 0, sizeof(float)*(w+2));
-
-            for (uint y = 0; y < h; y++) {
-                for (uint x = 0; x < w; x++) {
-
-                    float & f = img->pixel(channel, x, y, 0);
-
-                    // Add error and quantize.
-                    float qf = saturate((floorf((f + row0[1+x]) * scale + offset0) + offset1) / scale);
-
-                    // Compute new error:
-                    float diff = f - qf;
-
-                    // Store color.
-                    f = qf;
-
-                    // Propagate new error.
-                    row0[1+x+1] += (7.0f / 16.0f) * diff;
-                    row1[1+x-1] += (3.0f / 16.0f) * diff;
-                    row1[1+x+0] += (5.0f / 16.0f) * diff;
-                    row1[1+x+1] += (1.0f / 16.0f) * diff;
-                }
-
-                swap(row0, row1);
-                memset(row1, 0, sizeof(float)*(w+2));
-            }
-        }
-
-        delete [] row0;
-        delete [] row1;
+        Quantize::FloydSteinberg(img, channel, bits, exactEndPoints);
     }
 }
 
@@ -2642,9 +3411,9 @@ Surface Surface::createToksvigMap(float power) const
 {
     if (isNull()) return Surface();
 
-    // @@ TODO
+    m->flush();
 
-    return Surface();
+    return toksvigSurface(m, m->image->createToksvigMap(0, power));
 }
 
 // @@ Should I add support for LEAN maps? That requires 5 terms, which would have to be encoded in two textures.
@@ -2700,6 +3469,7 @@ Surface Surface::createSubImage(int x0, int x1, int y0, int y1, int z0, int z1)
     if (z0 < 0 || z1 > depth() || z0 > z1) return s;
     if (x1 >= width() || y1 >= height() || z1 >= depth()) return s;
 
+    m->flush();
     FloatImage * img = s.m->image = new FloatImage;
 
     int w = x1 - x0 + 1;
@@ -2708,15 +3478,8 @@ Surface Surface::createSubImage(int x0, int x1, int y0, int y1, int z0, int z1)
 
     img->allocate(4, w, h, d);
 
-    for (int c = 0; c < 4; c++) {
-        for (int z = 0; z < d; z++) {
-            for (int y = 0; y < h; y++) {
-                for (int x = 0; x < w; x++) {
-                    img->pixel(c, x, y, z) = m->image->pixel(c, x0+x, y0+y, z0+z);
-                }
-            }
-        }
-    }
+    CopyRegion region = { m->image, x0, y0, z0, w, h, d, 0, 0, 0 };
+    copyTexels(img, &region, 1);
 
     return s;
 }
@@ -2730,6 +3493,8 @@ bool Surface::copyChannel(const Surface & srcImage, int srcChannel, int dstChann
 {
     if (srcChannel < 0 || srcChannel > 3 || dstChannel < 0 || dstChannel > 3) return false;
 
+    srcImage.m->flush();
+
     FloatImage * dst = m->image;
     const FloatImage * src = srcImage.m->image;
 
@@ -2751,6 +3516,8 @@ bool Surface::addChannel(const Surface & srcImage, int srcChannel, int dstChanne
 {
     if (srcChannel < 0 || srcChannel > 3 || dstChannel < 0 || dstChannel > 3) return false;
 
+    srcImage.m->flush();
+
     FloatImage * dst = m->image;
     const FloatImage * src = srcImage.m->image;
 
@@ -2777,32 +3544,163 @@ bool Surface::addChannel(const Surface & srcImage, int srcChannel, int dstChanne
 
 bool Surface::copy(const Surface & srcImage, int xsrc, int ysrc, int zsrc, int xsize, int ysize, int zsize, int xdst, int ydst, int zdst)
 {
-    if (xsrc < 0 || ysrc < 0 || zsrc < 0) return false;
-    if (xdst < 0 || ydst < 0 || zdst < 0) return false;
+    const int region[9] = { xsrc, ysrc, zsrc, xsize, ysize, zsize, xdst, ydst, zdst };
+    const Surface * source = &srcImage;
 
-    FloatImage * dst = m->image;
-    const FloatImage * src = srcImage.m->image;
+    return copyRegions(1, &source, region);
+}
+
+bool Surface::copyRegions(int count, const Surface * const * sources, const int * regions)
+{
+    if (isNull() || count < 0) return false;
 
-    if (U32(xsrc + xsize) > src->width() || U32(ysrc + ysize) > src->height() || U32(zsrc + zsize) > src->depth()) return false;
-    if (U32(xdst + xsize) > dst->width() || U32(ydst + ysize) > dst->height() || U32(zdst + zsize) > dst->depth()) return false;
+    for (int i = 0; i < count; i++) {
+        const int * r = regions + 9 * i;
+        if (sources[i]->isNull()) return false;
+        if (r[0] < 0 || r[1] < 0 || r[2] < 0 || r[3] < 0 || r[4] < 0 || r[5] < 0) return false;
+        if (r[6] < 0 || r[7] < 0 || r[8] < 0) return false;
+        if (r[0] + r[3] > sources[i]->width() || r[1] + r[4] > sources[i]->height() || r[2] + r[5] > sources[i]->depth()) return false;
+        if (r[6] + r[3] > width() || r[7] + r[4] > height() || r[8] + r[5] > depth()) return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        sources[i]->m->flush();
+    }
 
     detach();
 
-    // For each channel.
-    for(int i = 0; i < 4; i++) {
-        float * d = dst->channel(i);
-        const float * s = src->channel(i);
+    // A source that is this surface reads the texels being written.
+    Array<CopyRegion> copies;
+    copies.resize(count);
+    for (int i = 0; i < count; i++) {
+        const int * r = regions + 9 * i;
+        CopyRegion & copy = copies[i];
+        copy.src = sources[i]->m->image;
+        copy.xsrc = r[0]; copy.ysrc = r[1]; copy.zsrc = r[2];
+        copy.xsize = r[3]; copy.ysize = r[4]; copy.zsize = r[5];
+        copy.xdst = r[6]; copy.ydst = r[7]; copy.zdst = r[8];
+    }
+
+    copyTexels(m->image, copies);
 
-        // Copy region from src to dst.
-        for (int z = 0; z < zsize; z++) {
-            for (int y = 0; y < ysize; y++) {
-                for (int x = 0; x < xsize; x++) {
-                    d[dst->index(xdst + x, ydst + y, zdst + z)] = s[src->index(xsrc + x, ysrc + y, zsrc + z)];
-                }
-            }
-        }
+    for (int i = 0; i < count; i++) {
+        const int * r = regions + 9 * i;
+        if (r[5] > 0) m->addDirty(r[6], r[7], r[6] + r[3], r[7] + r[4]);
+    }
+
+    return true;
+}
+
+
+void Surface::Private::addDirty(int x0, int y0, int x1, int y1)
+{
+    if (x0 >= x1 || y0 >= y1) return;
+
+    if (dirtyX0 == dirtyX1) {
+        dirtyX0 = x0;
+        dirtyY0 = y0;
+        dirtyX1 = x1;
+        dirtyY1 = y1;
+    }
+    else {
+        dirtyX0 = min(dirtyX0, x0);
+        dirtyY0 = min(dirtyY0, y0);
+        dirtyX1 = max(dirtyX1, x1);
+        dirtyY1 = max(dirtyY1, y1);
+    }
+}
+
+void Surface::addDirtyRegion(int x, int y, int w, int h)
+{
+    if (isNull() || w <= 0 || h <= 0) return;
+
+    detach();
+    m->addDirty(x, y, x + w, y + h);
+}
+
+bool Surface::dirtyRegion(int * x, int * y, int * w, int * h) const
+{
+    // Clip to the extents, the surface may have been resized since.
+    const int x0 = max(m->dirtyX0, 0);
+    const int y0 = max(m->dirtyY0, 0);
+    const int x1 = isNull() ? 0 : min(m->dirtyX1, width());
+    const int y1 = isNull() ? 0 : min(m->dirtyY1, height());
+
+    const bool dirty = x0 < x1 && y0 < y1;
+
+    if (x != NULL) *x = dirty ? x0 : 0;
+    if (y != NULL) *y = dirty ? y0 : 0;
+    if (w != NULL) *w = dirty ? x1 - x0 : 0;
+    if (h != NULL) *h = dirty ? y1 - y0 : 0;
+
+    return dirty;
+}
+
+void Surface::clearDirtyRegion()
+{
+    if (m->dirtyX0 == m->dirtyX1) return;
+
+    detach();
+    m->clearDirty();
+}
+
+// Texels [*begin, *end) of the next mipmap along an axis of n texels that fastDownSample builds from the texels [x0, x1).
+static void mipmapRange(int n, int x0, int x1, int * begin, int * end)
+{
+    if (n == 1) {
+        *begin = 0;
+        *end = 1;
+        return;
+    }
+
+    // Texel x reads the texels [2x, 2x + taps), polyphase filters read three.
+    const int taps = (n & 1) ? 3 : 2;
+
+    *begin = max(0, x0 - taps + 2) / 2;
+    *end = min(n / 2, (x1 - 1) / 2 + 1);
+}
+
+bool Surface::updateMipmap(const Surface & parent, MipmapFilter filter)
+{
+    if (parent.isNull() || !nv::canMakeNextMipmap(parent.width(), parent.height(), parent.depth(), 1)) {
+        return false;
+    }
+
+    const int w = max(1, parent.width() / 2);
+    const int h = max(1, parent.height() / 2);
+    const int d = max(1, parent.depth() / 2);
+
+    // The same condition under which buildNextMipmap uses fastDownSample without scaling the alpha.
+    const Surface::Private * p = parent.m;
+    if (isNull() || width() != w || height() != h || depth() != d || filter != MipmapFilter_Box ||
+        parent.depth() != 1 || p->alphaMode == AlphaMode_Transparency || p->alphaCoverage >= 0.0f)
+    {
+        Surface mipmap = parent;
+        mipmap.clearDirtyRegion();
+        mipmap.buildNextMipmap(filter);
+        mipmap.addDirtyRegion(0, 0, w, h);
+
+        *this = mipmap;
+        return true;
     }
 
+    int x, y, rw, rh;
+    if (!parent.dirtyRegion(&x, &y, &rw, &rh)) {
+        return true;
+    }
+
+    int x0, x1, y0, y1;
+    mipmapRange(parent.width(), x, x + rw, &x0, &x1);
+    mipmapRange(parent.height(), y, y + rh, &y0, &y1);
+
+    NVTT_PROFILE("update mipmap", (x1 - x0) * (y1 - y0));
+
+    p->flush();
+    detach();
+
+    p->image->fastDownSampleRegion(m->image, x0, y0, x1, y1);
+    m->addDirty(x0, y0, x1, y1);
+
     return true;
 }
 
@@ -2825,41 +3723,39 @@ void Surface::setAtlasBorder(int aw, int ah, float r, float g, float b, float a)
     uint tile_height = h / ah;
     uint tile_width = w / aw;
 
+    if (tile_width == 0 || tile_height == 0) return;
+
     // Note that this renders two consecutive lines between tiles. In theory we could just have one, but this way I think we have better rotation invariance.
 
-    for (uint z = 0; z < d; z++)
+    const float color[4] = { r, g, b, a };
+
+    for (uint c = 0; c < 4; c++)
     {
-        // Horizontal lines:
-        for (uint i = 0, y = 0; i < uint(ah); i++, y += tile_height)
+        const float value = color[c];
+
+        for (uint z = 0; z < d; z++)
         {
-            for (uint x = 0; x < w; x++)
+            // Horizontal lines:
+            for (uint i = 0, y = 0; i < uint(ah); i++, y += tile_height)
             {
-                img->pixel(0, x, y, z) = r;
-                img->pixel(1, x, y, z) = g;
-                img->pixel(2, x, y, z) = b;
-                img->pixel(3, x, y, z) = a;
-
-                img->pixel(0, x, y + tile_height - 1, z) = r;
-                img->pixel(1, x, y + tile_height - 1, z) = g;
-                img->pixel(2, x, y + tile_height - 1, z) = b;
-                img->pixel(3, x, y + tile_height - 1, z) = a;
+                float * row0 = img->channel(c) + img->index(0, y, z);
+                float * row1 = img->channel(c) + img->index(0, y + tile_height - 1, z);
+                for (uint x = 0; x < w; x++)
+                {
+                    row0[x] = value;
+                    row1[x] = value;
+                }
             }
-        }
 
-        // Vertical lines:
-        for (uint i = 0, x = 0; i < uint(ah); i++, x += tile_width)
-        {
+            // Vertical lines:
             for (uint y = 0; y < h; y++)
             {
-                img->pixel(0, x, y, z) = r;
-                img->pixel(1, x, y, z) = g;
-                img->pixel(2, x, y, z) = b;
-                img->pixel(3, x, y, z) = a;
-
-                img->pixel(0, x + tile_width - 1, y, z) = r;
-                img->pixel(1, x + tile_width - 1, y, z) = g;
-                img->pixel(2, x + tile_width - 1, y, z) = b;
-                img->pixel(3, x + tile_width - 1, y, z) = a;
+                float * row = img->channel(c) + img->index(0, y, z);
+                for (uint i = 0, x = 0; i < uint(aw); i++, x += tile_width)
+                {
+                    row[x] = value;
+                    row[x + tile_width - 1] = value;
+                }
             }
         }
     }
@@ -2869,30 +3765,70 @@ void Surface::setAtlasBorder(int aw, int ah, float r, float g, float b, float a)
 
 float nvtt::rmsError(const Surface & reference, const Surface & image)
 {
+    reference.m->flush();
+    image.m->flush();
     return nv::rmsColorError(reference.m->image, image.m->image, reference.alphaMode() == nvtt::AlphaMode_Transparency);
 }
 
 
 float nvtt::rmsAlphaError(const Surface & reference, const Surface & image)
 {
+    reference.m->flush();
+    image.m->flush();
     return nv::rmsAlphaError(reference.m->image, image.m->image);
 }
 
 
 float nvtt::cieLabError(const Surface & reference, const Surface & image)
 {
+    reference.m->flush();
+    image.m->flush();
     return nv::cieLabError(reference.m->image, image.m->image);
 }
 
 float nvtt::angularError(const Surface & reference, const Surface & image)
 {
+    reference.m->flush();
+    image.m->flush();
     //return nv::averageAngularError(reference.m->image, image.m->image);
     return nv::rmsAngularError(reference.m->image, image.m->image);
 }
 
+float nvtt::ssimError(const Surface & reference, const Surface & image, bool multiScale/*= false*/)
+{
+    reference.m->flush();
+    image.m->flush();
+
+    if (multiScale) return 1.0f - nv::multiScaleStructuralSimilarity(reference.m->image, image.m->image);
+    return 1.0f - nv::structuralSimilarity(reference.m->image, image.m->image);
+}
+
+void nvtt::errorMetrics(const Surface & reference, const Surface & image, float * rms, float * rmsAlpha, float * cieLab, float * angular)
+{
+    reference.m->flush();
+    image.m->flush();
+
+    uint flags = 0;
+    if (rms != NULL) flags |= nv::ErrorMetric_RmsColor;
+    if (rmsAlpha != NULL) flags |= nv::ErrorMetric_RmsAlpha;
+    if (cieLab != NULL) flags |= nv::ErrorMetric_CieLab;
+    if (angular != NULL) flags |= nv::ErrorMetric_RmsAngular;
+
+    nv::ErrorMetrics metrics;
+    nv::computeErrorMetrics(reference.m->image, image.m->image, reference.alphaMode() == nvtt::AlphaMode_Transparency, flags, &metrics);
+
+    if (rms != NULL) *rms = metrics.rmsColor;
+    if (rmsAlpha != NULL) *rmsAlpha = metrics.rmsAlpha;
+    if (cieLab != NULL) *cieLab = metrics.cieLab;
+    if (angular != NULL) *angular = metrics.rmsAngular;
+}
+
 
 Surface nvtt::diff(const Surface & reference, const Surface & image, float scale)
 {
+    reference.m->flush();
+    image.m->flush();
+
     const FloatImage * ref = reference.m->image;
     const FloatImage * img = image.m->image;
 
@@ -2940,24 +3876,39 @@ Surface nvtt::diff(const Surface & reference, const Surface & image, float scale
     return diffImage;
 }
 
-float nvtt::rmsToneMappedError(const Surface & reference, const Surface & img, float exposure)
+int nvtt::loadSurfaces(const char * const * fileNames, int count, Surface * surfaces, bool * hasAlpha/*= NULL*/)
 {
-    // @@ We could do this in the rms function without having to create image copies.
-    Surface r = reference;
-    Surface i = img;
+    nvCheck(count >= 0);
 
-    // @@ Ideally we should use our Reindhart operator. Add Reindhart_L & Reindhart_M ?
+    Array<FloatImage *> images;
+    images.resize(count);
+
+    const int loaded = ImageIO::loadFloatBatch(fileNames, count, images.buffer());
+
+    for (int i = 0; i < count; i++) {
+        if (images[i] != NULL) {
+            setLoadedImage(surfaces[i].m, images[i], hasAlpha != NULL ? hasAlpha + i : NULL);
+        }
+    }
+
+    return loaded;
+}
 
-    float scale = 1.0f / exposure;
+float nvtt::rmsToneMappedError(const Surface & reference, const Surface & img, float exposure)
+{
+    float error;
+    rmsToneMappedErrors(reference, img, &exposure, 1, &error);
+    return error;
+}
 
-    r.scaleBias(0, scale, 0); r.scaleBias(1, scale, 0); r.scaleBias(2, scale, 0);
-    r.toneMap(ToneMapper_Reindhart, NULL);
-    r.toSrgb();
+void nvtt::rmsToneMappedErrors(const Surface & reference, const Surface & img, const float * exposures, int count, float * errors)
+{
+    // @@ Ideally we should use our Reindhart operator. Add Reindhart_L & Reindhart_M ?
 
-    i.scaleBias(0, scale, 0); i.scaleBias(1, scale, 0); i.scaleBias(2, scale, 0);
-    i.toneMap(ToneMapper_Reindhart, NULL);
-    i.toSrgb();
+    // The texels are tone mapped as they are read, without copies of the surfaces.
+    reference.m->flush();
+    img.m->flush();
 
-    return nv::rmsColorError(r.m->image, i.m->image, reference.alphaMode() == nvtt::AlphaMode_Transparency);
+    nv::rmsToneMappedErrors(reference.m->image, img.m->image, reference.alphaMode() == nvtt::AlphaMode_Transparency, exposures, count, errors);
 }
 
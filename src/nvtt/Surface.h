@@ -29,12 +29,40 @@
 
 #include "nvcore/RefCounted.h"
 #include "nvcore/Ptr.h"
+#include "nvcore/Array.h"
 
 #include "nvimage/Image.h"
 #include "nvimage/FloatImage.h"
 
 namespace nvtt
 {
+    // Per-texel operation, run in tiles by Surface::Private::flush. Deferred surfaces accumulate them.
+    struct PixelOp
+    {
+        enum Type
+        {
+            Exponentiate,       // Channels [channel, channel + count), to the power of params[0], with approxPow when params[1] is not 0.
+            ToSrgb,             // With approxPow when params[0] is not 0.
+            FromSrgb,           // With approxPow when params[0] is not 0.
+            ToXenonSrgb,
+            Transform,          // Weights w0 to w3 of Surface::transform in params[0..15] and offset in params[16..19].
+            Swizzle,            // Sources in params[0..3], like FloatImage::swizzle.
+            ScaleBias,          // Channel, params[0] * x + params[1].
+            Clamp,              // Channel, between params[0] and params[1].
+            Blend,              // Towards the color in params[0..3] by params[4].
+            PremultiplyAlpha,
+            ToRgbm,             // Threshold in params[0].
+            ToRgbe,             // Mantissa and exponent bits in params[0] and params[1].
+            ToYCoCg,
+            ToLuvw,             // Range in params[0].
+            ToneMap,            // nvtt::ToneMapper in params[0].
+        };
+
+        Type type;
+        int channel;
+        int count;
+        float params[20];
+    };
 
     struct Surface::Private : public nv::RefCounted
     {
@@ -48,6 +76,12 @@ namespace nvtt
             wrapMode = WrapMode_Mirror;
             alphaMode = AlphaMode_None;
             isNormalMap = false;
+            deferred = false;
+            approximateGamma = false;
+            alphaCoverage = -1.0f;
+            alphaCoverageRef = 0.5f;
+            storageFormat = StorageFormat_Float;
+            clearDirty();
             
             image = NULL;
         }
@@ -59,8 +93,37 @@ namespace nvtt
             wrapMode = p.wrapMode;
             alphaMode = p.alphaMode;
             isNormalMap = p.isNormalMap;
+            deferred = p.deferred;
+            approximateGamma = p.approximateGamma;
+            alphaCoverage = p.alphaCoverage;
+            alphaCoverageRef = p.alphaCoverageRef;
+
+            image = (p.image != NULL) ? p.image->clone() : NULL;
+            ops = p.ops;
+            storageFormat = p.storageFormat;
+            packed = p.packed;
+
+            dirtyX0 = p.dirtyX0;
+            dirtyY0 = p.dirtyY0;
+            dirtyX1 = p.dirtyX1;
+            dirtyY1 = p.dirtyY1;
+        }
+        Private(const Private & p, nv::FloatImage * image) : RefCounted() // Copy the attributes, but not the texels or the pending operations.
+        {
+            nvDebugCheck( refCount() == 0 );
+
+            type = p.type;
+            wrapMode = p.wrapMode;
+            alphaMode = p.alphaMode;
+            isNormalMap = p.isNormalMap;
+            deferred = p.deferred;
+            approximateGamma = p.approximateGamma;
+            alphaCoverage = p.alphaCoverage;
+            alphaCoverageRef = p.alphaCoverageRef;
+            storageFormat = StorageFormat_Float;
+            clearDirty();
 
-            image = p.image->clone();
+            this->image = image;
         }
         ~Private()
         {
@@ -71,10 +134,39 @@ namespace nvtt
         WrapMode wrapMode;
         AlphaMode alphaMode;
         bool isNormalMap;
+        bool deferred;
+        bool approximateGamma;  // See setApproximateGamma.
+
+        // Alpha test coverage of the mipmaps, disabled when negative, see setMipmapAlphaCoverage.
+        float alphaCoverage;
+        float alphaCoverageRef;
+
+        // Views of external memory are replaced by a copy when flushing operations, see setImageView.
+        mutable nv::FloatImage * image;
+
+        // Expand the texels of a packed surface to floats.
+        void unpack() const;
 
-        nv::FloatImage * image;
+        // Run the pending operations, after unpacking the texels. When a source image is given its texels are copied to the image on the way, tile by tile.
+        void flush(const nv::FloatImage * source = NULL) const;
+
+        // Operations that are not in the image yet. Only deferred surfaces keep them after returning from an operation.
+        mutable nv::Array<PixelOp> ops;
+
+        // Packed surfaces keep their image with the extents, but no channels.
+        mutable StorageFormat storageFormat;
+        mutable nv::Array<uint8> packed;
+
+        // Bounding rectangle [x0, x1) x [y0, y1) of the texels changed since the dirty region was cleared, empty when x0 == x1.
+        int dirtyX0, dirtyY0, dirtyX1, dirtyY1;
+
+        void clearDirty() { dirtyX0 = dirtyY0 = dirtyX1 = dirtyY1 = 0; }
+        void addDirty(int x0, int y0, int x1, int y1);
     };
 
+    // Surface::setImageLinear of interleaved texels whose rows are pitch bytes apart, or packed when pitch is 0.
+    bool setImageLinear(Surface & img, InputFormat format, int w, int h, int d, const void * data, uint pitch, float gamma);
+
 } // nvtt namespace
 
 namespace nv {
@@ -0,0 +1,58 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "TaskDispatcher.h"
+
+using namespace nvtt;
+
+namespace {
+    struct RangeTaskContext
+    {
+        RangeTask * task;
+        void * context;
+        int count;
+        int grain;
+    };
+
+    // Each task runs one chunk of the range.
+    void RangeChunkTask(void * data, int i)
+    {
+        RangeTaskContext * ctx = (RangeTaskContext *)data;
+
+        int begin = i * ctx->grain;
+        int end = begin + ctx->grain;
+        if (end > ctx->count) end = ctx->count;
+
+        ctx->task(ctx->context, begin, end);
+    }
+}
+
+void TaskDispatcher::dispatchRange(RangeTask * task, void * context, int count, int grain)
+{
+    if (count <= 0) return;
+    if (grain < 1) grain = 1;
+
+    RangeTaskContext ctx = { task, context, count, grain };
+
+    dispatch(RangeChunkTask, &ctx, (count + grain - 1) / grain);
+}
@@ -28,6 +28,7 @@
 #endif
 
 #include "nvthread/ParallelFor.h"
+#include "nvthread/TaskScheduler.h"
 
 
 namespace nvtt {
@@ -39,13 +40,35 @@ namespace nvtt {
                 task(context, i);
             }
         }
+
+        virtual void dispatchRange(RangeTask * task, void * context, int count, int /*grain*/) {
+            if (count > 0) task(context, 0, count);
+        }
     };
 
     struct ParallelTaskDispatcher : public TaskDispatcher
     {
         virtual void dispatch(Task * task, void * context, int count) {
             nv::ParallelFor parallelFor(task, context);
-            parallelFor.run(count); // @@ Add support for custom grain.
+            parallelFor.run(count);
+        }
+
+        virtual void dispatchRange(RangeTask * task, void * context, int count, int grain) {
+            nv::ParallelFor parallelFor(task, context);
+            parallelFor.run(count, grain > 0 ? grain : 1);
+        }
+    };
+
+
+    // Task dispatcher using the work-stealing scheduler. Dispatches can be nested, a waiting task runs pending work instead of blocking.
+    struct WorkStealingTaskDispatcher : public TaskDispatcher
+    {
+        virtual void dispatch(Task * task, void * context, int count) {
+            nv::TaskScheduler::global()->parallelFor(task, context, count);
+        }
+
+        virtual void dispatchRange(RangeTask * task, void * context, int count, int grain) {
+            nv::TaskScheduler::global()->parallelFor(task, context, count, grain > 0 ? grain : 1);
         }
     };
 
@@ -60,6 +83,14 @@ namespace nvtt {
                 task(context, i);
             }
         }
+
+        virtual void dispatchRange(RangeTask * task, void * context, int count, int grain) {
+            if (grain < 1) grain = 1;
+            #pragma omp parallel for schedule(dynamic)
+            for (int begin = 0; begin < count; begin += grain) {
+                task(context, begin, begin + grain < count ? begin + grain : count);
+            }
+        }
     };
 
 #endif
@@ -143,7 +174,8 @@ namespace nvtt {
     typedef AppleTaskDispatcher         ConcurrentTaskDispatcher;
 #else
     //typedef SequentialTaskDispatcher    ConcurrentTaskDispatcher;
-    typedef ParallelTaskDispatcher        ConcurrentTaskDispatcher;
+    //typedef ParallelTaskDispatcher      ConcurrentTaskDispatcher;
+    typedef WorkStealingTaskDispatcher    ConcurrentTaskDispatcher;
 #endif
 
 } // namespace nvtt
@@ -24,6 +24,7 @@
 
 #include <math.h>
 #include <float.h> // FLT_MAX
+#include <limits.h> // INT_MAX
 
 #include "CudaMath.h"
 
@@ -388,17 +389,16 @@ __device__ void sortColors(const float * values, int * ranks, int count)
 // Load color block to shared mem
 ////////////////////////////////////////////////////////////////////////////////
 
-__device__ void loadColorBlockTex(uint firstBlock, uint blockWidth, float3 colors[16], float3 sums[16], int xrefs[16], int * sameColor)
+__device__ void loadColorBlockTex(uint block, uint blockWidth, float3 colors[16], float3 sums[16], int xrefs[16], int * sameColor)
 {
-    const int bid = blockIdx.x;
     const int idx = threadIdx.x;
 
     __shared__ float dps[16];
 
     if (idx < 16)
     {
-        float x = 4 * ((firstBlock + bid) % blockWidth) + idx % 4; // @@ Avoid mod and div by using 2D grid?
-        float y = 4 * ((firstBlock + bid) / blockWidth) + idx / 4;
+        float x = 4 * (block % blockWidth) + idx % 4; // @@ Avoid mod and div by using 2D grid?
+        float y = 4 * (block / blockWidth) + idx / 4;
 
         // Read color and copy to shared mem.
         float4 c = tex2D(tex, x, y);
@@ -463,9 +463,8 @@ __device__ void loadColorBlockTex(uint firstBlock, uint w, float3 colors[16], fl
 }
 */
 
-__device__ void loadColorBlockTex(uint firstBlock, uint width, float3 colors[16], float3 sums[16], float weights[16], int xrefs[16], int * sameColor)
+__device__ void loadColorBlockTex(uint block, uint width, float3 colors[16], float3 sums[16], float weights[16], int xrefs[16], int * sameColor)
 {
-    const int bid = blockIdx.x;
     const int idx = threadIdx.x;
 
     __shared__ float3 rawColors[16];
@@ -473,8 +472,8 @@ __device__ void loadColorBlockTex(uint firstBlock, uint width, float3 colors[16]
 
     if (idx < 16)
     {
-        float x = 4 * ((firstBlock + bid) % width) + idx % 4; // @@ Avoid mod and div by using 2D grid?
-        float y = 4 * ((firstBlock + bid) / width) + idx / 4;
+        float x = 4 * (block % width) + idx % 4; // @@ Avoid mod and div by using 2D grid?
+        float y = 4 * (block / width) + idx / 4;
 
         // Read color and copy to shared mem.
         float4 c = tex2D(tex, x, y);
@@ -1251,8 +1250,6 @@ __device__ int findMinError(float * errors)
 ////////////////////////////////////////////////////////////////////////////////
 __device__ void saveBlockDXT1(ushort start, ushort end, uint permutation, int xrefs[16], uint2 * result)
 {
-    const int bid = blockIdx.x;
-
     if (start == end)
     {
         permutation = 0;
@@ -1267,16 +1264,15 @@ __device__ void saveBlockDXT1(ushort start, ushort end, uint permutation, int xr
     }
 
     // Write endpoints.
-    result[bid].x = (end << 16) | start;
+    result->x = (end << 16) | start;
 
     // Write palette indices.
-    result[bid].y = indices;
+    result->y = indices;
 }
 
 __device__ void saveBlockDXT1_Parallel(uint endpoints, float3 colors[16], int xrefs[16], uint * result)
 {
     const int tid = threadIdx.x;
-    const int bid = blockIdx.x;
 
     if (tid < 16)
     {
@@ -1340,7 +1336,7 @@ __device__ void saveBlockDXT1_Parallel(uint endpoints, float3 colors[16], int xr
         if (tid < 1) indices[tid] |= indices[tid+1];
 
         if (tid < 2) {
-            result[2 * bid + tid] = tid == 0 ? endpoints : indices[0];
+            result[tid] = tid == 0 ? endpoints : indices[0];
         }
     }
 }
@@ -1348,7 +1344,6 @@ __device__ void saveBlockDXT1_Parallel(uint endpoints, float3 colors[16], int xr
 __device__ void saveBlockDXT1_Parallel(uint endpoints, uint permutation, int xrefs[16], uint * result)
 {
     const int tid = threadIdx.x;    
-    const int bid = blockIdx.x;
 
     if (tid < 16)
     {
@@ -1363,7 +1358,7 @@ __device__ void saveBlockDXT1_Parallel(uint endpoints, uint permutation, int xre
         if (tid < 1) indices[tid] |= indices[tid+1];
     	
         if (tid < 2) {
-            result[2 * bid + tid] = tid == 0 ? endpoints : indices[0];
+            result[tid] = tid == 0 ? endpoints : indices[0];
         }
     }
 }
@@ -1376,8 +1371,6 @@ __device__ void saveBlockCTX1(ushort start, ushort end, uint permutation, int xr
 
 __device__ void saveSingleColorBlockDXT1(float3 color, uint2 * result)
 {
-    const int bid = blockIdx.x;
-
     int r = color.x * 255;
     int g = color.y * 255;
     int b = color.z * 255;
@@ -1387,20 +1380,18 @@ __device__ void saveSingleColorBlockDXT1(float3 color, uint2 * result)
 
     if (color0 < color1)
     {
-        result[bid].x = (color0 << 16) | color1;
-        result[bid].y = 0xffffffff;
+        result->x = (color0 << 16) | color1;
+        result->y = 0xffffffff;
     }
     else
     {
-        result[bid].x = (color1 << 16) | color0;
-        result[bid].y = 0xaaaaaaaa;
+        result->x = (color1 << 16) | color0;
+        result->y = 0xaaaaaaaa;
     }
 }
 
 __device__ void saveSingleColorBlockDXT1(float2 color, uint2 * result)
 {
-    const int bid = blockIdx.x;
-
     int r = color.x * 255;
     int g = color.y * 255;
 
@@ -1409,27 +1400,25 @@ __device__ void saveSingleColorBlockDXT1(float2 color, uint2 * result)
 
     if (color0 < color1)
     {
-        result[bid].x = (color0 << 16) | color1;
-        result[bid].y = 0xffffffff;
+        result->x = (color0 << 16) | color1;
+        result->y = 0xffffffff;
     }
     else
     {
-        result[bid].x = (color1 << 16) | color0;
-        result[bid].y = 0xaaaaaaaa;
+        result->x = (color1 << 16) | color0;
+        result->y = 0xaaaaaaaa;
     }
 }
 
 __device__ void saveSingleColorBlockCTX1(float2 color, uint2 * result)
 {
-    const int bid = blockIdx.x;
-
     int r = color.x * 255;
     int g = color.y * 255;
 
     ushort color0 = (r << 8) | (g);
 
-    result[bid].x = (color0 << 16) | color0;
-    result[bid].y = 0x00000000;
+    result->x = (color0 << 16) | color0;
+    result->y = 0x00000000;
 }
 
 
@@ -1437,14 +1426,14 @@ __device__ void saveSingleColorBlockCTX1(float2 color, uint2 * result)
 // Compress color block
 ////////////////////////////////////////////////////////////////////////////////
 
-__global__ void compressDXT1(uint firstBlock, uint blockWidth, const uint * permutations, uint2 * result)
+__device__ void compressBlockDXT1(uint block, uint blockWidth, const uint * permutations, uint2 * result)
 {
     __shared__ float3 colors[16];
     __shared__ float3 sums[16];
     __shared__ int xrefs[16];
     __shared__ int sameColor;
 
-    loadColorBlockTex(firstBlock, blockWidth, colors, sums, xrefs, &sameColor);
+    loadColorBlockTex(block, blockWidth, colors, sums, xrefs, &sameColor);
 
     __syncthreads();
 
@@ -1480,14 +1469,14 @@ __global__ void compressDXT1(uint firstBlock, uint blockWidth, const uint * perm
 }
 
 
-__global__ void compressLevel4DXT1(uint firstBlock, uint blockWidth, const uint * permutations, uint2 * result)
+__device__ void compressBlockLevel4DXT1(uint block, uint blockWidth, const uint * permutations, uint2 * result)
 {
     __shared__ float3 colors[16];
     __shared__ float3 sums[16];
     __shared__ int xrefs[16];
     __shared__ int sameColor;
 
-    loadColorBlockTex(firstBlock, blockWidth, colors, sums, xrefs, &sameColor);
+    loadColorBlockTex(block, blockWidth, colors, sums, xrefs, &sameColor);
 
     __syncthreads();
 
@@ -1514,7 +1503,7 @@ __global__ void compressLevel4DXT1(uint firstBlock, uint blockWidth, const uint
     }
 }
 
-__global__ void compressWeightedDXT1(uint firstBlock, uint blockWidth, const uint * permutations, uint2 * result)
+__device__ void compressBlockWeightedDXT1(uint block, uint blockWidth, const uint * permutations, uint2 * result)
 {
     __shared__ float3 colors[16];
     __shared__ float3 sums[16];
@@ -1522,7 +1511,7 @@ __global__ void compressWeightedDXT1(uint firstBlock, uint blockWidth, const uin
     __shared__ int xrefs[16];
     __shared__ int sameColor;
 
-    loadColorBlockTex(firstBlock, blockWidth, colors, sums, weights, xrefs, &sameColor);
+    loadColorBlockTex(block, blockWidth, colors, sums, weights, xrefs, &sameColor);
 
     __syncthreads();
 
@@ -1552,6 +1541,8 @@ __global__ void compressWeightedDXT1(uint firstBlock, uint blockWidth, const uin
 
 __global__ void compressNormalDXT1(const uint * permutations, const uint * image, uint2 * result)
 {
+    result += blockIdx.x;
+
     __shared__ float2 colors[16];
     __shared__ float2 sums[16];
     __shared__ int xrefs[16];
@@ -1586,6 +1577,8 @@ __global__ void compressNormalDXT1(const uint * permutations, const uint * image
 
 __global__ void compressCTX1(const uint * permutations, const uint * image, uint2 * result)
 {
+    result += blockIdx.x;
+
     __shared__ float2 colors[16];
     __shared__ float2 sums[16];
     __shared__ int xrefs[16];
@@ -1916,6 +1909,397 @@ __global__ void compressDXT5n(uint blockNum, uint2 * d_result)
 */
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Compress alpha block (BC4, BC5)
+////////////////////////////////////////////////////////////////////////////////
+
+// Same palettes as AlphaBlockDXT5::evaluatePalette, the 6 step one when alpha0 <= alpha1.
+__device__ void evaluateAlphaPalette(int alpha0, int alpha1, int palette[8])
+{
+    palette[0] = alpha0;
+    palette[1] = alpha1;
+
+    if (alpha0 > alpha1)
+    {
+        palette[2] = (6 * alpha0 + 1 * alpha1) / 7;
+        palette[3] = (5 * alpha0 + 2 * alpha1) / 7;
+        palette[4] = (4 * alpha0 + 3 * alpha1) / 7;
+        palette[5] = (3 * alpha0 + 4 * alpha1) / 7;
+        palette[6] = (2 * alpha0 + 5 * alpha1) / 7;
+        palette[7] = (1 * alpha0 + 6 * alpha1) / 7;
+    }
+    else
+    {
+        palette[2] = (4 * alpha0 + 1 * alpha1) / 5;
+        palette[3] = (3 * alpha0 + 2 * alpha1) / 5;
+        palette[4] = (2 * alpha0 + 3 * alpha1) / 5;
+        palette[5] = (1 * alpha0 + 4 * alpha1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+__device__ int computeAlphaError(const int alphas[16], int alpha0, int alpha1, int bestError)
+{
+    int palette[8];
+    evaluateAlphaPalette(alpha0, alpha1, palette);
+
+    int totalError = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        int minDist = INT_MAX;
+        for (int p = 0; p < 8; p++)
+        {
+            int d = alphas[i] - palette[p];
+            minDist = min(minDist, d * d);
+        }
+
+        totalError += minDist;
+
+        // Early out.
+        if (totalError > bestError) break;
+    }
+
+    return totalError;
+}
+
+// Read one channel of the block, 0 is red and 1 is green.
+__device__ void loadAlphaBlockTex(uint block, uint blockWidth, int channel, int alphas[16])
+{
+    const int idx = threadIdx.x;
+
+    if (idx < 16)
+    {
+        float x = 4 * (block % blockWidth) + idx % 4;
+        float y = 4 * (block / blockWidth) + idx / 4;
+
+        // The texture is in Color32 order, red is in z.
+        float4 c = tex2D(tex, x, y);
+
+        alphas[idx] = __float2int_rn(__saturatef(channel == 0 ? c.z : c.y) * 255.0f);
+    }
+}
+
+// Exhaustive search of the endpoints, like OptimalCompress::compressDXT5A, with the pairs split between the threads.
+__device__ void compressAlphaBlock(const int alphas[16], uint2 * result)
+{
+    const int idx = threadIdx.x;
+
+    __shared__ int s_range[4];
+
+    if (idx == 0)
+    {
+        int mina = 255, maxa = 0;
+        int mina_no01 = 255, maxa_no01 = 0;
+
+        for (int i = 0; i < 16; i++)
+        {
+            mina = min(mina, alphas[i]);
+            maxa = max(maxa, alphas[i]);
+
+            if (alphas[i] != 0 && alphas[i] != 255)
+            {
+                mina_no01 = min(mina_no01, alphas[i]);
+                maxa_no01 = max(maxa_no01, alphas[i]);
+            }
+        }
+
+        s_range[0] = mina;
+        s_range[1] = maxa;
+        s_range[2] = mina_no01;
+        s_range[3] = maxa_no01;
+    }
+
+    __syncthreads();
+
+    const int mina = s_range[0];
+    const int maxa = s_range[1];
+    const int mina_no01 = s_range[2];
+    const int maxa_no01 = s_range[3];
+
+    __shared__ int s_endpoints;
+
+    if (maxa - mina < 8)
+    {
+        // The 8 step palette represents the block exactly.
+        if (idx == 0) s_endpoints = (mina << 8) | maxa;
+    }
+    else if (maxa_no01 - mina_no01 < 6)
+    {
+        // And so does the 6 step one.
+        if (idx == 0) s_endpoints = (maxa_no01 << 8) | mina_no01;
+    }
+    else
+    {
+        int bestError = computeAlphaError(alphas, maxa, mina, INT_MAX);
+        int bestEndpoints = (mina << 8) | maxa;
+
+        // Expand search space a bit.
+        const int lo8 = max(mina - 8, 0);
+        const int hi8 = min(maxa + 8, 255);
+        const int lo6 = max(mina_no01 - 6, 0);
+        const int hi6 = min(maxa_no01 + 6, 255);
+
+        // Each thread takes every NUM_THREADS-th upper endpoint of both palettes.
+        for (int a0 = lo8 + 9 + idx; a0 < hi8; a0 += NUM_THREADS)
+        {
+            for (int a1 = lo8; a1 < a0 - 8; a1++)
+            {
+                int error = computeAlphaError(alphas, a0, a1, bestError);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    bestEndpoints = (a1 << 8) | a0;
+                }
+            }
+        }
+
+        for (int a0 = lo6 + 9 + idx; a0 < hi6; a0 += NUM_THREADS)
+        {
+            for (int a1 = lo6; a1 < a0 - 8; a1++)
+            {
+                int error = computeAlphaError(alphas, a1, a0, bestError);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    bestEndpoints = (a0 << 8) | a1;
+                }
+            }
+        }
+
+        __shared__ float errors[NUM_THREADS];
+        errors[idx] = float(bestError);
+
+        // Use a parallel reduction to find minimum error.
+        const int minIdx = findMinError(errors);
+
+        if (idx == minIdx)
+        {
+            s_endpoints = bestEndpoints;
+        }
+    }
+
+    __syncthreads();
+
+    // Compute the indices, one thread per texel.
+    __shared__ uint s_indices[16];
+
+    const int alpha0 = s_endpoints & 0xFF;
+    const int alpha1 = s_endpoints >> 8;
+
+    if (idx < 16)
+    {
+        int palette[8];
+        evaluateAlphaPalette(alpha0, alpha1, palette);
+
+        int bestDist = INT_MAX;
+        uint bestIndex = 0;
+        for (int p = 0; p < 8; p++)
+        {
+            int d = alphas[idx] - palette[p];
+            if (d * d < bestDist)
+            {
+                bestDist = d * d;
+                bestIndex = p;
+            }
+        }
+
+        s_indices[idx] = bestIndex;
+    }
+
+    __syncthreads();
+
+    if (idx == 0)
+    {
+        unsigned long long bits = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            bits |= (unsigned long long)s_indices[i] << (3 * i);
+        }
+
+        uint2 block;
+        block.x = alpha0 | (alpha1 << 8) | uint(bits << 16);
+        block.y = uint(bits >> 16);
+        *result = block;
+    }
+}
+
+__device__ void compressBlockBC4(uint block, uint blockWidth, const uint * permutations, uint2 * result)
+{
+    __shared__ int alphas[16];
+
+    loadAlphaBlockTex(block, blockWidth, 0, alphas);
+
+    __syncthreads();
+
+    compressAlphaBlock(alphas, result);
+}
+
+__device__ void compressBlockBC5(uint block, uint blockWidth, const uint * permutations, uint4 * result)
+{
+    __shared__ int alphas[16];
+
+    loadAlphaBlockTex(block, blockWidth, 0, alphas);
+
+    __syncthreads();
+
+    compressAlphaBlock(alphas, (uint2 *)result + 0);
+
+    __syncthreads();
+
+    loadAlphaBlockTex(block, blockWidth, 1, alphas);
+
+    __syncthreads();
+
+    compressAlphaBlock(alphas, (uint2 *)result + 1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Measure error
+////////////////////////////////////////////////////////////////////////////////
+
+#define ERROR_BLOCKS 4  // Compressed blocks per thread block of the error kernel, one thread per texel.
+
+enum ErrorFormat
+{
+    ErrorFormat_DXT1,
+    ErrorFormat_BC4,
+    ErrorFormat_BC5,
+};
+
+// Decode one texel of a DXT1 block to red, green and blue in [0, 255].
+__device__ int3 decodeTexelDXT1(const uint * block, int i)
+{
+    const ushort endpoint0 = block[0] & 0xFFFF;
+    const ushort endpoint1 = block[0] >> 16;
+    const uint index = (block[1] >> (2 * i)) & 3;
+
+    int3 c0 = color16ToInt3(endpoint0);
+    int3 c1 = color16ToInt3(endpoint1);
+
+    if (index == 0) return c0;
+    if (index == 1) return c1;
+
+    if (endpoint0 > endpoint1)
+    {
+        if (index == 2) return make_int3((2 * c0.x + c1.x) / 3, (2 * c0.y + c1.y) / 3, (2 * c0.z + c1.z) / 3);
+        return make_int3((2 * c1.x + c0.x) / 3, (2 * c1.y + c0.y) / 3, (2 * c1.z + c0.z) / 3);
+    }
+
+    if (index == 2) return make_int3((c0.x + c1.x) / 2, (c0.y + c1.y) / 2, (c0.z + c1.z) / 2);
+    return make_int3(0, 0, 0);
+}
+
+// Decode one texel of a BC4 block to [0, 255].
+__device__ int decodeTexelBC4(const uint * block, int i)
+{
+    const int alpha0 = block[0] & 0xFF;
+    const int alpha1 = (block[0] >> 8) & 0xFF;
+    const unsigned long long bits = (block[0] >> 16) | ((unsigned long long)block[1] << 16);
+
+    int palette[8];
+    evaluateAlphaPalette(alpha0, alpha1, palette);
+
+    return palette[(bits >> (3 * i)) & 7];
+}
+
+// Squared error of the decoded texels against the texture, summed over the ERROR_BLOCKS blocks of each thread block.
+// Texels outside the image are not counted. The color error of DXT1 is weighted by alpha like nv::rmsColorError.
+template <int format>
+__global__ void measureError(uint firstBlock, uint blockNum, uint blockWidth, uint w, uint h, const uint * blocks, bool alphaWeight, float * errors)
+{
+    __shared__ float s_errors[16 * ERROR_BLOCKS];
+
+    const int idx = threadIdx.x;
+    const uint i = blockIdx.x * ERROR_BLOCKS + idx / 16;
+    const int texel = idx % 16;
+
+    float error = 0.0f;
+
+    if (i < blockNum)
+    {
+        const uint block = firstBlock + i;
+        const uint x = 4 * (block % blockWidth) + texel % 4;
+        const uint y = 4 * (block / blockWidth) + texel / 4;
+
+        if (x < w && y < h)
+        {
+            // The texture is in Color32 order, red is in z.
+            float4 c = tex2D(tex, x, y);
+
+            if (format == ErrorFormat_DXT1)
+            {
+                int3 d = decodeTexelDXT1(blocks + 2 * i, texel);
+                float r = d.x * (1.0f / 255.0f) - c.z;
+                float g = d.y * (1.0f / 255.0f) - c.y;
+                float b = d.z * (1.0f / 255.0f) - c.x;
+                error = r * r + g * g + b * b;
+                if (alphaWeight) error *= c.w;
+            }
+            else if (format == ErrorFormat_BC4)
+            {
+                float r = decodeTexelBC4(blocks + 2 * i, texel) * (1.0f / 255.0f) - c.z;
+                error = r * r;
+            }
+            else
+            {
+                float r = decodeTexelBC4(blocks + 4 * i + 0, texel) * (1.0f / 255.0f) - c.z;
+                float g = decodeTexelBC4(blocks + 4 * i + 2, texel) * (1.0f / 255.0f) - c.y;
+                error = r * r + g * g;
+            }
+        }
+    }
+
+    s_errors[idx] = error;
+
+    __syncthreads();
+
+    for (int n = 16 * ERROR_BLOCKS / 2; n > 0; n /= 2)
+    {
+        if (idx < n) s_errors[idx] += s_errors[idx + n];
+        __syncthreads();
+    }
+
+    if (idx == 0) errors[blockIdx.x] = s_errors[0];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Block kernels
+////////////////////////////////////////////////////////////////////////////////
+
+// One thread block per compressed block.
+template <typename Result, void (*compressBlock)(uint, uint, const uint *, Result *)>
+__global__ void compressGrid(uint firstBlock, uint blockWidth, const uint * permutations, Result * result)
+{
+    compressBlock(firstBlock + blockIdx.x, blockWidth, permutations, result + blockIdx.x);
+}
+
+// Persistent threads, a grid that fills the device takes the blocks from the work queue until there are none left.
+template <typename Result, void (*compressBlock)(uint, uint, const uint *, Result *)>
+__global__ void compressPersistent(uint firstBlock, uint blockNum, uint blockWidth, const uint * permutations, uint * queue, Result * result)
+{
+    __shared__ uint s_block;
+
+    for (;;)
+    {
+        if (threadIdx.x == 0) s_block = atomicAdd(queue, 1);
+
+        __syncthreads();
+
+        const uint i = s_block;
+        if (i >= blockNum) return;
+
+        compressBlock(firstBlock + i, blockWidth, permutations, result + i);
+
+        // Everybody has read s_block.
+        __syncthreads();
+    }
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Setup kernel
 ////////////////////////////////////////////////////////////////////////////////
@@ -1957,50 +2341,100 @@ extern "C" void bindTextureToArray(cudaArray * d_data)
 // Launch kernel
 ////////////////////////////////////////////////////////////////////////////////
 
+// With a queue the blocks go through a persistent grid of gridSize thread blocks, that needs a single launch on devices
+// without watchdog. Otherwise each block gets its own thread block.
+template <typename Result, void (*compressBlock)(uint, uint, const uint *, Result *)>
+static void launchCompressKernel(uint firstBlock, uint blockNum, uint blockWidth, const uint * d_bitmaps, uint * d_queue, uint gridSize, Result * d_result, cudaStream_t stream)
+{
+    if (d_queue != NULL)
+    {
+        const uint threadBlocks = (gridSize < blockNum) ? gridSize : blockNum;
+
+        cudaMemsetAsync(d_queue, 0, sizeof(uint), stream);
+        compressPersistent<Result, compressBlock><<<threadBlocks, NUM_THREADS, 0, stream>>>(firstBlock, blockNum, blockWidth, d_bitmaps, d_queue, d_result);
+    }
+    else
+    {
+        compressGrid<Result, compressBlock><<<blockNum, NUM_THREADS, 0, stream>>>(firstBlock, blockWidth, d_bitmaps, d_result);
+    }
+}
+
 // DXT1 compressors:
-extern "C" void compressKernelDXT1(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_bitmaps)
+extern "C" void compressKernelDXT1(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream)
 {
-    compressDXT1<<<blockNum, NUM_THREADS>>>(firstBlock, blockWidth, d_bitmaps, (uint2 *)d_result);
+    launchCompressKernel<uint2, compressBlockDXT1>(firstBlock, blockNum, blockWidth, d_bitmaps, d_queue, gridSize, (uint2 *)d_result, stream);
 }
 
-extern "C" void compressKernelDXT1_Level4(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_bitmaps)
+extern "C" void compressKernelDXT1_Level4(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream)
 {
-    compressLevel4DXT1<<<blockNum, NUM_THREADS>>>(firstBlock, blockWidth, d_bitmaps, (uint2 *)d_result);
+    launchCompressKernel<uint2, compressBlockLevel4DXT1>(firstBlock, blockNum, blockWidth, d_bitmaps, d_queue, gridSize, (uint2 *)d_result, stream);
 }
 
-extern "C" void compressWeightedKernelDXT1(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_bitmaps)
+extern "C" void compressWeightedKernelDXT1(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream)
 {
-    compressWeightedDXT1<<<blockNum, NUM_THREADS>>>(firstBlock, blockWidth, d_bitmaps, (uint2 *)d_result);
+    launchCompressKernel<uint2, compressBlockWeightedDXT1>(firstBlock, blockNum, blockWidth, d_bitmaps, d_queue, gridSize, (uint2 *)d_result, stream);
 }
 
 // @@ DXT1a compressors.
 
 
 // @@ DXT3 compressors:
-extern "C" void compressKernelDXT3(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_bitmaps)
+extern "C" void compressKernelDXT3(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream)
 {
-    //compressDXT3<<<blockNum, NUM_THREADS>>>(firstBlock, blockWidth, d_bitmaps, (uint2 *)d_result);
+    //compressDXT3<<<blockNum, NUM_THREADS, 0, stream>>>(firstBlock, blockWidth, d_bitmaps, (uint2 *)d_result);
 }
 
-extern "C" void compressWeightedKernelDXT3(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_bitmaps)
+extern "C" void compressWeightedKernelDXT3(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream)
 {
-    //compressWeightedDXT3<<<blockNum, NUM_THREADS>>>(firstBlock, blockWidth, d_bitmaps, (uint2 *)d_result);
+    //compressWeightedDXT3<<<blockNum, NUM_THREADS, 0, stream>>>(firstBlock, blockWidth, d_bitmaps, (uint2 *)d_result);
 }
 
 
 // @@ DXT5 compressors.
-extern "C" void compressKernelDXT5(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_bitmaps)
+extern "C" void compressKernelDXT5(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream)
+{
+    //compressDXT5<<<blockNum, NUM_THREADS, 0, stream>>>(firstBlock, w, d_bitmaps, (uint2 *)d_result);
+}
+
+extern "C" void compressWeightedKernelDXT5(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream)
+{
+    //compressWeightedDXT5<<<blockNum, NUM_THREADS, 0, stream>>>(firstBlock, w, d_bitmaps, (uint2 *)d_result);
+}
+
+
+
+
+
+// BC4 and BC5 compressors.
+extern "C" void compressKernelBC4(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_queue, uint gridSize, cudaStream_t stream)
 {
-    //compressDXT5<<<blockNum, NUM_THREADS>>>(firstBlock, w, d_bitmaps, (uint2 *)d_result);
+    launchCompressKernel<uint2, compressBlockBC4>(firstBlock, blockNum, blockWidth, NULL, d_queue, gridSize, (uint2 *)d_result, stream);
 }
 
-extern "C" void compressWeightedKernelDXT5(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_bitmaps)
+extern "C" void compressKernelBC5(uint firstBlock, uint blockNum, uint blockWidth, uint * d_result, uint * d_queue, uint gridSize, cudaStream_t stream)
 {
-    //compressWeightedDXT5<<<blockNum, NUM_THREADS>>>(firstBlock, w, d_bitmaps, (uint2 *)d_result);
+    launchCompressKernel<uint4, compressBlockBC5>(firstBlock, blockNum, blockWidth, NULL, d_queue, gridSize, (uint4 *)d_result, stream);
 }
 
 
+// Error of the blocks compressed from the bound texture, one partial sum per ERROR_BLOCKS blocks.
+extern "C" void measureErrorKernel(int format, uint firstBlock, uint blockNum, uint blockWidth, uint w, uint h, const uint * d_blocks, bool alphaWeight, float * d_errors, cudaStream_t stream)
+{
+    const uint threadBlocks = (blockNum + ERROR_BLOCKS - 1) / ERROR_BLOCKS;
 
+    if (format == ErrorFormat_DXT1)
+    {
+        measureError<ErrorFormat_DXT1><<<threadBlocks, 16 * ERROR_BLOCKS, 0, stream>>>(firstBlock, blockNum, blockWidth, w, h, d_blocks, alphaWeight, d_errors);
+    }
+    else if (format == ErrorFormat_BC4)
+    {
+        measureError<ErrorFormat_BC4><<<threadBlocks, 16 * ERROR_BLOCKS, 0, stream>>>(firstBlock, blockNum, blockWidth, w, h, d_blocks, alphaWeight, d_errors);
+    }
+    else if (format == ErrorFormat_BC5)
+    {
+        measureError<ErrorFormat_BC5><<<threadBlocks, 16 * ERROR_BLOCKS, 0, stream>>>(firstBlock, blockNum, blockWidth, w, h, d_blocks, alphaWeight, d_errors);
+    }
+}
 
 
 /*
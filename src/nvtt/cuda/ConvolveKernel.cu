@@ -22,244 +22,264 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
+
 #include <math.h>
 
 #include "CudaMath.h"
 
-#define TW 16
-#define TH 16
-
-#define THREAD_COUNT 		(TW * TH)
-
-#define MAX_KERNEL_WIDTH	32
-
-#define KW 4
-
-
 
-#if __DEVICE_EMULATION__
-#define __debugsync() __syncthreads()
-#else
-#define __debugsync()
-#endif
+#define NUM_THREADS 128		// Number of threads per block.
 
-#define TN            256
-#define WARP_COUNT    (TN / 32)
-#define HWARP_COUNT   (TN / 16)
+typedef unsigned int uint;
 
-// Window size
-#define WS            20
+// Same as FloatImage::WrapMode.
+#define WRAP_CLAMP  0
+#define WRAP_REPEAT 1
+#define WRAP_MIRROR 2
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Wrapping, same as wrapClamp, wrapRepeat and wrapMirror in FloatImage.h
+////////////////////////////////////////////////////////////////////////////////
 
-struct WrapClamp
+__device__ inline int wrapIndex(int x, int w, int wrapMode)
 {
-	int operator()(int i, int h)
-	{
-		i = min(max(i, 0), h-1);
-	}
-};
+    if (wrapMode == WRAP_CLAMP)
+    {
+        return min(max(x, 0), w - 1);
+    }
+    else if (wrapMode == WRAP_REPEAT)
+    {
+        if (x >= 0) return x % w;
+        else return (x + 1) % w + w - 1;
+    }
+    else
+    {
+        if (w == 1) x = 0;
+
+        x = abs(x);
+        while (x >= w) {
+            x = abs(w + w - x - 2);
+        }
+
+        return x;
+    }
+}
 
-struct WrapRepeat
-{
-	int operator()(int i, int h)
-	{
-		i = abs(i) % h;	// :( Non power of two!
-	}
-};
 
-struct WrapMirror
-{
-	int operator()(int i, int h)
-	{
-		i = abs(i);
-		while (i >= h) i = 2 * w - i - 2;
-	}
-};
+////////////////////////////////////////////////////////////////////////////////
+// Polyphase convolution filters
+////////////////////////////////////////////////////////////////////////////////
 
+// The images are planar, 4 channels of width * height floats, like FloatImage. The kernel holds windowSize weights for
+// each output pixel, as in PolyphaseKernel. One thread computes one output pixel, the grid is (columns, rows, channels).
 
-// Vertical convolution filter that processes vertical strips.
-__global__ void convolveStrip(float * d_channel, float * d_kernel, int width, int height)
+// Resample the rows, from srcWidth to dstWidth pixels. Same as FloatImage::applyKernelX.
+__global__ void convolveX(const float * input, float * output, const float * kernel, int windowSize, float kernelWidth, uint srcWidth, uint dstWidth, uint height, int wrapMode)
 {
-	__shared__ float s_kernel[32 * WS];
-
-	// Preload kernel in shared memory.
-	for (int i = 0; i < 32 * WS / TN; i++)
-	{
-		int idx = i * TN + tid;
-		if (idx < 32 * WS) s_kernel[idx] = d_kernel[idx];
-	}
-
-	__shared__ float s_strip[32 * WS];	// TN/32
-	
-	int wid = tid / 32 - WS/2;
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint y = blockIdx.y;
+    const uint c = blockIdx.z;
+    if (i >= dstWidth) return;
 
-	Mirror wrap;
-	int row = wrap(wid);
+    const float iscale = float(srcWidth) / float(dstWidth);
+    const float center = (0.5f + i) * iscale;
+    const int left = (int)floorf(center - kernelWidth);
 
-	// Preload image block.
-	for (int i = 0; i < 32 * WS / TN; i++)
-	{
-	}
-
-	// @@ Apply kernel to TN/32 rows.
-
-	// @@ Load 
+    const float * row = input + (c * height + y) * srcWidth;
+    const float * weights = kernel + i * windowSize;
 
+    float sum = 0;
+    for (int j = 0; j < windowSize; j++)
+    {
+        sum += weights[j] * row[wrapIndex(left + j, srcWidth, wrapMode)];
+    }
 
+    output[(c * height + y) * dstWidth + i] = sum;
 }
 
+// Resample the columns, from srcHeight to dstHeight pixels. Same as FloatImage::applyKernelY.
+__global__ void convolveY(const float * input, float * output, const float * kernel, int windowSize, float kernelWidth, uint width, uint srcHeight, uint dstHeight, int wrapMode)
+{
+    const uint x = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint i = blockIdx.y;
+    const uint c = blockIdx.z;
+    if (x >= width) return;
 
+    const float iscale = float(srcHeight) / float(dstHeight);
+    const float center = (0.5f + i) * iscale;
+    const int left = (int)floorf(center - kernelWidth);
 
+    const float * column = input + c * srcHeight * width + x;
+    const float * weights = kernel + i * windowSize;
 
+    float sum = 0;
+    for (int j = 0; j < windowSize; j++)
+    {
+        sum += weights[j] * column[wrapIndex(left + j, srcHeight, wrapMode) * width];
+    }
 
-
-__constant__ float inputGamma, outputInverseGamma;
-__constant__ float kernel[MAX_KERNEL_WIDTH];
-
-// Use texture to access input?
-// That's the most simple approach.
-
-texture<> image;
-
-////////////////////////////////////////////////////////////////////////////////
-// Combined convolution filter
-////////////////////////////////////////////////////////////////////////////////
-
-__global__ void convolve(float4 * output)
-{
-	// @@ Use morton order to assing threads.
-	int x = threadIdx.x;
-	int y = threadIdx.y;
-	
-	float4 color = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
-	
-	// texture coordinate.
-	int2 t;
-	t.x = 2 * (blockIdx.x * TW + x) - HW;
-	t.y = blockIdx.y * TH + y;
-	
-	// @@ We might want to loop and process strips, to reuse the results of the horizontal convolutions.
-	
-	// Horizontal convolution. @@ Unroll loops.
-	for (int e = HW; e > 0; e--)
-	{
-		t.x++;
-		float w = kernel[e-1];
-		color += w * tex2D(image, tc);
-	}
-	
-	for (int e = 0; e < HW; e++)
-	{
-		t.x++;
-		float w = kernel[e];
-		color += w * tex2D(image, tc);
-	}
-	
-	// Write color to shared memory.
-	__shared__ float tile[4 * THREAD_COUNT];
-
-	int tileIdx = y * TW + x;
-	tile[tileIdx + 0 * THREAD_COUNT] = color.x;
-	tile[tileIdx + 1 * THREAD_COUNT] = color.y;
-	tile[tileIdx + 2 * THREAD_COUNT] = color.z;
-	tile[tileIdx + 3 * THREAD_COUNT] = color.w;
-
-	__syncthreads();
-	
-	// tile coordinate.
-	t.x = x;
-	t.y = y - HW;
-	
-	// Vertical convolution. @@ Unroll loops.
-	for (int i = HW; i > 0; i--)
-	{
-		float w = kernel[i-1];
-		
-		t.y++;
-		int idx = t.y * TW + t.x;
-		
-		color.x += w * tile[idx + 0 * THREAD_COUNT];
-		color.y += w * tile[idx + 1 * THREAD_COUNT];
-		color.z += w * tile[idx + 2 * THREAD_COUNT];
-		color.w += w * tile[idx + 3 * THREAD_COUNT];
-	}
-	
-	for (int i = 0; i < HW; i++)
-	{
-		float w = kernel[i];
-		
-		t.y++;
-		int idx = t.y * TW + t.x;
-		
-		color.x += w * tile[idx + 0 * THREAD_COUNT];
-		color.y += w * tile[idx + 1 * THREAD_COUNT];
-		color.z += w * tile[idx + 2 * THREAD_COUNT];
-		color.w += w * tile[idx + 3 * THREAD_COUNT];
-	}	
-	
-	it (x < w && y < h)
-	{
-		// @@ Prevent unaligned writes.
-		
-		output[y * w + h] = color;
-	}
+    output[(c * dstHeight + i) * width + x] = sum;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// Monophase X convolution filter
+// Gamma correction and conversion to 8 bits
 ////////////////////////////////////////////////////////////////////////////////
 
-__device__ void convolveY()
+// Bring the color channels to gamma space, like FloatImage::toGamma, and pack the texels in the layout of Color32,
+// rounding like the CPU conversion in CudaCompressor::compress.
+__global__ void toColor32(const float * input, uint * output, uint count, uint pitch, float invGamma)
 {
-
+    const uint i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= count) return;
+
+    float r = input[i + pitch * 0];
+    float g = input[i + pitch * 1];
+    float b = input[i + pitch * 2];
+    float a = input[i + pitch * 3];
+
+    if (invGamma != 1.0f)
+    {
+        r = powf(fmaxf(0.0f, r), invGamma);
+        g = powf(fmaxf(0.0f, g), invGamma);
+        b = powf(fmaxf(0.0f, b), invGamma);
+    }
+
+    const uint R = uint(fminf(fmaxf(r, 0.0f), 1.0f) * 255);
+    const uint G = uint(fminf(fmaxf(g, 0.0f), 1.0f) * 255);
+    const uint B = uint(fminf(fmaxf(b, 0.0f), 1.0f) * 255);
+    const uint A = uint(fminf(fmaxf(a, 0.0f), 1.0f) * 255);
+
+    output[i] = (A << 24) | (R << 16) | (G << 8) | B;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// Mipmap convolution filter
+// Cube map filtering
 ////////////////////////////////////////////////////////////////////////////////
 
+// Same as EdgeFixup in nvtt.h.
+#define EDGE_FIXUP_STRETCH 1
+#define EDGE_FIXUP_WARP    2
 
-
-////////////////////////////////////////////////////////////////////////////////
-// Gamma correction
-////////////////////////////////////////////////////////////////////////////////
-
-/*
-__device__ float toLinear(float f, float gamma = 2.2f)
+// Direction of the texel center, like texelDirection in CubeSurface.cpp.
+__device__ float3 cubeTexelDirection(uint face, uint x, uint y, uint edgeLength, int fixupMethod)
 {
-	return __pow(f, gamma);
+    float u, v;
+    if (fixupMethod == EDGE_FIXUP_STRETCH)
+    {
+        // Match up edges exactly.
+        u = float(x) * 2.0f / (edgeLength - 1) - 1.0f;
+        v = float(y) * 2.0f / (edgeLength - 1) - 1.0f;
+    }
+    else
+    {
+        u = (float(x) + 0.5f) * (2.0f / edgeLength) - 1.0f;
+        v = (float(y) + 0.5f) * (2.0f / edgeLength) - 1.0f;
+    }
+
+    if (fixupMethod == EDGE_FIXUP_WARP)
+    {
+        // Warp texel centers in the proximity of the edges.
+        float a = powf(float(edgeLength), 2.0f) / powf(float(edgeLength - 1), 3.0f);
+        u = a * u * u * u + u;
+        v = a * v * v * v + v;
+    }
+
+    float3 n;
+    if (face == 0) n = make_float3(1, -v, -u);
+    else if (face == 1) n = make_float3(-1, -v, u);
+    else if (face == 2) n = make_float3(u, 1, v);
+    else if (face == 3) n = make_float3(u, -1, -v);
+    else if (face == 4) n = make_float3(u, -v, 1);
+    else n = make_float3(-u, -v, -1);
+
+    return n * rsqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
 }
 
-__device__ float toGamma(float f, float gamma = 2.2f)
+// Convolve the cube with a cosine power lobe, like CubeSurface::Private::applyCosinePowerFilter, one thread per texel
+// of the output. The input faces have 4 planes of inputFaceSize floats, the output faces 3 planes of size * size. Each
+// input texel has its direction and solid angle in texels, they go through shared memory one tile at a time.
+__global__ void cosinePowerFilter(const float * input, const float4 * texels, uint inputFaceSize, float * output, uint size, int fixupMethod, float cosineConeAngle, float cosinePower)
 {
-	return pow(f, 1.0f / gamma);
+    __shared__ float4 s_texels[NUM_THREADS];
+    __shared__ float3 s_colors[NUM_THREADS];
+
+    const uint outputFaceSize = size * size;
+    const uint id = blockIdx.x * blockDim.x + threadIdx.x;
+    const uint f = id / outputFaceSize;
+    const uint idx = id % outputFaceSize;
+
+    // The threads past the last texel help to load the tiles.
+    const float3 filterDir = (f < 6) ? cubeTexelDirection(f, idx % size, idx / size, size, fixupMethod) : make_float3(0, 0, 0);
+
+    float3 color = make_float3(0, 0, 0);
+    float sum = 0.0f;
+
+    const uint inputCount = 6 * inputFaceSize;
+    for (uint t = 0; t < inputCount; t += NUM_THREADS)
+    {
+        const uint j = t + threadIdx.x;
+        if (j < inputCount)
+        {
+            const float * texel = input + (j / inputFaceSize) * 4 * inputFaceSize + j % inputFaceSize;
+            s_texels[threadIdx.x] = texels[j];
+            s_colors[threadIdx.x] = make_float3(texel[0], texel[inputFaceSize], texel[2 * inputFaceSize]);
+        }
+
+        __syncthreads();
+
+        const uint n = min(NUM_THREADS, inputCount - t);
+        for (uint k = 0; k < n; k++)
+        {
+            const float4 texel = s_texels[k];
+            const float cosineAngle = filterDir.x * texel.x + filterDir.y * texel.y + filterDir.z * texel.z;
+
+            if (cosineAngle > cosineConeAngle)
+            {
+                const float contribution = texel.w * __powf(__saturatef(cosineAngle), cosinePower);
+                sum += contribution;
+                color += contribution * s_colors[k];
+            }
+        }
+
+        __syncthreads();
+    }
+
+    if (f >= 6) return;
+
+    float * texel = output + f * 3 * outputFaceSize + idx;
+    texel[0 * outputFaceSize] = color.x / sum;
+    texel[1 * outputFaceSize] = color.y / sum;
+    texel[2 * outputFaceSize] = color.z / sum;
 }
-*/
-
-
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// Setup kernel
+// Launch kernel
 ////////////////////////////////////////////////////////////////////////////////
 
-extern "C" void setupConvolveKernel(const float * k, int w)
+extern "C" void convolveKernelX(const float * d_input, float * d_output, const float * d_kernel, int windowSize, float kernelWidth, uint srcWidth, uint dstWidth, uint height, int wrapMode)
 {
-	w = min(w, MAX_KERNEL_WIDTH);
-	cudaMemcpyToSymbol(kernel, k, sizeof(float) * w, 0);
+    dim3 grid((dstWidth + NUM_THREADS - 1) / NUM_THREADS, height, 4);
+    convolveX<<<grid, NUM_THREADS>>>(d_input, d_output, d_kernel, windowSize, kernelWidth, srcWidth, dstWidth, height, wrapMode);
 }
 
+extern "C" void convolveKernelY(const float * d_input, float * d_output, const float * d_kernel, int windowSize, float kernelWidth, uint width, uint srcHeight, uint dstHeight, int wrapMode)
+{
+    dim3 grid((width + NUM_THREADS - 1) / NUM_THREADS, dstHeight, 4);
+    convolveY<<<grid, NUM_THREADS>>>(d_input, d_output, d_kernel, windowSize, kernelWidth, width, srcHeight, dstHeight, wrapMode);
+}
 
-////////////////////////////////////////////////////////////////////////////////
-// Launch kernel
-////////////////////////////////////////////////////////////////////////////////
-
-
-
+// The planes of the input are pitch floats apart.
+extern "C" void convertToColor32(const float * d_input, uint * d_output, uint count, uint pitch, float gamma, cudaStream_t stream)
+{
+    toColor32<<<(count + NUM_THREADS - 1) / NUM_THREADS, NUM_THREADS, 0, stream>>>(d_input, d_output, count, pitch, 1.0f / gamma);
+}
 
+extern "C" void cosinePowerFilterKernel(const float * d_input, const float * d_texels, uint inputEdgeLength, float * d_output, uint size, int fixupMethod, float cosineConeAngle, float cosinePower)
+{
+    const uint count = 6 * size * size;
+    cosinePowerFilter<<<(count + NUM_THREADS - 1) / NUM_THREADS, NUM_THREADS>>>(d_input, (const float4 *)d_texels, inputEdgeLength * inputEdgeLength, d_output, size, fixupMethod, cosineConeAngle, cosinePower);
+}
@@ -31,27 +31,36 @@
 #include "nvimage/Image.h"
 #include "nvimage/ColorBlock.h"
 #include "nvimage/BlockDXT.h"
+#include "nvimage/MemoryPool.h"
 #include "nvtt/CompressionOptions.h"
 #include "nvtt/OutputOptions.h"
 #include "nvtt/QuickCompressDXT.h"
+#include "nvtt/Profiler.h"
 #include "nvtt/OptimalCompressDXT.h"
 
 #include <time.h>
 #include <stdio.h>
 
+#define MAX_BLOCKS 8192U // 32768, 65535 // @@ Limit number of blocks on slow devices to prevent hitting the watchdog timer.
+#define MAX_PERSISTENT_BLOCKS (1U << 18) // A 2048x2048 level, 4 MB of results and 64 MB of staged rows per stream.
+#define MAX_POOLED_BYTES (256U << 20) // Size of the arrays that each device keeps around.
+#define ERROR_BLOCKS 4U // Blocks per partial sum of the error kernel, as in CompressKernel.cu.
+
 #if defined HAVE_CUDA
 #include <cuda_runtime_api.h>
 
-#define MAX_BLOCKS 8192U // 32768, 65535 // @@ Limit number of blocks on slow devices to prevent hitting the watchdog timer.
-
 extern "C" void setupOMatchTables(const void * OMatch5Src, size_t OMatch5Size, const void * OMatch6Src, size_t OMatch6Size);
 extern "C" void setupCompressKernel(const float weights[3]);
 extern "C" void bindTextureToArray(cudaArray * d_data);
-
-extern "C" void compressKernelDXT1(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_bitmaps);
-extern "C" void compressKernelDXT1_Level4(uint blockNum, uint * d_data, uint * d_result, uint * d_bitmaps);
-extern "C" void compressWeightedKernelDXT1(uint blockNum, uint * d_data, uint * d_result, uint * d_bitmaps);
-extern "C" void compressKernelDXT3(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_bitmaps);
+extern "C" void convertToColor32(const float * d_input, uint * d_output, uint count, uint pitch, float gamma, cudaStream_t stream);
+
+extern "C" void compressKernelDXT1(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream);
+extern "C" void compressKernelDXT1_Level4(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream);
+extern "C" void compressWeightedKernelDXT1(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream);
+extern "C" void compressKernelDXT3(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_bitmaps, uint * d_queue, uint gridSize, cudaStream_t stream);
+extern "C" void compressKernelBC4(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_queue, uint gridSize, cudaStream_t stream);
+extern "C" void compressKernelBC5(uint firstBlock, uint blockNum, uint w, uint * d_result, uint * d_queue, uint gridSize, cudaStream_t stream);
+extern "C" void measureErrorKernel(int format, uint firstBlock, uint blockNum, uint blockWidth, uint w, uint h, const uint * d_blocks, bool alphaWeight, float * d_errors, cudaStream_t stream);
 //extern "C" void compressNormalKernelDXT1(uint blockNum, uint * d_data, uint * d_result, uint * d_bitmaps);
 //extern "C" void compressKernelCTX1(uint blockNum, uint * d_data, uint * d_result, uint * d_bitmaps);
 
@@ -64,13 +73,42 @@ using namespace nv;
 using namespace nvtt;
 
 
-CudaContext::CudaContext() : 
+CudaDevice::CudaDevice(int id, uint weight) : 
+	id(id), 
+	weight(weight), 
+	maxBlocks(MAX_BLOCKS), 
+	gridSize(0), 
 	bitmapTable(NULL), 
 	bitmapTableCTX(NULL), 
 	data(NULL), 
-	result(NULL)
+	arrayPoolCount(0), 
+	arrayPoolBytes(0)
 {
+    for (uint i = 0; i < StreamCount; i++)
+    {
+        result[i] = NULL;
+        stream[i] = NULL;
+        uploaded[i] = NULL;
+        pinnedResult[i] = NULL;
+        workQueue[i] = NULL;
+        errors[i] = NULL;
+        pinnedErrors[i] = NULL;
+        stagingRows[i] = NULL;
+        stagingColors[i] = NULL;
+    }
+    stagingSize = 0;
+
 #if defined HAVE_CUDA
+    if (!cuda::setDevice(id)) return;
+
+    // Without a watchdog, a persistent grid that keeps every multiprocessor busy compresses whole levels in one launch.
+    cudaDeviceProp deviceProp;
+    if (cudaGetDeviceProperties(&deviceProp, id) == cudaSuccess && !deviceProp.kernelExecTimeoutEnabled)
+    {
+        maxBlocks = MAX_PERSISTENT_BLOCKS;
+        gridSize = deviceProp.multiProcessorCount * 16;
+    }
+
     // Allocate and upload bitmaps.
     cudaMalloc((void**) &bitmapTable, 992 * sizeof(uint));
     if (bitmapTable != NULL)
@@ -86,21 +124,187 @@ CudaContext::CudaContext() :
 
     // Allocate scratch buffers.
     cudaMalloc((void**) &data, MAX_BLOCKS * 64U);
-    cudaMalloc((void**) &result, MAX_BLOCKS * 8U);
+
+    // Allocate the streams and their result buffers, large enough for maxBlocks blocks of 16 bytes.
+    for (uint i = 0; i < StreamCount; i++)
+    {
+        cudaMalloc((void**) &result[i], maxBlocks * 16U);
+        cudaMallocHost(&pinnedResult[i], maxBlocks * 16U);
+        cudaStreamCreate(&stream[i]);
+        cudaEventCreateWithFlags(&uploaded[i], cudaEventDisableTiming);
+
+        if (gridSize != 0) cudaMalloc((void**) &workQueue[i], sizeof(uint));
+
+        const uint errorCount = (maxBlocks + ERROR_BLOCKS - 1) / ERROR_BLOCKS;
+        cudaMalloc((void**) &errors[i], errorCount * sizeof(float));
+        cudaMallocHost((void**) &pinnedErrors[i], errorCount * sizeof(float));
+    }
 
     // Init single color lookup contant tables.
 	setupOMatchTables(OMatch5, sizeof(OMatch5), OMatch6, sizeof(OMatch6));
 #endif
 }
 
-CudaContext::~CudaContext()
+CudaDevice::~CudaDevice()
 {
 #if defined HAVE_CUDA
+    cuda::setDevice(id);
+
     // Free device mem allocations.
     cudaFree(bitmapTableCTX);
     cudaFree(bitmapTable);
     cudaFree(data);
-    cudaFree(result);
+
+    for (uint i = 0; i < StreamCount; i++)
+    {
+        if (uploaded[i] != NULL) cudaEventDestroy(uploaded[i]);
+        if (stream[i] != NULL) cudaStreamDestroy(stream[i]);
+        cudaFreeHost(pinnedResult[i]);
+        cudaFree(result[i]);
+        cudaFree(workQueue[i]);
+        cudaFree(errors[i]);
+        cudaFreeHost(pinnedErrors[i]);
+        cudaFree(stagingRows[i]);
+        cudaFree(stagingColors[i]);
+    }
+
+    for (uint i = 0; i < arrayPoolCount; i++)
+    {
+        cudaFreeArray(arrayPool[i].array);
+    }
+#endif
+}
+
+bool CudaDevice::isValid() const
+{
+    for (uint i = 0; i < StreamCount; i++)
+    {
+        if (result[i] == NULL || stream[i] == NULL || uploaded[i] == NULL || pinnedResult[i] == NULL) return false;
+        if (gridSize != 0 && workQueue[i] == NULL) return false;
+        if (errors[i] == NULL || pinnedErrors[i] == NULL) return false;
+    }
+
+    return bitmapTable != NULL && bitmapTableCTX != NULL && data != NULL;
+}
+
+cudaArray * CudaDevice::acquireArray(uint w, uint h)
+{
+#if defined HAVE_CUDA
+    for (uint i = 0; i < arrayPoolCount; i++)
+    {
+        if (arrayPool[i].w == w && arrayPool[i].h == h)
+        {
+            cudaArray * array = arrayPool[i].array;
+            arrayPoolBytes -= w * h * 4;
+
+            // Keep the others in order.
+            for (uint j = i + 1; j < arrayPoolCount; j++) arrayPool[j - 1] = arrayPool[j];
+            arrayPoolCount--;
+
+            return array;
+        }
+    }
+
+    cudaArray * array = NULL;
+    cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(8, 8, 8, 8, cudaChannelFormatKindUnsigned);
+    if (cudaMallocArray(&array, &channelDesc, w, h) != cudaSuccess)
+    {
+        return NULL;
+    }
+    return array;
+#else
+    return NULL;
+#endif
+}
+
+void CudaDevice::releaseArray(cudaArray * array, uint w, uint h)
+{
+#if defined HAVE_CUDA
+    const uint bytes = w * h * 4;
+    if (bytes > MAX_POOLED_BYTES)
+    {
+        cudaFreeArray(array);
+        return;
+    }
+
+    // Evict the oldest arrays to make room.
+    while (arrayPoolCount == ArrayPoolSize || arrayPoolBytes + bytes > MAX_POOLED_BYTES)
+    {
+        cudaFreeArray(arrayPool[0].array);
+        arrayPoolBytes -= arrayPool[0].w * arrayPool[0].h * 4;
+
+        for (uint j = 1; j < arrayPoolCount; j++) arrayPool[j - 1] = arrayPool[j];
+        arrayPoolCount--;
+    }
+
+    arrayPool[arrayPoolCount].array = array;
+    arrayPool[arrayPoolCount].w = w;
+    arrayPool[arrayPoolCount].h = h;
+    arrayPoolCount++;
+    arrayPoolBytes += bytes;
+#endif
+}
+
+bool CudaDevice::reserveStaging(uint count)
+{
+#if defined HAVE_CUDA
+    if (count > stagingSize)
+    {
+        // Keep the buffers of the largest chunk around.
+        stagingSize = 0;
+
+        for (uint i = 0; i < StreamCount; i++)
+        {
+            cudaFree(stagingRows[i]);
+            cudaFree(stagingColors[i]);
+            stagingRows[i] = NULL;
+            stagingColors[i] = NULL;
+
+            if (cudaMalloc((void**) &stagingRows[i], count * 4 * sizeof(float)) != cudaSuccess ||
+                cudaMalloc((void**) &stagingColors[i], count * sizeof(uint)) != cudaSuccess)
+            {
+                return false;
+            }
+        }
+        stagingSize = count;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+CudaContext::CudaContext(uint deviceMask) : deviceCount(0)
+{
+#if defined HAVE_CUDA
+    int ids[MaxDeviceCount];
+    const int count = cuda::getDevices(deviceMask, ids, MaxDeviceCount);
+
+    // The chunks of each device are proportional to its speed, the fastest one gets chunks of MAX_BLOCKS blocks.
+    const float fastest = (count > 0) ? float(cuda::deviceSpeed(ids[0])) : 1.0f;
+
+    for (int i = 0; i < count; i++)
+    {
+        const uint weight = max(1U, uint(16.0f * float(cuda::deviceSpeed(ids[i])) / fastest));
+        device[deviceCount++] = new CudaDevice(ids[i], weight);
+    }
+
+    // The surfaces and the images that are not split between the devices live on the fastest one.
+    if (deviceCount > 0)
+    {
+        cuda::setDevice(device[0]->id);
+    }
+#endif
+}
+
+CudaContext::~CudaContext()
+{
+#if defined HAVE_CUDA
+    for (uint i = 0; i < deviceCount; i++)
+    {
+        delete device[i];
+    }
 #endif
 }
 
@@ -114,10 +318,16 @@ bool CudaContext::isValid() const
         return false;
     }
 #endif
-    return bitmapTable != NULL && bitmapTableCTX != NULL && data != NULL && result != NULL;
+    for (uint i = 0; i < deviceCount; i++)
+    {
+        if (!device[i]->isValid()) return false;
+    }
+
+    return deviceCount > 0;
 }
 
 
+
 #if defined HAVE_CUDA
 
 CudaCompressor::CudaCompressor(CudaContext & ctx) : m_ctx(ctx)
@@ -132,33 +342,26 @@ void CudaCompressor::compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d,
 
 #if defined HAVE_CUDA
 
-    // Allocate image as a cuda array.
-    const uint count = w * h;
-    Color32 * tmp = malloc<Color32>(count);
-    for (uint i = 0; i < count; i++) {
-        tmp[i].r = uint8(clamp(data[i + count*0], 0.0f, 1.0f) * 255);
-        tmp[i].g = uint8(clamp(data[i + count*1], 0.0f, 1.0f) * 255);
-        tmp[i].b = uint8(clamp(data[i + count*2], 0.0f, 1.0f) * 255);
-        tmp[i].a = uint8(clamp(data[i + count*3], 0.0f, 1.0f) * 255);
+    // Get the image array from the pool of the first device.
+    CudaDevice & device = *m_ctx.device[0];
+    cudaArray * d_image = device.acquireArray(w, h);
+    if (d_image == NULL)
+    {
+        outputOptions.error(Error_CudaError);
+        return;
     }
 
-    cudaArray * d_image;
-    cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(8, 8, 8, 8, cudaChannelFormatKindUnsigned);
-    cudaMallocArray(&d_image, &channelDesc, w, h);
-
-    cudaMemcpyToArray(d_image, 0, 0, tmp, count * sizeof(Color32), cudaMemcpyHostToDevice);
-
-    free(tmp);
+    compressArray(alphaMode, w, h, data, d_image, compressionOptions, outputOptions);
 
-    // To avoid the copy we could keep the data in floating point format, but the channels are not interleaved like the kernel expects.
-    /*
-    cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(32, 32, 32, 32, cudaChannelFormatKindFloat);
-    cudaMallocArray(&d_image, &channelDesc, w, h);
+    device.releaseArray(d_image, w, h);
 
-    const int imageSize = w * h * sizeof(float) * 4;
-    cudaMemcpyToArray(d_image, 0, 0, data, imageSize, cudaMemcpyHostToDevice);
-    */
+#else
+    outputOptions.error(Error_CudaError);
+#endif
+}
 
+void CudaCompressor::compressArray(nvtt::AlphaMode alphaMode, uint w, uint h, const float * data, cudaArray * d_image, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions)
+{
     // Image size in blocks.
     const uint bw = (w + 3) / 4;
     const uint bh = (h + 3) / 4;
@@ -166,45 +369,170 @@ void CudaCompressor::compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d,
     const uint blockNum = bw * bh;
     //const uint compressedSize = blockNum * bs;
 
-    void * h_result = ::malloc(min(blockNum, MAX_BLOCKS) * bs);
+    // An image that is already on the device stays on the first one, the other devices need the rows uploaded from the host.
+    const uint deviceCount = (data != NULL) ? m_ctx.deviceCount : 1;
+
+    // The other devices get their own array, that only receives the rows of their chunks.
+    cudaArray * images[CudaContext::MaxDeviceCount];
+    images[0] = d_image;
+
+    for (uint d = 1; d < deviceCount; d++)
+    {
+        cuda::setDevice(m_ctx.device[d]->id);
+        images[d] = m_ctx.device[d]->acquireArray(w, h);
+    }
+
+    // Each device has its own copy of the kernel constants and texture reference.
+    bool staged = true;
+    for (uint d = deviceCount; d-- > 0; )
+    {
+        CudaDevice & device = *m_ctx.device[d];
+
+        if (deviceCount > 1) cuda::setDevice(device.id);
+        setup(images[d], compressionOptions);
+
+        // Largest number of rows that a chunk uploads, its blocks span one more block row than they fill.
+        const uint chunkRows = min(h, ((device.maxBlocks - 1) / bw + 2) * 4);
+
+        if (images[d] == NULL || (data != NULL && !device.reserveStaging(chunkRows * w))) staged = false;
+    }
 
-    setup(d_image, compressionOptions);
+    if (!staged)
+    {
+        outputOptions.error(Error_CudaError);
+    }
 
     // Timer timer;
     // timer.start();
 
-    uint bn = 0;
-    while (bn != blockNum)
-    {
-        uint count = min(blockNum - bn, MAX_BLOCKS);
+    // The chunks go round robin through the devices and then through their streams, chunk c is in slot c % slotCount.
+    // Each chunk uploads the float rows of the image that its blocks need and no earlier chunk of the device uploaded,
+    // quantizes them to the array, then compresses its blocks and downloads them to its pinned buffer. The chunks of
+    // each device are proportional to its weight, so that all the devices finish their chunks of a round at about the
+    // same time. While the devices work on the chunks in flight, the CPU writes out the oldest one.
+    const uint slotCount = deviceCount * CudaDevice::StreamCount;
+    const uint lag = slotCount - 1;
+    const uint count = w * h;
+
+    // With an image error handler, each chunk also decodes its blocks and sums their squared error on the device.
+    const ErrorFormat measuredFormat = (outputOptions.imageErrorHandler != NULL) ? errorFormat() : ErrorFormat_None;
+    double squaredError = 0.0;
 
-        compressBlocks(bn, count, bw, bh, alphaMode, compressionOptions, h_result);
+    uint slotBlocks[CudaContext::MaxDeviceCount * CudaDevice::StreamCount];
+    uint uploadedRows[CudaContext::MaxDeviceCount];
+    for (uint d = 0; d < deviceCount; d++) uploadedRows[d] = (data != NULL) ? 0 : h;
 
-        // Check for errors.
-        cudaError_t err = cudaGetLastError();
-        if (err != cudaSuccess)
+    uint next = 0;      // First block of the next chunk.
+    uint launched = 0;  // Number of chunks launched.
+
+    for (uint c = 0; staged && (c < launched + lag || next < blockNum); c++)
+    {
+        if (next < blockNum)
+        {
+            const uint slot = c % slotCount;
+            const uint d = slot % deviceCount;
+            const uint s = slot / deviceCount;
+            CudaDevice & device = *m_ctx.device[d];
+
+            const uint bn = next;
+            const uint chunkBlocks = min(blockNum - bn, device.maxBlocks * device.weight / 16);
+            const uint firstRow = (bn / bw) * 4;
+            const uint lastRow = min(h, ((bn + chunkBlocks - 1) / bw + 1) * 4);
+
+            slotBlocks[slot] = chunkBlocks;
+            next += chunkBlocks;
+            launched++;
+
+            if (deviceCount > 1) cuda::setDevice(device.id);
+
+            // The blocks of this chunk may also read rows uploaded by the previous chunk of the device on its other stream.
+            if (c >= deviceCount)
+            {
+                cudaStreamWaitEvent(device.stream[s], device.uploaded[(s + CudaDevice::StreamCount - 1) % CudaDevice::StreamCount], 0);
+            }
+
+            const uint fromRow = max(uploadedRows[d], firstRow);
+            if (lastRow > fromRow)
+            {
+                const uint n = (lastRow - fromRow) * w;
+                NVTT_PROFILE("cuda upload", n);
+
+                // Upload the four planes of the rows and quantize them to Color32 on the device.
+                cudaMemcpy2DAsync(device.stagingRows[s], device.stagingSize * sizeof(float), data + fromRow * w, count * sizeof(float), n * sizeof(float), 4, cudaMemcpyHostToDevice, device.stream[s]);
+                convertToColor32(device.stagingRows[s], device.stagingColors[s], n, device.stagingSize, 1.0f, device.stream[s]);
+                cudaMemcpy2DToArrayAsync(images[d], 0, fromRow, device.stagingColors[s], w * sizeof(Color32), w * sizeof(Color32), lastRow - fromRow, cudaMemcpyDeviceToDevice, device.stream[s]);
+                uploadedRows[d] = lastRow;
+            }
+            cudaEventRecord(device.uploaded[s], device.stream[s]);
+
+            compressBlocks(bn, chunkBlocks, bw, bh, alphaMode, compressionOptions, device, s);
+
+            // The pinned buffer of this slot was written out before the previous iteration ended.
+            cudaMemcpyAsync(device.pinnedResult[s], device.result[s], chunkBlocks * bs, cudaMemcpyDeviceToHost, device.stream[s]);
+
+            if (measuredFormat != ErrorFormat_None)
+            {
+                measureErrorKernel(measuredFormat, bn, chunkBlocks, bw, w, h, device.result[s], alphaMode == AlphaMode_Transparency, device.errors[s], device.stream[s]);
+                cudaMemcpyAsync(device.pinnedErrors[s], device.errors[s], (chunkBlocks + ERROR_BLOCKS - 1) / ERROR_BLOCKS * sizeof(float), cudaMemcpyDeviceToHost, device.stream[s]);
+            }
+        }
+
+        // Output the oldest chunk once all the slots are busy, the devices compress the others meanwhile.
+        if (c >= lag)
         {
-            //nvDebug("CUDA Error: %s\n", cudaGetErrorString(err));
-            outputOptions.error(Error_CudaError);
+            const uint slot = (c - lag) % slotCount;
+            const uint s = slot / deviceCount;
+            CudaDevice & device = *m_ctx.device[slot % deviceCount];
+
+            // The transfers and the kernels are asynchronous, their time shows up here.
+            {
+                NVTT_PROFILE("cuda wait", slotBlocks[slot]);
+                cudaStreamSynchronize(device.stream[s]);
+            }
+
+            // Check for errors.
+            cudaError_t err = cudaGetLastError();
+            if (err != cudaSuccess)
+            {
+                //nvDebug("CUDA Error: %s\n", cudaGetErrorString(err));
+                outputOptions.error(Error_CudaError);
+            }
+
+            // Output result.
+            outputOptions.writeData(device.pinnedResult[s], slotBlocks[slot] * bs);
+
+            if (measuredFormat != ErrorFormat_None)
+            {
+                const uint errorCount = (slotBlocks[slot] + ERROR_BLOCKS - 1) / ERROR_BLOCKS;
+                for (uint i = 0; i < errorCount; i++) squaredError += device.pinnedErrors[s][i];
+            }
         }
+    }
 
-        // Output result.
-        outputOptions.writeData(h_result, count * bs);
+    if (staged && measuredFormat != ErrorFormat_None)
+    {
+        const uint channelCount = (measuredFormat == ErrorFormat_DXT1) ? 3 : (measuredFormat == ErrorFormat_BC5) ? 2 : 1;
+        const double mse = squaredError / (double(count) * channelCount);
 
-        bn += count;
+        const float rmse = float(sqrt(squaredError / count));
+        const float psnr = (mse > 0.0) ? float(10.0 * log10(1.0 / mse)) : 999.0f;
+        outputOptions.imageError(rmse, psnr);
     }
 
-    //timer.stop();
-    //printf("\rCUDA time taken: %.3f seconds\n", timer.elapsed() / CLOCKS_PER_SEC);
+    for (uint d = 1; d < deviceCount; d++)
+    {
+        cuda::setDevice(m_ctx.device[d]->id);
+        if (images[d] != NULL) m_ctx.device[d]->releaseArray(images[d], w, h);
+    }
 
-    free(h_result);
-    cudaFreeArray(d_image);
+    // Back to the device of the surfaces.
+    if (deviceCount > 1) cuda::setDevice(m_ctx.device[0]->id);
 
-#else
-    outputOptions.error(Error_CudaError);
-#endif
+    //timer.stop();
+    //printf("\rCUDA time taken: %.3f seconds\n", timer.elapsed() / CLOCKS_PER_SEC);
 }
 
+
 #if defined HAVE_CUDA
 
 void CudaCompressorDXT1::setup(cudaArray * image, const nvtt::CompressionOptions::Private & compressionOptions)
@@ -213,13 +541,10 @@ void CudaCompressorDXT1::setup(cudaArray * image, const nvtt::CompressionOptions
     bindTextureToArray(image);
 }
 
-void CudaCompressorDXT1::compressBlocks(uint first, uint count, uint bw, uint bh, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+void CudaCompressorDXT1::compressBlocks(uint first, uint count, uint bw, uint bh, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s)
 {
     // Launch kernel.
-    compressKernelDXT1(first, count, bw, m_ctx.result, m_ctx.bitmapTable);
-
-    // Copy result to host.
-    cudaMemcpy(output, m_ctx.result, count * 8, cudaMemcpyDeviceToHost);
+    compressKernelDXT1(first, count, bw, device.result[s], device.bitmapTable, device.workQueue[s], device.gridSize, device.stream[s]);
 }
 
 
@@ -229,13 +554,10 @@ void CudaCompressorDXT3::setup(cudaArray * image, const nvtt::CompressionOptions
     bindTextureToArray(image);
 }
 
-void CudaCompressorDXT3::compressBlocks(uint first, uint count, uint bw, uint bh, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+void CudaCompressorDXT3::compressBlocks(uint first, uint count, uint bw, uint bh, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s)
 {
     // Launch kernel.
-    compressKernelDXT3(first, count, bw, m_ctx.result, m_ctx.bitmapTable);
-
-    // Copy result to host.
-    cudaMemcpy(output, m_ctx.result, count * 16, cudaMemcpyDeviceToHost);
+    compressKernelDXT3(first, count, bw, device.result[s], device.bitmapTable, device.workQueue[s], device.gridSize, device.stream[s]);
 }
 
 
@@ -245,22 +567,19 @@ void CudaCompressorDXT5::setup(cudaArray * image, const nvtt::CompressionOptions
     bindTextureToArray(image);
 }
 
-void CudaCompressorDXT5::compressBlocks(uint first, uint count, uint bw, uint bh, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output)
+void CudaCompressorDXT5::compressBlocks(uint first, uint count, uint bw, uint bh, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s)
 {
     /*// Launch kernel.
-    compressKernelDXT5(first, count, bw, m_ctx.result, m_ctx.bitmapTable);
-
-    // Copy result to host.
-    cudaMemcpy(output, m_ctx.result, count * 16, cudaMemcpyDeviceToHost);*/
+    compressKernelDXT5(first, count, bw, device.result[s], device.bitmapTable, device.workQueue[s], device.gridSize, device.stream[s]);*/
 
     // Launch kernel.
     if (alphaMode == AlphaMode_Transparency)
     {
-    //	compressWeightedKernelDXT1(first, count, bw, m_ctx.result, m_ctx.bitmapTable);
+    //	compressWeightedKernelDXT1(first, count, bw, device.result[s], device.bitmapTable, device.workQueue[s], device.gridSize, device.stream[s]);
     }
     else
     {
-    //	compressKernelDXT1_Level4(first, count, w, m_ctx.result, m_ctx.bitmapTable);
+    //	compressKernelDXT1_Level4(first, count, bw, device.result[s], device.bitmapTable, device.workQueue[s], device.gridSize, device.stream[s]);
     }
 
     // Compress alpha in parallel with the GPU.
@@ -270,13 +589,34 @@ void CudaCompressorDXT5::compressBlocks(uint first, uint count, uint bw, uint bh
         //OptimalCompress::compressDXT3A(rgba, alphaBlocks + i);
     }
 
-    // Copy result to host.
-    cudaMemcpy(output, m_ctx.result, count * 8, cudaMemcpyDeviceToHost);
-
     // @@ Interleave color and alpha blocks.
 
 }
 
+
+void CudaCompressorBC4::setup(cudaArray * image, const nvtt::CompressionOptions::Private & compressionOptions)
+{
+    bindTextureToArray(image);
+}
+
+void CudaCompressorBC4::compressBlocks(uint first, uint count, uint bw, uint bh, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s)
+{
+    // Launch kernel.
+    compressKernelBC4(first, count, bw, device.result[s], device.workQueue[s], device.gridSize, device.stream[s]);
+}
+
+
+void CudaCompressorBC5::setup(cudaArray * image, const nvtt::CompressionOptions::Private & compressionOptions)
+{
+    bindTextureToArray(image);
+}
+
+void CudaCompressorBC5::compressBlocks(uint first, uint count, uint bw, uint bh, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s)
+{
+    // Launch kernel.
+    compressKernelBC5(first, count, bw, device.result[s], device.workQueue[s], device.gridSize, device.stream[s]);
+}
+
 #endif // defined HAVE_CUDA
 
 
@@ -321,14 +661,14 @@ void CudaCompressor::compressDXT3(const CompressionOptions::Private & compressio
 	const uint h = (m_image->height() + 3) / 4;
 
 	uint imageSize = w * h * 16 * sizeof(Color32);
-    uint * blockLinearImage = (uint *) malloc(imageSize);
+    uint * blockLinearImage = (uint *) poolAllocate(imageSize);
 	convertToBlockLinear(m_image, blockLinearImage);
 
 	const uint blockNum = w * h;
 	const uint compressedSize = blockNum * 8;
 
 	AlphaBlockDXT3 * alphaBlocks = NULL;
-	alphaBlocks = (AlphaBlockDXT3 *)malloc(min(compressedSize, MAX_BLOCKS * 8U));
+	alphaBlocks = (AlphaBlockDXT3 *)mem::malloc(min(compressedSize, MAX_BLOCKS * 8U));
 
 	setupCompressKernel(compressionOptions.colorWeight.ptr());
 	
@@ -382,8 +722,8 @@ void CudaCompressor::compressDXT3(const CompressionOptions::Private & compressio
 	clock_t end = clock();
 	//printf("\rCUDA time taken: %.3f seconds\n", float(end-start) / CLOCKS_PER_SEC);
 
-	free(alphaBlocks);
-	free(blockLinearImage);
+	mem::free(alphaBlocks);
+	poolFree(blockLinearImage);
 
 #else
 	outputOptions.error(Error_CudaError);
@@ -402,14 +742,14 @@ void CudaCompressor::compressDXT5(const CompressionOptions::Private & compressio
 	const uint h = (m_image->height() + 3) / 4;
 
 	uint imageSize = w * h * 16 * sizeof(Color32);
-    uint * blockLinearImage = (uint *) malloc(imageSize);
+    uint * blockLinearImage = (uint *) poolAllocate(imageSize);
 	convertToBlockLinear(m_image, blockLinearImage);
 
 	const uint blockNum = w * h;
 	const uint compressedSize = blockNum * 8;
 
 	AlphaBlockDXT5 * alphaBlocks = NULL;
-	alphaBlocks = (AlphaBlockDXT5 *)malloc(min(compressedSize, MAX_BLOCKS * 8U));
+	alphaBlocks = (AlphaBlockDXT5 *)mem::malloc(min(compressedSize, MAX_BLOCKS * 8U));
 
 	setupCompressKernel(compressionOptions.colorWeight.ptr());
 	
@@ -463,8 +803,8 @@ void CudaCompressor::compressDXT5(const CompressionOptions::Private & compressio
 	clock_t end = clock();
 	//printf("\rCUDA time taken: %.3f seconds\n", float(end-start) / CLOCKS_PER_SEC);
 
-	free(alphaBlocks);
-	free(blockLinearImage);
+	mem::free(alphaBlocks);
+	poolFree(blockLinearImage);
 
 #else
 	outputOptions.error(Error_CudaError);
@@ -482,7 +822,7 @@ void CudaCompressor::compressDXT1n(const nvtt::CompressionOptions::Private & com
 	const uint h = (m_image->height() + 3) / 4;
 
 	uint imageSize = w * h * 16 * sizeof(Color32);
-    uint * blockLinearImage = (uint *) malloc(imageSize);
+    uint * blockLinearImage = (uint *) poolAllocate(imageSize);
 	convertToBlockLinear(m_image, blockLinearImage);	// @@ Do this in parallel with the GPU, or in the GPU!
 
 	const uint blockNum = w * h;
@@ -523,7 +863,7 @@ void CudaCompressor::compressDXT1n(const nvtt::CompressionOptions::Private & com
 	clock_t end = clock();
 	//printf("\rCUDA time taken: %.3f seconds\n", float(end-start) / CLOCKS_PER_SEC);
 
-	free(blockLinearImage);
+	poolFree(blockLinearImage);
 
 #else
 	outputOptions.error(Error_CudaError);
@@ -541,7 +881,7 @@ void CudaCompressor::compressCTX1(const nvtt::CompressionOptions::Private & comp
 	const uint h = (m_image->height() + 3) / 4;
 
 	uint imageSize = w * h * 16 * sizeof(Color32);
-    uint * blockLinearImage = (uint *) malloc(imageSize);
+    uint * blockLinearImage = (uint *) poolAllocate(imageSize);
 	convertToBlockLinear(m_image, blockLinearImage);	// @@ Do this in parallel with the GPU, or in the GPU!
 
 	const uint blockNum = w * h;
@@ -583,7 +923,7 @@ void CudaCompressor::compressCTX1(const nvtt::CompressionOptions::Private & comp
 	clock_t end = clock();
 	//printf("\rCUDA time taken: %.3f seconds\n", float(end-start) / CLOCKS_PER_SEC);
 
-	free(blockLinearImage);
+	poolFree(blockLinearImage);
 
 #else
 	outputOptions.error(Error_CudaError);
@@ -29,37 +29,124 @@
 #include "nvtt/Compressor.h" // CompressorInterface
 
 struct cudaArray;
+struct CUstream_st;
+struct CUevent_st;
 
 namespace nv
 {
-    class CudaContext
+    // The tables, streams and result buffers of one device.
+    struct CudaDevice
     {
-    public:
-        CudaContext();
-        ~CudaContext();
+        CudaDevice(int id, uint weight);
+        ~CudaDevice();
 
         bool isValid() const;
 
-    public:
+        // Make room for count texels in the staging buffers of each stream.
+        bool reserveStaging(uint count);
+
+        // Get a Color32 array of the given extents, from the pool when one was released earlier. Returns NULL on failure.
+        cudaArray * acquireArray(uint w, uint h);
+
+        // Give the array back to the pool, for the next images of the same extents.
+        void releaseArray(cudaArray * array, uint w, uint h);
+
+        // Number of chunks of blocks in flight, each one on its own stream.
+        enum { StreamCount = 2 };
+
+        // Number of arrays kept in the pool.
+        enum { ArrayPoolSize = 16 };
+
+        int id;
+
+        // Relative throughput, the chunks of the device are this many sixteenths of maxBlocks.
+        uint weight;
+
+        // Largest chunk, in blocks. Devices with a watchdog take MAX_BLOCKS per launch, the others a whole level of up to
+        // MAX_PERSISTENT_BLOCKS blocks in a persistent grid of gridSize thread blocks, 0 when there's a watchdog.
+        uint maxBlocks;
+        uint gridSize;
+
         // Device pointers.
         uint * bitmapTable;
         uint * bitmapTableCTX;
         uint * data;
-        uint * result;
+        uint * result[StreamCount];
+
+        // Streams, with the pinned host buffer that receives their results and the event recorded after their upload.
+        CUstream_st * stream[StreamCount];
+        CUevent_st * uploaded[StreamCount];
+        void * pinnedResult[StreamCount];
+
+        // Work queues of the persistent kernels, the index of the next block.
+        uint * workQueue[StreamCount];
+
+        // Partial sums of the squared error of the chunks, on the device and in pinned host memory.
+        float * errors[StreamCount];
+        float * pinnedErrors[StreamCount];
+
+        // Staging buffers of the streams, the rows of a chunk as uploaded in planar float format and quantized to Color32.
+        float * stagingRows[StreamCount];
+        uint * stagingColors[StreamCount];
+        uint stagingSize;
+
+        // Released arrays, oldest first. Mipmap chains of the same extents reuse them texture after texture.
+        struct PooledArray
+        {
+            cudaArray * array;
+            uint w, h;
+        };
+        PooledArray arrayPool[ArrayPoolSize];
+        uint arrayPoolCount;
+        uint arrayPoolBytes;
+    };
+
+    class CudaContext
+    {
+    public:
+        // Use the devices in the mask, bit i is device i. The first device is the fastest one, the one that holds the surfaces.
+        CudaContext(uint deviceMask = ~0U);
+        ~CudaContext();
+
+        bool isValid() const;
+
+        enum { MaxDeviceCount = 8 };
+
+    public:
+        CudaDevice * device[MaxDeviceCount];
+        uint deviceCount;
     };
 
 #if defined HAVE_CUDA
 
+    // Block formats that the error kernel decodes.
+    enum ErrorFormat
+    {
+        ErrorFormat_None = -1,
+        ErrorFormat_DXT1,
+        ErrorFormat_BC4,
+        ErrorFormat_BC5,
+    };
+
     struct CudaCompressor : public CompressorInterface
     {
         CudaCompressor(CudaContext & ctx);
 
         virtual void compress(nvtt::AlphaMode alphaMode, uint w, uint h, uint d, const float * data, nvtt::TaskDispatcher * dispatcher, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions);
 
+        // Compress the image in the array. When data isn't NULL the rows of the chunks are uploaded from it as they go and
+        // quantized on the device, otherwise the image is already on the device, like a level of a CudaSurface.
+        void compressArray(nvtt::AlphaMode alphaMode, uint w, uint h, const float * data, cudaArray * image, const nvtt::CompressionOptions::Private & compressionOptions, const nvtt::OutputOptions::Private & outputOptions);
+
         virtual void setup(cudaArray * image, const nvtt::CompressionOptions::Private & compressionOptions) = 0;
-        virtual void compressBlocks(uint first, uint count, uint w, uint h, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output) = 0;
+
+        // Queue the kernels that compress count blocks starting at first into the result buffer of stream s of the device, the current one.
+        virtual void compressBlocks(uint first, uint count, uint w, uint h, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s) = 0;
         virtual uint blockSize() const = 0;
 
+        // Format of the blocks for the error measured when the output options have an image error handler.
+        virtual ErrorFormat errorFormat() const { return ErrorFormat_None; }
+
     protected:
         CudaContext & m_ctx;
     };
@@ -69,8 +156,9 @@ namespace nv
         CudaCompressorDXT1(CudaContext & ctx) : CudaCompressor(ctx) {}
 
         virtual void setup(cudaArray * image, const nvtt::CompressionOptions::Private & compressionOptions);
-        virtual void compressBlocks(uint first, uint count, uint w, uint h, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+        virtual void compressBlocks(uint first, uint count, uint w, uint h, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s);
         virtual uint blockSize() const { return 8; };
+        virtual ErrorFormat errorFormat() const { return ErrorFormat_DXT1; }
     };
 
     /*struct CudaCompressorDXT1n : public CudaCompressor
@@ -85,7 +173,7 @@ namespace nv
         CudaCompressorDXT3(CudaContext & ctx) : CudaCompressor(ctx) {}
 
         virtual void setup(cudaArray * image, const nvtt::CompressionOptions::Private & compressionOptions);
-        virtual void compressBlocks(uint first, uint count, uint w, uint h, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+        virtual void compressBlocks(uint first, uint count, uint w, uint h, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s);
         virtual uint blockSize() const { return 16; };
     };
 
@@ -94,8 +182,29 @@ namespace nv
         CudaCompressorDXT5(CudaContext & ctx) : CudaCompressor(ctx) {}
 
         virtual void setup(cudaArray * image, const nvtt::CompressionOptions::Private & compressionOptions);
-        virtual void compressBlocks(uint first, uint count, uint w, uint h, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, void * output);
+        virtual void compressBlocks(uint first, uint count, uint w, uint h, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s);
+        virtual uint blockSize() const { return 16; };
+    };
+
+    // Exhaustive endpoint search of each channel, same results as ProductionCompressorBC4/BC5.
+    struct CudaCompressorBC4 : public CudaCompressor
+    {
+        CudaCompressorBC4(CudaContext & ctx) : CudaCompressor(ctx) {}
+
+        virtual void setup(cudaArray * image, const nvtt::CompressionOptions::Private & compressionOptions);
+        virtual void compressBlocks(uint first, uint count, uint w, uint h, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s);
+        virtual uint blockSize() const { return 8; };
+        virtual ErrorFormat errorFormat() const { return ErrorFormat_BC4; }
+    };
+
+    struct CudaCompressorBC5 : public CudaCompressor
+    {
+        CudaCompressorBC5(CudaContext & ctx) : CudaCompressor(ctx) {}
+
+        virtual void setup(cudaArray * image, const nvtt::CompressionOptions::Private & compressionOptions);
+        virtual void compressBlocks(uint first, uint count, uint w, uint h, nvtt::AlphaMode alphaMode, const nvtt::CompressionOptions::Private & compressionOptions, const CudaDevice & device, uint s);
         virtual uint blockSize() const { return 16; };
+        virtual ErrorFormat errorFormat() const { return ErrorFormat_BC5; }
     };
 
     /*struct CudaCompressorCXT1 : public CudaCompressor
@@ -0,0 +1,281 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+// Copyright (c) 2007-2009 NVIDIA Corporation -- Ignacio Castano <icastano@nvidia.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "CudaSurface.h"
+
+#include "nvcore/Debug.h"
+#include "nvcore/Utils.h" // max
+#include "nvimage/Filter.h"
+
+#if defined HAVE_CUDA
+#include <cuda_runtime_api.h>
+#include <math.h> // cosf
+
+extern "C" void convolveKernelX(const float * d_input, float * d_output, const float * d_kernel, int windowSize, float kernelWidth, uint srcWidth, uint dstWidth, uint height, int wrapMode);
+extern "C" void convolveKernelY(const float * d_input, float * d_output, const float * d_kernel, int windowSize, float kernelWidth, uint width, uint srcHeight, uint dstHeight, int wrapMode);
+extern "C" void convertToColor32(const float * d_input, uint * d_output, uint count, uint pitch, float gamma, cudaStream_t stream);
+extern "C" void cosinePowerFilterKernel(const float * d_input, const float * d_texels, uint inputEdgeLength, float * d_output, uint size, int fixupMethod, float cosineConeAngle, float cosinePower);
+
+#endif
+
+using namespace nv;
+
+
+CudaSurface::CudaSurface() : m_width(0), m_height(0), m_image(NULL), m_color(NULL), m_array(NULL)
+{
+}
+
+CudaSurface::~CudaSurface()
+{
+#if defined HAVE_CUDA
+    cudaFree(m_image);
+    cudaFree(m_color);
+    if (m_array != NULL) cudaFreeArray(m_array);
+#endif
+}
+
+bool CudaSurface::setImage(const float * data, uint w, uint h)
+{
+#if defined HAVE_CUDA
+    float * image = NULL;
+    if (cudaMalloc((void**) &image, w * h * 4 * sizeof(float)) != cudaSuccess) {
+        return false;
+    }
+    cudaMemcpy(image, data, w * h * 4 * sizeof(float), cudaMemcpyHostToDevice);
+
+    cudaFree(m_image);
+    m_image = image;
+    m_width = w;
+    m_height = h;
+
+    return cudaGetLastError() == cudaSuccess;
+#else
+    return false;
+#endif
+}
+
+bool CudaSurface::getImage(float * data) const
+{
+#if defined HAVE_CUDA
+    return cudaMemcpy(data, m_image, m_width * m_height * 4 * sizeof(float), cudaMemcpyDeviceToHost) == cudaSuccess;
+#else
+    return false;
+#endif
+}
+
+#if defined HAVE_CUDA
+
+// Upload the weights of a polyphase kernel, windowSize() for each output pixel.
+static float * uploadKernel(const PolyphaseKernel & k)
+{
+    const uint size = k.length() * k.windowSize();
+
+    float * tmp = new float[size];
+    for (uint i = 0; i < k.length(); i++) {
+        for (int j = 0; j < k.windowSize(); j++) {
+            tmp[i * k.windowSize() + j] = k.valueAt(i, j);
+        }
+    }
+
+    float * d_kernel = NULL;
+    if (cudaMalloc((void**) &d_kernel, size * sizeof(float)) == cudaSuccess) {
+        cudaMemcpy(d_kernel, tmp, size * sizeof(float), cudaMemcpyHostToDevice);
+    }
+
+    delete [] tmp;
+    return d_kernel;
+}
+
+#endif
+
+bool CudaSurface::resize(const Filter & filter, uint w, uint h, int wrapMode)
+{
+#if defined HAVE_CUDA
+    nvDebugCheck(m_image != NULL);
+
+    if (w == m_width && h == m_height) {
+        return true;
+    }
+
+    PolyphaseKernel xkernel(filter, m_width, w, 32);
+    PolyphaseKernel ykernel(filter, m_height, h, 32);
+
+    float * d_xkernel = uploadKernel(xkernel);
+    float * d_ykernel = uploadKernel(ykernel);
+
+    // Same order as FloatImage::resize, rows first.
+    float * tmp = NULL;
+    float * image = NULL;
+    cudaMalloc((void**) &tmp, w * m_height * 4 * sizeof(float));
+    cudaMalloc((void**) &image, w * h * 4 * sizeof(float));
+
+    bool success = false;
+    if (d_xkernel != NULL && d_ykernel != NULL && tmp != NULL && image != NULL)
+    {
+        convolveKernelX(m_image, tmp, d_xkernel, xkernel.windowSize(), xkernel.width(), m_width, w, m_height, wrapMode);
+        convolveKernelY(tmp, image, d_ykernel, ykernel.windowSize(), ykernel.width(), w, m_height, h, wrapMode);
+
+        success = (cudaGetLastError() == cudaSuccess);
+    }
+
+    cudaFree(d_xkernel);
+    cudaFree(d_ykernel);
+    cudaFree(tmp);
+
+    if (!success) {
+        cudaFree(image);
+        return false;
+    }
+
+    cudaFree(m_image);
+    m_image = image;
+    m_width = w;
+    m_height = h;
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool CudaSurface::buildNextMipmap(const Filter & filter, int wrapMode)
+{
+    return resize(filter, max(1U, m_width / 2), max(1U, m_height / 2), wrapMode);
+}
+
+cudaArray * CudaSurface::toColor32(float gamma)
+{
+#if defined HAVE_CUDA
+    const uint count = m_width * m_height;
+
+    cudaFree(m_color);
+    m_color = NULL;
+    if (m_array != NULL) {
+        cudaFreeArray(m_array);
+        m_array = NULL;
+    }
+
+    if (cudaMalloc((void**) &m_color, count * sizeof(uint)) != cudaSuccess) {
+        m_color = NULL;
+        return NULL;
+    }
+
+    cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(8, 8, 8, 8, cudaChannelFormatKindUnsigned);
+    if (cudaMallocArray(&m_array, &channelDesc, m_width, m_height) != cudaSuccess) {
+        m_array = NULL;
+        return NULL;
+    }
+
+    convertToColor32(m_image, m_color, count, count, gamma, 0);
+    cudaMemcpyToArray(m_array, 0, 0, m_color, count * sizeof(uint), cudaMemcpyDeviceToDevice);
+
+    if (cudaGetLastError() != cudaSuccess) {
+        return NULL;
+    }
+
+    return m_array;
+#else
+    return NULL;
+#endif
+}
+
+
+CudaCubeSurface::CudaCubeSurface() : m_edgeLength(0), m_faces(NULL), m_texels(NULL), m_output(NULL), m_outputSize(0)
+{
+}
+
+CudaCubeSurface::~CudaCubeSurface()
+{
+#if defined HAVE_CUDA
+    cudaFree(m_faces);
+    cudaFree(m_texels);
+    cudaFree(m_output);
+#endif
+}
+
+bool CudaCubeSurface::setFaces(const float * const faces[6], const float * texels, uint edgeLength)
+{
+#if defined HAVE_CUDA
+    const uint faceSize = edgeLength * edgeLength * 4;
+
+    cudaFree(m_faces);
+    cudaFree(m_texels);
+    m_faces = NULL;
+    m_texels = NULL;
+    m_edgeLength = 0;
+
+    if (cudaMalloc((void**) &m_faces, 6 * faceSize * sizeof(float)) != cudaSuccess) {
+        m_faces = NULL;
+        return false;
+    }
+    if (cudaMalloc((void**) &m_texels, 6 * faceSize * sizeof(float)) != cudaSuccess) {
+        m_texels = NULL;
+        return false;
+    }
+
+    for (uint f = 0; f < 6; f++) {
+        cudaMemcpy(m_faces + f * faceSize, faces[f], faceSize * sizeof(float), cudaMemcpyHostToDevice);
+    }
+    cudaMemcpy(m_texels, texels, 6 * faceSize * sizeof(float), cudaMemcpyHostToDevice);
+
+    m_edgeLength = edgeLength;
+
+    return cudaGetLastError() == cudaSuccess;
+#else
+    return false;
+#endif
+}
+
+bool CudaCubeSurface::cosinePowerFilter(uint size, float cosinePower, float coneAngle, int fixupMethod, float * const faces[6])
+{
+#if defined HAVE_CUDA
+    nvDebugCheck(m_faces != NULL);
+
+    // Keep the output of the largest mipmap around for the smaller ones.
+    const uint faceSize = size * size * 3;
+    if (6 * faceSize > m_outputSize) {
+        cudaFree(m_output);
+        m_outputSize = 0;
+
+        if (cudaMalloc((void**) &m_output, 6 * faceSize * sizeof(float)) != cudaSuccess) {
+            m_output = NULL;
+            return false;
+        }
+        m_outputSize = 6 * faceSize;
+    }
+
+    cosinePowerFilterKernel(m_faces, m_texels, m_edgeLength, m_output, size, fixupMethod, cosf(coneAngle), cosinePower);
+
+    for (uint f = 0; f < 6; f++) {
+        if (cudaMemcpy(faces[f], m_output + f * faceSize, faceSize * sizeof(float), cudaMemcpyDeviceToHost) != cudaSuccess) {
+            return false;
+        }
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,107 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+// Copyright (c) 2007-2009 NVIDIA Corporation -- Ignacio Castano <icastano@nvidia.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef NV_TT_CUDASURFACE_H
+#define NV_TT_CUDASURFACE_H
+
+#include "nvcore/nvcore.h"
+
+struct cudaArray;
+
+namespace nv
+{
+    class Filter;
+
+    // Image in device memory, 4 planar float channels like FloatImage, so that a mipmap chain can be built and
+    // compressed on the GPU from a single upload.
+    class CudaSurface
+    {
+        NV_FORBID_COPY(CudaSurface);
+    public:
+        CudaSurface();
+        ~CudaSurface();
+
+        uint width() const { return m_width; }
+        uint height() const { return m_height; }
+
+        // Upload the 4 planar channels of a w x h image.
+        bool setImage(const float * data, uint w, uint h);
+
+        // Download the 4 planar channels of the image, width() * height() floats each.
+        bool getImage(float * data) const;
+
+        // Resample the image with the polyphase kernels of the filter, like FloatImage::resize.
+        bool resize(const Filter & filter, uint w, uint h, int wrapMode);
+
+        // Replace the image with its next mipmap, like FloatImage::downSample.
+        bool buildNextMipmap(const Filter & filter, int wrapMode);
+
+        // Convert the image to the given gamma and to 8 bits into the array the CUDA compressors read.
+        // The array is owned by the surface and valid until the next call.
+        cudaArray * toColor32(float gamma);
+
+    private:
+        uint m_width;
+        uint m_height;
+
+        // Device pointers.
+        float * m_image;
+        uint * m_color;
+        cudaArray * m_array;
+    };
+
+    // Cube map in device memory, the six faces in the layout of FloatImage, with the direction and solid angle of each
+    // texel, to convolve it on the GPU. The mipmaps of a prefiltered cube map all come from a single upload.
+    class CudaCubeSurface
+    {
+        NV_FORBID_COPY(CudaCubeSurface);
+    public:
+        CudaCubeSurface();
+        ~CudaCubeSurface();
+
+        uint edgeLength() const { return m_edgeLength; }
+
+        // Upload the 4 planar channels of each face, and 4 floats for each texel of the faces in order: its direction
+        // and its solid angle.
+        bool setFaces(const float * const faces[6], const float * texels, uint edgeLength);
+
+        // Convolve the cube with a cosine power lobe that extends to coneAngle, like CubeSurface::cosinePowerFilter,
+        // and download the first 3 planar channels of each face of size x size texels.
+        bool cosinePowerFilter(uint size, float cosinePower, float coneAngle, int fixupMethod, float * const faces[6]);
+
+    private:
+        uint m_edgeLength;
+
+        // Device pointers.
+        float * m_faces;
+        float * m_texels;
+        float * m_output;
+        uint m_outputSize;
+    };
+
+} // nv namespace
+
+
+#endif // NV_TT_CUDASURFACE_H
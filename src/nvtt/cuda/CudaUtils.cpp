@@ -29,6 +29,7 @@
 #if defined HAVE_CUDA
 #include <cuda.h>
 #include <cuda_runtime_api.h>
+#include <string.h> // strncpy
 #endif
 
 using namespace nv;
@@ -181,6 +182,72 @@ int nv::cuda::deviceCount()
 	return 0;
 }
 
+/// Get the relative throughput of the given device, 0 for emulation devices.
+unsigned int nv::cuda::deviceSpeed(int i)
+{
+#if defined HAVE_CUDA
+	cudaDeviceProp device_properties;
+	if (cudaGetDeviceProperties(&device_properties, i) == cudaSuccess && device_properties.major != -1 && device_properties.minor != -1)
+	{
+		return device_properties.multiProcessorCount * device_properties.clockRate;
+	}
+#endif
+	return 0;
+}
+
+/// Get the name of the given device, truncated to size characters.
+bool nv::cuda::getDeviceName(int i, char * name, int size)
+{
+#if defined HAVE_CUDA
+	cudaDeviceProp device_properties;
+	if (cudaGetDeviceProperties(&device_properties, i) == cudaSuccess)
+	{
+		strncpy(name, device_properties.name, size);
+		name[size - 1] = '\0';
+		return true;
+	}
+#endif
+	return false;
+}
+
+/// Get the devices whose bit is set in the mask, fastest first. Returns the number of devices.
+int nv::cuda::getDevices(unsigned int mask, int * devices, int maxCount)
+{
+	int ids[32];
+	unsigned int speeds[32];
+	int count = 0;
+
+	const int device_count = deviceCount();
+	for (int i = 0; i < device_count && i < 32; i++)
+	{
+		const unsigned int speed = deviceSpeed(i);
+		if ((mask & (1U << i)) == 0 || speed == 0)
+		{
+			continue;
+		}
+
+		// Insertion sort by speed.
+		int j = count++;
+		while (j > 0 && speeds[j - 1] < speed)
+		{
+			ids[j] = ids[j - 1];
+			speeds[j] = speeds[j - 1];
+			j--;
+		}
+		ids[j] = i;
+		speeds[j] = speed;
+	}
+
+	if (count > maxCount) count = maxCount;
+
+	for (int i = 0; i < count; i++)
+	{
+		devices[i] = ids[i];
+	}
+
+	return count;
+}
+
 int nv::cuda::getFastestDevice()
 {
 	int max_gflops_device = 0;
@@ -33,6 +33,9 @@ namespace nv
 		bool isHardwarePresent();
 		int deviceCount();
 		int getFastestDevice();
+		unsigned int deviceSpeed(int i);
+		bool getDeviceName(int i, char * name, int size);
+		int getDevices(unsigned int mask, int * devices, int maxCount);
 		bool setDevice(int i);
 		void exit();
 	};
@@ -1,57 +1,216 @@
 
 #include "nvtt_experimental.h"
 
+#include "nvtt/QuickCompressDXT.h"
+
+#include "nvimage/ColorBlock.h"
+#include "nvimage/BlockDXT.h"
+
+#include "nvcore/Debug.h"
+#include "nvcore/Utils.h" // max
+
+#include <new> // placement new
+
+using namespace nv;
+
 struct NvttTexture
 {
 	NvttTexture() :
-		m_constant(false),
-		m_image(NULL),
-		m_floatImage(NULL)
-	{
-	}
-	
-	~NvttTexture()
+		m_width(0),
+		m_height(0),
+		m_data(NULL)
 	{
-		if (m_constant && m_image) m_image->unwrap();
-		delete m_image;
-		delete m_floatImage;
 	}
-	
-	bool m_constant;
-	Image * m_image;
-	FloatImage * m_floatImage;
+
+	uint m_width;
+	uint m_height;
+	Color32 * m_data;	// Owned by the caller.
 };
 
-NvttTexture * nvttCreateTexture() 
+NvttTexture * nvttCreateTexture()
 {
 	return new NvttTexture();
 }
-	
+
 void nvttDestroyTexture(NvttTexture * tex)
 {
 	delete tex;
 }
 
-void nvttSetImageData(NvttImage * img, NvttInputFormat format, uint w, uint h, void * data)
+NvttBoolean nvttSetTexture2D(NvttTexture * tex, NvttInputFormat format, unsigned int w, unsigned int h, void * data)
 {
-	nvCheck(img != NULL);
-	
-	if (format == NVTT_InputFormat_BGRA_8UB)
+	nvCheck(tex != NULL);
+
+	if (format != NVTT_InputFormat_BGRA_8UB || w == 0 || h == 0 || data == NULL)
 	{
-		img->m_constant = false;
-		img->m_image->allocate(w, h);
-		memcpy(img->m_image->pixels(), data, w * h * 4);
+		return NVTT_False;
 	}
-	else
+
+	tex->m_width = w;
+	tex->m_height = h;
+	tex->m_data = (Color32 *)data;
+	return NVTT_True;
+}
+
+unsigned int nvttTextureWidth(const NvttTexture * tex)
+{
+	nvCheck(tex != NULL);
+	return tex->m_width;
+}
+
+unsigned int nvttTextureHeight(const NvttTexture * tex)
+{
+	nvCheck(tex != NULL);
+	return tex->m_height;
+}
+
+NvttBoolean nvttResize(NvttTexture * tex, unsigned int w, unsigned int h)
+{
+	nvCheck(tex != NULL);
+
+	const uint srcWidth = tex->m_width;
+	const uint srcHeight = tex->m_height;
+
+	if (tex->m_data == NULL || w == 0 || h == 0 || w > srcWidth || h > srcHeight)
 	{
-		nvCheck(false);
+		return NVTT_False;
 	}
+
+	// Every texel reads a box at or after its own index, so they can be written in order over the source.
+	Color32 * data = tex->m_data;
+
+	for (uint y = 0; y < h; y++)
+	{
+		const uint y0 = y * srcHeight / h;
+		const uint y1 = (y + 1) * srcHeight / h;
+
+		for (uint x = 0; x < w; x++)
+		{
+			const uint x0 = x * srcWidth / w;
+			const uint x1 = (x + 1) * srcWidth / w;
+
+			uint r = 0, g = 0, b = 0, a = 0;
+			for (uint sy = y0; sy < y1; sy++)
+			{
+				for (uint sx = x0; sx < x1; sx++)
+				{
+					const Color32 c = data[sy * srcWidth + sx];
+					r += c.r;
+					g += c.g;
+					b += c.b;
+					a += c.a;
+				}
+			}
+
+			const uint count = (x1 - x0) * (y1 - y0);
+			const uint half = count / 2;
+
+			Color32 & dst = data[y * w + x];
+			dst.r = uint8((r + half) / count);
+			dst.g = uint8((g + half) / count);
+			dst.b = uint8((b + half) / count);
+			dst.a = uint8((a + half) / count);
+		}
+	}
+
+	tex->m_width = w;
+	tex->m_height = h;
+	return NVTT_True;
+}
+
+NvttBoolean nvttDownsample(NvttTexture * tex)
+{
+	nvCheck(tex != NULL);
+
+	if (tex->m_width == 1 && tex->m_height == 1)
+	{
+		return NVTT_False;
+	}
+
+	return nvttResize(tex, max(1U, tex->m_width / 2), max(1U, tex->m_height / 2));
 }
 
-void nvttCompressImage(NvttImage * img, NvttFormat format)
+static uint blockSize(NvttFormat format)
 {
-	nvCheck(img != NULL);
+	switch (format)
+	{
+	case NVTT_Format_BC1:
+	case NVTT_Format_BC1a:
+	case NVTT_Format_BC4:
+		return 8;
+	case NVTT_Format_BC2:
+	case NVTT_Format_BC3:
+	case NVTT_Format_BC5:
+		return 16;
+	default:
+		return 0;
+	}
+}
 
-	// @@ Invoke appropriate compressor.
+unsigned int nvttCompressedSize(const NvttTexture * tex, NvttFormat format)
+{
+	nvCheck(tex != NULL);
+	return ((tex->m_width + 3) / 4) * ((tex->m_height + 3) / 4) * blockSize(format);
 }
 
+unsigned int nvttOutputCompressed(const NvttTexture * tex, NvttFormat format, void * buffer, unsigned int size)
+{
+	nvCheck(tex != NULL);
+
+	const uint outputSize = nvttCompressedSize(tex, format);
+	if (tex->m_data == NULL || outputSize == 0 || buffer == NULL || size < outputSize)
+	{
+		return 0;
+	}
+
+	const uint w = tex->m_width;
+	const uint h = tex->m_height;
+	const uint * data = (const uint *)tex->m_data;
+
+	uint8 * output = (uint8 *)buffer;
+	const uint bs = blockSize(format);
+
+	ColorBlock rgba;
+	AlphaBlock4x4 tmp;
+
+	for (uint y = 0; y < h; y += 4)
+	{
+		for (uint x = 0; x < w; x += 4, output += bs)
+		{
+			rgba.init(w, h, data, x, y);
+
+			if (format == NVTT_Format_BC1)
+			{
+				QuickCompress::compressDXT1(rgba, new(output) BlockDXT1);
+			}
+			else if (format == NVTT_Format_BC1a)
+			{
+				QuickCompress::compressDXT1a(rgba, new(output) BlockDXT1);
+			}
+			else if (format == NVTT_Format_BC2)
+			{
+				QuickCompress::compressDXT3(rgba, new(output) BlockDXT3);
+			}
+			else if (format == NVTT_Format_BC3)
+			{
+				QuickCompress::compressDXT5(rgba, new(output) BlockDXT5);
+			}
+			else if (format == NVTT_Format_BC4)
+			{
+				BlockATI1 * block = new(output) BlockATI1;
+				tmp.init(rgba, 0);  // Copy red to alpha
+				QuickCompress::compressDXT5A(tmp, &block->alpha);
+			}
+			else
+			{
+				BlockATI2 * block = new(output) BlockATI2;
+				tmp.init(rgba, 0);  // Copy red to alpha
+				QuickCompress::compressDXT5A(tmp, &block->x);
+				tmp.init(rgba, 1);  // Copy green to alpha
+				QuickCompress::compressDXT5A(tmp, &block->y);
+			}
+		}
+	}
+
+	return outputSize;
+}
@@ -2,102 +2,51 @@
 #ifndef NVTT_EXPERIMENTAL_H
 #define NVTT_EXPERIMENTAL_H
 
+#ifdef __cplusplus
 #include <nvtt/nvtt.h>
+#endif
 
-typedef struct NvttTexture NvttTexture;
-typedef struct NvttOutputOptions NvttOutputOptions;
+#include <nvtt/nvtt_wrapper.h>
 
+// Lightweight texture API for runtime compression.
+//
+// The texels stay in the caller's memory and are compressed into the caller's buffer, one block at a time on the
+// calling thread, with the fastest compressors. Besides nvttCreateTexture nothing allocates memory, and the task
+// scheduler is never started.
 
-// Global functions
-void nvttInitialize(...);
-unsigned int nvttGetVersion();
-const char * nvttGetErrorString(unsigned int error);
+typedef struct NvttTexture NvttTexture;
 
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 // Texture functions
-NvttTexture * nvttCreateTexture();
-void nvttDestroyTexture(NvttTexture * tex);
-
-void nvttSetTexture2D(NvttTexture * tex, NvttInputFormat format, uint w, uint h, uint idx, void * data);
-
-void nvttResize(NvttTexture * img, uint w, uint h);
-unsigned int nvttDownsample(NvttTexture * img);
-
-void nvttOutputCompressed(NvttTexture * img, NvttOutputFormat format);
-void nvttOutputPixelFormat(NvttTexture * img, NvttOutputFormat format);
-
-
-
-
-// How to control the compression parameters?
-
-// Using many arguments:
-// void nvttCompressImage(img, format, quality, r, g, b, a, ...);
-
-// Using existing compression option class:
-// compressionOptions = nvttCreateCompressionOptions();
-// nvttSetCompressionOptionsFormat(compressionOptions, format);
-// nvttSetCompressionOptionsQuality(compressionOptions, quality);
-// nvttSetCompressionOptionsQuality(compressionOptions, quality);
-// nvttSetCompressionOptionsColorWeights(compressionOptions, r, g, b, a);
-// ...
-// nvttCompressImage(img, compressionOptions);
-
-// Using thread local context state:
-// void nvttSetCompressionFormat(format);
-// void nvttSetCompressionQuality(quality);
-// void nvttSetCompressionColorWeights(r, g, b, a);
-// ...
-// nvttCompressImage(img);
-
-// Using thread local context state, but with GL style function arguments:
-// nvttCompressorParameteri(NVTT_FORMAT, format);
-// nvttCompressorParameteri(NVTT_QUALITY, quality);
-// nvttCompressorParameterf(NVTT_COLOR_WEIGHT_RED, r);
-// nvttCompressorParameterf(NVTT_COLOR_WEIGHT_GREEN, g);
-// nvttCompressorParameterf(NVTT_COLOR_WEIGHT_BLUE, b);
-// nvttCompressorParameterf(NVTT_COLOR_WEIGHT_ALPHA, a);
-// or nvttCompressorParameter4f(NVTT_COLOR_WEIGHTS, r, g, b, a);
-// ...
-// nvttCompressImage(img);
-
-// How do we get the compressed output?
-// - Using callbacks. (via new entrypoints, or through outputOptions)
-// - Return it explicitely from nvttCompressImage.
-// - Store it along the image, retrieve later explicitely with 'nvttGetCompressedData(img, ...)'
-
-/*
-
-// Global functions
-void nvttInitialize(...);
-unsigned int nvttGetVersion();
-const char * nvttGetErrorString(unsigned int error);
-
-// Context object
-void nvttCreateContext();
-void nvttDestroyContext();
-
-void nvttSetParameter1i(unsigned int name, int value);
+NVTT_API NvttTexture * nvttCreateTexture();
+NVTT_API void nvttDestroyTexture(NvttTexture * tex);
 
-void nvttSetParameter1f(unsigned int name, float value);
-void nvttSetParameter2f(unsigned int name, float v0, float v1);
-void nvttSetParameter3f(unsigned int name, float v0, float v1, float v2);
-void nvttSetParameter4f(unsigned int name, float v0, float v1, float v2, float v3);
+// Use the w x h BGRA_8UB texels at data, without copying them. nvttResize and nvttDownsample overwrite them, so the
+// data has to stay valid and writable while the texture uses it. Other input formats are not supported.
+NVTT_API NvttBoolean nvttSetTexture2D(NvttTexture * tex, NvttInputFormat format, unsigned int w, unsigned int h, void * data);
 
-// Image object
-NvttImage * nvttCreateImage();
-void nvttDestroyImage(NvttImage * img);
+NVTT_API unsigned int nvttTextureWidth(const NvttTexture * tex);
+NVTT_API unsigned int nvttTextureHeight(const NvttTexture * tex);
 
-void nvttSetImageData(NvttImage * image, NvttInputFormat format, unsigned int w, unsigned int h, void * data);
+// Box filter the texels in place to w x h. The texture can only shrink, since it has no memory of its own.
+NVTT_API NvttBoolean nvttResize(NvttTexture * tex, unsigned int w, unsigned int h);
 
-void nvttSetImageParameter1i(NvttImage * image, unsigned int name, int value);
-void nvttSetImageParameter1f(NvttImage * image, unsigned int name, float value);
+// Replace the texture with its next mipmap, returns false once it is 1x1.
+NVTT_API NvttBoolean nvttDownsample(NvttTexture * tex);
 
-void nvttResizeImage(NvttImage * image, unsigned int w, unsigned int h);
-void nvttQuantizeImage(NvttImage * image, bool dither, unsigned int rbits, unsigned int gbits, unsigned int bbits, unsigned int abits);
-void nvttCompressImage(NvttImage * image, void * buffer, int size);
+// Size in bytes of the texture in the given format, 0 for formats without a fast compressor. Supported formats are
+// BC1, BC1a, BC2, BC3, BC4 and BC5.
+NVTT_API unsigned int nvttCompressedSize(const NvttTexture * tex, NvttFormat format);
 
-*/
+// Compress the texture into buffer, returns the number of bytes written or 0 if the format is not supported or the
+// buffer is smaller than nvttCompressedSize.
+NVTT_API unsigned int nvttOutputCompressed(const NvttTexture * tex, NvttFormat format, void * buffer, unsigned int size);
 
+#ifdef __cplusplus
+} // extern "C"
+#endif
 
 #endif // NVTT_EXPERIMENTAL_H
@@ -1,61 +1,23 @@
-
 #include "nvtt_experimental.h"
 
-/*
-Errors in the original API:
-- Too many memory copies.
-- Implementation too complicated.
-- Error output should not be in output options.
-- Data driven interface. Follows the dialog model. Provide all the data upfront.
-*/
-
+#include <stdlib.h>
 
-// Output texture with mipmaps
-void example0()
+// Output the BC1 mipmap chain of a BGRA_8UB texture into a single buffer. The texels are overwritten.
+unsigned int example0(unsigned int w, unsigned int h, void * data, void * buffer, unsigned int size)
 {
-	CompressionOptions compressionOptions;
-	OutputOptions outputOptions;
-	
-	Texture img;
-	img.setTexture2D(format, w, h, 0, data);
+	NvttTexture * tex = nvttCreateTexture();
+	nvttSetTexture2D(tex, NVTT_InputFormat_BGRA_8UB, w, h, data);
 
-	Compressor context;
-	context.outputHeader(outputOptions);
-	context.outputCompressed(img, compressionOptions, outputOptions);
-
-	img.toLinear(2.2);	
-	while (img.downsample(NVTT_FILTER_BOX))
+	unsigned int offset = 0;
+	do
 	{
-		img.toGamma(2.2);	
-		outputCompressed(img, compressionOptions, outputOptions);		
-	}
-}
-
-
-// Output texture with colored mipmaps
-void example1()
-{
-	CompressionOptions compressionOptions;
-	OutputOptions outputOptions;
-	
-	Texture img;
-	img.setTexture2D(format, w, h, 0, data);
-
-	Compressor context;
-	context.outputHeader(outputOptions);
-	context.outputCompressed(img, compressionOptions, outputOptions);
+		unsigned int written = nvttOutputCompressed(tex, NVTT_Format_BC1, (char *)buffer + offset, size - offset);
+		if (written == 0) break;
 
-	img.toLinear(2.2);	
-	while (img.downsample(NVTT_FILTER_BOX))
-	{
-		img.toGamma(2.2);
-		
-		Texture mipmap = img;
-		mipmap.blend(color[i].r, color[i].g, color[i].b, 0.5f);
-		
-		context.outputCompressed(mipmap, compressionOptions, outputOptions);		
+		offset += written;
 	}
-}
-
-
+	while (nvttDownsample(tex));
 
+	nvttDestroyTexture(tex);
+	return offset;
+}
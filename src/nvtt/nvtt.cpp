@@ -24,6 +24,16 @@
 
 #include "nvtt.h"
 
+#include "nvimage/FloatImage.h"
+#include "nvimage/Supercompression.h"
+#include "nvimage/MemoryPool.h"
+
+#include "nvthread/ThreadPool.h"
+#include "nvthread/TaskScheduler.h"
+
+#include "nvcore/Memory.h"
+#include "nvcore/Array.inl"
+
 using namespace nvtt;
 
 /// Return a string for the given error.
@@ -45,6 +55,10 @@ const char * nvtt::errorString(Error e)
             return "Error writing through output handler";
         case Error_UnsupportedOutputFormat:
             return "The container file does not support the selected output format";
+        case Error_Cancelled:
+            return "The compression was cancelled";
+        case Error_NonDeterministic:
+            return "The output depends on the number of threads";
     }
 
     return "Invalid error";
@@ -56,5 +70,61 @@ unsigned int nvtt::version()
     return NVTT_VERSION;
 }
 
+/// Keep surfaces of at least the given size in memory mapped scratch files instead of RAM.
+void nvtt::setOutOfCoreThreshold(unsigned int megabytes, const char * scratchDirectory/*= 0*/)
+{
+    nv::FloatImage::setScratchFile(scratchDirectory, uint64(megabytes) << 20);
+}
+
+/// Route the allocations of nvcore and the libraries on top of it to the given functions.
+void nvtt::setAllocator(MallocFunction * mallocFunction, ReallocFunction * reallocFunction, FreeFunction * freeFunction, void * userData/*= 0*/, SizeFunction * sizeFunction/*= 0*/)
+{
+    nv::mem::setAllocator(mallocFunction, reallocFunction, freeFunction, userData, sizeFunction);
+}
+
+size_t nvtt::allocatedMemory()
+{
+    return nv::mem::allocatedBytes();
+}
+
+size_t nvtt::peakMemory()
+{
+    return nv::mem::peakAllocatedBytes();
+}
+
+void nvtt::enableHugePages(bool enable)
+{
+    nv::setPoolHugePages(enable);
+}
+
+void nvtt::setWorkerThreads(int count, ThreadPriority priority/*= ThreadPriority_Normal*/, const int * cpus/*= NULL*/, int cpuCount/*= 0*/)
+{
+    // Make sure enums match.
+    nvStaticCheck(nv::ThreadPriority_Lowest == (nv::ThreadPriority)ThreadPriority_Lowest);
+
+    nv::Array<uint> workerCpus;
+    for (int i = 0; cpus != NULL && i < cpuCount; i++) {
+        if (cpus[i] >= 0) workerCpus.append(uint(cpus[i]));
+    }
+
+    nv::setWorkerPriority((nv::ThreadPriority)priority);
+    nv::setWorkerAffinity(workerCpus.buffer(), workerCpus.count());
+
+    // The scheduler has one worker less, the thread that waits on it makes up for it.
+    nv::ThreadPool::setWorkerCount(count > 0 ? uint(count) : ~0U);
+    nv::TaskScheduler::setDefaultWorkerCount(count > 0 ? uint(count - 1) : ~0U);
+}
+
+/// Zstandard and LZ4 are optional dependencies, zlib is usually available.
+bool nvtt::isSupercompressionSupported(Supercompression scheme)
+{
+    // Make sure enums match.
+    nvStaticCheck(nv::Supercompression_Deflate == (nv::SupercompressionScheme)Supercompression_Deflate);
+    nvStaticCheck(nv::Supercompression_Zstd == (nv::SupercompressionScheme)Supercompression_Zstd);
+    nvStaticCheck(nv::Supercompression_LZ4 == (nv::SupercompressionScheme)Supercompression_LZ4);
+
+    return nv::isSupercompressionSupported(scheme);
+}
+
 
 
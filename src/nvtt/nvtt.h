@@ -26,6 +26,8 @@
 #ifndef NVTT_H
 #define NVTT_H
 
+#include <stddef.h> // size_t
+
 // Function linkage
 #if NVTT_SHARED
 
@@ -106,7 +108,9 @@ namespace nvtt
         Format_BC7,     // Not supported yet.
 
         Format_BC5_Luma,    // Two DXT alpha blocks encoding a single float.
-        Format_BC3_RGBM,    // 
+        Format_BC3_RGBM,    // RGB in color, M in alpha. See CompressionOptions::setRGBMParameters.
+        Format_BC3_YCoCg,   // YCoCg with a CoCg scale per block: R=Co, G=Cg, B=scale, A=Y. See Surface::blockScaleCoCg.
+        Format_BC5_Normal,  // BC5 optimized for the angular error of normals. See CompressionOptions::setNormalTransform.
 
         Format_Count
     };
@@ -140,6 +144,15 @@ namespace nvtt
         //Decoder_RSX, // To take advantage of DXT5 bug.
     };
 
+    // (New in NVTT 2.1)
+    enum NormalTransform {
+        NormalTransform_Orthographic,
+        NormalTransform_Stereographic,
+        NormalTransform_Paraboloid,
+        NormalTransform_Quartic
+        //NormalTransform_DualParaboloid,
+    };
+
 
     // Compression options. This class describes the desired compression format and other compression settings.
     struct CompressionOptions
@@ -154,6 +167,35 @@ namespace nvtt
 
         NVTT_API void setFormat(Format format);
         NVTT_API void setQuality(Quality quality);
+
+        // Compress the given mipmap and the smaller ones with another quality, for example Quality_Normal for the first level
+        // and Quality_Production for the rest. An effort set with setEffort still applies to all the levels. (New in NVTT 2.1)
+        NVTT_API void setMipmapQuality(int mipmap, Quality quality);
+
+        // Set a continuous search effort in [0, 1] for the compressors that support it: DXT1, BC4, BC5, BC6 and BC7.
+        // 0.5 is the amount of search they do by default, negative values restore it. (New in NVTT 2.1)
+        NVTT_API void setEffort(float effort);
+
+        // Stop the BC6 and BC7 mode search of a block as soon as a mode's squared error is below this fraction of the block's variance.
+        // 0 searches all the modes, which is the default. (New in NVTT 2.1)
+        NVTT_API void setErrorThreshold(float threshold);
+
+        // Restrict the BC7 encoder to a subset of its modes, bit i enables mode i. All the modes are searched by default.
+        // With only mode 6 enabled and Quality_Fastest, a single pass mode 6 encoder is used instead. (New in NVTT 2.1)
+        NVTT_API void setBC7ModeMask(unsigned int mask);
+
+        // Trade quality for output that compresses better losslessly: BC1, BC3, BC4, BC5 and BC7 blocks reuse the endpoints or indices
+        // of their neighbors when the squared error that adds is below lambda per bit saved. 0 disables it, the default. (New in NVTT 2.1)
+        NVTT_API void setRateDistortionLambda(float lambda);
+
+        // Range and threshold of the M values of Format_BC3_RGBM, which converts the colors to RGBM itself. The output is decoded
+        // with Surface::fromRGBM(range, threshold). The defaults are 1 and 0.25, like in Surface::toRGBM. (New in NVTT 2.1)
+        NVTT_API void setRGBMParameters(float range, float threshold);
+
+        // Transform that Format_BC5_Normal applies to the normals before compressing their x and y, which are decoded with
+        // Surface::reconstructNormals. The input is a normal map packed in [0, 1]. Orthographic by default. (New in NVTT 2.1)
+        NVTT_API void setNormalTransform(NormalTransform xform);
+
         NVTT_API void setColorWeights(float red, float green, float blue, float alpha = 1.0f);
 
         NVTT_API void setExternalCompressor(const char * name);
@@ -262,12 +304,19 @@ namespace nvtt
         NVTT_API void reset();
 
         // Setup input layout.
-        NVTT_API void setTextureLayout(TextureType type, int w, int h, int d = 1);
+        // Array textures have arraySize layers of 2D or cube images, 3D textures can't be arrays. The face of setMipmapData is the
+        // layer, or 6 * layer + face for cube arrays. Arrays are output in the DDS10 container only. (arraySize new in NVTT 2.1)
+        NVTT_API void setTextureLayout(TextureType type, int w, int h, int d = 1, int arraySize = 1);
         NVTT_API void resetTextureLayout();
 
         // Set mipmap data. Copies the data.
         NVTT_API bool setMipmapData(const void * data, int w, int h, int d = 1, int face = 0, int mipmap = 0);
 
+        // Set mipmap data without copying it, the compressor reads the caller's texels. They must stay valid until the image is
+        // replaced, the layout is reset or the options are destroyed. The rows are pitch bytes apart, or packed when pitch is 0,
+        // the slices of 3D textures h rows apart. (New in NVTT 2.1)
+        NVTT_API bool setMipmapDataView(const void * data, int w, int h, int d = 1, int face = 0, int mipmap = 0, int pitch = 0);
+
         // Describe the format of the input.
         NVTT_API void setFormat(InputFormat format);
 
@@ -285,6 +334,9 @@ namespace nvtt
         NVTT_API void setMipmapGeneration(bool enabled, int maxLevel = -1);
         NVTT_API void setKaiserParameters(float width, float alpha, float stretch);
 
+        // Keep the alpha test coverage of the top level in the mipmaps, for alpha tested textures like foliage. (New in NVTT 2.1)
+        NVTT_API void setMipmapAlphaCoverage(bool enabled, float alphaRef = 0.5f);
+
         // Set normal map options.
         NVTT_API void setNormalMap(bool b);
         NVTT_API void setConvertToNormalMap(bool convert);
@@ -313,6 +365,28 @@ namespace nvtt
         virtual void endImage() = 0;
     };
 
+    // Output handler that takes the images at their offset in the output, so that they can be written as soon as they are
+    // compressed, in any order, to a preallocated file or a mapped buffer. Compressor::process writes the header through
+    // writeData and then the data of every image through writeDataAt, from several threads at once when pipelining; the
+    // offsets are from the start of the output and include the header. beginImage and endImage of each image are still
+    // called, never concurrently, but the images may begin and end in any order. The other methods of the compressor,
+    // the KTX container and supercompression write everything in order through writeData. (New in NVTT 2.1)
+    struct PositionalOutputHandler : public OutputHandler
+    {
+        // Output data at the given offset. Calls for different images can overlap.
+        virtual bool writeDataAt(size_t offset, const void * data, int size) = 0;
+    };
+
+    // Receives the pages of Compressor::compressPages. (New in NVTT 2.1)
+    struct PageOutputHandler
+    {
+        virtual ~PageOutputHandler() {}
+
+        // Output the compressed page at column x and row y of the page grid of the mipmap. Called from several threads at once,
+        // with the pages in any order.
+        virtual bool writePage(int mipmap, int x, int y, const void * data, int size) = 0;
+    };
+
     // Error codes.
     enum Error
     {
@@ -323,6 +397,8 @@ namespace nvtt
         Error_FileOpen,
         Error_FileWrite,
         Error_UnsupportedOutputFormat,
+        Error_Cancelled,        // The progress handler cancelled the compression. (New in NVTT 2.1)
+        Error_NonDeterministic, // The output changed with the number of threads, see enableDeterminismCheck. (New in NVTT 2.1)
     };
 
     // Error handler.
@@ -339,10 +415,68 @@ namespace nvtt
     {
         Container_DDS,
         Container_DDS10,
-        // Container_KTX,   // Khronos Texture: http://www.khronos.org/opengles/sdk/tools/KTX/
+        Container_KTX,      // Khronos Texture: http://www.khronos.org/opengles/sdk/tools/KTX/ (New in NVTT 2.1)
+                            // The faces of each mipmap are stored together, compress them in that order.
         // Container_VTF,   // Valve Texture Format: http://developer.valvesoftware.com/wiki/Valve_Texture_Format
     };
 
+    // Lossless compression of the compressed surfaces. Only the DDS containers support it. The files start with the 'DDSZ'
+    // signature instead of 'DDS ', so that readers without supercompression reject them, and go by the .ddsz extension.
+    // (New in NVTT 2.1)
+    enum Supercompression
+    {
+        Supercompression_None,
+        Supercompression_Deflate,
+        Supercompression_Zstd,
+        Supercompression_LZ4,
+    };
+
+    // Order of the blocks of the compressed surfaces. (New in NVTT 2.1)
+    enum TileMode
+    {
+        TileMode_Linear,                // Rows of blocks, top to bottom.
+        TileMode_Morton,                // Z order of the block coordinates, x first, skipping those outside of the surface.
+        TileMode_StandardSwizzle64KB,   // 64KB tiles in rows, padded with zeros. See OutputOptions::setTileMode.
+    };
+
+
+    // Number of blocks of each class seen by the block compressors. (New in NVTT 2.1)
+    struct BlockStatistics
+    {
+        unsigned int constantBlocks;        // All texels are equal.
+        unsigned int transparentBlocks;     // All texels are fully transparent.
+        unsigned int twoColorBlocks;        // The texels have exactly two different values.
+        unsigned int generalBlocks;
+
+        unsigned int cacheLookups;          // Blocks looked up in the block cache.
+        unsigned int cacheHits;             // Blocks whose output was found in the block cache.
+
+        unsigned int reusedBlocks;          // Blocks copied from the previous output by incremental compression.
+    };
+
+    // Error of the compressed images. The CUDA compressors measure it on the device, without decoding on the CPU, and the
+    // CPU compressors of BC1-BC7 as they write each window of blocks. (New in NVTT 2.1)
+    struct ImageErrorHandler
+    {
+        virtual ~ImageErrorHandler() {}
+
+        // Called between beginImage and endImage. The errors are against the image that was compressed, quantized to
+        // 8 bits on the GPU and clamped on the CPU, over the channels that the format stores. The RMS error is in [0, 1] units,
+        // weighted by alpha like rmsError when the alpha mode is transparency, and the PSNR is in dB of the mean squared
+        // error per channel.
+        virtual void imageError(float rmsError, float psnr) = 0;
+    };
+
+    // Progress of a long compression or filter, which can be cancelled. (New in NVTT 2.1)
+    struct ProgressHandler
+    {
+        virtual ~ProgressHandler() {}
+
+        // Called with the fraction of the work done, in [0, 1], every few milliseconds and at the end. It's called from
+        // the threads that do the work, but never by two threads at once. Return false to cancel: the workers stop at
+        // their next block or texel, and the call returns as soon as they have.
+        virtual bool progress(float fraction) = 0;
+    };
 
     // Output Options. This class holds pointers to the interfaces that are used to report the output of
     // the compressor to the user.
@@ -367,15 +501,57 @@ namespace nvtt
         NVTT_API void setContainer(Container container);
         NVTT_API void setUserVersion(int version);
         NVTT_API void setSrgbFlag(bool b);
+
+        // (New in NVTT 2.1)
+        NVTT_API void setStreamingWindow(int blockRows);
+        NVTT_API void setBlockStatistics(BlockStatistics * statistics);
+        NVTT_API void setImageErrorHandler(ImageErrorHandler * handler);
+        NVTT_API void setBlockErrors(float * errors, int count);
+        NVTT_API void enableBlockCache(bool enable);
+        NVTT_API void enableAsyncOutput(bool enable, bool unbuffered = false);
+        NVTT_API void setPositionalOutputHandler(PositionalOutputHandler * outputHandler);
+        NVTT_API void setSupercompression(Supercompression scheme, int level = 0);
+        NVTT_API void setTileMode(TileMode mode);
+        NVTT_API void setProgressHandler(ProgressHandler * handler);
     };
 
     // (New in NVTT 2.1)
     typedef void Task(void * context, int id);
+    typedef void RangeTask(void * context, int begin, int end);
 
     // (New in NVTT 2.1)
     struct TaskDispatcher
     {
         virtual void dispatch(Task * task, void * context, int count) = 0;
+
+        // Run the task over [0, count) in contiguous runs of up to 'grain' items. 
+        // The default implementation issues one dispatch() item per run, override it to schedule ranges directly.
+        NVTT_API virtual void dispatchRange(RangeTask * task, void * context, int count, int grain);
+    };
+
+    // Completion callback of Compressor::processAsync. (New in NVTT 2.1)
+    struct JobHandler
+    {
+        virtual ~JobHandler() {}
+
+        // Called on the thread that ran the job once its output is complete, success is the result of process().
+        virtual void jobFinished(bool success) = 0;
+    };
+
+    // Handle of a compression running on the task scheduler, see Compressor::processAsync. (New in NVTT 2.1)
+    struct Job
+    {
+        NVTT_FORBID_COPY(Job);
+        NVTT_DECLARE_PIMPL(Job);
+
+        NVTT_API Job();
+        NVTT_API ~Job();    // Waits for the job.
+
+        // Returns true once the job and its handler have finished, without blocking. Also true for a job that was never started.
+        NVTT_API bool isDone() const;
+
+        // Waits for the job and returns the result of process(). The calling thread runs pending tasks of the scheduler meanwhile.
+        NVTT_API bool wait();
     };
 
     // Context.
@@ -388,24 +564,128 @@ namespace nvtt
         NVTT_API ~Compressor();
 
         // Context settings.
+        // CUDA acceleration is enabled by default. The CUDA context is only created the first time a format with a GPU compressor
+        // is compressed, or isCudaAccelerationEnabled is called, and is shared by the compressors that use the same devices.
         NVTT_API void enableCudaAcceleration(bool enable);
         NVTT_API bool isCudaAccelerationEnabled() const;
+        NVTT_API void setCudaDeviceMask(unsigned int mask); // Bit i enables device i, all devices by default. The images are split between them. (New in NVTT 2.1)
         NVTT_API void setTaskDispatcher(TaskDispatcher * disp); // (New in NVTT 2.1)
 
+        // Overlap the mipmap generation with the compression of the previous levels and process the faces and array layers
+        // concurrently. (New in NVTT 2.1)
+        // The compressed images are buffered and handed to the output handler in the usual order once the whole texture is done.
+        // With CUDA acceleration the faces take turns on the GPU for their large levels, while the CPU compresses the small levels
+        // of the previous ones.
+        NVTT_API void enablePipelining(bool enable);
+        NVTT_API bool isPipeliningEnabled() const;
+
+        // The output of process() only depends on the input and the options, not on the number of threads, the dispatcher or
+        // pipelining, so it can be cached by content. The CUDA compressors give different results than the CPU ones, and which
+        // levels go to the GPU is calibrated per machine, so disable CUDA acceleration for output that is the same on every
+        // machine. The determinism check compresses every process() call a second time on a single thread, without
+        // pipelining, and compares the outputs. A mismatch is reported as Error_NonDeterministic, and process() returns false.
+        // It doubles the compression time, and replaces the global task scheduler during the second pass, so only enable it
+        // while process() isn't called from several threads. (New in NVTT 2.1)
+        NVTT_API void enableDeterminismCheck(bool enable);
+        NVTT_API bool isDeterminismCheckEnabled() const;
+
+        // Keep the outputs of process() in a cache directory that persists across runs, keyed on a hash of the input images and
+        // of all the options that change the output. When the same texture is processed again the stored output is handed to the
+        // output handler without compressing; block statistics and image errors are not reported then. The least recently used
+        // outputs are removed when the cache grows over maxMegabytes. A NULL directory disables the cache. (New in NVTT 2.1)
+        NVTT_API void setOutputCache(const char * directory, unsigned int maxMegabytes = 1024);
+
+        // Keep the large transient buffers of compression, the images of the mipmaps, the filter kernels and the output windows,
+        // between calls instead of returning them to the system heap, so that a batch of textures reuses a few large blocks. They
+        // are always reused within a single process() call. The pool is shared by all the compressors, and released when the last
+        // one that enabled it disables it or is destroyed. (New in NVTT 2.1)
+        NVTT_API void enableMemoryPool(bool enable);
+        NVTT_API bool isMemoryPoolEnabled() const;
+
         // InputOptions API.
         NVTT_API bool process(const InputOptions & inputOptions, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
         NVTT_API int estimateSize(const InputOptions & inputOptions, const CompressionOptions & compressionOptions) const;
 
+        // Estimate the time process() takes for these options, from the extents, mipmap count, format and quality, and per block
+        // rates measured on a natural image corpus. Returns the CPU seconds summed over all the threads, the seconds spent in the
+        // CUDA compressors, for the levels that would use them, are returned through gpuSeconds. This is a scheduling hint, actual
+        // times vary with the content and the machine by a factor of two or more. (New in NVTT 2.1)
+        NVTT_API float estimateCost(const InputOptions & inputOptions, const CompressionOptions & compressionOptions, float * gpuSeconds = 0) const;
+
+        // Estimate the most memory process() allocates at once for these options, on top of what's allocated when it's called:
+        // the floating point images of the levels being built, the resized input, the compressed levels that are buffered
+        // and the output windows. Meant for deciding how many calls to run at once, it errs on the high side. (New in NVTT 2.1)
+        NVTT_API size_t estimatePeakMemory(const InputOptions & inputOptions, const CompressionOptions & compressionOptions) const;
+
+        // The most memory allocated at once during the last process() call of this compressor, on top of what was allocated
+        // when it started. The allocations of other calls running at the same time are included. (New in NVTT 2.1)
+        NVTT_API size_t lastPeakMemory() const;
+
+        // Incremental compression. (New in NVTT 2.1)
+        // Blocks whose texels are the same as in the previous input are copied from the previous output, a DDS file written with the same options.
+        // Only the images of the previous input are used, all the other settings come from inputOptions. If the previous output doesn't match, the whole texture is compressed.
+        // The previous output is read while compressing, so it can't be the file the output options write to.
+        NVTT_API bool process(const InputOptions & inputOptions, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions, const InputOptions & previousInputOptions, const char * previousFileName) const;
+
+        // Several outputs of the same input. (New in NVTT 2.1)
+        // The input is loaded and the mipmaps are built once, each level is compressed with every pair of compression and output
+        // options before the next level is built. Each output is the same as the one process() writes with its options. The
+        // mipmaps are always built on the CPU and the output cache is not used. Cancelling any of the outputs stops all of them.
+        NVTT_API bool process(const InputOptions & inputOptions, int targetCount, const CompressionOptions * const * compressionOptions, const OutputOptions * const * outputOptions) const;
+
+        // Asynchronous compression. (New in NVTT 2.1)
+        // Queues a process() call on the global task scheduler and returns immediately, poll or wait on the job for the result.
+        // The jobs and the loops inside each compression share the workers of the scheduler, so many textures are compressed
+        // concurrently without running more threads than there are cores. The loops use the task dispatcher when one was set.
+        // The options, and the handlers they point to, must stay alive until the job is done. A job that is still running is
+        // waited for before it is reused. Without workers, on a single hardware thread, the job runs before this returns.
+        NVTT_API void processAsync(Job & job, const InputOptions & inputOptions, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions, JobHandler * handler = 0) const;
+
         // Surface API. (New in NVTT 2.1)
         NVTT_API bool outputHeader(const Surface & img, int mipmapCount, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
         NVTT_API bool compress(const Surface & img, int face, int mipmap, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
         NVTT_API int estimateSize(const Surface & img, int mipmapCount, const CompressionOptions & compressionOptions) const;
 
+        // Compress the w x h region of img at x, y into output, as the blocks of an image of its own. x and y are multiples of 4,
+        // the region ends at a block boundary or is cut like the edge of an image. The block rows are pitch bytes apart, or packed
+        // when it's 0, so that regions compressed separately, on other threads or machines, can be assembled into the image or
+        // kept as tiles. The blocks only depend on their own texels, a region gives the same blocks as the whole image. Only
+        // block compressed formats and 2D surfaces are supported. (New in NVTT 2.1)
+        NVTT_API bool compressRegion(const Surface & img, int x, int y, int w, int h, const CompressionOptions & compressionOptions, void * output, int outputSize, int pitch = 0) const;
+
+        // Recompress the blocks of img that overlap its dirty region into output, a compressed image of img, as written by
+        // compress, in the format of compressionOptions. The other blocks are left as they are. Only block compressed formats and
+        // 2D surfaces are supported. The rate distortion pass only reuses the blocks of the region. (New in NVTT 2.1)
+        NVTT_API bool compressDirtyRegion(const Surface & img, const CompressionOptions & compressionOptions, void * output, int outputSize) const;
+
+        // Cut img and its mipmaps into pageSize x pageSize pages for virtual texturing and compress them in parallel. Each page holds
+        // pageSize - 2 * border texels of its level, surrounded by border texels of the neighbouring pages, or of the wrap mode of
+        // img past its edges. The grid of a w x h level has ceil(w / (pageSize - 2 * border)) columns and as many rows for h. The
+        // mipmaps are built with the filter, down to the first level that fits in a page when mipmapCount is 0. The texels are
+        // compressed as they are, without color space conversions, like compress does. (New in NVTT 2.1)
+        NVTT_API bool compressPages(const Surface & img, int pageSize, int border, int mipmapCount, MipmapFilter filter, const CompressionOptions & compressionOptions, PageOutputHandler * handler) const;
+
+        // Choose the format and quality of the compression options for img, keeping all its other settings. The candidates go from
+        // BC1 to BC3 to BC7, each from Quality_Fastest to Quality_Highest, and the first one whose RMS error, as reported by the
+        // ImageErrorHandler, is at most targetError on a small sample of the blocks of img is set. Like that RMS error, targetError
+        // is in [0, 1] units, so one 8 bit step is 1/255. BC1 is skipped when the alpha of img is used and not opaque. Returns false when no candidate meets the target, and sets the one with the lowest error.
+        // The chosen format and quality, and the sample error, are also returned through the optional pointers. (New in NVTT 2.1)
+        NVTT_API bool selectFormat(const Surface & img, float targetError, CompressionOptions & compressionOptions, Format * format = 0, Quality * quality = 0, float * error = 0) const;
+
         // CubeSurface API. (New in NVTT 2.1)
         NVTT_API bool outputHeader(const CubeSurface & cube, int mipmapCount, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
         NVTT_API bool compress(const CubeSurface & cube, int mipmap, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
         NVTT_API int estimateSize(const CubeSurface & cube, int mipmapCount, const CompressionOptions & compressionOptions) const;
 
+        // Output the header and all the images of an array of cube maps, the mipmapCount levels of cube i are stored from mipmaps[i * mipmapCount].
+        // Requires the DDS10 container. The images are compressed concurrently when pipelining is enabled. Face f of cube i is output as face 6 * i + f.
+        NVTT_API bool compressCubeArray(const CubeSurface * mipmaps, int cubeCount, int mipmapCount, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
+
+        // Transcode all the faces and mipmaps of a block compressed DDS file to the format of the compression options. The blocks
+        // are decoded in parallel in windows of block rows, each window is compressed before the next one is decoded, so whole
+        // images are never decoded. Only the CPU compressors are used, and dithering is not applied. (New in NVTT 2.1)
+        NVTT_API bool transcode(const char * fileName, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
+
         // Raw API. (New in NVTT 2.1)
         NVTT_API bool outputHeader(TextureType type, int w, int h, int d, int mipmapCount, bool isNormalMap, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
         NVTT_API bool compress(int w, int h, int d, int face, int mipmap, const float * rgba, const CompressionOptions & compressionOptions, const OutputOptions & outputOptions) const;
@@ -415,13 +695,35 @@ namespace nvtt
     // "Compressor" is deprecated. This should have been called "Context"
     typedef Compressor Context;
 
-    // (New in NVTT 2.1)
-    enum NormalTransform {
-        NormalTransform_Orthographic,
-        NormalTransform_Stereographic,
-        NormalTransform_Paraboloid,
-        NormalTransform_Quartic
-        //NormalTransform_DualParaboloid,
+    // Compressor for a stream of frames, like the frames of a video, with little overhead per frame. (New in NVTT 2.1)
+    // The frames are read straight from 8 bit texels in the layout of InputFormat_BGRA_8UB, with rows pitch bytes apart,
+    // and compressed into a buffer provided by the caller with the fastest encoders of each format. Nothing is allocated
+    // per frame. Large frames are compressed in parallel with the task dispatcher, in runs of block rows.
+    struct StreamCompressor
+    {
+        NVTT_FORBID_COPY(StreamCompressor);
+        NVTT_DECLARE_PIMPL(StreamCompressor);
+
+        NVTT_API StreamCompressor();
+        NVTT_API ~StreamCompressor();
+
+        // The supported formats are DXT1, DXT1a, DXT5 and BC7, which only uses mode 6. Returns false for the others.
+        NVTT_API bool setFormat(Format format);
+        NVTT_API void setTaskDispatcher(TaskDispatcher * disp);
+
+        // Size in bytes of a compressed frame, 0 when no format is set.
+        NVTT_API int frameSize(int w, int h) const;
+
+        // Compress a w x h frame into output, returns false when no format is set or outputSize is less than frameSize().
+        NVTT_API bool compress(int w, int h, int pitch, const void * bgra, void * output, int outputSize) const;
+
+        // Sequence mode, for animated textures and flipbooks.
+        // Compress a frame given the previous frame of the sequence, with the same extents and pitch, and its output in the
+        // current format. The blocks whose texels differ from the previous frame by at most the tolerance in every channel
+        // are copied from the previous output, the tolerance is 0 by default so only unchanged blocks are. The DXT1 and DXT5
+        // blocks that changed a little start from the endpoints of their previous block. The output can be previousOutput.
+        NVTT_API void setSequenceTolerance(int tolerance);
+        NVTT_API bool compress(int w, int h, int pitch, const void * bgra, const void * previousBgra, const void * previousOutput, void * output, int outputSize) const;
     };
 
     // (New in NVTT 2.1)
@@ -432,6 +734,14 @@ namespace nvtt
         ToneMapper_Lightmap,
     };
 
+    // Formats of the texels of packed surfaces. (New in NVTT 2.1)
+    enum StorageFormat {
+        StorageFormat_Float,        // 32 bit floats, not packed.
+        StorageFormat_Half,         // 16 bit floats.
+        StorageFormat_UNorm16,      // 16 bit integers, clamped to [0, 1].
+        StorageFormat_UNorm8,       // 8 bit integers, clamped to [0, 1].
+    };
+
 
     // A surface is one level of a 2D or 3D texture. (New in NVTT 2.1)
     // @@ It would be nice to add support for texture borders for correct resizing of tiled textures and constrained DXT compression.
@@ -448,6 +758,24 @@ namespace nvtt
         NVTT_API void setAlphaMode(AlphaMode alphaMode);
         NVTT_API void setNormalMap(bool isNormalMap);
 
+        // Keep the alpha test coverage in the mipmaps: the alpha channel of every level built from the surface is scaled so
+        // that its alphaTestCoverage(alphaRef) is the given coverage. A negative coverage disables it. (New in NVTT 2.1)
+        NVTT_API void setMipmapAlphaCoverage(float coverage, float alphaRef = 0.5f);
+
+        // Record the per-texel color operations, from toLinear to premultiplyAlpha, and run them in a single pass over the image
+        // when its texels are needed, by any other method. Disabling it runs the pending operations. (New in NVTT 2.1)
+        NVTT_API void setDeferred(bool deferred);
+
+        // Use a SIMD approximation of pow in the gamma and sRGB conversions, including those of setImageLinear and
+        // buildNextMipmapToGamma. Its relative error is about 2e-6, enough for 8 bit values to come back 1 lower after a round
+        // trip through linear space, so it's disabled by default. (New in NVTT 2.1)
+        NVTT_API void setApproximateGamma(bool approximate);
+
+        // Store the texels in a smaller format, for surfaces that are kept around between operations. The next method that needs
+        // the texels expands them to floats again, with the precision of the format. Resizing a 2D surface packed in UNorm8
+        // resamples the packed texels in fixed point instead, and keeps the result packed. (New in NVTT 2.1)
+        NVTT_API void pack(StorageFormat format);
+
         // Queries.
         NVTT_API bool isNull() const;
         NVTT_API int width() const;
@@ -457,6 +785,9 @@ namespace nvtt
         NVTT_API WrapMode wrapMode() const;
         NVTT_API AlphaMode alphaMode() const;
         NVTT_API bool isNormalMap() const;
+        NVTT_API bool isDeferred() const;
+        NVTT_API bool isApproximateGamma() const;
+        NVTT_API StorageFormat storageFormat() const;
         NVTT_API int countMipmaps() const;
         NVTT_API int countMipmaps(int min_size) const;
         NVTT_API float alphaTestCoverage(float alphaRef = 0.5, int alpha_channel = 3) const;
@@ -474,6 +805,18 @@ namespace nvtt
         NVTT_API bool setImage(InputFormat format, int w, int h, int d, const void * r, const void * g, const void * b, const void * a);
         NVTT_API bool setImage2D(Format format, Decoder decoder, int w, int h, const void * data);
 
+        // Same as setImage followed by toLinear(gamma), in a single pass: 8 bit texels are decoded through a table of the 256
+        // linear values. (New in NVTT 2.1)
+        NVTT_API bool setImageLinear(InputFormat format, int w, int h, int d, const void * data, float gamma);
+
+        // Same as setImage followed by toLinearFromSrgb, with the same table for 8 bit texels. (New in NVTT 2.1)
+        NVTT_API bool setImageLinearFromSrgb(InputFormat format, int w, int h, int d, const void * data);
+
+        // Use the caller's texels without copying them. The data is laid out as returned by data(): the r, g, b and a planes of
+        // w*h*d floats one after the other. It must outlive the surface and its copies. It is never written, operations that
+        // change the texels copy them first.
+        NVTT_API bool setImageView(int w, int h, int d, const float * data);
+
         // Resizing methods.
         NVTT_API void resize(int w, int h, int d, ResizeFilter filter);
         NVTT_API void resize(int w, int h, int d, ResizeFilter filter, float filterWidth, const float * params = 0);
@@ -484,6 +827,23 @@ namespace nvtt
         NVTT_API bool buildNextMipmap(MipmapFilter filter, int min_size = 1);
         NVTT_API bool buildNextMipmap(MipmapFilter filter, float filterWidth, const float * params = 0, int min_size = 1);
         NVTT_API bool buildNextMipmapSolidColor(const float * const color_components);
+
+        // Build the next count levels of the mipmap chain at once and store level i+1 in mipmaps[i], the surface is not changed.
+        // Returns the number of levels built, fewer than count when the chain reaches min_size. The levels are the same as
+        // those of successive buildNextMipmap calls, but box filtered 2D chains are built in a single pass over the texels.
+        // (New in NVTT 2.1)
+        NVTT_API int buildMipmapChain(MipmapFilter filter, int count, Surface * mipmaps, int min_size = 1) const;
+        NVTT_API int buildMipmapChain(MipmapFilter filter, float filterWidth, const float * params, int count, Surface * mipmaps, int min_size = 1) const;
+
+        // Build the next level of the mipmap chain into mipmap and convert this surface to gamma space. The same as
+        // *mipmap = *this, mipmap->buildNextMipmap(filter, min_size) and toGamma(gamma), but box filtered 2D surfaces convert
+        // their texels in the same pass that filters them. (New in NVTT 2.1)
+        NVTT_API bool buildNextMipmapToGamma(MipmapFilter filter, float gamma, Surface * mipmap, int min_size = 1);
+
+        // Build the next level of a normal map. The same as buildNextMipmap(filter, min_size), followed by
+        // *toksvig = createToksvigMap(power) when toksvig is not NULL and by normalizeNormalMap() when normalize is set, but
+        // box filtered 2D surfaces measure and renormalize the normals of each row as it's filtered. (New in NVTT 2.1)
+        NVTT_API bool buildNextNormalMipmap(MipmapFilter filter, bool normalize, float power = 0.0f, Surface * toksvig = 0, int min_size = 1);
         NVTT_API void canvasSize(int w, int h, int d);
         // associated to resizing:
         NVTT_API bool canMakeNextMipmap(int min_size = 1);
@@ -538,6 +898,8 @@ namespace nvtt
         NVTT_API void toCleanNormalMap();
         NVTT_API void packNormals(float scale = 0.5f, float bias = 0.5f);       // [-1,1] -> [ 0,1]
         NVTT_API void expandNormals(float scale = 2.0f, float bias = -1.0f);    // [ 0,1] -> [-1,1]
+        // Toksvig map of the normals of this surface, filtered and not yet renormalized. The color channels have the factor
+        // that scales the specular power of each texel, |n| / (|n| + power (1 - |n|)), and alpha is 1.
         NVTT_API Surface createToksvigMap(float power) const;
         NVTT_API Surface createCleanMap() const;
 
@@ -555,6 +917,25 @@ namespace nvtt
 
         NVTT_API bool copy(const Surface & src, int xsrc, int ysrc, int zsrc, int xsize, int ysize, int zsize, int xdst, int ydst, int zdst);
 
+        // Copy many regions at once, for building atlases. Region i is copied from sources[i], and is given by the 9 integers
+        // at regions[9 * i], in the order of the arguments of copy. The result is the same as calling copy for each region in
+        // order, but nothing is copied unless all the regions are valid. (New in NVTT 2.1)
+        NVTT_API bool copyRegions(int count, const Surface * const * sources, const int * regions);
+
+        // Dirty region tracking, for interactive editing. (New in NVTT 2.1)
+        // The dirty region is the bounding rectangle of the texels changed since it was last cleared, in every slice. copy and
+        // copyRegions add the regions they write, other changes have to be added by the caller. updateMipmap and
+        // Compressor::compressDirtyRegion only recompute what depends on it, then the caller clears it.
+        NVTT_API void addDirtyRegion(int x, int y, int w, int h);
+        NVTT_API bool dirtyRegion(int * x, int * y, int * w, int * h) const;   // Returns false when there is none.
+        NVTT_API void clearDirtyRegion();
+
+        // Recompute the texels of this surface, the next mipmap of parent, that are built from the dirty region of parent, and add
+        // them to the dirty region of this surface. The texels are the same as those of buildNextMipmap with the default filter
+        // width. Only 2D box filtered mipmaps without alpha coverage or transparency are updated in place, otherwise, or when this
+        // surface doesn't have the extents of the next mipmap, the whole level is rebuilt and dirty. (New in NVTT 2.1)
+        NVTT_API bool updateMipmap(const Surface & parent, MipmapFilter filter);
+
 
     //private:
         void detach();
@@ -602,7 +983,7 @@ namespace nvtt
         NVTT_API Surface & face(int face);
         NVTT_API const Surface & face(int face) const;
 
-        // Layout conversion. @@ Not implemented.
+        // Layout conversion.
         NVTT_API void fold(const Surface & img, CubeLayout layout);
         NVTT_API Surface unfold(CubeLayout layout) const;
 
@@ -617,12 +998,39 @@ namespace nvtt
         NVTT_API void clamp(int channel, float low = 0.0f, float high = 1.0f);
 
 
+        // Projection of the RGB channels to the second order spherical harmonic basis of nv::shBasis. coefficients holds 27
+        // floats, coefficients[9 * c + i] is coefficient i of channel c, in the order of nv::Sh::index.
+        NVTT_API void shProjection(float * coefficients) const;
+
         // Filtering.
+
+        // Cosine lobe filter normalized like cosinePowerFilter with a power of 1, evaluated from shProjection. Alpha is 1.
         NVTT_API CubeSurface irradianceFilter(int size, EdgeFixup fixupMethod) const;
-        NVTT_API CubeSurface cosinePowerFilter(int size, float cosinePower, EdgeFixup fixupMethod) const;
+
+        // Convolution with the cosine lobe raised to cosinePower. The cost is proportional to the number of input texels in the
+        // cone of the lobe, low powers on large cubes take very long. With a lobeResolution above 0 the lobe is convolved with
+        // the smallest mipmap of the cube that has at least lobeResolution texels across the lobe, measured where it drops to
+        // half its maximum. 0 always uses the whole cube. 8 stays within about 1% of it and bounds the cost for low powers.
+        // The progress handler can cancel the filter, the result is then incomplete. (New in NVTT 2.1)
+        NVTT_API CubeSurface cosinePowerFilter(int size, float cosinePower, EdgeFixup fixupMethod, float lobeResolution = 0.0f, ProgressHandler * progress = 0) const;
+
+        // Prefiltered mipmap chain, mipmap i is max(1, size >> i) texels wide and filtered with cosinePowers[i], alpha is 1.
+        // With CUDA the whole chain is filtered on the GPU from a single upload of the cube, which ignores lobeResolution.
+        // Otherwise like cosinePowerFilter, with the mipmaps of the cube built once and all the levels filtered in parallel.
+        NVTT_API void cosinePowerFilterMipmaps(int size, const float * cosinePowers, int count, EdgeFixup fixupMethod, CubeSurface * mipmaps, float lobeResolution = 0.0f, ProgressHandler * progress = 0) const;
 
         NVTT_API CubeSurface fastResample(int size, EdgeFixup fixupMethod) const;
 
+        // Replace the cube with its next mipmap, max(1, edgeLength / 2) texels wide. The filter reads the texels of the
+        // neighbouring faces across the edges, so the mipmaps are seamless without any edge fixup. Returns false when the
+        // cube is already 1 texel wide.
+        NVTT_API bool buildNextMipmap();
+
+        // Sky of the Hosek-Wilkie model. +Y is up, the sun is solarElevation radians above the horizon and solarAzimuth
+        // radians around +Y, from +Z towards +X. turbidity is in [1, 10] and albedo holds the ground albedo of each channel,
+        // in [0, 1]. The channels hold the spectral radiance of the model at 700, 546.1 and 435.8 nm, alpha is 1.
+        NVTT_API void sky(int size, float turbidity, const float albedo[3], float solarElevation, float solarAzimuth = 0.0f);
+
 
         /*
         NVTT_API void resize(int w, int h, ResizeFilter filter);
@@ -651,15 +1059,120 @@ namespace nvtt
     // Return NVTT version.
     NVTT_API unsigned int version();
 
+    // Store surfaces of at least the given size out of core, in memory mapped scratch files. 0 disables it. (New in NVTT 2.1)
+    NVTT_API void setOutOfCoreThreshold(unsigned int megabytes, const char * scratchDirectory = 0);
+
+    // Allocator of the surfaces, images, containers and output buffers of nvtt, the C runtime heap by default. userData is
+    // passed to every call. Buffers that need to be aligned for SIMD code or unbuffered I/O are carved out of larger blocks
+    // of malloc. Objects created with new and the external encoders still use the C++ heap. Set it before any other call,
+    // and keep it while any nvtt object or surface exists. NULL functions restore the default. sizeFunction returns the size
+    // of a live allocation, allocatedMemory() only counts the allocations of custom allocators that give it. (New in NVTT 2.1)
+    typedef void * MallocFunction(size_t size, void * userData);
+    typedef void * ReallocFunction(void * ptr, size_t size, void * userData);
+    typedef void FreeFunction(void * ptr, void * userData);
+    typedef size_t SizeFunction(const void * ptr, void * userData);
+    NVTT_API void setAllocator(MallocFunction * mallocFunction, ReallocFunction * reallocFunction, FreeFunction * freeFunction, void * userData = 0, SizeFunction * sizeFunction = 0);
+
+    // Bytes currently allocated through the allocator of nvtt, and the most allocated at once since the start of the process.
+    // Objects created with new are not counted, but they are small next to the images. (New in NVTT 2.1)
+    NVTT_API size_t allocatedMemory();
+    NVTT_API size_t peakMemory();
+
+    // Back the buffers of large images with transparent huge pages, on systems that support them. Saves TLB misses
+    // when compressing very large textures, at the cost of up to 2 MB of padding per buffer. (New in NVTT 2.1)
+    NVTT_API void enableHugePages(bool enable);
+
+    // Priority of the worker threads. (New in NVTT 2.1)
+    enum ThreadPriority
+    {
+        ThreadPriority_Normal,
+        ThreadPriority_BelowNormal,
+        ThreadPriority_Lowest,
+    };
+
+    // Run the loops and jobs of the library on count threads, the calling thread included. 0 restores the default, one per
+    // hardware thread available to the process, which respects its CPU affinity and, on Linux, the CPU quota of its cgroup.
+    // The workers run with the given priority, and worker i on cpus[i % cpuCount] when cpus are given; use the CPUs of a NUMA
+    // node to keep the workers on it. Call it while no other call is running, the workers are started again. (New in NVTT 2.1)
+    NVTT_API void setWorkerThreads(int count, ThreadPriority priority = ThreadPriority_Normal, const int * cpus = 0, int cpuCount = 0);
+
+    // Receives the timed events of the library: loading, resizing, mipmap generation, quantization, the compression of
+    // each image and of each run of blocks, the CUDA transfers and the output writes. event() is called when the event
+    // ends, on the thread that ran it, so it may be called from several threads at once. (New in NVTT 2.1)
+    struct Profiler
+    {
+        virtual ~Profiler() {}
+
+        // name is a static string. begin is in microseconds from an arbitrary origin, duration in microseconds. threadId
+        // is the id the OS gives the thread. count is the number of blocks, texels or bytes processed, 0 when it doesn't apply.
+        virtual void event(const char * name, double begin, double duration, unsigned int threadId, int count) = 0;
+
+        // Called right after event() with the bytes allocated by nvtt at the end of the event, and the most that were allocated
+        // at once while it ran. The allocations of all the threads count, also those of other calls running at the same time.
+        // end is in the microseconds of event(). (New in NVTT 2.1)
+        virtual void memory(const char * name, double end, unsigned int threadId, size_t allocatedBytes, size_t peakBytes) {}
+    };
+
+    // Profiler that records the events and saves them in the JSON trace event format, that chrome://tracing and
+    // Perfetto open. (New in NVTT 2.1)
+    struct TraceProfiler : public Profiler
+    {
+        NVTT_FORBID_COPY(TraceProfiler);
+        NVTT_DECLARE_PIMPL(TraceProfiler);
+
+        NVTT_API TraceProfiler();
+        NVTT_API virtual ~TraceProfiler();
+
+        NVTT_API virtual void event(const char * name, double begin, double duration, unsigned int threadId, int count);
+        NVTT_API virtual void memory(const char * name, double end, unsigned int threadId, size_t allocatedBytes, size_t peakBytes);
+
+        NVTT_API void clear();
+        NVTT_API int eventCount() const;
+        NVTT_API bool save(const char * fileName) const;
+    };
+
+    // Send the events of the library to profiler, NULL disables them, which is the default. Set it while no other
+    // call is running, and keep the profiler alive until it's replaced. (New in NVTT 2.1)
+    NVTT_API void setProfiler(Profiler * profiler);
+
+    // Whether the library was built with the given supercompression scheme. (New in NVTT 2.1)
+    NVTT_API bool isSupercompressionSupported(Supercompression scheme);
+
     // Image comparison and error measurement functions. (New in NVTT 2.1)
     NVTT_API float rmsError(const Surface & reference, const Surface & img);
     NVTT_API float rmsAlphaError(const Surface & reference, const Surface & img);
     NVTT_API float cieLabError(const Surface & reference, const Surface & img);
     NVTT_API float angularError(const Surface & reference, const Surface & img);
+    // 1 - SSIM, or 1 - MS-SSIM, of the color channels. 0 for equal surfaces. (New in NVTT 2.1)
+    NVTT_API float ssimError(const Surface & reference, const Surface & img, bool multiScale = false);
+    // Same as the functions above in a single pass over the surfaces, metrics whose pointer is NULL are skipped. (New in NVTT 2.1)
+    NVTT_API void errorMetrics(const Surface & reference, const Surface & img, float * rms, float * rmsAlpha, float * cieLab, float * angular);
     NVTT_API Surface diff(const Surface & reference, const Surface & img, float scale);
 
+    // Batch versions of CubeSurface::fold, unfold and fastResample. They process all the cubes in a single parallel job,
+    // for many small cubes such as reflection probes. The images, and the cubes, must all have the same size.
+    NVTT_API void foldCubes(const Surface * images, int count, CubeLayout layout, CubeSurface * cubes);
+    NVTT_API void unfoldCubes(const CubeSurface * cubes, int count, CubeLayout layout, Surface * images);
+    NVTT_API void fastResampleCubes(const CubeSurface * cubes, int count, int size, EdgeFixup fixupMethod, CubeSurface * resampled);
+
+    // Batch version of CubeSurface::cosinePowerFilterMipmaps on the CPU. The mipmapCount levels of cube i are stored from
+    // mipmaps[i * mipmapCount], ready for Compressor::compressCubeArray.
+    NVTT_API void cosinePowerFilterCubes(const CubeSurface * cubes, int count, int size, const float * cosinePowers, int mipmapCount, EdgeFixup fixupMethod, CubeSurface * mipmaps, float lobeResolution = 0.0f, ProgressHandler * progress = 0);
+
+    // Batch version of CubeSurface::sky, for the same atmosphere at several times of day. Cube i has the sun at
+    // solarElevations[i] and solarAzimuths[i], the directions of the texels are evaluated once for all the cubes.
+    NVTT_API void skyCubes(int size, float turbidity, const float albedo[3], const float * solarElevations, const float * solarAzimuths, int count, CubeSurface * cubes);
+
+    // Batch version of Surface::load, the files are decoded in parallel. Returns the number of files loaded, the surfaces
+    // of the files that failed to load are left unchanged. (New in NVTT 2.1)
+    NVTT_API int loadSurfaces(const char * const * fileNames, int count, Surface * surfaces, bool * hasAlpha = 0);
+
     NVTT_API float rmsToneMappedError(const Surface & reference, const Surface & img, float exposure);
 
+    // Batch version of rmsToneMappedError, errors[i] is the error at exposures[i]. The surfaces are read once for all the
+    // exposures. (New in NVTT 2.1)
+    NVTT_API void rmsToneMappedErrors(const Surface & reference, const Surface & img, const float * exposures, int count, float * errors);
+
 } // nvtt namespace
 
 #endif // NVTT_H
@@ -0,0 +1,94 @@
+// Copyright (c) 2009-2011 Ignacio Castano <castano@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+#ifndef NVTT_ENCODER_H
+#define NVTT_ENCODER_H
+
+// Interface of the block encoders that nvtt loads from a library. (New in NVTT 2.1)
+//
+// CompressionOptions::setExternalCompressor(name) loads the library name, or the library of the platform named after it,
+// like libname.so, and calls the function it exports as NVTT_ENCODER_ENTRY_POINT. The encoder then compresses the BC1,
+// BC1a, BC2, BC3, BC4, BC5 and BC7 images in place of the encoders of nvtt, which still does everything around the
+// blocks: the mipmaps, the threads, the block cache and the output. Libraries are loaded once and stay loaded.
+//
+// Only plain C types cross the interface, so the encoder doesn't need to be built with the compiler of nvtt. Later
+// versions of the interface only append fields to the structs and functions to NvttEncoder.
+
+#define NVTT_ENCODER_ABI_VERSION 1
+#define NVTT_ENCODER_ENTRY_POINT "nvttGetEncoder"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Settings of an image.
+typedef struct NvttEncoderSettings
+{
+    unsigned int structSize;    // sizeof(NvttEncoderSettings) in nvtt.
+    int format;                 // nvtt::Format of the blocks.
+    int quality;                // nvtt::Quality of the image.
+    int alphaMode;              // nvtt::AlphaMode of the texels.
+    float colorWeights[4];      // Of CompressionOptions::setColorWeights.
+    unsigned int threadCount;   // The thread indices of the batches are below this.
+} NvttEncoderSettings;
+
+// Consecutive blocks of an image, in row order.
+typedef struct NvttBlockBatch
+{
+    // The 16 texels of each block in row order, 4 bytes each in BGRA order like InputFormat_BGRA_8UB. Blocks on the edges
+    // of the image repeat their texels to fill the 4x4 block.
+    const unsigned char * texels;
+    unsigned int blockCount;
+
+    // Batches with the same thread index are never encoded at the same time, it can select scratch memory of the encoder.
+    unsigned int threadIndex;
+
+    // Encoded blocks, 8 bytes each for BC1, BC1a and BC4, 16 bytes for the others.
+    void * output;
+} NvttBlockBatch;
+
+typedef struct NvttEncoder
+{
+    unsigned int abiVersion;    // NVTT_ENCODER_ABI_VERSION the encoder was built with.
+
+    // Return the state of an image, NULL when the encoder doesn't support its settings; nvtt then reports
+    // Error_UnsupportedFeature. Called on the thread that compresses the image.
+    void * (*beginImage)(const NvttEncoderSettings * settings);
+
+    // Encode a batch of blocks. Called from several threads at once, with the thread indices of the settings.
+    void (*encodeBlocks)(void * state, const NvttBlockBatch * batch);
+
+    // Release the state once all the batches of the image are encoded.
+    void (*endImage)(void * state);
+} NvttEncoder;
+
+// The function exported by encoder libraries. abiVersion is NVTT_ENCODER_ABI_VERSION of nvtt, return NULL when it's not
+// supported.
+typedef const NvttEncoder * (*NvttGetEncoderFunction)(unsigned int abiVersion);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // NVTT_ENCODER_H
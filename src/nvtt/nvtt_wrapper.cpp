@@ -66,6 +66,24 @@ public:
     }
 };
 
+// A job with a JobHandler that calls a function pointer.
+struct NvttJob : public nvtt::JobHandler
+{
+    NvttJob() : handler(NULL), userData(NULL) {}
+
+    nvtt::Job job;
+    nvttJobHandler handler;
+    void * userData;
+
+    virtual void jobFinished(bool success)
+    {
+        if (handler != NULL)
+        {
+            handler(success ? NVTT_True : NVTT_False, userData);
+        }
+    }
+};
+
 
 // InputOptions class.
 NvttInputOptions * nvttCreateInputOptions()
@@ -128,6 +146,11 @@ void nvttSetInputOptionsKaiserParameters(NvttInputOptions * inputOptions, float
     inputOptions->setKaiserParameters(width, alpha, stretch);
 }
 
+void nvttSetInputOptionsMipmapAlphaCoverage(NvttInputOptions * inputOptions, NvttBoolean enabled, float alphaRef)
+{
+    inputOptions->setMipmapAlphaCoverage(enabled != NVTT_False, alphaRef);
+}
+
 void nvttSetInputOptionsNormalMap(NvttInputOptions * inputOptions, NvttBoolean b)
 {
     inputOptions->setNormalMap(b != NVTT_False);
@@ -280,6 +303,361 @@ int nvttEstimateSize(const NvttCompressor * compressor, const NvttInputOptions *
     return compressor->estimateSize(*inputOptions, *compressionOptions);
 }
 
+NvttBoolean nvttSurfaceOutputHeader(const NvttCompressor * compressor, const NvttSurface * surface, int mipmapCount, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions)
+{
+    return (NvttBoolean)compressor->outputHeader(*surface, mipmapCount, *compressionOptions, *outputOptions);
+}
+
+NvttBoolean nvttCompressSurface(const NvttCompressor * compressor, const NvttSurface * surface, int face, int mipmap, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions)
+{
+    return (NvttBoolean)compressor->compress(*surface, face, mipmap, *compressionOptions, *outputOptions);
+}
+
+int nvttEstimateSurfaceSize(const NvttCompressor * compressor, const NvttSurface * surface, int mipmapCount, const NvttCompressionOptions * compressionOptions)
+{
+    return compressor->estimateSize(*surface, mipmapCount, *compressionOptions);
+}
+
+NvttBoolean nvttCubeSurfaceOutputHeader(const NvttCompressor * compressor, const NvttCubeSurface * cube, int mipmapCount, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions)
+{
+    return (NvttBoolean)compressor->outputHeader(*cube, mipmapCount, *compressionOptions, *outputOptions);
+}
+
+NvttBoolean nvttCompressCubeSurface(const NvttCompressor * compressor, const NvttCubeSurface * cube, int mipmap, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions)
+{
+    return (NvttBoolean)compressor->compress(*cube, mipmap, *compressionOptions, *outputOptions);
+}
+
+NvttBoolean nvttCompressSurfaces(const NvttCompressor * compressor, int count, const NvttSurface * const * surfaces, const int * faces, const int * mipmaps, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (!compressor->compress(*surfaces[i], faces[i], mipmaps[i], *compressionOptions, *outputOptions))
+        {
+            return NVTT_False;
+        }
+    }
+    return NVTT_True;
+}
+
+NvttBoolean nvttCompressSurfaceMipmaps(const NvttCompressor * compressor, const NvttSurface * surface, int face, int mipmapCount, NvttMipmapFilter filter, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions)
+{
+    if (!compressor->compress(*surface, face, 0, *compressionOptions, *outputOptions))
+    {
+        return NVTT_False;
+    }
+
+    // The copy shares the texels of the surface until the first mipmap is built.
+    nvtt::Surface mipmap = *surface;
+    for (int m = 1; m < mipmapCount; m++)
+    {
+        if (!mipmap.buildNextMipmap((nvtt::MipmapFilter)filter) || !compressor->compress(mipmap, face, m, *compressionOptions, *outputOptions))
+        {
+            return NVTT_False;
+        }
+    }
+    return NVTT_True;
+}
+
+NvttJob * nvttCreateJob()
+{
+    return new NvttJob();
+}
+
+void nvttDestroyJob(NvttJob * job)
+{
+    delete job;
+}
+
+void nvttCompressAsync(const NvttCompressor * compressor, NvttJob * job, const NvttInputOptions * inputOptions, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions, nvttJobHandler handler, void * userData)
+{
+    // The handler of the previous call may still run.
+    job->job.wait();
+
+    job->handler = handler;
+    job->userData = userData;
+    compressor->processAsync(job->job, *inputOptions, *compressionOptions, *outputOptions, job);
+}
+
+NvttBoolean nvttJobIsDone(const NvttJob * job)
+{
+    return (NvttBoolean)job->job.isDone();
+}
+
+NvttBoolean nvttJobWait(NvttJob * job)
+{
+    return (NvttBoolean)job->job.wait();
+}
+
+
+// Surface class.
+NvttSurface * nvttCreateSurface()
+{
+    return new nvtt::Surface();
+}
+
+NvttSurface * nvttCloneSurface(const NvttSurface * surface)
+{
+    return new nvtt::Surface(*surface);
+}
+
+void nvttDestroySurface(NvttSurface * surface)
+{
+    delete surface;
+}
+
+void nvttSetSurfaceWrapMode(NvttSurface * surface, NvttWrapMode mode)
+{
+    surface->setWrapMode((nvtt::WrapMode)mode);
+}
+
+void nvttSetSurfaceAlphaMode(NvttSurface * surface, NvttAlphaMode alphaMode)
+{
+    surface->setAlphaMode((nvtt::AlphaMode)alphaMode);
+}
+
+void nvttSetSurfaceNormalMap(NvttSurface * surface, NvttBoolean isNormalMap)
+{
+    surface->setNormalMap(isNormalMap != NVTT_False);
+}
+
+NvttBoolean nvttSurfaceIsNull(const NvttSurface * surface)
+{
+    return (NvttBoolean)surface->isNull();
+}
+
+int nvttSurfaceWidth(const NvttSurface * surface)
+{
+    return surface->width();
+}
+
+int nvttSurfaceHeight(const NvttSurface * surface)
+{
+    return surface->height();
+}
+
+int nvttSurfaceDepth(const NvttSurface * surface)
+{
+    return surface->depth();
+}
+
+int nvttSurfaceCountMipmaps(const NvttSurface * surface)
+{
+    return surface->countMipmaps();
+}
+
+const float * nvttSurfaceData(const NvttSurface * surface)
+{
+    return surface->data();
+}
+
+const float * nvttSurfaceChannel(const NvttSurface * surface, int channel)
+{
+    return surface->channel(channel);
+}
+
+NvttBoolean nvttSurfaceLoad(NvttSurface * surface, const char * fileName)
+{
+    return (NvttBoolean)surface->load(fileName);
+}
+
+NvttBoolean nvttSurfaceSave(const NvttSurface * surface, const char * fileName)
+{
+    return (NvttBoolean)surface->save(fileName);
+}
+
+NvttBoolean nvttSetSurfaceImage(NvttSurface * surface, NvttInputFormat format, int w, int h, int d, const void * data)
+{
+    return (NvttBoolean)surface->setImage((nvtt::InputFormat)format, w, h, d, data);
+}
+
+NvttBoolean nvttSetSurfaceImageView(NvttSurface * surface, int w, int h, int d, const float * data)
+{
+    return (NvttBoolean)surface->setImageView(w, h, d, data);
+}
+
+void nvttSurfaceResize(NvttSurface * surface, int w, int h, int d, NvttResizeFilter filter)
+{
+    surface->resize(w, h, d, (nvtt::ResizeFilter)filter);
+}
+
+void nvttSurfaceResizeMax(NvttSurface * surface, int maxExtent, NvttRoundMode mode, NvttResizeFilter filter)
+{
+    surface->resize(maxExtent, (nvtt::RoundMode)mode, (nvtt::ResizeFilter)filter);
+}
+
+NvttBoolean nvttSurfaceBuildNextMipmap(NvttSurface * surface, NvttMipmapFilter filter)
+{
+    return (NvttBoolean)surface->buildNextMipmap((nvtt::MipmapFilter)filter);
+}
+
+void nvttSurfaceToLinear(NvttSurface * surface, float gamma)
+{
+    surface->toLinear(gamma);
+}
+
+void nvttSurfaceToGamma(NvttSurface * surface, float gamma)
+{
+    surface->toGamma(gamma);
+}
+
+void nvttSurfaceToSrgb(NvttSurface * surface)
+{
+    surface->toSrgb();
+}
+
+void nvttSurfaceToLinearFromSrgb(NvttSurface * surface)
+{
+    surface->toLinearFromSrgb();
+}
+
+void nvttSurfaceSwizzle(NvttSurface * surface, int r, int g, int b, int a)
+{
+    surface->swizzle(r, g, b, a);
+}
+
+void nvttSurfaceScaleBias(NvttSurface * surface, int channel, float scale, float bias)
+{
+    surface->scaleBias(channel, scale, bias);
+}
+
+void nvttSurfaceClamp(NvttSurface * surface, int channel, float low, float high)
+{
+    surface->clamp(channel, low, high);
+}
+
+void nvttSurfacePremultiplyAlpha(NvttSurface * surface)
+{
+    surface->premultiplyAlpha();
+}
+
+void nvttSurfaceToGreyScale(NvttSurface * surface, float redScale, float greenScale, float blueScale, float alphaScale)
+{
+    surface->toGreyScale(redScale, greenScale, blueScale, alphaScale);
+}
+
+void nvttSurfaceFill(NvttSurface * surface, float r, float g, float b, float a)
+{
+    surface->fill(r, g, b, a);
+}
+
+void nvttSurfaceScaleAlphaToCoverage(NvttSurface * surface, float coverage, float alphaRef)
+{
+    surface->scaleAlphaToCoverage(coverage, alphaRef);
+}
+
+void nvttSurfaceToRGBM(NvttSurface * surface, float range, float threshold)
+{
+    surface->toRGBM(range, threshold);
+}
+
+void nvttSurfaceToYCoCg(NvttSurface * surface)
+{
+    surface->toYCoCg();
+}
+
+void nvttSurfaceBinarize(NvttSurface * surface, int channel, float threshold, NvttBoolean dither)
+{
+    surface->binarize(channel, threshold, dither != NVTT_False);
+}
+
+void nvttSurfaceQuantize(NvttSurface * surface, int channel, int bits, NvttBoolean exactEndPoints, NvttBoolean dither)
+{
+    surface->quantize(channel, bits, exactEndPoints != NVTT_False, dither != NVTT_False);
+}
+
+void nvttSurfaceToNormalMap(NvttSurface * surface, float sm, float medium, float big, float large)
+{
+    surface->toNormalMap(sm, medium, big, large);
+}
+
+void nvttSurfaceNormalizeNormalMap(NvttSurface * surface)
+{
+    surface->normalizeNormalMap();
+}
+
+void nvttSurfacePackNormals(NvttSurface * surface, float scale, float bias)
+{
+    surface->packNormals(scale, bias);
+}
+
+void nvttSurfaceExpandNormals(NvttSurface * surface, float scale, float bias)
+{
+    surface->expandNormals(scale, bias);
+}
+
+void nvttSurfaceFlipX(NvttSurface * surface)
+{
+    surface->flipX();
+}
+
+void nvttSurfaceFlipY(NvttSurface * surface)
+{
+    surface->flipY();
+}
+
+NvttBoolean nvttSurfaceCopyChannel(NvttSurface * surface, const NvttSurface * source, int srcChannel, int dstChannel)
+{
+    return (NvttBoolean)surface->copyChannel(*source, srcChannel, dstChannel);
+}
+
+
+// CubeSurface class.
+NvttCubeSurface * nvttCreateCubeSurface()
+{
+    return new nvtt::CubeSurface();
+}
+
+void nvttDestroyCubeSurface(NvttCubeSurface * cube)
+{
+    delete cube;
+}
+
+NvttBoolean nvttCubeSurfaceIsNull(const NvttCubeSurface * cube)
+{
+    return (NvttBoolean)cube->isNull();
+}
+
+int nvttCubeSurfaceEdgeLength(const NvttCubeSurface * cube)
+{
+    return cube->edgeLength();
+}
+
+int nvttCubeSurfaceCountMipmaps(const NvttCubeSurface * cube)
+{
+    return cube->countMipmaps();
+}
+
+NvttBoolean nvttCubeSurfaceLoad(NvttCubeSurface * cube, const char * fileName, int mipmap)
+{
+    return (NvttBoolean)cube->load(fileName, mipmap);
+}
+
+NvttBoolean nvttCubeSurfaceSave(const NvttCubeSurface * cube, const char * fileName)
+{
+    return (NvttBoolean)cube->save(fileName);
+}
+
+NvttSurface * nvttCubeSurfaceFace(NvttCubeSurface * cube, int face)
+{
+    return &cube->face(face);
+}
+
+NvttBoolean nvttCubeSurfaceBuildNextMipmap(NvttCubeSurface * cube)
+{
+    return (NvttBoolean)cube->buildNextMipmap();
+}
+
+void nvttCubeSurfaceToLinear(NvttCubeSurface * cube, float gamma)
+{
+    cube->toLinear(gamma);
+}
+
+void nvttCubeSurfaceToGamma(NvttCubeSurface * cube, float gamma)
+{
+    cube->toGamma(gamma);
+}
+
 
 // Global functions.
 const char * nvttErrorString(NvttError e)
@@ -55,13 +55,20 @@ typedef struct nvtt::InputOptions NvttInputOptions;
 typedef struct nvtt::CompressionOptions NvttCompressionOptions;
 typedef struct nvtt::OutputOptions NvttOutputOptions;
 typedef struct nvtt::Compressor NvttCompressor;
+typedef struct nvtt::Surface NvttSurface;
+typedef struct nvtt::CubeSurface NvttCubeSurface;
 #else
 typedef struct NvttInputOptions NvttInputOptions;
 typedef struct NvttCompressionOptions NvttCompressionOptions;
 typedef struct NvttOutputOptions NvttOutputOptions;
 typedef struct NvttCompressor NvttCompressor;
+typedef struct NvttSurface NvttSurface;
+typedef struct NvttCubeSurface NvttCubeSurface;
 #endif
 
+// A job and its completion callback.
+typedef struct NvttJob NvttJob;
+
 /// Supported compression formats.
 typedef enum
 {
@@ -84,6 +91,17 @@ typedef enum
 	NVTT_Format_BC3n = NVTT_Format_DXT5n,
 	NVTT_Format_BC4,
 	NVTT_Format_BC5,
+
+	NVTT_Format_DXT1n,
+	NVTT_Format_CTX1,
+
+	NVTT_Format_BC6,
+	NVTT_Format_BC7,
+
+	NVTT_Format_BC5_Luma,
+	NVTT_Format_BC3_RGBM,
+	NVTT_Format_BC3_YCoCg,
+	NVTT_Format_BC5_Normal,
 } NvttFormat;
 
 /// Quality modes.
@@ -108,12 +126,16 @@ typedef enum
 {
 	NVTT_TextureType_2D,
 	NVTT_TextureType_Cube,
+	NVTT_TextureType_3D,
 } NvttTextureType;
 
 /// Input formats.
 typedef enum
 {
 	NVTT_InputFormat_BGRA_8UB,
+	NVTT_InputFormat_RGBA_16F,
+	NVTT_InputFormat_RGBA_32F,
+	NVTT_InputFormat_R_32F,
 } NvttInputFormat;
 
 /// Mipmap downsampling filters.
@@ -124,6 +146,15 @@ typedef enum
 	NVTT_MipmapFilter_Kaiser,
 } NvttMipmapFilter;
 
+/// Texture resize filters.
+typedef enum
+{
+	NVTT_ResizeFilter_Box,
+	NVTT_ResizeFilter_Triangle,
+	NVTT_ResizeFilter_Kaiser,
+	NVTT_ResizeFilter_Mitchell,
+} NvttResizeFilter;
+
 /// Extents rounding mode.
 typedef enum
 {
@@ -169,6 +200,7 @@ extern "C" {
 typedef void (* nvttBeginImageHandler)(int size, int width, int height, int depth, int face, int miplevel);
 typedef bool (* nvttOutputHandler)(const void * data, int size);
 typedef void (* nvttEndImageHandler)();
+typedef void (* nvttJobHandler)(NvttBoolean success, void * userData);
 
 
 // InputOptions class.
@@ -185,6 +217,7 @@ NVTT_API void nvttSetInputOptionsWrapMode(NvttInputOptions * inputOptions, NvttW
 NVTT_API void nvttSetInputOptionsMipmapFilter(NvttInputOptions * inputOptions, NvttMipmapFilter filter);
 NVTT_API void nvttSetInputOptionsMipmapGeneration(NvttInputOptions * inputOptions, NvttBoolean enabled, int maxLevel);
 NVTT_API void nvttSetInputOptionsKaiserParameters(NvttInputOptions * inputOptions, float width, float alpha, float stretch);
+NVTT_API void nvttSetInputOptionsMipmapAlphaCoverage(NvttInputOptions * inputOptions, NvttBoolean enabled, float alphaRef);
 NVTT_API void nvttSetInputOptionsNormalMap(NvttInputOptions * inputOptions, NvttBoolean b);
 NVTT_API void nvttSetInputOptionsConvertToNormalMap(NvttInputOptions * inputOptions, NvttBoolean convert);
 NVTT_API void nvttSetInputOptionsHeightEvaluation(NvttInputOptions * inputOptions, float redScale, float greenScale, float blueScale, float alphaScale);
@@ -222,6 +255,93 @@ NVTT_API void nvttDestroyCompressor(NvttCompressor * compressor);
 NVTT_API NvttBoolean nvttCompress(const NvttCompressor * compressor, const NvttInputOptions * inputOptions, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions);
 NVTT_API int nvttEstimateSize(const NvttCompressor * compressor, const NvttInputOptions * inputOptions, const NvttCompressionOptions * compressionOptions);
 
+// Compress surfaces, the output of each call goes to the output options in order.
+NVTT_API NvttBoolean nvttSurfaceOutputHeader(const NvttCompressor * compressor, const NvttSurface * surface, int mipmapCount, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions);
+NVTT_API NvttBoolean nvttCompressSurface(const NvttCompressor * compressor, const NvttSurface * surface, int face, int mipmap, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions);
+NVTT_API int nvttEstimateSurfaceSize(const NvttCompressor * compressor, const NvttSurface * surface, int mipmapCount, const NvttCompressionOptions * compressionOptions);
+NVTT_API NvttBoolean nvttCubeSurfaceOutputHeader(const NvttCompressor * compressor, const NvttCubeSurface * cube, int mipmapCount, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions);
+NVTT_API NvttBoolean nvttCompressCubeSurface(const NvttCompressor * compressor, const NvttCubeSurface * cube, int mipmap, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions);
+
+// Batches, in a single call. The surfaces of a batch are compressed as the given face and mipmap of each. The mipmap chain
+// compresses the surface as mipmap 0 of the face and builds and compresses the next mipmapCount - 1 levels from it.
+NVTT_API NvttBoolean nvttCompressSurfaces(const NvttCompressor * compressor, int count, const NvttSurface * const * surfaces, const int * faces, const int * mipmaps, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions);
+NVTT_API NvttBoolean nvttCompressSurfaceMipmaps(const NvttCompressor * compressor, const NvttSurface * surface, int face, int mipmapCount, NvttMipmapFilter filter, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions);
+
+// Asynchronous compression, see Compressor::processAsync. The handler, if any, is called with userData when the job is done.
+NVTT_API NvttJob * nvttCreateJob();
+NVTT_API void nvttDestroyJob(NvttJob * job);
+NVTT_API void nvttCompressAsync(const NvttCompressor * compressor, NvttJob * job, const NvttInputOptions * inputOptions, const NvttCompressionOptions * compressionOptions, const NvttOutputOptions * outputOptions, nvttJobHandler handler, void * userData);
+NVTT_API NvttBoolean nvttJobIsDone(const NvttJob * job);
+NVTT_API NvttBoolean nvttJobWait(NvttJob * job);
+
+
+// Surface class.
+NVTT_API NvttSurface * nvttCreateSurface();
+NVTT_API NvttSurface * nvttCloneSurface(const NvttSurface * surface);
+NVTT_API void nvttDestroySurface(NvttSurface * surface);
+
+NVTT_API void nvttSetSurfaceWrapMode(NvttSurface * surface, NvttWrapMode mode);
+NVTT_API void nvttSetSurfaceAlphaMode(NvttSurface * surface, NvttAlphaMode alphaMode);
+NVTT_API void nvttSetSurfaceNormalMap(NvttSurface * surface, NvttBoolean isNormalMap);
+
+NVTT_API NvttBoolean nvttSurfaceIsNull(const NvttSurface * surface);
+NVTT_API int nvttSurfaceWidth(const NvttSurface * surface);
+NVTT_API int nvttSurfaceHeight(const NvttSurface * surface);
+NVTT_API int nvttSurfaceDepth(const NvttSurface * surface);
+NVTT_API int nvttSurfaceCountMipmaps(const NvttSurface * surface);
+
+// The texels without copying them: the r, g, b and a planes of width * height * depth floats. Valid until the surface changes.
+NVTT_API const float * nvttSurfaceData(const NvttSurface * surface);
+NVTT_API const float * nvttSurfaceChannel(const NvttSurface * surface, int channel);
+
+NVTT_API NvttBoolean nvttSurfaceLoad(NvttSurface * surface, const char * fileName);
+NVTT_API NvttBoolean nvttSurfaceSave(const NvttSurface * surface, const char * fileName);
+NVTT_API NvttBoolean nvttSetSurfaceImage(NvttSurface * surface, NvttInputFormat format, int w, int h, int d, const void * data);
+// Uses the caller's texels without copying them, laid out as nvttSurfaceData. They must outlive the surface and its clones.
+NVTT_API NvttBoolean nvttSetSurfaceImageView(NvttSurface * surface, int w, int h, int d, const float * data);
+
+NVTT_API void nvttSurfaceResize(NvttSurface * surface, int w, int h, int d, NvttResizeFilter filter);
+NVTT_API void nvttSurfaceResizeMax(NvttSurface * surface, int maxExtent, NvttRoundMode mode, NvttResizeFilter filter);
+NVTT_API NvttBoolean nvttSurfaceBuildNextMipmap(NvttSurface * surface, NvttMipmapFilter filter);
+NVTT_API void nvttSurfaceToLinear(NvttSurface * surface, float gamma);
+NVTT_API void nvttSurfaceToGamma(NvttSurface * surface, float gamma);
+NVTT_API void nvttSurfaceToSrgb(NvttSurface * surface);
+NVTT_API void nvttSurfaceToLinearFromSrgb(NvttSurface * surface);
+NVTT_API void nvttSurfaceSwizzle(NvttSurface * surface, int r, int g, int b, int a);
+NVTT_API void nvttSurfaceScaleBias(NvttSurface * surface, int channel, float scale, float bias);
+NVTT_API void nvttSurfaceClamp(NvttSurface * surface, int channel, float low, float high);
+NVTT_API void nvttSurfacePremultiplyAlpha(NvttSurface * surface);
+NVTT_API void nvttSurfaceToGreyScale(NvttSurface * surface, float redScale, float greenScale, float blueScale, float alphaScale);
+NVTT_API void nvttSurfaceFill(NvttSurface * surface, float r, float g, float b, float a);
+NVTT_API void nvttSurfaceScaleAlphaToCoverage(NvttSurface * surface, float coverage, float alphaRef);
+NVTT_API void nvttSurfaceToRGBM(NvttSurface * surface, float range, float threshold);
+NVTT_API void nvttSurfaceToYCoCg(NvttSurface * surface);
+NVTT_API void nvttSurfaceBinarize(NvttSurface * surface, int channel, float threshold, NvttBoolean dither);
+NVTT_API void nvttSurfaceQuantize(NvttSurface * surface, int channel, int bits, NvttBoolean exactEndPoints, NvttBoolean dither);
+NVTT_API void nvttSurfaceToNormalMap(NvttSurface * surface, float sm, float medium, float big, float large);
+NVTT_API void nvttSurfaceNormalizeNormalMap(NvttSurface * surface);
+NVTT_API void nvttSurfacePackNormals(NvttSurface * surface, float scale, float bias);
+NVTT_API void nvttSurfaceExpandNormals(NvttSurface * surface, float scale, float bias);
+NVTT_API void nvttSurfaceFlipX(NvttSurface * surface);
+NVTT_API void nvttSurfaceFlipY(NvttSurface * surface);
+NVTT_API NvttBoolean nvttSurfaceCopyChannel(NvttSurface * surface, const NvttSurface * source, int srcChannel, int dstChannel);
+
+
+// CubeSurface class.
+NVTT_API NvttCubeSurface * nvttCreateCubeSurface();
+NVTT_API void nvttDestroyCubeSurface(NvttCubeSurface * cube);
+
+NVTT_API NvttBoolean nvttCubeSurfaceIsNull(const NvttCubeSurface * cube);
+NVTT_API int nvttCubeSurfaceEdgeLength(const NvttCubeSurface * cube);
+NVTT_API int nvttCubeSurfaceCountMipmaps(const NvttCubeSurface * cube);
+NVTT_API NvttBoolean nvttCubeSurfaceLoad(NvttCubeSurface * cube, const char * fileName, int mipmap);
+NVTT_API NvttBoolean nvttCubeSurfaceSave(const NvttCubeSurface * cube, const char * fileName);
+// The face is owned by the cube, operations on it change the cube.
+NVTT_API NvttSurface * nvttCubeSurfaceFace(NvttCubeSurface * cube, int face);
+NVTT_API NvttBoolean nvttCubeSurfaceBuildNextMipmap(NvttCubeSurface * cube);
+NVTT_API void nvttCubeSurfaceToLinear(NvttCubeSurface * cube, float gamma);
+NVTT_API void nvttCubeSurfaceToGamma(NvttCubeSurface * cube, float gamma);
+
 
 // Global functions.
 NVTT_API const char * nvttErrorString(NvttError e);
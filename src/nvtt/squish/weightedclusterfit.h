@@ -53,15 +53,16 @@ private:
 	Vec3 m_principle;
 
 #if SQUISH_USE_SIMD
-	Vec4 m_weighted[16];
+	// The cluster loops read one element past the last point when they exit.
+	Vec4 m_weighted[17];
 	Vec4 m_metric;
 	Vec4 m_metricSqr;
 	Vec4 m_xxsum;
 	Vec4 m_xsum;
 	Vec4 m_besterror;
 #else
-	Vec3 m_weighted[16];
-	float m_weights[16];
+	Vec3 m_weighted[17];
+	float m_weights[17];
 	Vec3 m_metric;
 	Vec3 m_metricSqr;
 	Vec3 m_xxsum;
@@ -0,0 +1,520 @@
+// This code is in the public domain -- castano@gmail.com
+
+// Measures the cost per block of the block compressors on fixed corpora of synthetic blocks. The kernels are timed
+// in isolation, on blocks that are already in the layout they take, and the formats are timed through the public API
+// at every quality level, with a sequential dispatcher, so that the numbers are per core.
+
+#include <nvtt/nvtt.h>
+#include <nvtt/QuickCompressDXT.h>
+#include <nvtt/OptimalCompressDXT.h>
+#include <nvtt/CompressorDXT1.h>
+
+#include <nvimage/ColorBlock.h>
+#include <nvimage/BlockDXT.h>
+
+#include <nvmath/Vector.inl>
+#include <nvmath/Color.inl>
+#include <nvmath/Half.h>
+
+#include <nvcore/Timer.h>
+#include <nvcore/PerfCounters.h>
+#include <nvcore/CpuInfo.h>
+#include <nvcore/StrLib.h>
+#include <nvcore/Hash.h>
+#include <nvcore/Array.inl>
+
+#include <bc6h/zoh.h>
+#include <bc7/avpcl.h>
+
+#include "../tools/cmdline.h"
+
+#include <stdlib.h> // EXIT_SUCCESS, EXIT_FAILURE, atoi
+#include <stdio.h> // printf
+#include <string.h> // strstr
+#include <math.h> // sinf, cosf, sqrtf
+
+using namespace nv;
+
+namespace
+{
+    // The corpus images are this many blocks wide.
+    static const uint kBlocksPerRow = 64;
+
+    // Small deterministic generator, the corpora must be the same on every run and platform.
+    struct Random
+    {
+        Random(uint32 seed) : state(seed * 2654435761U + 1) {}
+
+        uint32 next() {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+        float nextFloat() { return float(next() >> 8) * (1.0f / 16777216.0f); }
+
+        uint32 state;
+    };
+
+    struct Corpus
+    {
+        const char * name;
+        Array<Vector4> texels;  // blockCount * 16 texels, block after block, in [0, 1].
+        uint blockCount;
+    };
+
+    static float saturate01(float f) { return clamp(f, 0.0f, 1.0f); }
+
+    // Smooth colors with a little noise, like most blocks of photographs and painted textures.
+    static Vector4 naturalTexel(Random & rnd, uint b, uint i)
+    {
+        const float bx = float(b % kBlocksPerRow) + float(i % 4) * 0.25f;
+        const float by = float(b / kBlocksPerRow) + float(i / 4) * 0.25f;
+
+        const float r = 0.5f + 0.35f * sinf(bx * 0.31f + by * 0.07f);
+        const float g = 0.5f + 0.30f * sinf(bx * 0.11f - by * 0.23f + 1.0f);
+        const float b2 = 0.4f + 0.25f * cosf(bx * 0.05f + by * 0.17f);
+
+        const float n = (rnd.nextFloat() - 0.5f) * (8.0f / 255.0f);
+        return Vector4(saturate01(r + n), saturate01(g + n), saturate01(b2 + n), 1.0f);
+    }
+
+    static void generateCorpus(Corpus & corpus, uint blockCount)
+    {
+        corpus.blockCount = blockCount;
+        corpus.texels.resize(blockCount * 16);
+
+        Random rnd(sdbmHash(corpus.name, strLen(corpus.name)));
+
+        for (uint b = 0; b < blockCount; b++)
+        {
+            Vector4 * block = corpus.texels.buffer() + b * 16;
+
+            if (strEqual(corpus.name, "natural"))
+            {
+                for (uint i = 0; i < 16; i++) block[i] = naturalTexel(rnd, b, i);
+            }
+            else if (strEqual(corpus.name, "gradient"))
+            {
+                // Linear ramp between two random colors, in a random direction.
+                const Vector4 c0(rnd.nextFloat(), rnd.nextFloat(), rnd.nextFloat(), 1.0f);
+                const Vector4 c1(rnd.nextFloat(), rnd.nextFloat(), rnd.nextFloat(), 1.0f);
+                const float angle = rnd.nextFloat() * 6.2831853f;
+                const float dx = cosf(angle), dy = sinf(angle);
+                for (uint i = 0; i < 16; i++) {
+                    float t = ((float(i % 4) - 1.5f) * dx + (float(i / 4) - 1.5f) * dy) / 4.25f + 0.5f;
+                    block[i] = lerp(c0, c1, saturate01(t));
+                }
+            }
+            else if (strEqual(corpus.name, "noise"))
+            {
+                for (uint i = 0; i < 16; i++) block[i] = Vector4(rnd.nextFloat(), rnd.nextFloat(), rnd.nextFloat(), 1.0f);
+            }
+            else if (strEqual(corpus.name, "alpha"))
+            {
+                // Natural colors with smooth, binary and constant alpha, in that proportion.
+                const uint kind = rnd.next() % 4;
+                const float a0 = rnd.nextFloat(), a1 = rnd.nextFloat();
+                const uint edge = rnd.next() % 5;
+                for (uint i = 0; i < 16; i++) {
+                    block[i] = naturalTexel(rnd, b, i);
+                    if (kind < 2) block[i].w = lerp(a0, a1, float(i) / 15.0f);
+                    else if (kind == 2) block[i].w = (i % 4) < edge ? 0.0f : 1.0f;
+                    else block[i].w = a0;
+                }
+            }
+            else if (strEqual(corpus.name, "normal"))
+            {
+                // Unit vectors tilted around +z, encoded to [0, 1].
+                const float tx = (rnd.nextFloat() - 0.5f) * 0.8f;
+                const float ty = (rnd.nextFloat() - 0.5f) * 0.8f;
+                for (uint i = 0; i < 16; i++) {
+                    Vector3 n(tx + (rnd.nextFloat() - 0.5f) * 0.1f, ty + (rnd.nextFloat() - 0.5f) * 0.1f, 1.0f);
+                    n = normalize(n);
+                    block[i] = Vector4(n * 0.5f + Vector3(0.5f), 1.0f);
+                }
+            }
+        }
+    }
+
+
+    // The corpus in the layouts the kernels take, converted outside of the timed loops.
+    struct KernelInput
+    {
+        Array<ColorBlock> colorBlocks;
+        Array<Vector3> colors;          // 16 per block.
+        Array<AVPCL::Tile> avpclTiles;
+        Array<ZOH::Tile> zohTiles;
+    };
+
+    static void prepareInput(const Corpus & corpus, KernelInput & input)
+    {
+        const uint count = corpus.blockCount;
+        input.colorBlocks.resize(count);
+        input.colors.resize(count * 16);
+        input.avpclTiles.resize(count);
+        input.zohTiles.resize(count);
+
+        for (uint b = 0; b < count; b++)
+        {
+            const Vector4 * block = corpus.texels.buffer() + b * 16;
+
+            AVPCL::Tile & avpclTile = input.avpclTiles[b];
+            avpclTile.size_x = avpclTile.size_y = 4;
+
+            ZOH::Tile & zohTile = input.zohTiles[b];
+            zohTile.size_x = zohTile.size_y = 4;
+
+            for (uint i = 0; i < 16; i++)
+            {
+                const Vector4 c = block[i];
+                input.colorBlocks[b].color(i) = toColor32(c);
+                input.colors[b * 16 + i] = c.xyz();
+
+                avpclTile.data[i / 4][i % 4] = c * 255.0f;
+                avpclTile.importance_map[i / 4][i % 4] = 1.0f;
+
+                zohTile.data[i / 4][i % 4].x = ZOH::Tile::half2float(to_half(c.x), ZOH::UNSIGNED_F16);
+                zohTile.data[i / 4][i % 4].y = ZOH::Tile::half2float(to_half(c.y), ZOH::UNSIGNED_F16);
+                zohTile.data[i / 4][i % 4].z = ZOH::Tile::half2float(to_half(c.z), ZOH::UNSIGNED_F16);
+                zohTile.importance_map[i / 4][i % 4] = 1.0f;
+            }
+        }
+    }
+
+
+    // Compress block b of the input to output.
+    typedef void KernelFunction(const KernelInput & input, uint b, void * output);
+
+    static const float s_uniformWeights[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+
+    static void quickDXT1(const KernelInput & input, uint b, void * output) {
+        QuickCompress::compressDXT1(input.colorBlocks[b], (BlockDXT1 *)output);
+    }
+    // Compresses the run of 16 blocks that starts at b, the calls for the other blocks of the run do nothing.
+    static void quickDXT1Batch(const KernelInput & input, uint b, void * output) {
+        if (b % 16 == 0) QuickCompress::compressDXT1(&input.colorBlocks[b], min(16U, input.colorBlocks.count() - b), (BlockDXT1 *)output);
+    }
+    static void clusterDXT1(const KernelInput & input, uint b, void * output) {
+        compress_dxt1(&input.colors[b * 16], s_uniformWeights, Vector3(1.0f), (BlockDXT1 *)output);
+    }
+    static void exhaustiveDXT1(const KernelInput & input, uint b, void * output) {
+        compress_dxt1(&input.colors[b * 16], s_uniformWeights, Vector3(1.0f), (BlockDXT1 *)output, /*exhaustive_volume*/400);
+    }
+    static void quickDXT5A(const KernelInput & input, uint b, void * output) {
+        QuickCompress::compressDXT5A(input.colorBlocks[b], (AlphaBlockDXT5 *)output);
+    }
+    static void optimalDXT5A(const KernelInput & input, uint b, void * output) {
+        OptimalCompress::compressDXT5A(input.colorBlocks[b], (AlphaBlockDXT5 *)output);
+    }
+
+    static void avpcl(const KernelInput & input, uint b, void * output, int modeCandidates) {
+        AVPCL::Options options;
+        options.premult = false;
+        options.nonuniform = false;
+        options.nonuniform_ati = false;
+        for (int c = 0; c < 4; c++) options.channel_weights[c] = 1.0f;
+        options.effort = 0.5f;
+        options.mode_candidates = modeCandidates;
+        options.mode_mask = 0xFF;
+        options.error_threshold = 0.0f;
+        options.dispatch = NULL;
+        options.dispatcher = NULL;
+        AVPCL::compress(input.avpclTiles[b], options, (char *)output);
+    }
+    // The mode candidates of the BC7 compressor at the fastest, normal and production qualities.
+    static void avpclFastest(const KernelInput & input, uint b, void * output) { avpcl(input, b, output, 1); }
+    static void avpclNormal(const KernelInput & input, uint b, void * output) { avpcl(input, b, output, 2); }
+    static void avpclProduction(const KernelInput & input, uint b, void * output) { avpcl(input, b, output, 8); }
+
+    static void zoh(const KernelInput & input, uint b, void * output) {
+        ZOH::compress(input.zohTiles[b], (char *)output, ZOH::UNSIGNED_F16);
+    }
+
+    struct Kernel
+    {
+        const char * name;
+        KernelFunction * function;
+    };
+
+    static const Kernel s_kernels[] = {
+        { "QuickCompress::compressDXT1", quickDXT1 },
+        { "QuickCompress::compressDXT1 x16", quickDXT1Batch },
+        { "compress_dxt1", clusterDXT1 },
+        { "compress_dxt1 exhaustive", exhaustiveDXT1 },
+        { "QuickCompress::compressDXT5A", quickDXT5A },
+        { "OptimalCompress::compressDXT5A", optimalDXT5A },
+        { "AVPCL::compress fastest", avpclFastest },
+        { "AVPCL::compress normal", avpclNormal },
+        { "AVPCL::compress production", avpclProduction },
+        { "ZOH::compress", zoh },
+    };
+
+
+    // Hardware counters of the calling thread, NULL unless they are requested and available. All the measurements run
+    // on the calling thread.
+    static PerfCounters * s_counters = NULL;
+
+    struct Measurement
+    {
+        double seconds;     // Of the fastest pass.
+        uint64 cycles;      // Of the same pass, in time stamp counter ticks.
+        uint64 counters[PerfCounters::Counter_Count];   // Of the same pass.
+    };
+
+    // Best of the passes that fit in minTime, at least two. The first pass is not timed, it warms up the caches.
+    template <typename Pass>
+    static Measurement measure(Pass & pass, float minTime)
+    {
+        pass();
+
+        Measurement best = { 1e30, 0, { 0 } };
+        double total = 0.0;
+        for (int i = 0; i < 2 || total < minTime; i++)
+        {
+            uint64 e0[PerfCounters::Counter_Count], e1[PerfCounters::Counter_Count];
+            if (s_counters != NULL) s_counters->read(e0);
+
+            Timer timer;
+            timer.start();
+            const uint64 c0 = fastCpuClock();
+            pass();
+            const uint64 c1 = fastCpuClock();
+            timer.stop();
+
+            if (s_counters != NULL) s_counters->read(e1);
+
+            const double t = timer.elapsed();
+            total += t;
+            if (t < best.seconds) {
+                best.seconds = t;
+                best.cycles = c1 - c0;
+                if (s_counters != NULL) {
+                    for (int c = 0; c < PerfCounters::Counter_Count; c++) best.counters[c] = e1[c] - e0[c];
+                }
+            }
+        }
+        return best;
+    }
+
+    struct KernelPass
+    {
+        const KernelInput * input;
+        uint blockCount;
+        KernelFunction * function;
+        uint8 output[16 * 16];      // Room for the output of a batch.
+
+        void operator()() {
+            for (uint b = 0; b < blockCount; b++) function(*input, b, output);
+        }
+    };
+
+    struct SequentialDispatcher : public nvtt::TaskDispatcher
+    {
+        virtual void dispatch(nvtt::Task * task, void * context, int count) {
+            for (int i = 0; i < count; i++) task(context, i);
+        }
+        virtual void dispatchRange(nvtt::RangeTask * task, void * context, int count, int grain) {
+            if (count > 0) task(context, 0, count);
+        }
+    };
+
+    struct NullOutputHandler : public nvtt::OutputHandler
+    {
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel) {}
+        virtual bool writeData(const void * data, int size) { return true; }
+        virtual void endImage() {}
+    };
+
+    struct FormatPass
+    {
+        const nvtt::Compressor * context;
+        const nvtt::Surface * surface;
+        const nvtt::CompressionOptions * compressionOptions;
+        const nvtt::OutputOptions * outputOptions;
+
+        void operator()() {
+            context->compress(*surface, 0, 0, *compressionOptions, *outputOptions);
+        }
+    };
+
+    // Surface with the blocks of the corpus laid out in rows of kBlocksPerRow.
+    static void makeSurface(const Corpus & corpus, nvtt::Surface & surface)
+    {
+        const uint w = kBlocksPerRow * 4;
+        const uint h = (corpus.blockCount / kBlocksPerRow) * 4;
+
+        Array<float> rgba;
+        rgba.resize(w * h * 4);
+        for (uint b = 0; b < corpus.blockCount; b++) {
+            for (uint i = 0; i < 16; i++) {
+                const uint x = (b % kBlocksPerRow) * 4 + i % 4;
+                const uint y = (b / kBlocksPerRow) * 4 + i / 4;
+                const Vector4 & c = corpus.texels[b * 16 + i];
+                float * dst = rgba.buffer() + (y * w + x) * 4;
+                dst[0] = c.x; dst[1] = c.y; dst[2] = c.z; dst[3] = c.w;
+            }
+        }
+        surface.setImage(nvtt::InputFormat_RGBA_32F, w, h, 1, rgba.buffer());
+    }
+
+    static void printRow(const char * name, const char * corpus, uint blockCount, const Measurement & m)
+    {
+        const double ns = 1e9 * m.seconds / blockCount;
+        printf("%-32s %-9s %12.1f %14.1f %12.0f", name, corpus, ns, double(m.cycles) / blockCount, blockCount / m.seconds);
+
+        if (s_counters != NULL) {
+            const uint64 * c = m.counters;
+            printf(" %6.2f %12.1f %10.3f %10.3f", c[PerfCounters::Counter_Cycles] ? double(c[PerfCounters::Counter_Instructions]) / c[PerfCounters::Counter_Cycles] : 0.0,
+                double(c[PerfCounters::Counter_Instructions]) / blockCount, double(c[PerfCounters::Counter_CacheMisses]) / blockCount, double(c[PerfCounters::Counter_BranchMisses]) / blockCount);
+        }
+        printf("\n");
+    }
+
+    static bool selected(const char * name, const char * filter)
+    {
+        return filter == NULL || strstr(name, filter) != NULL;
+    }
+
+    // Feature mask of an instruction set name, 0 if unknown.
+    static uint isaMask(const char * name)
+    {
+        if (strEqual(name, "sse2")) return CpuFeature_SSE2 | CpuFeature_StreamingStores;
+        if (strEqual(name, "avx2")) return CpuFeature_SSE2 | CpuFeature_StreamingStores | CpuFeature_AVX | CpuFeature_AVX2 | CpuFeature_FMA;
+        if (strEqual(name, "avx512")) return ~0U;
+        return 0;
+    }
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    MyAssertHandler assertHandler;
+    MyMessageHandler messageHandler;
+
+    uint blockCount = 1024;
+    float minTime = 0.1f;
+    const char * kernelFilter = NULL;
+    const char * corpusFilter = NULL;
+    bool runKernels = true;
+    bool runFormats = true;
+    bool counters = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp("-blocks", argv[i]) == 0 && i+1 < argc) blockCount = max(atoi(argv[++i]), 1);
+        else if (strcmp("-time", argv[i]) == 0 && i+1 < argc) minTime = float(atof(argv[++i]));
+        else if (strcmp("-only", argv[i]) == 0 && i+1 < argc) kernelFilter = argv[++i];
+        else if (strcmp("-corpus", argv[i]) == 0 && i+1 < argc) corpusFilter = argv[++i];
+        else if (strcmp("-kernels", argv[i]) == 0) runFormats = false;
+        else if (strcmp("-formats", argv[i]) == 0) runKernels = false;
+        else if (strcmp("-counters", argv[i]) == 0) counters = true;
+        else if (strcmp("-isa", argv[i]) == 0 && i+1 < argc && isaMask(argv[i+1]) != 0) setCpuFeatureMask(isaMask(argv[++i]));
+        else
+        {
+            printf("usage: blockbench [options]\n\n");
+            printf("  -blocks <n>   \tBlocks per corpus, rounded up to a multiple of %u (default 1024).\n", kBlocksPerRow);
+            printf("  -time <s>     \tMinimum time of each measurement (default 0.1).\n");
+            printf("  -only <name>  \tOnly the kernels and formats whose name contains this string.\n");
+            printf("  -corpus <name>\tOnly this corpus: natural, gradient, noise, alpha or normal.\n");
+            printf("  -kernels      \tOnly the kernels.\n");
+            printf("  -formats      \tOnly the formats.\n");
+            printf("  -counters     \tAlso report the instructions per cycle, and the instructions, last level cache misses and\n");
+            printf("                \tbranch mispredictions per block, from the hardware performance counters.\n");
+            printf("  -isa <name>   \tWidest instruction set the kernels may use: sse2, avx2 or avx512.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    blockCount = ((blockCount + kBlocksPerRow - 1) / kBlocksPerRow) * kBlocksPerRow;
+
+    const char * const corpusNames[] = { "natural", "gradient", "noise", "alpha", "normal" };
+    const uint corpusCount = sizeof(corpusNames) / sizeof(corpusNames[0]);
+
+    PerfCounters perfCounters;
+    if (counters) {
+        if (perfCounters.open(/*allThreads=*/false)) s_counters = &perfCounters;
+        else fprintf(stderr, "Hardware performance counters are not available.\n");
+    }
+
+    printf("%u blocks per corpus, %s kernels, cycles are time stamp counter ticks.\n\n", blockCount, cpuFeatureName(cpuFeatures()));
+    printf("%-32s %-9s %12s %14s %12s", "compressor", "corpus", "ns/block", "cycles/block", "blocks/s");
+    if (s_counters != NULL) printf(" %6s %12s %10s %10s", "IPC", "instr/block", "LLC/block", "br/block");
+    printf("\n");
+
+    for (uint c = 0; c < corpusCount; c++)
+    {
+        if (corpusFilter != NULL && !strEqual(corpusFilter, corpusNames[c])) continue;
+
+        Corpus corpus;
+        corpus.name = corpusNames[c];
+        generateCorpus(corpus, blockCount);
+
+        if (runKernels)
+        {
+            KernelInput input;
+            prepareInput(corpus, input);
+
+            for (uint k = 0; k < sizeof(s_kernels) / sizeof(s_kernels[0]); k++)
+            {
+                if (!selected(s_kernels[k].name, kernelFilter)) continue;
+
+                KernelPass pass;
+                pass.input = &input;
+                pass.blockCount = blockCount;
+                pass.function = s_kernels[k].function;
+
+                printRow(s_kernels[k].name, corpus.name, blockCount, measure(pass, minTime));
+            }
+        }
+
+        if (runFormats)
+        {
+            static const struct { const char * name; nvtt::Format format; } formats[] = {
+                { "BC1", nvtt::Format_BC1 }, { "BC1a", nvtt::Format_BC1a }, { "BC2", nvtt::Format_BC2 },
+                { "BC3", nvtt::Format_BC3 }, { "BC3n", nvtt::Format_BC3n }, { "BC4", nvtt::Format_BC4 },
+                { "BC5", nvtt::Format_BC5 }, { "BC6", nvtt::Format_BC6 }, { "BC7", nvtt::Format_BC7 },
+            };
+            static const char * const qualityNames[] = { "fastest", "normal", "production", "highest" };
+
+            nvtt::Surface surface;
+            makeSurface(corpus, surface);
+            if (strEqual(corpus.name, "alpha")) surface.setAlphaMode(nvtt::AlphaMode_Transparency);
+            if (strEqual(corpus.name, "normal")) surface.setNormalMap(true);
+
+            SequentialDispatcher dispatcher;
+            nvtt::Compressor context;
+            context.enableCudaAcceleration(false);
+            context.setTaskDispatcher(&dispatcher);
+
+            NullOutputHandler outputHandler;
+            nvtt::OutputOptions outputOptions;
+            outputOptions.setOutputHandler(&outputHandler);
+
+            for (uint f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+            {
+                for (int q = nvtt::Quality_Fastest; q <= nvtt::Quality_Highest; q++)
+                {
+                    StringBuilder name;
+                    name.format("%s %s", formats[f].name, qualityNames[q]);
+                    if (!selected(name.str(), kernelFilter)) continue;
+
+                    nvtt::CompressionOptions compressionOptions;
+                    compressionOptions.setFormat(formats[f].format);
+                    compressionOptions.setQuality(nvtt::Quality(q));
+
+                    FormatPass pass;
+                    pass.context = &context;
+                    pass.surface = &surface;
+                    pass.compressionOptions = &compressionOptions;
+                    pass.outputOptions = &outputOptions;
+
+                    printRow(name.str(), corpus.name, blockCount, measure(pass, minTime));
+                }
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,237 @@
+// This code is in the public domain -- castano@gmail.com
+
+// Checks that the block and output caches only return outputs compressed with the same options: every compression of a
+// warm cache must give the same bytes as a cold one. Also checks that incremental compression of an unchanged input reuses
+// all the blocks of the previous output.
+
+#include <nvtt/nvtt.h>
+
+#include <nvcore/Array.inl>
+
+#include "../tools/cmdline.h"
+
+#include <stdlib.h> // EXIT_SUCCESS, EXIT_FAILURE
+#include <stdio.h> // printf, fopen
+#include <string.h> // memcmp
+#include <math.h> // sqrtf, cosf, sinf
+
+using namespace nv;
+
+namespace
+{
+    struct MemoryOutputHandler : public nvtt::OutputHandler
+    {
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel) {}
+        virtual bool writeData(const void * data, int size)
+        {
+            data_.append((const uint8 *)data, size);
+            return true;
+        }
+        virtual void endImage() {}
+
+        Array<uint8> data_;
+    };
+
+    static const int s_size = 64;
+
+    // Tangent space normals of a bumpy surface, with a few flat and repeated blocks.
+    static void buildNormalMap(uint8 * texels)
+    {
+        for (int y = 0; y < s_size; y++) {
+            for (int x = 0; x < s_size; x++) {
+                float nx = 0.0f, ny = 0.0f;
+                if (y < 48) {
+                    nx = 0.7f * cosf(x * 0.31f + y * 0.07f);
+                    ny = 0.7f * sinf(y * 0.23f - x * 0.11f);
+                }
+                const float nz = sqrtf(1.0f - nx * nx - ny * ny);
+
+                uint8 * texel = texels + 4 * (y * s_size + x);
+                texel[0] = uint8(255.0f * (nz * 0.5f + 0.5f) + 0.5f);  // B
+                texel[1] = uint8(255.0f * (ny * 0.5f + 0.5f) + 0.5f);  // G
+                texel[2] = uint8(255.0f * (nx * 0.5f + 0.5f) + 0.5f);  // R
+                texel[3] = 255;
+            }
+        }
+    }
+
+    static bool sameOutput(const Array<uint8> & a, const Array<uint8> & b)
+    {
+        return a.count() == b.count() && memcmp(a.buffer(), b.buffer(), a.count()) == 0;
+    }
+
+    // Compress the surface with the block cache of the output options.
+    static void compressSurface(const nvtt::Compressor & compressor, const nvtt::Surface & image, const nvtt::CompressionOptions & compressionOptions, nvtt::OutputOptions & outputOptions, Array<uint8> & output)
+    {
+        MemoryOutputHandler outputHandler;
+        outputOptions.setOutputHandler(&outputHandler);
+        outputOptions.setOutputHeader(false);
+        compressor.compress(image, 0, 0, compressionOptions, outputOptions);
+        outputOptions.setOutputHandler(NULL);
+        swap(output, outputHandler.data_);
+    }
+
+    // Compress the input options with the output cache of the compressor.
+    static void processTexture(const nvtt::Compressor & compressor, const nvtt::InputOptions & inputOptions, const nvtt::CompressionOptions & compressionOptions, Array<uint8> & output)
+    {
+        MemoryOutputHandler outputHandler;
+        nvtt::OutputOptions outputOptions;
+        outputOptions.setOutputHandler(&outputHandler);
+        compressor.process(inputOptions, compressionOptions, outputOptions);
+        swap(output, outputHandler.data_);
+    }
+
+    static bool testBlockCache(const uint8 * texels)
+    {
+        nvtt::Surface image;
+        image.setImage(nvtt::InputFormat_BGRA_8UB, s_size, s_size, 1, texels);
+        image.setNormalMap(true);
+
+        nvtt::Compressor compressor;
+        compressor.enableCudaAcceleration(false);
+
+        nvtt::CompressionOptions compressionOptions;
+        compressionOptions.setFormat(nvtt::Format_BC5_Normal);
+
+        nvtt::OutputOptions warmOptions;
+        warmOptions.enableBlockCache(true);
+
+        Array<uint8> orthographic, warm, cold;
+        compressionOptions.setNormalTransform(nvtt::NormalTransform_Orthographic);
+        compressSurface(compressor, image, compressionOptions, warmOptions, orthographic);
+
+        compressionOptions.setNormalTransform(nvtt::NormalTransform_Stereographic);
+        compressSurface(compressor, image, compressionOptions, warmOptions, warm);
+
+        nvtt::OutputOptions coldOptions;
+        compressSurface(compressor, image, compressionOptions, coldOptions, cold);
+
+        if (sameOutput(orthographic, cold)) {
+            printf("Block cache: the normal transform doesn't change the output\n");
+            return false;
+        }
+        if (!sameOutput(warm, cold)) {
+            printf("Block cache: changing the normal transform returned stale blocks\n");
+            return false;
+        }
+        return true;
+    }
+
+    static bool testOutputCache(const uint8 * texels)
+    {
+        nvtt::InputOptions inputOptions;
+        inputOptions.setTextureLayout(nvtt::TextureType_2D, s_size, s_size);
+        inputOptions.setMipmapData(texels, s_size, s_size);
+        inputOptions.setMipmapGeneration(false);
+        inputOptions.setNormalMap(true);
+
+        nvtt::Compressor warmCompressor;
+        warmCompressor.enableCudaAcceleration(false);
+        warmCompressor.setOutputCache("cachetest-output");
+
+        nvtt::Compressor coldCompressor;
+        coldCompressor.enableCudaAcceleration(false);
+
+        nvtt::CompressionOptions compressionOptions;
+        compressionOptions.setFormat(nvtt::Format_BC5_Normal);
+
+        Array<uint8> warm, cold;
+        compressionOptions.setNormalTransform(nvtt::NormalTransform_Orthographic);
+        processTexture(warmCompressor, inputOptions, compressionOptions, warm);
+
+        compressionOptions.setNormalTransform(nvtt::NormalTransform_Stereographic);
+        processTexture(warmCompressor, inputOptions, compressionOptions, warm);
+        processTexture(coldCompressor, inputOptions, compressionOptions, cold);
+
+        if (!sameOutput(warm, cold)) {
+            printf("Output cache: changing the normal transform returned a stale output\n");
+            return false;
+        }
+        return true;
+    }
+
+    static bool readFile(const char * fileName, Array<uint8> & data)
+    {
+        FILE * fp = fopen(fileName, "rb");
+        if (fp == NULL) return false;
+
+        fseek(fp, 0, SEEK_END);
+        data.resize(uint(ftell(fp)));
+        fseek(fp, 0, SEEK_SET);
+
+        const bool success = fread(data.buffer(), 1, data.count(), fp) == data.count();
+        fclose(fp);
+        return success;
+    }
+
+    static bool testIncremental(const uint8 * texels)
+    {
+        nvtt::InputOptions inputOptions;
+        inputOptions.setTextureLayout(nvtt::TextureType_2D, s_size, s_size);
+        inputOptions.setMipmapData(texels, s_size, s_size);
+
+        nvtt::Compressor compressor;
+        compressor.enableCudaAcceleration(false);
+
+        nvtt::CompressionOptions compressionOptions;
+        compressionOptions.setFormat(nvtt::Format_BC1);
+
+        const char * previousFileName = "cachetest-previous.dds";
+        {
+            nvtt::OutputOptions outputOptions;
+            outputOptions.setFileName(previousFileName);
+            if (!compressor.process(inputOptions, compressionOptions, outputOptions)) {
+                printf("Incremental: can't write %s\n", previousFileName);
+                return false;
+            }
+        }
+
+        Array<uint8> previous;
+        if (!readFile(previousFileName, previous)) {
+            printf("Incremental: can't read %s\n", previousFileName);
+            return false;
+        }
+
+        // Recompress the same input with the previous output.
+        MemoryOutputHandler outputHandler;
+        nvtt::BlockStatistics statistics = {};
+        nvtt::OutputOptions outputOptions;
+        outputOptions.setOutputHandler(&outputHandler);
+        outputOptions.setBlockStatistics(&statistics);
+        compressor.process(inputOptions, compressionOptions, outputOptions, inputOptions, previousFileName);
+
+        uint blockCount = 0;
+        for (int w = s_size, h = s_size; ; w = max(1, w / 2), h = max(1, h / 2)) {
+            blockCount += ((w + 3) / 4) * ((h + 3) / 4);
+            if (w == 1 && h == 1) break;
+        }
+
+        if (statistics.reusedBlocks != blockCount) {
+            printf("Incremental: reused %u of %u blocks\n", statistics.reusedBlocks, blockCount);
+            return false;
+        }
+        if (!sameOutput(outputHandler.data_, previous)) {
+            printf("Incremental: the output differs from the previous one\n");
+            return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    MyAssertHandler assertHandler;
+    MyMessageHandler messageHandler;
+
+    Array<uint8> texels;
+    texels.resize(4 * s_size * s_size);
+    buildNormalMap(texels.buffer());
+
+    bool success = true;
+    success &= testBlockCache(texels.buffer());
+    success &= testOutputCache(texels.buffer());
+    success &= testIncremental(texels.buffer());
+
+    printf(success ? "Cache test passed\n" : "Cache test failed\n");
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,348 @@
+// This code is in the public domain -- castano@gmail.com
+
+// Runs the same workloads through every task dispatcher available in this build, at several thread counts, and
+// reports the speedup and efficiency of each one against itself on a single thread, and the cost of a dispatch.
+
+#include <nvtt/nvtt.h>
+
+#include <nvthread/nvthread.h>
+#include <nvthread/ThreadPool.h>
+#include <nvthread/TaskScheduler.h>
+
+#include <nvcore/Timer.h>
+#include <nvcore/StrLib.h>
+#include <nvcore/Array.inl>
+
+#include "../tools/cmdline.h"
+#include "../TaskDispatcher.h" // after nvconfig.h, which tells which dispatchers are available
+
+#include <stdlib.h> // EXIT_SUCCESS, EXIT_FAILURE, atoi
+#include <stdio.h> // printf
+#include <string.h> // strstr
+#include <math.h> // sinf
+
+using namespace nv;
+
+namespace
+{
+    // A dispatcher and how to run it on a given number of threads.
+    struct Dispatcher
+    {
+        const char * name;
+        nvtt::TaskDispatcher * dispatcher;
+        bool scalable;      // False when the thread count of the dispatcher can't be set, it only runs at its default.
+    };
+
+    static TaskScheduler * s_scheduler = NULL;
+
+    static void setThreadCount(uint threadCount)
+    {
+        // ParallelFor's pools: the calling thread waits for the workers.
+        ThreadPool::setWorkerCount(threadCount);
+
+        // The work stealing scheduler: the calling thread takes part in the work.
+        TaskScheduler::setGlobal(NULL);
+        delete s_scheduler;
+        s_scheduler = new TaskScheduler(threadCount - 1);
+        TaskScheduler::setGlobal(s_scheduler);
+
+#if defined(HAVE_OPENMP)
+        omp_set_num_threads(threadCount);
+#endif
+    }
+
+    static void resetThreadCount()
+    {
+        ThreadPool::setWorkerCount(~0U);
+        TaskScheduler::setGlobal(NULL);
+        delete s_scheduler;
+        s_scheduler = NULL;
+#if defined(HAVE_OPENMP)
+        omp_set_num_threads(hardwareThreadCount());
+#endif
+    }
+
+
+    struct NullOutputHandler : public nvtt::OutputHandler
+    {
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel) {}
+        virtual bool writeData(const void * data, int size) { return true; }
+        virtual void endImage() {}
+    };
+
+    struct Workload
+    {
+        virtual ~Workload() {}
+        virtual const char * name() const = 0;
+        virtual void run(nvtt::TaskDispatcher * dispatcher) = 0;
+    };
+
+    // Compress the mipmaps of an image with the dispatcher of the compressor.
+    struct CompressWorkload : public Workload
+    {
+        CompressWorkload(const char * name, const nvtt::Surface & image, nvtt::Format format, nvtt::Quality quality) : m_name(name), m_image(image)
+        {
+            m_compressionOptions.setFormat(format);
+            m_compressionOptions.setQuality(quality);
+            m_outputOptions.setOutputHandler(&m_outputHandler);
+            m_context.enableCudaAcceleration(false);
+        }
+
+        virtual const char * name() const { return m_name; }
+
+        virtual void run(nvtt::TaskDispatcher * dispatcher)
+        {
+            m_context.setTaskDispatcher(dispatcher);
+
+            nvtt::Surface image = m_image;
+            int mipmap = 0;
+            do {
+                m_context.compress(image, 0, mipmap++, m_compressionOptions, m_outputOptions);
+            } while (image.buildNextMipmap(nvtt::MipmapFilter_Box));
+        }
+
+        const char * m_name;
+        const nvtt::Surface & m_image;
+        nvtt::Compressor m_context;
+        nvtt::CompressionOptions m_compressionOptions;
+        nvtt::OutputOptions m_outputOptions;
+        NullOutputHandler m_outputHandler;
+    };
+
+    // Build the mipmap chains of a batch of small images, one task per image. The surface operations don't take a
+    // dispatcher, so the images are split between the threads of the dispatcher instead.
+    struct MipmapWorkload : public Workload
+    {
+        MipmapWorkload(const nvtt::Surface & image, int count) : m_image(image), m_count(count) {}
+
+        virtual const char * name() const { return "mipmaps"; }
+
+        static void task(void * context, int i)
+        {
+            MipmapWorkload * w = (MipmapWorkload *)context;
+            nvtt::Surface image = w->m_image;
+            image.toLinear(2.2f);
+            while (image.buildNextMipmap(nvtt::MipmapFilter_Kaiser)) {}
+        }
+
+        virtual void run(nvtt::TaskDispatcher * dispatcher)
+        {
+            dispatcher->dispatch(task, this, m_count);
+        }
+
+        const nvtt::Surface & m_image;
+        int m_count;
+    };
+
+    static void emptyTask(void * context, int i) {}
+
+    // Microseconds per dispatch of tasks that do nothing, one per thread and a few more.
+    static double dispatchOverhead(nvtt::TaskDispatcher * dispatcher, uint threadCount)
+    {
+        const int dispatchCount = 2000;
+        const int taskCount = int(threadCount) * 4;
+
+        dispatcher->dispatch(emptyTask, NULL, taskCount);
+
+        Timer timer;
+        timer.start();
+        for (int i = 0; i < dispatchCount; i++) {
+            dispatcher->dispatch(emptyTask, NULL, taskCount);
+        }
+        timer.stop();
+
+        return 1e6 * timer.elapsed() / dispatchCount;
+    }
+
+    // Median of the runs, after an untimed one.
+    static double timeWorkload(Workload * workload, nvtt::TaskDispatcher * dispatcher, int runCount)
+    {
+        workload->run(dispatcher);
+
+        Array<double> times;
+        for (int i = 0; i < runCount; i++)
+        {
+            Timer timer;
+            timer.start();
+            workload->run(dispatcher);
+            timer.stop();
+
+            double t = timer.elapsed();
+            uint j = times.count();
+            times.append(t);
+            for (; j > 0 && times[j - 1] > t; j--) times[j] = times[j - 1];
+            times[j] = t;
+        }
+        return times[times.count() / 2];
+    }
+
+    // Smooth colors with a little detail, so that the compressors have some work to do on every block.
+    static void makeImage(int size, nvtt::Surface & image)
+    {
+        Array<float> rgba;
+        rgba.resize(size * size * 4);
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                float * p = rgba.buffer() + (y * size + x) * 4;
+                p[0] = 0.5f + 0.45f * sinf(x * 0.071f + y * 0.013f);
+                p[1] = 0.5f + 0.40f * sinf(x * 0.023f - y * 0.057f + 1.0f);
+                p[2] = 0.5f + 0.25f * sinf((x ^ y) * 0.37f);
+                p[3] = 0.5f + 0.5f * sinf(x * 0.011f + y * 0.031f);
+            }
+        }
+        image.setImage(nvtt::InputFormat_RGBA_32F, size, size, 1, rgba.buffer());
+    }
+
+    static bool parseThreadCounts(const char * str, Array<uint> & counts)
+    {
+        while (*str != '\0') {
+            char * end;
+            long n = strtol(str, &end, 10);
+            if (end == str || n <= 0) return false;
+            counts.append(uint(n));
+            str = end;
+            if (*str == ',') str++;
+        }
+        return counts.count() > 0;
+    }
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    MyAssertHandler assertHandler;
+    MyMessageHandler messageHandler;
+
+    int size = 256;
+    int runCount = 3;
+    const char * dispatcherFilter = NULL;
+    const char * workloadFilter = NULL;
+    const char * imageName = NULL;
+    Array<uint> threadCounts;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp("-size", argv[i]) == 0 && i+1 < argc) size = max(atoi(argv[++i]), 4);
+        else if (strcmp("-runs", argv[i]) == 0 && i+1 < argc) runCount = max(atoi(argv[++i]), 1);
+        else if (strcmp("-dispatcher", argv[i]) == 0 && i+1 < argc) dispatcherFilter = argv[++i];
+        else if (strcmp("-workload", argv[i]) == 0 && i+1 < argc) workloadFilter = argv[++i];
+        else if (strcmp("-threads", argv[i]) == 0 && i+1 < argc)
+        {
+            if (!parseThreadCounts(argv[++i], threadCounts)) {
+                fprintf(stderr, "-threads expects a comma separated list of thread counts.\n");
+                return EXIT_FAILURE;
+            }
+        }
+        else if (argv[i][0] != '-') imageName = argv[i];
+        else
+        {
+            printf("usage: dispatchbench [options] [image]\n\n");
+            printf("  -size <n>         \tSize of the synthetic image when none is given (default 256).\n");
+            printf("  -runs <n>         \tTimed runs of each measurement, the median is reported (default 3).\n");
+            printf("  -threads <list>   \tComma separated thread counts (default 1, 2, 4... up to the hardware threads).\n");
+            printf("  -dispatcher <name>\tOnly this dispatcher: sequential, parallelfor, workstealing, openmp, gcd, ppl or tbb.\n");
+            printf("  -workload <name>  \tOnly the workloads whose name contains this string.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    const uint hardwareThreads = hardwareThreadCount();
+    if (threadCounts.isEmpty()) {
+        for (uint n = 1; n < hardwareThreads; n *= 2) threadCounts.append(n);
+        threadCounts.append(hardwareThreads);
+    }
+
+    nvtt::Surface image;
+    if (imageName != NULL) {
+        if (!image.load(imageName)) {
+            fprintf(stderr, "Error opening '%s'.\n", imageName);
+            return EXIT_FAILURE;
+        }
+    }
+    else {
+        makeImage(size, image);
+    }
+
+    nvtt::Surface smallImage = image;
+    smallImage.resize(64, 64, 1, nvtt::ResizeFilter_Box);
+
+    nvtt::SequentialTaskDispatcher sequential;
+    nvtt::ParallelTaskDispatcher parallelFor;
+    nvtt::WorkStealingTaskDispatcher workStealing;
+#if defined(HAVE_OPENMP)
+    nvtt::OpenMPTaskDispatcher openMP;
+#endif
+#if defined(HAVE_GCD)
+    nvtt::AppleTaskDispatcher gcd;
+#endif
+#if defined(HAVE_PPL)
+    nvtt::MicrosoftTaskDispatcher ppl;
+#endif
+#if defined(HAVE_TBB)
+    nvtt::IntelTaskDispatcher tbb;
+#endif
+
+    const Dispatcher dispatchers[] = {
+        { "sequential", &sequential, false },
+        { "parallelfor", &parallelFor, true },
+        { "workstealing", &workStealing, true },
+#if defined(HAVE_OPENMP)
+        { "openmp", &openMP, true },
+#endif
+#if defined(HAVE_GCD)
+        { "gcd", &gcd, false },
+#endif
+#if defined(HAVE_PPL)
+        { "ppl", &ppl, false },
+#endif
+#if defined(HAVE_TBB)
+        { "tbb", &tbb, false },
+#endif
+    };
+    const uint dispatcherCount = sizeof(dispatchers) / sizeof(dispatchers[0]);
+
+    CompressWorkload bc1("BC1 fast", image, nvtt::Format_BC1, nvtt::Quality_Fastest);
+    CompressWorkload bc3("BC3 production", image, nvtt::Format_BC3, nvtt::Quality_Production);
+    CompressWorkload bc7("BC7", image, nvtt::Format_BC7, nvtt::Quality_Normal);
+    MipmapWorkload mipmaps(smallImage, 64);
+    Workload * const workloads[] = { &bc1, &bc3, &bc7, &mipmaps };
+    const uint workloadCount = sizeof(workloads) / sizeof(workloads[0]);
+
+    printf("%dx%d image, %u hardware threads, median of %d runs.\n\n", image.width(), image.height(), hardwareThreads, runCount);
+    printf("%-16s %-13s %8s %12s %9s %11s %14s\n", "workload", "dispatcher", "threads", "time (ms)", "speedup", "efficiency", "dispatch (us)");
+
+    for (uint w = 0; w < workloadCount; w++)
+    {
+        if (workloadFilter != NULL && strstr(workloads[w]->name(), workloadFilter) == NULL) continue;
+
+        for (uint d = 0; d < dispatcherCount; d++)
+        {
+            const Dispatcher & dispatcher = dispatchers[d];
+            if (dispatcherFilter != NULL && !strEqual(dispatcherFilter, dispatcher.name)) continue;
+
+            // The dispatchers whose thread count can't be set run once, with the threads they choose.
+            const uint sweepCount = dispatcher.scalable ? threadCounts.count() : 1;
+
+            double baseline = 0.0;
+            for (uint t = 0; t < sweepCount; t++)
+            {
+                const uint threadCount = dispatcher.scalable ? threadCounts[t] : (d == 0 ? 1 : hardwareThreads);
+                if (dispatcher.scalable) setThreadCount(threadCount);
+
+                const double seconds = timeWorkload(workloads[w], dispatcher.dispatcher, runCount);
+                const double overhead = dispatchOverhead(dispatcher.dispatcher, threadCount);
+
+                if (t == 0) baseline = seconds * (dispatcher.scalable ? threadCounts[0] : 1);
+                const double speedup = baseline / seconds;
+
+                printf("%-16s %-13s %8u %12.2f %8.2fx %10.0f%% %14.2f\n", workloads[w]->name(), dispatcher.name, threadCount,
+                    1000 * seconds, speedup, 100 * speedup / threadCount, overhead);
+            }
+
+            resetThreadCount();
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,215 @@
+// This code is in the public domain -- castano@gmail.com
+
+// Compares ConcurrentHashMap against mutex guarded maps with the access pattern of a cache:
+// every thread looks up random keys and inserts the ones it misses.
+
+#include <nvthread/ConcurrentHashMap.h>
+#include <nvthread/Mutex.h>
+#include <nvthread/Thread.h>
+#include <nvcore/Timer.h>
+#include <nvcore/Hash.h>
+#include <nvcore/StrLib.h>
+
+#include "../tools/cmdline.h"
+
+#include <stdlib.h> // EXIT_SUCCESS, EXIT_FAILURE, atoi
+#include <stdio.h> // printf
+#include <string.h> // memcmp
+
+using namespace nv;
+
+namespace
+{
+    struct Key
+    {
+        uint32 words[8];
+        bool operator==(const Key & other) const { return memcmp(words, other.words, sizeof(words)) == 0; }
+    };
+
+    struct Value
+    {
+        uint32 words[4];
+    };
+
+    static void makeKey(uint32 id, Key * key, Value * value, uint32 * hash)
+    {
+        for (uint i = 0; i < 8; i++) key->words[i] = id * 8 + i;
+        for (uint i = 0; i < 4; i++) value->words[i] = ~id;
+        *hash = sdbmHash(key->words, sizeof(key->words));
+    }
+
+    // A table with the same capacity and eviction policy, guarded by MutexCount mutexes. Keys are probed
+    // in aligned groups of ProbeCount slots so that each group is protected by a single mutex.
+    template <uint MutexCount>
+    class MutexHashMap
+    {
+    public:
+        enum { ProbeCount = 8 };
+
+        explicit MutexHashMap(uint capacity)
+        {
+            const uint count = nextPowerOfTwo(max(capacity, uint(ProbeCount)));
+            m_slots = new Slot[count];
+            m_mask = count - 1;
+            m_clock = 0;
+            for (uint i = 0; i < count; i++) m_slots[i].used = false;
+        }
+        ~MutexHashMap() { delete [] m_slots; }
+
+        bool lookup(uint32 hash, const Key & key, Value * value)
+        {
+            const uint first = hash & m_mask & ~(ProbeCount - 1);
+            Lock<Mutex> lock(m_mutexes[(first / ProbeCount) % MutexCount]);
+
+            for (uint i = 0; i < ProbeCount; i++) {
+                const Slot & slot = m_slots[first + i];
+                if (slot.used && slot.hash == hash && slot.key == key) {
+                    *value = slot.value;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool insert(uint32 hash, const Key & key, const Value & value)
+        {
+            const uint first = hash & m_mask & ~(ProbeCount - 1);
+            Lock<Mutex> lock(m_mutexes[(first / ProbeCount) % MutexCount]);
+
+            const uint32 stamp = atomicIncrement(&m_clock);
+
+            Slot * victim = NULL;
+            for (uint i = 0; i < ProbeCount; i++) {
+                Slot & slot = m_slots[first + i];
+                if (!slot.used || (slot.hash == hash && slot.key == key)) {
+                    victim = &slot;
+                    break;
+                }
+                if (victim == NULL || stamp - slot.stamp > stamp - victim->stamp) victim = &slot;
+            }
+
+            victim->used = true;
+            victim->hash = hash;
+            victim->stamp = stamp;
+            victim->key = key;
+            victim->value = value;
+            return true;
+        }
+
+    private:
+        struct Slot
+        {
+            bool used;
+            uint32 hash;
+            uint32 stamp;
+            Key key;
+            Value value;
+        };
+
+        Mutex m_mutexes[MutexCount];
+        Slot * m_slots;
+        uint m_mask;
+        uint32 m_clock;
+    };
+
+    template <typename Map>
+    struct Context
+    {
+        Map * map;
+        uint keyCount;
+        uint opCount;
+        uint32 hits;
+        uint32 errors;
+    };
+
+    template <typename Map>
+    static void run(void * arg)
+    {
+        Context<Map> * ctx = (Context<Map> *)arg;
+
+        uint32 seed = sdbmHash(&arg, sizeof(arg)) | 1;
+        uint hits = 0, errors = 0;
+
+        for (uint i = 0; i < ctx->opCount; i++) {
+            seed = seed * 1664525 + 1013904223;
+            const uint32 id = (seed >> 8) % ctx->keyCount;
+
+            Key key;
+            Value value, cached;
+            uint32 hash;
+            makeKey(id, &key, &value, &hash);
+
+            if (ctx->map->lookup(hash, key, &cached)) {
+                hits++;
+                if (memcmp(&cached, &value, sizeof(Value)) != 0) errors++;
+            }
+            else {
+                ctx->map->insert(hash, key, value);
+            }
+        }
+
+        atomicAdd(&ctx->hits, hits);
+        atomicAdd(&ctx->errors, errors);
+    }
+
+    template <typename Map>
+    static bool benchmark(const char * name, uint threadCount, uint capacity, uint opCount)
+    {
+        Map map(capacity);
+
+        Context<Map> ctx;
+        ctx.map = &map;
+        ctx.keyCount = capacity;    // The working set exceeds what the probe windows can hold, so eviction is exercised.
+        ctx.opCount = opCount;
+        ctx.hits = 0;
+        ctx.errors = 0;
+
+        Thread * threads = new Thread[threadCount];
+
+        Timer timer;
+        timer.start();
+        for (uint i = 0; i < threadCount; i++) threads[i].start(run<Map>, &ctx);
+        Thread::wait(threads, threadCount);
+        timer.stop();
+
+        delete [] threads;
+
+        const float total = float(threadCount) * opCount;
+        printf("%-24s %8.3f s %8.2f Mops/s  hit rate %5.1f%%  errors %u\n", name, timer.elapsed(),
+            total / timer.elapsed() * 1e-6f, 100.0f * ctx.hits / total, ctx.errors);
+
+        return ctx.errors == 0;
+    }
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    MyAssertHandler assertHandler;
+    MyMessageHandler messageHandler;
+
+    uint threadCount = 32;
+    uint capacity = 1 << 16;
+    uint opCount = 1 << 20;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strCaseDiff("-threads", argv[i]) == 0 && i+1 < argc) threadCount = atoi(argv[++i]);
+        else if (strCaseDiff("-capacity", argv[i]) == 0 && i+1 < argc) capacity = atoi(argv[++i]);
+        else if (strCaseDiff("-ops", argv[i]) == 0 && i+1 < argc) opCount = atoi(argv[++i]);
+        else {
+            printf("usage: hashmapbench [-threads n] [-capacity n] [-ops n]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%u threads, capacity %u, %u operations per thread\n", threadCount, capacity, opCount);
+
+    bool ok = true;
+    ok &= benchmark< MutexHashMap<1> >("Mutex", threadCount, capacity, opCount);
+    ok &= benchmark< MutexHashMap<64> >("64 striped mutexes", threadCount, capacity, opCount);
+    ok &= benchmark< ConcurrentHashMap<Key, Value> >("ConcurrentHashMap", threadCount, capacity, opCount);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,147 @@
+// This code is in the public domain -- castano@gmail.com
+
+// Measures the startup cost of short lived processes like nvcompress: each run is a new process that compresses a single
+// block, so every table and pool it needs is set up from scratch. Reports the time of the whole process, the time from
+// main to the first compressed block, and the time of the same block once everything is set up.
+
+#include <nvtt/nvtt.h>
+
+#include <nvcore/Timer.h>
+#include <nvcore/StrLib.h>
+#include <nvcore/Array.inl>
+
+#include "../tools/cmdline.h"
+
+#include <stdlib.h> // EXIT_SUCCESS, EXIT_FAILURE, atoi
+#include <stdio.h> // printf, popen
+
+#if NV_OS_WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+using namespace nv;
+
+namespace
+{
+    struct Format
+    {
+        const char * name;
+        nvtt::Format format;
+    };
+
+    static const Format s_formats[] = {
+        { "bc1", nvtt::Format_BC1 },
+        { "bc3", nvtt::Format_BC3 },
+        { "bc4", nvtt::Format_BC4 },
+        { "bc5", nvtt::Format_BC5 },
+        { "bc6", nvtt::Format_BC6 },
+        { "bc7", nvtt::Format_BC7 },
+    };
+    static const int s_formatCount = sizeof(s_formats) / sizeof(s_formats[0]);
+
+    struct NullOutputHandler : public nvtt::OutputHandler
+    {
+        virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel) {}
+        virtual bool writeData(const void * data, int size) { return true; }
+        virtual void endImage() {}
+    };
+
+    static float median(Array<float> & values)
+    {
+        // Few runs, an insertion sort is enough.
+        for (uint i = 1; i < values.count(); i++) {
+            for (uint j = i; j > 0 && values[j - 1] > values[j]; j--) swap(values[j - 1], values[j]);
+        }
+        return values[values.count() / 2];
+    }
+
+    // The work of the child process, prints the time of the first block and of the second one in microseconds.
+    static int runChild(int formatIndex)
+    {
+        Timer timer;
+        timer.start();
+
+        uint8 texels[4 * 4 * 4];
+        for (int i = 0; i < 4 * 4 * 4; i++) texels[i] = uint8(i * 37);
+
+        nvtt::Surface image;
+        image.setImage(nvtt::InputFormat_BGRA_8UB, 4, 4, 1, texels);
+
+        nvtt::Compressor context;
+        context.enableCudaAcceleration(false);
+
+        nvtt::CompressionOptions compressionOptions;
+        compressionOptions.setFormat(s_formats[formatIndex].format);
+
+        NullOutputHandler outputHandler;
+        nvtt::OutputOptions outputOptions;
+        outputOptions.setOutputHandler(&outputHandler);
+
+        context.compress(image, 0, 0, compressionOptions, outputOptions);
+        timer.stop();
+        const float first = timer.elapsed();
+
+        timer.start();
+        context.compress(image, 0, 0, compressionOptions, outputOptions);
+        timer.stop();
+        const float warm = timer.elapsed();
+
+        printf("%f %f\n", first * 1e6f, warm * 1e6f);
+        return EXIT_SUCCESS;
+    }
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    MyAssertHandler assertHandler;
+    MyMessageHandler messageHandler;
+
+    int runCount = 5;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strCaseDiff("-child", argv[i]) == 0 && i+1 < argc) return runChild(clamp(atoi(argv[i+1]), 0, s_formatCount - 1));
+        else if (strCaseDiff("-runs", argv[i]) == 0 && i+1 < argc) runCount = max(atoi(argv[++i]), 1);
+        else {
+            printf("usage: startupbench [-runs n]\n\n");
+            printf("  -runs <n>     \tProcesses started for each format, the median is reported (default 5).\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("Median of %d processes.\n\n", runCount);
+    printf("%-8s %14s %18s %16s\n", "format", "process (ms)", "first block (us)", "warm block (us)");
+
+    for (int f = 0; f < s_formatCount; f++) {
+        Array<float> processTimes, firstTimes, warmTimes;
+
+        for (int r = 0; r < runCount; r++) {
+            StringBuilder command;
+            command.format("\"%s\" -child %d", argv[0], f);
+
+            Timer timer;
+            timer.start();
+            FILE * child = popen(command.str(), "r");
+            float first = 0, warm = 0;
+            const bool ok = child != NULL && fscanf(child, "%f %f", &first, &warm) == 2;
+            if (child != NULL) pclose(child);
+            timer.stop();
+
+            if (!ok) {
+                fprintf(stderr, "Error running '%s'.\n", command.str());
+                return EXIT_FAILURE;
+            }
+
+            processTimes.append(timer.elapsed());
+            firstTimes.append(first);
+            warmTimes.append(warm);
+        }
+
+        printf("%-8s %14.2f %18.1f %16.1f\n", s_formats[f].name, median(processTimes) * 1000, median(firstTimes), median(warmTimes));
+    }
+
+    return EXIT_SUCCESS;
+}
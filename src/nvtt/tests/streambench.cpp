@@ -0,0 +1,134 @@
+// This code is in the public domain -- castano@gmail.com
+
+// Measures what the non-temporal stores of the large buffers save: runs the input conversion and the resize of a large
+// image with and without them, and times how long it takes to read back a working set that was in cache before each run.
+
+#include <nvtt/nvtt.h>
+
+#include <nvcore/CpuInfo.h>
+#include <nvcore/Timer.h>
+#include <nvcore/StrLib.h>
+#include <nvcore/Array.inl>
+
+#include "../tools/cmdline.h"
+
+#include <stdlib.h> // EXIT_SUCCESS, EXIT_FAILURE, atoi
+#include <stdio.h> // printf
+
+using namespace nv;
+
+namespace
+{
+    struct Result
+    {
+        float time;         // Of the workload, in seconds.
+        float readBack;     // Of the working set after the workload, in seconds.
+    };
+
+    static float median(Array<float> & values)
+    {
+        // Few runs, an insertion sort is enough.
+        for (uint i = 1; i < values.count(); i++) {
+            for (uint j = i; j > 0 && values[j - 1] > values[j]; j--) swap(values[j - 1], values[j]);
+        }
+        return values[values.count() / 2];
+    }
+
+    static volatile float s_sink;
+
+    static void readWorkingSet(const Array<float> & workingSet)
+    {
+        float sum = 0.0f;
+        for (uint i = 0; i < workingSet.count(); i += 16) sum += workingSet[i];    // One read per cache line.
+        s_sink = sum;
+    }
+
+    // 0 converts the texels, 1 resizes the image.
+    static Result run(int workload, const Array<uint32> & texels, int size, int resizedSize, Array<float> & workingSet, int runCount)
+    {
+        Array<float> times, readBacks;
+
+        for (int r = 0; r < runCount; r++) {
+            nvtt::Surface surface;
+            if (workload == 1) surface.setImage(nvtt::InputFormat_BGRA_8UB, size, size, 1, texels.buffer());
+
+            readWorkingSet(workingSet);
+
+            Timer timer;
+            timer.start();
+            if (workload == 0) surface.setImage(nvtt::InputFormat_BGRA_8UB, size, size, 1, texels.buffer());
+            else surface.resize(resizedSize, resizedSize, 1, nvtt::ResizeFilter_Triangle);
+            timer.stop();
+            times.append(timer.elapsed());
+
+            timer.start();
+            readWorkingSet(workingSet);
+            timer.stop();
+            readBacks.append(timer.elapsed());
+        }
+
+        Result result;
+        result.time = median(times);
+        result.readBack = median(readBacks);
+        return result;
+    }
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+    MyAssertHandler assertHandler;
+    MyMessageHandler messageHandler;
+
+    int size = 2048;
+    int workingSetSize = 1024;      // In KB.
+    int runCount = 5;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strCaseDiff("-size", argv[i]) == 0 && i+1 < argc) size = max(atoi(argv[++i]), 4);
+        else if (strCaseDiff("-working", argv[i]) == 0 && i+1 < argc) workingSetSize = max(atoi(argv[++i]), 1);
+        else if (strCaseDiff("-runs", argv[i]) == 0 && i+1 < argc) runCount = max(atoi(argv[++i]), 1);
+        else {
+            printf("usage: streambench [-size n] [-working kb] [-runs n]\n\n");
+            printf("  -size <n>     \tSize of the synthetic image, the resize writes one 3/4 its size (default 2048).\n");
+            printf("  -working <kb> \tSize of the working set that is read back after each workload (default 1024).\n");
+            printf("  -runs <n>     \tTimed runs of each measurement, the median is reported (default 5).\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    Array<uint32> texels;
+    texels.resize(size * size);
+    uint32 seed = 1;
+    for (uint i = 0; i < texels.count(); i++) {
+        seed = seed * 1664525 + 1013904223;
+        texels[i] = seed;
+    }
+
+    Array<float> workingSet;
+    workingSet.resize(workingSetSize * 1024 / sizeof(float), 1.0f);
+
+    const int resizedSize = size * 3 / 4;
+    const char * names[2] = { "convert", "resize" };
+    const float outputBytes[2] = { float(size) * size * 16, float(resizedSize) * resizedSize * 16 };
+
+    printf("%dx%d image, %d KB working set, median of %d runs.\n\n", size, size, workingSetSize, runCount);
+    printf("%-10s %-10s %12s %12s %18s\n", "workload", "stores", "time (ms)", "write GB/s", "read back (us)");
+
+    for (int w = 0; w < 2; w++) {
+        for (int streaming = 1; streaming >= 0; streaming--) {
+            setCpuFeatureMask(streaming ? ~0U : ~uint(CpuFeature_StreamingStores));
+            if (streaming && (cpuFeatures() & CpuFeature_StreamingStores) == 0) continue;
+
+            const Result result = run(w, texels, size, resizedSize, workingSet, runCount);
+            printf("%-10s %-10s %12.2f %12.2f %18.2f\n", names[w], streaming ? "streaming" : "cached",
+                result.time * 1000, outputBytes[w] / result.time * 1e-9f, result.readBack * 1e6f);
+        }
+    }
+
+    setCpuFeatureMask(~0U);
+
+    return EXIT_SUCCESS;
+}
@@ -35,8 +35,11 @@
 #include <nvcore/FileSystem.h>
 #include <nvcore/Timer.h>
 
+#include <nvcore/Array.inl>
+
 #include <stdlib.h> // free
 #include <string.h> // memcpy
+#include <stdio.h> // fgets, sscanf
 
 #include "../tools/cmdline.h"
 
@@ -290,6 +293,11 @@ struct MyOutputHandler : public nvtt::OutputHandler
 
     nvtt::Surface decompress(Mode mode, nvtt::Format format, nvtt::Decoder decoder)
     {
+        // The YCoCg and RGBM blocks are BC3 blocks, the caller converts the channels back to RGB.
+        if (format == nvtt::Format_BC3_YCoCg || format == nvtt::Format_BC3_RGBM) format = nvtt::Format_BC3;
+        // The normal blocks are BC5 blocks, the caller reconstructs the normals.
+        if (format == nvtt::Format_BC5_Normal) format = nvtt::Format_BC5;
+
         nvtt::Surface img;
         img.setImage2D(format, decoder, m_width, m_height, m_data);
         return img;
@@ -307,6 +315,69 @@ enum ErrorMode {
     ErrorMode_CieLab,
     ErrorMode_AngularRMSE
 };
+static const char * s_errorModeNames[] = {
+    "RMSE",         // ErrorMode_RMSE
+    "CieLab",       // ErrorMode_CieLab
+    "AngularRMSE",  // ErrorMode_AngularRMSE
+};
+
+
+// One line of the results file: the time and error of an image compressed with a mode.
+struct Result
+{
+    char set[64];
+    char mode[64];
+    char image[128];
+    char quality[16];
+    char metric[16];
+    int width, height;
+    float time;
+    float error;
+
+    bool matches(const Result & other) const
+    {
+        return strEqual(set, other.set) && strEqual(mode, other.mode) && strEqual(image, other.image) &&
+            strEqual(quality, other.quality) && strEqual(metric, other.metric);
+    }
+};
+
+static const char * s_resultsHeader = "set,mode,image,quality,metric,width,height,seconds,mpixels_per_second,error";
+
+static void writeResult(FILE * fp, const Result & r)
+{
+    const float mpixels = float(r.width) * float(r.height) / 1000000.0f;
+    fprintf(fp, "%s,%s,%s,%s,%s,%d,%d,%.6f,%.3f,%.6f\n", r.set, r.mode, r.image, r.quality, r.metric,
+        r.width, r.height, r.time, r.time > 0 ? mpixels / r.time : 0.0f, r.error);
+}
+
+static bool loadResults(const char * fileName, Array<Result> & results)
+{
+    FILE * fp = fileOpen(fileName, "rb");
+    if (fp == NULL) return false;
+
+    char line[512];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        Result r;
+        float throughput;
+        if (sscanf(line, "%63[^,],%63[^,],%127[^,],%15[^,],%15[^,],%d,%d,%f,%f,%f", r.set, r.mode, r.image, r.quality, r.metric,
+            &r.width, &r.height, &r.time, &throughput, &r.error) == 10)
+        {
+            results.append(r);
+        }
+    }
+
+    fclose(fp);
+    return true;
+}
+
+static const Result * findResult(const Array<Result> & results, const Result & r)
+{
+    for (uint i = 0; i < results.count(); i++) {
+        if (results[i].matches(r)) return &results[i];
+    }
+    return NULL;
+}
 
 
 int main(int argc, char *argv[])
@@ -331,6 +402,10 @@ int main(int argc, char *argv[])
     Path basePath = "";
     const char * outPath = "output";
     const char * regressPath = NULL;
+    const char * resultsPath = NULL;
+    const char * baselinePath = NULL;
+    float timeTolerance = 0.25f;
+    float errorTolerance = 0.01f;
 
     // Parse arguments.
     for (int i = 1; i < argc; i++)
@@ -403,6 +478,34 @@ int main(int argc, char *argv[])
                 regressPath = argv[i+1];
                 i++;
             }
+        }
+        else if (strcmp("-results", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                resultsPath = argv[i+1];
+                i++;
+            }
+        }
+        else if (strcmp("-baseline", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                baselinePath = argv[i+1];
+                i++;
+            }
+        }
+        else if (strcmp("-timetol", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                timeTolerance = float(atof(argv[i+1]));
+                i++;
+            }
+        }
+        else if (strcmp("-errtol", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                errorTolerance = float(atof(argv[i+1]));
+                i++;
+            }
         }
 		else
 		{
@@ -450,6 +553,12 @@ int main(int argc, char *argv[])
         printf("    0:           \tRMSE (default).\n");
         printf("    1:           \tCieLab.\n");
         printf("    2:           \tAngular RMSE.\n");
+        printf("  -results <file>\tWrite the time and error of every image to a csv file.\n");
+        printf("\n");
+        printf("Regression options:\n");
+        printf("  -baseline <file>\tCompare against the results file of an earlier run.\n");
+        printf("  -timetol <f>   \tAllowed relative increase of the compression time of a mode (default 0.25).\n");
+        printf("  -errtol <f>    \tAllowed relative increase of the error of an image (default 0.01).\n");
 
         return 1;
     }
@@ -483,6 +592,23 @@ int main(int argc, char *argv[])
     nvtt::Context context;
     context.enableCudaAcceleration(!nocuda);
 
+    // Open the results and the baseline before moving to the image directory, their paths are relative to the current one.
+    Array<Result> baseline;
+    if (baselinePath != NULL && !loadResults(baselinePath, baseline)) {
+        printf("Baseline '%s' not found.\n", baselinePath);
+        return EXIT_FAILURE;
+    }
+
+    FILE * resultsFile = NULL;
+    if (resultsPath != NULL) {
+        resultsFile = fileOpen(resultsPath, "wb");
+        if (resultsFile == NULL) {
+            printf("Error opening '%s'.\n", resultsPath);
+            return EXIT_FAILURE;
+        }
+        fprintf(resultsFile, "%s\n", s_resultsHeader);
+    }
+
     basePath.append(set.basePath);
 
     FileSystem::changeDirectory(basePath.str());
@@ -587,6 +713,7 @@ int main(int argc, char *argv[])
     Timer timer;
     //int failedTests = 0;
     //float totalDiff = 0;
+    int regressionCount = 0;
 
     nvtt::Surface img;
 
@@ -598,6 +725,11 @@ int main(int argc, char *argv[])
     {
         float totalCompressionTime = 0;
         float totalError = 0;
+        float totalPixels = 0;
+
+        // Compression time of the images that are also in the baseline, and their time in the baseline.
+        float matchedTime = 0;
+        float baselineTime = 0;
 
         Mode mode = test.modes[t];
 
@@ -605,14 +737,20 @@ int main(int argc, char *argv[])
         if (mode == Mode_BC1 || mode == Mode_BC1_Alpha || mode == Mode_BC1_Normal || mode == Mode_BC3_RGBS) {
             format = nvtt::Format_BC1;
         }
-        else if (mode == Mode_BC3_Alpha || mode == Mode_BC3_YCoCg || mode == Mode_BC3_RGBM || mode == Mode_BC3_LUVW) {
+        else if (mode == Mode_BC3_Alpha || mode == Mode_BC3_LUVW) {
             format = nvtt::Format_BC3;
         }
+        else if (mode == Mode_BC3_RGBM) {
+            format = nvtt::Format_BC3_RGBM;
+        }
+        else if (mode == Mode_BC3_YCoCg) {
+            format = nvtt::Format_BC3_YCoCg;
+        }
         else if (mode == Mode_BC3_Normal) {
             format = nvtt::Format_BC3n;
         }
         else if (mode == Mode_BC5_Normal || mode == Mode_BC5_Normal_Stereographic || mode == Mode_BC5_Normal_Paraboloid || mode == Mode_BC5_Normal_Quartic) {
-            format = nvtt::Format_BC5;
+            format = nvtt::Format_BC5_Normal;
         }
 		else if (mode == Mode_BC6)
 		{
@@ -681,28 +819,20 @@ int main(int argc, char *argv[])
                         tmp.clamp(i);
                     }*/
                 }
-                tmp.toYCoCg();          // Y=3, Co=0, Cg=1
-                tmp.blockScaleCoCg();   // Co=0, Cg=1, Scale=2, ScaleBits = 5
-
-                tmp.scaleBias(0, 123.0f/255.0f, 123.0f/255.0f); tmp.clamp(0, 0, 246.0f/255.0f); // -1->0, 0->123, 1->246
-                tmp.scaleBias(1, 125.0f/255.0f, 125.0f/255.0f); tmp.clamp(1, 0, 250.0f/255.0f); // -1->0, 0->125, 1->250
-
-                //tmp.scaleBias(0, 0.5f, 0.5f); tmp.clamp(0);
-                //tmp.scaleBias(1, 0.5f, 0.5f); tmp.clamp(1);
-
-                tmp.clamp(2);
-                tmp.clamp(3);
+                // The compressor converts the blocks: Y=3, Co=0, Cg=1, Scale=2, ScaleBits = 5
+                // Co: -1->0, 0->123, 1->246, Cg: -1->0, 0->125, 1->250
             }
             else if (mode == Mode_BC3_RGBM) {
                 tmp.setAlphaMode(nvtt::AlphaMode_None);
                 if (set.type == ImageType_HDR) {
 					// Transform to gamma-2.0 space before applying RGBM - helps a lot with banding in the darks.
 					tmp.toGamma(2.0f);
-                    tmp.toRGBM(3.0f);	// range of 3.0 in gamma-2.0 space == range of 9.0 in linear space
+                    compressionOptions.setRGBMParameters(3.0f, 0.25f);	// range of 3.0 in gamma-2.0 space == range of 9.0 in linear space
                 }
                 else {
-                    tmp.toRGBM();
+                    compressionOptions.setRGBMParameters(1.0f, 0.25f);
                 }
+                // The compressor converts the blocks to RGBM.
             }
             else if (mode == Mode_BC3_LUVW) {
                 tmp.setAlphaMode(nvtt::AlphaMode_None);
@@ -726,17 +856,18 @@ int main(int argc, char *argv[])
                 tmp.swizzle(0, 3, 1, 4); // Co Cg 1 Y -> Co Y Cg 1
                 tmp.copyChannel(img, 3); // Restore alpha channel for weighting.*/
             }
+            // The compressor transforms the normals.
             else if (mode == Mode_BC5_Normal) {
-                tmp.transformNormals(nvtt::NormalTransform_Orthographic);
+                compressionOptions.setNormalTransform(nvtt::NormalTransform_Orthographic);
             }
             else if (mode == Mode_BC5_Normal_Stereographic) {
-                tmp.transformNormals(nvtt::NormalTransform_Stereographic);
+                compressionOptions.setNormalTransform(nvtt::NormalTransform_Stereographic);
             }
             else if (mode == Mode_BC5_Normal_Paraboloid) {
-                tmp.transformNormals(nvtt::NormalTransform_Paraboloid);
+                compressionOptions.setNormalTransform(nvtt::NormalTransform_Paraboloid);
             }
             else if (mode == Mode_BC5_Normal_Quartic) {
-                tmp.transformNormals(nvtt::NormalTransform_Quartic);
+                compressionOptions.setNormalTransform(nvtt::NormalTransform_Quartic);
             }
             /*else if (mode == Mode_BC5_Normal_DualParaboloid) {
                 tmp.transformNormals(nvtt::NormalTransform_DualParaboloid);
@@ -750,8 +881,9 @@ int main(int argc, char *argv[])
             context.compress(tmp, 0, 0, compressionOptions, outputOptions);
 
             timer.stop();
-            printf("  Time:  \t%.3f sec\n", timer.elapsed());
+            printf("  Time:  \t%.3f sec (%.2f Mpixels/sec)\n", timer.elapsed(), tmp.width() * tmp.height() / (1000000 * max(timer.elapsed(), 1e-6f)));
             totalCompressionTime += timer.elapsed();
+            totalPixels += float(tmp.width()) * tmp.height();
 
             nvtt::Surface img_out = outputHandler.decompress(mode, format, decoder);
             img_out.setAlphaMode(img.alphaMode());
@@ -807,17 +939,23 @@ int main(int argc, char *argv[])
                 img_out.scaleBias(1, 1.0, -0.5);
                 img_out.fromYCoCg();*/
             }
-            else if (mode == Mode_BC5_Normal) {
-                img_out.reconstructNormals(nvtt::NormalTransform_Orthographic);
-            }
-            else if (mode == Mode_BC5_Normal_Stereographic) {
-                img_out.reconstructNormals(nvtt::NormalTransform_Stereographic);
-            }
-            else if (mode == Mode_BC5_Normal_Paraboloid) {
-                img_out.reconstructNormals(nvtt::NormalTransform_Paraboloid);
-            }
-            else if (mode == Mode_BC5_Normal_Quartic) {
-                img_out.reconstructNormals(nvtt::NormalTransform_Quartic);
+            else if (mode == Mode_BC5_Normal || mode == Mode_BC5_Normal_Stereographic || mode == Mode_BC5_Normal_Paraboloid || mode == Mode_BC5_Normal_Quartic) {
+                img_out.expandNormals(2.0f, -1.0f);
+
+                if (mode == Mode_BC5_Normal) {
+                    img_out.reconstructNormals(nvtt::NormalTransform_Orthographic);
+                }
+                else if (mode == Mode_BC5_Normal_Stereographic) {
+                    img_out.reconstructNormals(nvtt::NormalTransform_Stereographic);
+                }
+                else if (mode == Mode_BC5_Normal_Paraboloid) {
+                    img_out.reconstructNormals(nvtt::NormalTransform_Paraboloid);
+                }
+                else if (mode == Mode_BC5_Normal_Quartic) {
+                    img_out.reconstructNormals(nvtt::NormalTransform_Quartic);
+                }
+
+                img_out.packNormals();
             }
             /*else if (mode == Mode_BC5_Normal_DualParaboloid) {
                 tmp.transformNormals(nvtt::NormalTransform_DualParaboloid);
@@ -903,6 +1041,33 @@ int main(int argc, char *argv[])
             totalError += error;
             printf("  Error: \t%.4f\n", error);
 
+            Result result;
+            strCpySafe(result.set, set.name);
+            strCpySafe(result.mode, s_modeNames[mode]);
+            strCpySafe(result.image, set.fileNames[i]);
+            strCpySafe(result.quality, fast ? "fastest" : "production");
+            strCpySafe(result.metric, s_errorModeNames[errorMode]);
+            result.width = tmp.width();
+            result.height = tmp.height();
+            result.time = timer.elapsed();
+            result.error = error;
+
+            if (resultsFile != NULL) {
+                writeResult(resultsFile, result);
+            }
+
+            if (const Result * base = findResult(baseline, result))
+            {
+                matchedTime += result.time;
+                baselineTime += base->time;
+
+                // The time of a single image is too noisy to judge, the time is only checked for the whole mode.
+                if (result.error > base->error * (1 + errorTolerance) + 1e-6f) {
+                    printf("  REGRESSION: error %.4f, baseline %.4f\n", result.error, base->error);
+                    regressionCount++;
+                }
+            }
+
             graphWriter << error;
             if (i != set.fileCount-1) graphWriter << ",";
 
@@ -959,8 +1124,19 @@ int main(int argc, char *argv[])
 
         printf("Total Results:\n");
         printf("  Total Compression Time:\t%.3f sec\n", totalCompressionTime);
+        printf("  Throughput:            \t%.2f Mpixels/sec\n", totalPixels / (1000000 * max(totalCompressionTime, 1e-6f)));
         printf("  Average Error:         \t%.4f\n", totalError);
 
+        if (baselineTime > 0)
+        {
+            const float ratio = matchedTime / baselineTime;
+            printf("  Time vs Baseline:      \t%.2fx\n", ratio);
+            if (ratio > 1 + timeTolerance) {
+                printf("  REGRESSION: %s is %.2fx slower than the baseline\n", s_modeNames[mode], ratio);
+                regressionCount++;
+            }
+        }
+
         if (t != test.count-1) graphWriter << "|";
     }
 
@@ -971,6 +1147,17 @@ int main(int argc, char *argv[])
         printf("  %d/%d tests failed.\n", failedTests, fileCount);
     }*/
 
+    if (resultsFile != NULL) {
+        fclose(resultsFile);
+    }
+
+    if (baselinePath != NULL)
+    {
+        printf("Baseline Results:\n");
+        printf("  %d regressions.\n", regressionCount);
+        if (regressionCount != 0) return EXIT_FAILURE;
+    }
+
     return EXIT_SUCCESS;
 }
 
@@ -27,9 +27,18 @@
 
 #include "cmdline.h"
 
+#include "nvtt/nvtt.h"
+
 #include "nvimage/DirectDrawSurface.h"
+#include "nvimage/Image.h"
+#include "nvimage/ImageIO.h"
+
+#include "nvthread/TaskScheduler.h"
+
+#include "nvmath/Color.h"
 
 #include "nvcore/Array.inl"
+#include "nvcore/Ptr.h"
 #include "nvcore/StrLib.h"
 #include "nvcore/StdStream.h"
 
@@ -44,6 +53,22 @@ struct ImageData {
 };
 
 
+static const struct {
+	const char   *name;
+	nvtt::Format  format;
+} s_formats[] = {
+	{ "-rgb",  nvtt::Format_RGB  },
+	{ "-bc1",  nvtt::Format_BC1  },
+	{ "-bc1a", nvtt::Format_BC1a },
+	{ "-bc2",  nvtt::Format_BC2  },
+	{ "-bc3",  nvtt::Format_BC3  },
+	{ "-bc4",  nvtt::Format_BC4  },
+	{ "-bc5",  nvtt::Format_BC5  },
+	{ "-bc6",  nvtt::Format_BC6  },
+	{ "-bc7",  nvtt::Format_BC7  },
+};
+
+
 
 bool ProcessCommandLine(
 		int                     argc,
@@ -51,11 +76,22 @@ bool ProcessCommandLine(
 		std::vector<nv::Path>  &files,
 		nv::Path               &output,
 		bool                   &assemble_array,
-		bool                   &assemble_cubemap)
+		bool                   &assemble_cubemap,
+		bool                   &assemble_volume,
+		bool                   &compress,
+		nvtt::Format           &format,
+		bool                   &fast,
+		bool                   &mipmaps)
 {
 
 	assemble_cubemap = false;
 	assemble_array   = false;
+	assemble_volume  = false;
+
+	compress = false;
+	format   = nvtt::Format_BC1;
+	fast     = false;
+	mipmaps  = true;
 
 	output = "nvout.dds";
 
@@ -63,12 +99,38 @@ bool ProcessCommandLine(
 
 	for (int n=1; n < argc; n++) {
 
+		bool format_option = false;
+
+		for (uint f=0; f < sizeof(s_formats) / sizeof(s_formats[0]); f++) {
+
+			if (std::strcmp(s_formats[f].name, argv[n]) == 0) {
+
+				compress      = true;
+				format        = s_formats[f].format;
+				format_option = true;
+
+			}
+
+		}
+
+		if (format_option)
+			continue;
+
 		if (std::strcmp("-cube", argv[n]) == 0)
 			assemble_cubemap = true;
 
 		else if (std::strcmp("-array", argv[n]) == 0)
 			assemble_array = true;
 
+		else if (std::strcmp("-volume", argv[n]) == 0)
+			assemble_volume = true;
+
+		else if (std::strcmp("-fast", argv[n]) == 0)
+			fast = true;
+
+		else if (std::strcmp("-nomips", argv[n]) == 0)
+			mipmaps = false;
+
 		else if (std::strcmp("-o", argv[n]) == 0)
 			output_specified = true;
 
@@ -89,7 +151,11 @@ bool ProcessCommandLine(
 
 	if (files.empty()) {
 
-		printf("\nUsage: nvassemble [-cube] [-array] [-o output] image0.dds image1.dds ... imageN.dds\n\n");
+		printf("\nUsage: nvassemble [-cube] [-array] [-volume] [-o output] image0.dds image1.dds ... imageN.dds\n");
+		printf("       nvassemble [-cube] [-array] [-volume] <format> [-fast] [-nomips] [-o output] image0 image1 ... imageN\n\n");
+		printf("The surfaces of DDS files are copied, volumes are assembled from slices without mipmaps.\n");
+		printf("With a format the images are compressed, and the mipmaps generated, while assembling.\n");
+		printf("Formats: -rgb -bc1 -bc1a -bc2 -bc3 -bc4 -bc5 -bc6 -bc7\n\n");
 		return false;
 
 	}
@@ -103,6 +169,74 @@ bool ProcessCommandLine(
 
 
 
+bool ValidateLayout(
+		uint facecount,
+		bool assemble_array,
+		bool assemble_cubemap,
+		bool assemble_volume)
+{
+
+	if (assemble_volume) {
+
+		if (assemble_array || assemble_cubemap) {
+
+			printf("Error: Volumes can't be assembled into arrays or cubemaps\n");
+			return false;
+
+		}
+
+		return true;
+
+	}
+
+	const uint expected = assemble_cubemap? 6: 1;
+
+	if (assemble_array) {
+
+		if (facecount % expected != 0) {
+
+			printf("Error: Expected a multiple of %d images, but %d were specified\n", expected, facecount);
+			return false;
+
+		}
+
+	} else {
+
+		if (facecount != expected) {
+
+			printf("Error: Expected %d images, but %d were specified\n", expected, facecount);
+			return false;
+
+		}
+
+	}
+
+	return true;
+
+}
+
+
+
+struct LoadDDSContext {
+
+	const std::vector<nv::Path> *files;
+	nv::DirectDrawSurface      **surfaces;
+	bool                        *loaded;
+
+};
+
+static void LoadDDSTask(void *arg, int n)
+{
+
+	LoadDDSContext *context = (LoadDDSContext *)arg;
+
+	context->surfaces[n] = new nv::DirectDrawSurface();
+	context->loaded[n]   = context->surfaces[n]->load((*context->files)[n].str());
+
+}
+
+
+
 bool GatherSourceImages(
 		std::vector<nv::Path>  &files,
 		std::vector<ImageData> &images,
@@ -113,20 +247,32 @@ bool GatherSourceImages(
 		uint                   &image_mipmaps)
 {
 
-	for (int n=0; n < files.size(); n++) {
+	// Load the files in parallel, then check them in order.
+	std::vector<nv::DirectDrawSurface *> surfaces(files.size());
+	bool *loaded = new bool[files.size()];
+
+	LoadDDSContext context = { &files, &surfaces[0], loaded };
+	nv::TaskScheduler::global()->parallelFor(LoadDDSTask, &context, files.size());
+
+	bool success = true;
+
+	for (int n=0; n < files.size() && success; n++) {
 
 		images.push_back(ImageData());
 
 		ImageData &image = images.back();
 
 		image.file = files[n];
-		image.dds  = new nv::DirectDrawSurface();
+		image.dds  = surfaces[n];
 		image.face = 0;
 
-		if (!image.dds->load(files[n].str())) {
+		surfaces[n] = NULL;
+
+		if (!loaded[n]) {
 
 			printf("Error: Unable to load %s!\n", files[n].str());
-			return false;
+			success = false;
+			break;
 
 		}
 
@@ -151,7 +297,8 @@ bool GatherSourceImages(
 				image.dds->mipmapCount() != image_mipmaps) {
 
 				printf("Error: Image format does not match!\n");
-				return false;
+				success = false;
+				break;
 
 			}
 
@@ -176,7 +323,104 @@ bool GatherSourceImages(
 
 	}
 
-	return true;
+	// The files after an error were not added to the images.
+	for (int n=0; n < files.size(); n++)
+		delete surfaces[n];
+
+	delete [] loaded;
+
+	return success;
+}
+
+
+
+// Number of source files read ahead of the output. The next window is read by the task scheduler while the current one
+// is written.
+static const uint ReadWindowSize = 16;
+
+struct ReadWindow {
+
+	const std::vector<ImageData> *images;
+	const std::vector<uint>      *filestart;    // First face of each source file, followed by the face count.
+	const uint                   *mipsize;
+	uint                          mipmaps;
+	uint                          facesize;     // Of all the mipmaps of a face.
+
+	uint                          firstfile;
+	uint                          lastfile;
+	std::vector<unsigned char>    buffer;       // Surfaces that are not memory mapped.
+	std::vector<const void *>     data;         // Of each mipmap of the faces of the window, NULL when it couldn't be read.
+
+};
+
+static void ReadFileTask(void *arg, int n)
+{
+
+	ReadWindow &window = *(ReadWindow *)arg;
+
+	const std::vector<uint> &filestart = *window.filestart;
+	const uint               file      = window.firstfile + n;
+	const uint               firstface = filestart[window.firstfile];
+
+	for (uint f = filestart[file]; f < filestart[file + 1]; f++) {
+
+		const ImageData &image  = (*window.images)[f];
+		uint             offset = (f - firstface) * window.facesize;
+
+		for (uint m=0; m < window.mipmaps; offset += window.mipsize[m], m++) {
+
+			const void *data = image.dds->surfaceData(image.face, m);
+
+			if (data != NULL) {
+
+				// Touch the pages of mapped surfaces, so that they're resident when they are written.
+				const volatile unsigned char *bytes = (const volatile unsigned char *)data;
+
+				for (uint i=0; i < window.mipsize[m]; i += 4096)
+					(void)bytes[i];
+
+			} else {
+
+				unsigned char *pixels = &window.buffer[offset];
+
+				if (image.dds->readSurface(image.face, m, pixels, window.mipsize[m]))
+					data = pixels;
+
+			}
+
+			window.data[(f - firstface) * window.mipmaps + m] = data;
+
+		}
+
+	}
+
+}
+
+static void StartReadWindow(ReadWindow &window, nv::TaskGroup &group, uint firstfile, uint filecount)
+{
+
+	const std::vector<uint> &filestart = *window.filestart;
+
+	window.firstfile = firstfile;
+	window.lastfile  = firstfile + ReadWindowSize < filecount? firstfile + ReadWindowSize: filecount;
+
+	const uint firstface = filestart[window.firstfile];
+	const uint lastface  = filestart[window.lastfile];
+
+	window.data.assign((lastface - firstface) * window.mipmaps, NULL);
+
+	// Only files that aren't mapped need the buffer, the first surface tells.
+	bool mapped = true;
+
+	for (uint f = firstface; f < lastface && mapped; f++)
+		mapped = (*window.images)[f].dds->surfaceData((*window.images)[f].face, 0) != NULL;
+
+	if (!mapped && window.buffer.size() < (lastface - firstface) * window.facesize)
+		window.buffer.resize((lastface - firstface) * window.facesize);
+
+	for (uint file = window.firstfile; file < window.lastfile; file++)
+		group.run(ReadFileTask, &window, file - window.firstfile);
+
 }
 
 
@@ -186,6 +430,7 @@ bool StitchFinalImage(
 		const std::vector<ImageData> &images,
 		bool                          assemble_array,
 		bool                          assemble_cubemap,
+		bool                          assemble_volume,
 		uint                          image_width,
 		uint                          image_height,
 		uint                          image_depth,
@@ -196,29 +441,19 @@ bool StitchFinalImage(
 	const uint facecount = images.size();
  	const uint expected  = assemble_cubemap? 6: 1;
 
-	if (assemble_array) {
-
-		if (facecount % expected != 0) {
-
-			printf("Error: Expected a multiple of %d images, but %d were specified\n", expected, facecount);
-			return false;
-
-		}
-
-	} else {
-
-		if (facecount != expected) {
+	if (!ValidateLayout(facecount, assemble_array, assemble_cubemap, assemble_volume))
+		return false;
 
-			printf("Error: Expected %d images, but %d were specified\n", expected, facecount);
-			return false;
+	if (assemble_cubemap && image_depth > 1) {
 
-		}
+		printf("Error: Cannot assemble a cubemap with volume textures\n");
+		return false;
 
 	}
 
-	if (assemble_cubemap && image_depth > 1) {
+	if (assemble_volume && (image_depth > 1 || image_mipmaps > 1)) {
 
-		printf("Error: Cannot assemble a cubemap with volume textures\n");
+		printf("Error: Volume slices must be 2D images without mipmaps, give a format to generate the mipmaps\n");
 		return false;
 
 	}
@@ -244,6 +479,11 @@ bool StitchFinalImage(
 
 		header.setTextureCube();
 
+	} else if (assemble_volume) {
+
+		header.setTexture3D();
+		header.setDepth(facecount);
+
 	} else if (image_depth > 1) {
 
 		header.setTexture3D();
@@ -256,26 +496,227 @@ bool StitchFinalImage(
 
 	stream << header;
 
-	const bool block = header.isBlockFormat();
-	const uint step  = block? 4: 1;
-
 	uint mipsize[32];
+	uint facesize = 0;
+
+	for (int m=0; m < image_mipmaps; m++) {
 
-	for (int m=0; m < image_mipmaps; m++)
 		mipsize[m] = images[0].dds->surfaceSize(m);
+		facesize  += mipsize[m];
+
+	}
+
+	// The faces of a source file are read together, the faces of a cubemap or array share its stream.
+	std::vector<uint> filestart;
+
+	for (uint f=0; f < facecount; f++)
+		if (f == 0 || images[f].dds != images[f - 1].dds)
+			filestart.push_back(f);
+
+	const uint filecount = filestart.size();
+	filestart.push_back(facecount);
+
+	ReadWindow windows[2];
+
+	for (int w=0; w < 2; w++) {
+
+		windows[w].images    = &images;
+		windows[w].filestart = &filestart;
+		windows[w].mipsize   = mipsize;
+		windows[w].mipmaps   = image_mipmaps;
+		windows[w].facesize  = facesize;
+
+	}
+
+	// Waits for the reads when leaving early, before the windows are destroyed.
+	nv::TaskGroup group;
 
-	unsigned char *pixels = new unsigned char[mipsize[0]];
+	StartReadWindow(windows[0], group, 0, filecount);
 
-	for (int f=0; f < facecount; f++)
-		for (int m=0; m < image_mipmaps; m++)
-			if (!images[f].dds->readSurface(images[f].face, m, pixels, mipsize[m]) ||
-				stream.serialize(pixels, mipsize[m]) != mipsize[m]) {
+	for (uint firstfile=0, w=0; firstfile < filecount; firstfile += ReadWindowSize, w ^= 1) {
 
- 				printf("Error: Failed to copy mipmap %d of face %d (%s)!\n", m, f + 1, images[f].file.str());
-				return false;
+		group.wait();
+
+		if (firstfile + ReadWindowSize < filecount)
+			StartReadWindow(windows[w ^ 1], group, firstfile + ReadWindowSize, filecount);
+
+		const ReadWindow &window    = windows[w];
+		const uint        firstface = filestart[window.firstfile];
+		const uint        lastface  = filestart[window.lastfile];
+
+		for (uint f = firstface; f < lastface; f++)
+			for (int m=0; m < image_mipmaps; m++) {
+
+				const void *data = window.data[(f - firstface) * image_mipmaps + m];
+
+				if (data == NULL || stream.serialize(const_cast<void *>(data), mipsize[m]) != mipsize[m]) {
+
+ 					printf("Error: Failed to copy mipmap %d of face %d (%s)!\n", m, f + 1, images[f].file.str());
+					return false;
+
+				}
 
 			}
 
+	}
+
+	printf("Operation complete.\n");
+	return true;
+
+}
+
+
+
+struct LoadImageContext {
+
+	const std::vector<nv::Path> *files;
+	nv::Image                   *first;     // Already loaded, it sets the extents.
+	nv::Image                  **images;    // Of the array layers and cube faces.
+	nv::Color32                 *volume;    // Of the volume slices, NULL otherwise.
+	int                         *status;    // 0 when loaded, 1 when the file can't be loaded, 2 when the extents differ.
+
+};
+
+static void LoadImageTask(void *arg, int n)
+{
+
+	LoadImageContext *context = (LoadImageContext *)arg;
+
+	nv::Image *image = (n == 0)? context->first: nv::ImageIO::load((*context->files)[n].str());
+
+	const uint w = context->first->width();
+	const uint h = context->first->height();
+
+	if (image == NULL) {
+
+		context->status[n] = 1;
+		return;
+
+	}
+
+	if (image->width() != w || image->height() != h || image->depth() != 1) {
+
+		context->status[n] = 2;
+		if (n > 0) delete image;
+		return;
+
+	}
+
+	context->status[n] = 0;
+
+	if (context->volume != NULL) {
+
+		memcpy(context->volume + size_t(n) * w * h, image->pixels(), size_t(w) * h * sizeof(nv::Color32));
+		if (n > 0) delete image;
+
+	} else
+		context->images[n] = image;
+
+}
+
+
+
+bool CompressFinalImage(
+		const nv::Path              &output,
+		const std::vector<nv::Path> &files,
+		bool                         assemble_array,
+		bool                         assemble_cubemap,
+		bool                         assemble_volume,
+		nvtt::Format                 format,
+		bool                         fast,
+		bool                         mipmaps)
+{
+
+	const uint facecount = files.size();
+
+	if (!ValidateLayout(facecount, assemble_array, assemble_cubemap, assemble_volume))
+		return false;
+
+	nv::AutoPtr<nv::Image> first(nv::ImageIO::load(files[0].str()));
+
+	if (first == NULL) {
+
+		printf("Error: Unable to load %s!\n", files[0].str());
+		return false;
+
+	}
+
+	const uint w = first->width();
+	const uint h = first->height();
+
+	printf("Assembling %d images of %dx%d.\n", facecount, w, h);
+
+	// The images are loaded in parallel, volume slices straight into the volume.
+	std::vector<nv::Image *>  images(facecount, (nv::Image *)NULL);
+	std::vector<nv::Color32>  volume(assemble_volume? size_t(w) * h * facecount: 0);
+	std::vector<int>          status(facecount, 0);
+
+	LoadImageContext context = { &files, first.ptr(), &images[0], assemble_volume? &volume[0]: NULL, &status[0] };
+	nv::TaskScheduler::global()->parallelFor(LoadImageTask, &context, facecount);
+
+	bool success = true;
+
+	for (uint n=0; n < facecount && success; n++) {
+
+		if (status[n] == 1)
+			printf("Error: Unable to load %s!\n", files[n].str());
+
+		else if (status[n] == 2)
+			printf("Error: The extents of %s do not match!\n", files[n].str());
+
+		success = (status[n] == 0);
+
+	}
+
+	nvtt::InputOptions inputOptions;
+	inputOptions.setFormat(nvtt::InputFormat_BGRA_8UB);
+	inputOptions.setMipmapGeneration(mipmaps);
+
+	if (success && assemble_volume) {
+
+		inputOptions.setTextureLayout(nvtt::TextureType_3D, w, h, facecount);
+		inputOptions.setMipmapData(&volume[0], w, h, facecount);
+
+	} else if (success) {
+
+		const uint layers = assemble_cubemap? facecount / 6: facecount;
+
+		inputOptions.setTextureLayout(assemble_cubemap? nvtt::TextureType_Cube: nvtt::TextureType_2D, w, h, 1, layers);
+
+		for (uint n=0; n < facecount; n++)
+			inputOptions.setMipmapData(images[n]->pixels(), w, h, 1, n);
+
+	}
+
+	// The first image is owned by the AutoPtr.
+	for (uint n=1; n < facecount; n++)
+		delete images[n];
+
+	std::vector<nv::Color32>().swap(volume);
+
+	if (!success)
+		return false;
+
+	nvtt::CompressionOptions compressionOptions;
+	compressionOptions.setFormat(format);
+	compressionOptions.setQuality(fast? nvtt::Quality_Fastest: nvtt::Quality_Normal);
+
+	nvtt::OutputOptions outputOptions;
+	outputOptions.setFileName(output.str());
+
+	if (assemble_array || format == nvtt::Format_BC6 || format == nvtt::Format_BC7)
+		outputOptions.setContainer(nvtt::Container_DDS10);
+
+	nvtt::Compressor compressor;
+	compressor.enablePipelining(true);
+
+	if (!compressor.process(inputOptions, compressionOptions, outputOptions)) {
+
+		printf("Error: Failed to compress '%s'\n", output.str());
+		return false;
+
+	}
+
 	printf("Operation complete.\n");
 	return true;
 
@@ -310,6 +751,12 @@ int main(int argc, char *argv[])
 
 	bool assemble_array;
 	bool assemble_cubemap;
+	bool assemble_volume;
+
+	bool         compress;
+	nvtt::Format format;
+	bool         fast;
+	bool         mipmaps;
 
 	nv::Path output;
 
@@ -325,9 +772,22 @@ int main(int argc, char *argv[])
 	if (!ProcessCommandLine(
 			argc,           argv,
 			files,          output,
-			assemble_array, assemble_cubemap))
+			assemble_array, assemble_cubemap, assemble_volume,
+			compress,       format,           fast,            mipmaps))
 		return 1;
 
+	if (compress) {
+
+		if (!CompressFinalImage(
+				output,         files,
+				assemble_array, assemble_cubemap, assemble_volume,
+				format,         fast,             mipmaps))
+			return 3;
+
+		return 0;
+
+	}
+
 	if (!GatherSourceImages(
 			files,        images,
 			image_width,  image_height, image_depth,
@@ -341,7 +801,7 @@ int main(int argc, char *argv[])
 	if (!StitchFinalImage(
 			output,
 			images,
-			assemble_array, assemble_cubemap,
+			assemble_array, assemble_cubemap, assemble_volume,
 			image_width,    image_height, image_depth, image_format, image_mipmaps)) {
 
 		DestroyImageArray(images);
@@ -353,4 +813,3 @@ int main(int argc, char *argv[])
 	return 0;
 
 }
-
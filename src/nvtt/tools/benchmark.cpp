@@ -1,5 +1,5 @@
 // Copyright NVIDIA Corporation 2007 -- Ignacio Castano <icastano@nvidia.com>
-// 
+//
 // Permission is hereby granted, free of charge, to any person
 // obtaining a copy of this software and associated documentation
 // files (the "Software"), to deal in the Software without
@@ -8,10 +8,10 @@
 // copies of the Software, and to permit persons to whom the
 // Software is furnished to do so, subject to the following
 // conditions:
-// 
+//
 // The above copyright notice and this permission notice shall be
 // included in all copies or substantial portions of the Software.
-// 
+//
 // THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
 // EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
 // OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
@@ -23,352 +23,539 @@
 
 #include <nvcore/StrLib.h>
 #include <nvcore/StdStream.h>
+#include <nvcore/Timer.h>
+#include <nvcore/PerfCounters.h>
+#include <nvcore/Array.inl>
 
-#include <nvimage/Image.h>
-#include <nvimage/DirectDrawSurface.h>
+#include <nvthread/nvthread.h>
+#include <nvthread/TaskScheduler.h>
 
 #include <nvtt/nvtt.h>
 
 #include "cmdline.h"
 
-#include <time.h> // clock
+#include <stdlib.h> // atoi, strtol
 
 
 struct MyErrorHandler : public nvtt::ErrorHandler
 {
-	virtual void error(nvtt::Error e)
-	{
-		nvDebugBreak();
-	}
+    virtual void error(nvtt::Error e)
+    {
+        fprintf(stderr, "Error: '%s'\n", nvtt::errorString(e));
+    }
 };
 
+// Keeps the compressed texture in memory, so that the output stage can be timed on its own.
+struct MemoryOutputHandler : public nvtt::OutputHandler
+{
+    virtual void beginImage(int size, int width, int height, int depth, int face, int miplevel) {}
+    virtual void endImage() {}
+
+    virtual bool writeData(const void * data, int size)
+    {
+        buffer.append((const uint8 *)data, size);
+        return true;
+    }
+
+    nv::Array<uint8> buffer;
+};
+
+
+enum Stage
+{
+    Stage_Load,
+    Stage_Linearize,
+    Stage_Resize,
+    Stage_Mipmap,
+    Stage_Quantize,
+    Stage_Compress,
+    Stage_Output,
+    Stage_Total,
+    Stage_Count
+};
+
+static const char * const s_stageNames[Stage_Count] = {
+    "load", "linearize", "resize", "mip", "quantize", "compress", "output", "total"
+};
+
+struct Settings
+{
+    const char * input;
+    const char * output;
+    bool normal;
+    bool wrapRepeat;
+    bool noMipmaps;
+    bool dither;
+    int maxExtent;
+    nvtt::Format format;
+    nvtt::Quality quality;
+    bool cuda;
+};
 
-// Set color to normal map conversion options.
-void setColorToNormalMap(nvtt::InputOptions & inputOptions)
+typedef nv::PerfCounters PerfCounters;
+
+// Hardware counters of all the threads, NULL unless they are requested and available.
+static PerfCounters * s_counters = NULL;
+
+// Seconds spent in each stage by one run, and the hardware events counted in it. Stages that a run skips stay at 0.
+struct RunTimes
 {
-	inputOptions.setNormalMap(false);
-	inputOptions.setConvertToNormalMap(true);
-	inputOptions.setHeightEvaluation(1.0f/3.0f, 1.0f/3.0f, 1.0f/3.0f, 0.0f);
-	//inputOptions.setNormalFilter(1.0f, 0, 0, 0);
-	//inputOptions.setNormalFilter(0.0f, 0, 0, 1);
-	inputOptions.setGamma(1.0f, 1.0f);
-	inputOptions.setNormalizeMipmaps(true);
+    float stage[Stage_Count];
+    uint64 counters[Stage_Count][PerfCounters::Counter_Count];
+    uint blockCount;    // Blocks of all the levels, compressed or not.
+};
+
+// Adds the wall clock time of its scope to a stage, and the hardware events when they are counted.
+class StageTimer
+{
+public:
+    StageTimer(RunTimes & times, Stage stage) : m_times(times), m_stage(stage)
+    {
+        if (s_counters != NULL) s_counters->read(m_counters);
+        m_timer.start();
+    }
+    ~StageTimer()
+    {
+        m_timer.stop();
+        m_times.stage[m_stage] += m_timer.elapsed();
+
+        if (s_counters != NULL) {
+            uint64 counters[PerfCounters::Counter_Count];
+            s_counters->read(counters);
+            for (int c = 0; c < PerfCounters::Counter_Count; c++) m_times.counters[m_stage][c] += counters[c] - m_counters[c];
+        }
+    }
+
+private:
+    RunTimes & m_times;
+    Stage m_stage;
+    nv::Timer m_timer;
+    uint64 m_counters[PerfCounters::Counter_Count];
+};
+
+
+// Run the whole pipeline once, from the file on disk to the compressed texture. Returns false on errors.
+static bool runOnce(const Settings & settings, nvtt::Compressor & context, const nvtt::CompressionOptions & compressionOptions, RunTimes & times)
+{
+    for (int i = 0; i < Stage_Count; i++) {
+        times.stage[i] = 0.0f;
+        for (int c = 0; c < PerfCounters::Counter_Count; c++) times.counters[i][c] = 0;
+    }
+    times.blockCount = 0;
+
+    StageTimer total(times, Stage_Total);
+
+    nvtt::Surface image;
+    {
+        StageTimer t(times, Stage_Load);
+        if (!image.load(settings.input)) {
+            fprintf(stderr, "The file '%s' is not a supported image type.\n", settings.input);
+            return false;
+        }
+    }
+
+    image.setWrapMode(settings.wrapRepeat ? nvtt::WrapMode_Repeat : nvtt::WrapMode_Clamp);
+    image.setNormalMap(settings.normal);
+
+    // Color maps are filtered in linear space.
+    const bool linear = !settings.normal;
+    if (linear) {
+        StageTimer t(times, Stage_Linearize);
+        image.toLinear(2.2f);
+    }
+
+    if (settings.maxExtent > 0) {
+        StageTimer t(times, Stage_Resize);
+        image.resize(settings.maxExtent, nvtt::RoundMode_None, nvtt::ResizeFilter_Box);
+    }
+
+    MemoryOutputHandler outputHandler;
+    outputHandler.buffer.reserve(image.width() * image.height());
+
+    MyErrorHandler errorHandler;
+    nvtt::OutputOptions outputOptions;
+    outputOptions.setOutputHandler(&outputHandler);
+    outputOptions.setErrorHandler(&errorHandler);
+    if (settings.format == nvtt::Format_BC6 || settings.format == nvtt::Format_BC7) {
+        outputOptions.setContainer(nvtt::Container_DDS10);
+    }
+
+    const int mipmapCount = settings.noMipmaps ? 1 : image.countMipmaps();
+
+    {
+        StageTimer t(times, Stage_Compress);
+        context.outputHeader(image, mipmapCount, compressionOptions, outputOptions);
+    }
+
+    for (int m = 0; m < mipmapCount; m++)
+    {
+        if (m > 0) {
+            StageTimer t(times, Stage_Mipmap);
+            image.buildNextMipmap(nvtt::MipmapFilter_Box);
+        }
+
+        nvtt::Surface level(image);
+        {
+            StageTimer t(times, Stage_Quantize);
+            if (linear) level.toGamma(2.2f);
+            if (settings.dither) {
+                for (int c = 0; c < 3; c++) level.quantize(c, 8, /*exactEndPoints*/true, /*dither*/true);
+            }
+        }
+
+        {
+            StageTimer t(times, Stage_Compress);
+            if (!context.compress(level, 0, m, compressionOptions, outputOptions)) {
+                return false;
+            }
+        }
+        times.blockCount += ((level.width() + 3) / 4) * ((level.height() + 3) / 4);
+    }
+
+    if (settings.output != NULL) {
+        StageTimer t(times, Stage_Output);
+        nv::StdOutputStream stream(settings.output);
+        if (stream.isError()) {
+            fprintf(stderr, "Error opening '%s' for writing.\n", settings.output);
+            return false;
+        }
+        stream.serialize(outputHandler.buffer.buffer(), outputHandler.buffer.size());
+    }
+
+    return true;
 }
 
-// Set options for normal maps.
-void setNormalMap(nvtt::InputOptions & inputOptions)
+
+// Value at the given fraction of the sorted samples, by the nearest rank method.
+static float percentile(const nv::Array<float> & sorted, float fraction)
 {
-	inputOptions.setNormalMap(true);
-	inputOptions.setConvertToNormalMap(false);
-	inputOptions.setGamma(1.0f, 1.0f);
-	inputOptions.setNormalizeMipmaps(true);
+    nvDebugCheck(sorted.count() > 0);
+    uint rank = uint(fraction * sorted.count() + 0.999f);
+    rank = nv::clamp(rank, 1U, sorted.count());
+    return sorted[rank - 1];
 }
 
-// Set options for color maps.
-void setColorMap(nvtt::InputOptions & inputOptions)
+static void sortSamples(nv::Array<float> & samples)
 {
-	inputOptions.setNormalMap(false);
-	inputOptions.setConvertToNormalMap(false);
-	inputOptions.setGamma(2.2f, 2.2f);
-	inputOptions.setNormalizeMipmaps(false);
+    // Insertion sort, there are only a few runs.
+    for (uint i = 1; i < samples.count(); i++) {
+        float x = samples[i];
+        uint j = i;
+        for (; j > 0 && samples[j - 1] > x; j--) samples[j] = samples[j - 1];
+        samples[j] = x;
+    }
 }
 
+// Parse a comma separated list of thread counts.
+static bool parseThreadCounts(const char * str, nv::Array<uint> & counts)
+{
+    while (*str != '\0') {
+        char * end;
+        long n = strtol(str, &end, 10);
+        if (end == str || n <= 0) return false;
+        counts.append(uint(n));
+        str = end;
+        if (*str == ',') str++;
+    }
+    return counts.count() > 0;
+}
 
 
 int main(int argc, char *argv[])
 {
-	MyAssertHandler assertHandler;
-	MyMessageHandler messageHandler;
-
-	bool normal = false;
-	bool color2normal = false;
-	bool wrapRepeat = false;
-	bool noMipmaps = false;
-	bool fast = false;
-	bool nocuda = false;
-	bool silent = false;
-	nvtt::Format format = nvtt::Format_BC1;
-
-	const char * externalCompressor = NULL;
-
-	nv::Path input;
-	nv::Path output;
-
-
-	// Parse arguments.
-	for (int i = 1; i < argc; i++)
-	{
-		// Input options.
-		if (strcmp("-color", argv[i]) == 0)
-		{
-		}
-		else if (strcmp("-normal", argv[i]) == 0)
-		{
-			normal = true;
-		}
-		else if (strcmp("-tonormal", argv[i]) == 0)
-		{
-			color2normal = true;
-		}
-		else if (strcmp("-clamp", argv[i]) == 0)
-		{
-		}
-		else if (strcmp("-repeat", argv[i]) == 0)
-		{
-			wrapRepeat = true;
-		}
-		else if (strcmp("-nomips", argv[i]) == 0)
-		{
-			noMipmaps = true;
-		}
-
-		// Compression options.
-		else if (strcmp("-fast", argv[i]) == 0)
-		{
-			fast = true;
-		}
-		else if (strcmp("-nocuda", argv[i]) == 0)
-		{
-			nocuda = true;
-		}
-		else if (strcmp("-rgb", argv[i]) == 0)
-		{
-			format = nvtt::Format_RGB;
-		}
-		else if (strcmp("-bc1", argv[i]) == 0)
-		{
-			format = nvtt::Format_BC1;
-		}
-		else if (strcmp("-bc1a", argv[i]) == 0)
-		{
-			format = nvtt::Format_BC1a;
-		}
-		else if (strcmp("-bc2", argv[i]) == 0)
-		{
-			format = nvtt::Format_BC2;
-		}
-		else if (strcmp("-bc3", argv[i]) == 0)
-		{
-			format = nvtt::Format_BC3;
-		}
-		else if (strcmp("-bc3n", argv[i]) == 0)
-		{
-			format = nvtt::Format_BC3n;
-		}
-		else if (strcmp("-bc4", argv[i]) == 0)
-		{
-			format = nvtt::Format_BC4;
-		}
-		else if (strcmp("-bc5", argv[i]) == 0)
-		{
-			format = nvtt::Format_BC5;
-		}
-
-		// Undocumented option. Mainly used for testing.
-		else if (strcmp("-ext", argv[i]) == 0)
-		{
-			if (i+1 < argc && argv[i+1][0] != '-') {
-				externalCompressor = argv[i+1];
-				i++;
-			}
-		}
-
-		// Misc options
-		else if (strcmp("-silent", argv[i]) == 0)
-		{
-			silent = true;
-		}
-
-		else if (argv[i][0] != '-')
-		{
-			input = argv[i];
-
-			if (i+1 < argc && argv[i+1][0] != '-') {
-				output = argv[i+1];
-			}
-			else
-			{
-				output.copy(input.str());
-				output.stripExtension();
-				output.append(".dds");
-			}
-
-			break;
-		}
-	}
-
-	printf("NVIDIA Texture Tools - Copyright NVIDIA Corporation 2007\n\n");
-
-	if (input.isNull())
-	{
-		printf("usage: nvttbenchmark [options] infile [outfile]\n\n");
-		
-		printf("Input options:\n");
-		printf("  -color   \tThe input image is a color map (default).\n");
-		printf("  -normal  \tThe input image is a normal map.\n");
-		printf("  -tonormal\tConvert input to normal map.\n");
-		printf("  -clamp   \tClamp wrapping mode (default).\n");
-		printf("  -repeat  \tRepeat wrapping mode.\n");
-		printf("  -nomips  \tDisable mipmap generation.\n\n");
-
-		printf("Compression options:\n");
-		printf("  -fast    \tFast compression.\n");
-		printf("  -nocuda  \tDo not use cuda compressor.\n");
-		printf("  -rgb     \tRGBA format\n");
-		printf("  -bc1     \tBC1 format (DXT1)\n");
-		printf("  -bc1a    \tBC1 format with binary alpha (DXT1a)\n");
-		printf("  -bc2     \tBC2 format (DXT3)\n");
-		printf("  -bc3     \tBC3 format (DXT5)\n");
-		printf("  -bc3n    \tBC3 normal map format (DXT5nm)\n");
-		printf("  -bc4     \tBC4 format (ATI1)\n");
-		printf("  -bc5     \tBC5 format (3Dc/ATI2)\n\n");
-		
-		return 1;
-	}
-
-	// @@ Make sure input file exists.
-	
-	// Set input options.
-	nvtt::InputOptions inputOptions;
-	
-	if (nv::strCaseCmp(input.extension(), ".dds") == 0)
-	{
-		// Load surface.
-		nv::DirectDrawSurface dds(input);
-		if (!dds.isValid())
-		{
-			fprintf(stderr, "The file '%s' is not a valid DDS file.\n", input.str());
-			return 1;
-		}
-		
-		if (!dds.isSupported() || dds.isTexture3D())
-		{
-			fprintf(stderr, "The file '%s' is not a supported DDS file.\n", input.str());
-			return 1;
-		}
-		
-		uint faceCount;
-		if (dds.isTexture2D())
-		{
-			inputOptions.setTextureLayout(nvtt::TextureType_2D, dds.width(), dds.height());
-			faceCount = 1;
-		}
-		else 
-		{
-			nvDebugCheck(dds.isTextureCube());
-			inputOptions.setTextureLayout(nvtt::TextureType_Cube, dds.width(), dds.height());
-			faceCount = 6;
-		}
-		
-		uint mipmapCount = dds.mipmapCount();
-		
-		nv::Image mipmap;
-		
-		for (uint f = 0; f < faceCount; f++)
-		{
-			for (uint m = 0; m <= mipmapCount; m++)
-			{
-				dds.mipmap(&mipmap, f, m);
-				
-				inputOptions.setMipmapData(mipmap.pixels(), mipmap.width(), mipmap.height(), 1, f, m);
-			}
-		}
-	}
-	else
-	{
-		// Regular image.
-		nv::Image image;
-		if (!image.load(input))
-		{
-			fprintf(stderr, "The file '%s' is not a supported image type.\n", input.str());
-			return 1;
-		}
-		
-		inputOptions.setTextureLayout(nvtt::TextureType_2D, image.width(), image.height());
-		inputOptions.setMipmapData(image.pixels(), image.width(), image.height());
-	}
-
-	if (fast)
-	{
-		inputOptions.setMipmapping(true, nvtt::MipmapFilter_Box);
-	}
-	else
-	{
-		inputOptions.setMipmapping(true, nvtt::MipmapFilter_Box);
-		//inputOptions.setMipmapping(true, nvtt::MipmapFilter_Kaiser);
-	}
-
-	if (wrapRepeat)
-	{
-		inputOptions.setWrapMode(nvtt::WrapMode_Repeat);
-	}
-	else
-	{
-		inputOptions.setWrapMode(nvtt::WrapMode_Clamp);
-	}
-
-	if (normal)
-	{
-		setNormalMap(inputOptions);
-	}
-	else if (color2normal)
-	{
-		setColorToNormalMap(inputOptions);
-	}
-	else
-	{
-		setColorMap(inputOptions);
-	}
-	
-	if (noMipmaps)
-	{
-		inputOptions.setMipmapping(false);
-	}
-	
-
-	nvtt::CompressionOptions compressionOptions;
-	compressionOptions.setFormat(format);
-	if (fast)
-	{
-		compressionOptions.setQuality(nvtt::Quality_Fastest);
-	}
-	else
-	{
-		compressionOptions.setQuality(nvtt::Quality_Normal);
-		//compressionOptions.setQuality(nvtt::Quality_Production, 0.5f);
-		//compressionOptions.setQuality(nvtt::Quality_Highest);
-	}
-	compressionOptions.enableHardwareCompression(!nocuda);
-	compressionOptions.setColorWeights(1, 1, 1);
-
-	if (externalCompressor != NULL)
-	{
-		compressionOptions.setExternalCompressor(externalCompressor);
-	}	
-	
-	
-	MyErrorHandler errorHandler;
-	nvtt::OutputOptions outputOptions(NULL, &errorHandler);
-	
-//	printf("Press ENTER.\n");
-//	fflush(stdout);
-//	getchar();
-
-	clock_t start = clock();
-	
-	const int iterationCount = 20;
-	for (int i = 0; i < iterationCount; i++)
-	{
-		nvtt::compress(inputOptions, outputOptions, compressionOptions);
-	}
-
-	clock_t end = clock();
-	
-	float seconds = float(end-start) / CLOCKS_PER_SEC
-	printf("total time taken: %.3f seconds\n", seconds);
-	printf("time taken per texture: %.3f seconds\n", seconds / iterationCount);
-	printf("textures per second: %.3f T/s\n", iterationCount / seconds);
-	
-	return 0;
+    MyAssertHandler assertHandler;
+    MyMessageHandler messageHandler;
+
+    Settings settings;
+    settings.input = NULL;
+    settings.output = NULL;
+    settings.normal = false;
+    settings.wrapRepeat = false;
+    settings.noMipmaps = false;
+    settings.dither = false;
+    settings.maxExtent = 0;
+    settings.format = nvtt::Format_BC1;
+    settings.quality = nvtt::Quality_Normal;
+    settings.cuda = true;
+
+    int runCount = 10;
+    int warmupCount = 1;
+    bool sweep = false;
+    bool counters = false;
+    nv::Array<uint> threadCounts;
+
+    // Parse arguments.
+    for (int i = 1; i < argc; i++)
+    {
+        // Input options.
+        if (strcmp("-color", argv[i]) == 0)
+        {
+        }
+        else if (strcmp("-normal", argv[i]) == 0)
+        {
+            settings.normal = true;
+        }
+        else if (strcmp("-clamp", argv[i]) == 0)
+        {
+        }
+        else if (strcmp("-repeat", argv[i]) == 0)
+        {
+            settings.wrapRepeat = true;
+        }
+        else if (strcmp("-nomips", argv[i]) == 0)
+        {
+            settings.noMipmaps = true;
+        }
+        else if (strcmp("-max", argv[i]) == 0)
+        {
+            if (i+1 < argc) settings.maxExtent = atoi(argv[++i]);
+        }
+        else if (strcmp("-dither", argv[i]) == 0)
+        {
+            settings.dither = true;
+        }
+
+        // Compression options.
+        else if (strcmp("-fast", argv[i]) == 0)
+        {
+            settings.quality = nvtt::Quality_Fastest;
+        }
+        else if (strcmp("-production", argv[i]) == 0)
+        {
+            settings.quality = nvtt::Quality_Production;
+        }
+        else if (strcmp("-nocuda", argv[i]) == 0)
+        {
+            settings.cuda = false;
+        }
+        else if (strcmp("-rgb", argv[i]) == 0)
+        {
+            settings.format = nvtt::Format_RGB;
+        }
+        else if (strcmp("-bc1", argv[i]) == 0)
+        {
+            settings.format = nvtt::Format_BC1;
+        }
+        else if (strcmp("-bc1a", argv[i]) == 0)
+        {
+            settings.format = nvtt::Format_BC1a;
+        }
+        else if (strcmp("-bc2", argv[i]) == 0)
+        {
+            settings.format = nvtt::Format_BC2;
+        }
+        else if (strcmp("-bc3", argv[i]) == 0)
+        {
+            settings.format = nvtt::Format_BC3;
+        }
+        else if (strcmp("-bc3n", argv[i]) == 0)
+        {
+            settings.format = nvtt::Format_BC3n;
+        }
+        else if (strcmp("-bc4", argv[i]) == 0)
+        {
+            settings.format = nvtt::Format_BC4;
+        }
+        else if (strcmp("-bc5", argv[i]) == 0)
+        {
+            settings.format = nvtt::Format_BC5;
+        }
+        else if (strcmp("-bc6", argv[i]) == 0)
+        {
+            settings.format = nvtt::Format_BC6;
+        }
+        else if (strcmp("-bc7", argv[i]) == 0)
+        {
+            settings.format = nvtt::Format_BC7;
+        }
+
+        // Benchmark options.
+        else if (strcmp("-runs", argv[i]) == 0)
+        {
+            if (i+1 < argc) runCount = nv::max(atoi(argv[++i]), 1);
+        }
+        else if (strcmp("-warmup", argv[i]) == 0)
+        {
+            if (i+1 < argc) warmupCount = nv::max(atoi(argv[++i]), 0);
+        }
+        else if (strcmp("-threads", argv[i]) == 0)
+        {
+            if (i+1 >= argc || !parseThreadCounts(argv[++i], threadCounts))
+            {
+                fprintf(stderr, "-threads expects a comma separated list of thread counts.\n");
+                return 1;
+            }
+        }
+        else if (strcmp("-sweep", argv[i]) == 0)
+        {
+            sweep = true;
+        }
+        else if (strcmp("-counters", argv[i]) == 0)
+        {
+            counters = true;
+        }
+
+        else if (argv[i][0] != '-')
+        {
+            settings.input = argv[i];
+
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                settings.output = argv[i+1];
+            }
+
+            break;
+        }
+    }
+
+    printf("NVIDIA Texture Tools - Copyright NVIDIA Corporation 2007\n\n");
+
+    if (settings.input == NULL)
+    {
+        printf("usage: nvttbenchmark [options] infile [outfile]\n\n");
+
+        printf("Input options:\n");
+        printf("  -color   \tThe input image is a color map (default).\n");
+        printf("  -normal  \tThe input image is a normal map.\n");
+        printf("  -clamp   \tClamp wrapping mode (default).\n");
+        printf("  -repeat  \tRepeat wrapping mode.\n");
+        printf("  -nomips  \tDisable mipmap generation.\n");
+        printf("  -max <n> \tResize the image to a maximum extent of n.\n");
+        printf("  -dither  \tDither the color channels to 8 bits before the compression.\n\n");
+
+        printf("Compression options:\n");
+        printf("  -fast    \tFast compression.\n");
+        printf("  -production\tProduction quality compression.\n");
+        printf("  -nocuda  \tDo not use cuda compressor.\n");
+        printf("  -rgb     \tRGBA format\n");
+        printf("  -bc1     \tBC1 format (DXT1)\n");
+        printf("  -bc1a    \tBC1 format with binary alpha (DXT1a)\n");
+        printf("  -bc2     \tBC2 format (DXT3)\n");
+        printf("  -bc3     \tBC3 format (DXT5)\n");
+        printf("  -bc3n    \tBC3 normal map format (DXT5nm)\n");
+        printf("  -bc4     \tBC4 format (ATI1)\n");
+        printf("  -bc5     \tBC5 format (3Dc/ATI2)\n");
+        printf("  -bc6     \tBC6 format\n");
+        printf("  -bc7     \tBC7 format\n\n");
+
+        printf("Benchmark options:\n");
+        printf("  -runs <n>\tNumber of timed runs (default 10).\n");
+        printf("  -warmup <n>\tNumber of untimed runs before the timed ones (default 1).\n");
+        printf("  -threads <list>\tComma separated thread counts to measure, 1,2,4 for example.\n");
+        printf("  -sweep   \tMeasure 1, 2, 4... up to the number of hardware threads.\n");
+        printf("  -counters\tReport the instructions per cycle, cache misses and branch mispredictions of each stage.\n\n");
+
+        printf("The output file, when given, is written in the output stage of every run.\n");
+
+        return 1;
+    }
+
+    const uint hardwareThreads = nv::hardwareThreadCount();
+    if (sweep)
+    {
+        threadCounts.clear();
+        for (uint n = 1; n < hardwareThreads; n *= 2) threadCounts.append(n);
+        threadCounts.append(hardwareThreads);
+    }
+
+    nvtt::CompressionOptions compressionOptions;
+    compressionOptions.setFormat(settings.format);
+    compressionOptions.setQuality(settings.quality);
+
+    nvtt::Compressor context;
+    context.enableCudaAcceleration(settings.cuda);
+
+    const uint sweepCount = nv::max(threadCounts.count(), 1U);
+    float baseline = 0.0f;
+
+    for (uint s = 0; s < sweepCount; s++)
+    {
+        // The calling thread takes part in the work, so n threads are n-1 workers.
+        nv::TaskScheduler * scheduler = NULL;
+        if (threadCounts.count() > 0)
+        {
+            scheduler = new nv::TaskScheduler(threadCounts[s] - 1);
+            nv::TaskScheduler::setGlobal(scheduler);
+        }
+
+        const uint threadCount = nv::TaskScheduler::global()->workerCount() + 1;
+
+        RunTimes times;
+        bool success = true;
+        for (int i = 0; i < warmupCount && success; i++)
+        {
+            success = runOnce(settings, context, compressionOptions, times);
+        }
+
+        // The workers exist after the warmup, the counters are opened for all of them.
+        PerfCounters perfCounters;
+        if (counters && success)
+        {
+            if (perfCounters.open(/*allThreads=*/true)) s_counters = &perfCounters;
+            else fprintf(stderr, "Hardware performance counters are not available.\n");
+        }
+
+        // Per run: instructions per cycle in place of the cycles, and the other events per block.
+        nv::Array<float> samples[Stage_Count];
+        nv::Array<float> counterSamples[Stage_Count][PerfCounters::Counter_Count];
+        for (int i = 0; i < runCount && success; i++)
+        {
+            success = runOnce(settings, context, compressionOptions, times);
+            for (int k = 0; k < Stage_Count; k++)
+            {
+                samples[k].append(times.stage[k]);
+
+                const uint64 * c = times.counters[k];
+                counterSamples[k][PerfCounters::Counter_Cycles].append(c[PerfCounters::Counter_Cycles] ? float(c[PerfCounters::Counter_Instructions]) / c[PerfCounters::Counter_Cycles] : 0.0f);
+                for (int n = PerfCounters::Counter_Instructions; n < PerfCounters::Counter_Count; n++) {
+                    counterSamples[k][n].append(float(c[n]) / times.blockCount);
+                }
+            }
+        }
+
+        const bool counted = (s_counters != NULL);
+        s_counters = NULL;
+        perfCounters.close();
+
+        nv::TaskScheduler::setGlobal(NULL);
+        delete scheduler;
+
+        if (!success) return 1;
+
+        printf("%u thread%s, %d runs after %d warmup:\n", threadCount, threadCount > 1 ? "s" : "", runCount, warmupCount);
+        printf("  %-10s %12s %12s\n", "stage", "median (ms)", "p95 (ms)");
+
+        float median[Stage_Count];
+        for (int k = 0; k < Stage_Count; k++)
+        {
+            sortSamples(samples[k]);
+            median[k] = percentile(samples[k], 0.5f);
+            if (samples[k].back() == 0.0f) continue; // Skipped stage.
+
+            printf("  %-10s %12.3f %12.3f\n", s_stageNames[k], 1000 * median[k], 1000 * percentile(samples[k], 0.95f));
+        }
+
+        if (counted)
+        {
+            printf("\n  %-10s %8s %14s %14s %14s\n", "stage", "IPC", "instr/block", "LLC miss/block", "br miss/block");
+            for (int k = 0; k < Stage_Count; k++)
+            {
+                if (samples[k].back() == 0.0f) continue;
+
+                float m[PerfCounters::Counter_Count];
+                for (int n = 0; n < PerfCounters::Counter_Count; n++) {
+                    sortSamples(counterSamples[k][n]);
+                    m[n] = percentile(counterSamples[k][n], 0.5f);
+                }
+                printf("  %-10s %8.2f %14.1f %14.3f %14.3f\n", s_stageNames[k], m[PerfCounters::Counter_Cycles], m[PerfCounters::Counter_Instructions], m[PerfCounters::Counter_CacheMisses], m[PerfCounters::Counter_BranchMisses]);
+            }
+        }
+
+        if (s == 0) baseline = median[Stage_Total];
+
+        printf("  %.3f textures/s", 1.0f / median[Stage_Total]);
+        if (threadCounts.count() > 1) printf(", %.2fx speedup", baseline / median[Stage_Total]);
+        printf("\n\n");
+    }
+
+    return 0;
 }
-
@@ -35,11 +35,21 @@
 #include <nvcore/StdStream.h>
 #include <nvcore/FileSystem.h>
 #include <nvcore/Timer.h>
+#include <nvthread/AsyncOutputStream.h>
+#include <nvthread/Atomic.h>
+#include <nvthread/Event.h>
+#include <nvthread/Mutex.h>
+#include <nvthread/Thread.h>
+#include <nvcore/Array.inl>
 
 
 struct MyOutputHandler : public nvtt::OutputHandler
 {
-    MyOutputHandler(const char * name) : total(0), progress(0), percentage(0), stream(new nv::StdOutputStream(name)) {}
+    MyOutputHandler(const char * name, bool async, bool unbuffered) : total(0), progress(0), percentage(0)
+    {
+        if (async) stream = new nv::AsyncOutputStream(name, unbuffered);
+        else stream = new nv::StdOutputStream(name);
+    }
     virtual ~MyOutputHandler() { delete stream; }
 
     void setTotal(int64 t)
@@ -85,7 +95,7 @@ struct MyOutputHandler : public nvtt::OutputHandler
     int64 progress;
     int percentage;
     bool verbose;
-    nv::StdOutputStream * stream;
+    nv::Stream * stream;
 };
 
 struct MyErrorHandler : public nvtt::ErrorHandler
@@ -133,276 +143,50 @@ void setColorMap(nvtt::InputOptions & inputOptions)
 }
 
 
-
-int main(int argc, char *argv[])
+// DDS files, supercompressed ones have the .ddsz extension.
+static bool isDdsFile(const nv::Path & fileName)
 {
-    MyAssertHandler assertHandler;
-    MyMessageHandler messageHandler;
-
-    bool alpha = false;
-    bool normal = false;
-    bool color2normal = false;
-    bool wrapRepeat = false;
-    bool noMipmaps = false;
-    bool fast = false;
-    bool nocuda = false;
-    bool bc1n = false;
-    bool luminance = false;
-    nvtt::Format format = nvtt::Format_BC1;
-    bool premultiplyAlpha = false;
-    nvtt::MipmapFilter mipmapFilter = nvtt::MipmapFilter_Box;
-    bool loadAsFloat = false;
-    bool flip = true;
-
-    const char * externalCompressor = NULL;
-
-    bool silent = false;
-    bool dds10 = false;
-
-    nv::Path input;
-    nv::Path output;
-
-
-    // Parse arguments.
-    for (int i = 1; i < argc; i++)
-    {
-        // Input options.
-        if (strcmp("-color", argv[i]) == 0)
-        {
-        }
-        else if (strcmp("-alpha", argv[i]) == 0)
-        {
-            alpha = true;
-        }
-        else if (strcmp("-normal", argv[i]) == 0)
-        {
-            normal = true;
-        }
-        else if (strcmp("-tonormal", argv[i]) == 0)
-        {
-            color2normal = true;
-        }
-        else if (strcmp("-clamp", argv[i]) == 0)
-        {
-        }
-        else if (strcmp("-repeat", argv[i]) == 0)
-        {
-            wrapRepeat = true;
-        }
-        else if (strcmp("-nomips", argv[i]) == 0)
-        {
-            noMipmaps = true;
-        }
-        else if (strcmp("-premula", argv[i]) == 0)
-        {
-            premultiplyAlpha = true;
-        }
-        else if (strcmp("-mipfilter", argv[i]) == 0)
-        {
-            if (i+1 == argc) break;
-            i++;
-
-            if (strcmp("box", argv[i]) == 0) mipmapFilter = nvtt::MipmapFilter_Box;
-            else if (strcmp("triangle", argv[i]) == 0) mipmapFilter = nvtt::MipmapFilter_Triangle;
-            else if (strcmp("kaiser", argv[i]) == 0) mipmapFilter = nvtt::MipmapFilter_Kaiser;
-        }
-        else if (strcmp("-float", argv[i]) == 0)
-        {
-            loadAsFloat = true;
-        }
-        else if (strcmp("-flip", argv[i]) == 0)
-        {
-            flip = true;
-        }
-
-        // Compression options.
-        else if (strcmp("-fast", argv[i]) == 0)
-        {
-            fast = true;
-        }
-        else if (strcmp("-nocuda", argv[i]) == 0)
-        {
-            nocuda = true;
-        }
-        else if (strcmp("-rgb", argv[i]) == 0)
-        {
-            format = nvtt::Format_RGB;
-        }
-        else if (strcmp("-lumi", argv[i]) == 0)
-        {
-            luminance = true;
-            format = nvtt::Format_RGB;
-        }
-        else if (strcmp("-bc1", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC1;
-        }
-        else if (strcmp("-bc1n", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC1;
-            bc1n = true;
-        }
-        else if (strcmp("-bc1a", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC1a;
-        }
-        else if (strcmp("-bc2", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC2;
-        }
-        else if (strcmp("-bc3", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC3;
-        }
-        else if (strcmp("-bc3n", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC3n;
-        }
-        else if (strcmp("-bc4", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC4;
-        }
-        else if (strcmp("-bc5", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC5;
-        }
-        else if (strcmp("-bc6", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC6;
-        }
-        else if (strcmp("-bc7", argv[i]) == 0)
-        {
-            format = nvtt::Format_BC7;
-        }
-
-        // Undocumented option. Mainly used for testing.
-        else if (strcmp("-ext", argv[i]) == 0)
-        {
-            if (i+1 < argc && argv[i+1][0] != '-') {
-                externalCompressor = argv[i+1];
-                i++;
-            }
-        }
-        else if (strcmp("-pause", argv[i]) == 0)
-        {
-            printf("Press ENTER\n"); fflush(stdout);
-            getchar();
-        }
-
-        // Output options
-        else if (strcmp("-silent", argv[i]) == 0)
-        {
-            silent = true;
-        }
-        else if (strcmp("-dds10", argv[i]) == 0)
-        {
-            dds10 = true;
-        }
-
-        else if (argv[i][0] != '-')
-        {
-            input = argv[i];
-
-            if (i+1 < argc && argv[i+1][0] != '-') {
-                output = argv[i+1];
-            }
-            else
-            {
-                output.copy(input.str());
-                output.stripExtension();
-                output.append(".dds");
-            }
-
-            break;
-        }
-		else
-		{
-			printf("Warning: unrecognized option \"%s\"\n", argv[i]);
-		}
-    }
-
-    const uint version = nvtt::version();
-    const uint major = version / 100 / 100;
-    const uint minor = (version / 100) % 100;
-    const uint rev = version % 100;
-
-
-    if (!silent)
-    {
-        printf("NVIDIA Texture Tools %u.%u.%u - Copyright NVIDIA Corporation 2007\n\n", major, minor, rev);
-    }
-
-    if (input.isNull())
-    {
-        printf("usage: nvcompress [options] infile [outfile.dds]\n\n");
-
-        printf("Input options:\n");
-        printf("  -color     \tThe input image is a color map (default).\n");
-        printf("  -alpha     \tThe input image has an alpha channel used for transparency.\n");
-        printf("  -normal    \tThe input image is a normal map.\n");
-        printf("  -tonormal  \tConvert input to normal map.\n");
-        printf("  -clamp     \tClamp wrapping mode (default).\n");
-        printf("  -repeat    \tRepeat wrapping mode.\n");
-        printf("  -nomips    \tDisable mipmap generation.\n");
-        printf("  -premula   \tPremultiply alpha into color channel.\n");
-        printf("  -mipfilter \tMipmap filter. One of the following: box, triangle, kaiser.\n");
-        printf("  -float     \tLoad as floating point image.\n");
-        printf("  -flip      \tFlip image before compression.\n\n");
-
-        printf("Compression options:\n");
-        printf("  -fast    \tFast compression.\n");
-        printf("  -nocuda  \tDo not use cuda compressor.\n");
-        printf("  -rgb     \tRGBA format\n");
-        printf("  -lumi    \tLUMINANCE format\n");
-        printf("  -bc1     \tBC1 format (DXT1)\n");
-        printf("  -bc1n    \tBC1 normal map format (DXT1nm)\n");
-        printf("  -bc1a    \tBC1 format with binary alpha (DXT1a)\n");
-        printf("  -bc2     \tBC2 format (DXT3)\n");
-        printf("  -bc3     \tBC3 format (DXT5)\n");
-        printf("  -bc3n    \tBC3 normal map format (DXT5nm)\n");
-        printf("  -bc4     \tBC4 format (ATI1)\n");
-        printf("  -bc5     \tBC5 format (3Dc/ATI2)\n");
-        printf("  -bc6     \tBC6 format\n");
-        printf("  -bc7     \tBC7 format\n\n");
-
-        printf("Output options:\n");
-        printf("  -silent  \tDo not output progress messages\n");
-        printf("  -dds10   \tUse DirectX 10 DDS format (enabled by default for BC6/7)\n\n");
-
-        return EXIT_FAILURE;
-    }
+    return nv::strCaseDiff(fileName.extension(), ".dds") == 0 || nv::strCaseDiff(fileName.extension(), ".ddsz") == 0;
+}
 
-    // Make sure input file exists.
-    if (!nv::FileSystem::exists(input.str()))
-    {
-        fprintf(stderr, "The file '%s' does not exist.\n", input.str());
-        return 1;
-    }
+// Extension of the output files that are not named explicitly.
+static const char * outputExtension(bool ktx, nvtt::Supercompression supercompression)
+{
+    if (ktx) return ".ktx";
+    return (supercompression != nvtt::Supercompression_None) ? ".ddsz" : ".dds";
+}
 
-    // Set input options.
-    nvtt::InputOptions inputOptions;
+// Supercompressed outputs are not standard DDS files, they can't be given the .dds extension.
+static bool isValidOutputName(const nv::Path & fileName, nvtt::Supercompression supercompression)
+{
+    return supercompression == nvtt::Supercompression_None || nv::strCaseDiff(fileName.extension(), ".dds") != 0;
+}
 
-    if (nv::strCaseDiff(input.extension(), ".dds") == 0)
+// Load the image or DDS file into the input options.
+bool loadInput(const nv::Path & fileName, bool loadAsFloat, bool flip, nvtt::InputOptions & inputOptions)
+{
+    if (isDdsFile(fileName))
     {
         // Load surface.
-        nv::DirectDrawSurface dds(input.str());
+        nv::DirectDrawSurface dds(fileName.str());
         if (!dds.isValid())
         {
-            fprintf(stderr, "The file '%s' is not a valid DDS file.\n", input.str());
-            return EXIT_FAILURE;
+            fprintf(stderr, "The file '%s' is not a valid DDS file.\n", fileName.str());
+            return false;
         }
 
         if (!dds.isSupported())
         {
-            fprintf(stderr, "The file '%s' is not a supported DDS file.\n", input.str());
-            return EXIT_FAILURE;
+            fprintf(stderr, "The file '%s' is not a supported DDS file.\n", fileName.str());
+            return false;
         }
 
+        // The faces of all the layers of arrays.
         uint faceCount;
         if (dds.isTexture2D())
         {
-            inputOptions.setTextureLayout(nvtt::TextureType_2D, dds.width(), dds.height());
-            faceCount = 1;
+            inputOptions.setTextureLayout(nvtt::TextureType_2D, dds.width(), dds.height(), 1, dds.arrayCount());
+            faceCount = dds.arrayCount();
         }
         else if (dds.isTexture3D())
         {
@@ -414,8 +198,8 @@ int main(int argc, char *argv[])
         else 
         {
             nvDebugCheck(dds.isTextureCube());
-            inputOptions.setTextureLayout(nvtt::TextureType_Cube, dds.width(), dds.height());
-            faceCount = 6;
+            inputOptions.setTextureLayout(nvtt::TextureType_Cube, dds.width(), dds.height(), 1, dds.arrayCount());
+            faceCount = 6 * dds.arrayCount();
         }
 
         uint mipmapCount = dds.mipmapCount();
@@ -434,19 +218,19 @@ int main(int argc, char *argv[])
     }
     else
     {
-        if (nv::strCaseDiff(input.extension(), ".exr") == 0 || nv::strCaseDiff(input.extension(), ".hdr") == 0)
+        if (nv::strCaseDiff(fileName.extension(), ".exr") == 0 || nv::strCaseDiff(fileName.extension(), ".hdr") == 0)
         {
             loadAsFloat = true;
         }
 
         if (loadAsFloat)
         {
-            nv::AutoPtr<nv::FloatImage> image(nv::ImageIO::loadFloat(input.str()));
+            nv::AutoPtr<nv::FloatImage> image(nv::ImageIO::loadFloat(fileName.str()));
 
             if (image == NULL)
             {
-                fprintf(stderr, "The file '%s' is not a supported image type.\n", input.str());
-                return EXIT_FAILURE;
+                fprintf(stderr, "The file '%s' is not a supported image type.\n", fileName.str());
+                return false;
             }
 
             if (flip)
@@ -464,10 +248,10 @@ int main(int argc, char *argv[])
         {
             // Regular image.
             nv::Image image;
-            if (!image.load(input.str()))
+            if (!image.load(fileName.str()))
             {
-                fprintf(stderr, "The file '%s' is not a supported image type.\n", input.str());
-                return 1;
+                fprintf(stderr, "The file '%s' is not a supported image type.\n", fileName.str());
+                return false;
             }
 
             if (flip)
@@ -478,6 +262,12 @@ int main(int argc, char *argv[])
         }
     }
 
+    return true;
+}
+
+// Apply the command line settings to the loaded input.
+void setInputSettings(nvtt::InputOptions & inputOptions, bool wrapRepeat, bool alpha, bool powerOfTwo, bool normal, bool color2normal, bool noMipmaps, nvtt::MipmapFilter mipmapFilter)
+{
     if (wrapRepeat)
     {
         inputOptions.setWrapMode(nvtt::WrapMode_Repeat);
@@ -496,8 +286,7 @@ int main(int argc, char *argv[])
         inputOptions.setAlphaMode(nvtt::AlphaMode_None);
     }
 
-    // Block compressed textures with mipmaps must be powers of two.
-    if (!noMipmaps && format != nvtt::Format_RGB)
+    if (powerOfTwo)
     {
         inputOptions.setRoundMode(nvtt::RoundMode_ToPreviousPowerOfTwo);
     }
@@ -527,8 +316,12 @@ int main(int argc, char *argv[])
     }*/
 
     inputOptions.setMipmapFilter(mipmapFilter);
+}
 
-    nvtt::CompressionOptions compressionOptions;
+
+// Apply the command line settings to the compression options.
+void setCompressionSettings(nvtt::CompressionOptions & compressionOptions, nvtt::Format format, bool fast, bool bc1n, bool luminance, float effort, float errorThreshold, uint bc7Modes, float rdoLambda)
+{
     compressionOptions.setFormat(format);
 
     //compressionOptions.setQuantization(/*color dithering*/true, /*alpha dithering*/false, /*binary alpha*/false);
@@ -571,80 +364,1265 @@ int main(int argc, char *argv[])
         //compressionOptions.setQuality(nvtt::Quality_Highest);
     }
 
+    compressionOptions.setEffort(effort);
+    compressionOptions.setErrorThreshold(errorThreshold);
+    compressionOptions.setBC7ModeMask(bc7Modes);
+    compressionOptions.setRateDistortionLambda(rdoLambda);
+
     if (bc1n)
     {
         compressionOptions.setColorWeights(1, 1, 0);
     }
 
-    
     //compressionOptions.setColorWeights(0.2126, 0.7152, 0.0722);
     //compressionOptions.setColorWeights(0.299, 0.587, 0.114);
     //compressionOptions.setColorWeights(3, 4, 2);
+}
 
-    if (externalCompressor != NULL)
+
+// One file of a batch.
+struct BatchItem
+{
+    nv::Path input;
+    nv::Path output;
+    nvtt::InputOptions inputOptions;
+    bool loaded;
+    nv::Event canLoad;  // Posted when the file enters the window of inputs kept in memory.
+    nv::Event ready;    // Posted once the file is loaded, or failed to load.
+};
+
+// The loader threads decode the inputs of a batch in order, a few files ahead of the compressor.
+struct BatchLoader
+{
+    nv::Array<BatchItem *> items;
+    uint32 next;
+    bool loadAsFloat;
+    bool flip;
+    bool ktx;
+    nvtt::Supercompression supercompression;
+};
+
+static void batchLoaderThread(void * arg)
+{
+    BatchLoader * loader = (BatchLoader *)arg;
+
+    for (;;)
     {
-        compressionOptions.setExternalCompressor(externalCompressor);
+        const uint i = nv::atomicIncrement(&loader->next) - 1;
+        if (i >= loader->items.count()) break;
+
+        BatchItem * item = loader->items[i];
+        item->canLoad.wait();
+        item->loaded = loadInput(item->input, loader->loadAsFloat, loader->flip, item->inputOptions);
+        item->ready.post();
     }
+}
 
+static void addBatchItem(BatchLoader * loader, const char * input, const char * output)
+{
+    BatchItem * item = new BatchItem;
+    item->input = input;
+    item->loaded = false;
 
-    MyErrorHandler errorHandler;
-    MyOutputHandler outputHandler(output.str());
-    if (outputHandler.stream->isError())
+    if (output != NULL)
     {
-        fprintf(stderr, "Error opening '%s' for writting\n", output.str());
-        return EXIT_FAILURE;
+        item->output = output;
+    }
+    else
+    {
+        item->output.copy(input);
+        item->output.stripExtension();
+        item->output.append(outputExtension(loader->ktx, loader->supercompression));
     }
 
-    nvtt::Context context;
-    context.enableCudaAcceleration(!nocuda);
+    loader->items.append(item);
+}
+
+static void addBatchFile(const char * path, void * arg)
+{
+    addBatchItem((BatchLoader *)arg, path, NULL);
+}
 
-    if (!silent) 
+// A batch is either a file name pattern, or a manifest with an input file per line, optionally followed by a tab and the
+// output file name. Empty lines and lines that start with '#' are skipped.
+static bool collectBatch(const char * batch, BatchLoader * loader)
+{
+    if (strchr(batch, '*') != NULL || strchr(batch, '?') != NULL)
     {
-        printf("CUDA acceleration ");
-        if (context.isCudaAccelerationEnabled())
+        nv::FileSystem::findFiles(batch, addBatchFile, loader);
+        return true;
+    }
+
+    FILE * fp = nv::fileOpen(batch, "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Error opening manifest '%s'\n", batch);
+        return false;
+    }
+
+    char line[2048];
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+
+        char * tab = strchr(line, '\t');
+        if (tab != NULL) *tab = '\0';
+
+        const char * output = (tab != NULL && tab[1] != '\0') ? tab + 1 : NULL;
+        if (output != NULL && !isValidOutputName(output, loader->supercompression))
         {
-            printf("ENABLED\n\n");
+            fprintf(stderr, "Supercompressed output '%s' needs the .ddsz extension\n", output);
+            fclose(fp);
+            return false;
         }
-        else
+
+        addBatchItem(loader, line, output);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+
+// Records the events of the library and saves them when main returns, after the compressor is gone.
+struct TraceFile
+{
+    ~TraceFile()
+    {
+        if (!fileName.isNull())
         {
-            printf("DISABLED\n\n");
+            nvtt::setProfiler(NULL);
+            if (!profiler.save(fileName.str())) fprintf(stderr, "Error writing trace file '%s'.\n", fileName.str());
         }
     }
 
-    outputHandler.setTotal(context.estimateSize(inputOptions, compressionOptions));
-    outputHandler.setDisplayProgress(!silent);
+    void start(const char * name)
+    {
+        fileName = name;
+        nvtt::setProfiler(&profiler);
+    }
+
+    nvtt::TraceProfiler profiler;
+    nv::Path fileName;
+};
+
+
+// Server mode: the jobs are read from stdin, one per line, and their status is written to stdout, one line per job in
+// the order they finish. A job is an id, the options below, the input file and optionally the output file:
+//
+//   <id> [-color|-alpha|-normal|-tonormal] [-clamp|-repeat] [-nomips] [-mipfilter <filter>] [-float] [-fast]
+//        [-rgb|-lumi|-bc1|-bc1n|-bc1a|-bc2|-bc3|-bc3n|-bc4|-bc5|-bc6|-bc7] [-dds10|-ktx] <input> [<output>]
+//
+// Arguments with spaces are quoted with double quotes. The other settings come from the command line of the server,
+// which also sets the defaults of these. The status is '<id> ok <seconds>' once the output file is closed, or
+// '<id> error <message>'. Empty lines and lines that start with '#' are skipped, 'quit' or the end of the input stop
+// the server once the running jobs are done. The server doesn't read the next job while the maximum number of jobs
+// is running, so a client that sends jobs faster than they are done blocks on the pipe.
+
+// Settings of a job, the defaults come from the command line.
+struct JobSettings
+{
+    nvtt::Format format;
+    bool alpha;
+    bool normal;
+    bool color2normal;
+    bool wrapRepeat;
+    bool noMipmaps;
+    nvtt::MipmapFilter mipmapFilter;
+    bool loadAsFloat;
+    bool fast;
+    bool bc1n;
+    bool luminance;
+    bool dds10;
+    bool ktx;
+};
+
+// Settings of the command line that are the same for all the jobs.
+struct ServerSettings
+{
+    JobSettings defaults;
+    bool flip;
+    float effort;
+    float errorThreshold;
+    uint bc7Modes;
+    float rdoLambda;
+    const char * externalCompressor;
+    int streamingWindow;
+    bool blockCache;
+    nvtt::Supercompression supercompression;
+};
+
+static nv::Mutex s_statusMutex;
+
+// Write the status of a job, error is NULL when it succeeded.
+static void reportJob(const char * id, const char * error, float seconds)
+{
+    nv::Lock<nv::Mutex> lock(s_statusMutex);
+    if (error == NULL) printf("%s ok %.3f\n", id, seconds);
+    else printf("%s error %s\n", id, error);
+    fflush(stdout);
+}
+
+// A job of the server. Keeps the options and the output alive while it runs.
+struct ServerJob : public nvtt::JobHandler, public nvtt::ErrorHandler
+{
+    ServerJob() : outputHandler(NULL), failed(false), firstError(nvtt::Error_Unknown) {}
+    virtual ~ServerJob() { delete outputHandler; }
+
+    virtual void error(nvtt::Error e)
+    {
+        if (!failed)
+        {
+            failed = true;
+            firstError = e;
+        }
+    }
+
+    // The output is closed before the status is written, so that the client can read it right away.
+    virtual void jobFinished(bool success)
+    {
+        delete outputHandler;
+        outputHandler = NULL;
+        timer.stop();
+
+        if (success && !failed) reportJob(id.str(), NULL, timer.elapsed());
+        else reportJob(id.str(), failed ? nvtt::errorString(firstError) : "compression failed", 0.0f);
+    }
 
+    nv::String id;
+    nvtt::InputOptions inputOptions;
+    nvtt::CompressionOptions compressionOptions;
     nvtt::OutputOptions outputOptions;
-    //outputOptions.setFileName(output);
-    outputOptions.setOutputHandler(&outputHandler);
-    outputOptions.setErrorHandler(&errorHandler);
+    MyOutputHandler * outputHandler;
+    bool failed;
+    nvtt::Error firstError;
+    nv::Timer timer;
+    nvtt::Job job;
+};
 
-	// Automatically use dds10 if compressing to BC6 or BC7
-	if (format == nvtt::Format_BC6 || format == nvtt::Format_BC7)
-	{
-		dds10 = true;
-	}
+// Split the line in place into its arguments.
+static void splitJobLine(char * line, nv::Array<const char *> & args)
+{
+    char * p = line;
+    for (;;)
+    {
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '\0') break;
+
+        if (*p == '"')
+        {
+            args.append(++p);
+            while (*p != '\0' && *p != '"') p++;
+        }
+        else
+        {
+            args.append(p);
+            while (*p != '\0' && *p != ' ' && *p != '\t') p++;
+        }
+
+        if (*p == '\0') break;
+        *p++ = '\0';
+    }
+}
+
+// Parse the options, input and output of a job. Returns the error message, or NULL.
+static const char * parseJob(const nv::Array<const char *> & args, nvtt::Supercompression supercompression, JobSettings & settings, nv::Path & input, nv::Path & output)
+{
+    uint i = 1;
+    for (; i < args.count() && args[i][0] == '-'; i++)
+    {
+        const char * arg = args[i];
+
+        if (strcmp("-color", arg) == 0) { settings.alpha = false; settings.normal = false; settings.color2normal = false; }
+        else if (strcmp("-alpha", arg) == 0) settings.alpha = true;
+        else if (strcmp("-normal", arg) == 0) settings.normal = true;
+        else if (strcmp("-tonormal", arg) == 0) settings.color2normal = true;
+        else if (strcmp("-clamp", arg) == 0) settings.wrapRepeat = false;
+        else if (strcmp("-repeat", arg) == 0) settings.wrapRepeat = true;
+        else if (strcmp("-nomips", arg) == 0) settings.noMipmaps = true;
+        else if (strcmp("-float", arg) == 0) settings.loadAsFloat = true;
+        else if (strcmp("-fast", arg) == 0) settings.fast = true;
+        else if (strcmp("-dds10", arg) == 0) settings.dds10 = true;
+        else if (strcmp("-ktx", arg) == 0) settings.ktx = true;
+        else if (strcmp("-mipfilter", arg) == 0 && i+1 < args.count())
+        {
+            i++;
+            if (strcmp("box", args[i]) == 0) settings.mipmapFilter = nvtt::MipmapFilter_Box;
+            else if (strcmp("triangle", args[i]) == 0) settings.mipmapFilter = nvtt::MipmapFilter_Triangle;
+            else if (strcmp("kaiser", args[i]) == 0) settings.mipmapFilter = nvtt::MipmapFilter_Kaiser;
+            else return "unknown mipmap filter";
+        }
+        else
+        {
+            static const struct { const char * name; nvtt::Format format; } formats[] = {
+                { "-rgb", nvtt::Format_RGB }, { "-lumi", nvtt::Format_RGB }, { "-bc1", nvtt::Format_BC1 }, { "-bc1n", nvtt::Format_BC1 },
+                { "-bc1a", nvtt::Format_BC1a }, { "-bc2", nvtt::Format_BC2 }, { "-bc3", nvtt::Format_BC3 }, { "-bc3n", nvtt::Format_BC3n },
+                { "-bc4", nvtt::Format_BC4 }, { "-bc5", nvtt::Format_BC5 }, { "-bc6", nvtt::Format_BC6 }, { "-bc7", nvtt::Format_BC7 },
+            };
+
+            uint f = 0;
+            const uint formatCount = sizeof(formats) / sizeof(formats[0]);
+            while (f < formatCount && strcmp(formats[f].name, arg) != 0) f++;
+            if (f == formatCount) return "unknown option";
+
+            settings.format = formats[f].format;
+            settings.bc1n = (strcmp("-bc1n", arg) == 0);
+            settings.luminance = (strcmp("-lumi", arg) == 0);
+        }
+    }
+
+    if (i >= args.count()) return "missing input file";
+    input = args[i++];
+
+    if (i < args.count())
+    {
+        output = args[i++];
+    }
+    else
+    {
+        output.copy(input.str());
+        output.stripExtension();
+        output.append(outputExtension(settings.ktx, supercompression));
+    }
 
-    if (dds10)
+    if (!isValidOutputName(output, supercompression)) return "supercompressed outputs need the .ddsz extension";
+
+    if (i < args.count()) return "unexpected argument after the output file";
+
+    return NULL;
+}
+
+// Start the job of the line, or report why it can't be started.
+static ServerJob * startJob(nvtt::Context & context, const ServerSettings & server, const nv::Array<const char *> & args)
+{
+    JobSettings settings = server.defaults;
+    nv::Path input, output;
+
+    const char * error = parseJob(args, server.supercompression, settings, input, output);
+    if (error != NULL)
+    {
+        reportJob(args[0], error, 0.0f);
+        return NULL;
+    }
+
+    nv::AutoPtr<ServerJob> job(new ServerJob);
+    job->id = args[0];
+    job->timer.start();
+
+    if (!loadInput(input, settings.loadAsFloat, server.flip, job->inputOptions))
+    {
+        reportJob(args[0], "cannot load the input file", 0.0f);
+        return NULL;
+    }
+
+    // Block compressed textures with mipmaps must be powers of two.
+    const bool powerOfTwo = !settings.noMipmaps && settings.format != nvtt::Format_RGB;
+    setInputSettings(job->inputOptions, settings.wrapRepeat, settings.alpha, powerOfTwo, settings.normal, settings.color2normal, settings.noMipmaps, settings.mipmapFilter);
+
+    setCompressionSettings(job->compressionOptions, settings.format, settings.fast, settings.bc1n, settings.luminance, server.effort, server.errorThreshold, server.bc7Modes, server.rdoLambda);
+    if (server.externalCompressor != NULL)
+    {
+        job->compressionOptions.setExternalCompressor(server.externalCompressor);
+    }
+
+    job->outputHandler = new MyOutputHandler(output.str(), /*async=*/false, /*unbuffered=*/false);
+    if (job->outputHandler->stream->isError())
+    {
+        reportJob(args[0], "cannot open the output file", 0.0f);
+        return NULL;
+    }
+    job->outputHandler->setTotal(0);
+    job->outputHandler->setDisplayProgress(false);
+
+    nvtt::OutputOptions & outputOptions = job->outputOptions;
+    outputOptions.setOutputHandler(job->outputHandler);
+    outputOptions.setErrorHandler(job.ptr());
+    outputOptions.setStreamingWindow(server.streamingWindow);
+    outputOptions.enableBlockCache(server.blockCache);
+    outputOptions.setSupercompression(server.supercompression);
+
+    if (settings.ktx)
+    {
+        outputOptions.setContainer(nvtt::Container_KTX);
+    }
+    else if (settings.dds10 || settings.format == nvtt::Format_BC6 || settings.format == nvtt::Format_BC7)
     {
         outputOptions.setContainer(nvtt::Container_DDS10);
     }
 
-    // printf("Press ENTER.\n");
-    // fflush(stdout);
-    // getchar();
+    context.processAsync(job->job, job->inputOptions, job->compressionOptions, job->outputOptions, job.ptr());
 
-    nv::Timer timer;
-    timer.start();
+    return job.release();
+}
+
+// Run the jobs of stdin until it ends, up to maxJobs at once on the workers of the task scheduler. The compressor, its
+// CUDA context and memory pool, the tables and the workers stay warm from one job to the next.
+static int runServer(nvtt::Context & context, const ServerSettings & server, uint maxJobs)
+{
+    nv::Array<ServerJob *> running;
+    char line[4096];
 
-    if (!context.process(inputOptions, compressionOptions, outputOptions))
+    for (;;)
     {
-        return EXIT_FAILURE;
+        // Release the jobs that are done, and wait for the oldest one while all the slots are taken.
+        for (uint i = 0; i < running.count(); )
+        {
+            if (running[i]->job.isDone())
+            {
+                delete running[i];
+                running.removeAt(i);
+            }
+            else i++;
+        }
+        while (running.count() >= maxJobs)
+        {
+            running[0]->job.wait();
+            delete running[0];
+            running.removeAt(0);
+        }
+
+        if (fgets(line, sizeof(line), stdin) == NULL) break;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        nv::Array<const char *> args;
+        splitJobLine(line, args);
+
+        if (args.isEmpty() || args[0][0] == '#') continue;
+        if (args.count() == 1 && strcmp("quit", args[0]) == 0) break;
+
+        ServerJob * job = startJob(context, server, args);
+        if (job != NULL) running.append(job);
     }
-    timer.stop();
 
-    if (!silent) {
-        printf("\rtime taken: %.3f seconds\n", timer.elapsed());
+    for (uint i = 0; i < running.count(); i++)
+    {
+        running[i]->job.wait();
+        delete running[i];
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+    MyAssertHandler assertHandler;
+    MyMessageHandler messageHandler;
+    TraceFile traceFile;
+
+    bool alpha = false;
+    bool normal = false;
+    bool color2normal = false;
+    bool wrapRepeat = false;
+    bool noMipmaps = false;
+    bool fast = false;
+    float effort = -1.0f;
+    float errorThreshold = 0.0f;
+    uint bc7Modes = 0xFF;
+    float rdoLambda = 0.0f;
+    float targetError = 0.0f;
+    bool nocuda = false;
+    bool pipeline = false;
+    bool checkDeterminism = false;
+    int outOfCoreThreshold = 0;
+    bool hugePages = false;
+    bool bc1n = false;
+    bool luminance = false;
+    nvtt::Format format = nvtt::Format_BC1;
+    bool premultiplyAlpha = false;
+    nvtt::MipmapFilter mipmapFilter = nvtt::MipmapFilter_Box;
+    bool loadAsFloat = false;
+    bool flip = true;
+
+    const char * externalCompressor = NULL;
+
+    bool silent = false;
+    int streamingWindow = 0;
+    bool blockCache = false;
+    bool asyncOutput = false;
+    bool unbufferedOutput = false;
+    bool dds10 = false;
+    bool ktx = false;
+    bool transcode = false;
+    nvtt::Supercompression supercompression = nvtt::Supercompression_None;
+
+    nv::Path input;
+    nv::Path output;
+
+    nv::Path previousInput;
+    nv::Path previousOutput;
+
+    nv::Path batch;
+    nv::Path cacheDirectory;
+    int cacheSize = 1024;
+
+    bool server = false;
+    uint serverJobs = 0;
+
+
+    // Parse arguments.
+    for (int i = 1; i < argc; i++)
+    {
+        // Input options.
+        if (strcmp("-color", argv[i]) == 0)
+        {
+        }
+        else if (strcmp("-alpha", argv[i]) == 0)
+        {
+            alpha = true;
+        }
+        else if (strcmp("-normal", argv[i]) == 0)
+        {
+            normal = true;
+        }
+        else if (strcmp("-tonormal", argv[i]) == 0)
+        {
+            color2normal = true;
+        }
+        else if (strcmp("-clamp", argv[i]) == 0)
+        {
+        }
+        else if (strcmp("-repeat", argv[i]) == 0)
+        {
+            wrapRepeat = true;
+        }
+        else if (strcmp("-nomips", argv[i]) == 0)
+        {
+            noMipmaps = true;
+        }
+        else if (strcmp("-premula", argv[i]) == 0)
+        {
+            premultiplyAlpha = true;
+        }
+        else if (strcmp("-mipfilter", argv[i]) == 0)
+        {
+            if (i+1 == argc) break;
+            i++;
+
+            if (strcmp("box", argv[i]) == 0) mipmapFilter = nvtt::MipmapFilter_Box;
+            else if (strcmp("triangle", argv[i]) == 0) mipmapFilter = nvtt::MipmapFilter_Triangle;
+            else if (strcmp("kaiser", argv[i]) == 0) mipmapFilter = nvtt::MipmapFilter_Kaiser;
+        }
+        else if (strcmp("-float", argv[i]) == 0)
+        {
+            loadAsFloat = true;
+        }
+        else if (strcmp("-flip", argv[i]) == 0)
+        {
+            flip = true;
+        }
+
+        // Compression options.
+        else if (strcmp("-fast", argv[i]) == 0)
+        {
+            fast = true;
+        }
+        else if (strcmp("-effort", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                effort = float(atof(argv[i+1]));
+                i++;
+            }
+        }
+        else if (strcmp("-threshold", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                errorThreshold = float(atof(argv[i+1]));
+                i++;
+            }
+        }
+        else if (strcmp("-nocuda", argv[i]) == 0)
+        {
+            nocuda = true;
+        }
+        else if (strcmp("-pipeline", argv[i]) == 0)
+        {
+            pipeline = true;
+        }
+        else if (strcmp("-checkdeterminism", argv[i]) == 0)
+        {
+            checkDeterminism = true;
+        }
+        else if (strcmp("-outofcore", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                outOfCoreThreshold = atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp("-hugepages", argv[i]) == 0)
+        {
+            hugePages = true;
+        }
+        else if (strcmp("-trace", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                traceFile.start(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp("-rgb", argv[i]) == 0)
+        {
+            format = nvtt::Format_RGB;
+        }
+        else if (strcmp("-lumi", argv[i]) == 0)
+        {
+            luminance = true;
+            format = nvtt::Format_RGB;
+        }
+        else if (strcmp("-bc1", argv[i]) == 0)
+        {
+            format = nvtt::Format_BC1;
+        }
+        else if (strcmp("-bc1n", argv[i]) == 0)
+        {
+            format = nvtt::Format_BC1;
+            bc1n = true;
+        }
+        else if (strcmp("-bc1a", argv[i]) == 0)
+        {
+            format = nvtt::Format_BC1a;
+        }
+        else if (strcmp("-bc2", argv[i]) == 0)
+        {
+            format = nvtt::Format_BC2;
+        }
+        else if (strcmp("-bc3", argv[i]) == 0)
+        {
+            format = nvtt::Format_BC3;
+        }
+        else if (strcmp("-bc3n", argv[i]) == 0)
+        {
+            format = nvtt::Format_BC3n;
+        }
+        else if (strcmp("-bc4", argv[i]) == 0)
+        {
+            format = nvtt::Format_BC4;
+        }
+        else if (strcmp("-bc5", argv[i]) == 0)
+        {
+            format = nvtt::Format_BC5;
+        }
+        else if (strcmp("-bc6", argv[i]) == 0)
+        {
+            format = nvtt::Format_BC6;
+        }
+        else if (strcmp("-bc7", argv[i]) == 0)
+        {
+            format = nvtt::Format_BC7;
+        }
+        else if (strcmp("-bc7modes", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                bc7Modes = uint(strtoul(argv[i+1], NULL, 0));
+                i++;
+            }
+        }
+        else if (strcmp("-rdo", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                rdoLambda = float(atof(argv[i+1]));
+                i++;
+            }
+        }
+        else if (strcmp("-target", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                // In 8 bit units, selectFormat takes the error of [0, 1] texels.
+                targetError = float(atof(argv[i+1])) / 255.0f;
+                i++;
+            }
+        }
+
+        // Undocumented option. Mainly used for testing.
+        else if (strcmp("-ext", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                externalCompressor = argv[i+1];
+                i++;
+            }
+        }
+        else if (strcmp("-pause", argv[i]) == 0)
+        {
+            printf("Press ENTER\n"); fflush(stdout);
+            getchar();
+        }
+
+        // Output options
+        else if (strcmp("-silent", argv[i]) == 0)
+        {
+            silent = true;
+        }
+        else if (strcmp("-dds10", argv[i]) == 0)
+        {
+            dds10 = true;
+        }
+        else if (strcmp("-ktx", argv[i]) == 0)
+        {
+            ktx = true;
+        }
+        else if (strcmp("-stream", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                streamingWindow = atoi(argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp("-blockcache", argv[i]) == 0)
+        {
+            blockCache = true;
+        }
+        else if (strcmp("-async", argv[i]) == 0)
+        {
+            asyncOutput = true;
+        }
+        else if (strcmp("-unbuffered", argv[i]) == 0)
+        {
+            asyncOutput = true;
+            unbufferedOutput = true;
+        }
+        else if (strcmp("-previous", argv[i]) == 0)
+        {
+            if (i+2 < argc && argv[i+1][0] != '-' && argv[i+2][0] != '-') {
+                previousInput = argv[i+1];
+                previousOutput = argv[i+2];
+                i += 2;
+            }
+        }
+        else if (strcmp("-batch", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                batch = argv[i+1];
+                i++;
+            }
+        }
+        else if (strcmp("-supercompress", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                if (strcmp("deflate", argv[i+1]) == 0) supercompression = nvtt::Supercompression_Deflate;
+                else if (strcmp("zstd", argv[i+1]) == 0) supercompression = nvtt::Supercompression_Zstd;
+                else if (strcmp("lz4", argv[i+1]) == 0) supercompression = nvtt::Supercompression_LZ4;
+                else printf("Warning: unknown supercompression scheme '%s'\n", argv[i+1]);
+                i++;
+            }
+        }
+        else if (strcmp("-transcode", argv[i]) == 0)
+        {
+            transcode = true;
+        }
+        else if (strcmp("-server", argv[i]) == 0)
+        {
+            server = true;
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                serverJobs = uint(atoi(argv[i+1]));
+                i++;
+            }
+        }
+        else if (strcmp("-cache", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                cacheDirectory = argv[i+1];
+                i++;
+            }
+        }
+        else if (strcmp("-cachesize", argv[i]) == 0)
+        {
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                cacheSize = atoi(argv[i+1]);
+                i++;
+            }
+        }
+
+        else if (argv[i][0] != '-')
+        {
+            input = argv[i];
+
+            if (i+1 < argc && argv[i+1][0] != '-') {
+                output = argv[i+1];
+            }
+            else
+            {
+                output.copy(input.str());
+                output.stripExtension();
+                output.append(outputExtension(ktx, supercompression));
+            }
+
+            break;
+        }
+		else
+		{
+			printf("Warning: unrecognized option \"%s\"\n", argv[i]);
+		}
+    }
+
+    // The output of the server is the status of its jobs.
+    if (server)
+    {
+        silent = true;
+    }
+
+    const uint version = nvtt::version();
+    const uint major = version / 100 / 100;
+    const uint minor = (version / 100) % 100;
+    const uint rev = version % 100;
+
+
+    if (!silent)
+    {
+        printf("NVIDIA Texture Tools %u.%u.%u - Copyright NVIDIA Corporation 2007\n\n", major, minor, rev);
+    }
+
+    if (input.isNull() && batch.isNull() && !server)
+    {
+        printf("usage: nvcompress [options] infile [outfile.dds]\n");
+        printf("       nvcompress [options] -batch <manifest|pattern>\n");
+        printf("       nvcompress [options] -server [jobs]\n\n");
+
+        printf("Input options:\n");
+        printf("  -color     \tThe input image is a color map (default).\n");
+        printf("  -alpha     \tThe input image has an alpha channel used for transparency.\n");
+        printf("  -normal    \tThe input image is a normal map.\n");
+        printf("  -tonormal  \tConvert input to normal map.\n");
+        printf("  -clamp     \tClamp wrapping mode (default).\n");
+        printf("  -repeat    \tRepeat wrapping mode.\n");
+        printf("  -nomips    \tDisable mipmap generation.\n");
+        printf("  -premula   \tPremultiply alpha into color channel.\n");
+        printf("  -mipfilter \tMipmap filter. One of the following: box, triangle, kaiser.\n");
+        printf("  -float     \tLoad as floating point image.\n");
+        printf("  -flip      \tFlip image before compression.\n\n");
+
+        printf("Compression options:\n");
+        printf("  -fast    \tFast compression.\n");
+        printf("  -effort <e>\tSearch effort between 0 and 1, 0.5 by default.\n");
+        printf("  -threshold <t>\tStop the BC6/BC7 mode search at this fraction of the block variance.\n");
+        printf("  -nocuda  \tDo not use cuda compressor.\n");
+        printf("  -ext <name>\tCompress BC1, BC2, BC3, BC4, BC5 and BC7 blocks with the encoder library <name> of nvtt_encoder.h.\n");
+        printf("  -pipeline\tOverlap mipmap generation with compression.\n");
+        printf("  -checkdeterminism\tCompress again on a single thread and fail if the output differs.\n");
+        printf("  -outofcore <MB>\tKeep images larger than <MB> in scratch files.\n");
+        printf("  -hugepages\tBack large images with huge pages.\n");
+        printf("  -trace <file>\tSave a timeline of the compression for chrome://tracing or Perfetto.\n");
+        printf("  -rgb     \tRGBA format\n");
+        printf("  -lumi    \tLUMINANCE format\n");
+        printf("  -bc1     \tBC1 format (DXT1)\n");
+        printf("  -bc1n    \tBC1 normal map format (DXT1nm)\n");
+        printf("  -bc1a    \tBC1 format with binary alpha (DXT1a)\n");
+        printf("  -bc2     \tBC2 format (DXT3)\n");
+        printf("  -bc3     \tBC3 format (DXT5)\n");
+        printf("  -bc3n    \tBC3 normal map format (DXT5nm)\n");
+        printf("  -bc4     \tBC4 format (ATI1)\n");
+        printf("  -bc5     \tBC5 format (3Dc/ATI2)\n");
+        printf("  -bc6     \tBC6 format\n");
+        printf("  -bc7     \tBC7 format\n");
+        printf("  -bc7modes <mask>\tBC7 modes to use, bit i enables mode i. 0x40 with -fast uses a single pass mode 6 encoder.\n");
+        printf("  -rdo <lambda>\tBC1, BC3, BC4, BC5 and BC7 blocks reuse their neighbors' endpoints and indices to compress better losslessly.\n");
+        printf("  -target <rmse>\tUse the cheapest of BC1, BC3 and BC7 and quality whose RMS error is below <rmse>, in 8 bit\n");
+        printf("           \tunits (0 to 255), estimated on a sample of the blocks of the input.\n\n");
+
+        printf("Output options:\n");
+        printf("  -silent  \tDo not output progress messages\n");
+        printf("  -dds10   \tUse DirectX 10 DDS format (enabled by default for BC6/7)\n");
+        printf("  -ktx     \tUse KTX format\n");
+        printf("  -stream <rows>\tWrite compressed output every <rows> block rows.\n");
+        printf("  -blockcache\tReuse the output of identical blocks.\n");
+        printf("  -async   \tWrite the output file from a background thread.\n");
+        printf("  -unbuffered\tWrite the output file from a background thread, past the system cache.\n");
+        printf("  -previous <image> <dds>\tOnly compress the blocks that changed since the previous image, copy the others from its output.\n");
+        printf("  -batch <file>\tCompress many files in one process. <file> is a name pattern, like textures/*.png, or a manifest\n");
+        printf("           \twith an input file per line, optionally followed by a tab and the output file.\n");
+        printf("  -supercompress <scheme>\tCompress the output losslessly with deflate, zstd or lz4, into a .ddsz file.\n");
+        printf("  -transcode \tConvert a block compressed DDS input block by block, keeping its mipmaps.\n");
+        printf("  -cache <dir>\tReuse the outputs of previous runs with the same input and options, kept in <dir>.\n");
+        printf("  -cachesize <MB>\tMaximum size of the output cache, 1024 MB by default.\n");
+        printf("  -server [jobs]\tRead jobs from stdin, one per line: an id, input and format options, the input file and optionally\n");
+        printf("           \tthe output file. Writes '<id> ok <seconds>' or '<id> error <message>' to stdout as each job is done.\n");
+        printf("           \tRuns up to [jobs] at once, the number of hardware threads by default.\n\n");
+
+        return EXIT_FAILURE;
+    }
+
+    // Make sure input file exists.
+    if (batch.isNull() && !server && !nv::FileSystem::exists(input.str()))
+    {
+        fprintf(stderr, "The file '%s' does not exist.\n", input.str());
+        return 1;
+    }
+
+    // Block compressed textures with mipmaps must be powers of two.
+    const bool powerOfTwo = !noMipmaps && format != nvtt::Format_RGB;
+
+    nvtt::CompressionOptions compressionOptions;
+    setCompressionSettings(compressionOptions, format, fast, bc1n, luminance, effort, errorThreshold, bc7Modes, rdoLambda);
+
+    if (externalCompressor != NULL)
+    {
+        compressionOptions.setExternalCompressor(externalCompressor);
+    }
+
+
+    nvtt::Context context;
+    context.enableCudaAcceleration(!nocuda);
+    context.enablePipelining(pipeline);
+    context.enableDeterminismCheck(checkDeterminism);
+
+    if (!cacheDirectory.isNull())
+    {
+        context.setOutputCache(cacheDirectory.str(), cacheSize);
+    }
+
+    // The files of a batch or a server reuse the image buffers of the previous ones.
+    context.enableMemoryPool(!batch.isNull() || server);
+
+    nvtt::setOutOfCoreThreshold(outOfCoreThreshold);
+    nvtt::enableHugePages(hugePages);
+
+    if (!silent)
+    {
+        printf("CUDA acceleration ");
+        if (context.isCudaAccelerationEnabled())
+        {
+            printf("ENABLED\n\n");
+        }
+        else
+        {
+            printf("DISABLED\n\n");
+        }
+    }
+
+    MyErrorHandler errorHandler;
+
+    nvtt::OutputOptions outputOptions;
+    //outputOptions.setFileName(output);
+    outputOptions.setErrorHandler(&errorHandler);
+    outputOptions.setStreamingWindow(streamingWindow);
+    outputOptions.enableBlockCache(blockCache);
+
+    if (supercompression != nvtt::Supercompression_None)
+    {
+        if (!nvtt::isSupercompressionSupported(supercompression))
+        {
+            fprintf(stderr, "The requested supercompression scheme is not available in this build\n");
+            return EXIT_FAILURE;
+        }
+        if (!output.isNull() && !isValidOutputName(output, supercompression))
+        {
+            fprintf(stderr, "Supercompressed outputs are not standard DDS files, use the .ddsz extension\n");
+            return EXIT_FAILURE;
+        }
+        outputOptions.setSupercompression(supercompression);
+    }
+
+    if (targetError > 0.0f)
+    {
+        if (!batch.isNull() || transcode || server)
+        {
+            fprintf(stderr, "Warning: -target is ignored in batch, transcode and server modes\n");
+        }
+        else
+        {
+            nvtt::Surface image;
+            if (!image.load(input.str()))
+            {
+                fprintf(stderr, "Error opening input file '%s'.\n", input.str());
+                return EXIT_FAILURE;
+            }
+            if (alpha) image.setAlphaMode(nvtt::AlphaMode_Transparency);
+            if (normal) image.setNormalMap(true);
+
+            nvtt::Quality quality;
+            float error;
+            if (!context.selectFormat(image, targetError, compressionOptions, &format, &quality, &error) && !silent)
+            {
+                printf("Warning: no format meets the target error\n");
+            }
+
+            if (!silent)
+            {
+                static const char * const qualityNames[] = { "fastest", "normal", "production", "highest" };
+                printf("Selected %s, %s quality, estimated RMS error %.2f\n\n", format == nvtt::Format_BC1 ? "BC1" : format == nvtt::Format_BC3 ? "BC3" : "BC7", qualityNames[quality], error * 255.0f);
+            }
+        }
+    }
+
+    if (server)
+    {
+        if (!batch.isNull() || transcode || !previousInput.isNull())
+        {
+            fprintf(stderr, "Warning: -batch, -transcode and -previous are ignored in server mode\n");
+        }
+
+        ServerSettings settings;
+        settings.defaults.format = format;
+        settings.defaults.alpha = alpha;
+        settings.defaults.normal = normal;
+        settings.defaults.color2normal = color2normal;
+        settings.defaults.wrapRepeat = wrapRepeat;
+        settings.defaults.noMipmaps = noMipmaps;
+        settings.defaults.mipmapFilter = mipmapFilter;
+        settings.defaults.loadAsFloat = loadAsFloat;
+        settings.defaults.fast = fast;
+        settings.defaults.bc1n = bc1n;
+        settings.defaults.luminance = luminance;
+        settings.defaults.dds10 = dds10;
+        settings.defaults.ktx = ktx;
+        settings.flip = flip;
+        settings.effort = effort;
+        settings.errorThreshold = errorThreshold;
+        settings.bc7Modes = bc7Modes;
+        settings.rdoLambda = rdoLambda;
+        settings.externalCompressor = externalCompressor;
+        settings.streamingWindow = streamingWindow;
+        settings.blockCache = blockCache;
+        settings.supercompression = supercompression;
+
+        return runServer(context, settings, serverJobs > 0 ? serverJobs : nv::hardwareThreadCount());
+    }
+
+	// Automatically use dds10 if compressing to BC6 or BC7
+	if (format == nvtt::Format_BC6 || format == nvtt::Format_BC7)
+	{
+		dds10 = true;
+	}
+
+    if (ktx)
+    {
+        outputOptions.setContainer(nvtt::Container_KTX);
+    }
+    else if (dds10)
+    {
+        outputOptions.setContainer(nvtt::Container_DDS10);
+    }
+
+    if (!batch.isNull())
+    {
+        if (!previousInput.isNull())
+        {
+            printf("Warning: -previous is ignored in batch mode\n");
+        }
+
+        BatchLoader loader;
+        loader.next = 0;
+        loader.loadAsFloat = loadAsFloat;
+        loader.flip = flip;
+        loader.ktx = ktx;
+        loader.supercompression = supercompression;
+
+        if (!collectBatch(batch.str(), &loader))
+        {
+            return EXIT_FAILURE;
+        }
+
+        const uint count = loader.items.count();
+
+        // The files are compressed one after the other, each one with all the threads. Meanwhile the loaders decode the
+        // next inputs, and the output of the previous file is still being written.
+        const uint loaderCount = nv::clamp(nv::hardwareThreadCount(), 1U, 4U);
+        const uint window = 2 * loaderCount;
+
+        for (uint i = 0; i < count && i < window; i++)
+        {
+            loader.items[i]->canLoad.post();
+        }
+
+        nv::Thread * loaders = new nv::Thread[loaderCount];
+        for (uint i = 0; i < loaderCount; i++)
+        {
+            loaders[i].start(batchLoaderThread, &loader);
+        }
+
+        nv::Timer timer;
+        timer.start();
+
+        nv::AutoPtr<MyOutputHandler> previousHandler;
+        uint failures = 0;
+
+        for (uint i = 0; i < count; i++)
+        {
+            BatchItem * item = loader.items[i];
+            item->ready.wait();
+
+            bool success = false;
+            if (item->loaded)
+            {
+                setInputSettings(item->inputOptions, wrapRepeat, alpha, powerOfTwo, normal, color2normal, noMipmaps, mipmapFilter);
+
+                MyOutputHandler * outputHandler = new MyOutputHandler(item->output.str(), /*async=*/true, unbufferedOutput);
+                if (outputHandler->stream->isError())
+                {
+                    fprintf(stderr, "Error opening '%s' for writting\n", item->output.str());
+                    delete outputHandler;
+                }
+                else
+                {
+                    outputHandler->setTotal(context.estimateSize(item->inputOptions, compressionOptions));
+                    outputHandler->setDisplayProgress(false);
+
+                    outputOptions.setOutputHandler(outputHandler);
+                    success = context.process(item->inputOptions, compressionOptions, outputOptions);
+                    outputOptions.setOutputHandler(NULL);
+
+                    // Wait for the previous file to be written and close it.
+                    previousHandler = outputHandler;
+                }
+            }
+
+            if (success)
+            {
+                if (!silent) printf("[%u/%u] %s\n", i + 1, count, item->output.str());
+            }
+            else
+            {
+                fprintf(stderr, "Failed to compress '%s'\n", item->input.str());
+                failures++;
+            }
+
+            // Release the input and let the loaders read one more file.
+            item->inputOptions.resetTextureLayout();
+            if (i + window < count)
+            {
+                loader.items[i + window]->canLoad.post();
+            }
+        }
+
+        previousHandler = NULL;
+        timer.stop();
+
+        nv::Thread::wait(loaders, loaderCount);
+        delete [] loaders;
+
+        for (uint i = 0; i < count; i++)
+        {
+            delete loader.items[i];
+        }
+
+        if (!silent)
+        {
+            printf("%u files, %u failed, time taken: %.3f seconds\n", count, failures, timer.elapsed());
+        }
+
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (transcode)
+    {
+        if (!isDdsFile(input))
+        {
+            fprintf(stderr, "-transcode requires a DDS input\n");
+            return EXIT_FAILURE;
+        }
+
+        MyOutputHandler outputHandler(output.str(), asyncOutput, unbufferedOutput);
+        if (outputHandler.stream->isError())
+        {
+            fprintf(stderr, "Error opening '%s' for writting\n", output.str());
+            return EXIT_FAILURE;
+        }
+
+        // The size of the output is not known in advance.
+        outputHandler.setTotal(0);
+        outputHandler.setDisplayProgress(false);
+        outputOptions.setOutputHandler(&outputHandler);
+
+        nv::Timer timer;
+        timer.start();
+
+        if (!context.transcode(input.str(), compressionOptions, outputOptions))
+        {
+            return EXIT_FAILURE;
+        }
+
+        timer.stop();
+
+        if (!silent) printf("time taken: %.3f seconds\n", timer.elapsed());
+
+        return EXIT_SUCCESS;
+    }
+
+    // Set input options.
+    nvtt::InputOptions inputOptions;
+
+    if (!loadInput(input, loadAsFloat, flip, inputOptions))
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Only the images of the previous input are used, the settings below apply to both.
+    nvtt::InputOptions previousInputOptions;
+
+    if (!previousInput.isNull() && !loadInput(previousInput, loadAsFloat, flip, previousInputOptions))
+    {
+        return EXIT_FAILURE;
+    }
+
+    setInputSettings(inputOptions, wrapRepeat, alpha, powerOfTwo, normal, color2normal, noMipmaps, mipmapFilter);
+
+    // The previous output is read while compressing, move it out of the way if it's going to be overwritten.
+    nv::Path previousOutputCopy;
+    if (!previousInput.isNull() && nv::strEqual(previousOutput.str(), output.str()))
+    {
+        previousOutputCopy.format("%s.previous", output.str());
+        if (rename(output.str(), previousOutputCopy.str()) != 0)
+        {
+            fprintf(stderr, "Error renaming '%s'\n", output.str());
+            return EXIT_FAILURE;
+        }
+        previousOutput = previousOutputCopy;
+    }
+
+    MyOutputHandler outputHandler(output.str(), asyncOutput, unbufferedOutput);
+    if (outputHandler.stream->isError())
+    {
+        fprintf(stderr, "Error opening '%s' for writting\n", output.str());
+        return EXIT_FAILURE;
+    }
+
+    outputHandler.setTotal(context.estimateSize(inputOptions, compressionOptions));
+    outputHandler.setDisplayProgress(!silent);
+
+    outputOptions.setOutputHandler(&outputHandler);
+
+    nvtt::BlockStatistics statistics = {};
+    if (!previousInput.isNull())
+    {
+        outputOptions.setBlockStatistics(&statistics);
+    }
+
+    // printf("Press ENTER.\n");
+    // fflush(stdout);
+    // getchar();
+
+    nv::Timer timer;
+    timer.start();
+
+    bool success;
+    if (previousInput.isNull())
+    {
+        success = context.process(inputOptions, compressionOptions, outputOptions);
+    }
+    else
+    {
+        success = context.process(inputOptions, compressionOptions, outputOptions, previousInputOptions, previousOutput.str());
+    }
+
+    if (!success)
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (!previousOutputCopy.isNull())
+    {
+        nv::FileSystem::removeFile(previousOutputCopy.str());
+    }
+    timer.stop();
+
+    if (!silent) {
+        printf("\rtime taken: %.3f seconds\n", timer.elapsed());
+
+        if (!previousInput.isNull()) {
+            const uint blockCount = statistics.constantBlocks + statistics.transparentBlocks + statistics.twoColorBlocks + statistics.generalBlocks;
+            printf("reused %u of %u blocks\n", statistics.reusedBlocks, blockCount);
+        }
     }
 
     return EXIT_SUCCESS;
@@ -23,35 +23,128 @@
 
 #include <nvcore/StrLib.h>
 #include <nvcore/StdStream.h>
+#include <nvcore/FileSystem.h>
+#include <nvcore/Array.inl>
 
 #include <nvimage/Image.h>
 #include <nvimage/DirectDrawSurface.h>
+#include <nvimage/Supercompression.h>
+
+#include <nvthread/TaskScheduler.h>
 
 #include "cmdline.h"
 
 
+struct ScanContext
+{
+	nv::Array<nv::Path> fileNames;
+	nv::DirectDrawSurface * surfaces;
+};
+
+static void collectDDSFile(const char * path, void * arg)
+{
+	ScanContext * context = (ScanContext *)arg;
+	if (nv::strCaseEqual(nv::Path::extension(path), ".dds") || nv::strCaseEqual(nv::Path::extension(path), ".ddsz"))
+	{
+		context->fileNames.append(nv::Path(path));
+	}
+}
+
+static void probeTask(void * arg, int i)
+{
+	ScanContext * context = (ScanContext *)arg;
+	context->surfaces[i].loadHeader(context->fileNames[i].str());
+}
+
+// Print a summary of all the DDS files in a directory, or that match a pattern. Only the headers are read, from several threads.
+static int scan(const char * location)
+{
+	ScanContext context;
+
+	if (strchr(location, '*') != NULL || strchr(location, '?') != NULL)
+	{
+		nv::FileSystem::findFiles(location, collectDDSFile, &context);
+	}
+	else
+	{
+		nv::FileSystem::findFilesRecursive(location, collectDDSFile, &context);
+	}
+
+	const uint count = context.fileNames.count();
+	context.surfaces = new nv::DirectDrawSurface[count];
+
+	nv::TaskScheduler::global()->parallelFor(probeTask, &context, count);
+
+	uint invalidCount = 0;
+	for (uint i = 0; i < count; i++)
+	{
+		printf("%s: ", context.fileNames[i].str());
+
+		if (context.surfaces[i].isValid())
+		{
+			context.surfaces[i].printSummary();
+			printf("\n");
+		}
+		else
+		{
+			printf("not a valid DDS file\n");
+			invalidCount++;
+		}
+	}
+
+	printf("%u files, %u invalid.\n", count, invalidCount);
+
+	delete [] context.surfaces;
+
+	return invalidCount == 0 ? 0 : 1;
+}
+
+
 int main(int argc, char *argv[])
 {
 	MyAssertHandler assertHandler;
 	MyMessageHandler messageHandler;
 
+	if (argc == 3 && strcmp(argv[1], "-scan") == 0)
+	{
+		return scan(argv[2]);
+	}
+
 	if (argc != 2)
 	{
 		printf("NVIDIA Texture Tools - Copyright NVIDIA Corporation 2007\n\n");
-		printf("usage: nvddsinfo ddsfile\n\n");
+		printf("usage: nvddsinfo ddsfile\n");
+		printf("       nvddsinfo -scan <directory or pattern>\n\n");
 		return 1;
 	}
 
-	// Load surface.
-	nv::DirectDrawSurface dds(argv[1]);
-	if (!dds.isValid())
+	// Only the header is needed.
+	nv::DirectDrawSurface dds;
+	if (!dds.loadHeader(argv[1]) || !dds.isValid())
 	{
 		printf("The file '%s' is not a valid DDS file.\n", argv[1]);
 		return 1;
 	}
 	
+	// The sizes of supercompressed surfaces are stored with them, the whole file is needed for their offsets.
+	if (dds.header.supercompression() != nv::Supercompression_None && !dds.load(argv[1]))
+	{
+		printf("Error reading '%s'.\n", argv[1]);
+		return 1;
+	}
+
 	dds.printInfo();
 
+	printf("Surfaces:\n");
+	const uint faceCount = (dds.isTextureCube() ? 6 : 1) * dds.arrayCount();
+	for (uint f = 0; f < faceCount; f++)
+	{
+		for (uint m = 0; m < dds.mipmapCount(); m++)
+		{
+			printf("\tFace %u, mipmap %u: %ux%u, offset %llu, size %u\n", f, m, dds.surfaceWidth(m), dds.surfaceHeight(m),
+				(unsigned long long)dds.offset(f, m), dds.surfaceSize(m));
+		}
+	}
+
 	return 0;
 }
-
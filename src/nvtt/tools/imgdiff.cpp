@@ -29,37 +29,67 @@
 #include "nvimage/Image.h"
 #include "nvimage/DirectDrawSurface.h"
 
+#include "nvthread/TaskScheduler.h"
+
+#include "nvcore/Array.inl"
+#include "nvcore/FileSystem.h"
+#include "nvcore/Memory.h" // NV_ALIGN_16
 #include "nvcore/StrLib.h"
 #include "nvcore/StdStream.h"
 
 #include <math.h>
 
+#if NV_USE_SSE > 1
+#include <emmintrin.h>
+#endif
+
 
-static bool loadImage(nv::Image & image, const char * fileName)
+// One of the two inputs of a comparison. DDS files are compared face by face and mipmap by mipmap, the block surfaces are
+// decoded straight from the mapped file.
+struct Input
 {
-	if (nv::strCaseDiff(nv::Path::extension(fileName), ".dds") == 0)
+	Input() : isDDS(false), faceCount(1), mipmapCount(1) {}
+
+	bool load(const char * fileName)
 	{
-		nv::DirectDrawSurface dds(fileName);
-		if (!dds.isValid())
+		if (nv::strCaseDiff(nv::Path::extension(fileName), ".dds") == 0 || nv::strCaseDiff(nv::Path::extension(fileName), ".ddsz") == 0)
 		{
-			printf("The file '%s' is not a valid DDS file.\n", fileName);
-			return false;
+			if (!dds.load(fileName) || !dds.isValid())
+			{
+				fprintf(stderr, "The file '%s' is not a valid DDS file.\n", fileName);
+				return false;
+			}
+
+			isDDS = true;
+			faceCount = (dds.isTextureCube() ? 6 : 1) * dds.arrayCount();
+			mipmapCount = dds.mipmapCount();
 		}
-		
-		dds.mipmap(&image, 0, 0); // get first image
-	}
-	else
-	{
-		// Regular image.
-		if (!image.load(fileName))
+		else
 		{
-			printf("The file '%s' is not a supported image type.\n", fileName);
-			return false;
+			// Regular image.
+			if (!image.load(fileName))
+			{
+				fprintf(stderr, "The file '%s' is not a supported image type.\n", fileName);
+				return false;
+			}
 		}
+
+		return true;
 	}
 
-	return true;
-}
+	// Only valid until the next call.
+	const nv::Image & surface(uint face, uint mipmap)
+	{
+		if (isDDS) dds.mipmap(&image, face, mipmap);
+		return image;
+	}
+
+	nv::DirectDrawSurface dds;
+	nv::Image image;
+	bool isDDS;
+	uint faceCount;
+	uint mipmapCount;
+};
 
 struct Error
 {
@@ -71,7 +101,6 @@ struct Error
 		mse = 0.0f;
 	}
 
-    // @@ This has poor precision...
 	void addSample(double e)
 	{
 		samples++;
@@ -80,10 +109,22 @@ struct Error
 		mse += e * e;
 	}
 
+	// Merge the samples of another error, before calling done.
+	void add(const Error & e)
+	{
+		samples += e.samples;
+		mabse += e.mabse;
+		maxabse = nv::max(maxabse, e.maxabse);
+		mse += e.mse;
+	}
+
 	void done()
 	{
-		mabse /= samples;
-		mse /= samples;
+		if (samples)
+		{
+			mabse /= samples;
+			mse /= samples;
+		}
 		rmse = sqrt(mse);
 		psnr = (rmse == 0) ? 999.0 : 20.0 * log10(255.0 / rmse);
 	}
@@ -110,8 +151,10 @@ struct NormalError
 	NormalError()
 	{
 		samples = 0;
-		ade = 0.0f;
-		mse = 0.0f;
+		ade = 0.0;
+		mse = 0.0;
+		rmse = 0.0;
+		psnr = 999.0;
 	}
 
 	void addSample(nv::Color32 o, nv::Color32 c)
@@ -129,14 +172,22 @@ struct NormalError
 		samples++;
 	}
 
+	// Merge the samples of another error, before calling done.
+	void add(const NormalError & e)
+	{
+		samples += e.samples;
+		ade += e.ade;
+		mse += e.mse;
+	}
+
 	void done()
 	{
 		if (samples)
 		{
 			ade /= samples;
 			mse /= samples * 3;
-			rmse = sqrtf(mse);
-			psnr = (rmse == 0) ? 999.0f : 20.0f * log10(255.0f / rmse);
+			rmse = sqrt(mse);
+			psnr = (rmse == 0) ? 999.0 : 20.0 * log10(255.0 / rmse);
 		}
 	}
 
@@ -148,10 +199,10 @@ struct NormalError
 	}
 
 	int samples;
-	float ade;
-	float mse;
-	float rmse;
-	float psnr;
+	double ade;
+	double mse;
+	double rmse;
+	double psnr;
 };
 
 static float luma(const nv::Color32 & c) {
@@ -161,30 +212,513 @@ static float luma(const nv::Color32 & c) {
     //return 0.1f * float(c.r) + 0.8f * float(c.g) + 0.1f * float(c.g);
 }
 
+// Errors of a row of texels, or of a whole surface.
+struct SurfaceError
+{
+	void add(const SurfaceError & e)
+	{
+		color.add(e.color);
+		luma.add(e.luma);
+		alpha.add(e.alpha);
+		normal.add(e.normal);
+	}
+
+	void done()
+	{
+		color.done();
+		luma.done();
+		alpha.done();
+		normal.done();
+	}
+
+	Error color;    // Distance between the RGB colors, alpha weighted with -alpha.
+	Error luma;
+	Error alpha;
+	NormalError normal; // Only with -normal.
+};
+
+#if NV_USE_SSE > 1
+
+static NV_FORCEINLINE __m128d lowHalf(__m128 v) { return _mm_cvtps_pd(v); }
+static NV_FORCEINLINE __m128d highHalf(__m128 v) { return _mm_cvtps_pd(_mm_movehl_ps(v, v)); }
+
+// Add the absolute values and squares of the 2 errors in e to the sums.
+static NV_FORCEINLINE void addErrors(__m128d e, __m128d & sumAbs, __m128d & sumSquares, __m128d & maxAbs)
+{
+	const __m128d a = _mm_andnot_pd(_mm_set1_pd(-0.0), e);
+	maxAbs = _mm_max_pd(maxAbs, a);
+	sumAbs = _mm_add_pd(sumAbs, a);
+	sumSquares = _mm_add_pd(sumSquares, _mm_mul_pd(a, a));
+}
+
+static NV_FORCEINLINE void addSums(Error & error, int samples, __m128d sumAbs, __m128d sumSquares, __m128d maxAbs)
+{
+	NV_ALIGN_16 double abs[2];
+	NV_ALIGN_16 double squares[2];
+	NV_ALIGN_16 double max[2];
+	_mm_store_pd(abs, sumAbs);
+	_mm_store_pd(squares, sumSquares);
+	_mm_store_pd(max, maxAbs);
+
+	error.samples += samples;
+	error.mabse += abs[0] + abs[1];
+	error.mse += squares[0] + squares[1];
+	error.maxabse = nv::max(error.maxabse, nv::max(max[0], max[1]));
+}
+
+#endif // NV_USE_SSE > 1
+
+// Add the errors of w texels of two rows.
+static void addRowErrors(const nv::Color32 * row0, const nv::Color32 * row1, uint w, bool compareAlpha, bool compareNormal, SurfaceError * error)
+{
+	uint x = 0;
+
+#if NV_USE_SSE > 1
+	// Four texels at a time. The channel differences and lumas are exact in single precision, like in the scalar loop
+	// below, the rest is computed in double precision.
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const __m128 kr = _mm_set1_ps(0.299f);
+	const __m128 kg = _mm_set1_ps(0.587f);
+	const __m128 kb = _mm_set1_ps(0.114f);
+	const __m128d alphaScale = _mm_set1_pd(255.0);
+
+	__m128d colorAbs = _mm_setzero_pd(), colorSquares = _mm_setzero_pd(), colorMax = _mm_setzero_pd();
+	__m128d lumaAbs = _mm_setzero_pd(), lumaSquares = _mm_setzero_pd(), lumaMax = _mm_setzero_pd();
+	__m128d alphaAbs = _mm_setzero_pd(), alphaSquares = _mm_setzero_pd(), alphaMax = _mm_setzero_pd();
+
+	for (; x + 4 <= w; x += 4)
+	{
+		const __m128i c0 = _mm_loadu_si128((const __m128i *)(row0 + x));
+		const __m128i c1 = _mm_loadu_si128((const __m128i *)(row1 + x));
+
+		const __m128 b0 = _mm_cvtepi32_ps(_mm_and_si128(c0, mask));
+		const __m128 g0 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c0, 8), mask));
+		const __m128 r0 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c0, 16), mask));
+		const __m128 a0 = _mm_cvtepi32_ps(_mm_srli_epi32(c0, 24));
+		const __m128 b1 = _mm_cvtepi32_ps(_mm_and_si128(c1, mask));
+		const __m128 g1 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c1, 8), mask));
+		const __m128 r1 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c1, 16), mask));
+		const __m128 a1 = _mm_cvtepi32_ps(_mm_srli_epi32(c1, 24));
+
+		const __m128 dr = _mm_sub_ps(r0, r1);
+		const __m128 dg = _mm_sub_ps(g0, g1);
+		const __m128 db = _mm_sub_ps(b0, b1);
+
+		const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+		__m128d dlo = _mm_sqrt_pd(lowHalf(d2));
+		__m128d dhi = _mm_sqrt_pd(highHalf(d2));
+		if (compareAlpha) {
+			dlo = _mm_mul_pd(dlo, _mm_div_pd(lowHalf(a0), alphaScale));
+			dhi = _mm_mul_pd(dhi, _mm_div_pd(highHalf(a0), alphaScale));
+		}
+		addErrors(dlo, colorAbs, colorSquares, colorMax);
+		addErrors(dhi, colorAbs, colorSquares, colorMax);
+
+		const __m128 l0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(kr, r0), _mm_mul_ps(kg, g0)), _mm_mul_ps(kb, b0));
+		const __m128 l1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(kr, r1), _mm_mul_ps(kg, g1)), _mm_mul_ps(kb, b1));
+		addErrors(_mm_sub_pd(lowHalf(l0), lowHalf(l1)), lumaAbs, lumaSquares, lumaMax);
+		addErrors(_mm_sub_pd(highHalf(l0), highHalf(l1)), lumaAbs, lumaSquares, lumaMax);
+
+		const __m128 da = _mm_sub_ps(a0, a1);
+		addErrors(lowHalf(da), alphaAbs, alphaSquares, alphaMax);
+		addErrors(highHalf(da), alphaAbs, alphaSquares, alphaMax);
+	}
+
+	addSums(error->color, x, colorAbs, colorSquares, colorMax);
+	addSums(error->luma, x, lumaAbs, lumaSquares, lumaMax);
+	addSums(error->alpha, x, alphaAbs, alphaSquares, alphaMax);
+#endif
+
+	for (; x < w; x++)
+	{
+		const nv::Color32 c0(row0[x]);
+		const nv::Color32 c1(row1[x]);
+
+		double r = float(c0.r - c1.r);
+		double g = float(c0.g - c1.g);
+		double b = float(c0.b - c1.b);
+		double a = float(c0.a - c1.a);
+
+		double d = sqrt(r*r + g*g + b*b);
+
+		if (compareAlpha) {
+			d *= c0.a / 255.0;
+		}
+
+		error->color.addSample(d);
+		error->luma.addSample(double(luma(c0)) - double(luma(c1)));
+		error->alpha.addSample(a);
+	}
+
+	if (compareNormal) {
+		for (x = 0; x < w; x++) {
+			error->normal.addSample(row0[x], row1[x]);
+		}
+	}
+}
+
+struct DiffContext
+{
+	const nv::Image * image0;
+	const nv::Image * image1;
+	uint w;
+	bool compareAlpha;
+	bool compareNormal;
+	SurfaceError * rows;
+};
+
+static void DiffRowTask(void * context, int y)
+{
+	DiffContext * ctx = (DiffContext *)context;
+
+	const nv::Color32 * row0 = ctx->image0->pixels() + y * ctx->image0->width();
+	const nv::Color32 * row1 = ctx->image1->pixels() + y * ctx->image1->width();
+
+	addRowErrors(row0, row1, ctx->w, ctx->compareAlpha, ctx->compareNormal, ctx->rows + y);
+}
+
+// Compare the overlap of the first slice of two images, rows in parallel. The rows are added in order, so that the errors
+// don't depend on the number of threads.
+static void compareImages(const nv::Image & image0, const nv::Image & image1, bool compareAlpha, bool compareNormal, SurfaceError * error)
+{
+	const uint w = nv::min(image0.width(), image1.width());
+	const uint h = nv::min(image0.height(), image1.height());
+
+	nv::Array<SurfaceError> rows;
+	rows.resize(h);
+
+	DiffContext context;
+	context.image0 = &image0;
+	context.image1 = &image1;
+	context.w = w;
+	context.compareAlpha = compareAlpha;
+	context.compareNormal = compareNormal;
+	context.rows = rows.buffer();
+
+	nv::TaskScheduler::global()->parallelFor(DiffRowTask, &context, h);
+
+	for (uint y = 0; y < h; y++)
+	{
+		error->add(rows[y]);
+	}
+	error->done();
+}
+
+// Errors of a face and mipmap of a comparison.
+struct SurfaceResult
+{
+	uint face;
+	uint mipmap;
+	uint w0, h0;
+	uint w1, h1;
+	SurfaceError error;
+};
+
+// A pair of files to compare and its results.
+struct Comparison
+{
+	nv::Path input0;
+	nv::Path input1;
+	bool success;
+	nv::Array<SurfaceResult *> surfaces;
+
+	~Comparison()
+	{
+		for (uint i = 0; i < surfaces.count(); i++) delete surfaces[i];
+	}
+};
+
+struct CompareOptions
+{
+	bool compareAlpha;
+	bool compareNormal;
+	bool allSurfaces;   // Every face and mipmap both DDS inputs have, instead of only the first one.
+};
+
+static bool compareFiles(Comparison * comparison, const CompareOptions & options)
+{
+	Input input0, input1;
+	if (!input0.load(comparison->input0.str()) || !input1.load(comparison->input1.str())) return false;
+
+	uint faceCount = 1;
+	uint mipmapCount = 1;
+	if (options.allSurfaces && input0.isDDS && input1.isDDS)
+	{
+		faceCount = nv::min(input0.faceCount, input1.faceCount);
+		mipmapCount = nv::min(input0.mipmapCount, input1.mipmapCount);
+	}
+
+	for (uint f = 0; f < faceCount; f++)
+	{
+		for (uint m = 0; m < mipmapCount; m++)
+		{
+			const nv::Image & image0 = input0.surface(f, m);
+			const nv::Image & image1 = input1.surface(f, m);
+
+			SurfaceResult * result = new SurfaceResult;
+			result->face = f;
+			result->mipmap = m;
+			result->w0 = image0.width();
+			result->h0 = image0.height();
+			result->w1 = image1.width();
+			result->h1 = image1.height();
+
+			compareImages(image0, image1, options.compareAlpha, options.compareNormal, &result->error);
+
+			comparison->surfaces.append(result);
+		}
+	}
+
+	return true;
+}
+
+struct BatchContext
+{
+	Comparison * const * comparisons;
+	const CompareOptions * options;
+};
+
+static void CompareTask(void * context, int i)
+{
+	BatchContext * ctx = (BatchContext *)context;
+	Comparison * comparison = ctx->comparisons[i];
+	comparison->success = compareFiles(comparison, *ctx->options);
+}
+
+
+enum OutputFormat
+{
+	OutputFormat_Text,
+	OutputFormat_CSV,
+	OutputFormat_JSON,
+};
+
+static void printTextResult(const SurfaceResult & result, const CompareOptions & options)
+{
+	const uint w = nv::min(result.w0, result.w1);
+	const uint h = nv::min(result.h0, result.h1);
+
+	printf("Image size compared: %dx%d\n", w, h);
+	if (w != result.w0 || w != result.w1 || h != result.h0 || h != result.h1) {
+		printf("--- NOTE: only the overlap between the 2 images (%d,%d) and (%d,%d) was compared\n", result.w0, result.h0, result.w1, result.h1);
+	}
+	printf("Total pixels: %d\n", w*h);
+
+	SurfaceError error = result.error;
+
+	printf("Color:\n");
+	error.color.print();
+
+	printf("Luma:\n");
+	error.luma.print();
+
+	if (options.compareNormal)
+	{
+		printf("Normal:\n");
+		error.normal.print();
+	}
+
+	if (options.compareAlpha)
+	{
+		printf("Alpha:\n");
+		error.alpha.print();
+	}
+}
+
+// Quote a file name as a CSV field.
+static void printCsvString(const char * str)
+{
+	putchar('"');
+	for (const char * c = str; *c != '\0'; c++)
+	{
+		if (*c == '"') putchar('"');
+		putchar(*c);
+	}
+	putchar('"');
+}
+
+static void printJsonString(const char * str)
+{
+	putchar('"');
+	for (const char * c = str; *c != '\0'; c++)
+	{
+		if (*c == '"' || *c == '\\') putchar('\\');
+		if (uint8(*c) < 0x20) printf("\\u%04x", uint8(*c));
+		else putchar(*c);
+	}
+	putchar('"');
+}
+
+static void printCsvHeader()
+{
+	printf("original,updated,face,mipmap,width,height,"
+		"color_mae,color_max,color_rmse,color_psnr,luma_mae,luma_max,luma_rmse,luma_psnr,"
+		"alpha_mae,alpha_max,alpha_rmse,alpha_psnr,normal_ade,normal_rmse,normal_psnr\n");
+}
+
+static void printCsvResult(const Comparison & comparison, const SurfaceResult & result, const CompareOptions & options)
+{
+	const SurfaceError & e = result.error;
+
+	printCsvString(comparison.input0.str());
+	putchar(',');
+	printCsvString(comparison.input1.str());
+	printf(",%u,%u,%u,%u", result.face, result.mipmap, nv::min(result.w0, result.w1), nv::min(result.h0, result.h1));
+	printf(",%f,%f,%f,%f", e.color.mabse, e.color.maxabse, e.color.rmse, e.color.psnr);
+	printf(",%f,%f,%f,%f", e.luma.mabse, e.luma.maxabse, e.luma.rmse, e.luma.psnr);
+	printf(",%f,%f,%f,%f", e.alpha.mabse, e.alpha.maxabse, e.alpha.rmse, e.alpha.psnr);
+	if (options.compareNormal) printf(",%f,%f,%f\n", e.normal.ade, e.normal.rmse, e.normal.psnr);
+	else printf(",,,\n");
+}
+
+static void printJsonError(const char * name, const Error & e)
+{
+	printf(", \"%s\": {\"mae\": %f, \"max\": %f, \"rmse\": %f, \"psnr\": %f}", name, e.mabse, e.maxabse, e.rmse, e.psnr);
+}
+
+static void printJsonResult(const Comparison & comparison, const SurfaceResult & result, const CompareOptions & options)
+{
+	const SurfaceError & e = result.error;
+
+	printf("  {\"original\": ");
+	printJsonString(comparison.input0.str());
+	printf(", \"updated\": ");
+	printJsonString(comparison.input1.str());
+	printf(", \"face\": %u, \"mipmap\": %u, \"width\": %u, \"height\": %u", result.face, result.mipmap, nv::min(result.w0, result.w1), nv::min(result.h0, result.h1));
+	printJsonError("color", e.color);
+	printJsonError("luma", e.luma);
+	printJsonError("alpha", e.alpha);
+	if (options.compareNormal) {
+		printf(", \"normal\": {\"ade\": %f, \"rmse\": %f, \"psnr\": %f}", e.normal.ade, e.normal.rmse, e.normal.psnr);
+	}
+	printf("}");
+}
+
+
+// A batch is a manifest with an original and an updated file name per line, separated by a tab, or two directories, where
+// every file of the first one is compared with the file of the same relative path in the second one. Empty lines and lines
+// that start with '#' are skipped.
+struct BatchCollector
+{
+	nv::Array<Comparison *> * comparisons;
+	const char * directory0;
+	const char * directory1;
+};
+
+static void addComparison(nv::Array<Comparison *> & comparisons, const char * input0, const char * input1)
+{
+	Comparison * comparison = new Comparison;
+	comparison->input0 = input0;
+	comparison->input1 = input1;
+	comparison->success = false;
+	comparisons.append(comparison);
+}
+
+static void addDirectoryFile(const char * path, void * arg)
+{
+	BatchCollector * collector = (BatchCollector *)arg;
+
+	nv::Path updated(collector->directory1);
+	updated.append(path + strlen(collector->directory0));
+
+	addComparison(*collector->comparisons, path, updated.str());
+}
+
+static bool collectBatch(const char * batch, const char * directory, nv::Array<Comparison *> & comparisons)
+{
+	if (directory != NULL)
+	{
+		BatchCollector collector;
+		collector.comparisons = &comparisons;
+		collector.directory0 = batch;
+		collector.directory1 = directory;
+
+		nv::FileSystem::findFilesRecursive(batch, addDirectoryFile, &collector);
+		return true;
+	}
+
+	FILE * fp = nv::fileOpen(batch, "rb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Error opening manifest '%s'\n", batch);
+		return false;
+	}
+
+	char line[4096];
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#') continue;
+
+		char * tab = strchr(line, '\t');
+		if (tab == NULL || tab[1] == '\0')
+		{
+			fprintf(stderr, "Warning: skipping manifest line without an updated file: '%s'\n", line);
+			continue;
+		}
+		*tab = '\0';
+
+		addComparison(comparisons, line, tab + 1);
+	}
+
+	fclose(fp);
+	return true;
+}
+
+// Files compared at once. Their results are printed in order before moving to the next ones.
+static const uint kBatchWindow = 64;
+
 
 int main(int argc, char *argv[])
 {
 	MyAssertHandler assertHandler;
 	MyMessageHandler messageHandler;
 
-	bool compareNormal = false;
-	bool compareAlpha = false;
+	CompareOptions options;
+	options.compareNormal = false;
+	options.compareAlpha = false;
+	options.allSurfaces = false;
+
+	OutputFormat outputFormat = OutputFormat_Text;
 
 	nv::Path input0;
 	nv::Path input1;
 	nv::Path output;
 
+	nv::Path batch;
+	nv::Path batchDirectory;
+
 	// Parse arguments.
 	for (int i = 1; i < argc; i++)
 	{
 		// Input options.
 		if (strcmp("-normal", argv[i]) == 0)
 		{
-			compareNormal = true;
+			options.compareNormal = true;
 		}
 		else if (strcmp("-alpha", argv[i]) == 0)
 		{
-			compareAlpha = true;
+			options.compareAlpha = true;
+		}
+		else if (strcmp("-csv", argv[i]) == 0)
+		{
+			outputFormat = OutputFormat_CSV;
+		}
+		else if (strcmp("-json", argv[i]) == 0)
+		{
+			outputFormat = OutputFormat_JSON;
+		}
+		else if (strcmp("-batch", argv[i]) == 0)
+		{
+			if (i+1 < argc && argv[i+1][0] != '-') {
+				batch = argv[i+1];
+				i++;
+
+				if (i+1 < argc && argv[i+1][0] != '-') {
+					batchDirectory = argv[i+1];
+					i++;
+				}
+			}
 		}
 		else if (argv[i][0] != '-')
 		{
@@ -202,110 +736,132 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	if (input0.isNull() || input1.isNull())
+	if ((input0.isNull() || input1.isNull()) && batch.isNull())
 	{
 		printf("NVIDIA Texture Tools - Copyright NVIDIA Corporation 2007\n\n");
 		
-		printf("usage: nvimgdiff [options] original_file updated_file [output]\n\n");
+		printf("usage: nvimgdiff [options] original_file updated_file [output]\n");
+		printf("       nvimgdiff [options] -batch <manifest | original_dir updated_dir>\n\n");
 		
 		printf("Diff options:\n");
 		printf("  -normal \tCompare images as if they were normal maps.\n");
 		printf("  -alpha  \tCompare alpha weighted images.\n");
+		printf("  -batch <manifest>\tCompare the files of a manifest, with an original and an updated file per line separated by a tab.\n");
+		printf("  -batch <original_dir> <updated_dir>\tCompare every file of a directory with the file of the same name in another.\n\n");
+
+		printf("Output options:\n");
+		printf("  -csv    \tPrint a line of comma separated errors per file, face and mipmap. The default in batch mode.\n");
+		printf("  -json   \tPrint the errors of each file, face and mipmap as JSON.\n");
 
 		return 1;
 	}
 
-	nv::Image image0, image1;
-	if (!loadImage(image0, input0.str())) return 0;
-	if (!loadImage(image1, input1.str())) return 0;
-
-	const uint w0 = image0.width();
-	const uint h0 = image0.height();
-	const uint w1 = image1.width();
-	const uint h1 = image1.height();
-	const uint w = nv::min(w0, w1);
-	const uint h = nv::min(h0, h1);
+	if (!batch.isNull() && outputFormat == OutputFormat_Text)
+	{
+		outputFormat = OutputFormat_CSV;
+	}
 
-	// Compute errors.
-	Error error_r;
-	Error error_g;
-	Error error_b;
-	Error error_a;
-    Error error_luma;
-	Error error_total;
-	NormalError error_normal;
+	// The text output only reports the first face and mipmap, like before.
+	options.allSurfaces = (outputFormat != OutputFormat_Text);
 
-	for (uint i = 0; i < h; i++)
+	nv::Array<Comparison *> comparisons;
+	if (!batch.isNull())
 	{
-		for (uint e = 0; e < w; e++)
+		if (!collectBatch(batch.str(), batchDirectory.isNull() ? NULL : batchDirectory.str(), comparisons))
 		{
-			const nv::Color32 c0(image0.pixel(e, i));
-			const nv::Color32 c1(image1.pixel(e, i));
+			return 1;
+		}
+	}
+	else
+	{
+		addComparison(comparisons, input0.str(), input1.str());
+	}
 
-			double r = float(c0.r - c1.r);
-			double g = float(c0.g - c1.g);
-			double b = float(c0.b - c1.b);
-			double a = float(c0.a - c1.a);
+	const uint count = comparisons.count();
 
-			error_r.addSample(r);
-			error_g.addSample(g);
-			error_b.addSample(b);
-			error_a.addSample(a);
+	if (outputFormat == OutputFormat_CSV) printCsvHeader();
+	else if (outputFormat == OutputFormat_JSON) printf("[\n");
 
-            double l0 = luma(c0);
-            double l1 = luma(c1);
+	// Summary of the batch.
+	uint failures = 0;
+	uint surfaceCount = 0;
+	double colorRmseSum = 0.0;
+	double worstColorRmse = -1.0;
+	nv::Path worstInput;
+	uint worstMipmap = 0;
 
-            error_luma.addSample(l0 - l1);
+	bool first = true;
 
-            double d = sqrt(r*r + g*g + b*b);
+	for (uint begin = 0; begin < count; begin += kBatchWindow)
+	{
+		const uint end = nv::min(begin + kBatchWindow, count);
 
-			if (compareAlpha) {
-                d *= c0.a / 255.0;
-			}
+		// Files in parallel, and the rows of each surface in parallel too.
+		BatchContext context;
+		context.comparisons = comparisons.buffer() + begin;
+		context.options = &options;
+		nv::TaskScheduler::global()->parallelFor(CompareTask, &context, end - begin);
 
-            error_total.addSample(d);
+		for (uint i = begin; i < end; i++)
+		{
+			Comparison * comparison = comparisons[i];
 
-			if (compareNormal) {
-				error_normal.addSample(c0, c1);
+			if (!comparison->success)
+			{
+				fprintf(stderr, "Failed to compare '%s' and '%s'\n", comparison->input0.str(), comparison->input1.str());
+				failures++;
 			}
-		}
-	}
-
-	error_r.done();
-	error_g.done();
-	error_b.done();
-	error_a.done();
-    error_luma.done();
-	error_total.done();
-	error_normal.done();
-	
 
-	printf("Image size compared: %dx%d\n", w, h);
-	if (w != w0 || w != w1 || h != h0 || h != h1) {
-		printf("--- NOTE: only the overlap between the 2 images (%d,%d) and (%d,%d) was compared\n", w0, h0, w1, h1);
-	}
-	printf("Total pixels: %d\n", w*h);
-
-	printf("Color:\n");
-	error_total.print();
+			for (uint s = 0; s < comparison->surfaces.count(); s++)
+			{
+				const SurfaceResult & result = *comparison->surfaces[s];
+
+				if (outputFormat == OutputFormat_Text)
+				{
+					printTextResult(result, options);
+				}
+				else if (outputFormat == OutputFormat_CSV)
+				{
+					printCsvResult(*comparison, result, options);
+				}
+				else
+				{
+					if (!first) printf(",\n");
+					printJsonResult(*comparison, result, options);
+				}
+				first = false;
+
+				surfaceCount++;
+				colorRmseSum += result.error.color.rmse;
+				if (result.error.color.rmse > worstColorRmse)
+				{
+					worstColorRmse = result.error.color.rmse;
+					worstInput = comparison->input1;
+					worstMipmap = result.mipmap;
+				}
+			}
 
-	printf("Luma:\n");
-	error_luma.print();
+			// Release the results once printed.
+			delete comparison;
+			comparisons[i] = NULL;
+		}
 
-	if (compareNormal)
-	{
-		printf("Normal:\n");
-		error_normal.print();
+		fflush(stdout);
 	}
 
-	if (compareAlpha)
+	if (outputFormat == OutputFormat_JSON) printf("%s]\n", first ? "" : "\n");
+
+	if (!batch.isNull())
 	{
-		printf("Alpha:\n");
-		error_a.print();
+		fprintf(stderr, "Compared %u of %u files, %u surfaces\n", count - failures, count, surfaceCount);
+		if (surfaceCount != 0)
+		{
+			fprintf(stderr, "Color RMSE: mean %f, max %f in '%s' mipmap %u\n", colorRmseSum / surfaceCount, worstColorRmse, worstInput.str(), worstMipmap);
+		}
+		return failures == 0 ? 0 : 1;
 	}
 
 	// @@ Write image difference.
 	
 	return 0;
 }
-
@@ -35,11 +35,15 @@
 #include <nvmath/Color.h>
 #include <nvmath/Vector.h>
 
+#include <nvthread/TaskScheduler.h>
+
 #include <math.h>
 
 #include "cmdline.h"
 
-static bool loadImage(nv::Image & image, const char * fileName)
+// Load the image. DDS files only have their smallest mipmap that is at least size texels wide or high decoded, so that
+// large files are quick to thumbnail. The extents of the full image are returned.
+static bool loadImage(nv::Image & image, const char * fileName, uint size, uint * width, uint * height)
 {
     if (nv::strCaseDiff(nv::Path::extension(fileName), ".dds") == 0)
     {
@@ -50,7 +54,16 @@ static bool loadImage(nv::Image & image, const char * fileName)
             return false;
         }
 
-        dds.mipmap(&image, 0, 0); // get first image
+        uint mipmap = 0;
+        while (mipmap + 1 < dds.mipmapCount() && nv::max(dds.surfaceWidth(mipmap + 1), dds.surfaceHeight(mipmap + 1)) >= size)
+        {
+            mipmap++;
+        }
+
+        dds.mipmap(&image, 0, mipmap); // first face
+
+        *width = dds.width();
+        *height = dds.height();
     }
     else
     {
@@ -60,21 +73,88 @@ static bool loadImage(nv::Image & image, const char * fileName)
                 fprintf(stderr, "The file '%s' is not a supported image type.\n", fileName);
                 return false;
         }
+
+        *width = image.width();
+        *height = image.height();
     }
 
     return true;
 }
 
+static bool makeThumbnail(const char * input, const char * output, uint size, float gamma)
+{
+    nv::Image image;
+    uint width, height;
+    if (!loadImage(image, input, size, &width, &height)) return false;
+
+    nv::StringBuilder widthString;
+    widthString.number(width);
+    nv::StringBuilder heightString;
+    heightString.number(height);
+
+    nv::Array<const char *> metaData;
+    metaData.append("Thumb::Image::Width");
+    metaData.append(widthString.str());
+    metaData.append("Thumb::Image::Height");
+    metaData.append(heightString.str());
+    metaData.append(NULL);
+    metaData.append(NULL);
+
+    if ((image.width() > size) || (image.height() > size))
+    {
+        nv::FloatImage fimage(&image);
+        fimage.toLinear(0, 3, gamma);
+
+	uint thumbW, thumbH;
+	if (image.width() > image.height())
+	{
+	    thumbW = size;
+	    thumbH = uint ((float (image.height()) / float (image.width())) * size);
+	}
+	else
+	{
+	    thumbW = uint ((float (image.width()) / float (image.height())) * size);
+	    thumbH = size;
+	}
+	nv::AutoPtr<nv::FloatImage> fresult(fimage.resize(nv::BoxFilter(), thumbW, thumbH, nv::FloatImage::WrapMode_Clamp));
+
+	nv::AutoPtr<nv::Image> result(fresult->createImageGammaCorrect(gamma));
+	result->setFormat(nv::Image::Format_ARGB);
+
+        nv::StdOutputStream stream(output);
+        return nv::ImageIO::save(output, stream, result.ptr(), metaData.buffer());
+    }
+    else
+    {
+        nv::StdOutputStream stream(output);
+        return nv::ImageIO::save(output, stream, &image, metaData.buffer());
+    }
+}
+
+struct ThumbnailContext
+{
+    nv::Array<nv::Path> inputs;
+    nv::Array<nv::Path> outputs;
+    nv::Array<bool> results;
+    uint size;
+    float gamma;
+};
+
+static void thumbnailTask(void * arg, int i)
+{
+    ThumbnailContext * context = (ThumbnailContext *)arg;
+    context->results[i] = makeThumbnail(context->inputs[i].str(), context->outputs[i].str(), context->size, context->gamma);
+}
+
 
 int main(int argc, char *argv[])
 {
     //MyAssertHandler assertHandler;
     MyMessageHandler messageHandler;
 
-    float gamma = 2.2f;
-    nv::Path input;
-    nv::Path output;
-    uint size = 128;
+    ThumbnailContext context;
+    context.size = 128;
+    context.gamma = 2.2f;
 
     // Parse arguments.
     for (int i = 1; i < argc; i++)
@@ -83,31 +163,29 @@ int main(int argc, char *argv[])
         if (strcmp("-s", argv[i]) == 0)
         {
             if (i+1 < argc && argv[i+1][0] != '-') {
-                size = (uint)atoi(argv[i+1]);
+                context.size = (uint)atoi(argv[i+1]);
                 i++;
             }
         }
         else if (argv[i][0] != '-')
         {
-            input = argv[i];
-
             if (i+1 < argc && argv[i+1][0] != '-') {
-                output = argv[i+1];
+                context.inputs.append(nv::Path(argv[i]));
+                context.outputs.append(nv::Path(argv[i+1]));
+                i++;
             }
             else {
                 fprintf(stderr, "No output filename.\n");
                 return 1;
             }
-
-	    break;
 	}
     }
 
-    if (input.isNull() || output.isNull())
+    if (context.inputs.isEmpty())
     {
         printf("NVIDIA Texture Tools - Copyright NVIDIA Corporation 2007\n\n");
 
-        printf("usage: nv-gnome-thumbnailer [options] input output\n\n");
+        printf("usage: nv-gnome-thumbnailer [options] input output [input output ...]\n\n");
 
         printf("Options:\n");
         printf("  -s size\tThumbnail size (default = 128)\n");
@@ -115,52 +193,15 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    nv::Image image;
-    if (!loadImage(image, input.str())) return 1;
-
-    nv::StringBuilder widthString;
-    widthString.number(image.width());
-    nv::StringBuilder heightString;
-    heightString.number(image.height());
+    // Several files are thumbnailed in parallel.
+    const uint count = context.inputs.count();
+    context.results.resize(count);
+    nv::TaskScheduler::global()->parallelFor(thumbnailTask, &context, count);
 
-    nv::Array<const char *> metaData;
-    metaData.append("Thumb::Image::Width");
-    metaData.append(widthString.str());
-    metaData.append("Thumb::Image::Height");
-    metaData.append(heightString.str());
-    metaData.append(NULL);
-    metaData.append(NULL);
-
-    if ((image.width() > size) || (image.height() > size))
+    for (uint i = 0; i < count; i++)
     {
-        nv::FloatImage fimage(&image);
-        fimage.toLinear(0, 3, gamma);
-
-	uint thumbW, thumbH;
-	if (image.width() > image.height())
-	{
-	    thumbW = size;
-	    thumbH = uint ((float (image.height()) / float (image.width())) * size);
-	}
-	else
-	{
-	    thumbW = uint ((float (image.width()) / float (image.height())) * size);
-	    thumbH = size;
-	}
-	nv::AutoPtr<nv::FloatImage> fresult(fimage.resize(nv::BoxFilter(), thumbW, thumbH, nv::FloatImage::WrapMode_Clamp));
-
-	nv::AutoPtr<nv::Image> result(fresult->createImageGammaCorrect(gamma));
-	result->setFormat(nv::Image::Format_ARGB);
-
-        nv::StdOutputStream stream(output.str());
-        nv::ImageIO::save(output.str(), stream, result.ptr(), metaData.buffer());
+        if (!context.results[i]) return 1;
     }
-    else
-    {
-        nv::StdOutputStream stream(output.str());
-        nv::ImageIO::save(output.str(), stream, &image, metaData.buffer());
-    }
-	
+
     return 0;
 }
-